@@ -111,11 +111,14 @@ testScripts = [
     'listtransactions.py',
     'receivedby.py',
     'mempool_resurrect_test.py',
+    'mempool_persist.py',
     'txn_doublespend.py --mineblock',
     'txn_clone.py',
     'getchaintips.py',
     'rawtransactions.py',
     'rest.py',
+    'scriptindex.py',
+    'blockstats.py',
     'mempool_spendcoinbase.py',
     'mempool_reorg.py',
     #'mempool_limit.py',
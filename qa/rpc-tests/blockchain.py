@@ -28,6 +28,7 @@ class BlockchainTest(BitcoinTestFramework):
 
         - gettxoutsetinfo
         - verifychain
+        - getvalidationstats
 
     """
 
@@ -46,10 +47,11 @@ class BlockchainTest(BitcoinTestFramework):
         self._test_gettxoutsetinfo()
         self._test_getblockheader()
         self.nodes[0].verifychain(4, 0)
+        self._test_getvalidationstats()
 
     def _test_gettxoutsetinfo(self):
         node = self.nodes[0]
-        res = node.gettxoutsetinfo()
+        res = node.gettxoutsetinfo(True)
 
         assert_equal(res['total_amount'], Decimal('8725.00000000'))
         assert_equal(res['transactions'], 200)
@@ -59,6 +61,24 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(len(res['bestblock']), 64)
         assert_equal(len(res['hash_serialized']), 64)
 
+        # The statistics kept up to date block by block match the full scan.
+        fast = node.gettxoutsetinfo()
+        for key in ['height', 'bestblock', 'txouts', 'blinded_txouts', 'total_amount', 'locked_amount', 'hash_set']:
+            assert_equal(fast[key], res[key])
+        assert('hash_serialized' not in fast)
+
+    def _test_getvalidationstats(self):
+        node = self.nodes[0]
+        node.generate(1)
+        stats = node.getvalidationstats()
+
+        assert_equal(sorted(stats.keys()), sorted(['connect_block', 'utxo_fetch', 'script_check', 'rangeproof_check',
+                                                   'tally_check', 'withdraw_rpc', 'index_write', 'flush']))
+        assert(stats['connect_block']['count'] >= 1)
+        for stage in stats.values():
+            assert_equal(sum(bucket[1] for bucket in stage['histogram']), stage['count'])
+            assert(stage['p50_us'] <= stage['p99_us'])
+
     def _test_getblockheader(self):
         node = self.nodes[0]
 
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+# Copyright (c) 2016 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the block statistics index (-blockstatsindex) and getblockstats.
+#
+
+from decimal import Decimal
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import JSONRPCException
+from test_framework.util import (
+    assert_equal,
+    assert_raises,
+    start_nodes,
+    connect_nodes_bi,
+)
+
+
+class BlockStatsTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = False
+        self.num_nodes = 2
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [["-blockstatsindex"], []])
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        # Without the index there is nothing to look up.
+        assert_raises(JSONRPCException, self.nodes[1].getblockstats, 0)
+
+        # The cached chain was connected before the index was enabled.
+        start = self.nodes[0].getblockcount()
+        assert_raises(JSONRPCException, self.nodes[0].getblockstats, start)
+
+        address = self.nodes[1].getnewaddress()
+        unconfidential = self.nodes[1].validateaddress(address)["unconfidential"]
+        self.nodes[0].sendtoaddress(unconfidential, Decimal('1.5'))
+        self.nodes[0].sendtoaddress(address, Decimal('2.5'))
+        blockhash = self.nodes[0].generate(1)[0]
+        self.sync_all()
+
+        stats = self.nodes[0].getblockstats(start + 1)
+        assert_equal(stats, self.nodes[0].getblockstats(blockhash))
+        assert_equal(stats, self.nodes[0].getblockstats(str(start + 1)))
+        block = self.nodes[0].getblock(blockhash)
+        assert_equal(stats['blockhash'], blockhash)
+        assert_equal(stats['height'], start + 1)
+        assert_equal(stats['time'], block['time'])
+        assert_equal(stats['size'], block['size'])
+        assert_equal(stats['txs'], 3)
+        assert(stats['blinded_outs'] >= 1)
+        assert(stats['explicit_outs'] >= 2)
+        assert(stats['rangeproof_bytes'] > 0)
+        assert(stats['totalfee'] > 0)
+        assert(stats['minfeerate'] <= stats['medianfeerate'] <= stats['maxfeerate'])
+        assert_equal(stats['pegins'], 0)
+        assert_equal(stats['pegouts'], 0)
+        assert(stats['out_script_types']['pubkeyhash'] >= 2)
+
+        res = self.nodes[0].getblockstatsrange(start)
+        assert_equal(len(res), 2)
+        assert_equal(res[0], None)
+        assert_equal(res[1], stats)
+        assert_raises(JSONRPCException, self.nodes[0].getblockstatsrange, start, start + 2)
+        assert_raises(JSONRPCException, self.nodes[0].getblockstatsrange, start + 1, start)
+
+
+if __name__ == '__main__':
+    BlockStatsTest().main()
@@ -108,6 +108,20 @@ class HTTPBasicsTest (BitcoinTestFramework):
         out1 = conn.getresponse()
         assert_equal(out1.status, http.client.BAD_REQUEST)
 
+        # Batch replies are streamed, but keep the order of the calls
+        conn = http.client.HTTPConnection(urlNode2.hostname, urlNode2.port)
+        conn.connect()
+        batch = [{"method": "getblockhash", "params": [i], "id": i} for i in range(50)]
+        batch.append({"method": "nosuchmethod", "id": 50})
+        conn.request('POST', '/', json.dumps(batch), headers)
+        out1 = conn.getresponse()
+        assert_equal(out1.status, http.client.OK)
+        replies = json.loads(out1.read().decode('utf-8'))
+        assert_equal([r["id"] for r in replies], list(range(51)))
+        assert_equal(replies[10]["result"], self.nodes[2].getblockhash(10))
+        assert_equal(replies[50]["error"]["code"], -32601)
+        assert(conn.sock!=None) #the connection stays open after a chunked reply
+
 
 if __name__ == '__main__':
     HTTPBasicsTest ().main ()
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+# Copyright (c) 2016 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test that the mempool, with its prioritisation deltas, is saved on
+# shutdown and loaded on restart (-persistmempool).
+#
+# Node 0 sends the transactions to itself; its wallet would put them back
+# in its mempool on restart anyway, so nodes 1 and 2, which only relay
+# them, are the ones restarted.
+#
+
+import time
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+
+class MempoolPersistTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = False
+        self.num_nodes = 3
+
+    def setup_network(self):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir)
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 0, 2)
+        self.is_network_split = False
+        self.sync_all()
+
+    def wait_for_mempool_size(self, node, size):
+        for _ in range(50):
+            if len(node.getrawmempool()) == size:
+                return
+            time.sleep(0.2)
+        assert_equal(len(node.getrawmempool()), size)
+
+    def run_test(self):
+        txids = [self.nodes[0].sendtoaddress(self.nodes[0].getnewaddress(), Decimal("1")) for _ in range(5)]
+        sync_mempools(self.nodes)
+        self.nodes[1].prioritisetransaction(txids[0], 0, 1000)
+        modifiedfee = self.nodes[1].getmempoolentry(txids[0])['modifiedfee']
+
+        stop_node(self.nodes[1], 1)
+        stop_node(self.nodes[2], 2)
+        self.nodes[1] = start_node(1, self.options.tmpdir)
+        self.nodes[2] = start_node(2, self.options.tmpdir, ["-persistmempool=0"])
+
+        self.wait_for_mempool_size(self.nodes[1], 5)
+        assert_equal(set(self.nodes[1].getrawmempool()), set(txids))
+        assert_equal(self.nodes[1].getmempoolentry(txids[0])['modifiedfee'], modifiedfee)
+        # Give node 2 the time it would need to load them, had it saved them.
+        time.sleep(2)
+        assert_equal(len(self.nodes[2].getrawmempool()), 0)
+
+        # A node that did not load the mempool does not overwrite the file
+        # it left; it is still there for a restart with -persistmempool.
+        stop_node(self.nodes[2], 2)
+        self.nodes[2] = start_node(2, self.options.tmpdir)
+        self.wait_for_mempool_size(self.nodes[2], 5)
+
+
+if __name__ == '__main__':
+    MempoolPersistTest().main()
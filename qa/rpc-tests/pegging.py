@@ -98,6 +98,30 @@ if "confirmations" in tx and tx["confirmations"] > 0:
 else:
     print("Peg-in has failed.")
 
+# Lock up more funds and claim two deposits, and one bogus claim, in a batch
+sidechain.sendtomainchain(addr, 20)
+sidechain.sendtomainchain(addr, 20)
+sidechain.generate(1)
+
+claims = []
+for value in [10, 5]:
+    addrs = sidechain.getpeginaddress()
+    txid = bitcoin.sendtoaddress(addrs["mainchain_address"], value)
+    bitcoin.generate(10)
+    claims.append({"sidechain_address": addrs["sidechain_address"],
+                   "bitcoinTx": bitcoin.getrawtransaction(txid),
+                   "txoutproof": bitcoin.gettxoutproof([txid])})
+claims.append({"sidechain_address": addrs["sidechain_address"], "bitcoinTx": "00", "txoutproof": "00"})
+
+print("Attempting batch peg-in")
+results = sidechain.claimpegins(claims)
+sidechain.generate(1)
+
+if "error" in results[2] and all("confirmations" in sidechain.gettransaction(r["txid"]) and sidechain.gettransaction(r["txid"])["confirmations"] > 0 for r in results[:2]):
+    print("Batch peg-in is confirmed: Success!")
+else:
+    print("Batch peg-in has failed.")
+
 
 
 print("Stopping daemons and cleaning up")
@@ -118,6 +118,23 @@ class RawTransactionsTest(BitcoinTestFramework):
 
         txDetails = self.nodes[0].gettransaction(txId, True)
         rawTx = self.nodes[0].decoderawtransaction(txDetails['hex'])
+
+        # A lean decode gives the size of the range proofs instead of decoding them.
+        txId = self.nodes[0].sendtoaddress(self.nodes[1].getnewaddress(), 1)
+        txHex = self.nodes[0].gettransaction(txId)['hex']
+        full = self.nodes[0].decoderawtransaction(txHex)
+        lean = self.nodes[0].decoderawtransaction(txHex, True)
+        assert_equal(len(full['vout']), len(lean['vout']))
+        blinded = [(f, l) for f, l in zip(full['vout'], lean['vout']) if 'value' not in l]
+        assert(len(blinded) > 0)
+        for f, l in blinded:
+            assert('ct-bits' in f)
+            assert('ct-bits' not in l)
+            assert_greater_than(l['ct-rangeproof-size'], 0)
+            assert_equal(f['serValue'], l['serValue'])
+        assert_equal(self.nodes[0].getrawtransaction(txId, 1)['hex'], txHex)
+        assert('hex' not in self.nodes[0].getrawtransaction(txId, 1, True))
+
         vout = False
         ''' TODO: Tests are largely incompatible with CT
         for outpoint in rawTx['vout']:
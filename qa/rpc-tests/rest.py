@@ -24,6 +24,16 @@ def deser_uint256(f):
         r += t << (i * 32)
     return r
 
+def deser_compact_size(f):
+    nit = unpack(b"<B", f.read(1))[0]
+    if nit == 253:
+        nit = unpack(b"<H", f.read(2))[0]
+    elif nit == 254:
+        nit = unpack(b"<I", f.read(4))[0]
+    elif nit == 255:
+        nit = unpack(b"<Q", f.read(8))[0]
+    return nit
+
 #allows simple http get calls
 def http_get_call(host, port, path, response_object = 0):
     conn = http.client.HTTPConnection(host, port)
@@ -325,6 +335,54 @@ class RESTTest (BitcoinTestFramework):
         for tx in txs:
             assert_equal(tx in json_obj['tx'], True)
 
+        # check the confidential output data of the block
+        block_json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/block/'+newblockhash[0]+self.FORMAT_SEPARATOR+'json'))
+        response = http_get_call(url.hostname, url.port, '/rest/ctdata/'+newblockhash[0]+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        etag = response.getheader('etag')
+        ctdata = BytesIO(response.read())
+        assert_equal(deser_uint256(ctdata), int(newblockhash[0], 16))
+        assert_equal(deser_compact_size(ctdata), len(block_json_obj['tx']))
+        for tx in block_json_obj['tx']:
+            assert_equal(deser_uint256(ctdata), int(tx['txid'], 16))
+            assert_equal(deser_compact_size(ctdata), len(tx['vout']))
+            for vout in tx['vout']:
+                assert_equal(len(ctdata.read(33)), 33)
+                ctdata.read(deser_compact_size(ctdata)) # nonce commitment
+                ctdata.read(deser_compact_size(ctdata)) # rangeproof
+        assert_equal(ctdata.read(), b'')
+
+        # unchanged data is not sent again
+        conn = http.client.HTTPConnection(url.hostname, url.port)
+        conn.request('GET', '/rest/ctdata/'+newblockhash[0]+self.FORMAT_SEPARATOR+'bin', headers={'If-None-Match': etag})
+        response = conn.getresponse()
+        assert_equal(response.status, 304)
+        assert_equal(response.read(), b'')
+
+        # a range of blocks is the data of each of them in turn
+        prevhash = block_json_obj['previousblockhash']
+        response = http_get_call(url.hostname, url.port, '/rest/ctdata/2/'+prevhash+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        assert(response.getheader('etag') != etag)
+        ctdata_range = response.read()
+        ctdata_prev = http_get_call(url.hostname, url.port, '/rest/ctdata/'+prevhash+self.FORMAT_SEPARATOR+'bin', True).read()
+        ctdata_new = http_get_call(url.hostname, url.port, '/rest/ctdata/'+newblockhash[0]+self.FORMAT_SEPARATOR+'bin', True).read()
+        assert_equal(ctdata_range, ctdata_prev + ctdata_new)
+        response = http_get_call(url.hostname, url.port, '/rest/ctdata/101/'+prevhash+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 400)
+
+        # export raw blocks in bulk, each preceded by its size
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/'+prevhash+'/3'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        blocks = BytesIO(response.read())
+        for blockhash in [prevhash, newblockhash[0]]:
+            block = http_get_call(url.hostname, url.port, '/rest/block/'+blockhash+self.FORMAT_SEPARATOR+'bin', True).read()
+            assert_equal(unpack(b"<I", blocks.read(4))[0], len(block))
+            assert_equal(blocks.read(len(block)), block)
+        assert_equal(blocks.read(), b'') # no more blocks on top yet
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/'+prevhash+'/0'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 400)
+
         #test rest bestblock
         bb_hash = self.nodes[0].getbestblockhash()
 
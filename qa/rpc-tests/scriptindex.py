@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+# Copyright (c) 2016 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the script index (-scriptindex) and getscripthistory.
+#
+
+from decimal import Decimal
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import JSONRPCException
+from test_framework.util import (
+    assert_equal,
+    assert_raises,
+    start_nodes,
+    connect_nodes_bi,
+)
+
+
+class ScriptIndexTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = False
+        self.num_nodes = 2
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [["-scriptindex"], []])
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        # Without the index there is nothing to look up.
+        assert_raises(JSONRPCException, self.nodes[1].getscripthistory, self.nodes[1].getnewaddress())
+
+        address = self.nodes[1].getnewaddress()
+        unconfidential = self.nodes[1].validateaddress(address)["unconfidential"]
+
+        # An explicit and a blinded output to the same script.
+        txid_explicit = self.nodes[0].sendtoaddress(unconfidential, Decimal('1.5'))
+        txid_blinded = self.nodes[0].sendtoaddress(address, Decimal('2.5'))
+        self.nodes[0].generate(1)
+        self.sync_all()
+        height = self.nodes[0].getblockcount()
+
+        res = self.nodes[0].getscripthistory(unconfidential)
+        assert_equal(res, self.nodes[0].getscripthistory(address))
+        outputs = res['outputs']
+        assert_equal(len(outputs), 2)
+        for output in outputs:
+            assert_equal(output['height'], height)
+            assert('spent' not in output)
+        explicit = [o for o in outputs if o['txid'] == txid_explicit][0]
+        blinded = [o for o in outputs if o['txid'] == txid_blinded][0]
+        assert_equal(explicit['value'], Decimal('1.5'))
+        assert('value' not in blinded)
+        assert_equal(len(blinded['serValue']), 66)
+
+        # Spend both back and check they are marked spent.
+        txid_spend = self.nodes[1].sendtoaddress(self.nodes[0].getnewaddress(), Decimal('3.9'))
+        self.nodes[1].generate(1)
+        self.sync_all()
+        outputs = self.nodes[0].getscripthistory(address)['outputs']
+        assert_equal(len(outputs), 2)
+        for output in outputs:
+            assert_equal(output['spent']['txid'], txid_spend)
+            assert_equal(output['spent']['height'], height + 1)
+        assert_equal(self.nodes[0].getscripthistory(address, True)['outputs'], [])
+
+        # Disconnecting the block removes its spends from the index.
+        self.nodes[0].invalidateblock(self.nodes[0].getbestblockhash())
+        assert_equal(len(self.nodes[0].getscripthistory(address, True)['outputs']), 2)
+        self.nodes[0].invalidateblock(self.nodes[0].getbestblockhash())
+        assert_equal(self.nodes[0].getscripthistory(address)['outputs'], [])
+
+
+if __name__ == '__main__':
+    ScriptIndexTest().main()
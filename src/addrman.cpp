@@ -246,7 +246,7 @@ void CAddrMan::Good_(const CService& addr, int64_t nTime)
     MakeTried(info, nId);
 }
 
-bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimePenalty)
+bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimePenalty, int nUBucket, int nUBucketPos)
 {
     if (!addr.IsRoutable())
         return false;
@@ -290,8 +290,11 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
         fNew = true;
     }
 
-    int nUBucket = pinfo->GetNewBucket(nKey, source);
-    int nUBucketPos = pinfo->GetBucketPosition(nKey, true, nUBucket);
+    // The position depends on the port, which a known entry may not share.
+    if (nUBucket < 0 || pinfo->GetPort() != addr.GetPort()) {
+        nUBucket = pinfo->GetNewBucket(nKey, source);
+        nUBucketPos = pinfo->GetBucketPosition(nKey, true, nUBucket);
+    }
     if (vvNew[nUBucket][nUBucketPos] != nId) {
         bool fInsert = vvNew[nUBucket][nUBucketPos] == -1;
         if (!fInsert) {
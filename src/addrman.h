@@ -13,6 +13,7 @@
 #include "timedata.h"
 #include "util.h"
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <stdint.h>
@@ -233,8 +234,8 @@ protected:
     //! Mark an entry "good", possibly moving it from "new" to "tried".
     void Good_(const CService &addr, int64_t nTime);
 
-    //! Add an entry to the "new" table.
-    bool Add_(const CAddress &addr, const CNetAddr& source, int64_t nTimePenalty);
+    //! Add an entry to the "new" table, at nUBucket/nUBucketPos if these are already known.
+    bool Add_(const CAddress &addr, const CNetAddr& source, int64_t nTimePenalty, int nUBucket = -1, int nUBucketPos = -1);
 
     //! Mark an entry as attempted to connect.
     void Attempt_(const CService &addr, bool fCountFailure, int64_t nTime);
@@ -303,10 +304,13 @@ public:
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
+        // Pairs of nId and index in the file, in the order of mapInfo, so
+        // that they can be looked up without building another map.
+        std::vector<std::pair<int, int> > vUnkIds;
+        vUnkIds.reserve(mapInfo.size());
         int nIds = 0;
         for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            mapUnkIds[(*it).first] = nIds;
+            vUnkIds.push_back(std::make_pair((*it).first, nIds));
             const CAddrInfo &info = (*it).second;
             if (info.nRefCount) {
                 assert(nIds != nNew); // this means nNew was wrong, oh ow
@@ -332,8 +336,9 @@ public:
             s << nSize;
             for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
                 if (vvNew[bucket][i] != -1) {
-                    int nIndex = mapUnkIds[vvNew[bucket][i]];
-                    s << nIndex;
+                    std::vector<std::pair<int, int> >::const_iterator itUnk = std::lower_bound(vUnkIds.begin(), vUnkIds.end(), std::make_pair(vvNew[bucket][i], 0));
+                    assert(itUnk != vUnkIds.end() && itUnk->first == vvNew[bucket][i]);
+                    s << itUnk->second;
                 }
             }
         }
@@ -515,15 +520,39 @@ public:
         return fRet;
     }
 
-    //! Add multiple addresses.
+    //! Add multiple addresses. Only the first of several entries for the same address counts.
     bool Add(const std::vector<CAddress> &vAddr, const CNetAddr& source, int64_t nTimePenalty = 0)
     {
+        // Hashing out the new table position of each address is most of the
+        // work of adding it, so do that before taking the lock.
+        uint256 nKeyUsed;
+        {
+            LOCK(cs);
+            nKeyUsed = nKey;
+        }
+        std::vector<std::pair<int, int> > vPos(vAddr.size(), std::make_pair(-1, -1));
+        std::set<CNetAddr> setSeen;
+        for (size_t i = 0; i < vAddr.size(); i++) {
+            if (!vAddr[i].IsRoutable() || !setSeen.insert(vAddr[i]).second)
+                continue;
+            const CAddrInfo info(vAddr[i], source);
+            vPos[i].first = info.GetNewBucket(nKeyUsed, source);
+            vPos[i].second = info.GetBucketPosition(nKeyUsed, true, vPos[i].first);
+        }
         int nAdd = 0;
         {
             LOCK(cs);
             Check();
-            for (std::vector<CAddress>::const_iterator it = vAddr.begin(); it != vAddr.end(); it++)
-                nAdd += Add_(*it, source, nTimePenalty) ? 1 : 0;
+            // Positions are only good for the key they were computed with.
+            const bool fKeyChanged = nKey != nKeyUsed;
+            for (size_t i = 0; i < vAddr.size(); i++) {
+                if (vPos[i].first < 0)
+                    continue;
+                if (fKeyChanged)
+                    nAdd += Add_(vAddr[i], source, nTimePenalty) ? 1 : 0;
+                else
+                    nAdd += Add_(vAddr[i], source, nTimePenalty, vPos[i].first, vPos[i].second) ? 1 : 0;
+            }
             Check();
         }
         if (nAdd)
@@ -0,0 +1,268 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "amountverifier.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <deque>
+#include <map>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <secp256k1_rangeproof.h>
+
+namespace {
+
+/** Range proofs per secp256k1 batch call on the CPU */
+static const size_t CPU_AMOUNT_BATCH_SIZE = 16;
+
+bool VerifyRangeProofsOnCPU(const secp256k1_context* ctx, const unsigned char* const* commits, const unsigned char* const* proofs, const int* lens, size_t n)
+{
+    if (n == 1) {
+        uint64_t min_value, max_value;
+        return secp256k1_rangeproof_verify(ctx, &min_value, &max_value, commits[0], proofs[0], lens[0]);
+    }
+    return secp256k1_rangeproof_verify_batch(ctx, commits, proofs, lens, n);
+}
+
+/** Verifies everything on the calling thread, as validation always did */
+class CCPUAmountVerifier : public CAmountVerifier
+{
+public:
+    size_t GetBatchSize() const { return CPU_AMOUNT_BATCH_SIZE; }
+
+    Result VerifyRangeProofs(const secp256k1_context* ctx, const unsigned char* const* commits, const unsigned char* const* proofs, const int* lens, size_t n)
+    {
+        return VerifyRangeProofsOnCPU(ctx, commits, proofs, lens, n) ? VERIFY_VALID : VERIFY_INVALID;
+    }
+
+    Result VerifyTallies(const secp256k1_context* ctx, const unsigned char* const* const* commitsIn, const int* countsIn, const unsigned char* const* const* commitsOut, const int* countsOut, const int64_t* excesses, size_t n)
+    {
+        bool fValid;
+        if (n == 1)
+            fValid = secp256k1_pedersen_verify_tally(ctx, commitsIn[0], countsIn[0], commitsOut[0], countsOut[0], excesses[0]);
+        else
+            fValid = secp256k1_pedersen_verify_tally_batch(ctx, commitsIn, countsIn, commitsOut, countsOut, excesses, n);
+        return fValid ? VERIFY_VALID : VERIFY_INVALID;
+    }
+};
+
+/**
+ * Reference backend for large batches: a batch is cut into chunks of
+ * CPU_AMOUNT_BATCH_SIZE proofs, which a pool of worker threads of its own and
+ * the calling thread verify together. Once a chunk fails, the rest of its
+ * batch is skipped. Tallies are cheap and left to the calling thread.
+ */
+class CThreadedAmountVerifier : public CAmountVerifier
+{
+private:
+    struct Batch
+    {
+        const secp256k1_context* ctx;
+        const unsigned char* const* commits;
+        const unsigned char* const* proofs;
+        const int* lens;
+        size_t n;
+        //! Proofs handed out to a thread, and proofs done with
+        size_t nNext;
+        size_t nDone;
+        bool fValid;
+    };
+
+    const int nThreads;
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    boost::condition_variable condDone;
+    //! Batches some proofs of which have not been handed out yet
+    std::deque<Batch*> queue;
+    bool fStop;
+    boost::thread_group workers;
+
+    //! Hand out the next chunk of batch, which is queued. mutex must be held.
+    void TakeChunk(Batch& batch, size_t& nBegin, size_t& nEnd)
+    {
+        nBegin = batch.nNext;
+        nEnd = std::min(batch.n, nBegin + CPU_AMOUNT_BATCH_SIZE);
+        batch.nNext = nEnd;
+        if (nEnd == batch.n)
+            queue.erase(std::find(queue.begin(), queue.end(), &batch));
+    }
+
+    void RunChunk(Batch& batch, size_t nBegin, size_t nEnd)
+    {
+        bool fSkip;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fSkip = !batch.fValid;
+        }
+        const bool fValid = fSkip || VerifyRangeProofsOnCPU(batch.ctx, batch.commits + nBegin, batch.proofs + nBegin, batch.lens + nBegin, nEnd - nBegin);
+        // The caller may return as soon as the last chunk is accounted for.
+        boost::unique_lock<boost::mutex> lock(mutex);
+        batch.fValid = batch.fValid && fValid;
+        batch.nDone += nEnd - nBegin;
+        if (batch.nDone == batch.n)
+            condDone.notify_all();
+    }
+
+    void ThreadVerify()
+    {
+        RenameThread("bitcoin-amountverify");
+        while (true) {
+            Batch* batch;
+            size_t nBegin, nEnd;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && queue.empty())
+                    condWork.wait(lock);
+                if (fStop)
+                    return;
+                batch = queue.front();
+                TakeChunk(*batch, nBegin, nEnd);
+            }
+            RunChunk(*batch, nBegin, nEnd);
+        }
+    }
+
+public:
+    CThreadedAmountVerifier(int nThreadsIn) : nThreads(nThreadsIn), fStop(false)
+    {
+        for (int i = 0; i < nThreads; i++)
+            workers.create_thread(boost::bind(&CThreadedAmountVerifier::ThreadVerify, this));
+    }
+
+    ~CThreadedAmountVerifier()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condWork.notify_all();
+        workers.join_all();
+    }
+
+    size_t GetBatchSize() const { return CPU_AMOUNT_BATCH_SIZE * (nThreads + 1); }
+
+    Result VerifyRangeProofs(const secp256k1_context* ctx, const unsigned char* const* commits, const unsigned char* const* proofs, const int* lens, size_t n)
+    {
+        if (n <= CPU_AMOUNT_BATCH_SIZE)
+            return VerifyRangeProofsOnCPU(ctx, commits, proofs, lens, n) ? VERIFY_VALID : VERIFY_INVALID;
+
+        Batch batch = {ctx, commits, proofs, lens, n, 0, 0, true};
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            queue.push_back(&batch);
+        }
+        condWork.notify_all();
+
+        // Work on our own batch rather than wait for the workers.
+        while (true) {
+            size_t nBegin, nEnd;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (batch.nNext == batch.n)
+                    break;
+                TakeChunk(batch, nBegin, nEnd);
+            }
+            RunChunk(batch, nBegin, nEnd);
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (batch.nDone < batch.n)
+            condDone.wait(lock);
+        return batch.fValid ? VERIFY_VALID : VERIFY_INVALID;
+    }
+
+    Result VerifyTallies(const secp256k1_context* ctx, const unsigned char* const* const* commitsIn, const int* countsIn, const unsigned char* const* const* commitsOut, const int* countsOut, const int64_t* excesses, size_t n)
+    {
+        return VERIFY_UNAVAILABLE;
+    }
+};
+
+CAmountVerifier* CreateCPUAmountVerifier(int nThreads)
+{
+    return new CCPUAmountVerifier();
+}
+
+CAmountVerifier* CreateThreadedAmountVerifier(int nThreads)
+{
+    return new CThreadedAmountVerifier(nThreads > 0 ? nThreads : GetNumCores());
+}
+
+std::map<std::string, AmountVerifierFactory>& GetAmountVerifierFactories()
+{
+    static std::map<std::string, AmountVerifierFactory> mapFactories;
+    if (mapFactories.empty()) {
+        mapFactories["cpu"] = CreateCPUAmountVerifier;
+        mapFactories["threads"] = CreateThreadedAmountVerifier;
+    }
+    return mapFactories;
+}
+
+CCPUAmountVerifier cpuAmountVerifier;
+//! The -amountverifier backend, or NULL for cpuAmountVerifier
+CAmountVerifier* pAmountVerifier = NULL;
+
+} // namespace
+
+void RegisterAmountVerifier(const std::string& name, AmountVerifierFactory factory)
+{
+    GetAmountVerifierFactories()[name] = factory;
+}
+
+std::vector<std::string> GetAmountVerifierNames()
+{
+    std::vector<std::string> vNames;
+    const std::map<std::string, AmountVerifierFactory>& mapFactories = GetAmountVerifierFactories();
+    for (std::map<std::string, AmountVerifierFactory>::const_iterator it = mapFactories.begin(); it != mapFactories.end(); ++it)
+        vNames.push_back(it->first);
+    return vNames;
+}
+
+bool StartAmountVerifier(const std::string& name, int nThreads, bool& fFallback)
+{
+    fFallback = false;
+    const std::map<std::string, AmountVerifierFactory>& mapFactories = GetAmountVerifierFactories();
+    std::map<std::string, AmountVerifierFactory>::const_iterator it = mapFactories.find(name);
+    if (it == mapFactories.end())
+        return false;
+    StopAmountVerifier();
+    pAmountVerifier = it->second(nThreads);
+    fFallback = pAmountVerifier == NULL;
+    return true;
+}
+
+void StopAmountVerifier()
+{
+    delete pAmountVerifier;
+    pAmountVerifier = NULL;
+}
+
+size_t GetAmountVerifierBatchSize()
+{
+    return pAmountVerifier ? pAmountVerifier->GetBatchSize() : cpuAmountVerifier.GetBatchSize();
+}
+
+bool VerifyRangeProofBatch(const secp256k1_context* ctx, const unsigned char* const* commits, const unsigned char* const* proofs, const int* lens, size_t n)
+{
+    CAmountVerifier::Result result = CAmountVerifier::VERIFY_UNAVAILABLE;
+    if (pAmountVerifier)
+        result = pAmountVerifier->VerifyRangeProofs(ctx, commits, proofs, lens, n);
+    if (result == CAmountVerifier::VERIFY_UNAVAILABLE)
+        result = cpuAmountVerifier.VerifyRangeProofs(ctx, commits, proofs, lens, n);
+    return result == CAmountVerifier::VERIFY_VALID;
+}
+
+bool VerifyTallyBatch(const secp256k1_context* ctx, const unsigned char* const* const* commitsIn, const int* countsIn, const unsigned char* const* const* commitsOut, const int* countsOut, const int64_t* excesses, size_t n)
+{
+    CAmountVerifier::Result result = CAmountVerifier::VERIFY_UNAVAILABLE;
+    if (pAmountVerifier)
+        result = pAmountVerifier->VerifyTallies(ctx, commitsIn, countsIn, commitsOut, countsOut, excesses, n);
+    if (result == CAmountVerifier::VERIFY_UNAVAILABLE)
+        result = cpuAmountVerifier.VerifyTallies(ctx, commitsIn, countsIn, commitsOut, countsOut, excesses, n);
+    return result == CAmountVerifier::VERIFY_VALID;
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_AMOUNTVERIFIER_H
+#define BITCOIN_AMOUNTVERIFIER_H
+
+#include <secp256k1.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Default for -amountverifier */
+static const char* const DEFAULT_AMOUNT_VERIFIER = "cpu";
+
+/**
+ * Where the range proofs and commitment tallies of confidential amounts are
+ * verified. CRangeCheck, CRangeBatchCheck and CBalanceBatchCheck hand their
+ * work to the active backend (-amountverifier) through VerifyRangeProofBatch
+ * and VerifyTallyBatch. A backend that cannot take a batch, such as an
+ * accelerator that is busy or has gone away, answers VERIFY_UNAVAILABLE and
+ * the batch is verified on the calling thread instead.
+ *
+ * ctx is the context the calling thread would verify with; a backend that
+ * verifies on the CPU uses it, an offload backend may ignore it.
+ */
+class CAmountVerifier
+{
+public:
+    enum Result {
+        VERIFY_VALID,
+        VERIFY_INVALID,
+        VERIFY_UNAVAILABLE,
+    };
+
+    virtual ~CAmountVerifier() {}
+
+    /**
+     * Number of range proofs a batch should hold to keep this backend busy.
+     * During initial block download blocks are checked in batches this big.
+     */
+    virtual size_t GetBatchSize() const = 0;
+
+    /** Verify n range proofs, see secp256k1_rangeproof_verify_batch */
+    virtual Result VerifyRangeProofs(const secp256k1_context* ctx, const unsigned char* const* commits, const unsigned char* const* proofs, const int* lens, size_t n) = 0;
+
+    /** Verify n commitment tallies, see secp256k1_pedersen_verify_tally_batch */
+    virtual Result VerifyTallies(const secp256k1_context* ctx, const unsigned char* const* const* commitsIn, const int* countsIn, const unsigned char* const* const* commitsOut, const int* countsOut, const int64_t* excesses, size_t n) = 0;
+};
+
+/** Creates a backend, or returns NULL if it cannot run on this machine */
+typedef CAmountVerifier* (*AmountVerifierFactory)(int nThreads);
+
+/** Make a backend selectable with -amountverifier=name */
+void RegisterAmountVerifier(const std::string& name, AmountVerifierFactory factory);
+/** Names of the registered backends */
+std::vector<std::string> GetAmountVerifierNames();
+
+/**
+ * Switch to the named backend. If the backend cannot run here, the CPU one
+ * is used and fFallback is set. Returns false for an unknown name. Only
+ * call this while nothing is being verified, during init and shutdown.
+ */
+bool StartAmountVerifier(const std::string& name, int nThreads, bool& fFallback);
+/** Delete the active backend and go back to the CPU one */
+void StopAmountVerifier();
+
+/** The batch size of the active backend */
+size_t GetAmountVerifierBatchSize();
+
+/** Verify n range proofs with the active backend, falling back to the calling thread */
+bool VerifyRangeProofBatch(const secp256k1_context* ctx, const unsigned char* const* commits, const unsigned char* const* proofs, const int* lens, size_t n);
+/** Verify n commitment tallies with the active backend, falling back to the calling thread */
+bool VerifyTallyBatch(const secp256k1_context* ctx, const unsigned char* const* const* commitsIn, const int* countsIn, const unsigned char* const* const* commitsOut, const int* countsOut, const int64_t* excesses, size_t n);
+
+#endif // BITCOIN_AMOUNTVERIFIER_H
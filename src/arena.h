@@ -0,0 +1,98 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ARENA_H
+#define BITCOIN_ARENA_H
+
+#include "serialize.h"
+
+#include <assert.h>
+#include <memory>
+#include <stddef.h>
+
+/**
+ * A monotonic arena: allocations are carved out of large chunks one after the
+ * other and are never freed one by one. Each comes with a reference to its
+ * chunk, which is freed in one go once the last allocation in it is gone.
+ *
+ * Deserializing a block reads the rangeproofs of all its transactions into
+ * one arena (see CArenaStream), which takes two heap allocations per
+ * rangeproof down to one per chunk and keeps the proofs together in memory.
+ * As one rangeproof keeps its whole chunk alive, copies that outlive the
+ * block by far should move their proofs out (see shared_vector).
+ */
+class CMonotonicArena
+{
+public:
+    //! Size of the chunks allocations are carved out of
+    static const size_t CHUNK_SIZE = 64 * 1024;
+    //! Larger allocations are better left to the heap
+    static const size_t MAX_ALLOCATION = 8 * 1024;
+
+private:
+    std::shared_ptr<unsigned char> chunk;
+    size_t nUsed;
+
+    CMonotonicArena(const CMonotonicArena&);
+    CMonotonicArena& operator=(const CMonotonicArena&);
+
+public:
+    CMonotonicArena() : nUsed(CHUNK_SIZE) {}
+
+    //! Allocate nSize bytes, at most MAX_ALLOCATION, which live as long as the result or a copy of it
+    std::shared_ptr<unsigned char> Allocate(size_t nSize)
+    {
+        assert(nSize <= MAX_ALLOCATION);
+        if (CHUNK_SIZE - nUsed < nSize) {
+            chunk.reset(new unsigned char[CHUNK_SIZE], std::default_delete<unsigned char[]>());
+            nUsed = 0;
+        }
+        std::shared_ptr<unsigned char> ret(chunk, chunk.get() + nUsed);
+        nUsed += nSize;
+        return ret;
+    }
+};
+
+/**
+ * Wraps a stream being read from, so that the objects deserialized from it
+ * can allocate from an arena; see GetStreamArena.
+ */
+template<typename Stream>
+class CArenaStream
+{
+private:
+    Stream& stream;
+    CMonotonicArena& arena;
+
+public:
+    CArenaStream(Stream& streamIn, CMonotonicArena& arenaIn) : stream(streamIn), arena(arenaIn) {}
+
+    void read(char* pch, size_t nSize) { stream.read(pch, nSize); }
+
+    CMonotonicArena& GetArena() { return arena; }
+};
+
+//! The arena of a stream, if it has one
+template<typename Stream>
+inline CMonotonicArena* GetStreamArena(Stream& s) { return NULL; }
+
+template<typename Stream>
+inline CMonotonicArena* GetStreamArena(CArenaStream<Stream>& s) { return &s.GetArena(); }
+
+/** Like READWRITE(obj), but deserialize obj with an arena of its own. */
+template<typename Stream, typename T>
+inline void SerReadWriteInArena(Stream& s, const T& obj, int nType, int nVersion, CSerActionSerialize ser_action)
+{
+    ::Serialize(s, obj, nType, nVersion);
+}
+
+template<typename Stream, typename T>
+inline void SerReadWriteInArena(Stream& s, T& obj, int nType, int nVersion, CSerActionUnserialize ser_action)
+{
+    CMonotonicArena arena;
+    CArenaStream<Stream> sArena(s, arena);
+    ::Unserialize(sArena, obj, nType, nVersion);
+}
+
+#endif // BITCOIN_ARENA_H
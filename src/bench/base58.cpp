@@ -50,7 +50,32 @@ static void Base58Decode(benchmark::State& state)
     }
 }
 
+// The payload of a confidential address: prefixes, blinding pubkey, hash and checksum
+static void Base58EncodeConfidential(benchmark::State& state)
+{
+    std::vector<unsigned char> vch(2 + 33 + 20 + 4);
+    for (size_t i = 0; i < vch.size(); i++)
+        vch[i] = (unsigned char)(i * 151 + 7);
+    while (state.KeepRunning()) {
+        EncodeBase58(vch);
+    }
+}
+
+
+static void Base58DecodeConfidential(benchmark::State& state)
+{
+    std::vector<unsigned char> vch(2 + 33 + 20 + 4);
+    for (size_t i = 0; i < vch.size(); i++)
+        vch[i] = (unsigned char)(i * 151 + 7);
+    const std::string addr = EncodeBase58(vch);
+    while (state.KeepRunning()) {
+        DecodeBase58(addr, vch);
+    }
+}
+
 
 BENCHMARK(Base58Encode);
 BENCHMARK(Base58CheckEncode);
 BENCHMARK(Base58Decode);
+BENCHMARK(Base58EncodeConfidential);
+BENCHMARK(Base58DecodeConfidential);
@@ -3,19 +3,30 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "bench.h"
+#include "connectblock.h"
 
+#include "crypto/sha256.h"
 #include "key.h"
 #include "main.h"
+#include "script/sigcache.h"
 #include "util.h"
 
 int
 main(int argc, char** argv)
 {
+    SHA256AutoDetect();
     ECC_Start();
     SetupEnvironment();
+    InitSignatureCache();
     fPrintToDebugLog = false; // don't want to write to debug.log file
+    ParseParameters(argc, argv);
 
-    benchmark::BenchRunner::RunAll();
+    int nRet = 0;
+    if (mapArgs.count("-replay"))
+        nRet = benchmark::ReplayConnectBlock();
+    else
+        benchmark::BenchRunner::RunAll();
 
     ECC_Stop();
+    return nRet;
 }
@@ -0,0 +1,207 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "blind.h"
+#include "coins.h"
+#include "eccontext.h"
+#include "hash.h"
+#include "key.h"
+#include "main.h"
+#include "primitives/transaction.h"
+#include "uint256.h"
+
+#include <secp256k1.h>
+#include <secp256k1_rangeproof.h>
+
+#include <vector>
+
+/* A committed value together with a range proof over it, as BlindOutputs
+ * would produce with -ct_exponent=exp and -ct_bits=min_bits. */
+struct BenchProof
+{
+    unsigned char blind[32];
+    unsigned char nonce[32];
+    unsigned char commit[33];
+    std::vector<unsigned char> proof;
+    uint64_t value;
+    int exp;
+    int min_bits;
+
+    BenchProof(int expIn, int min_bitsIn) : value(123456789), exp(expIn), min_bits(min_bitsIn)
+    {
+        for (int i = 0; i < 32; i++) {
+            blind[i] = i + 1;
+            nonce[i] = 255 - i;
+        }
+        assert(secp256k1_pedersen_commit(ECC_GetContext(), commit, blind, value));
+        Sign();
+    }
+
+    void Sign()
+    {
+        int len = 5134;
+        proof.resize(len);
+        assert(secp256k1_rangeproof_sign(ECC_GetContext(), &proof[0], &len, 0, commit, blind, nonce, exp, min_bits, value));
+        proof.resize(len);
+    }
+};
+
+static void RangeproofSign(benchmark::State& state, int exp, int min_bits)
+{
+    BenchProof p(exp, min_bits);
+    while (state.KeepRunning()) {
+        p.Sign();
+    }
+}
+
+static void RangeproofVerify(benchmark::State& state, int exp, int min_bits)
+{
+    const BenchProof p(exp, min_bits);
+    uint64_t min_value, max_value;
+    while (state.KeepRunning()) {
+        assert(secp256k1_rangeproof_verify(ECC_GetContext(), &min_value, &max_value, p.commit, &p.proof[0], p.proof.size()));
+    }
+}
+
+static void RangeproofRewind(benchmark::State& state, int exp, int min_bits)
+{
+    const BenchProof p(exp, min_bits);
+    unsigned char blind_out[32];
+    unsigned char msg[4096];
+    int msg_size;
+    uint64_t min_value, max_value, value;
+    while (state.KeepRunning()) {
+        assert(secp256k1_rangeproof_rewind(ECC_GetContext(), blind_out, &value, msg, &msg_size, p.nonce, &min_value, &max_value, p.commit, &p.proof[0], p.proof.size()));
+    }
+}
+
+// The former wallet default (-ct_exponent=0 -ct_bits=32), the current one
+// (-ct_exponent=2 -ct_bits=26), and the largest range BlindOutputs permits.
+static void RangeproofSign_0_32(benchmark::State& state) { RangeproofSign(state, 0, 32); }
+static void RangeproofSign_2_26(benchmark::State& state) { RangeproofSign(state, 2, 26); }
+static void RangeproofSign_0_51(benchmark::State& state) { RangeproofSign(state, 0, 51); }
+static void RangeproofVerify_0_32(benchmark::State& state) { RangeproofVerify(state, 0, 32); }
+static void RangeproofVerify_2_26(benchmark::State& state) { RangeproofVerify(state, 2, 26); }
+static void RangeproofVerify_0_51(benchmark::State& state) { RangeproofVerify(state, 0, 51); }
+static void RangeproofRewind_0_32(benchmark::State& state) { RangeproofRewind(state, 0, 32); }
+static void RangeproofRewind_2_26(benchmark::State& state) { RangeproofRewind(state, 2, 26); }
+static void RangeproofRewind_0_51(benchmark::State& state) { RangeproofRewind(state, 0, 51); }
+
+static void PedersenVerifyTally(benchmark::State& state, int n)
+{
+    // n inputs and n outputs; the last output's blinding factor balances the rest.
+    std::vector<unsigned char> blinds(32 * 2 * n);
+    std::vector<unsigned char> commits(33 * 2 * n);
+    std::vector<const unsigned char*> blindptrs, inptrs, outptrs;
+    for (int i = 0; i < 2 * n; i++) {
+        for (int j = 0; j < 32; j++) {
+            blinds[32 * i + j] = (i * 7 + j + 1) & 0xff;
+        }
+        blindptrs.push_back(&blinds[32 * i]);
+    }
+    assert(secp256k1_pedersen_blind_sum(ECC_GetContext(), &blinds[32 * (2 * n - 1)], &blindptrs[0], 2 * n - 1, n));
+    for (int i = 0; i < 2 * n; i++) {
+        assert(secp256k1_pedersen_commit(ECC_GetContext(), &commits[33 * i], &blinds[32 * i], 1000));
+        (i < n ? inptrs : outptrs).push_back(&commits[33 * i]);
+    }
+    while (state.KeepRunning()) {
+        assert(secp256k1_pedersen_verify_tally(ECC_GetContext(), &inptrs[0], n, &outptrs[0], n, 0));
+    }
+}
+
+static void PedersenVerifyTally_2(benchmark::State& state) { PedersenVerifyTally(state, 2); }
+static void PedersenVerifyTally_16(benchmark::State& state) { PedersenVerifyTally(state, 16); }
+
+static CKey GetBenchKey(unsigned char seed)
+{
+    unsigned char k[32] = {seed, 1, 2, 3};
+    CKey key;
+    key.Set(&k[0], &k[32], true);
+    return key;
+}
+
+/* Spend a single unblinded coin of 1000 into two blinded outputs and a fee. */
+static CMutableTransaction CreateBlindedTx(const CPubKey& pubkey)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = ArithToUint256(1);
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 600;
+    tx.vout[1].nValue = 390;
+    tx.nTxFee = 10;
+
+    std::vector<uint256> input_blinds(1);
+    std::vector<uint256> output_blinds(2);
+    std::vector<CPubKey> output_pubkeys(2, pubkey);
+    assert(BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx));
+    return tx;
+}
+
+static void BlindTwoOutputs(benchmark::State& state)
+{
+    const CPubKey pubkey = GetBenchKey(1).GetPubKey();
+    while (state.KeepRunning()) {
+        CreateBlindedTx(pubkey);
+    }
+}
+
+static void UnblindOneOutput(benchmark::State& state)
+{
+    const CKey key = GetBenchKey(1);
+    const CMutableTransaction tx = CreateBlindedTx(key.GetPubKey());
+    CAmount amount;
+    uint256 blind;
+    while (state.KeepRunning()) {
+        assert(UnblindOutput(key, tx.vout[0], amount, blind));
+    }
+}
+
+static void UnblindForeignOutput(benchmark::State& state)
+{
+    const CKey key = GetBenchKey(2);
+    const CMutableTransaction tx = CreateBlindedTx(GetBenchKey(1).GetPubKey());
+    CAmount amount;
+    uint256 blind;
+    while (state.KeepRunning()) {
+        assert(!UnblindOutput(key, tx.vout[0], amount, blind));
+    }
+}
+
+static void VerifyBlindedAmounts(benchmark::State& state)
+{
+    CCoinsView viewBase;
+    CCoinsViewCache cache(&viewBase);
+    {
+        CCoinsModifier prev = cache.ModifyCoins(ArithToUint256(1));
+        prev->vout.resize(1);
+        prev->vout[0].nValue = 1000;
+    }
+    const CTransaction tx(CreateBlindedTx(GetBenchKey(1).GetPubKey()));
+    while (state.KeepRunning()) {
+        assert(VerifyAmounts(cache, tx, tx.nTxFee));
+    }
+}
+
+BENCHMARK(RangeproofSign_0_32);
+BENCHMARK(RangeproofSign_2_26);
+BENCHMARK(RangeproofSign_0_51);
+BENCHMARK(RangeproofVerify_0_32);
+BENCHMARK(RangeproofVerify_2_26);
+BENCHMARK(RangeproofVerify_0_51);
+BENCHMARK(RangeproofRewind_0_32);
+BENCHMARK(RangeproofRewind_2_26);
+BENCHMARK(RangeproofRewind_0_51);
+
+BENCHMARK(PedersenVerifyTally_2);
+BENCHMARK(PedersenVerifyTally_16);
+
+BENCHMARK(BlindTwoOutputs);
+BENCHMARK(UnblindOneOutput);
+BENCHMARK(UnblindForeignOutput);
+BENCHMARK(VerifyBlindedAmounts);
@@ -0,0 +1,270 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "connectblock.h"
+
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+#include "version.h"
+
+#include <fstream>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+/*
+ * Usage:
+
+    bench_bitcoin -replay=<blocks> -snapshot=<file> [chain options] [-par=<n>] [-dbcache=<n>] [-warm] [-runs=<n>]
+
+ * <blocks> holds one hex serialized block or block header per line, from the
+ * genesis block on, as printed by "getblock <hash> false" and
+ * "getblockheader <hash> false". <file> is a UTXO snapshot written by
+ * dumptxoutset at one of these blocks. Everything up to and including that
+ * block only serves as the chain before the replay and may be headers; the
+ * blocks after it are connected on top of the snapshot, each run starting
+ * from a freshly loaded chainstate database.
+ *
+ * -par and -dbcache have their elementsd meaning. Every run starts with
+ * empty signature and range proof caches, unless -warm replays the blocks
+ * once, untimed, before each run to fill them, as relaying the transactions
+ * beforehand would.
+ */
+
+namespace {
+
+struct CReplayRun
+{
+    int64_t nMicros;
+    uint64_t nBlocks;
+    uint64_t nInputs;
+    uint64_t nRangeProofs;
+
+    CReplayRun() : nMicros(0), nBlocks(0), nInputs(0), nRangeProofs(0) {}
+};
+
+bool ReadReplayFile(const std::string& strPath, std::vector<CBlock>& vBlocks, std::string& strError)
+{
+    std::ifstream file(strPath.c_str());
+    if (!file.is_open()) {
+        strError = "Unable to open " + strPath;
+        return false;
+    }
+    std::string strLine;
+    while (std::getline(file, strLine)) {
+        if (strLine.empty())
+            continue;
+        if (!IsHex(strLine)) {
+            strError = strprintf("Line %u of %s is not hex", vBlocks.size() + 1, strPath);
+            return false;
+        }
+        const std::vector<unsigned char> vch = ParseHex(strLine);
+        CBlock block;
+        try {
+            CDataStream ssBlock(vch, SER_NETWORK, PROTOCOL_VERSION);
+            ssBlock >> block;
+        } catch (const std::exception&) {
+            // Not a whole block; it may still be a header.
+            try {
+                CDataStream ssHeader(vch, SER_NETWORK, PROTOCOL_VERSION);
+                CBlockHeader header;
+                ssHeader >> header;
+                block = CBlock(header);
+            } catch (const std::exception&) {
+                strError = strprintf("Line %u of %s is neither a block nor a header", vBlocks.size() + 1, strPath);
+                return false;
+            }
+        }
+        vBlocks.push_back(block);
+    }
+    return true;
+}
+
+/** Give the blocks a chain of block indexes, so that ConnectBlock finds their context. */
+bool BuildReplayChain(const Consensus::Params& consensusParams, const std::vector<CBlock>& vBlocks, std::vector<CBlockIndex*>& vIndex, std::string& strError)
+{
+    AssertLockHeld(cs_main);
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        const CBlock& block = vBlocks[i];
+        const uint256 hash = block.GetHash();
+        if (block.nHeight != i || (i == 0 ? hash != consensusParams.hashGenesisBlock : block.hashPrevBlock != vIndex.back()->GetBlockHash())) {
+            strError = strprintf("Block %s is not in chain order after the genesis block", hash.ToString());
+            return false;
+        }
+        CBlockIndex* pindex = new CBlockIndex(block);
+        BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(hash, pindex)).first;
+        pindex->phashBlock = &mi->first;
+        pindex->pprev = i == 0 ? NULL : vIndex.back();
+        pindex->BuildSkip();
+        vIndex.push_back(pindex);
+    }
+    return true;
+}
+
+/** Load the snapshot into a freshly wiped chainstate database. */
+bool LoadReplaySnapshot(CCoinsViewDB& db, const boost::filesystem::path& pathSnapshot, CUTXOSnapshotInfo& info, std::string& strError)
+{
+    CCoinsViewCache view(&db);
+    CUTXOStats stats;
+    std::multimap<uint256, std::pair<COutPoint, CAmount> > mapLocksCreated;
+    if (!ReadUTXOSnapshot(pathSnapshot, view, info, stats, mapLocksCreated, strError))
+        return false;
+    view.SetBestBlock(info.hashBlock);
+    if (!view.Flush() || !db.Sync()) {
+        strError = "Failed to write the snapshot to the chainstate database";
+        return false;
+    }
+    return true;
+}
+
+/** Connect the blocks after the snapshot's on top of it, as ConnectTip would. */
+bool ReplayBlocks(const CChainParams& chainparams, const std::vector<CBlock>& vBlocks, const std::vector<CBlockIndex*>& vIndex, const boost::filesystem::path& pathSnapshot, int64_t nCoinDBCache, CReplayRun& run, std::string& strError)
+{
+    AssertLockHeld(cs_main);
+    CCoinsViewDB db(nCoinDBCache, false, true);
+    CUTXOSnapshotInfo info;
+    if (!LoadReplaySnapshot(db, pathSnapshot, info, strError))
+        return false;
+    if (info.nHeight < 0 || (size_t)info.nHeight >= vIndex.size() || vIndex[info.nHeight]->GetBlockHash() != info.hashBlock) {
+        strError = strprintf("The snapshot's block %s is not in the replay file", info.hashBlock.ToString());
+        return false;
+    }
+    const size_t nFirst = info.nHeight + 1;
+    if (nFirst == vBlocks.size()) {
+        strError = "There are no blocks after the snapshot's in the replay file";
+        return false;
+    }
+
+    CCoinsViewCache tip(&db);
+    const int64_t nStart = GetTimeMicros();
+    for (size_t i = nFirst; i < vBlocks.size(); i++) {
+        const CBlock& block = vBlocks[i];
+        if (block.vtx.empty()) {
+            strError = strprintf("Only the header of block %s, at height %u, is in the replay file", block.GetHash().ToString(), i);
+            return false;
+        }
+        CValidationState state;
+        block.fChecked = false;
+        if (!CheckBlock(block, state, chainparams.GetConsensus())) {
+            strError = strprintf("CheckBlock failed for block %s: %s", block.GetHash().ToString(), FormatStateMessage(state));
+            return false;
+        }
+        // With fJustCheck, ConnectBlock does not write undo data or indexes;
+        // what is left is the work of validating the block.
+        CCoinsViewCache view(&tip);
+        if (!ConnectBlock(block, state, vIndex[i], view, chainparams, NULL, true)) {
+            strError = strprintf("ConnectBlock failed for block %s: %s", block.GetHash().ToString(), FormatStateMessage(state));
+            return false;
+        }
+        view.SetBestBlock(block.GetHash());
+        if (!view.Flush() || (tip.DynamicMemoryUsage() > nCoinCacheUsage && !tip.Flush())) {
+            strError = "Failed to write to the chainstate database";
+            return false;
+        }
+
+        run.nBlocks++;
+        for (size_t j = 0; j < block.vtx.size(); j++) {
+            const CTransaction& tx = *block.vtx[j];
+            if (!tx.IsCoinBase())
+                run.nInputs += tx.vin.size();
+            for (size_t k = 0; k < tx.vout.size(); k++) {
+                if (!tx.vout[k].nValue.IsAmount() && !tx.vout[k].nValue.vchRangeproof.empty())
+                    run.nRangeProofs++;
+            }
+        }
+    }
+    if (!tip.Flush() || !db.Sync()) {
+        strError = "Failed to write to the chainstate database";
+        return false;
+    }
+    run.nMicros = GetTimeMicros() - nStart;
+    return true;
+}
+
+}
+
+int benchmark::ReplayConnectBlock()
+{
+    try {
+        SelectParams(ChainNameFromCommandLine(), mapArgs);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    const CChainParams& chainparams = Params();
+    // Blocks behind a checkpoint would skip their script checks.
+    fCheckpointsEnabled = false;
+
+    // Split -dbcache as elementsd does, less the block tree database.
+    int64_t nTotalCache = (GetArg("-dbcache", nDefaultDbCache) << 20);
+    nTotalCache = std::max(nTotalCache, nMinDbCache << 20);
+    nTotalCache = std::min(nTotalCache, nMaxDbCache << 20);
+    int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23));
+    nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20);
+    nCoinCacheUsage = nTotalCache - nCoinDBCache;
+
+    nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
+    if (nScriptCheckThreads <= 0)
+        nScriptCheckThreads += GetNumCores();
+    if (nScriptCheckThreads <= 1)
+        nScriptCheckThreads = 0;
+    else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
+        nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+    const bool fWarm = GetBoolArg("-warm", false);
+    const int nRuns = std::max(1, (int)GetArg("-runs", 1));
+
+    // The chainstate database goes to a scratch data directory.
+    const boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / strprintf("bench_connectblock_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+    ClearDatadirCache();
+
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threadGroup.create_thread(&ThreadScriptCheck);
+
+    int nRet = 0;
+    {
+        LOCK(cs_main);
+        std::string strError;
+        std::vector<CBlock> vBlocks;
+        std::vector<CBlockIndex*> vIndex;
+        if (ReadReplayFile(GetArg("-replay", ""), vBlocks, strError))
+            BuildReplayChain(chainparams.GetConsensus(), vBlocks, vIndex, strError);
+
+        std::cout << strprintf("# -par=%d, -dbcache=%d, %s caches", nScriptCheckThreads, GetArg("-dbcache", nDefaultDbCache), fWarm ? "warm" : "cold") << std::endl;
+        std::cout << "# Run,Seconds,Blocks/s,Inputs/s,Rangeproofs/s" << std::endl;
+        for (int r = 0; r < nRuns && strError.empty(); r++) {
+            InitSignatureCache();
+            CReplayRun run;
+            if (fWarm && !ReplayBlocks(chainparams, vBlocks, vIndex, GetArg("-snapshot", ""), nCoinDBCache, run, strError))
+                break;
+            run = CReplayRun();
+            if (!ReplayBlocks(chainparams, vBlocks, vIndex, GetArg("-snapshot", ""), nCoinDBCache, run, strError))
+                break;
+            const double dSeconds = std::max(run.nMicros, (int64_t)1) * 0.000001;
+            std::cout << strprintf("%d,%.3f,%.1f,%.1f,%.1f", r + 1, dSeconds, run.nBlocks / dSeconds, run.nInputs / dSeconds, run.nRangeProofs / dSeconds) << std::endl;
+        }
+        if (!strError.empty()) {
+            std::cerr << "Error: " << strError << std::endl;
+            nRet = 1;
+        }
+        UnloadBlockIndex();
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    boost::filesystem::remove_all(pathTemp);
+    return nRet;
+}
@@ -0,0 +1,19 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_CONNECTBLOCK_H
+#define BITCOIN_BENCH_CONNECTBLOCK_H
+
+namespace benchmark {
+
+/**
+ * Replay recorded blocks on top of a UTXO snapshot through ConnectBlock and
+ * report the throughput, as configured by -replay and friends (see
+ * connectblock.cpp). Returns the process exit code.
+ */
+int ReplayConnectBlock();
+
+}
+
+#endif // BITCOIN_BENCH_CONNECTBLOCK_H
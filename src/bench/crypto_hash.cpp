@@ -7,6 +7,7 @@
 #include "bench.h"
 #include "bloom.h"
 #include "hash.h"
+#include "consensus/merkle.h"
 #include "uint256.h"
 #include "utiltime.h"
 #include "crypto/ripemd160.h"
@@ -51,6 +52,26 @@ static void SHA256_32b(benchmark::State& state)
     }
 }
 
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        SHA256D64(&in[0], &in[0], 1024);
+    }
+}
+
+static void MerkleRoot_1024(benchmark::State& state)
+{
+    std::vector<uint256> leaves(1024);
+    for (size_t i = 0; i < leaves.size(); i++) {
+        *((uint64_t*)leaves[i].begin()) = i;
+    }
+    while (state.KeepRunning()) {
+        bool mutated;
+        ComputeMerkleRoot(leaves, &mutated);
+    }
+}
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -75,4 +96,6 @@ BENCHMARK(SHA256);
 BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(MerkleRoot_1024);
 BENCHMARK(SipHash_32b);
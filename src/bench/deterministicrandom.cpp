@@ -0,0 +1,25 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "script/interpreter.h"
+#include "script/script.h"
+
+#include <vector>
+
+// One draw from a 32 byte seed, as a contract picking from a wide range does.
+static void DeterministicRandom(benchmark::State& state)
+{
+    const std::vector<unsigned char> vchSeed(32, 0x5a);
+    const CScript script = CScript() << vchSeed << CScriptNum(-1000) << CScriptNum(0x40000001) << OP_DETERMINISTICRANDOM;
+    const BaseSignatureChecker checker;
+    std::vector<std::vector<unsigned char> > stack;
+    while (state.KeepRunning()) {
+        stack.clear();
+        EvalScript(stack, script, 0, checker, SIGVERSION_BASE, NULL);
+    }
+}
+
+BENCHMARK(DeterministicRandom);
@@ -0,0 +1,37 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "utilstrencodings.h"
+
+#include <string>
+#include <vector>
+
+// About the size of a range proof.
+static const size_t HEX_BENCH_BYTES = 5134;
+
+static void HexEncode(benchmark::State& state)
+{
+    std::vector<unsigned char> vch(HEX_BENCH_BYTES);
+    for (size_t i = 0; i < vch.size(); i++)
+        vch[i] = i * 37;
+    while (state.KeepRunning()) {
+        HexStr(vch);
+    }
+}
+
+static void HexDecode(benchmark::State& state)
+{
+    std::vector<unsigned char> vch(HEX_BENCH_BYTES);
+    for (size_t i = 0; i < vch.size(); i++)
+        vch[i] = i * 37;
+    const std::string hex = HexStr(vch);
+    while (state.KeepRunning()) {
+        ParseHex(hex);
+    }
+}
+
+BENCHMARK(HexEncode);
+BENCHMARK(HexDecode);
@@ -0,0 +1,277 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "blind.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "policy/policy.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/sign.h"
+#include "script/sigcache.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "uint256.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <limits>
+#include <list>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+/*
+ * The AcceptToMemoryPool and GetLockedOutputs benchmarks run against the
+ * global chain state: a one-block regtest chain whose UTXO set holds the coins
+ * their transactions spend and the withdraw locks, with the block tree
+ * database in memory. The other benchmarks use a mempool of their own.
+ */
+
+//! Fee paid by the benchmark transactions, well above the minimum relay fee
+static const CAmount BENCH_FEE = 100000;
+//! Transactions accepted before the mempool and caches are reset
+static const int ACCEPT_EXPLICIT_TXS = 5000;
+static const int ACCEPT_BLINDED_TXS = 500;
+//! Confirmed withdraw locks, of 1000 to LOCKS * 1000
+static const int LOCKS = 10000;
+
+static CKey GetBenchKey(unsigned char seed)
+{
+    unsigned char k[32] = {seed, 1, 2, 3};
+    CKey key;
+    key.Set(&k[0], &k[32], true);
+    return key;
+}
+
+struct BenchChainState
+{
+    boost::filesystem::path pathTemp;
+    CCoinsView viewDummy;
+    CBasicKeyStore keystore;
+    CScript scriptPubKey;
+    uint256 genesisLocks;
+    std::vector<CTransactionRef> vExplicitTxs;
+    std::vector<CTransactionRef> vBlindedTxs;
+
+    BenchChainState()
+    {
+        SelectParams(CBaseChainParams::REGTEST, mapArgs);
+
+        // The block tree database, for the locks, goes to a scratch data directory.
+        pathTemp = boost::filesystem::temp_directory_path() / strprintf("bench_mempool_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+        boost::filesystem::create_directories(pathTemp);
+        mapArgs["-datadir"] = pathTemp.string();
+        ClearDatadirCache();
+
+        LOCK(cs_main);
+        pblocktree = new CBlockTreeDB(1 << 20, true);
+        pcoinsTip = new CCoinsViewCache(&viewDummy);
+
+        CBlockIndex* pindex = new CBlockIndex();
+        BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(uint256S("0c"), pindex)).first;
+        pindex->phashBlock = &mi->first;
+        chainActive.SetTip(pindex);
+        pindexBestHeader = pindex;
+        pcoinsTip->SetBestBlock(pindex->GetBlockHash());
+
+        const CKey key = GetBenchKey(1);
+        keystore.AddKey(key);
+        scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+        const CPubKey blindingKey = GetBenchKey(2).GetPubKey();
+
+        int nCoin = 0;
+        for (int i = 0; i < ACCEPT_EXPLICIT_TXS + ACCEPT_BLINDED_TXS; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = COutPoint(AddCoin(++nCoin, CTxOut(COIN, scriptPubKey)), 0);
+            if (i < ACCEPT_EXPLICIT_TXS) {
+                tx.vout.push_back(CTxOut(COIN - BENCH_FEE, scriptPubKey));
+            } else {
+                tx.vout.push_back(CTxOut(COIN / 2, scriptPubKey));
+                tx.vout.push_back(CTxOut(COIN / 2 - BENCH_FEE, scriptPubKey));
+                std::vector<uint256> input_blinds(1);
+                std::vector<uint256> output_blinds(2);
+                std::vector<CPubKey> output_pubkeys(2, blindingKey);
+                assert(BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx));
+            }
+            tx.nTxFee = BENCH_FEE;
+            assert(SignSignature(keystore, scriptPubKey, tx, 0, CTxOutValue(COIN), SIGHASH_ALL));
+            (i < ACCEPT_EXPLICIT_TXS ? vExplicitTxs : vBlindedTxs).push_back(MakeTransactionRef(std::move(tx)));
+        }
+
+        genesisLocks = uint256S("0d");
+        const CScript scriptLock = CScript() << std::vector<unsigned char>(genesisLocks.begin(), genesisLocks.end()) << OP_WITHDRAWPROOFVERIFY;
+        std::multimap<uint256, std::pair<COutPoint, CAmount> > mapLocks;
+        for (int i = 0; i < LOCKS; i++) {
+            const CAmount nValue = (i + 1) * 1000;
+            const COutPoint outpoint(AddCoin(++nCoin, CTxOut(nValue, scriptLock)), 0);
+            mapLocks.insert(std::make_pair(genesisLocks, std::make_pair(outpoint, nValue)));
+        }
+        assert(UpdateLockedOutputs(mapLocks, std::multimap<uint256, std::pair<COutPoint, CAmount> >()));
+    }
+
+    ~BenchChainState()
+    {
+        boost::filesystem::remove_all(pathTemp);
+    }
+
+    //! Add an unspent coin with a single output, returning its txid
+    uint256 AddCoin(int n, const CTxOut& txout)
+    {
+        const uint256 hash = ArithToUint256(n);
+        CCoinsModifier coins = pcoinsTip->ModifyCoins(hash);
+        coins->fCoinBase = false;
+        coins->nVersion = 1;
+        coins->nHeight = 0;
+        coins->vout.assign(1, txout);
+        return hash;
+    }
+};
+
+static BenchChainState& GetBenchChainState()
+{
+    static BenchChainState benchChainState;
+    return benchChainState;
+}
+
+/** Accept vtx into the global mempool, one per iteration. Once all are in, the
+ * mempool and the signature, range proof and transaction validation caches
+ * are emptied and the transactions accepted again, so that each one is
+ * verified in full. */
+static void AcceptTransactions(benchmark::State& state, const std::vector<CTransactionRef>& vtx)
+{
+    LOCK(cs_main);
+    size_t i = vtx.size();
+    while (state.KeepRunning()) {
+        if (i == vtx.size()) {
+            mempool.clear();
+            InitSignatureCache();
+            InitTxValidationCache();
+            i = 0;
+        }
+        CValidationState valstate;
+        assert(AcceptToMemoryPool(mempool, valstate, *vtx[i++], false, NULL));
+    }
+    mempool.clear();
+}
+
+static void MempoolAcceptExplicit(benchmark::State& state)
+{
+    AcceptTransactions(state, GetBenchChainState().vExplicitTxs);
+}
+
+static void MempoolAcceptBlinded(benchmark::State& state)
+{
+    AcceptTransactions(state, GetBenchChainState().vBlindedTxs);
+}
+
+static void LockedOutputs(benchmark::State& state, CAmount nAmount, size_t nExpected)
+{
+    const uint256 genesisLocks = GetBenchChainState().genesisLocks;
+    std::vector<std::pair<COutPoint, CAmount> > res;
+    while (state.KeepRunning()) {
+        assert(GetLockedOutputs(genesisLocks, nAmount, res));
+        assert(res.size() == nExpected);
+    }
+}
+
+// One lock large enough, and the 96 largest locks aggregated.
+static void GetLockedOutputsSingle(benchmark::State& state) { LockedOutputs(state, LOCKS * 1000 / 2, 1); }
+static void GetLockedOutputsAggregate(benchmark::State& state) { LockedOutputs(state, (CAmount)LOCKS * 1000 * 95, 96); }
+
+/** Mempool entries for n transactions in chains of nChainLength, fees varying between them */
+static std::vector<CTxMemPoolEntry> CreateEntries(int n, int nChainLength)
+{
+    std::vector<CTxMemPoolEntry> vEntries;
+    std::set<std::pair<uint256, COutPoint> > setWithdrawsSpent;
+    LockPoints lp;
+    uint256 hashPrev;
+    for (int i = 0; i < n; i++) {
+        const bool fChainStart = i % nChainLength == 0;
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(fChainStart ? ArithToUint256(i + 1) : hashPrev, 0);
+        tx.vin[0].scriptSig = CScript() << OP_TRUE;
+        tx.vout.push_back(CTxOut(COIN, CScript() << OP_TRUE));
+        tx.nTxFee = 1000 + (i * 7919) % 10000;
+        const CTransaction txNew(tx);
+        hashPrev = txNew.GetHash();
+        vEntries.push_back(CTxMemPoolEntry(txNew, tx.nTxFee, 0, 0.0, 1, fChainStart, fChainStart ? COIN : 0, false, 4, lp, setWithdrawsSpent));
+    }
+    return vEntries;
+}
+
+static void MempoolAncestors(benchmark::State& state, int nChainLength)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    std::vector<CTxMemPoolEntry> vEntries = CreateEntries(nChainLength + 1, nChainLength + 1);
+    LOCK(pool.cs);
+    for (int i = 0; i < nChainLength; i++)
+        pool.addUnchecked(vEntries[i].GetTx().GetHash(), vEntries[i]);
+    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    CTxMemPool::setEntries setAncestors;
+    std::string errString;
+    while (state.KeepRunning()) {
+        setAncestors.clear();
+        assert(pool.CalculateMemPoolAncestors(vEntries.back(), setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, errString));
+        assert(setAncestors.size() == (size_t)nChainLength);
+    }
+}
+
+// The default -limitancestorcount, and a chain far beyond it.
+static void MempoolAncestors_25(benchmark::State& state) { MempoolAncestors(state, 25); }
+static void MempoolAncestors_1000(benchmark::State& state) { MempoolAncestors(state, 1000); }
+
+/** Fill a mempool with 1000 transactions, then trim it down in steps. */
+static void MempoolTrimToSize(benchmark::State& state)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    const std::vector<CTxMemPoolEntry> vEntries = CreateEntries(1000, 10);
+    LOCK(pool.cs);
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < vEntries.size(); i++)
+            pool.addUnchecked(vEntries[i].GetTx().GetHash(), vEntries[i]);
+        pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 4);
+        pool.TrimToSize(pool.DynamicMemoryUsage() / 2);
+        pool.TrimToSize(0);
+    }
+}
+
+/** Fill a mempool with 1000 transactions, then remove them all for a block. */
+static void MempoolRemoveForBlock(benchmark::State& state)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    const std::vector<CTxMemPoolEntry> vEntries = CreateEntries(1000, 10);
+    std::vector<CTransactionRef> vtx;
+    for (size_t i = 0; i < vEntries.size(); i++)
+        vtx.push_back(vEntries[i].GetSharedTx());
+    const std::set<std::pair<uint256, COutPoint> > setWithdrawsSpent;
+    std::list<CTransaction> conflicts;
+    LOCK(pool.cs);
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < vEntries.size(); i++)
+            pool.addUnchecked(vEntries[i].GetTx().GetHash(), vEntries[i]);
+        pool.removeForBlock(vtx, 2, setWithdrawsSpent, conflicts);
+        assert(pool.size() == 0);
+    }
+}
+
+BENCHMARK(MempoolAcceptExplicit);
+BENCHMARK(MempoolAcceptBlinded);
+BENCHMARK(GetLockedOutputsSingle);
+BENCHMARK(GetLockedOutputsAggregate);
+BENCHMARK(MempoolAncestors_25);
+BENCHMARK(MempoolAncestors_1000);
+BENCHMARK(MempoolTrimToSize);
+BENCHMARK(MempoolRemoveForBlock);
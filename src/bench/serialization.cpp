@@ -0,0 +1,183 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "blind.h"
+#include "clientversion.h"
+#include "compressor.h"
+#include "key.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "version.h"
+
+#include <vector>
+
+/*
+ * A block shaped like a busy Elements block: a coinbase and BLOCK_TXS
+ * transactions spending two P2PKH inputs into two outputs, every other one
+ * with both outputs blinded. The Bitcoin form of the block has the same
+ * transactions with explicit amounts, as the peg-in proofs of the mainchain
+ * carry them.
+ */
+
+static const int BLOCK_TXS = 250;
+
+struct BenchBlock
+{
+    CBlock block;
+    CBlock blockBitcoin;
+    std::vector<unsigned char> vchBlock;
+    std::vector<unsigned char> vchBlockBitcoin;
+
+    BenchBlock()
+    {
+        unsigned char k[32] = {1, 2, 3, 4};
+        CKey key;
+        key.Set(&k[0], &k[32], true);
+        const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+        // A push of a DER signature and one of a compressed key
+        const CScript scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << ToByteVector(key.GetPubKey());
+
+        block.nVersion = blockBitcoin.nVersion = 4;
+        block.proof = CProof(CScript() << OP_TRUE, CScript());
+
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << 1000 << OP_0;
+        coinbase.vout.push_back(CTxOut(50 * COIN, scriptPubKey));
+        block.vtx.push_back(MakeTransactionRef(CTransaction(coinbase)));
+        blockBitcoin.vtx.push_back(block.vtx.back());
+
+        for (int i = 0; i < BLOCK_TXS; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(2);
+            for (int j = 0; j < 2; j++) {
+                tx.vin[j].prevout = COutPoint(ArithToUint256(2 * i + j + 1), j);
+                tx.vin[j].scriptSig = scriptSig;
+            }
+            tx.vout.push_back(CTxOut(COIN, scriptPubKey));
+            tx.vout.push_back(CTxOut(COIN - 10000, scriptPubKey));
+            tx.nTxFee = 10000;
+            blockBitcoin.vtx.push_back(MakeTransactionRef(CTransaction(tx)));
+            if (i % 2 == 0) {
+                std::vector<uint256> input_blinds(2);
+                std::vector<uint256> output_blinds(2);
+                std::vector<CPubKey> output_pubkeys(2, key.GetPubKey());
+                assert(BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx));
+            }
+            block.vtx.push_back(MakeTransactionRef(CTransaction(tx)));
+        }
+
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+        ssBlock << block;
+        vchBlock.assign(ssBlock.begin(), ssBlock.end());
+        CDataStream ssBlockBitcoin(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX);
+        ssBlockBitcoin << blockBitcoin;
+        vchBlockBitcoin.assign(ssBlockBitcoin.begin(), ssBlockBitcoin.end());
+    }
+};
+
+static const BenchBlock& GetBenchBlock()
+{
+    static const BenchBlock benchBlock;
+    return benchBlock;
+}
+
+static void DeserializeBlock(benchmark::State& state, const std::vector<unsigned char>& vch, int nVersion)
+{
+    CDataStream stream(vch, SER_NETWORK, nVersion);
+    char a = 0;
+    stream.write(&a, 1); // Prevent compaction
+    while (state.KeepRunning()) {
+        CBlock block;
+        stream >> block;
+        assert(stream.Rewind(vch.size()));
+    }
+}
+
+static void DeserializeBlockElements(benchmark::State& state)
+{
+    DeserializeBlock(state, GetBenchBlock().vchBlock, PROTOCOL_VERSION);
+}
+
+static void DeserializeBlockBitcoin(benchmark::State& state)
+{
+    DeserializeBlock(state, GetBenchBlock().vchBlockBitcoin, PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX);
+}
+
+static void SerializeBlock(benchmark::State& state, const CBlock& block, int nVersion)
+{
+    CDataStream stream(SER_NETWORK, nVersion);
+    while (state.KeepRunning()) {
+        stream.clear();
+        stream << block;
+    }
+}
+
+static void SerializeBlockElements(benchmark::State& state)
+{
+    SerializeBlock(state, GetBenchBlock().block, PROTOCOL_VERSION);
+}
+
+static void SerializeBlockBitcoin(benchmark::State& state)
+{
+    SerializeBlock(state, GetBenchBlock().blockBitcoin, PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX);
+}
+
+/** The txids and witness hashes of all transactions in the block, as computed on deserialization */
+static void BlockTransactionHashes(benchmark::State& state)
+{
+    const CBlock& block = GetBenchBlock().block;
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < block.vtx.size(); i++)
+            block.vtx[i]->UpdateHash();
+    }
+}
+
+static void CompressTxOuts(benchmark::State& state)
+{
+    const CBlock& block = GetBenchBlock().block;
+    std::vector<CTxOut> vout;
+    for (size_t i = 0; i < block.vtx.size(); i++)
+        vout.insert(vout.end(), block.vtx[i]->vout.begin(), block.vtx[i]->vout.end());
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    while (state.KeepRunning()) {
+        stream.clear();
+        for (size_t i = 0; i < vout.size(); i++)
+            stream << CTxOutCompressor(vout[i]);
+    }
+}
+
+static void DecompressTxOuts(benchmark::State& state)
+{
+    const CBlock& block = GetBenchBlock().block;
+    std::vector<CTxOut> vout;
+    for (size_t i = 0; i < block.vtx.size(); i++)
+        vout.insert(vout.end(), block.vtx[i]->vout.begin(), block.vtx[i]->vout.end());
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    for (size_t i = 0; i < vout.size(); i++)
+        stream << CTxOutCompressor(vout[i]);
+    const size_t nSize = stream.size();
+    char a = 0;
+    stream.write(&a, 1); // Prevent compaction
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < vout.size(); i++) {
+            CTxOutCompressor compressor(vout[i]);
+            stream >> compressor;
+        }
+        assert(stream.Rewind(nSize));
+    }
+}
+
+BENCHMARK(DeserializeBlockElements);
+BENCHMARK(DeserializeBlockBitcoin);
+BENCHMARK(SerializeBlockElements);
+BENCHMARK(SerializeBlockBitcoin);
+BENCHMARK(BlockTransactionHashes);
+BENCHMARK(CompressTxOuts);
+BENCHMARK(DecompressTxOuts);
@@ -0,0 +1,91 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <string>
+
+#include <univalue.h>
+
+//! A fundrawtransaction-sized request: many inputs and outputs, mostly hex strings and amounts
+static std::string MakeRequest()
+{
+    UniValue inputs(UniValue::VARR);
+    UniValue outputs(UniValue::VOBJ);
+    char buf[65];
+    for (int i = 0; i < 500; i++) {
+        snprintf(buf, sizeof(buf), "%064x", i * 2654435761u);
+        UniValue input(UniValue::VOBJ);
+        input.pushKV("txid", buf);
+        input.pushKV("vout", i % 4);
+        input.pushKV("amount", 0.1234 + i);
+        input.pushKV("blinder", buf);
+        inputs.push_back(input);
+        snprintf(buf, sizeof(buf), "2dcF%030d", i);
+        outputs.pushKV(buf, 1.00000001 * i);
+    }
+    UniValue params(UniValue::VARR);
+    params.push_back(inputs);
+    params.push_back(outputs);
+    UniValue request(UniValue::VOBJ);
+    request.pushKV("method", "createrawtransaction");
+    request.pushKV("params", params);
+    request.pushKV("id", 1);
+    return request.write();
+}
+
+//! A getblock-like reply: one large array of txids
+static std::string MakeReply()
+{
+    UniValue txs(UniValue::VARR);
+    char buf[65];
+    for (int i = 0; i < 4000; i++) {
+        snprintf(buf, sizeof(buf), "%064x", i * 2654435761u);
+        txs.push_back(buf);
+    }
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("hash", buf);
+    result.pushKV("height", 431000);
+    result.pushKV("tx", txs);
+    UniValue reply(UniValue::VOBJ);
+    reply.pushKV("result", result);
+    reply.pushKV("error", NullUniValue);
+    reply.pushKV("id", 1);
+    return reply.write();
+}
+
+static void UniValueReadRequest(benchmark::State& state)
+{
+    const std::string str = MakeRequest();
+    while (state.KeepRunning()) {
+        UniValue val;
+        bool ok = val.read(str);
+        assert(ok);
+    }
+}
+
+static void UniValueReadReply(benchmark::State& state)
+{
+    const std::string str = MakeReply();
+    while (state.KeepRunning()) {
+        UniValue val;
+        bool ok = val.read(str);
+        assert(ok);
+    }
+}
+
+static void UniValueWriteReply(benchmark::State& state)
+{
+    UniValue val;
+    bool ok = val.read(MakeReply());
+    assert(ok);
+    while (state.KeepRunning()) {
+        val.write();
+    }
+}
+
+BENCHMARK(UniValueReadRequest);
+BENCHMARK(UniValueReadReply);
+BENCHMARK(UniValueWriteReply);
@@ -0,0 +1,168 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "blind.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "key.h"
+#include "main.h"
+#include "primitives/transaction.h"
+#include "script/standard.h"
+#include "uint256.h"
+#include "util.h"
+#include "wallet/wallet.h"
+#include "coincontrol.h"
+
+#include <vector>
+
+/*
+ * A wallet that is not backed by a file, holding WALLET_TXS confirmed
+ * transactions that pay one of its keys. One in BLINDED_INTERVAL of them has
+ * a blinded output, the others an explicit one. It is built once, on the
+ * first benchmark that needs it; unblinding its outputs is part of that.
+ */
+
+static const int WALLET_TXS = 100000;
+static const int BLINDED_INTERVAL = 10;
+
+struct BenchWallet
+{
+    CWallet wallet;
+    CKey key;
+    CScript scriptPubKey;
+    //! An output of the wallet's blinded transactions
+    CTxOut blindedOut;
+
+    BenchWallet()
+    {
+        SelectParams(CBaseChainParams::REGTEST, mapArgs);
+
+        // A chain of one block, which all transactions are in
+        CBlockIndex* pindex = new CBlockIndex();
+        BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(uint256S("0b"), pindex)).first;
+        pindex->phashBlock = &mi->first;
+        chainActive.SetTip(pindex);
+
+        LOCK2(cs_main, wallet.cs_wallet);
+        unsigned char k[32] = {1, 2, 3, 4};
+        key.Set(&k[0], &k[32], true);
+        assert(wallet.AddKeyPubKey(key, key.GetPubKey()));
+        wallet.blinding_derivation_key = uint256S("0102030405");
+        scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+        CMutableTransaction blindedTx;
+        blindedTx.vin.resize(1);
+        blindedTx.vout.push_back(CTxOut(12 * COIN, scriptPubKey));
+        std::vector<uint256> input_blinds(1, uint256S("0a"));
+        std::vector<uint256> output_blinds(1);
+        std::vector<CPubKey> output_pubkeys(1, wallet.GetBlindingPubKey(scriptPubKey));
+        assert(BlindOutputs(input_blinds, output_blinds, output_pubkeys, blindedTx));
+        blindedOut = blindedTx.vout[0];
+
+        for (int i = 0; i < WALLET_TXS; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout.hash = ArithToUint256(i + 1);
+            if (i % BLINDED_INTERVAL == 0)
+                tx.vout.push_back(blindedOut);
+            else
+                tx.vout.push_back(CTxOut(COIN + i, scriptPubKey));
+            CWalletTx wtx(&wallet, tx);
+            wtx.hashBlock = pindex->GetBlockHash();
+            wtx.nIndex = i + 1;
+            wtx.nOrderPos = i;
+            wallet.AddToWallet(wtx, true, NULL);
+        }
+        // Unblind everything once, as the wallet would have done when it
+        // received the transactions.
+        wallet.GetBalance();
+    }
+};
+
+static BenchWallet& GetBenchWallet()
+{
+    static BenchWallet benchWallet;
+    return benchWallet;
+}
+
+static void WalletAvailableCoins(benchmark::State& state)
+{
+    CWallet& wallet = GetBenchWallet().wallet;
+    std::vector<COutput> vCoins;
+    while (state.KeepRunning()) {
+        wallet.AvailableCoins(vCoins);
+        assert(vCoins.size() == (size_t)WALLET_TXS);
+    }
+}
+
+static void WalletSelectCoinsMinConf(benchmark::State& state)
+{
+    CWallet& wallet = GetBenchWallet().wallet;
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins);
+    std::set<std::pair<const CWalletTx*, unsigned int> > setCoins;
+    CAmount nValue;
+    LOCK2(cs_main, wallet.cs_wallet);
+    while (state.KeepRunning()) {
+        assert(wallet.SelectCoinsMinConf(50 * COIN + 12345, 1, 6, vCoins, setCoins, nValue));
+    }
+}
+
+static void WalletGetBalance(benchmark::State& state)
+{
+    CWallet& wallet = GetBenchWallet().wallet;
+    while (state.KeepRunning()) {
+        assert(wallet.GetBalance() > 0);
+    }
+}
+
+static void WalletGetBalanceDirty(benchmark::State& state)
+{
+    CWallet& wallet = GetBenchWallet().wallet;
+    while (state.KeepRunning()) {
+        wallet.MarkDirty();
+        assert(wallet.GetBalance() > 0);
+    }
+}
+
+static void WalletCreateBlindedTransaction(benchmark::State& state)
+{
+    BenchWallet& benchWallet = GetBenchWallet();
+    CWallet& wallet = benchWallet.wallet;
+    CRecipient recipient = {benchWallet.scriptPubKey, 30 * COIN, wallet.GetBlindingPubKey(benchWallet.scriptPubKey), false};
+    std::vector<CRecipient> vecSend(1, recipient);
+    CCoinControl coinControl;
+    coinControl.destChange = benchWallet.key.GetPubKey().GetID();
+    LOCK2(cs_main, wallet.cs_wallet);
+    while (state.KeepRunning()) {
+        CWalletTx wtx;
+        CReserveKey reservekey(&wallet);
+        CAmount nFee;
+        int nChangePos = -1;
+        std::string strError;
+        assert(wallet.CreateTransaction(vecSend, wtx, reservekey, nFee, nChangePos, strError, &coinControl));
+    }
+}
+
+static void WalletComputeBlindingData(benchmark::State& state)
+{
+    BenchWallet& benchWallet = GetBenchWallet();
+    CAmount amount;
+    CPubKey pubkey;
+    uint256 blindingfactor;
+    while (state.KeepRunning()) {
+        benchWallet.wallet.ComputeBlindingData(benchWallet.blindedOut, amount, pubkey, blindingfactor);
+        assert(amount == 12 * COIN);
+    }
+}
+
+BENCHMARK(WalletAvailableCoins);
+BENCHMARK(WalletSelectCoinsMinConf);
+BENCHMARK(WalletGetBalance);
+BENCHMARK(WalletGetBalanceDirty);
+BENCHMARK(WalletCreateBlindedTransaction);
+BENCHMARK(WalletComputeBlindingData);
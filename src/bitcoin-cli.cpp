@@ -21,6 +21,8 @@
 
 using namespace std;
 
+static const int DEFAULT_BATCHSIZE = 1;
+
 std::string HelpMessageCli()
 {
     const boost::scoped_ptr<CBaseChainParams> defaultBaseParams(CBaseChainParams::Factory(CBaseChainParams::MAIN));
@@ -37,6 +39,8 @@ std::string HelpMessageCli()
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcclienttimeout=<n>", strprintf(_("Timeout during HTTP requests (default: %d)"), DEFAULT_HTTP_CLIENT_TIMEOUT));
     strUsage += HelpMessageOpt("-stdin", _("Read extra arguments from standard input, one per line until EOF/Ctrl-D (recommended for sensitive information such as passphrases)"));
+    strUsage += HelpMessageOpt("-batch", _("Read commands from standard input, one per line with their arguments, and send them all over one connection, printing each result as it arrives"));
+    strUsage += HelpMessageOpt("-batchsize=<n>", strprintf(_("With -batch, send up to <n> commands at a time as one JSON-RPC batch (default: %u)"), DEFAULT_BATCHSIZE));
 
     return strUsage;
 }
@@ -58,7 +62,8 @@ static bool AppInitRPC(int argc, char* argv[])
             strUsage += "\n" + _("Usage:") + "\n" +
                   "  bitcoin-cli [options] <command> [params]  " + strprintf(_("Send command to %s"), _(PACKAGE_NAME)) + "\n" +
                   "  bitcoin-cli [options] help                " + _("List commands") + "\n" +
-                  "  bitcoin-cli [options] help <command>      " + _("Get help for a command") + "\n";
+                  "  bitcoin-cli [options] help <command>      " + _("Get help for a command") + "\n" +
+                  "  bitcoin-cli [options] -batch < <file>     " + _("Send each line of <file> as a command") + "\n";
 
             strUsage += "\n" + HelpMessageCli();
         }
@@ -91,11 +96,175 @@ static bool AppInitRPC(int argc, char* argv[])
     return true;
 }
 
+/** Turn a reply into what to print; returns the exit code for it */
+static int FormatReply(const UniValue& reply, std::string& strPrint)
+{
+    const UniValue& result = find_value(reply, "result");
+    const UniValue& error  = find_value(reply, "error");
+
+    if (!error.isNull()) {
+        // Error
+        int code = error["code"].get_int();
+        strPrint = "error: " + error.write();
+        if (error.isObject())
+        {
+            UniValue errCode = find_value(error, "code");
+            UniValue errMsg  = find_value(error, "message");
+            strPrint = errCode.isNull() ? "" : "error code: "+errCode.getValStr()+"\n";
+
+            if (errMsg.isStr())
+                strPrint += "error message:\n"+errMsg.get_str();
+        }
+        return abs(code);
+    }
+
+    // Result
+    if (result.isNull())
+        strPrint = "";
+    else if (result.isStr())
+        strPrint = result.get_str();
+    else
+        strPrint = result.write(2);
+    return 0;
+}
+
+static bool IsWarmupReply(const UniValue& reply)
+{
+    const UniValue& error = find_value(reply, "error");
+    return error.isObject() && find_value(error, "code").isNum() && find_value(error, "code").get_int() == RPC_IN_WARMUP;
+}
+
+/**
+ * Split a -batch line into a command and its arguments at whitespace.
+ * Single or double quotes keep an argument with spaces, a JSON one say,
+ * together; a backslash escapes the next character.
+ */
+static std::vector<std::string> SplitBatchLine(const std::string& strLine)
+{
+    std::vector<std::string> args;
+    std::string strArg;
+    bool fInArg = false;
+    char chQuote = 0;
+    for (size_t i = 0; i < strLine.size(); i++) {
+        const char ch = strLine[i];
+        if (ch == '\\' && i + 1 < strLine.size()) {
+            strArg += strLine[++i];
+            fInArg = true;
+        } else if (chQuote) {
+            if (ch == chQuote)
+                chQuote = 0;
+            else
+                strArg += ch;
+        } else if (ch == '"' || ch == '\'') {
+            chQuote = ch;
+            fInArg = true;
+        } else if (isspace((unsigned char)ch)) {
+            if (fInArg)
+                args.push_back(strArg);
+            strArg.clear();
+            fInArg = false;
+        } else {
+            strArg += ch;
+            fInArg = true;
+        }
+    }
+    if (chQuote)
+        throw runtime_error("unterminated quote");
+    if (fInArg)
+        args.push_back(strArg);
+    return args;
+}
+
+/** A command read in -batch mode, or why it could not be parsed */
+struct CBatchCommand
+{
+    std::string strMethod;
+    UniValue params;
+    std::string strError;
+};
+
+/**
+ * Send the commands read from stdin over one keep-alive connection, up to
+ * -batchsize of them per JSON-RPC batch, printing the results in order as
+ * they come in. The exit code is that of the first command that failed.
+ */
+static int BatchCommandLineRPC()
+{
+    if (GetBoolArg("-stdin", false))
+        throw runtime_error("-batch and -stdin cannot be used together");
+    SetRPCKeepAlive(true);
+    const size_t nBatchSize = std::max((int64_t)1, GetArg("-batchsize", DEFAULT_BATCHSIZE));
+    const bool fWait = GetBoolArg("-rpcwait", false);
+
+    int nRet = 0;
+    bool fEOF = false;
+    while (!fEOF) {
+        std::vector<CBatchCommand> vCommands;
+        std::vector<std::pair<std::string, UniValue> > vRequests;
+        std::string strLine;
+        while (vRequests.size() < nBatchSize) {
+            if (!std::getline(std::cin, strLine)) {
+                fEOF = true;
+                break;
+            }
+            CBatchCommand command;
+            try {
+                std::vector<std::string> args = SplitBatchLine(strLine);
+                if (args.empty() || args[0][0] == '#')
+                    continue;
+                command.strMethod = args[0];
+                command.params = RPCConvertValues(args[0], std::vector<std::string>(args.begin() + 1, args.end()));
+                vRequests.push_back(std::make_pair(command.strMethod, command.params));
+            } catch (const std::exception& e) {
+                command.strError = string("error: ") + e.what();
+            }
+            vCommands.push_back(command);
+        }
+
+        UniValue replies(UniValue::VARR);
+        while (!vRequests.empty()) {
+            try {
+                if (vRequests.size() == 1) {
+                    replies.push_back(CallRPC(vRequests[0].first, vRequests[0].second));
+                } else {
+                    replies = CallRPCBatch(vRequests);
+                }
+                if (fWait && replies.size() > 0 && IsWarmupReply(replies[0]))
+                    throw CConnectionFailed("server in warmup");
+                break;
+            } catch (const CConnectionFailed&) {
+                if (!fWait)
+                    throw;
+                replies = UniValue(UniValue::VARR);
+                MilliSleep(1000);
+            }
+        }
+
+        size_t nReply = 0;
+        for (size_t i = 0; i < vCommands.size(); i++) {
+            std::string strPrint = vCommands[i].strError;
+            int nCode = EXIT_FAILURE;
+            if (strPrint.empty())
+                nCode = FormatReply(replies[nReply++], strPrint);
+            if (nRet == 0)
+                nRet = nCode;
+            if (strPrint != "")
+                fprintf((nCode == 0 ? stdout : stderr), "%s\n", strPrint.c_str());
+        }
+        fflush(stdout);
+        fflush(stderr);
+    }
+    return nRet;
+}
+
 int CommandLineRPC(int argc, char *argv[])
 {
     string strPrint;
     int nRet = 0;
     try {
+        if (GetBoolArg("-batch", false))
+            return BatchCommandLineRPC();
+
         // Skip switches
         while (argc > 1 && IsSwitchChar(argv[1][0])) {
             argc--;
@@ -118,36 +287,11 @@ int CommandLineRPC(int argc, char *argv[])
         do {
             try {
                 const UniValue reply = CallRPC(strMethod, params);
+                if (fWait && IsWarmupReply(reply))
+                    throw CConnectionFailed("server in warmup");
 
                 // Parse reply
-                const UniValue& result = find_value(reply, "result");
-                const UniValue& error  = find_value(reply, "error");
-
-                if (!error.isNull()) {
-                    // Error
-                    int code = error["code"].get_int();
-                    if (fWait && code == RPC_IN_WARMUP)
-                        throw CConnectionFailed("server in warmup");
-                    strPrint = "error: " + error.write();
-                    nRet = abs(code);
-                    if (error.isObject())
-                    {
-                        UniValue errCode = find_value(error, "code");
-                        UniValue errMsg  = find_value(error, "message");
-                        strPrint = errCode.isNull() ? "" : "error code: "+errCode.getValStr()+"\n";
-
-                        if (errMsg.isStr())
-                            strPrint += "error message:\n"+errMsg.get_str();
-                    }
-                } else {
-                    // Result
-                    if (result.isNull())
-                        strPrint = "";
-                    else if (result.isStr())
-                        strPrint = result.get_str();
-                    else
-                        strPrint = result.write(2);
-                }
+                nRet = FormatReply(reply, strPrint);
                 // Connection succeeded, no need to retry.
                 break;
             }
@@ -12,6 +12,7 @@
 #include "coins.h"
 #include "consensus/consensus.h"
 #include "core_io.h"
+#include "eccontext.h"
 #include "keystore.h"
 #include "merkleblock.h"
 #include "policy/policy.h"
@@ -25,15 +26,21 @@
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
+#include <iostream>
 #include <stdio.h>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/assign/list_of.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 
 static bool fCreateBlank;
-static map<string,UniValue> registers;
+
+/** Lines of -batch input handed to each thread at a time */
+static const size_t BATCH_LINES_PER_THREAD = 16;
 
 static bool AppInitRawTx(int argc, char* argv[])
 {
@@ -59,12 +66,15 @@ static bool AppInitRawTx(int argc, char* argv[])
             _("Usage:") + "\n" +
               "  elements-tx [options] <hex-tx> [commands]  " + _("Update hex-encoded bitcoin transaction") + "\n" +
               "  elements-tx [options] -create [commands]   " + _("Create hex-encoded bitcoin transaction") + "\n" +
+              "  elements-tx [options] -batch               " + _("Update or create one transaction per line of standard input") + "\n" +
               "\n";
 
         fprintf(stdout, "%s", strUsage.c_str());
 
         strUsage = HelpMessageGroup(_("Options:"));
         strUsage += HelpMessageOpt("-?", _("This help message"));
+        strUsage += HelpMessageOpt("-batch", _("Read the arguments that would follow the options, separated by spaces, from each line of standard input, and write the resultant transaction or an error for each to a line of standard output, in the same order. Registers are set per line."));
+        strUsage += HelpMessageOpt("-batchthreads=<n>", strprintf(_("Number of threads that process -batch lines (default: %u, the number of cores)"), GetNumCores()));
         strUsage += HelpMessageOpt("-create", _("Create new, empty TX."));
         strUsage += HelpMessageOpt("-json", _("Select JSON output"));
         strUsage += HelpMessageOpt("-txid", _("Output only the hex-encoded transaction id of the resultant transaction."));
@@ -99,7 +109,7 @@ static bool AppInitRawTx(int argc, char* argv[])
     return true;
 }
 
-static void RegisterSetJson(const string& key, const string& rawJson)
+static void RegisterSetJson(map<string,UniValue>& registers, const string& key, const string& rawJson)
 {
     UniValue val;
     if (!val.read(rawJson)) {
@@ -110,7 +120,7 @@ static void RegisterSetJson(const string& key, const string& rawJson)
     registers[key] = val;
 }
 
-static void RegisterSet(const string& strInput)
+static void RegisterSet(map<string,UniValue>& registers, const string& strInput)
 {
     // separate NAME:VALUE in string
     size_t pos = strInput.find(':');
@@ -122,10 +132,10 @@ static void RegisterSet(const string& strInput)
     string key = strInput.substr(0, pos);
     string valStr = strInput.substr(pos + 1, string::npos);
 
-    RegisterSetJson(key, valStr);
+    RegisterSetJson(registers, key, valStr);
 }
 
-static void RegisterLoad(const string& strInput)
+static void RegisterLoad(map<string,UniValue>& registers, const string& strInput)
 {
     // separate NAME:FILENAME in string
     size_t pos = strInput.find(':');
@@ -163,7 +173,7 @@ static void RegisterLoad(const string& strInput)
     }
 
     // evaluate as JSON buffer register
-    RegisterSetJson(key, valStr);
+    RegisterSetJson(registers, key, valStr);
 }
 
 static void MutateTxVersion(CMutableTransaction& tx, const string& cmdVal)
@@ -253,7 +263,7 @@ static void MutateTxAddOutAddr(CMutableTransaction& tx, const string& strInput)
     CTxOut txout(value, scriptPubKey);
     if (addr.IsBlinded()) {
         CPubKey pubkey = addr.GetBlindingKey();
-        txout.nValue.vchNonceCommitment = std::vector<unsigned char>(pubkey.begin(), pubkey.end());
+        txout.nValue.vchNonceCommitment.assign(pubkey.begin(), pubkey.end());
     }
     tx.vout.push_back(txout);
     tx.nTxFee -= value;
@@ -318,7 +328,7 @@ static void MutateTxBlind(CMutableTransaction& tx, const string& strInput)
         if (tx.vout[nOut].nValue.vchNonceCommitment.size() == 0) {
             output_pubkeys.push_back(CPubKey());
         } else {
-            CPubKey pubkey(tx.vout[nOut].nValue.vchNonceCommitment);
+            CPubKey pubkey(tx.vout[nOut].nValue.vchNonceCommitment.begin(), tx.vout[nOut].nValue.vchNonceCommitment.end());
             if (!pubkey.IsValid()) {
                  throw runtime_error("Invalid parameter: invalid confidentiality public key given");
             }
@@ -443,7 +453,7 @@ static CAmount AmountFromValue(const UniValue& value)
     return amount;
 }
 
-static void MutateTxSign(CMutableTransaction& tx, const string& flagStr)
+static void MutateTxSign(CMutableTransaction& tx, const string& flagStr, map<string,UniValue>& registers)
 {
     int nHashType = SIGHASH_ALL;
 
@@ -569,7 +579,7 @@ static void MutateTxSign(CMutableTransaction& tx, const string& flagStr)
     tx = mergedTx;
 }
 
-static void MutateTxPeginSign(CMutableTransaction& tx, const string& flagStr)
+static void MutateTxPeginSign(CMutableTransaction& tx, const string& flagStr, map<string,UniValue>& registers)
 {
     if (!registers.count("peginkeys"))
         throw runtime_error("peginkeys register variable must be set.");
@@ -633,11 +643,14 @@ public:
     }
 };
 
+/**
+ * Apply one command to tx. The secp256k1 contexts are started in ecc on
+ * first need and kept for the caller's later commands.
+ */
 static void MutateTx(CMutableTransaction& tx, const string& command,
-                     const string& commandVal)
+                     const string& commandVal, map<string,UniValue>& registers,
+                     boost::scoped_ptr<Secp256k1Init>& ecc)
 {
-    boost::scoped_ptr<Secp256k1Init> ecc;
-
     if (command == "nversion")
         MutateTxVersion(tx, commandVal);
     else if (command == "locktime")
@@ -659,54 +672,57 @@ static void MutateTx(CMutableTransaction& tx, const string& command,
 
     else if (command == "sign") {
         if (!ecc) { ecc.reset(new Secp256k1Init()); }
-        MutateTxSign(tx, commandVal);
+        MutateTxSign(tx, commandVal, registers);
     } else if (command == "blind") {
         if (!ecc) { ecc.reset(new Secp256k1Init()); }
         MutateTxBlind(tx, commandVal);
     } else if (command == "peginsign")
-        MutateTxPeginSign(tx, commandVal);
+        MutateTxPeginSign(tx, commandVal, registers);
 
     else if (command == "load")
-        RegisterLoad(commandVal);
+        RegisterLoad(registers, commandVal);
 
     else if (command == "set")
-        RegisterSet(commandVal);
+        RegisterSet(registers, commandVal);
 
     else
         throw runtime_error("unknown command");
 }
 
-static void OutputTxJSON(const CTransaction& tx)
+static string FormatTxJSON(const CTransaction& tx, unsigned int prettyIndent)
 {
     UniValue entry(UniValue::VOBJ);
     TxToUniv(tx, uint256(), entry);
 
-    string jsonOutput = entry.write(4);
-    fprintf(stdout, "%s\n", jsonOutput.c_str());
+    return entry.write(prettyIndent);
 }
 
-static void OutputTxHash(const CTransaction& tx)
+static string FormatTxHash(const CTransaction& tx)
 {
-    string strHexHash = tx.GetHash().GetHex(); // the hex-encoded transaction hash (aka the transaction id)
-
-    fprintf(stdout, "%s\n", strHexHash.c_str());
+    return tx.GetHash().GetHex(); // the hex-encoded transaction hash (aka the transaction id)
 }
 
-static void OutputTxHex(const CTransaction& tx)
+static string FormatTxHex(const CTransaction& tx)
 {
-    string strHex = EncodeHexTx(tx);
-
-    fprintf(stdout, "%s\n", strHex.c_str());
+    return EncodeHexTx(tx);
 }
 
-static void OutputTx(const CTransaction& tx)
+/** The resultant transaction, as selected by -json and -txid */
+static string FormatTx(const CTransaction& tx, unsigned int prettyIndent)
 {
     if (GetBoolArg("-json", false))
-        OutputTxJSON(tx);
+        return FormatTxJSON(tx, prettyIndent);
     else if (GetBoolArg("-txid", false))
-        OutputTxHash(tx);
+        return FormatTxHash(tx);
     else
-        OutputTxHex(tx);
+        return FormatTxHex(tx);
+}
+
+static void OutputTx(const CTransaction& tx)
+{
+    string strOutput = FormatTx(tx, 4);
+
+    fprintf(stdout, "%s\n", strOutput.c_str());
 }
 
 static string readStdin()
@@ -729,6 +745,48 @@ static string readStdin()
     return ret;
 }
 
+/**
+ * Build the transaction that args, the arguments after the options, describe:
+ * the hex-encoded transaction unless -create is given, then the commands.
+ */
+static CMutableTransaction ProcessRawTx(const vector<string>& args, map<string,UniValue>& registers,
+                                        boost::scoped_ptr<Secp256k1Init>& ecc)
+{
+    CTransaction txDecodeTmp;
+    size_t startArg;
+
+    if (!fCreateBlank) {
+        // require at least one param
+        if (args.empty() || args[0].empty())
+            throw runtime_error("too few parameters");
+
+        // param: hex-encoded bitcoin transaction
+        if (!DecodeHexTx(txDecodeTmp, args[0]))
+            throw runtime_error("invalid transaction encoding");
+
+        startArg = 1;
+    } else
+        startArg = 0;
+
+    CMutableTransaction tx(txDecodeTmp);
+
+    for (size_t i = startArg; i < args.size(); i++) {
+        const string& arg = args[i];
+        string key, value;
+        size_t eqpos = arg.find('=');
+        if (eqpos == string::npos)
+            key = arg;
+        else {
+            key = arg.substr(0, eqpos);
+            value = arg.substr(eqpos + 1);
+        }
+
+        MutateTx(tx, key, value, registers, ecc);
+    }
+
+    return tx;
+}
+
 static int CommandLineRawTx(int argc, char* argv[])
 {
     string strPrint;
@@ -741,41 +799,13 @@ static int CommandLineRawTx(int argc, char* argv[])
             argv++;
         }
 
-        CTransaction txDecodeTmp;
-        int startArg;
-
-        if (!fCreateBlank) {
-            // require at least one param
-            if (argc < 2)
-                throw runtime_error("too few parameters");
-
-            // param: hex-encoded bitcoin transaction
-            string strHexTx(argv[1]);
-            if (strHexTx == "-")                 // "-" implies standard input
-                strHexTx = readStdin();
-
-            if (!DecodeHexTx(txDecodeTmp, strHexTx))
-                throw runtime_error("invalid transaction encoding");
-
-            startArg = 2;
-        } else
-            startArg = 1;
-
-        CMutableTransaction tx(txDecodeTmp);
-
-        for (int i = startArg; i < argc; i++) {
-            string arg = argv[i];
-            string key, value;
-            size_t eqpos = arg.find('=');
-            if (eqpos == string::npos)
-                key = arg;
-            else {
-                key = arg.substr(0, eqpos);
-                value = arg.substr(eqpos + 1);
-            }
+        vector<string> args(argv + 1, argv + argc);
+        if (!fCreateBlank && !args.empty() && args[0] == "-") // "-" implies standard input
+            args[0] = readStdin();
 
-            MutateTx(tx, key, value);
-        }
+        map<string,UniValue> registers;
+        boost::scoped_ptr<Secp256k1Init> ecc;
+        CMutableTransaction tx = ProcessRawTx(args, registers, ecc);
 
         OutputTx(tx);
     }
@@ -798,6 +828,88 @@ static int CommandLineRawTx(int argc, char* argv[])
     return nRet;
 }
 
+/** Process one line of -batch input into strResult, the line to output */
+static bool ProcessBatchLine(const string& strLine, string& strResult, boost::scoped_ptr<Secp256k1Init>& ecc)
+{
+    string strArgs = boost::algorithm::trim_copy(strLine);
+    vector<string> args;
+    if (!strArgs.empty())
+        boost::split(args, strArgs, boost::is_any_of(" \t"), boost::token_compress_on);
+
+    try {
+        // Every line starts from empty registers
+        map<string,UniValue> registers;
+        CMutableTransaction tx = ProcessRawTx(args, registers, ecc);
+        strResult = FormatTx(tx, 0);
+        return true;
+    } catch (const boost::thread_interrupted&) {
+        throw;
+    } catch (const std::exception& e) {
+        strResult = string("error: ") + e.what();
+        return false;
+    }
+}
+
+static void ProcessBatchLines(const vector<string>& vLines, vector<string>& vResults, vector<int>& vRet, std::atomic<size_t>& nNext,
+                              boost::scoped_ptr<Secp256k1Init>& ecc)
+{
+    for (size_t i = nNext++; i < vLines.size(); i = nNext++) {
+        vRet[i] = ProcessBatchLine(vLines[i], vResults[i], ecc) ? 0 : EXIT_FAILURE;
+    }
+}
+
+/**
+ * Process standard input a line at a time, as if each line were the
+ * arguments of a separate invocation, without paying for process startup
+ * and the secp256k1 tables each time. Lines are processed in parallel, a
+ * chunk at a time, and their results written in input order.
+ */
+static int BatchRawTx()
+{
+    const size_t nThreads = std::max((int)GetArg("-batchthreads", GetNumCores()), 1);
+
+    // Keep the signing, verification and blinding contexts warm for all
+    // lines. Commands only start them when they are not there yet, so the
+    // threads never do.
+    boost::scoped_ptr<Secp256k1Init> ecc(new Secp256k1Init());
+    ECC_GetContext();
+
+    int nRet = 0;
+    bool fEOF = false;
+    while (!fEOF) {
+        vector<string> vLines;
+        string strLine;
+        while (vLines.size() < nThreads * BATCH_LINES_PER_THREAD) {
+            if (!std::getline(std::cin, strLine)) {
+                fEOF = true;
+                break;
+            }
+            vLines.push_back(strLine);
+        }
+        if (vLines.empty())
+            break;
+
+        vector<string> vResults(vLines.size());
+        vector<int> vRet(vLines.size(), 0);
+        std::atomic<size_t> nNext(0);
+        boost::thread_group threads;
+        for (size_t i = 1; i < std::min(nThreads, vLines.size()); i++) {
+            threads.create_thread(boost::bind(&ProcessBatchLines, boost::cref(vLines), boost::ref(vResults), boost::ref(vRet), boost::ref(nNext), boost::ref(ecc)));
+        }
+        ProcessBatchLines(vLines, vResults, vRet, nNext, ecc);
+        threads.join_all();
+
+        for (size_t i = 0; i < vLines.size(); i++) {
+            fprintf(stdout, "%s\n", vResults[i].c_str());
+            if (vRet[i] != 0)
+                nRet = EXIT_FAILURE;
+        }
+        fflush(stdout);
+    }
+
+    return nRet;
+}
+
 int main(int argc, char* argv[])
 {
     SetupEnvironment();
@@ -816,7 +928,10 @@ int main(int argc, char* argv[])
 
     int ret = EXIT_FAILURE;
     try {
-        ret = CommandLineRawTx(argc, argv);
+        if (GetBoolArg("-batch", false))
+            ret = BatchRawTx();
+        else
+            ret = CommandLineRawTx(argc, argv);
     }
     catch (const std::exception& e) {
         PrintExceptionContinue(&e, "CommandLineRawTx()");
@@ -1,55 +1,51 @@
 #include "blind.h"
 
+#include "eccontext.h"
 #include "hash.h"
 #include "primitives/transaction.h"
 #include "random.h"
+#include "support/cleanse.h"
 #include "util.h"
+#include "utilmoneystr.h"
 
 #include <secp256k1.h>
 #include <secp256k1_rangeproof.h>
 
-static secp256k1_context* secp256k1_blind_context = NULL;
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
-class Blind_ECC_Init {
-public:
-    Blind_ECC_Init() {
-        assert(secp256k1_blind_context == NULL);
-
-        secp256k1_context *ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN | SECP256K1_CONTEXT_VERIFY);
-        assert(ctx != NULL);
-        secp256k1_pedersen_context_initialize(ctx);
-        secp256k1_rangeproof_context_initialize(ctx);
-
-        secp256k1_blind_context = ctx;
-    }
-
-    ~Blind_ECC_Init() {
-        secp256k1_context *ctx = secp256k1_blind_context;
-        secp256k1_blind_context = NULL;
-
-        if (ctx) {
-            secp256k1_context_destroy(ctx);
-        }
-    }
-};
-
-static Blind_ECC_Init ecc_init_on_load;
+CRangeProofSettings GetRangeProofSettings()
+{
+    CRangeProofSettings settings;
+    settings.nExponent = std::min(std::max((int)GetArg("-ct_exponent", DEFAULT_CT_EXPONENT), -1), 18);
+    settings.nMinBits = std::min(std::max((int)GetArg("-ct_bits", DEFAULT_CT_BITS), 1), MAX_CT_BITS);
+    if (mapArgs.count("-ct_minvalue") && (!ParseMoney(mapArgs["-ct_minvalue"], settings.nMinValue) || !MoneyRange(settings.nMinValue)))
+        settings.nMinValue = 0;
+    return settings;
+}
 
 bool UnblindOutput(const CKey &key, const CTxOut& txout, CAmount& amount_out, uint256& blinding_factor_out)
 {
     if (!key.IsValid()) {
         return false;
     }
-    CPubKey ephemeral_key(txout.nValue.vchNonceCommitment);
+    CPubKey ephemeral_key(txout.nValue.vchNonceCommitment.begin(), txout.nValue.vchNonceCommitment.end());
     if (!ephemeral_key.IsValid()) {
         return false;
     }
     uint256 nonce = key.ECDH(ephemeral_key);
     CSHA256().Write(nonce.begin(), 32).Finalize(nonce.begin());
+    // Most outputs we try are not ours; reject those before paying for the
+    // verification a rewind starts with.
+    if (txout.nValue.vchRangeproof.empty() || !secp256k1_rangeproof_rewind_precheck(ECC_GetContext(), nonce.begin(), &txout.nValue.vchCommitment[0], &txout.nValue.vchRangeproof[0], txout.nValue.vchRangeproof.size())) {
+        amount_out = 0;
+        blinding_factor_out = uint256();
+        return false;
+    }
     unsigned char msg[4096];
-    int msg_size;
+    int msg_size = 0;
     uint64_t min_value, max_value, amount;
-    int res = secp256k1_rangeproof_rewind(secp256k1_blind_context, blinding_factor_out.begin(), &amount, msg, &msg_size, nonce.begin(), &min_value, &max_value, &txout.nValue.vchCommitment[0], &txout.nValue.vchRangeproof[0], txout.nValue.vchRangeproof.size());
+    int res = secp256k1_rangeproof_rewind(ECC_GetContext(), blinding_factor_out.begin(), &amount, msg, &msg_size, nonce.begin(), &min_value, &max_value, &txout.nValue.vchCommitment[0], &txout.nValue.vchRangeproof[0], txout.nValue.vchRangeproof.size());
     if (!res || amount > (uint64_t)MAX_MONEY || !MoneyRange((CAmount)amount)) {
         amount_out = 0;
         blinding_factor_out = uint256();
@@ -60,8 +56,62 @@ bool UnblindOutput(const CKey &key, const CTxOut& txout, CAmount& amount_out, ui
     }
 }
 
-bool BlindOutputs(const std::vector<uint256 >& input_blinding_factors, std::vector<uint256 >& output_blinding_factors, const std::vector<CPubKey>& output_pubkeys, CMutableTransaction& tx)
+namespace {
+
+/** A range proof to be created by BlindOutputs */
+struct CRangeProofJob
 {
+    CTxOutValue* pvalue;
+    const unsigned char* pblind;
+    uint256 nonce;
+    CAmount amount;
+    bool fSigned;
+
+    CRangeProofJob(CTxOutValue& value, const unsigned char* pblindIn, const uint256& nonceIn, CAmount amountIn) :
+        pvalue(&value), pblind(pblindIn), nonce(nonceIn), amount(amountIn), fSigned(false) {}
+};
+
+/** Create the proofs of jobs nStart, nStart + nStride, nStart + 2 * nStride, ... */
+void SignRangeProofs(std::vector<CRangeProofJob>& jobs, size_t nStart, size_t nStride, const CRangeProofSettings& settings)
+{
+    for (size_t i = nStart; i < jobs.size(); i += nStride) {
+        CRangeProofJob& job = jobs[i];
+        CTxOutValue& value = *job.pvalue;
+        int nRangeProofLen = 5134;
+        // A minimum above the amount cannot be proven.
+        uint64_t nMinValue = job.amount >= settings.nMinValue ? settings.nMinValue : 0;
+        value.vchRangeproof.resize(nRangeProofLen);
+        job.fSigned = secp256k1_rangeproof_sign(ECC_GetContext(), &value.vchRangeproof[0], &nRangeProofLen, nMinValue, &value.vchCommitment[0], job.pblind, job.nonce.begin(), settings.nExponent, settings.nMinBits, job.amount);
+        value.vchRangeproof.resize(nRangeProofLen);
+    }
+}
+
+/**
+ * Create the proofs of all jobs. Each proof takes milliseconds, so large
+ * transactions spread them over all cores. Every job writes only its own
+ * output, and the proofs are deterministic given the nonce, so the result
+ * does not depend on how the jobs were divided.
+ */
+void CreateRangeProofs(std::vector<CRangeProofJob>& jobs, const CRangeProofSettings& settings)
+{
+    const size_t nThreads = std::min(jobs.size(), (size_t)std::max(GetNumCores(), 1));
+    boost::thread_group threads;
+    for (size_t i = 1; i < nThreads; i++) {
+        threads.create_thread(boost::bind(&SignRangeProofs, boost::ref(jobs), i, nThreads, boost::cref(settings)));
+    }
+    SignRangeProofs(jobs, 0, nThreads, settings);
+    threads.join_all();
+    for (size_t i = 0; i < jobs.size(); i++) {
+        // TODO: do something smarter here
+        assert(jobs[i].fSigned);
+    }
+}
+
+}
+
+bool BlindOutputs(const std::vector<uint256 >& input_blinding_factors, std::vector<uint256 >& output_blinding_factors, const std::vector<CPubKey>& output_pubkeys, CMutableTransaction& tx, const CRangeProofSettings& settings)
+{
+    assert(settings.IsValid());
     assert(tx.vout.size() == output_blinding_factors.size());
     assert(tx.vout.size() == output_pubkeys.size());
     assert(tx.vin.size() == input_blinding_factors.size());
@@ -99,7 +149,7 @@ bool BlindOutputs(const std::vector<uint256 >& input_blinding_factors, std::vect
     if (nToBlind == 0) {
         unsigned char diff[32];
         // If there is no place to put a blinding factor anymore, the existing input blinding factors must equal the outputs
-        bool ret = secp256k1_pedersen_blind_sum(secp256k1_blind_context, diff, &blindptrs[0], nBlindsOut + nBlindsIn, nBlindsIn);
+        bool ret = secp256k1_pedersen_blind_sum(ECC_GetContext(), diff, &blindptrs[0], nBlindsOut + nBlindsIn, nBlindsIn);
         assert(ret);
         if (memcmp(diff_zero, diff, 32)) {
             return false;
@@ -109,20 +159,23 @@ bool BlindOutputs(const std::vector<uint256 >& input_blinding_factors, std::vect
     //Running total of newly blinded outputs
     int nBlinded = 0;
     unsigned char blind[tx.vout.size()][32];
+    std::vector<CRangeProofJob> jobs;
 
     for (size_t nOut = 0; nOut < tx.vout.size(); nOut++) {
         if (tx.vout[nOut].nValue.IsAmount() && output_pubkeys[nOut].IsValid()) {
             assert(output_pubkeys[nOut].IsValid());
             if (nBlinded + 1 == nToBlind) {
                 // Last to-be-blinded value: compute from all other blinding factors.
-                assert(secp256k1_pedersen_blind_sum(secp256k1_blind_context, &blind[nBlinded][0], &blindptrs[0], nBlindsOut + nBlindsIn, nBlindsIn));
+                assert(secp256k1_pedersen_blind_sum(ECC_GetContext(), &blind[nBlinded][0], &blindptrs[0], nBlindsOut + nBlindsIn, nBlindsIn));
                 // Never permit producting a blinding factor 0, but insist a new output is added.
                 if (memcmp(diff_zero, &blind[nBlinded][0], 32) == 0) {
+                    // The outputs blinded so far stay blinded when the caller retries.
+                    CreateRangeProofs(jobs, settings);
                     return false;
                 }
                 blindptrs.push_back(&blind[nBlinded++][0]);
             } else {
-                GetRandBytes(&blind[nBlinded][0], 32);
+                GetFastRandBytes(&blind[nBlinded][0], 32);
                 blindptrs.push_back(&blind[nBlinded++][0]);
             }
             output_blinding_factors[nOut] = uint256(std::vector<unsigned char>(blindptrs[blindptrs.size()-1], blindptrs[blindptrs.size()-1]+32));
@@ -130,26 +183,26 @@ bool BlindOutputs(const std::vector<uint256 >& input_blinding_factors, std::vect
             // Create blinded value
             CTxOutValue& value = tx.vout[nOut].nValue;
             CAmount amount = value.GetAmount();
-            assert(secp256k1_pedersen_commit(secp256k1_blind_context, &value.vchCommitment[0], (unsigned char*)blindptrs.back(), amount));
+            assert(secp256k1_pedersen_commit(ECC_GetContext(), &value.vchCommitment[0], (unsigned char*)blindptrs.back(), amount));
             // Generate ephemeral key for ECDH nonce generation
+            unsigned char vchEphemeralKey[32];
             CKey ephemeral_key;
-            ephemeral_key.MakeNewKey(true);
+            do {
+                GetFastRandBytes(vchEphemeralKey, sizeof(vchEphemeralKey));
+                ephemeral_key.Set(vchEphemeralKey, vchEphemeralKey + sizeof(vchEphemeralKey), true);
+            } while (!ephemeral_key.IsValid());
+            memory_cleanse(vchEphemeralKey, sizeof(vchEphemeralKey));
             CPubKey ephemeral_pubkey = ephemeral_key.GetPubKey();
-            value.vchNonceCommitment.resize(33);
-            memcpy(&value.vchNonceCommitment[0], &ephemeral_pubkey[0], 33);
+            value.vchNonceCommitment.assign(ephemeral_pubkey.begin(), ephemeral_pubkey.end());
             // Generate nonce
             uint256 nonce = ephemeral_key.ECDH(output_pubkeys[nOut]);
             CSHA256().Write(nonce.begin(), 32).Finalize(nonce.begin());
-            // Create range proof
-            int nRangeProofLen = 5134;
-            // TODO: smarter min_value selection
-            value.vchRangeproof.resize(nRangeProofLen);
-            int res = secp256k1_rangeproof_sign(secp256k1_blind_context, &value.vchRangeproof[0], &nRangeProofLen, 0, &value.vchCommitment[0], blindptrs.back(), nonce.begin(), std::min(std::max((int)GetArg("-ct_exponent", 0), -1),18), std::min(std::max((int)GetArg("-ct_bits", 32), 1), 51), amount);
-            value.vchRangeproof.resize(nRangeProofLen);
-            // TODO: do something smarter here
-            assert(res);
+            // Range proofs are created below, once all outputs are committed to
+            jobs.push_back(CRangeProofJob(value, blindptrs.back(), nonce, amount));
         }
     }
 
+    CreateRangeProofs(jobs, settings);
+
     return true;
 }
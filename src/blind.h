@@ -1,10 +1,43 @@
 #ifndef BITCOIN_BLIND_H_
 #define BITCOIN_BLIND_H_ 1
 
+#include "amount.h"
 #include "key.h"
 #include "pubkey.h"
 #include "primitives/transaction.h"
 
+/** Default for -ct_exponent */
+static const int DEFAULT_CT_EXPONENT = 2;
+/** Default for -ct_bits */
+static const int DEFAULT_CT_BITS = 26;
+/** Largest accepted -ct_bits */
+static const int MAX_CT_BITS = 51;
+
+/**
+ * What the range proofs created by BlindOutputs reveal about an amount, which
+ * also decides their size: each two bits of mantissa cost 160 bytes.
+ */
+struct CRangeProofSettings
+{
+    //! The lowest nExponent decimal digits of the amount are made public, or all of it for -1 (from -1 to 18)
+    int nExponent;
+    //! Bits of mantissa the proof covers at least; larger amounts get as many bits as they need (from 1 to MAX_CT_BITS)
+    int nMinBits;
+    //! Public lower bound of the amount, not used for amounts below it
+    CAmount nMinValue;
+
+    CRangeProofSettings() : nExponent(DEFAULT_CT_EXPONENT), nMinBits(DEFAULT_CT_BITS), nMinValue(0) {}
+    CRangeProofSettings(int nExponentIn, int nMinBitsIn, CAmount nMinValueIn) : nExponent(nExponentIn), nMinBits(nMinBitsIn), nMinValue(nMinValueIn) {}
+
+    bool IsValid() const
+    {
+        return nExponent >= -1 && nExponent <= 18 && nMinBits >= 1 && nMinBits <= MAX_CT_BITS && MoneyRange(nMinValue);
+    }
+};
+
+/** The settings given by -ct_exponent, -ct_bits and -ct_minvalue, with out-of-range values clamped */
+CRangeProofSettings GetRangeProofSettings();
+
 bool UnblindOutput(const CKey& blinding_key, const CTxOut& txout, CAmount& amount_out, uint256& blinding_factor_out);
 
 /* Returns false if there is no output to create where the non-zero resultant (inputs - outputs) factor can be put.
@@ -14,7 +47,8 @@ bool UnblindOutput(const CKey& blinding_key, const CTxOut& txout, CAmount& amoun
  * @param[in]   blinding factor must be created for the commitments and range proof creation. Non-null is used to signal that the given value should be used.
  * @param[in]   output_pubkeys - If non-null, these pubkeys will be used in conjunction with the non-null passed in output blinding factors.
  * @param[in/out]   tx - The transaction to be modified.
+ * @param[in]   settings - What the range proofs of the newly blinded outputs reveal; must be valid.
  */
-bool BlindOutputs(const std::vector<uint256>& input_blinding_factors, std::vector<uint256>& output_blinding_factors, const std::vector<CPubKey>& output_pubkeys, CMutableTransaction& tx);
+bool BlindOutputs(const std::vector<uint256>& input_blinding_factors, std::vector<uint256>& output_blinding_factors, const std::vector<CPubKey>& output_pubkeys, CMutableTransaction& tx, const CRangeProofSettings& settings = GetRangeProofSettings());
 
 #endif
@@ -22,9 +22,9 @@ CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool f
         shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
     FillShortTxIDSelector();
     //TODO: Use our mempool prior to block acceptance to predictively fill more than just the coinbase
-    prefilledtxn[0] = {0, block.vtx[0]};
+    prefilledtxn[0] = {0, *block.vtx[0]};
     for (size_t i = 1; i < block.vtx.size(); i++) {
-        const CTransaction& tx = block.vtx[i];
+        const CTransaction& tx = *block.vtx[i];
         shorttxids[i - 1] = GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash());
     }
 }
@@ -47,6 +47,37 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
 
 
 
+void BlockTransactionsNoRangeproofs::AddTransaction(const CTransaction& tx, bool fStripRangeproofs) {
+    bool fHasRangeproofs = false;
+    for (const CTxOut& txout : tx.vout)
+        fHasRangeproofs |= !txout.nValue.vchRangeproof.empty();
+    if (!fStripRangeproofs || !fHasRangeproofs) {
+        txn.push_back(tx);
+        stripped_wtxids.push_back(uint256());
+        return;
+    }
+    CMutableTransaction mtx(tx);
+    for (CTxOut& txout : mtx.vout)
+        txout.nValue.vchRangeproof.clear();
+    txn.push_back(CTransaction(mtx));
+    stripped_wtxids.push_back(tx.GetWitnessHash());
+}
+
+bool BlockTransactionsNoRangeproofs::FillRangeproofs(size_t index, const CTransaction& txKnown) {
+    assert(index < txn.size() && !stripped_wtxids[index].IsNull());
+    if (txKnown.GetHash() != txn[index].GetHash() || txKnown.vout.size() != txn[index].vout.size())
+        return false;
+    CMutableTransaction mtx(txn[index]);
+    for (size_t i = 0; i < mtx.vout.size(); i++)
+        mtx.vout[i].nValue.vchRangeproof = txKnown.vout[i].nValue.vchRangeproof;
+    CTransaction tx(mtx);
+    if (tx.GetWitnessHash() != stripped_wtxids[index])
+        return false;
+    txn[index] = tx;
+    stripped_wtxids[index].SetNull();
+    return true;
+}
+
 ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock) {
     if (cmpctblock.header.IsNull() || (cmpctblock.shorttxids.empty() && cmpctblock.prefilledtxn.empty()))
         return READ_STATUS_INVALID;
@@ -142,6 +173,12 @@ bool PartiallyDownloadedBlock::IsTxAvailable(size_t index) const {
     return txn_available[index] ? true : false;
 }
 
+void PartiallyDownloadedBlock::SetTxAvailable(size_t index, const CTransaction& tx) {
+    assert(!header.IsNull());
+    assert(index < txn_available.size() && !txn_available[index]);
+    txn_available[index] = std::make_shared<CTransaction>(tx);
+}
+
 ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<CTransaction>& vtx_missing) const {
     assert(!header.IsNull());
     block = header;
@@ -152,9 +189,9 @@ ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<
         if (!txn_available[i]) {
             if (vtx_missing.size() <= tx_missing_offset)
                 return READ_STATUS_INVALID;
-            block.vtx[i] = vtx_missing[tx_missing_offset++];
+            block.vtx[i] = MakeTransactionRef(vtx_missing[tx_missing_offset++]);
         } else
-            block.vtx[i] = *txn_available[i];
+            block.vtx[i] = txn_available[i]; // the mempool's copy
     }
     if (vtx_missing.size() != tx_missing_offset)
         return READ_STATUS_INVALID;
@@ -26,6 +26,83 @@ public:
     }
 };
 
+/**
+ * Serializes a header for a CompactHeaders message: as in a "headers" message
+ * without the transaction count, and without the challenge if it equals
+ * prevChallenge, the challenge of the header before it.
+ */
+struct HeaderCompressor {
+private:
+    CBlockHeader& header;
+    const CScript& prevChallenge;
+
+    enum {
+        HAS_BITCOIN_PROOF = 1,
+        HAS_CHALLENGE = 2,
+    };
+
+public:
+    HeaderCompressor(CBlockHeader& headerIn, const CScript& prevChallengeIn) : header(headerIn), prevChallenge(prevChallengeIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(header.nVersion);
+        READWRITE(header.hashPrevBlock);
+        READWRITE(header.hashMerkleRoot);
+        READWRITE(header.nTime);
+        uint8_t flags = 0;
+        if (!ser_action.ForRead()) {
+            if (header.IsBitcoinBlock())
+                flags |= HAS_BITCOIN_PROOF;
+            else if (header.proof.challenge != prevChallenge)
+                flags |= HAS_CHALLENGE;
+        }
+        READWRITE(flags);
+        if (flags & HAS_BITCOIN_PROOF) {
+            READWRITE(header.bitcoinproof);
+            return;
+        }
+        READWRITE(header.nHeight);
+        if (flags & HAS_CHALLENGE)
+            READWRITE(*(CScriptBase*)(&header.proof.challenge));
+        else if (ser_action.ForRead())
+            header.proof.challenge = prevChallenge;
+        READWRITE(*(CScriptBase*)(&header.proof.solution));
+    }
+};
+
+/**
+ * A "cheaders" message. Signed block headers carry the federation's whole
+ * challenge script, which only changes when the federation does, so after
+ * the first header it is left out until it changes.
+ */
+class CompactHeaders {
+public:
+    std::vector<CBlockHeader> headers;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        const CScript empty;
+        uint64_t headers_size = (uint64_t)headers.size();
+        READWRITE(COMPACTSIZE(headers_size));
+        if (ser_action.ForRead()) {
+            size_t i = 0;
+            while (headers.size() < headers_size) {
+                headers.resize(std::min((uint64_t)(1000 + headers.size()), headers_size));
+                for (; i < headers.size(); i++)
+                    READWRITE(REF(HeaderCompressor(headers[i], i == 0 ? empty : headers[i - 1].proof.challenge)));
+            }
+        } else {
+            for (size_t i = 0; i < headers.size(); i++)
+                READWRITE(REF(HeaderCompressor(headers[i], i == 0 ? empty : headers[i - 1].proof.challenge)));
+        }
+    }
+};
+
 class BlockTransactionsRequest {
 public:
     // A BlockTransactionsRequest message
@@ -99,6 +176,80 @@ public:
     }
 };
 
+/**
+ * A BlockTransactions message in which transactions may lack their
+ * rangeproofs. For each of those the witness hash of the complete transaction
+ * is included, so the receiver can check the rangeproofs it fills in from its
+ * own copy of the transaction.
+ */
+class BlockTransactionsNoRangeproofs {
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> txn;
+    //! For each transaction in txn: null if it is complete, else its witness hash with rangeproofs
+    std::vector<uint256> stripped_wtxids;
+
+    BlockTransactionsNoRangeproofs() {}
+    explicit BlockTransactionsNoRangeproofs(const uint256& blockhashIn) : blockhash(blockhashIn) {}
+
+    //! Append tx, without its rangeproofs if fStripRangeproofs
+    void AddTransaction(const CTransaction& tx, bool fStripRangeproofs);
+
+    /**
+     * Complete txn[index] with the rangeproofs of txKnown, a transaction with
+     * the same txid. Returns false if the result does not match the witness
+     * hash that was sent.
+     */
+    bool FillRangeproofs(size_t index, const CTransaction& txKnown);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        // Same encoding as BlockTransactions, followed by the stripped transactions
+        READWRITE(blockhash);
+        uint64_t txn_size = (uint64_t)txn.size();
+        READWRITE(COMPACTSIZE(txn_size));
+        if (ser_action.ForRead()) {
+            size_t i = 0;
+            while (txn.size() < txn_size) {
+                txn.resize(std::min((uint64_t)(1000 + txn.size()), txn_size));
+                for (; i < txn.size(); i++)
+                    READWRITE(REF(TransactionCompressor(txn[i])));
+            }
+        } else {
+            for (size_t i = 0; i < txn.size(); i++)
+                READWRITE(REF(TransactionCompressor(txn[i])));
+        }
+
+        // Only the stripped transactions are listed, as (position, witness hash)
+        uint64_t stripped_count = 0;
+        for (size_t i = 0; i < stripped_wtxids.size(); i++)
+            stripped_count += !stripped_wtxids[i].IsNull();
+        READWRITE(COMPACTSIZE(stripped_count));
+        if (ser_action.ForRead()) {
+            stripped_wtxids.assign(txn.size(), uint256());
+            if (stripped_count > txn.size())
+                throw std::ios_base::failure("too many stripped transactions");
+            for (uint64_t i = 0; i < stripped_count; i++) {
+                uint64_t pos = 0;
+                READWRITE(COMPACTSIZE(pos));
+                if (pos >= txn.size())
+                    throw std::ios_base::failure("stripped transaction out of range");
+                READWRITE(stripped_wtxids[pos]);
+            }
+        } else {
+            for (size_t i = 0; i < stripped_wtxids.size(); i++) {
+                if (stripped_wtxids[i].IsNull())
+                    continue;
+                uint64_t pos = i;
+                READWRITE(COMPACTSIZE(pos));
+                READWRITE(stripped_wtxids[i]);
+            }
+        }
+    }
+};
+
 // Dumb serialization/storage-helper for CBlockHeaderAndShortTxIDs and PartiallyDownlaodedBlock
 struct PrefilledTransaction {
     // Used as an offset since last prefilled tx in CBlockHeaderAndShortTxIDs,
@@ -200,6 +351,9 @@ public:
 
     ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock);
     bool IsTxAvailable(size_t index) const;
+    size_t BlockTxCount() const { return txn_available.size(); }
+    //! Provide a transaction that was not available, as received from the peer
+    void SetTxAvailable(size_t index, const CTransaction& tx);
     ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtx_missing) const;
 };
 
@@ -0,0 +1,174 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilewriter.h"
+
+#include "mappedfile.h"
+#include "reverselock.h"
+#include "util.h"
+
+#include <boost/bind.hpp>
+
+CBlockFileWriter::CBlockFileWriter(OpenFileFn openBlockFileIn, OpenFileFn openUndoFileIn, CMappedFileCache* pmappedBlockFilesIn, size_t nMaxQueuedBytesIn) :
+    openBlockFile(openBlockFileIn), openUndoFile(openUndoFileIn), pmappedBlockFiles(pmappedBlockFilesIn), nMaxQueuedBytes(nMaxQueuedBytesIn),
+    nQueuedBytes(0), fFailed(false), fStop(false), pthread(NULL)
+{
+}
+
+CBlockFileWriter::~CBlockFileWriter()
+{
+    Stop();
+}
+
+void CBlockFileWriter::Start()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (pthread)
+        return;
+    fStop = false;
+    pthread = new boost::thread(boost::bind(&CBlockFileWriter::ThreadWrite, this));
+}
+
+void CBlockFileWriter::Stop()
+{
+    boost::thread* pthreadStop;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!pthread)
+            return;
+        pthreadStop = pthread;
+        fStop = true;
+        cond.notify_all();
+    }
+    pthreadStop->join();
+    delete pthreadStop;
+    boost::unique_lock<boost::mutex> lock(mutex);
+    pthread = NULL;
+}
+
+bool CBlockFileWriter::Run(const Job& job)
+{
+    if (job.fCommit) {
+        CDiskBlockPos pos(job.pos.nFile, 0);
+        FILE* file = openBlockFile(pos, false);
+        if (file) {
+            if (job.fFinalize) {
+                // Pages past the new end would fault if a mapping still covered them.
+                if (pmappedBlockFiles)
+                    pmappedBlockFiles->Erase(pos.nFile);
+                TruncateFile(file, job.nSize);
+            }
+            FileCommit(file);
+            fclose(file);
+        }
+        file = openUndoFile(pos, false);
+        if (file) {
+            if (job.fFinalize)
+                TruncateFile(file, job.nUndoSize);
+            FileCommit(file);
+            fclose(file);
+        }
+        return true;
+    }
+
+    FILE* file = (job.fUndo ? openUndoFile : openBlockFile)(job.pos, false);
+    if (!file)
+        return error("%s: failed to open %s file for %s", __func__, job.fUndo ? "undo" : "block", job.pos.ToString());
+    bool fOk = fwrite(job.vData.data(), 1, job.vData.size(), file) == job.vData.size();
+    // Closing flushes the data, which readers then see.
+    fOk = fclose(file) == 0 && fOk;
+    if (!fOk)
+        return error("%s: failed to write %s data at %s", __func__, job.fUndo ? "undo" : "block", job.pos.ToString());
+    return true;
+}
+
+void CBlockFileWriter::Queue(Job& job)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    // The node is shutting down; nothing after a failed write is kept.
+    if (fFailed)
+        return;
+    if (!pthread) {
+        if (!Run(job))
+            fFailed = true;
+        return;
+    }
+    while (!queue.empty() && nQueuedBytes > nMaxQueuedBytes)
+        cond.wait(lock);
+    nQueuedBytes += job.vData.size();
+    queue.push_back(Job());
+    std::swap(queue.back(), job);
+    cond.notify_all();
+}
+
+bool CBlockFileWriter::Write(bool fUndo, const CDiskBlockPos& pos, std::vector<char>& vData)
+{
+    Job job;
+    job.fUndo = fUndo;
+    job.pos = pos;
+    job.vData.swap(vData);
+    job.fCommit = false;
+    Queue(job);
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return !fFailed;
+}
+
+void CBlockFileWriter::Commit(int nFile, bool fFinalize, unsigned int nSize, unsigned int nUndoSize)
+{
+    Job job;
+    job.fUndo = false;
+    job.pos = CDiskBlockPos(nFile, 0);
+    job.fCommit = true;
+    job.fFinalize = fFinalize;
+    job.nSize = nSize;
+    job.nUndoSize = nUndoSize;
+    Queue(job);
+}
+
+void CBlockFileWriter::WaitForWrite(bool fUndo, const CDiskBlockPos& pos)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        bool fPending = false;
+        for (std::deque<Job>::const_iterator it = queue.begin(); it != queue.end() && !fPending; it++) {
+            fPending = !it->fCommit && it->fUndo == fUndo && it->pos.nFile == pos.nFile &&
+                it->pos.nPos <= pos.nPos && pos.nPos < it->pos.nPos + it->vData.size();
+        }
+        if (!fPending)
+            return;
+        cond.wait(lock);
+    }
+}
+
+bool CBlockFileWriter::Sync()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!queue.empty())
+        cond.wait(lock);
+    return !fFailed;
+}
+
+void CBlockFileWriter::ThreadWrite()
+{
+    RenameThread("bitcoin-blockwrite");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (!fStop && queue.empty())
+            cond.wait(lock);
+        if (queue.empty())
+            return;
+        // Only this thread removes jobs, so the front stays where it is.
+        const Job& job = queue.front();
+        bool fOk;
+        {
+            reverse_lock<boost::unique_lock<boost::mutex> > unlock(lock);
+            fOk = Run(job);
+        }
+        if (!fOk)
+            fFailed = true;
+        nQueuedBytes -= job.vData.size();
+        queue.pop_front();
+        cond.notify_all();
+    }
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEWRITER_H
+#define BITCOIN_BLOCKFILEWRITER_H
+
+#include "chain.h"
+
+#include <deque>
+#include <stdio.h>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+class CMappedFileCache;
+
+/**
+ * Writes records to the block (blk?????.dat) and undo (rev?????.dat) files on
+ * a background thread, in the order they are queued, so that validation does
+ * not wait for the disk. Positions are assigned by the caller, as they are
+ * for a synchronous write.
+ *
+ * Readers of a record call WaitForWrite() first, which returns once it is in
+ * the file. Sync() is the durability barrier: it waits for everything queued
+ * before it, including the commits queued with Commit(). Once a write fails,
+ * later jobs are dropped and every Write() and Sync() returns false. Until
+ * Start(), and after Stop(), everything is done on the calling thread.
+ */
+class CBlockFileWriter
+{
+public:
+    typedef FILE* (*OpenFileFn)(const CDiskBlockPos& pos, bool fReadOnly);
+
+private:
+    struct Job
+    {
+        bool fUndo;
+        //! Where vData goes; for a commit, only the file number is used
+        CDiskBlockPos pos;
+        std::vector<char> vData;
+        //! Commit both files of pos.nFile rather than write
+        bool fCommit;
+        //! Truncate the files to nSize and nUndoSize before committing them
+        bool fFinalize;
+        unsigned int nSize;
+        unsigned int nUndoSize;
+    };
+
+    const OpenFileFn openBlockFile;
+    const OpenFileFn openUndoFile;
+    //! Mappings of the block files, dropped before one is truncated
+    CMappedFileCache* const pmappedBlockFiles;
+    const size_t nMaxQueuedBytes;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    //! The job being done stays at the front until it is done
+    std::deque<Job> queue;
+    size_t nQueuedBytes;
+    bool fFailed;
+    bool fStop;
+    boost::thread* pthread;
+
+    void Queue(Job& job);
+    bool Run(const Job& job);
+    void ThreadWrite();
+
+public:
+    CBlockFileWriter(OpenFileFn openBlockFileIn, OpenFileFn openUndoFileIn, CMappedFileCache* pmappedBlockFilesIn, size_t nMaxQueuedBytesIn);
+    ~CBlockFileWriter();
+
+    void Start();
+    //! Finish the queued jobs and join the thread
+    void Stop();
+
+    /**
+     * Queue vData, which is taken over, to be written at pos in a block or
+     * undo file. Waits while more than nMaxQueuedBytes are queued.
+     */
+    bool Write(bool fUndo, const CDiskBlockPos& pos, std::vector<char>& vData);
+    //! Queue flushing both files of nFile to disk, truncating them first if fFinalize
+    void Commit(int nFile, bool fFinalize, unsigned int nSize, unsigned int nUndoSize);
+    //! Wait until no queued write covers pos
+    void WaitForWrite(bool fUndo, const CDiskBlockPos& pos);
+    //! Wait for everything queued; false if any write failed
+    bool Sync();
+};
+
+#endif // BITCOIN_BLOCKFILEWRITER_H
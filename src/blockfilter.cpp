@@ -0,0 +1,198 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+
+#include <algorithm>
+
+namespace {
+
+/** (x * n) >> 64, mapping a uniform 64-bit x uniformly into [0, n). */
+uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)x * n) >> 64);
+#else
+    const uint64_t x_hi = x >> 32, x_lo = x & 0xffffffff;
+    const uint64_t n_hi = n >> 32, n_lo = n & 0xffffffff;
+    const uint64_t hh = x_hi * n_hi, hl = x_hi * n_lo, lh = x_lo * n_hi, ll = x_lo * n_lo;
+    const uint64_t mid = (ll >> 32) + (hl & 0xffffffff) + (lh & 0xffffffff);
+    return hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+#endif
+}
+
+/** Appends bits, most significant first, to a byte vector. */
+class CBitWriter
+{
+    std::vector<unsigned char>& vch;
+    int nBits; //!< bits used in the last byte of vch, 8 if it is full
+
+public:
+    CBitWriter(std::vector<unsigned char>& vchIn) : vch(vchIn), nBits(8) {}
+
+    void Write(uint64_t data, int n)
+    {
+        while (n > 0) {
+            if (nBits == 8) {
+                vch.push_back(0);
+                nBits = 0;
+            }
+            const int nTake = std::min(8 - nBits, n);
+            const unsigned char bits = (data >> (n - nTake)) & ((1 << nTake) - 1);
+            vch.back() |= bits << (8 - nBits - nTake);
+            nBits += nTake;
+            n -= nTake;
+        }
+    }
+};
+
+/** Reads bits written by CBitWriter; reading past the end yields zero bits. */
+class CBitReader
+{
+    const std::vector<unsigned char>& vch;
+    size_t nPos; //!< index of the next bit
+
+public:
+    CBitReader(const std::vector<unsigned char>& vchIn) : vch(vchIn), nPos(0) {}
+
+    bool AtEnd() const { return nPos >= vch.size() * 8; }
+
+    bool ReadBit()
+    {
+        const size_t nByte = nPos / 8;
+        const int nShift = 7 - (nPos % 8);
+        nPos++;
+        return nByte < vch.size() && ((vch[nByte] >> nShift) & 1);
+    }
+
+    uint64_t Read(int n)
+    {
+        uint64_t ret = 0;
+        while (n > 0) {
+            const size_t nByte = nPos / 8;
+            const int nOffset = nPos % 8;
+            const int nTake = std::min(8 - nOffset, n);
+            const unsigned char byte = nByte < vch.size() ? vch[nByte] : 0;
+            ret = (ret << nTake) | ((byte >> (8 - nOffset - nTake)) & ((1 << nTake) - 1));
+            nPos += nTake;
+            n -= nTake;
+        }
+        return ret;
+    }
+};
+
+void GolombRiceEncode(CBitWriter& writer, uint64_t x)
+{
+    // Unary quotient, terminated by a zero, then the remainder in P bits.
+    for (uint64_t q = x >> BLOCK_FILTER_P; q > 0; q--)
+        writer.Write(1, 1);
+    writer.Write(0, 1);
+    writer.Write(x, BLOCK_FILTER_P);
+}
+
+uint64_t GolombRiceDecode(CBitReader& reader)
+{
+    uint64_t q = 0;
+    while (reader.ReadBit())
+        q++;
+    return (q << BLOCK_FILTER_P) | reader.Read(BLOCK_FILTER_P);
+}
+
+}
+
+CBlockFilter::CBlockFilter(const uint256& blockHashIn, const std::vector<Element>& vElementsIn) : blockHash(blockHashIn), nElements(0)
+{
+    std::vector<Element> vElements(vElementsIn);
+    std::sort(vElements.begin(), vElements.end());
+    vElements.erase(std::unique(vElements.begin(), vElements.end()), vElements.end());
+    nElements = vElements.size();
+
+    std::vector<uint64_t> vHashed;
+    vHashed.reserve(vElements.size());
+    for (size_t i = 0; i < vElements.size(); i++)
+        vHashed.push_back(HashToRange(vElements[i]));
+    std::sort(vHashed.begin(), vHashed.end());
+
+    CBitWriter writer(vData);
+    uint64_t nLast = 0;
+    for (size_t i = 0; i < vHashed.size(); i++) {
+        GolombRiceEncode(writer, vHashed[i] - nLast);
+        nLast = vHashed[i];
+    }
+}
+
+CBlockFilter::CBlockFilter(const CBlock& block) : CBlockFilter(block.GetHash(), GetElements(block))
+{
+}
+
+uint64_t CBlockFilter::HashToRange(const Element& element) const
+{
+    const uint64_t nHash = CSipHasher(blockHash.GetUint64(0), blockHash.GetUint64(1)).Write(element.data(), element.size()).Finalize();
+    return MapIntoRange(nHash, (uint64_t)nElements * BLOCK_FILTER_M);
+}
+
+CBlockFilter::Element CBlockFilter::OutPointElement(const COutPoint& outpoint)
+{
+    Element element;
+    CVectorWriter<Element>(element, SER_NETWORK, PROTOCOL_VERSION) << outpoint;
+    return element;
+}
+
+std::vector<CBlockFilter::Element> CBlockFilter::GetElements(const CBlock& block)
+{
+    std::vector<Element> vElements;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        // Fee outputs have an empty script, and data carriers pay no one.
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            const CScript& script = tx.vout[j].scriptPubKey;
+            if (!script.empty() && !script.IsUnspendable())
+                vElements.push_back(Element(script.begin(), script.end()));
+        }
+        if (tx.IsCoinBase())
+            continue;
+        for (size_t j = 0; j < tx.vin.size(); j++)
+            vElements.push_back(OutPointElement(tx.vin[j].prevout));
+    }
+    return vElements;
+}
+
+bool CBlockFilter::Match(const Element& element) const
+{
+    return MatchAny(std::vector<Element>(1, element));
+}
+
+bool CBlockFilter::MatchAny(const std::vector<Element>& vQuery) const
+{
+    if (nElements == 0 || vQuery.empty())
+        return false;
+
+    std::vector<uint64_t> vHashed;
+    vHashed.reserve(vQuery.size());
+    for (size_t i = 0; i < vQuery.size(); i++)
+        vHashed.push_back(HashToRange(vQuery[i]));
+    std::sort(vHashed.begin(), vHashed.end());
+
+    // Walk the filter and the sorted query side by side.
+    CBitReader reader(vData);
+    uint64_t nValue = 0;
+    std::vector<uint64_t>::const_iterator it = vHashed.begin();
+    for (uint32_t i = 0; i < nElements; i++) {
+        nValue += GolombRiceDecode(reader);
+        while (*it < nValue) {
+            if (++it == vHashed.end())
+                return false;
+        }
+        if (*it == nValue)
+            return true;
+        if (reader.AtEnd())
+            break;
+    }
+    return false;
+}
@@ -0,0 +1,70 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <vector>
+
+class CBlock;
+class COutPoint;
+
+//! Golomb-Rice parameter of block filters: remainders are this many bits
+static const int BLOCK_FILTER_P = 19;
+//! Inverse false positive rate of a single element lookup in a block filter
+static const uint64_t BLOCK_FILTER_M = 784931;
+
+/**
+ * Compact filter of the items a block touches: the scriptPubKeys of its
+ * outputs (withdraw locks included), and the outpoints its inputs spend.
+ *
+ * Each item is hashed with SipHash keyed by the block hash, mapped into
+ * [0, N * M), and the sorted values are stored as Golomb-Rice coded
+ * differences. A lookup never misses an item that is in the block, and
+ * matches an item that is not with probability 1/M.
+ */
+class CBlockFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+
+private:
+    uint256 blockHash;
+    uint32_t nElements;
+    std::vector<unsigned char> vData;
+
+    uint64_t HashToRange(const Element& element) const;
+
+public:
+    CBlockFilter() : nElements(0) {}
+    CBlockFilter(const uint256& blockHashIn, const std::vector<Element>& vElements);
+    explicit CBlockFilter(const CBlock& block);
+
+    //! The items of a block that a filter is built from
+    static std::vector<Element> GetElements(const CBlock& block);
+    static Element OutPointElement(const COutPoint& outpoint);
+
+    const uint256& GetBlockHash() const { return blockHash; }
+    uint32_t GetN() const { return nElements; }
+
+    //! Whether element may be in the filter
+    bool Match(const Element& element) const;
+    //! Whether any of vQuery may be in the filter; cheaper than one Match per element
+    bool MatchAny(const std::vector<Element>& vQuery) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(blockHash);
+        READWRITE(VARINT(nElements));
+        READWRITE(vData);
+    }
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -0,0 +1,116 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstats.h"
+
+#include "policy/policy.h"
+#include "primitives/block.h"
+#include "script/standard.h"
+#include "undo.h"
+#include "version.h"
+
+#include <algorithm>
+
+namespace {
+
+const char* GetScriptTypeName(const CScript& scriptPubKey)
+{
+    txnouttype type;
+    std::vector<std::vector<unsigned char> > vSolutions;
+    if (!Solver(scriptPubKey, type, vSolutions))
+        type = TX_NONSTANDARD;
+    return GetTxnOutputType(type);
+}
+
+}
+
+void CBlockStats::SetNull()
+{
+    blockHash.SetNull();
+    nHeight = 0;
+    nTime = 0;
+    nSize = 0;
+    nWeight = 0;
+    nTx = 0;
+    nInputs = 0;
+    nOutputs = 0;
+    nBlindedOutputs = 0;
+    nExplicitOutputs = 0;
+    nExplicitOutputValue = 0;
+    nRangeProofBytes = 0;
+    nTotalFee = 0;
+    nMinFeeRate = 0;
+    nMedianFeeRate = 0;
+    nMaxFeeRate = 0;
+    nPegIns = 0;
+    nPegInValue = 0;
+    nPegOuts = 0;
+    nPegOutValue = 0;
+    mapOutputScriptTypes.clear();
+    mapSpentScriptTypes.clear();
+}
+
+CBlockStats::CBlockStats(const CBlock& block, const CBlockUndo& blockundo, int nHeightIn)
+{
+    SetNull();
+    blockHash = block.GetHash();
+    nHeight = nHeightIn;
+    nTime = block.GetBlockTime();
+    nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    nWeight = GetBlockWeight(block);
+    nTx = block.vtx.size();
+
+    std::vector<CAmount> vFeeRates;
+    vFeeRates.reserve(block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        CAmount nLocked = 0;
+
+        nOutputs += tx.vout.size();
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            const CTxOut& txout = tx.vout[j];
+            if (txout.nValue.IsAmount()) {
+                nExplicitOutputs++;
+                nExplicitOutputValue += txout.nValue.GetAmount();
+                if (txout.scriptPubKey.IsWithdrawLock())
+                    nLocked += txout.nValue.GetAmount();
+            } else {
+                nBlindedOutputs++;
+            }
+            nRangeProofBytes += txout.nValue.vchRangeproof.size();
+            mapOutputScriptTypes[GetScriptTypeName(txout.scriptPubKey)]++;
+        }
+
+        // The genesis block is connected without undo data, and only has
+        // a coinbase.
+        if (tx.IsCoinBase() || i - 1 >= blockundo.vtxundo.size())
+            continue;
+
+        nInputs += tx.vin.size();
+        const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+        for (size_t j = 0; j < txundo.vprevout.size(); j++) {
+            const CTxOut& prevout = txundo.vprevout[j].txout;
+            if (prevout.scriptPubKey.IsWithdrawLock() && prevout.nValue.IsAmount())
+                nLocked -= prevout.nValue.GetAmount();
+            mapSpentScriptTypes[GetScriptTypeName(prevout.scriptPubKey)]++;
+        }
+        if (nLocked < 0) {
+            nPegIns++;
+            nPegInValue -= nLocked;
+        } else if (nLocked > 0) {
+            nPegOuts++;
+            nPegOutValue += nLocked;
+        }
+
+        nTotalFee += tx.nTxFee;
+        vFeeRates.push_back(CFeeRate(tx.nTxFee, GetVirtualTransactionSize(tx)).GetFeePerK());
+    }
+
+    if (!vFeeRates.empty()) {
+        std::sort(vFeeRates.begin(), vFeeRates.end());
+        nMinFeeRate = vFeeRates.front();
+        nMedianFeeRate = vFeeRates[vFeeRates.size() / 2];
+        nMaxFeeRate = vFeeRates.back();
+    }
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKSTATS_H
+#define BITCOIN_BLOCKSTATS_H
+
+#include "amount.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+class CBlock;
+class CBlockUndo;
+
+/**
+ * Summary statistics of a connected block (-blockstatsindex), so that they
+ * can be looked up without reading the block and its undo data again.
+ *
+ * Fee rates are per 1000 virtual bytes, over the transactions other than
+ * the coinbase. Peg flows are the net change of a transaction's explicit
+ * withdraw lock value: a transaction that spends more locked value than it
+ * locks again pegs the difference in, one that locks more pegs it out.
+ */
+class CBlockStats
+{
+public:
+    uint256 blockHash;
+    int nHeight;
+    int64_t nTime;
+
+    uint64_t nSize;
+    uint64_t nWeight;
+    uint32_t nTx;
+    uint32_t nInputs;
+    uint32_t nOutputs;
+
+    uint32_t nBlindedOutputs;
+    uint32_t nExplicitOutputs;
+    //! Total of the explicit output amounts, coinbase included
+    CAmount nExplicitOutputValue;
+    uint64_t nRangeProofBytes;
+
+    CAmount nTotalFee;
+    CAmount nMinFeeRate;
+    CAmount nMedianFeeRate;
+    CAmount nMaxFeeRate;
+
+    uint32_t nPegIns;
+    CAmount nPegInValue;
+    uint32_t nPegOuts;
+    CAmount nPegOutValue;
+
+    //! Outputs by script type, see GetTxnOutputType
+    std::map<std::string, uint32_t> mapOutputScriptTypes;
+    //! Spent outputs by script type
+    std::map<std::string, uint32_t> mapSpentScriptTypes;
+
+    CBlockStats() { SetNull(); }
+    //! Compute the statistics of a block; blockundo holds the outputs it spends
+    CBlockStats(const CBlock& block, const CBlockUndo& blockundo, int nHeightIn);
+
+    void SetNull();
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(blockHash);
+        READWRITE(VARINT(nHeight));
+        READWRITE(nTime);
+        READWRITE(VARINT(nSize));
+        READWRITE(VARINT(nWeight));
+        READWRITE(VARINT(nTx));
+        READWRITE(VARINT(nInputs));
+        READWRITE(VARINT(nOutputs));
+        READWRITE(VARINT(nBlindedOutputs));
+        READWRITE(VARINT(nExplicitOutputs));
+        READWRITE(nExplicitOutputValue);
+        READWRITE(VARINT(nRangeProofBytes));
+        READWRITE(nTotalFee);
+        READWRITE(nMinFeeRate);
+        READWRITE(nMedianFeeRate);
+        READWRITE(nMaxFeeRate);
+        READWRITE(VARINT(nPegIns));
+        READWRITE(nPegInValue);
+        READWRITE(VARINT(nPegOuts));
+        READWRITE(nPegOutValue);
+        READWRITE(mapOutputScriptTypes);
+        READWRITE(mapSpentScriptTypes);
+    }
+};
+
+#endif // BITCOIN_BLOCKSTATS_H
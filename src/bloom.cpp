@@ -133,7 +133,51 @@ bool CBloomFilter::IsWithinSizeConstraints() const
     return vData.size() <= MAX_BLOOM_FILTER_SIZE && nHashFuncs <= MAX_HASH_FUNCS;
 }
 
+/** The non-empty data pushes of script, up to the first opcode that fails to parse */
+static std::vector<std::vector<unsigned char> > GetScriptPushes(const CScript& script)
+{
+    std::vector<std::vector<unsigned char> > vPushes;
+    CScript::const_iterator pc = script.begin();
+    vector<unsigned char> data;
+    while (pc < script.end())
+    {
+        opcodetype opcode;
+        if (!script.GetOp(pc, opcode, data))
+            break;
+        if (data.size() != 0)
+            vPushes.push_back(data);
+    }
+    return vPushes;
+}
+
+CBloomTxElements::CBloomTxElements(const CTransaction& tx) : hash(tx.GetHash())
+{
+    vOutputs.resize(tx.vout.size());
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        const CScript& scriptPubKey = tx.vout[i].scriptPubKey;
+        vOutputs[i].vPushes = GetScriptPushes(scriptPubKey);
+        txnouttype type;
+        vOutputs[i].fPubKeyOrMultisig = !vOutputs[i].vPushes.empty() && Solver(scriptPubKey, type) && (type == TX_PUBKEY || type == TX_MULTISIG);
+    }
+    vInputs.resize(tx.vin.size());
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    {
+        vInputs[i].prevout = tx.vin[i].prevout;
+        vInputs[i].vPushes = GetScriptPushes(tx.vin[i].scriptSig);
+    }
+}
+
 bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
+{
+    if (isFull)
+        return true;
+    if (isEmpty)
+        return false;
+    return IsRelevantAndUpdate(CBloomTxElements(tx));
+}
+
+bool CBloomFilter::IsRelevantAndUpdate(const CBloomTxElements& elements)
 {
     bool fFound = false;
     // Match if the filter contains the hash of tx
@@ -142,37 +186,25 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
         return true;
     if (isEmpty)
         return false;
-    const uint256& hash = tx.GetHash();
-    if (contains(hash))
+    if (contains(elements.hash))
         fFound = true;
 
-    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    for (unsigned int i = 0; i < elements.vOutputs.size(); i++)
     {
-        const CTxOut& txout = tx.vout[i];
+        const CBloomTxElements::Output& output = elements.vOutputs[i];
         // Match if the filter contains any arbitrary script data element in any scriptPubKey in tx
         // If this matches, also add the specific output that was matched.
         // This means clients don't have to update the filter themselves when a new relevant tx 
         // is discovered in order to find spending transactions, which avoids round-tripping and race conditions.
-        CScript::const_iterator pc = txout.scriptPubKey.begin();
-        vector<unsigned char> data;
-        while (pc < txout.scriptPubKey.end())
+        for (unsigned int j = 0; j < output.vPushes.size(); j++)
         {
-            opcodetype opcode;
-            if (!txout.scriptPubKey.GetOp(pc, opcode, data))
-                break;
-            if (data.size() != 0 && contains(data))
+            if (contains(output.vPushes[j]))
             {
                 fFound = true;
                 if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_ALL)
-                    insert(COutPoint(hash, i));
-                else if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_P2PUBKEY_ONLY)
-                {
-                    txnouttype type;
-                    vector<vector<unsigned char> > vSolutions;
-                    if (Solver(txout.scriptPubKey, type, vSolutions) &&
-                            (type == TX_PUBKEY || type == TX_MULTISIG))
-                        insert(COutPoint(hash, i));
-                }
+                    insert(COutPoint(elements.hash, i));
+                else if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_P2PUBKEY_ONLY && output.fPubKeyOrMultisig)
+                    insert(COutPoint(elements.hash, i));
                 break;
             }
         }
@@ -181,21 +213,16 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
     if (fFound)
         return true;
 
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    BOOST_FOREACH(const CBloomTxElements::Input& input, elements.vInputs)
     {
         // Match if the filter contains an outpoint tx spends
-        if (contains(txin.prevout))
+        if (contains(input.prevout))
             return true;
 
         // Match if the filter contains any arbitrary script data element in any scriptSig in tx
-        CScript::const_iterator pc = txin.scriptSig.begin();
-        vector<unsigned char> data;
-        while (pc < txin.scriptSig.end())
+        for (unsigned int j = 0; j < input.vPushes.size(); j++)
         {
-            opcodetype opcode;
-            if (!txin.scriptSig.GetOp(pc, opcode, data))
-                break;
-            if (data.size() != 0 && contains(data))
+            if (contains(input.vPushes[j]))
                 return true;
         }
     }
@@ -243,12 +270,25 @@ CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
     reset();
 }
 
-/* Similar to CBloomFilter::Hash */
-static inline uint32_t RollingBloomHash(unsigned int nHashNum, uint32_t nTweak, const std::vector<unsigned char>& vDataToHash) {
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash);
+/* Unlike CBloomFilter, whose hashes are fixed by BIP37, the rolling filter only
+ * lives in memory, so it derives all of its nHashFuncs positions from a single
+ * SipHash of the key (double hashing, see Kirsch and Mitzenmacher, "Less
+ * Hashing, Same Performance"). Position n is h1 + n * h2, of which the low 6
+ * bits pick the bit within a word and the rest the pair of words, scaled into
+ * range with a multiply instead of a division. */
+static inline void RollingBloomHashes(uint64_t nHash, uint32_t& h1, uint32_t& h2)
+{
+    h1 = (uint32_t)nHash;
+    // An odd step never makes two positions of a key collide on its own.
+    h2 = (uint32_t)(nHash >> 32) | 1;
 }
 
-void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+static inline uint32_t RollingBloomPair(uint32_t h, uint32_t nPairs)
+{
+    return (uint32_t)(((uint64_t)(h >> 6) * nPairs) >> 26);
+}
+
+void CRollingBloomFilter::insert(uint64_t nHash)
 {
     if (nEntriesThisGeneration == nEntriesPerGeneration) {
         nEntriesThisGeneration = 0;
@@ -268,45 +308,60 @@ void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
     }
     nEntriesThisGeneration++;
 
-    for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
+    const uint64_t nBit1 = nGeneration & 1, nBit2 = nGeneration >> 1;
+    const uint32_t nPairs = data.size() >> 1;
+    uint32_t h, h2;
+    RollingBloomHashes(nHash, h, h2);
+    for (int n = 0; n < nHashFuncs; n++, h += h2) {
         int bit = h & 0x3F;
-        uint32_t pos = (h >> 6) % data.size();
-        /* The lowest bit of pos is ignored, and set to zero for the first bit, and to one for the second. */
-        data[pos & ~1] = (data[pos & ~1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration & 1)) << bit;
-        data[pos | 1] = (data[pos | 1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration >> 1)) << bit;
+        uint32_t pos = RollingBloomPair(h, nPairs) << 1;
+        /* The first word of the pair holds the low bit of the generation, the second the high bit. */
+        data[pos] = (data[pos] & ~(((uint64_t)1) << bit)) | nBit1 << bit;
+        data[pos | 1] = (data[pos | 1] & ~(((uint64_t)1) << bit)) | nBit2 << bit;
     }
 }
 
-void CRollingBloomFilter::insert(const uint256& hash)
-{
-    vector<unsigned char> data(hash.begin(), hash.end());
-    insert(data);
-}
-
-bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+bool CRollingBloomFilter::contains(uint64_t nHash) const
 {
-    for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
+    const uint32_t nPairs = data.size() >> 1;
+    uint32_t h, h2;
+    RollingBloomHashes(nHash, h, h2);
+    for (int n = 0; n < nHashFuncs; n++, h += h2) {
         int bit = h & 0x3F;
-        uint32_t pos = (h >> 6) % data.size();
-        /* If the relevant bit is not set in either data[pos & ~1] or data[pos | 1], the filter does not contain vKey */
-        if (!(((data[pos & ~1] | data[pos | 1]) >> bit) & 1)) {
+        uint32_t pos = RollingBloomPair(h, nPairs) << 1;
+        /* If the relevant bit is not set in either data[pos] or data[pos | 1], the filter does not contain the key */
+        if (!(((data[pos] | data[pos | 1]) >> bit) & 1)) {
             return false;
         }
     }
     return true;
 }
 
+void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    insert(CSipHasher(nKey0, nKey1).Write(vKey.data(), vKey.size()).Finalize());
+}
+
+void CRollingBloomFilter::insert(const uint256& hash)
+{
+    // The same as hashing its 32 bytes, so either overload finds the other's entries.
+    insert(SipHashUint256(nKey0, nKey1, hash));
+}
+
+bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+{
+    return contains(CSipHasher(nKey0, nKey1).Write(vKey.data(), vKey.size()).Finalize());
+}
+
 bool CRollingBloomFilter::contains(const uint256& hash) const
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    return contains(data);
+    return contains(SipHashUint256(nKey0, nKey1, hash));
 }
 
 void CRollingBloomFilter::reset()
 {
-    nTweak = GetRand(std::numeric_limits<unsigned int>::max());
+    nKey0 = GetRand(std::numeric_limits<uint64_t>::max());
+    nKey1 = GetRand(std::numeric_limits<uint64_t>::max());
     nEntriesThisGeneration = 0;
     nGeneration = 1;
     for (std::vector<uint64_t>::iterator it = data.begin(); it != data.end(); it++) {
@@ -5,14 +5,11 @@
 #ifndef BITCOIN_BLOOM_H
 #define BITCOIN_BLOOM_H
 
+#include "primitives/transaction.h"
 #include "serialize.h"
 
 #include <vector>
 
-class COutPoint;
-class CTransaction;
-class uint256;
-
 //! 20,000 items with fp rate < 0.1% or 10,000 items and <0.0001%
 static const unsigned int MAX_BLOOM_FILTER_SIZE = 36000; // bytes
 static const unsigned int MAX_HASH_FUNCS = 50;
@@ -30,6 +27,35 @@ enum bloomflags
     BLOOM_UPDATE_MASK = 3,
 };
 
+/**
+ * The data elements of a transaction that CBloomFilter::IsRelevantAndUpdate
+ * looks for: its txid, the data pushes of its scriptPubKeys and scriptSigs
+ * and the outpoints it spends. Parsed out once, they can be matched against
+ * the filters of many peers, as a block served to filtered peers is.
+ */
+class CBloomTxElements
+{
+public:
+    struct Output
+    {
+        std::vector<std::vector<unsigned char> > vPushes;
+        //! Pay-to-pubkey or multisig, which BLOOM_UPDATE_P2PUBKEY_ONLY adds the outpoint of
+        bool fPubKeyOrMultisig;
+    };
+
+    struct Input
+    {
+        COutPoint prevout;
+        std::vector<std::vector<unsigned char> > vPushes;
+    };
+
+    uint256 hash;
+    std::vector<Output> vOutputs;
+    std::vector<Input> vInputs;
+
+    explicit CBloomTxElements(const CTransaction& tx);
+};
+
 /**
  * BloomFilter is a probabilistic filter which SPV clients provide
  * so that we can filter the transactions we send them.
@@ -97,6 +123,7 @@ public:
 
     //! Also adds any outputs which match the filter to the filter (to match their spending txes)
     bool IsRelevantAndUpdate(const CTransaction& tx);
+    bool IsRelevantAndUpdate(const CBloomTxElements& elements);
 
     //! Checks for empty and full filters to avoid wasting cpu
     void UpdateEmptyFull();
@@ -105,9 +132,9 @@ public:
 /**
  * RollingBloomFilter is a probabilistic "keep track of most recently inserted" set.
  * Construct it with the number of items to keep track of, and a false-positive
- * rate. Unlike CBloomFilter, by default nTweak is set to a cryptographically
- * secure random value for you. Similarly rather than clear() the method
- * reset() is provided, which also changes nTweak to decrease the impact of
+ * rate. Unlike CBloomFilter, it is keyed with a cryptographically secure
+ * random SipHash key for you. Similarly rather than clear() the method
+ * reset() is provided, which also changes the key to decrease the impact of
  * false-positives.
  *
  * contains(item) will always return true if item was one of the last N to 1.5*N
@@ -136,8 +163,13 @@ private:
     int nEntriesThisGeneration;
     int nGeneration;
     std::vector<uint64_t> data;
-    unsigned int nTweak;
+    uint64_t nKey0;
+    uint64_t nKey1;
     int nHashFuncs;
+
+    //! Insert or look up a key by its SipHash
+    void insert(uint64_t nHash);
+    bool contains(uint64_t nHash) const;
 };
 
 #endif // BITCOIN_BLOOM_H
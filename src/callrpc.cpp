@@ -1,7 +1,13 @@
 #include "chainparamsbase.h"
 #include "callrpc.h"
+#include "limitedmap.h"
+#include "parentheaders.h"
+#include "primitives/transaction.h"
+#include "streams.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "validationstats.h"
+#include "version.h"
 #include "rpc/protocol.h"
 
 #include <event2/event.h>
@@ -9,18 +15,29 @@
 #include <event2/buffer.h>
 #include <event2/keyvalq_struct.h>
 
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
 using namespace std;
 
 /** Reply structure for request_done to fill in */
 struct HTTPReply
 {
+    HTTPReply(): status(0), done(false) {}
+
     int status;
     std::string body;
+    bool done;
 };
 
 static void http_request_done(struct evhttp_request *req, void *ctx)
 {
     HTTPReply *reply = static_cast<HTTPReply*>(ctx);
+    reply->done = true;
 
     if (req == NULL) {
         /* If req is NULL, it means an error occurred while connecting, but
@@ -43,7 +60,94 @@ static void http_request_done(struct evhttp_request *req, void *ctx)
     }
 }
 
-UniValue CallRPC(const string& strMethod, const UniValue& params, bool connectToMainchain)
+/** An HTTP connection to an RPC server, together with the event base that drives it */
+class CRPCConnection
+{
+public:
+    struct event_base *base;
+    struct evhttp_connection *evcon;
+    std::string host;
+    int port;
+
+    CRPCConnection(const std::string& hostIn, int portIn) : base(NULL), evcon(NULL), host(hostIn), port(portIn)
+    {
+        base = event_base_new();
+        if (!base)
+            throw runtime_error("cannot create event_base");
+
+        // Synchronously look up hostname
+        evcon = evhttp_connection_base_new(base, NULL, host.c_str(), port);
+        if (evcon == NULL) {
+            event_base_free(base);
+            throw runtime_error("create connection failed");
+        }
+        evhttp_connection_set_timeout(evcon, GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
+    }
+
+    ~CRPCConnection()
+    {
+        evhttp_connection_free(evcon);
+        event_base_free(base);
+    }
+};
+
+/**
+ * Idle keep-alive connections to the mainchain daemon, and to our own RPC
+ * server once SetRPCKeepAlive is on. Peg-in validation
+ * runs on the script check threads, so each caller takes a connection of
+ * its own and hands it back when done; libevent reconnects transparently
+ * if the server closed it in the meantime.
+ */
+class CRPCConnectionPool
+{
+private:
+    boost::mutex mutex;
+    std::vector<CRPCConnection*> vIdle;
+
+public:
+    ~CRPCConnectionPool()
+    {
+        BOOST_FOREACH(CRPCConnection* conn, vIdle)
+            delete conn;
+    }
+
+    CRPCConnection* Get(const std::string& host, int port)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            for (std::vector<CRPCConnection*>::iterator it = vIdle.begin(); it != vIdle.end(); ++it) {
+                if ((*it)->host == host && (*it)->port == port) {
+                    CRPCConnection* conn = *it;
+                    vIdle.erase(it);
+                    return conn;
+                }
+            }
+        }
+        return new CRPCConnection(host, port);
+    }
+
+    void Release(CRPCConnection* conn)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (vIdle.size() < MAX_MAINCHAIN_RPC_IDLE_CONNECTIONS) {
+            vIdle.push_back(conn);
+            return;
+        }
+        lock.unlock();
+        delete conn;
+    }
+};
+
+static CRPCConnectionPool keepAliveConnections;
+static bool fKeepAliveLocal = false;
+
+void SetRPCKeepAlive(bool fKeepAlive)
+{
+    fKeepAliveLocal = fKeepAlive;
+}
+
+/** Send a raw JSON-RPC request body and return the parsed reply, which is an object for single requests and an array for batches */
+static UniValue CallRPCRaw(const std::string& strRequest, bool connectToMainchain)
 {
     std::string strhost = "-rpcconnect";
     std::string strport = "-rpcport";
@@ -61,21 +165,6 @@ UniValue CallRPC(const string& strMethod, const UniValue& params, bool connectTo
     }
 
     std::string host = GetArg(strhost, DEFAULT_RPCHOST);
-    // Create event base
-    struct event_base *base = event_base_new(); // TODO RAII
-    if (!base)
-        throw runtime_error("cannot create event_base");
-
-    // Synchronously look up hostname
-    struct evhttp_connection *evcon = evhttp_connection_base_new(base, NULL, host.c_str(), port); // TODO RAII
-    if (evcon == NULL)
-        throw runtime_error("create connection failed");
-    evhttp_connection_set_timeout(evcon, GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
-
-    HTTPReply response;
-    struct evhttp_request *req = evhttp_request_new(http_request_done, (void*)&response); // TODO RAII
-    if (req == NULL)
-        throw runtime_error("create http request failed");
 
     // Get credentials
     std::string strRPCUserColonPass;
@@ -103,28 +192,45 @@ UniValue CallRPC(const string& strMethod, const UniValue& params, bool connectTo
             strRPCUserColonPass = mapArgs[struser] + ":" + mapArgs[strpassword];
     }
 
+    // Connections to the mainchain daemon are kept open between calls
+    const bool fKeepAlive = connectToMainchain || fKeepAliveLocal;
+    CRPCConnection *conn = fKeepAlive ? keepAliveConnections.Get(host, port) : new CRPCConnection(host, port);
+
+    HTTPReply response;
+    struct evhttp_request *req = evhttp_request_new(http_request_done, (void*)&response); // TODO RAII
+    if (req == NULL) {
+        delete conn;
+        throw runtime_error("create http request failed");
+    }
+
     struct evkeyvalq *output_headers = evhttp_request_get_output_headers(req);
     assert(output_headers);
     evhttp_add_header(output_headers, "Host", host.c_str());
-    evhttp_add_header(output_headers, "Connection", "close");
+    evhttp_add_header(output_headers, "Connection", fKeepAlive ? "keep-alive" : "close");
     evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
 
     // Attach request data
-    std::string strRequest = JSONRPCRequest(strMethod, params, 1);
     struct evbuffer * output_buffer = evhttp_request_get_output_buffer(req);
     assert(output_buffer);
     evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
 
-    int r = evhttp_make_request(evcon, req, EVHTTP_REQ_POST, "/");
+    int r = evhttp_make_request(conn->evcon, req, EVHTTP_REQ_POST, "/");
     if (r != 0) {
-        evhttp_connection_free(evcon);
-        event_base_free(base);
+        delete conn;
         throw CConnectionFailed("send http request failed");
     }
 
-    event_base_dispatch(base);
-    evhttp_connection_free(evcon);
-    event_base_free(base);
+    // A kept-alive connection stays registered with the event base, so run
+    // the loop until this request completes rather than until it is empty.
+    while (!response.done) {
+        if (event_base_loop(conn->base, EVLOOP_ONCE) != 0)
+            break;
+    }
+
+    if (fKeepAlive && response.status != 0)
+        keepAliveConnections.Release(conn);
+    else
+        delete conn;
 
     if (response.status == 0)
         throw CConnectionFailed("couldn't connect to server (make sure daemon is running and you are using the right rpc port)");
@@ -142,6 +248,12 @@ UniValue CallRPC(const string& strMethod, const UniValue& params, bool connectTo
     UniValue valReply(UniValue::VSTR);
     if (!valReply.read(response.body))
         throw runtime_error("couldn't parse reply from server");
+    return valReply;
+}
+
+UniValue CallRPC(const string& strMethod, const UniValue& params, bool connectToMainchain)
+{
+    UniValue valReply = CallRPCRaw(JSONRPCRequest(strMethod, params, 1), connectToMainchain);
     const UniValue& reply = valReply.get_obj();
     if (reply.empty())
         throw runtime_error("expected reply to have result, error and id properties");
@@ -149,13 +261,272 @@ UniValue CallRPC(const string& strMethod, const UniValue& params, bool connectTo
     return reply;
 }
 
+UniValue CallRPCBatch(const std::vector<std::pair<std::string, UniValue> >& vRequests, bool connectToMainchain)
+{
+    UniValue batch(UniValue::VARR);
+    for (size_t i = 0; i < vRequests.size(); i++)
+        batch.push_back(JSONRPCRequestObj(vRequests[i].first, vRequests[i].second, (uint64_t)i));
+
+    UniValue valReply = CallRPCRaw(batch.write() + "\n", connectToMainchain);
+    if (!valReply.isArray() || valReply.size() != vRequests.size())
+        throw runtime_error("expected one reply per batched request");
+
+    // Replies may come back in any order; put them in request order
+    std::vector<UniValue> vReplies(vRequests.size());
+    for (size_t i = 0; i < valReply.size(); i++) {
+        const UniValue& reply = valReply[i];
+        const UniValue& id = find_value(reply, "id");
+        if (!reply.isObject() || !id.isNum() || id.get_int64() < 0 || (uint64_t)id.get_int64() >= vRequests.size())
+            throw runtime_error("expected reply to have result, error and id properties");
+        vReplies[id.get_int64()] = reply;
+    }
+
+    UniValue replies(UniValue::VARR);
+    for (size_t i = 0; i < vReplies.size(); i++) {
+        if (vReplies[i].isNull())
+            throw runtime_error("missing reply to batched request");
+        replies.push_back(vReplies[i]);
+    }
+    return replies;
+}
+
+/**
+ * Parent chain blocks that have been seen with at least
+ * PARENT_BLOCK_CACHE_DEPTH confirmations. Such a block stays at least that
+ * deep unless the parent chain reorganizes, so peg-ins referring to it need
+ * no further round trips. Values are last-use sequence numbers, so the
+ * least recently used entry is evicted first.
+ */
+class CConfirmedParentBlockCache
+{
+private:
+    boost::mutex mutex;
+    limitedmap<uint256, uint64_t> mapBlocks;
+    uint64_t nSequence;
+    bool fDirty;
+
+    void EraseAll()
+    {
+        // limitedmap holds iterators into itself, so it cannot be reassigned
+        while (!mapBlocks.empty())
+            mapBlocks.erase(mapBlocks.begin()->first);
+    }
+
+public:
+    CConfirmedParentBlockCache() : mapBlocks(MAX_PARENT_BLOCK_CACHE_SIZE), nSequence(0), fDirty(false) {}
+
+    bool Contains(const uint256& hash)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        limitedmap<uint256, uint64_t>::const_iterator it = mapBlocks.find(hash);
+        if (it == mapBlocks.end())
+            return false;
+        mapBlocks.update(it, ++nSequence);
+        return true;
+    }
+
+    void Insert(const uint256& hash)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (mapBlocks.count(hash))
+            return;
+        mapBlocks.insert(std::make_pair(hash, ++nSequence));
+        fDirty = true;
+    }
+
+    void Clear()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fDirty = fDirty || !mapBlocks.empty();
+        EraseAll();
+    }
+
+    void Load(const std::vector<uint256>& vBlocks)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        EraseAll();
+        BOOST_FOREACH(const uint256& hash, vBlocks)
+            mapBlocks.insert(std::make_pair(hash, ++nSequence));
+        fDirty = false;
+    }
+
+    /** Entries ordered from least to most recently used; returns whether they changed since the last fResetDirty call */
+    bool Get(std::vector<uint256>& vBlocks, bool fResetDirty)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::vector<std::pair<uint64_t, uint256> > vSorted;
+        vSorted.reserve(mapBlocks.size());
+        for (limitedmap<uint256, uint64_t>::const_iterator it = mapBlocks.begin(); it != mapBlocks.end(); ++it)
+            vSorted.push_back(std::make_pair(it->second, it->first));
+        std::sort(vSorted.begin(), vSorted.end());
+
+        vBlocks.clear();
+        vBlocks.reserve(vSorted.size());
+        for (size_t i = 0; i < vSorted.size(); i++)
+            vBlocks.push_back(vSorted[i].second);
+
+        bool fWasDirty = fDirty;
+        if (fResetDirty)
+            fDirty = false;
+        return fWasDirty;
+    }
+};
+
+static CConfirmedParentBlockCache confirmedParentBlocks;
+
+void LoadConfirmedParentBlocks(const std::vector<uint256>& vBlocks)
+{
+    confirmedParentBlocks.Load(vBlocks);
+}
+
+bool GetConfirmedParentBlocks(std::vector<uint256>& vBlocks)
+{
+    return confirmedParentBlocks.Get(vBlocks, true);
+}
+
+void RecheckConfirmedParentBlocks()
+{
+    std::vector<uint256> vBlocks;
+    confirmedParentBlocks.Get(vBlocks, false);
+    if (vBlocks.empty())
+        return;
+
+    // A reorg of the parent chain deep enough to unconfirm a cached block
+    // shows up first in the most recently used entries.
+    std::vector<std::pair<std::string, UniValue> > vRequests;
+    for (size_t i = vBlocks.size() - std::min<size_t>(vBlocks.size(), PARENT_BLOCK_CACHE_RECHECK); i < vBlocks.size(); i++) {
+        UniValue params(UniValue::VARR);
+        params.push_back(vBlocks[i].GetHex());
+        vRequests.push_back(std::make_pair("getblockheader", params));
+    }
+
+    try {
+        UniValue replies = CallRPCBatch(vRequests, true);
+        for (size_t i = 0; i < replies.size(); i++) {
+            const UniValue& result = find_value(replies[i], "result");
+            const UniValue& confirmations = result.isObject() ? find_value(result.get_obj(), "confirmations") : NullUniValue;
+            if (!confirmations.isNum() || confirmations.get_int64() < PARENT_BLOCK_CACHE_DEPTH) {
+                LogPrintf("Parent chain block %s is no longer confirmed, clearing confirmed parent block cache\n", vRequests[i].second[0].get_str());
+                confirmedParentBlocks.Clear();
+                return;
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        // Keep the cache; it is rechecked on the next run
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+}
+
+/**
+ * Heights of the most recent parent chain blocks, as of the last parent tip
+ * notification. Within the window this answers confirmation questions
+ * without asking bitcoind; it is rebuilt wholesale on every new tip, which
+ * also takes care of parent reorgs.
+ */
+static boost::mutex csParentChainWindow;
+static std::map<uint256, int> mapParentChainWindow;
+static int nParentChainHeight = -1;
+static uint64_t nParentChainUpdates = 0;
+
+bool UpdateParentChainWindow(const uint256& genesishash)
+{
+    try {
+        std::vector<std::pair<std::string, UniValue> > vRequests;
+        UniValue params(UniValue::VARR);
+        params.push_back(UniValue(0));
+        vRequests.push_back(std::make_pair("getblockhash", params));
+        vRequests.push_back(std::make_pair("getblockcount", UniValue(UniValue::VARR)));
+        UniValue replies = CallRPCBatch(vRequests, true);
+        const UniValue& genesis = find_value(replies[0], "result");
+        if (!genesis.isStr() || genesis.get_str() != genesishash.GetHex())
+            return false;
+        const UniValue& count = find_value(replies[1], "result");
+        if (!count.isNum())
+            return false;
+        int nHeight = count.get_int();
+
+        vRequests.clear();
+        for (int h = std::max(0, nHeight - PARENT_CHAIN_WINDOW + 1); h <= nHeight; h++) {
+            UniValue params(UniValue::VARR);
+            params.push_back(UniValue(h));
+            vRequests.push_back(std::make_pair("getblockhash", params));
+        }
+        replies = CallRPCBatch(vRequests, true);
+
+        std::map<uint256, int> mapWindow;
+        for (size_t i = 0; i < replies.size(); i++) {
+            const UniValue& result = find_value(replies[i], "result");
+            if (!result.isStr())
+                return false;
+            mapWindow[uint256S(result.get_str())] = vRequests[i].second[0].get_int();
+        }
+
+        boost::unique_lock<boost::mutex> lock(csParentChainWindow);
+        mapParentChainWindow.swap(mapWindow);
+        nParentChainHeight = nHeight;
+        nParentChainUpdates++;
+        return true;
+    } catch (const std::runtime_error& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        return false;
+    }
+}
+
+uint64_t GetParentChainUpdateCount()
+{
+    boost::unique_lock<boost::mutex> lock(csParentChainWindow);
+    return nParentChainUpdates;
+}
+
+/** Confirmations of a block in the parent chain window, or -1 if it is not in it */
+static int GetParentChainWindowDepth(const uint256& hash)
+{
+    boost::unique_lock<boost::mutex> lock(csParentChainWindow);
+    std::map<uint256, int>::const_iterator it = mapParentChainWindow.find(hash);
+    if (it == mapParentChainWindow.end())
+        return -1;
+    return nParentChainHeight - it->second + 1;
+}
+
 bool IsConfirmedBitcoinBlock(const uint256& genesishash, const uint256& hash, int nMinConfirmationDepth)
 {
+    // The cache only holds blocks of the parent chain we talk to, so a
+    // hit also implies a matching parent genesis hash.
+    if (nMinConfirmationDepth <= PARENT_BLOCK_CACHE_DEPTH && confirmedParentBlocks.Contains(hash))
+        return true;
+
+    // So does the header store, which starts at the parent genesis block.
+    if (pparentheaders) {
+        int nDepth = pparentheaders->GetDepth(hash);
+        if (nDepth >= 0)
+            return nDepth >= nMinConfirmationDepth;
+    }
+
+    // The window is only filled after checking the parent genesis hash,
+    // so a block found in it is on the right chain.
+    int nDepth = GetParentChainWindowDepth(hash);
+    if (nDepth >= 0) {
+        if (nDepth >= PARENT_BLOCK_CACHE_DEPTH)
+            confirmedParentBlocks.Insert(hash);
+        return nDepth >= nMinConfirmationDepth;
+    }
 
     try {
+        // Ask for the parent genesis hash and the block in one round trip
+        std::vector<std::pair<std::string, UniValue> > vRequests;
         UniValue params(UniValue::VARR);
         params.push_back(UniValue(0));
-        UniValue reply = CallRPC("getblockhash", params, true);
+        vRequests.push_back(std::make_pair("getblockhash", params));
+        params = UniValue(UniValue::VARR);
+        params.push_back(hash.GetHex());
+        vRequests.push_back(std::make_pair("getblock", params));
+        UniValue replies;
+        {
+            CValidationTimer timer(VALIDATION_WITHDRAW_RPC);
+            replies = CallRPCBatch(vRequests, true);
+        }
+
+        UniValue reply = replies[0];
         if (!find_value(reply, "error").isNull())
             return false;
         UniValue result = find_value(reply, "result");
@@ -164,16 +535,18 @@ bool IsConfirmedBitcoinBlock(const uint256& genesishash, const uint256& hash, in
         if (result.get_str() != genesishash.GetHex())
             return false;
 
-        params = UniValue(UniValue::VARR);
-        params.push_back(hash.GetHex());
-        reply = CallRPC("getblock", params, true);
+        reply = replies[1];
         if (!find_value(reply, "error").isNull())
             return false;
         result = find_value(reply, "result");
         if (!result.isObject())
             return false;
         result = find_value(result.get_obj(), "confirmations");
-        return result.isNum() && result.get_int64() >= nMinConfirmationDepth;
+        if (!result.isNum())
+            return false;
+        if (result.get_int64() >= PARENT_BLOCK_CACHE_DEPTH)
+            confirmedParentBlocks.Insert(hash);
+        return result.get_int64() >= nMinConfirmationDepth;
     } catch (CConnectionFailed& e) {
         LogPrintf("ERROR: Lost connection to bitcoind RPC, you will want to restart after fixing this!\n");
         return false;
@@ -183,3 +556,132 @@ bool IsConfirmedBitcoinBlock(const uint256& genesishash, const uint256& hash, in
     }
     return true;
 }
+
+void PrefetchConfirmedBitcoinBlocks(const uint256& genesishash, const std::vector<uint256>& vHashes)
+{
+    std::vector<std::pair<std::string, UniValue> > vRequests;
+    UniValue params(UniValue::VARR);
+    params.push_back(UniValue(0));
+    vRequests.push_back(std::make_pair("getblockhash", params));
+    std::set<uint256> setAsked;
+    BOOST_FOREACH(const uint256& hash, vHashes) {
+        if (confirmedParentBlocks.Contains(hash) || GetParentChainWindowDepth(hash) >= 0 || !setAsked.insert(hash).second)
+            continue;
+        params = UniValue(UniValue::VARR);
+        params.push_back(hash.GetHex());
+        vRequests.push_back(std::make_pair("getblockheader", params));
+    }
+    if (setAsked.empty())
+        return;
+
+    try {
+        UniValue replies;
+        {
+            CValidationTimer timer(VALIDATION_WITHDRAW_RPC);
+            replies = CallRPCBatch(vRequests, true);
+        }
+        const UniValue& genesis = find_value(replies[0], "result");
+        if (!genesis.isStr() || genesis.get_str() != genesishash.GetHex())
+            return;
+        for (size_t i = 1; i < replies.size(); i++) {
+            const UniValue& result = find_value(replies[i], "result");
+            const UniValue& confirmations = result.isObject() ? find_value(result.get_obj(), "confirmations") : NullUniValue;
+            if (confirmations.isNum() && confirmations.get_int64() >= PARENT_BLOCK_CACHE_DEPTH)
+                confirmedParentBlocks.Insert(uint256S(vRequests[i].second[0].get_str()));
+        }
+    } catch (const std::runtime_error& e) {
+        // Whatever is missing gets checked one block at a time later
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+}
+
+bool SyncParentHeaders(const uint256& genesishash)
+{
+    if (!pparentheaders)
+        return false;
+    try {
+        const UniValue& count = find_value(CallRPC("getblockcount", UniValue(UniValue::VARR), true), "result");
+        if (!count.isNum())
+            return false;
+        const int nTip = count.get_int();
+
+        // Find the last stored block that is still in the parent daemon's
+        // best chain, stepping back further each time.
+        int nHeight = std::min(pparentheaders->Height(), nTip);
+        for (int nStep = 1; nHeight >= 0; nStep *= 2) {
+            UniValue params(UniValue::VARR);
+            params.push_back(UniValue(nHeight));
+            const UniValue& result = find_value(CallRPC("getblockhash", params, true), "result");
+            if (!result.isStr())
+                return false;
+            if (uint256S(result.get_str()) == pparentheaders->GetHash(nHeight))
+                break;
+            nHeight = nHeight > 0 ? std::max(nHeight - nStep, 0) : -1;
+        }
+
+        for (int nStart = nHeight + 1; nStart <= nTip; nStart += PARENT_HEADER_SYNC_BATCH) {
+            boost::this_thread::interruption_point();
+            const int nEnd = std::min(nStart + PARENT_HEADER_SYNC_BATCH - 1, nTip);
+            std::vector<std::pair<std::string, UniValue> > vRequests;
+            for (int h = nStart; h <= nEnd; h++) {
+                UniValue params(UniValue::VARR);
+                params.push_back(UniValue(h));
+                vRequests.push_back(std::make_pair("getblockhash", params));
+            }
+            UniValue replies = CallRPCBatch(vRequests, true);
+
+            vRequests.clear();
+            for (size_t i = 0; i < replies.size(); i++) {
+                const UniValue& result = find_value(replies[i], "result");
+                if (!result.isStr())
+                    return false;
+                UniValue params(UniValue::VARR);
+                params.push_back(result);
+                params.push_back(UniValue(false));
+                vRequests.push_back(std::make_pair("getblockheader", params));
+            }
+            replies = CallRPCBatch(vRequests, true);
+
+            std::vector<CBlockHeader> vHeaders(replies.size());
+            for (size_t i = 0; i < replies.size(); i++) {
+                const UniValue& result = find_value(replies[i], "result");
+                if (!result.isStr() || !IsHex(result.get_str()))
+                    return false;
+                CDataStream ss(ParseHex(result.get_str()), SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX);
+                ss >> vHeaders[i];
+            }
+            std::string strError;
+            if (!pparentheaders->Connect(nStart, vHeaders, strError)) {
+                LogPrintf("%s: %s\n", __func__, strError);
+                return false;
+            }
+        }
+        return true;
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        return false;
+    }
+}
+
+static boost::mutex csParentHeaderSync;
+static boost::condition_variable condParentHeaderSync;
+static bool fParentHeaderSyncWanted = false;
+
+void ThreadParentHeaderSync(const uint256& genesishash)
+{
+    while (true) {
+        SyncParentHeaders(genesishash);
+
+        boost::unique_lock<boost::mutex> lock(csParentHeaderSync);
+        const boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(PARENT_HEADER_SYNC_INTERVAL);
+        while (!fParentHeaderSyncWanted && condParentHeaderSync.timed_wait(lock, deadline)) {}
+        fParentHeaderSyncWanted = false;
+    }
+}
+
+void WakeParentHeaderSync()
+{
+    boost::unique_lock<boost::mutex> lock(csParentHeaderSync);
+    fParentHeaderSyncWanted = true;
+    condParentHeaderSync.notify_one();
+}
@@ -12,11 +12,27 @@
 
 #include <string>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
 #include <univalue.h>
 
 static const char DEFAULT_RPCHOST[] = "127.0.0.1";
 static const int DEFAULT_HTTP_CLIENT_TIMEOUT=900;
+//! Number of idle keep-alive connections to the mainchain daemon kept around for reuse
+static const unsigned int MAX_MAINCHAIN_RPC_IDLE_CONNECTIONS = 8;
+//! Parent chain blocks with at least this many confirmations are remembered as confirmed
+static const int PARENT_BLOCK_CACHE_DEPTH = 10;
+//! Maximum number of confirmed parent chain block hashes to remember
+static const unsigned int MAX_PARENT_BLOCK_CACHE_SIZE = 100000;
+//! Number of most recently confirmed parent chain blocks to re-check for a parent reorg
+static const unsigned int PARENT_BLOCK_CACHE_RECHECK = 100;
+//! Number of parent chain headers fetched from the parent daemon per batch when filling the header store
+static const int PARENT_HEADER_SYNC_BATCH = 2000;
+//! Seconds between polls of the parent daemon for new headers, unless woken by a parent tip notification
+static const int PARENT_HEADER_SYNC_INTERVAL = 30;
+//! Number of blocks at the parent chain tip tracked when following it via ZMQ
+static const int PARENT_CHAIN_WINDOW = 1000;
 
 //
 // Exception thrown on connection error.  This error is used to determine
@@ -33,6 +49,39 @@ public:
 };
 
 UniValue CallRPC(const std::string& strMethod, const UniValue& params, bool connectToMainchain=false);
+/** Keep the connection to our own RPC server open between calls too, rather than only those to the mainchain daemon */
+void SetRPCKeepAlive(bool fKeepAlive);
+/** Send several (method, params) requests as one JSON-RPC batch; the replies are returned in request order */
+UniValue CallRPCBatch(const std::vector<std::pair<std::string, UniValue> >& vRequests, bool connectToMainchain=false);
 bool IsConfirmedBitcoinBlock(const uint256& genesishash, const uint256& hash, int nMinConfirmationDepth);
+/**
+ * Ask the parent daemon about several blocks in one round trip, and cache
+ * those buried at least PARENT_BLOCK_CACHE_DEPTH deep, so that checking
+ * peg-ins that refer to them needs no further round trips.
+ */
+void PrefetchConfirmedBitcoinBlocks(const uint256& genesishash, const std::vector<uint256>& vHashes);
+
+/** Replace the confirmed parent block cache with vBlocks, least recently used first */
+void LoadConfirmedParentBlocks(const std::vector<uint256>& vBlocks);
+/** Get the confirmed parent block cache contents, least recently used first. Returns whether they changed since the last call. */
+bool GetConfirmedParentBlocks(std::vector<uint256>& vBlocks);
+/** Ask the parent daemon whether the most recently confirmed parent blocks are still buried, and forget them all if not */
+void RecheckConfirmedParentBlocks();
+
+/** Re-read the hashes of the PARENT_CHAIN_WINDOW blocks at the parent chain tip; called whenever that tip changes */
+bool UpdateParentChainWindow(const uint256& genesishash);
+/** Number of successful UpdateParentChainWindow calls, 0 if the parent chain tip is not being followed */
+uint64_t GetParentChainUpdateCount();
+
+/**
+ * Bring the parent header store (-parentheaders) up to the parent daemon's
+ * best chain, fetching the missing headers in batches of getblockheader
+ * calls and undoing any parent reorg first.
+ */
+bool SyncParentHeaders(const uint256& genesishash);
+/** Keep the parent header store in sync, every PARENT_HEADER_SYNC_INTERVAL seconds or when woken */
+void ThreadParentHeaderSync(const uint256& genesishash);
+/** Have ThreadParentHeaderSync sync now, as the parent chain tip moved */
+void WakeParentHeaderSync();
 
 #endif // BITCOIN_CALLRPC_H
@@ -5,6 +5,10 @@
 
 #include "chain.h"
 
+#include "sync.h"
+
+#include <set>
+
 using namespace std;
 
 /**
@@ -61,6 +65,28 @@ const CBlockIndex *CChain::FindFork(const CBlockIndex *pindex) const {
     return pindex;
 }
 
+CChainSnapshot::CChainSnapshot(const CChain& chain, const CChainSnapshot* prev) : nHeight(chain.Height())
+{
+    const int nChunks = (nHeight + CHUNK_SIZE) / CHUNK_SIZE;
+    vChunks.reserve(nChunks);
+    for (int i = 0; i < nChunks; i++) {
+        const int nBegin = i * CHUNK_SIZE;
+        const int nEnd = std::min(nBegin + CHUNK_SIZE, nHeight + 1);
+        // A chunk ending at the same block holds the same blocks, as each
+        // block has a single chain of ancestors.
+        if (prev && i < (int)prev->vChunks.size() && (int)prev->vChunks[i]->size() == nEnd - nBegin &&
+            prev->vChunks[i]->back() == chain[nEnd - 1]) {
+            vChunks.push_back(prev->vChunks[i]);
+            continue;
+        }
+        std::shared_ptr<std::vector<CBlockIndex*> > chunk = std::make_shared<std::vector<CBlockIndex*> >();
+        chunk->reserve(nEnd - nBegin);
+        for (int h = nBegin; h < nEnd; h++)
+            chunk->push_back(chain[h]);
+        vChunks.push_back(chunk);
+    }
+}
+
 /** Turn the lowest '1' bit in the binary representation of a number into a '0'. */
 int static inline InvertLowestOne(int n) { return n & (n - 1); }
 
@@ -112,6 +138,23 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
+static CCriticalSection cs_challenges;
+static std::set<CScript> setChallenges;
+
+const CScript* InternChallenge(const CScript& challenge)
+{
+    if (challenge.empty())
+        return NULL;
+    LOCK(cs_challenges);
+    return &*setChallenges.insert(challenge).first;
+}
+
+const CScript& CBlockIndex::GetChallenge() const
+{
+    static const CScript empty;
+    return pchallenge ? *pchallenge : empty;
+}
+
 arith_uint256 GetBlockProof(const CBlockIndex& block)
 {
     return 1;
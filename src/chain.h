@@ -12,6 +12,7 @@
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <memory>
 #include <vector>
 
 class CBlockFileInfo
@@ -146,8 +147,17 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+    BLOCK_PROOF_VALID        =   256, //!< proof (as stored in this index) passed CheckProof
+    BLOCK_RANGEPROOFS_PRUNED =   512, //!< block data in blk*.dat had its rangeproofs removed by -prunerangeproofs
 };
 
+/**
+ * Shared copy of a block signing challenge, or NULL if it is empty. Nearly
+ * all blocks have the challenge of their parent, so block indexes keep a
+ * pointer to one of these instead of a copy each. They are never freed.
+ */
+const CScript* InternChallenge(const CScript& challenge);
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -196,7 +206,13 @@ public:
     int nVersion;
     uint256 hashMerkleRoot;
     unsigned int nTime;
-    CProof proof;
+    //! Block signing challenge, shared by all indexes with the same one (see InternChallenge); NULL if empty
+    const CScript* pchallenge;
+    //! Block signing solution, unless fSolutionDropped
+    CScript solution;
+
+    //! (memory only) Whether solution was dropped from memory, to be read back from the block tree when needed
+    bool fSolutionDropped;
 
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
@@ -219,7 +235,9 @@ public:
         nVersion       = 0;
         hashMerkleRoot = uint256();
         nTime          = 0;
-        proof.SetNull();
+        pchallenge     = NULL;
+        solution.clear();
+        fSolutionDropped = false;
     }
 
     CBlockIndex()
@@ -235,7 +253,7 @@ public:
         hashMerkleRoot = block.hashMerkleRoot;
         nTime          = block.nTime;
         nHeight        = block.nHeight;
-        proof          = block.proof;
+        SetProof(block.proof);
     }
 
     CDiskBlockPos GetBlockPos() const {
@@ -265,10 +283,32 @@ public:
         block.hashMerkleRoot = hashMerkleRoot;
         block.nTime          = nTime;
         block.nHeight        = nHeight;
-        block.proof          = proof;
+        block.proof          = GetProof();
         return block;
     }
 
+    const CScript& GetChallenge() const;
+
+    //! The block proof; its solution is empty if it was dropped, see GetBlockIndexHeader
+    CProof GetProof() const
+    {
+        return CProof(GetChallenge(), solution);
+    }
+
+    void SetProof(const CProof& proof)
+    {
+        pchallenge       = InternChallenge(proof.challenge);
+        solution         = proof.solution;
+        fSolutionDropped = false;
+    }
+
+    //! Free the solution, which the block tree database must hold
+    void DropSolution()
+    {
+        CScript().swap(solution);
+        fSolutionDropped = true;
+    }
+
     uint256 GetBlockHash() const
     {
         return *phashBlock;
@@ -374,7 +414,12 @@ public:
         READWRITE(hashPrev);
         READWRITE(hashMerkleRoot);
         READWRITE(nTime);
+        CProof proof;
+        if (!ser_action.ForRead())
+            proof = GetProof();
         READWRITE(proof);
+        if (ser_action.ForRead())
+            SetProof(proof);
     }
 
     uint256 GetBlockHash() const
@@ -384,7 +429,7 @@ public:
         block.hashPrevBlock   = hashPrev;
         block.hashMerkleRoot  = hashMerkleRoot;
         block.nTime           = nTime;
-        block.proof           = proof;
+        block.proof           = GetProof();
         block.nHeight         = nHeight;
         return block.GetHash();
     }
@@ -458,4 +503,52 @@ public:
     const CBlockIndex *FindFork(const CBlockIndex *pindex) const;
 };
 
+/**
+ * An immutable copy of a CChain, which can be read without any lock while
+ * the chain moves on. The entries are kept in chunks, and a copy shares the
+ * chunks below the fork point with the copy it was made after, so making one
+ * costs little more than the entries that changed.
+ */
+class CChainSnapshot {
+private:
+    static const int CHUNK_SIZE = 1024;
+    std::vector<std::shared_ptr<const std::vector<CBlockIndex*> > > vChunks;
+    int nHeight;
+
+public:
+    CChainSnapshot() : nHeight(-1) {}
+
+    /** Copy chain, sharing the chunks it has in common with prev, if any. */
+    CChainSnapshot(const CChain& chain, const CChainSnapshot* prev);
+
+    CBlockIndex *Genesis() const {
+        return (*this)[0];
+    }
+
+    CBlockIndex *Tip() const {
+        return (*this)[nHeight];
+    }
+
+    CBlockIndex *operator[](int nHeightIn) const {
+        if (nHeightIn < 0 || nHeightIn > nHeight)
+            return NULL;
+        return (*vChunks[nHeightIn / CHUNK_SIZE])[nHeightIn % CHUNK_SIZE];
+    }
+
+    bool Contains(const CBlockIndex *pindex) const {
+        return (*this)[pindex->nHeight] == pindex;
+    }
+
+    CBlockIndex *Next(const CBlockIndex *pindex) const {
+        if (Contains(pindex))
+            return (*this)[pindex->nHeight + 1];
+        else
+            return NULL;
+    }
+
+    int Height() const {
+        return nHeight;
+    }
+};
+
 #endif // BITCOIN_CHAIN_H
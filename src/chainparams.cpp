@@ -13,6 +13,7 @@
 
 #include <assert.h>
 
+#include <boost/algorithm/string.hpp>
 #include <boost/assign/list_of.hpp>
 #include <boost/scoped_ptr.hpp>
 
@@ -30,6 +31,25 @@ static CScript StrHexToScriptWithDefault(std::string strScript, const CScript de
     return returnScript;
 }
 
+/** Parse -assumeutxo=<height>:<blockhash>:<snapshothash>:<nchaintx>; malformed values are ignored. */
+static MapAssumeutxo ParseAssumeutxo(const std::string& strArg)
+{
+    MapAssumeutxo mapRet;
+    std::vector<std::string> vParts;
+    boost::split(vParts, strArg, boost::is_any_of(":"));
+    int32_t nHeight;
+    int32_t nChainTx;
+    if (vParts.size() != 4 || !ParseInt32(vParts[0], &nHeight) || nHeight <= 0 ||
+        !IsHex(vParts[1]) || vParts[1].size() != 64 || !IsHex(vParts[2]) || vParts[2].size() != 64 ||
+        !ParseInt32(vParts[3], &nChainTx) || nChainTx <= nHeight)
+        return mapRet;
+    CAssumeutxoData& data = mapRet[nHeight];
+    data.hashBlock = uint256S(vParts[1]);
+    data.hashSnapshot = uint256S(vParts[2]);
+    data.nChainTx = nChainTx;
+    return mapRet;
+}
+
 static CBlock CreateGenesisBlock(const char* pszTimestamp, const CScript& genesisOutputScript, uint32_t nTime, const CScript& scriptChallenge, int32_t nVersion, const CAmount& genesisReward, const uint32_t rewardShards)
 {
     // Shards must be evenly divisible
@@ -48,7 +68,7 @@ static CBlock CreateGenesisBlock(const char* pszTimestamp, const CScript& genesi
     genesis.nTime    = nTime;
     genesis.proof = CProof(scriptChallenge, CScript());
     genesis.nVersion = nVersion;
-    genesis.vtx.push_back(txNew);
+    genesis.vtx.push_back(MakeTransactionRef(std::move(txNew)));
     genesis.hashPrevBlock.SetNull();
     genesis.hashMerkleRoot = BlockMerkleRoot(genesis);
     return genesis;
@@ -110,6 +130,9 @@ public:
         consensus.vDeployments[Consensus::DEPLOYMENT_SEGWIT].nStartTime = 1479168000; // November 15th, 2016.
         consensus.vDeployments[Consensus::DEPLOYMENT_SEGWIT].nTimeout = 1510704000; // November 15th, 2017.
 
+        // No block of this chain is buried deep enough to be trusted by default yet.
+        consensus.defaultAssumeValid = uint256();
+
         /**
          * The message start string is designed to be unlikely to occur in normal data.
          * The characters are rarely used upper ASCII, not valid as UTF-8, and produce
@@ -145,6 +168,7 @@ public:
             0,
             0
         };
+        mapAssumeutxo = ParseAssumeutxo(GetArg("-assumeutxo", "", mapArgs));
         base58Prefixes[PUBKEY_ADDRESS] = std::vector<unsigned char>(1,235);
         base58Prefixes[SCRIPT_ADDRESS] = std::vector<unsigned char>(1,40);
         base58Prefixes[BLINDED_ADDRESS]= std::vector<unsigned char>(1,4);
@@ -220,6 +244,8 @@ public:
         consensus.vDeployments[Consensus::DEPLOYMENT_SEGWIT].nStartTime = 0;
         consensus.vDeployments[Consensus::DEPLOYMENT_SEGWIT].nTimeout = 999999999999ULL;
 
+        consensus.defaultAssumeValid = uint256();
+
         pchMessageStart[0] = 0xfa;
         pchMessageStart[1] = 0xbf;
         pchMessageStart[2] = 0xb5;
@@ -250,6 +276,7 @@ public:
             0,
             0
         };
+        mapAssumeutxo = ParseAssumeutxo(GetArg("-assumeutxo", "", mapArgs));
         base58Prefixes[PUBKEY_ADDRESS] = std::vector<unsigned char>(1,235);
         base58Prefixes[SCRIPT_ADDRESS] = std::vector<unsigned char>(1,40);
         base58Prefixes[BLINDED_ADDRESS]= std::vector<unsigned char>(1,4);
@@ -33,6 +33,15 @@ struct CCheckpointData {
     double fTransactionsPerDay;
 };
 
+/** A UTXO snapshot (see loadtxoutset) that the chain trusts, by height */
+struct CAssumeutxoData {
+    uint256 hashBlock;      //!< block the snapshot's chainstate is at
+    uint256 hashSnapshot;   //!< hash of the snapshot's contents, as reported by dumptxoutset
+    unsigned int nChainTx;  //!< transactions in the chain up to and including hashBlock
+};
+
+typedef std::map<int, CAssumeutxoData> MapAssumeutxo;
+
 /**
  * CChainParams defines various tweakable parameters of a given instance of the
  * Bitcoin system. There are three: the main network on which people trade goods
@@ -84,6 +93,7 @@ public:
     const std::vector<unsigned char>& Base58Prefix(Base58Type type) const { return base58Prefixes[type]; }
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
+    const MapAssumeutxo& Assumeutxo() const { return mapAssumeutxo; }
     /** Only allowed in regtest for testing purposes, otherwise NOP */
     void UpdateBIP9Parameters(Consensus::DeploymentPos d, int64_t nStartTime, int64_t nTimeout) {};
     /** All coinbase outputs (after genesis) must be to this destination */
@@ -114,6 +124,7 @@ protected:
     bool fMineBlocksOnDemand;
     bool fTestnetToBeDeprecatedFieldRPC;
     CCheckpointData checkpointData;
+    MapAssumeutxo mapAssumeutxo;
     CScript scriptCoinbaseDestination;
 };
 
@@ -17,6 +17,7 @@ void AppendParamsHelpMessages(std::string& strUsage, bool debugHelp)
 {
     strUsage += HelpMessageGroup(_("Chain selection options:"));
     strUsage += HelpMessageOpt("-chain=<chain>", strprintf(_("Use the chain <chain> (default: %s). Allowed values: main, testnet, regtest"), CHAINPARAMS_ELEMENTS));
+    strUsage += HelpMessageOpt("-assumeutxo=<height>:<blockhash>:<snapshothash>:<nchaintx>", _("Trust the UTXO snapshot with this hash at this block for loadtxoutset; nchaintx is the number of transactions up to and including it"));
     if (debugHelp) {
         strUsage += HelpMessageOpt("-regtest", "Enter regression test mode, which uses a special chain in which blocks can be solved instantly. "
                                    "This is intended for regression testing tools and app development.");
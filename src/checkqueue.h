@@ -5,7 +5,11 @@
 #ifndef BITCOIN_CHECKQUEUE_H
 #define BITCOIN_CHECKQUEUE_H
 
+#include "utiltime.h"
+
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -16,154 +20,321 @@
 template <typename T>
 class CCheckQueueControl;
 
+/** Counters describing how the workers of a CCheckQueue spent one Wait(). */
+struct CCheckQueueStats
+{
+    //! Number of times a worker that ran dry took checks from another worker
+    unsigned int nSteals;
+    //! Time workers (including the master) spent waiting while checks were still outstanding
+    int64_t nIdleMicros;
+
+    CCheckQueueStats() : nSteals(0), nIdleMicros(0) {}
+};
+
 /** 
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
-  * operator(), returning a bool.
+  * operator(), returning a bool, and a GetCost() giving a rough estimate of
+  * how expensive that is.
   *
   * One thread (the master) is assumed to push batches of verifications
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker has its own deque of checks. Add() hands each check to the
+  * worker with the least queued cost, putting expensive checks at the front
+  * so they are started early. A worker takes checks from the front of its
+  * own deque, and once that is empty steals half of the deque of whichever
+  * worker has the most work left, from its back.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
+    //! Maximum number of workers (including the master) that can share the work.
+    static const unsigned int MAX_WORKERS = 64;
+
+    /** The checks assigned to one worker. */
+    struct WorkerQueue
+    {
+        boost::mutex mutex;
+        std::deque<T*> checks;
+        //! Total cost of the checks in the deque, read without the lock to pick a worker
+        std::atomic<uint64_t> nCost;
+
+        WorkerQueue() : nCost(0) {}
+    };
+
+    //! Per-worker deques; slot 0 belongs to the master, the others to Thread()s in order of arrival.
+    WorkerQueue queues[MAX_WORKERS];
+
+    //! Highest slot handed out to a Thread() so far.
+    std::atomic<unsigned int> nWorkerSlots;
+
     //! Mutex to protect the inner state
     boost::mutex mutex;
 
+    //! Which slots belong to a running Thread(); slots of exited threads are reused.
+    bool fSlotTaken[MAX_WORKERS];
+
+    /** Gives a worker's slot back when its Thread() exits, including by interruption. */
+    struct SlotRelease
+    {
+        CCheckQueue* pqueue;
+        unsigned int nSlot;
+
+        SlotRelease(CCheckQueue* pqueueIn, unsigned int nSlotIn) : pqueue(pqueueIn), nSlot(nSlotIn) {}
+        ~SlotRelease()
+        {
+            boost::unique_lock<boost::mutex> lock(pqueue->mutex);
+            pqueue->fSlotTaken[nSlot] = false;
+            pqueue->nIdleSince[nSlot] = 0;
+        }
+    };
+
     //! Worker threads block on this when out of work
     boost::condition_variable condWorker;
 
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    //! This should really be a vector of unique_ptr's, but that's C++11.
-    std::vector<T*> queue;
-
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
-
-    //! The total number of workers (including the master).
-    int nTotal;
-
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
+
+    //! Number of verifications still sitting in one of the deques.
+    std::atomic<unsigned int> nQueued;
 
     //! Whether we're shutting down.
     bool fQuit;
 
-    //! The maximum number of elements to be processed in one batch
+    //! The maximum number of elements taken in one steal
     unsigned int nBatchSize;
 
+    //! Statistics for the current Wait(), and when each idle worker started waiting (0 if it isn't).
+    CCheckQueueStats stats;
+    int64_t nIdleSince[MAX_WORKERS];
+
+    /** Take the check at the front of a worker's own deque. */
+    T* TakeOwn(unsigned int nSlot)
+    {
+        WorkerQueue& own = queues[nSlot];
+        boost::unique_lock<boost::mutex> lock(own.mutex);
+        if (own.checks.empty())
+            return NULL;
+        T* check = own.checks.front();
+        own.checks.pop_front();
+        own.nCost -= check->GetCost();
+        nQueued--;
+        return check;
+    }
+
+    /** Move up to half of the deque of the busiest other worker into vChecks. */
+    void Steal(unsigned int nSlot, std::vector<T*>& vChecks)
+    {
+        const unsigned int nSlots = nWorkerSlots + 1;
+        unsigned int nVictim = nSlot;
+        uint64_t nMaxCost = 0;
+        for (unsigned int i = 0; i < nSlots; i++) {
+            if (i != nSlot && queues[i].nCost > nMaxCost) {
+                nMaxCost = queues[i].nCost;
+                nVictim = i;
+            }
+        }
+        if (nVictim == nSlot)
+            return;
+        WorkerQueue& victim = queues[nVictim];
+        boost::unique_lock<boost::mutex> lock(victim.mutex);
+        unsigned int nSteal = std::min(nBatchSize, std::max(1U, (unsigned int)victim.checks.size() / 2));
+        while (nSteal-- && !victim.checks.empty()) {
+            T* check = victim.checks.back();
+            victim.checks.pop_back();
+            victim.nCost -= check->GetCost();
+            nQueued--;
+            vChecks.push_back(check);
+        }
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(unsigned int nSlot, bool fMaster = false)
     {
         boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T*> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
+            vChecks.clear();
+            T* check = TakeOwn(nSlot);
+            if (check != NULL) {
+                vChecks.push_back(check);
+            } else {
+                Steal(nSlot, vChecks);
+                if (!vChecks.empty()) {
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    stats.nSteals++;
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+            }
+            if (!vChecks.empty()) {
+                // execute work; once anything failed the rest is only freed
+                bool fOk = fAllOk;
+                BOOST_FOREACH (T* check, vChecks) {
+                    if (fOk)
+                        fOk = (*check)();
+                    delete check;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.clear();
-                vChecks.insert(vChecks.end(), queue.end() - nNow, queue.end());
-                queue.resize(queue.size() - nNow);
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                if (!fOk)
+                    fAllOk = false;
+                if (nTodo.fetch_sub(vChecks.size()) == vChecks.size()) {
+                    // We processed the last element; inform the master it can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    condMaster.notify_one();
+                }
+                continue;
             }
-            // execute work
-            BOOST_FOREACH (T* check, vChecks) {
-                if (fOk)
-                    fOk = (*check)();
-                delete check;
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            // Checks taken from a deque but not yet accounted for in nQueued
+            // make us go around once more instead of sleeping.
+            while (nQueued == 0) {
+                if ((fMaster || fQuit) && nTodo == 0) {
+                    bool fRet = fAllOk;
+                    // reset the status for new work later
+                    if (fMaster) {
+                        fAllOk = true;
+                        int64_t nNow = GetTimeMicros();
+                        for (unsigned int i = 0; i < MAX_WORKERS; i++) {
+                            if (nIdleSince[i]) {
+                                stats.nIdleMicros += nNow - nIdleSince[i];
+                                nIdleSince[i] = 0;
+                            }
+                        }
+                    }
+                    // return the current status
+                    return fRet;
+                }
+                if (nTodo > 0)
+                    nIdleSince[nSlot] = GetTimeMicros();
+                cond.wait(lock); // wait
+                if (nIdleSince[nSlot]) {
+                    stats.nIdleMicros += GetTimeMicros() - nIdleSince[nSlot];
+                    nIdleSince[nSlot] = 0;
+                }
             }
-            vChecks.clear();
         } while (true);
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nWorkerSlots(0), fAllOk(true), nTodo(0), nQueued(0), fQuit(false), nBatchSize(nBatchSizeIn)
+    {
+        std::fill(nIdleSince, nIdleSince + MAX_WORKERS, 0);
+        std::fill(fSlotTaken, fSlotTaken + MAX_WORKERS, false);
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        unsigned int nSlot = 1;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (nSlot < MAX_WORKERS && fSlotTaken[nSlot])
+                nSlot++;
+            assert(nSlot < MAX_WORKERS);
+            fSlotTaken[nSlot] = true;
+            if (nSlot > nWorkerSlots)
+                nWorkerSlots = nSlot;
+        }
+        // Checks left in the deque of an exited worker are stolen by the others.
+        SlotRelease release(this, nSlot);
+        Loop(nSlot);
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        return Loop(0, true);
     }
 
     //! Add a batch of checks to the queue and takes ownership of them
     void Add(const std::vector<T*> vChecks)
     {
+        if (vChecks.empty())
+            return;
+        // Hand out checks from the most expensive down, each to the worker
+        // with the least work queued.
+        const unsigned int nSlots = std::min(nWorkerSlots + 1, MAX_WORKERS);
+        std::vector<uint64_t> vLoad(nSlots);
+        for (unsigned int i = 0; i < nSlots; i++)
+            vLoad[i] = queues[i].nCost;
+        std::vector<std::pair<unsigned int, T*> > vSorted;
+        vSorted.reserve(vChecks.size());
+        BOOST_FOREACH(T* check, vChecks)
+            vSorted.push_back(std::make_pair(check->GetCost(), check));
+        std::stable_sort(vSorted.begin(), vSorted.end(), CompareCost);
+        std::vector<std::vector<std::pair<unsigned int, T*> > > vAssigned(nSlots);
+        for (size_t i = 0; i < vSorted.size(); i++) {
+            unsigned int nSlot = std::min_element(vLoad.begin(), vLoad.end()) - vLoad.begin();
+            vLoad[nSlot] += vSorted[i].first;
+            vAssigned[nSlot].push_back(vSorted[i]);
+        }
+        for (unsigned int nSlot = 0; nSlot < nSlots; nSlot++) {
+            if (vAssigned[nSlot].empty())
+                continue;
+            // Expensive checks go to the front, most expensive first.
+            std::vector<T*> vExpensive;
+            WorkerQueue& queue = queues[nSlot];
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            for (size_t i = 0; i < vAssigned[nSlot].size(); i++) {
+                if (vAssigned[nSlot][i].first > 1)
+                    vExpensive.push_back(vAssigned[nSlot][i].second);
+                else
+                    queue.checks.push_back(vAssigned[nSlot][i].second);
+                queue.nCost += vAssigned[nSlot][i].first;
+            }
+            queue.checks.insert(queue.checks.begin(), vExpensive.begin(), vExpensive.end());
+        }
         boost::unique_lock<boost::mutex> lock(mutex);
-        queue.insert(queue.end(), vChecks.begin(), vChecks.end());
         nTodo += vChecks.size();
+        nQueued += vChecks.size();
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
     ~CCheckQueue()
     {
-        assert(queue.empty());
+        for (unsigned int i = 0; i < MAX_WORKERS; i++)
+            assert(queues[i].checks.empty());
     }
 
+    //! Whether all work has been done. Workers may still be on their way to sleep.
     bool IsIdle()
     {
         boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return (nTodo == 0 && nQueued == 0 && fAllOk == true);
     }
 
+    //! Return the statistics gathered since the last call, and reset them.
+    CCheckQueueStats GetStats()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CCheckQueueStats ret = stats;
+        stats = CCheckQueueStats();
+        return ret;
+    }
+
+private:
+    static bool CompareCost(const std::pair<unsigned int, T*>& a, const std::pair<unsigned int, T*>& b)
+    {
+        return a.first > b.first;
+    }
 };
 
 /** 
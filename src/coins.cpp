@@ -4,11 +4,56 @@
 
 #include "coins.h"
 
+#include "crypto/sha256.h"
 #include "memusage.h"
 #include "random.h"
 
 #include <assert.h>
 
+#include <algorithm>
+
+void CUTXOStats::SetNull()
+{
+    nTransactionOutputs = 0;
+    nBlindedOutputs = 0;
+    nTotalAmount = 0;
+    nLockedAmount = 0;
+    memset(lanes, 0, sizeof(lanes));
+}
+
+void CUTXOStats::Update(const COutPoint& outpoint, const CTxOut& txout, int nSign)
+{
+    nTransactionOutputs += nSign;
+    if (txout.nValue.IsAmount()) {
+        nTotalAmount += nSign * txout.nValue.GetAmount();
+        if (txout.scriptPubKey.IsWithdrawLock())
+            nLockedAmount += nSign * txout.nValue.GetAmount();
+    } else {
+        nBlindedOutputs += nSign;
+    }
+
+    // Expand the hash of the output to the lanes, 16 lanes per SHA256.
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << outpoint << txout;
+    const uint256 seed = ss.GetHash();
+    unsigned char buf[CSHA256::OUTPUT_SIZE];
+    for (uint32_t nBlock = 0; nBlock < UTXO_HASH_LANES / 16; nBlock++) {
+        unsigned char counter[4];
+        WriteLE32(counter, nBlock);
+        CSHA256().Write(seed.begin(), seed.size()).Write(counter, sizeof(counter)).Finalize(buf);
+        for (int i = 0; i < 16; i++)
+            lanes[nBlock * 16 + i] += nSign * ReadLE16(buf + 2 * i);
+    }
+}
+
+uint256 CUTXOStats::GetSetHash() const
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    for (size_t i = 0; i < UTXO_HASH_LANES; i++)
+        ss << lanes[i];
+    return ss.GetHash();
+}
+
 /**
  * calculate number of bytes for the bitmask, and its number of non-zero bytes
  * each bit in the bitmask represents the availability of one output, but the
@@ -46,7 +91,11 @@ bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
 bool CCoinsView::IsWithdrawSpent(const std::pair<uint256, COutPoint> &outpoint) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::Sync() { return true; }
 CCoinsViewCursor *CCoinsView::Cursor() const { return 0; }
+bool CCoinsView::GetUTXOStats(const uint256 &hashBlock, CUTXOStats &stats) const { return false; }
+void CCoinsView::SetUTXOStats(const uint256 &hashBlock, const CUTXOStats &stats) { }
+bool CCoinsView::GetWithdrawsSpent(std::vector<std::pair<uint256, COutPoint> > &vSpent) const { return false; }
 
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
@@ -56,11 +105,16 @@ bool CCoinsViewBacked::IsWithdrawSpent(const std::pair<uint256, COutPoint> &outp
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
 bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::Sync() { return base->Sync(); }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
+bool CCoinsViewBacked::GetUTXOStats(const uint256 &hashBlock, CUTXOStats &stats) const { return base->GetUTXOStats(hashBlock, stats); }
+void CCoinsViewBacked::SetUTXOStats(const uint256 &hashBlock, const CUTXOStats &stats) { base->SetUTXOStats(hashBlock, stats); }
+bool CCoinsViewBacked::GetWithdrawsSpent(std::vector<std::pair<uint256, COutPoint> > &vSpent) const { return base->GetWithdrawsSpent(vSpent); }
 
 SaltedTxidHasher::SaltedTxidHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false),
+    cacheCoins(0, SaltedTxidHasher(), CCoinsMap::key_equal(), &cacheCoinsMemoryResource), cachedCoinsUsage(0) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -89,7 +143,7 @@ CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
-    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
+    cachedCoinsUsage += ret->second.DynamicMemoryUsage();
     return ret;
 }
 
@@ -116,7 +170,7 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
             ret.first->second.flags = CCoinsCacheEntry::FRESH;
         }
     } else {
-        cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
+        cachedCoinUsage = ret.first->second.DynamicMemoryUsage();
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
@@ -230,9 +284,11 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     if (fIsWithdraw) {
                         entry.withdrawSpent = it->second.withdrawSpent;
                         entry.flags |= CCoinsCacheEntry::WITHDRAW;
-                    } else
+                    } else {
                         entry.coins.swap(it->second.coins);
-                    cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
+                        entry.vChanged.swap(it->second.vChanged);
+                    }
+                    cachedCoinsUsage += entry.DynamicMemoryUsage();
                     // We can mark it FRESH in the parent if it was FRESH in the child
                     // Otherwise it might have just been flushed from the parent's cache
                     // and already exist in the grandparent
@@ -246,16 +302,21 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage -= itUs->second.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
-                    if (fIsWithdraw)
+                    cachedCoinsUsage -= itUs->second.DynamicMemoryUsage();
+                    if (fIsWithdraw) {
                         itUs->second.withdrawSpent = it->second.withdrawSpent;
-                    else
+                    } else {
                         itUs->second.coins.swap(it->second.coins);
-                    cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
+                        for (size_t n = 0; n < it->second.vChanged.size(); n++) {
+                            if (it->second.vChanged[n])
+                                itUs->second.MarkChanged(n);
+                        }
+                    }
+                    cachedCoinsUsage += itUs->second.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                 }
             }
@@ -271,14 +332,24 @@ bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    ReallocateCache();
     return fOk;
 }
 
+void CCoinsViewCache::ReallocateCache()
+{
+    assert(cacheCoins.empty());
+    cacheCoins.~CCoinsMap();
+    cacheCoinsMemoryResource.~CCoinsMapMemoryResource();
+    ::new (&cacheCoinsMemoryResource) CCoinsMapMemoryResource();
+    ::new (&cacheCoins) CCoinsMap(0, SaltedTxidHasher(), CCoinsMap::key_equal(), &cacheCoinsMemoryResource);
+}
+
 void CCoinsViewCache::Uncache(const uint256& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(make_txentry(hash));
     if (it != cacheCoins.end() && it->second.flags == 0) {
-        cachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+        cachedCoinsUsage -= it->second.DynamicMemoryUsage();
         cacheCoins.erase(it);
     }
 }
@@ -334,6 +405,13 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight, CAmount
 CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
     assert(!cache.hasModifier);
     cache.hasModifier = true;
+    const CCoins& coins = it->second.coins;
+    vAvailableBefore.resize(coins.vout.size());
+    for (size_t n = 0; n < coins.vout.size(); n++)
+        vAvailableBefore[n] = !coins.vout[n].IsNull();
+    nHeightBefore = coins.nHeight;
+    nVersionBefore = coins.nVersion;
+    fCoinBaseBefore = coins.fCoinBase;
 }
 
 CCoinsModifier::~CCoinsModifier()
@@ -342,11 +420,23 @@ CCoinsModifier::~CCoinsModifier()
     cache.hasModifier = false;
     it->second.coins.Cleanup();
     cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
+
+    // Outputs are only ever spent or (re)created, and the transaction
+    // metadata only changes when all of them are replaced, so comparing
+    // which outputs are unspent finds everything a flush has to write.
+    const CCoins& coins = it->second.coins;
+    const bool fMetadataChanged = coins.nHeight != nHeightBefore || coins.nVersion != nVersionBefore || coins.fCoinBase != fCoinBaseBefore;
+    for (size_t n = 0; n < std::max(coins.vout.size(), vAvailableBefore.size()); n++) {
+        const bool fAvailable = coins.IsAvailable(n);
+        const bool fWasAvailable = n < vAvailableBefore.size() && vAvailableBefore[n];
+        if (fAvailable != fWasAvailable || (fAvailable && fMetadataChanged))
+            it->second.MarkChanged(n);
+    }
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
         cache.cacheCoins.erase(it);
     } else {
         // If the coin still exists after the modification, add the new usage
-        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
+        cache.cachedCoinsUsage += it->second.DynamicMemoryUsage();
     }
 }
 
@@ -11,6 +11,7 @@
 #include "hash.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
@@ -89,13 +90,22 @@ public:
 
     void FromTx(const CTransaction &tx, int nHeightIn) {
         fCoinBase = tx.IsCoinBase();
-        vout = tx.vout;
+        // Copy everything but the output witnesses: range proofs are several
+        // kilobytes each and are not needed once the transaction is validated.
+        // Unspendable outputs are left null rather than copied and cleared.
+        vout.resize(tx.vout.size());
         for (size_t i = 0; i < vout.size(); i++) {
-            CTxOutWitnessSerializer(vout[i]).SetNull();
+            CTxOut& txout = vout[i];
+            if (tx.vout[i].scriptPubKey.IsUnspendable()) {
+                txout.SetNull();
+                continue;
+            }
+            txout.nValue.vchCommitment = tx.vout[i].nValue.vchCommitment;
+            CTxOutWitnessSerializer(txout).SetNull();
+            txout.scriptPubKey = tx.vout[i].scriptPubKey;
         }
         nHeight = nHeightIn;
         nVersion = tx.nVersion;
-        ClearUnspendable();
     }
 
     //! construct a CCoins from a CTransaction, at a given height
@@ -262,7 +272,7 @@ public:
     size_t DynamicMemoryUsage() const {
         size_t ret = memusage::DynamicUsage(vout);
         BOOST_FOREACH(const CTxOut &out, vout) {
-            ret += RecursiveDynamicUsage(out.scriptPubKey);
+            ret += RecursiveDynamicUsage(out);
         }
         return ret;
     }
@@ -298,6 +308,7 @@ struct CCoinsCacheEntry
     CCoins coins; // The actual cached data.
     bool withdrawSpent;
     unsigned char flags;
+    std::vector<bool> vChanged; // Outputs that may differ from the parent view; flushing only writes these unless FRESH.
 
     enum Flags {
         DIRTY    = (1 << 0), // This cache entry is potentially different from the version in the parent view.
@@ -306,9 +317,81 @@ struct CCoinsCacheEntry
     };
 
     CCoinsCacheEntry() : coins(), withdrawSpent(false), flags(0) {}
+
+    void MarkChanged(size_t n) {
+        if (vChanged.size() <= n)
+            vChanged.resize(n + 1);
+        vChanged[n] = true;
+    }
+
+    bool IsChanged(size_t n) const {
+        return n < vChanged.size() && vChanged[n];
+    }
+
+    size_t DynamicMemoryUsage() const {
+        return coins.DynamicMemoryUsage() + memusage::DynamicUsage(vChanged);
+    }
 };
 
-typedef boost::unordered_map<CCoinsMapKey, CCoinsCacheEntry, SaltedTxidHasher> CCoinsMap;
+/**
+ * The coins cache holds millions of entries with -dbcache set high, so its
+ * nodes come from a pool rather than one malloc each. Room is left for the
+ * node's links next to the entry.
+ */
+typedef boost::unordered_map<CCoinsMapKey, CCoinsCacheEntry, SaltedTxidHasher, std::equal_to<CCoinsMapKey>,
+                             PoolAllocator<std::pair<const CCoinsMapKey, CCoinsCacheEntry>,
+                                           sizeof(std::pair<const CCoinsMapKey, CCoinsCacheEntry>) + sizeof(void*) * 4> > CCoinsMap;
+typedef CCoinsMap::allocator_type::ResourceType CCoinsMapMemoryResource;
+
+/**
+ * Statistics of a set of unspent outputs that can be kept up to date as
+ * outputs are added and removed, instead of being computed by a scan.
+ *
+ * The set hash is a lattice hash: each output is expanded to
+ * UTXO_HASH_LANES 16-bit numbers, which are added to (or, on removal,
+ * subtracted from) the lanes lane by lane, modulo 2^16. The result does not
+ * depend on the order outputs were added and removed in.
+ */
+class CUTXOStats
+{
+public:
+    static const size_t UTXO_HASH_LANES = 1024;
+
+    uint64_t nTransactionOutputs;
+    uint64_t nBlindedOutputs;
+    //! Sum of the explicit amounts
+    CAmount nTotalAmount;
+    //! Explicit amounts in withdraw locks, locked to the mainchain
+    CAmount nLockedAmount;
+
+private:
+    uint16_t lanes[UTXO_HASH_LANES];
+
+    void Update(const COutPoint& outpoint, const CTxOut& txout, int nSign);
+
+public:
+    CUTXOStats() { SetNull(); }
+
+    void SetNull();
+
+    void Add(const COutPoint& outpoint, const CTxOut& txout) { Update(outpoint, txout, 1); }
+    void Remove(const COutPoint& outpoint, const CTxOut& txout) { Update(outpoint, txout, -1); }
+
+    //! Hash of the set of outputs
+    uint256 GetSetHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBlindedOutputs);
+        READWRITE(nTotalAmount);
+        READWRITE(nLockedAmount);
+        for (size_t i = 0; i < UTXO_HASH_LANES; i++)
+            READWRITE(lanes[i]);
+    }
+};
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -352,9 +435,23 @@ public:
     //! The passed mapCoins can be modified.
     virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
 
+    //! Wait until everything handed to BatchWrite is durable; returns false
+    //! if writing any of it failed
+    virtual bool Sync();
+
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
 
+    //! Retrieve the statistics stored with best block hashBlock, if any
+    virtual bool GetUTXOStats(const uint256 &hashBlock, CUTXOStats &stats) const;
+
+    //! Store stats along with the next BatchWrite of best block hashBlock
+    virtual void SetUTXOStats(const uint256 &hashBlock, const CUTXOStats &stats);
+
+    //! Retrieve all spent withdraws of the stored state; views with unflushed
+    //! changes do not include those
+    virtual bool GetWithdrawsSpent(std::vector<std::pair<uint256, COutPoint> > &vSpent) const;
+
     //! As we use CCoinsViews polymorphically, have a virtual destructor
     virtual ~CCoinsView() {}
 };
@@ -374,7 +471,11 @@ public:
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView &viewIn);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool Sync();
     CCoinsViewCursor *Cursor() const;
+    bool GetUTXOStats(const uint256 &hashBlock, CUTXOStats &stats) const;
+    void SetUTXOStats(const uint256 &hashBlock, const CUTXOStats &stats);
+    bool GetWithdrawsSpent(std::vector<std::pair<uint256, COutPoint> > &vSpent) const;
 };
 
 
@@ -390,7 +491,11 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    size_t cachedCoinUsage; // Cached memory usage of the cache entry before modification
+    std::vector<bool> vAvailableBefore; // Which outputs were unspent before modification
+    int nHeightBefore;
+    int nVersionBefore;
+    bool fCoinBaseBefore;
     CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
@@ -413,6 +518,8 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    /* Pool the entries of cacheCoins are allocated from; must outlive it. */
+    mutable CCoinsMapMemoryResource cacheCoinsMemoryResource;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner CCoins objects. */
@@ -443,7 +550,7 @@ public:
      * more efficient than GetCoins. Modifications to other cache entries are
      * allowed while accessing the returned pointer.
      */
-    const CCoins* AccessCoins(const uint256 &txid) const;
+    virtual const CCoins* AccessCoins(const uint256 &txid) const;
 
     /**
      * Return a modifiable reference to a CCoins. If no entry with the given
@@ -500,6 +607,12 @@ private:
     CCoinsMap::iterator FetchCoins(const uint256 &txid);
     CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
 
+    /**
+     * Start over with an empty pool once the cache is empty, as the pool
+     * keeps its chunks until destroyed.
+     */
+    void ReallocateCache();
+
     /**
      * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
      */
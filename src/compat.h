@@ -82,12 +82,10 @@ typedef u_int SOCKET;
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+//! Sockets are waited on with select() only on Windows, where FD_SETSIZE
+//! limits the number of sockets rather than their value.
 bool static inline IsSelectableSocket(SOCKET s) {
-#ifdef WIN32
     return true;
-#else
-    return (s < FD_SETSIZE);
-#endif
 }
 
 #endif // BITCOIN_COMPAT_H
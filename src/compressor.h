@@ -139,4 +139,87 @@ public:
     }
 };
 
+/**
+ * Wrapper for CTxOut with the more compact serialization of undo data.
+ *
+ * A first byte says how the value and the script follow. Its low four bits
+ * are 0 for an amount, compressed as CTxOutCompressor does, 2 or 3 for a
+ * commitment with that prefix, of which the other 32 bytes follow, and 1 for
+ * any other value in full. Its high four bits are 0 for a script in
+ * CScriptCompressor form, or one of the codes below for a version 0 witness
+ * program, of which only the program follows. Data written by
+ * CTxOutCompressor, which starts with a 0 or 1, reads back the same.
+ */
+class CTxOutUndoCompressor
+{
+private:
+    static const uint8_t UNDO_SCRIPT_WITNESS_KEYHASH = 1;
+    static const uint8_t UNDO_SCRIPT_WITNESS_SCRIPTHASH = 2;
+
+    CTxOut &txout;
+
+    static unsigned int WitnessProgramSize(uint8_t nScriptCode) { return nScriptCode == UNDO_SCRIPT_WITNESS_KEYHASH ? 20 : 32; }
+
+public:
+    CTxOutUndoCompressor(CTxOut &txoutIn) : txout(txoutIn) { }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        CTxOutValue::commitment_type& vchCommitment = txout.nValue.vchCommitment;
+        CScript& script = txout.scriptPubKey;
+        uint8_t nValueCode = 0;
+        uint8_t nScriptCode = 0;
+        if (!ser_action.ForRead()) {
+            if (txout.nValue.IsAmount())
+                nValueCode = 0;
+            else if (vchCommitment[0] == 2 || vchCommitment[0] == 3)
+                nValueCode = vchCommitment[0];
+            else
+                nValueCode = 1;
+            if (script.size() == 22 && script[0] == OP_0 && script[1] == 20)
+                nScriptCode = UNDO_SCRIPT_WITNESS_KEYHASH;
+            else if (script.size() == 34 && script[0] == OP_0 && script[1] == 32)
+                nScriptCode = UNDO_SCRIPT_WITNESS_SCRIPTHASH;
+        }
+        uint8_t b = nValueCode | (nScriptCode << 4);
+        READWRITE(b);
+        nValueCode = b & 0x0f;
+        nScriptCode = b >> 4;
+
+        if (nValueCode == 0) {
+            uint64_t nVal = 0;
+            if (!ser_action.ForRead())
+                nVal = CTxOutCompressor::CompressAmount(txout.nValue.GetAmount());
+            READWRITE(VARINT(nVal));
+            if (ser_action.ForRead())
+                txout.nValue = CTxOutCompressor::DecompressAmount(nVal);
+        } else if (nValueCode == 1) {
+            READWRITE(txout.nValue);
+        } else if (nValueCode == 2 || nValueCode == 3) {
+            if (ser_action.ForRead())
+                vchCommitment[0] = nValueCode;
+            READWRITE(REF(CFlatData(&vchCommitment[1], &vchCommitment[CTxOutValue::nCommitmentSize])));
+        } else {
+            throw std::ios_base::failure("Unknown value encoding in undo data");
+        }
+
+        if (nScriptCode == 0) {
+            CScriptCompressor cscript(REF(script));
+            READWRITE(cscript);
+        } else if (nScriptCode == UNDO_SCRIPT_WITNESS_KEYHASH || nScriptCode == UNDO_SCRIPT_WITNESS_SCRIPTHASH) {
+            const unsigned int nProgramSize = WitnessProgramSize(nScriptCode);
+            if (ser_action.ForRead()) {
+                script.resize(2 + nProgramSize);
+                script[0] = OP_0;
+                script[1] = nProgramSize;
+            }
+            READWRITE(REF(CFlatData(&script[2], &script[0] + script.size())));
+        } else {
+            throw std::ios_base::failure("Unknown script encoding in undo data");
+        }
+    }
+};
+
 #endif // BITCOIN_COMPRESSOR_H
@@ -4,8 +4,11 @@
 
 #include "merkle.h"
 #include "hash.h"
+#include "crypto/sha256.h"
 #include "utilstrencodings.h"
 
+#include <assert.h>
+
 /*     WARNING! If you're reading this because you're learning about crypto
        and/or designing a new system that will use merkle trees, keep in mind
        that the following merkle tree algorithm has a serious flaw related to
@@ -130,10 +133,25 @@ static void MerkleComputation(const std::vector<uint256>& leaves, uint256* proot
     if (proot) *proot = h;
 }
 
-uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated) {
-    uint256 hash;
-    MerkleComputation(leaves, &hash, mutated, -1, NULL);
-    return hash;
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated) {
+    // Without a branch to extract, the tree is hashed one level at a time, in
+    // place, so that SHA256D64 can work on many pairs of nodes at once.
+    bool mutation = false;
+    while (hashes.size() > 1) {
+        if (mutated) {
+            for (size_t pos = 0; pos + 1 < hashes.size(); pos += 2) {
+                if (hashes[pos] == hashes[pos + 1]) mutation = true;
+            }
+        }
+        if (hashes.size() & 1) {
+            hashes.push_back(hashes.back());
+        }
+        SHA256D64(hashes[0].begin(), hashes[0].begin(), hashes.size() / 2);
+        hashes.resize(hashes.size() / 2);
+    }
+    if (mutated) *mutated = mutation;
+    if (hashes.size() == 0) return uint256();
+    return hashes[0];
 }
 
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position) {
@@ -160,9 +178,9 @@ uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
     std::vector<uint256> leaves;
     leaves.resize(block.vtx.size());
     for (size_t s = 0; s < block.vtx.size(); s++) {
-        leaves[s] = block.vtx[s].GetHash();
+        leaves[s] = block.vtx[s]->GetHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return ComputeMerkleRoot(std::move(leaves), mutated);
 }
 
 uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated)
@@ -171,9 +189,9 @@ uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated)
     leaves.resize(block.vtx.size());
     leaves[0].SetNull(); // The witness hash of the coinbase is 0.
     for (size_t s = 1; s < block.vtx.size(); s++) {
-        leaves[s] = block.vtx[s].GetWitnessHash();
+        leaves[s] = block.vtx[s]->GetWitnessHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return ComputeMerkleRoot(std::move(leaves), mutated);
 }
 
 std::vector<uint256> BlockMerkleBranch(const CBlock& block, uint32_t position)
@@ -181,7 +199,76 @@ std::vector<uint256> BlockMerkleBranch(const CBlock& block, uint32_t position)
     std::vector<uint256> leaves;
     leaves.resize(block.vtx.size());
     for (size_t s = 0; s < block.vtx.size(); s++) {
-        leaves[s] = block.vtx[s].GetHash();
+        leaves[s] = block.vtx[s]->GetHash();
     }
     return ComputeMerkleBranch(leaves, position);
 }
+
+void CIncrementalMerkleTree::Append(const uint256& leaf)
+{
+    if (vLevels.empty()) vLevels.resize(1);
+    vLevels[0].push_back(leaf);
+    // Each time a level gets an even number of nodes, the last two of them
+    // are complete siblings and their parent can be hashed.
+    for (size_t level = 0; vLevels[level].size() % 2 == 0; level++) {
+        if (level + 1 == vLevels.size()) vLevels.resize(level + 2);
+        const std::vector<uint256>& nodes = vLevels[level];
+        uint256 h;
+        CHash256().Write(nodes[nodes.size() - 2].begin(), 32).Write(nodes.back().begin(), 32).Finalize(h.begin());
+        vLevels[level + 1].push_back(h);
+    }
+}
+
+void CIncrementalMerkleTree::SetFirst(const uint256& leaf)
+{
+    assert(size() > 0);
+    vLevels[0][0] = leaf;
+    for (size_t level = 1; level < vLevels.size() && !vLevels[level].empty(); level++) {
+        const std::vector<uint256>& nodes = vLevels[level - 1];
+        CHash256().Write(nodes[0].begin(), 32).Write(nodes[1].begin(), 32).Finalize(vLevels[level][0].begin());
+    }
+}
+
+void CIncrementalMerkleTree::Sweep(uint256* proot, std::vector<uint256>* pbranch) const
+{
+    if (pbranch) pbranch->clear();
+    if (size() == 0) {
+        if (proot) *proot = uint256();
+        return;
+    }
+    // Walk up the levels with the incomplete node at the right edge of each,
+    // if there is one, which the complete nodes do not include.
+    uint256 edge;
+    bool fEdge = false;
+    for (size_t level = 0; ; level++) {
+        const size_t nComplete = level < vLevels.size() ? vLevels[level].size() : 0;
+        const size_t nNodes = nComplete + (fEdge ? 1 : 0);
+        if (nNodes == 1) {
+            if (proot) *proot = fEdge ? edge : vLevels[level][0];
+            return;
+        }
+        if (pbranch) pbranch->push_back(nComplete >= 2 ? vLevels[level][1] : edge);
+        if (fEdge || nNodes % 2 == 1) {
+            // The last node is paired with its complete left sibling, or with
+            // itself if it has none (Bitcoin's special rule for odd levels).
+            const uint256& right = fEdge ? edge : vLevels[level].back();
+            const uint256& left = nNodes % 2 == 1 ? right : vLevels[level].back();
+            CHash256().Write(left.begin(), 32).Write(right.begin(), 32).Finalize(edge.begin());
+            fEdge = true;
+        }
+    }
+}
+
+uint256 CIncrementalMerkleTree::Root() const
+{
+    uint256 root;
+    Sweep(&root, NULL);
+    return root;
+}
+
+std::vector<uint256> CIncrementalMerkleTree::FirstBranch() const
+{
+    std::vector<uint256> branch;
+    Sweep(NULL, &branch);
+    return branch;
+}
@@ -12,7 +12,7 @@
 #include "primitives/block.h"
 #include "uint256.h"
 
-uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated = NULL);
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated = NULL);
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position);
 uint256 ComputeMerkleRootFromBranch(const uint256& leaf, const std::vector<uint256>& branch, uint32_t position);
 
@@ -35,4 +35,32 @@ uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated = NULL);
  */
 std::vector<uint256> BlockMerkleBranch(const CBlock& block, uint32_t position);
 
+/*
+ * A merkle tree that is built up one leaf at a time, as a block is
+ * assembled, hashing each inner node once it is complete. Replacing the
+ * first leaf (the coinbase) only rehashes the nodes above it, and the root
+ * only costs the hashes of the incomplete right edge of the tree.
+ */
+class CIncrementalMerkleTree
+{
+private:
+    /* vLevels[h] holds the complete nodes at height h; vLevels[0] the leaves */
+    std::vector<std::vector<uint256> > vLevels;
+
+    void Sweep(uint256* proot, std::vector<uint256>* pbranch) const;
+
+public:
+    void Clear() { vLevels.clear(); }
+    size_t size() const { return vLevels.empty() ? 0 : vLevels[0].size(); }
+
+    void Append(const uint256& leaf);
+    /* Replace the first leaf, which must exist */
+    void SetFirst(const uint256& leaf);
+
+    /* The root, as ComputeMerkleRoot would compute it from the leaves */
+    uint256 Root() const;
+    /* The branch of the first leaf, as ComputeMerkleBranch(leaves, 0) */
+    std::vector<uint256> FirstBranch() const;
+};
+
 #endif
@@ -64,6 +64,8 @@ struct Params {
     int64_t nPowTargetTimespan;
     int64_t DifficultyAdjustmentInterval() const { return nPowTargetTimespan / nPowTargetSpacing; }
     CScript fedpegScript;
+    /** A block whose ancestors need not have their scripts and range proofs checked (-assumevalid) */
+    uint256 defaultAssumeValid;
 };
 } // namespace Consensus
 
@@ -21,8 +21,12 @@ static inline size_t RecursiveDynamicUsage(const CTxIn& in) {
     return RecursiveDynamicUsage(in.scriptSig) + RecursiveDynamicUsage(in.prevout);
 }
 
+static inline size_t RecursiveDynamicUsage(const CTxOutValue& value) {
+    return memusage::DynamicUsage(value.vchCommitment) + memusage::DynamicUsage(value.vchRangeproof) + memusage::DynamicUsage(value.vchNonceCommitment);
+}
+
 static inline size_t RecursiveDynamicUsage(const CTxOut& out) {
-    return RecursiveDynamicUsage(out.scriptPubKey);
+    return RecursiveDynamicUsage(out.nValue) + RecursiveDynamicUsage(out.scriptPubKey);
 }
 
 static inline size_t RecursiveDynamicUsage(const CScriptWitness& scriptWit) {
@@ -69,8 +73,8 @@ static inline size_t RecursiveDynamicUsage(const CMutableTransaction& tx) {
 
 static inline size_t RecursiveDynamicUsage(const CBlock& block) {
     size_t mem = memusage::DynamicUsage(block.vtx);
-    for (std::vector<CTransaction>::const_iterator it = block.vtx.begin(); it != block.vtx.end(); it++) {
-        mem += RecursiveDynamicUsage(*it);
+    for (std::vector<CTransactionRef>::const_iterator it = block.vtx.begin(); it != block.vtx.end(); it++) {
+        mem += memusage::DynamicUsage(*it) + RecursiveDynamicUsage(**it);
     }
     return mem;
 }
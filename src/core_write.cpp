@@ -5,6 +5,7 @@
 #include "core_io.h"
 
 #include "base58.h"
+#include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "script/script.h"
 #include "script/standard.h"
@@ -118,16 +119,18 @@ string ScriptToAsmStr(const CScript& script, const bool fAttemptSighashDecode)
 
 string EncodeHexTx(const CTransaction& tx)
 {
-    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
-    ssTx << tx;
-    return HexStr(ssTx.begin(), ssTx.end());
+    std::vector<unsigned char> vchTx;
+    vchTx.reserve(tx.GetTotalSize());
+    CVectorWriter<std::vector<unsigned char> >(vchTx, SER_NETWORK, PROTOCOL_VERSION) << tx;
+    return HexStr(vchTx);
 }
 
 string EncodeHexBlock(const CBlock& block)
 {
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
-    return HexStr(ssBlock.begin(), ssBlock.end());
+    std::vector<unsigned char> vchBlock;
+    vchBlock.reserve(GetBlockTotalSize(block));
+    CVectorWriter<std::vector<unsigned char> >(vchBlock, SER_NETWORK, PROTOCOL_VERSION) << block;
+    return HexStr(vchBlock);
 }
 
 void ScriptPubKeyToUniv(const CScript& scriptPubKey,
@@ -12,6 +12,33 @@ extern "C" {
 #include "crypto/ctaes/ctaes.c"
 }
 
+#if defined(ENABLE_AESNI)
+#include <cpuid.h>
+
+namespace aes256_aesni
+{
+void ExpandKey(unsigned char* schedule, const unsigned char* key);
+void ExpandDecryptionKey(unsigned char* schedule, const unsigned char* key);
+void Encrypt(const unsigned char* schedule, unsigned char* out, const unsigned char* in);
+void Decrypt(const unsigned char* schedule, unsigned char* out, const unsigned char* in);
+}
+#endif
+
+bool AES256UseAESNI()
+{
+#if defined(ENABLE_AESNI)
+    // Detected on first use; C++11 makes this initialization thread safe.
+    static const bool fAESNI = []() {
+        uint32_t eax, ebx, ecx, edx;
+        __cpuid_count(1, 0, eax, ebx, ecx, edx);
+        return ((ecx >> 25) & 1) != 0;
+    }();
+    return fAESNI;
+#else
+    return false;
+#endif
+}
+
 AES128Encrypt::AES128Encrypt(const unsigned char key[16])
 {
     AES128_init(&ctx, key);
@@ -42,37 +69,62 @@ void AES128Decrypt::Decrypt(unsigned char plaintext[16], const unsigned char cip
     AES128_decrypt(&ctx, 1, plaintext, ciphertext);
 }
 
-AES256Encrypt::AES256Encrypt(const unsigned char key[32])
+AES256Encrypt::AES256Encrypt(const unsigned char key[32]) : fAESNI(AES256UseAESNI())
 {
+#if defined(ENABLE_AESNI)
+    if (fAESNI) {
+        aes256_aesni::ExpandKey(schedule, key);
+        return;
+    }
+#endif
     AES256_init(&ctx, key);
 }
 
 AES256Encrypt::~AES256Encrypt()
 {
     memset(&ctx, 0, sizeof(ctx));
+    memset(schedule, 0, sizeof(schedule));
 }
 
 void AES256Encrypt::Encrypt(unsigned char ciphertext[16], const unsigned char plaintext[16]) const
 {
+#if defined(ENABLE_AESNI)
+    if (fAESNI) {
+        aes256_aesni::Encrypt(schedule, ciphertext, plaintext);
+        return;
+    }
+#endif
     AES256_encrypt(&ctx, 1, ciphertext, plaintext);
 }
 
-AES256Decrypt::AES256Decrypt(const unsigned char key[32])
+AES256Decrypt::AES256Decrypt(const unsigned char key[32]) : fAESNI(AES256UseAESNI())
 {
+#if defined(ENABLE_AESNI)
+    if (fAESNI) {
+        aes256_aesni::ExpandDecryptionKey(schedule, key);
+        return;
+    }
+#endif
     AES256_init(&ctx, key);
 }
 
 AES256Decrypt::~AES256Decrypt()
 {
     memset(&ctx, 0, sizeof(ctx));
+    memset(schedule, 0, sizeof(schedule));
 }
 
 void AES256Decrypt::Decrypt(unsigned char plaintext[16], const unsigned char ciphertext[16]) const
 {
+#if defined(ENABLE_AESNI)
+    if (fAESNI) {
+        aes256_aesni::Decrypt(schedule, plaintext, ciphertext);
+        return;
+    }
+#endif
     AES256_decrypt(&ctx, 1, plaintext, ciphertext);
 }
 
-
 template <typename T>
 static int CBCEncrypt(const T& enc, const unsigned char iv[AES_BLOCKSIZE], const unsigned char* data, int size, bool pad, unsigned char* out)
 {
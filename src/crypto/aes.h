@@ -14,6 +14,11 @@ extern "C" {
 static const int AES_BLOCKSIZE = 16;
 static const int AES128_KEYSIZE = 16;
 static const int AES256_KEYSIZE = 32;
+//! Size of the expanded AES-256 key used by the AES-NI code
+static const int AES256_SCHEDULESIZE = 240;
+
+/** Whether AES-256 runs on the AES-NI instructions rather than ctaes. */
+bool AES256UseAESNI();
 
 /** An encryption class for AES-128. */
 class AES128Encrypt
@@ -44,6 +49,8 @@ class AES256Encrypt
 {
 private:
     AES256_ctx ctx;
+    unsigned char schedule[AES256_SCHEDULESIZE];
+    bool fAESNI;
 
 public:
     AES256Encrypt(const unsigned char key[32]);
@@ -56,6 +63,8 @@ class AES256Decrypt
 {
 private:
     AES256_ctx ctx;
+    unsigned char schedule[AES256_SCHEDULESIZE];
+    bool fAESNI;
 
 public:
     AES256Decrypt(const unsigned char key[32]);
@@ -0,0 +1,96 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// AES-256 using the x86 AES instructions. Like ctaes, these run in constant
+// time; they are just much faster. The key schedule is 15 round keys of 16
+// bytes, and the decryption schedule is the reverse of it, with
+// InvMixColumns applied to the inner round keys.
+
+#ifdef ENABLE_AESNI
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace {
+
+/** Derive the next even round key from the previous two, given keygenassist of the odd one. */
+__m128i inline ExpandEven(__m128i prev, __m128i assist)
+{
+    prev = _mm_xor_si128(prev, _mm_slli_si128(prev, 4));
+    prev = _mm_xor_si128(prev, _mm_slli_si128(prev, 8));
+    return _mm_xor_si128(prev, _mm_shuffle_epi32(assist, 0xff));
+}
+
+/** Derive the next odd round key from the previous odd one and the new even one. */
+__m128i inline ExpandOdd(__m128i prev, __m128i even)
+{
+    const __m128i assist = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(even, 0x00), 0xaa);
+    prev = _mm_xor_si128(prev, _mm_slli_si128(prev, 4));
+    prev = _mm_xor_si128(prev, _mm_slli_si128(prev, 8));
+    return _mm_xor_si128(prev, assist);
+}
+
+}
+
+namespace aes256_aesni {
+void ExpandKey(unsigned char* schedule, const unsigned char* key)
+{
+    __m128i* rk = (__m128i*)schedule;
+    __m128i k0 = _mm_loadu_si128((const __m128i*)key);
+    __m128i k1 = _mm_loadu_si128((const __m128i*)(key + 16));
+    _mm_storeu_si128(rk + 0, k0);
+    _mm_storeu_si128(rk + 1, k1);
+
+    // The round constant must be an immediate, hence no loop.
+    k0 = ExpandEven(k0, _mm_aeskeygenassist_si128(k1, 0x01)); _mm_storeu_si128(rk + 2, k0);
+    k1 = ExpandOdd(k1, k0); _mm_storeu_si128(rk + 3, k1);
+    k0 = ExpandEven(k0, _mm_aeskeygenassist_si128(k1, 0x02)); _mm_storeu_si128(rk + 4, k0);
+    k1 = ExpandOdd(k1, k0); _mm_storeu_si128(rk + 5, k1);
+    k0 = ExpandEven(k0, _mm_aeskeygenassist_si128(k1, 0x04)); _mm_storeu_si128(rk + 6, k0);
+    k1 = ExpandOdd(k1, k0); _mm_storeu_si128(rk + 7, k1);
+    k0 = ExpandEven(k0, _mm_aeskeygenassist_si128(k1, 0x08)); _mm_storeu_si128(rk + 8, k0);
+    k1 = ExpandOdd(k1, k0); _mm_storeu_si128(rk + 9, k1);
+    k0 = ExpandEven(k0, _mm_aeskeygenassist_si128(k1, 0x10)); _mm_storeu_si128(rk + 10, k0);
+    k1 = ExpandOdd(k1, k0); _mm_storeu_si128(rk + 11, k1);
+    k0 = ExpandEven(k0, _mm_aeskeygenassist_si128(k1, 0x20)); _mm_storeu_si128(rk + 12, k0);
+    k1 = ExpandOdd(k1, k0); _mm_storeu_si128(rk + 13, k1);
+    k0 = ExpandEven(k0, _mm_aeskeygenassist_si128(k1, 0x40)); _mm_storeu_si128(rk + 14, k0);
+}
+
+void ExpandDecryptionKey(unsigned char* schedule, const unsigned char* key)
+{
+    unsigned char enc[240];
+    ExpandKey(enc, key);
+    const __m128i* rk = (const __m128i*)enc;
+    __m128i* drk = (__m128i*)schedule;
+    _mm_storeu_si128(drk, _mm_loadu_si128(rk + 14));
+    for (int i = 1; i < 14; i++)
+        _mm_storeu_si128(drk + i, _mm_aesimc_si128(_mm_loadu_si128(rk + 14 - i)));
+    _mm_storeu_si128(drk + 14, _mm_loadu_si128(rk));
+    // Do not leave the round keys on the stack.
+    volatile unsigned char* p = enc;
+    for (int i = 0; i < 240; i++)
+        p[i] = 0;
+}
+
+void Encrypt(const unsigned char* schedule, unsigned char* out, const unsigned char* in)
+{
+    const __m128i* rk = (const __m128i*)schedule;
+    __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)in), _mm_loadu_si128(rk));
+    for (int i = 1; i < 14; i++)
+        b = _mm_aesenc_si128(b, _mm_loadu_si128(rk + i));
+    _mm_storeu_si128((__m128i*)out, _mm_aesenclast_si128(b, _mm_loadu_si128(rk + 14)));
+}
+
+void Decrypt(const unsigned char* schedule, unsigned char* out, const unsigned char* in)
+{
+    const __m128i* drk = (const __m128i*)schedule;
+    __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)in), _mm_loadu_si128(drk));
+    for (int i = 1; i < 14; i++)
+        b = _mm_aesdec_si128(b, _mm_loadu_si128(drk + i));
+    _mm_storeu_si128((__m128i*)out, _mm_aesdeclast_si128(b, _mm_loadu_si128(drk + 14)));
+}
+}
+
+#endif
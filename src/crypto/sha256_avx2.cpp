@@ -0,0 +1,172 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// This is a translation to AVX2 intrinsics of the portable SHA-256 code, hashing
+// eight independent 64-byte inputs at once, one per 32-bit lane.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace sha256d64_avx2 {
+namespace {
+
+__m256i inline K(uint32_t x) { return _mm256_set1_epi32(x); }
+
+__m256i inline Add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+__m256i inline Add(__m256i x, __m256i y, __m256i z) { return Add(Add(x, y), z); }
+__m256i inline Add(__m256i x, __m256i y, __m256i z, __m256i w) { return Add(Add(x, y), Add(z, w)); }
+__m256i inline Add(__m256i x, __m256i y, __m256i z, __m256i w, __m256i v) { return Add(Add(x, y, z), Add(w, v)); }
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+__m256i inline Xor(__m256i x, __m256i y, __m256i z) { return Xor(Xor(x, y), z); }
+__m256i inline Or(__m256i x, __m256i y) { return _mm256_or_si256(x, y); }
+__m256i inline And(__m256i x, __m256i y) { return _mm256_and_si256(x, y); }
+__m256i inline ShR(__m256i x, int n) { return _mm256_srli_epi32(x, n); }
+__m256i inline ShL(__m256i x, int n) { return _mm256_slli_epi32(x, n); }
+
+__m256i inline Ch(__m256i x, __m256i y, __m256i z) { return Xor(z, And(x, Xor(y, z))); }
+__m256i inline Maj(__m256i x, __m256i y, __m256i z) { return Or(And(x, y), And(z, Or(x, y))); }
+__m256i inline Sigma0(__m256i x) { return Xor(Or(ShR(x, 2), ShL(x, 30)), Or(ShR(x, 13), ShL(x, 19)), Or(ShR(x, 22), ShL(x, 10))); }
+__m256i inline Sigma1(__m256i x) { return Xor(Or(ShR(x, 6), ShL(x, 26)), Or(ShR(x, 11), ShL(x, 21)), Or(ShR(x, 25), ShL(x, 7))); }
+__m256i inline sigma0(__m256i x) { return Xor(Or(ShR(x, 7), ShL(x, 25)), Or(ShR(x, 18), ShL(x, 14)), ShR(x, 3)); }
+__m256i inline sigma1(__m256i x) { return Xor(Or(ShR(x, 17), ShL(x, 15)), Or(ShR(x, 19), ShL(x, 13)), ShR(x, 10)); }
+
+const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/** One round of SHA-256, on all lanes. */
+void inline Round(__m256i a, __m256i b, __m256i c, __m256i& d, __m256i e, __m256i f, __m256i g, __m256i& h, uint32_t k, __m256i w)
+{
+    __m256i t1 = Add(h, Sigma1(e), Ch(e, f, g), K(k), w);
+    __m256i t2 = Add(Sigma0(a), Maj(a, b, c));
+    d = Add(d, t1);
+    h = Add(t1, t2);
+}
+
+/** Extend the message schedule by one word, in place in a 16-word window. */
+__m256i inline Expand(__m256i* w, int i)
+{
+    return w[i & 15] = Add(w[i & 15], sigma1(w[(i + 14) & 15]), w[(i + 9) & 15], sigma0(w[(i + 1) & 15]));
+}
+
+/** Run the compression function on state s with message w (which is clobbered). */
+void inline Compress(__m256i* s, __m256i* w)
+{
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+
+    for (int i = 0; i < 16; i += 8) {
+        Round(a, b, c, d, e, f, g, h, K256[i + 0], w[i + 0]);
+        Round(h, a, b, c, d, e, f, g, K256[i + 1], w[i + 1]);
+        Round(g, h, a, b, c, d, e, f, K256[i + 2], w[i + 2]);
+        Round(f, g, h, a, b, c, d, e, K256[i + 3], w[i + 3]);
+        Round(e, f, g, h, a, b, c, d, K256[i + 4], w[i + 4]);
+        Round(d, e, f, g, h, a, b, c, K256[i + 5], w[i + 5]);
+        Round(c, d, e, f, g, h, a, b, K256[i + 6], w[i + 6]);
+        Round(b, c, d, e, f, g, h, a, K256[i + 7], w[i + 7]);
+    }
+    for (int i = 16; i < 64; i += 8) {
+        Round(a, b, c, d, e, f, g, h, K256[i + 0], Expand(w, i + 0));
+        Round(h, a, b, c, d, e, f, g, K256[i + 1], Expand(w, i + 1));
+        Round(g, h, a, b, c, d, e, f, K256[i + 2], Expand(w, i + 2));
+        Round(f, g, h, a, b, c, d, e, K256[i + 3], Expand(w, i + 3));
+        Round(e, f, g, h, a, b, c, d, K256[i + 4], Expand(w, i + 4));
+        Round(d, e, f, g, h, a, b, c, K256[i + 5], Expand(w, i + 5));
+        Round(c, d, e, f, g, h, a, b, K256[i + 6], Expand(w, i + 6));
+        Round(b, c, d, e, f, g, h, a, K256[i + 7], Expand(w, i + 7));
+    }
+
+    s[0] = Add(s[0], a);
+    s[1] = Add(s[1], b);
+    s[2] = Add(s[2], c);
+    s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e);
+    s[5] = Add(s[5], f);
+    s[6] = Add(s[6], g);
+    s[7] = Add(s[7], h);
+}
+
+void inline Initialize(__m256i* s)
+{
+    s[0] = K(0x6a09e667ul);
+    s[1] = K(0xbb67ae85ul);
+    s[2] = K(0x3c6ef372ul);
+    s[3] = K(0xa54ff53aul);
+    s[4] = K(0x510e527ful);
+    s[5] = K(0x9b05688cul);
+    s[6] = K(0x1f83d9abul);
+    s[7] = K(0x5be0cd19ul);
+}
+
+/** Load word i of each of the eight 64-byte inputs, one per lane. */
+__m256i inline Read8(const unsigned char* in, int i)
+{
+    return _mm256_set_epi32(ReadBE32(in + 448 + 4 * i), ReadBE32(in + 384 + 4 * i), ReadBE32(in + 320 + 4 * i), ReadBE32(in + 256 + 4 * i),
+                            ReadBE32(in + 192 + 4 * i), ReadBE32(in + 128 + 4 * i), ReadBE32(in + 64 + 4 * i), ReadBE32(in + 4 * i));
+}
+
+/** Store word i of each lane into the matching one of eight 32-byte outputs. */
+void inline Write8(unsigned char* out, int i, __m256i v)
+{
+    WriteBE32(out + 4 * i, _mm256_extract_epi32(v, 0));
+    WriteBE32(out + 32 + 4 * i, _mm256_extract_epi32(v, 1));
+    WriteBE32(out + 64 + 4 * i, _mm256_extract_epi32(v, 2));
+    WriteBE32(out + 96 + 4 * i, _mm256_extract_epi32(v, 3));
+    WriteBE32(out + 128 + 4 * i, _mm256_extract_epi32(v, 4));
+    WriteBE32(out + 160 + 4 * i, _mm256_extract_epi32(v, 5));
+    WriteBE32(out + 192 + 4 * i, _mm256_extract_epi32(v, 6));
+    WriteBE32(out + 224 + 4 * i, _mm256_extract_epi32(v, 7));
+}
+
+}
+
+void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    __m256i s[8], t[8], w[16];
+
+    // Transform 1: the 64-byte input.
+    Initialize(s);
+    for (int i = 0; i < 16; i++) {
+        w[i] = Read8(in, i);
+    }
+    Compress(s, w);
+
+    // Transform 2: padding, for a message length of 512 bits.
+    w[0] = K(0x80000000ul);
+    for (int i = 1; i < 15; i++) {
+        w[i] = K(0);
+    }
+    w[15] = K(512);
+    Compress(s, w);
+
+    // Transform 3: the 32-byte digest, padded for a message length of 256 bits.
+    Initialize(t);
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+    }
+    w[8] = K(0x80000000ul);
+    for (int i = 9; i < 15; i++) {
+        w[i] = K(0);
+    }
+    w[15] = K(256);
+    Compress(t, w);
+
+    for (int i = 0; i < 8; i++) {
+        Write8(out, i, t[i]);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,199 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// SHA-256 using the x86 SHA extensions. Each _mm_sha256rnds2_epu32 performs
+// two rounds, on a state split as ABEF/CDGH across two registers.
+
+#ifdef ENABLE_SHANI
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace {
+
+alignas(__m128i) const uint8_t MASK[16] = {0x03, 0x02, 0x01, 0x00, 0x07, 0x06, 0x05, 0x04, 0x0b, 0x0a, 0x09, 0x08, 0x0f, 0x0e, 0x0d, 0x0c};
+alignas(__m128i) const uint32_t INIT[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+alignas(__m128i) const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// Message blocks appended to a 64-byte input (padding for 512 bits), and to
+// a 32-byte digest (padding for 256 bits), as big-endian words.
+alignas(__m128i) const uint32_t PAD512[16] = {0x80000000ul, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 512};
+alignas(__m128i) const uint32_t PAD256[8] = {0x80000000ul, 0, 0, 0, 0, 0, 0, 256};
+
+/** Four rounds, using message words m (rounds 4*i to 4*i+3). */
+void inline QuadRound(__m128i& state0, __m128i& state1, __m128i m, int i)
+{
+    const __m128i msg = _mm_add_epi32(m, _mm_load_si128((const __m128i*)(K256 + 4 * i)));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+}
+
+/** Compute the next four message words, from the previous sixteen (m0 oldest). */
+__m128i inline Schedule(__m128i m0, __m128i m1, __m128i m2, __m128i m3)
+{
+    return _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), _mm_alignr_epi8(m3, m2, 4)), m3);
+}
+
+/** Convert the state from ABCD/EFGH to the ABEF/CDGH layout the instructions use. */
+void inline Shuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0xB1);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0x1B);
+    s0 = _mm_alignr_epi8(t1, t2, 0x08);
+    s1 = _mm_blend_epi16(t2, t1, 0xF0);
+}
+
+/** Inverse of Shuffle. */
+void inline Unshuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0x1B);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0xB1);
+    s0 = _mm_blend_epi16(t1, t2, 0xF0);
+    s1 = _mm_alignr_epi8(t2, t1, 0x08);
+}
+
+/** Load four big-endian message words. */
+__m128i inline Load(const unsigned char* in)
+{
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), _mm_load_si128((const __m128i*)MASK));
+}
+
+/** Store four words in big-endian order. */
+void inline Save(unsigned char* out, __m128i s)
+{
+    _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(s, _mm_load_si128((const __m128i*)MASK)));
+}
+
+/** Run the compression function on a shuffled state, for message words m0..m3. */
+void inline Compress(__m128i& s0, __m128i& s1, __m128i m0, __m128i m1, __m128i m2, __m128i m3)
+{
+    const __m128i so0 = s0, so1 = s1;
+
+    QuadRound(s0, s1, m0, 0);
+    QuadRound(s0, s1, m1, 1);
+    QuadRound(s0, s1, m2, 2);
+    QuadRound(s0, s1, m3, 3);
+    for (int i = 4; i < 16; i += 4) {
+        m0 = Schedule(m0, m1, m2, m3);
+        QuadRound(s0, s1, m0, i);
+        m1 = Schedule(m1, m2, m3, m0);
+        QuadRound(s0, s1, m1, i + 1);
+        m2 = Schedule(m2, m3, m0, m1);
+        QuadRound(s0, s1, m2, i + 2);
+        m3 = Schedule(m3, m0, m1, m2);
+        QuadRound(s0, s1, m3, i + 3);
+    }
+
+    s0 = _mm_add_epi32(s0, so0);
+    s1 = _mm_add_epi32(s1, so1);
+}
+
+/** Run the compression function on two independent states, interleaved. */
+void inline Compress2(__m128i& s0a, __m128i& s1a, __m128i m0a, __m128i m1a, __m128i m2a, __m128i m3a,
+                      __m128i& s0b, __m128i& s1b, __m128i m0b, __m128i m1b, __m128i m2b, __m128i m3b)
+{
+    const __m128i so0a = s0a, so1a = s1a, so0b = s0b, so1b = s1b;
+
+    QuadRound(s0a, s1a, m0a, 0);
+    QuadRound(s0b, s1b, m0b, 0);
+    QuadRound(s0a, s1a, m1a, 1);
+    QuadRound(s0b, s1b, m1b, 1);
+    QuadRound(s0a, s1a, m2a, 2);
+    QuadRound(s0b, s1b, m2b, 2);
+    QuadRound(s0a, s1a, m3a, 3);
+    QuadRound(s0b, s1b, m3b, 3);
+    for (int i = 4; i < 16; i += 4) {
+        m0a = Schedule(m0a, m1a, m2a, m3a);
+        m0b = Schedule(m0b, m1b, m2b, m3b);
+        QuadRound(s0a, s1a, m0a, i);
+        QuadRound(s0b, s1b, m0b, i);
+        m1a = Schedule(m1a, m2a, m3a, m0a);
+        m1b = Schedule(m1b, m2b, m3b, m0b);
+        QuadRound(s0a, s1a, m1a, i + 1);
+        QuadRound(s0b, s1b, m1b, i + 1);
+        m2a = Schedule(m2a, m3a, m0a, m1a);
+        m2b = Schedule(m2b, m3b, m0b, m1b);
+        QuadRound(s0a, s1a, m2a, i + 2);
+        QuadRound(s0b, s1b, m2b, i + 2);
+        m3a = Schedule(m3a, m0a, m1a, m2a);
+        m3b = Schedule(m3b, m0b, m1b, m2b);
+        QuadRound(s0a, s1a, m3a, i + 3);
+        QuadRound(s0b, s1b, m3b, i + 3);
+    }
+
+    s0a = _mm_add_epi32(s0a, so0a);
+    s1a = _mm_add_epi32(s1a, so1a);
+    s0b = _mm_add_epi32(s0b, so0b);
+    s1b = _mm_add_epi32(s1b, so1b);
+}
+
+}
+
+namespace sha256_shani {
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    __m128i s0 = _mm_loadu_si128((const __m128i*)s);
+    __m128i s1 = _mm_loadu_si128((const __m128i*)(s + 4));
+    Shuffle(s0, s1);
+
+    while (blocks--) {
+        Compress(s0, s1, Load(chunk), Load(chunk + 16), Load(chunk + 32), Load(chunk + 48));
+        chunk += 64;
+    }
+
+    Unshuffle(s0, s1);
+    _mm_storeu_si128((__m128i*)s, s0);
+    _mm_storeu_si128((__m128i*)(s + 4), s1);
+}
+}
+
+namespace sha256d64_shani {
+void Transform_2way(unsigned char* out, const unsigned char* in)
+{
+    const __m128i init0 = _mm_load_si128((const __m128i*)INIT);
+    const __m128i init1 = _mm_load_si128((const __m128i*)(INIT + 4));
+    const __m128i pad0 = _mm_load_si128((const __m128i*)PAD512);
+    const __m128i pad1 = _mm_load_si128((const __m128i*)(PAD512 + 4));
+    const __m128i pad2 = _mm_load_si128((const __m128i*)(PAD512 + 8));
+    const __m128i pad3 = _mm_load_si128((const __m128i*)(PAD512 + 12));
+    const __m128i pad256a = _mm_load_si128((const __m128i*)PAD256);
+    const __m128i pad256b = _mm_load_si128((const __m128i*)(PAD256 + 4));
+
+    // Transform 1: the 64-byte inputs.
+    __m128i s0a = init0, s1a = init1, s0b = init0, s1b = init1;
+    Shuffle(s0a, s1a);
+    Shuffle(s0b, s1b);
+    const __m128i sh0 = s0a, sh1 = s1a;
+    Compress2(s0a, s1a, Load(in), Load(in + 16), Load(in + 32), Load(in + 48),
+              s0b, s1b, Load(in + 64), Load(in + 80), Load(in + 96), Load(in + 112));
+
+    // Transform 2: padding.
+    Compress2(s0a, s1a, pad0, pad1, pad2, pad3, s0b, s1b, pad0, pad1, pad2, pad3);
+
+    // Transform 3: the digests, which become the message words as they are.
+    Unshuffle(s0a, s1a);
+    Unshuffle(s0b, s1b);
+    __m128i t0a = sh0, t1a = sh1, t0b = sh0, t1b = sh1;
+    Compress2(t0a, t1a, s0a, s1a, pad256a, pad256b, t0b, t1b, s0b, s1b, pad256a, pad256b);
+
+    Unshuffle(t0a, t1a);
+    Unshuffle(t0b, t1b);
+    Save(out, t0a);
+    Save(out + 16, t1a);
+    Save(out + 32, t0b);
+    Save(out + 48, t1b);
+}
+}
+
+#endif
@@ -0,0 +1,230 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * A fixed size, set-associative cache for elements that are already
+ * uniformly distributed hashes (such as the entries of the signature
+ * cache). Every element may live in one of eight slots, picked by the eight
+ * hash functions of Hash.
+ *
+ * Lookups never move elements and erase by clearing a per-slot atomic flag,
+ * so any number of threads may call contains() concurrently. insert() moves
+ * elements between slots and must not run concurrently with anything else;
+ * callers guard it with a writer lock and lookups with a reader lock.
+ *
+ * Instead of tracking recency, elements are assigned to generations. Once
+ * more than 45% of the slots hold live elements of the current generation,
+ * every element of the previous generation is marked as erasable and the
+ * current generation becomes the previous one.
+ */
+namespace CuckooCache
+{
+
+/** A vector of bits that can be set and cleared atomically, all initially set. */
+class bit_packed_atomic_flags
+{
+    std::unique_ptr<std::atomic<uint8_t>[]> mem;
+
+public:
+    bit_packed_atomic_flags() = delete;
+
+    explicit bit_packed_atomic_flags(uint32_t size)
+    {
+        size = (size + 7) / 8;
+        mem.reset(new std::atomic<uint8_t>[size]);
+        for (uint32_t i = 0; i < size; ++i)
+            mem[i].store(0xFF);
+    }
+
+    /** Resize to b bits and set all of them, discarding the old contents. */
+    void setup(uint32_t b)
+    {
+        bit_packed_atomic_flags d(b);
+        std::swap(mem, d.mem);
+    }
+
+    void bit_set(uint32_t s)
+    {
+        mem[s >> 3].fetch_or(1 << (s & 7), std::memory_order_relaxed);
+    }
+
+    void bit_unset(uint32_t s)
+    {
+        mem[s >> 3].fetch_and(~(1 << (s & 7)), std::memory_order_relaxed);
+    }
+
+    bool bit_is_set(uint32_t s) const
+    {
+        return (1 << (s & 7)) & mem[s >> 3].load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Hash must provide template <uint8_t n> uint32_t operator()(const Element&)
+ * for n in 0..7, returning independent, uniformly distributed values.
+ */
+template <typename Element, typename Hash>
+class cache
+{
+private:
+    std::vector<Element> table;
+    uint32_t size;
+    //! Set for slots that are empty or may be overwritten
+    mutable bit_packed_atomic_flags collection_flags;
+    //! Set for slots whose element belongs to the current generation
+    std::vector<bool> epoch_flags;
+    //! Number of inserts until epoch_check() next scans the table
+    uint32_t epoch_heuristic_counter;
+    //! Number of live current generation elements that starts a new generation
+    uint32_t epoch_size;
+    //! Maximum number of elements one insert() displaces before giving up
+    uint8_t depth_limit;
+    const Hash hash_function;
+
+    /** Map the eight hashes of e onto [0, size) without a modulo. */
+    std::array<uint32_t, 8> compute_hashes(const Element& e) const
+    {
+        return {{(uint32_t)((hash_function.template operator()<0>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<1>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<2>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<3>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<4>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<5>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<6>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<7>(e) * (uint64_t)size) >> 32)}};
+    }
+
+    static uint32_t invalid() { return ~(uint32_t)0; }
+
+    void allow_erase(uint32_t n) const { collection_flags.bit_set(n); }
+    void please_keep(uint32_t n) const { collection_flags.bit_unset(n); }
+
+    /** Start a new generation if the current one has filled its share of the table. */
+    void epoch_check()
+    {
+        if (epoch_heuristic_counter != 0) {
+            --epoch_heuristic_counter;
+            return;
+        }
+
+        uint32_t epoch_unused_count = 0;
+        for (uint32_t i = 0; i < size; ++i)
+            epoch_unused_count += epoch_flags[i] && !collection_flags.bit_is_set(i);
+
+        if (epoch_unused_count >= epoch_size) {
+            for (uint32_t i = 0; i < size; ++i) {
+                if (epoch_flags[i])
+                    epoch_flags[i] = false;
+                else
+                    allow_erase(i);
+            }
+            epoch_heuristic_counter = epoch_size;
+        } else {
+            // Without any erases in between it takes at least this many
+            // inserts before the generation can be full.
+            epoch_heuristic_counter = std::max(1u, std::max(epoch_size / 16, epoch_size - epoch_unused_count));
+        }
+    }
+
+public:
+    cache() : table(), size(), collection_flags(0), epoch_flags(),
+              epoch_heuristic_counter(), epoch_size(), depth_limit(0), hash_function()
+    {
+    }
+
+    /** Allocate room for new_size elements (at least 2) and clear the cache. */
+    uint32_t setup(uint32_t new_size)
+    {
+        size = std::max<uint32_t>(2, new_size);
+        depth_limit = static_cast<uint8_t>(std::log2(static_cast<float>(size)));
+        table.assign(size, Element());
+        collection_flags.setup(size);
+        epoch_flags.assign(size, false);
+        epoch_size = std::max<uint32_t>(1, (45 * size) / 100);
+        epoch_heuristic_counter = epoch_size;
+        return size;
+    }
+
+    /** Like setup(), sized to use at most bytes of memory for the table. */
+    uint32_t setup_bytes(size_t bytes)
+    {
+        return setup(std::min<size_t>(bytes / sizeof(Element), std::numeric_limits<uint32_t>::max()));
+    }
+
+    /**
+     * Insert e, displacing other elements up to depth_limit times if all of
+     * its slots are taken. The element left over at the end is dropped,
+     * which is always an old one rather than e.
+     */
+    void insert(Element e)
+    {
+        epoch_check();
+        uint32_t last_loc = invalid();
+        bool last_epoch = true;
+        std::array<uint32_t, 8> locs = compute_hashes(e);
+
+        // Already present: make sure it is kept.
+        for (uint32_t loc : locs) {
+            if (table[loc] == e) {
+                please_keep(loc);
+                epoch_flags[loc] = last_epoch;
+                return;
+            }
+        }
+
+        for (uint8_t depth = 0; depth < depth_limit; ++depth) {
+            for (uint32_t loc : locs) {
+                if (!collection_flags.bit_is_set(loc))
+                    continue;
+                table[loc] = std::move(e);
+                please_keep(loc);
+                epoch_flags[loc] = last_epoch;
+                return;
+            }
+
+            // Swap with the slot after the one we filled last, so that we
+            // never evict the element we just placed.
+            last_loc = locs[(1 + (std::find(locs.begin(), locs.end(), last_loc) - locs.begin())) & 7];
+            std::swap(table[last_loc], e);
+            bool epoch = last_epoch;
+            last_epoch = epoch_flags[last_loc];
+            epoch_flags[last_loc] = epoch;
+
+            locs = compute_hashes(e);
+        }
+    }
+
+    /**
+     * Return whether e is in the cache. With erase, its slot may be reused
+     * by a later insert(); the element stays visible until then.
+     */
+    bool contains(const Element& e, const bool erase) const
+    {
+        std::array<uint32_t, 8> locs = compute_hashes(e);
+        for (uint32_t loc : locs) {
+            if (table[loc] == e) {
+                if (erase)
+                    allow_erase(loc);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+} // namespace CuckooCache
+
+#endif // BITCOIN_CUCKOOCACHE_H
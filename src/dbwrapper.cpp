@@ -7,6 +7,8 @@
 #include "util.h"
 #include "random.h"
 
+#include <algorithm>
+
 #include <boost/filesystem.hpp>
 
 #include <leveldb/cache.h>
@@ -15,12 +17,34 @@
 #include <memenv.h>
 #include <stdint.h>
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static leveldb::Options GetOptions(size_t nCacheSize, int nBloomBits, DBProfile profile)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    switch (profile) {
+    case DB_PROFILE_METADATA:
+        // Every write buffer ends up as a level 0 table that has to be
+        // compacted. A small buffer keeps these compactions short, and the
+        // records are read back through the block cache anyway.
+        options.write_buffer_size = std::min(nCacheSize / 4, (size_t)1 << 20);
+        options.block_cache = leveldb::NewLRUCache(nCacheSize - 2 * options.write_buffer_size);
+        break;
+    case DB_PROFILE_INDEX:
+        // Keys are hashes, so each write buffer overlaps the whole key range
+        // of the level below. Larger buffers mean fewer, larger compactions;
+        // reads are rare and mostly answered by the Bloom filter.
+        options.write_buffer_size = nCacheSize * 3 / 8;
+        options.block_cache = leveldb::NewLRUCache(nCacheSize / 4);
+        options.block_size = 16 << 10;
+        break;
+    default:
+        options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
+        options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+        break;
+    }
+    // Tables written without a filter are simply read in full; the filter
+    // can be switched on and off without touching existing data.
+    if (nBloomBits > 0)
+        options.filter_policy = leveldb::NewBloomFilterPolicy(nBloomBits);
     options.compression = leveldb::kNoCompression;
     options.max_open_files = 64;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
@@ -31,14 +55,14 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, int nBloomBits, DBProfile profile) : nReads(0), nReadsNotFound(0), nSeeks(0), nWrites(0), nWriteMicros(0), fBulkLoad(false)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, nBloomBits, profile);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -90,7 +114,10 @@ CDBWrapper::~CDBWrapper()
 
 bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
 {
+    const int64_t nStart = GetTimeMicros();
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
+    nWrites++;
+    nWriteMicros += std::max(GetTimeMicros() - nStart, (int64_t)0);
     dbwrapper_private::HandleError(status);
     return true;
 }
@@ -122,7 +149,50 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
+CDBReadStats CDBWrapper::GetReadStats() const
+{
+    CDBReadStats stats;
+    stats.nReads = nReads;
+    stats.nReadsNotFound = nReadsNotFound;
+    stats.nSeeks = nSeeks;
+    return stats;
+}
+
+uint64_t CDBWrapper::GetPropertyNumber(const std::string& property) const
+{
+    std::string strValue;
+    if (!pdb->GetProperty(property, &strValue))
+        return 0;
+    return atoi64(strValue);
+}
+
+CDBWriteStats CDBWrapper::GetWriteStats() const
+{
+    CDBWriteStats stats;
+    stats.nWrites = nWrites;
+    stats.nWriteMicros = nWriteMicros;
+    stats.nSlowdowns = GetPropertyNumber("leveldb.write-slowdowns");
+    stats.nStallMicros = GetPropertyNumber("leveldb.write-stall-micros");
+    stats.nCompactions = GetPropertyNumber("leveldb.compactions");
+    stats.nCompactionMicros = GetPropertyNumber("leveldb.compaction-micros");
+    stats.nCompactionBytesRead = GetPropertyNumber("leveldb.compaction-bytes-read");
+    stats.nCompactionBytesWritten = GetPropertyNumber("leveldb.compaction-bytes-written");
+    stats.nThrottleMicros = GetPropertyNumber("leveldb.compaction-throttle-micros");
+    stats.nLevel0Files = GetPropertyNumber("leveldb.num-files-at-level0");
+    return stats;
+}
+
+void CDBWrapper::SetBulkLoad(bool fBulkLoadIn, uint64_t nCompactionRate)
+{
+    fBulkLoad = fBulkLoadIn;
+    if (fBulkLoadIn)
+        pdb->SetCompactionThrottle(DB_BULK_LOAD_L0_SLOWDOWN, DB_BULK_LOAD_L0_STOP, nCompactionRate);
+    else
+        pdb->SetCompactionThrottle(DB_L0_SLOWDOWN, DB_L0_STOP, 0);
+}
+
 CDBIterator::~CDBIterator() { delete piter; }
+void CDBIterator::CountSeek() { parent.nSeeks++; }
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
 void CDBIterator::Next() { piter->Next(); }
@@ -12,11 +12,35 @@
 #include "utilstrencodings.h"
 #include "version.h"
 
+#include <atomic>
+
 #include <boost/filesystem/path.hpp>
 
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+//! -dbbloombits default
+static const int DEFAULT_DB_BLOOM_BITS = 10;
+//! max. -dbbloombits
+static const int MAX_DB_BLOOM_BITS = 20;
+
+//! Level 0 files at which LevelDB slows down and stops writes
+static const int DB_L0_SLOWDOWN = 8;
+static const int DB_L0_STOP = 12;
+//! The same during a bulk load, see CDBWrapper::SetBulkLoad
+static const int DB_BULK_LOAD_L0_SLOWDOWN = 20;
+static const int DB_BULK_LOAD_L0_STOP = 32;
+//! -dbcompactionrate default (MiB/s, 0 for no limit)
+static const int64_t DEFAULT_DB_COMPACTION_RATE = 0;
+
+/** How a database is used, which decides how its cache is split and its tables are laid out. */
+enum DBProfile
+{
+    DB_PROFILE_DEFAULT,  //!< point reads and large batch writes, as the chain state
+    DB_PROFILE_METADATA, //!< small records that are mostly read in full, written in small batches
+    DB_PROFILE_INDEX,    //!< a large index with random keys, written a block at a time and rarely read
+};
+
 class dbwrapper_error : public std::runtime_error
 {
 public:
@@ -56,6 +80,11 @@ public:
      */
     CDBBatch(const CDBWrapper &parent) : parent(parent) { };
 
+    void Clear()
+    {
+        batch.Clear();
+    }
+
     template <typename K, typename V>
     void Write(const K& key, const V& value)
     {
@@ -85,12 +114,50 @@ public:
     }
 };
 
+/** Counts of the lookups done on a CDBWrapper */
+struct CDBReadStats
+{
+    //! Point reads (Read and Exists)
+    uint64_t nReads;
+    //! Point reads that found nothing
+    uint64_t nReadsNotFound;
+    //! Iterator seeks, which the Bloom filter cannot shortcut
+    uint64_t nSeeks;
+
+    CDBReadStats() : nReads(0), nReadsNotFound(0), nSeeks(0) {}
+};
+
+/** Writes to a CDBWrapper and the background compactions they cause */
+struct CDBWriteStats
+{
+    //! Batches written and the time spent in them, write stalls included
+    uint64_t nWrites;
+    uint64_t nWriteMicros;
+    //! Writes delayed by 1ms because level 0 had many files
+    uint64_t nSlowdowns;
+    //! Time writes waited for a compaction to make room
+    uint64_t nStallMicros;
+    //! Background compactions, flushes of the write buffer included
+    uint64_t nCompactions;
+    uint64_t nCompactionMicros;
+    uint64_t nCompactionBytesRead;
+    uint64_t nCompactionBytesWritten;
+    //! Time compactions were held back by the bulk load compaction rate
+    uint64_t nThrottleMicros;
+    //! Files at level 0 right now
+    uint64_t nLevel0Files;
+
+    CDBWriteStats() : nWrites(0), nWriteMicros(0), nSlowdowns(0), nStallMicros(0), nCompactions(0), nCompactionMicros(0), nCompactionBytesRead(0), nCompactionBytesWritten(0), nThrottleMicros(0), nLevel0Files(0) {}
+};
+
 class CDBIterator
 {
 private:
     const CDBWrapper &parent;
     leveldb::Iterator *piter;
 
+    void CountSeek();
+
 public:
 
     /**
@@ -111,6 +178,7 @@ public:
         ssKey << key;
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
         piter->Seek(slKey);
+        CountSeek();
     }
 
     void Next();
@@ -151,6 +219,7 @@ public:
 class CDBWrapper
 {
     friend const std::vector<unsigned char>& dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
+    friend class CDBIterator;
 private:
     //! custom environment this database is using (may be NULL in case of default environment)
     leveldb::Env* penv;
@@ -176,6 +245,20 @@ private:
     //! a key used for optional XOR-obfuscation of the database
     std::vector<unsigned char> obfuscate_key;
 
+    //! lookup counters, see CDBReadStats
+    mutable std::atomic<uint64_t> nReads;
+    mutable std::atomic<uint64_t> nReadsNotFound;
+    mutable std::atomic<uint64_t> nSeeks;
+
+    //! write counters, see CDBWriteStats
+    std::atomic<uint64_t> nWrites;
+    std::atomic<uint64_t> nWriteMicros;
+
+    //! whether SetBulkLoad is on
+    std::atomic<bool> fBulkLoad;
+
+    uint64_t GetPropertyNumber(const std::string& property) const;
+
     //! the key under which the obfuscation key is stored
     static const std::string OBFUSCATE_KEY_KEY;
 
@@ -192,8 +275,11 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] nBloomBits  Bits per key of the Bloom filter that lets point reads of
+     *                        missing keys skip table reads. 0 disables the filter.
+     * @param[in] profile     How the database is used, see DBProfile.
      */
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, int nBloomBits = DEFAULT_DB_BLOOM_BITS, DBProfile profile = DB_PROFILE_DEFAULT);
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -206,9 +292,12 @@ public:
 
         std::string strValue;
         leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        nReads++;
         if (!status.ok()) {
-            if (status.IsNotFound())
+            if (status.IsNotFound()) {
+                nReadsNotFound++;
                 return false;
+            }
             LogPrintf("LevelDB read failure: %s\n", status.ToString());
             dbwrapper_private::HandleError(status);
         }
@@ -240,9 +329,12 @@ public:
 
         std::string strValue;
         leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        nReads++;
         if (!status.ok()) {
-            if (status.IsNotFound())
+            if (status.IsNotFound()) {
+                nReadsNotFound++;
                 return false;
+            }
             LogPrintf("LevelDB read failure: %s\n", status.ToString());
             dbwrapper_private::HandleError(status);
         }
@@ -280,6 +372,19 @@ public:
      * Return true if the database managed by this class contains no entries.
      */
     bool IsEmpty();
+
+    CDBReadStats GetReadStats() const;
+    CDBWriteStats GetWriteStats() const;
+
+    /**
+     * Tune compactions for a bulk load, such as that of the chain state
+     * during initial block download: writes are only held back at many more
+     * level 0 files, and compactions below level 1 write at most
+     * nCompactionRate bytes per second (0 for no limit) while level 0 needs
+     * no compaction. Reads get slower as level 0 grows.
+     */
+    void SetBulkLoad(bool fBulkLoadIn, uint64_t nCompactionRate = 0);
+    bool IsBulkLoad() const { return fBulkLoad; }
 };
 
 #endif // BITCOIN_DBWRAPPER_H
@@ -0,0 +1,41 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "eccontext.h"
+
+#include <assert.h>
+
+#include <secp256k1_rangeproof.h>
+
+namespace {
+
+class CSharedECCContext
+{
+public:
+    secp256k1_context* ctx;
+
+    CSharedECCContext()
+    {
+        ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN | SECP256K1_CONTEXT_VERIFY);
+        assert(ctx != NULL);
+        secp256k1_pedersen_context_initialize(ctx);
+        secp256k1_rangeproof_context_initialize(ctx);
+    }
+
+    ~CSharedECCContext()
+    {
+        secp256k1_context_destroy(ctx);
+    }
+};
+
+}
+
+const secp256k1_context* ECC_GetContext()
+{
+    // Built on first use rather than at load time, so that programs which
+    // never need the tables do not pay for them. C++11 makes the
+    // initialization of function-local statics thread safe.
+    static CSharedECCContext shared;
+    return shared.ctx;
+}
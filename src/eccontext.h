@@ -0,0 +1,21 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ECCONTEXT_H
+#define BITCOIN_ECCONTEXT_H
+
+#include <secp256k1.h>
+
+/**
+ * The secp256k1 context shared by all code in the process that verifies
+ * signatures, commitments and range proofs, or creates commitments and range
+ * proofs. It holds the verification, generation, Pedersen and range proof
+ * tables, which are built once, by the first call. Thread safe.
+ *
+ * The context is not randomized: ECDSA signing with private keys goes through
+ * the blinded context that ECC_Start creates instead.
+ */
+const secp256k1_context* ECC_GetContext();
+
+#endif // BITCOIN_ECCONTEXT_H
@@ -158,6 +158,33 @@ public:
     }
 };
 
+/**
+ * Writes to an underlying stream and hashes what it writes, so that data which
+ * is both stored and checksummed is serialized once.
+ */
+template<typename Stream>
+class CHashingWriter : public CHashWriter
+{
+private:
+    Stream& stream;
+
+public:
+    CHashingWriter(Stream& streamIn) : CHashWriter(streamIn.GetType(), streamIn.GetVersion()), stream(streamIn) {}
+
+    CHashingWriter& write(const char *pch, size_t size) {
+        stream.write(pch, size);
+        CHashWriter::write(pch, size);
+        return (*this);
+    }
+
+    template<typename T>
+    CHashingWriter& operator<<(const T& obj) {
+        // Serialize to this stream
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 /** Compute the 256-bit hash of an object's serialization. */
 template<typename T>
 uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL_VERSION)
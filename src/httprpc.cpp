@@ -7,6 +7,7 @@
 #include "base58.h"
 #include "chainparams.h"
 #include "httpserver.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -15,15 +16,23 @@
 #include "utilstrencodings.h"
 #include "ui_interface.h"
 #include "crypto/hmac_sha256.h"
+#include "crypto/sha256.h"
+#include "utiltime.h"
 #include <stdio.h>
 #include "utilstrencodings.h"
 
 #include <boost/algorithm/string.hpp> // boost::trim
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp> //BOOST_FOREACH
 
 /** WWW-Authenticate to present with 401 Unauthorized response */
 static const char* WWW_AUTH_HEADER_DATA = "Basic realm=\"jsonrpc\"";
 
+/** Number of -rpcauth credentials remembered as verified */
+static const size_t RPC_AUTH_CACHE_SIZE = 64;
+/** Seconds a verified -rpcauth credential is remembered for */
+static const int64_t RPC_AUTH_CACHE_EXPIRY = 300;
+
 /** Simple one-shot callback timer to be used by the RPC mechanism to e.g.
  * re-lock the wellet.
  */
@@ -83,6 +92,78 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
     req->WriteReply(nStatus, strReply);
 }
 
+/**
+ * Credentials that recently passed the -rpcauth check, so that a client
+ * sending many requests is not put through the HMAC of every -rpcauth entry
+ * each time. Only a salted hash of a credential is kept, and a lookup
+ * compares against every slot, so that neither its time nor the memory
+ * contents reveal which credentials were seen.
+ */
+class CRPCAuthCache
+{
+private:
+    struct Entry
+    {
+        unsigned char digest[CSHA256::OUTPUT_SIZE];
+        int64_t nExpiry;
+    };
+
+    CCriticalSection cs;
+    unsigned char salt[32];
+    Entry entries[RPC_AUTH_CACHE_SIZE];
+
+    void Digest(const std::string& strUserPass, unsigned char* digest) const
+    {
+        CSHA256().Write(salt, sizeof(salt)).Write((const unsigned char*)strUserPass.data(), strUserPass.size()).Finalize(digest);
+    }
+
+public:
+    CRPCAuthCache()
+    {
+        memset(salt, 0, sizeof(salt));
+        memset(entries, 0, sizeof(entries));
+    }
+
+    //! Forget every credential and pick a new salt
+    void Clear()
+    {
+        LOCK(cs);
+        GetRandBytes(salt, sizeof(salt));
+        memset(entries, 0, sizeof(entries));
+    }
+
+    bool Contains(const std::string& strUserPass)
+    {
+        unsigned char digest[CSHA256::OUTPUT_SIZE];
+        Digest(strUserPass, digest);
+        const int64_t nNow = GetTime();
+        bool fFound = false;
+        LOCK(cs);
+        for (size_t i = 0; i < RPC_AUTH_CACHE_SIZE; i++) {
+            unsigned char accumulator = 0;
+            for (size_t j = 0; j < sizeof(digest); j++)
+                accumulator |= entries[i].digest[j] ^ digest[j];
+            fFound |= (accumulator == 0) & (entries[i].nExpiry > nNow);
+        }
+        return fFound;
+    }
+
+    /** Remember a credential, in place of the one that expires first */
+    void Add(const std::string& strUserPass)
+    {
+        LOCK(cs);
+        size_t nSlot = 0;
+        for (size_t i = 1; i < RPC_AUTH_CACHE_SIZE; i++) {
+            if (entries[i].nExpiry < entries[nSlot].nExpiry)
+                nSlot = i;
+        }
+        Digest(strUserPass, entries[nSlot].digest);
+        entries[nSlot].nExpiry = GetTime() + RPC_AUTH_CACHE_EXPIRY;
+    }
+};
+
+static CRPCAuthCache rpcAuthCache;
+
 //This function checks username and password against -rpcauth
 //entries from config file.
 static bool multiUserAuthorized(std::string strUserPass)
@@ -141,7 +222,124 @@ static bool RPCAuthorized(const std::string& strAuth)
     if (TimingResistantEqual(strUserPass, strRPCUserColonPass)) {
         return true;
     }
-    return multiUserAuthorized(strUserPass);
+    if (rpcAuthCache.Contains(strUserPass))
+        return true;
+    if (!multiUserAuthorized(strUserPass))
+        return false;
+    rpcAuthCache.Add(strUserPass);
+    return true;
+}
+
+/** The calls of a JSON-RPC batch, run by the worker thread that received
+ * the batch together with any HTTP worker threads that are idle.
+ */
+class HTTPRPCBatch
+{
+private:
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    //! Index of the next call to start
+    size_t nNext;
+    //! Replies of the calls that finished and were not taken yet
+    std::vector<std::string> vReply;
+    std::vector<bool> vDone;
+
+public:
+    const UniValue vReq;
+    //! RPC user name, for logging on the helping threads
+    const std::string strUser;
+
+    HTTPRPCBatch(const UniValue& vReqIn, const std::string& strUserIn) :
+        nNext(0), vReply(vReqIn.size()), vDone(vReqIn.size(), false), vReq(vReqIn), strUser(strUserIn)
+    {
+    }
+
+    /** Run the next call that nobody started yet. Returns false if there is none. */
+    bool RunOne()
+    {
+        size_t nIndex;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (nNext == vReq.size())
+                return false;
+            nIndex = nNext++;
+        }
+        std::string strReply = JSONRPCExecOne(vReq[nIndex]).write();
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            vReply[nIndex].swap(strReply);
+            vDone[nIndex] = true;
+        }
+        cond.notify_all();
+        return true;
+    }
+
+    /**
+     * Append the replies of the calls from nBegin on that have finished, up
+     * to the first one that has not, to strOut, separated by commas. If
+     * fWait is set, wait for call nBegin to finish first. Returns the index
+     * of the first call not taken.
+     */
+    size_t TakeReplies(size_t nBegin, bool fWait, std::string& strOut)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (fWait && !vDone[nBegin])
+            cond.wait(lock);
+        size_t nEnd = nBegin;
+        for (; nEnd < vDone.size() && vDone[nEnd]; nEnd++) {
+            if (nEnd > 0)
+                strOut += ",";
+            strOut += vReply[nEnd];
+            std::string().swap(vReply[nEnd]);
+        }
+        return nEnd;
+    }
+};
+
+/** Work item that helps running the calls of a batch */
+class HTTPRPCBatchWorkItem : public HTTPClosure
+{
+private:
+    std::shared_ptr<HTTPRPCBatch> batch;
+
+public:
+    HTTPRPCBatchWorkItem(const std::shared_ptr<HTTPRPCBatch>& batchIn) : batch(batchIn) {}
+
+    void operator()()
+    {
+        if (!userInstance.get()) {
+            userInstance.reset(new std::string(batch->strUser));
+        }
+        while (batch->RunOne()) {}
+    }
+};
+
+/** Run the calls of a batch on as many idle worker threads as can help,
+ * and send the reply array as the replies come in, in the order of the calls.
+ */
+static void JSONRPCExecBatchStreaming(HTTPRequest* req, const UniValue& vReq, const std::string& strUser)
+{
+    std::shared_ptr<HTTPRPCBatch> batch = std::make_shared<HTTPRPCBatch>(vReq, strUser);
+    for (size_t i = 1; i < vReq.size(); i++) {
+        std::unique_ptr<HTTPRPCBatchWorkItem> item(new HTTPRPCBatchWorkItem(batch));
+        if (!EnqueueHTTPIdleWork(item.get()))
+            break;
+        item.release(); /* queue took ownership */
+    }
+
+    req->WriteHeader("Content-Type", "application/json");
+    req->WriteReplyStart(HTTP_OK);
+    std::string strChunk = "[";
+    size_t nTaken = 0;
+    while (nTaken < vReq.size()) {
+        // Once every call has been started, wait for the others to finish.
+        bool fRan = batch->RunOne();
+        nTaken = batch->TakeReplies(nTaken, !fRan, strChunk);
+        req->WriteReplyChunk(strChunk);
+        strChunk.clear();
+    }
+    req->WriteReplyChunk("]\n");
+    req->WriteReplyEnd();
 }
 
 static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
@@ -176,8 +374,9 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     std::string strUserPass64 = authHeader.second.substr(6);
     boost::trim(strUserPass64);
     std::string strUserPass = DecodeBase64(strUserPass64);
+    std::string strUser = strUserPass.substr(0, strUserPass.find(":"));
     if (!userInstance.get()) {
-        userInstance.reset(new std::string(strUserPass.substr(0, strUserPass.find(":"))));
+        userInstance.reset(new std::string(strUser));
     }
 
     JSONRequest jreq;
@@ -192,12 +391,23 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
-            UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
-
-            // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
-
-        // array of requests
+            // Send reply, large results in parts as they are written
+            CJSONStreamWriter writer(boost::bind(&HTTPRequest::WriteReplyPart, req, "application/json", _1));
+            writer.BeginObject();
+            writer.Key("result");
+            tableRPC.execute(jreq.strMethod, jreq.params, writer);
+            writer.Key("error");
+            writer.Value(NullUniValue);
+            writer.Key("id");
+            writer.Value(jreq.id);
+            writer.EndObject();
+            req->WriteReplyLast("application/json", writer.GetBuffered() + "\n");
+            return true;
+
+        // array of requests, whose replies are sent as they finish
+        } else if (valRequest.isArray() && !valRequest.empty()) {
+            JSONRPCExecBatchStreaming(req, valRequest.get_array(), strUser);
+            return true;
         } else if (valRequest.isArray())
             strReply = JSONRPCExecBatch(valRequest.get_array());
         else
@@ -206,9 +416,20 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         req->WriteHeader("Content-Type", "application/json");
         req->WriteReply(HTTP_OK, strReply);
     } catch (const UniValue& objError) {
+        if (req->IsReplyStarted()) {
+            // Part of the result is out already; all that can be done is cut it short
+            LogPrintf("JSON-RPC %s failed after its reply was started: %s\n", SanitizeString(jreq.strMethod), find_value(objError, "message").write());
+            req->WriteReplyEnd();
+            return false;
+        }
         JSONErrorReply(req, objError, jreq.id);
         return false;
     } catch (const std::exception& e) {
+        if (req->IsReplyStarted()) {
+            LogPrintf("JSON-RPC %s failed after its reply was started: %s\n", SanitizeString(jreq.strMethod), e.what());
+            req->WriteReplyEnd();
+            return false;
+        }
         JSONErrorReply(req, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
         return false;
     }
@@ -217,6 +438,7 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 
 static bool InitRPCAuthentication()
 {
+    rpcAuthCache.Clear();
     if (mapArgs["-rpcpassword"] == "")
     {
         LogPrintf("No rpcpassword set - using random cookie authentication\n");
@@ -34,4 +34,12 @@ void InterruptREST();
  */
 void StopREST();
 
+/** Start serving the validation stats to Prometheus at /metrics.
+ * Precondition; HTTP has been started.
+ */
+bool StartMetrics();
+/** Stop serving /metrics.
+ */
+void StopMetrics();
+
 #endif
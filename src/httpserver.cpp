@@ -24,6 +24,7 @@
 #include <event2/http.h>
 #include <event2/thread.h>
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
 
@@ -40,6 +41,10 @@
 /** Maximum size of http request (request line + headers) */
 static const size_t MAX_HEADERS_SIZE = 8192;
 
+/** Maximum bytes of a chunked reply waiting to be written to the client
+ * before the thread producing it waits for the client to catch up */
+static const size_t MAX_REPLY_PENDING_SIZE = 1024 * 1024;
+
 /** HTTP request work item */
 class HTTPWorkItem : public HTTPClosure
 {
@@ -74,6 +79,8 @@ private:
     bool running;
     size_t maxDepth;
     int numThreads;
+    /** Number of threads waiting for work */
+    int numIdle;
 
     /** RAII object to keep track of number of running worker threads */
     class ThreadCounter
@@ -96,7 +103,8 @@ private:
 public:
     WorkQueue(size_t maxDepth) : running(true),
                                  maxDepth(maxDepth),
-                                 numThreads(0)
+                                 numThreads(0),
+                                 numIdle(0)
     {
     }
     /** Precondition: worker threads have all stopped
@@ -116,6 +124,19 @@ public:
         cond.notify_one();
         return true;
     }
+    /** Enqueue a work item only if a thread is waiting to pick it up, so
+     * that it neither waits nor takes the place of other work
+     */
+    bool EnqueueIfIdle(WorkItem* item)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (queue.size() >= (size_t)numIdle) {
+            return false;
+        }
+        queue.emplace_back(std::unique_ptr<WorkItem>(item));
+        cond.notify_one();
+        return true;
+    }
     /** Thread function */
     void Run()
     {
@@ -124,8 +145,10 @@ public:
             std::unique_ptr<WorkItem> i;
             {
                 boost::unique_lock<boost::mutex> lock(cs);
+                numIdle += 1;
                 while (running && queue.empty())
                     cond.wait(lock);
+                numIdle -= 1;
                 if (!running)
                     break;
                 i = std::move(queue.front());
@@ -169,20 +192,31 @@ struct HTTPPathHandler
     HTTPRequestHandler handler;
 };
 
+/** An event loop thread of the HTTP server. Every loop accepts connections
+ * on the same listening sockets, and the requests and replies of a
+ * connection are handled on the loop that accepted it.
+ */
+struct HTTPEventLoop
+{
+    struct event_base* base;
+    struct evhttp* http;
+    //! Listening sockets, duplicates of the first loop's on the other loops
+    std::vector<evhttp_bound_socket *> boundSockets;
+    boost::thread thread;
+
+    HTTPEventLoop() : base(0), http(0) {}
+};
+
 /** HTTP module state */
 
-//! libevent event loop
-static struct event_base* eventBase = 0;
-//! HTTP server
-struct evhttp* eventHTTP = 0;
+//! libevent event loops, the first of which also runs the RPC timers
+static std::vector<HTTPEventLoop*> eventLoops;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
 //! Work queue for handling longer requests off the event loop thread
 static WorkQueue<HTTPClosure>* workQueue = 0;
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
-//! Bound listening sockets
-std::vector<evhttp_bound_socket *> boundSockets;
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -245,7 +279,7 @@ static std::string RequestMethodString(HTTPRequest::RequestMethod m)
 /** HTTP request callback */
 static void http_request_cb(struct evhttp_request* req, void* arg)
 {
-    std::unique_ptr<HTTPRequest> hreq(new HTTPRequest(req));
+    std::unique_ptr<HTTPRequest> hreq(new HTTPRequest(req, (struct event_base*)arg));
 
     LogPrint("http", "Received a %s request for %s from %s\n",
              RequestMethodString(hreq->GetRequestMethod()), hreq->GetURI(), hreq->GetPeer().ToString());
@@ -302,7 +336,7 @@ static void http_reject_request_cb(struct evhttp_request* req, void*)
 }
 
 /** Event dispatcher thread */
-static void ThreadHTTP(struct event_base* base, struct evhttp* http)
+static void ThreadHTTP(struct event_base* base)
 {
     RenameThread("bitcoin-http");
     LogPrint("http", "Entering http event loop\n");
@@ -312,7 +346,7 @@ static void ThreadHTTP(struct event_base* base, struct evhttp* http)
 }
 
 /** Bind HTTP server to specified addresses */
-static bool HTTPBindAddresses(struct evhttp* http)
+static bool HTTPBindAddresses(struct evhttp* http, std::vector<evhttp_bound_socket *>& boundSockets)
 {
     int defaultPort = GetArg("-rpcport", BaseParams().RPCPort());
     std::vector<std::pair<std::string, uint16_t> > endpoints;
@@ -350,6 +384,67 @@ static bool HTTPBindAddresses(struct evhttp* http)
     return !boundSockets.empty();
 }
 
+/** Accept connections on the listening sockets of another event loop too */
+static bool HTTPShareAddresses(struct evhttp* http, const std::vector<evhttp_bound_socket *>& boundSocketsFirst, std::vector<evhttp_bound_socket *>& boundSockets)
+{
+#ifdef WIN32
+    return false;
+#else
+    // Every loop closes its own descriptors when it stops listening, so each
+    // gets duplicates. Unlike binding a socket of its own with SO_REUSEPORT,
+    // this does not let another process bind the RPC port alongside us.
+    BOOST_FOREACH (evhttp_bound_socket *socket, boundSocketsFirst) {
+        evutil_socket_t fd = dup(evhttp_bound_socket_get_fd(socket));
+        if (fd < 0)
+            return false;
+        evhttp_bound_socket *handle = evhttp_accept_socket_with_handle(http, fd);
+        if (!handle) {
+            close(fd);
+            return false;
+        }
+        boundSockets.push_back(handle);
+    }
+    return true;
+#endif
+}
+
+/** Set up an event loop with its HTTP server */
+static HTTPEventLoop* NewHTTPEventLoop()
+{
+    HTTPEventLoop* loop = new HTTPEventLoop();
+    loop->base = event_base_new(); // XXX RAII
+    if (!loop->base) {
+        LogPrintf("Couldn't create an event_base: exiting\n");
+        delete loop;
+        return NULL;
+    }
+
+    /* Create a new evhttp object to handle requests. */
+    loop->http = evhttp_new(loop->base); // XXX RAII
+    if (!loop->http) {
+        LogPrintf("couldn't create evhttp. Exiting.\n");
+        event_base_free(loop->base);
+        delete loop;
+        return NULL;
+    }
+
+    evhttp_set_timeout(loop->http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
+    evhttp_set_max_headers_size(loop->http, MAX_HEADERS_SIZE);
+    evhttp_set_max_body_size(loop->http, MAX_SIZE);
+    evhttp_set_gencb(loop->http, http_request_cb, loop->base);
+    return loop;
+}
+
+static void FreeHTTPEventLoops()
+{
+    BOOST_FOREACH (HTTPEventLoop* loop, eventLoops) {
+        evhttp_free(loop->http);
+        event_base_free(loop->base);
+        delete loop;
+    }
+    eventLoops.clear();
+}
+
 /** Simple wrapper to set thread name and run work queue */
 static void HTTPWorkQueueRun(WorkQueue<HTTPClosure>* queue)
 {
@@ -372,9 +467,6 @@ static void libevent_log_cb(int severity, const char *msg)
 
 bool InitHTTPServer()
 {
-    struct evhttp* http = 0;
-    struct event_base* base = 0;
-
     if (!InitHTTPAllowList())
         return false;
 
@@ -401,30 +493,32 @@ bool InitHTTPServer()
     evthread_use_pthreads();
 #endif
 
-    base = event_base_new(); // XXX RAII
-    if (!base) {
-        LogPrintf("Couldn't create an event_base: exiting\n");
+    HTTPEventLoop* first = NewHTTPEventLoop();
+    if (!first)
         return false;
-    }
-
-    /* Create a new evhttp object to handle requests. */
-    http = evhttp_new(base); // XXX RAII
-    if (!http) {
-        LogPrintf("couldn't create evhttp. Exiting.\n");
-        event_base_free(base);
+    eventLoops.push_back(first);
+    if (!HTTPBindAddresses(first->http, first->boundSockets)) {
+        LogPrintf("Unable to bind any endpoint for RPC server\n");
+        FreeHTTPEventLoops();
         return false;
     }
 
-    evhttp_set_timeout(http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
-    evhttp_set_max_headers_size(http, MAX_HEADERS_SIZE);
-    evhttp_set_max_body_size(http, MAX_SIZE);
-    evhttp_set_gencb(http, http_request_cb, NULL);
-
-    if (!HTTPBindAddresses(http)) {
-        LogPrintf("Unable to bind any endpoint for RPC server\n");
-        evhttp_free(http);
-        event_base_free(base);
-        return false;
+    // Parsing requests and writing out large replies is spread over more
+    // event loops, which take turns accepting connections.
+    int eventThreads = std::max((long)GetArg("-rpceventthreads", DEFAULT_HTTP_EVENT_THREADS), 1L);
+    for (int i = 1; i < eventThreads; i++) {
+        HTTPEventLoop* loop = NewHTTPEventLoop();
+        if (!loop)
+            break;
+        if (!HTTPShareAddresses(loop->http, first->boundSockets, loop->boundSockets)) {
+            BOOST_FOREACH (evhttp_bound_socket *socket, loop->boundSockets)
+                evhttp_del_accept_socket(loop->http, socket);
+            evhttp_free(loop->http);
+            event_base_free(loop->base);
+            delete loop;
+            break;
+        }
+        eventLoops.push_back(loop);
     }
 
     LogPrint("http", "Initialized HTTP server\n");
@@ -432,19 +526,16 @@ bool InitHTTPServer()
     LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
 
     workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
-    eventBase = base;
-    eventHTTP = http;
     return true;
 }
 
-boost::thread threadHTTP;
-
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
     int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
-    LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
-    threadHTTP = boost::thread(boost::bind(&ThreadHTTP, eventBase, eventHTTP));
+    LogPrintf("HTTP: starting %d event loop threads and %d worker threads\n", eventLoops.size(), rpcThreads);
+    BOOST_FOREACH (HTTPEventLoop* loop, eventLoops)
+        loop->thread = boost::thread(boost::bind(&ThreadHTTP, loop->base));
 
     for (int i = 0; i < rpcThreads; i++)
         boost::thread(boost::bind(&HTTPWorkQueueRun, workQueue));
@@ -454,13 +545,14 @@ bool StartHTTPServer()
 void InterruptHTTPServer()
 {
     LogPrint("http", "Interrupting HTTP server\n");
-    if (eventHTTP) {
+    BOOST_FOREACH (HTTPEventLoop* loop, eventLoops) {
         // Unlisten sockets
-        BOOST_FOREACH (evhttp_bound_socket *socket, boundSockets) {
-            evhttp_del_accept_socket(eventHTTP, socket);
+        BOOST_FOREACH (evhttp_bound_socket *socket, loop->boundSockets) {
+            evhttp_del_accept_socket(loop->http, socket);
         }
+        loop->boundSockets.clear();
         // Reject requests on current connections
-        evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
+        evhttp_set_gencb(loop->http, http_reject_request_cb, NULL);
     }
     if (workQueue)
         workQueue->Interrupt();
@@ -474,38 +566,36 @@ void StopHTTPServer()
         workQueue->WaitExit();
         delete workQueue;
     }
-    if (eventBase) {
-        LogPrint("http", "Waiting for HTTP event thread to exit\n");
+    if (!eventLoops.empty()) {
+        LogPrint("http", "Waiting for HTTP event threads to exit\n");
         // Give event loop a few seconds to exit (to send back last RPC responses), then break it
         // Before this was solved with event_base_loopexit, but that didn't work as expected in
         // at least libevent 2.0.21 and always introduced a delay. In libevent
         // master that appears to be solved, so in the future that solution
         // could be used again (if desirable).
         // (see discussion in https://github.com/bitcoin/bitcoin/pull/6990)
-#if BOOST_VERSION >= 105000
-        if (!threadHTTP.try_join_for(boost::chrono::milliseconds(2000))) {
-#else
-        if (!threadHTTP.timed_join(boost::posix_time::milliseconds(2000))) {
-#endif
-            LogPrintf("HTTP event loop did not exit within allotted time, sending loopbreak\n");
-            event_base_loopbreak(eventBase);
-            threadHTTP.join();
+        const boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(2000);
+        BOOST_FOREACH (HTTPEventLoop* loop, eventLoops) {
+            if (!loop->thread.timed_join(deadline)) {
+                LogPrintf("HTTP event loop did not exit within allotted time, sending loopbreak\n");
+                event_base_loopbreak(loop->base);
+                loop->thread.join();
+            }
         }
     }
-    if (eventHTTP) {
-        evhttp_free(eventHTTP);
-        eventHTTP = 0;
-    }
-    if (eventBase) {
-        event_base_free(eventBase);
-        eventBase = 0;
-    }
+    FreeHTTPEventLoops();
     LogPrint("http", "Stopped HTTP server\n");
 }
 
 struct event_base* EventBase()
 {
-    return eventBase;
+    return eventLoops.empty() ? NULL : eventLoops[0]->base;
+}
+
+bool EnqueueHTTPIdleWork(HTTPClosure* item)
+{
+    assert(workQueue);
+    return workQueue->EnqueueIfIdle(item);
 }
 
 static void httpevent_callback_fn(evutil_socket_t, short, void* data)
@@ -530,17 +620,22 @@ HTTPEvent::~HTTPEvent()
 void HTTPEvent::trigger(struct timeval* tv)
 {
     if (tv == NULL)
-        event_active(ev, 0, 0); // immediately trigger event in main thread
+        event_active(ev, 0, 0); // immediately trigger event in its event loop thread
     else
         evtimer_add(ev, tv); // trigger after timeval passed
 }
-HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
-                                                       replySent(false)
+HTTPRequest::HTTPRequest(struct evhttp_request* req, struct event_base* base) : req(req),
+                                                                              base(base),
+                                                                              replySent(false),
+                                                                              replyStarted(false)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (replyStarted && !replySent) {
+        LogPrintf("%s: Unfinished reply\n", __func__);
+        WriteReplyEnd();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -586,23 +681,171 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
     evhttp_add_header(headers, hdr.c_str(), value.c_str());
 }
 
-/** Closure sent to main thread to request a reply to be sent to
+/** Closure sent to the event loop thread to request a reply to be sent to
  * a HTTP request.
- * Replies must be sent in the main loop in the main http thread,
+ * Replies must be sent in the event loop of the connection,
  * this cannot be done from worker threads.
  */
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
     assert(!replySent && req);
-    // Send event to main http thread to send reply message
+    // Send event to the http thread of the connection to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
     evbuffer_add(evb, strReply.data(), strReply.size());
-    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+    HTTPEvent* ev = new HTTPEvent(base, true,
         boost::bind(evhttp_send_reply, req, nStatus, (const char*)NULL, (struct evbuffer *)NULL));
     ev->trigger(0);
     replySent = true;
-    req = 0; // transferred back to main thread
+    req = 0; // transferred back to the event loop thread
+}
+
+/** Progress of a chunked reply, shared between the worker thread producing
+ * it and the http thread sending it.
+ */
+struct HTTPReplyFlow
+{
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    //! Bytes of chunks handed to the http thread but not to the connection yet
+    size_t nQueued;
+    //! Bytes in the output buffer of the connection
+    size_t nOutput;
+    //! Set once the connection has failed; the rest of the reply is dropped
+    bool fFailed;
+
+    HTTPReplyFlow() : nQueued(0), nOutput(0), fFailed(false) {}
+
+    void Update(size_t nSent, size_t nOutputIn, bool fFailedIn)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            nQueued -= nSent;
+            nOutput = nOutputIn;
+            fFailed |= fFailedIn;
+        }
+        cond.notify_all();
+    }
+};
+
+static void http_send_reply_start(struct evhttp_request* req, int nStatus)
+{
+    // If the connection failed while the request was being handled, libevent
+    // detached req from it and leaves freeing it to evhttp_send_reply_end.
+    if (evhttp_request_get_connection(req))
+        evhttp_send_reply_start(req, nStatus, NULL);
+}
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02010500
+/** Called by libevent when the output buffer of a connection has been written out */
+static void http_reply_written_cb(struct evhttp_connection*, void* arg)
+{
+    ((HTTPReplyFlow*)arg)->Update(0, 0, false);
+}
+#endif
+
+static void http_send_reply_chunk(struct evhttp_request* req, struct evbuffer* evb, std::shared_ptr<HTTPReplyFlow> flow)
+{
+    size_t nSize = evbuffer_get_length(evb);
+    size_t nOutput = 0;
+    struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+    if (evcon) {
+#if LIBEVENT_VERSION_NUMBER >= 0x02010500
+        // The callback is replaced by the next chunk and by the end of the
+        // reply, so it never runs after flow has gone.
+        evhttp_send_reply_chunk_with_cb(req, evb, http_reply_written_cb, flow.get());
+        nOutput = evbuffer_get_length(bufferevent_get_output(evhttp_connection_get_bufferevent(evcon)));
+#else
+        evhttp_send_reply_chunk(req, evb);
+#endif
+    }
+    evbuffer_free(evb);
+    flow->Update(nSize, nOutput, evcon == NULL);
+}
+
+static void http_send_reply_end(struct evhttp_request* req, std::shared_ptr<HTTPReplyFlow> flow)
+{
+    // Keeps flow alive until here, as the callback of the last chunk may
+    // still refer to it.
+    evhttp_send_reply_end(req);
+}
+
+static void http_check_reply(struct evhttp_request* req, std::shared_ptr<HTTPReplyFlow> flow)
+{
+    if (!evhttp_request_get_connection(req))
+        flow->Update(0, 0, true);
+}
+
+void HTTPRequest::WriteReplyStart(int nStatus)
+{
+    assert(!replyStarted && !replySent && req);
+    HTTPEvent* ev = new HTTPEvent(base, true,
+        boost::bind(http_send_reply_start, req, nStatus));
+    ev->trigger(0);
+    replyStarted = true;
+    replyFlow = std::make_shared<HTTPReplyFlow>();
+}
+
+void HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(replyStarted && !replySent && req);
+    // An empty chunk would mark the end of the reply
+    if (strChunk.empty())
+        return;
+    {
+        // Wait for a slow client to catch up, rather than piling up the
+        // reply in memory. A client that stops reading altogether is
+        // eventually disconnected by the -rpcservertimeout.
+        boost::unique_lock<boost::mutex> lock(replyFlow->cs);
+        while (!replyFlow->fFailed && replyFlow->nQueued + replyFlow->nOutput > MAX_REPLY_PENDING_SIZE) {
+            if (!replyFlow->cond.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(1))) {
+                HTTPEvent* ev = new HTTPEvent(base, true,
+                    boost::bind(http_check_reply, req, replyFlow));
+                ev->trigger(0);
+            }
+        }
+        if (replyFlow->fFailed)
+            return;
+        replyFlow->nQueued += strChunk.size();
+    }
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    // Events are handled in the order they were triggered, so chunks go out
+    // in order.
+    HTTPEvent* ev = new HTTPEvent(base, true,
+        boost::bind(http_send_reply_chunk, req, evb, replyFlow));
+    ev->trigger(0);
+}
+
+void HTTPRequest::WriteReplyPart(const std::string& strContentType, const std::string& strPart)
+{
+    if (!replyStarted) {
+        WriteHeader("Content-Type", strContentType);
+        WriteReplyStart(HTTP_OK);
+    }
+    WriteReplyChunk(strPart);
+}
+
+void HTTPRequest::WriteReplyLast(const std::string& strContentType, const std::string& strPart)
+{
+    if (!replyStarted) {
+        WriteHeader("Content-Type", strContentType);
+        WriteReply(HTTP_OK, strPart);
+        return;
+    }
+    WriteReplyChunk(strPart);
+    WriteReplyEnd();
+}
+
+void HTTPRequest::WriteReplyEnd()
+{
+    assert(replyStarted && !replySent && req);
+    HTTPEvent* ev = new HTTPEvent(base, true,
+        boost::bind(http_send_reply_end, req, replyFlow));
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to the event loop thread
 }
 
 CService HTTPRequest::GetPeer()
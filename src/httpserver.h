@@ -5,6 +5,7 @@
 #ifndef BITCOIN_HTTPSERVER_H
 #define BITCOIN_HTTPSERVER_H
 
+#include <memory>
 #include <string>
 #include <stdint.h>
 #include <boost/thread.hpp>
@@ -14,11 +15,14 @@
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+static const int DEFAULT_HTTP_EVENT_THREADS=2;
 
 struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+class HTTPClosure;
+struct HTTPReplyFlow;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -44,11 +48,17 @@ void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPR
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
-/** Return evhttp event base. This can be used by submodules to
+/** Return the event base of the first HTTP event loop. This can be used by submodules to
  * queue timers or custom events.
  */
 struct event_base* EventBase();
 
+/** Run item on an HTTP worker thread that is idle at the moment, to share
+ * out the work of a request. Returns true if the work queue took ownership
+ * of item, false if all worker threads are busy.
+ */
+bool EnqueueHTTPIdleWork(HTTPClosure* item);
+
 /** In-flight HTTP request.
  * Thin C++ wrapper around evhttp_request.
  */
@@ -56,10 +66,14 @@ class HTTPRequest
 {
 private:
     struct evhttp_request* req;
+    //! Event loop of the connection, where replies are sent from
+    struct event_base* base;
     bool replySent;
+    bool replyStarted;
+    std::shared_ptr<HTTPReplyFlow> replyFlow;
 
 public:
-    HTTPRequest(struct evhttp_request* req);
+    HTTPRequest(struct evhttp_request* req, struct event_base* base);
     ~HTTPRequest();
 
     enum RequestMethod {
@@ -112,6 +126,46 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start an HTTP reply whose body is sent in parts as it is produced,
+     * using chunked transfer encoding if the client supports it.
+     * nStatus is the HTTP status code to send.
+     *
+     * @note Call this instead of WriteReply, then WriteReplyChunk for every
+     * part of the body and WriteReplyEnd at the end.
+     */
+    void WriteReplyStart(int nStatus);
+
+    /**
+     * Send the next part of a reply started with WriteReplyStart. If the
+     * client is far behind in reading the reply, wait for it to catch up.
+     */
+    void WriteReplyChunk(const std::string& strChunk);
+
+    /**
+     * Finish a reply started with WriteReplyStart.
+     *
+     * @note As with WriteReply, do not call any other HTTPRequest methods
+     * after calling this.
+     */
+    void WriteReplyEnd();
+
+    /** Whether WriteReplyStart has been called */
+    bool IsReplyStarted() const { return replyStarted; }
+
+    /**
+     * Send the next part of a reply body with status HTTP_OK that is
+     * produced piece by piece, such as by a CJSONStreamWriter, starting a
+     * reply with the given content type at the first part.
+     */
+    void WriteReplyPart(const std::string& strContentType, const std::string& strPart);
+
+    /**
+     * Finish a reply produced with WriteReplyPart with its last part. A
+     * reply with no other parts is sent in one go with WriteReply.
+     */
+    void WriteReplyLast(const std::string& strContentType, const std::string& strPart);
 };
 
 /** Event handler closure.
@@ -11,18 +11,21 @@
 
 #include "addrman.h"
 #include "amount.h"
+#include "amountverifier.h"
 #include "callrpc.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
 #include "httpserver.h"
 #include "httprpc.h"
 #include "key.h"
 #include "main.h"
 #include "miner.h"
 #include "net.h"
+#include "parentheaders.h"
 #include "policy/policy.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
@@ -48,6 +51,7 @@
 #endif
 
 #include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/split.hpp>
@@ -60,19 +64,25 @@
 
 #if ENABLE_ZMQ
 #include "zmq/zmqnotificationinterface.h"
+#include "zmq/zmqparentchainlistener.h"
+#include "zmq/zmqverifiedtxlistener.h"
 #endif
 
 using namespace std;
 
 bool fFeeEstimatesInitialized = false;
+static bool fDumpMempoolLater = false;
 static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
+static const bool DEFAULT_METRICS_ENABLE = false;
 static const bool DEFAULT_DISABLE_SAFEMODE = false;
 static const bool DEFAULT_STOPAFTERBLOCKIMPORT = false;
 
 
 #if ENABLE_ZMQ
 static CZMQNotificationInterface* pzmqNotificationInterface = NULL;
+static CZMQParentChainListener* pzmqParentChainListener = NULL;
+static CZMQVerifiedTxListener* pzmqVerifiedTxListener = NULL;
 #endif
 
 #ifdef WIN32
@@ -160,7 +170,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -191,8 +200,10 @@ void Shutdown()
 
     StopHTTPRPC();
     StopREST();
+    StopMetrics();
     StopRPC();
     StopHTTPServer();
+    StopValidationQueue();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(false);
@@ -201,6 +212,9 @@ void Shutdown()
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
 
+    if (fDumpMempoolLater)
+        DumpMempool();
+
     if (fFeeEstimatesInitialized)
     {
         boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
@@ -216,16 +230,29 @@ void Shutdown()
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
             FlushStateToDisk();
+            WriteBlockIndexSnapshot();
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
+        delete pcoinsPrefetch;
+        pcoinsPrefetch = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
-    }
+        delete ptxindexdb;
+        ptxindexdb = NULL;
+        delete pblockfilterdb;
+        pblockfilterdb = NULL;
+        delete pblockstatsdb;
+        pblockstatsdb = NULL;
+        delete pscriptindexdb;
+        pscriptindexdb = NULL;
+    }
+    StopBlockFileWriter();
+    StopAmountVerifier();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(true);
@@ -237,7 +264,13 @@ void Shutdown()
         delete pzmqNotificationInterface;
         pzmqNotificationInterface = NULL;
     }
+    delete pzmqParentChainListener;
+    pzmqParentChainListener = NULL;
+    delete pzmqVerifiedTxListener;
+    pzmqVerifiedTxListener = NULL;
 #endif
+    delete pparentheaders;
+    pparentheaders = NULL;
 
 #ifndef WIN32
     try {
@@ -254,6 +287,7 @@ void Shutdown()
     globalVerifyHandle.reset();
     ECC_Stop();
     LogPrintf("%s: done\n", __func__);
+    StopLogWriter();
 }
 
 /**
@@ -309,6 +343,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-amountverifier=<name>", strprintf(_("Verify range proofs with this backend, one of: %s. Falls back to the script verification threads when it is not available (default: %s)"), boost::algorithm::join(GetAmountVerifierNames(), ", "), DEFAULT_AMOUNT_VERIFIER));
+    strUsage += HelpMessageOpt("-amountverifierthreads=<n>", _("Number of threads the threads amount verifier uses (0 = one per core, default: 0)"));
+    strUsage += HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and skip their script, range proof and peg-in confirmation checks (0 to verify all, default: %s)"), defaultChainParams->GetConsensus().defaultAssumeValid.GetHex()));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Keep a compact filter of the scripts and outpoints of each connected block, used to skip blocks during wallet rescans (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
+    strUsage += HelpMessageOpt("-blockstatsindex", strprintf(_("Keep statistics of each connected block, used by the getblockstats rpc call (default: %u)"), DEFAULT_BLOCKSTATSINDEX));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
@@ -323,22 +362,33 @@ std::string HelpMessage(HelpMessageMode mode)
     }
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dbbloombits=<n>", strprintf(_("Bits per key of the Bloom filters that let chainstate and block index lookups of missing entries skip disk reads (0 to %d, 0 = off, default: %d)"), MAX_DB_BLOOM_BITS, DEFAULT_DB_BLOOM_BITS));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-dbcompactionrate=<n>", strprintf("During initial block download, limit the compactions of the chainstate below its first level to <n> MiB/s while writes are not waiting for them (0 = no limit, default: %u)", DEFAULT_DB_COMPACTION_RATE));
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxorphantxsize=<n>", strprintf(_("Keep unconnectable transactions in memory below <n> kilobytes (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS_SIZE));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
+    strUsage += HelpMessageOpt("-parentheaders", strprintf(_("With -validatepegin, keep the parent chain's block headers, fetched from the parent daemon, and look up the depth of peg-in blocks in them (default: %u)"), DEFAULT_PARENT_HEADERS));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
     strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode is incompatible with -txindex and -rescan. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+    strUsage += HelpMessageOpt("-prunerangeproofs=<n>", strprintf(_("Reduce storage requirements by removing the rangeproofs of old blocks, keeping their transactions and commitments. "
+            "Such blocks are not served to peers. This mode is incompatible with -prune, -txindex and -rescan. "
+            "Warning: Reverting this setting requires re-downloading the entire blockchain. "
+            "(default: 0 = disable, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
+    strUsage += HelpMessageOpt("-scriptindex", strprintf(_("Maintain an index of the outputs to and spends from each script, used by the getscripthistory rpc call (default: %u)"), DEFAULT_SCRIPTINDEX));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
@@ -357,14 +407,17 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-forcednsseed", strprintf(_("Always query for peer addresses via DNS lookup (default: %u)"), DEFAULT_FORCEDNSSEED));
     strUsage += HelpMessageOpt("-listen", _("Accept connections from outside (default: 1 if no -proxy or -connect)"));
     strUsage += HelpMessageOpt("-listenonion", strprintf(_("Automatically create Tor hidden service (default: %d)"), DEFAULT_LISTEN_ONION));
+    strUsage += HelpMessageOpt("-lowlatencyfetch", strprintf(_("Fetch new blocks for the lowest latency at some cost in bandwidth, as block signers need: request a late block from another peer too, and have the peers that deliver blocks first announce them as compact blocks (default: %u)"), DEFAULT_LOW_LATENCY_FETCH));
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Set the number of threads processing peer messages (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
+    strUsage += HelpMessageOpt("-peertxbudget=<n>", strprintf(_("Postpone the transactions of a peer whose transactions took more than <n> milliseconds per second to validate on average, 0 for no limit (default: %u)"), DEFAULT_PEER_TX_BUDGET));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u)"), defaultChainParams->GetDefaultPort()));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
@@ -372,6 +425,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
+    strUsage += HelpMessageOpt("-txreconciliation", strprintf(_("Announce transactions by set reconciliation to peers that support it, rather than by inv (default: %u)"), DEFAULT_TXRECONCILIATION));
 #ifdef USE_UPNP
 #if USE_UPNP
     strUsage += HelpMessageOpt("-upnp", _("Use UPnP to map the listening port (default: 1 when listening and no -proxy)"));
@@ -394,8 +448,17 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("ZeroMQ notification options:"));
     strUsage += HelpMessageOpt("-zmqpubhashblock=<address>", _("Enable publish hash block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubmempooldelta=<address>", _("Enable publish transactions added to and removed from the mempool in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubunblindedoutput=<address>", _("Enable publish the outputs of transactions that unblind with a -zmqblindingkey in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubverifiedtx=<address>", _("Enable publish the signed witness hashes of transactions accepted to the mempool in <address>, for nodes with -zmqsubverifiedtx to skip verifying their range proofs"));
+    strUsage += HelpMessageOpt("-zmqblindingkey=<hex>", _("Private blinding key to unblind outputs with for -zmqpubunblindedoutput (can be specified multiple times)"));
+    strUsage += HelpMessageOpt("-zmqverifiedtxkey=<hex>", _("Private key to sign -zmqpubverifiedtx notifications with"));
+    strUsage += HelpMessageOpt("-zmqsubverifiedtx=<address>", _("Take the range proofs of transactions that a -zmqverifiedtxsigner published as verified at <address> as valid (can be specified multiple times)"));
+    strUsage += HelpMessageOpt("-zmqverifiedtxsigner=<hex>", _("Public key trusted to sign -zmqsubverifiedtx notifications (can be specified multiple times)"));
+    strUsage += HelpMessageOpt("-zmqverifiedtxinblocks", strprintf(_("Also take range proofs trusted through -zmqsubverifiedtx as valid when validating blocks (default: %u)"), DEFAULT_ZMQ_VERIFIEDTX_IN_BLOCKS));
+    strUsage += HelpMessageOpt("-mainchainzmqhashblock=<address>", _("With -validatepegin, follow the parent chain tip through the hashblock notifications the parent daemon publishes at <address>"));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
@@ -409,6 +472,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", DEFAULT_TESTSAFEMODE));
         strUsage += HelpMessageOpt("-dropmessagestest=<n>", "Randomly drop 1 of every <n> network messages");
         strUsage += HelpMessageOpt("-fuzzmessagestest=<n>", "Randomly fuzz 1 of every <n> network messages");
+        strUsage += HelpMessageOpt("-schedulerthreads=<n>", strprintf("Set the number of threads that run background tasks (default: %d)", DEFAULT_SCHEDULER_THREADS));
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", DEFAULT_STOPAFTERBLOCKIMPORT));
         strUsage += HelpMessageOpt("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT));
         strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
@@ -428,11 +492,14 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), DEFAULT_LOGTIMESTAMPS));
     if (showDebug)
     {
+        strUsage += HelpMessageOpt("-logasync", strprintf("Write debug output from a background thread, dropping the messages of a thread that has more than %u waiting (default: %u)", LOG_BUFFER_MESSAGES, DEFAULT_LOGASYNC));
         strUsage += HelpMessageOpt("-logtimemicros", strprintf("Add microsecond precision to debug timestamps (default: %u)", DEFAULT_LOGTIMEMICROS));
+        strUsage += HelpMessageOpt("-lockprofile", strprintf("Record wait and hold times per lock site from startup, see getlockprofile (default: %u)", DEFAULT_LOCKPROFILE));
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-rangeproofcachesize=<n>", strprintf("Limit size of range proof cache to <n> MiB (default: %u)", DEFAULT_MAX_RANGEPROOF_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
@@ -466,6 +533,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), DEFAULT_REST_ENABLE));
+    strUsage += HelpMessageOpt("-metrics", strprintf(_("Serve validation latency histograms to Prometheus at /metrics on the RPC port (default: %u)"), DEFAULT_METRICS_ENABLE));
     strUsage += HelpMessageOpt("-rpcbind=<addr>", _("Bind to given address to listen for JSON-RPC connections. Use [host]:port notation for IPv6. This option can be specified multiple times (default: bind to all interfaces)"));
     strUsage += HelpMessageOpt("-rpccookiefile=<loc>", _("Location of the auth cookie (default: data dir)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
@@ -474,7 +542,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u)"), defaultBaseParams->RPCPort()));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpcjobthreads=<n>", strprintf(_("Set the number of threads to run RPC calls submitted with submitjob (default: %d)"), DEFAULT_RPC_JOB_THREADS));
+    strUsage += HelpMessageOpt("-rpcslowcall=<n>", strprintf(_("Log RPC calls that take at least <n> milliseconds, 0 to log none (default: %d)"), DEFAULT_RPC_SLOW_CALL));
     if (showDebug) {
+        strUsage += HelpMessageOpt("-rpceventthreads=<n>", strprintf("Set the number of threads that accept RPC connections and send replies (default: %d)", DEFAULT_HTTP_EVENT_THREADS));
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
@@ -590,64 +661,61 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
 {
     const CChainParams& chainparams = Params();
     RenameThread("bitcoin-loadblk");
-    CImportingNow imp;
-
-    // -reindex
-    if (fReindex) {
-        int nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
-            nFile++;
+
+    {
+        CImportingNow imp;
+
+        // -reindex
+        if (fReindex) {
+            ReindexBlockFiles(chainparams);
+            pblocktree->WriteReindexing(false);
+            fReindex = false;
+            LogPrintf("Reindexing finished\n");
+            // To avoid ending up in a situation without genesis block, re-try initializing (no-op if reindexing worked):
+            InitBlockIndex(chainparams);
         }
-        pblocktree->WriteReindexing(false);
-        fReindex = false;
-        LogPrintf("Reindexing finished\n");
-        // To avoid ending up in a situation without genesis block, re-try initializing (no-op if reindexing worked):
-        InitBlockIndex(chainparams);
-    }
-
-    // hardcoded $DATADIR/bootstrap.dat
-    boost::filesystem::path pathBootstrap = GetDataDir() / "bootstrap.dat";
-    if (boost::filesystem::exists(pathBootstrap)) {
-        FILE *file = fopen(pathBootstrap.string().c_str(), "rb");
-        if (file) {
-            boost::filesystem::path pathBootstrapOld = GetDataDir() / "bootstrap.dat.old";
-            LogPrintf("Importing bootstrap.dat...\n");
-            LoadExternalBlockFile(chainparams, file);
-            RenameOver(pathBootstrap, pathBootstrapOld);
-        } else {
-            LogPrintf("Warning: Could not open bootstrap file %s\n", pathBootstrap.string());
+
+        // hardcoded $DATADIR/bootstrap.dat
+        boost::filesystem::path pathBootstrap = GetDataDir() / "bootstrap.dat";
+        if (boost::filesystem::exists(pathBootstrap)) {
+            FILE *file = fopen(pathBootstrap.string().c_str(), "rb");
+            if (file) {
+                boost::filesystem::path pathBootstrapOld = GetDataDir() / "bootstrap.dat.old";
+                LogPrintf("Importing bootstrap.dat...\n");
+                LoadExternalBlockFile(chainparams, file);
+                RenameOver(pathBootstrap, pathBootstrapOld);
+            } else {
+                LogPrintf("Warning: Could not open bootstrap file %s\n", pathBootstrap.string());
+            }
         }
-    }
 
-    // -loadblock=
-    BOOST_FOREACH(const boost::filesystem::path& path, vImportFiles) {
-        FILE *file = fopen(path.string().c_str(), "rb");
-        if (file) {
-            LogPrintf("Importing blocks file %s...\n", path.string());
-            LoadExternalBlockFile(chainparams, file);
-        } else {
-            LogPrintf("Warning: Could not open blocks file %s\n", path.string());
+        // -loadblock=
+        BOOST_FOREACH(const boost::filesystem::path& path, vImportFiles) {
+            FILE *file = fopen(path.string().c_str(), "rb");
+            if (file) {
+                LogPrintf("Importing blocks file %s...\n", path.string());
+                LoadExternalBlockFile(chainparams, file);
+            } else {
+                LogPrintf("Warning: Could not open blocks file %s\n", path.string());
+            }
         }
-    }
 
-    // scan for better chains in the block chain database, that are not yet connected in the active best chain
-    CValidationState state;
-    if (!ActivateBestChain(state, chainparams)) {
-        LogPrintf("Failed to connect best block");
-        StartShutdown();
-    }
+        // scan for better chains in the block chain database, that are not yet connected in the active best chain
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            LogPrintf("Failed to connect best block");
+            StartShutdown();
+        }
+
+        if (GetBoolArg("-stopafterblockimport", DEFAULT_STOPAFTERBLOCKIMPORT)) {
+            LogPrintf("Stopping after block import\n");
+            StartShutdown();
+        }
+    } // End scope of CImportingNow
 
-    if (GetBoolArg("-stopafterblockimport", DEFAULT_STOPAFTERBLOCKIMPORT)) {
-        LogPrintf("Stopping after block import\n");
-        StartShutdown();
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool();
+        fDumpMempoolLater = !ShutdownRequested();
     }
 }
 
@@ -679,6 +747,8 @@ bool AppInitServers(boost::thread_group& threadGroup)
         return false;
     if (GetBoolArg("-rest", DEFAULT_REST_ENABLE) && !StartREST())
         return false;
+    if (GetBoolArg("-metrics", DEFAULT_METRICS_ENABLE) && !StartMetrics())
+        return false;
     if (!StartHTTPServer())
         return false;
     return true;
@@ -775,6 +845,7 @@ void InitLogging()
     fLogTimestamps = GetBoolArg("-logtimestamps", DEFAULT_LOGTIMESTAMPS);
     fLogTimeMicros = GetBoolArg("-logtimemicros", DEFAULT_LOGTIMEMICROS);
     fLogIPs = GetBoolArg("-logips", DEFAULT_LOGIPS);
+    fProfileLocks = GetBoolArg("-lockprofile", DEFAULT_LOCKPROFILE);
 
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("Bitcoin version %s\n", FormatFullVersion());
@@ -857,13 +928,28 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #endif
     }
 
+    if (GetArg("-prunerangeproofs", 0)) {
+        if (GetArg("-prune", 0))
+            return InitError(_("-prunerangeproofs is incompatible with -prune."));
+        if (GetBoolArg("-txindex", DEFAULT_TXINDEX))
+            return InitError(_("-prunerangeproofs is incompatible with -txindex."));
+#ifdef ENABLE_WALLET
+        if (GetBoolArg("-rescan", false)) {
+            return InitError(_("Rescans are not possible once rangeproofs are pruned. You will need to use -reindex which will download the whole blockchain again."));
+        }
+#endif
+    }
+
     // Make sure enough file descriptors are available
-    int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     int nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
     // Trim requested connection counts, to fit into system limitations
+#ifdef WIN32
+    // Only Windows still waits for sockets with select()
+    int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+#endif
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -907,6 +993,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
+    hashAssumeValid = uint256S(GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
+    if (!hashAssumeValid.IsNull())
+        LogPrintf("Assuming ancestors of block %s have valid signatures and range proofs.\n", hashAssumeValid.GetHex());
+    else
+        LogPrintf("Validating signatures and range proofs for all blocks.\n");
+
     // mempool limits
     int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     int64_t nMempoolSizeMin = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000 * 40;
@@ -922,6 +1014,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    nMessageHandlerThreads = std::max(1, std::min((int)GetArg("-msghandlerthreads", DEFAULT_MESSAGE_HANDLER_THREADS), MAX_MESSAGE_HANDLER_THREADS));
+
     fServer = GetBoolArg("-server", false);
 
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
@@ -938,6 +1032,20 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         fPruneMode = true;
     }
 
+    // rangeproof pruning; get the amount of disk space (in MiB) to allot for block & undo files
+    int64_t nSignedRangeproofPruneTarget = GetArg("-prunerangeproofs", 0) * 1024 * 1024;
+    if (nSignedRangeproofPruneTarget < 0) {
+        return InitError(_("Rangeproof pruning cannot be configured with a negative value."));
+    }
+    nRangeproofPruneTarget = (uint64_t) nSignedRangeproofPruneTarget;
+    if (nRangeproofPruneTarget) {
+        if (nRangeproofPruneTarget < MIN_DISK_SPACE_FOR_BLOCK_FILES) {
+            return InitError(strprintf(_("Rangeproof pruning configured below the minimum of %d MiB.  Please use a higher number."), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+        }
+        LogPrintf("Rangeproof pruning configured to target %uMiB on disk for block and undo files.\n", nRangeproofPruneTarget / 1024 / 1024);
+        fRangeproofPruneMode = true;
+    }
+
     RegisterAllCoreRPCCommands(tableRPC);
 #ifdef ENABLE_WALLET
     bool fDisableWallet = GetBoolArg("-disablewallet", false);
@@ -983,6 +1091,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     if (GetBoolArg("-peerbloomfilters", false))
         nLocalServices = ServiceFlags(nLocalServices | NODE_BLOOM);
+    if (GetBoolArg("-txreconciliation", DEFAULT_TXRECONCILIATION))
+        nLocalServices = ServiceFlags(nLocalServices | NODE_TXRECON);
 
     nMaxTipAge = GetArg("-maxtipage", DEFAULT_MAX_TIP_AGE);
 
@@ -1032,6 +1142,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
+    // Pick the fastest SHA256 implementation the CPU supports
+    std::string sha256_algo = SHA256AutoDetect();
+
     // Initialize elliptic curve code
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1067,23 +1180,60 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (fPrintToAuditLog)
         OpenAuditLog();
 
+    if (GetBoolArg("-logasync", DEFAULT_LOGASYNC))
+        StartLogWriter();
+
     if (!fLogTimestamps)
         LogPrintf("Startup time: %s\n", DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()));
     LogPrintf("Default data directory %s\n", GetDefaultDataDir().string());
     LogPrintf("Using data directory %s\n", strDataDir);
     LogPrintf("Using config file %s\n", GetConfigFile().string());
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
+    InitSignatureCache();
+    InitTxValidationCache();
+
+    const std::string strAmountVerifier = GetArg("-amountverifier", DEFAULT_AMOUNT_VERIFIER);
+    bool fAmountVerifierFallback;
+    if (!StartAmountVerifier(strAmountVerifier, GetArg("-amountverifierthreads", 0), fAmountVerifierFallback))
+        return InitError(strprintf(_("Unknown -amountverifier: '%s'"), strAmountVerifier));
+    if (fAmountVerifierFallback)
+        InitWarning(strprintf(_("The %s amount verifier is not available, verifying range proofs on the script verification threads."), strAmountVerifier));
+    else
+        LogPrintf("Using the %s amount verifier\n", strAmountVerifier);
+
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for processing peer messages\n", nMessageHandlerThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadMempoolCheck);
     }
 
-    // Start the lightweight task scheduler thread
+    if (GetBoolArg("-validatepegin", false))
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "peginprefetch", &ThreadPeginPrefetch));
+
+    if (GetBoolArg("-validatepegin", false) && GetBoolArg("-parentheaders", DEFAULT_PARENT_HEADERS)) {
+        pparentheaders = new CParentHeaderStore();
+        if (!pparentheaders->Open(GetDataDir() / "parentheaders.dat", Params().ParentGenesisBlockHash()))
+            return InitError(_("Unable to open the parent header store"));
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "parentheaders", boost::function<void()>(boost::bind(&ThreadParentHeaderSync, Params().ParentGenesisBlockHash()))));
+    }
+
+    // Start delivering validation callbacks to the wallet and ZMQ in the background
+    StartValidationQueue();
+
+    // Write blocks and undo data behind validation
+    StartBlockFileWriter();
+
+    // Start the lightweight task scheduler threads
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    int nSchedulerThreads = std::max((int)GetArg("-schedulerthreads", DEFAULT_SCHEDULER_THREADS), 1);
+    for (int i = 0; i < nSchedulerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1186,6 +1336,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fDiscover = GetBoolArg("-discover", true);
     fNameLookup = GetBoolArg("-dns", DEFAULT_NAME_LOOKUP);
     fRelayTxes = !GetBoolArg("-blocksonly", DEFAULT_BLOCKSONLY);
+    fLowLatencyFetch = GetBoolArg("-lowlatencyfetch", DEFAULT_LOW_LATENCY_FETCH);
+    nPeerTxBudget = std::max(GetArg("-peertxbudget", DEFAULT_PEER_TX_BUDGET), (int64_t)0);
 
     bool fBound = false;
     if (fListen) {
@@ -1232,7 +1384,32 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     pzmqNotificationInterface = CZMQNotificationInterface::CreateWithArguments(mapArgs);
 
     if (pzmqNotificationInterface) {
-        RegisterValidationInterface(pzmqNotificationInterface);
+        RegisterValidationInterface(pzmqNotificationInterface, true);
+    }
+
+    if (GetBoolArg("-validatepegin", false) && mapArgs.count("-mainchainzmqhashblock")) {
+        pzmqParentChainListener = CZMQParentChainListener::Create(mapArgs["-mainchainzmqhashblock"], Params().ParentGenesisBlockHash());
+        if (!pzmqParentChainListener)
+            return InitError(_("Unable to subscribe to the parent chain hashblock notifications given by -mainchainzmqhashblock"));
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "zmqparent", boost::function<void()>(boost::bind(&CZMQParentChainListener::Thread, pzmqParentChainListener))));
+    }
+
+    if (mapArgs.count("-zmqsubverifiedtx")) {
+        std::vector<CPubKey> vSigners;
+        BOOST_FOREACH(const std::string& strSigner, mapMultiArgs["-zmqverifiedtxsigner"]) {
+            std::vector<unsigned char> vchSigner = ParseHex(strSigner);
+            CPubKey signer(vchSigner.begin(), vchSigner.end());
+            if (!signer.IsFullyValid())
+                return InitError(strprintf(_("Invalid -zmqverifiedtxsigner: '%s'"), strSigner));
+            vSigners.push_back(signer);
+        }
+        if (vSigners.empty())
+            return InitError(_("-zmqsubverifiedtx needs at least one -zmqverifiedtxsigner"));
+        InitFleetVerifiedCache(GetBoolArg("-zmqverifiedtxinblocks", DEFAULT_ZMQ_VERIFIEDTX_IN_BLOCKS));
+        pzmqVerifiedTxListener = CZMQVerifiedTxListener::Create(mapMultiArgs["-zmqsubverifiedtx"], vSigners);
+        if (!pzmqVerifiedTxListener)
+            return InitError(_("Unable to subscribe to the verified transactions given by -zmqsubverifiedtx"));
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "zmqverifiedtx", boost::function<void()>(boost::bind(&CZMQVerifiedTxListener::Thread, pzmqVerifiedTxListener))));
     }
 #endif
     if (mapArgs.count("-maxuploadtarget")) {
@@ -1278,14 +1455,26 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nBlockTreeDBCache = nTotalCache / 8;
     nBlockTreeDBCache = std::min(nBlockTreeDBCache, (GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
     nTotalCache -= nBlockTreeDBCache;
+    // The transaction index has its own database, which gets all but what
+    // the block index needs.
+    int64_t nTxIndexDBCache = 0;
+    if (GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+        nTxIndexDBCache = std::max(nBlockTreeDBCache - (nMaxBlockDBCache << 20), nBlockTreeDBCache / 2);
+        nBlockTreeDBCache -= nTxIndexDBCache;
+    }
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    if (nTxIndexDBCache > 0)
+        LogPrintf("* Using %.1fMiB for transaction index database\n", nTxIndexDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
+    int nDBBloomBits = std::max(0, std::min((int)GetArg("-dbbloombits", DEFAULT_DB_BLOOM_BITS), MAX_DB_BLOOM_BITS));
+    LogPrintf("* Using %d Bloom filter bits per database key\n", nDBBloomBits);
+    nDBCompactionRate = std::max(GetArg("-dbcompactionrate", DEFAULT_DB_COMPACTION_RATE), (int64_t)0) << 20;
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1299,15 +1488,68 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
-                delete pcoinsdbview;
                 delete pcoinscatcher;
+                delete pcoinsPrefetch;
+                delete pcoinsdbview;
                 delete pblocktree;
+                delete ptxindexdb;
+                ptxindexdb = NULL;
+                delete pblockfilterdb;
+                pblockfilterdb = NULL;
+                delete pblockstatsdb;
+                pblockstatsdb = NULL;
+                delete pscriptindexdb;
+                pscriptindexdb = NULL;
+
+                if (fReindex || fReindexChainState) {
+                    // Blocks without their rangeproofs cannot be validated again,
+                    // so refuse before anything is wiped.
+                    CBlockTreeDB oldtree(nBlockTreeDBCache, false, false);
+                    bool fOldPrunedRangeproofs = false;
+                    oldtree.ReadFlag("prunedrangeproofs", fOldPrunedRangeproofs);
+                    if (fOldPrunedRangeproofs)
+                        return InitError(_("Rangeproofs have been pruned, so the chain state cannot be rebuilt from the block files. Delete the blocks and chainstate directories to download the whole blockchain again."));
+                }
 
-                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
-                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
-                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                std::vector<uint256> vParentBlocks;
+                if (fReindex && GetBoolArg("-validatepegin", false)) {
+                    // Reindexing does not change the parent chain, so carry
+                    // its confirmed blocks over the wipe of the block index.
+                    CBlockTreeDB oldtree(nBlockTreeDBCache, false, false);
+                    oldtree.ReadConfirmedParentBlocks(vParentBlocks);
+                }
+
+                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex, nDBBloomBits);
+                if (GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+                    ptxindexdb = new CTxIndexDB(nTxIndexDBCache, false, fReindex, nDBBloomBits);
+                    if (!ptxindexdb->Upgrade(*pblocktree)) {
+                        strLoadError = _("Error upgrading transaction index database");
+                        break;
+                    }
+                }
+                if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+                    pblockfilterdb = new CBlockFilterDB(nMaxBlockDBCache << 20, false, fReindex);
+                if (GetBoolArg("-blockstatsindex", DEFAULT_BLOCKSTATSINDEX))
+                    pblockstatsdb = new CBlockStatsDB(nMaxBlockDBCache << 20, false, fReindex);
+                if (GetBoolArg("-scriptindex", DEFAULT_SCRIPTINDEX))
+                    pscriptindexdb = new CScriptIndexDB(nMaxBlockDBCache << 20, false, fReindex || fReindexChainState);
+                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState, nDBBloomBits);
+                pcoinsPrefetch = new CCoinsViewPrefetch(pcoinsdbview, nCoinCacheUsage / 8);
+                pcoinsPrefetch->Start(std::max(nScriptCheckThreads, 1));
+                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsPrefetch);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
+                if (GetBoolArg("-validatepegin", false)) {
+                    if (!fReindex)
+                        pblocktree->ReadConfirmedParentBlocks(vParentBlocks);
+                    LoadConfirmedParentBlocks(vParentBlocks);
+                }
+
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
                     //If we're reindexing in prune mode, wipe away unusable block files and all undo data files
@@ -1337,6 +1579,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // Check for changed -scriptindex state
+                if (fScriptIndex != GetBoolArg("-scriptindex", DEFAULT_SCRIPTINDEX)) {
+                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -scriptindex");
+                    break;
+                }
+
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
                 if (fHavePruned && !fPruneMode) {
@@ -1344,6 +1592,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                if (fHavePrunedRangeproofs && !fRangeproofPruneMode) {
+                    strLoadError = _("Rangeproofs have been pruned. Delete the blocks and chainstate directories to go back to keeping them.  This will redownload the entire blockchain");
+                    break;
+                }
+
                 if (!fReindex && chainActive.Tip() != NULL) {
                     uiInterface.InitMessage(_("Rewinding blocks..."));
                     if (!RewindBlockIndex(chainparams)) {
@@ -1448,6 +1701,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         }
     }
 
+    // Blocks without their rangeproofs are not served, so unset the service bit as well.
+    if (fRangeproofPruneMode) {
+        LogPrintf("Unsetting NODE_NETWORK on rangeproof prune mode\n");
+        nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+        if (!fReindex) {
+            uiInterface.InitMessage(_("Pruning blockstore..."));
+            PruneAndFlush();
+        }
+    }
+
     if (Params().GetConsensus().vDeployments[Consensus::DEPLOYMENT_SEGWIT].nTimeout != 0) {
         // Only advertize witness capabilities if they have a reasonable start time.
         // This allows us to have the code merged without a defined softfork, by setting its
@@ -1497,7 +1760,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     CBlockIndex *genesis = chainActive.Genesis();
     const CBlock &genesisBlock = Params().GenesisBlock();
     for (unsigned int i = 0; i<genesis->nTx ; i++) {
-        SyncWithWallets(genesisBlock.vtx[i], genesis, &genesisBlock);
+        SyncWithWallets(*genesisBlock.vtx[i], genesis, &genesisBlock);
     }
 
     // ********************************************************* Step 11: start node
@@ -1524,7 +1787,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     SetRPCWarmupFinished();
 
     CScheduler::Function f2 = boost::bind(&BitcoindRPCCheck, false);
-    scheduler.scheduleEvery(f2, 120);
+    scheduler.scheduleEvery(f2, 120, CScheduler::PRIORITY_LOW, "bitcoindrpccheck");
 
     uiInterface.InitMessage(_("Awaiting bitcoind RPC warmup"));
 
@@ -1541,6 +1804,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
         // Run a thread to flush wallet periodically
         threadGroup.create_thread(boost::bind(&ThreadFlushWalletDB, boost::ref(pwalletMain->strWalletFile)));
+
+        // Keep the keypool filled in the background, off the RPC threads
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "keypool", boost::function<void()>(boost::bind(&CWallet::KeyPoolThread, pwalletMain))));
+
+        // Send the queued peg-outs as they come due
+        CScheduler::Function fPegouts = boost::bind(&CWallet::SendDuePegouts, pwalletMain);
+        scheduler.scheduleEvery(fPegouts, PEGOUT_CHECK_INTERVAL, CScheduler::PRIORITY_LOW, "pegouts");
     }
 #endif
 
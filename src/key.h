@@ -140,6 +140,11 @@ public:
      */
     bool SignCompact(const uint256& hash, std::vector<unsigned char>& vchSig) const;
 
+    /**
+     * Create a Schnorr signature (64 bytes), as checked by CPubKey::VerifySchnorr.
+     */
+    bool SignSchnorr(const uint256& hash, std::vector<unsigned char>& vchSig) const;
+
     //! Derive BIP32 child key.
     bool Derive(CKey& keyChild, ChainCode &ccChild, unsigned int nChild, const ChainCode& cc) const;
 
@@ -7,10 +7,15 @@
 
 #include "key.h"
 #include "pubkey.h"
+#include "random.h"
 #include "util.h"
 
+#include <limits>
+
 #include <boost/foreach.hpp>
 
+SaltedKeyStoreHasher::SaltedKeyStoreHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
 bool CKeyStore::AddKey(const CKey &key) {
     return AddKeyPubKey(key, key.GetPubKey());
 }
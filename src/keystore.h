@@ -6,6 +6,7 @@
 #ifndef BITCOIN_KEYSTORE_H
 #define BITCOIN_KEYSTORE_H
 
+#include "hash.h"
 #include "key.h"
 #include "pubkey.h"
 #include "script/script.h"
@@ -13,6 +14,8 @@
 #include "sync.h"
 
 #include <boost/signals2/signal.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 #include <boost/variant.hpp>
 
 /** A virtual base class for key stores */
@@ -46,10 +49,32 @@ public:
     virtual bool HaveWatchOnly() const =0;
 };
 
-typedef std::map<CKeyID, CKey> KeyMap;
-typedef std::map<CKeyID, CPubKey> WatchKeyMap;
-typedef std::map<CScriptID, CScript > ScriptMap;
-typedef std::set<CScript> WatchOnlySet;
+/**
+ * Hashes the key IDs, script IDs and scripts of a key store with a salt of
+ * its own, like SaltedTxidHasher does txids, so that a wallet full of
+ * imported scripts cannot be made to pile them into one bucket.
+ */
+class SaltedKeyStoreHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedKeyStoreHasher();
+
+    size_t operator()(const uint160& id) const {
+        return CSipHasher(k0, k1).Write(id.begin(), id.size()).Finalize();
+    }
+    size_t operator()(const CScript& script) const {
+        return CSipHasher(k0, k1).Write(script.empty() ? NULL : &script[0], script.size()).Finalize();
+    }
+};
+
+typedef boost::unordered_map<CKeyID, CKey, SaltedKeyStoreHasher> KeyMap;
+typedef boost::unordered_map<CKeyID, CPubKey, SaltedKeyStoreHasher> WatchKeyMap;
+typedef boost::unordered_map<CScriptID, CScript, SaltedKeyStoreHasher> ScriptMap;
+typedef boost::unordered_set<CScript, SaltedKeyStoreHasher> WatchOnlySet;
 
 /** Basic key store, that keeps keys in an address->secret map */
 class CBasicKeyStore : public CKeyStore
@@ -109,6 +134,6 @@ public:
 };
 
 typedef std::vector<unsigned char, secure_allocator<unsigned char> > CKeyingMaterial;
-typedef std::map<CKeyID, std::pair<CPubKey, std::vector<unsigned char> > > CryptedKeyMap;
+typedef boost::unordered_map<CKeyID, std::pair<CPubKey, std::vector<unsigned char> >, SaltedKeyStoreHasher> CryptedKeyMap;
 
 #endif // BITCOIN_KEYSTORE_H
@@ -133,7 +133,14 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       seed_(0),
       tmp_batch_(new WriteBatch),
       bg_compaction_scheduled_(false),
-      manual_compaction_(NULL) {
+      manual_compaction_(NULL),
+      num_compactions_(0),
+      l0_slowdown_trigger_(config::kL0_SlowdownWritesTrigger),
+      l0_stop_trigger_(config::kL0_StopWritesTrigger),
+      compaction_bytes_per_second_(0),
+      write_slowdowns_(0),
+      write_stall_micros_(0),
+      compaction_throttle_micros_(0) {
   mem_->Ref();
   has_imm_.Release_Store(NULL);
 
@@ -528,11 +535,55 @@ void DBImpl::CompactMemTable() {
     imm_ = NULL;
     has_imm_.Release_Store(NULL);
     DeleteObsoleteFiles();
+    num_compactions_++;
   } else {
     RecordBackgroundError(s);
   }
 }
 
+void DBImpl::SetCompactionThrottle(int l0_slowdown_trigger,
+                                   int l0_stop_trigger,
+                                   uint64_t compaction_bytes_per_second) {
+  MutexLock l(&mutex_);
+  l0_slowdown_trigger_ = l0_slowdown_trigger;
+  l0_stop_trigger_ = std::max(l0_stop_trigger, l0_slowdown_trigger);
+  compaction_bytes_per_second_ = compaction_bytes_per_second;
+  // Writers waiting for level 0 may go ahead under a higher trigger
+  bg_cv_.SignalAll();
+}
+
+void DBImpl::ThrottleCompaction(int level, uint64_t bytes_written,
+                                uint64_t work_micros) {
+  // Compactions out of level 0 are what writers wait for.  Compactions
+  // further down only hold them up while level 0 needs compacting too,
+  // since they share the background thread.
+  if (level == 0) {
+    return;
+  }
+  uint64_t rate;
+  {
+    MutexLock l(&mutex_);
+    rate = compaction_bytes_per_second_;
+    if (versions_->NumLevelFiles(0) >= config::kL0_CompactionTrigger) {
+      return;
+    }
+  }
+  if (rate == 0) {
+    return;
+  }
+  const uint64_t due_micros = bytes_written * 1000000 / rate;
+  if (due_micros <= work_micros) {
+    return;
+  }
+  // Sleep in short slices, so that a full memtable is compacted promptly
+  // by the caller.
+  const uint64_t sleep_micros = std::min<uint64_t>(due_micros - work_micros,
+                                                   10000);
+  env_->SleepForMicroseconds(static_cast<int>(sleep_micros));
+  MutexLock l(&mutex_);
+  compaction_throttle_micros_ += sleep_micros;
+}
+
 void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
   int max_level_with_files = 1;
   {
@@ -881,6 +932,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
+  uint64_t throttle_check_bytes = 0;
+  int64_t throttle_micros = 0;  // Micros spent held back by the throttle
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
     // Prioritize immutable compaction work
     if (has_imm_.NoBarrier_Load() != NULL) {
@@ -894,6 +947,18 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       imm_micros += (env_->NowMicros() - imm_start);
     }
 
+    // Check the throttle every 256KB written
+    const uint64_t bytes_written = compact->total_bytes +
+        (compact->builder != NULL ? compact->builder->FileSize() : 0);
+    if (bytes_written >= throttle_check_bytes + (256 << 10)) {
+      throttle_check_bytes = bytes_written;
+      const uint64_t throttle_start = env_->NowMicros();
+      ThrottleCompaction(compact->compaction->level(), bytes_written,
+                         throttle_start - start_micros - imm_micros -
+                         throttle_micros);
+      throttle_micros += env_->NowMicros() - throttle_start;
+    }
+
     Slice key = input->key();
     if (compact->compaction->ShouldStopBefore(key) &&
         compact->builder != NULL) {
@@ -988,7 +1053,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   input = NULL;
 
   CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
+  stats.micros = env_->NowMicros() - start_micros - imm_micros -
+                 throttle_micros;
   for (int which = 0; which < 2; which++) {
     for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
       stats.bytes_read += compact->compaction->input(which, i)->file_size;
@@ -1000,6 +1066,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 
   mutex_.Lock();
   stats_[compact->compaction->level() + 1].Add(stats);
+  num_compactions_++;
 
   if (status.ok()) {
     status = InstallCompactionResults(compact);
@@ -1295,7 +1362,7 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       break;
     } else if (
         allow_delay &&
-        versions_->NumLevelFiles(0) >= config::kL0_SlowdownWritesTrigger) {
+        versions_->NumLevelFiles(0) >= l0_slowdown_trigger_) {
       // We are getting close to hitting a hard limit on the number of
       // L0 files.  Rather than delaying a single write by several
       // seconds when we hit the hard limit, start delaying each
@@ -1306,6 +1373,7 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       env_->SleepForMicroseconds(1000);
       allow_delay = false;  // Do not delay a single write more than once
       mutex_.Lock();
+      write_slowdowns_++;
     } else if (!force &&
                (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
       // There is room in current memtable
@@ -1314,11 +1382,15 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // We have filled up the current memtable, but the previous
       // one is still being compacted, so we wait.
       Log(options_.info_log, "Current memtable full; waiting...\n");
+      const uint64_t wait_start = env_->NowMicros();
       bg_cv_.Wait();
-    } else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
+      write_stall_micros_ += env_->NowMicros() - wait_start;
+    } else if (versions_->NumLevelFiles(0) >= l0_stop_trigger_) {
       // There are too many level-0 files.
       Log(options_.info_log, "Too many L0 files; waiting...\n");
+      const uint64_t wait_start = env_->NowMicros();
       bg_cv_.Wait();
+      write_stall_micros_ += env_->NowMicros() - wait_start;
     } else {
       // Attempt to switch to a new memtable and trigger compaction of old
       assert(versions_->PrevLogNumber() == 0);
@@ -1395,6 +1467,35 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
+  } else if (in == "write-slowdowns" || in == "write-stall-micros" ||
+             in == "compactions" || in == "compaction-micros" ||
+             in == "compaction-bytes-read" ||
+             in == "compaction-bytes-written" ||
+             in == "compaction-throttle-micros") {
+    CompactionStats total;
+    for (int level = 0; level < config::kNumLevels; level++) {
+      total.Add(stats_[level]);
+    }
+    int64_t n;
+    if (in == "write-slowdowns") {
+      n = write_slowdowns_;
+    } else if (in == "write-stall-micros") {
+      n = write_stall_micros_;
+    } else if (in == "compactions") {
+      n = num_compactions_;
+    } else if (in == "compaction-micros") {
+      n = total.micros;
+    } else if (in == "compaction-bytes-read") {
+      n = total.bytes_read;
+    } else if (in == "compaction-bytes-written") {
+      n = total.bytes_written;
+    } else {
+      n = compaction_throttle_micros_;
+    }
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(n));
+    *value = buf;
+    return true;
   }
 
   return false;
@@ -41,6 +41,9 @@ class DBImpl : public DB {
   virtual bool GetProperty(const Slice& property, std::string* value);
   virtual void GetApproximateSizes(const Range* range, int n, uint64_t* sizes);
   virtual void CompactRange(const Slice* begin, const Slice* end);
+  virtual void SetCompactionThrottle(int l0_slowdown_trigger,
+                                     int l0_stop_trigger,
+                                     uint64_t compaction_bytes_per_second);
 
   // Extra methods (for testing) that are not in the public DB interface
 
@@ -112,6 +115,10 @@ class DBImpl : public DB {
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Sleep while a compaction out of "level" that has been at work for
+  // "work_micros" wrote "bytes_written" faster than the throttle allows.
+  void ThrottleCompaction(int level, uint64_t bytes_written,
+                          uint64_t work_micros);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
@@ -189,6 +196,17 @@ class DBImpl : public DB {
     }
   };
   CompactionStats stats_[config::kNumLevels];
+  int64_t num_compactions_;
+
+  // See SetCompactionThrottle()
+  int l0_slowdown_trigger_;
+  int l0_stop_trigger_;
+  uint64_t compaction_bytes_per_second_;
+
+  // Time lost to write stalls and compaction throttling
+  int64_t write_slowdowns_;
+  int64_t write_stall_micros_;
+  int64_t compaction_throttle_micros_;
 
   // No copying allowed
   DBImpl(const DBImpl&);
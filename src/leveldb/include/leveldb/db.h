@@ -115,6 +115,16 @@ class DB {
   //     about the internal operation of the DB.
   //  "leveldb.sstables" - returns a multi-line string that describes all
   //     of the sstables that make up the db contents.
+  //  "leveldb.write-slowdowns" - number of writes delayed by 1ms because
+  //     level 0 had too many files.
+  //  "leveldb.write-stall-micros" - time writes spent waiting for a full
+  //     memtable or level 0 to be compacted.
+  //  "leveldb.compactions" - number of background compactions, memtable
+  //     compactions included.
+  //  "leveldb.compaction-micros", "leveldb.compaction-bytes-read",
+  //  "leveldb.compaction-bytes-written" - totals over these compactions.
+  //  "leveldb.compaction-throttle-micros" - time compactions were held back
+  //     by SetCompactionThrottle().
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
@@ -140,6 +150,20 @@ class DB {
   //    db->CompactRange(NULL, NULL);
   virtual void CompactRange(const Slice* begin, const Slice* end) = 0;
 
+  // Writes are delayed by 1ms each once level 0 has "l0_slowdown_trigger"
+  // files, and stop once it has "l0_stop_trigger" files, until compactions
+  // catch up.  Compactions into level 2 and up write at most
+  // "compaction_bytes_per_second" (0 for no limit) while level 0 does not
+  // need compacting itself.  The defaults are 8, 12 and 0.
+  //
+  // Higher triggers suit a bulk load, where the total time matters more
+  // than the latency of each write, at the cost of slower reads.
+  //
+  // The default implementation ignores the call.
+  virtual void SetCompactionThrottle(int l0_slowdown_trigger,
+                                     int l0_stop_trigger,
+                                     uint64_t compaction_bytes_per_second) { }
+
  private:
   // No copying allowed
   DB(const DB&);
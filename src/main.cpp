@@ -6,9 +6,13 @@
 #include "main.h"
 
 #include "addrman.h"
+#include "amountverifier.h"
 #include "arith_uint256.h"
 #include "callrpc.h"
 #include "blockencodings.h"
+#include "blockfilewriter.h"
+#include "blockfilter.h"
+#include "blockstats.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -16,8 +20,13 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "core_memusage.h"
+#include "crypto/common.h"
+#include "cuckoocache.h"
+#include "eccontext.h"
 #include "hash.h"
 #include "init.h"
+#include "mappedfile.h"
 #include "merkleblock.h"
 #include "net.h"
 #include "policy/fees.h"
@@ -32,15 +41,20 @@
 #include "tinyformat.h"
 #include "txdb.h"
 #include "txmempool.h"
+#include "txreconciliation.h"
 #include "ui_interface.h"
 #include "undo.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
 #include "validationinterface.h"
+#include "validationstats.h"
 #include "versionbits.h"
 
 #include <atomic>
+#include <deque>
+#include <list>
+#include <memory>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -66,6 +80,17 @@ CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
 CChain chainActive;
+namespace {
+    /** Last copy of chainActive, see GetChainSnapshot. */
+    CCriticalSection cs_chainSnapshot;
+    std::shared_ptr<const CChainSnapshot> chainSnapshot = std::make_shared<const CChainSnapshot>();
+    /**
+     * Held exclusively, on top of cs_main, while entries are added to
+     * mapBlockIndex and set up or while it is cleared, and shared by
+     * LookupBlockIndex.
+     */
+    boost::shared_mutex csBlockIndexWrite;
+}
 CBlockIndex *pindexBestHeader = NULL;
 int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
@@ -74,16 +99,24 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
+bool fScriptIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+uint256 hashAssumeValid;
 size_t nCoinCacheUsage = 5000 * 300;
+uint64_t nDBCompactionRate = DEFAULT_DB_COMPACTION_RATE << 20;
 uint64_t nPruneTarget = 0;
+bool fHavePrunedRangeproofs = false;
+bool fRangeproofPruneMode = false;
+uint64_t nRangeproofPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
+bool fLowLatencyFetch = DEFAULT_LOW_LATENCY_FETCH;
+int64_t nPeerTxBudget = DEFAULT_PEER_TX_BUDGET;
 
 
 CFeeRate minRelayTxFee = CFeeRate(DEFAULT_MIN_RELAY_TX_FEE);
@@ -105,12 +138,37 @@ struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
     int64_t nTimeExpire;
+    size_t nUsage;
 };
 map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
+/** Memory used by the transactions in mapOrphanTransactions. */
+size_t nOrphanTransactionsUsage GUARDED_BY(cs_main) = 0;
 map<COutPoint, set<map<uint256, COrphanTx>::iterator, IteratorComparator>> mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
 void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 static void CheckBlockIndex(const Consensus::Params& consensusParams);
+static bool PruneRangeproofsFromFile(int nFile, const CChainParams& chainparams);
+static void FinishPruneRangeproofs(int nFile);
+
+/** Block files mapped for reading, see ReadBlockFromDiskNoProof. */
+static CMappedFileCache mappedBlockFiles(MAX_MAPPED_BLOCK_FILES);
+
+/**
+ * Writes block and undo data behind validation. Whatever reads them back
+ * waits for their write first; FlushBlockFile is the barrier that makes them
+ * durable before the block index refers to them.
+ */
+static CBlockFileWriter blockFileWriter(OpenBlockFile, OpenUndoFile, &mappedBlockFiles, MAX_BLOCK_WRITE_QUEUE_BYTES);
+
+void StartBlockFileWriter()
+{
+    blockFileWriter.Start();
+}
+
+void StopBlockFileWriter()
+{
+    blockFileWriter.Stop();
+}
 
 /** Constant stuff for coinbase transactions we create: */
 CScript COINBASE_FLAGS;
@@ -164,6 +222,8 @@ namespace {
      *  or if we allocate more file space when we're in prune mode
      */
     bool fCheckForPruning = false;
+    /** Block files whose rangeproofs have been pruned. Protected by cs_LastBlockFile. */
+    set<int> setRangeproofsPrunedFiles;
 
     /**
      * Every received block is assigned a unique and increasing identifier, so we
@@ -209,6 +269,7 @@ namespace {
         CBlockIndex* pindex;                                     //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
+        int64_t nTime;                                           //!< When it was requested, in microseconds.
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -232,6 +293,24 @@ namespace {
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+
+    /** A transaction in the announcement queue. */
+    struct CTxAnnouncement {
+        std::shared_ptr<const CTransaction> tx;
+        CAmount nFeePerK;  //!< Its fee rate when it was queued
+        int64_t nTime;     //!< When it was queued, in microseconds
+    };
+    /** Transactions passed to RelayTransaction since the last QueueTxAnnouncements. */
+    CCriticalSection cs_txToAnnounce;
+    std::vector<uint256> vTxToAnnounce;
+    /**
+     * Transactions to announce, shared by all peers and protected by cs_main.
+     * Each peer announces them in order, from its CNodeState::nNextTxAnnounce
+     * on, so the queue is sorted once for all of them.
+     */
+    std::deque<CTxAnnouncement> dequeTxAnnounce;
+    /** Sequence number of the front of dequeTxAnnounce, protected by cs_main. */
+    uint64_t nTxAnnounceBegin = 0;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -285,6 +364,8 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Moving average of the time in microseconds this peer took to deliver the blocks requested from it, or 0.
+    int64_t nBlockDownloadMicros;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -306,6 +387,25 @@ struct CNodeState {
      * otherwise: whether this peer sends non-witnesses in cmpctblocks/blocktxns.
      */
     bool fSupportsDesiredCmpctVersion;
+    //! Whether this peer wants rpblocktxns instead of blocktxns
+    bool fWantsRangeproofDedup;
+    //! Whether this peer wants cheaders instead of headers
+    bool fWantsCompactHeaders;
+    //! Block of the last rpblocktxn sent; a second getblocktxn for it is answered in full
+    uint256 hashLastRangeproofDedupBlock;
+    //! Sequence number in the announcement queue of the next transaction to consider for this peer.
+    uint64_t nNextTxAnnounce;
+    //! Time in microseconds spent on the transactions this peer sent us.
+    int64_t nTxValidationMicros;
+    //! What is left of this peer's transaction validation budget (-peertxbudget), in microseconds.
+    int64_t nTxBudget;
+    //! When nTxBudget was last topped up, or 0.
+    int64_t nTxBudgetTime;
+    //! Whether we sent this peer "sendrecon", and the salt it carried.
+    bool fTxReconOffered;
+    uint64_t nTxReconSalt;
+    //! Set once both sides sent "sendrecon": our transactions are then announced by reconciliation.
+    std::shared_ptr<CTxReconState> txrecon;
 
     CNodeState() {
         fCurrentlyConnected = false;
@@ -321,6 +421,7 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlockDownloadMicros = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -328,6 +429,15 @@ struct CNodeState {
         fHaveWitness = false;
         fWantsCmpctWitness = false;
         fSupportsDesiredCmpctVersion = false;
+        fWantsRangeproofDedup = false;
+        fWantsCompactHeaders = false;
+        hashLastRangeproofDedupBlock.SetNull();
+        nNextTxAnnounce = 0;
+        nTxValidationMicros = 0;
+        nTxBudget = 0;
+        nTxBudgetTime = 0;
+        fTxReconOffered = false;
+        nTxReconSalt = 0;
     }
 };
 
@@ -363,6 +473,7 @@ void InitializeNode(NodeId nodeid, const CNode *pnode) {
     CNodeState &state = mapNodeState.insert(std::make_pair(nodeid, CNodeState())).first->second;
     state.name = pnode->addrName;
     state.address = pnode->addr;
+    state.nNextTxAnnounce = nTxAnnounceBegin + dequeTxAnnounce.size();
 }
 
 void FinalizeNode(NodeId nodeid) {
@@ -394,13 +505,22 @@ void FinalizeNode(NodeId nodeid) {
     }
 }
 
+// Requires cs_main.
+void UpdateBlockDownloadTime(CNodeState *state, int64_t nMicros) {
+    state->nBlockDownloadMicros = state->nBlockDownloadMicros ? (state->nBlockDownloadMicros * 3 + nMicros) / 4 : std::max<int64_t>(nMicros, 1);
+}
+
 // Requires cs_main.
 // Returns a bool indicating whether we requested this block.
 // Also used if a block was /not/ received and timed out or started with another peer
-bool MarkBlockAsReceived(const uint256& hash) {
+// If the block was requested from nodeFrom, its download time counts towards that peer's average.
+bool MarkBlockAsReceived(const uint256& hash, NodeId nodeFrom = -1) {
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
+        if (itInFlight->second.first == nodeFrom) {
+            UpdateBlockDownloadTime(state, GetTimeMicros() - itInFlight->second.second->nTime);
+        }
         state->nBlocksInFlightValidHeaders -= itInFlight->second.second->fValidatedHeaders;
         if (state->nBlocksInFlightValidHeaders == 0 && itInFlight->second.second->fValidatedHeaders) {
             // Last validated block on the queue was received.
@@ -437,7 +557,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     MarkBlockAsReceived(hash);
 
     list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL)});
+            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL), GetTimeMicros()});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -512,6 +632,18 @@ void MaybeSetPeerAsAnnouncingHeaderAndIDs(const CNodeState* nodestate, CNode* pf
     }
 }
 
+/** Send headers to a peer, as a cheaders message if fCompact (it sent sendcheaders) */
+static void PushHeaders(CNode* pto, bool fCompact, const std::vector<CBlock>& vHeaders)
+{
+    if (!fCompact) {
+        pto->PushMessage(NetMsgType::HEADERS, vHeaders);
+        return;
+    }
+    CompactHeaders cheaders;
+    cheaders.headers.assign(vHeaders.begin(), vHeaders.end());
+    pto->PushMessage(NetMsgType::CHEADERS, cheaders);
+}
+
 // Requires cs_main
 bool CanDirectFetch(const Consensus::Params &consensusParams)
 {
@@ -528,6 +660,40 @@ bool PeerHasHeader(CNodeState *state, CBlockIndex *pindex)
     return false;
 }
 
+/**
+ * With -lowlatencyfetch, the block after the tip that nodeid has and that was
+ * requested from another peer, if that peer is late by its own measure.
+ */
+CBlockIndex* FindBlockToRace(NodeId nodeid, int64_t nNow, const Consensus::Params& consensusParams) {
+    CNodeState *state = State(nodeid);
+    assert(state != NULL);
+
+    ProcessBlockAvailability(nodeid);
+    if (state->pindexBestKnownBlock == NULL || state->pindexBestKnownBlock->nHeight <= chainActive.Height())
+        return NULL;
+    CBlockIndex *pindex = state->pindexBestKnownBlock->GetAncestor(chainActive.Height() + 1);
+    if (pindex->pprev != chainActive.Tip() || (pindex->nStatus & BLOCK_HAVE_DATA) || !pindex->IsValid(BLOCK_VALID_TREE))
+        return NULL;
+    if (!state->fHaveWitness && IsWitnessEnabled(pindex->pprev, consensusParams))
+        return NULL;
+
+    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(pindex->GetBlockHash());
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first == nodeid)
+        return NULL;
+    // Twice the usual time of the peer it was requested from, as a block
+    // usually takes about as long as the previous ones.
+    const CNodeState *stateFrom = State(itInFlight->second.first);
+    int64_t nTimeout = BLOCK_RACE_TIMEOUT_UNMEASURED;
+    if (stateFrom->nBlockDownloadMicros)
+        nTimeout = std::max(BLOCK_RACE_TIMEOUT_MIN, stateFrom->nBlockDownloadMicros * 2);
+    if (nNow < itInFlight->second.second->nTime + nTimeout)
+        return NULL;
+    // Do not race to a peer known to be slower still.
+    if (state->nBlockDownloadMicros > nTimeout)
+        return NULL;
+    return pindex;
+}
+
 /** Find the last common ancestor two blocks have.
  *  Both pa and pb must be non-NULL. */
 CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
@@ -649,6 +815,7 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nTxValidationMicros = state->nTxValidationMicros;
     return true;
 }
 
@@ -689,7 +856,24 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
+CCoinsViewPrefetch *pcoinsPrefetch = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CTxIndexDB *ptxindexdb = NULL;
+CBlockFilterDB *pblockfilterdb = NULL;
+CBlockStatsDB *pblockstatsdb = NULL;
+CScriptIndexDB *pscriptindexdb = NULL;
+
+/** Statistics of the UTXO set at pcoinsTip's best block, if fUTXOStatsValid (protected by cs_main) */
+static CUTXOStats utxoStats;
+static bool fUTXOStatsValid = false;
+
+/**
+ * Block the chainstate was loaded at from a UTXO snapshot, if any (protected
+ * by cs_main). Its nTx counts all transactions up to it, and the blocks
+ * before it have no data.
+ */
+static uint256 hashSnapshotBase;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -716,14 +900,16 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(c
         return false;
     }
 
-    auto ret = mapOrphanTransactions.emplace(hash, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME});
+    const size_t nUsage = RecursiveDynamicUsage(tx);
+    auto ret = mapOrphanTransactions.emplace(hash, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME, nUsage});
     assert(ret.second);
+    nOrphanTransactionsUsage += nUsage;
     BOOST_FOREACH(const CTxIn& txin, tx.vin) {
         mapOrphanTransactionsByPrev[txin.prevout].insert(ret.first);
     }
 
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u outsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u outsz %u usage %u)\n", hash.ToString(),
+             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size(), nOrphanTransactionsUsage);
     return true;
 }
 
@@ -741,6 +927,7 @@ int static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+    nOrphanTransactionsUsage -= it->second.nUsage;
     mapOrphanTransactions.erase(it);
     return 1;
 }
@@ -761,7 +948,7 @@ void EraseOrphansFor(NodeId peer)
 }
 
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphansUsage) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     unsigned int nEvicted = 0;
     static int64_t nNextSweep;
@@ -784,7 +971,7 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRE
         nNextSweep = nMinExpTime + ORPHAN_TX_EXPIRE_INTERVAL;
         if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nErased);
     }
-    while (mapOrphanTransactions.size() > nMaxOrphans)
+    while (mapOrphanTransactions.size() > nMaxOrphans || nOrphanTransactionsUsage > nMaxOrphansUsage)
     {
         // Evict a random orphan:
         uint256 randomhash = GetRandHash();
@@ -797,6 +984,14 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRE
     return nEvicted;
 }
 
+void GetOrphanStats(size_t& nCount, size_t& nUsage, size_t& nMissingOutpoints)
+{
+    LOCK(cs_main);
+    nCount = mapOrphanTransactions.size();
+    nUsage = nOrphanTransactionsUsage;
+    nMissingOutpoints = mapOrphanTransactionsByPrev.size();
+}
+
 bool IsFinalTx(const CTransaction &tx, int nBlockHeight, int64_t nBlockTime)
 {
     if (tx.nLockTime == 0)
@@ -966,22 +1161,23 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
         lockPair.second = lp->time;
     }
     else {
-        // pcoinsTip contains the UTXO set for chainActive.Tip()
-        CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        // pcoinsTip contains the UTXO set for chainActive.Tip(); only the
+        // heights are needed, so look up the coins without copying them, in
+        // the mempool first as CCoinsViewMemPool does.
         std::vector<int> prevheights;
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
-                return error("%s: Missing input", __func__);
-            }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (mempool.exists(txin.prevout.hash)) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
-            } else {
-                prevheights[txinIndex] = coins.nHeight;
+                continue;
+            }
+            const CCoins* coins = pcoinsTip->AccessCoins(txin.prevout.hash);
+            if (!coins || coins->IsPruned()) {
+                return error("%s: Missing input", __func__);
             }
+            prevheights[txinIndex] = coins->nHeight;
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
         if (lp) {
@@ -1066,6 +1262,55 @@ int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& i
 
 
 
+bool CheckRangeProofHeader(const CTxOutValue& val, unsigned int& nCost)
+{
+    nCost = 0;
+    if (val.IsAmount() || val.vchRangeproof.empty())
+        return true;
+    const unsigned char* proof = val.vchRangeproof.data();
+    const size_t plen = val.vchRangeproof.size();
+    int exp, mantissa;
+    uint64_t nMinValue, nMaxValue;
+    if (plen > (size_t)std::numeric_limits<int>::max() ||
+        !secp256k1_rangeproof_info(ECC_GetContext(), &exp, &mantissa, &nMinValue, &nMaxValue, proof, plen))
+        return false;
+
+    // The ring layout the header implies, as secp256k1_rangeproof_verify
+    // derives it: two bits of the value per ring of four keys, and a ring of
+    // two for an odd bit.
+    int nRings = 1, nPubs = 1;
+    if (mantissa != 0) {
+        nRings = mantissa >> 1;
+        nPubs = nRings * 4;
+        if (mantissa & 1) {
+            nRings++;
+            nPubs += 2;
+        }
+    }
+    // After the header come the sign bits and points of all rings but the
+    // last, e0, and a scalar per key; verification rejects anything else.
+    const size_t nHeader = ((proof[0] & 64) ? 2 : 1) + ((proof[0] & 32) ? 8 : 0);
+    const size_t nSignBytes = (nRings + 6) >> 3;
+    if (plen != nHeader + nSignBytes + 32 * (nRings - 1) + 32 + 32 * nPubs)
+        return false;
+    // Unused sign bits must be zero
+    if (((nRings - 1) & 7) && (proof[nHeader + nSignBytes - 1] >> ((nRings - 1) & 7)) != 0)
+        return false;
+    nCost = nPubs;
+    return true;
+}
+
+int64_t GetTransactionRangeProofCost(const CTransaction& tx)
+{
+    int64_t nCost = 0;
+    BOOST_FOREACH(const CTxOut& txout, tx.vout) {
+        unsigned int nProofCost;
+        if (CheckRangeProofHeader(txout.nValue, nProofCost))
+            nCost += nProofCost;
+    }
+    return nCost;
+}
+
 bool CheckTransaction(const CTransaction& tx, CValidationState &state)
 {
     // Basic checks that don't depend on any context
@@ -1074,7 +1319,7 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state)
     if (tx.vout.empty())
         return state.DoS(10, false, REJECT_INVALID, "bad-txns-vout-empty");
     // Size limits (this doesn't take the witness into account, as that hasn't been checked for malleability)
-    if (::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) > MAX_BLOCK_BASE_SIZE)
+    if (tx.GetStrippedSize() > MAX_BLOCK_BASE_SIZE)
         return state.DoS(100, false, REJECT_INVALID, "bad-txns-oversize");
 
     // Check for negative or overflow output values
@@ -1090,13 +1335,23 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state)
             return state.DoS(100, false, REJECT_INVALID, "bad-txns-txouttotal-toolarge");
     }
 
-    // Check for duplicate inputs
-    set<COutPoint> vInOutPoints;
+    // Check for duplicate inputs, in a sorted copy rather than a set to
+    // save an allocation per input
+    std::vector<COutPoint> vInOutPoints;
+    vInOutPoints.reserve(tx.vin.size());
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        vInOutPoints.push_back(txin.prevout);
+    std::sort(vInOutPoints.begin(), vInOutPoints.end());
+    if (std::adjacent_find(vInOutPoints.begin(), vInOutPoints.end()) != vInOutPoints.end())
+        return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputs-duplicate");
+
+    // Malformed range proofs fail here, before anything hashes them for the
+    // proof cache or tries to verify them
+    BOOST_FOREACH(const CTxOut& txout, tx.vout)
     {
-        if (vInOutPoints.count(txin.prevout))
-            return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputs-duplicate");
-        vInOutPoints.insert(txin.prevout);
+        unsigned int nProofCost;
+        if (!CheckRangeProofHeader(txout.nValue, nProofCost))
+            return state.DoS(100, false, REJECT_INVALID, "bad-txns-rangeproof-header");
     }
 
     if (tx.IsCoinBase())
@@ -1119,38 +1374,58 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state)
 
 namespace {
 
-static secp256k1_context* secp256k1_ctx_verify_amounts;
+/** Approximate cost of verifying one range proof, relative to a signature check. */
+static const unsigned int RANGE_CHECK_COST = 50;
 
-class Secp256k1Ctx
+/** Closure representing one output range check. */
+class CRangeCheck : public CCheck
 {
+private:
+    const CTxOutValue* val;
+    RangeProofCacheKey key;
+    const bool store;
+
 public:
-    Secp256k1Ctx() {
-        assert(secp256k1_ctx_verify_amounts == NULL);
-        secp256k1_ctx_verify_amounts = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY);
-        secp256k1_pedersen_context_initialize(secp256k1_ctx_verify_amounts);
-        secp256k1_rangeproof_context_initialize(secp256k1_ctx_verify_amounts);
-        assert(secp256k1_ctx_verify_amounts != NULL);
-    }
+    CRangeCheck(const CTxOutValue* val_, const RangeProofCacheKey& keyIn, const bool storeIn) : val(val_), key(keyIn), store(storeIn) {}
 
-    ~Secp256k1Ctx() {
-        assert(secp256k1_ctx_verify_amounts != NULL);
-        secp256k1_context_destroy(secp256k1_ctx_verify_amounts);
-        secp256k1_ctx_verify_amounts = NULL;
-    }
+    bool operator()();
+    unsigned int GetCost() const { return RANGE_CHECK_COST; }
+
+    const CTxOutValue* GetValue() const { return val; }
+    const RangeProofCacheKey& GetKey() const { return key; }
 };
-static Secp256k1Ctx instance_of_secp256k1ctx;
 
-/** Closure representing one output range check. */
-class CRangeCheck : public CCheck
+/** Number of range proofs verified together by one CRangeBatchCheck. */
+static const size_t RANGEPROOF_BATCH_SIZE = 16;
+
+/**
+ * Number of range proofs of a block verified together by one
+ * CRangeBatchCheck. During initial block download and reindex, batches are
+ * as big as the -amountverifier backend takes at once.
+ */
+static size_t GetBlockRangeProofBatchSize()
+{
+    if (IsInitialBlockDownload())
+        return std::max(RANGEPROOF_BATCH_SIZE, GetAmountVerifierBatchSize());
+    return RANGEPROOF_BATCH_SIZE;
+}
+
+/** Closure representing several output range checks that are verified as one batch. */
+class CRangeBatchCheck : public CCheck
 {
 private:
-    const CTxOutValue* val;
+    std::vector<const CTxOutValue*> vVals;
+    std::vector<RangeProofCacheKey> vKeys;
     const bool store;
 
 public:
-    CRangeCheck(const CTxOutValue* val_, const bool storeIn) : val(val_), store(storeIn) {}
+    CRangeBatchCheck(const bool storeIn) : store(storeIn) {}
+
+    void Add(const CTxOutValue* val, const RangeProofCacheKey& key) { vVals.push_back(val); vKeys.push_back(key); }
+    size_t size() const { return vVals.size(); }
 
     bool operator()();
+    unsigned int GetCost() const { return vVals.size() * RANGE_CHECK_COST; }
 };
 
 /** Closure representing a transaction amount balance check. */
@@ -1161,6 +1436,8 @@ private:
     std::vector<unsigned char *> vpchCommitsIn, vpchCommitsOut;
     CAmount nPlainAmount;
 
+    friend class CBalanceBatchCheck;
+
 public:
     CBalanceCheck(std::vector<unsigned char>& vchData_, std::vector<unsigned char*>& vpchCommitsIn_, std::vector<unsigned char*>& vpchCommitsOut_, const CAmount& nPlainAmount_) : nPlainAmount(nPlainAmount_) {
         vchData.swap(vchData_);
@@ -1171,6 +1448,43 @@ public:
     bool operator()();
 };
 
+/** Number of transaction balance checks verified together by one CBalanceBatchCheck. */
+static const size_t BALANCE_BATCH_SIZE = 64;
+
+/** Closure representing the balance checks of several transactions, verified as one batch. */
+class CBalanceBatchCheck : public CCheck
+{
+private:
+    std::vector<CBalanceCheck*> vChecks;
+    std::vector<uint256> vTxids;
+
+public:
+    ~CBalanceBatchCheck() {
+        BOOST_FOREACH(CBalanceCheck* check, vChecks)
+            delete check;
+    }
+
+    void Add(CBalanceCheck* check, const uint256& txid) {
+        vChecks.push_back(check);
+        vTxids.push_back(txid);
+    }
+    size_t size() const { return vChecks.size(); }
+
+    bool operator()();
+    unsigned int GetCost() const { return vChecks.size(); }
+};
+
+/** Checks put aside to be run later, which are deleted if they never are. */
+struct CDeferredChecks
+{
+    std::vector<CCheck*> vChecks;
+
+    ~CDeferredChecks() {
+        BOOST_FOREACH(CCheck* check, vChecks)
+            delete check;
+    }
+};
+
 // Does *not* destroy the check in the case of no queue, or passes its ownership to the queue.
 static inline bool QueueCheck(std::vector<CCheck*>* queue, CCheck* check)
 {
@@ -1185,16 +1499,80 @@ static inline bool QueueCheck(std::vector<CCheck*>* queue, CCheck* check)
 
 bool CRangeCheck::operator()()
 {
+    CValidationTimer timer(VALIDATION_RANGEPROOF);
     if (val->IsAmount()) {
         return true;
     }
 
-    return CachingRangeProofChecker(store).VerifyRangeProof(val->vchRangeproof, val->vchCommitment, secp256k1_ctx_verify_amounts);
+    return CachingRangeProofChecker(store).VerifyRangeProof(key, *val, ECC_GetContext());
 };
 
+bool CRangeBatchCheck::operator()()
+{
+    CValidationTimer timer(VALIDATION_RANGEPROOF);
+    std::vector<const CTxOutValue*> vBlinded;
+    std::vector<RangeProofCacheKey> vBlindedKeys;
+    vBlinded.reserve(vVals.size());
+    vBlindedKeys.reserve(vVals.size());
+    for (size_t i = 0; i < vVals.size(); i++) {
+        if (vVals[i]->IsAmount())
+            continue;
+        vBlinded.push_back(vVals[i]);
+        vBlindedKeys.push_back(vKeys[i]);
+    }
+
+    size_t nFailed = 0;
+    if (!CachingRangeProofChecker(store).VerifyRangeProofs(vBlindedKeys, vBlinded, ECC_GetContext(), &nFailed)) {
+        LogPrintf("%s: invalid range proof for commitment %s\n", __func__, HexStr(vBlinded[nFailed]->vchCommitment));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Pull the range and balance checks of transaction txid out of vChecks and
+ * collect them in rangeBatch and balanceBatch. Every time a batch fills up
+ * it is handed back to vChecks, so the check queue sees one check per
+ * nRangeBatchSize proofs or BALANCE_BATCH_SIZE transactions.
+ * With fRangeProofsQueued, checks of outputs that carry a proof are dropped
+ * since StartRangeProofPrecheck has queued them already.
+ */
+static void BatchAmountChecks(std::vector<CCheck*>& vChecks, const uint256& txid, std::unique_ptr<CRangeBatchCheck>& rangeBatch, std::unique_ptr<CBalanceBatchCheck>& balanceBatch, const bool fCacheStore, const bool fRangeProofsQueued, const size_t nRangeBatchSize)
+{
+    std::vector<CCheck*>::iterator itKeep = vChecks.begin();
+    for (std::vector<CCheck*>::iterator it = vChecks.begin(); it != vChecks.end(); ++it) {
+        if (CRangeCheck* check = dynamic_cast<CRangeCheck*>(*it)) {
+            if (fRangeProofsQueued && !check->GetValue()->vchRangeproof.empty()) {
+                delete check;
+                continue;
+            }
+            if (!rangeBatch)
+                rangeBatch.reset(new CRangeBatchCheck(fCacheStore));
+            rangeBatch->Add(check->GetValue(), check->GetKey());
+            delete check;
+            if (rangeBatch->size() >= nRangeBatchSize)
+                *itKeep++ = rangeBatch.release();
+        } else if (CBalanceCheck* check = dynamic_cast<CBalanceCheck*>(*it)) {
+            if (!balanceBatch)
+                balanceBatch.reset(new CBalanceBatchCheck());
+            balanceBatch->Add(check, txid);
+            if (balanceBatch->size() >= BALANCE_BATCH_SIZE)
+                *itKeep++ = balanceBatch.release();
+        } else {
+            *itKeep++ = *it;
+        }
+    }
+    vChecks.erase(itKeep, vChecks.end());
+}
+
 bool CBalanceCheck::operator()()
 {
-    if (!secp256k1_pedersen_verify_tally(secp256k1_ctx_verify_amounts, vpchCommitsIn.data(), vpchCommitsIn.size(), vpchCommitsOut.data(), vpchCommitsOut.size(), nPlainAmount)) {
+    CValidationTimer timer(VALIDATION_TALLY);
+    const unsigned char* const* pchCommitsIn = vpchCommitsIn.data();
+    const unsigned char* const* pchCommitsOut = vpchCommitsOut.data();
+    const int nCommitsIn = vpchCommitsIn.size();
+    const int nCommitsOut = vpchCommitsOut.size();
+    if (!VerifyTallyBatch(ECC_GetContext(), &pchCommitsIn, &nCommitsIn, &pchCommitsOut, &nCommitsOut, &nPlainAmount, 1)) {
         fAmountError = true;
         return false;
     }
@@ -1202,11 +1580,39 @@ bool CBalanceCheck::operator()()
     return true;
 }
 
+bool CBalanceBatchCheck::operator()()
+{
+    CValidationTimer timer(VALIDATION_TALLY);
+    std::vector<const unsigned char * const *> vpCommitsIn, vpCommitsOut;
+    std::vector<int> vnCommitsIn, vnCommitsOut;
+    std::vector<int64_t> vExcess;
+    BOOST_FOREACH(const CBalanceCheck* check, vChecks) {
+        vpCommitsIn.push_back(check->vpchCommitsIn.data());
+        vnCommitsIn.push_back(check->vpchCommitsIn.size());
+        vpCommitsOut.push_back(check->vpchCommitsOut.data());
+        vnCommitsOut.push_back(check->vpchCommitsOut.size());
+        vExcess.push_back(check->nPlainAmount);
+    }
+
+    if (VerifyTallyBatch(ECC_GetContext(), vpCommitsIn.data(), vnCommitsIn.data(), vpCommitsOut.data(), vnCommitsOut.data(), vExcess.data(), vChecks.size()))
+        return true;
+
+    // Find the transaction that does not balance
+    for (size_t i = 0; i < vChecks.size(); i++) {
+        if (!(*vChecks[i])()) {
+            LogPrintf("%s: amounts of transaction %s do not balance\n", __func__, vTxids[i].ToString());
+            break;
+        }
+    }
+    fAmountError = true;
+    return false;
+}
+
 } // namespace
 
 
 
-bool VerifyAmounts(const CCoinsViewCache& cache, const CTransaction& tx, const CAmount& excess, std::vector<CCheck*>* pvChecks, const bool cacheStore)
+bool VerifyAmounts(const CCoinsViewCache& cache, const CTransaction& tx, const CAmount& excess, std::vector<CCheck*>* pvChecks, const bool cacheStore, const bool fRangeProofChecks, std::vector<CCheck*>* pvRangeChecks)
 {
     bool fNeedNoRangeProof = false;
     CAmount nPlainAmount = excess;
@@ -1270,15 +1676,16 @@ bool VerifyAmounts(const CCoinsViewCache& cache, const CTransaction& tx, const C
     }
 
     // Rangeproof is optional in this case
-    if (fNeedNoRangeProof)
+    if (fNeedNoRangeProof || !fRangeProofChecks)
         return true;
 
+    const uint256 wtxid = tx.GetWitnessHash();
     for (size_t i = 0; i < tx.vout.size(); ++i)
     {
         const CTxOutValue& val = tx.vout[i].nValue;
         if (val.IsAmount())
             continue;
-        if (!QueueCheck(pvChecks, new CRangeCheck(&val, cacheStore))) {
+        if (!QueueCheck(pvRangeChecks ? pvRangeChecks : pvChecks, new CRangeCheck(&val, RangeProofCacheKey(wtxid, i), cacheStore))) {
             return false;
         }
     }
@@ -1299,6 +1706,80 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
         pcoinsTip->Uncache(removed);
 }
 
+/**
+ * Transactions whose scripts and amounts were fully verified when they
+ * entered the mempool, under the script flags of the next block. For these
+ * CheckInputs only runs the contextual input checks. Entries are
+ * SHA256(nonce || witness hash || flags); the outpoints in the witness hash
+ * commit to the coins spent. Guarded by cs_main.
+ */
+static CuckooCache::cache<uint256, CSignatureCacheHasher> txValidationCache;
+static uint256 txValidationCacheNonce;
+
+void InitTxValidationCache()
+{
+    txValidationCacheNonce = GetRandHash();
+    // Entries are per transaction rather than per signature, so half the
+    // size of the signature cache goes a long way.
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20) / 2;
+    size_t nElems = txValidationCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for transaction validation cache, able to store %zu elements\n",
+              (nElems * sizeof(uint256)) >> 20, nMaxCacheSize >> 20, nElems);
+}
+
+static void ComputeTxValidationCacheEntry(uint256& entry, const uint256& wtxid, unsigned int flags)
+{
+    unsigned char vchFlags[4];
+    WriteLE32(vchFlags, flags);
+    CSHA256().Write(txValidationCacheNonce.begin(), 32).Write(wtxid.begin(), 32).Write(vchFlags, 4).Finalize(entry.begin());
+}
+
+static bool AddToTxValidationCache(const CTransaction& tx, const CCoinsViewCache& view, unsigned int flags)
+{
+    AssertLockHeld(cs_main);
+    // Peg-ins also depend on the state of the parent chain, which may have
+    // changed by the time they are mined.
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        if (view.GetOutputFor(txin).scriptPubKey.IsWithdrawLock())
+            return false;
+    }
+    uint256 entry;
+    ComputeTxValidationCacheEntry(entry, tx.GetWitnessHash(), flags);
+    txValidationCache.insert(entry);
+    return true;
+}
+
+/**
+ * Re-add the transactions of a block template that the mempool fully
+ * validated under flags to the transaction validation cache, in case they
+ * were evicted since, so that checking the template only runs the block
+ * level and contextual input checks for them.
+ */
+static void RefreshTxValidationCache(const CBlock& block, const CTxMemPool& pool, unsigned int flags)
+{
+    AssertLockHeld(cs_main);
+    LOCK(pool.cs);
+    unsigned int nRefreshed = 0;
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        CTxMemPool::txiter it = pool.mapTx.find(tx.GetHash());
+        if (it == pool.mapTx.end() || it->GetValidatedFlags() != flags)
+            continue;
+        // Same txid but different witnesses are not what the mempool checked.
+        const uint256 wtxid = tx.GetWitnessHash();
+        if (pool.vTxHashes[it->vTxHashesIdx].first != wtxid)
+            continue;
+        uint256 entry;
+        ComputeTxValidationCacheEntry(entry, wtxid, flags);
+        if (!txValidationCache.contains(entry, false)) {
+            txValidationCache.insert(entry);
+            nRefreshed++;
+        }
+    }
+    if (nRefreshed)
+        LogPrint("bench", "    - Restored %u mempool transactions to the validation cache\n", nRefreshed);
+}
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state)
 {
@@ -1309,7 +1790,7 @@ std::string FormatStateMessage(const CValidationState &state)
 }
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
-                              bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
+                              bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
                               std::vector<uint256>& vHashTxnToUncache)
 {
     const uint256 hash = tx.GetHash();
@@ -1399,15 +1880,14 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
     }
 
     {
-        CCoinsView dummy;
-        CCoinsViewCache view(&dummy);
+        // Refers to the coins in pcoinsTip rather than copying them, so none
+        // of the coins looked up may be uncached until we are done.
+        CCoinsViewMemPoolOverlay view(pcoinsTip, pool);
         std::set<std::pair<uint256, COutPoint> > setWithdrawsSpent;
 
         LockPoints lp;
         {
         LOCK(pool.cs);
-        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
-        view.SetBackend(viewMemPool);
 
         // do we already have it?
         bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
@@ -1437,13 +1917,13 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // We disable replacement of peg-ins as they are spendable-by-anyone
         BOOST_FOREACH(const CTxIn &txin, tx.vin)
         {
-            CCoins coins;
-            assert(view.GetCoins(txin.prevout.hash, coins));
-            if (coins.vout[txin.prevout.n].scriptPubKey.IsWithdrawLock() && txin.scriptSig.IsWithdrawProof()) {
+            const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+            assert(coins);
+            if (coins->vout[txin.prevout.n].scriptPubKey.IsWithdrawLock() && txin.scriptSig.IsWithdrawProof()) {
                 if (pool.mapNextTx.count(txin.prevout))
                     return state.Invalid(false, REJECT_CONFLICT, "txn-mempool-replace-withdraw");
 
-                pair<uint256, COutPoint> outpoint = make_pair(coins.vout[txin.prevout.n].scriptPubKey.GetWithdrawLockGenesisHash(), txin.scriptSig.GetWithdrawSpent());
+                pair<uint256, COutPoint> outpoint = make_pair(coins->vout[txin.prevout.n].scriptPubKey.GetWithdrawLockGenesisHash(), txin.scriptSig.GetWithdrawSpent());
                 if (view.IsWithdrawSpent(outpoint))
                     return state.Invalid(false, REJECT_CONFLICT, "withdraw-already-claimed");
                 setWithdrawsSpent.insert(outpoint);
@@ -1453,8 +1933,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // Bring the best block into scope
         view.GetBestBlock();
 
-        // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
-        view.SetBackend(dummy);
+        // we have all inputs found now, so detach, so we don't need to keep lock on mempool
+        view.Detach();
 
         // Only accept BIP68 sequence locked transactions that can be mined in the next
         // block; we don't want our mempool filled up with transactions that can't
@@ -1465,15 +1945,15 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             return state.DoS(0, false, REJECT_NONSTANDARD, "non-BIP68-final");
         }
 
-        // Check for non-standard pay-to-script-hash in inputs
-        if (fRequireStandard && !AreInputsStandard(tx, view))
-            return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
-
-        // Check for non-standard witness in P2WSH
-        if (!tx.wit.IsNull() && fRequireStandard && !IsWitnessStandard(tx, view))
-            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
-
-        int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+        // Check for non-standard pay-to-script-hash in inputs and non-standard
+        // witness in P2WSH, counting the sigops on the way
+        int64_t nSigOpsCost;
+        std::string strInputsReason;
+        if (!CheckInputsStandard(tx, view, fRequireStandard, STANDARD_SCRIPT_VERIFY_FLAGS, nSigOpsCost, strInputsReason)) {
+            if (strInputsReason == "bad-witness-nonstandard")
+                return state.DoS(0, false, REJECT_NONSTANDARD, strInputsReason, true);
+            return state.Invalid(false, REJECT_NONSTANDARD, strInputsReason);
+        }
 
         // nModifiedFees includes any fee deltas from PrioritiseTransaction
         CAmount nFees = tx.nTxFee;
@@ -1495,8 +1975,13 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             }
         }
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOpsCost, lp, setWithdrawsSpent);
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOpsCost, lp, setWithdrawsSpent);
         unsigned int nSize = entry.GetTxSize();
+        // The fee checks below also charge for verifying the range proofs,
+        // at one sigop per public key they commit to, through -bytespersigop.
+        // They are not sigops as far as block limits go, so the entry does
+        // not count them.
+        unsigned int nFeeSize = GetVirtualTransactionSize(entry.GetTxWeight(), nSigOpsCost + GetTransactionRangeProofCost(tx));
 
         // Check that the transaction doesn't have an excessive number of
         // sigops, making it impossible to mine. Since the coinbase transaction
@@ -1507,10 +1992,10 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
                 strprintf("%d", nSigOpsCost));
 
-        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nFeeSize);
         if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
-        } else if (GetBoolArg("-relaypriority", DEFAULT_RELAYPRIORITY) && nModifiedFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(entry.GetPriority(chainActive.Height() + 1))) {
+        } else if (GetBoolArg("-relaypriority", DEFAULT_RELAYPRIORITY) && nModifiedFees < ::minRelayTxFee.GetFee(nFeeSize) && !AllowFree(entry.GetPriority(chainActive.Height() + 1))) {
             // Require that free transactions have sufficient priority to be mined in the next block.
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
         }
@@ -1518,7 +2003,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // Continuously rate-limit free (really, very-low-fee) transactions
         // This mitigates 'penny-flooding' -- sending thousands of free transactions just to
         // be annoying or make others' transactions take longer to confirm.
-        if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize))
+        if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nFeeSize))
         {
             static CCriticalSection csFreeLimiter;
             static double dFreeCount;
@@ -1722,23 +2207,30 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         assert(setWithdrawsSpent2 == setWithdrawsSpent);
         setWithdrawsSpent2.clear();
 
-        // Check again against just the consensus-critical mandatory script
-        // verification flags, in case of bugs in the standard flags that cause
-        // transactions to pass as valid when they're actually invalid. For
-        // instance the STRICTENC flag was incorrectly allowing certain
-        // CHECKSIG NOT scripts to pass, even though they were invalid.
+        // Check again against just the consensus-critical script
+        // verification flags of the next block, in case of bugs in the
+        // standard flags that cause transactions to pass as valid when
+        // they're actually invalid. For instance the STRICTENC flag was
+        // incorrectly allowing certain CHECKSIG NOT scripts to pass, even
+        // though they were invalid.
         //
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, setWithdrawsSpent2))
+        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
+        if (!CheckInputs(tx, state, view, true, currentBlockScriptVerifyFlags, true, txdata, setWithdrawsSpent2))
         {
-            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
+            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against block but not STANDARD flags %s, %s",
                 __func__, hash.ToString(), FormatStateMessage(state));
         }
 
         assert(setWithdrawsSpent2 == setWithdrawsSpent);
 
+        // Everything was verified inline under the flags the next block will
+        // most likely use, so ConnectBlock can skip it.
+        if (AddToTxValidationCache(tx, view, currentBlockScriptVerifyFlags))
+            entry.SetValidatedFlags(currentBlockScriptVerifyFlags);
+
         // Remove conflicting transactions from the mempool
         BOOST_FOREACH(const CTxMemPool::txiter it, allConflicting)
         {
@@ -1766,11 +2258,11 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
     return true;
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
     std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
     if (!res) {
         BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
             pcoinsTip->Uncache(hashTx);
@@ -1778,6 +2270,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return res;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fOverrideMempoolLimit, nAbsurdFee);
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1794,7 +2292,8 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
 
     if (fTxIndex) {
         CDiskTxPos postx;
-        if (pblocktree->ReadTxIndex(hash, postx)) {
+        if (ptxindexdb->ReadTxIndex(hash, postx)) {
+            blockFileWriter.WaitForWrite(false, postx);
             CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
             if (file.IsNull())
                 return error("%s: OpenBlockFile failed", __func__);
@@ -1828,7 +2327,8 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     if (pindexSlow) {
         CBlock block;
         if (ReadBlockFromDisk(block, pindexSlow, consensusParams)) {
-            BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+            BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+                const CTransaction& tx = *ptx;
                 if (tx.GetHash() == hash) {
                     txOut = tx;
                     hashBlock = pindexSlow->GetBlockHash();
@@ -1841,8 +2341,50 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     return false;
 }
 
-bool utxoSort(const std::pair<COutPoint, CAmount>& a, const std::pair<COutPoint, CAmount>& b) {
-    return a.second > b.second;
+/** Confirmed withdraw lock outputs by genesis hash, sorted by amount. Mirrors the block tree DB lock entries. */
+static std::map<uint256, std::set<std::pair<CAmount, COutPoint> > > mapLockedOutputs;
+
+static bool LoadLockedOutputs()
+{
+    AssertLockHeld(cs_main);
+    std::multimap<uint256, std::pair<COutPoint, CAmount> > mapLocks;
+    if (!pblocktree->ReadLocks(mapLocks))
+        return false;
+    mapLockedOutputs.clear();
+    for (std::multimap<uint256, std::pair<COutPoint, CAmount> >::const_iterator it = mapLocks.begin(); it != mapLocks.end(); it++)
+        mapLockedOutputs[it->first].insert(std::make_pair(it->second.second, it->second.first));
+    LogPrintf("%s: %u withdraw locks\n", __func__, mapLocks.size());
+    return true;
+}
+
+bool UpdateLockedOutputs(const std::multimap<uint256, std::pair<COutPoint, CAmount> >& mapAdded, const std::multimap<uint256, std::pair<COutPoint, CAmount> >& mapRemoved)
+{
+    AssertLockHeld(cs_main);
+    for (std::multimap<uint256, std::pair<COutPoint, CAmount> >::const_iterator it = mapAdded.begin(); it != mapAdded.end(); it++)
+        mapLockedOutputs[it->first].insert(std::make_pair(it->second.second, it->second.first));
+    for (std::multimap<uint256, std::pair<COutPoint, CAmount> >::const_iterator it = mapRemoved.begin(); it != mapRemoved.end(); it++) {
+        std::map<uint256, std::set<std::pair<CAmount, COutPoint> > >::iterator itLocks = mapLockedOutputs.find(it->first);
+        if (itLocks == mapLockedOutputs.end())
+            continue;
+        itLocks->second.erase(std::make_pair(it->second.second, it->second.first));
+        if (itLocks->second.empty())
+            mapLockedOutputs.erase(itLocks);
+    }
+    return pblocktree->UpdateLocks(mapAdded, mapRemoved);
+}
+
+/** Whether a confirmed lock can be spent right now. Locks no longer in the UTXO set are queued in mapStale for removal. */
+static bool IsLockedOutputAvailable(const uint256& genesisHash, const std::pair<CAmount, COutPoint>& lock, std::multimap<uint256, std::pair<COutPoint, CAmount> >& mapStale)
+{
+    const CCoins* coins = pcoinsTip->AccessCoins(lock.second.hash);
+    if (!coins || !coins->IsAvailable(lock.second.n)) {
+        mapStale.insert(std::make_pair(genesisHash, std::make_pair(lock.second, lock.first)));
+        return false;
+    }
+    if (mempool.mapNextTx.count(lock.second))
+        return false;
+    assert(coins->vout[lock.second.n].nValue.IsAmount() && coins->vout[lock.second.n].nValue.GetAmount() == lock.first);
+    return true;
 }
 
 /** Select Inputs which lock at least nAmount to the given chain */
@@ -1851,120 +2393,51 @@ bool GetLockedOutputs(const uint256 &genesisHash, const CAmount &nAmount, std::v
 
     LOCK2(cs_main, mempool.cs);
 
-    std::vector<std::pair<COutPoint, CAmount> > locksCreated;
-    bool locksChanged = false;
-    if (!pblocktree->ReadLocksCreated(genesisHash, locksCreated))
-        return false;
-
-    //For faster random esasure
-    std::list<std::pair<COutPoint, CAmount> > locksList;
-    std::copy(locksCreated.begin(), locksCreated.end(), std::back_inserter(locksList));
-
-    unsigned int skippedLocks = 0;
-    while (locksList.size() - skippedLocks > 0) {
-        uint64_t idx = GetRand(locksList.size() - skippedLocks);
-        std::list<std::pair<COutPoint, CAmount> >::iterator it = locksList.begin();
-        std::advance(it, idx);
-        const std::pair<COutPoint, CAmount> &lock = (*it);
-        //Should run this first
-        //Erase locks that have been spent in an active block
-        CCoins coins;
-        if (!pcoinsTip->GetCoins(lock.first.hash, coins) || !coins.IsAvailable(lock.first.n)) {
-            locksList.erase(it);
-            locksChanged = true;
-            continue;
+    std::multimap<uint256, std::pair<COutPoint, CAmount> > mapStale;
+    CAmount nTotal = 0;
+    std::map<uint256, std::set<std::pair<CAmount, COutPoint> > >::const_iterator itLocks = mapLockedOutputs.find(genesisHash);
+    if (itLocks != mapLockedOutputs.end()) {
+        const std::set<std::pair<CAmount, COutPoint> >& setLocks = itLocks->second;
+
+        //Prefer the smallest single lock large enough
+        std::set<std::pair<CAmount, COutPoint> >::const_iterator itLarge = setLocks.lower_bound(std::make_pair(nAmount, COutPoint(uint256(), 0)));
+        for (std::set<std::pair<CAmount, COutPoint> >::const_iterator it = itLarge; it != setLocks.end(); it++) {
+            if (IsLockedOutputAvailable(genesisHash, *it, mapStale)) {
+                res.push_back(std::make_pair(it->second, it->first));
+                nTotal = it->first;
+                break;
+            }
         }
 
-        //Move too-small locks or locks currently spent in mempool to back of list
-        if (lock.second < nAmount ||
-                mempool.mapNextTx.count(COutPoint(lock.first.hash, lock.first.n))) {
-            locksList.push_back(lock);
-            locksList.erase(it);
-            skippedLocks++;
-            continue;
+        //Otherwise gather up smaller locked outputs for aggregation, largest first
+        for (std::set<std::pair<CAmount, COutPoint> >::const_reverse_iterator it(itLarge); it != setLocks.rend() && nTotal < nAmount; it++) {
+            if (!IsLockedOutputAvailable(genesisHash, *it, mapStale))
+                continue;
+            res.push_back(std::make_pair(it->second, it->first));
+            nTotal += it->first;
+            assert(MoneyRange(nTotal));
         }
-
-        assert(coins.vout[lock.first.n].nValue.IsAmount() && coins.vout[lock.first.n].nValue.GetAmount() == lock.second);
-        res.push_back(lock);
-        break;
-    }
-    if (locksChanged) {
-        //Convert back for serialization
-        std::vector<std::pair<COutPoint, CAmount> > vChangedLocks(locksList.begin(), locksList.end());
-        pblocktree->ReWriteLocksCreated(genesisHash, vChangedLocks);
     }
-    //Found single lock large enough
-    if (res.size())
-        return true;
-
-    CAmount nTotal = 0;
-    //Gather up smaller locked outputs for aggregation.
-    for (std::list<std::pair<COutPoint, CAmount> >::iterator it = locksList.begin(); it != locksList.end(); it++) {
-        CCoins coins;
-        if (!pcoinsTip->GetCoins(it->first.hash, coins) || !coins.IsAvailable(it->first.n)) {
-            it = locksList.erase(it);
-            it--;
-            locksChanged = true;
-            continue;
-        }
-
-        if (mempool.mapNextTx.count(COutPoint(it->first.hash, it->first.n)))
-            continue;
-
-        assert(coins.vout[it->first.n].nValue.IsAmount() && coins.vout[it->first.n].nValue.GetAmount() == it->second);
-        res.push_back(*it);
 
-        nTotal += it->second;
-        assert(MoneyRange(nTotal));
-    }
+    if (!mapStale.empty())
+        UpdateLockedOutputs(std::multimap<uint256, std::pair<COutPoint, CAmount> >(), mapStale);
 
-    if (locksChanged) {
-        //Convert back for serialization
-        std::vector<std::pair<COutPoint, CAmount> > vChangedLocks(locksList.begin(), locksList.end());
-        pblocktree->ReWriteLocksCreated(genesisHash, vChangedLocks);
-    }
+    if (nTotal >= nAmount)
+        return true;
 
     //If not enough, combine mempool locks
-    if (nTotal < nAmount) {
-        std::vector<const CTransaction*> vMempoolTxn;
-        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx) {
-            vMempoolTxn.push_back(&e.GetTx());
-        }
-
-        std::random_shuffle(vMempoolTxn.begin(), vMempoolTxn.end());
-
-        BOOST_FOREACH(const CTransaction* ptx, vMempoolTxn) {
-            const CTransaction& tx = *ptx;
-            for (unsigned int j = 0; j < tx.vout.size() && nTotal < nAmount; j++) {
-                CTxOut txout = tx.vout[j];
-                if (!txout.scriptPubKey.IsWithdrawLock())
-                    continue;
-
-                uint256 withdrawGenHash = txout.scriptPubKey.GetWithdrawLockGenesisHash();
-                if (genesisHash != withdrawGenHash)
-                    continue;
-                if (mempool.mapWithdrawsSpentToTxid.count(std::make_pair(withdrawGenHash, COutPoint(tx.GetHash(), j))))
-                    continue;
-
-                if (txout.scriptPubKey.IsWithdrawLock() && txout.nValue.IsAmount()) {
-                    res.push_back(std::make_pair(COutPoint(tx.GetHash(), j), txout.nValue.GetAmount()));
-                    nTotal += txout.nValue.GetAmount();
-                    if (nTotal >= nAmount)
-                        return true;
-                }
-            }
-       }
+    std::map<uint256, std::set<std::pair<CAmount, COutPoint> > >::const_iterator itPool = mempool.mapWithdrawLocks.find(genesisHash);
+    if (itPool == mempool.mapWithdrawLocks.end())
         return false;
+    for (std::set<std::pair<CAmount, COutPoint> >::const_reverse_iterator it = itPool->second.rbegin(); it != itPool->second.rend(); it++) {
+        if (mempool.mapNextTx.count(it->second) || mempool.mapWithdrawsSpentToTxid.count(std::make_pair(genesisHash, it->second)))
+            continue;
+        res.push_back(std::make_pair(it->second, it->first));
+        nTotal += it->first;
+        if (nTotal >= nAmount)
+            return true;
     }
-
-    //res list is already randomized
-    nTotal = 0;
-    size_t i = 0;
-    for (; i < res.size() && nTotal < nAmount; i++)
-        nTotal += res[i].second;
-
-    res.resize(i);
-    return true;
+    return false;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1974,42 +2447,131 @@ bool GetLockedOutputs(const uint256 &genesisHash, const CAmount &nAmount, std::v
 
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("WriteBlockToDisk: OpenBlockFile failed");
+    // Index header and block, for the block file writer
+    unsigned int nSize = GetBlockTotalSize(block);
+    std::vector<char> vData;
+    vData.reserve(MESSAGE_START_SIZE + sizeof(nSize) + nSize);
+    CVectorWriter<std::vector<char> > writer(vData, SER_DISK, CLIENT_VERSION);
+    writer << FLATDATA(messageStart) << nSize << block;
+
+    const CDiskBlockPos posHeader = pos;
+    pos.nPos += MESSAGE_START_SIZE + sizeof(nSize);
+    if (!blockFileWriter.Write(false, posHeader, vData))
+        return error("WriteBlockToDisk: writing to the block file failed");
+
+    return true;
+}
 
-    // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(block);
-    fileout << FLATDATA(messageStart) << nSize;
+/** Whether the proof of block is the one already verified for pindex, so CheckProof can be skipped */
+static bool IsProofCached(const CBlockHeader& block, const CBlockIndex* pindex)
+{
+    return pindex && (pindex->nStatus & BLOCK_PROOF_VALID) && !pindex->fSolutionDropped &&
+        block.proof.challenge == pindex->GetChallenge() && block.proof.solution == pindex->solution;
+}
 
-    // Write block
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("WriteBlockToDisk: ftell failed");
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+/** Height up to which the active chain has had its block solutions dropped, see DropDeepSolutions. */
+static int nSolutionsDroppedHeight = 0;
 
+/** Read the solution of pindex back from the block tree database. */
+static bool ReadBlockIndexSolution(const CBlockIndex* pindex, CScript& solution)
+{
+    CDiskBlockIndex diskindex;
+    if (!pblocktree->ReadBlockIndex(pindex->GetBlockHash(), diskindex) || diskindex.GetChallenge() != pindex->GetChallenge())
+        return error("%s: failed to read block index %s", __func__, pindex->GetBlockHash().ToString());
+    solution.swap(diskindex.solution);
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+bool GetBlockIndexHeader(const CBlockIndex* pindex, CBlockHeader& header)
 {
-    block.SetNull();
-
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    AssertLockHeld(cs_main);
+    header = pindex->GetBlockHeader();
+    return !pindex->fSolutionDropped || ReadBlockIndexSolution(pindex, header.proof.solution);
+}
 
-    // Read block
-    try {
+/**
+ * Drop the solutions of the active chain blocks more than
+ * KEEP_SOLUTIONS_DEPTH deep from memory. Only blocks whose index is written
+ * to the block tree database are considered, as that is where the solution
+ * is read back from.
+ */
+static void DropDeepSolutions()
+{
+    AssertLockHeld(cs_main);
+    const int nEndHeight = chainActive.Height() - KEEP_SOLUTIONS_DEPTH;
+    for (int nHeight = nSolutionsDroppedHeight; nHeight < nEndHeight; nHeight++) {
+        CBlockIndex* pindex = chainActive[nHeight];
+        if (!setDirtyBlockIndex.count(pindex))
+            pindex->DropSolution();
+    }
+    nSolutionsDroppedHeight = std::max(nSolutionsDroppedHeight, nEndHeight);
+}
+
+/**
+ * Find the serialized block at pos in a mapped block file. Its size is
+ * taken from the index header WriteBlockToDisk puts in front of it.
+ */
+static bool GetMappedBlock(const CDiskBlockPos& pos, boost::shared_ptr<CMappedFile>& pfile, const char*& pbegin, const char*& pend)
+{
+    if (pos.IsNull() || pos.nPos < sizeof(unsigned int))
+        return false;
+    pfile = mappedBlockFiles.Get(pos.nFile, GetBlockPosFilename(pos, "blk"), pos.nPos);
+    if (!pfile)
+        return false;
+    unsigned int nSize;
+    memcpy(&nSize, pfile->begin() + pos.nPos - sizeof(nSize), sizeof(nSize));
+    nSize = le32toh(nSize);
+    if (nSize > pfile->size() - pos.nPos) {
+        // Written after the file was mapped; map it again.
+        pfile = mappedBlockFiles.Get(pos.nFile, GetBlockPosFilename(pos, "blk"), (size_t)pos.nPos + nSize);
+        if (!pfile)
+            return false;
+    }
+    pbegin = pfile->begin() + pos.nPos;
+    pend = pbegin + nSize;
+    return true;
+}
+
+static bool ReadBlockFromDiskNoProof(CBlock& block, const CDiskBlockPos& pos)
+{
+    block.SetNull();
+    blockFileWriter.WaitForWrite(false, pos);
+
+    // Deserialize straight from the mapped file where possible.
+    boost::shared_ptr<CMappedFile> pfile;
+    const char *pbegin, *pend;
+    if (GetMappedBlock(pos, pfile, pbegin, pend)) {
+        try {
+            CMemoryReader reader(pbegin, pend, SER_DISK, CLIENT_VERSION);
+            reader >> block;
+            return true;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    }
+
+    // Open history file to read
+    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+    // Read block
+    try {
         filein >> block;
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
 
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    if (!ReadBlockFromDiskNoProof(block, pos))
+        return false;
+
     // Check the header
     if (!CheckProof(block, consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
@@ -2019,11 +2581,227 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    if (!ReadBlockFromDiskNoProof(block, pindex->GetBlockPos()))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
                 pindex->ToString(), pindex->GetBlockPos().ToString());
+    if (!IsProofCached(block, pindex) && !CheckProof(block, consensusParams))
+        return error("ReadBlockFromDisk: Errors in block header at %s", pindex->GetBlockPos().ToString());
+    return true;
+}
+
+static void SkipSerializedBytes(CMemoryReader& s)
+{
+    s.ignore(ReadCompactSize(s));
+}
+
+/**
+ * Append the transaction at the start of s to vOut the way it serializes with
+ * SERIALIZE_TRANSACTION_NO_WITNESS, by copying the byte ranges around its
+ * witness data. Mirrors the reading side of SerializeTransaction.
+ */
+static void StripTransactionWitness(CMemoryReader& s, std::vector<char>& vOut)
+{
+    const char* pbegin = s.begin();
+    s.ignore(4 + 8); // nVersion, nTxFee
+    const char* pvin = s.begin();
+    uint64_t nInputs = ReadCompactSize(s);
+    unsigned char flags = 0;
+    if (nInputs == 0) {
+        s >> flags;
+        if (flags == 0) {
+            // Nothing follows but nLockTime; the bytes are the same either way.
+            s.ignore(4);
+            vOut.insert(vOut.end(), pbegin, s.begin());
+            return;
+        }
+        if (flags & ~3)
+            throw std::ios_base::failure("Unknown transaction optional data");
+        pvin = s.begin();
+        nInputs = ReadCompactSize(s);
+    }
+    for (uint64_t i = 0; i < nInputs; i++) {
+        s.ignore(32 + 4); // prevout
+        SkipSerializedBytes(s); // scriptSig
+        s.ignore(4); // nSequence
+    }
+    uint64_t nOutputs = ReadCompactSize(s);
+    for (uint64_t i = 0; i < nOutputs; i++) {
+        s.ignore(CTxOutValue::nCommitmentSize);
+        SkipSerializedBytes(s); // scriptPubKey
+    }
+    const char* pvoutEnd = s.begin();
+    if (flags & 1) {
+        for (uint64_t i = 0; i < nInputs; i++) {
+            uint64_t nStack = ReadCompactSize(s);
+            for (uint64_t j = 0; j < nStack; j++)
+                SkipSerializedBytes(s);
+        }
+    }
+    if (flags & 2) {
+        for (uint64_t i = 0; i < nOutputs; i++) {
+            SkipSerializedBytes(s); // vchRangeproof
+            SkipSerializedBytes(s); // vchNonceCommitment
+        }
+    }
+    const char* pLockTime = s.begin();
+    s.ignore(4);
+
+    vOut.insert(vOut.end(), pbegin, pbegin + 4 + 8);
+    vOut.insert(vOut.end(), pvin, pvoutEnd);
+    vOut.insert(vOut.end(), pLockTime, s.begin());
+}
+
+/**
+ * Append the confidential data of the outputs of the transaction at the start
+ * of s to ssOut, in the layout of ReadBlockCTDataFromDisk. Walks the same
+ * fields as StripTransactionWitness.
+ */
+static void AppendTransactionCTData(CMemoryReader& s, CDataStream& ssOut)
+{
+    s.ignore(4 + 8); // nVersion, nTxFee
+    uint64_t nInputs = ReadCompactSize(s);
+    unsigned char flags = 0;
+    if (nInputs == 0) {
+        s >> flags;
+        if (flags == 0) {
+            // No inputs and no outputs.
+            s.ignore(4);
+            WriteCompactSize(ssOut, 0);
+            return;
+        }
+        if (flags & ~3)
+            throw std::ios_base::failure("Unknown transaction optional data");
+        nInputs = ReadCompactSize(s);
+    }
+    for (uint64_t i = 0; i < nInputs; i++) {
+        s.ignore(32 + 4); // prevout
+        SkipSerializedBytes(s); // scriptSig
+        s.ignore(4); // nSequence
+    }
+    uint64_t nOutputs = ReadCompactSize(s);
+    std::vector<const char*> vCommitments;
+    vCommitments.reserve(nOutputs);
+    for (uint64_t i = 0; i < nOutputs; i++) {
+        vCommitments.push_back(s.begin());
+        s.ignore(CTxOutValue::nCommitmentSize);
+        SkipSerializedBytes(s); // scriptPubKey
+    }
+    if (flags & 1) {
+        for (uint64_t i = 0; i < nInputs; i++) {
+            uint64_t nStack = ReadCompactSize(s);
+            for (uint64_t j = 0; j < nStack; j++)
+                SkipSerializedBytes(s);
+        }
+    }
+    WriteCompactSize(ssOut, nOutputs);
+    for (uint64_t i = 0; i < nOutputs; i++) {
+        ssOut.write(vCommitments[i], CTxOutValue::nCommitmentSize);
+        if (flags & 2) {
+            // Stored as rangeproof then nonce commitment; both keep their length prefix.
+            const char* pRangeproof = s.begin();
+            SkipSerializedBytes(s);
+            const char* pNonce = s.begin();
+            SkipSerializedBytes(s);
+            ssOut.write(pNonce, s.begin() - pNonce);
+            ssOut.write(pRangeproof, pNonce - pRangeproof);
+        } else {
+            WriteCompactSize(ssOut, 0);
+            WriteCompactSize(ssOut, 0);
+        }
+    }
+    s.ignore(4); // nLockTime
+}
+
+bool ReadBlockCTDataFromDisk(CDataStream& ss, const CBlockIndex* pindex)
+{
+    std::vector<char> vBlock;
+    if (!ReadRawBlockFromDisk(vBlock, pindex, true))
+        return false;
+
+    try {
+        CMemoryReader s(begin_ptr(vBlock), end_ptr(vBlock), SER_DISK, CLIENT_VERSION);
+        CBlockHeader header;
+        s >> header;
+        uint64_t nTx = ReadCompactSize(s);
+        ss << pindex->GetBlockHash();
+        WriteCompactSize(ss, nTx);
+        std::vector<char> vStripped;
+        for (uint64_t i = 0; i < nTx; i++) {
+            const char* pbegin = s.begin();
+            vStripped.clear();
+            StripTransactionWitness(s, vStripped);
+            ss << Hash(vStripped.begin(), vStripped.end());
+            CMemoryReader stx(pbegin, s.begin(), SER_DISK, CLIENT_VERSION);
+            AppendTransactionCTData(stx, ss);
+        }
+        if (!s.empty())
+            return error("%s: trailing data in %s", __func__, pindex->GetBlockHash().ToString());
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s in %s", __func__, e.what(), pindex->GetBlockHash().ToString());
+    }
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<char>& vData, const CBlockIndex* pindex, bool fWitness)
+{
+    return ReadRawBlockFromDisk(vData, pindex->GetBlockPos(), pindex->GetBlockHash(), fWitness);
+}
+
+bool ReadRawBlockFromDisk(std::vector<char>& vData, const CDiskBlockPos& pos, const uint256& hash, bool fWitness)
+{
+    vData.clear();
+    blockFileWriter.WaitForWrite(false, pos);
+
+    boost::shared_ptr<CMappedFile> pfile;
+    const char *pbegin, *pend;
+    std::vector<char> vStored;
+    if (!GetMappedBlock(pos, pfile, pbegin, pend)) {
+        if (pos.IsNull() || pos.nPos < sizeof(unsigned int))
+            return error("%s: no data for %s", __func__, hash.ToString());
+        CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - sizeof(unsigned int)), true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+        try {
+            unsigned int nSize;
+            filein >> nSize;
+            if (nSize > MAX_SIZE)
+                return error("%s: bad size %u at %s", __func__, nSize, pos.ToString());
+            vStored.resize(nSize);
+            filein.read(begin_ptr(vStored), nSize);
+        } catch (const std::exception& e) {
+            return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+        pbegin = begin_ptr(vStored);
+        pend = end_ptr(vStored);
+    }
+
+    try {
+        CMemoryReader s(pbegin, pend, SER_DISK, CLIENT_VERSION);
+        CBlockHeader header;
+        s >> header;
+        if (header.GetHash() != hash)
+            return error("%s: GetHash() doesn't match %s at %s", __func__, hash.ToString(), pos.ToString());
+        if (fWitness) {
+            // The stored serialization is the one with witness data.
+            if (vStored.empty())
+                vData.assign(pbegin, pend);
+            else
+                vData.swap(vStored);
+            return true;
+        }
+        vData.reserve(pend - pbegin);
+        uint64_t nTx = ReadCompactSize(s);
+        vData.assign(pbegin, s.begin());
+        for (uint64_t i = 0; i < nTx; i++)
+            StripTransactionWitness(s, vData);
+        if (!s.empty())
+            return error("%s: trailing data at %s", __func__, pos.ToString());
+    } catch (const std::exception& e) {
+        vData.clear();
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+    }
     return true;
 }
 
@@ -2184,6 +2962,34 @@ void Misbehaving(NodeId pnode, int howmuch)
         LogPrintf("%s: %s (%d -> %d)\n", __func__, state->name, state->nMisbehavior-howmuch, state->nMisbehavior);
 }
 
+/**
+ * Charge a peer nMicros spent on one of its transactions. Its budget is
+ * topped up at -peertxbudget for the time passed, up to PEER_TX_BUDGET_BURST
+ * seconds' worth. Returns the time at which an overdrawn budget is paid off,
+ * or 0 if there is budget left. Requires cs_main.
+ */
+static int64_t ChargeTxValidation(NodeId nodeid, int64_t nMicros, int64_t nNow)
+{
+    CNodeState *state = State(nodeid);
+    if (state == NULL)
+        return 0;
+    state->nTxValidationMicros += nMicros;
+    if (nPeerTxBudget <= 0)
+        return 0;
+
+    // Milliseconds per second are microseconds per millisecond.
+    const int64_t nMaxBudget = nPeerTxBudget * 1000 * PEER_TX_BUDGET_BURST;
+    if (state->nTxBudgetTime == 0)
+        state->nTxBudget = nMaxBudget;
+    else
+        state->nTxBudget = std::min(nMaxBudget, state->nTxBudget + (nNow - state->nTxBudgetTime) * nPeerTxBudget / 1000);
+    state->nTxBudgetTime = nNow;
+    state->nTxBudget -= nMicros;
+    if (state->nTxBudget >= 0)
+        return 0;
+    return nNow + (-state->nTxBudget) * 1000 / nPeerTxBudget;
+}
+
 void static InvalidChainFound(CBlockIndex* pindexNew)
 {
     if (!pindexBestInvalid || pindexNew->nChainWork > pindexBestInvalid->nChainWork)
@@ -2261,6 +3067,7 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
 }
 
 bool CScriptCheck::operator()() {
+    CValidationTimer timer(VALIDATION_SCRIPT);
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     const CScriptWitness *witness = (nIn < ptxTo->wit.vtxinwit.size()) ? &ptxTo->wit.vtxinwit[nIn].scriptWitness : NULL;
     if (!VerifyScript(scriptSig, scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, amountPreviousInput, Params().GetConsensus().fedpegScript, cacheStore, *txdata), &error)) {
@@ -2277,7 +3084,7 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 }
 
 namespace Consensus {
-bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, int nSpendHeight, std::set<std::pair<uint256, COutPoint> >& setWithdrawsSpent, std::vector<CCheck*> *pvChecks, const bool cacheStore)
+bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, int nSpendHeight, std::set<std::pair<uint256, COutPoint> >& setWithdrawsSpent, std::vector<CCheck*> *pvChecks, const bool cacheStore, const bool fVerifyAmounts, const bool fRangeProofChecks, std::vector<CCheck*>* pvRangeChecks)
 {
         // This doesn't trigger the DoS code on purpose; if it did, it would make it easier
         // for an attacker to attempt to split the network.
@@ -2325,7 +3132,7 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         if (!MoneyRange(nTxFee))
             return state.DoS(100, false, REJECT_INVALID, "bad-txns-fee-outofrange");
 
-        if (!VerifyAmounts(inputs, tx, nTxFee, pvChecks, cacheStore))
+        if (fVerifyAmounts && !VerifyAmounts(inputs, tx, nTxFee, pvChecks, cacheStore, fRangeProofChecks, pvRangeChecks))
             return state.DoS(100, false, REJECT_INVALID, "bad-txns-in-belowout", false,
                 strprintf("value in (%s) < value out", FormatMoney(nValueIn)));
 
@@ -2333,13 +3140,32 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
+static bool RunDeferredRangeChecks(std::vector<CCheck*>& vChecks);
+
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, set<pair<uint256, COutPoint> >& setWithdrawsSpent, std::vector<CCheck*> *pvChecks)
 {
     if (!tx.IsCoinBase())
     {
-        if (!Consensus::CheckTxInputs(tx, state, inputs, GetSpendHeight(inputs), setWithdrawsSpent, pvChecks, cacheStore))
+        // Transactions that were fully verified under these flags when they
+        // entered the mempool only get the contextual input checks.
+        bool fFullyValidated = false;
+        if (fScriptChecks) {
+            AssertLockHeld(cs_main);
+            uint256 hashCacheEntry;
+            ComputeTxValidationCacheEntry(hashCacheEntry, tx.GetWitnessHash(), flags);
+            fFullyValidated = txValidationCache.contains(hashCacheEntry, !cacheStore);
+        }
+
+        // Without a queue, as for the mempool, the range proofs are put aside
+        // until the tally and the scripts have passed, and then verified on
+        // the script check threads.
+        CDeferredChecks rangeChecks;
+        if (!Consensus::CheckTxInputs(tx, state, inputs, GetSpendHeight(inputs), setWithdrawsSpent, pvChecks, cacheStore, !fFullyValidated, fScriptChecks, pvChecks ? NULL : &rangeChecks.vChecks))
             return false;
 
+        if (fFullyValidated)
+            return true;
+
         if (pvChecks)
             pvChecks->reserve(tx.vin.size());
 
@@ -2402,6 +3228,10 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     prevValueIn = -1;
             }
         }
+
+        // The proofs are part of the witness, which may have been malleated.
+        if (!RunDeferredRangeChecks(rangeChecks.vChecks))
+            return state.DoS(100, false, REJECT_INVALID, "bad-txns-rangeproof", true);
     }
 
     return true;
@@ -2409,35 +3239,33 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
 
 namespace {
 
-bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+/** Write blockundo, whose serialized size is nSize, with its header and checksum. */
+bool UndoWriteToDisk(const CBlockUndo& blockundo, unsigned int nSize, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(blockundo);
-    fileout << FLATDATA(messageStart) << nSize;
-
-    // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("%s: ftell failed", __func__);
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
-
-    // calculate & write checksum
-    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-    hasher << hashBlock;
+    // Index header, for the block file writer
+    std::vector<char> vData;
+    vData.reserve(MESSAGE_START_SIZE + sizeof(nSize) + nSize + sizeof(uint256));
+    CVectorWriter<std::vector<char> > writer(vData, SER_DISK, CLIENT_VERSION);
+    writer << FLATDATA(messageStart) << nSize;
+
+    // Undo data, hashed for the checksum, which covers the block hash first
+    CHashingWriter<CVectorWriter<std::vector<char> > > hasher(writer);
+    static_cast<CHashWriter&>(hasher) << hashBlock;
     hasher << blockundo;
-    fileout << hasher.GetHash();
+    writer << hasher.GetHash();
+
+    const CDiskBlockPos posHeader = pos;
+    pos.nPos += MESSAGE_START_SIZE + sizeof(nSize);
+    if (!blockFileWriter.Write(true, posHeader, vData))
+        return error("%s: writing to the undo file failed", __func__);
 
     return true;
 }
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
+    blockFileWriter.WaitForWrite(true, pos);
+
     // Open history file to read
     CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
@@ -2497,7 +3325,7 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
     CCoinsModifier coins = view.ModifyCoins(out.hash);
     if (undo.nHeight != 0 ||
             // Special-case genesis since nHeight is always 0, assume DB is clean
-            (Params().GenesisBlock().vtx[0].GetHash() == out.hash && coins->IsPruned())) {
+            (Params().GenesisBlock().vtx[0]->GetHash() == out.hash && coins->IsPruned())) {
         // undo data contains height: this is the last output of the prevout tx being spent
         if (!coins->IsPruned())
             fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
@@ -2532,7 +3360,33 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
     return fClean;
 }
 
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+/** Account for connecting (or disconnecting) a block, with the outputs it spends given by its undo data. */
+static void UpdateUTXOStats(CUTXOStats& stats, const CBlock& block, const CBlockUndo& blockundo, bool fConnect)
+{
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        // The coins database does not keep unspendable outputs either.
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            if (tx.vout[j].IsNull() || tx.vout[j].scriptPubKey.IsUnspendable())
+                continue;
+            if (fConnect)
+                stats.Add(COutPoint(tx.GetHash(), j), tx.vout[j]);
+            else
+                stats.Remove(COutPoint(tx.GetHash(), j), tx.vout[j]);
+        }
+        if (i == 0)
+            continue;
+        const CTxUndo& txundo = blockundo.vtxundo[i-1];
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            if (fConnect)
+                stats.Remove(tx.vin[j].prevout, txundo.vprevout[j].txout);
+            else
+                stats.Add(tx.vin[j].prevout, txundo.vprevout[j].txout);
+        }
+    }
+}
+
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, CUTXOStats* pstats)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -2541,6 +3395,9 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
     bool fClean = true;
 
+    std::multimap<uint256, std::pair<COutPoint, CAmount> > mLocksRestored;
+    std::multimap<uint256, std::pair<COutPoint, CAmount> > mLocksRemoved;
+
     CBlockUndo blockUndo;
     CDiskBlockPos pos = pindex->GetUndoPos();
     if (pos.IsNull())
@@ -2553,7 +3410,7 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
-        const CTransaction &tx = block.vtx[i];
+        const CTransaction &tx = *block.vtx[i];
         uint256 hash = tx.GetHash();
 
         // Check that all outputs are available and match the outputs in the block itself
@@ -2575,6 +3432,12 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
         outs->Clear();
         }
 
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            const CTxOut& txout = tx.vout[j];
+            if (txout.scriptPubKey.IsWithdrawLock() && txout.nValue.IsAmount())
+                mLocksRemoved.insert(std::make_pair(txout.scriptPubKey.GetWithdrawLockGenesisHash(), std::make_pair(COutPoint(hash, j), txout.nValue.GetAmount())));
+        }
+
         // restore inputs
         if (i > 0) { // not coinbases
             const CTxUndo &txundo = blockUndo.vtxundo[i-1];
@@ -2585,6 +3448,8 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                 const CTxInUndo &undo = txundo.vprevout[j];
                 if (!ApplyTxInUndo(undo, view, out, tx.vin[j]))
                     fClean = false;
+                if (undo.txout.scriptPubKey.IsWithdrawLock() && undo.txout.nValue.IsAmount())
+                    mLocksRestored.insert(std::make_pair(undo.txout.scriptPubKey.GetWithdrawLockGenesisHash(), std::make_pair(out, undo.txout.nValue.GetAmount())));
             }
         }
     }
@@ -2592,35 +3457,37 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
+    // VerifyDB (the only caller passing pfClean) disconnects onto a scratch
+    // view, which must leave the withdraw lock and script indexes alone.
+    if (!pfClean && !UpdateLockedOutputs(mLocksRestored, mLocksRemoved))
+        return AbortNode(state, "Failed to write withdraw lock index");
+    if (!pfClean && pscriptindexdb && !pscriptindexdb->DisconnectBlock(block, blockUndo))
+        return AbortNode(state, "Failed to write script index");
+
     if (pfClean) {
         *pfClean = fClean;
         return true;
     }
 
+    if (fClean && pstats)
+        UpdateUTXOStats(*pstats, block, blockUndo, false);
+
     return fClean;
 }
 
-void static FlushBlockFile(bool fFinalize = false)
+/**
+ * Flush the last block and undo files to disk, truncating them first if
+ * fFinalize, after the data queued for them. Unless fSync this is only
+ * queued, as when leaving a file; otherwise it waits for all block and undo
+ * data to be on disk and returns false if writing any of it failed.
+ */
+bool static FlushBlockFile(bool fFinalize = false, bool fSync = true)
 {
-    LOCK(cs_LastBlockFile);
-
-    CDiskBlockPos posOld(nLastBlockFile, 0);
-
-    FILE *fileOld = OpenBlockFile(posOld);
-    if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
-        FileCommit(fileOld);
-        fclose(fileOld);
-    }
-
-    fileOld = OpenUndoFile(posOld);
-    if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
-        FileCommit(fileOld);
-        fclose(fileOld);
+    {
+        LOCK(cs_LastBlockFile);
+        blockFileWriter.Commit(nLastBlockFile, fFinalize, vinfoBlockFile[nLastBlockFile].nSize, vinfoBlockFile[nLastBlockFile].nUndoSize);
     }
+    return !fSync || blockFileWriter.Sync();
 }
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
@@ -2632,6 +3499,338 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/**
+ * Queue for the range proofs PreCheckTransactionForMempool verifies without
+ * cs_main. scriptcheckqueue belongs to whoever holds cs_main, so relayed
+ * transactions get their own queue and threads. Only one caller at a time
+ * may hold a control on it.
+ */
+static CCheckQueue<CCheck> mempoolcheckqueue(128);
+static CCriticalSection cs_mempoolcheckqueue;
+
+void ThreadMempoolCheck() {
+    RenameThread("bitcoin-mempoolch");
+    mempoolcheckqueue.Thread();
+}
+
+bool PreCheckTransactionForMempool(const CTransaction& tx, CValidationState& state)
+{
+    if (!CheckTransaction(tx, state))
+        return false;
+    if (tx.IsCoinBase())
+        return state.DoS(100, false, REJECT_INVALID, "coinbase");
+
+    // Transactions that do not pay the relay fee are turned away or rate
+    // limited by AcceptToMemoryPool before it gets to their range proofs;
+    // don't let them cost us the proofs here either.
+    if (tx.nTxFee < ::minRelayTxFee.GetFee(GetVirtualTransactionSize(tx)))
+        return true;
+
+    // Outputs without a proof may not need one, which depends on the inputs;
+    // leave them to AcceptToMemoryPool. Spread the others over the threads.
+    const uint256 wtxid = tx.GetWitnessHash();
+    std::vector<std::pair<const CTxOutValue*, unsigned int> > vProofs;
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        const CTxOutValue& val = tx.vout[i].nValue;
+        if (!val.IsAmount() && !val.vchRangeproof.empty())
+            vProofs.push_back(std::make_pair(&val, i));
+    }
+    if (vProofs.empty())
+        return true;
+    const size_t nThreads = std::max(nScriptCheckThreads, 1);
+    const size_t nBatchSize = std::min(RANGEPROOF_BATCH_SIZE, (vProofs.size() + nThreads - 1) / nThreads);
+    std::vector<CCheck*> vChecks;
+    std::unique_ptr<CRangeBatchCheck> rangeBatch;
+    for (size_t i = 0; i < vProofs.size(); i++) {
+        if (!rangeBatch)
+            rangeBatch.reset(new CRangeBatchCheck(true));
+        rangeBatch->Add(vProofs[i].first, RangeProofCacheKey(wtxid, vProofs[i].second));
+        if (rangeBatch->size() >= nBatchSize)
+            vChecks.push_back(rangeBatch.release());
+    }
+    if (rangeBatch)
+        vChecks.push_back(rangeBatch.release());
+
+    bool fValid;
+    {
+        LOCK(cs_mempoolcheckqueue);
+        CCheckQueueControl<CCheck> control(&mempoolcheckqueue);
+        control.Add(vChecks);
+        fValid = control.Wait();
+    }
+    // The proofs are part of the witness, which may have been malleated.
+    if (!fValid)
+        return state.DoS(100, false, REJECT_INVALID, "bad-txns-rangeproof", true);
+    return true;
+}
+
+/**
+ * Range proofs of a block that has just been received, handed to the script
+ * check threads before the block is checked and stored, so that they are
+ * verified while ConnectBlock is still looking up its inputs. ConnectBlock
+ * adopts the control when it connects that very block; anyone else who
+ * needs the queue waits for it first. Guarded by cs_main.
+ */
+static std::unique_ptr<CCheckQueueControl<CCheck> > pRangeProofPrecheck;
+static const CBlock* pblockRangeProofPrecheck = NULL;
+//! Which transactions of that block had their range proofs queued
+static std::vector<bool> vRangeProofPrechecked;
+
+/**
+ * Whether pindex is an ancestor of the last checkpoint or of the -assumevalid
+ * block, so that its scripts, range proofs and peg-ins are taken on trust.
+ * Everything else, down to the balance of blinded amounts, is still checked.
+ */
+static bool IsBlockAssumedValid(const CBlockIndex* pindex, const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    if (fCheckpointsEnabled) {
+        CBlockIndex *pindexLastCheckpoint = Checkpoints::GetLastCheckpoint(chainparams.Checkpoints());
+        if (pindexLastCheckpoint && pindexLastCheckpoint->GetAncestor(pindex->nHeight) == pindex)
+            return true;
+    }
+    if (!hashAssumeValid.IsNull()) {
+        BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+        if (it != mapBlockIndex.end() && it->second->GetAncestor(pindex->nHeight) == pindex)
+            return true;
+    }
+    return false;
+}
+
+static void StartRangeProofPrecheck(const CBlock& block, const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    assert(!pRangeProofPrecheck);
+    if (!nScriptCheckThreads)
+        return;
+
+    // Only spend the work on blocks whose header we have accepted and
+    // ConnectBlock will verify in full.
+    BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
+    if (mi == mapBlockIndex.end())
+        return;
+    CBlockIndex* pindex = mi->second;
+    if (pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_FAILED_MASK))
+        return;
+    if (IsBlockAssumedValid(pindex, chainparams))
+        return;
+
+    // The coinbase is verified inline by ConnectBlock, and outputs without a
+    // proof may not need one; leave both to ConnectBlock, as well as the
+    // transactions the mempool has fully validated already.
+    const unsigned int flags = GetBlockScriptFlags(pindex->pprev, chainparams.GetConsensus());
+    const size_t nBatchSize = GetBlockRangeProofBatchSize();
+    std::vector<CCheck*> vChecks;
+    std::unique_ptr<CRangeBatchCheck> rangeBatch;
+    std::vector<bool> vQueued(block.vtx.size(), false);
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        const uint256 wtxid = tx.GetWitnessHash();
+        uint256 entry;
+        ComputeTxValidationCacheEntry(entry, wtxid, flags);
+        if (txValidationCache.contains(entry, false))
+            continue;
+        vQueued[i] = true;
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            const CTxOutValue& val = tx.vout[j].nValue;
+            if (val.IsAmount() || val.vchRangeproof.empty())
+                continue;
+            if (!rangeBatch)
+                rangeBatch.reset(new CRangeBatchCheck(false));
+            rangeBatch->Add(&val, RangeProofCacheKey(wtxid, j));
+            if (rangeBatch->size() >= nBatchSize)
+                vChecks.push_back(rangeBatch.release());
+        }
+    }
+    if (rangeBatch)
+        vChecks.push_back(rangeBatch.release());
+    if (vChecks.empty())
+        return;
+
+    pRangeProofPrecheck.reset(new CCheckQueueControl<CCheck>(&scriptcheckqueue));
+    pRangeProofPrecheck->Add(vChecks);
+    pblockRangeProofPrecheck = &block;
+    vRangeProofPrechecked.swap(vQueued);
+}
+
+/** Wait for and discard a pending range proof precheck. */
+static void FinishRangeProofPrecheck()
+{
+    AssertLockHeld(cs_main);
+    pRangeProofPrecheck.reset();
+    pblockRangeProofPrecheck = NULL;
+    vRangeProofPrechecked.clear();
+}
+
+/**
+ * Verify the range checks CheckInputs put aside, on the script check threads
+ * if there are several and the threads are not busy with the precheck of a
+ * block, which ConnectBlock is going to pick up. Empties vChecks.
+ */
+static bool RunDeferredRangeChecks(std::vector<CCheck*>& vChecks)
+{
+    if (vChecks.size() > 1 && nScriptCheckThreads && !pRangeProofPrecheck) {
+        AssertLockHeld(cs_main);
+        CCheckQueueControl<CCheck> control(&scriptcheckqueue);
+        control.Add(vChecks);
+        vChecks.clear();
+        return control.Wait();
+    }
+    bool fRet = true;
+    BOOST_FOREACH(CCheck* check, vChecks) {
+        fRet = fRet && (*check)();
+        delete check;
+    }
+    vChecks.clear();
+    return fRet;
+}
+
+/**
+ * Return the control ConnectBlock adds the checks of block to. If the range
+ * proofs of this very block are already being verified, that control is
+ * handed over and vRangeProofsQueued tells for which transactions.
+ */
+static CCheckQueueControl<CCheck>* GetBlockCheckQueueControl(const CBlock& block, bool fUseQueue, std::vector<bool>& vRangeProofsQueued)
+{
+    AssertLockHeld(cs_main);
+    vRangeProofsQueued.assign(block.vtx.size(), false);
+    if (pRangeProofPrecheck && pblockRangeProofPrecheck == &block && fUseQueue) {
+        vRangeProofsQueued.swap(vRangeProofPrechecked);
+        pblockRangeProofPrecheck = NULL;
+        vRangeProofPrechecked.clear();
+        return pRangeProofPrecheck.release();
+    }
+    FinishRangeProofPrecheck();
+    return new CCheckQueueControl<CCheck>(fUseQueue ? &scriptcheckqueue : NULL);
+}
+
+/** Closure representing one block header proof check. */
+class CProofCheck : public CCheck
+{
+private:
+    const CBlockHeader* pheader;
+    const Consensus::Params* pparams;
+
+public:
+    CProofCheck(const CBlockHeader& headerIn, const Consensus::Params& paramsIn) : pheader(&headerIn), pparams(&paramsIn) {}
+
+    bool operator()() { return CheckProof(*pheader, *pparams); }
+};
+
+/** Closure checking the proofs of several Schnorr-challenge headers in one batch. */
+class CProofBatchCheck : public CCheck
+{
+private:
+    std::vector<const CBlockHeader*> vHeaders;
+    const Consensus::Params* pparams;
+
+public:
+    CProofBatchCheck(const std::vector<const CBlockHeader*>& vHeadersIn, const Consensus::Params& paramsIn) : vHeaders(vHeadersIn), pparams(&paramsIn) {}
+
+    bool operator()() { return CheckProofs(vHeaders, *pparams); }
+    unsigned int GetCost() const { return vHeaders.size(); }
+};
+
+/**
+ * Verify the proofs of all headers we don't know yet. Headers with a Schnorr
+ * challenge are verified in batches, one per script check thread; the others
+ * are spread over the threads one by one. Returns false if any of them fails, or if a
+ * non-Schnorr header needs checking and there are no script check threads;
+ * the caller then lets AcceptBlockHeader check each one.
+ */
+static bool CheckHeaderProofs(const std::vector<CBlockHeader>& headers, const Consensus::Params& params)
+{
+    AssertLockHeld(cs_main);
+    if (headers.size() < 2)
+        return false;
+
+    std::vector<const CBlockHeader*> vSchnorrHeaders;
+    std::vector<CCheck*> vChecks;
+    vChecks.reserve(headers.size());
+    BOOST_FOREACH(const CBlockHeader& header, headers) {
+        if (mapBlockIndex.count(header.GetHash()))
+            continue;
+        if (IsSchnorrChallenge(header.proof.challenge))
+            vSchnorrHeaders.push_back(&header);
+        else if (nScriptCheckThreads)
+            vChecks.push_back(new CProofCheck(header, params));
+        else
+            return false;
+    }
+    if (!nScriptCheckThreads)
+        return CheckProofs(vSchnorrHeaders, params);
+
+    // One batch per thread, so that a long signed chain still uses them all.
+    const size_t nBatchSize = (vSchnorrHeaders.size() + nScriptCheckThreads - 1) / nScriptCheckThreads;
+    for (size_t i = 0; i < vSchnorrHeaders.size(); i += nBatchSize) {
+        const size_t nEnd = std::min(vSchnorrHeaders.size(), i + nBatchSize);
+        vChecks.push_back(new CProofBatchCheck(std::vector<const CBlockHeader*>(vSchnorrHeaders.begin() + i, vSchnorrHeaders.begin() + nEnd), params));
+    }
+
+    FinishRangeProofPrecheck();
+    CCheckQueueControl<CCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
+/**
+ * Parent chain blocks referred to by peg-ins in blocks we have stored but
+ * not yet connected. ThreadPeginPrefetch asks bitcoind about them ahead of
+ * time, so that by the time ConnectBlock runs the answer is already in the
+ * confirmed parent block cache and no RPC happens under cs_main.
+ */
+static boost::mutex csPeginPrefetch;
+static boost::condition_variable condPeginPrefetch;
+static std::deque<uint256> queuePeginPrefetch;
+static std::set<uint256> setPeginPrefetch;
+
+static void QueuePeginPrefetch(const CBlock& block)
+{
+    std::vector<uint256> vHashes;
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (!txin.scriptSig.IsWithdrawProof())
+                continue;
+            uint256 hash = txin.scriptSig.GetWithdrawBlockHash();
+            if (!hash.IsNull())
+                vHashes.push_back(hash);
+        }
+    }
+    if (vHashes.empty())
+        return;
+
+    {
+        boost::unique_lock<boost::mutex> lock(csPeginPrefetch);
+        BOOST_FOREACH(const uint256& hash, vHashes) {
+            if (queuePeginPrefetch.size() >= MAX_PEGIN_PREFETCH_QUEUE)
+                break;
+            if (setPeginPrefetch.insert(hash).second)
+                queuePeginPrefetch.push_back(hash);
+        }
+    }
+    condPeginPrefetch.notify_one();
+}
+
+void ThreadPeginPrefetch()
+{
+    RenameThread("bitcoin-peginpf");
+    const uint256 genesishash = Params().ParentGenesisBlockHash();
+    while (true) {
+        uint256 hash;
+        {
+            boost::unique_lock<boost::mutex> lock(csPeginPrefetch);
+            while (queuePeginPrefetch.empty())
+                condPeginPrefetch.wait(lock);
+            hash = queuePeginPrefetch.front();
+            queuePeginPrefetch.pop_front();
+            setPeginPrefetch.erase(hash);
+        }
+        // Only the deepest requirement is cached, so ask for that
+        IsConfirmedBitcoinBlock(genesishash, hash, PARENT_BLOCK_CACHE_DEPTH);
+    }
+}
+
 bool BitcoindRPCCheck(const bool init)
 {
     //First, we can clear out any blocks thatsomehow are now deemed valid
@@ -2682,6 +3881,19 @@ bool BitcoindRPCCheck(const bool init)
             // Success
             break;
         }
+
+        // When following the parent tip over ZMQ, nothing can have become
+        // confirmed, or unconfirmed, unless that tip moved since last time.
+        static uint64_t nLastParentChainUpdate = 0;
+        uint64_t nParentChainUpdate = GetParentChainUpdateCount();
+        if (!init && nParentChainUpdate != 0) {
+            if (nParentChainUpdate == nLastParentChainUpdate)
+                return true;
+            nLastParentChainUpdate = nParentChainUpdate;
+        }
+
+        if (!init)
+            RecheckConfirmedParentBlocks();
     }
 
     //Sanity startup check won't reconsider queued blocks
@@ -2731,6 +3943,35 @@ bool BitcoindRPCCheck(const bool init)
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
+unsigned int GetBlockScriptFlags(const CBlockIndex* pindexPrev, const Consensus::Params& consensusparams)
+{
+    AssertLockHeld(cs_main);
+
+    //P2SH is a requirement for segwit + CT
+    unsigned int flags = SCRIPT_VERIFY_P2SH;
+
+    // Start enforcing the DERSIG (BIP66) rule
+    flags |= SCRIPT_VERIFY_DERSIG;
+
+    // Start enforcing CHECKLOCKTIMEVERIFY (BIP65) rule
+    flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+
+    // Start enforcing BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    if (VersionBitsState(pindexPrev, consensusparams, Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE)
+        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+
+    // Start enforcing WITNESS rules using versionbits logic.
+    if (IsWitnessEnabled(pindexPrev, consensusparams)) {
+        flags |= SCRIPT_VERIFY_WITNESS;
+        flags |= SCRIPT_VERIFY_NULLDUMMY;
+    }
+
+    //Enforce WITHDRAWPROOFVERIFY
+    flags |= SCRIPT_VERIFY_WITHDRAW;
+
+    return flags;
+}
+
 int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
 {
     LOCK(cs_main);
@@ -2781,14 +4022,16 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, const CChainParams& chainparams, set<pair<uint256, COutPoint> >* setWithdrawsSpent, bool fJustCheck)
+static bool IsCheckedProposal(const CBlock& block, const CBlockIndex* pindex);
+
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, const CChainParams& chainparams, set<pair<uint256, COutPoint> >* setWithdrawsSpent, bool fJustCheck, CUTXOStats* pstats)
 {
     AssertLockHeld(cs_main);
 
     int64_t nTimeStart = GetTimeMicros();
 
     // Check it again in case a previous version let a bad block in
-    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck))
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck && !IsProofCached(block, pindex), !fJustCheck))
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
 
     // verify that the view's current state corresponds to the previous block
@@ -2803,7 +4046,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             std::vector<std::pair<uint256, CDiskTxPos> > vPos;
             std::multimap<uint256, std::pair<COutPoint, CAmount> > mLocksCreated;
-            const CTransaction& tx = block.vtx[0];
+            const CTransaction& tx = *block.vtx[0];
 
             CTxUndo undoDummy;
             UpdateCoins(tx, view, undoDummy, pindex->nHeight);
@@ -2817,30 +4060,34 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             }
 
             if (fTxIndex)
-                if (!pblocktree->WriteTxIndex(vPos))
+                if (!ptxindexdb->WriteTxIndex(vPos))
                     return AbortNode(state, "Failed to write transaction index");
-            pblocktree->WriteLocksCreated(mLocksCreated);
+            if (pblockfilterdb && !pblockfilterdb->WriteFilter(CBlockFilter(block)))
+                return AbortNode(state, "Failed to write block filter");
+            if (pblockstatsdb && !pblockstatsdb->WriteStats(CBlockStats(block, CBlockUndo(), pindex->nHeight)))
+                return AbortNode(state, "Failed to write block statistics");
+            if (pscriptindexdb && !pscriptindexdb->ConnectBlock(block, CBlockUndo(), pindex->nHeight))
+                return AbortNode(state, "Failed to write script index");
+            if (!UpdateLockedOutputs(mLocksCreated, std::multimap<uint256, std::pair<COutPoint, CAmount> >()))
+                return AbortNode(state, "Failed to write withdraw lock index");
 
             view.SetBestBlock(pindex->GetBlockHash());
+            if (pstats)
+                UpdateUTXOStats(*pstats, block, CBlockUndo(), true);
         }
         return true;
     }
 
     // Check that all non-zero-value coinbase outputs pay to the required destination
-    BOOST_FOREACH(const CTxOut& txout, block.vtx[0].vout) {
+    BOOST_FOREACH(const CTxOut& txout, block.vtx[0]->vout) {
         if (chainparams.CoinbaseDestination() != CScript() && txout.scriptPubKey != chainparams.CoinbaseDestination() && !(txout.nValue.IsAmount() && txout.nValue.GetAmount() == 0))
             return state.DoS(100, error("ConnectBlock(): Coinbase outputs didnt match required scriptPubKey"),
                              REJECT_INVALID, "bad-coinbase-txos");
     }
 
-    bool fScriptChecks = true;
-    if (fCheckpointsEnabled) {
-        CBlockIndex *pindexLastCheckpoint = Checkpoints::GetLastCheckpoint(chainparams.Checkpoints());
-        if (pindexLastCheckpoint && pindexLastCheckpoint->GetAncestor(pindex->nHeight) == pindex) {
-            // This block is an ancestor of a checkpoint: disable script checks
-            fScriptChecks = false;
-        }
-    }
+    // An ancestor of a checkpoint or of the -assumevalid block: skip script
+    // (and with them peg-in confirmation) and range proof checks.
+    bool fScriptChecks = !IsBlockAssumedValid(pindex, chainparams);
 
     int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
     LogPrint("bench", "    - Sanity checks: %.2fms [%.2fs]\n", 0.001 * (nTime1 - nTimeStart), nTimeCheck * 0.000001);
@@ -2872,7 +4119,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     fEnforceBIP30 = fEnforceBIP30 && (!pindexBIP34height || !(pindexBIP34height->GetBlockHash() == chainparams.GetConsensus().BIP34Hash));
 
     if (fEnforceBIP30) {
-        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+            const CTransaction& tx = *ptx;
             const CCoins* coins = view.AccessCoins(tx.GetHash());
             if (coins && !coins->IsPruned())
                 return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
@@ -2880,37 +4128,22 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
-    //P2SH is a requirement for segwit + CT
-    unsigned int flags = SCRIPT_VERIFY_P2SH;
-
-    // Start enforcing the DERSIG (BIP66) rule
-    flags |= SCRIPT_VERIFY_DERSIG;
-
-    // Start enforcing CHECKLOCKTIMEVERIFY (BIP65) rule
-    flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    unsigned int flags = GetBlockScriptFlags(pindex->pprev, chainparams.GetConsensus());
+    const bool fCheckedProposal = !fJustCheck && fScriptChecks && IsCheckedProposal(block, pindex);
 
-    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    // Start enforcing BIP68 (sequence locks) along with BIP112 (CHECKSEQUENCEVERIFY).
     int nLockTimeFlags = 0;
-    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    if (flags & SCRIPT_VERIFY_CHECKSEQUENCEVERIFY)
         nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
-    }
-
-    // Start enforcing WITNESS rules using versionbits logic.
-    if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_WITNESS;
-        flags |= SCRIPT_VERIFY_NULLDUMMY;
-    }
-
-    //Enforce WITHDRAWPROOFVERIFY
-    flags |= SCRIPT_VERIFY_WITHDRAW;
 
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    std::vector<bool> vRangeProofsQueued;
+    std::unique_ptr<CCheckQueueControl<CCheck> > pcontrol(GetBlockCheckQueueControl(block, fScriptChecks && nScriptCheckThreads, vRangeProofsQueued));
+    CCheckQueueControl<CCheck>& control = *pcontrol;
 
     std::vector<uint256> vOrphanErase;
     std::vector<int> prevheights;
@@ -2921,30 +4154,41 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
     std::multimap<uint256, std::pair<COutPoint, CAmount> > mLocksCreated;
+    std::multimap<uint256, std::pair<COutPoint, CAmount> > mLocksSpent;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     std::vector<PrecomputedTransactionData> txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
 
     set<std::pair<uint256, COutPoint> > setWithdrawsSpentDummy;
+    std::unique_ptr<CRangeBatchCheck> rangeBatch;
+    std::unique_ptr<CBalanceBatchCheck> balanceBatch;
+    const size_t nRangeBatchSize = GetBlockRangeProofBatchSize();
+    int64_t nTimeFetch = 0;
 
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
-        const CTransaction &tx = block.vtx[i];
+        const CTransaction &tx = *block.vtx[i];
 
         nInputs += tx.vin.size();
 
         if (!tx.IsCoinBase())
         {
+            int64_t nTimeFetchStart = GetTimeMicros();
             if (!view.HaveInputs(tx))
                 return state.DoS(100, error("ConnectBlock(): inputs missing/spent"),
                                  REJECT_INVALID, "bad-txns-inputs-missingorspent");
+            nTimeFetch += GetTimeMicros() - nTimeFetchStart;
 
             // Check that transaction is BIP68 final
             // BIP68 lock checks (as opposed to nLockTime checks) must
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                const CCoins* coins = view.AccessCoins(tx.vin[j].prevout.hash);
+                prevheights[j] = coins->nHeight;
+                const CTxOut& prevout = coins->vout[tx.vin[j].prevout.n];
+                if (prevout.scriptPubKey.IsWithdrawLock() && prevout.nValue.IsAmount())
+                    mLocksSpent.insert(std::make_pair(prevout.scriptPubKey.GetWithdrawLockGenesisHash(), std::make_pair(tx.vin[j].prevout, prevout.nValue.GetAmount())));
             }
 
             // Which orphan pool entries must we evict?
@@ -2980,11 +4224,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             if (!MoneyRange(nFees))
                 return state.DoS(100, error("ConnectBlock(): total tx fee overflowed"), REJECT_INVALID, "bad-txns-fee-outofrange");
 
+            // The transactions of a proposal we checked are only verified
+            // again where they depend on the parent chain.
+            if (fCheckedProposal)
+                AddToTxValidationCache(tx, view, flags);
+
             std::vector<CCheck*> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
             if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, txdata[i], setWithdrawsSpent == NULL ? setWithdrawsSpentDummy : *setWithdrawsSpent, nScriptCheckThreads ? &vChecks : NULL))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
+            BatchAmountChecks(vChecks, tx.GetHash(), rangeBatch, balanceBatch, fCacheResults, vRangeProofsQueued[i], nRangeBatchSize);
             control.Add(vChecks);
         }
 
@@ -2995,7 +4245,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        pos.nTxOffset += tx.GetTotalSize();
 
         for (unsigned int j = 0; j < tx.vout.size(); j++) {
             CTxOut txout = tx.vout[j];
@@ -3003,13 +4253,24 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 mLocksCreated.insert(std::make_pair(txout.scriptPubKey.GetWithdrawLockGenesisHash(), std::make_pair(COutPoint(tx.GetHash(), j), txout.nValue.GetAmount())));
         }
     }
+    {
+        // Queue the last, partially filled batches of amount checks
+        std::vector<CCheck*> vChecks;
+        if (rangeBatch)
+            vChecks.push_back(rangeBatch.release());
+        if (balanceBatch)
+            vChecks.push_back(balanceBatch.release());
+        control.Add(vChecks);
+    }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
+    if (!fJustCheck)
+        RecordValidationTime(VALIDATION_UTXO_FETCH, nTimeFetch);
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
 
     CAmount blockReward = nFees;
     if (!MoneyRange(blockReward))
         return state.DoS(100, error("ConnectBlock(): total block reward overflowed"), REJECT_INVALID, "bad-blockreward-outofrange");
-    if (!VerifyAmounts(view, block.vtx[0], -blockReward))
+    if (!VerifyAmounts(view, *block.vtx[0], -blockReward, NULL, false, fScriptChecks))
         return state.DoS(100,
                          error("ConnectBlock(): coinbase pays too much (limit=%d)",
                                blockReward),
@@ -3020,6 +4281,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         return state.Invalid(false, REJECT_SCRIPT);
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime4 - nTime2), nInputs <= 1 ? 0 : 0.001 * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * 0.000001);
+    if (fScriptChecks && nScriptCheckThreads) {
+        CCheckQueueStats queueStats = scriptcheckqueue.GetStats();
+        LogPrint("bench", "      - Check queue: %u steals, %.2fms idle\n", queueStats.nSteals, 0.001 * queueStats.nIdleMicros);
+    }
 
     if (fJustCheck)
         return true;
@@ -3029,9 +4294,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     {
         if (pindex->GetUndoPos().IsNull()) {
             CDiskBlockPos pos;
-            if (!FindUndoPos(state, pindex->nFile, pos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40))
+            unsigned int nUndoSize = ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION);
+            if (!FindUndoPos(state, pindex->nFile, pos, nUndoSize + 40))
                 return error("ConnectBlock(): FindUndoPos failed");
-            if (!UndoWriteToDisk(blockundo, pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
+            if (!UndoWriteToDisk(blockundo, nUndoSize, pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
                 return AbortNode(state, "Failed to write undo data");
 
             // update nUndoPos in block index
@@ -3044,21 +4310,34 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
 
     if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
+        if (!ptxindexdb->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
-    pblocktree->WriteLocksCreated(mLocksCreated);
+    if (pblockfilterdb && !pblockfilterdb->WriteFilter(CBlockFilter(block)))
+        return AbortNode(state, "Failed to write block filter");
+
+    if (pblockstatsdb && !pblockstatsdb->WriteStats(CBlockStats(block, blockundo, pindex->nHeight)))
+        return AbortNode(state, "Failed to write block statistics");
+
+    if (pscriptindexdb && !pscriptindexdb->ConnectBlock(block, blockundo, pindex->nHeight))
+        return AbortNode(state, "Failed to write script index");
+
+    if (!UpdateLockedOutputs(mLocksCreated, mLocksSpent))
+        return AbortNode(state, "Failed to write withdraw lock index");
 
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
+    if (pstats)
+        UpdateUTXOStats(*pstats, block, blockundo, true);
 
     int64_t nTime5 = GetTimeMicros(); nTimeIndex += nTime5 - nTime4;
+    RecordValidationTime(VALIDATION_INDEX_WRITE, nTime5 - nTime4);
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime5 - nTime4), nTimeIndex * 0.000001);
 
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
     GetMainSignals().UpdatedTransaction(hashPrevBestCoinBase);
-    hashPrevBestCoinBase = block.vtx[0].GetHash();
+    hashPrevBestCoinBase = block.vtx[0]->GetHash();
 
     // Erase orphan transactions include or precluded by this block
     if (vOrphanErase.size()) {
@@ -3108,6 +4387,20 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             }
         }
     }
+    int nFileRangeproofsPruned = -1;
+    if (fRangeproofPruneMode && fCheckForPruning && !fReindex) {
+        // One file at a time, as each is rewritten; keep checking until below the target.
+        fCheckForPruning = false;
+        int nFile = FindFileToPruneRangeproofs(chainparams.PruneAfterHeight());
+        if (nFile >= 0 && PruneRangeproofsFromFile(nFile, chainparams)) {
+            nFileRangeproofsPruned = nFile;
+            fCheckForPruning = true;
+            if (!fHavePrunedRangeproofs) {
+                pblocktree->WriteFlag("prunedrangeproofs", true);
+                fHavePrunedRangeproofs = true;
+            }
+        }
+    }
     int64_t nNow = GetTimeMicros();
     // Avoid writing/flushing immediately after startup.
     if (nLastWrite == 0) {
@@ -3130,13 +4423,15 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
     // Combine all conditions that result in a full cache flush.
     bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+    int64_t nWriteStart = GetTimeMicros();
     // Write blocks and block index to disk.
-    if (fDoFullFlush || fPeriodicWrite) {
+    if (fDoFullFlush || fPeriodicWrite || nFileRangeproofsPruned >= 0) {
         // Depend on nMinDiskSpace to ensure we can write block index
         if (!CheckDiskSpace(0))
             return state.Error("out of disk space");
         // First make sure all block and undo data is flushed to disk.
-        FlushBlockFile();
+        if (!FlushBlockFile())
+            return AbortNode(state, "Failed to write to block files");
         // Then update all block file information (which may refer to block and undo files).
         {
             std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
@@ -3148,16 +4443,29 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             std::vector<const CBlockIndex*> vBlocks;
             vBlocks.reserve(setDirtyBlockIndex.size());
             for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-                vBlocks.push_back(*it);
+                CBlockIndex* pindex = *it;
+                // The record holding the dropped solution is about to be overwritten.
+                if (pindex->fSolutionDropped) {
+                    CScript solution;
+                    if (!ReadBlockIndexSolution(pindex, solution))
+                        return AbortNode(state, "Failed to read block index database");
+                    pindex->SetProof(CProof(pindex->GetChallenge(), solution));
+                }
+                vBlocks.push_back(pindex);
                 setDirtyBlockIndex.erase(it++);
             }
             if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                 return AbortNode(state, "Files to write to block index database");
             }
+            DropDeepSolutions();
+            std::vector<uint256> vParentBlocks;
+            if (GetConfirmedParentBlocks(vParentBlocks) && !pblocktree->WriteConfirmedParentBlocks(vParentBlocks)) {
+                return AbortNode(state, "Failed to write confirmed parent blocks to block index database");
+            }
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
-            UnlinkPrunedFiles(setFilesToPrune);
+        // The block index now refers to the file without rangeproofs.
+        if (nFileRangeproofsPruned >= 0)
+            FinishPruneRangeproofs(nFileRangeproofsPruned);
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -3170,10 +4478,25 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
+        // It is written in the background; wait for that when shutting
+        // down, or before pruning files the chainstate on disk may need.
+        if (fUTXOStatsValid)
+            pcoinsTip->SetUTXOStats(pcoinsTip->GetBestBlock(), utxoStats);
+        // Initial block download is a bulk load of the chainstate, whose
+        // compactions are tuned for throughput until it is over.
+        if (pcoinsdbview->IsBulkLoad() != IsInitialBlockDownload())
+            pcoinsdbview->SetBulkLoad(!pcoinsdbview->IsBulkLoad(), nDBCompactionRate);
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
+        if ((mode == FLUSH_STATE_ALWAYS || fFlushForPrune) && !pcoinsTip->Sync())
+            return AbortNode(state, "Failed to write to coin database");
         nLastFlush = nNow;
     }
+    if (fDoFullFlush || fPeriodicWrite || nFileRangeproofsPruned >= 0)
+        RecordValidationTime(VALIDATION_FLUSH, GetTimeMicros() - nWriteStart);
+    // Finally remove any pruned files
+    if (fFlushForPrune)
+        UnlinkPrunedFiles(setFilesToPrune);
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
         // Update best block in wallet (so we can detect restored wallets).
         GetMainSignals().SetBestChain(chainActive.GetLocator());
@@ -3197,8 +4520,31 @@ void PruneAndFlush() {
 }
 
 /** Update chainActive and related internal data structures. */
+std::shared_ptr<const CChainSnapshot> GetChainSnapshot()
+{
+    LOCK(cs_chainSnapshot);
+    return chainSnapshot;
+}
+
+/** Make the current chainActive what GetChainSnapshot returns, after each change to it. */
+static void PublishChainSnapshot()
+{
+    // Only those changing chainActive replace it, so the copy can be made outside cs_chainSnapshot.
+    std::shared_ptr<const CChainSnapshot> snapshot = std::make_shared<const CChainSnapshot>(chainActive, GetChainSnapshot().get());
+    LOCK(cs_chainSnapshot);
+    chainSnapshot = snapshot;
+}
+
+CBlockIndex* LookupBlockIndex(const uint256& hash)
+{
+    boost::shared_lock<boost::shared_mutex> lock(csBlockIndexWrite);
+    BlockMap::const_iterator it = mapBlockIndex.find(hash);
+    return it == mapBlockIndex.end() ? NULL : it->second;
+}
+
 void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
     chainActive.SetTip(pindexNew);
+    PublishChainSnapshot();
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -3258,8 +4604,91 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
 
 }
 
-/** Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and manually re-limit mempool size after this, with cs_main held. */
-bool static DisconnectTip(CValidationState& state, const CChainParams& chainparams, bool fBare = false)
+/**
+ * Verify the range proofs of transactions about to be put back into the
+ * mempool on the script check threads, so that AcceptToMemoryPool finds them
+ * in the range proof cache instead of checking them one transaction at a
+ * time. Invalid proofs are left for AcceptToMemoryPool to reject.
+ */
+static void PreCheckRangeProofsForMempool(const std::vector<const CTransaction*>& vtx)
+{
+    AssertLockHeld(cs_main);
+    if (!nScriptCheckThreads)
+        return;
+
+    std::vector<CCheck*> vChecks;
+    std::unique_ptr<CRangeBatchCheck> rangeBatch;
+    BOOST_FOREACH(const CTransaction* ptx, vtx) {
+        if (ptx->IsCoinBase())
+            continue;
+        const uint256 wtxid = ptx->GetWitnessHash();
+        for (unsigned int j = 0; j < ptx->vout.size(); j++) {
+            const CTxOutValue& val = ptx->vout[j].nValue;
+            if (val.IsAmount() || val.vchRangeproof.empty())
+                continue;
+            if (!rangeBatch)
+                rangeBatch.reset(new CRangeBatchCheck(true));
+            rangeBatch->Add(&val, RangeProofCacheKey(wtxid, j));
+            if (rangeBatch->size() >= RANGEPROOF_BATCH_SIZE)
+                vChecks.push_back(rangeBatch.release());
+        }
+    }
+    if (rangeBatch)
+        vChecks.push_back(rangeBatch.release());
+    if (vChecks.empty())
+        return;
+
+    FinishRangeProofPrecheck();
+    CCheckQueueControl<CCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
+/**
+ * Return the transactions of the blocks a reorg disconnected to the mempool
+ * once the new chain is connected. disconnected holds them oldest block
+ * first, so parents go in before their children. Transactions the new chain
+ * confirmed are skipped, and ones that do not go back in are removed with
+ * their descendants. Call with cs_main held, and follow up with
+ * mempool.removeForReorg and a mempool size limit.
+ */
+static void UpdateMempoolForReorg(std::deque<CTransactionRef>& disconnected)
+{
+    AssertLockHeld(cs_main);
+    std::vector<const CTransaction*> vtx;
+    vtx.reserve(disconnected.size());
+    BOOST_FOREACH(const CTransactionRef& ptx, disconnected) {
+        if (!pcoinsTip->HaveCoins(ptx->GetHash()))
+            vtx.push_back(ptx.get());
+    }
+    PreCheckRangeProofsForMempool(vtx);
+
+    std::vector<uint256> vHashUpdate;
+    BOOST_FOREACH(const CTransaction* ptx, vtx) {
+        // ignore validation errors in resurrected transactions
+        list<CTransaction> removed;
+        CValidationState stateDummy;
+        if (ptx->IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, *ptx, false, NULL, true)) {
+            mempool.removeRecursive(*ptx, removed);
+        } else if (mempool.exists(ptx->GetHash())) {
+            vHashUpdate.push_back(ptx->GetHash());
+        }
+    }
+    // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
+    // no in-mempool children, which is generally not true when adding
+    // previously-confirmed transactions back to the mempool.
+    // UpdateTransactionsFromBlock finds descendants of any transactions in these
+    // blocks that were added back and cleans up the mempool state.
+    mempool.UpdateTransactionsFromBlock(vHashUpdate);
+    disconnected.clear();
+}
+
+/**
+ * Disconnect chainActive's tip. Unless pdisconnected is NULL, the block's
+ * transactions are added to its front, for UpdateMempoolForReorg to put back
+ * into the mempool.
+ */
+bool static DisconnectTip(CValidationState& state, const CChainParams& chainparams, std::deque<CTransactionRef>* pdisconnected)
 {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
@@ -3271,7 +4700,7 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, fUTXOStatsValid ? &utxoStats : NULL))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
     }
@@ -3280,33 +4709,15 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
 
-    if (!fBare) {
-        // Resurrect mempool transactions from the disconnected block.
-        std::vector<uint256> vHashUpdate;
-        BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-            // ignore validation errors in resurrected transactions
-            list<CTransaction> removed;
-            CValidationState stateDummy;
-            if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL, true)) {
-                mempool.removeRecursive(tx, removed);
-            } else if (mempool.exists(tx.GetHash())) {
-                vHashUpdate.push_back(tx.GetHash());
-            }
-        }
-        // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
-        // no in-mempool children, which is generally not true when adding
-        // previously-confirmed transactions back to the mempool.
-        // UpdateTransactionsFromBlock finds descendants of any transactions in this
-        // block that were added back and cleans up the mempool state.
-        mempool.UpdateTransactionsFromBlock(vHashUpdate);
-    }
+    if (pdisconnected)
+        pdisconnected->insert(pdisconnected->begin(), block.vtx.begin(), block.vtx.end());
 
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev, chainparams);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-        SyncWithWallets(tx, pindexDelete->pprev, NULL);
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        SyncWithWallets(*ptx, pindexDelete->pprev, NULL);
     }
     return true;
 }
@@ -3339,7 +4750,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     set<pair<uint256, COutPoint> > setWithdrawsSpent;
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams, &setWithdrawsSpent);
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams, &setWithdrawsSpent, false, fUTXOStatsValid ? &utxoStats : NULL);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid()) {
@@ -3369,6 +4780,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         }
         mapBlockSource.erase(pindexNew->GetBlockHash());
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
+        RecordValidationTime(VALIDATION_CONNECT_BLOCK, nTime3 - nTime2);
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
     }
@@ -3390,8 +4802,8 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         SyncWithWallets(tx, pindexNew, NULL);
     }
     // ... and about transactions that got confirmed:
-    BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
-        SyncWithWallets(tx, pindexNew, pblock);
+    BOOST_FOREACH(const CTransactionRef& ptx, pblock->vtx) {
+        SyncWithWallets(*ptx, pindexNew, pblock);
     }
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
@@ -3428,7 +4840,8 @@ static CBlockIndex* FindMostWorkChain() {
             // for the most work chain if we come across them; we can't switch
             // to a chain unless we have all the non-active-chain parent blocks.
             bool fFailedChain = pindexTest->nStatus & BLOCK_FAILED_MASK;
-            bool fMissingData = !(pindexTest->nStatus & BLOCK_HAVE_DATA);
+            // Blocks without their rangeproofs cannot be connected again either.
+            bool fMissingData = !(pindexTest->nStatus & BLOCK_HAVE_DATA) || (pindexTest->nStatus & BLOCK_RANGEPROOFS_PRUNED);
             if (fFailedChain || fMissingData) {
                 // Candidate chain is not usable (either invalid or missing data)
                 if (fFailedChain && (pindexBestInvalid == NULL || pindexNew->nChainWork > pindexBestInvalid->nChainWork))
@@ -3480,11 +4893,15 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
     const CBlockIndex *pindexOldTip = chainActive.Tip();
     const CBlockIndex *pindexFork = chainActive.FindFork(pindexMostWork);
 
-    // Disconnect active blocks which are no longer in the best chain.
+    // Disconnect active blocks which are no longer in the best chain. Their
+    // transactions go back into the mempool once the new blocks are connected.
     bool fBlocksDisconnected = false;
+    std::deque<CTransactionRef> disconnected;
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-        if (!DisconnectTip(state, chainparams))
+        if (!DisconnectTip(state, chainparams, &disconnected)) {
+            UpdateMempoolForReorg(disconnected);
             return false;
+        }
         fBlocksDisconnected = true;
     }
 
@@ -3518,6 +4935,7 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
                     break;
                 } else {
                     // A system error occurred (disk space, database error, ...).
+                    UpdateMempoolForReorg(disconnected);
                     return false;
                 }
             } else {
@@ -3532,6 +4950,7 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
     }
 
     if (fBlocksDisconnected) {
+        UpdateMempoolForReorg(disconnected);
         mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
         LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
     }
@@ -3581,6 +5000,9 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
         if (ShutdownRequested())
             break;
 
+        // Every transaction connected is queued for the wallet.
+        LimitValidationQueue();
+
         const CBlockIndex *pindexFork;
         bool fInitialDownload;
         int nNewHeight;
@@ -3668,6 +5090,7 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
     setDirtyBlockIndex.insert(pindex);
     setBlockIndexCandidates.erase(pindex);
 
+    std::deque<CTransactionRef> disconnected;
     while (chainActive.Contains(pindex)) {
         CBlockIndex *pindexWalk = chainActive.Tip();
         pindexWalk->nStatus |= BLOCK_FAILED_CHILD;
@@ -3675,11 +5098,13 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
         setBlockIndexCandidates.erase(pindexWalk);
         // ActivateBestChain considers blocks already in chainActive
         // unconditionally valid already, so force disconnect away from it.
-        if (!DisconnectTip(state, chainparams)) {
+        if (!DisconnectTip(state, chainparams, &disconnected)) {
+            UpdateMempoolForReorg(disconnected);
             mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
             return false;
         }
     }
+    UpdateMempoolForReorg(disconnected);
 
     LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
 
@@ -3739,6 +5164,7 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     if (it != mapBlockIndex.end())
         return it->second;
 
+    boost::unique_lock<boost::shared_mutex> lock(csBlockIndexWrite);
     // Construct new block index object
     CBlockIndex* pindexNew = new CBlockIndex(block);
     assert(pindexNew);
@@ -3766,6 +5192,34 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
 }
 
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
+/** Set nChainTx of pindexNew, whose parents all have it set, and of the descendants that were waiting for it. */
+static void LinkReceivedBlocks(CBlockIndex *pindexNew)
+{
+    deque<CBlockIndex*> queue;
+    queue.push_back(pindexNew);
+
+    // Recursively process any descendant blocks that now may be eligible to be connected.
+    while (!queue.empty()) {
+        CBlockIndex *pindex = queue.front();
+        queue.pop_front();
+        pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
+        {
+            LOCK(cs_nBlockSequenceId);
+            pindex->nSequenceId = nBlockSequenceId++;
+        }
+        if (chainActive.Tip() == NULL || !setBlockIndexCandidates.value_comp()(pindex, chainActive.Tip())) {
+            setBlockIndexCandidates.insert(pindex);
+        }
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
+        while (range.first != range.second) {
+            std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
+            queue.push_back(it->second);
+            range.first++;
+            mapBlocksUnlinked.erase(it);
+        }
+    }
+}
+
 bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBlockIndex *pindexNew, const CDiskBlockPos& pos)
 {
     pindexNew->nTx = block.vtx.size();
@@ -3782,29 +5236,7 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBl
 
     if (pindexNew->pprev == NULL || pindexNew->pprev->nChainTx) {
         // If pindexNew is the genesis block or all parents are BLOCK_VALID_TRANSACTIONS.
-        deque<CBlockIndex*> queue;
-        queue.push_back(pindexNew);
-
-        // Recursively process any descendant blocks that now may be eligible to be connected.
-        while (!queue.empty()) {
-            CBlockIndex *pindex = queue.front();
-            queue.pop_front();
-            pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
-            {
-                LOCK(cs_nBlockSequenceId);
-                pindex->nSequenceId = nBlockSequenceId++;
-            }
-            if (chainActive.Tip() == NULL || !setBlockIndexCandidates.value_comp()(pindex, chainActive.Tip())) {
-                setBlockIndexCandidates.insert(pindex);
-            }
-            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
-            while (range.first != range.second) {
-                std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
-                queue.push_back(it->second);
-                range.first++;
-                mapBlocksUnlinked.erase(it);
-            }
-        }
+        LinkReceivedBlocks(pindexNew);
     } else {
         if (pindexNew->pprev && pindexNew->pprev->IsValid(BLOCK_VALID_TREE)) {
             mapBlocksUnlinked.insert(std::make_pair(pindexNew->pprev, pindexNew));
@@ -3838,7 +5270,7 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         if (!fKnown) {
             LogPrintf("Leaving block file %i: %s\n", nLastBlockFile, vinfoBlockFile[nLastBlockFile].ToString());
         }
-        FlushBlockFile(!fKnown);
+        FlushBlockFile(!fKnown, false);
         nLastBlockFile = nFile;
     }
 
@@ -3852,7 +5284,7 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         unsigned int nOldChunks = (pos.nPos + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         unsigned int nNewChunks = (vinfoBlockFile[nFile].nSize + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         if (nNewChunks > nOldChunks) {
-            if (fPruneMode)
+            if (fPruneMode || fRangeproofPruneMode)
                 fCheckForPruning = true;
             if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
                 FILE *file = OpenBlockFile(pos);
@@ -3885,7 +5317,7 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     unsigned int nOldChunks = (pos.nPos + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     unsigned int nNewChunks = (nNewSize + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     if (nNewChunks > nOldChunks) {
-        if (fPruneMode)
+        if (fPruneMode || fRangeproofPruneMode)
             fCheckForPruning = true;
         if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
             FILE *file = OpenUndoFile(pos);
@@ -3917,7 +5349,51 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
+/** Closure running CheckTransaction over a range of a block's transactions. */
+class CTransactionsCheck : public CCheck
+{
+private:
+    const CBlock* pblock;
+    size_t nBegin;
+    size_t nEnd;
+
+public:
+    CTransactionsCheck(const CBlock& blockIn, size_t nBeginIn, size_t nEndIn) : pblock(&blockIn), nBegin(nBeginIn), nEnd(nEndIn) {}
+
+    bool operator()()
+    {
+        for (size_t i = nBegin; i < nEnd; i++) {
+            CValidationState state;
+            if (!CheckTransaction(*pblock->vtx[i], state))
+                return false;
+        }
+        return true;
+    }
+};
+
+/**
+ * Run CheckTransaction over all of block's transactions, one batch per script
+ * check thread. Returns false if any of them fails, or if there are no
+ * threads to use; the caller then checks them one by one.
+ */
+static bool CheckTransactionsOnQueue(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (!nScriptCheckThreads || block.vtx.size() < 2 * (size_t)nScriptCheckThreads)
+        return false;
+
+    std::vector<CCheck*> vChecks;
+    const size_t nBatchSize = (block.vtx.size() + nScriptCheckThreads - 1) / nScriptCheckThreads;
+    for (size_t i = 0; i < block.vtx.size(); i += nBatchSize)
+        vChecks.push_back(new CTransactionsCheck(block, i, std::min(block.vtx.size(), i + nBatchSize)));
+
+    FinishRangeProofPrecheck();
+    CCheckQueueControl<CCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot, bool fUseQueue)
 {
     // These are checks that are independent of context.
 
@@ -3950,26 +5426,29 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     // checks that use witness data may be performed here.
 
     // Size limits
-    if (block.vtx.empty() || block.vtx.size() > MAX_BLOCK_BASE_SIZE || ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) > MAX_BLOCK_BASE_SIZE)
+    if (block.vtx.empty() || block.vtx.size() > MAX_BLOCK_BASE_SIZE || GetBlockStrippedSize(block) > MAX_BLOCK_BASE_SIZE)
         return state.DoS(100, false, REJECT_INVALID, "bad-blk-length", false, "size limits failed");
 
     // First transaction must be coinbase, the rest must not be
-    if (block.vtx.empty() || !block.vtx[0].IsCoinBase())
+    if (block.vtx.empty() || !block.vtx[0]->IsCoinBase())
         return state.DoS(100, false, REJECT_INVALID, "bad-cb-missing", false, "first tx is not coinbase");
     for (unsigned int i = 1; i < block.vtx.size(); i++)
-        if (block.vtx[i].IsCoinBase())
+        if (block.vtx[i]->IsCoinBase())
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-multiple", false, "more than one coinbase");
 
-    // Check transactions
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state))
-            return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
-                                 strprintf("Transaction check failed (tx hash %s) %s", tx.GetHash().ToString(), state.GetDebugMessage()));
+    // Check transactions. If they were checked on the queue and one failed,
+    // they are checked again in order to tell which.
+    if (!fUseQueue || !CheckTransactionsOnQueue(block)) {
+        BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
+            if (!CheckTransaction(*ptx, state))
+                return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
+                                     strprintf("Transaction check failed (tx hash %s) %s", ptx->GetHash().ToString(), state.GetDebugMessage()));
+    }
 
     unsigned int nSigOps = 0;
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
     {
-        nSigOps += GetLegacySigOpCount(tx);
+        nSigOps += GetLegacySigOpCount(*ptx);
     }
     if (nSigOps * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
         return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, "out-of-bounds SigOpCount");
@@ -4005,8 +5484,8 @@ bool IsWitnessEnabled(const CBlockIndex* pindexPrev, const Consensus::Params& pa
 static int GetWitnessCommitmentIndex(const CBlock& block)
 {
     int commitpos = -1;
-    for (size_t o = 0; o < block.vtx[0].vout.size(); o++) {
-        if (block.vtx[0].vout[o].scriptPubKey.size() >= 38 && block.vtx[0].vout[o].scriptPubKey[0] == OP_RETURN && block.vtx[0].vout[o].scriptPubKey[1] == 0x24 && block.vtx[0].vout[o].scriptPubKey[2] == 0xaa && block.vtx[0].vout[o].scriptPubKey[3] == 0x21 && block.vtx[0].vout[o].scriptPubKey[4] == 0xa9 && block.vtx[0].vout[o].scriptPubKey[5] == 0xed) {
+    for (size_t o = 0; o < block.vtx[0]->vout.size(); o++) {
+        if (block.vtx[0]->vout[o].scriptPubKey.size() >= 38 && block.vtx[0]->vout[o].scriptPubKey[0] == OP_RETURN && block.vtx[0]->vout[o].scriptPubKey[1] == 0x24 && block.vtx[0]->vout[o].scriptPubKey[2] == 0xaa && block.vtx[0]->vout[o].scriptPubKey[3] == 0x21 && block.vtx[0]->vout[o].scriptPubKey[4] == 0xa9 && block.vtx[0]->vout[o].scriptPubKey[5] == 0xed) {
             commitpos = o;
         }
     }
@@ -4017,25 +5496,27 @@ void UpdateUncommittedBlockStructures(CBlock& block, const CBlockIndex* pindexPr
 {
     int commitpos = GetWitnessCommitmentIndex(block);
     static const std::vector<unsigned char> nonce(32, 0x00);
-    if (commitpos != -1 && IsWitnessEnabled(pindexPrev, consensusParams) && block.vtx[0].wit.IsEmpty()) {
-        block.vtx[0].wit.vtxinwit.resize(1);
-        block.vtx[0].wit.vtxinwit[0].scriptWitness.stack.resize(1);
-        block.vtx[0].wit.vtxinwit[0].scriptWitness.stack[0] = nonce;
+    if (commitpos != -1 && IsWitnessEnabled(pindexPrev, consensusParams) && block.vtx[0]->wit.IsEmpty()) {
+        CMutableTransaction tx(*block.vtx[0]);
+        tx.wit.vtxinwit.resize(1);
+        tx.wit.vtxinwit[0].scriptWitness.stack.resize(1);
+        tx.wit.vtxinwit[0].scriptWitness.stack[0] = nonce;
+        block.vtx[0] = MakeTransactionRef(std::move(tx));
     }
 }
 
-std::vector<unsigned char> GenerateCoinbaseCommitment(CBlock& block, const CBlockIndex* pindexPrev, const Consensus::Params& consensusParams)
+std::vector<unsigned char> GenerateCoinbaseCommitment(CBlock& block, const CBlockIndex* pindexPrev, const Consensus::Params& consensusParams, const uint256* pwitnessroot)
 {
     std::vector<unsigned char> commitment;
     int commitpos = GetWitnessCommitmentIndex(block);
     bool fHaveWitness = false;
     for (size_t t = 1; t < block.vtx.size(); t++) {
-        if (!block.vtx[t].wit.IsNull()) {
+        if (!block.vtx[t]->wit.IsNull()) {
             fHaveWitness = true;
             break;
         }
-        for (size_t o = 0; o < block.vtx[t].vout.size(); o++) {
-            if (!CTxOutWitnessSerializer(REF(block.vtx[t].vout[o])).IsNull()) {
+        for (size_t o = 0; o < block.vtx[t]->vout.size(); o++) {
+            if (!CTxOutWitnessSerializer(REF(block.vtx[t]->vout[o])).IsNull()) {
                 fHaveWitness = true;
                 break;
             }
@@ -4044,7 +5525,7 @@ std::vector<unsigned char> GenerateCoinbaseCommitment(CBlock& block, const CBloc
     std::vector<unsigned char> ret(32, 0x00);
     if (fHaveWitness && IsWitnessEnabled(pindexPrev, consensusParams)) {
         if (commitpos == -1) {
-            uint256 witnessroot = BlockWitnessMerkleRoot(block, NULL);
+            uint256 witnessroot = pwitnessroot ? *pwitnessroot : BlockWitnessMerkleRoot(block, NULL);
             CHash256().Write(witnessroot.begin(), 32).Write(&ret[0], 32).Finalize(witnessroot.begin());
             CTxOut out;
             out.nValue = 0;
@@ -4057,8 +5538,9 @@ std::vector<unsigned char> GenerateCoinbaseCommitment(CBlock& block, const CBloc
             out.scriptPubKey[5] = 0xed;
             memcpy(&out.scriptPubKey[6], witnessroot.begin(), 32);
             commitment = std::vector<unsigned char>(out.scriptPubKey.begin(), out.scriptPubKey.end());
-            const_cast<std::vector<CTxOut>*>(&block.vtx[0].vout)->push_back(out);
-            block.vtx[0].UpdateHash();
+            CMutableTransaction tx(*block.vtx[0]);
+            tx.vout.push_back(out);
+            block.vtx[0] = MakeTransactionRef(std::move(tx));
         }
     }
     UpdateUncommittedBlockStructures(block, pindexPrev, consensusParams);
@@ -4108,7 +5590,8 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
                               : block.GetBlockTime();
 
     // Check that all transactions are finalized
-    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
         if (!IsFinalTx(tx, nHeight, nLockTimeCutoff)) {
             return state.DoS(10, false, REJECT_INVALID, "bad-txns-nonfinal", false, "non-final transaction");
         }
@@ -4118,8 +5601,8 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     if (block.nVersion >= 2)
     {
         CScript expect = CScript() << nHeight;
-        if (block.vtx[0].vin[0].scriptSig.size() < expect.size() ||
-            !std::equal(expect.begin(), expect.end(), block.vtx[0].vin[0].scriptSig.begin())) {
+        if (block.vtx[0]->vin[0].scriptSig.size() < expect.size() ||
+            !std::equal(expect.begin(), expect.end(), block.vtx[0]->vin[0].scriptSig.begin())) {
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-height", false, "block height mismatch in coinbase");
         }
     }
@@ -4141,11 +5624,11 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
             // The malleation check is ignored; as the transaction tree itself
             // already does not permit it, it is impossible to trigger in the
             // witness tree.
-            if (block.vtx[0].wit.vtxinwit.size() != 1 || block.vtx[0].wit.vtxinwit[0].scriptWitness.stack.size() != 1 || block.vtx[0].wit.vtxinwit[0].scriptWitness.stack[0].size() != 32) {
+            if (block.vtx[0]->wit.vtxinwit.size() != 1 || block.vtx[0]->wit.vtxinwit[0].scriptWitness.stack.size() != 1 || block.vtx[0]->wit.vtxinwit[0].scriptWitness.stack[0].size() != 32) {
                 return state.DoS(100, error("%s : invalid witness nonce size", __func__), REJECT_INVALID, "bad-witness-nonce-size", true);
             }
-            CHash256().Write(hashWitness.begin(), 32).Write(&block.vtx[0].wit.vtxinwit[0].scriptWitness.stack[0][0], 32).Finalize(hashWitness.begin());
-            if (memcmp(hashWitness.begin(), &block.vtx[0].vout[commitpos].scriptPubKey[6], 32)) {
+            CHash256().Write(hashWitness.begin(), 32).Write(&block.vtx[0]->wit.vtxinwit[0].scriptWitness.stack[0][0], 32).Finalize(hashWitness.begin());
+            if (memcmp(hashWitness.begin(), &block.vtx[0]->vout[commitpos].scriptPubKey[6], 32)) {
                 return state.DoS(100, error("%s : witness merkle commitment mismatch", __func__), REJECT_INVALID, "bad-witness-merkle-match", true);
             }
             fHaveWitness = true;
@@ -4155,11 +5638,11 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     // No witness data is allowed in blocks that don't commit to witness data, as this would otherwise leave room for spam
     if (!fHaveWitness) {
         for (size_t i = 0; i < block.vtx.size(); i++) {
-            if (!block.vtx[i].wit.IsNull()) {
+            if (!block.vtx[i]->wit.IsNull()) {
                 return state.DoS(100, error("%s : unexpected witness data found", __func__), REJECT_INVALID, "unexpected-witness", true);
             }
-            for (size_t o = 0; o < block.vtx[i].vout.size(); o++) {
-                if (!CTxOutWitnessSerializer(REF(block.vtx[i].vout[o])).IsNull()) {
+            for (size_t o = 0; o < block.vtx[i]->vout.size(); o++) {
+                if (!CTxOutWitnessSerializer(REF(block.vtx[i]->vout[o])).IsNull()) {
                     return state.DoS(100, false, REJECT_INVALID, "unexpected-witness", true, strprintf("%s : unexpected output witness data found", __func__));
                 }
             }
@@ -4179,7 +5662,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, bool fProofChecked=false)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -4198,7 +5681,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), !fProofChecked))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -4217,8 +5700,14 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
         if (!ContextualCheckBlockHeader(block, state, chainparams.GetConsensus(), pindexPrev, GetAdjustedTime()))
             return error("%s: Consensus::ContextualCheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
     }
-    if (pindex == NULL)
+    if (pindex == NULL) {
         pindex = AddToBlockIndex(block);
+        // The proof has been checked above, remember that across restarts
+        if (!(pindex->nStatus & BLOCK_PROOF_VALID)) {
+            pindex->nStatus |= BLOCK_PROOF_VALID;
+            setDirtyBlockIndex.insert(pindex);
+        }
+    }
 
     if (ppindex)
         *ppindex = pindex;
@@ -4242,7 +5731,8 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
         return false;
     }
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    // A block that passed CheckBlock has had its proof checked too.
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, block.fChecked))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -4267,7 +5757,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     }
     if (fNewBlock) *fNewBlock = true;
 
-    if ((!CheckBlock(block, state, chainparams.GetConsensus(), GetAdjustedTime())) || !ContextualCheckBlock(block, state, pindex->pprev)) {
+    if ((!CheckBlock(block, state, chainparams.GetConsensus(), !IsProofCached(block, pindex))) || !ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -4279,7 +5769,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        unsigned int nBlockSize = GetBlockTotalSize(block);
         CDiskBlockPos blockPos;
         if (dbp != NULL)
             blockPos = *dbp;
@@ -4297,14 +5787,37 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     if (fCheckForPruning)
         FlushStateToDisk(state, FLUSH_STATE_NONE); // we just allocated more disk space for block files
 
+    if (GetBoolArg("-validatepegin", false) && !IsBlockAssumedValid(pindex, chainparams))
+        QueuePeginPrefetch(block);
+
     return true;
 }
 
+/** Start loading the coins spent by a block that is about to be connected on top of the tip. */
+static void PrefetchBlockInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    std::set<uint256> setCreated;
+    std::vector<uint256> vTxids;
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
+        setCreated.insert(tx.GetHash());
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            const uint256& txid = txin.prevout.hash;
+            if (!setCreated.count(txid) && !pcoinsTip->HaveCoinsInCache(txid))
+                vTxids.push_back(txid);
+        }
+    }
+    pcoinsPrefetch->Prefetch(vTxids);
+}
+
 bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, CNode* pfrom, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp)
 {
     {
         LOCK(cs_main);
-        bool fRequested = MarkBlockAsReceived(pblock->GetHash());
+        bool fRequested = MarkBlockAsReceived(pblock->GetHash(), pfrom ? pfrom->GetId() : -1);
         fRequested |= fForceProcessing;
 
         // Store to disk
@@ -4314,10 +5827,16 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, C
         if (pindex && pfrom) {
             mapBlockSource[pindex->GetBlockHash()] = pfrom->GetId();
             if (fNewBlock) pfrom->nLastBlockTime = GetTime();
+            // The first peer to deliver the next block is likely to be the
+            // fastest next time too, so have it announce with compact blocks.
+            if (fLowLatencyFetch && fNewBlock && pindex->pprev == chainActive.Tip() && CanDirectFetch(chainparams.GetConsensus()))
+                MaybeSetPeerAsAnnouncingHeaderAndIDs(State(pfrom->GetId()), pfrom);
         }
         CheckBlockIndex(chainparams.GetConsensus());
         if (!ret)
             return error("%s: AcceptBlock FAILED", __func__);
+        if (pcoinsPrefetch && pindex && pindex->pprev == chainActive.Tip())
+            PrefetchBlockInputs(*pblock);
     }
 
     NotifyHeaderTip();
@@ -4347,6 +5866,9 @@ bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams,
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
     if (!ContextualCheckBlock(block, state, pindexPrev))
         return error("%s: Consensus::ContextualCheckBlock: %s", __func__, FormatStateMessage(state));
+    // Templates are mostly built from the mempool; trust its per-transaction
+    // checks so only the block level rules are evaluated for those.
+    RefreshTxValidationCache(block, mempool, GetBlockScriptFlags(pindexPrev, chainparams.GetConsensus()));
     if (!ConnectBlock(block, state, &indexDummy, viewNew, chainparams, NULL, true))
         return false;
     assert(state.IsValid());
@@ -4354,6 +5876,195 @@ bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams,
     return true;
 }
 
+namespace {
+
+/** A block proposal being signed by the federation */
+struct CSigningRound
+{
+    //! The proposal, with the signatures combined so far as its solution; null until we see it
+    std::shared_ptr<CBlock> pblock;
+    //! The verdict of TestBlockValidity on the proposal
+    CValidationState state;
+    //! Signatures that arrived before the proposal did, with the peer that sent each
+    std::vector<std::pair<CScript, NodeId> > vEarlySigs;
+    int64_t nTimeCreated;
+    bool fSubmitted;
+
+    CSigningRound() : nTimeCreated(GetTime()), fSubmitted(false) {}
+};
+
+/** Block proposals being signed, by block hash. Protected by cs_main. */
+std::map<uint256, CSigningRound> mapSigningRounds;
+
+/**
+ * Forget the proposals that no longer build on our tip, and then the oldest
+ * rounds beyond MAX_SIGNING_ROUNDS, those we only have signatures for first.
+ */
+void TrimSigningRounds(const uint256& hashKeep)
+{
+    AssertLockHeld(cs_main);
+    const uint256 hashTip = chainActive.Tip()->GetBlockHash();
+    std::map<uint256, CSigningRound>::iterator it = mapSigningRounds.begin();
+    while (it != mapSigningRounds.end()) {
+        if (it->second.pblock && it->second.pblock->hashPrevBlock != hashTip)
+            mapSigningRounds.erase(it++);
+        else
+            ++it;
+    }
+    while (mapSigningRounds.size() > MAX_SIGNING_ROUNDS) {
+        std::map<uint256, CSigningRound>::iterator itEvict = mapSigningRounds.end();
+        for (it = mapSigningRounds.begin(); it != mapSigningRounds.end(); ++it) {
+            if (it->first == hashKeep)
+                continue;
+            if (itEvict == mapSigningRounds.end() ||
+                    std::make_pair(!!it->second.pblock, it->second.nTimeCreated) < std::make_pair(!!itEvict->second.pblock, itEvict->second.nTimeCreated))
+                itEvict = it;
+        }
+        if (itEvict == mapSigningRounds.end())
+            break;
+        mapSigningRounds.erase(itEvict);
+    }
+}
+
+/** Signatures on proposals we have not seen yet that nodeid sent us */
+unsigned int CountEarlyBlockSigs(NodeId nodeid)
+{
+    AssertLockHeld(cs_main);
+    unsigned int nCount = 0;
+    for (std::map<uint256, CSigningRound>::const_iterator it = mapSigningRounds.begin(); it != mapSigningRounds.end(); ++it) {
+        for (size_t i = 0; i < it->second.vEarlySigs.size(); i++)
+            nCount += it->second.vEarlySigs[i].second == nodeid;
+    }
+    return nCount;
+}
+
+/** Whether scriptSig holds a signature on block that the challenge accepts */
+bool HasValidBlockSignature(const CBlock& block, const CScript& scriptSig)
+{
+    const std::vector<CScript> vNone(1, CScript());
+    return CombineBlockSignatures(block, CScript(), scriptSig) != CombineBlockSignatures(block, vNone);
+}
+
+} // anon namespace
+
+bool TestProposedBlock(CValidationState& state, const CChainParams& chainparams, const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    CBlockIndex* const pindexPrev = chainActive.Tip();
+    // TestBlockValidity only supports blocks built on the current Tip
+    if (block.hashPrevBlock != pindexPrev->GetBlockHash())
+        return state.Invalid(false, REJECT_INVALID, "proposal was not based on our best chain");
+
+    const uint256 hash = block.GetHash();
+    CSigningRound& round = mapSigningRounds[hash];
+    if (!round.pblock) {
+        TestBlockValidity(round.state, chainparams, block, pindexPrev, false, true);
+        round.pblock = std::make_shared<CBlock>(block);
+        TrimSigningRounds(hash);
+    }
+    state = round.state;
+    return state.IsValid();
+}
+
+/**
+ * Whether block is a proposal that TestProposedBlock found valid on top of
+ * the same parent. ConnectBlock then adds its transactions to the validation
+ * cache, except peg-ins, so that connecting the signed block only runs the
+ * contextual input checks again rather than every script and range proof.
+ */
+static bool IsCheckedProposal(const CBlock& block, const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    std::map<uint256, CSigningRound>::const_iterator it = mapSigningRounds.find(block.GetHash());
+    if (it == mapSigningRounds.end() || !it->second.pblock || !it->second.state.IsValid())
+        return false;
+    const CBlock& proposal = *it->second.pblock;
+    if (!pindex->pprev || proposal.hashPrevBlock != pindex->pprev->GetBlockHash() || proposal.vtx.size() != block.vtx.size())
+        return false;
+    // The block hash does not commit to the witnesses.
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        if (proposal.vtx[i]->GetWitnessHash() != block.vtx[i]->GetWitnessHash())
+            return false;
+    }
+    LogPrint("bench", "    - Block %s was checked as a proposal\n", block.GetHash().ToString());
+    return true;
+}
+
+bool AddBlockSignature(const CChainParams& chainparams, const uint256& hash, const CScript& scriptSig, CNode* pfrom)
+{
+    std::shared_ptr<CBlock> pblockComplete;
+    CScript solution;
+    {
+        LOCK(cs_main);
+        std::map<uint256, CSigningRound>::iterator it = mapSigningRounds.find(hash);
+        if (it == mapSigningRounds.end() || !it->second.pblock) {
+            // We may see the proposal only after the first signatures on it.
+            if (mapBlockIndex.count(hash))
+                return false;
+            // They cannot be verified until then, so keep only a few per
+            // peer, lest one peer flushes everyone else's with made up hashes.
+            const NodeId nodeid = pfrom ? pfrom->GetId() : -1;
+            if (pfrom && !pfrom->fWhitelisted && CountEarlyBlockSigs(nodeid) >= MAX_EARLY_BLOCK_SIGS_PER_PEER)
+                return false;
+            CSigningRound& round = mapSigningRounds[hash];
+            for (size_t i = 0; i < round.vEarlySigs.size(); i++) {
+                if (round.vEarlySigs[i].first == scriptSig)
+                    return false;
+            }
+            if (round.vEarlySigs.size() >= MAX_EARLY_BLOCK_SIGS)
+                return false;
+            round.vEarlySigs.push_back(std::make_pair(scriptSig, nodeid));
+            TrimSigningRounds(uint256());
+            return true;
+        }
+        CSigningRound& round = it->second;
+        if (round.pblock->hashPrevBlock != chainActive.Tip()->GetBlockHash()) {
+            mapSigningRounds.erase(it);
+            return false;
+        }
+        if (!round.state.IsValid())
+            return false;
+
+        CBlock& block = *round.pblock;
+        const CScript solutionBefore = block.proof.solution;
+        std::vector<CScript> vSolutions(1, solutionBefore);
+        for (size_t i = 0; i < round.vEarlySigs.size(); i++) {
+            if (HasValidBlockSignature(block, round.vEarlySigs[i].first))
+                vSolutions.push_back(round.vEarlySigs[i].first);
+            else if (round.vEarlySigs[i].second != -1)
+                Misbehaving(round.vEarlySigs[i].second, 10);
+        }
+        vSolutions.push_back(scriptSig);
+        round.vEarlySigs.clear();
+        block.proof.solution = CombineBlockSignatures(block, vSolutions);
+        if (block.proof.solution == solutionBefore) {
+            // Signatures we have already are fine, ones that do not verify are not.
+            if (pfrom && !HasValidBlockSignature(block, scriptSig))
+                Misbehaving(pfrom->GetId(), 10);
+            return false;
+        }
+        solution = block.proof.solution;
+        if (!round.fSubmitted && CheckProof(block, chainparams.GetConsensus())) {
+            round.fSubmitted = true;
+            pblockComplete = std::make_shared<CBlock>(block);
+        }
+    }
+
+    LogPrint("blocksig", "Combined a signature into block proposal %s%s\n", hash.ToString(), pblockComplete ? ", which is now complete" : "");
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes) {
+            if (pnode != pfrom && pnode->fSuccessfullyConnected && !pnode->fDisconnect)
+                pnode->PushMessage(NetMsgType::BLOCKSIG, hash, *(CScriptBase*)(&solution));
+        }
+    }
+    if (pblockComplete) {
+        CValidationState state;
+        ProcessNewBlock(state, chainparams, NULL, pblockComplete.get(), true, NULL);
+    }
+    return true;
+}
+
 /**
  * BLOCK PRUNING CODE
  */
@@ -4405,6 +6116,7 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        mappedBlockFiles.Erase(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4459,38 +6171,160 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
            nLastBlockWeCanPrune, count);
 }
 
-bool CheckDiskSpace(uint64_t nAdditionalBytes)
+/** Where a block file is rewritten before it replaces the original, see PruneRangeproofsFromFile. */
+static boost::filesystem::path GetRangeproofsPrunedFilename(int nFile)
 {
-    uint64_t nFreeBytesAvailable = boost::filesystem::space(GetDataDir()).available;
-
-    // Check for nMinDiskSpace bytes (currently 50MB)
-    if (nFreeBytesAvailable < nMinDiskSpace + nAdditionalBytes)
-        return AbortNode("Disk space is low!", _("Error: Disk space is low!"));
-
-    return true;
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+    return path.string() + ".new";
 }
 
-FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fReadOnly)
+int FindFileToPruneRangeproofs(uint64_t nPruneAfterHeight)
 {
-    if (pos.IsNull())
-        return NULL;
-    boost::filesystem::path path = GetBlockPosFilename(pos, prefix);
-    boost::filesystem::create_directories(path.parent_path());
-    FILE* file = fopen(path.string().c_str(), "rb+");
-    if (!file && !fReadOnly)
-        file = fopen(path.string().c_str(), "wb+");
-    if (!file) {
-        LogPrintf("Unable to open file %s\n", path.string());
-        return NULL;
+    LOCK2(cs_main, cs_LastBlockFile);
+    if (chainActive.Tip() == NULL || nRangeproofPruneTarget == 0) {
+        return -1;
     }
-    if (pos.nPos) {
-        if (fseek(file, pos.nPos, SEEK_SET)) {
-            LogPrintf("Unable to seek to position %u of %s\n", pos.nPos, path.string());
-            fclose(file);
-            return NULL;
-        }
+    if ((uint64_t)chainActive.Tip()->nHeight <= nPruneAfterHeight) {
+        return -1;
     }
-    return file;
+
+    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    uint64_t nCurrentUsage = CalculateCurrentUsage();
+    // Leave a buffer under the target for another allocation, as in FindFilesToPrune.
+    uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+    if (nCurrentUsage + nBuffer < nRangeproofPruneTarget) {
+        return -1;
+    }
+
+    for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
+        if (vinfoBlockFile[fileNumber].nSize == 0 || setRangeproofsPrunedFiles.count(fileNumber))
+            continue;
+        if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
+            continue;
+        LogPrint("prune", "Prune: target=%dMiB actual=%dMiB max_prune_height=%d pruning rangeproofs of blk%05u.dat\n",
+                 nRangeproofPruneTarget/1024/1024, nCurrentUsage/1024/1024, nLastBlockWeCanPrune, fileNumber);
+        return fileNumber;
+    }
+    return -1;
+}
+
+/**
+ * Write a copy of block file nFile with every rangeproof removed to
+ * GetRangeproofsPrunedFilename(nFile), and point the block index at it. The
+ * copy only replaces the original in FinishPruneRangeproofs, after the block
+ * index has been written; LoadBlockIndexDB completes or discards an
+ * interrupted replacement depending on whether that write happened.
+ */
+static bool PruneRangeproofsFromFile(int nFile, const CChainParams& chainparams)
+{
+    // The file is replaced below; nothing queued may still go to it.
+    if (!blockFileWriter.Sync())
+        return error("%s: writing to the block files failed", __func__);
+
+    std::vector<std::pair<unsigned int, CBlockIndex*> > vBlocks;
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        CBlockIndex* pindex = it->second;
+        if (pindex->nFile == nFile && (pindex->nStatus & BLOCK_HAVE_DATA))
+            vBlocks.push_back(std::make_pair(pindex->nDataPos, pindex));
+    }
+    std::sort(vBlocks.begin(), vBlocks.end());
+
+    boost::filesystem::path pathNew = GetRangeproofsPrunedFilename(nFile);
+    std::vector<unsigned int> vNewPos;
+    vNewPos.reserve(vBlocks.size());
+    long nNewSize;
+    try {
+        CAutoFile fileout(fopen(pathNew.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull())
+            return error("%s: failed to create %s", __func__, pathNew.string());
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, vBlocks[i].second, chainparams.GetConsensus())) {
+                fileout.fclose();
+                boost::filesystem::remove(pathNew);
+                return error("%s: failed to read block %s", __func__, vBlocks[i].second->GetBlockHash().ToString());
+            }
+            BOOST_FOREACH(CTransactionRef& ptx, block.vtx) {
+                bool fHasRangeproof = false;
+                BOOST_FOREACH(const CTxOut& txout, ptx->vout)
+                    fHasRangeproof |= !txout.nValue.vchRangeproof.empty();
+                if (!fHasRangeproof)
+                    continue;
+                CMutableTransaction mtx(*ptx);
+                BOOST_FOREACH(CTxOut& txout, mtx.vout)
+                    txout.nValue.vchRangeproof.clear();
+                ptx = MakeTransactionRef(std::move(mtx));
+            }
+
+            unsigned int nSize = GetBlockTotalSize(block);
+            fileout << FLATDATA(chainparams.MessageStart()) << nSize;
+            long nPos = ftell(fileout.Get());
+            if (nPos < 0)
+                throw std::runtime_error("ftell failed");
+            vNewPos.push_back((unsigned int)nPos);
+            fileout << block;
+        }
+        nNewSize = ftell(fileout.Get());
+        if (nNewSize < 0)
+            throw std::runtime_error("ftell failed");
+        FileCommit(fileout.Get());
+    } catch (const std::exception& e) {
+        boost::filesystem::remove(pathNew);
+        return error("%s: failed to write %s: %s", __func__, pathNew.string(), e.what());
+    }
+
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        CBlockIndex* pindex = vBlocks[i].second;
+        pindex->nDataPos = vNewPos[i];
+        pindex->nStatus |= BLOCK_RANGEPROOFS_PRUNED;
+        setDirtyBlockIndex.insert(pindex);
+    }
+    LogPrintf("Prune: %s pruned rangeproofs of blk%05u.dat (%d to %d bytes)\n", __func__, nFile, vinfoBlockFile[nFile].nSize, nNewSize);
+    vinfoBlockFile[nFile].nSize = nNewSize;
+    setDirtyFileInfo.insert(nFile);
+    setRangeproofsPrunedFiles.insert(nFile);
+    return true;
+}
+
+/** Replace block file nFile by its copy without rangeproofs, once the block index refers to the copy. */
+static void FinishPruneRangeproofs(int nFile)
+{
+    mappedBlockFiles.Erase(nFile);
+    RenameOver(GetRangeproofsPrunedFilename(nFile), GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk"));
+}
+
+bool CheckDiskSpace(uint64_t nAdditionalBytes)
+{
+    uint64_t nFreeBytesAvailable = boost::filesystem::space(GetDataDir()).available;
+
+    // Check for nMinDiskSpace bytes (currently 50MB)
+    if (nFreeBytesAvailable < nMinDiskSpace + nAdditionalBytes)
+        return AbortNode("Disk space is low!", _("Error: Disk space is low!"));
+
+    return true;
+}
+
+FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fReadOnly)
+{
+    if (pos.IsNull())
+        return NULL;
+    boost::filesystem::path path = GetBlockPosFilename(pos, prefix);
+    boost::filesystem::create_directories(path.parent_path());
+    FILE* file = fopen(path.string().c_str(), "rb+");
+    if (!file && !fReadOnly)
+        file = fopen(path.string().c_str(), "wb+");
+    if (!file) {
+        LogPrintf("Unable to open file %s\n", path.string());
+        return NULL;
+    }
+    if (pos.nPos) {
+        if (fseek(file, pos.nPos, SEEK_SET)) {
+            LogPrintf("Unable to seek to position %u of %s\n", pos.nPos, path.string());
+            fclose(file);
+            return NULL;
+        }
+    }
+    return file;
 }
 
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly) {
@@ -4520,29 +6354,155 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     CBlockIndex* pindexNew = new CBlockIndex();
     if (!pindexNew)
         throw runtime_error(std::string(__func__) + ": new CBlockIndex failed");
+    boost::unique_lock<boost::shared_mutex> lock(csBlockIndexWrite);
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
-bool static LoadBlockIndexDB()
+/** Snapshot of the block index, see WriteBlockIndexSnapshot. */
+static boost::filesystem::path GetIndexSnapshotFilename()
 {
-    const CChainParams& chainparams = Params();
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
-        return false;
+    return GetDataDir() / "blocks" / "index.snapshot";
+}
 
-    boost::this_thread::interruption_point();
+bool WriteBlockIndexSnapshot()
+{
+    AssertLockHeld(cs_main);
 
-    // Calculate nChainWork
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
-    }
+        vSortedByHeight.push_back(make_pair(item.second->nHeight, item.second));
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
+
+    const uint256 tag = GetRandHash();
+    boost::filesystem::path path = GetIndexSnapshotFilename();
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".new";
+    try {
+        CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull())
+            return error("%s: failed to create %s", __func__, pathTmp.string());
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        const uint64_t nCount = vSortedByHeight.size();
+        fileout << tag << nCount;
+        hasher << tag << nCount;
+        BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight) {
+            const CDiskBlockIndex diskindex(item.second);
+            fileout << *item.second->phashBlock << diskindex << item.second->fSolutionDropped;
+            hasher << *item.second->phashBlock << diskindex << item.second->fSolutionDropped;
+        }
+        fileout << hasher.GetHash();
+        FileCommit(fileout.Get());
+    } catch (const std::exception& e) {
+        boost::filesystem::remove(pathTmp);
+        return error("%s: failed to write %s: %s", __func__, pathTmp.string(), e.what());
+    }
+    if (!RenameOver(pathTmp, path))
+        return error("%s: failed to rename %s", __func__, pathTmp.string());
+    // Only now the snapshot is complete may it be used.
+    return pblocktree->WriteIndexSnapshotTag(tag);
+}
+
+/**
+ * Load mapBlockIndex from the snapshot WriteBlockIndexSnapshot wrote, if the
+ * block tree database still matches it. The snapshot is read with a single
+ * read, and lists the blocks by height, so vSortedByHeight needs no sort.
+ */
+static bool LoadBlockIndexSnapshot(vector<pair<int, CBlockIndex*> >& vSortedByHeight)
+{
+    uint256 tag;
+    if (!pblocktree->ReadIndexSnapshotTag(tag))
+        return false;
+
+    boost::filesystem::path path = GetIndexSnapshotFilename();
+    std::vector<char> vData;
+    try {
+        vData.resize(boost::filesystem::file_size(path));
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull() || vData.size() < 2 * sizeof(uint256))
+            return false;
+        filein.read(&vData[0], vData.size());
+    } catch (const std::exception& e) {
+        LogPrintf("%s: failed to read %s: %s\n", __func__, path.string(), e.what());
+        return false;
+    }
+    const char* pchecksum = &vData[0] + vData.size() - sizeof(uint256);
+    if (Hash((const char*)&vData[0], pchecksum) != uint256(std::vector<unsigned char>(pchecksum, pchecksum + sizeof(uint256)))) {
+        LogPrintf("%s: %s is corrupt\n", __func__, path.string());
+        return false;
+    }
+
+    try {
+        CDataStream ss(&vData[0], pchecksum, SER_DISK, CLIENT_VERSION);
+        uint256 tagFile;
+        uint64_t nCount;
+        ss >> tagFile >> nCount;
+        if (tagFile != tag)
+            return false;
+        mapBlockIndex.reserve(nCount);
+        vSortedByHeight.reserve(nCount);
+        for (uint64_t i = 0; i < nCount; i++) {
+            boost::this_thread::interruption_point();
+            uint256 hash;
+            CDiskBlockIndex diskindex;
+            bool fSolutionDropped;
+            ss >> hash >> diskindex >> fSolutionDropped;
+
+            CBlockIndex* pindexNew    = InsertBlockIndex(hash);
+            pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->pchallenge     = diskindex.pchallenge;
+            pindexNew->solution       = diskindex.solution;
+            pindexNew->fSolutionDropped = fSolutionDropped;
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nTx            = diskindex.nTx;
+            vSortedByHeight.push_back(make_pair(pindexNew->nHeight, pindexNew));
+        }
+        if (mapBlockIndex.size() != nCount)
+            throw std::runtime_error("blocks missing");
+    } catch (const std::exception& e) {
+        LogPrintf("%s: failed to load %s: %s\n", __func__, path.string(), e.what());
+        boost::unique_lock<boost::shared_mutex> lock(csBlockIndexWrite);
+        BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex)
+            delete entry.second;
+        mapBlockIndex.clear();
+        vSortedByHeight.clear();
+        return false;
+    }
+    LogPrintf("%s: loaded %u block index entries from %s\n", __func__, vSortedByHeight.size(), path.string());
+    return true;
+}
+
+bool static LoadBlockIndexDB()
+{
+    const CChainParams& chainparams = Params();
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    if (!LoadBlockIndexSnapshot(vSortedByHeight)) {
+        if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
+            return false;
+
+        boost::this_thread::interruption_point();
+
+        vSortedByHeight.reserve(mapBlockIndex.size());
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        {
+            CBlockIndex* pindex = item.second;
+            vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        }
+        sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    }
+    pblocktree->ReadSnapshotBase(hashSnapshotBase);
+
+    // Calculate nChainWork
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
@@ -4550,7 +6510,7 @@ bool static LoadBlockIndexDB()
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
         if (pindex->nTx > 0) {
-            if (pindex->pprev) {
+            if (pindex->pprev && *pindex->phashBlock != hashSnapshotBase) {
                 if (pindex->pprev->nChainTx) {
                     pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
                 } else {
@@ -4597,6 +6557,22 @@ bool static LoadBlockIndexDB()
         if (pindex->nStatus & BLOCK_HAVE_DATA) {
             setBlkDataFiles.insert(pindex->nFile);
         }
+        if (pindex->nStatus & BLOCK_RANGEPROOFS_PRUNED) {
+            setRangeproofsPrunedFiles.insert(pindex->nFile);
+        }
+    }
+    // Complete the replacement of block files by their copies without
+    // rangeproofs if the block index already refers to them, else undo it.
+    for (int nFile = 0; nFile < (int)vinfoBlockFile.size(); nFile++) {
+        boost::filesystem::path pathNew = GetRangeproofsPrunedFilename(nFile);
+        if (!boost::filesystem::exists(pathNew))
+            continue;
+        if (setRangeproofsPrunedFiles.count(nFile)) {
+            LogPrintf("Completing rangeproof pruning of blk%05u.dat\n", nFile);
+            RenameOver(pathNew, GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk"));
+        } else {
+            boost::filesystem::remove(pathNew);
+        }
     }
     for (std::set<int>::iterator it = setBlkDataFiles.begin(); it != setBlkDataFiles.end(); it++)
     {
@@ -4610,6 +6586,9 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
     if (fHavePruned)
         LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
+    pblocktree->ReadFlag("prunedrangeproofs", fHavePrunedRangeproofs);
+    if (fHavePrunedRangeproofs)
+        LogPrintf("LoadBlockIndexDB(): Rangeproofs have previously been pruned\n");
 
     // Check whether we need to continue reindexing
     bool fReindexing = false;
@@ -4619,12 +6598,20 @@ bool static LoadBlockIndexDB()
     // Check whether we have a transaction index
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
+    pblocktree->ReadFlag("scriptindex", fScriptIndex);
+    LogPrintf("%s: script index %s\n", __func__, fScriptIndex ? "enabled" : "disabled");
+
+    // Load the withdraw lock index
+    if (!LoadLockedOutputs())
+        return false;
 
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    PublishChainSnapshot();
+    DropDeepSolutions();
 
     PruneBlockIndexCandidates();
 
@@ -4646,6 +6633,54 @@ CVerifyDB::~CVerifyDB()
     uiInterface.ShowProgress("", 100);
 }
 
+/** Blocks VerifyDB reads ahead per core before checking them in chain order. */
+static const size_t VERIFYDB_BATCH_PER_CORE = 16;
+
+/**
+ * Read the blocks of vIndex from nStart on, every nStep-th one, and run the
+ * VerifyDB checks up to level 2 on them. These need no chain state, so they
+ * run on all cores; a failure is left in vError for the caller to report in
+ * order.
+ */
+static void VerifyDBReadBlocks(const Consensus::Params& consensusParams, const std::vector<CBlockIndex*>& vIndex, int nCheckLevel, std::vector<CBlock>& vBlocks, std::vector<std::string>& vError, size_t nStart, size_t nStep)
+{
+    for (size_t i = nStart; i < vIndex.size(); i += nStep) {
+        const CBlockIndex* pindex = vIndex[i];
+        CBlock& block = vBlocks[i];
+        // check level 0: read from disk
+        if (!ReadBlockFromDisk(block, pindex, consensusParams)) {
+            vError[i] = strprintf("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            continue;
+        }
+        // check level 1: verify block validity
+        CValidationState state;
+        if (nCheckLevel >= 1 && !CheckBlock(block, state, consensusParams, !IsProofCached(block, pindex))) {
+            vError[i] = strprintf("VerifyDB(): *** found bad block at %d, hash=%s (%s)", pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
+            continue;
+        }
+        // check level 2: verify undo validity
+        if (nCheckLevel >= 2) {
+            CBlockUndo undo;
+            CDiskBlockPos pos = pindex->GetUndoPos();
+            if (!pos.IsNull() && !UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
+                vError[i] = strprintf("VerifyDB(): *** found bad undo data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        }
+    }
+}
+
+/** Run VerifyDBReadBlocks over vIndex on up to GetNumCores() threads. */
+static void VerifyDBReadBlocksParallel(const Consensus::Params& consensusParams, const std::vector<CBlockIndex*>& vIndex, int nCheckLevel, std::vector<CBlock>& vBlocks, std::vector<std::string>& vError)
+{
+    vBlocks.assign(vIndex.size(), CBlock());
+    vError.assign(vIndex.size(), std::string());
+    const size_t nThreads = std::min(vIndex.size(), (size_t)std::max(GetNumCores(), 1));
+    boost::thread_group threads;
+    for (size_t i = 1; i < nThreads; i++)
+        threads.create_thread(boost::bind(&VerifyDBReadBlocks, boost::cref(consensusParams), boost::cref(vIndex), nCheckLevel, boost::ref(vBlocks), boost::ref(vError), i, nThreads));
+    VerifyDBReadBlocks(consensusParams, vIndex, nCheckLevel, vBlocks, vError, 0, std::max(nThreads, (size_t)1));
+    threads.join_all();
+}
+
 bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
 {
     LOCK(cs_main);
@@ -4659,77 +6694,93 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         nCheckDepth = chainActive.Height();
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
     LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+
+    // Find the blocks to check, from the tip down.
+    std::vector<CBlockIndex*> vToCheck;
+    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
+    {
+        if (pindex->nHeight < chainActive.Height()-nCheckDepth)
+            break;
+        if ((fPruneMode || !hashSnapshotBase.IsNull()) && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning, or starting from a UTXO snapshot, only go back as far as we have data.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
+            break;
+        }
+        if (pindex->nStatus & BLOCK_RANGEPROOFS_PRUNED) {
+            LogPrintf("VerifyDB(): block verification stopping at height %d (rangeproofs pruned)\n", pindex->nHeight);
+            break;
+        }
+        vToCheck.push_back(pindex);
+    }
+
+    // Blocks are read and checked a batch at a time, so that a deep check
+    // does not hold the whole chain in memory.
+    const size_t nBatch = VERIFYDB_BATCH_PER_CORE * std::max(GetNumCores(), 1);
     CCoinsViewCache coins(coinsview);
     CBlockIndex* pindexState = chainActive.Tip();
     CBlockIndex* pindexFailure = NULL;
     int nGoodTransactions = 0;
     CValidationState state;
     int reportDone = 0;
+    std::vector<CBlock> vBlocks;
+    std::vector<std::string> vError;
     LogPrintf("[0%]...");
-    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
+    for (size_t nBatchStart = 0; nBatchStart < vToCheck.size(); nBatchStart += nBatch)
     {
         boost::this_thread::interruption_point();
-        int percentageDone = std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100))));
-        if (reportDone < percentageDone/10) {
-            // report every 10% step
-            LogPrintf("[%d%%]...", percentageDone);
-            reportDone = percentageDone/10;
-        }
-        uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone);
-        if (pindex->nHeight < chainActive.Height()-nCheckDepth)
-            break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
-            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
-            break;
-        }
-        CBlock block;
-        // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus()))
-            return error("%s: *** found bad block at %d, hash=%s (%s)\n", __func__, 
-                         pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
-                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-            }
-        }
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
-            bool fClean = true;
-            if (!DisconnectBlock(block, state, pindex, coins, &fClean))
-                return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            pindexState = pindex->pprev;
-            if (!fClean) {
-                nGoodTransactions = 0;
-                pindexFailure = pindex;
-            } else
-                nGoodTransactions += block.vtx.size();
+        const std::vector<CBlockIndex*> vIndex(vToCheck.begin() + nBatchStart, vToCheck.begin() + std::min(vToCheck.size(), nBatchStart + nBatch));
+        VerifyDBReadBlocksParallel(chainparams.GetConsensus(), vIndex, nCheckLevel, vBlocks, vError);
+        for (size_t i = 0; i < vIndex.size(); i++)
+        {
+            CBlockIndex* pindex = vIndex[i];
+            const CBlock& block = vBlocks[i];
+            int percentageDone = std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100))));
+            if (reportDone < percentageDone/10) {
+                // report every 10% step
+                LogPrintf("[%d%%]...", percentageDone);
+                reportDone = percentageDone/10;
+            }
+            uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone);
+            if (!vError[i].empty())
+                return error("%s", vError[i]);
+            // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
+            if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
+                bool fClean = true;
+                if (!DisconnectBlock(block, state, pindex, coins, &fClean))
+                    return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                pindexState = pindex->pprev;
+                if (!fClean) {
+                    nGoodTransactions = 0;
+                    pindexFailure = pindex;
+                } else
+                    nGoodTransactions += block.vtx.size();
+            }
+            if (ShutdownRequested())
+                return true;
         }
-        if (ShutdownRequested())
-            return true;
     }
     if (pindexFailure)
         return error("VerifyDB(): *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions);
 
-    // check level 4: try reconnecting blocks
+    // check level 4: try reconnecting blocks. The reads are done ahead on all
+    // cores, and ConnectBlock hands the script and range proof checks to the
+    // script check threads as it does for new blocks.
     if (nCheckLevel >= 4) {
         CBlockIndex *pindex = pindexState;
         while (pindex != chainActive.Tip()) {
-            boost::this_thread::interruption_point();
-            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
-            pindex = chainActive.Next(pindex);
-            CBlock block;
-            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-                return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            if (!ConnectBlock(block, state, pindex, coins, chainparams))
-                return error("VerifyDB(): *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            std::vector<CBlockIndex*> vIndex;
+            for (CBlockIndex* pindexNext = chainActive.Next(pindex); pindexNext && vIndex.size() < nBatch; pindexNext = chainActive.Next(pindexNext))
+                vIndex.push_back(pindexNext);
+            VerifyDBReadBlocksParallel(chainparams.GetConsensus(), vIndex, 0, vBlocks, vError);
+            for (size_t i = 0; i < vIndex.size(); i++) {
+                boost::this_thread::interruption_point();
+                pindex = vIndex[i];
+                uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
+                if (!vError[i].empty())
+                    return error("%s", vError[i]);
+                if (!ConnectBlock(vBlocks[i], state, pindex, coins, chainparams))
+                    return error("VerifyDB(): *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            }
         }
     }
 
@@ -4743,7 +6794,10 @@ bool RewindBlockIndex(const CChainParams& params)
 {
     LOCK(cs_main);
 
+    // The history of a UTXO snapshot is assumed, not validated anew.
     int nHeight = 1;
+    if (!hashSnapshotBase.IsNull())
+        nHeight = mapBlockIndex[hashSnapshotBase]->nHeight + 1;
     while (nHeight <= chainActive.Height()) {
         if (IsWitnessEnabled(chainActive[nHeight - 1], params.GetConsensus()) && !(chainActive[nHeight]->nStatus & BLOCK_OPT_WITNESS)) {
             break;
@@ -4763,7 +6817,7 @@ bool RewindBlockIndex(const CChainParams& params)
             // of the blockchain).
             break;
         }
-        if (!DisconnectTip(state, params, true)) {
+        if (!DisconnectTip(state, params, NULL)) {
             return error("RewindBlockIndex: unable to disconnect block at height %i", pindex->nHeight);
         }
         // Occasionally flush state to disk.
@@ -4828,11 +6882,13 @@ void UnloadBlockIndex()
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    PublishChainSnapshot();
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
     mapOrphanTransactions.clear();
     mapOrphanTransactionsByPrev.clear();
+    nOrphanTransactionsUsage = 0;
     nSyncStarted = 0;
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
@@ -4843,6 +6899,10 @@ void UnloadBlockIndex()
     nPreferredDownload = 0;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
+    nSolutionsDroppedHeight = 0;
+    hashSnapshotBase.SetNull();
+    utxoStats.SetNull();
+    fUTXOStatsValid = false;
     mapNodeState.clear();
     recentRejects.reset(NULL);
     versionbitscache.Clear();
@@ -4850,11 +6910,17 @@ void UnloadBlockIndex()
         warningcache[b].clear();
     }
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(csBlockIndexWrite);
+        BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
+            delete entry.second;
+        }
+        mapBlockIndex.clear();
     }
-    mapBlockIndex.clear();
+    mapLockedOutputs.clear();
     fHavePruned = false;
+    fHavePrunedRangeproofs = false;
+    setRangeproofsPrunedFiles.clear();
 }
 
 bool LoadBlockIndex()
@@ -4862,6 +6928,340 @@ bool LoadBlockIndex()
     // Load block index from databases
     if (!fReindex && !LoadBlockIndexDB())
         return false;
+
+    // Pick up the UTXO set statistics, if they were written along with the chainstate.
+    LOCK(cs_main);
+    const uint256 hashBest = pcoinsTip->GetBestBlock();
+    utxoStats.SetNull();
+    fUTXOStatsValid = hashBest.IsNull() || pcoinsTip->GetUTXOStats(hashBest, utxoStats);
+    if (!fUTXOStatsValid)
+        LogPrintf("UTXO set statistics are missing, gettxoutsetinfo will scan the UTXO set once\n");
+    return true;
+}
+
+bool GetUTXOSetStats(CUTXOStats& stats, uint256& hashBlock)
+{
+    AssertLockHeld(cs_main);
+    if (!fUTXOStatsValid)
+        return false;
+    stats = utxoStats;
+    hashBlock = pcoinsTip->GetBestBlock();
+    return true;
+}
+
+void SetUTXOSetStats(const CUTXOStats& stats, const uint256& hashBlock)
+{
+    AssertLockHeld(cs_main);
+    if (hashBlock != pcoinsTip->GetBestBlock())
+        return;
+    utxoStats = stats;
+    fUTXOStatsValid = true;
+}
+
+static const char UTXO_SNAPSHOT_MAGIC[4] = {'u', 't', 'x', 'o'};
+
+bool DumpUTXOSnapshot(const boost::filesystem::path& path, CUTXOSnapshotInfo& info, std::string& strError)
+{
+    LOCK(cs_main);
+    // Everything must be in the database, which is what the cursor walks.
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+        strError = "Unable to flush the chainstate";
+        return false;
+    }
+    std::vector<std::pair<uint256, COutPoint> > vWithdrawsSpent;
+    if (!pcoinsTip->GetWithdrawsSpent(vWithdrawsSpent)) {
+        strError = "Unable to read spent withdraws";
+        return false;
+    }
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(pcoinsTip->Cursor());
+    info.hashBlock = pcursor->GetBestBlock();
+    assert(info.hashBlock == chainActive.Tip()->GetBlockHash());
+    info.nHeight = chainActive.Height();
+    info.nCoins = 0;
+    info.nWithdrawsSpent = vWithdrawsSpent.size();
+
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".new";
+    try {
+        CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull()) {
+            strError = "Unable to create " + pathTmp.string();
+            return false;
+        }
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        fileout << FLATDATA(UTXO_SNAPSHOT_MAGIC) << info.hashBlock << info.nHeight;
+        hasher << FLATDATA(UTXO_SNAPSHOT_MAGIC) << info.hashBlock << info.nHeight;
+        // The coins of each transaction, ending with a null txid.
+        for (; pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            uint256 txid;
+            CCoins coins;
+            if (!pcursor->GetKey(txid) || !pcursor->GetValue(coins))
+                throw std::runtime_error("unable to read the UTXO set");
+            fileout << txid << coins;
+            hasher << txid << coins;
+            info.nCoins++;
+        }
+        fileout << uint256();
+        hasher << uint256();
+        fileout << vWithdrawsSpent;
+        hasher << vWithdrawsSpent;
+        info.hashSnapshot = hasher.GetHash();
+        fileout << info.hashSnapshot;
+        FileCommit(fileout.Get());
+    } catch (const std::exception& e) {
+        boost::filesystem::remove(pathTmp);
+        strError = strprintf("Unable to write %s: %s", pathTmp.string(), e.what());
+        return false;
+    }
+    if (!RenameOver(pathTmp, path)) {
+        strError = "Unable to rename " + pathTmp.string();
+        return false;
+    }
+    return true;
+}
+
+bool ReadUTXOSnapshot(const boost::filesystem::path& path, CCoinsViewCache& view, CUTXOSnapshotInfo& info, CUTXOStats& stats, std::multimap<uint256, std::pair<COutPoint, CAmount> >& mapLocksCreated, std::string& strError)
+{
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = "Unable to open " + path.string();
+        return false;
+    }
+
+    try {
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        char magic[sizeof(UTXO_SNAPSHOT_MAGIC)];
+        filein >> FLATDATA(magic) >> info.hashBlock >> info.nHeight;
+        hasher << FLATDATA(magic) << info.hashBlock << info.nHeight;
+        if (memcmp(magic, UTXO_SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+            strError = "Not a UTXO snapshot";
+            return false;
+        }
+
+        info.nCoins = 0;
+        while (true) {
+            boost::this_thread::interruption_point();
+            uint256 txid;
+            filein >> txid;
+            hasher << txid;
+            if (txid.IsNull())
+                break;
+            CCoins coins;
+            filein >> coins;
+            hasher << coins;
+            if (coins.IsPruned())
+                throw std::runtime_error("spent coins");
+            for (unsigned int i = 0; i < coins.vout.size(); i++) {
+                const CTxOut& txout = coins.vout[i];
+                if (txout.IsNull())
+                    continue;
+                stats.Add(COutPoint(txid, i), txout);
+                if (txout.scriptPubKey.IsWithdrawLock() && txout.nValue.IsAmount())
+                    mapLocksCreated.insert(std::make_pair(txout.scriptPubKey.GetWithdrawLockGenesisHash(), std::make_pair(COutPoint(txid, i), txout.nValue.GetAmount())));
+            }
+            *view.ModifyCoins(txid) = coins;
+            info.nCoins++;
+        }
+
+        std::vector<std::pair<uint256, COutPoint> > vWithdrawsSpent;
+        filein >> vWithdrawsSpent;
+        hasher << vWithdrawsSpent;
+        for (std::vector<std::pair<uint256, COutPoint> >::const_iterator it = vWithdrawsSpent.begin(); it != vWithdrawsSpent.end(); it++)
+            view.SetWithdrawSpent(*it, true);
+        info.nWithdrawsSpent = vWithdrawsSpent.size();
+
+        uint256 hashFile;
+        filein >> hashFile;
+        info.hashSnapshot = hasher.GetHash();
+        if (hashFile != info.hashSnapshot) {
+            strError = "The snapshot is corrupt";
+            return false;
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Unable to read %s: %s", path.string(), e.what());
+        return false;
+    }
+    return true;
+}
+
+bool LoadUTXOSnapshot(const CChainParams& chainparams, const boost::filesystem::path& path, CUTXOSnapshotInfo& info, std::string& strError)
+{
+    LOCK(cs_main);
+    if (chainActive.Height() != 0 || !hashSnapshotBase.IsNull()) {
+        strError = "A UTXO snapshot can only be loaded into a chainstate that is still at the genesis block";
+        return false;
+    }
+    if (fTxIndex || fScriptIndex) {
+        strError = "A UTXO snapshot cannot be loaded with -txindex or -scriptindex, which need the whole history";
+        return false;
+    }
+
+    // The coins go to a view on top of pcoinsTip, which is only flushed
+    // into it once the whole snapshot checks out.
+    CCoinsViewCache view(pcoinsTip);
+    CUTXOStats stats;
+    std::multimap<uint256, std::pair<COutPoint, CAmount> > mapLocksCreated;
+    // Genesis outputs are in the snapshot if they are still unspent.
+    view.ModifyCoins(chainparams.GenesisBlock().vtx[0]->GetHash())->Clear();
+    if (!ReadUTXOSnapshot(path, view, info, stats, mapLocksCreated, strError))
+        return false;
+
+    MapAssumeutxo::const_iterator itData = chainparams.Assumeutxo().find(info.nHeight);
+    if (itData == chainparams.Assumeutxo().end() || itData->second.hashBlock != info.hashBlock) {
+        strError = strprintf("No -assumeutxo for block %s at height %d", info.hashBlock.ToString(), info.nHeight);
+        return false;
+    }
+    const CAssumeutxoData* pdata = &itData->second;
+    BlockMap::iterator mi = mapBlockIndex.find(info.hashBlock);
+    if (mi == mapBlockIndex.end() || mi->second->nHeight != info.nHeight || (mi->second->nStatus & BLOCK_FAILED_MASK)) {
+        strError = "The header of the snapshot's block is not known (yet), or invalid";
+        return false;
+    }
+    CBlockIndex* pindexBase = mi->second;
+    if (info.hashSnapshot != pdata->hashSnapshot) {
+        strError = strprintf("The snapshot's hash %s does not match -assumeutxo", info.hashSnapshot.ToString());
+        return false;
+    }
+
+    view.SetBestBlock(info.hashBlock);
+    bool flushed = view.Flush();
+    assert(flushed);
+    mempool.clear();
+
+    // Replace the withdraw lock index (of the genesis block) with the snapshot's.
+    std::multimap<uint256, std::pair<COutPoint, CAmount> > mapLocksRemoved;
+    for (std::map<uint256, std::set<std::pair<CAmount, COutPoint> > >::const_iterator it = mapLockedOutputs.begin(); it != mapLockedOutputs.end(); it++) {
+        for (std::set<std::pair<CAmount, COutPoint> >::const_iterator itLock = it->second.begin(); itLock != it->second.end(); itLock++)
+            mapLocksRemoved.insert(std::make_pair(it->first, std::make_pair(itLock->second, itLock->first)));
+    }
+    if (!UpdateLockedOutputs(std::multimap<uint256, std::pair<COutPoint, CAmount> >(), mapLocksRemoved) ||
+        !UpdateLockedOutputs(mapLocksCreated, std::multimap<uint256, std::pair<COutPoint, CAmount> >())) {
+        CValidationState state;
+        return AbortNode(state, "Failed to write withdraw lock index");
+    }
+
+    // The snapshot's block stands for all of its history: it counts all
+    // transactions up to it, and becomes the tip without having data.
+    hashSnapshotBase = info.hashBlock;
+    if (!pblocktree->WriteSnapshotBase(hashSnapshotBase)) {
+        CValidationState state;
+        return AbortNode(state, "Failed to write snapshot base");
+    }
+    pindexBase->nTx = pdata->nChainTx;
+    pindexBase->RaiseValidity(BLOCK_VALID_SCRIPTS);
+    setDirtyBlockIndex.insert(pindexBase);
+    chainActive.SetTip(pindexBase);
+    PublishChainSnapshot();
+    LinkReceivedBlocks(pindexBase);
+    PruneBlockIndexCandidates();
+    utxoStats = stats;
+    fUTXOStatsValid = true;
+
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+        strError = "Unable to flush the chainstate";
+        return false;
+    }
+    LogPrintf("%s: loaded %u transactions' coins at block %s (height %d)\n", __func__, info.nCoins, info.hashBlock.ToString(), info.nHeight);
+    return true;
+}
+
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+bool LoadMempool()
+{
+    const int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    boost::filesystem::path path = GetDataDir() / "mempool.dat";
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        LogPrintf("%s: failed to open %s, continuing anyway\n", __func__, path.string());
+        return false;
+    }
+
+    const int64_t nStart = GetTimeMicros();
+    const int64_t nNow = GetTime();
+    int64_t nAccepted = 0, nFailed = 0, nExpired = 0;
+    try {
+        uint64_t nVersion;
+        filein >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION)
+            return error("%s: unknown version %u of %s", __func__, nVersion, path.string());
+
+        // The deltas go first, so that the transactions they prioritise are
+        // accepted with them.
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        filein >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+        uint64_t nCount;
+        filein >> nCount;
+        while (nCount--) {
+            CTransaction tx;
+            int64_t nTime;
+            filein >> tx >> nTime;
+            if (nTime + nExpiryTimeout <= nNow) {
+                nExpired++;
+            } else {
+                // The range proofs are verified on the mempool check threads
+                // without cs_main, and found in their cache by
+                // AcceptToMemoryPool.
+                CValidationState state;
+                if (PreCheckTransactionForMempool(tx, state)) {
+                    LOCK(cs_main);
+                    AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime);
+                }
+                if (state.IsValid())
+                    nAccepted++;
+                else
+                    nFailed++;
+            }
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        return error("%s: failed to read %s: %s", __func__, path.string(), e.what());
+    }
+
+    LogPrintf("%s: %i transactions accepted, %i failed, %i expired in %.2fs\n", __func__, nAccepted, nFailed, nExpired, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+bool DumpMempool()
+{
+    const int64_t nStart = GetTimeMicros();
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<TxMempoolInfo> vInfo;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        vInfo = mempool.infoAll();
+    }
+
+    boost::filesystem::path path = GetDataDir() / "mempool.dat";
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".new";
+    try {
+        CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull())
+            return error("%s: failed to create %s", __func__, pathTmp.string());
+        fileout << MEMPOOL_DUMP_VERSION << mapDeltas;
+        // infoAll sorts parents before their children, the order in which
+        // LoadMempool needs them.
+        const uint64_t nCount = vInfo.size();
+        fileout << nCount;
+        BOOST_FOREACH(const TxMempoolInfo& info, vInfo)
+            fileout << *info.tx << info.nTime;
+        FileCommit(fileout.Get());
+    } catch (const std::exception& e) {
+        boost::filesystem::remove(pathTmp);
+        return error("%s: failed to write %s: %s", __func__, pathTmp.string(), e.what());
+    }
+    if (!RenameOver(pathTmp, path))
+        return error("%s: failed to rename %s", __func__, pathTmp.string());
+    LogPrintf("%s: wrote %u transactions in %.2fs\n", __func__, vInfo.size(), (GetTimeMicros() - nStart) * 0.000001);
     return true;
 }
 
@@ -4879,6 +7279,8 @@ bool InitBlockIndex(const CChainParams& chainparams)
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fScriptIndex = GetBoolArg("-scriptindex", DEFAULT_SCRIPTINDEX);
+    pblocktree->WriteFlag("scriptindex", fScriptIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -4886,7 +7288,7 @@ bool InitBlockIndex(const CChainParams& chainparams)
         try {
             CBlock &block = const_cast<CBlock&>(chainparams.GenesisBlock());
             // Start new block file
-            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+            unsigned int nBlockSize = GetBlockTotalSize(block);
             CDiskBlockPos blockPos;
             CValidationState state;
             if (!FindBlockPos(state, blockPos, nBlockSize+8, 0, block.GetBlockTime()))
@@ -4906,13 +7308,16 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
-{
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+// Map of disk positions for blocks with unknown parent (only used for reindex)
+static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
 
-    int nLoaded = 0;
+/**
+ * Find the blocks in a block file and call processBlock on each, stopping
+ * early if it returns false. If dbp is given, its nPos is set to the
+ * position of each block before the call.
+ */
+static void ScanBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos* dbp, const boost::function<bool (CBlock&, CDiskBlockPos*)>& processBlock)
+{
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
@@ -4951,74 +7356,232 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 blkdat >> block;
                 nRewind = blkdat.GetPos();
 
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
+                if (!processBlock(block, dbp))
+                    break;
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+}
+
+/**
+ * Accept a block read from a block file, or remember its position for later
+ * if its parent is not known yet, in which case dbp must be given. Then
+ * accept the remembered successors of the block. Returns false if loading
+ * should stop.
+ */
+static bool AcceptExternalBlock(const CChainParams& chainparams, const CBlock& block, const uint256& hash, CDiskBlockPos* dbp, int& nLoaded)
+{
+    // detect out of order blocks, and store them for later
+    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        return true;
+    }
+
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        LOCK(cs_main);
+        CValidationState state;
+        if (AcceptBlock(block, state, chainparams, NULL, true, dbp, NULL))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Activate the genesis block so normal node progress can continue
+    if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            return false;
+        }
+    }
+
+    NotifyHeaderTip();
+
+    // Recursively process earlier encountered successors of this block
+    deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            CBlock blockChild;
+            if (ReadBlockFromDisk(blockChild, it->second, chainparams.GetConsensus()))
+            {
+                LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, blockChild.GetHash().ToString(),
+                        head.ToString());
+                LOCK(cs_main);
+                CValidationState dummy;
+                if (AcceptBlock(blockChild, dummy, chainparams, NULL, true, &it->second, NULL))
+                {
+                    nLoaded++;
+                    queue.push_back(blockChild.GetHash());
                 }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+            NotifyHeaderTip();
+        }
+    }
+    return true;
+}
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    LOCK(cs_main);
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+{
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    ScanBlockFile(chainparams, fileIn, dbp, [&](CBlock& block, CDiskBlockPos* dbpBlock) {
+        return AcceptExternalBlock(chainparams, block, block.GetHash(), dbpBlock, nLoaded);
+    });
+    if (nLoaded > 0)
+        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    return nLoaded > 0;
+}
+
+namespace {
+
+/**
+ * Most block files read ahead of the one being accepted during -reindex,
+ * which is also the number of reader threads. Each read file is held in
+ * memory, deserialized, until its blocks are accepted.
+ */
+static const int MAX_REINDEX_READAHEAD = 3;
+
+/** A block read by a reindex reader thread, with its context-free checks done. */
+struct CReindexBlock
+{
+    CBlock block;
+    uint256 hash;
+    CDiskBlockPos pos;
+};
+
+/**
+ * Reader threads that find and deserialize block files for -reindex, and
+ * run CheckBlock on them, while the importing thread accepts the blocks of
+ * earlier files in order.
+ */
+class CReindexReader
+{
+private:
+    const CChainParams& chainparams;
+    const int nAhead;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    int nNextFile;   //!< next file for a reader thread to take
+    int nAcceptFile; //!< file the importing thread is accepting blocks of
+    int nEndFile;    //!< first file that could not be opened, once known
+    std::map<int, std::vector<CReindexBlock> > mapRead;
+
+    boost::thread_group threads;
+
+    void ThreadRead()
+    {
+        RenameThread("bitcoin-reindex");
+        while (true) {
+            int nFile;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (nNextFile < nEndFile && nNextFile > nAcceptFile + nAhead)
+                    cond.wait(lock);
+                if (nNextFile >= nEndFile)
+                    return;
+                nFile = nNextFile++;
+            }
+
+            CDiskBlockPos pos(nFile, 0);
+            FILE* file = NULL;
+            if (boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
+                file = OpenBlockFile(pos, true); // Errors are logged in OpenBlockFile
+            std::vector<CReindexBlock> vBlocks;
+            if (file) {
+                ScanBlockFile(chainparams, file, &pos, [&](CBlock& block, CDiskBlockPos* dbp) {
+                    vBlocks.push_back(CReindexBlock());
+                    CReindexBlock& read = vBlocks.back();
+                    read.block = std::move(block);
+                    read.hash = read.block.GetHash();
+                    read.pos = *dbp;
+                    // On success this marks the block checked, so AcceptBlock
+                    // does not repeat the work. On failure AcceptBlock finds out.
                     CValidationState state;
-                    if (AcceptBlock(block, state, chainparams, NULL, true, dbp, NULL))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+                    CheckBlock(read.block, state, chainparams.GetConsensus(), true, true);
+                    return true;
+                });
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (file)
+                mapRead[nFile].swap(vBlocks);
+            else
+                nEndFile = std::min(nEndFile, nFile);
+            cond.notify_all();
+        }
+    }
+
+public:
+    CReindexReader(const CChainParams& chainparamsIn, int nThreads) : chainparams(chainparamsIn), nAhead(nThreads), nNextFile(0), nAcceptFile(0), nEndFile(std::numeric_limits<int>::max())
+    {
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&CReindexReader::ThreadRead, this));
+    }
+
+    ~CReindexReader()
+    {
+        threads.interrupt_all();
+        threads.join_all();
+    }
+
+    /** Wait for the blocks of file nFile. Returns false if there is no such file. */
+    bool Take(int nFile, std::vector<CReindexBlock>& vBlocks)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nAcceptFile = nFile;
+        cond.notify_all();
+        while (nFile < nEndFile && !mapRead.count(nFile))
+            cond.wait(lock);
+        if (nFile >= nEndFile)
+            return false;
+        vBlocks.swap(mapRead[nFile]);
+        mapRead.erase(nFile);
+        return true;
+    }
+};
 
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
-                }
+}
 
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (AcceptBlock(block, dummy, chainparams, NULL, true, &it->second, NULL))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
-                    }
-                }
+void ReindexBlockFiles(const CChainParams& chainparams)
+{
+    CReindexReader reader(chainparams, std::max(1, std::min(GetNumCores() - 1, MAX_REINDEX_READAHEAD)));
+    for (int nFile = 0; ; nFile++) {
+        std::vector<CReindexBlock> vBlocks;
+        if (!reader.Take(nFile, vBlocks))
+            break; // No block files left to reindex
+        LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+        int64_t nStart = GetTimeMillis();
+        int nLoaded = 0;
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            boost::this_thread::interruption_point();
+            try {
+                if (!AcceptExternalBlock(chainparams, vBlocks[i].block, vBlocks[i].hash, &vBlocks[i].pos, nLoaded))
+                    break;
             } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                LogPrintf("%s: I/O error - %s\n", __func__, e.what());
             }
         }
-    } catch (const std::runtime_error& e) {
-        AbortNode(std::string("System error: ") + e.what());
+        if (nLoaded > 0)
+            LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     }
-    if (nLoaded > 0)
-        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
-    return nLoaded > 0;
 }
 
 void static CheckBlockIndex(const Consensus::Params& consensusParams)
@@ -5037,6 +7600,11 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
         return;
     }
 
+    // The history before a UTXO snapshot was never processed, which breaks
+    // most of the invariants below.
+    if (!hashSnapshotBase.IsNull())
+        return;
+
     // Build forward-pointing map of the entire block tree.
     std::multimap<CBlockIndex*,CBlockIndex*> forward;
     for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
@@ -5294,14 +7862,137 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     return true;
 }
 
+/**
+ * Whether the range proofs of a relayed transaction are worth verifying
+ * before it gets to AcceptToMemoryPool: it is not one we already have or
+ * recently rejected, and all of its inputs exist, so that a peer cannot make
+ * us verify proofs of duplicates or of transactions spending made up coins.
+ */
+static bool ShouldPreCheckTransaction(const CTransaction& tx, const CInv& inv)
+{
+    LOCK2(cs_main, mempool.cs);
+    if (AlreadyHave(inv))
+        return false;
+    CCoinsViewMemPoolOverlay view(pcoinsTip, mempool);
+    return view.HaveInputs(tx);
+}
+
+/**
+ * Transactions recently rejected from the mempool, oldest first, so that
+ * rpblocktxn messages can be completed from them. Copies share their
+ * rangeproofs, so keeping them is cheap while they are still referenced
+ * elsewhere. Protected by cs_main.
+ */
+static std::map<uint256, CTransaction> mapRecentRejectedTxs;
+static std::deque<uint256> queueRecentRejectedTxs;
+static size_t nRecentRejectedTxsUsage = 0;
+
+static void AddRecentRejectedTx(const CTransaction& tx)
+{
+    if (!mapRecentRejectedTxs.insert(std::make_pair(tx.GetHash(), tx)).second)
+        return;
+    queueRecentRejectedTxs.push_back(tx.GetHash());
+    nRecentRejectedTxsUsage += RecursiveDynamicUsage(tx);
+    while (nRecentRejectedTxsUsage > MAX_RECENT_REJECTED_TXS_USAGE) {
+        std::map<uint256, CTransaction>::iterator it = mapRecentRejectedTxs.find(queueRecentRejectedTxs.front());
+        nRecentRejectedTxsUsage -= RecursiveDynamicUsage(it->second);
+        mapRecentRejectedTxs.erase(it);
+        queueRecentRejectedTxs.pop_front();
+    }
+}
+
+/** Our copy of the transaction with the given txid, from the mempool, orphans or recent rejects */
+static std::shared_ptr<const CTransaction> FindKnownTransaction(const uint256& hash)
+{
+    std::shared_ptr<const CTransaction> ptx = mempool.get(hash);
+    if (ptx)
+        return ptx;
+    map<uint256, COrphanTx>::const_iterator itOrphan = mapOrphanTransactions.find(hash);
+    if (itOrphan != mapOrphanTransactions.end())
+        return std::make_shared<const CTransaction>(itOrphan->second.tx);
+    std::map<uint256, CTransaction>::const_iterator itRejected = mapRecentRejectedTxs.find(hash);
+    if (itRejected != mapRecentRejectedTxs.end())
+        return std::make_shared<const CTransaction>(itRejected->second);
+    return ptx;
+}
+
+/**
+ * Whether the block of pindex can still be sent to peers, after reading it
+ * without cs_main failed because its block file was pruned or compacted.
+ */
+static bool IsBlockStillServable(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    return (pindex->nStatus & BLOCK_HAVE_DATA) && !(pindex->nStatus & BLOCK_RANGEPROOFS_PRUNED);
+}
+
+/** A block served to filtered peers, with what their filters are matched against */
+struct CFilteredBlockSource
+{
+    CBlock block;
+    CMerkleTreeLevels tree;
+    std::vector<CBloomTxElements> vElements;
+
+    explicit CFilteredBlockSource(const CBlock& blockIn, const std::vector<uint256>& vTxid) : block(blockIn), tree(vTxid)
+    {
+        vElements.reserve(block.vtx.size());
+        BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
+            vElements.push_back(CBloomTxElements(*ptx));
+    }
+};
+
+//! Number of blocks kept for serving to filtered peers
+static const size_t FILTERED_BLOCK_CACHE_SIZE = 4;
+
+static CCriticalSection cs_filteredblocks;
+//! The blocks last served to filtered peers, most recently used first
+static std::list<std::pair<uint256, std::shared_ptr<const CFilteredBlockSource> > > listFilteredBlocks;
+
+/**
+ * The block of pindex for filtered peers, from the cache or read from disk at
+ * pos, so that the many SPV peers asking for a new block share one read and
+ * parse of it. NULL if the block was pruned meanwhile.
+ */
+static std::shared_ptr<const CFilteredBlockSource> GetFilteredBlockSource(const CBlockIndex* pindex, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    {
+        LOCK(cs_filteredblocks);
+        for (std::list<std::pair<uint256, std::shared_ptr<const CFilteredBlockSource> > >::iterator it = listFilteredBlocks.begin(); it != listFilteredBlocks.end(); ++it) {
+            if (it->first == hash) {
+                listFilteredBlocks.splice(listFilteredBlocks.begin(), listFilteredBlocks, it);
+                return it->second;
+            }
+        }
+    }
+
+    CBlock block;
+    if (!ReadBlockFromDiskNoProof(block, pos) || block.GetHash() != hash) {
+        LOCK(cs_main);
+        if (!IsBlockStillServable(pindex))
+            return std::shared_ptr<const CFilteredBlockSource>();
+        if (!ReadBlockFromDisk(block, pindex, consensusParams))
+            assert(!"cannot load block from disk");
+    }
+    std::vector<uint256> vTxid;
+    vTxid.reserve(block.vtx.size());
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
+        vTxid.push_back(ptx->GetHash());
+    std::shared_ptr<const CFilteredBlockSource> pblock = std::make_shared<CFilteredBlockSource>(block, vTxid);
+
+    LOCK(cs_filteredblocks);
+    listFilteredBlocks.push_front(std::make_pair(hash, pblock));
+    if (listFilteredBlocks.size() > FILTERED_BLOCK_CACHE_SIZE)
+        listFilteredBlocks.pop_back();
+    return pblock;
+}
+
 void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
 
     vector<CInv> vNotFound;
 
-    LOCK(cs_main);
-
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->nSendSize >= SendBufferSize())
@@ -5314,7 +8005,17 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK || inv.type == MSG_WITNESS_BLOCK)
             {
+                // Decide under cs_main whether to send the block, then read
+                // and send it without, so that peers downloading blocks do not
+                // hold up validation and the handling of other peers.
                 bool send = false;
+                const CBlockIndex* pindex = NULL;
+                CDiskBlockPos pos;
+                bool fCmpctAsFull = false;
+                bool fPeerWantsWitness = false;
+                uint256 hashTip;
+                {
+                LOCK(cs_main);
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
@@ -5344,57 +8045,94 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                     pfrom->fDisconnect = true;
                     send = false;
                 }
+                // Blocks without their rangeproofs would fail validation at the peer.
+                if (send && (mi->second->nStatus & BLOCK_RANGEPROOFS_PRUNED)) {
+                    LogPrint("net", "%s: ignoring request from peer=%i for block without rangeproofs\n", __func__, pfrom->GetId());
+                    send = false;
+                }
                 // Pruned nodes may have deleted the block, so check whether
                 // it's available before trying to send.
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
+                send = send && (mi->second->nStatus & BLOCK_HAVE_DATA);
+                if (send)
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
-                    else if (inv.type == MSG_WITNESS_BLOCK)
-                        pfrom->PushMessage(NetMsgType::BLOCK, block);
+                    pindex = mi->second;
+                    pos = pindex->GetBlockPos();
+                    // If a peer is asking for old blocks, we're almost guaranteed
+                    // they wont have a useful mempool to match against a compact block,
+                    // and we don't feel like constructing the object for them, so
+                    // instead we respond with the full, non-compact block.
+                    fCmpctAsFull = inv.type == MSG_CMPCT_BLOCK && pindex->nHeight < chainActive.Height() - 10;
+                    fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+                    hashTip = chainActive.Tip()->GetBlockHash();
+                }
+                }
+
+                if (send)
+                {
+                    if (inv.type == MSG_BLOCK || inv.type == MSG_WITNESS_BLOCK || fCmpctAsFull)
+                    {
+                        // Send the stored bytes as they are, rather than
+                        // deserializing the block only to serialize it again.
+                        bool fWitness = inv.type == MSG_WITNESS_BLOCK || (fCmpctAsFull && fPeerWantsWitness);
+                        std::vector<char> vData;
+                        if (!ReadRawBlockFromDisk(vData, pos, inv.hash, fWitness)) {
+                            LOCK(cs_main);
+                            send = IsBlockStillServable(pindex);
+                            if (send && !ReadRawBlockFromDisk(vData, pindex, fWitness))
+                                assert(!"cannot load block from disk");
+                        }
+                        if (send)
+                            pfrom->PushMessage(NetMsgType::BLOCK, CFlatData(vData));
+                    }
                     else if (inv.type == MSG_FILTERED_BLOCK)
                     {
-                        bool send = false;
-                        CMerkleBlock merkleBlock;
+                        std::shared_ptr<const CFilteredBlockSource> pblock = GetFilteredBlockSource(pindex, pos, consensusParams);
+                        send = pblock != NULL;
+                        if (send)
                         {
-                            LOCK(pfrom->cs_filter);
-                            if (pfrom->pfilter) {
-                                send = true;
-                                merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
+                            bool send = false;
+                            CMerkleBlock merkleBlock;
+                            {
+                                LOCK(pfrom->cs_filter);
+                                if (pfrom->pfilter) {
+                                    send = true;
+                                    merkleBlock = CMerkleBlock(pblock->block.GetBlockHeader(), pblock->tree, pblock->vElements, *pfrom->pfilter);
+                                }
                             }
+                            if (send) {
+                                pfrom->PushMessage(NetMsgType::MERKLEBLOCK, merkleBlock);
+                                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                                // This avoids hurting performance by pointlessly requiring a round-trip
+                                // Note that there is currently no way for a node to request any single transactions we didn't send here -
+                                // they must either disconnect and retry or request the full block.
+                                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                                // however we MUST always provide at least what the remote peer needs
+                                typedef std::pair<unsigned int, uint256> PairType;
+                                BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
+                                    pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, pblock->block.vtx[pair.first]);
+                            }
+                            // else
+                                // no response
                         }
-                        if (send) {
-                            pfrom->PushMessage(NetMsgType::MERKLEBLOCK, merkleBlock);
-                            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                            // This avoids hurting performance by pointlessly requiring a round-trip
-                            // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                            // they must either disconnect and retry or request the full block.
-                            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the remote peer needs
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, block.vtx[pair.first]);
-                        }
-                        // else
-                            // no response
                     }
-                    else if (inv.type == MSG_CMPCT_BLOCK)
+                    else
                     {
-                        // If a peer is asking for old blocks, we're almost guaranteed
-                        // they wont have a useful mempool to match against a compact block,
-                        // and we don't feel like constructing the object for them, so
-                        // instead we respond with the full, non-compact block.
-                        bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
-                        if (mi->second->nHeight >= chainActive.Height() - 10) {
+                        // Send block from disk
+                        CBlock block;
+                        if (!ReadBlockFromDiskNoProof(block, pos) || block.GetHash() != inv.hash) {
+                            LOCK(cs_main);
+                            send = IsBlockStillServable(pindex);
+                            if (send && !ReadBlockFromDisk(block, pindex, consensusParams))
+                                assert(!"cannot load block from disk");
+                        }
+                        if (send && inv.type == MSG_CMPCT_BLOCK)
+                        {
                             CBlockHeaderAndShortTxIDs cmpctblock(block, fPeerWantsWitness);
                             pfrom->PushMessageWithFlag(fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
-                        } else
-                            pfrom->PushMessageWithFlag(fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
+                        }
                     }
+                    if (!send)
+                        LogPrint("net", "%s: block %s requested by peer=%d was pruned meanwhile\n", __func__, inv.hash.ToString(), pfrom->GetId());
 
                     // Trigger the peer node to send a getblocks request for the next batch of inventory
                     if (inv.hash == pfrom->hashContinue)
@@ -5403,7 +8141,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         // and we want it right after the last block so they don't
                         // wait for other stuff first.
                         vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        vInv.push_back(CInv(MSG_BLOCK, hashTip));
                         pfrom->PushMessage(NetMsgType::INV, vInv);
                         pfrom->hashContinue.SetNull();
                     }
@@ -5413,6 +8151,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             {
                 // Send stream from relay memory
                 bool push = false;
+                LOCK(cs_main);
                 auto mi = mapRelay.find(inv.hash);
                 if (mi != mapRelay.end()) {
                     pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *mi->second);
@@ -5461,6 +8200,28 @@ uint32_t GetFetchFlags(CNode* pfrom, CBlockIndex* pprev, const Consensus::Params
     return nFetchFlags;
 }
 
+/**
+ * Send invs for the transactions of a reconciliation round with a peer: those
+ * with the given short ids, or all of them. They are in mapRelay already,
+ * having been put there when they were queued for the peer.
+ */
+static void PushReconciledInventory(CNode* pnode, const std::map<uint32_t, CTransactionRef>& mapTxs, const std::vector<uint32_t>& vShortIds, bool fAll)
+{
+    vector<CInv> vInv;
+    if (fAll) {
+        for (std::map<uint32_t, CTransactionRef>::const_iterator it = mapTxs.begin(); it != mapTxs.end(); it++)
+            vInv.push_back(CInv(MSG_TX, it->second->GetHash()));
+    } else {
+        BOOST_FOREACH(uint32_t nShortId, vShortIds) {
+            std::map<uint32_t, CTransactionRef>::const_iterator it = mapTxs.find(nShortId);
+            if (it != mapTxs.end())
+                vInv.push_back(CInv(MSG_TX, it->second->GetHash()));
+        }
+    }
+    for (size_t i = 0; i < vInv.size(); i += MAX_INV_SZ)
+        pnode->PushMessage(NetMsgType::INV, vector<CInv>(vInv.begin() + i, vInv.begin() + std::min(vInv.size(), i + MAX_INV_SZ)));
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams)
 {
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -5670,6 +8431,21 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 pfrom->PushMessage(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
             nCMPCTBLOCKVersion = 1;
             pfrom->PushMessage(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
+            // Tell our peer we can complete transactions sent without their rangeproofs
+            pfrom->PushMessage(NetMsgType::SENDRPDEDUP);
+            // and that we can take headers without repeated challenges
+            pfrom->PushMessage(NetMsgType::SENDCHEADERS);
+        }
+        if ((nLocalServices & NODE_TXRECON) && (pfrom->nServices & NODE_TXRECON) && pfrom->fRelayTxes) {
+            // Offer to announce transactions by reconciliation rather than invs
+            uint64_t nSalt = GetRand(std::numeric_limits<uint64_t>::max());
+            {
+                LOCK(cs_main);
+                CNodeState* state = State(pfrom->GetId());
+                state->fTxReconOffered = true;
+                state->nTxReconSalt = nSalt;
+            }
+            pfrom->PushMessage(NetMsgType::SENDRECON, TXRECON_VERSION, nSalt);
         }
     }
 
@@ -5769,6 +8545,117 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == NetMsgType::SENDRPDEDUP)
+    {
+        LOCK(cs_main);
+        State(pfrom->GetId())->fWantsRangeproofDedup = true;
+    }
+
+
+    else if (strCommand == NetMsgType::SENDCHEADERS)
+    {
+        LOCK(cs_main);
+        State(pfrom->GetId())->fWantsCompactHeaders = true;
+    }
+
+
+    else if (strCommand == NetMsgType::SENDRECON)
+    {
+        uint32_t nReconVersion = 0;
+        uint64_t nRemoteSalt = 0;
+        vRecv >> nReconVersion >> nRemoteSalt;
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        // Only with peers we offered it to ourselves; the side that made the connection asks for the sketches.
+        if (state->fTxReconOffered && !state->txrecon && nReconVersion >= TXRECON_VERSION) {
+            state->txrecon = std::make_shared<CTxReconState>(!pfrom->fInbound, state->nTxReconSalt, nRemoteSalt);
+            state->txrecon->nNextRequest = PoissonNextSend(GetTimeMicros(), TXRECON_REQUEST_INTERVAL);
+        }
+    }
+
+
+    else if (strCommand == NetMsgType::REQRECON)
+    {
+        uint32_t nRemoteSize = 0;
+        vRecv >> nRemoteSize;
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        if (!state->txrecon || state->txrecon->fInitiator) {
+            Misbehaving(pfrom->GetId(), 10);
+            return error("unexpected reqrecon from peer=%d", pfrom->id);
+        }
+        CTxReconState& recon = *state->txrecon;
+        // What an unfinished round left behind goes out in invs.
+        PushReconciledInventory(pfrom, recon.mapSketched, std::vector<uint32_t>(), true);
+        size_t nCells = std::min(CReconSketch::CellsForCapacity(recon.EstimateDifference(nRemoteSize)), MAX_TXRECON_SKETCH_CELLS);
+        pfrom->PushMessage(NetMsgType::SKETCH, recon.GetSketch(nCells));
+        recon.mapSketched.swap(recon.mapSet);
+        recon.mapSet.clear();
+    }
+
+
+    else if (strCommand == NetMsgType::SKETCH)
+    {
+        CReconSketch sketch;
+        vRecv >> sketch;
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        if (!state->txrecon || !state->txrecon->fAwaitingSketch) {
+            Misbehaving(pfrom->GetId(), 10);
+            return error("unexpected sketch from peer=%d", pfrom->id);
+        }
+        if (!sketch.IsValid()) {
+            Misbehaving(pfrom->GetId(), 100);
+            return error("invalid sketch of %u cells from peer=%d", sketch.GetCells(), pfrom->id);
+        }
+        CTxReconState& recon = *state->txrecon;
+        recon.fAwaitingSketch = false;
+        CReconSketch diff = recon.GetSketch(sketch.GetCells());
+        std::vector<uint32_t> vLocal, vRemote;
+        bool fSuccess = diff.Subtract(sketch) && diff.Decode(vLocal, vRemote);
+        if (!fSuccess) {
+            // Fall back to announcing everything, both ways
+            vRemote.clear();
+            LogPrint("net", "failed to reconcile %u transactions with a sketch of %u cells from peer=%d\n", recon.mapSet.size(), sketch.GetCells(), pfrom->id);
+        } else {
+            LogPrint("net", "reconciled %u transactions with peer=%d: %u missing there, %u here\n", recon.mapSet.size(), pfrom->id, vLocal.size(), vRemote.size());
+        }
+        PushReconciledInventory(pfrom, recon.mapSet, vLocal, !fSuccess);
+        pfrom->PushMessage(NetMsgType::RECONCILDIFF, fSuccess, vRemote);
+        recon.mapSet.clear();
+    }
+
+
+    else if (strCommand == NetMsgType::RECONCILDIFF)
+    {
+        bool fSuccess = false;
+        std::vector<uint32_t> vShortIds;
+        vRecv >> fSuccess >> vShortIds;
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        if (!state->txrecon || state->txrecon->fInitiator) {
+            Misbehaving(pfrom->GetId(), 10);
+            return error("unexpected reconcildiff from peer=%d", pfrom->id);
+        }
+        PushReconciledInventory(pfrom, state->txrecon->mapSketched, vShortIds, !fSuccess);
+        state->txrecon->mapSketched.clear();
+    }
+
+
+    else if (strCommand == NetMsgType::BLOCKSIG)
+    {
+        uint256 hash;
+        CScript scriptSig;
+        vRecv >> hash >> *(CScriptBase*)(&scriptSig);
+        if (scriptSig.size() > MAX_SCRIPT_SIZE) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 10);
+            return true;
+        }
+        AddBlockSignature(chainparams, hash, scriptSig, pfrom);
+    }
+
+
     else if (strCommand == NetMsgType::INV)
     {
         vector<CInv> vInv;
@@ -5904,7 +8791,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             // If pruning, don't inv blocks unless we have on disk and are likely to still have
             // for some reasonable time window (1 hour) that block relay might require.
             const int nPrunedBlocksLikelyToHave = MIN_BLOCKS_TO_KEEP - 3600 / chainparams.GetConsensus().nPowTargetSpacing;
-            if (fPruneMode && (!(pindex->nStatus & BLOCK_HAVE_DATA) || pindex->nHeight <= chainActive.Tip()->nHeight - nPrunedBlocksLikelyToHave))
+            if ((fPruneMode || fRangeproofPruneMode) && (!(pindex->nStatus & BLOCK_HAVE_DATA) || pindex->nHeight <= chainActive.Tip()->nHeight - nPrunedBlocksLikelyToHave))
             {
                 LogPrint("net", " getblocks stopping, pruned or too old block at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
                 break;
@@ -5927,6 +8814,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         BlockTransactionsRequest req;
         vRecv >> req;
 
+        LOCK(cs_main);
+
         BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
         if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
             LogPrintf("Peer %d sent us a getblocktxn for a block we don't have", pfrom->id);
@@ -5948,9 +8837,23 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
                 return true;
             }
-            resp.txn[i] = block.vtx[req.indexes[i]];
+            resp.txn[i] = *block.vtx[req.indexes[i]];
+        }
+        CNodeState* state = State(pfrom->GetId());
+        if (state->fWantsRangeproofDedup && state->fWantsCmpctWitness && state->hashLastRangeproofDedupBlock != req.blockhash) {
+            // Leave out the rangeproofs of transactions the peer announced to
+            // us or was sent; it asks again if it no longer has them.
+            BlockTransactionsNoRangeproofs respNoRangeproofs(resp.blockhash);
+            {
+                LOCK(pfrom->cs_inventory);
+                BOOST_FOREACH(const CTransaction& tx, resp.txn)
+                    respNoRangeproofs.AddTransaction(tx, pfrom->filterInventoryKnown.contains(tx.GetHash()));
+            }
+            state->hashLastRangeproofDedupBlock = req.blockhash;
+            pfrom->PushMessage(NetMsgType::RPBLOCKTXN, respNoRangeproofs);
+        } else {
+            pfrom->PushMessageWithFlag(state->fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCKTXN, resp);
         }
-        pfrom->PushMessageWithFlag(State(pfrom->GetId())->fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCKTXN, resp);
     }
 
 
@@ -5960,6 +8863,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         uint256 hashStop;
         vRecv >> locator >> hashStop;
 
+        // Take a snapshot of the part of the chain to send under cs_main, and
+        // build and send the headers from it without. Block index entries are
+        // never freed and their headers never change.
+        vector<const CBlockIndex*> vChainPart;
+        bool fCompactHeaders;
+        {
         LOCK(cs_main);
         /*if (IsInitialBlockDownload() && !pfrom->fWhitelisted) {
             LogPrint("net", "Ignoring getheaders from peer=%d because node is in initial block download\n", pfrom->id);
@@ -5984,13 +8893,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 pindex = chainActive.Next(pindex);
         }
 
-        // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
-        vector<CBlock> vHeaders;
         int nLimit = MAX_HEADERS_RESULTS;
         LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->id);
         for (; pindex; pindex = chainActive.Next(pindex))
         {
-            vHeaders.push_back(pindex->GetBlockHeader());
+            vChainPart.push_back(pindex);
             if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
                 break;
         }
@@ -5999,7 +8906,20 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         // headers message). In both cases it's safe to update
         // pindexBestHeaderSent to be our tip.
         nodestate->pindexBestHeaderSent = pindex ? pindex : chainActive.Tip();
-        pfrom->PushMessage(NetMsgType::HEADERS, vHeaders);
+        fCompactHeaders = nodestate->fWantsCompactHeaders;
+        }
+
+        // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
+        vector<CBlock> vHeaders;
+        vHeaders.reserve(vChainPart.size());
+        BOOST_FOREACH(const CBlockIndex* pindex, vChainPart) {
+            // Headers must connect, so send the ones up to a header we cannot read.
+            CBlockHeader header;
+            if (!GetBlockIndexHeader(pindex, header))
+                break;
+            vHeaders.push_back(header);
+        }
+        PushHeaders(pfrom, fCompactHeaders, vHeaders);
     }
 
 
@@ -6021,15 +8941,32 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        // Verify the range proofs before taking cs_main, so that
+        // AcceptToMemoryPool finds them in the cache and only has to do the
+        // checks that depend on the chain and the mempool. Anything else is
+        // left to AcceptToMemoryPool.
+        CValidationState state;
+        bool fPreChecked = true;
+        int64_t nPreCheckTime = 0;
+        if (ShouldPreCheckTransaction(tx, inv)) {
+            const int64_t nPreCheckStart = GetTimeMicros();
+            fPreChecked = PreCheckTransactionForMempool(tx, state);
+            nPreCheckTime = GetTimeMicros() - nPreCheckStart;
+        }
+
+        LimitValidationQueue();
         LOCK(cs_main);
 
+        // What follows is charged to the peer's validation budget, with the
+        // precheck but not the wait for cs_main.
+        const int64_t nTxStart = GetTimeMicros() - nPreCheckTime;
+
         bool fMissingInputs = false;
-        CValidationState state;
 
         pfrom->setAskFor.erase(inv.hash);
         mapAlreadyAskedFor.erase(inv.hash);
 
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs)) {
+        if (fPreChecked && !AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs)) {
             mempool.check(pcoinsTip);
             RelayTransaction(tx);
             for (unsigned int i = 0; i < tx.vout.size(); i++) {
@@ -6122,13 +9059,16 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
                 // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
                 unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+                size_t nMaxOrphanTxSize = (size_t)std::max((int64_t)0, GetArg("-maxorphantxsize", DEFAULT_MAX_ORPHAN_TRANSACTIONS_SIZE)) * 1000;
+                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx, nMaxOrphanTxSize);
                 if (nEvicted > 0)
                     LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
             } else {
                 LogPrint("mempool", "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
             }
         } else {
+            AddRecentRejectedTx(tx);
+
             if (tx.wit.IsNull() && !state.CorruptionPossible()) {
                 // Do not use rejection cache for witness transactions or
                 // witness-stripped transactions, as they can have been malleated.
@@ -6168,6 +9108,17 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 Misbehaving(pfrom->GetId(), nDoS);
             }
         }
+
+        // A peer that has used up its budget gets its next transaction
+        // processed once it has paid off the overdraft, so that it cannot
+        // keep the message handler busy with transactions that are costly to
+        // validate at the expense of the other peers.
+        const int64_t nNow = GetTimeMicros();
+        const int64_t nPostponeUntil = ChargeTxValidation(pfrom->GetId(), nNow - nTxStart, nNow);
+        if (nPostponeUntil && !pfrom->fWhitelisted) {
+            LogPrint("net", "peer=%d is over its transaction validation budget, postponing its transactions for %dms\n", pfrom->id, (nPostponeUntil - nNow) / 1000);
+            pfrom->nTxPostponedUntil = nPostponeUntil;
+        }
         FlushStateToDisk(state, FLUSH_STATE_PERIODIC);
     }
 
@@ -6302,6 +9253,64 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CheckBlockIndex(chainparams.GetConsensus());
     }
 
+    else if (strCommand == NetMsgType::RPBLOCKTXN && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactionsNoRangeproofs resp;
+        vRecv >> resp;
+
+        LOCK(cs_main);
+
+        map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(resp.blockhash);
+        if (it == mapBlocksInFlight.end() || !it->second.second->partialBlock ||
+                it->second.first != pfrom->GetId()) {
+            LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+            return true;
+        }
+
+        PartiallyDownloadedBlock& partialBlock = *it->second.second->partialBlock;
+        std::vector<uint16_t> vMissing;
+        for (size_t i = 0; i < partialBlock.BlockTxCount(); i++) {
+            if (!partialBlock.IsTxAvailable(i))
+                vMissing.push_back(i);
+        }
+        if (resp.txn.size() != vMissing.size()) {
+            MarkBlockAsReceived(resp.blockhash); // Reset in-flight state in case of whitelist
+            Misbehaving(pfrom->GetId(), 100);
+            LogPrintf("Peer %d sent us non-matching block transactions\n", pfrom->id);
+            return true;
+        }
+
+        // Complete the transactions sent without rangeproofs from our own
+        // copies, and request the ones we no longer have in full.
+        BlockTransactionsRequest req;
+        req.blockhash = resp.blockhash;
+        size_t nFilled = 0;
+        for (size_t i = 0; i < resp.txn.size(); i++) {
+            if (!resp.stripped_wtxids[i].IsNull()) {
+                std::shared_ptr<const CTransaction> ptxKnown = FindKnownTransaction(resp.txn[i].GetHash());
+                if (!ptxKnown || !resp.FillRangeproofs(i, *ptxKnown)) {
+                    req.indexes.push_back(vMissing[i]);
+                    continue;
+                }
+                nFilled++;
+            }
+            partialBlock.SetTxAvailable(vMissing[i], resp.txn[i]);
+        }
+        LogPrint("cmpctblock", "Completed %u of %u transactions sent without rangeproofs for block %s\n", nFilled, nFilled + req.indexes.size(), resp.blockhash.ToString());
+
+        if (req.indexes.empty()) {
+            // Dirty hack to jump to BLOCKTXN code (TODO: move message handling into their own functions)
+            BlockTransactions txn;
+            txn.blockhash = resp.blockhash;
+            CDataStream blockTxnMsg(SER_NETWORK, PROTOCOL_VERSION);
+            blockTxnMsg << txn;
+            return ProcessMessage(pfrom, NetMsgType::BLOCKTXN, blockTxnMsg, nTimeReceived, chainparams);
+        } else {
+            pfrom->PushMessage(NetMsgType::GETBLOCKTXN, req);
+        }
+    }
+
+
     else if (strCommand == NetMsgType::BLOCKTXN && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         BlockTransactions resp;
@@ -6331,7 +9340,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             pfrom->PushMessage(NetMsgType::GETDATA, invs);
         } else {
             CValidationState state;
+            StartRangeProofPrecheck(block, chainparams);
             ProcessNewBlock(state, chainparams, pfrom, &block, false, NULL);
+            FinishRangeProofPrecheck();
             int nDoS;
             if (state.IsInvalid(nDoS)) {
                 assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
@@ -6346,21 +9357,32 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == NetMsgType::HEADERS && !fImporting && !fReindex) // Ignore headers received while importing
+    else if ((strCommand == NetMsgType::HEADERS || strCommand == NetMsgType::CHEADERS) && !fImporting && !fReindex) // Ignore headers received while importing
     {
         std::vector<CBlockHeader> headers;
-
-        // Bypass the normal CBlock deserialization, as we don't want to risk deserializing 2000 full blocks.
-        unsigned int nCount = ReadCompactSize(vRecv);
+        unsigned int nCount;
+
+        if (strCommand == NetMsgType::CHEADERS) {
+            // The challenges left out are filled in from the header before.
+            CompactHeaders cheaders;
+            vRecv >> cheaders;
+            headers.swap(cheaders.headers);
+            nCount = headers.size();
+        } else {
+            // Bypass the normal CBlock deserialization, as we don't want to risk deserializing 2000 full blocks.
+            nCount = ReadCompactSize(vRecv);
+        }
         if (nCount > MAX_HEADERS_RESULTS) {
             LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
             return error("headers message size = %u", nCount);
         }
-        headers.resize(nCount);
-        for (unsigned int n = 0; n < nCount; n++) {
-            vRecv >> headers[n];
-            ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
+        if (strCommand == NetMsgType::HEADERS) {
+            headers.resize(nCount);
+            for (unsigned int n = 0; n < nCount; n++) {
+                vRecv >> headers[n];
+                ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
+            }
         }
 
         {
@@ -6400,6 +9422,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
+        // If any proof fails here, AcceptBlockHeader checks them one by one
+        // again below so the offending header is found.
+        bool fProofsChecked = CheckHeaderProofs(headers, chainparams.GetConsensus());
+
         CBlockIndex *pindexLast = NULL;
         BOOST_FOREACH(const CBlockHeader& header, headers) {
             CValidationState state;
@@ -6407,7 +9433,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast, fProofsChecked)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -6501,6 +9527,19 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         LogPrint("net", "received block %s peer=%d\n", block.GetHash().ToString(), pfrom->id);
 
+        {
+            LOCK(cs_main);
+            // Check the transactions of a block whose header we accepted on
+            // all threads while the queue is still free. On success
+            // AcceptBlock does not repeat the work; on failure it finds out.
+            BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
+            if (mi != mapBlockIndex.end() && !(mi->second->nStatus & (BLOCK_HAVE_DATA | BLOCK_FAILED_MASK))) {
+                CValidationState stateDummy;
+                CheckBlock(block, stateDummy, chainparams.GetConsensus(), true, true, true);
+            }
+            StartRangeProofPrecheck(block, chainparams);
+        }
+
         CValidationState state;
         // Process all blocks from whitelisted peers, even if not requested,
         // unless we're still syncing with the network.
@@ -6508,6 +9547,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         // conditions in AcceptBlock().
         bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
         ProcessNewBlock(state, chainparams, pfrom, &block, forceProcessing, NULL);
+        {
+            LOCK(cs_main);
+            FinishRangeProofPrecheck();
+        }
         int nDoS;
         if (state.IsInvalid(nDoS)) {
             assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
@@ -6542,7 +9585,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -6797,6 +9843,10 @@ bool ProcessMessages(CNode* pfrom)
         if (!msg.complete())
             break;
 
+        // leave a postponed transaction, and what follows it, for later
+        if (pfrom->IsTxPostponed(msg, GetTimeMicros()))
+            break;
+
         // at this point, any failure means we can delete the current message
         it++;
 
@@ -6821,8 +9871,8 @@ bool ProcessMessages(CNode* pfrom)
 
         // Checksum
         CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
-        unsigned int nChecksum = ReadLE32((unsigned char*)&hash);
+        const uint256& hash = msg.GetMessageHash();
+        unsigned int nChecksum = ReadLE32(hash.begin());
         if (nChecksum != hdr.nChecksum)
         {
             LogPrintf("%s(%s, %u bytes): CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n", __func__,
@@ -6877,27 +9927,40 @@ bool ProcessMessages(CNode* pfrom)
 
     // In case the connection got shut down, its receive buffer was wiped
     if (!pfrom->fDisconnect)
-        pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
+        pfrom->EraseRecvMsgs(it);
 
     return fOk;
 }
 
-class CompareInvMempoolOrder
+void RelayTransaction(const CTransaction& tx)
 {
-    CTxMemPool *mp;
-public:
-    CompareInvMempoolOrder(CTxMemPool *mempool)
-    {
-        mp = mempool;
-    }
+    LOCK(cs_txToAnnounce);
+    vTxToAnnounce.push_back(tx.GetHash());
+}
 
-    bool operator()(std::set<uint256>::iterator a, std::set<uint256>::iterator b)
+/**
+ * Append the transactions relayed since the last call to the announcement
+ * queue, topologically and fee-rate sorted for privacy and priority reasons,
+ * and drop the announcements that expired.
+ */
+static void QueueTxAnnouncements(int64_t nNow)
+{
+    AssertLockHeld(cs_main);
+    std::vector<uint256> vHashes;
     {
-        /* As std::make_heap produces a max-heap, we want the entries with the
-         * fewest ancestors/highest fee to sort later. */
-        return mp->CompareDepthAndScore(*b, *a);
+        LOCK(cs_txToAnnounce);
+        vHashes.swap(vTxToAnnounce);
     }
-};
+    if (!vHashes.empty()) {
+        // Those no longer in the mempool are not worth announcing.
+        for (const TxMempoolInfo& txinfo : mempool.infoSorted(vHashes))
+            dequeTxAnnounce.push_back(CTxAnnouncement{txinfo.tx, txinfo.feeRate.GetFeePerK(), nNow});
+    }
+    while (!dequeTxAnnounce.empty() && dequeTxAnnounce.front().nTime < nNow - TX_ANNOUNCE_EXPIRY) {
+        dequeTxAnnounce.pop_front();
+        nTxAnnounceBegin++;
+    }
+}
 
 bool SendMessages(CNode* pto)
 {
@@ -6953,27 +10016,25 @@ bool SendMessages(CNode* pto)
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
             vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
             {
-                if (!pto->addrKnown.contains(addr.GetKey()))
+                LOCK(pto->cs_vAddrToSend);
+                vAddr.reserve(pto->vAddrToSend.size());
+                BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
                 {
-                    pto->addrKnown.insert(addr.GetKey());
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
+                    if (!pto->addrKnown.contains(addr.GetKey()))
                     {
-                        pto->PushMessage(NetMsgType::ADDR, vAddr);
-                        vAddr.clear();
+                        pto->addrKnown.insert(addr.GetKey());
+                        vAddr.push_back(addr);
                     }
                 }
+                pto->vAddrToSend.clear();
+                // we only send the big addr message once
+                if (pto->vAddrToSend.capacity() > 40)
+                    pto->vAddrToSend.shrink_to_fit();
             }
-            pto->vAddrToSend.clear();
-            if (!vAddr.empty())
-                pto->PushMessage(NetMsgType::ADDR, vAddr);
-            // we only send the big addr message once
-            if (pto->vAddrToSend.capacity() > 40)
-                pto->vAddrToSend.shrink_to_fit();
+            // receiver rejects addr messages larger than 1000
+            for (size_t i = 0; i < vAddr.size(); i += 1000)
+                pto->PushMessage(NetMsgType::ADDR, vector<CAddress>(vAddr.begin() + i, vAddr.begin() + std::min(i + 1000, vAddr.size())));
         }
 
         CNodeState &state = *State(pto->GetId());
@@ -7077,16 +10138,25 @@ bool SendMessages(CNode* pto)
                         break;
                     }
                     pBestIndex = pindex;
+                    CBlockHeader header;
                     if (fFoundStartingHeader) {
                         // add this to the headers message
-                        vHeaders.push_back(pindex->GetBlockHeader());
+                        if (!GetBlockIndexHeader(pindex, header)) {
+                            fRevertToInv = true;
+                            break;
+                        }
+                        vHeaders.push_back(header);
                     } else if (PeerHasHeader(&state, pindex)) {
                         continue; // keep looking for the first new block
                     } else if (pindex->pprev == NULL || PeerHasHeader(&state, pindex->pprev)) {
                         // Peer doesn't have this header but they do have the prior one.
                         // Start sending headers.
                         fFoundStartingHeader = true;
-                        vHeaders.push_back(pindex->GetBlockHeader());
+                        if (!GetBlockIndexHeader(pindex, header)) {
+                            fRevertToInv = true;
+                            break;
+                        }
+                        vHeaders.push_back(header);
                     } else {
                         // Peer doesn't have this header or the prior one -- nothing will
                         // connect, so bail out.
@@ -7117,7 +10187,7 @@ bool SendMessages(CNode* pto)
                         LogPrint("net", "%s: sending header %s to peer=%d\n", __func__,
                                 vHeaders.front().GetHash().ToString(), pto->id);
                     }
-                    pto->PushMessage(NetMsgType::HEADERS, vHeaders);
+                    PushHeaders(pto, state.fWantsCompactHeaders, vHeaders);
                     state.pindexBestHeaderSent = pBestIndex;
                 } else
                     fRevertToInv = true;
@@ -7177,12 +10247,6 @@ bool SendMessages(CNode* pto)
                 pto->nNextInvSend = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL >> !pto->fInbound);
             }
 
-            // Time to send but the peer has requested we not relay transactions.
-            if (fSendTrickle) {
-                LOCK(pto->cs_filter);
-                if (!pto->fRelayTxes) pto->setInventoryTxToSend.clear();
-            }
-
             // Respond to BIP35 mempool requests
             if (fSendTrickle && pto->fSendMempool) {
                 auto vtxinfo = mempool.infoAll();
@@ -7198,7 +10262,6 @@ bool SendMessages(CNode* pto)
                 for (const auto& txinfo : vtxinfo) {
                     const uint256& hash = txinfo.tx->GetHash();
                     CInv inv(MSG_TX, hash);
-                    pto->setInventoryTxToSend.erase(hash);
                     if (filterrate) {
                         if (txinfo.feeRate.GetFeePerK() < filterrate)
                             continue;
@@ -7218,49 +10281,42 @@ bool SendMessages(CNode* pto)
 
             // Determine transactions to relay
             if (fSendTrickle) {
-                // Produce a vector with all candidates for sending
-                vector<std::set<uint256>::iterator> vInvTx;
-                vInvTx.reserve(pto->setInventoryTxToSend.size());
-                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); it++) {
-                    vInvTx.push_back(it);
-                }
+                QueueTxAnnouncements(nNow);
                 CAmount filterrate = 0;
                 {
                     LOCK(pto->cs_feeFilter);
                     filterrate = pto->minFeeFilter;
                 }
-                // Topologically and fee-rate sort the inventory we send for privacy and priority reasons.
-                // A heap is used so that not all items need sorting if only a few are being sent.
-                CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
-                std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
+                const uint64_t nTxAnnounceEnd = nTxAnnounceBegin + dequeTxAnnounce.size();
+                // Announcements expired before this peer got to them are skipped.
+                uint64_t& nNext = state.nNextTxAnnounce;
+                nNext = std::max(nNext, nTxAnnounceBegin);
                 // No reason to drain out at many times the network's capacity,
                 // especially since we have many peers and some will draw much shorter delays.
                 unsigned int nRelayedTransactions = 0;
                 LOCK(pto->cs_filter);
-                while (!vInvTx.empty() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
-                    // Fetch the top element from the heap
-                    std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
-                    std::set<uint256>::iterator it = vInvTx.back();
-                    vInvTx.pop_back();
-                    uint256 hash = *it;
-                    // Remove it from the to-be-sent set
-                    pto->setInventoryTxToSend.erase(it);
+                // Time to send but the peer has requested we not relay transactions.
+                if (!pto->fRelayTxes) nNext = nTxAnnounceEnd;
+                while (nNext < nTxAnnounceEnd && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
+                    const CTxAnnouncement& announcement = dequeTxAnnounce[nNext++ - nTxAnnounceBegin];
+                    const uint256& hash = announcement.tx->GetHash();
                     // Check if not in the filter already
                     if (pto->filterInventoryKnown.contains(hash)) {
                         continue;
                     }
-                    // Not in the mempool anymore? don't bother sending it.
-                    auto txinfo = mempool.info(hash);
-                    if (!txinfo.tx) {
+                    if (filterrate && announcement.nFeePerK < filterrate) {
                         continue;
                     }
-                    if (filterrate && txinfo.feeRate.GetFeePerK() < filterrate) {
+                    // Not in the mempool anymore? don't bother sending it.
+                    if (!mempool.exists(hash)) {
                         continue;
                     }
-                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
-                    // Send
-                    vInv.push_back(CInv(MSG_TX, hash));
-                    nRelayedTransactions++;
+                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*announcement.tx)) continue;
+                    // Send, or leave for the next reconciliation with the peer
+                    if (!state.txrecon || !state.txrecon->Add(announcement.tx)) {
+                        vInv.push_back(CInv(MSG_TX, hash));
+                        nRelayedTransactions++;
+                    }
                     {
                         // Expire old relay messages
                         while (!vRelayExpiration.empty() && vRelayExpiration.front().first < nNow)
@@ -7269,7 +10325,7 @@ bool SendMessages(CNode* pto)
                             vRelayExpiration.pop_front();
                         }
 
-                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(txinfo.tx)));
+                        auto ret = mapRelay.insert(std::make_pair(hash, announcement.tx));
                         if (ret.second) {
                             vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
                         }
@@ -7281,6 +10337,14 @@ bool SendMessages(CNode* pto)
                     pto->filterInventoryKnown.insert(hash);
                 }
             }
+
+            // Start a reconciliation round; until its sketch arrives, what
+            // the peer would be announced keeps collecting in the set.
+            if (state.txrecon && state.txrecon->fInitiator && !state.txrecon->fAwaitingSketch && state.txrecon->nNextRequest < nNow) {
+                pto->PushMessage(NetMsgType::REQRECON, (uint32_t)state.txrecon->mapSet.size());
+                state.txrecon->fAwaitingSketch = true;
+                state.txrecon->nNextRequest = PoissonNextSend(nNow, TXRECON_REQUEST_INTERVAL);
+            }
         }
         if (!vInv.empty())
             pto->PushMessage(NetMsgType::INV, vInv);
@@ -7330,6 +10394,24 @@ bool SendMessages(CNode* pto)
                 }
             }
         }
+        // Request a late next block from this peer as well. The block stays
+        // in flight from one peer at a time, but the late one's copy is still
+        // accepted when it arrives first.
+        if (fLowLatencyFetch && !pto->fDisconnect && !pto->fClient && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER && CanDirectFetch(consensusParams)) {
+            CBlockIndex *pindex = FindBlockToRace(pto->GetId(), nNow, consensusParams);
+            if (pindex) {
+                const pair<NodeId, list<QueuedBlock>::iterator>& inFlight = mapBlocksInFlight[pindex->GetBlockHash()];
+                // It took at least this long.
+                UpdateBlockDownloadTime(State(inFlight.first), nNow - inFlight.second->nTime);
+                LogPrint("net", "Racing block %s (%d) from peer=%d to peer=%d\n", pindex->GetBlockHash().ToString(),
+                    pindex->nHeight, inFlight.first, pto->id);
+                MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), consensusParams, pindex);
+                if (state.fSupportsDesiredCmpctVersion)
+                    vGetData.push_back(CInv(MSG_CMPCT_BLOCK, pindex->GetBlockHash()));
+                else
+                    vGetData.push_back(CInv(MSG_BLOCK | GetFetchFlags(pto, pindex->pprev, consensusParams), pindex->GetBlockHash()));
+            }
+        }
 
         //
         // Message: getdata (non-blocks)
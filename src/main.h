@@ -30,11 +30,18 @@
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
+class CBlockFilterDB;
+class CBlockStatsDB;
+class CScriptIndexDB;
 class CBlockTreeDB;
+class CTxIndexDB;
 class CBloomFilter;
 class CChainParams;
 class CInv;
 class CCheck;
+class CDataStream;
+class CCoinsViewDB;
+class CCoinsViewPrefetch;
 class CTxMemPool;
 class CValidationInterface;
 class CValidationState;
@@ -55,8 +62,16 @@ static const CAmount DEFAULT_TRANSACTION_MAXFEE = 0.1 * COIN;
 static const CAmount HIGH_TX_FEE_PER_KB = 0.01 * COIN;
 //! -maxtxfee will warn if called with a higher fee than this amount (in satoshis)
 static const CAmount HIGH_MAX_TX_FEE = 100 * HIGH_TX_FEE_PER_KB;
+/** Memory used by recently rejected transactions kept to complete rpblocktxn messages */
+static const size_t MAX_RECENT_REJECTED_TXS_USAGE = 5 * 1000 * 1000;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxorphantxsize, maximum kilobytes of memory used by orphan transactions */
+static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS_SIZE = 5000;
+/** Default for -peertxbudget, milliseconds per second a peer's transactions may take to validate on average */
+static const int64_t DEFAULT_PEER_TX_BUDGET = 100;
+/** Seconds' worth of -peertxbudget a peer can save up for a burst of transactions */
+static const int64_t PEER_TX_BUDGET_BURST = 10;
 /** Expiration time for orphan transactions in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 /** Minimum time between orphan transactions expire time checks in seconds */
@@ -71,10 +86,16 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 375;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
+/** The maximum number of block files kept memory mapped for reading */
+static const unsigned int MAX_MAPPED_BLOCK_FILES = 32;
+/** The most block and undo data queued for writing before validation waits for the disk */
+static const size_t MAX_BLOCK_WRITE_QUEUE_BYTES = 64 * 1024 * 1024;
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
@@ -82,6 +103,8 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of parent chain blocks waiting to be looked up ahead of peg-in validation */
+static const unsigned int MAX_PEGIN_PREFETCH_QUEUE = 10000;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -110,6 +133,9 @@ static const unsigned int INVENTORY_BROADCAST_INTERVAL = 5;
 /** Maximum number of inventory items to send per transmission.
  *  Limits the impact of low-fee transaction floods. */
 static const unsigned int INVENTORY_BROADCAST_MAX = 7 * INVENTORY_BROADCAST_INTERVAL;
+/** Time in microseconds a transaction stays queued for announcement to peers
+ *  that have not reached it yet, as long as it is kept for their getdata. */
+static const int64_t TX_ANNOUNCE_EXPIRY = 15 * 60 * 1000000LL;
 /** Average delay between feefilter broadcasts in seconds. */
 static const unsigned int AVG_FEEFILTER_BROADCAST_INTERVAL = 10 * 60;
 /** Maximum feefilter broadcast delay after significant change. */
@@ -118,6 +144,12 @@ static const unsigned int MAX_FEEFILTER_CHANGE_DELAY = 5 * 60;
 static const int64_t BLOCK_DOWNLOAD_TIMEOUT_BASE = 1000000;
 /** Additional block download timeout per parallel downloading peer (i.e. 5 min) */
 static const int64_t BLOCK_DOWNLOAD_TIMEOUT_PER_PEER = 500000;
+/** Default for -lowlatencyfetch */
+static const bool DEFAULT_LOW_LATENCY_FETCH = false;
+/** With -lowlatencyfetch, the shortest time in microseconds a block after the tip is waited for before it is raced */
+static const int64_t BLOCK_RACE_TIMEOUT_MIN = 250000;
+/** With -lowlatencyfetch, the time waited for a block from a peer whose download time was not measured yet */
+static const int64_t BLOCK_RACE_TIMEOUT_UNMEASURED = 1000000;
 
 static const unsigned int DEFAULT_LIMITFREERELAY = 15;
 static const bool DEFAULT_RELAYPRIORITY = true;
@@ -127,6 +159,9 @@ static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+static const bool DEFAULT_BLOCKSTATSINDEX = false;
+static const bool DEFAULT_SCRIPTINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 static const bool DEFAULT_TESTSAFEMODE = false;
@@ -141,7 +176,16 @@ static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
 /** Maximum number of unconnecting headers announcements before DoS score */
 static const int MAX_UNCONNECTING_HEADERS = 10;
 
+/** Maximum number of block proposals being signed that are kept at once */
+static const unsigned int MAX_SIGNING_ROUNDS = 8;
+/** Maximum number of signatures kept for a proposal we have not seen yet */
+static const unsigned int MAX_EARLY_BLOCK_SIGS = 32;
+/** Maximum number of signatures on proposals we have not seen yet kept from one peer */
+static const unsigned int MAX_EARLY_BLOCK_SIGS_PER_PEER = 4;
+
 static const bool DEFAULT_PEERBLOOMFILTERS = true;
+/** Default for -txreconciliation */
+static const bool DEFAULT_TXRECONCILIATION = false;
 
 struct BlockHasher
 {
@@ -163,11 +207,16 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fScriptIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Block whose ancestors ConnectBlock skips script and range proof checks for (-assumevalid) */
+extern uint256 hashAssumeValid;
 extern size_t nCoinCacheUsage;
+/** Compaction rate limit of the chain state during initial block download (bytes/s, 0 for no limit) */
+extern uint64_t nDBCompactionRate;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** Absolute maximum transaction fee (in satoshis) used by wallet and mempool (rejects high fee in sendrawtransaction) */
@@ -175,6 +224,10 @@ extern CAmount maxTxFee;
 /** If the tip is older than this (in seconds), the node is considered to be in initial block download. */
 extern int64_t nMaxTipAge;
 extern bool fEnableReplacement;
+/** Whether blocks after the tip are fetched for the lowest latency rather than the least bandwidth. */
+extern bool fLowLatencyFetch;
+/** Milliseconds per second each peer's transactions may take to validate before they are postponed, 0 for no limit. */
+extern int64_t nPeerTxBudget;
 
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
@@ -189,8 +242,21 @@ extern bool fHavePruned;
 extern bool fPruneMode;
 /** Number of MiB of block files that we're trying to stay below. */
 extern uint64_t nPruneTarget;
+/** True if the rangeproofs of any block file have ever been pruned. */
+extern bool fHavePrunedRangeproofs;
+/** True if we're running in -prunerangeproofs mode. */
+extern bool fRangeproofPruneMode;
+/** Number of bytes of block files that -prunerangeproofs tries to stay below. */
+extern uint64_t nRangeproofPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
+/**
+ * Block solutions of active chain blocks deeper than this are dropped from
+ * memory, and read from the block tree database when needed. One
+ * MAX_HEADERS_RESULTS worth of headers stays in memory for peers that are
+ * nearly in sync.
+ */
+static const int KEEP_SOLUTIONS_DEPTH = MAX_HEADERS_RESULTS;
 
 static const signed int DEFAULT_CHECKBLOCKS = 6;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
@@ -233,10 +299,70 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/** Re-import the block files for -reindex, reading ahead on parallel threads */
+void ReindexBlockFiles(const CChainParams& chainparams);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex();
+/**
+ * Write the block index to a snapshot file that the next startup loads in
+ * one read, instead of iterating the block tree database. Any later change
+ * to the block index in the database invalidates the snapshot.
+ */
+bool WriteBlockIndexSnapshot();
+/**
+ * The statistics of the UTXO set, kept up to date as blocks are connected
+ * and disconnected. Returns false if they are not known, until a full scan
+ * hands them to SetUTXOSetStats. Both require cs_main.
+ */
+bool GetUTXOSetStats(CUTXOStats& stats, uint256& hashBlock);
+/** Adopt statistics computed by a full scan, if hashBlock is still the chainstate's best block */
+void SetUTXOSetStats(const CUTXOStats& stats, const uint256& hashBlock);
+
+/** What a UTXO snapshot file holds, see DumpUTXOSnapshot */
+struct CUTXOSnapshotInfo
+{
+    uint256 hashBlock;
+    int nHeight;
+    uint64_t nCoins;            //!< transactions with unspent outputs
+    uint64_t nWithdrawsSpent;
+    uint256 hashSnapshot;       //!< what -assumeutxo commits to
+
+    CUTXOSnapshotInfo() : nHeight(0), nCoins(0), nWithdrawsSpent(0) {}
+};
+
+/**
+ * Write the chainstate at the tip (its coins and spent withdraws) to a
+ * snapshot file. Another node can start from it with LoadUTXOSnapshot.
+ */
+bool DumpUTXOSnapshot(const boost::filesystem::path& path, CUTXOSnapshotInfo& info, std::string& strError);
+/**
+ * Read the coins and spent withdraws of the UTXO snapshot at path into view,
+ * checking the hash at its end but not whether -assumeutxo commits to it.
+ * The coins are also counted in stats, and withdraw locks among them added
+ * to mapLocksCreated.
+ */
+bool ReadUTXOSnapshot(const boost::filesystem::path& path, CCoinsViewCache& view, CUTXOSnapshotInfo& info, CUTXOStats& stats, std::multimap<uint256, std::pair<COutPoint, CAmount> >& mapLocksCreated, std::string& strError);
+/**
+ * Replace a chainstate still at the genesis block with a snapshot, if
+ * -assumeutxo commits to it and the header of its block is known. The block
+ * becomes the tip; the blocks before it are not downloaded or validated.
+ */
+bool LoadUTXOSnapshot(const CChainParams& chainparams, const boost::filesystem::path& path, CUTXOSnapshotInfo& info, std::string& strError);
+/**
+ * Add the transactions of mempool.dat, written by DumpMempool, back to the
+ * mempool, with their original acceptance times and prioritisation deltas.
+ * Those past -mempoolexpiry are left out.
+ */
+bool LoadMempool();
+/** Write the mempool and its prioritisation deltas to mempool.dat */
+bool DumpMempool();
+/**
+ * Number of orphan transactions, the memory they use and the number of
+ * distinct outpoints they are waiting for.
+ */
+void GetOrphanStats(size_t& nCount, size_t& nUsage, size_t& nMissingOutpoints);
 /** Unload database information */
 void UnloadBlockIndex();
 /** Process protocol messages received from a given node */
@@ -247,8 +373,18 @@ bool ProcessMessages(CNode* pfrom);
  * @param[in]   pto             The node which we are sending messages to.
  */
 bool SendMessages(CNode* pto);
+/** Queue a transaction to be announced to all peers */
+void RelayTransaction(const CTransaction& tx);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread verifying relayed transactions for PreCheckTransactionForMempool */
+void ThreadMempoolCheck();
+/** Run the thread that looks up peg-in parent blocks before their block is connected */
+void ThreadPeginPrefetch();
+/** Write block and undo data in the background from now on */
+void StartBlockFileWriter();
+/** Finish writing queued block and undo data, and write on the caller's thread again */
+void StopBlockFileWriter();
 /** Check if bitcoind connection via RPC is correctly working*/
 bool BitcoindRPCCheck(bool init);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -265,6 +401,8 @@ std::string GetWarnings(const std::string& strFor);
 bool GetTransaction(const uint256 &hash, CTransaction &tx, const Consensus::Params& params, uint256 &hashBlock, bool fAllowSlow = false);
 /** Select Inputs which lock at least nAmount to the given chain */
 bool GetLockedOutputs(const uint256 &genesisHash, const CAmount &nAmount, std::vector<std::pair<COutPoint, CAmount> >& res);
+/** Add and remove confirmed withdraw locks, keyed by genesis hash, in the lock index and block tree DB */
+bool UpdateLockedOutputs(const std::multimap<uint256, std::pair<COutPoint, CAmount> >& mapAdded, const std::multimap<uint256, std::pair<COutPoint, CAmount> >& mapRemoved);
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams, const CBlock* pblock = NULL);
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
@@ -291,8 +429,21 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
  */
 void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
 
+/**
+ * Find the oldest block file whose rangeproofs should be removed to bring the block and undo files below
+ * nRangeproofPruneTarget, or -1 if there is none. Like FindFilesToPrune it never selects a file containing a
+ * block within MIN_BLOCKS_TO_KEEP of the tip, and files are only pruned once.
+ *
+ * Unlike -prune, headers, transactions and value commitments are kept: the file is rewritten with every
+ * rangeproof removed and the affected blocks are flagged BLOCK_RANGEPROOFS_PRUNED. Such blocks are no longer
+ * served to peers, as they fail to validate without their rangeproofs.
+ */
+int FindFileToPruneRangeproofs(uint64_t nPruneAfterHeight);
+
 /** Create a new block index entry for a given block hash */
 CBlockIndex * InsertBlockIndex(uint256 hash);
+/** The header of a block index, with its solution read back from the block tree database if it was dropped. Returns false if that read fails. */
+bool GetBlockIndexHeader(const CBlockIndex* pindex, CBlockHeader& header);
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
@@ -306,6 +457,18 @@ void PruneAndFlush();
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
+
+/**
+ * Run the checks of AcceptToMemoryPool that need neither the chain nor the
+ * mempool, including the range proofs, on the mempool check threads. Does not
+ * need cs_main. Valid proofs are stored in the range proof cache, where
+ * AcceptToMemoryPool finds them.
+ */
+bool PreCheckTransactionForMempool(const CTransaction& tx, CValidationState& state);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -317,6 +480,7 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int64_t nTxValidationMicros;
 };
 
 
@@ -349,26 +513,46 @@ int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& i
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline. Transactions the mempool fully verified under the same
+ * flags only get the checks that depend on the UTXO set.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
                  unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::set<std::pair<uint256, COutPoint> >& setWithdrawsSpent,
                  std::vector<CCheck*> *pvChecks = NULL);
 
+/** Script verification flags ConnectBlock uses for a block on top of pindexPrev. */
+unsigned int GetBlockScriptFlags(const CBlockIndex* pindexPrev, const Consensus::Params& consensusparams);
+
+/** Allocate the cache of fully validated mempool transactions, sized from -maxsigcachesize. */
+void InitTxValidationCache();
+
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
 
 /** Context-independent validity checks */
 bool CheckTransaction(const CTransaction& tx, CValidationState& state);
 
+/**
+ * Check the range proof of a confidential output for what can be seen without
+ * verifying it: the header, and a length matching the rings the header
+ * implies. Every proof this rejects would fail verification too. nCost is
+ * set to the number of public keys verification goes through, 0 for an
+ * output without a proof.
+ */
+bool CheckRangeProofHeader(const CTxOutValue& val, unsigned int& nCost);
+
+/** Sum of the costs CheckRangeProofHeader gives the well-formed proofs of tx */
+int64_t GetTransactionRangeProofCost(const CTransaction& tx);
+
 namespace Consensus {
 
 /**
  * Check whether all inputs of this transaction are valid (no double spends and amounts)
- * This does not modify the UTXO set. This does not check scripts and sigs.
+ * This does not modify the UTXO set. This does not check scripts and sigs, nor
+ * amounts if fVerifyAmounts is false, nor range proofs if fRangeProofChecks is false.
  * Preconditions: tx.IsCoinBase() is false.
  */
-bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, int nSpendHeight, std::set<std::pair<uint256, COutPoint> >& setWithdrawsSpent, std::vector<CCheck*> *pvChecks, const bool cacheStore);
+bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, int nSpendHeight, std::set<std::pair<uint256, COutPoint> >& setWithdrawsSpent, std::vector<CCheck*> *pvChecks, const bool cacheStore, const bool fVerifyAmounts = true, const bool fRangeProofChecks = true, std::vector<CCheck*>* pvRangeChecks = NULL);
 
 } // namespace Consensus
 
@@ -380,9 +564,11 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
  * @param[in] excess additional amount to consider as input value (eg fees), can be negative
  * @param[in] pvChecks  multithreaded rangeproof and commitment checker
  * @param[in] cacheStore signal if rangeproof verification should be cached
+ * @param[in] fRangeProofChecks false to only check the totals, not the rangeproofs
+ * @param[out] pvRangeChecks  if given, where the rangeproof checks go instead of pvChecks
  * @return  True if totals are identical
 */
-bool VerifyAmounts(const CCoinsViewCache& cache, const CTransaction& tx, const CAmount& excess, std::vector<CCheck*>* pvChecks = NULL, const bool cacheStore = false);
+bool VerifyAmounts(const CCoinsViewCache& cache, const CTransaction& tx, const CAmount& excess, std::vector<CCheck*>* pvChecks = NULL, const bool cacheStore = false, const bool fRangeProofChecks = true, std::vector<CCheck*>* pvRangeChecks = NULL);
 
 
 /**
@@ -440,6 +626,9 @@ class CCheck
 
      virtual bool operator()() = 0;
 
+     //! Rough cost of operator(), in units of one signature check (used by CCheckQueue to balance work)
+     virtual unsigned int GetCost() const { return 1; }
+
      ScriptError GetScriptError() const { return error; }
      bool IsAmountError() const { return fAmountError; }
 };
@@ -471,12 +660,31 @@ public:
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/**
+ * Read the block of pindex as serialized on the network, without deserializing
+ * it. Without fWitness the witness data is cut out of the stored bytes.
+ */
+bool ReadRawBlockFromDisk(std::vector<char>& vData, const CBlockIndex* pindex, bool fWitness);
+/** Same as above for the block with the given hash at pos, which fails if a different block is found there. */
+bool ReadRawBlockFromDisk(std::vector<char>& vData, const CDiskBlockPos& pos, const uint256& hash, bool fWitness);
+/**
+ * Append the confidential data of the outputs of the block of pindex to ss,
+ * picked out of the stored bytes without deserializing the block: the block
+ * hash, then the number of transactions, then for each of them its txid, the
+ * number of its outputs and for each output its 33 byte value commitment,
+ * nonce commitment and rangeproof, the last two as CompactSize-prefixed bytes.
+ */
+bool ReadBlockCTDataFromDisk(CDataStream& ss, const CBlockIndex* pindex);
 
 /** Functions for validating blocks and updating the block tree */
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true);
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/**
+ * fUseQueue spreads the transaction checks over the script check threads; the
+ * caller must then hold cs_main.
+ */
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fUseQueue = false);
 
 /** Context-dependent validity checks.
  *  By "context", we mean only the previous block headers, but not the UTXO
@@ -486,19 +694,44 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons).
+ *  If pstats is given, the block's changes to the UTXO set are applied to it on success. */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins,
-                  const CChainParams& chainparams, std::set<std::pair<uint256, COutPoint> >* setWithdrawsSpent = NULL, bool fJustCheck = false);
+                  const CChainParams& chainparams, std::set<std::pair<uint256, COutPoint> >* setWithdrawsSpent = NULL, bool fJustCheck = false, CUTXOStats* pstats = NULL);
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified. pstats is updated
+ *  only on a clean disconnect without pfClean. */
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, CUTXOStats* pstats = NULL);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
+/**
+ * Check a block proposal on top of the current tip, as TestBlockValidity,
+ * once per block hash: the verdict is kept, along with the block, for as long
+ * as the tip does not move, so that signing the same proposal again does not
+ * validate it again. Signatures on a valid proposal are combined as they
+ * arrive in "blocksig" messages, and the block is processed once complete.
+ * When the signed block is connected, from there or from submitblock, the
+ * scripts and range proofs checked here are not checked again.
+ * Requires cs_main.
+ */
+bool TestProposedBlock(CValidationState& state, const CChainParams& chainparams, const CBlock& block);
+
+/**
+ * Combine a signature (a scriptSig on the block header) into the proposal
+ * with the given hash and relay it to our peers if it added anything. If this
+ * completes the block, it is processed as a new block. A signature on a
+ * proposal we have not seen yet is kept until we do, up to
+ * MAX_EARLY_BLOCK_SIGS_PER_PEER of them from a peer that is not whitelisted.
+ * pfrom is penalized for a signature that turns out not to verify.
+ * Returns whether the signature was new to us.
+ */
+bool AddBlockSignature(const CChainParams& chainparams, const uint256& hash, const CScript& scriptSig, CNode* pfrom = NULL);
+
 /** Check whether witness commitments are required for block. */
 bool IsWitnessEnabled(const CBlockIndex* pindexPrev, const Consensus::Params& params);
 
@@ -508,8 +741,9 @@ bool RewindBlockIndex(const CChainParams& params);
 /** Update uncommitted block structures (currently: only the witness nonce). This is safe for submitted blocks. */
 void UpdateUncommittedBlockStructures(CBlock& block, const CBlockIndex* pindexPrev, const Consensus::Params& consensusParams);
 
-/** Produce the necessary coinbase commitment for a block (modifies the hash, don't call for mined blocks). */
-std::vector<unsigned char> GenerateCoinbaseCommitment(CBlock& block, const CBlockIndex* pindexPrev, const Consensus::Params& consensusParams);
+/** Produce the necessary coinbase commitment for a block (modifies the hash, don't call for mined blocks).
+ *  pwitnessroot, if given, is the witness merkle root of the block, which is then not recomputed. */
+std::vector<unsigned char> GenerateCoinbaseCommitment(CBlock& block, const CBlockIndex* pindexPrev, const Consensus::Params& consensusParams, const uint256* pwitnessroot = NULL);
 
 /** RAII wrapper for VerifyDB: Verify consistency of the block and coin databases */
 class CVerifyDB {
@@ -531,12 +765,43 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/**
+ * Copy of chainActive as of its last change, which stays valid and unchanged
+ * for as long as it is held. Does not need cs_main.
+ */
+std::shared_ptr<const CChainSnapshot> GetChainSnapshot();
+
+/**
+ * Find a block index entry by hash without cs_main, or NULL. Entries are not
+ * freed while the node runs, and their header fields, height, pprev and
+ * nChainWork do not change; the rest of an entry still needs cs_main.
+ */
+CBlockIndex* LookupBlockIndex(const uint256& hash);
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** The chainstate database at the bottom of pcoinsTip */
+extern CCoinsViewDB *pcoinsdbview;
+
+/** Loads the inputs of incoming blocks ahead of pcoinsTip (may be NULL) */
+extern CCoinsViewPrefetch *pcoinsPrefetch;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Positions of transactions in the block files, NULL unless -txindex (protected by cs_main) */
+extern CTxIndexDB *ptxindexdb;
+
+/** Compact filters of connected blocks, NULL unless -blockfilterindex (protected by cs_main) */
+extern CBlockFilterDB *pblockfilterdb;
+
+/** Statistics of connected blocks, NULL unless -blockstatsindex (protected by cs_main) */
+extern CBlockStatsDB *pblockstatsdb;
+
+/** Outputs and spends by script, NULL unless -scriptindex (protected by cs_main) */
+extern CScriptIndexDB *pscriptindexdb;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
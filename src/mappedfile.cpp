@@ -0,0 +1,77 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::CMappedFile(const boost::filesystem::path& path) : pbegin(NULL), nSize(0)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            pbegin = static_cast<const char*>(p);
+            nSize = st.st_size;
+        } else {
+            LogPrintf("Unable to map %s\n", path.string());
+        }
+    }
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+#endif
+}
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    if (pbegin)
+        munmap(const_cast<char*>(pbegin), nSize);
+#endif
+}
+
+boost::shared_ptr<CMappedFile> CMappedFileCache::Get(int nFile, const boost::filesystem::path& path, size_t nMinSize)
+{
+    LOCK(cs);
+    for (MappedList::iterator it = listMapped.begin(); it != listMapped.end(); ++it) {
+        if (it->first != nFile)
+            continue;
+        if (it->second->size() >= nMinSize) {
+            listMapped.splice(listMapped.begin(), listMapped, it);
+            return it->second;
+        }
+        listMapped.erase(it);
+        break;
+    }
+
+    boost::shared_ptr<CMappedFile> pfile(new CMappedFile(path));
+    if (!pfile->IsMapped() || pfile->size() < nMinSize)
+        return boost::shared_ptr<CMappedFile>();
+    listMapped.push_front(std::make_pair(nFile, pfile));
+    if (listMapped.size() > nMaxFiles)
+        listMapped.pop_back();
+    return pfile;
+}
+
+void CMappedFileCache::Erase(int nFile)
+{
+    LOCK(cs);
+    for (MappedList::iterator it = listMapped.begin(); it != listMapped.end(); ++it) {
+        if (it->first == nFile) {
+            listMapped.erase(it);
+            return;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <stddef.h>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * Read-only memory mapping of a whole file, as large as the file was when it
+ * was mapped. Bytes appended later are not visible; map the file again to
+ * see them. Not available on Windows, where IsMapped() is always false.
+ */
+class CMappedFile
+{
+private:
+    const char* pbegin;
+    size_t nSize;
+
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+public:
+    explicit CMappedFile(const boost::filesystem::path& path);
+    ~CMappedFile();
+
+    bool IsMapped() const { return pbegin != NULL; }
+    const char* begin() const { return pbegin; }
+    size_t size() const { return nSize; }
+};
+
+/**
+ * Keeps the most recently used files of a numbered series (such as blk?????.dat)
+ * mapped. Mappings are handed out as shared pointers, so one stays valid for as
+ * long as a reader holds it, even if it is evicted or the file is deleted.
+ */
+class CMappedFileCache
+{
+private:
+    typedef std::list<std::pair<int, boost::shared_ptr<CMappedFile> > > MappedList;
+
+    CCriticalSection cs;
+    //! Most recently used first
+    MappedList listMapped;
+    const size_t nMaxFiles;
+
+public:
+    explicit CMappedFileCache(size_t nMaxFilesIn) : nMaxFiles(nMaxFilesIn) {}
+
+    /**
+     * Return a mapping of file nFile at path that covers at least nMinSize
+     * bytes, remapping the file if it grew since it was last mapped. Returns
+     * NULL if the file is shorter or cannot be mapped.
+     */
+    boost::shared_ptr<CMappedFile> Get(int nFile, const boost::filesystem::path& path, size_t nMinSize);
+
+    //! Drop the mapping of nFile, to be called when the file is truncated or deleted
+    void Erase(int nFile);
+};
+
+#endif // BITCOIN_MAPPEDFILE_H
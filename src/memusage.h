@@ -6,6 +6,8 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include "indirectmap.h"
+#include "sharedvector.h"
+#include "support/allocators/pool.h"
 
 #include <stdlib.h>
 
@@ -81,6 +83,11 @@ struct stl_shared_counter
     size_t weak_count;
 };
 
+static inline size_t DynamicUsage(const std::vector<bool>& v)
+{
+    return MallocUsage((v.capacity() + 7) / 8);
+}
+
 template<typename X>
 static inline size_t DynamicUsage(const std::vector<X>& v)
 {
@@ -146,6 +153,16 @@ static inline size_t DynamicUsage(const std::shared_ptr<X>& p)
     return p ? MallocUsage(sizeof(X)) + MallocUsage(sizeof(stl_shared_counter)) : 0;
 }
 
+template<typename X>
+static inline size_t DynamicUsage(const shared_vector<X>& v)
+{
+    // Elements shared between copies are counted in full for each of them,
+    // and elements in an arena as their share of its chunk.
+    if (v.is_in_arena())
+        return v.size() * sizeof(X);
+    return v.is_allocated() ? MallocUsage(sizeof(std::vector<X>)) + MallocUsage(sizeof(stl_shared_counter)) + MallocUsage(v.capacity() * sizeof(X)) : 0;
+}
+
 // Boost data structures
 
 template<typename X>
@@ -167,6 +184,16 @@ static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(boost_unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z, typename P, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z, P, PoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    // The nodes live in the pool, which holds on to its chunks, so count
+    // those (and their std::list nodes) instead of the nodes themselves.
+    const PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>* resource = m.get_allocator().Resource();
+    const size_t nChunkUsage = MallocUsage(resource->ChunkSizeBytes()) + MallocUsage(sizeof(void*) * 3);
+    return nChunkUsage * resource->NumAllocatedChunks() + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
@@ -9,6 +9,8 @@
 #include "consensus/consensus.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+
 using namespace std;
 
 CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
@@ -23,8 +25,8 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
 
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
-        const uint256& hash = block.vtx[i].GetHash();
-        if (filter.IsRelevantAndUpdate(block.vtx[i]))
+        const uint256& hash = block.vtx[i]->GetHash();
+        if (filter.IsRelevantAndUpdate(*block.vtx[i]))
         {
             vMatch.push_back(true);
             vMatchedTxn.push_back(make_pair(i, hash));
@@ -37,6 +39,23 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
     txn = CPartialMerkleTree(vHashes, vMatch);
 }
 
+CMerkleBlock::CMerkleBlock(const CBlockHeader& headerIn, const CMerkleTreeLevels& tree, const std::vector<CBloomTxElements>& vElements, CBloomFilter& filter) : header(headerIn)
+{
+    assert(vElements.size() == tree.GetTransactionCount());
+
+    vector<unsigned int> vMatchPos;
+    for (unsigned int i = 0; i < vElements.size(); i++)
+    {
+        if (filter.IsRelevantAndUpdate(vElements[i]))
+        {
+            vMatchPos.push_back(i);
+            vMatchedTxn.push_back(make_pair(i, vElements[i].hash));
+        }
+    }
+
+    txn = CPartialMerkleTree(tree, vMatchPos);
+}
+
 CMerkleBlock::CMerkleBlock(const CBlock& block, const std::set<uint256>& txids)
 {
     header = block.GetBlockHeader();
@@ -49,7 +68,7 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, const std::set<uint256>& txids)
 
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
-        const uint256& hash = block.vtx[i].GetHash();
+        const uint256& hash = block.vtx[i]->GetHash();
         if (txids.count(hash))
             vMatch.push_back(true);
         else
@@ -95,6 +114,23 @@ void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const st
     }
 }
 
+void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const CMerkleTreeLevels &tree, const std::vector<unsigned int> &vMatchPos) {
+    // determine whether this node is the parent of at least one matched txid
+    std::vector<unsigned int>::const_iterator it = std::lower_bound(vMatchPos.begin(), vMatchPos.end(), pos << height);
+    bool fParentOfMatch = it != vMatchPos.end() && *it < (pos+1) << height;
+    // store as flag bit
+    vBits.push_back(fParentOfMatch);
+    if (height==0 || !fParentOfMatch) {
+        // if at height 0, or nothing interesting below, store hash and stop
+        vHash.push_back(tree.GetHash(height, pos));
+    } else {
+        // otherwise, don't store any hash, but descend into the subtrees
+        TraverseAndBuild(height-1, pos*2, tree, vMatchPos);
+        if (pos*2+1 < CalcTreeWidth(height-1))
+            TraverseAndBuild(height-1, pos*2+1, tree, vMatchPos);
+    }
+}
+
 uint256 CPartialMerkleTree::TraverseAndExtract(int height, unsigned int pos, unsigned int &nBitsUsed, unsigned int &nHashUsed, std::vector<uint256> &vMatch, std::vector<unsigned int> &vnIndex) {
     if (nBitsUsed >= vBits.size()) {
         // overflowed the bits array - failure
@@ -147,8 +183,27 @@ CPartialMerkleTree::CPartialMerkleTree(const std::vector<uint256> &vTxid, const
     TraverseAndBuild(nHeight, 0, vTxid, vMatch);
 }
 
+CPartialMerkleTree::CPartialMerkleTree(const CMerkleTreeLevels &tree, const std::vector<unsigned int> &vMatchPos) : nTransactions(tree.GetTransactionCount()), fBad(false) {
+    TraverseAndBuild(tree.GetHeight(), 0, tree, vMatchPos);
+}
+
 CPartialMerkleTree::CPartialMerkleTree() : nTransactions(0), fBad(true) {}
 
+CMerkleTreeLevels::CMerkleTreeLevels(const std::vector<uint256>& vTxid) : vLevels(1, vTxid) {
+    // each level pairs up the nodes of the one below, the last node with
+    // itself if it has no sibling, as CalcHash does
+    while (vLevels.back().size() > 1) {
+        const std::vector<uint256>& vBelow = vLevels.back();
+        std::vector<uint256> vLevel((vBelow.size() + 1) / 2);
+        for (unsigned int pos = 0; pos < vLevel.size(); pos++) {
+            const uint256& left = vBelow[pos*2];
+            const uint256& right = pos*2+1 < vBelow.size() ? vBelow[pos*2+1] : left;
+            vLevel[pos] = Hash(BEGIN(left), END(left), BEGIN(right), END(right));
+        }
+        vLevels.push_back(vLevel);
+    }
+}
+
 uint256 CPartialMerkleTree::ExtractMatches(std::vector<uint256> &vMatch, std::vector<unsigned int> &vnIndex) {
     vMatch.clear();
     // An empty set will not work
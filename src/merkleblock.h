@@ -13,6 +13,25 @@
 
 #include <vector>
 
+/**
+ * All the levels of a block's merkle tree, from the txids up to the root,
+ * computed once so that many partial merkle trees can be cut out of it
+ * without hashing anything again.
+ */
+class CMerkleTreeLevels
+{
+private:
+    /** vLevels[h][pos] is the hash of node pos at height h; vLevels[0] are the txids */
+    std::vector<std::vector<uint256> > vLevels;
+
+public:
+    explicit CMerkleTreeLevels(const std::vector<uint256>& vTxid);
+
+    unsigned int GetTransactionCount() const { return vLevels.front().size(); }
+    int GetHeight() const { return vLevels.size() - 1; }
+    const uint256& GetHash(int height, unsigned int pos) const { return vLevels[height][pos]; }
+};
+
 /** Data structure that represents a partial merkle tree.
  *
  * It represents a subset of the txid's of a known block, in a way that
@@ -73,6 +92,9 @@ protected:
     /** recursive function that traverses tree nodes, storing the data as bits and hashes */
     void TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
 
+    /** the same, taking the hashes from the complete tree and the matches as sorted positions */
+    void TraverseAndBuild(int height, unsigned int pos, const CMerkleTreeLevels &tree, const std::vector<unsigned int> &vMatchPos);
+
     /**
      * recursive function that traverses tree nodes, consuming the bits and hashes produced by TraverseAndBuild.
      * it returns the hash of the respective node and its respective index.
@@ -107,6 +129,13 @@ public:
     /** Construct a partial merkle tree from a list of transaction ids, and a mask that selects a subset of them */
     CPartialMerkleTree(const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
 
+    /**
+     * Construct a partial merkle tree from a block's complete tree, selecting
+     * the transactions at the given positions, which must be sorted. The
+     * result is the same as with the list of txids and a mask.
+     */
+    CPartialMerkleTree(const CMerkleTreeLevels &tree, const std::vector<unsigned int> &vMatchPos);
+
     CPartialMerkleTree();
 
     /**
@@ -140,6 +169,13 @@ public:
      */
     CMerkleBlock(const CBlock& block, CBloomFilter& filter);
 
+    /**
+     * The same, from a block's header and merkle tree and the elements of its
+     * transactions, so that serving the block to many filtered peers neither
+     * parses its transactions nor hashes its merkle tree again.
+     */
+    CMerkleBlock(const CBlockHeader& headerIn, const CMerkleTreeLevels& tree, const std::vector<CBloomTxElements>& vElements, CBloomFilter& filter);
+
     // Create from a CBlock, matching the txids in the set
     CMerkleBlock(const CBlock& block, const std::set<uint256>& txids);
 
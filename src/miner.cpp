@@ -26,6 +26,7 @@
 #include "validationinterface.h"
 
 #include <algorithm>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <queue>
@@ -58,6 +59,75 @@ public:
     }
 };
 
+/**
+ * The transactions of the last block template, kept current by mempool
+ * events so that the next CreateNewBlock only has to look at what entered
+ * the mempool since. The candidate is dropped, and the next block assembled
+ * from scratch, when one of its transactions leaves the mempool or the
+ * mempool changes in a way that comes without an event (a block, a
+ * prioritisetransaction, a clear). Guarded by mempool.cs.
+ */
+class CBlockCandidate
+{
+public:
+    bool fValid;
+    //! What the candidate was assembled for; a template for anything else starts over
+    uint256 hashPrevBlock;
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    bool fIncludeWitness;
+    unsigned int nBlockMaxWeight, nBlockMaxSize;
+    //! The transactions in block order, without the coinbase
+    std::vector<uint256> vTxHashes;
+    std::set<uint256> setTxHashes;
+    //! Transactions that entered the mempool since, in order of arrival
+    std::vector<uint256> vAdded;
+    //! mempool.GetTransactionsUpdated() if every change since came with an event
+    unsigned int nTransactionsUpdated;
+
+    CBlockCandidate() : fValid(false), fConnected(false) {}
+
+    void Connect()
+    {
+        if (fConnected)
+            return;
+        mempool.NotifyEntryAdded.connect(boost::bind(&CBlockCandidate::EntryAdded, this, _1));
+        mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockCandidate::EntryRemoved, this, _1));
+        fConnected = true;
+    }
+
+    void Clear()
+    {
+        fValid = false;
+        vTxHashes.clear();
+        setTxHashes.clear();
+        vAdded.clear();
+    }
+
+private:
+    bool fConnected;
+
+    void EntryAdded(const CTransaction& tx)
+    {
+        if (!fValid)
+            return;
+        vAdded.push_back(tx.GetHash());
+        nTransactionsUpdated++;
+    }
+
+    void EntryRemoved(const CTransaction& tx)
+    {
+        if (!fValid)
+            return;
+        if (setTxHashes.count(tx.GetHash()))
+            Clear();
+        else
+            nTransactionsUpdated++;
+    }
+};
+
+static CBlockCandidate blockCandidate;
+
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
     int64_t nOldTime = pblock->nTime;
@@ -107,6 +177,10 @@ BlockAssembler::BlockAssembler(const CChainParams& _chainparams)
 void BlockAssembler::resetBlock()
 {
     inBlock.clear();
+    merkleTree.Clear();
+    merkleTree.Append(uint256());
+    witnessMerkleTree.Clear();
+    witnessMerkleTree.Append(uint256()); // The witness hash of the coinbase is 0.
 
     // Reserve space for coinbase tx
     nBlockSize = 1000;
@@ -133,7 +207,7 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     pblock = &pblocktemplate->block; // pointer for convenience
 
     // Add dummy coinbase tx as first transaction
-    pblock->vtx.push_back(CTransaction());
+    pblock->vtx.push_back(CTransactionRef());
     pblocktemplate->vTxFees.push_back(-1); // updated at end
     pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
 
@@ -160,10 +234,19 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     // -promiscuousmempoolflags is used.
     // TODO: replace this with a call to main to assess validity of a mempool
     // transaction (which in most cases can be a no-op).
-    fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus());
-
-    addPriorityTxs();
-    addPackageTxs();
+    const bool fWitnessEnabled = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus());
+    fIncludeWitness = fWitnessEnabled;
+
+    if (!addCandidateTxs()) {
+        resetBlock();
+        fIncludeWitness = fWitnessEnabled;
+        pblock->vtx.resize(1);
+        pblocktemplate->vTxFees.resize(1);
+        pblocktemplate->vTxSigOpsCost.resize(1);
+
+        addPriorityTxs();
+        addPackageTxs();
+    }
 
     nLastBlockTx = nBlockTx;
     nLastBlockSize = nBlockSize;
@@ -178,8 +261,12 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
     coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
     coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
-    pblock->vtx[0] = coinbaseTx;
-    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
+    pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    const uint256 witnessRoot = fIncludeWitness ? witnessMerkleTree.Root() : uint256();
+    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus(), fIncludeWitness ? &witnessRoot : NULL);
+    merkleTree.SetFirst(pblock->vtx[0]->GetHash());
+    pblock->hashMerkleRoot = merkleTree.Root();
+    pblocktemplate->vCoinbaseMerkleBranch = merkleTree.FirstBranch();
     pblocktemplate->vTxFees[0] = -nFees;
 
     // Fill in header
@@ -188,16 +275,103 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     ResetChallenge(*pblock, *pindexPrev, chainparams.GetConsensus());
     ResetProof(*pblock);
     pblock->nHeight = nHeight;
-    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(pblock->vtx[0]);
+    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
 
+    // Transactions that passed the mempool's checks under the flags of this
+    // block are found in the transaction validation cache; only the
+    // contextual checks of those are run again.
     CValidationState state;
     if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+        blockCandidate.Clear();
         throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
     }
+    saveCandidate();
 
     return pblocktemplate.release();
 }
 
+bool BlockAssembler::addCandidateTxs()
+{
+    blockCandidate.Connect();
+
+    const CBlockCandidate& candidate = blockCandidate;
+    if (!candidate.fValid || candidate.nTransactionsUpdated != mempool.GetTransactionsUpdated() ||
+        candidate.hashPrevBlock != chainActive.Tip()->GetBlockHash() || candidate.nHeight != nHeight ||
+        candidate.nLockTimeCutoff != nLockTimeCutoff || candidate.fIncludeWitness != fIncludeWitness ||
+        candidate.nBlockMaxWeight != nBlockMaxWeight || candidate.nBlockMaxSize != nBlockMaxSize)
+        return false;
+
+    BOOST_FOREACH(const uint256& hash, candidate.vTxHashes) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it == mempool.mapTx.end())
+            return false;
+        AddToBlock(it);
+    }
+
+    // Add the new transactions one package at a time, in order of arrival,
+    // so parents always come first. They are only considered by feerate;
+    // the priority space is filled when the block is assembled from scratch,
+    // at the latest on the next tip. Once a package does not fit, the block
+    // is full enough that choosing by feerate again is worth it.
+    BOOST_FOREACH(const uint256& hash, candidate.vAdded) {
+        CTxMemPool::txiter iter = mempool.mapTx.find(hash);
+        if (iter == mempool.mapTx.end() || inBlock.count(iter))
+            continue;
+
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+        onlyUnconfirmed(ancestors);
+        ancestors.insert(iter);
+
+        uint64_t packageSize = 0;
+        CAmount packageFees = 0;
+        int64_t packageSigOpsCost = 0;
+        BOOST_FOREACH(CTxMemPool::txiter it, ancestors) {
+            packageSize += it->GetTxSize();
+            packageFees += it->GetModifiedFee();
+            packageSigOpsCost += it->GetSigOpCost();
+        }
+
+        if (packageFees < ::minRelayTxFee.GetFee(packageSize))
+            continue;
+        if (!TestPackage(packageSize, packageSigOpsCost))
+            return false;
+        if (!TestPackageTransactions(ancestors))
+            continue;
+
+        vector<CTxMemPool::txiter> sortedEntries;
+        SortForBlock(ancestors, iter, sortedEntries);
+        for (size_t i=0; i<sortedEntries.size(); ++i) {
+            AddToBlock(sortedEntries[i]);
+        }
+    }
+
+    LogPrint("bench", "    - Reused %u of the previous template's transactions, considered %u new ones\n",
+             candidate.vTxHashes.size(), candidate.vAdded.size());
+    return true;
+}
+
+void BlockAssembler::saveCandidate()
+{
+    CBlockCandidate& candidate = blockCandidate;
+    candidate.Clear();
+    candidate.hashPrevBlock = pblock->hashPrevBlock;
+    candidate.nHeight = nHeight;
+    candidate.nLockTimeCutoff = nLockTimeCutoff;
+    candidate.fIncludeWitness = fIncludeWitness;
+    candidate.nBlockMaxWeight = nBlockMaxWeight;
+    candidate.nBlockMaxSize = nBlockMaxSize;
+    for (size_t i = 1; i < pblock->vtx.size(); i++) {
+        candidate.vTxHashes.push_back(pblock->vtx[i]->GetHash());
+        candidate.setTxHashes.insert(pblock->vtx[i]->GetHash());
+    }
+    candidate.nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    candidate.fValid = true;
+}
+
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
 {
     BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
@@ -246,7 +420,7 @@ bool BlockAssembler::TestPackageTransactions(const CTxMemPool::setEntries& packa
         if (!fIncludeWitness && !it->GetTx().wit.IsNull())
             return false;
         if (fNeedSizeAccounting) {
-            uint64_t nTxSize = ::GetSerializeSize(it->GetTx(), SER_NETWORK, PROTOCOL_VERSION);
+            uint64_t nTxSize = it->GetTx().GetTotalSize();
             if (nPotentialBlockSize + nTxSize >= nBlockMaxSize) {
                 return false;
             }
@@ -275,7 +449,7 @@ bool BlockAssembler::TestForBlock(CTxMemPool::txiter iter)
     }
 
     if (fNeedSizeAccounting) {
-        if (nBlockSize + ::GetSerializeSize(iter->GetTx(), SER_NETWORK, PROTOCOL_VERSION) >= nBlockMaxSize) {
+        if (nBlockSize + iter->GetTx().GetTotalSize() >= nBlockMaxSize) {
             if (nBlockSize >  nBlockMaxSize - 100 || lastFewTxs > 50) {
                  blockFinished = true;
                  return false;
@@ -310,11 +484,14 @@ bool BlockAssembler::TestForBlock(CTxMemPool::txiter iter)
 
 void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
 {
-    pblock->vtx.push_back(iter->GetTx());
+    pblock->vtx.push_back(iter->GetSharedTx());
+    merkleTree.Append(iter->GetTx().GetHash());
+    if (fIncludeWitness)
+        witnessMerkleTree.Append(iter->GetTx().GetWitnessHash());
     pblocktemplate->vTxFees.push_back(iter->GetFee());
     pblocktemplate->vTxSigOpsCost.push_back(iter->GetSigOpCost());
     if (fNeedSizeAccounting) {
-        nBlockSize += ::GetSerializeSize(iter->GetTx(), SER_NETWORK, PROTOCOL_VERSION);
+        nBlockSize += iter->GetTx().GetTotalSize();
     }
     nBlockWeight += iter->GetTxWeight();
     ++nBlockTx;
@@ -588,15 +765,51 @@ void BlockAssembler::addPriorityTxs()
     fNeedSizeAccounting = fSizeAccounting;
 }
 
-void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
+static void UpdateExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     assert(pblock->hashPrevBlock == pindexPrev->GetBlockHash());
     ++nExtraNonce;
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
-    CMutableTransaction txCoinbase(pblock->vtx[0]);
+    CMutableTransaction txCoinbase(*pblock->vtx[0]);
     txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
-    pblock->vtx[0] = txCoinbase;
+    pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
+}
+
+void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
+{
+    UpdateExtraNonce(pblock, pindexPrev, nExtraNonce);
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+void IncrementExtraNonce(CBlockTemplate* pblocktemplate, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
+{
+    CBlock* pblock = &pblocktemplate->block;
+    UpdateExtraNonce(pblock, pindexPrev, nExtraNonce);
+    pblock->hashMerkleRoot = ComputeMerkleRootFromBranch(pblock->vtx[0]->GetHash(), pblocktemplate->vCoinbaseMerkleBranch, 0);
+}
+
+void UpdateEmptyBlock(CBlock* pblock, const CBlockIndex* pindexPrev, const CScript& scriptPubKeyIn, const CChainParams& chainparams)
+{
+    const int nHeight = pindexPrev->nHeight + 1;
+    pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
+    if (chainparams.MineBlocksOnDemand())
+        pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+
+    CMutableTransaction coinbaseTx;
+    coinbaseTx.vin.resize(1);
+    coinbaseTx.vin[0].prevout.SetNull();
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    coinbaseTx.vout[0].nValue = GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    pblock->vtx.assign(1, MakeTransactionRef(std::move(coinbaseTx)));
+    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+
+    pblock->hashPrevBlock = pindexPrev->GetBlockHash();
+    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+    ResetChallenge(*pblock, *pindexPrev, chainparams.GetConsensus());
+    ResetProof(*pblock);
+    pblock->nHeight = nHeight;
+}
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_MINER_H
 #define BITCOIN_MINER_H
 
+#include "consensus/merkle.h"
 #include "primitives/block.h"
 #include "txmempool.h"
 
@@ -30,6 +31,8 @@ struct CBlockTemplate
     std::vector<CAmount> vTxFees;
     std::vector<int64_t> vTxSigOpsCost;
     std::vector<unsigned char> vchCoinbaseCommitment;
+    //! Merkle branch of the coinbase, which is all a new coinbase needs to rehash
+    std::vector<uint256> vCoinbaseMerkleBranch;
 };
 
 // Container for tracking updates to ancestor feerate as we include (parent)
@@ -151,6 +154,10 @@ private:
     uint64_t nBlockSigOpsCost;
     CAmount nFees;
     CTxMemPool::setEntries inBlock;
+    // Merkle trees of the block's txids and witness hashes, the coinbase's
+    // leaf being a placeholder until it is created
+    CIncrementalMerkleTree merkleTree;
+    CIncrementalMerkleTree witnessMerkleTree;
 
     // Chain context for the block
     int nHeight;
@@ -178,6 +185,12 @@ private:
     void addPriorityTxs();
     /** Add transactions based on feerate including unconfirmed ancestors */
     void addPackageTxs();
+    /** Add the transactions of the last template, then the packages of the
+      * transactions that entered the mempool since. Returns false if the
+      * block has to be assembled from scratch instead. */
+    bool addCandidateTxs();
+    /** Remember the transactions of the finished block for the next template */
+    void saveCandidate();
 
     // helper function for addPriorityTxs
     /** Test if tx will still "fit" in the block */
@@ -207,6 +220,15 @@ private:
 
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
+/** Modify the extranonce in a template's block, rehashing only the coinbase's merkle branch */
+void IncrementExtraNonce(CBlockTemplate* pblocktemplate, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
+/**
+ * Turn a block into the block after pindexPrev with only a coinbase paying
+ * the subsidy to scriptPubKeyIn. Unlike CreateNewBlock this neither looks at
+ * the mempool nor checks the block, so it is only for blocks that just need
+ * to exist, as those of generate on regtest.
+ */
+void UpdateEmptyBlock(CBlock* pblock, const CBlockIndex* pindexPrev, const CScript& scriptPubKeyIn, const CChainParams& chainparams);
 
 #endif // BITCOIN_MINER_H
@@ -18,6 +18,7 @@
 #include "hash.h"
 #include "primitives/transaction.h"
 #include "scheduler.h"
+#include "socketevents.h"
 #include "ui_interface.h"
 #include "utilstrencodings.h"
 
@@ -93,6 +94,7 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
+int nMessageHandlerThreads = DEFAULT_MESSAGE_HANDLER_THREADS;
 bool fAddressesInitialized = false;
 std::string strSubVersion;
 
@@ -111,11 +113,19 @@ CCriticalSection cs_nLastNodeId;
 
 static CSemaphore *semOutbound = NULL;
 boost::condition_variable messageHandlerCondition;
+static CSocketEvents* psocketEvents = NULL;
 
 // Signals for message handling
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
 
+/** Make the socket handler re-evaluate which sockets it waits for. */
+static void WakeSocketHandler()
+{
+    if (psocketEvents)
+        psocketEvents->Wakeup();
+}
+
 void AddOneShot(const std::string& strDest)
 {
     LOCK(cs_vOneShots);
@@ -735,6 +745,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 
         // absorb network data
         int handled;
+        bool fHeader = !msg.in_data;
         if (!msg.in_data)
             handled = msg.readHeader(pch, nBytes);
         else
@@ -748,6 +759,17 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
             return false;
         }
 
+        if (fHeader && msg.in_data) {
+            // Receive into a recycled buffer if one is at hand. Otherwise the
+            // buffer grows as data arrives, so that a peer cannot make us
+            // allocate just by announcing a large message.
+            CSerializeData data;
+            if (bufferPool.Get(data, msg.hdr.nMessageSize)) {
+                msg.vRecv.SwapData(data);
+                msg.vRecv.resize(msg.hdr.nMessageSize);
+            }
+        }
+
         pch += handled;
         nBytes -= handled;
 
@@ -769,6 +791,16 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
     return true;
 }
 
+void CNode::EraseRecvMsgs(std::deque<CNetMessage>::iterator itEnd)
+{
+    for (std::deque<CNetMessage>::iterator it = vRecvMsg.begin(); it != itEnd; ++it) {
+        CSerializeData data;
+        it->vRecv.SwapData(data);
+        bufferPool.Put(data);
+    }
+    vRecvMsg.erase(vRecvMsg.begin(), itEnd);
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -810,12 +842,21 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
         vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
     }
 
+    hasher.Write((const unsigned char*)pch, nCopy);
     memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+const uint256& CNetMessage::GetMessageHash() const
+{
+    assert(complete());
+    if (data_hash.IsNull())
+        hasher.Finalize(data_hash.begin());
+    return data_hash;
+}
+
 
 
 
@@ -830,7 +871,7 @@ void SocketSendData(CNode *pnode)
     std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
+        CSerializeData &data = *it;
         assert(data.size() > pnode->nSendOffset);
         int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
         if (nBytes > 0) {
@@ -841,6 +882,7 @@ void SocketSendData(CNode *pnode)
             if (pnode->nSendOffset == data.size()) {
                 pnode->nSendOffset = 0;
                 pnode->nSendSize -= data.size();
+                pnode->bufferPool.Put(data);
                 it++;
             } else {
                 // could not send full message; stop sending more
@@ -1158,43 +1200,28 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
+        std::vector<CSocketEvents::Interest> vInterest;
+
+        // Listening sockets get negative tokens, nodes are identified by their id.
+        for (unsigned int i = 0; i < vhListenSocket.size(); i++)
+            vInterest.push_back(CSocketEvents::Interest(vhListenSocket[i].socket, -1 - (int64_t)i, CSocketEvents::RECV));
 
         {
             LOCK(cs_vNodes);
+            vInterest.reserve(vInterest.size() + vNodes.size());
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
 
                 // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
+                // * If there is data to send, wait for sending data. As this only
                 //   happens when optimistic write failed, we choose to first drain the
                 //   write buffer in this case before receiving more. This avoids
                 //   needlessly queueing received data, if the remote peer is not themselves
                 //   receiving data. This means properly utilizing TCP flow control signalling.
                 // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
+                //   or there is space left in the buffer, wait for receiving data.
                 // * (if neither of the above applies, there is certainly one message
                 //   in the receiver buffer ready to be processed).
                 // Together, that means that at least one of the following is always possible,
@@ -1202,49 +1229,48 @@ void ThreadSocketHandler()
                 // * We send some data.
                 // * We wait for data to be received (and disconnect after timeout).
                 // * We process a message in the buffer (message handler thread).
+                int nEvents = 0;
                 {
                     TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
+                    if (lockSend && !pnode->vSendMsg.empty())
+                        nEvents = CSocketEvents::SEND;
                 }
+                if (nEvents == 0)
                 {
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                     if (lockRecv && (
                         pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
                         pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
+                        nEvents = CSocketEvents::RECV;
                 }
+                pnode->fPauseRecv = (nEvents == 0);
+                vInterest.push_back(CSocketEvents::Interest(pnode->hSocket, pnode->id, nEvents));
             }
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
-
-        if (nSelect == SOCKET_ERROR)
+        // The timeout bounds how long disconnections and inactivity go unnoticed;
+        // newly queued data and drained receive buffers wake us up early.
+        std::set<int64_t> setRecv;
+        std::set<int64_t> setSend;
+        if (!psocketEvents->Wait(vInterest, 50, setRecv, setSend))
         {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
+            LogPrintf("socket %s error %s\n", CSocketEvents::Backend(), NetworkErrorString(WSAGetLastError()));
+            // Let recv() find the failing socket.
+            BOOST_FOREACH(const CSocketEvents::Interest& interest, vInterest)
+                if (interest.nEvents & CSocketEvents::RECV)
+                    setRecv.insert(interest.nToken);
+            MilliSleep(50);
         }
+        boost::this_thread::interruption_point();
 
         //
         // Accept new connections
         //
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+        for (unsigned int i = 0; i < vhListenSocket.size(); i++)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (vhListenSocket[i].socket != INVALID_SOCKET && setRecv.count(-1 - (int64_t)i))
             {
-                AcceptConnection(hListenSocket);
+                AcceptConnection(vhListenSocket[i]);
             }
         }
 
@@ -1267,7 +1293,7 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            if (setRecv.count(pnode->id))
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
@@ -1311,7 +1337,7 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if (setSend.count(pnode->id))
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
@@ -1848,7 +1874,7 @@ bool OpenNetworkConnection(const CAddress& addrConnect, bool fCountFailure, CSem
 }
 
 
-void ThreadMessageHandler()
+void ThreadMessageHandler(int nThread)
 {
     boost::mutex condition_mutex;
     boost::unique_lock<boost::mutex> lock(condition_mutex);
@@ -1866,11 +1892,19 @@ void ThreadMessageHandler()
 
         bool fSleep = true;
 
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        // Each thread starts at a different node, and skips the nodes other
+        // threads are busy with.
+        size_t nStart = vNodesCopy.size() * nThread / nMessageHandlerThreads;
+        for (size_t i = 0; i < vNodesCopy.size(); i++)
         {
+            CNode* pnode = vNodesCopy[(nStart + i) % vNodesCopy.size()];
             if (pnode->fDisconnect)
                 continue;
 
+            TRY_LOCK(pnode->cs_msgHandler, lockHandler);
+            if (!lockHandler)
+                continue;
+
             // Receive messages
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
@@ -1879,9 +1913,12 @@ void ThreadMessageHandler()
                     if (!GetNodeSignals().ProcessMessages(pnode))
                         pnode->CloseSocketDisconnect();
 
+                    if (pnode->fPauseRecv && pnode->GetTotalRecvSize() <= ReceiveFloodSize())
+                        WakeSocketHandler();
+
                     if (pnode->nSendSize < SendBufferSize())
                     {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete() && !pnode->IsTxPostponed(pnode->vRecvMsg[0], GetTimeMicros())))
                         {
                             fSleep = false;
                         }
@@ -2126,6 +2163,10 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     MapPort(GetBoolArg("-upnp", DEFAULT_UPNP));
 
     // Send and receive from sockets, accept connections
+    if (psocketEvents == NULL) {
+        psocketEvents = new CSocketEvents();
+        LogPrintf("Using %s to wait for sockets\n", CSocketEvents::Backend());
+    }
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "net", &ThreadSocketHandler));
 
     // Initiate outbound connections from -addnode
@@ -2135,10 +2176,11 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", boost::function<void()>(boost::bind(&ThreadMessageHandler, i))));
 
     // Dump network addresses
-    scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
+    scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL, CScheduler::PRIORITY_LOW, "dumpaddresses");
 }
 
 bool StopNode()
@@ -2186,6 +2228,8 @@ public:
         semOutbound = NULL;
         delete pnodeLocalHost;
         pnodeLocalHost = NULL;
+        delete psocketEvents;
+        psocketEvents = NULL;
 
 #ifdef WIN32
         // Shutdown Windows Sockets
@@ -2196,16 +2240,6 @@ public:
 instance_of_cnetcleanup;
 
 
-void RelayTransaction(const CTransaction& tx)
-{
-    CInv inv(MSG_TX, tx.GetHash());
-    LOCK(cs_vNodes);
-    BOOST_FOREACH(CNode* pnode, vNodes)
-    {
-        pnode->PushInventory(inv);
-    }
-}
-
 void CNode::RecordBytesRecv(uint64_t bytes)
 {
     LOCK(cs_totalBytesRecv);
@@ -2462,6 +2496,7 @@ unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", DEFAULT_MAX
 
 CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNameIn, bool fInboundIn) :
     ssSend(SER_NETWORK, INIT_PROTO_VERSION),
+    bufferPool(MAX_NODE_BUFFER_POOL_SIZE),
     addr(addrIn),
     nKeyedNetGroup(CalculateKeyedNetGroup(addrIn)),
     addrKnown(5000, 0.001),
@@ -2488,6 +2523,7 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fPauseRecv = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -2505,6 +2541,7 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     timeLastMempoolReq = 0;
     nLastBlockTime = 0;
     nLastTXTime = 0;
+    nTxPostponedUntil = 0;
     nPingNonceSent = 0;
     nPingUsecStart = 0;
     nPingUsecTime = 0;
@@ -2632,12 +2669,18 @@ void CNode::EndMessage(const char* pszCommand) UNLOCK_FUNCTION(cs_vSend)
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
     std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
+    bufferPool.Get(*it, ssSend.size());
     ssSend.GetAndClear(*it);
     nSendSize += (*it).size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (it == vSendMsg.begin()) {
         SocketSendData(this);
+        // The socket handler only waits for sockets to become writable when
+        // they have queued data, so tell it about the leftover.
+        if (!vSendMsg.empty())
+            WakeSocketHandler();
+    }
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
@@ -9,8 +9,10 @@
 #include "amount.h"
 #include "bloom.h"
 #include "compat.h"
+#include "hash.h"
 #include "limitedmap.h"
 #include "netbase.h"
+#include "netbufferpool.h"
 #include "protocol.h"
 #include "random.h"
 #include "streams.h"
@@ -49,6 +51,8 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 4 MB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 4 * 1000 * 1000;
+/** Maximum bytes of message buffers kept per peer for reuse, enough for a receive and a send buffer of maximum size */
+static const size_t MAX_NODE_BUFFER_POOL_SIZE = 2 * MAX_PROTOCOL_MESSAGE_LENGTH;
 /** Maximum length of strSubVer in `version` message */
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 /** -listen default */
@@ -71,6 +75,10 @@ static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
 static const bool DEFAULT_BLOCKSONLY = false;
 
 static const bool DEFAULT_FORCEDNSSEED = false;
+/** The default number of threads processing peer messages */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 4;
+/** Maximum number of threads processing peer messages */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
 
@@ -165,6 +173,8 @@ extern CAddrMan addrman;
 
 /** Maximum number of connections to simultaneously allow (aka connection slots) */
 extern int nMaxConnections;
+/** Number of threads processing peer messages */
+extern int nMessageHandlerThreads;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
@@ -218,6 +228,10 @@ public:
 
 
 class CNetMessage {
+private:
+    mutable CHash256 hasher;        // running hash of the data received so far
+    mutable uint256 data_hash;
+
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
@@ -251,6 +265,9 @@ public:
         vRecv.SetVersion(nVersionIn);
     }
 
+    //! Double SHA256 of the complete message data, hashed as it was received
+    const uint256& GetMessageHash() const;
+
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
 };
@@ -335,8 +352,17 @@ public:
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    // Buffers of messages sent and processed, reused for the next ones
+    CNetBufferPool bufferPool;
     uint64_t nRecvBytes;
     int nRecvVersion;
+    // Held by the message handler thread serving this node, so that its
+    // messages are processed one at a time and in order
+    CCriticalSection cs_msgHandler;
+    // Set by the socket handler while it does not read from the socket because
+    // the receive buffer is full; tells the message handler to wake it once
+    // the buffer has been drained.
+    std::atomic<bool> fPauseRecv;
 
     int64_t nLastSend;
     int64_t nLastRecv;
@@ -398,6 +424,8 @@ public:
     // flood relay
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    // Protects vAddrToSend and addrKnown, which other peers' message handlers add to
+    CCriticalSection cs_vAddrToSend;
     bool fGetAddr;
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
@@ -405,9 +433,6 @@ public:
 
     // inventory based relay
     CRollingBloomFilter filterInventoryKnown;
-    // Set of transaction ids we still have to announce.
-    // They are sorted by the mempool before relay, so the order is not important.
-    std::set<uint256> setInventoryTxToSend;
     // List of block ids we still have announce.
     // There is no final sorting before sending, as they are always sent immediately
     // and in the order requested.
@@ -429,6 +454,11 @@ public:
     std::atomic<int64_t> nLastBlockTime;
     std::atomic<int64_t> nLastTXTime;
 
+    // Until when (in usec) the transactions of this peer are left unprocessed,
+    // as it is over its validation budget; see ChargeTxValidation. Guarded by
+    // cs_vRecvMsg.
+    int64_t nTxPostponedUntil;
+
     // Ping time measurement:
     // The pong reply we're expecting, or 0 if no pong expected.
     uint64_t nPingNonceSent;
@@ -479,6 +509,12 @@ public:
         return nRefCount;
     }
 
+    // requires LOCK(cs_vRecvMsg)
+    bool IsTxPostponed(const CNetMessage& msg, int64_t nNow) const
+    {
+        return nTxPostponedUntil > nNow && msg.hdr.GetCommand() == NetMsgType::TX;
+    }
+
     // requires LOCK(cs_vRecvMsg)
     unsigned int GetTotalRecvSize()
     {
@@ -491,6 +527,10 @@ public:
     // requires LOCK(cs_vRecvMsg)
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes);
 
+    // requires LOCK(cs_vRecvMsg)
+    // Remove the messages before itEnd, which have been processed
+    void EraseRecvMsgs(std::deque<CNetMessage>::iterator itEnd);
+
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
     {
@@ -514,11 +554,13 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(addr.GetKey());
     }
 
     void PushAddress(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
@@ -540,14 +582,11 @@ public:
         }
     }
 
+    // Transactions are announced through RelayTransaction, to all peers at once.
     void PushInventory(const CInv& inv)
     {
         LOCK(cs_inventory);
-        if (inv.type == MSG_TX) {
-            if (!filterInventoryKnown.contains(inv.hash)) {
-                setInventoryTxToSend.insert(inv.hash);
-            }
-        } else if (inv.type == MSG_BLOCK) {
+        if (inv.type == MSG_BLOCK) {
             vInventoryBlockToSend.push_back(inv.hash);
         }
     }
@@ -815,10 +854,6 @@ public:
 };
 
 
-
-class CTransaction;
-void RelayTransaction(const CTransaction& tx);
-
 /** Access to the (IP) address database (peers.dat) */
 class CAddrDB
 {
@@ -0,0 +1,81 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netbufferpool.h"
+
+std::atomic<uint64_t> CNetBufferPool::nTotalHits(0);
+std::atomic<uint64_t> CNetBufferPool::nTotalMisses(0);
+std::atomic<uint64_t> CNetBufferPool::nTotalPooledBytes(0);
+
+//! Size class of a buffer with capacity n, or -1 if it is too small to pool
+static int SizeClass(size_t n)
+{
+    if (n < ((size_t)1 << CNetBufferPool::MIN_CLASS_BITS))
+        return -1;
+    int nBits = CNetBufferPool::MIN_CLASS_BITS;
+    while (nBits < CNetBufferPool::MAX_CLASS_BITS && (n >> (nBits + 1)) != 0)
+        nBits++;
+    return nBits - CNetBufferPool::MIN_CLASS_BITS;
+}
+
+CNetBufferPool::~CNetBufferPool()
+{
+    nTotalPooledBytes -= nPooledBytes;
+}
+
+bool CNetBufferPool::Get(CSerializeData& data, size_t nSize)
+{
+    int nClass = SizeClass(nSize);
+    if (nClass < 0)
+        return false;
+
+    LOCK(cs);
+    // Larger classes are searched too, but not so far up that a small
+    // message would tie up a much larger buffer.
+    for (int i = nClass; i < NUM_CLASSES && i <= nClass + 2; i++) {
+        std::vector<CSerializeData>& vClass = vBuffers[i];
+        for (size_t j = vClass.size(); j > 0; j--) {
+            if (vClass[j - 1].capacity() < nSize)
+                continue;
+            data.swap(vClass[j - 1]);
+            vClass.erase(vClass.begin() + (j - 1));
+            nPooledBytes -= data.capacity();
+            nTotalPooledBytes -= data.capacity();
+            nTotalHits++;
+            return true;
+        }
+    }
+    nTotalMisses++;
+    return false;
+}
+
+void CNetBufferPool::Put(CSerializeData& data)
+{
+    int nClass = SizeClass(data.capacity());
+    if (nClass >= 0) {
+        LOCK(cs);
+        if (nPooledBytes + data.capacity() <= nMaxBytes) {
+            data.clear();
+            nPooledBytes += data.capacity();
+            nTotalPooledBytes += data.capacity();
+            vBuffers[nClass].push_back(CSerializeData());
+            vBuffers[nClass].back().swap(data);
+            return;
+        }
+    }
+    CSerializeData().swap(data);
+}
+
+size_t CNetBufferPool::GetPooledBytes()
+{
+    LOCK(cs);
+    return nPooledBytes;
+}
+
+void CNetBufferPool::GetStats(uint64_t& nHits, uint64_t& nMisses, uint64_t& nPooledBytes)
+{
+    nHits = nTotalHits;
+    nMisses = nTotalMisses;
+    nPooledBytes = nTotalPooledBytes;
+}
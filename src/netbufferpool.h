@@ -0,0 +1,65 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NETBUFFERPOOL_H
+#define BITCOIN_NETBUFFERPOOL_H
+
+#include "support/allocators/zeroafterfree.h"
+#include "sync.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Keeps the buffers of messages a peer is done with, so that the next
+ * messages of similar size reuse them instead of going through the heap.
+ * Buffers are kept in power-of-two size classes by capacity, up to a total
+ * of nMaxBytes; buffers that do not fit and ones smaller than the smallest
+ * class are freed as usual. Thread safe.
+ */
+class CNetBufferPool
+{
+public:
+    //! Size classes are [2^MIN_CLASS_BITS, 2^(MIN_CLASS_BITS+1)) and so on
+    static const int MIN_CLASS_BITS = 8;
+    static const int MAX_CLASS_BITS = 25;
+    static const int NUM_CLASSES = MAX_CLASS_BITS - MIN_CLASS_BITS + 1;
+
+private:
+    CCriticalSection cs;
+    std::vector<CSerializeData> vBuffers[NUM_CLASSES];
+    size_t nPooledBytes;
+    const size_t nMaxBytes;
+
+    static std::atomic<uint64_t> nTotalHits;
+    static std::atomic<uint64_t> nTotalMisses;
+    static std::atomic<uint64_t> nTotalPooledBytes;
+
+    CNetBufferPool(const CNetBufferPool&);
+    CNetBufferPool& operator=(const CNetBufferPool&);
+
+public:
+    explicit CNetBufferPool(size_t nMaxBytesIn) : nPooledBytes(0), nMaxBytes(nMaxBytesIn) {}
+    ~CNetBufferPool();
+
+    /**
+     * Replace data with an empty pooled buffer that can hold nSize bytes
+     * without reallocating. Returns false and leaves data alone if there is
+     * none. Requests too small for the pool are not counted as misses.
+     */
+    bool Get(CSerializeData& data, size_t nSize);
+
+    //! Take the buffer of data into the pool, leaving data empty either way
+    void Put(CSerializeData& data);
+
+    //! Bytes of capacity currently held by this pool
+    size_t GetPooledBytes();
+
+    //! Totals over all pools
+    static void GetStats(uint64_t& nHits, uint64_t& nMisses, uint64_t& nPooledBytes);
+};
+
+#endif // BITCOIN_NETBUFFERPOOL_H
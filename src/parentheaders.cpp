@@ -0,0 +1,158 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "parentheaders.h"
+
+#include "mappedfile.h"
+#include "pow.h"
+#include "primitives/transaction.h"
+#include "streams.h"
+#include "tinyformat.h"
+#include "util.h"
+#include "version.h"
+
+#include <boost/filesystem.hpp>
+
+CParentHeaderStore* pparentheaders = NULL;
+
+namespace {
+
+const int PARENT_HEADER_SER_VERSION = PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX;
+
+bool ReadParentHeader(const char* pbegin, CBlockHeader& header)
+{
+    try {
+        CDataStream ss(pbegin, pbegin + PARENT_HEADER_SIZE, SER_DISK, PARENT_HEADER_SER_VERSION);
+        ss >> header;
+        return ss.empty() && header.IsBitcoinBlock();
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+}
+
+CParentHeaderStore::CParentHeaderStore() : file(NULL)
+{
+}
+
+CParentHeaderStore::~CParentHeaderStore()
+{
+    if (file)
+        fclose(file);
+}
+
+bool CParentHeaderStore::Open(const boost::filesystem::path& pathIn, const uint256& genesishashIn)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    path = pathIn;
+    genesishash = genesishashIn;
+    vHashes.clear();
+    mapHeights.clear();
+
+    {
+        CMappedFile mapped(path);
+        if (boost::filesystem::exists(path) && boost::filesystem::file_size(path) > 0 && !mapped.IsMapped())
+            return error("%s: unable to map %s", __func__, path.string());
+        const size_t nHeaders = mapped.size() / PARENT_HEADER_SIZE;
+        vHashes.reserve(nHeaders);
+        for (size_t i = 0; i < nHeaders; i++) {
+            CBlockHeader header;
+            if (!ReadParentHeader(mapped.begin() + i * PARENT_HEADER_SIZE, header))
+                break;
+            const uint256 hash = header.GetHash();
+            if (i == 0 ? hash != genesishash : header.hashPrevBlock != vHashes.back())
+                break;
+            vHashes.push_back(hash);
+            mapHeights[hash] = i;
+        }
+    }
+
+    file = fopen(path.string().c_str(), "ab+");
+    if (!file)
+        return error("%s: unable to open %s", __func__, path.string());
+    Truncate((int)vHashes.size() - 1);
+    LogPrintf("%s: %u parent chain headers\n", __func__, vHashes.size());
+    return true;
+}
+
+void CParentHeaderStore::Truncate(int nHeight)
+{
+    while ((int)vHashes.size() > nHeight + 1) {
+        mapHeights.erase(vHashes.back());
+        vHashes.pop_back();
+    }
+    fflush(file);
+    TruncateFile(file, vHashes.size() * PARENT_HEADER_SIZE);
+}
+
+int CParentHeaderStore::Height() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return (int)vHashes.size() - 1;
+}
+
+uint256 CParentHeaderStore::GetHash(int nHeight) const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (nHeight < 0 || nHeight >= (int)vHashes.size())
+        return uint256();
+    return vHashes[nHeight];
+}
+
+int CParentHeaderStore::GetDepth(const uint256& hash) const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    boost::unordered_map<uint256, int, HashHasher>::const_iterator it = mapHeights.find(hash);
+    if (it == mapHeights.end())
+        return -1;
+    return (int)vHashes.size() - it->second;
+}
+
+bool CParentHeaderStore::Connect(int nHeight, const std::vector<CBlockHeader>& vHeaders, std::string& strError)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!file) {
+        strError = "The parent header store is not open";
+        return false;
+    }
+    if (nHeight < 0 || nHeight > (int)vHashes.size()) {
+        strError = strprintf("Headers from height %d do not connect to the stored %d", nHeight, vHashes.size());
+        return false;
+    }
+
+    // Check everything before touching the store.
+    CDataStream ss(SER_DISK, PARENT_HEADER_SER_VERSION);
+    std::vector<uint256> vNewHashes;
+    vNewHashes.reserve(vHeaders.size());
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        const CBlockHeader& header = vHeaders[i];
+        if (!header.IsBitcoinBlock() || !CheckBitcoinProof(header)) {
+            strError = strprintf("Parent header at height %d has an invalid proof of work", nHeight + i);
+            return false;
+        }
+        const uint256 hash = header.GetHash();
+        const uint256 hashPrev = i > 0 ? vNewHashes.back() : nHeight > 0 ? vHashes[nHeight - 1] : uint256();
+        if (nHeight + i == 0 ? hash != genesishash : header.hashPrevBlock != hashPrev) {
+            strError = strprintf("Parent header %s at height %d does not connect", hash.ToString(), nHeight + i);
+            return false;
+        }
+        vNewHashes.push_back(hash);
+        ss << header;
+    }
+    assert(ss.size() == vHeaders.size() * PARENT_HEADER_SIZE);
+
+    Truncate(nHeight - 1);
+    if ((!ss.empty() && fwrite(&ss[0], 1, ss.size(), file) != ss.size()) || fflush(file) != 0) {
+        Truncate(nHeight - 1);
+        strError = "Failed to write the parent header store";
+        return false;
+    }
+    FileCommit(file);
+    for (size_t i = 0; i < vNewHashes.size(); i++) {
+        mapHeights[vNewHashes[i]] = vHashes.size();
+        vHashes.push_back(vNewHashes[i]);
+    }
+    return true;
+}
@@ -0,0 +1,86 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PARENTHEADERS_H
+#define BITCOIN_PARENTHEADERS_H
+
+#include "primitives/block.h"
+#include "uint256.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+static const bool DEFAULT_PARENT_HEADERS = false;
+//! Size of a parent chain block header in the store
+static const size_t PARENT_HEADER_SIZE = 80;
+
+/**
+ * The parent chain's headers from its genesis block on, in a flat file of
+ * 80 byte headers that is memory mapped when opened (-parentheaders). Only
+ * the block hashes are kept in memory, so that the depth of a parent block
+ * is a hash table lookup rather than a round trip to bitcoind.
+ *
+ * Headers must link up and carry the proof of work they claim, but the
+ * difficulty they claim is not checked against the parent chain's retargeting
+ * rules: the store follows whatever chain its feeder, the parent daemon we
+ * trust for peg-ins anyway, reports as the best one.
+ */
+class CParentHeaderStore
+{
+private:
+    struct HashHasher
+    {
+        size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+    };
+
+    mutable boost::mutex mutex;
+    boost::filesystem::path path;
+    FILE* file;
+    uint256 genesishash;
+    //! Hashes by height
+    std::vector<uint256> vHashes;
+    boost::unordered_map<uint256, int, HashHasher> mapHeights;
+
+    CParentHeaderStore(const CParentHeaderStore&);
+    CParentHeaderStore& operator=(const CParentHeaderStore&);
+
+    void Truncate(int nHeight);
+
+public:
+    CParentHeaderStore();
+    ~CParentHeaderStore();
+
+    /**
+     * Open the store at path for the parent chain with the given genesis
+     * hash, creating it if needed. Headers that do not link up, from a
+     * torn write say, are dropped along with everything after them.
+     */
+    bool Open(const boost::filesystem::path& pathIn, const uint256& genesishashIn);
+
+    //! Height of the tip, -1 if the store is empty
+    int Height() const;
+
+    //! Hash of the block at nHeight, null if there is none
+    uint256 GetHash(int nHeight) const;
+
+    //! Confirmations of a block of the stored chain, -1 if it is not in it
+    int GetDepth(const uint256& hash) const;
+
+    /**
+     * Replace the stored chain above nHeight - 1 with vHeaders, the first of
+     * which must extend the block at nHeight - 1 (or be the genesis block if
+     * nHeight is 0). If a header does not fit, the store is left as it was.
+     */
+    bool Connect(int nHeight, const std::vector<CBlockHeader>& vHeaders, std::string& strError);
+};
+
+/** The parent chain header store, if -parentheaders is on */
+extern CParentHeaderStore* pparentheaders;
+
+#endif // BITCOIN_PARENTHEADERS_H
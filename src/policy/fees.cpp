@@ -23,34 +23,42 @@ void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
         bucketMap[defaultBuckets[i]] = i;
     }
     confAvg.resize(maxConfirms);
-    curBlockConf.resize(maxConfirms);
     unconfTxs.resize(maxConfirms);
     for (unsigned int i = 0; i < maxConfirms; i++) {
         confAvg[i].resize(buckets.size());
-        curBlockConf[i].resize(buckets.size());
         unconfTxs[i].resize(buckets.size());
     }
 
     oldUnconfTxs.resize(buckets.size());
-    curBlockTxCt.resize(buckets.size());
     txCtAvg.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
     avg.resize(buckets.size());
+    scale = 1;
 }
 
-// Zero out the data for the current block
-void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
+void TxConfirmStats::NewBlock(unsigned int nBlockHeight)
 {
     for (unsigned int j = 0; j < buckets.size(); j++) {
         oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
         unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
-        for (unsigned int i = 0; i < curBlockConf.size(); i++)
-            curBlockConf[i][j] = 0;
-        curBlockTxCt[j] = 0;
-        curBlockVal[j] = 0;
     }
+
+    // Decaying every average comes down to decaying the common scale, so that
+    // the block only costs as much as the transactions it records.
+    scale *= decay;
+    if (scale < MIN_STATS_SCALE)
+        Rescale();
 }
 
+void TxConfirmStats::Rescale()
+{
+    for (unsigned int j = 0; j < buckets.size(); j++) {
+        for (unsigned int i = 0; i < confAvg.size(); i++)
+            confAvg[i][j] *= scale;
+        avg[j] *= scale;
+        txCtAvg[j] *= scale;
+    }
+    scale = 1;
+}
 
 void TxConfirmStats::Record(int blocksToConfirm, double val)
 {
@@ -58,21 +66,12 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     if (blocksToConfirm < 1)
         return;
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++) {
-        curBlockConf[i - 1][bucketindex]++;
-    }
-    curBlockTxCt[bucketindex]++;
-    curBlockVal[bucketindex] += val;
-}
-
-void TxConfirmStats::UpdateMovingAverages()
-{
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
-        avg[j] = avg[j] * decay + curBlockVal[j];
-        txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
+    const double weight = 1 / scale;
+    for (size_t i = blocksToConfirm; i <= confAvg.size(); i++) {
+        confAvg[i - 1][bucketindex] += weight;
     }
+    txCtAvg[bucketindex] += weight;
+    avg[bucketindex] += val * weight;
 }
 
 // returns -1 on error conditions
@@ -110,8 +109,8 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     // Start counting from highest(default) or lowest fee/pri transactions
     for (int bucket = startbucket; bucket >= 0 && bucket <= maxbucketindex; bucket += step) {
         curFarBucket = bucket;
-        nConf += confAvg[confTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
+        nConf += confAvg[confTarget - 1][bucket] * scale;
+        totalNum += txCtAvg[bucket] * scale;
         for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
             extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
         extraNum += oldUnconfTxs[bucket];
@@ -152,13 +151,13 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int minBucket = bestNearBucket < bestFarBucket ? bestNearBucket : bestFarBucket;
     unsigned int maxBucket = bestNearBucket > bestFarBucket ? bestNearBucket : bestFarBucket;
     for (unsigned int j = minBucket; j <= maxBucket; j++) {
-        txSum += txCtAvg[j];
+        txSum += txCtAvg[j] * scale;
     }
     if (foundAnswer && txSum != 0) {
         txSum = txSum / 2;
         for (unsigned int j = minBucket; j <= maxBucket; j++) {
-            if (txCtAvg[j] < txSum)
-                txSum -= txCtAvg[j];
+            if (txCtAvg[j] * scale < txSum)
+                txSum -= txCtAvg[j] * scale;
             else { // we're in the right bucket
                 median = avg[j] / txCtAvg[j];
                 break;
@@ -176,6 +175,8 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
 
 void TxConfirmStats::Write(CAutoFile& fileout)
 {
+    // The file holds the plain averages.
+    Rescale();
     fileout << decay;
     fileout << buckets;
     fileout << avg;
@@ -222,17 +223,11 @@ void TxConfirmStats::Read(CAutoFile& filein)
     avg = fileAvg;
     confAvg = fileConfAvg;
     txCtAvg = fileTxCtAvg;
+    scale = 1;
     bucketMap.clear();
 
-    // Resize the current block variables which aren't stored in the data file
-    // to match the number of confirms and buckets
-    curBlockConf.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        curBlockConf[i].resize(buckets.size());
-    }
-    curBlockTxCt.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
-
+    // Resize the mempool counts, which aren't stored in the data file, to
+    // match the number of confirms and buckets
     unconfTxs.resize(maxConfirms);
     for (unsigned int i = 0; i < maxConfirms; i++) {
         unconfTxs[i].resize(buckets.size());
@@ -305,7 +300,9 @@ CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
 {
     minTrackedFee = _minRelayFee < CFeeRate(MIN_FEERATE) ? CFeeRate(MIN_FEERATE) : _minRelayFee;
     std::vector<double> vfeelist;
-    for (double bucketBoundary = minTrackedFee.GetFeePerK(); bucketBoundary <= MAX_FEERATE; bucketBoundary *= FEE_SPACING) {
+    const double fineFeeLimit = minTrackedFee.GetFeePerK() * FINE_FEE_RANGE;
+    for (double bucketBoundary = minTrackedFee.GetFeePerK(); bucketBoundary <= MAX_FEERATE;
+         bucketBoundary *= bucketBoundary < fineFeeLimit ? FINE_FEE_SPACING : FEE_SPACING) {
         vfeelist.push_back(bucketBoundary);
     }
     vfeelist.push_back(INF_FEERATE);
@@ -476,18 +473,12 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     else
         feeUnlikely = CFeeRate(feeUnlikelyEst);
 
-    // Clear the current block states
-    feeStats.ClearCurrent(nBlockHeight);
-    priStats.ClearCurrent(nBlockHeight);
-
-    // Repopulate the current block states
+    // Decay the historical moving averages and add the block's transactions
+    feeStats.NewBlock(nBlockHeight);
+    priStats.NewBlock(nBlockHeight);
     for (unsigned int i = 0; i < entries.size(); i++)
         processBlockTx(nBlockHeight, entries[i]);
 
-    // Update all exponential averages with the current block states
-    feeStats.UpdateMovingAverages();
-    priStats.UpdateMovingAverages();
-
     LogPrint("estimatefee", "Blockpolicy after updating estimates for %u confirmed entries, new mempool map size %u\n",
              entries.size(), mapMemPoolTxs.size());
 }
@@ -87,20 +87,18 @@ private:
     // Count the total # of txs in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> txCtAvg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<int> curBlockTxCt;
 
     // Count the total # of txs confirmed within Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
     std::vector<std::vector<double> > confAvg; // confAvg[Y][X]
-    // and calculate the totals for the current block to update the moving averages
-    std::vector<std::vector<int> > curBlockConf; // curBlockConf[Y][X]
 
     // Sum the total priority/fee of all tx's in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> avg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<double> curBlockVal;
+
+    // The moving averages above are stored divided by scale, which takes the
+    // decay of each block instead of all of them
+    double scale;
 
     // Combine the conf counts with tx counts to calculate the confirmation % for each Y,X
     // Combine the total value with the tx counts to calculate the avg fee/priority per bucket
@@ -126,11 +124,14 @@ public:
      */
     void Initialize(std::vector<double>& defaultBuckets, unsigned int maxConfirms, double decay, std::string dataTypeString);
 
-    /** Clear the state of the curBlock variables to start counting for the new block */
-    void ClearCurrent(unsigned int nBlockHeight);
+    /** Start counting for a new block, decaying the historical moving averages */
+    void NewBlock(unsigned int nBlockHeight);
+
+    /** Fold scale into the stored moving averages */
+    void Rescale();
 
     /**
-     * Record a new transaction data point in the current block stats
+     * Record a new transaction data point in the current block's moving averages
      * @param blocksToConfirm the number of blocks it took this transaction to confirm
      * @param val either the fee or the priority when entered of the transaction
      * @warning blocksToConfirm is 1-based and has to be >= 1
@@ -144,10 +145,6 @@ public:
     void removeTx(unsigned int entryHeight, unsigned int nBestSeenHeight,
                   unsigned int bucketIndex);
 
-    /** Update our estimates by decaying our historical moving average and updating
-        with the data gathered from the current block */
-    void UpdateMovingAverages();
-
     /**
      * Calculate a fee or priority estimate.  Find the lowest value bucket (or range of buckets
      * to make sure we have enough data points) whose transactions still have sufficient likelihood
@@ -183,6 +180,9 @@ static const unsigned int MAX_BLOCK_CONFIRMS = 25;
 /** Decay of .998 is a half-life of 346 blocks or about 2.4 days */
 static const double DEFAULT_DECAY = .998;
 
+/** Fold the decay scale into the moving averages before it gets this small */
+static const double MIN_STATS_SCALE = 1e-100;
+
 /** Require greater than 95% of X fee transactions to be confirmed within Y blocks for X to be big enough */
 static const double MIN_SUCCESS_PCT = .95;
 static const double UNLIKELY_PCT = .5;
@@ -207,6 +207,14 @@ static const double INF_PRIORITY = 1e9 * MAX_MONEY;
 /** Spacing of FeeRate buckets */
 static const double FEE_SPACING = 1.1;
 
+/**
+ * Confidential transactions are large, so most of them pay little more than
+ * the minimum relay fee rate. The buckets up to FINE_FEE_RANGE times the
+ * lowest tracked fee rate are spaced more finely.
+ */
+static const double FINE_FEE_SPACING = 1.05;
+static const double FINE_FEE_RANGE = 10;
+
 /** Spacing of Priority buckets */
 static const double PRI_SPACING = 2;
 
@@ -33,14 +33,14 @@
 
 bool IsStandard(const CScript& scriptPubKey, txnouttype& whichType, const bool witnessEnabled)
 {
-    std::vector<std::vector<unsigned char> > vSolutions;
-    if (!Solver(scriptPubKey, whichType, vSolutions))
+    if (!Solver(scriptPubKey, whichType))
         return false;
 
     if (whichType == TX_MULTISIG)
     {
-        unsigned char m = vSolutions.front()[0];
-        unsigned char n = vSolutions.back()[0];
+        // m and n are the script's first and next to last opcodes
+        unsigned char m = CScript::DecodeOP_N((opcodetype)scriptPubKey[0]);
+        unsigned char n = CScript::DecodeOP_N((opcodetype)scriptPubKey[scriptPubKey.size() - 2]);
         // Support up to x-of-3 multisig txns as standard
         if (n < 1 || n > 3)
             return false;
@@ -111,55 +111,94 @@ bool IsStandardTx(const CTransaction& tx, std::string& reason, const bool witnes
     return true;
 }
 
-bool AreInputsStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs)
+/** The redeemScript a P2SH scriptSig leaves on top of the stack; false if evaluating it fails or leaves none */
+static bool EvalRedeemScript(const CScript& scriptSig, CScript& redeemScript)
 {
-    if (tx.IsCoinBase())
-        return true; // Coinbases don't use vin normally
-
-    for (unsigned int i = 0; i < tx.vin.size(); i++)
-    {
-        const CTxOut& prev = mapInputs.GetOutputFor(tx.vin[i]);
+    std::vector<std::vector<unsigned char> > stack;
+    if (!EvalScript(stack, scriptSig, SCRIPT_VERIFY_NONE, BaseSignatureChecker(), SIGVERSION_BASE))
+        return false;
+    if (stack.empty())
+        return false;
+    redeemScript = CScript(stack.back().begin(), stack.back().end());
+    return true;
+}
 
-        if (prev.scriptPubKey.IsWithdrawLock()) {
-            if (!tx.vin[i].scriptSig.IsWithdrawProof()) {
-                if (tx.vout.size() < i)
-                    if (!tx.vout[i].nValue.IsAmount() || tx.vout[i].nValue.GetAmount() > MAX_MONEY / 100)
-                        return false;
-            }
-            continue;
+/** The checks AreInputsStandard makes on one input, which leave the redeemScript of a P2SH one in redeemScript */
+static bool IsInputStandard(const CTransaction& tx, unsigned int i, const CScript& prevScript, CScript& redeemScript)
+{
+    if (prevScript.IsWithdrawLock()) {
+        if (!tx.vin[i].scriptSig.IsWithdrawProof()) {
+            if (tx.vout.size() < i)
+                if (!tx.vout[i].nValue.IsAmount() || tx.vout[i].nValue.GetAmount() > MAX_MONEY / 100)
+                    return false;
         }
+        return true;
+    }
 
-        // Biggest 'standard' txin is a 15-of-15 P2SH multisig with compressed
-        // keys. (remember the 520 byte limit on redeemScript size) That works
-        // out to a (15*(33+1))+3=513 byte redeemScript, 513+1+15*(73+1)+3=1627
-        // bytes of scriptSig, which we round off to 1650 bytes for some minor
-        // future-proofing. That's also enough to spend a 20-of-20
-        // CHECKMULTISIG scriptPubKey, though such a scriptPubKey is not
-        // considered standard)
-        if (tx.vin[i].scriptSig.size() > 1650)
-            return false;
+    // Biggest 'standard' txin is a 15-of-15 P2SH multisig with compressed
+    // keys. (remember the 520 byte limit on redeemScript size) That works
+    // out to a (15*(33+1))+3=513 byte redeemScript, 513+1+15*(73+1)+3=1627
+    // bytes of scriptSig, which we round off to 1650 bytes for some minor
+    // future-proofing. That's also enough to spend a 20-of-20
+    // CHECKMULTISIG scriptPubKey, though such a scriptPubKey is not
+    // considered standard)
+    if (tx.vin[i].scriptSig.size() > 1650)
+        return false;
 
-        std::vector<std::vector<unsigned char> > vSolutions;
-        txnouttype whichType;
-        // get the scriptPubKey corresponding to this input:
-        const CScript& prevScript = prev.scriptPubKey;
-        if (!Solver(prevScript, whichType, vSolutions))
+    txnouttype whichType;
+    if (!Solver(prevScript, whichType))
+        return false;
+
+    if (whichType == TX_SCRIPTHASH)
+    {
+        // convert the scriptSig into a stack, so we can inspect the redeemScript
+        if (!EvalRedeemScript(tx.vin[i].scriptSig, redeemScript))
             return false;
+        if (redeemScript.GetSigOpCount(true) > MAX_P2SH_SIGOPS) {
+            return false;
+        }
+    }
+    return true;
+}
 
-        if (whichType == TX_SCRIPTHASH)
-        {
-            std::vector<std::vector<unsigned char> > stack;
-            // convert the scriptSig into a stack, so we can inspect the redeemScript
-            if (!EvalScript(stack, tx.vin[i].scriptSig, SCRIPT_VERIFY_NONE, BaseSignatureChecker(), SIGVERSION_BASE))
-                return false;
-            if (stack.empty())
-                return false;
-            CScript subscript(stack.back().begin(), stack.back().end());
-            if (subscript.GetSigOpCount(true) > MAX_P2SH_SIGOPS) {
+/** The checks IsWitnessStandard makes on one input with a witness, given the script it spends (the redeemScript for P2SH) */
+static bool IsWitnessInputStandard(const CScript& script, const CScriptWitness& scriptWitness)
+{
+    int witnessversion = 0;
+    std::vector<unsigned char> witnessprogram;
+
+    // Non-witness program must not be associated with any witness
+    if (!script.IsWitnessProgram(witnessversion, witnessprogram))
+        return false;
+
+    // Check P2WSH standard limits
+    if (witnessversion == 0 && witnessprogram.size() == 32) {
+        if (scriptWitness.stack.back().size() > MAX_STANDARD_P2WSH_SCRIPT_SIZE)
+            return false;
+        size_t sizeWitnessStack = scriptWitness.stack.size() - 1;
+        if (sizeWitnessStack > MAX_STANDARD_P2WSH_STACK_ITEMS)
+            return false;
+        for (unsigned int j = 0; j < sizeWitnessStack; j++) {
+            if (scriptWitness.stack[j].size() > MAX_STANDARD_P2WSH_STACK_ITEM_SIZE)
                 return false;
-            }
         }
     }
+    return true;
+}
+
+bool AreInputsStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs)
+{
+    if (tx.IsCoinBase())
+        return true; // Coinbases don't use vin normally
+
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    {
+        // get the scriptPubKey corresponding to this input:
+        const CScript& prevScript = mapInputs.GetOutputFor(tx.vin[i]).scriptPubKey;
+        CScript redeemScript;
+        if (!IsInputStandard(tx, i, prevScript, redeemScript))
+            return false;
+    }
 
     return true;
 }
@@ -182,36 +221,75 @@ bool IsWitnessStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs)
         CScript prevScript = prev.scriptPubKey;
 
         if (prevScript.IsPayToScriptHash()) {
-            std::vector <std::vector<unsigned char> > stack;
             // If the scriptPubKey is P2SH, we try to extract the redeemScript casually by converting the scriptSig
             // into a stack. We do not check IsPushOnly nor compare the hash as these will be done later anyway.
             // If the check fails at this stage, we know that this txid must be a bad one.
-            if (!EvalScript(stack, tx.vin[i].scriptSig, SCRIPT_VERIFY_NONE, BaseSignatureChecker(), SIGVERSION_BASE))
-                return false;
-            if (stack.empty())
+            if (!EvalRedeemScript(tx.vin[i].scriptSig, prevScript))
                 return false;
-            prevScript = CScript(stack.back().begin(), stack.back().end());
         }
 
-        int witnessversion = 0;
-        std::vector<unsigned char> witnessprogram;
-
-        // Non-witness program must not be associated with any witness
-        if (!prevScript.IsWitnessProgram(witnessversion, witnessprogram))
+        if (!IsWitnessInputStandard(prevScript, tx.wit.vtxinwit[i].scriptWitness))
             return false;
+    }
+    return true;
+}
 
-        // Check P2WSH standard limits
-        if (witnessversion == 0 && witnessprogram.size() == 32) {
-            if (tx.wit.vtxinwit[i].scriptWitness.stack.back().size() > MAX_STANDARD_P2WSH_SCRIPT_SIZE)
-                return false;
-            size_t sizeWitnessStack = tx.wit.vtxinwit[i].scriptWitness.stack.size() - 1;
-            if (sizeWitnessStack > MAX_STANDARD_P2WSH_STACK_ITEMS)
-                return false;
-            for (unsigned int j = 0; j < sizeWitnessStack; j++) {
-                if (tx.wit.vtxinwit[i].scriptWitness.stack[j].size() > MAX_STANDARD_P2WSH_STACK_ITEM_SIZE)
-                    return false;
+bool CheckInputsStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs, bool fCheckStandard, int flags, int64_t& nSigOpCostRet, std::string& reason)
+{
+    nSigOpCostRet = GetLegacySigOpCount(tx) * WITNESS_SCALE_FACTOR;
+    if (tx.IsCoinBase())
+        return true;
+
+    bool fWitnessStandard = true;
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    {
+        const CScript& scriptSig = tx.vin[i].scriptSig;
+        const CScript& prevScript = mapInputs.GetOutputFor(tx.vin[i]).scriptPubKey;
+        const CScriptWitness* witness = i < tx.wit.vtxinwit.size() ? &tx.wit.vtxinwit[i].scriptWitness : NULL;
+
+        // Sigops, as GetTransactionSigOpCost counts them. For P2SH both
+        // kinds are counted in the last push of a push only scriptSig,
+        // which is only taken once.
+        if (prevScript.IsPayToScriptHash()) {
+            std::vector<unsigned char> data;
+            bool fPushOnly = true;
+            CScript::const_iterator pc = scriptSig.begin();
+            while (fPushOnly && pc < scriptSig.end()) {
+                opcodetype opcode;
+                fPushOnly = scriptSig.GetOp(pc, opcode, data) && opcode <= OP_16;
             }
+            if (fPushOnly) {
+                CScript subscript(data.begin(), data.end());
+                if (flags & SCRIPT_VERIFY_P2SH)
+                    nSigOpCostRet += subscript.GetSigOpCount(true) * WITNESS_SCALE_FACTOR;
+                // Counts if the subscript is a witness program
+                nSigOpCostRet += CountWitnessSigOps(CScript(), subscript, witness, flags);
+            }
+        } else {
+            nSigOpCostRet += CountWitnessSigOps(scriptSig, prevScript, witness, flags);
+        }
+
+        if (!fCheckStandard)
+            continue;
+
+        CScript redeemScript;
+        if (!IsInputStandard(tx, i, prevScript, redeemScript)) {
+            reason = "bad-txns-nonstandard-inputs";
+            return false;
         }
+
+        // A nonstandard witness is only reported once all inputs passed the
+        // checks above, as separate AreInputsStandard and IsWitnessStandard
+        // calls would.
+        if (!fWitnessStandard || tx.wit.IsNull() || tx.wit.vtxinwit[i].IsNull())
+            continue;
+        if (!IsWitnessInputStandard(prevScript.IsPayToScriptHash() ? redeemScript : prevScript, tx.wit.vtxinwit[i].scriptWitness))
+            fWitnessStandard = false;
+    }
+
+    if (!fWitnessStandard) {
+        reason = "bad-witness-nonstandard";
+        return false;
     }
     return true;
 }
@@ -83,6 +83,15 @@ bool AreInputsStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs)
      * These limits are adequate for multi-signature up to n-of-100 using OP_CHECKSIG, OP_ADD, and OP_EQUAL,
      */
 bool IsWitnessStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs);
+    /**
+     * AreInputsStandard and, for a transaction with a witness, IsWitnessStandard
+     * (if fCheckStandard) along with GetTransactionSigOpCost, in one pass over
+     * the inputs that looks up each spent output and evaluates each P2SH
+     * scriptSig once.
+     * @param[out] nSigOpCostRet  GetTransactionSigOpCost(tx, mapInputs, flags)
+     * @param[out] reason         The reject reason if a check fails
+     */
+bool CheckInputsStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs, bool fCheckStandard, int flags, int64_t& nSigOpCostRet, std::string& reason);
 
 extern unsigned int nBytesPerSigOp;
 
@@ -14,27 +14,215 @@
 #include "primitives/block.h"
 #include "script/generic.hpp"
 #include "script/standard.h"
+#include "sync.h"
 #include "uint256.h"
 
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
 #endif
 
+#include <map>
+#include <memory>
+#include <set>
+
+#include <boost/foreach.hpp>
+
+/**
+ * A Schnorr challenge is an m-of-n CHECKMULTISIG behind an OP_RETURN, so that
+ * the script interpreter can never satisfy it by accident:
+ *   OP_RETURN OP_m <pubkey>... OP_n OP_CHECKMULTISIG
+ * Its solution pushes a bitmap of the keys that signed (bit i of byte i/8 for
+ * key i), followed by one 64-byte Schnorr signature of the header hash per
+ * set bit, in key order. A complete solution has exactly m bits set.
+ */
+static bool ParseSchnorrChallenge(const CScript& challenge, unsigned int& nRequired, std::vector<CPubKey>& vPubKeys)
+{
+    if (challenge.empty() || challenge[0] != OP_RETURN)
+        return false;
+    txnouttype type;
+    std::vector<std::vector<unsigned char> > vSolutions;
+    if (!Solver(CScript(challenge.begin() + 1, challenge.end()), type, vSolutions) || type != TX_MULTISIG)
+        return false;
+    nRequired = vSolutions.front()[0];
+    vPubKeys.clear();
+    for (size_t i = 1; i + 1 < vSolutions.size(); i++)
+        vPubKeys.push_back(CPubKey(vSolutions[i]));
+    return true;
+}
+
+static bool ParseSchnorrSolution(const CScript& solution, size_t nKeys, std::map<size_t, std::vector<unsigned char> >& mapSigs)
+{
+    CScript::const_iterator pc = solution.begin();
+    opcodetype opcode;
+    std::vector<unsigned char> vchBitmap;
+    if (!solution.GetOp(pc, opcode, vchBitmap) || opcode > OP_PUSHDATA4 || vchBitmap.size() != (nKeys + 7) / 8)
+        return false;
+    mapSigs.clear();
+    for (size_t i = 0; i < vchBitmap.size() * 8; i++) {
+        if (!(vchBitmap[i / 8] & (1 << (i % 8))))
+            continue;
+        std::vector<unsigned char> vchSig;
+        if (i >= nKeys || !solution.GetOp(pc, opcode, vchSig) || vchSig.size() != 64)
+            return false;
+        mapSigs[i] = vchSig;
+    }
+    return pc == solution.end();
+}
+
+static CScript SchnorrSolution(size_t nKeys, const std::map<size_t, std::vector<unsigned char> >& mapSigs)
+{
+    std::vector<unsigned char> vchBitmap((nKeys + 7) / 8, 0);
+    for (std::map<size_t, std::vector<unsigned char> >::const_iterator it = mapSigs.begin(); it != mapSigs.end(); ++it)
+        vchBitmap[it->first / 8] |= 1 << (it->first % 8);
+    CScript solution;
+    solution << vchBitmap;
+    for (std::map<size_t, std::vector<unsigned char> >::const_iterator it = mapSigs.begin(); it != mapSigs.end(); ++it)
+        solution << it->second;
+    return solution;
+}
+
+bool IsSchnorrChallenge(const CScript& challenge)
+{
+    unsigned int nRequired;
+    std::vector<CPubKey> vPubKeys;
+    return ParseSchnorrChallenge(challenge, nRequired, vPubKeys);
+}
+
+namespace {
+
+/** The keys of a block challenge, parsed once for as long as the challenge stays the same */
+struct CChallengeKeys
+{
+    CScript challenge;
+    bool fSchnorr;
+    //! Whether the challenge is a bare m-of-n CHECKMULTISIG
+    bool fMultisig;
+    unsigned int nRequired;
+    std::vector<CPubKey> vPubKeys;
+};
+
+CCriticalSection cs_challengekeys;
+std::shared_ptr<const CChallengeKeys> pchallengekeys;
+
+std::shared_ptr<const CChallengeKeys> GetChallengeKeys(const CScript& challenge)
+{
+    {
+        LOCK(cs_challengekeys);
+        if (pchallengekeys && pchallengekeys->challenge == challenge)
+            return pchallengekeys;
+    }
+    std::shared_ptr<CChallengeKeys> pkeys = std::make_shared<CChallengeKeys>();
+    pkeys->challenge = challenge;
+    pkeys->fSchnorr = ParseSchnorrChallenge(challenge, pkeys->nRequired, pkeys->vPubKeys);
+    pkeys->fMultisig = false;
+    txnouttype type;
+    std::vector<std::vector<unsigned char> > vSolutions;
+    if (!pkeys->fSchnorr && Solver(challenge, type, vSolutions) && type == TX_MULTISIG) {
+        pkeys->fMultisig = true;
+        pkeys->nRequired = vSolutions.front()[0];
+        for (size_t i = 1; i + 1 < vSolutions.size(); i++)
+            pkeys->vPubKeys.push_back(CPubKey(vSolutions[i]));
+    }
+    LOCK(cs_challengekeys);
+    pchallengekeys = pkeys;
+    return pkeys;
+}
+
+CScript CombineSchnorrSolutions(const CBlockHeader& header, const CChallengeKeys& keys, const std::vector<CScript>& vSolutions)
+{
+    std::vector<std::map<size_t, std::vector<unsigned char> > > vmapSigs(vSolutions.size());
+    for (size_t i = 0; i < vSolutions.size(); i++) {
+        if (!ParseSchnorrSolution(vSolutions[i], keys.vPubKeys.size(), vmapSigs[i]))
+            vmapSigs[i].clear();
+    }
+
+    // Keep only signatures that are valid, like CombineSignatures does.
+    const uint256 hash = SerializeHash(header);
+    std::map<size_t, std::vector<unsigned char> > mapSigs;
+    for (size_t i = 0; i < keys.vPubKeys.size() && mapSigs.size() < keys.nRequired; i++) {
+        for (size_t j = 0; j < vmapSigs.size(); j++) {
+            std::map<size_t, std::vector<unsigned char> >::const_iterator it = vmapSigs[j].find(i);
+            if (it != vmapSigs[j].end() && keys.vPubKeys[i].VerifySchnorr(hash, it->second)) {
+                mapSigs[i] = it->second;
+                break;
+            }
+        }
+    }
+    return SchnorrSolution(keys.vPubKeys.size(), mapSigs);
+}
+
+/** Merge the signatures of CHECKMULTISIG solutions, as CombineSignatures would for a TX_MULTISIG script */
+CScript CombineMultisigSolutions(const CBlockHeader& header, const CChallengeKeys& keys, const std::vector<CScript>& vSolutions)
+{
+    std::set<std::vector<unsigned char> > setSigs;
+    BOOST_FOREACH(const CScript& solution, vSolutions) {
+        CScript::const_iterator pc = solution.begin();
+        opcodetype opcode;
+        std::vector<unsigned char> vchSig;
+        while (pc < solution.end() && solution.GetOp(pc, opcode, vchSig) && opcode <= OP_PUSHDATA4) {
+            if (!vchSig.empty())
+                setSigs.insert(vchSig);
+        }
+    }
+
+    // Match each signature to the first key without one that it is valid for.
+    const uint256 hash = SerializeHash(header);
+    std::vector<const std::vector<unsigned char>*> vpSigs(keys.vPubKeys.size(), NULL);
+    BOOST_FOREACH(const std::vector<unsigned char>& vchSig, setSigs) {
+        for (size_t i = 0; i < keys.vPubKeys.size(); i++) {
+            if (!vpSigs[i] && keys.vPubKeys[i].IsValid() && keys.vPubKeys[i].Verify(hash, vchSig)) {
+                vpSigs[i] = &vchSig;
+                break;
+            }
+        }
+    }
+
+    CScript result;
+    result << OP_0; // pop-one-too-many workaround
+    unsigned int nSigsHave = 0;
+    for (size_t i = 0; i < vpSigs.size() && nSigsHave < keys.nRequired; i++) {
+        if (vpSigs[i]) {
+            result << *vpSigs[i];
+            nSigsHave++;
+        }
+    }
+    for (; nSigsHave < keys.nRequired; nSigsHave++)
+        result << OP_0;
+    return result;
+}
+
+} // anon namespace
+
+CScript CombineBlockSignatures(const CBlockHeader& header, const std::vector<CScript>& vSolutions)
+{
+    std::shared_ptr<const CChallengeKeys> pkeys = GetChallengeKeys(header.proof.challenge);
+    if (pkeys->fSchnorr)
+        return CombineSchnorrSolutions(header, *pkeys, vSolutions);
+    if (pkeys->fMultisig)
+        return CombineMultisigSolutions(header, *pkeys, vSolutions);
+
+    SignatureData solution;
+    BOOST_FOREACH(const CScript& scriptSig, vSolutions)
+        solution = GenericCombineSignatures(header.proof.challenge, header, solution, SignatureData(scriptSig));
+    return solution.scriptSig;
+}
+
 CScript CombineBlockSignatures(const CBlockHeader& header, const CScript& scriptSig1, const CScript& scriptSig2)
 {
-    SignatureData sig1(scriptSig1);
-    SignatureData sig2(scriptSig2);
-    return GenericCombineSignatures(header.proof.challenge, header, sig1, sig2).scriptSig;
+    std::vector<CScript> vSolutions;
+    vSolutions.push_back(scriptSig1);
+    vSolutions.push_back(scriptSig2);
+    return CombineBlockSignatures(header, vSolutions);
 }
 
 bool CheckChallenge(const CBlockHeader& block, const CBlockIndex& indexLast, const Consensus::Params& params)
 {
-    return block.proof.challenge == indexLast.proof.challenge;
+    return block.proof.challenge == indexLast.GetChallenge();
 }
 
 void ResetChallenge(CBlockHeader& block, const CBlockIndex& indexLast, const Consensus::Params& params)
 {
-    block.proof.challenge = indexLast.proof.challenge;
+    block.proof.challenge = indexLast.GetChallenge();
 }
 
 bool CheckBitcoinProof(const CBlockHeader& block)
@@ -62,12 +250,60 @@ bool CheckProof(const CBlockHeader& block, const Consensus::Params& params)
 {
     if (block.GetHash() == params.hashGenesisBlock)
        return true;
+    if (IsSchnorrChallenge(block.proof.challenge))
+        return CheckProofs(std::vector<const CBlockHeader*>(1, &block), params);
     return GenericVerifyScript(block.proof.solution, block.proof.challenge, SCRIPT_VERIFY_P2SH, block);
 }
 
+bool CheckProofs(const std::vector<const CBlockHeader*>& vBlocks, const Consensus::Params& params)
+{
+    std::vector<std::vector<unsigned char> > vchSigs;
+    std::vector<uint256> hashes;
+    std::vector<CPubKey> pubkeys;
+    BOOST_FOREACH(const CBlockHeader* pblock, vBlocks) {
+        unsigned int nRequired;
+        std::vector<CPubKey> vPubKeys;
+        if (!ParseSchnorrChallenge(pblock->proof.challenge, nRequired, vPubKeys)) {
+            if (!CheckProof(*pblock, params))
+                return false;
+            continue;
+        }
+        if (pblock->GetHash() == params.hashGenesisBlock)
+            continue;
+        std::map<size_t, std::vector<unsigned char> > mapSigs;
+        if (!ParseSchnorrSolution(pblock->proof.solution, vPubKeys.size(), mapSigs) || mapSigs.size() != nRequired)
+            return false;
+        const uint256 hash = SerializeHash(*pblock);
+        for (std::map<size_t, std::vector<unsigned char> >::const_iterator it = mapSigs.begin(); it != mapSigs.end(); ++it) {
+            vchSigs.push_back(it->second);
+            hashes.push_back(hash);
+            pubkeys.push_back(vPubKeys[it->first]);
+        }
+    }
+    return CPubKey::VerifySchnorrBatch(vchSigs, hashes, pubkeys);
+}
+
 bool MaybeGenerateProof(CBlockHeader *pblock, CWallet *pwallet)
 {
 #ifdef ENABLE_WALLET
+    unsigned int nRequired;
+    std::vector<CPubKey> vPubKeys;
+    if (ParseSchnorrChallenge(pblock->proof.challenge, nRequired, vPubKeys)) {
+        // Add our signatures to whatever partial solution is already there.
+        std::map<size_t, std::vector<unsigned char> > mapSigs;
+        if (!ParseSchnorrSolution(pblock->proof.solution, vPubKeys.size(), mapSigs))
+            mapSigs.clear();
+        const uint256 hash = SerializeHash(*pblock);
+        for (size_t i = 0; i < vPubKeys.size() && mapSigs.size() < nRequired; i++) {
+            CKey key;
+            if (mapSigs.count(i) || !pwallet->GetKey(vPubKeys[i].GetID(), key))
+                continue;
+            if (!key.SignSchnorr(hash, mapSigs[i]))
+                return false;
+        }
+        pblock->proof.solution = SchnorrSolution(vPubKeys.size(), mapSigs);
+        return mapSigs.size() == nRequired;
+    }
     SignatureData solution(pblock->proof.solution);
     bool res = GenericSignScript(*pwallet, *pblock, pblock->proof.challenge, solution);
     pblock->proof.solution = solution.scriptSig;
@@ -88,12 +324,12 @@ double GetChallengeDifficulty(const CBlockIndex* blockindex)
 
 std::string GetChallengeStr(const CBlockIndex& block)
 {
-    return ScriptToAsmStr(block.proof.challenge);
+    return ScriptToAsmStr(block.GetChallenge());
 }
 
 std::string GetChallengeStrHex(const CBlockIndex& block)
 {
-    return ScriptToAsmStr(block.proof.challenge);
+    return ScriptToAsmStr(block.GetChallenge());
 }
 
 uint32_t GetNonce(const CBlockHeader& block)
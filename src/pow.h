@@ -10,6 +10,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 class CBlockHeader;
 class CBlockIndex;
@@ -22,6 +23,10 @@ class uint256;
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
 bool CheckBitcoinProof(const CBlockHeader& block);
 bool CheckProof(const CBlockHeader& block, const Consensus::Params&);
+/** Check the proofs of several headers at once, batching the Schnorr signatures of those with a Schnorr challenge */
+bool CheckProofs(const std::vector<const CBlockHeader*>& vBlocks, const Consensus::Params&);
+/** Whether a challenge is an m-of-n Schnorr challenge (OP_RETURN followed by a multisig template) */
+bool IsSchnorrChallenge(const CScript& challenge);
 /** Scans nonces looking for a hash with at least some zero bits */
 bool MaybeGenerateProof(CBlockHeader* pblock, CWallet* pwallet);
 void ResetProof(CBlockHeader& block);
@@ -29,6 +34,12 @@ bool CheckChallenge(const CBlockHeader& block, const CBlockIndex& indexLast, con
 void ResetChallenge(CBlockHeader& block, const CBlockIndex& indexLast, const Consensus::Params&);
 
 CScript CombineBlockSignatures(const CBlockHeader& header, const CScript& scriptSig1, const CScript& scriptSig2);
+/**
+ * Merge any number of partial solutions for a header's challenge in one pass,
+ * keeping only valid signatures. The keys of the challenge are parsed once
+ * and reused for as long as the challenge does not change.
+ */
+CScript CombineBlockSignatures(const CBlockHeader& header, const std::vector<CScript>& vSolutions);
 
 /** Avoid using these functions when possible */
 double GetChallengeDifficulty(const CBlockIndex* blockindex);
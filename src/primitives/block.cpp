@@ -41,16 +41,34 @@ std::string CBlock::ToString() const
         vtx.size());
     for (unsigned int i = 0; i < vtx.size(); i++)
     {
-        s << "  " << vtx[i].ToString() << "\n";
+        s << "  " << vtx[i]->ToString() << "\n";
     }
     return s.str();
 }
 
+static unsigned int GetBlockSize(const CBlock& block, bool fWitness)
+{
+    unsigned int nSize = ::GetSerializeSize(static_cast<const CBlockHeader&>(block), SER_NETWORK, PROTOCOL_VERSION) + GetSizeOfCompactSize(block.vtx.size());
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        nSize += fWitness ? block.vtx[i]->GetTotalSize() : block.vtx[i]->GetStrippedSize();
+    return nSize;
+}
+
+unsigned int GetBlockStrippedSize(const CBlock& block)
+{
+    return GetBlockSize(block, false);
+}
+
+unsigned int GetBlockTotalSize(const CBlock& block)
+{
+    return GetBlockSize(block, true);
+}
+
 int64_t GetBlockWeight(const CBlock& block)
 {
     // This implements the weight = (stripped_size * 4) + witness_size formula,
-    // using only serialization with and without witness data. As witness_size
+    // using only the sizes with and without witness data. As witness_size
     // is equal to total_size - stripped_size, this formula is identical to:
     // weight = (stripped_size * 3) + total_size.
-    return ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) * (WITNESS_SCALE_FACTOR - 1) + ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    return (int64_t)GetBlockStrippedSize(block) * (WITNESS_SCALE_FACTOR - 1) + GetBlockTotalSize(block);
 }
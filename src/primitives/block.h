@@ -6,6 +6,7 @@
 #ifndef BITCOIN_PRIMITIVES_BLOCK_H
 #define BITCOIN_PRIMITIVES_BLOCK_H
 
+#include "arena.h"
 #include "primitives/transaction.h"
 #include "script/script.h"
 #include "serialize.h"
@@ -158,7 +159,7 @@ class CBlock : public CBlockHeader
 {
 public:
     // network and disk
-    std::vector<CTransaction> vtx;
+    std::vector<CTransactionRef> vtx;
 
     // memory only
     mutable bool fChecked;
@@ -179,7 +180,8 @@ public:
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
         READWRITE(*(CBlockHeader*)this);
-        READWRITE(vtx);
+        // The rangeproofs of all the transactions go into one arena.
+        ::SerReadWriteInArena(s, vtx, nType, nVersion, ser_action);
     }
 
     void SetNull()
@@ -240,6 +242,12 @@ struct CBlockLocator
     }
 };
 
+/** Serialized size of the block without witness data, summed from the sizes cached on its transactions. */
+unsigned int GetBlockStrippedSize(const CBlock& block);
+
+/** Serialized size of the block including witness data, summed from the sizes cached on its transactions. */
+unsigned int GetBlockTotalSize(const CBlock& block);
+
 /** Compute the consensus-critical block weight (see BIP 141). */
 int64_t GetBlockWeight(const CBlock& tx);
 
@@ -140,16 +140,19 @@ uint256 CMutableTransaction::GetHash() const
 void CTransaction::UpdateHash() const
 {
     *const_cast<uint256*>(&hash) = SerializeHash(*this, SER_GETHASH, SERIALIZE_TRANSACTION_NO_WITNESS);
+    *const_cast<unsigned int*>(&nStrippedSize) = ::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    *const_cast<unsigned int*>(&nTotalSize) = ::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION);
+    // Without witness data both serializations are the same, so is their hash.
+    if (nTotalSize == nStrippedSize) {
+        *const_cast<uint256*>(&witnessHash) = hash;
+    } else {
+        *const_cast<uint256*>(&witnessHash) = SerializeHash(*this, SER_GETHASH, 0);
+    }
 }
 
-uint256 CTransaction::GetWitnessHash() const
-{
-    return SerializeHash(*this, SER_GETHASH, 0);
-}
-
-CTransaction::CTransaction() : nVersion(CTransaction::CURRENT_VERSION), nTxFee(0), vin(), vout(), nLockTime(0) { }
+CTransaction::CTransaction() : nStrippedSize(0), nTotalSize(0), nVersion(CTransaction::CURRENT_VERSION), nTxFee(0), vin(), vout(), nLockTime(0) { }
 
-CTransaction::CTransaction(const CMutableTransaction &tx) : nVersion(tx.nVersion), nTxFee(tx.nTxFee), vin(tx.vin), vout(tx.vout), wit(tx.wit), nLockTime(tx.nLockTime) {
+CTransaction::CTransaction(const CMutableTransaction &tx) : nStrippedSize(0), nTotalSize(0), nVersion(tx.nVersion), nTxFee(tx.nTxFee), vin(tx.vin), vout(tx.vout), wit(tx.wit), nLockTime(tx.nLockTime) {
     UpdateHash();
 }
 
@@ -161,9 +164,20 @@ CTransaction& CTransaction::operator=(const CTransaction &tx) {
     *const_cast<CTxWitness*>(&wit) = tx.wit;
     *const_cast<unsigned int*>(&nLockTime) = tx.nLockTime;
     *const_cast<uint256*>(&hash) = tx.hash;
+    *const_cast<uint256*>(&witnessHash) = tx.witnessHash;
+    *const_cast<unsigned int*>(&nStrippedSize) = tx.nStrippedSize;
+    *const_cast<unsigned int*>(&nTotalSize) = tx.nTotalSize;
     return *this;
 }
 
+void CTransaction::ReleaseArena()
+{
+    // This changes where the rangeproofs are, not what they are.
+    std::vector<CTxOut>& voutMutable = *const_cast<std::vector<CTxOut>*>(&vout);
+    for (size_t i = 0; i < voutMutable.size(); i++)
+        voutMutable[i].nValue.vchRangeproof.release_arena();
+}
+
 double CTransaction::ComputePriority(double dPriorityInputs, unsigned int nTxSize) const
 {
     nTxSize = CalculateModifiedSize(nTxSize);
@@ -211,5 +225,5 @@ std::string CTransaction::ToString() const
 
 int64_t GetTransactionWeight(const CTransaction& tx)
 {
-    return ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) * (WITNESS_SCALE_FACTOR -1) + ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    return (int64_t)tx.GetStrippedSize() * (WITNESS_SCALE_FACTOR - 1) + tx.GetTotalSize();
 }
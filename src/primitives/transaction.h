@@ -9,6 +9,7 @@
 #include "amount.h"
 #include "script/script.h"
 #include "serialize.h"
+#include "sharedvector.h"
 #include "uint256.h"
 
 static const int SERIALIZE_TRANSACTION_NO_WITNESS = 0x40000000;
@@ -134,9 +135,14 @@ class CTxOutValue
 public:
     static const size_t nCommitmentSize = 33;
 
-    std::vector<unsigned char> vchCommitment;
-    std::vector<unsigned char> vchRangeproof;
-    std::vector<unsigned char> vchNonceCommitment;
+    /** Commitments and nonce commitments fit in nCommitmentSize bytes, so
+     *  they are stored inline rather than in a separate heap allocation. */
+    typedef prevector<nCommitmentSize, unsigned char> commitment_type;
+
+    commitment_type vchCommitment;
+    //! Shared between copies of the transaction, see shared_vector
+    shared_vector<unsigned char> vchRangeproof;
+    commitment_type vchNonceCommitment;
 
     CTxOutValue();
     CTxOutValue(CAmount);
@@ -146,18 +152,23 @@ public:
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
-        if ((nVersion & SERIALIZE_BITCOIN_BLOCK_OR_TX) || IsInBitcoinTransaction()) {
-            CAmount nAmount = 0;
-            if (!ser_action.ForRead())
-                nAmount = GetAmount();
-            READWRITE(nAmount);
-            if (ser_action.ForRead())
-                SetToBitcoinAmount(nAmount);
-        } else {
-            // We only serialize the value commitment here.
-            // The ECDH key and range proof are serialized through CTxOutWitnessSerializer.
-            READWRITE(REF(CFlatData(&vchCommitment[0], &vchCommitment[nCommitmentSize])));
-        }
+        if ((nVersion & SERIALIZE_BITCOIN_BLOCK_OR_TX) || IsInBitcoinTransaction())
+            SerializeAmount(s, ser_action, nType, nVersion);
+        else
+            SerializeCommitment(s, ser_action, nType, nVersion);
+    }
+
+    /**
+     * As SerializationOp, with the format of SERIALIZE_BITCOIN_BLOCK_OR_TX
+     * given at compile time. Reading assumes a value that was not read
+     * before, as the outputs of a transaction being read are.
+     */
+    template <bool fBitcoinFormat, typename Stream, typename Operation>
+    inline void SerializeFormat(Stream& s, Operation ser_action, int nType, int nVersion) {
+        if (fBitcoinFormat || (!ser_action.ForRead() && IsInBitcoinTransaction()))
+            SerializeAmount(s, ser_action, nType, nVersion);
+        else
+            SerializeCommitment(s, ser_action, nType, nVersion);
     }
 
     bool IsValid() const;
@@ -170,6 +181,23 @@ public:
     friend bool operator!=(const CTxOutValue& a, const CTxOutValue& b);
 
 private: // "Bitcoin amounts" can only be set by deserializing with SERIALIZE_BITCOIN_BLOCK_OR_TX
+    template <typename Stream, typename Operation>
+    inline void SerializeAmount(Stream& s, Operation ser_action, int nType, int nVersion) {
+        CAmount nAmount = 0;
+        if (!ser_action.ForRead())
+            nAmount = GetAmount();
+        READWRITE(nAmount);
+        if (ser_action.ForRead())
+            SetToBitcoinAmount(nAmount);
+    }
+
+    template <typename Stream, typename Operation>
+    inline void SerializeCommitment(Stream& s, Operation ser_action, int nType, int nVersion) {
+        // We only serialize the value commitment here.
+        // The ECDH key and range proof are serialized through CTxOutWitnessSerializer.
+        READWRITE(REF(CFlatData(&vchCommitment[0], &vchCommitment[nCommitmentSize])));
+    }
+
     void SetToBitcoinAmount(const CAmount nAmount);
     bool IsInBitcoinTransaction() const;
     void SetToAmount(const CAmount nAmount);
@@ -289,8 +317,8 @@ public:
     }
 
     void SetNull() {
-        std::vector<unsigned char>().swap(ref.nValue.vchRangeproof);
-        std::vector<unsigned char>().swap(ref.nValue.vchNonceCommitment);
+        ref.nValue.vchRangeproof.clear();
+        CTxOutValue::commitment_type().swap(ref.nValue.vchNonceCommitment);
     }
 };
 
@@ -375,10 +403,49 @@ struct CMutableTransaction;
  * - uint32_t nLockTime
  */
 static const CAmount TX_FEE_BITCOIN_TX_FLAG = -42;
-template<typename Stream, typename Operation, typename TxType>
-inline void SerializeTransaction(TxType& tx, Stream& s, Operation ser_action, int nType, int nVersion) {
-    const bool fAllowWitness = !(nVersion & SERIALIZE_TRANSACTION_NO_WITNESS);
-    const bool fIsBitcoinTx = (nVersion & SERIALIZE_BITCOIN_BLOCK_OR_TX);
+
+/**
+ * The outputs of a transaction, as READWRITE(vout) would serialize them,
+ * with the format of their values fixed at compile time rather than looked
+ * up in nVersion for each of them.
+ */
+template<bool fBitcoinFormat, typename Stream>
+inline void SerializeTxOuts(const std::vector<CTxOut>& vout, Stream& s, CSerActionSerialize ser_action, int nType, int nVersion)
+{
+    WriteCompactSize(s, vout.size());
+    for (size_t i = 0; i < vout.size(); i++) {
+        CTxOut& txout = *const_cast<CTxOut*>(&vout[i]);
+        txout.nValue.SerializeFormat<fBitcoinFormat>(s, ser_action, nType, nVersion);
+        READWRITE(*(CScriptBase*)(&txout.scriptPubKey));
+    }
+}
+
+template<bool fBitcoinFormat, typename Stream>
+inline void SerializeTxOuts(const std::vector<CTxOut>& vout, Stream& s, CSerActionUnserialize ser_action, int nType, int nVersion)
+{
+    std::vector<CTxOut>& voutRead = *const_cast<std::vector<CTxOut>*>(&vout);
+    voutRead.clear();
+    // Grow the vector a batch at a time, as the vector deserializer does, so
+    // that a bogus size does not allocate all of it up front.
+    unsigned int nSize = ReadCompactSize(s);
+    unsigned int i = 0;
+    unsigned int nMid = 0;
+    while (nMid < nSize) {
+        nMid = std::min(nSize, nMid + (unsigned int)(5000000 / sizeof(CTxOut)));
+        voutRead.resize(nMid);
+        for (; i < nMid; i++) {
+            voutRead[i].nValue.SerializeFormat<fBitcoinFormat>(s, ser_action, nType, nVersion);
+            READWRITE(*(CScriptBase*)(&voutRead[i].scriptPubKey));
+        }
+    }
+}
+
+/**
+ * SerializeTransaction for one combination of the format flags, so that the
+ * checks of them, done for each output, are resolved at compile time.
+ */
+template<bool fAllowWitness, bool fIsBitcoinTx, typename Stream, typename Operation, typename TxType>
+inline void SerializeTransactionFormat(TxType& tx, Stream& s, Operation ser_action, int nType, int nVersion) {
     READWRITE(*const_cast<int32_t*>(&tx.nVersion));
     if ((ser_action.ForRead() || (!ser_action.ForRead() && tx.nTxFee != TX_FEE_BITCOIN_TX_FLAG)) && !fIsBitcoinTx)
         READWRITE(*const_cast<CAmount*>(&tx.nTxFee));
@@ -391,18 +458,18 @@ inline void SerializeTransaction(TxType& tx, Stream& s, Operation ser_action, in
         const_cast<CTxWitness*>(&tx.wit)->SetNull();
         /* Try to read the vin. In case the dummy is there, this will be read as an empty vector. */
         READWRITE(*const_cast<std::vector<CTxIn>*>(&tx.vin));
-        if (tx.vin.size() == 0 && !(nVersion & SERIALIZE_TRANSACTION_NO_WITNESS)) {
+        if (tx.vin.size() == 0 && fAllowWitness) {
             /* We read a dummy or an empty vin. */
             READWRITE(flags);
             if (flags != 0) {
                 READWRITE(*const_cast<std::vector<CTxIn>*>(&tx.vin));
-                READWRITE(*const_cast<std::vector<CTxOut>*>(&tx.vout));
+                SerializeTxOuts<fIsBitcoinTx>(tx.vout, s, ser_action, nType, nVersion);
             }
         } else {
             /* We read a non-empty vin. Assume a normal vout follows. */
-            READWRITE(*const_cast<std::vector<CTxOut>*>(&tx.vout));
+            SerializeTxOuts<fIsBitcoinTx>(tx.vout, s, ser_action, nType, nVersion);
         }
-        if ((flags & 1) && !(nVersion & SERIALIZE_TRANSACTION_NO_WITNESS)) {
+        if ((flags & 1) && fAllowWitness) {
             /* The witness flag is present, and we support witnesses. */
             flags ^= 1;
             const_cast<CTxWitness*>(&tx.wit)->vtxinwit.resize(tx.vin.size());
@@ -413,9 +480,10 @@ inline void SerializeTransaction(TxType& tx, Stream& s, Operation ser_action, in
             flags ^= 2;
             bool fHadOutputWitness = false;
             for (size_t i = 0; i < tx.vout.size(); i++) {
-                CTxOutWitnessSerializer witser(REF(tx.vout[i]));
-                READWRITE(witser);
-                if (!witser.IsNull()) {
+                CTxOutValue& value = REF(tx.vout[i]).nValue;
+                READWRITE(value.vchRangeproof);
+                READWRITE(value.vchNonceCommitment);
+                if (!value.vchRangeproof.empty() || !value.vchNonceCommitment.empty()) {
                     fHadOutputWitness = true;
                 }
             }
@@ -430,7 +498,7 @@ inline void SerializeTransaction(TxType& tx, Stream& s, Operation ser_action, in
     } else {
         // Consistency check
         assert(tx.wit.vtxinwit.size() <= tx.vin.size());
-        if (!(nVersion & SERIALIZE_TRANSACTION_NO_WITNESS)) {
+        if (fAllowWitness) {
             /* Check whether witnesses need to be serialized. */
             if (!tx.wit.IsNull()) {
                 flags |= 1;
@@ -451,21 +519,36 @@ inline void SerializeTransaction(TxType& tx, Stream& s, Operation ser_action, in
             READWRITE(flags);
         }
         READWRITE(*const_cast<std::vector<CTxIn>*>(&tx.vin));
-        READWRITE(*const_cast<std::vector<CTxOut>*>(&tx.vout));
+        SerializeTxOuts<fIsBitcoinTx>(tx.vout, s, ser_action, nType, nVersion);
         if (flags & 1) {
             const_cast<CTxWitness*>(&tx.wit)->vtxinwit.resize(tx.vin.size());
             READWRITE(tx.wit);
         }
         if (flags & 2) {
             for (size_t i = 0; i < tx.vout.size(); i++) {
-                CTxOutWitnessSerializer witser(*const_cast<CTxOut*>(&tx.vout[i]));
-                READWRITE(witser);
+                CTxOutValue& value = const_cast<CTxOut*>(&tx.vout[i])->nValue;
+                READWRITE(value.vchRangeproof);
+                READWRITE(value.vchNonceCommitment);
             }
         }
     }
     READWRITE(*const_cast<uint32_t*>(&tx.nLockTime));
 }
 
+template<typename Stream, typename Operation, typename TxType>
+inline void SerializeTransaction(TxType& tx, Stream& s, Operation ser_action, int nType, int nVersion) {
+    const bool fAllowWitness = !(nVersion & SERIALIZE_TRANSACTION_NO_WITNESS);
+    const bool fIsBitcoinTx = (nVersion & SERIALIZE_BITCOIN_BLOCK_OR_TX);
+    if (fAllowWitness && !fIsBitcoinTx)
+        SerializeTransactionFormat<true, false>(tx, s, ser_action, nType, nVersion);
+    else if (!fIsBitcoinTx)
+        SerializeTransactionFormat<false, false>(tx, s, ser_action, nType, nVersion);
+    else if (fAllowWitness)
+        SerializeTransactionFormat<true, true>(tx, s, ser_action, nType, nVersion);
+    else
+        SerializeTransactionFormat<false, true>(tx, s, ser_action, nType, nVersion);
+}
+
 /** The basic transaction that is broadcasted on the network and contained in
  * blocks.  A transaction can contain multiple inputs and outputs.
  */
@@ -474,6 +557,9 @@ class CTransaction
 private:
     /** Memory only. */
     const uint256 hash;
+    const uint256 witnessHash;
+    const unsigned int nStrippedSize;
+    const unsigned int nTotalSize;
 
 public:
     // Default transaction version.
@@ -494,7 +580,7 @@ public:
     const CAmount nTxFee;
     const std::vector<CTxIn> vin;
     const std::vector<CTxOut> vout;
-    CTxWitness wit; // Not const: can change without invalidating the txid cache
+    CTxWitness wit; // Not const: can change without invalidating the txid cache, but call UpdateHash() after changing it
     const uint32_t nLockTime;
 
     /** Construct a CTransaction that qualifies as IsNull() */
@@ -505,6 +591,10 @@ public:
 
     CTransaction& operator=(const CTransaction& tx);
 
+    /** Move the rangeproofs that are in the arena of the block this was read
+     *  with to allocations of their own, for a copy that outlives the block */
+    void ReleaseArena();
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -523,8 +613,20 @@ public:
         return hash;
     }
 
-    // Compute a hash that includes both transaction and witness data
-    uint256 GetWitnessHash() const;
+    // Hash that includes both transaction and witness data
+    const uint256& GetWitnessHash() const {
+        return witnessHash;
+    }
+
+    // Serialized size without witness data
+    unsigned int GetStrippedSize() const {
+        return nStrippedSize;
+    }
+
+    // Serialized size including witness data (range proofs and surjection proofs included)
+    unsigned int GetTotalSize() const {
+        return nTotalSize;
+    }
 
     // Compute priority, given priority of inputs and (optionally) tx size
     double ComputePriority(double dPriorityInputs, unsigned int nTxSize=0) const;
@@ -549,6 +651,7 @@ public:
 
     std::string ToString() const;
 
+    /** Recompute the cached hashes and sizes. Needed after changing wit. */
     void UpdateHash() const;
 };
 
@@ -581,4 +684,10 @@ struct CMutableTransaction
 /** Compute the weight of a transaction, as defined by BIP 141 */
 int64_t GetTransactionWeight(const CTransaction &tx);
 
+/** A transaction shared between the mempool, relay and blocks, which is
+ * never changed once it is built */
+typedef std::shared_ptr<const CTransaction> CTransactionRef;
+static inline CTransactionRef MakeTransactionRef() { return std::make_shared<const CTransaction>(); }
+template <typename Tx> static inline CTransactionRef MakeTransactionRef(Tx&& txIn) { return std::make_shared<const CTransaction>(std::forward<Tx>(txIn)); }
+
 #endif // BITCOIN_PRIMITIVES_TRANSACTION_H
@@ -39,6 +39,15 @@ const char *SENDCMPCT="sendcmpct";
 const char *CMPCTBLOCK="cmpctblock";
 const char *GETBLOCKTXN="getblocktxn";
 const char *BLOCKTXN="blocktxn";
+const char *SENDRPDEDUP="sendrpdedup";
+const char *RPBLOCKTXN="rpblocktxn";
+const char *BLOCKSIG="blocksig";
+const char *SENDCHEADERS="sendcheaders";
+const char *CHEADERS="cheaders";
+const char *SENDRECON="sendrecon";
+const char *REQRECON="reqrecon";
+const char *SKETCH="sketch";
+const char *RECONCILDIFF="reconcildiff";
 };
 
 /** All known message types. Keep this in the same order as the list of
@@ -71,6 +80,15 @@ const static std::string allNetMessageTypes[] = {
     NetMsgType::CMPCTBLOCK,
     NetMsgType::GETBLOCKTXN,
     NetMsgType::BLOCKTXN,
+    NetMsgType::SENDRPDEDUP,
+    NetMsgType::RPBLOCKTXN,
+    NetMsgType::BLOCKSIG,
+    NetMsgType::SENDCHEADERS,
+    NetMsgType::CHEADERS,
+    NetMsgType::SENDRECON,
+    NetMsgType::REQRECON,
+    NetMsgType::SKETCH,
+    NetMsgType::RECONCILDIFF,
 };
 const static std::vector<std::string> allNetMessageTypesVec(allNetMessageTypes, allNetMessageTypes+ARRAYLEN(allNetMessageTypes));
 
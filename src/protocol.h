@@ -243,6 +243,69 @@ extern const char *GETBLOCKTXN;
  * @since protocol version 70014 as described by BIP 152
  */
 extern const char *BLOCKTXN;
+/**
+ * Indicates that a node understands "rpblocktxn" messages, and sends them
+ * instead of "blocktxn" to peers that sent this message.
+ * Elements extension, sent to peers with protocol version 70014 or higher.
+ */
+extern const char *SENDRPDEDUP;
+/**
+ * Contains a BlockTransactionsNoRangeproofs.
+ * Sent in response to a "getblocktxn" message instead of "blocktxn" to peers
+ * that sent "sendrpdedup". Transactions the peer already knew about are sent
+ * without their rangeproofs; if it no longer has them, the peer requests those
+ * transactions again with a "getblocktxn" message.
+ * Elements extension.
+ */
+extern const char *RPBLOCKTXN;
+/**
+ * Contains a block hash and a signature (a scriptSig) on the header of the
+ * block proposal with that hash, for the signers of a federated chain to
+ * combine their signatures without a round of RPC calls.
+ * Elements extension.
+ */
+extern const char *BLOCKSIG;
+/**
+ * Indicates that a node understands "cheaders" messages, and sends them
+ * instead of "headers" to peers that sent this message.
+ * Elements extension, sent to peers with protocol version 70014 or higher.
+ */
+extern const char *SENDCHEADERS;
+/**
+ * Contains a CompactHeaders: the headers a "headers" message would, each
+ * without the block signing challenge when it equals the previous one's.
+ * Elements extension.
+ */
+extern const char *CHEADERS;
+/**
+ * Contains a 4-byte protocol version and an 8-byte salt, and indicates that
+ * a node wants to reconcile the transactions it announces to the peer
+ * instead of sending invs for them. Once both sides sent it, the short ids
+ * of the reconciliation are keyed with both salts.
+ * Elements extension, sent to peers with service bit NODE_TXRECON.
+ */
+extern const char *SENDRECON;
+/**
+ * Contains the 4-byte number of transactions the sender has to reconcile,
+ * and asks the peer for a "sketch" of its own. Only sent by the side that
+ * made the connection.
+ * Elements extension.
+ */
+extern const char *REQRECON;
+/**
+ * Contains a CReconSketch of the short ids of the transactions the sender
+ * had to announce, in response to a "reqrecon" message.
+ * Elements extension.
+ */
+extern const char *SKETCH;
+/**
+ * Contains a 1-byte success flag and a vector of 4-byte short ids: those of
+ * the transactions in the last "sketch" the sender wants announced to it.
+ * If the sketch could not be decoded, the flag is false and the peer
+ * announces all of them.
+ * Elements extension.
+ */
+extern const char *RECONCILDIFF;
 };
 
 /* Get a vector of all valid message types (see above) */
@@ -267,6 +330,9 @@ enum ServiceFlags : uint64_t {
     // Indicates that a node can be asked for blocks and transactions including
     // witness data.
     NODE_WITNESS = (1 << 3),
+    // NODE_TXRECON means the node can announce transactions by set reconciliation
+    // (see "sendrecon"). Elements extension, taken from the experimental range below.
+    NODE_TXRECON = (1 << 24),
 
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
@@ -4,13 +4,57 @@
 
 #include "pubkey.h"
 
+#include "crypto/common.h"
+#include "eccontext.h"
+
 #include <secp256k1.h>
 #include <secp256k1_recovery.h>
+#include <secp256k1_schnorr.h>
+
+#include <map>
+#include <mutex>
 
 namespace
 {
 /* Global secp256k1_context object used for verification. */
-secp256k1_context* secp256k1_context_verify = NULL;
+const secp256k1_context* secp256k1_context_verify = NULL;
+
+/**
+ * Parsed public keys, so that the keys behind every block and many
+ * transactions (the block signers, the federation, reused addresses) are
+ * decompressed once rather than for every signature. The table is direct
+ * mapped on the key's x coordinate: a key landing in a taken slot replaces
+ * the one there. An empty slot has a zero header byte, which no key has.
+ */
+const size_t PUBKEY_PARSE_CACHE_SIZE = 4096;
+
+struct CParsedPubKey
+{
+    unsigned char vch[65];
+    secp256k1_pubkey parsed;
+};
+
+std::mutex csParsedPubKeys;
+CParsedPubKey vParsedPubKeys[PUBKEY_PARSE_CACHE_SIZE];
+
+/** secp256k1_ec_pubkey_parse of a valid-sized key, through the cache */
+bool ParsePubKey(const CPubKey& pubkey, secp256k1_pubkey& parsed)
+{
+    CParsedPubKey& slot = vParsedPubKeys[ReadLE32(pubkey.begin() + 1) % PUBKEY_PARSE_CACHE_SIZE];
+    {
+        std::lock_guard<std::mutex> lock(csParsedPubKeys);
+        if (memcmp(slot.vch, pubkey.begin(), pubkey.size()) == 0) {
+            parsed = slot.parsed;
+            return true;
+        }
+    }
+    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &parsed, pubkey.begin(), pubkey.size()))
+        return false;
+    std::lock_guard<std::mutex> lock(csParsedPubKeys);
+    memcpy(slot.vch, pubkey.begin(), pubkey.size());
+    slot.parsed = parsed;
+    return true;
+}
 }
 
 /** This function is taken from the libsecp256k1 distribution and implements
@@ -169,7 +213,7 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
         return false;
     secp256k1_pubkey pubkey;
     secp256k1_ecdsa_signature sig;
-    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
+    if (!ParsePubKey(*this, pubkey)) {
         return false;
     }
     if (vchSig.size() == 0) {
@@ -184,6 +228,55 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
     return secp256k1_ecdsa_verify(secp256k1_context_verify, &sig, hash.begin(), &pubkey);
 }
 
+bool CPubKey::VerifySchnorr(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
+    if (!IsValid())
+        return false;
+    secp256k1_pubkey pubkey;
+    if (!ParsePubKey(*this, pubkey)) {
+        return false;
+    }
+    if (vchSig.size() != 64) {
+        return false;
+    }
+    return secp256k1_schnorr_verify(secp256k1_context_verify, &vchSig[0], hash.begin(), &pubkey);
+}
+
+bool CPubKey::VerifySchnorrBatch(const std::vector<std::vector<unsigned char> >& vchSigs, const std::vector<uint256>& hashes, const std::vector<CPubKey>& pubkeys) {
+    if (vchSigs.size() != hashes.size() || vchSigs.size() != pubkeys.size())
+        return false;
+    /* Signers reuse a handful of keys, so parse each distinct one only once;
+     * passing the same pointer also saves the library from comparing them. */
+    std::map<CPubKey, size_t> mapParsed;
+    std::vector<secp256k1_pubkey> vParsed;
+    vParsed.reserve(pubkeys.size());
+    std::vector<size_t> vKeyIndex(pubkeys.size());
+    for (size_t i = 0; i < pubkeys.size(); i++) {
+        std::map<CPubKey, size_t>::const_iterator it = mapParsed.find(pubkeys[i]);
+        if (it == mapParsed.end()) {
+            if (!pubkeys[i].IsValid())
+                return false;
+            vParsed.resize(vParsed.size() + 1);
+            if (!ParsePubKey(pubkeys[i], vParsed.back()))
+                return false;
+            it = mapParsed.insert(std::make_pair(pubkeys[i], vParsed.size() - 1)).first;
+        }
+        vKeyIndex[i] = it->second;
+    }
+    std::vector<const unsigned char*> vSigPtrs(vchSigs.size());
+    std::vector<const unsigned char*> vHashPtrs(vchSigs.size());
+    std::vector<const secp256k1_pubkey*> vKeyPtrs(vchSigs.size());
+    for (size_t i = 0; i < vchSigs.size(); i++) {
+        if (vchSigs[i].size() != 64)
+            return false;
+        vSigPtrs[i] = &vchSigs[i][0];
+        vHashPtrs[i] = hashes[i].begin();
+        vKeyPtrs[i] = &vParsed[vKeyIndex[i]];
+    }
+    if (vchSigs.empty())
+        return true;
+    return secp256k1_schnorr_verify_batch(secp256k1_context_verify, &vSigPtrs[0], &vHashPtrs[0], &vKeyPtrs[0], vchSigs.size());
+}
+
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
     if (vchSig.size() != 65)
         return false;
@@ -286,8 +379,7 @@ ECCVerifyHandle::ECCVerifyHandle()
 {
     if (refcount == 0) {
         assert(secp256k1_context_verify == NULL);
-        secp256k1_context_verify = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY);
-        assert(secp256k1_context_verify != NULL);
+        secp256k1_context_verify = ECC_GetContext();
     }
     refcount++;
 }
@@ -297,7 +389,6 @@ ECCVerifyHandle::~ECCVerifyHandle()
     refcount--;
     if (refcount == 0) {
         assert(secp256k1_context_verify != NULL);
-        secp256k1_context_destroy(secp256k1_context_verify);
         secp256k1_context_verify = NULL;
     }
 }
@@ -184,6 +184,19 @@ public:
      */
     static bool CheckLowS(const std::vector<unsigned char>& vchSig);
 
+    /**
+     * Verify a 64-byte Schnorr signature.
+     * If this public key is not fully valid, the return value will be false.
+     */
+    bool VerifySchnorr(const uint256& hash, const std::vector<unsigned char>& vchSig) const;
+
+    /**
+     * Verify a set of Schnorr signatures at once; vchSigs[i] is checked
+     * against hashes[i] and pubkeys[i]. This is much cheaper than checking
+     * them one by one, but only tells whether all of them are valid.
+     */
+    static bool VerifySchnorrBatch(const std::vector<std::vector<unsigned char> >& vchSigs, const std::vector<uint256>& hashes, const std::vector<CPubKey>& pubkeys);
+
     //! Recover a public key from a compact signature.
     bool RecoverCompact(const uint256& hash, const std::vector<unsigned char>& vchSig);
 
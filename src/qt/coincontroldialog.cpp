@@ -18,6 +18,8 @@
 #include "main.h" // For minRelayTxFee
 #include "wallet/wallet.h"
 
+#include <set>
+
 #include <boost/assign/list_of.hpp> // for 'map_list_of()'
 
 #include <QApplication>
@@ -26,6 +28,7 @@
 #include <QDialogButtonBox>
 #include <QFlags>
 #include <QIcon>
+#include <QMap>
 #include <QSettings>
 #include <QString>
 #include <QTreeWidget>
@@ -707,9 +710,20 @@ void CoinControlDialog::updateView()
     std::map<QString, std::vector<COutput> > mapCoins;
     model->listCoins(mapCoins);
 
+    // Look the locked coins and the labels up once, rather than per output
+    std::vector<COutPoint> vLockedCoins;
+    model->listLockedCoins(vLockedCoins);
+    std::set<COutPoint> setLockedCoins(vLockedCoins.begin(), vLockedCoins.end());
+    QMap<QString, QString> mapLabels;
+
+    // The items are filled in before they are added to the tree, and then
+    // added all at once: every change to an item that is in the tree
+    // notifies the view, which with thousands of coins takes far longer
+    // than building them.
+    QList<QTreeWidgetItem*> topLevelItems;
+
     BOOST_FOREACH(const PAIRTYPE(QString, std::vector<COutput>)& coins, mapCoins) {
-        QTreeWidgetItem *itemWalletAddress = new QTreeWidgetItem();
-        itemWalletAddress->setCheckState(COLUMN_CHECKBOX, Qt::Unchecked);
+        QTreeWidgetItem *itemWalletAddress = 0;
         QString sWalletAddress = coins.first;
         QString sWalletLabel = model->getAddressTableModel()->labelForAddress(sWalletAddress);
         if (sWalletLabel.isEmpty())
@@ -718,7 +732,8 @@ void CoinControlDialog::updateView()
         if (treeMode)
         {
             // wallet address
-            ui->treeWidget->addTopLevelItem(itemWalletAddress);
+            itemWalletAddress = new QTreeWidgetItem();
+            topLevelItems.append(itemWalletAddress);
 
             itemWalletAddress->setFlags(flgTristate);
             itemWalletAddress->setCheckState(COLUMN_CHECKBOX, Qt::Unchecked);
@@ -734,14 +749,16 @@ void CoinControlDialog::updateView()
         double dPrioritySum = 0;
         int nChildren = 0;
         int nInputSum = 0;
+        QList<QTreeWidgetItem*> outputItems;
         BOOST_FOREACH(const COutput& out, coins.second) {
             int nInputSize = 0;
-            nSum += out.tx->GetValueOut(out.i);
+            // Unblinded once, for the amount, its sort key and the priority
+            CAmount nValue = out.tx->GetValueOut(out.i);
+            nSum += nValue;
             nChildren++;
 
-            QTreeWidgetItem *itemOutput;
-            if (treeMode)    itemOutput = new QTreeWidgetItem(itemWalletAddress);
-            else             itemOutput = new QTreeWidgetItem(ui->treeWidget);
+            QTreeWidgetItem *itemOutput = new QTreeWidgetItem();
+            outputItems.append(itemOutput);
             itemOutput->setFlags(flgCheckbox);
             itemOutput->setCheckState(COLUMN_CHECKBOX,Qt::Unchecked);
 
@@ -771,15 +788,20 @@ void CoinControlDialog::updateView()
             }
             else if (!treeMode)
             {
-                QString sLabel = model->getAddressTableModel()->labelForAddress(sAddress);
-                if (sLabel.isEmpty())
-                    sLabel = tr("(no label)");
-                itemOutput->setText(COLUMN_LABEL, sLabel);
+                QMap<QString, QString>::const_iterator it = mapLabels.constFind(sAddress);
+                if (it == mapLabels.constEnd())
+                {
+                    QString sLabel = model->getAddressTableModel()->labelForAddress(sAddress);
+                    if (sLabel.isEmpty())
+                        sLabel = tr("(no label)");
+                    it = mapLabels.insert(sAddress, sLabel);
+                }
+                itemOutput->setText(COLUMN_LABEL, it.value());
             }
 
             // amount
-            itemOutput->setText(COLUMN_AMOUNT, BitcoinUnits::format(nDisplayUnit, out.tx->GetValueOut(out.i)));
-            itemOutput->setText(COLUMN_AMOUNT_INT64, strPad(QString::number(out.tx->GetValueOut(out.i)), 15, " ")); // padding so that sorting works correctly
+            itemOutput->setText(COLUMN_AMOUNT, BitcoinUnits::format(nDisplayUnit, nValue));
+            itemOutput->setText(COLUMN_AMOUNT_INT64, strPad(QString::number(nValue), 15, " ")); // padding so that sorting works correctly
 
             // date
             itemOutput->setText(COLUMN_DATE, GUIUtil::dateTimeStr(out.tx->GetTxTime()));
@@ -789,10 +811,10 @@ void CoinControlDialog::updateView()
             itemOutput->setText(COLUMN_CONFIRMATIONS, strPad(QString::number(out.nDepth), 8, " "));
 
             // priority
-            double dPriority = ((double)out.tx->vout[out.i].nValue.GetAmount()  / (nInputSize + 78)) * (out.nDepth+1); // 78 = 2 * 34 + 10
+            double dPriority = ((double)nValue / (nInputSize + 78)) * (out.nDepth+1); // 78 = 2 * 34 + 10
             itemOutput->setText(COLUMN_PRIORITY, CoinControlDialog::getPriorityLabel(dPriority, mempoolEstimatePriority));
             itemOutput->setText(COLUMN_PRIORITY_INT64, strPad(QString::number((int64_t)dPriority), 20, " "));
-            dPrioritySum += (double)out.tx->vout[out.i].nValue.GetAmount()  * (out.nDepth+1);
+            dPrioritySum += (double)nValue * (out.nDepth+1);
             nInputSum    += nInputSize;
 
             // transaction hash
@@ -803,22 +825,24 @@ void CoinControlDialog::updateView()
             itemOutput->setText(COLUMN_VOUT_INDEX, QString::number(out.i));
 
              // disable locked coins
-            if (model->isLockedCoin(txhash, out.i))
+            COutPoint outpt(txhash, out.i);
+            if (setLockedCoins.count(outpt))
             {
-                COutPoint outpt(txhash, out.i);
                 coinControl->UnSelect(outpt); // just to be sure
                 itemOutput->setDisabled(true);
                 itemOutput->setIcon(COLUMN_CHECKBOX, platformStyle->SingleColorIcon(":/icons/lock_closed"));
             }
 
             // set checkbox
-            if (coinControl->IsSelected(COutPoint(txhash, out.i)))
+            if (coinControl->IsSelected(outpt))
                 itemOutput->setCheckState(COLUMN_CHECKBOX, Qt::Checked);
         }
 
-        // amount
         if (treeMode)
         {
+            itemWalletAddress->addChildren(outputItems);
+
+            // amount
             dPrioritySum = dPrioritySum / (nInputSum + 78);
             itemWalletAddress->setText(COLUMN_CHECKBOX, "(" + QString::number(nChildren) + ")");
             itemWalletAddress->setText(COLUMN_AMOUNT, BitcoinUnits::format(nDisplayUnit, nSum));
@@ -826,8 +850,14 @@ void CoinControlDialog::updateView()
             itemWalletAddress->setText(COLUMN_PRIORITY, CoinControlDialog::getPriorityLabel(dPrioritySum, mempoolEstimatePriority));
             itemWalletAddress->setText(COLUMN_PRIORITY_INT64, strPad(QString::number((int64_t)dPrioritySum), 20, " "));
         }
+        else
+        {
+            topLevelItems.append(outputItems);
+        }
     }
 
+    ui->treeWidget->addTopLevelItems(topLevelItems);
+
     // expand all partially selected
     if (treeMode)
     {
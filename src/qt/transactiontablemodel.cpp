@@ -25,9 +25,16 @@
 #include <QDebug>
 #include <QIcon>
 #include <QList>
+#include <QMutex>
+#include <QThread>
+
+#include <atomic>
 
 #include <boost/foreach.hpp>
 
+/** Number of wallet transactions decomposed per lock of the wallet when loading the table */
+static const int LOAD_BATCH_SIZE = 250;
+
 // Amount column is right-aligned it contains numbers
 static int column_alignments[] = {
         Qt::AlignLeft|Qt::AlignVCenter, /* status */
@@ -55,18 +62,96 @@ struct TxLessThan
     }
 };
 
+/** Decomposes the wallet's transactions into records on a thread of its own,
+ * a batch at a time, so that loading a large wallet does not freeze the GUI.
+ */
+class TransactionTableLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    TransactionTableLoader(CWallet *wallet, TransactionTableModel *ttm) :
+        wallet(wallet),
+        ttm(ttm),
+        fInterrupted(false)
+    {
+    }
+
+    /** Stop after the batch in progress */
+    void interrupt() { fInterrupted = true; }
+
+    /** Take the records loaded since the last call */
+    QList<TransactionRecord> takeLoaded()
+    {
+        QMutexLocker locker(&mutex);
+        QList<TransactionRecord> records;
+        records.swap(loaded);
+        return records;
+    }
+
+public Q_SLOTS:
+    void load();
+
+private:
+    CWallet *wallet;
+    TransactionTableModel *ttm;
+    std::atomic<bool> fInterrupted;
+    QMutex mutex;
+    QList<TransactionRecord> loaded;
+};
+
+#include "transactiontablemodel.moc"
+
+void TransactionTableLoader::load()
+{
+    std::vector<uint256> vHashes;
+    {
+        LOCK(wallet->cs_wallet);
+        vHashes.reserve(wallet->mapWallet.size());
+        for (std::map<uint256, CWalletTx>::const_iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it)
+            vHashes.push_back(it->first);
+    }
+
+    // Only hold the locks for a batch at a time; transactions added or
+    // removed in between reach the model through the wallet's notifications.
+    for (size_t i = 0; i < vHashes.size() && !fInterrupted; i += LOAD_BATCH_SIZE)
+    {
+        QList<TransactionRecord> records;
+        {
+            LOCK2(cs_main, wallet->cs_wallet);
+            for (size_t j = i; j < std::min(i + LOAD_BATCH_SIZE, vHashes.size()); j++)
+            {
+                std::map<uint256, CWalletTx>::const_iterator mi = wallet->mapWallet.find(vHashes[j]);
+                if (mi != wallet->mapWallet.end() && TransactionRecord::showTransaction(mi->second))
+                    records.append(TransactionRecord::decomposeTransaction(wallet, mi->second));
+            }
+        }
+        if (records.isEmpty())
+            continue;
+        {
+            QMutexLocker locker(&mutex);
+            loaded.append(records);
+        }
+        QMetaObject::invokeMethod(ttm, "insertLoadedTransactions", Qt::QueuedConnection);
+    }
+}
+
 // Private implementation
 class TransactionTablePriv
 {
 public:
     TransactionTablePriv(CWallet *wallet, TransactionTableModel *parent) :
         wallet(wallet),
-        parent(parent)
+        parent(parent),
+        loader(0),
+        loaderThread(0)
     {
     }
 
     CWallet *wallet;
     TransactionTableModel *parent;
+    TransactionTableLoader *loader;
+    QThread *loaderThread;
 
     /* Local cache of wallet.
      * As it is in the same order as the CWallet, by definition
@@ -74,19 +159,65 @@ public:
      */
     QList<TransactionRecord> cachedWallet;
 
-    /* Query entire wallet anew from core.
+    /* Query entire wallet anew from core, in the background. The rows are
+       inserted as they are loaded.
      */
     void refreshWallet()
     {
         qDebug() << "TransactionTablePriv::refreshWallet";
         cachedWallet.clear();
+        loaderThread = new QThread(parent);
+        loader = new TransactionTableLoader(wallet, parent);
+        loader->moveToThread(loaderThread);
+        loaderThread->start();
+        QMetaObject::invokeMethod(loader, "load", Qt::QueuedConnection);
+    }
+
+    /* Wait for the background loading to stop, if it has not finished.
+     */
+    void stopLoading()
+    {
+        if (!loaderThread)
+            return;
+        loader->interrupt();
+        loaderThread->quit();
+        loaderThread->wait();
+        delete loader;
+        loader = 0;
+    }
+
+    /* Insert the records loaded in the background since the last call.
+       Both they and the model are sorted by hash, so they go in as runs of
+       consecutive rows. Transactions a notification has put in the model
+       in the meantime are skipped.
+     */
+    void insertLoaded()
+    {
+        if (!loader)
+            return;
+        QList<TransactionRecord> records = loader->takeLoaded();
+        int i = 0;
+        while (i < records.size())
         {
-            LOCK2(cs_main, wallet->cs_wallet);
-            for(std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it)
+            QList<TransactionRecord>::iterator lower = qLowerBound(
+                cachedWallet.begin(), cachedWallet.end(), records[i].hash, TxLessThan());
+            int insertIndex = (lower - cachedWallet.begin());
+            if (lower != cachedWallet.end() && lower->hash == records[i].hash)
             {
-                if(TransactionRecord::showTransaction(it->second))
-                    cachedWallet.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+                const uint256 hash = records[i].hash;
+                while (i < records.size() && records[i].hash == hash)
+                    i++;
+                continue;
             }
+            int runEnd = i;
+            while (runEnd < records.size() &&
+                   (insertIndex == cachedWallet.size() || records[runEnd].hash < cachedWallet[insertIndex].hash))
+                runEnd++;
+            parent->beginInsertRows(QModelIndex(), insertIndex, insertIndex + (runEnd - i) - 1);
+            for (int j = i; j < runEnd; j++)
+                cachedWallet.insert(insertIndex + (j - i), records[j]);
+            parent->endInsertRows();
+            i = runEnd;
         }
     }
 
@@ -254,6 +385,7 @@ TransactionTableModel::TransactionTableModel(const PlatformStyle *platformStyle,
 TransactionTableModel::~TransactionTableModel()
 {
     unsubscribeFromCoreSignals();
+    priv->stopLoading();
     delete priv;
 }
 
@@ -272,6 +404,11 @@ void TransactionTableModel::updateTransaction(const QString &hash, int status, b
     priv->updateWallet(updated, status, showTransaction);
 }
 
+void TransactionTableModel::insertLoadedTransactions()
+{
+    priv->insertLoaded();
+}
+
 void TransactionTableModel::updateConfirmations()
 {
     // Blocks came in since last poll.
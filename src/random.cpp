@@ -5,6 +5,8 @@
 
 #include "random.h"
 
+#include "crypto/chacha20.h"
+#include "crypto/sha256.h"
 #include "crypto/sha512.h"
 #include "support/cleanse.h"
 #ifdef WIN32
@@ -22,6 +24,8 @@
 #include <sys/time.h>
 #endif
 
+#include <boost/thread/tss.hpp>
+
 #include <openssl/err.h>
 #include <openssl/rand.h>
 
@@ -151,6 +155,90 @@ void GetStrongRandBytes(unsigned char* out, int num)
     memory_cleanse(buf, 64);
 }
 
+namespace {
+
+//! Key stream GetFastRandBytes generates at a time
+const size_t FAST_RAND_BUFFER_SIZE = 256;
+//! Output after which a thread's key is mixed with fresh entropy
+const uint64_t FAST_RAND_RESEED_BYTES = 1 << 20;
+
+/**
+ * A thread's state for GetFastRandBytes. Every time the buffer is refilled,
+ * the key is replaced with the first 32 bytes of the key stream, and output
+ * is wiped from the buffer as it is handed out, so that the state never
+ * reveals what was generated before.
+ */
+struct CFastRandState
+{
+    unsigned char key[32];
+    unsigned char buf[FAST_RAND_BUFFER_SIZE];
+    //! Bytes of buf handed out already
+    size_t nUsed;
+    //! Bytes handed out since the key was last mixed with fresh entropy
+    uint64_t nSinceSeed;
+
+    CFastRandState() : nUsed(FAST_RAND_BUFFER_SIZE), nSinceSeed(0)
+    {
+        GetStrongRandBytes(key, sizeof(key));
+    }
+
+    ~CFastRandState()
+    {
+        memory_cleanse(key, sizeof(key));
+        memory_cleanse(buf, sizeof(buf));
+    }
+
+    void Reseed()
+    {
+        unsigned char seed[32];
+        GetStrongRandBytes(seed, sizeof(seed));
+        CSHA256().Write(key, sizeof(key)).Write(seed, sizeof(seed)).Finalize(key);
+        memory_cleanse(seed, sizeof(seed));
+        memory_cleanse(buf, sizeof(buf));
+        nUsed = sizeof(buf);
+        nSinceSeed = 0;
+    }
+
+    void Refill()
+    {
+        unsigned char stream[sizeof(key) + sizeof(buf)];
+        ChaCha20(key, sizeof(key)).Output(stream, sizeof(stream));
+        memcpy(key, stream, sizeof(key));
+        memcpy(buf, stream + sizeof(key), sizeof(buf));
+        memory_cleanse(stream, sizeof(stream));
+        nUsed = 0;
+    }
+};
+
+void ReleaseFastRandState(CFastRandState* pstate)
+{
+    delete pstate;
+}
+
+}
+
+void GetFastRandBytes(unsigned char* buf, int num)
+{
+    static boost::thread_specific_ptr<CFastRandState> ptrState(&ReleaseFastRandState);
+    if (ptrState.get() == NULL)
+        ptrState.reset(new CFastRandState());
+    CFastRandState& state = *ptrState;
+
+    if (state.nSinceSeed >= FAST_RAND_RESEED_BYTES)
+        state.Reseed();
+    while (num > 0) {
+        if (state.nUsed == sizeof(state.buf))
+            state.Refill();
+        const size_t n = std::min((size_t)num, sizeof(state.buf) - state.nUsed);
+        memcpy(buf, state.buf + state.nUsed, n);
+        memory_cleanse(state.buf + state.nUsed, n);
+        state.nUsed += n;
+        state.nSinceSeed += n;
+        buf += n;
+        num -= n;
+    }
+}
+
 uint64_t GetRand(uint64_t nMax)
 {
     if (nMax == 0)
@@ -161,7 +249,7 @@ uint64_t GetRand(uint64_t nMax)
     uint64_t nRange = (std::numeric_limits<uint64_t>::max() / nMax) * nMax;
     uint64_t nRand = 0;
     do {
-        GetRandBytes((unsigned char*)&nRand, sizeof(nRand));
+        GetFastRandBytes((unsigned char*)&nRand, sizeof(nRand));
     } while (nRand >= nRange);
     return (nRand % nMax);
 }
@@ -174,7 +262,7 @@ int GetRandInt(int nMax)
 uint256 GetRandHash()
 {
     uint256 hash;
-    GetRandBytes((unsigned char*)&hash, sizeof(hash));
+    GetFastRandBytes((unsigned char*)&hash, sizeof(hash));
     return hash;
 }
 
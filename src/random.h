@@ -17,6 +17,15 @@ void RandAddSeed();
  * Functions to gather random data via the OpenSSL PRNG
  */
 void GetRandBytes(unsigned char* buf, int num);
+
+/**
+ * Random data from a ChaCha20 key stream of the calling thread's own, keyed
+ * with GetStrongRandBytes. It is as unpredictable as GetRandBytes, but takes
+ * no global lock, which makes it the one to use for blinding factors,
+ * nonces and other randomness that is asked for often. GetRand, GetRandInt
+ * and GetRandHash draw on it too.
+ */
+void GetFastRandBytes(unsigned char* buf, int num);
 uint64_t GetRand(uint64_t nMax);
 int GetRandInt(int nMax);
 uint256 GetRandHash();
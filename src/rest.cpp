@@ -5,18 +5,23 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "crypto/common.h"
+#include "hash.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "main.h"
 #include "httpserver.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
 #include "utilstrencodings.h"
+#include "validationstats.h"
 #include "version.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 #include <boost/dynamic_bitset.hpp>
 
 #include <univalue.h>
@@ -24,6 +29,8 @@
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const long MAX_CTDATA_BLOCKS = 100; //allow a max of 100 blocks of confidential output data at once
+static const long MAX_REST_BLOCKS = 2000; //allow a max of 2000 raw blocks to be exported at once
 
 enum RetFormat {
     RF_UNDEF,
@@ -58,12 +65,13 @@ struct CCoin {
     }
 };
 
-extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
-extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry, bool fLean = false);
+extern void blockToJSON(CJSONWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 extern UniValue mempoolInfoToJSON();
-extern UniValue mempoolToJSON(bool fVerbose = false);
+extern void mempoolToJSON(CJSONWriter& writer, bool fVerbose = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
+extern UniValue scriptHistoryToJSON(const uint256& scriptHash, bool fUnspentOnly);
 
 static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, string message)
 {
@@ -150,23 +158,23 @@ static bool rest_headers(HTTPRequest* req,
 
     std::vector<const CBlockIndex *> headers;
     headers.reserve(count);
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
     {
         LOCK(cs_main);
         BlockMap::const_iterator it = mapBlockIndex.find(hash);
         const CBlockIndex *pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
         while (pindex != NULL && chainActive.Contains(pindex)) {
+            CBlockHeader header;
+            if (!GetBlockIndexHeader(pindex, header))
+                return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, pindex->GetBlockHash().GetHex() + " header could not be read");
             headers.push_back(pindex);
+            ssHeader << header;
             if (headers.size() == (unsigned long)count)
                 break;
             pindex = chainActive.Next(pindex);
         }
     }
 
-    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
-    BOOST_FOREACH(const CBlockIndex *pindex, headers) {
-        ssHeader << pindex->GetBlockHeader();
-    }
-
     switch (rf) {
     case RF_BINARY: {
         string binaryHeader = ssHeader.str();
@@ -247,10 +255,9 @@ static bool rest_block(HTTPRequest* req,
     }
 
     case RF_JSON: {
-        UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        string strJSON = objBlock.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        CJSONStreamWriter writer(boost::bind(&HTTPRequest::WriteReplyPart, req, "application/json", _1));
+        blockToJSON(writer, block, pblockindex, showTxDetails);
+        req->WriteReplyLast("application/json", writer.GetBuffered() + "\n");
         return true;
     }
 
@@ -263,6 +270,170 @@ static bool rest_block(HTTPRequest* req,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+/** Whether the If-None-Match header of req lists strETag */
+static bool ETagMatches(HTTPRequest* req, const std::string& strETag)
+{
+    std::pair<bool, std::string> header = req->GetHeader("if-none-match");
+    if (!header.first)
+        return false;
+    vector<string> tags;
+    boost::split(tags, header.second, boost::is_any_of(","));
+    BOOST_FOREACH(string& tag, tags) {
+        boost::trim(tag);
+        if (tag == "*" || tag == strETag)
+            return true;
+    }
+    return false;
+}
+
+static bool rest_ctdata(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    vector<string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+    if (path.size() != 1 && path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Use /rest/ctdata/<hash>.<ext> or /rest/ctdata/<count>/<hash>.<ext>.");
+
+    long count = 1;
+    if (path.size() == 2) {
+        count = strtol(path[0].c_str(), NULL, 10);
+        if (count < 1 || count > MAX_CTDATA_BLOCKS)
+            return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[0]);
+    }
+
+    string hashStr = path.back();
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    // A single block can be any we have; a range follows the main chain
+    // upwards, like /rest/headers/.
+    std::vector<const CBlockIndex*> blocks;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it == mapBlockIndex.end())
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        const CBlockIndex* pindex = it->second;
+        if (path.size() == 2 && !chainActive.Contains(pindex))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not in the main chain");
+        while (pindex != NULL) {
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().GetHex() + (fHavePruned && pindex->nTx > 0 ? " not available (pruned data)" : " not found"));
+            blocks.push_back(pindex);
+            if (blocks.size() == (unsigned long)count)
+                break;
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    // Blocks never change, so the reply is named by which blocks it covers.
+    CHashWriter ssETag(SER_GETHASH, 0);
+    ssETag << (int)rf;
+    BOOST_FOREACH(const CBlockIndex* pindex, blocks)
+        ssETag << pindex->GetBlockHash();
+    const std::string strETag = "\"" + ssETag.GetHash().GetHex() + "\"";
+    req->WriteHeader("ETag", strETag);
+    if (ETagMatches(req, strETag)) {
+        req->WriteReply(HTTP_NOT_MODIFIED);
+        return true;
+    }
+
+    // Each block is read and sent on its own, so a range of them is never
+    // held in memory at once.
+    const std::string strContentType = rf == RF_BINARY ? "application/octet-stream" : "text/plain";
+    for (size_t i = 0; i < blocks.size(); i++) {
+        CDataStream ssCTData(SER_NETWORK, PROTOCOL_VERSION);
+        if (!ReadBlockCTDataFromDisk(ssCTData, blocks[i])) {
+            if (!req->IsReplyStarted())
+                return RESTERR(req, HTTP_NOT_FOUND, blocks[i]->GetBlockHash().GetHex() + " not found");
+            req->WriteReplyEnd();
+            return false;
+        }
+        std::string strPart = rf == RF_BINARY ? ssCTData.str() : HexStr(ssCTData.begin(), ssCTData.end());
+        if (i + 1 < blocks.size()) {
+            req->WriteReplyPart(strContentType, strPart);
+        } else {
+            if (rf == RF_HEX)
+                strPart += "\n";
+            req->WriteReplyLast(strContentType, strPart);
+        }
+    }
+    return true;
+}
+
+static bool rest_blocks(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (rf != RF_BINARY)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin)");
+
+    vector<string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block count specified. Use /rest/blocks/<hash>/<count>.bin.");
+
+    string hashStr = path[0];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    long count = strtol(path[1].c_str(), NULL, 10);
+    if (count < 1 || count > MAX_REST_BLOCKS)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[1]);
+
+    std::vector<const CBlockIndex*> blocks;
+    blocks.reserve(count);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it == mapBlockIndex.end() || !chainActive.Contains(it->second))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found in the main chain");
+        const CBlockIndex* pindex = it->second;
+        while (pindex != NULL) {
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().GetHex() + " not available (pruned data)");
+            blocks.push_back(pindex);
+            if (blocks.size() == (unsigned long)count)
+                break;
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    // The stored bytes are sent as they are, each block in its own chunk
+    // and preceded by its size, so that a client can split the stream
+    // without parsing it.
+    for (size_t i = 0; i < blocks.size(); i++) {
+        std::vector<char> vBlock;
+        if (!ReadRawBlockFromDisk(vBlock, blocks[i], true)) {
+            if (!req->IsReplyStarted())
+                return RESTERR(req, HTTP_NOT_FOUND, blocks[i]->GetBlockHash().GetHex() + " not found");
+            req->WriteReplyEnd();
+            return false;
+        }
+        unsigned char size[4];
+        WriteLE32(size, vBlock.size());
+        std::string strPart;
+        strPart.reserve(sizeof(size) + vBlock.size());
+        strPart.append((const char*)size, sizeof(size));
+        strPart.append(begin_ptr(vBlock), vBlock.size());
+        if (i + 1 < blocks.size())
+            req->WriteReplyPart("application/octet-stream", strPart);
+        else
+            req->WriteReplyLast("application/octet-stream", strPart);
+    }
+    return true;
+}
+
 static bool rest_block_extended(HTTPRequest* req, const std::string& strURIPart)
 {
     return rest_block(req, strURIPart, true);
@@ -301,6 +472,41 @@ static bool rest_chaininfo(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_scripthistory(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (rf != RF_JSON)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+
+    vector<string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+    if (path.size() == 2 && path[0] != "unspent")
+        path.clear();
+    if (path.size() != 1 && path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Use /rest/scripthistory/<scripthash>.json or /rest/scripthistory/unspent/<scripthash>.json.");
+
+    uint256 scriptHash;
+    if (!ParseHashStr(path.back(), scriptHash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + path.back());
+    if (!pscriptindexdb)
+        return RESTERR(req, HTTP_NOT_FOUND, "The script index is disabled, use -scriptindex");
+
+    UniValue outputs;
+    try {
+        LOCK(cs_main);
+        outputs = scriptHistoryToJSON(scriptHash, path.size() == 2);
+    } catch (const UniValue& objError) {
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, find_value(objError, "message").get_str());
+    }
+    string strJSON = outputs.write() + "\n";
+    req->WriteHeader("Content-Type", "application/json");
+    req->WriteReply(HTTP_OK, strJSON);
+    return true;
+}
+
 static bool rest_mempool_info(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -335,11 +541,9 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
 
     switch (rf) {
     case RF_JSON: {
-        UniValue mempoolObject = mempoolToJSON(true);
-
-        string strJSON = mempoolObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        CJSONStreamWriter writer(boost::bind(&HTTPRequest::WriteReplyPart, req, "application/json", _1));
+        mempoolToJSON(writer, true);
+        req->WriteReplyLast("application/json", writer.GetBuffered() + "\n");
         return true;
     }
     default: {
@@ -612,6 +816,9 @@ static const struct {
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
+      {"/rest/ctdata/", rest_ctdata},
+      {"/rest/scripthistory/", rest_scripthistory},
+      {"/rest/blocks/", rest_blocks},
       {"/rest/getutxos", rest_getutxos},
 };
 
@@ -626,6 +833,25 @@ void InterruptREST()
 {
 }
 
+static bool http_metrics(HTTPRequest* req, const std::string& strURIPart)
+{
+    // Only the histograms are exposed, so there is nothing to wait for.
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, FormatValidationMetrics());
+    return true;
+}
+
+bool StartMetrics()
+{
+    RegisterHTTPHandler("/metrics", true, http_metrics);
+    return true;
+}
+
+void StopMetrics()
+{
+    UnregisterHTTPHandler("/metrics", true);
+}
+
 void StopREST()
 {
     for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++)
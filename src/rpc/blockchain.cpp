@@ -4,6 +4,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amount.h"
+#include "base58.h"
+#include "blockstats.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -12,13 +14,18 @@
 #include "main.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
+#include "script/standard.h"
 #include "pow.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "validationstats.h"
 #include "hash.h"
 
 #include <stdint.h>
@@ -29,7 +36,10 @@
 
 using namespace std;
 
-extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
+/** Number of mempool entries written per lock of the mempool by mempoolToJSON */
+static const unsigned int MEMPOOL_JSON_BATCH_SIZE = 1000;
+
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry, bool fLean = false);
 void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 
 double GetDifficulty(const CBlockIndex* blockindex)
@@ -46,14 +56,16 @@ double GetDifficulty(const CBlockIndex* blockindex)
     return GetChallengeDifficulty(blockindex);
 }
 
+/** Only reads what LookupBlockIndex allows, so it needs no cs_main. */
 UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 {
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    if (chain->Contains(blockindex))
+        confirmations = chain->Height() - blockindex->nHeight + 1;
     result.push_back(Pair("confirmations", confirmations));
     result.push_back(Pair("height", blockindex->nHeight));
     result.push_back(Pair("version", blockindex->nVersion));
@@ -61,61 +73,75 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.push_back(Pair("merkleroot", blockindex->hashMerkleRoot.GetHex()));
     result.push_back(Pair("time", (int64_t)blockindex->nTime));
     result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
-    result.push_back(Pair("nonce", (uint64_t)GetNonce(blockindex->GetBlockHeader())));
-    result.push_back(Pair("bits", GetChallengeStr(blockindex->GetBlockHeader())));
+    // Signed blocks have no nonce. Their solution, which GetBlockHeader
+    // would copy, may be dropped from the index meanwhile.
+    result.push_back(Pair("nonce", (uint64_t)GetNonce(CBlockHeader())));
+    result.push_back(Pair("bits", GetChallengeStr(*blockindex)));
     result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
     result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
 
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+    CBlockIndex *pnext = chain->Next(blockindex);
     if (pnext)
         result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+void blockToJSON(CJSONWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
 {
-    UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
-    int confirmations = -1;
-    // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
-    result.push_back(Pair("confirmations", confirmations));
-    result.push_back(Pair("strippedsize", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS)));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("weight", (int)::GetBlockWeight(block)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    UniValue txs(UniValue::VARR);
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+    // The fields around the transactions are put together first, so that
+    // cs_main is not held while the writer waits for a slow client.
+    UniValue before(UniValue::VOBJ);
+    UniValue after(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
+        before.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
+        int confirmations = -1;
+        // Only report confirmations if the block is on the main chain
+        if (chainActive.Contains(blockindex))
+            confirmations = chainActive.Height() - blockindex->nHeight + 1;
+        before.push_back(Pair("confirmations", confirmations));
+        before.push_back(Pair("strippedsize", (int)GetBlockStrippedSize(block)));
+        before.push_back(Pair("size", (int)GetBlockTotalSize(block)));
+        before.push_back(Pair("weight", (int)::GetBlockWeight(block)));
+        before.push_back(Pair("height", blockindex->nHeight));
+        before.push_back(Pair("version", block.nVersion));
+        before.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
+        before.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+        after.push_back(Pair("time", block.GetBlockTime()));
+        after.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
+        after.push_back(Pair("nonce", (uint64_t)GetNonce(block)));
+        after.push_back(Pair("bits", GetChallengeStr(block)));
+        after.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+        after.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
+
+        if (blockindex->pprev)
+            after.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+        CBlockIndex *pnext = chainActive.Next(blockindex);
+        if (pnext)
+            after.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+    }
+
+    writer.BeginObject();
+    writer.Members(before);
+    writer.Key("tx");
+    writer.BeginArray();
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
     {
+        const CTransaction& tx = *ptx;
         if(txDetails)
         {
             UniValue objTx(UniValue::VOBJ);
             TxToJSON(tx, uint256(), objTx);
-            txs.push_back(objTx);
+            writer.Value(objTx);
         }
         else
-            txs.push_back(tx.GetHash().GetHex());
+            writer.Value(tx.GetHash().GetHex());
     }
-    result.push_back(Pair("tx", txs));
-    result.push_back(Pair("time", block.GetBlockTime()));
-    result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
-    result.push_back(Pair("nonce", (uint64_t)GetNonce(block)));
-    result.push_back(Pair("bits", GetChallengeStr(block)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
-
-    if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
-    if (pnext)
-        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
-    return result;
+    writer.EndArray();
+    writer.Members(after);
+    writer.EndObject();
 }
 
 UniValue getblockcount(const UniValue& params, bool fHelp)
@@ -131,8 +157,7 @@ UniValue getblockcount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    return GetChainSnapshot()->Height();
 }
 
 UniValue getbestblockhash(const UniValue& params, bool fHelp)
@@ -148,8 +173,7 @@ UniValue getbestblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return GetChainSnapshot()->Tip()->GetBlockHash().GetHex();
 }
 
 UniValue getdifficulty(const UniValue& params, bool fHelp)
@@ -223,35 +247,46 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
     info.push_back(Pair("depends", depends));
 }
 
-UniValue mempoolToJSON(bool fVerbose = false)
+void mempoolToJSON(CJSONWriter& writer, bool fVerbose = false)
 {
+    vector<uint256> vtxid;
+    mempool.queryHashes(vtxid);
+
     if (fVerbose)
     {
-        LOCK(mempool.cs);
-        UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
+        // Entries are looked up a batch at a time, so that the mempool is not
+        // locked while the writer waits for a slow client. Transactions that
+        // leave the mempool in the meantime are left out.
+        writer.BeginObject();
+        for (size_t i = 0; i < vtxid.size(); )
         {
-            const uint256& hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
-            o.push_back(Pair(hash.ToString(), info));
+            UniValue o(UniValue::VOBJ);
+            {
+                LOCK(mempool.cs);
+                for (size_t nEnd = std::min(vtxid.size(), i + MEMPOOL_JSON_BATCH_SIZE); i < nEnd; i++)
+                {
+                    CTxMemPool::txiter it = mempool.mapTx.find(vtxid[i]);
+                    if (it == mempool.mapTx.end())
+                        continue;
+                    UniValue info(UniValue::VOBJ);
+                    entryToJSON(info, *it);
+                    o.push_back(Pair(vtxid[i].ToString(), info));
+                }
+            }
+            writer.Members(o);
         }
-        return o;
+        writer.EndObject();
     }
     else
     {
-        vector<uint256> vtxid;
-        mempool.queryHashes(vtxid);
-
-        UniValue a(UniValue::VARR);
+        writer.BeginArray();
         BOOST_FOREACH(const uint256& hash, vtxid)
-            a.push_back(hash.ToString());
-
-        return a;
+            writer.Value(hash.ToString());
+        writer.EndArray();
     }
 }
 
-UniValue getrawmempool(const UniValue& params, bool fHelp)
+void streamgetrawmempool(const UniValue& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() > 1)
         throw runtime_error(
@@ -279,7 +314,15 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     if (params.size() > 0)
         fVerbose = params[0].get_bool();
 
-    return mempoolToJSON(fVerbose);
+    mempoolToJSON(writer, fVerbose);
+}
+
+UniValue getrawmempool(const UniValue& params, bool fHelp)
+{
+    UniValue result;
+    CJSONTreeWriter writer(result);
+    streamgetrawmempool(params, fHelp, writer);
+    return result;
 }
 
 UniValue getmempoolancestors(const UniValue& params, bool fHelp)
@@ -458,13 +501,13 @@ UniValue getblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
-    LOCK(cs_main);
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
 
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > chainActive.Height())
+    if (nHeight < 0 || nHeight > chain->Height())
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
 
-    CBlockIndex* pblockindex = chainActive[nHeight];
+    CBlockIndex* pblockindex = (*chain)[nHeight];
     return pblockindex->GetBlockHash().GetHex();
 }
 
@@ -502,8 +545,6 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockheader", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -511,15 +552,19 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
     if (!fVerbose)
     {
+        // The solution may have to be read back from the block tree database.
+        LOCK(cs_main);
+        CBlockHeader header;
+        if (!GetBlockIndexHeader(pblockindex, header))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block header from disk");
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << pblockindex->GetBlockHeader();
+        ssBlock << header;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
         return strHex;
     }
@@ -527,7 +572,7 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     return blockheaderToJSON(pblockindex);
 }
 
-UniValue getblock(const UniValue& params, bool fHelp)
+void streamgetblock(const UniValue& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
@@ -568,8 +613,6 @@ UniValue getblock(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -577,27 +620,41 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+
+        if (mapBlockIndex.count(hash) == 0)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+        pblockindex = mapBlockIndex[hash];
 
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    }
 
     if (!fVerbose)
     {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
         ssBlock << block;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        writer.Value(strHex);
+        return;
     }
 
-    return blockToJSON(block, pblockindex);
+    blockToJSON(writer, block, pblockindex);
+}
+
+UniValue getblock(const UniValue& params, bool fHelp)
+{
+    UniValue result;
+    CJSONTreeWriter writer(result);
+    streamgetblock(params, fHelp, writer);
+    return result;
 }
 
 struct CCoinsStats
@@ -609,6 +666,7 @@ struct CCoinsStats
     uint64_t nSerializedSize;
     uint256 hashSerialized;
     CAmount nTotalAmount;
+    CUTXOStats utxo;
 
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
 };
@@ -641,6 +699,7 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
                     ss << out;
                     if (out.nValue.IsAmount())
                         nTotalAmount += out.nValue.GetAmount();
+                    stats.utxo.Add(COutPoint(key, i), out);
                 }
             }
             stats.nSerializedSize += 32 + pcursor->GetValueSize();
@@ -657,38 +716,322 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( full )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "The statistics are kept up to date as blocks are connected, so this is\n"
+            "fast unless full is set, or they are not known yet (as after an upgrade).\n"
+            "\nArguments:\n"
+            "1. full      (boolean, optional, default=false) Also scan the UTXO set for the\n"
+            "             transaction count, serialized size and serialized hash; this may take some time\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
-            "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"blinded_txouts\": n,    (numeric) The number of outputs with a blinded amount\n"
+            "  \"total_amount\": x.xxx,  (numeric) The total of the explicit amounts\n"
+            "  \"locked_amount\": x.xxx, (numeric) The part of total_amount in withdraw locks\n"
+            "  \"hash_set\": \"hash\",    (string) Hash of the set of outputs, independent of their order\n"
+            "  \"transactions\": n,      (numeric) The number of transactions, if full\n"
+            "  \"bytes_serialized\": n,  (numeric) The serialized size, if full\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash, if full\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "true")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
-    UniValue ret(UniValue::VOBJ);
+    const bool fFull = params.size() > 0 && params[0].get_bool();
+
+    CUTXOStats utxo;
+    uint256 hashBlock;
+    bool fKnown;
+    {
+        LOCK(cs_main);
+        fKnown = GetUTXOSetStats(utxo, hashBlock);
+    }
 
     CCoinsStats stats;
-    FlushStateToDisk();
-    if (GetUTXOStats(pcoinsTip, stats)) {
-        ret.push_back(Pair("height", (int64_t)stats.nHeight));
-        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    if (fFull || !fKnown) {
+        FlushStateToDisk();
+        if (!GetUTXOStats(pcoinsTip, stats))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        utxo = stats.utxo;
+        hashBlock = stats.hashBlock;
+        LOCK(cs_main);
+        SetUTXOSetStats(utxo, hashBlock);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
+        ret.push_back(Pair("height", (int64_t)mapBlockIndex.find(hashBlock)->second->nHeight));
+    }
+    ret.push_back(Pair("bestblock", hashBlock.GetHex()));
+    ret.push_back(Pair("txouts", (int64_t)utxo.nTransactionOutputs));
+    ret.push_back(Pair("blinded_txouts", (int64_t)utxo.nBlindedOutputs));
+    ret.push_back(Pair("total_amount", ValueFromAmount(utxo.nTotalAmount)));
+    ret.push_back(Pair("locked_amount", ValueFromAmount(utxo.nLockedAmount)));
+    ret.push_back(Pair("hash_set", utxo.GetSetHash().GetHex()));
+    if (fFull) {
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
-        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
         ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+    }
+    return ret;
+}
+
+/** The outputs to a script in the active chain, oldest first, with the inputs that spent them. Requires cs_main. */
+UniValue scriptHistoryToJSON(const uint256& scriptHash, bool fUnspentOnly)
+{
+    AssertLockHeld(cs_main);
+    std::vector<std::pair<COutPoint, CScriptIndexOutput> > vOutputs;
+    std::map<COutPoint, CScriptIndexSpend> mapSpends;
+    if (!pscriptindexdb->ReadOutputs(scriptHash, vOutputs) || !pscriptindexdb->ReadSpends(scriptHash, mapSpends))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the script index");
+
+    std::vector<std::pair<int, size_t> > vOrder;
+    for (size_t i = 0; i < vOutputs.size(); i++)
+        vOrder.push_back(std::make_pair(vOutputs[i].second.nHeight, i));
+    std::sort(vOrder.begin(), vOrder.end());
+
+    UniValue ret(UniValue::VARR);
+    for (size_t i = 0; i < vOrder.size(); i++) {
+        const COutPoint& outpoint = vOutputs[vOrder[i].second].first;
+        const CScriptIndexOutput& output = vOutputs[vOrder[i].second].second;
+        std::map<COutPoint, CScriptIndexSpend>::const_iterator itSpend = mapSpends.find(outpoint);
+        if (fUnspentOnly && itSpend != mapSpends.end())
+            continue;
+
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("txid", outpoint.hash.GetHex()));
+        entry.push_back(Pair("vout", (int64_t)outpoint.n));
+        entry.push_back(Pair("height", output.nHeight));
+        if (output.nValue.IsAmount())
+            entry.push_back(Pair("value", ValueFromAmount(output.nValue.GetAmount())));
+        CDataStream ssValue(SER_NETWORK, PROTOCOL_VERSION);
+        ssValue << output.nValue;
+        entry.push_back(Pair("serValue", HexStr(ssValue.begin(), ssValue.end())));
+        if (itSpend != mapSpends.end()) {
+            UniValue spent(UniValue::VOBJ);
+            spent.push_back(Pair("txid", itSpend->second.txid.GetHex()));
+            spent.push_back(Pair("vin", (int64_t)itSpend->second.nInput));
+            spent.push_back(Pair("height", itSpend->second.nHeight));
+            entry.push_back(Pair("spent", spent));
+        }
+        ret.push_back(entry);
+    }
+    return ret;
+}
+
+UniValue getscripthistory(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getscripthistory \"script\" ( unspentonly )\n"
+            "\nReturns the outputs to a script in the active chain, and the inputs that spent them.\n"
+            "Requires -scriptindex. Blinded values are returned as their commitments only.\n"
+            "\nArguments:\n"
+            "1. \"script\"      (string, required) an address, or a scriptPubKey in hex\n"
+            "2. unspentonly     (boolean, optional, default=false) only return the outputs that are unspent\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"scripthash\": \"hash\",  (string) the SHA256 of the scriptPubKey, as used by /rest/scripthistory/\n"
+            "  \"outputs\": [          (array) the outputs, oldest first\n"
+            "    {\n"
+            "      \"txid\": \"hash\",     (string) the transaction id\n"
+            "      \"vout\": n,          (numeric) the output index\n"
+            "      \"height\": n,        (numeric) the height of the block that has the output\n"
+            "      \"value\": x.xxx,     (numeric) the value, if not blinded\n"
+            "      \"serValue\": \"hex\",  (string) the serialized value or value commitment\n"
+            "      \"spent\": {          (object) the spending input, if spent\n"
+            "        \"txid\": \"hash\",   (string) the spending transaction id\n"
+            "        \"vin\": n,         (numeric) the input index\n"
+            "        \"height\": n       (numeric) the height of the block that has the input\n"
+            "      }\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getscripthistory", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+            + HelpExampleCli("getscripthistory", "\"76a914f54a5851e9372b87810a8e60cdd2e7cfd80b6e3188ac\" true")
+            + HelpExampleRpc("getscripthistory", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+        );
+
+    if (!pscriptindexdb)
+        throw JSONRPCError(RPC_MISC_ERROR, "The script index is disabled, use -scriptindex");
+
+    CScript scriptPubKey;
+    CBitcoinAddress address(params[0].get_str());
+    if (address.IsValid()) {
+        scriptPubKey = GetScriptForDestination(address.Get());
+    } else if (IsHex(params[0].get_str())) {
+        std::vector<unsigned char> vchScript(ParseHex(params[0].get_str()));
+        scriptPubKey = CScript(vchScript.begin(), vchScript.end());
+    } else {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address or script");
+    }
+    const bool fUnspentOnly = params.size() > 1 && params[1].get_bool();
+
+    const uint256 scriptHash = CScriptIndexDB::GetScriptHash(scriptPubKey);
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("scripthash", scriptHash.GetHex()));
+    LOCK(cs_main);
+    ret.push_back(Pair("outputs", scriptHistoryToJSON(scriptHash, fUnspentOnly)));
+    return ret;
+}
+
+/** Most blocks getblockstatsrange returns at once */
+static const int MAX_BLOCKSTATS_RANGE = 10000;
+
+static UniValue scriptTypesToJSON(const std::map<std::string, uint32_t>& mapTypes)
+{
+    UniValue ret(UniValue::VOBJ);
+    for (std::map<std::string, uint32_t>::const_iterator it = mapTypes.begin(); it != mapTypes.end(); ++it)
+        ret.push_back(Pair(it->first, (int64_t)it->second));
+    return ret;
+}
+
+static UniValue blockStatsToJSON(const CBlockStats& stats)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("blockhash", stats.blockHash.GetHex()));
+    ret.push_back(Pair("height", stats.nHeight));
+    ret.push_back(Pair("time", stats.nTime));
+    ret.push_back(Pair("size", stats.nSize));
+    ret.push_back(Pair("weight", stats.nWeight));
+    ret.push_back(Pair("txs", (int64_t)stats.nTx));
+    ret.push_back(Pair("ins", (int64_t)stats.nInputs));
+    ret.push_back(Pair("outs", (int64_t)stats.nOutputs));
+    ret.push_back(Pair("blinded_outs", (int64_t)stats.nBlindedOutputs));
+    ret.push_back(Pair("explicit_outs", (int64_t)stats.nExplicitOutputs));
+    ret.push_back(Pair("explicit_out_value", ValueFromAmount(stats.nExplicitOutputValue)));
+    ret.push_back(Pair("rangeproof_bytes", stats.nRangeProofBytes));
+    ret.push_back(Pair("totalfee", ValueFromAmount(stats.nTotalFee)));
+    ret.push_back(Pair("minfeerate", ValueFromAmount(stats.nMinFeeRate)));
+    ret.push_back(Pair("medianfeerate", ValueFromAmount(stats.nMedianFeeRate)));
+    ret.push_back(Pair("maxfeerate", ValueFromAmount(stats.nMaxFeeRate)));
+    ret.push_back(Pair("pegins", (int64_t)stats.nPegIns));
+    ret.push_back(Pair("pegin_value", ValueFromAmount(stats.nPegInValue)));
+    ret.push_back(Pair("pegouts", (int64_t)stats.nPegOuts));
+    ret.push_back(Pair("pegout_value", ValueFromAmount(stats.nPegOutValue)));
+    ret.push_back(Pair("out_script_types", scriptTypesToJSON(stats.mapOutputScriptTypes)));
+    ret.push_back(Pair("spent_script_types", scriptTypesToJSON(stats.mapSpentScriptTypes)));
+    return ret;
+}
+
+UniValue getblockstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getblockstats \"hash_or_height\"\n"
+            "\nReturns statistics of a block, as recorded when it was connected (needs -blockstatsindex).\n"
+            "\nArguments:\n"
+            "1. \"hash_or_height\" (string or numeric, required) The block hash, or the height of a block in the active chain\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blockhash\": \"hash\",        (string) the block hash\n"
+            "  \"height\": n,                (numeric) the block height\n"
+            "  \"time\": n,                  (numeric) the block time\n"
+            "  \"size\": n,                  (numeric) the block size\n"
+            "  \"weight\": n,                (numeric) the block weight\n"
+            "  \"txs\": n,                   (numeric) the number of transactions\n"
+            "  \"ins\": n,                   (numeric) the number of inputs, coinbase excluded\n"
+            "  \"outs\": n,                  (numeric) the number of outputs\n"
+            "  \"blinded_outs\": n,          (numeric) the number of outputs with a blinded value\n"
+            "  \"explicit_outs\": n,         (numeric) the number of outputs with an explicit value\n"
+            "  \"explicit_out_value\": x.xxx, (numeric) the total of the explicit output values\n"
+            "  \"rangeproof_bytes\": n,      (numeric) the total size of the range proofs\n"
+            "  \"totalfee\": x.xxx,          (numeric) the total of the transaction fees\n"
+            "  \"minfeerate\": x.xxx,        (numeric) the lowest fee rate of a transaction, per kB of virtual size\n"
+            "  \"medianfeerate\": x.xxx,     (numeric) the median fee rate, per kB of virtual size\n"
+            "  \"maxfeerate\": x.xxx,        (numeric) the highest fee rate, per kB of virtual size\n"
+            "  \"pegins\": n,                (numeric) the number of transactions that release withdraw locked value\n"
+            "  \"pegin_value\": x.xxx,       (numeric) the value they release\n"
+            "  \"pegouts\": n,               (numeric) the number of transactions that lock value for withdrawal\n"
+            "  \"pegout_value\": x.xxx,      (numeric) the value they lock\n"
+            "  \"out_script_types\": {       (object) the number of outputs of each script type\n"
+            "    \"type\": n, ...\n"
+            "  },\n"
+            "  \"spent_script_types\": {     (object) the number of spent outputs of each script type\n"
+            "    \"type\": n, ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockstats", "1000")
+            + HelpExampleCli("getblockstats", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
+            + HelpExampleRpc("getblockstats", "1000")
+        );
+
+    if (!pblockstatsdb)
+        throw JSONRPCError(RPC_MISC_ERROR, "The block statistics index is disabled, use -blockstatsindex");
+
+    LOCK(cs_main);
+
+    CBlockIndex* pblockindex = NULL;
+    int32_t nHeight;
+    if (params[0].isNum() || ParseInt32(params[0].get_str(), &nHeight)) {
+        if (params[0].isNum())
+            nHeight = params[0].get_int();
+        if (nHeight < 0 || nHeight > chainActive.Height())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+        pblockindex = chainActive[nHeight];
     } else {
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        uint256 hash = ParseHashV(params[0], "parameter 1");
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = it->second;
+    }
+
+    CBlockStats stats;
+    if (!pblockstatsdb->ReadStats(pblockindex->GetBlockHash(), stats))
+        throw JSONRPCError(RPC_MISC_ERROR, "No statistics for this block, it was not connected with -blockstatsindex");
+    return blockStatsToJSON(stats);
+}
+
+UniValue getblockstatsrange(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getblockstatsrange startheight ( endheight )\n"
+            "\nReturns the statistics of a range of blocks of the active chain, as getblockstats does (needs -blockstatsindex).\n"
+            "\nArguments:\n"
+            "1. startheight    (numeric, required) The height of the first block\n"
+            "2. endheight      (numeric, optional) The height of the last block (default: the tip)\n"
+            "\nResult:\n"
+            "[                 (array) the statistics of each block, in height order, or null for a block that has none\n"
+            "  {...}, ...\n"
+            "]\n"
+            "\nAt most " + strprintf("%d", MAX_BLOCKSTATS_RANGE) + " blocks are returned at once.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockstatsrange", "1000 1100")
+            + HelpExampleRpc("getblockstatsrange", "1000, 1100")
+        );
+
+    if (!pblockstatsdb)
+        throw JSONRPCError(RPC_MISC_ERROR, "The block statistics index is disabled, use -blockstatsindex");
+
+    LOCK(cs_main);
+
+    const int nStart = params[0].get_int();
+    const int nEnd = params.size() > 1 ? params[1].get_int() : chainActive.Height();
+    if (nStart < 0 || nEnd > chainActive.Height() || nStart > nEnd)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+    if (nEnd - nStart >= MAX_BLOCKSTATS_RANGE)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("At most %d blocks can be requested at once", MAX_BLOCKSTATS_RANGE));
+
+    UniValue ret(UniValue::VARR);
+    for (int nHeight = nStart; nHeight <= nEnd; nHeight++) {
+        CBlockStats stats;
+        if (pblockstatsdb->ReadStats(chainActive[nHeight]->GetBlockHash(), stats))
+            ret.push_back(blockStatsToJSON(stats));
+        else
+            ret.push_back(NullUniValue);
     }
     return ret;
 }
@@ -803,6 +1146,105 @@ UniValue verifychain(const UniValue& params, bool fHelp)
     return CVerifyDB().VerifyDB(Params(), pcoinsTip, nCheckLevel, nCheckDepth);
 }
 
+static boost::filesystem::path GetSnapshotPath(const std::string& strPath)
+{
+    return boost::filesystem::absolute(strPath, GetDataDir());
+}
+
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the UTXO set at the tip, with the spent withdraws, to a snapshot file\n"
+            "that a new node can start from with loadtxoutset. This may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"   (string, required) the file to write, relative to the data directory\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",            (string) the file written\n"
+            "  \"base_hash\": \"hash\",       (string) the block the snapshot is at\n"
+            "  \"base_height\": n,          (numeric) the height of that block\n"
+            "  \"coins_written\": n,        (numeric) the number of transactions with unspent outputs\n"
+            "  \"withdraws_spent\": n,      (numeric) the number of spent withdraws\n"
+            "  \"txoutset_hash\": \"hash\",   (string) the hash of the snapshot\n"
+            "  \"assumeutxo\": \"value\"      (string) the -assumeutxo value that makes nodes trust the snapshot\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    const boost::filesystem::path path = GetSnapshotPath(params[0].get_str());
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CUTXOSnapshotInfo info;
+    std::string strError;
+    if (!DumpUTXOSnapshot(path, info, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    unsigned int nChainTx;
+    {
+        LOCK(cs_main);
+        nChainTx = mapBlockIndex[info.hashBlock]->nChainTx;
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("base_hash", info.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", info.nHeight));
+    ret.push_back(Pair("coins_written", (int64_t)info.nCoins));
+    ret.push_back(Pair("withdraws_spent", (int64_t)info.nWithdrawsSpent));
+    ret.push_back(Pair("txoutset_hash", info.hashSnapshot.GetHex()));
+    ret.push_back(Pair("assumeutxo", strprintf("%d:%s:%s:%u", info.nHeight, info.hashBlock.GetHex(), info.hashSnapshot.GetHex(), nChainTx)));
+    return ret;
+}
+
+UniValue loadtxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "loadtxoutset \"path\"\n"
+            "\nStarts the chainstate from a snapshot written by dumptxoutset, instead of\n"
+            "validating the chain from the genesis block. The node must not have connected\n"
+            "any block yet, the header of the snapshot's block must be known, and -assumeutxo\n"
+            "must commit to the snapshot. The blocks before it are neither downloaded nor validated.\n"
+            "\nArguments:\n"
+            "1. \"path\"   (string, required) the snapshot file, relative to the data directory\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"base_hash\": \"hash\",       (string) the block the chainstate is now at\n"
+            "  \"base_height\": n,          (numeric) the height of that block\n"
+            "  \"coins_loaded\": n,         (numeric) the number of transactions with unspent outputs\n"
+            "  \"withdraws_spent\": n,      (numeric) the number of spent withdraws\n"
+            "  \"txoutset_hash\": \"hash\"    (string) the hash of the snapshot\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\"")
+        );
+
+    CUTXOSnapshotInfo info;
+    std::string strError;
+    if (!LoadUTXOSnapshot(Params(), GetSnapshotPath(params[0].get_str()), info, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    // Connect the blocks after the snapshot we may already have.
+    CValidationState state;
+    ActivateBestChain(state, Params());
+    if (!state.IsValid())
+        throw JSONRPCError(RPC_DATABASE_ERROR, state.GetRejectReason());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("base_hash", info.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", info.nHeight));
+    ret.push_back(Pair("coins_loaded", (int64_t)info.nCoins));
+    ret.push_back(Pair("withdraws_spent", (int64_t)info.nWithdrawsSpent));
+    ret.push_back(Pair("txoutset_hash", info.hashSnapshot.GetHex()));
+    return ret;
+}
+
 static UniValue BIP9SoftForkDesc(const Consensus::Params& consensusParams, Consensus::DeploymentPos id)
 {
     UniValue rv(UniValue::VOBJ);
@@ -1034,6 +1476,15 @@ UniValue mempoolInfoToJSON()
     size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
     ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
+    uint64_t nRangeProofCacheHits, nRangeProofCacheMisses;
+    GetRangeProofCacheStats(nRangeProofCacheHits, nRangeProofCacheMisses);
+    ret.push_back(Pair("rangeproofcachehits", nRangeProofCacheHits));
+    ret.push_back(Pair("rangeproofcachemisses", nRangeProofCacheMisses));
+    size_t nOrphans, nOrphanUsage, nOrphanOutpoints;
+    GetOrphanStats(nOrphans, nOrphanUsage, nOrphanOutpoints);
+    ret.push_back(Pair("orphans", (int64_t) nOrphans));
+    ret.push_back(Pair("orphanusage", (int64_t) nOrphanUsage));
+    ret.push_back(Pair("orphanmissingoutpoints", (int64_t) nOrphanOutpoints));
 
     return ret;
 }
@@ -1050,7 +1501,12 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "  \"bytes\": xxxxx,              (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx,              (numeric) Total memory usage for the mempool\n"
             "  \"maxmempool\": xxxxx,         (numeric) Maximum memory usage for the mempool\n"
-            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee for tx to be accepted\n"
+            "  \"mempoolminfee\": xxxxx,      (numeric) Minimum fee for tx to be accepted\n"
+            "  \"rangeproofcachehits\": xxxxx,   (numeric) Range proof checks answered from the range proof cache\n"
+            "  \"rangeproofcachemisses\": xxxxx, (numeric) Range proof checks that had to verify the proof\n"
+            "  \"orphans\": xxxxx,            (numeric) Transactions kept while their inputs are missing\n"
+            "  \"orphanusage\": xxxxx,        (numeric) Memory usage of the orphan transactions\n"
+            "  \"orphanmissingoutpoints\": xxxxx (numeric) Distinct outpoints the orphan transactions are waiting for\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -1060,6 +1516,202 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue getmempooldeltas(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getmempooldeltas sequence ( timeout )\n"
+            "\nReturns the transactions added to and removed from the memory pool since sequence,\n"
+            "so that a copy of it can be kept up to date without fetching all of it again.\n"
+            "Start with sequence 0, which returns the whole memory pool, then pass the sequence of each\n"
+            "result to the next call.\n"
+            "If the changes since sequence are no longer kept, the result lists the whole memory pool\n"
+            "instead and the copy has to be replaced with it. Sequences count from node startup.\n"
+            "\nArguments:\n"
+            "1. sequence           (numeric, required) The sequence of the last change seen\n"
+            "2. timeout            (numeric, optional, default=0) Seconds to wait for a change if there is none yet\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"sequence\": n,           (numeric) The sequence of the last change to the memory pool\n"
+            "  \"full\": true|false,      (boolean) Whether \"changes\" is the whole memory pool rather than the changes since sequence\n"
+            "  \"changes\": [             (array of json objects) The changes, oldest first\n"
+            "    {\n"
+            "      \"sequence\": n,       (numeric) The sequence of the change\n"
+            "      \"txid\": \"hash\",     (string) The transaction id\n"
+            "      \"added\": true|false, (boolean) Whether the transaction was added, or else removed\n"
+            "      \"fee\": n,            (numeric) Transaction fee in " + CURRENCY_UNIT + "\n"
+            "      \"size\": n            (numeric) Virtual transaction size\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempooldeltas", "0")
+            + HelpExampleCli("getmempooldeltas", "1234 30")
+            + HelpExampleRpc("getmempooldeltas", "1234, 30")
+        );
+
+    const int64_t nSequence = params[0].get_int64();
+    if (nSequence < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative sequence");
+    int64_t nTimeout = 0;
+    if (params.size() > 1)
+        nTimeout = params[1].get_int64();
+
+    // Wait in slices of a second at most, to notice a shutdown
+    const boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(std::max(nTimeout, (int64_t)0));
+    while (IsRPCRunning()) {
+        const boost::system_time now = boost::get_system_time();
+        if (now >= deadline || mempool.WaitForDeltas(nSequence, std::min(deadline, now + boost::posix_time::seconds(1))))
+            break;
+    }
+    if (!IsRPCRunning())
+        throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
+
+    std::vector<CMempoolDelta> vDeltas;
+    uint64_t nSequenceNow;
+    const bool fFull = !mempool.GetDeltas(nSequence, vDeltas, nSequenceNow);
+
+    UniValue changes(UniValue::VARR);
+    BOOST_FOREACH(const CMempoolDelta& delta, vDeltas) {
+        UniValue change(UniValue::VOBJ);
+        change.push_back(Pair("sequence", delta.nSequence));
+        change.push_back(Pair("txid", delta.txid.GetHex()));
+        change.push_back(Pair("added", delta.fAdded));
+        change.push_back(Pair("fee", ValueFromAmount(delta.nFee)));
+        change.push_back(Pair("size", (int64_t)delta.nSize));
+        changes.push_back(change);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("sequence", nSequenceNow));
+    ret.push_back(Pair("full", fFull));
+    ret.push_back(Pair("changes", changes));
+    return ret;
+}
+
+/** Upper bound, in microseconds, of the bucket that holds the given fraction of the durations. */
+static uint64_t ValidationPercentile(const CValidationStageStats& stats, double dFraction)
+{
+    uint64_t nTarget = (uint64_t)(dFraction * stats.nCount + 0.5), nCumulative = 0;
+    for (int i = 0; i < VALIDATION_HISTOGRAM_BUCKETS; i++) {
+        nCumulative += stats.vBuckets[i];
+        if (nCumulative >= nTarget && nCumulative > 0)
+            return (uint64_t)1 << i;
+    }
+    return 0;
+}
+
+UniValue getvalidationstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getvalidationstats\n"
+            "\nReturns latency histograms of the stages of block and transaction validation since startup.\n"
+            "Durations are bucketed by powers of two microseconds, so percentiles are upper bounds.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"stage\": {                (object) One of connect_block, utxo_fetch, script_check, rangeproof_check,\n"
+            "                                 tally_check, withdraw_rpc, index_write or flush\n"
+            "    \"count\": n,             (numeric) Number of durations recorded\n"
+            "    \"total_us\": n,          (numeric) Sum of the durations in microseconds\n"
+            "    \"p50_us\": n,            (numeric) Median, in microseconds\n"
+            "    \"p99_us\": n,            (numeric) 99th percentile, in microseconds\n"
+            "    \"histogram\": [          (array) Non-empty buckets\n"
+            "      [ n, n ],               (array) Durations below the first number of microseconds, and how many\n"
+            "      ...\n"
+            "    ]\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getvalidationstats", "")
+            + HelpExampleRpc("getvalidationstats", "")
+        );
+
+    UniValue ret(UniValue::VOBJ);
+    for (int s = 0; s < VALIDATION_STAGE_COUNT; s++) {
+        const ValidationStage stage = (ValidationStage)s;
+        const CValidationStageStats stats = GetValidationStageStats(stage);
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("count", stats.nCount));
+        obj.push_back(Pair("total_us", stats.nTotalMicros));
+        obj.push_back(Pair("p50_us", ValidationPercentile(stats, 0.5)));
+        obj.push_back(Pair("p99_us", ValidationPercentile(stats, 0.99)));
+        UniValue histogram(UniValue::VARR);
+        for (int i = 0; i < VALIDATION_HISTOGRAM_BUCKETS; i++) {
+            if (stats.vBuckets[i] == 0)
+                continue;
+            UniValue bucket(UniValue::VARR);
+            bucket.push_back((uint64_t)1 << i);
+            bucket.push_back(stats.vBuckets[i]);
+            histogram.push_back(bucket);
+        }
+        obj.push_back(Pair("histogram", histogram));
+        ret.push_back(Pair(GetValidationStageName(stage), obj));
+    }
+    return ret;
+}
+
+static UniValue DBStatsToJSON(const CDBReadStats& readStats, const CDBWriteStats& writeStats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("reads", readStats.nReads));
+    obj.push_back(Pair("reads_not_found", readStats.nReadsNotFound));
+    obj.push_back(Pair("seeks", readStats.nSeeks));
+    obj.push_back(Pair("writes", writeStats.nWrites));
+    obj.push_back(Pair("write_us", writeStats.nWriteMicros));
+    obj.push_back(Pair("slowdowns", writeStats.nSlowdowns));
+    obj.push_back(Pair("stall_us", writeStats.nStallMicros));
+    obj.push_back(Pair("compactions", writeStats.nCompactions));
+    obj.push_back(Pair("compaction_us", writeStats.nCompactionMicros));
+    obj.push_back(Pair("compaction_bytes_read", writeStats.nCompactionBytesRead));
+    obj.push_back(Pair("compaction_bytes_written", writeStats.nCompactionBytesWritten));
+    obj.push_back(Pair("throttle_us", writeStats.nThrottleMicros));
+    obj.push_back(Pair("level0_files", writeStats.nLevel0Files));
+    return obj;
+}
+
+UniValue getdbinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbinfo\n"
+            "\nReturns counters of the LevelDB databases since startup, to tell whether writes are held back by compactions.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"database\": {           (object) chainstate, blockindex, and txindex if enabled\n"
+            "    \"reads\": n,                     (numeric) Point reads\n"
+            "    \"reads_not_found\": n,           (numeric) Point reads that found nothing\n"
+            "    \"seeks\": n,                     (numeric) Iterator seeks\n"
+            "    \"writes\": n,                    (numeric) Batches written\n"
+            "    \"write_us\": n,                  (numeric) Time spent writing them, in microseconds\n"
+            "    \"slowdowns\": n,                 (numeric) Writes delayed by 1ms because level 0 had many files\n"
+            "    \"stall_us\": n,                  (numeric) Time writes waited for compactions to make room, in microseconds\n"
+            "    \"compactions\": n,               (numeric) Background compactions, write buffer flushes included\n"
+            "    \"compaction_us\": n,             (numeric) Time spent in them, in microseconds\n"
+            "    \"compaction_bytes_read\": n,     (numeric) Bytes they read\n"
+            "    \"compaction_bytes_written\": n,  (numeric) Bytes they wrote\n"
+            "    \"throttle_us\": n,               (numeric) Time they were held back by -dbcompactionrate, in microseconds\n"
+            "    \"level0_files\": n               (numeric) Files at level 0 now\n"
+            "  },\n"
+            "  ...\n"
+            "  \"bulk_load\": true|false  (boolean) Whether the chainstate compactions are tuned for initial block download\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbinfo", "")
+            + HelpExampleRpc("getdbinfo", "")
+        );
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("chainstate", DBStatsToJSON(pcoinsdbview->GetReadStats(), pcoinsdbview->GetWriteStats())));
+    ret.push_back(Pair("blockindex", DBStatsToJSON(pblocktree->GetReadStats(), pblocktree->GetWriteStats())));
+    if (ptxindexdb)
+        ret.push_back(Pair("txindex", DBStatsToJSON(ptxindexdb->GetReadStats(), ptxindexdb->GetWriteStats())));
+    ret.push_back(Pair("bulk_load", pcoinsdbview->IsBulkLoad()));
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -1144,24 +1796,41 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblock",               &getblock,               true  },
     { "blockchain",         "getblockhash",           &getblockhash,           true  },
     { "blockchain",         "getblockheader",         &getblockheader,         true  },
+    { "blockchain",         "getblockstats",          &getblockstats,          true  },
+    { "blockchain",         "getblockstatsrange",     &getblockstatsrange,     true  },
     { "blockchain",         "getchaintips",           &getchaintips,           true  },
+    { "blockchain",         "getdbinfo",              &getdbinfo,              true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    true  },
+    { "blockchain",         "getmempooldeltas",       &getmempooldeltas,       true  },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true  },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true  },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
+    { "blockchain",         "getscripthistory",       &getscripthistory,       true  },
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "getvalidationstats",     &getvalidationstats,     true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true  },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           false },
 
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        true  },
     { "hidden",             "reconsiderblock",        &reconsiderblock,        true  },
 };
 
+static const CRPCStreamCommand streamCommands[] =
+{ //  name                      stream actor (function)
+  //  ------------------------  -----------------------
+    { "getblock",               &streamgetblock          },
+    { "getrawmempool",          &streamgetrawmempool     },
+};
+
 void RegisterBlockchainRPCCommands(CRPCTable &tableRPC)
 {
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+    for (unsigned int vcidx = 0; vcidx < ARRAYLEN(streamCommands); vcidx++)
+        tableRPC.appendStreamCommand(streamCommands[vcidx].name, &streamCommands[vcidx]);
 }
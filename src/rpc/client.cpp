@@ -25,12 +25,21 @@ public:
 static const CRPCConvertParam vRPCConvertParams[] =
 {
     { "stop", 0 },
+    { "submitjob", 1 },
+    { "getjobresult", 0 },
+    { "getjobresult", 1 },
+    { "canceljob", 0 },
     { "setmocktime", 0 },
+    { "setlockprofiling", 0 },
+    { "getlockprofile", 0 },
     { "getaddednodeinfo", 0 },
     { "generate", 0 },
+    { "generate", 1 },
     { "combineblocksigs", 1 },
     { "getnetworkhashps", 0 },
     { "getnetworkhashps", 1 },
+    { "claimpegins", 0 },
+    { "sendtomainchain", 2 },
     { "sendtoaddress", 1 },
     { "sendtoaddress", 4 },
     { "settxfee", 0 },
@@ -45,6 +54,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getbalance", 1 },
     { "getbalance", 2 },
     { "getblockhash", 0 },
+    { "getblockstatsrange", 0 },
+    { "getblockstatsrange", 1 },
     { "move", 2 },
     { "move", 3 },
     { "sendfrom", 2 },
@@ -52,6 +63,9 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "listtransactions", 1 },
     { "listtransactions", 2 },
     { "listtransactions", 3 },
+    { "listtransactionpage", 0 },
+    { "listtransactionpage", 1 },
+    { "listtransactionpage", 2 },
     { "listaccounts", 0 },
     { "listaccounts", 1 },
     { "walletpassphrase", 1 },
@@ -72,21 +86,30 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblockheader", 1 },
     { "gettransaction", 1 },
     { "getrawtransaction", 1 },
+    { "getrawtransaction", 2 },
     { "createrawtransaction", 0 },
     { "createrawtransaction", 1 },
     { "createrawtransaction", 2 },
     { "rawblindrawtransaction", 1 },
+    { "rawblindrawtransaction", 3 },
+    { "blindrawtransaction", 2 },
     { "signrawtransaction", 1 },
     { "signrawtransaction", 2 },
+    { "decoderawtransaction", 1 },
     { "sendrawtransaction", 1 },
     { "sendrawtransaction", 2 },
     { "fundrawtransaction", 1 },
+    { "getscripthistory", 1 },
+    { "gettxoutsetinfo", 0 },
     { "gettxout", 1 },
     { "gettxout", 2 },
     { "gettxoutproof", 0 },
+    { "gettxoutproofs", 0 },
     { "lockunspent", 0 },
     { "lockunspent", 1 },
     { "importprivkey", 2 },
+    { "importmulti", 0 },
+    { "importmulti", 1 },
     { "importaddress", 2 },
     { "importaddress", 3 },
     { "importpubkey", 2 },
@@ -94,6 +117,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "verifychain", 1 },
     { "keypoolrefill", 0 },
     { "getrawmempool", 0 },
+    { "getmempooldeltas", 0 },
+    { "getmempooldeltas", 1 },
     { "estimatefee", 0 },
     { "estimatepriority", 0 },
     { "estimatesmartfee", 0 },
@@ -0,0 +1,154 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/jsonwriter.h"
+
+#include <assert.h>
+
+void CJSONWriter::Members(const UniValue& obj)
+{
+    const std::vector<std::string> keys = obj.getKeys();
+    for (unsigned int i = 0; i < keys.size(); i++) {
+        Key(keys[i]);
+        Value(obj[i]);
+    }
+}
+
+CJSONStreamWriter::CJSONStreamWriter(const boost::function<void(const std::string&)>& sinkIn, size_t nFlushSizeIn) :
+    sink(sinkIn), nFlushSize(nFlushSizeIn), fAfterKey(false), fFlushed(false)
+{
+}
+
+void CJSONStreamWriter::Separate()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vEmpty.empty()) {
+        if (!vEmpty.back())
+            strBuffer += ',';
+        vEmpty.back() = false;
+    }
+}
+
+void CJSONStreamWriter::WriteValue(const UniValue& val)
+{
+    if (val.isArray()) {
+        strBuffer += '[';
+        for (unsigned int i = 0; i < val.size(); i++) {
+            if (i > 0)
+                strBuffer += ',';
+            WriteValue(val[i]);
+            MaybeFlush();
+        }
+        strBuffer += ']';
+    } else if (val.isObject()) {
+        const std::vector<std::string> keys = val.getKeys();
+        strBuffer += '{';
+        for (unsigned int i = 0; i < keys.size(); i++) {
+            if (i > 0)
+                strBuffer += ',';
+            strBuffer += UniValue(keys[i]).write();
+            strBuffer += ':';
+            WriteValue(val[i]);
+            MaybeFlush();
+        }
+        strBuffer += '}';
+    } else {
+        strBuffer += val.write();
+    }
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    Separate();
+    strBuffer += '{';
+    vEmpty.push_back(true);
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    strBuffer += '}';
+    vEmpty.pop_back();
+    MaybeFlush();
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    Separate();
+    strBuffer += '[';
+    vEmpty.push_back(true);
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    strBuffer += ']';
+    vEmpty.pop_back();
+    MaybeFlush();
+}
+
+void CJSONStreamWriter::Key(const std::string& key)
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    Separate();
+    strBuffer += UniValue(key).write();
+    strBuffer += ':';
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::Value(const UniValue& val)
+{
+    Separate();
+    WriteValue(val);
+    MaybeFlush();
+}
+
+void CJSONStreamWriter::Flush()
+{
+    if (strBuffer.empty())
+        return;
+    sink(strBuffer);
+    strBuffer.clear();
+    fFlushed = true;
+}
+
+void CJSONTreeWriter::Begin(UniValue::VType type)
+{
+    if (!fStarted) {
+        result = UniValue(type);
+        fStarted = true;
+    } else {
+        vOpen.push_back(std::make_pair(strKey, UniValue(type)));
+    }
+}
+
+void CJSONTreeWriter::Add(UniValue& parent, const std::string& key, const UniValue& val)
+{
+    if (parent.isObject())
+        parent.pushKV(key, val);
+    else
+        parent.push_back(val);
+}
+
+void CJSONTreeWriter::End()
+{
+    if (vOpen.empty())
+        return;
+    UniValue& parent = vOpen.size() > 1 ? vOpen[vOpen.size() - 2].second : result;
+    Add(parent, vOpen.back().first, vOpen.back().second);
+    vOpen.pop_back();
+}
+
+void CJSONTreeWriter::Value(const UniValue& val)
+{
+    if (!fStarted) {
+        result = val;
+        fStarted = true;
+    } else {
+        Add(Current(), strKey, val);
+    }
+}
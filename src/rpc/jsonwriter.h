@@ -0,0 +1,115 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPCJSONWRITER_H
+#define BITCOIN_RPCJSONWRITER_H
+
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <univalue.h>
+
+/**
+ * Receives a JSON document one piece at a time, so that large results can
+ * be produced without holding all of them in memory at once. Values are
+ * written as the next element of the innermost open array, as the value of
+ * the last key written in the innermost open object, or as the document.
+ */
+class CJSONWriter
+{
+public:
+    virtual ~CJSONWriter() {}
+
+    virtual void BeginObject() = 0;
+    virtual void EndObject() = 0;
+    virtual void BeginArray() = 0;
+    virtual void EndArray() = 0;
+    //! Write the key of the next member of the innermost open object
+    virtual void Key(const std::string& key) = 0;
+    //! Write a complete value
+    virtual void Value(const UniValue& val) = 0;
+
+    //! Write all members of obj as members of the innermost open object
+    void Members(const UniValue& obj);
+};
+
+/**
+ * Writes a JSON document as compact text, identical to what UniValue::write()
+ * makes of the same document, and hands it to sink in pieces of at least
+ * nFlushSize bytes. The text after the last of those stays buffered, for the
+ * caller to send after the document is complete.
+ */
+class CJSONStreamWriter : public CJSONWriter
+{
+private:
+    boost::function<void(const std::string&)> sink;
+    const size_t nFlushSize;
+    std::string strBuffer;
+    //! For every open object and array, whether it has no members yet
+    std::vector<bool> vEmpty;
+    bool fAfterKey;
+    bool fFlushed;
+
+    void Separate();
+    void WriteValue(const UniValue& val);
+    void MaybeFlush()
+    {
+        if (strBuffer.size() >= nFlushSize)
+            Flush();
+    }
+
+public:
+    static const size_t DEFAULT_FLUSH_SIZE = 64 * 1024;
+
+    explicit CJSONStreamWriter(const boost::function<void(const std::string&)>& sinkIn, size_t nFlushSizeIn = DEFAULT_FLUSH_SIZE);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    void Key(const std::string& key);
+    void Value(const UniValue& val);
+
+    //! Hand all buffered text to the sink
+    void Flush();
+    //! Whether any text has been handed to the sink
+    bool HasFlushed() const { return fFlushed; }
+    //! Text not handed to the sink yet
+    const std::string& GetBuffered() const { return strBuffer; }
+};
+
+/**
+ * Builds the document as a UniValue, for callers that want the result of a
+ * streamable RPC call in one piece.
+ */
+class CJSONTreeWriter : public CJSONWriter
+{
+private:
+    UniValue& result;
+    bool fStarted;
+    //! Open objects and arrays below the document, innermost last, with the keys they go under
+    std::vector<std::pair<std::string, UniValue> > vOpen;
+    std::string strKey;
+
+    UniValue& Current() { return vOpen.empty() ? result : vOpen.back().second; }
+    static void Add(UniValue& parent, const std::string& key, const UniValue& val);
+    void Begin(UniValue::VType type);
+    void End();
+
+public:
+    explicit CJSONTreeWriter(UniValue& resultIn) : result(resultIn), fStarted(false) {}
+
+    void BeginObject() { Begin(UniValue::VOBJ); }
+    void EndObject() { End(); }
+    void BeginArray() { Begin(UniValue::VARR); }
+    void EndArray() { End(); }
+    void Key(const std::string& key) { strKey = key; }
+    void Value(const UniValue& val);
+};
+
+#endif // BITCOIN_RPCJSONWRITER_H
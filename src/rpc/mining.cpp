@@ -99,20 +99,26 @@ UniValue getnetworkhashps(const UniValue& params, bool fHelp)
 
 UniValue generate(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() < 1 || params.size() > 1)
+    if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
-            "generate numblocks\n"
+            "generate numblocks ( fast )\n"
             "\nMine blocks immediately (before the RPC call returns)\n"
             "\nNote: this function can only be used on the regtest network\n"
             "\nArguments:\n"
             "1. numblocks    (numeric, required) How many blocks are generated immediately.\n"
+            "2. fast         (boolean, optional, default=false) Only the first block takes transactions from the mempool;\n"
+            "                the others, with just a coinbase, are built from it without a block template of their own.\n"
             "\nResult\n"
             "[ blockhashes ]     (array) hashes of blocks generated\n"
             "\nExamples:\n"
             "\nGenerate 11 blocks\n"
             + HelpExampleCli("generate", "11")
+            + "\nGenerate 1000 blocks fast\n"
+            + HelpExampleCli("generate", "1000 true")
         );
 
+    const bool fFast = params.size() > 1 && params[1].get_bool();
+
     LOCK(cs_main);
 
     CScript coinbaseDest(Params().CoinbaseDestination());
@@ -121,9 +127,6 @@ UniValue generate(const UniValue& params, bool fHelp)
 #ifdef ENABLE_WALLET
         LOCK2(cs_main, pwalletMain->cs_wallet);
 
-        if (!pwalletMain->IsLocked())
-            pwalletMain->TopUpKeyPool();
-
         // Generate a new key that is added to wallet
         CPubKey newKey;
         if (!pwalletMain->GetKeyFromPool(newKey))
@@ -137,12 +140,19 @@ UniValue generate(const UniValue& params, bool fHelp)
     }
 
     UniValue arr(UniValue::VARR);
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
     for (int i = 0; i < params[0].get_int(); i++) {
-        std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(coinbaseDest));
-        if (!pblocktemplate.get())
-            throw JSONRPCError(RPC_INTERNAL_ERROR, "Wallet keypool empty");
-        unsigned int nExtraNonce = 0;
-        IncrementExtraNonce(&pblocktemplate->block, chainActive.Tip(), nExtraNonce);
+        if (fFast && pblocktemplate.get()) {
+            // Skip the template and its validity check, which
+            // ProcessNewBlock would only repeat.
+            UpdateEmptyBlock(&pblocktemplate->block, chainActive.Tip(), coinbaseDest, Params());
+        } else {
+            pblocktemplate.reset(BlockAssembler(Params()).CreateNewBlock(coinbaseDest));
+            if (!pblocktemplate.get())
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Wallet keypool empty");
+            unsigned int nExtraNonce = 0;
+            IncrementExtraNonce(pblocktemplate.get(), chainActive.Tip(), nExtraNonce);
+        }
         if (!CheckProof(pblocktemplate->block, Params().GetConsensus()))
             throw JSONRPCError(RPC_METHOD_NOT_FOUND, "This method cannot be used with a block-signature-required chain");
         CValidationState state;
@@ -176,7 +186,7 @@ UniValue getnewblockhex(const UniValue& params, bool fHelp)
         // IncrementExtraNonce sets coinbase flags and builds merkle tree
         LOCK(cs_main);
         unsigned int nExtraNonce = 0;
-        IncrementExtraNonce(&pblocktemplate->block, chainActive.Tip(), nExtraNonce);
+        IncrementExtraNonce(pblocktemplate.get(), chainActive.Tip(), nExtraNonce);
     }
 
     CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
@@ -191,7 +201,7 @@ UniValue combineblocksigs(const UniValue& params, bool fHelp)
             "combineblocksigs \"blockhex\" [\"signature\",...]\n"
             "\nMerges signatures on a block proposal\n"
             "\nArguments:\n"
-            "1. \"blockhex\"       (string, required) The hex-encoded block from getnewblockhex\n"
+            "1. \"blockhex\"       (string, required) The hex-encoded block from getnewblockhex, or just its header\n"
             "2. \"signatures\"     (string) A json array of signatures\n"
             "    [\n"
             "      \"signature\"   (string) A signature (in the form of a hex-encoded scriptSig)\n"
@@ -206,27 +216,36 @@ UniValue combineblocksigs(const UniValue& params, bool fHelp)
             + HelpExampleCli("combineblocksigs", "")
         );
 
-    CBlock block;
-    if (!DecodeHexBlk(block, params[0].get_str()))
+    // Only the header is decoded: the transactions are passed through as they
+    // are, after the header with the combined solution.
+    if (!IsHex(params[0].get_str()))
         throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Block decode failed");
+    CDataStream ssBlock(ParseHex(params[0].get_str()), SER_NETWORK, PROTOCOL_VERSION);
+    CBlockHeader header;
+    try {
+        ssBlock >> header;
+    }
+    catch (const std::exception&) {
+        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Block decode failed");
+    }
 
-    UniValue result(UniValue::VOBJ);
     const UniValue& sigs = params[1].get_array();
+    std::vector<CScript> vSolutions(1, header.proof.solution);
     for (unsigned int i = 0; i < sigs.size(); i++) {
         const std::string& sig = sigs[i].get_str();
         if (!IsHex(sig))
             continue;
         std::vector<unsigned char> vchScript = ParseHex(sig);
-        block.proof.solution = CombineBlockSignatures(block, block.proof.solution, CScript(vchScript.begin(), vchScript.end()));
-        if (CheckProof(block, Params().GetConsensus())) {
-            result.push_back(Pair("hex", EncodeHexBlock(block)));
-            result.push_back(Pair("complete", true));
-            return result;
-        }
+        vSolutions.push_back(CScript(vchScript.begin(), vchScript.end()));
     }
+    header.proof.solution = CombineBlockSignatures(header, vSolutions);
+
+    CDataStream ssResult(SER_NETWORK, PROTOCOL_VERSION);
+    ssResult << header;
 
-    result.push_back(Pair("hex", EncodeHexBlock(block)));
-    result.push_back(Pair("complete", false));
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("hex", HexStr(ssResult.begin(), ssResult.end()) + HexStr(ssBlock.begin(), ssBlock.end())));
+    result.push_back(Pair("complete", CheckProof(header, Params().GetConsensus())));
     return result;
 }
 
@@ -338,6 +357,7 @@ UniValue testproposedblock(const UniValue& params, bool fHelp)
         throw runtime_error(
             "testproposedblock \"blockhex\"\n"
             "\nChecks a block proposal for validity, and that it extends chaintip\n"
+            "The verdict is kept until the chaintip moves, so checking or signing the same proposal again is cheap.\n"
             "\nArguments:\n"
             "1. \"blockhex\"    (string, required) The hex-encoded block from getnewblockhex\n"
             "\nResult\n"
@@ -356,13 +376,8 @@ UniValue testproposedblock(const UniValue& params, bool fHelp)
     if (mi != mapBlockIndex.end())
         throw JSONRPCError(RPC_VERIFY_ERROR, "already have block");
 
-    CBlockIndex* const pindexPrev = chainActive.Tip();
-    // TestBlockValidity only supports blocks built on the current Tip
-    if (block.hashPrevBlock != pindexPrev->GetBlockHash())
-        throw JSONRPCError(RPC_VERIFY_ERROR, "proposal was not based on our best chain");
-
     CValidationState state;
-    if (!TestBlockValidity(state, Params(), block, pindexPrev, false, true) || !state.IsValid()) {
+    if (!TestProposedBlock(state, Params(), block)) {
         std::string strRejectReason = state.GetRejectReason();
         if (strRejectReason.empty())
             throw JSONRPCError(RPC_VERIFY_ERROR, state.IsInvalid() ? "Block proposal was invalid" : "Error checking block proposal");
@@ -620,7 +635,8 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     UniValue transactions(UniValue::VARR);
     map<uint256, int64_t> setTxIndex;
     int i = 0;
-    BOOST_FOREACH (CTransaction& tx, pblock->vtx) {
+    BOOST_FOREACH (const CTransactionRef& ptx, pblock->vtx) {
+        const CTransaction& tx = *ptx;
         uint256 txHash = tx.GetHash();
         setTxIndex[txHash] = i++;
 
@@ -723,7 +739,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
     result.push_back(Pair("transactions", transactions));
     result.push_back(Pair("coinbaseaux", aux));
-    result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue.GetAmount()));
+    result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0]->vout[0].nValue.GetAmount()));
     result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
     result.push_back(Pair("target", GetChallengeStrHex(*pblock)));
     result.push_back(Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1));
@@ -18,6 +18,7 @@
 #include "wallet/walletdb.h"
 #endif
 
+#include <algorithm>
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp>
@@ -466,10 +467,86 @@ UniValue setmocktime(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+UniValue setlockprofiling(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "setlockprofiling enable\n"
+            "\nStart or stop recording how long each lock site waits for and holds its lock, see getlockprofile.\n"
+            "Recorded profiles are kept while stopped.\n"
+            "\nArguments:\n"
+            "1. enable    (boolean, required) true to start recording, false to stop\n"
+            "\nExamples:\n"
+            + HelpExampleCli("setlockprofiling", "true")
+            + HelpExampleRpc("setlockprofiling", "true")
+        );
+
+    fProfileLocks = params[0].get_bool();
+    return NullUniValue;
+}
+
+static bool LockSiteWaitGreater(const CLockSiteStats& a, const CLockSiteStats& b)
+{
+    return a.nWaitMicros > b.nWaitMicros;
+}
+
+UniValue getlockprofile(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getlockprofile ( reset )\n"
+            "\nReturns the wait and hold times of the lock sites recorded while lock profiling was on\n"
+            "(-lockprofile, setlockprofiling), most waited on first.\n"
+            "\nArguments:\n"
+            "1. reset     (boolean, optional, default=false) Clear the profile after returning it\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"lock\": \"name\",          (string) The lock, as named at the site\n"
+            "    \"site\": \"file:line\",     (string) Where it is taken\n"
+            "    \"count\": n,              (numeric) Acquisitions\n"
+            "    \"contended\": n,          (numeric) Acquisitions that had to wait for another thread\n"
+            "    \"wait_us\": n,            (numeric) Total time waited, in microseconds\n"
+            "    \"max_wait_us\": n,        (numeric) Longest wait, in microseconds\n"
+            "    \"hold_us\": n,            (numeric) Total time held, in microseconds\n"
+            "    \"max_hold_us\": n         (numeric) Longest hold, in microseconds\n"
+            "  },\n"
+            "  ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockprofile", "")
+            + HelpExampleRpc("getlockprofile", "true")
+        );
+
+    bool fReset = params.size() > 0 && params[0].get_bool();
+
+    std::vector<CLockSiteStats> vStats = GetLockProfile();
+    if (fReset)
+        ResetLockProfile();
+    std::sort(vStats.begin(), vStats.end(), LockSiteWaitGreater);
+
+    UniValue ret(UniValue::VARR);
+    BOOST_FOREACH(const CLockSiteStats& stats, vStats) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("lock", stats.strName));
+        obj.push_back(Pair("site", strprintf("%s:%d", stats.strFile, stats.nLine)));
+        obj.push_back(Pair("count", stats.nCount));
+        obj.push_back(Pair("contended", stats.nContended));
+        obj.push_back(Pair("wait_us", stats.nWaitMicros));
+        obj.push_back(Pair("max_wait_us", stats.nMaxWaitMicros));
+        obj.push_back(Pair("hold_us", stats.nHoldMicros));
+        obj.push_back(Pair("max_hold_us", stats.nMaxHoldMicros));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
+    { "control",            "getlockprofile",         &getlockprofile,         true  },
+    { "control",            "setlockprofiling",       &setlockprofiling,       true  },
     { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         true  },
     { "util",               "verifymessage",          &verifymessage,          true  },
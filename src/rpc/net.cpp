@@ -17,6 +17,10 @@
 #include "utilstrencodings.h"
 #include "version.h"
 
+#if ENABLE_ZMQ
+#include "zmq/zmqpublishnotifier.h"
+#endif
+
 #include <boost/foreach.hpp>
 
 #include <univalue.h>
@@ -111,6 +115,7 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ]\n"
+            "    \"txvalidationtime\": n,     (numeric) The time in seconds spent on the transactions this peer sent\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,             (numeric) The total bytes sent aggregated by message type\n"
             "       ...\n"
@@ -172,6 +177,7 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("txvalidationtime", statestats.nTxValidationMicros * 0.000001));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
@@ -353,6 +359,18 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
             "    \"serve_historical_blocks\": true|false,  (boolean) True if serving historical blocks\n"
             "    \"bytes_left_in_cycle\": t,               (numeric) Bytes left in current time cycle\n"
             "    \"time_left_in_cycle\": t                 (numeric) Seconds left in current time cycle\n"
+            "  },\n"
+            "  \"bufferpool\":\n"
+            "  {\n"
+            "    \"hits\": n,              (numeric) Messages that reused the buffer of an earlier one\n"
+            "    \"misses\": n,            (numeric) Messages for which no buffer was available for reuse\n"
+            "    \"bytes\": n              (numeric) Bytes of buffers currently kept for reuse\n"
+            "  },\n"
+            "  \"zmq\":                   (only with ZeroMQ notifications compiled in)\n"
+            "  {\n"
+            "    \"queued\": n,            (numeric) Notifications waiting to be published\n"
+            "    \"dropped\": n,           (numeric) Notifications dropped because the queue was full or they failed\n"
+            "    \"sent\": n               (numeric) Notifications published\n"
             "  }\n"
             "}\n"
             "\nExamples:\n"
@@ -373,6 +391,24 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     outboundLimit.push_back(Pair("bytes_left_in_cycle", CNode::GetOutboundTargetBytesLeft()));
     outboundLimit.push_back(Pair("time_left_in_cycle", CNode::GetMaxOutboundTimeLeftInCycle()));
     obj.push_back(Pair("uploadtarget", outboundLimit));
+
+    uint64_t nHits, nMisses, nPooledBytes;
+    CNetBufferPool::GetStats(nHits, nMisses, nPooledBytes);
+    UniValue bufferPool(UniValue::VOBJ);
+    bufferPool.push_back(Pair("hits", nHits));
+    bufferPool.push_back(Pair("misses", nMisses));
+    bufferPool.push_back(Pair("bytes", nPooledBytes));
+    obj.push_back(Pair("bufferpool", bufferPool));
+
+#if ENABLE_ZMQ
+    uint64_t nQueued, nDropped, nSent;
+    CZMQPublishQueue::GetStats(nQueued, nDropped, nSent);
+    UniValue zmq(UniValue::VOBJ);
+    zmq.push_back(Pair("queued", nQueued));
+    zmq.push_back(Pair("dropped", nDropped));
+    zmq.push_back(Pair("sent", nSent));
+    obj.push_back(Pair("zmq", zmq));
+#endif
     return obj;
 }
 
@@ -9,6 +9,7 @@
 #include "coins.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "eccontext.h"
 #include "init.h"
 #include "keystore.h"
 #include "main.h"
@@ -29,6 +30,8 @@
 #include "wallet/wallet.h"
 #endif
 
+#include <list>
+#include <memory>
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp>
@@ -38,30 +41,6 @@
 
 using namespace std;
 
-static secp256k1_context* secp256k1_blind_context = NULL;
-
-class RPCRawTransaction_ECC_Init {
-public:
-    RPCRawTransaction_ECC_Init() {
-        assert(secp256k1_blind_context == NULL);
-
-        secp256k1_context *ctx = secp256k1_context_create(SECP256K1_CONTEXT_NONE);
-        assert(ctx != NULL);
-
-        secp256k1_blind_context = ctx;
-    }
-
-    ~RPCRawTransaction_ECC_Init() {
-        secp256k1_context *ctx = secp256k1_blind_context;
-        secp256k1_blind_context = NULL;
-
-        if (ctx) {
-            secp256k1_context_destroy(ctx);
-        }
-    }
-};
-static RPCRawTransaction_ECC_Init ecc_init_on_load;
-
 void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex)
 {
     txnouttype type;
@@ -86,11 +65,11 @@ void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fInclud
     out.push_back(Pair("addresses", a));
 }
 
-void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
+void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry, bool fLean)
 {
     entry.push_back(Pair("txid", tx.GetHash().GetHex()));
     entry.push_back(Pair("hash", tx.GetWitnessHash().GetHex()));
-    entry.push_back(Pair("size", (int)::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION)));
+    entry.push_back(Pair("size", (int)tx.GetTotalSize()));
     entry.push_back(Pair("vsize", (int)::GetVirtualTransactionSize(tx)));
     entry.push_back(Pair("version", tx.nVersion));
     entry.push_back(Pair("locktime", (int64_t)tx.nLockTime));
@@ -131,12 +110,14 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
         UniValue out(UniValue::VOBJ);
         if (txout.nValue.IsAmount())
             out.push_back(Pair("value", ValueFromAmount(txout.nValue.GetAmount())));
-        else {
+        else if (fLean) {
+            out.push_back(Pair("ct-rangeproof-size", (int64_t)txout.nValue.vchRangeproof.size()));
+        } else {
             int exp;
             int mantissa;
             uint64_t minv;
             uint64_t maxv;
-            if (secp256k1_rangeproof_info(secp256k1_blind_context, &exp, &mantissa, &minv, &maxv, &txout.nValue.vchRangeproof[0], txout.nValue.vchRangeproof.size())) {
+            if (secp256k1_rangeproof_info(ECC_GetContext(), &exp, &mantissa, &minv, &maxv, &txout.nValue.vchRangeproof[0], txout.nValue.vchRangeproof.size())) {
                 if (exp == -1) {
                     out.push_back(Pair("value", ValueFromAmount((CAmount)minv)));
                 } else {
@@ -179,9 +160,9 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
 
 UniValue getrawtransaction(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() < 1 || params.size() > 2)
+    if (fHelp || params.size() < 1 || params.size() > 3)
         throw runtime_error(
-            "getrawtransaction \"txid\" ( verbose )\n"
+            "getrawtransaction \"txid\" ( verbose lean )\n"
             "\nNOTE: By default this function only works sometimes. This is when the tx is in the mempool\n"
             "or there is an unspent output in the utxo for this transaction. To make it always work,\n"
             "you need to maintain a transaction index, using the -txindex command line option.\n"
@@ -192,6 +173,7 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             "\nArguments:\n"
             "1. \"txid\"      (string, required) The transaction id\n"
             "2. verbose       (numeric, optional, default=0) If 0, return a string, other return a json object\n"
+            "3. lean          (boolean, optional, default=false) With verbose, leave out \"hex\" and give the size of each range proof instead of decoding it\n"
 
             "\nResult (if verbose is not set or set to 0):\n"
             "\"data\"      (string) The serialized, hex-encoded data for 'txid'\n"
@@ -221,7 +203,8 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             "  ],\n"
             "  \"vout\" : [              (array of json objects)\n"
             "     {\n"
-            "       \"value\" : x.xxx,            (numeric) The value in " + CURRENCY_UNIT + "\n"
+            "       \"value\" : x.xxx,            (numeric) The value in " + CURRENCY_UNIT + ", if not confidential\n"
+            "       \"ct-rangeproof-size\" : n,   (numeric) With lean, the size of the range proof of a confidential value\n"
             "       \"n\" : n,                    (numeric) index\n"
             "       \"scriptPubKey\" : {          (json object)\n"
             "         \"asm\" : \"asm\",          (string) the asm\n"
@@ -245,6 +228,7 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             "\nExamples:\n"
             + HelpExampleCli("getrawtransaction", "\"mytxid\"")
             + HelpExampleCli("getrawtransaction", "\"mytxid\" 1")
+            + HelpExampleCli("getrawtransaction", "\"mytxid\" 1 true")
             + HelpExampleRpc("getrawtransaction", "\"mytxid\", 1")
         );
 
@@ -255,67 +239,61 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
     bool fVerbose = false;
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
+    bool fLean = false;
+    if (params.size() > 2)
+        fLean = params[2].get_bool();
 
     CTransaction tx;
     uint256 hashBlock;
     if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
 
-    string strHex = EncodeHexTx(tx);
-
     if (!fVerbose)
-        return strHex;
+        return EncodeHexTx(tx);
 
     UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("hex", strHex));
-    TxToJSON(tx, hashBlock, result);
+    // The hex holds every range proof in full.
+    if (!fLean)
+        result.push_back(Pair("hex", EncodeHexTx(tx)));
+    TxToJSON(tx, hashBlock, result, fLean);
     return result;
 }
 
-UniValue gettxoutproof(const UniValue& params, bool fHelp)
+/** A block's header and complete merkle tree, from which proofs are cut */
+struct CTxOutProofBlock
 {
-    if (fHelp || (params.size() != 1 && params.size() != 2))
-        throw runtime_error(
-            "gettxoutproof [\"txid\",...] ( blockhash )\n"
-            "\nReturns a hex-encoded proof that \"txid\" was included in a block.\n"
-            "\nNOTE: By default this function only works sometimes. This is when there is an\n"
-            "unspent output in the utxo for this transaction. To make it always work,\n"
-            "you need to maintain a transaction index, using the -txindex command line option or\n"
-            "specify the block in which the transaction is included manually (by blockhash).\n"
-            "\nReturn the raw transaction data.\n"
-            "\nArguments:\n"
-            "1. \"txids\"       (string) A json array of txids to filter\n"
-            "    [\n"
-            "      \"txid\"     (string) A transaction hash\n"
-            "      ,...\n"
-            "    ]\n"
-            "2. \"block hash\"  (string, optional) If specified, looks for txid in the block with this hash\n"
-            "\nResult:\n"
-            "\"data\"           (string) A string that is a serialized, hex-encoded data for the proof.\n"
-        );
+    CBlockHeader header;
+    CMerkleTreeLevels tree;
+    //! Position of each transaction in the block
+    std::map<uint256, unsigned int> mapTxPos;
 
-    set<uint256> setTxids;
-    uint256 oneTxid;
-    UniValue txids = params[0].get_array();
-    for (unsigned int idx = 0; idx < txids.size(); idx++) {
-        const UniValue& txid = txids[idx];
-        if (txid.get_str().length() != 64 || !IsHex(txid.get_str()))
-            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid txid ")+txid.get_str());
-        uint256 hash(uint256S(txid.get_str()));
-        if (setTxids.count(hash))
-            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter, duplicated txid: ")+txid.get_str());
-       setTxids.insert(hash);
-       oneTxid = hash;
+    CTxOutProofBlock(const CBlock& block, const std::vector<uint256>& vTxid) : header(block.GetBlockHeader()), tree(vTxid)
+    {
+        for (unsigned int i = 0; i < vTxid.size(); i++)
+            mapTxPos[vTxid[i]] = i;
     }
+};
 
-    LOCK(cs_main);
+//! Number of blocks whose merkle trees are kept for gettxoutproof(s)
+static const size_t TXOUTPROOF_BLOCK_CACHE_SIZE = 16;
 
-    CBlockIndex* pblockindex = NULL;
+static CCriticalSection cs_txoutproofblocks;
+//! The blocks proofs were last cut from, most recently used first
+static std::list<std::pair<uint256, std::shared_ptr<const CTxOutProofBlock> > > listTxOutProofBlocks;
 
+/**
+ * The block to look for oneTxid in, as gettxoutproof finds it: the given
+ * block if blockhash is not null, else the one the utxo set or the
+ * transaction index places it in. Requires cs_main.
+ */
+static CBlockIndex* FindTxOutProofBlock(const uint256& oneTxid, const UniValue& blockhash)
+{
+    AssertLockHeld(cs_main);
+    CBlockIndex* pblockindex = NULL;
     uint256 hashBlock;
-    if (params.size() > 1)
+    if (!blockhash.isNull())
     {
-        hashBlock = uint256S(params[1].get_str());
+        hashBlock = uint256S(blockhash.get_str());
         if (!mapBlockIndex.count(hashBlock))
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
         pblockindex = mapBlockIndex[hashBlock];
@@ -334,23 +312,193 @@ UniValue gettxoutproof(const UniValue& params, bool fHelp)
             throw JSONRPCError(RPC_INTERNAL_ERROR, "Transaction index corrupt");
         pblockindex = mapBlockIndex[hashBlock];
     }
+    return pblockindex;
+}
+
+/** The merkle tree of a block, from the cache or read from disk. Requires cs_main. */
+static std::shared_ptr<const CTxOutProofBlock> GetTxOutProofBlock(const CBlockIndex* pblockindex)
+{
+    AssertLockHeld(cs_main);
+    const uint256 hash = pblockindex->GetBlockHash();
+    {
+        LOCK(cs_txoutproofblocks);
+        for (std::list<std::pair<uint256, std::shared_ptr<const CTxOutProofBlock> > >::iterator it = listTxOutProofBlocks.begin(); it != listTxOutProofBlocks.end(); ++it) {
+            if (it->first == hash) {
+                listTxOutProofBlocks.splice(listTxOutProofBlocks.begin(), listTxOutProofBlocks, it);
+                return it->second;
+            }
+        }
+    }
 
     CBlock block;
     if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    std::vector<uint256> vTxid;
+    vTxid.reserve(block.vtx.size());
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
+        vTxid.push_back(ptx->GetHash());
+    std::shared_ptr<const CTxOutProofBlock> pblock = std::make_shared<CTxOutProofBlock>(block, vTxid);
+
+    LOCK(cs_txoutproofblocks);
+    listTxOutProofBlocks.push_front(std::make_pair(hash, pblock));
+    if (listTxOutProofBlocks.size() > TXOUTPROOF_BLOCK_CACHE_SIZE)
+        listTxOutProofBlocks.pop_back();
+    return pblock;
+}
 
-    unsigned int ntxFound = 0;
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
-        if (setTxids.count(tx.GetHash()))
-            ntxFound++;
-    if (ntxFound != setTxids.size())
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "(Not all) transactions not found in specified block");
+/** The hex-encoded proof that the transactions are in the block */
+static std::string MakeTxOutProof(const CTxOutProofBlock& block, const std::set<uint256>& setTxids)
+{
+    std::vector<unsigned int> vMatchPos;
+    vMatchPos.reserve(setTxids.size());
+    BOOST_FOREACH(const uint256& txid, setTxids) {
+        std::map<uint256, unsigned int>::const_iterator it = block.mapTxPos.find(txid);
+        if (it == block.mapTxPos.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "(Not all) transactions not found in specified block");
+        vMatchPos.push_back(it->second);
+    }
+    std::sort(vMatchPos.begin(), vMatchPos.end());
 
+    CMerkleBlock mb;
+    mb.header = block.header;
+    mb.txn = CPartialMerkleTree(block.tree, vMatchPos);
     CDataStream ssMB(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
-    CMerkleBlock mb(block, setTxids);
     ssMB << mb;
-    std::string strHex = HexStr(ssMB.begin(), ssMB.end());
-    return strHex;
+    return HexStr(ssMB.begin(), ssMB.end());
+}
+
+/** Parse a json array of distinct txids into setTxids, returning the last one */
+static uint256 ParseTxOutProofTxids(const UniValue& txids, std::set<uint256>& setTxids)
+{
+    uint256 oneTxid;
+    for (unsigned int idx = 0; idx < txids.size(); idx++) {
+        const UniValue& txid = txids[idx];
+        if (txid.get_str().length() != 64 || !IsHex(txid.get_str()))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid txid ")+txid.get_str());
+        uint256 hash(uint256S(txid.get_str()));
+        if (setTxids.count(hash))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter, duplicated txid: ")+txid.get_str());
+        setTxids.insert(hash);
+        oneTxid = hash;
+    }
+    return oneTxid;
+}
+
+UniValue gettxoutproof(const UniValue& params, bool fHelp)
+{
+    if (fHelp || (params.size() != 1 && params.size() != 2))
+        throw runtime_error(
+            "gettxoutproof [\"txid\",...] ( blockhash )\n"
+            "\nReturns a hex-encoded proof that \"txid\" was included in a block.\n"
+            "\nNOTE: By default this function only works sometimes. This is when there is an\n"
+            "unspent output in the utxo for this transaction. To make it always work,\n"
+            "you need to maintain a transaction index, using the -txindex command line option or\n"
+            "specify the block in which the transaction is included manually (by blockhash).\n"
+            "\nReturn the raw transaction data.\n"
+            "\nArguments:\n"
+            "1. \"txids\"       (string) A json array of txids to filter\n"
+            "    [\n"
+            "      \"txid\"     (string) A transaction hash\n"
+            "      ,...\n"
+            "    ]\n"
+            "2. \"block hash\"  (string, optional) If specified, looks for txid in the block with this hash\n"
+            "\nResult:\n"
+            "\"data\"           (string) A string that is a serialized, hex-encoded data for the proof.\n"
+        );
+
+    set<uint256> setTxids;
+    uint256 oneTxid = ParseTxOutProofTxids(params[0].get_array(), setTxids);
+
+    std::shared_ptr<const CTxOutProofBlock> pblock;
+    {
+        LOCK(cs_main);
+        pblock = GetTxOutProofBlock(FindTxOutProofBlock(oneTxid, params.size() > 1 ? params[1] : NullUniValue));
+    }
+    return MakeTxOutProof(*pblock, setTxids);
+}
+
+UniValue gettxoutproofs(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "gettxoutproofs [request,...]\n"
+            "\nReturns many proofs that transactions were included in blocks, as gettxoutproof does,\n"
+            "reading each block once and cutting all of its proofs out of the same merkle tree.\n"
+            "\nArguments:\n"
+            "1. \"requests\"          (array, required) The proofs to make\n"
+            "    [\n"
+            "      \"txid\"            (string) A transaction to prove on its own, or\n"
+            "      {\n"
+            "        \"txids\": [\"txid\",...],  (array, required) Transactions to prove in one proof\n"
+            "        \"blockhash\": \"hash\"     (string, optional) The block to look for them in\n"
+            "      }\n"
+            "      ,...\n"
+            "    ]\n"
+            "\nResult:\n"
+            "[                         (array) One entry per request, in order\n"
+            "  {\n"
+            "    \"proof\": \"data\",       (string) The hex-encoded proof, or\n"
+            "    \"error\": { ... }       (object) Why there is no proof for this request\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gettxoutproofs", "\"[\\\"mytxid\\\",{\\\"txids\\\":[\\\"mytxid2\\\",\\\"mytxid3\\\"]}]\"")
+            + HelpExampleRpc("gettxoutproofs", "[\"mytxid\",{\"txids\":[\"mytxid2\",\"mytxid3\"]}]")
+        );
+
+    const UniValue& requests = params[0].get_array();
+    std::vector<std::set<uint256> > vsetTxids(requests.size());
+    std::vector<uint256> vOneTxid(requests.size());
+    std::vector<UniValue> vBlockHash(requests.size());
+    for (unsigned int i = 0; i < requests.size(); i++) {
+        const UniValue& request = requests[i];
+        if (request.isStr()) {
+            UniValue txids(UniValue::VARR);
+            txids.push_back(request);
+            vOneTxid[i] = ParseTxOutProofTxids(txids, vsetTxids[i]);
+        } else {
+            const UniValue& o = request.get_obj();
+            RPCTypeCheckObj(o, boost::assign::map_list_of("txids", UniValueType(UniValue::VARR))("blockhash", UniValueType(UniValue::VSTR)), true);
+            vOneTxid[i] = ParseTxOutProofTxids(find_value(o, "txids"), vsetTxids[i]);
+            vBlockHash[i] = find_value(o, "blockhash");
+        }
+        if (vsetTxids[i].empty())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Request %u has no txids", i));
+    }
+
+    // Find and load every block under one lock, each only once; the proofs
+    // are cut from the cached trees after releasing it.
+    std::vector<UniValue> vResults(requests.size());
+    std::vector<std::shared_ptr<const CTxOutProofBlock> > vBlocks(requests.size());
+    {
+        LOCK(cs_main);
+        for (unsigned int i = 0; i < requests.size(); i++) {
+            try {
+                vBlocks[i] = GetTxOutProofBlock(FindTxOutProofBlock(vOneTxid[i], vBlockHash[i]));
+            } catch (const UniValue& objError) {
+                vResults[i] = objError;
+            } catch (const std::exception& e) {
+                vResults[i] = JSONRPCError(RPC_MISC_ERROR, e.what());
+            }
+        }
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (unsigned int i = 0; i < requests.size(); i++) {
+        UniValue entry(UniValue::VOBJ);
+        if (vBlocks[i]) {
+            try {
+                entry.push_back(Pair("proof", MakeTxOutProof(*vBlocks[i], vsetTxids[i])));
+            } catch (const UniValue& objError) {
+                vResults[i] = objError;
+            }
+        }
+        if (!vResults[i].isNull())
+            entry.push_back(Pair("error", vResults[i]));
+        ret.push_back(entry);
+    }
+    return ret;
 }
 
 UniValue verifytxoutproof(const UniValue& params, bool fHelp)
@@ -507,7 +655,7 @@ UniValue createrawtransaction(const UniValue& params, bool fHelp)
                 CPubKey confidentiality_pubkey = address.GetBlindingKey();
                 if (!confidentiality_pubkey.IsValid())
                      throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter: invalid confidentiality public key given"));
-                out.nValue.vchNonceCommitment = std::vector<unsigned char>(confidentiality_pubkey.begin(), confidentiality_pubkey.end());
+                out.nValue.vchNonceCommitment.assign(confidentiality_pubkey.begin(), confidentiality_pubkey.end());
             }
             rawTx.vout.push_back(out);
         }
@@ -536,7 +684,7 @@ void FillOutputBlinds(const CMutableTransaction& tx, bool fUseWallet, std::vecto
             output_pubkeys.push_back(CPubKey());
             output_blinds.push_back(uint256());
         } else {
-            CPubKey pubkey(tx.vout[nOut].nValue.vchNonceCommitment);
+            CPubKey pubkey(tx.vout[nOut].nValue.vchNonceCommitment.begin(), tx.vout[nOut].nValue.vchNonceCommitment.end());
             if (!pubkey.IsValid()) {
                  throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter: invalid confidentiality public key given"));
             }
@@ -546,11 +694,47 @@ void FillOutputBlinds(const CMutableTransaction& tx, bool fUseWallet, std::vecto
     }
 }
 
+/** Help text for the options argument of [raw]blindrawtransaction */
+static std::string RangeProofOptionsHelp(int nArg)
+{
+    return strprintf("%d. options                 (object, optional) Range proof settings for the newly blinded outputs; smaller proofs reveal more\n", nArg) +
+        "   {\n"
+        "     \"exponent\"        (numeric, optional, default set by -ct_exponent) Make the lowest this many decimal digits of each amount public, or all of it for -1\n"
+        "     \"bits\"            (numeric, optional, default set by -ct_bits) Minimum bits of mantissa to cover; every two bits add 160 bytes to each proof\n"
+        "     \"minvalue\"        (numeric, optional, default set by -ct_minvalue) Make public that amounts of at least this much are at least this much\n"
+        "   }\n";
+}
+
+/** The settings in the options argument of [raw]blindrawtransaction, with the configured ones for those not given */
+static CRangeProofSettings RangeProofSettingsFromOptions(const UniValue& options)
+{
+    CRangeProofSettings settings = GetRangeProofSettings();
+    if (options.isNull())
+        return settings;
+
+    RPCTypeCheckObj(options,
+        {
+            {"exponent", UniValueType(UniValue::VNUM)},
+            {"bits", UniValueType(UniValue::VNUM)},
+            {"minvalue", UniValueType()}, // checked by AmountFromValue
+        },
+        true, true);
+    if (options.exists("exponent"))
+        settings.nExponent = options["exponent"].get_int();
+    if (options.exists("bits"))
+        settings.nMinBits = options["bits"].get_int();
+    if (options.exists("minvalue"))
+        settings.nMinValue = AmountFromValue(options["minvalue"]);
+    if (!settings.IsValid())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid range proof options: exponent must be from -1 to 18 and bits from 1 to %d", MAX_CT_BITS));
+    return settings;
+}
+
 UniValue rawblindrawtransaction(const UniValue& params, bool fHelp)
 {
-    if (fHelp || (params.size() != 2 && params.size() != 3))
+    if (fHelp || params.size() < 2 || params.size() > 4)
         throw runtime_error(
-            "rawblindrawtransaction \"hexstring\" [\"inputblinder\",...] [\"totalblinder\"]\n"
+            "rawblindrawtransaction \"hexstring\" [\"inputblinder\",...] ( \"totalblinder\" options )\n"
             "\nConvert one or more outputs of a raw transaction into confidential ones.\n"
             "Returns the hex-encoded raw transaction.\n"
             "If at least one of the inputs is confidential, at least one of the outputs must be.\n"
@@ -563,17 +747,18 @@ UniValue rawblindrawtransaction(const UniValue& params, bool fHelp)
             "    \"inputblinder\"       (string, required) A hex-encoded blinding factor, one for each input.\n"
             "                         Blinding factors can be found in the \"blinder\" output of listunspent.\n"
             "   ],\n"
-            "3. \"totalblinder\"        (string, optional) Ignored for now.\n"
+            "3. \"totalblinder\"        (string, optional) Ignored for now; may be null.\n"
+            + RangeProofOptionsHelp(4) +
 
             "\nResult:\n"
             "\"transaction\"              (string) hex string of the transaction\n"
+
+            "\nExamples:\n"
+            + HelpExampleCli("rawblindrawtransaction", "\"hexstring\" \"[\\\"inputblinder\\\"]\" null \"{\\\"exponent\\\":0,\\\"bits\\\":32}\"")
         );
 
-    if (params.size() == 2) {
-        RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VARR));
-    } else {
-        RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VARR)(UniValue::VSTR));
-    }
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VARR)(UniValue::VSTR)(UniValue::VOBJ), true);
+    const CRangeProofSettings settings = RangeProofSettingsFromOptions(params.size() > 3 ? params[3] : NullUniValue);
 
     vector<unsigned char> txData(ParseHexV(params[0], "argument 1"));
     CDataStream ssData(txData, SER_NETWORK, PROTOCOL_VERSION);
@@ -602,7 +787,7 @@ UniValue rawblindrawtransaction(const UniValue& params, bool fHelp)
 
     FillOutputBlinds(tx, false, output_blinds, output_pubkeys);
 
-    if (!BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx)) {
+    if (!BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx, settings)) {
         throw JSONRPCError(RPC_INVALID_PARAMETER, string("Unable to blind transaction: add an additional output with a blinding pubkey"));
     }
 
@@ -612,9 +797,9 @@ UniValue rawblindrawtransaction(const UniValue& params, bool fHelp)
 #ifdef ENABLE_WALLET
 UniValue blindrawtransaction(const UniValue& params, bool fHelp)
 {
-    if (fHelp || (params.size() != 1 && params.size() != 2))
+    if (fHelp || params.size() < 1 || params.size() > 3)
         throw runtime_error(
-            "blindrawtransaction \"hexstring\" [\"totalblinder\"]\n"
+            "blindrawtransaction \"hexstring\" ( \"totalblinder\" options )\n"
             "\nConvert one or more outputs of a raw transaction into confidential ones using only wallet inputs.\n"
             "Returns the hex-encoded raw transaction.\n"
             "If at least one of the inputs is confidential, at least one of the outputs must be.\n"
@@ -622,17 +807,18 @@ UniValue blindrawtransaction(const UniValue& params, bool fHelp)
 
             "\nArguments:\n"
             "1. \"hexstring\",          (string, required) A hex-encoded raw transaction.\n"
-            "2. \"totalblinder\"        (string, optional) Ignored for now.\n"
+            "2. \"totalblinder\"        (string, optional) Ignored for now; may be null.\n"
+            + RangeProofOptionsHelp(3) +
 
             "\nResult:\n"
             "\"transaction\"              (string) hex string of the transaction\n"
+
+            "\nExamples:\n"
+            + HelpExampleCli("blindrawtransaction", "\"hexstring\" null \"{\\\"exponent\\\":0,\\\"bits\\\":32}\"")
         );
 
-    if (params.size() == 1) {
-        RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR));
-    } else {
-        RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VSTR));
-    }
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VSTR)(UniValue::VOBJ), true);
+    const CRangeProofSettings settings = RangeProofSettingsFromOptions(params.size() > 2 ? params[2] : NullUniValue);
 
     vector<unsigned char> txData(ParseHexV(params[0], "argument 1"));
     CDataStream ssData(txData, SER_NETWORK, PROTOCOL_VERSION);
@@ -661,7 +847,7 @@ UniValue blindrawtransaction(const UniValue& params, bool fHelp)
 
     FillOutputBlinds(tx, true, output_blinds, output_pubkeys);
 
-    if (!BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx)) {
+    if (!BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx, settings)) {
         throw JSONRPCError(RPC_INVALID_PARAMETER, string("Unable to blind transaction: add an additional output with a blinding pubkey"));
     }
 
@@ -671,13 +857,14 @@ UniValue blindrawtransaction(const UniValue& params, bool fHelp)
 
 UniValue decoderawtransaction(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 1)
+    if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
-            "decoderawtransaction \"hexstring\"\n"
+            "decoderawtransaction \"hexstring\" ( lean )\n"
             "\nReturn a JSON object representing the serialized, hex-encoded transaction.\n"
 
             "\nArguments:\n"
             "1. \"hex\"      (string, required) The transaction hex string\n"
+            "2. lean       (boolean, optional, default=false) Give the size of each range proof instead of decoding it\n"
 
             "\nResult:\n"
             "{\n"
@@ -703,7 +890,8 @@ UniValue decoderawtransaction(const UniValue& params, bool fHelp)
             "  ],\n"
             "  \"vout\" : [             (array of json objects)\n"
             "     {\n"
-            "       \"value\" : x.xxx,            (numeric) The value in " + CURRENCY_UNIT + "\n"
+            "       \"value\" : x.xxx,            (numeric) The value in " + CURRENCY_UNIT + ", if not confidential\n"
+            "       \"ct-rangeproof-size\" : n,   (numeric) With lean, the size of the range proof of a confidential value\n"
             "       \"n\" : n,                    (numeric) index\n"
             "       \"scriptPubKey\" : {          (json object)\n"
             "         \"asm\" : \"asm\",          (string) the asm\n"
@@ -722,19 +910,24 @@ UniValue decoderawtransaction(const UniValue& params, bool fHelp)
 
             "\nExamples:\n"
             + HelpExampleCli("decoderawtransaction", "\"hexstring\"")
+            + HelpExampleCli("decoderawtransaction", "\"hexstring\" true")
             + HelpExampleRpc("decoderawtransaction", "\"hexstring\"")
         );
 
     LOCK(cs_main);
-    RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR));
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VBOOL));
 
     CTransaction tx;
 
     if (!DecodeHexTx(tx, params[0].get_str(), true))
         throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "TX decode failed");
 
+    bool fLean = false;
+    if (params.size() > 1)
+        fLean = params[1].get_bool();
+
     UniValue result(UniValue::VOBJ);
-    TxToJSON(tx, uint256(), result);
+    TxToJSON(tx, uint256(), result, fLean);
 
     return result;
 }
@@ -1014,35 +1207,54 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
     UniValue vErrors(UniValue::VARR);
 
     // Use CTransaction for the constant parts of the
-    // transaction to avoid rehashing.
+    // transaction to avoid rehashing. The signature hashes do not cover the
+    // scriptSigs, so it serves every input however far the signing got.
     const CTransaction txConst(mergedTx);
-    // Sign what we can:
+    const PrecomputedTransactionData txdata(txConst);
+
+    // Look up what the inputs spend first, so that the signing threads
+    // only read their own slot.
+    std::vector<const CTxOut*> vSpent(mergedTx.vin.size(), NULL);
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
-        CTxIn& txin = mergedTx.vin[i];
+        const CTxIn& txin = mergedTx.vin[i];
         const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
-            TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
-            continue;
-        }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CTxOutValue& amount = coins->vout[txin.prevout.n].nValue;
+        if (coins != NULL && coins->IsAvailable(txin.prevout.n))
+            vSpent[i] = &coins->vout[txin.prevout.n];
+    }
 
-        SignatureData sigdata;
+    // Sign what we can, merge in the other signatures and check the result,
+    // one input per thread at a time. ProduceSignature need not verify its
+    // own signatures, as the merged result is verified anyway.
+    std::vector<SignatureData> vSigData(mergedTx.vin.size());
+    std::vector<ScriptError> vScriptErrors(mergedTx.vin.size(), SCRIPT_ERR_OK);
+    ForEachInputParallel(mergedTx.vin.size(), nScriptCheckThreads, [&](size_t i) {
+        if (!vSpent[i])
+            return;
+        const CScript& prevPubKey = vSpent[i]->scriptPubKey;
+        const CTxOutValue& amount = vSpent[i]->nValue;
+        const TransactionNoWithdrawsSignatureChecker checker(&txConst, i, amount, txdata);
+
+        SignatureData& sigdata = vSigData[i];
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
         if (!fHashSingle || (i < mergedTx.vout.size()))
-            ProduceSignature(MutableTransactionSignatureCreator(&keystore, &mergedTx, i, amount, nHashType), prevPubKey, sigdata);
+            ProduceSignature(TransactionSignatureCreator(&keystore, &txConst, i, amount, nHashType, &txdata), prevPubKey, sigdata, false);
 
         // ... and merge in other signatures:
         BOOST_FOREACH(const CMutableTransaction& txv, txVariants) {
-            sigdata = CombineSignatures(prevPubKey, MutableTransactionNoWithdrawsSignatureChecker(&mergedTx, i, amount), sigdata, DataFromTransaction(txv, i));
+            sigdata = CombineSignatures(prevPubKey, checker, sigdata, DataFromTransaction(txv, i));
         }
 
-        UpdateTransaction(mergedTx, i, sigdata);
+        VerifyScript(sigdata.scriptSig, prevPubKey, &sigdata.scriptWitness, STANDARD_SCRIPT_VERIFY_FLAGS, checker, &vScriptErrors[i]);
+    });
 
-        ScriptError serror = SCRIPT_ERR_OK;
-        if (!VerifyScript(txin.scriptSig, prevPubKey, mergedTx.wit.vtxinwit.size() > i ? &mergedTx.wit.vtxinwit[i].scriptWitness : NULL, STANDARD_SCRIPT_VERIFY_FLAGS, MutableTransactionNoWithdrawsSignatureChecker(&mergedTx, i, amount), &serror)) {
-            TxInErrorToJSON(txin, vErrors, ScriptErrorString(serror));
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
+        if (!vSpent[i]) {
+            TxInErrorToJSON(mergedTx.vin[i], vErrors, "Input not found or already spent");
+            continue;
         }
+        UpdateTransaction(mergedTx, i, vSigData[i]);
+        if (vScriptErrors[i] != SCRIPT_ERR_OK)
+            TxInErrorToJSON(mergedTx.vin[i], vErrors, ScriptErrorString(vScriptErrors[i]));
     }
     bool fComplete = vErrors.empty();
 
@@ -1149,6 +1361,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "blindrawtransaction",    &blindrawtransaction,    true  },
 #endif
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
+    { "blockchain",         "gettxoutproofs",         &gettxoutproofs,         true  },
     { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true  },
 };
 
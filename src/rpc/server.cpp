@@ -8,13 +8,18 @@
 #include "base58.h"
 #include "init.h"
 #include "random.h"
+#include "rpc/jsonwriter.h"
 #include "sync.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "utiltime.h"
+#include "validationinterface.h"
 
 #include <univalue.h>
 
+#include <deque>
+
 #include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
@@ -24,6 +29,7 @@
 #include <boost/signals2/signal.hpp>
 #include <boost/thread.hpp>
 #include <boost/algorithm/string/case_conv.hpp> // for to_upper()
+#include <boost/assign/list_of.hpp>
 
 //For thread local rpc username
 #include <boost/thread/tss.hpp>
@@ -46,6 +52,10 @@ static RPCTimerInterface* timerInterface = NULL;
 /* Map of name to timer.
  * @note Can be changed to std::unique_ptr when C++11 */
 static std::map<std::string, boost::shared_ptr<RPCTimerBase> > deadlineTimers;
+/* Calls at least this long are logged, if positive */
+static int64_t nRPCSlowCallMicros = DEFAULT_RPC_SLOW_CALL * 1000;
+static boost::mutex csRPCStats;
+static std::map<std::string, CRPCMethodStats> mapRPCStats;
 
 static struct CRPCSignals
 {
@@ -269,6 +279,368 @@ UniValue stop(const UniValue& params, bool fHelp)
     return "Elements server stopping";
 }
 
+/**
+ * A call submitted with submitjob. It runs on one of the -rpcjobthreads job
+ * threads rather than on an HTTP worker, so that slow calls cannot starve
+ * the -rpcthreads pool; its caller polls getjobresult for the outcome.
+ */
+struct CRPCJob
+{
+    enum Status { QUEUED, RUNNING, DONE, FAILED, CANCELLED };
+
+    int64_t nId;
+    std::string strUser;
+    std::string strMethod;
+    UniValue params;
+    Status status;
+    UniValue result;
+    UniValue error;
+    int64_t nSubmitted;
+    int64_t nFinished;
+    bool fCancel;
+    //! The job thread running it, to interrupt on cancellation
+    boost::thread* pthread;
+
+    CRPCJob() : nId(0), status(QUEUED), nSubmitted(0), nFinished(0), fCancel(false), pthread(NULL) {}
+};
+
+static boost::mutex csRPCJobs;
+static boost::condition_variable condRPCJobQueued;
+static boost::condition_variable condRPCJobFinished;
+static std::map<int64_t, boost::shared_ptr<CRPCJob> > mapRPCJobs;
+static std::deque<boost::shared_ptr<CRPCJob> > queueRPCJobs;
+static int64_t nLastRPCJobId = 0;
+static bool fRPCJobsRunning = false;
+static boost::thread_group threadGroupRPCJobs;
+static std::vector<boost::thread*> vRPCJobThreads;
+
+static const char* RPCJobStatusName(CRPCJob::Status status)
+{
+    switch (status) {
+    case CRPCJob::QUEUED: return "queued";
+    case CRPCJob::RUNNING: return "running";
+    case CRPCJob::DONE: return "done";
+    case CRPCJob::FAILED: return "failed";
+    case CRPCJob::CANCELLED: return "cancelled";
+    }
+    return "";
+}
+
+static void FinishRPCJob(CRPCJob& job, CRPCJob::Status status)
+{
+    job.status = status;
+    job.nFinished = GetTime();
+    job.pthread = NULL;
+    condRPCJobFinished.notify_all();
+}
+
+static void RPCJobThread(size_t nThread)
+{
+    RenameThread("bitcoin-rpcjob");
+    while (true) {
+        boost::shared_ptr<CRPCJob> job;
+        {
+            boost::unique_lock<boost::mutex> lock(csRPCJobs);
+            while (fRPCJobsRunning && queueRPCJobs.empty())
+                condRPCJobQueued.wait(lock);
+            if (!fRPCJobsRunning)
+                return;
+            job = queueRPCJobs.front();
+            queueRPCJobs.pop_front();
+            job->status = CRPCJob::RUNNING;
+            job->pthread = vRPCJobThreads[nThread];
+        }
+
+        userInstance.reset(new std::string(job->strUser));
+        LogPrint("rpc", "RPC job %d running method=%s\n", job->nId, SanitizeString(job->strMethod));
+        CRPCJob::Status status = CRPCJob::DONE;
+        UniValue result, error;
+        try {
+            result = tableRPC.execute(job->strMethod, job->params);
+        } catch (const boost::thread_interrupted&) {
+            status = CRPCJob::CANCELLED;
+        } catch (const UniValue& objError) {
+            status = CRPCJob::FAILED;
+            error = objError;
+        } catch (const std::exception& e) {
+            status = CRPCJob::FAILED;
+            error = JSONRPCError(RPC_MISC_ERROR, e.what());
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(csRPCJobs);
+            job->result = result;
+            job->error = error;
+            FinishRPCJob(*job, status);
+        }
+        // A cancellation that came too late to stop the call must not
+        // interrupt the next one.
+        try {
+            boost::this_thread::interruption_point();
+        } catch (const boost::thread_interrupted&) {}
+    }
+}
+
+static UniValue RPCJobToJSON(const CRPCJob& job)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("id", job.nId));
+    ret.push_back(Pair("method", job.strMethod));
+    ret.push_back(Pair("status", RPCJobStatusName(job.status)));
+    if (job.status == CRPCJob::DONE)
+        ret.push_back(Pair("result", job.result));
+    if (job.status == CRPCJob::FAILED)
+        ret.push_back(Pair("error", job.error));
+    return ret;
+}
+
+/** Find a job of the calling user. csRPCJobs must be held. */
+static boost::shared_ptr<CRPCJob> FindRPCJob(const UniValue& id)
+{
+    std::map<int64_t, boost::shared_ptr<CRPCJob> >::const_iterator it = mapRPCJobs.find(id.get_int64());
+    if (it == mapRPCJobs.end() || it->second->strUser != getUser())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Job not found");
+    return it->second;
+}
+
+UniValue submitjob(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "submitjob \"method\" ( [params] )\n"
+            "\nRun an RPC call in the background, on one of the -rpcjobthreads job threads, and return its job id at once.\n"
+            "Use getjobresult to wait for its result and canceljob to stop it.\n"
+            "\nArguments:\n"
+            "1. \"method\"     (string, required) The RPC method to call\n"
+            "2. params       (array, optional) Its arguments\n"
+            "\nResult:\n"
+            "n               (numeric) The job id\n"
+            "\nExamples:\n"
+            + HelpExampleCli("submitjob", "\"gettxoutsetinfo\"")
+            + HelpExampleCli("submitjob", "\"verifychain\" '[4, 1000]'")
+            + HelpExampleRpc("submitjob", "\"gettxoutsetinfo\", []")
+        );
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VARR));
+    const std::string strMethod = params[0].get_str();
+    if (!tableRPC[strMethod])
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
+    if (strMethod == "submitjob" || strMethod == "getjobresult" || strMethod == "canceljob")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Job calls cannot be run as jobs");
+
+    boost::shared_ptr<CRPCJob> job(new CRPCJob());
+    job->strUser = getUser();
+    job->strMethod = strMethod;
+    job->params = params.size() > 1 ? params[1] : UniValue(UniValue::VARR);
+    job->nSubmitted = GetTime();
+
+    boost::unique_lock<boost::mutex> lock(csRPCJobs);
+    if (!fRPCJobsRunning)
+        throw JSONRPCError(RPC_MISC_ERROR, "RPC jobs are not running");
+    // Forget results nobody collected in time.
+    for (std::map<int64_t, boost::shared_ptr<CRPCJob> >::iterator it = mapRPCJobs.begin(); it != mapRPCJobs.end(); ) {
+        const CRPCJob& old = *it->second;
+        if (old.nFinished && old.nFinished + RPC_JOB_EXPIRY < job->nSubmitted)
+            mapRPCJobs.erase(it++);
+        else
+            ++it;
+    }
+    if (mapRPCJobs.size() >= MAX_RPC_JOBS)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Too many RPC jobs");
+    job->nId = ++nLastRPCJobId;
+    mapRPCJobs[job->nId] = job;
+    queueRPCJobs.push_back(job);
+    condRPCJobQueued.notify_one();
+    return job->nId;
+}
+
+UniValue getjobresult(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getjobresult id ( timeout )\n"
+            "\nReturn the status of a job submitted with submitjob, and its result or error once it has finished.\n"
+            "Results are kept for " + strprintf("%d", RPC_JOB_EXPIRY / 60) + " minutes after the job finishes.\n"
+            "\nArguments:\n"
+            "1. id           (numeric, required) The job id\n"
+            "2. timeout      (numeric, optional, default=0) Seconds to wait for the job to finish before returning\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"id\": n,              (numeric) The job id\n"
+            "  \"method\": \"xxxx\",     (string) The RPC method called\n"
+            "  \"status\": \"xxxx\",     (string) One of \"queued\", \"running\", \"done\", \"failed\" or \"cancelled\"\n"
+            "  \"result\": xxxx,       (any) The call's result, if done\n"
+            "  \"error\": {...}        (object) The call's error, if failed\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getjobresult", "1")
+            + HelpExampleCli("getjobresult", "1 60")
+            + HelpExampleRpc("getjobresult", "1, 60")
+        );
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM)(UniValue::VNUM));
+    int64_t nTimeout = params.size() > 1 ? params[1].get_int64() : 0;
+    if (nTimeout < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative timeout");
+
+    boost::unique_lock<boost::mutex> lock(csRPCJobs);
+    boost::shared_ptr<CRPCJob> job = FindRPCJob(params[0]);
+    const boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(nTimeout);
+    while ((job->status == CRPCJob::QUEUED || job->status == CRPCJob::RUNNING) && IsRPCRunning()) {
+        if (!condRPCJobFinished.timed_wait(lock, deadline))
+            break;
+    }
+    return RPCJobToJSON(*job);
+}
+
+UniValue canceljob(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "canceljob id\n"
+            "\nCancel a job submitted with submitjob. A queued job will not run; a running one is interrupted\n"
+            "the next time it checks for interruption, so some calls may still finish.\n"
+            "\nArguments:\n"
+            "1. id           (numeric, required) The job id\n"
+            "\nResult:\n"
+            "true|false      (boolean) Whether the job had not finished yet\n"
+            "\nExamples:\n"
+            + HelpExampleCli("canceljob", "1")
+            + HelpExampleRpc("canceljob", "1")
+        );
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM));
+
+    boost::unique_lock<boost::mutex> lock(csRPCJobs);
+    boost::shared_ptr<CRPCJob> job = FindRPCJob(params[0]);
+    if (job->status == CRPCJob::QUEUED) {
+        queueRPCJobs.erase(std::find(queueRPCJobs.begin(), queueRPCJobs.end(), job));
+        FinishRPCJob(*job, CRPCJob::CANCELLED);
+        return true;
+    }
+    if (job->status == CRPCJob::RUNNING) {
+        job->fCancel = true;
+        job->pthread->interrupt();
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Records the duration, lock wait and outcome of one call, from construction
+ * to destruction, in the method's statistics, and logs slow calls.
+ */
+class CRPCCallTimer
+{
+private:
+    const std::string& strMethod;
+    const int64_t nStart;
+    const uint64_t nLockWaitStart;
+
+public:
+    bool fSucceeded;
+
+    CRPCCallTimer(const std::string& strMethodIn) : strMethod(strMethodIn), nStart(GetTimeMicros()), nLockWaitStart(GetThreadLockWaitMicros()), fSucceeded(false) {}
+
+    ~CRPCCallTimer()
+    {
+        // The clock may step backwards.
+        const uint64_t nMicros = std::max(GetTimeMicros() - nStart, (int64_t)0);
+        const uint64_t nLockWait = GetThreadLockWaitMicros() - nLockWaitStart;
+        int nBucket = 0;
+        for (uint64_t n = nMicros; n > 0 && nBucket < RPC_HISTOGRAM_BUCKETS - 1; n >>= 1)
+            nBucket++;
+        {
+            boost::unique_lock<boost::mutex> lock(csRPCStats);
+            CRPCMethodStats& stats = mapRPCStats[strMethod];
+            stats.nCount++;
+            if (!fSucceeded)
+                stats.nErrors++;
+            stats.nTotalMicros += nMicros;
+            stats.nMaxMicros = std::max(stats.nMaxMicros, nMicros);
+            stats.nLockWaitMicros += nLockWait;
+            stats.vBuckets[nBucket]++;
+        }
+        if (nRPCSlowCallMicros > 0 && nMicros >= (uint64_t)nRPCSlowCallMicros)
+            LogPrintf("Slow RPC call: method=%s user=%s time=%.3fs lockwait=%.3fs%s\n", SanitizeString(strMethod), getUser(),
+                nMicros * 0.000001, nLockWait * 0.000001, fSucceeded ? "" : " failed");
+    }
+};
+
+std::map<std::string, CRPCMethodStats> GetRPCStats()
+{
+    boost::unique_lock<boost::mutex> lock(csRPCStats);
+    return mapRPCStats;
+}
+
+/** Upper bound, in microseconds, of the bucket that holds the given fraction of the calls. */
+static uint64_t RPCPercentile(const CRPCMethodStats& stats, double dFraction)
+{
+    uint64_t nTarget = (uint64_t)(dFraction * stats.nCount + 0.5), nCumulative = 0;
+    for (int i = 0; i < RPC_HISTOGRAM_BUCKETS; i++) {
+        nCumulative += stats.vBuckets[i];
+        if (nCumulative >= nTarget && nCumulative > 0)
+            return (uint64_t)1 << i;
+    }
+    return 0;
+}
+
+UniValue getrpcstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcstats\n"
+            "\nReturns call counts and latency histograms of the RPC methods called since startup.\n"
+            "Durations are bucketed by powers of two microseconds, so percentiles are upper bounds.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"method\": {               (object) An RPC method called at least once\n"
+            "    \"count\": n,             (numeric) Number of calls\n"
+            "    \"errors\": n,            (numeric) Number of calls that returned an error\n"
+            "    \"total_us\": n,          (numeric) Sum of the durations in microseconds\n"
+            "    \"max_us\": n,            (numeric) Longest call, in microseconds\n"
+            "    \"lock_wait_us\": n,      (numeric) Time spent waiting for locks, in microseconds, counted only with -lockprofile\n"
+            "    \"p50_us\": n,            (numeric) Median, in microseconds\n"
+            "    \"p99_us\": n,            (numeric) 99th percentile, in microseconds\n"
+            "    \"histogram\": [          (array) Non-empty buckets\n"
+            "      [ n, n ],               (array) Durations below the first number of microseconds, and how many\n"
+            "      ...\n"
+            "    ]\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcstats", "")
+            + HelpExampleRpc("getrpcstats", "")
+        );
+
+    const std::map<std::string, CRPCMethodStats> mapStats = GetRPCStats();
+    UniValue ret(UniValue::VOBJ);
+    for (std::map<std::string, CRPCMethodStats>::const_iterator it = mapStats.begin(); it != mapStats.end(); ++it) {
+        const CRPCMethodStats& stats = it->second;
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("count", stats.nCount));
+        obj.push_back(Pair("errors", stats.nErrors));
+        obj.push_back(Pair("total_us", stats.nTotalMicros));
+        obj.push_back(Pair("max_us", stats.nMaxMicros));
+        obj.push_back(Pair("lock_wait_us", stats.nLockWaitMicros));
+        obj.push_back(Pair("p50_us", RPCPercentile(stats, 0.5)));
+        obj.push_back(Pair("p99_us", RPCPercentile(stats, 0.99)));
+        UniValue histogram(UniValue::VARR);
+        for (int i = 0; i < RPC_HISTOGRAM_BUCKETS; i++) {
+            if (stats.vBuckets[i] == 0)
+                continue;
+            UniValue bucket(UniValue::VARR);
+            bucket.push_back((uint64_t)1 << i);
+            bucket.push_back(stats.vBuckets[i]);
+            histogram.push_back(bucket);
+        }
+        obj.push_back(Pair("histogram", histogram));
+        ret.push_back(Pair(it->first, obj));
+    }
+    return ret;
+}
+
 /**
  * Call Table
  */
@@ -278,6 +650,10 @@ static const CRPCCommand vRPCCommands[] =
     /* Overall control/query calls */
     { "control",            "help",                   &help,                   true  },
     { "control",            "stop",                   &stop,                   true  },
+    { "control",            "submitjob",              &submitjob,              true  },
+    { "control",            "getjobresult",           &getjobresult,           true  },
+    { "control",            "canceljob",              &canceljob,              true  },
+    { "control",            "getrpcstats",            &getrpcstats,            true  },
 };
 
 CRPCTable::CRPCTable()
@@ -314,10 +690,30 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
     return true;
 }
 
+bool CRPCTable::appendStreamCommand(const std::string& name, const CRPCStreamCommand* pcmd)
+{
+    if (IsRPCRunning())
+        return false;
+
+    if (!mapCommands.count(name) || mapStreamCommands.count(name))
+        return false;
+
+    mapStreamCommands[name] = pcmd;
+    return true;
+}
+
 bool StartRPC()
 {
     LogPrint("rpc", "Starting RPC\n");
     fRPCRunning = true;
+    nRPCSlowCallMicros = GetArg("-rpcslowcall", DEFAULT_RPC_SLOW_CALL) * 1000;
+    {
+        boost::unique_lock<boost::mutex> lock(csRPCJobs);
+        fRPCJobsRunning = true;
+        int nThreads = std::max((int)GetArg("-rpcjobthreads", DEFAULT_RPC_JOB_THREADS), 1);
+        for (int i = 0; i < nThreads; i++)
+            vRPCJobThreads.push_back(threadGroupRPCJobs.create_thread(boost::bind(&RPCJobThread, (size_t)i)));
+    }
     g_rpcSignals.Started();
     return true;
 }
@@ -327,11 +723,29 @@ void InterruptRPC()
     LogPrint("rpc", "Interrupting RPC\n");
     // Interrupt e.g. running longpolls
     fRPCRunning = false;
+    {
+        boost::unique_lock<boost::mutex> lock(csRPCJobs);
+        fRPCJobsRunning = false;
+        condRPCJobQueued.notify_all();
+        condRPCJobFinished.notify_all();
+    }
+    threadGroupRPCJobs.interrupt_all();
 }
 
 void StopRPC()
 {
     LogPrint("rpc", "Stopping RPC\n");
+    threadGroupRPCJobs.join_all();
+    {
+        boost::unique_lock<boost::mutex> lock(csRPCJobs);
+        for (size_t i = 0; i < vRPCJobThreads.size(); i++)
+            threadGroupRPCJobs.remove_thread(vRPCJobThreads[i]);
+        for (size_t i = 0; i < vRPCJobThreads.size(); i++)
+            delete vRPCJobThreads[i];
+        vRPCJobThreads.clear();
+        mapRPCJobs.clear();
+        queueRPCJobs.clear();
+    }
     deadlineTimers.clear();
     g_rpcSignals.Stopped();
 }
@@ -392,7 +806,7 @@ void JSONRequest::parse(const UniValue& valRequest)
         throw JSONRPCError(RPC_INVALID_REQUEST, "Params must be an array");
 }
 
-static UniValue JSONRPCExecOne(const UniValue& req)
+UniValue JSONRPCExecOne(const UniValue& req)
 {
     UniValue rpc_result(UniValue::VOBJ);
 
@@ -425,7 +839,7 @@ std::string JSONRPCExecBatch(const UniValue& vReq)
     return ret.write() + "\n";
 }
 
-UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
+const CRPCCommand* CRPCTable::prepareCommand(const std::string &strMethod) const
 {
     // Return immediately if in warmup
     {
@@ -439,12 +853,48 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
     if (!pcmd)
         throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
 
+    // Let the wallet and other queued listeners catch up with validation, so
+    // that the call sees their state as of the current tip.
+    SyncWithValidationQueue();
+
     g_rpcSignals.PreCommand(*pcmd);
+    return pcmd;
+}
+
+UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
+{
+    const CRPCCommand *pcmd = prepareCommand(strMethod);
+    CRPCCallTimer timer(strMethod);
+
+    try
+    {
+        // Execute
+        UniValue result = pcmd->actor(params, false);
+        timer.fSucceeded = true;
+        return result;
+    }
+    catch (const std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+
+    g_rpcSignals.PostCommand(*pcmd);
+}
+
+void CRPCTable::execute(const std::string &strMethod, const UniValue &params, CJSONWriter& writer) const
+{
+    const CRPCCommand *pcmd = prepareCommand(strMethod);
+    map<string, const CRPCStreamCommand*>::const_iterator it = mapStreamCommands.find(strMethod);
+    CRPCCallTimer timer(strMethod);
 
     try
     {
         // Execute
-        return pcmd->actor(params, false);
+        if (it != mapStreamCommands.end())
+            it->second->streamActor(params, false, writer);
+        else
+            writer.Value(pcmd->actor(params, false));
+        timer.fSucceeded = true;
     }
     catch (const std::exception& e)
     {
@@ -14,6 +14,7 @@
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include <boost/function.hpp>
 
@@ -25,6 +26,7 @@
 extern boost::thread_specific_ptr<std::string> userInstance;
 
 class CRPCCommand;
+class CJSONWriter;
 
 namespace RPCServer
 {
@@ -37,6 +39,39 @@ namespace RPCServer
 class CBlockIndex;
 class CNetAddr;
 
+/** Default number of threads running RPC jobs submitted with submitjob */
+static const int DEFAULT_RPC_JOB_THREADS = 2;
+/** Seconds a finished RPC job's result is kept for getjobresult */
+static const int64_t RPC_JOB_EXPIRY = 15 * 60;
+/** Maximum number of RPC jobs, queued, running or finished, kept at once */
+static const size_t MAX_RPC_JOBS = 1000;
+/** Default threshold in milliseconds above which RPC calls are logged, 0 to log none */
+static const int64_t DEFAULT_RPC_SLOW_CALL = 10000;
+
+/**
+ * Latency histograms of RPC calls have a bucket per power of two
+ * microseconds: bucket i counts calls below 2^i us, the last one everything
+ * longer.
+ */
+static const int RPC_HISTOGRAM_BUCKETS = 32;
+
+/** The calls of one RPC method since startup */
+struct CRPCMethodStats
+{
+    uint64_t nCount;
+    uint64_t nErrors;
+    uint64_t nTotalMicros;
+    uint64_t nMaxMicros;
+    //! Time spent waiting for locks, measured only while lock profiling is on
+    uint64_t nLockWaitMicros;
+    std::vector<uint64_t> vBuckets;
+
+    CRPCMethodStats() : nCount(0), nErrors(0), nTotalMicros(0), nMaxMicros(0), nLockWaitMicros(0), vBuckets(RPC_HISTOGRAM_BUCKETS, 0) {}
+};
+
+/** Snapshot of the statistics of all RPC methods called so far */
+std::map<std::string, CRPCMethodStats> GetRPCStats();
+
 /** Wrapper for UniValue::VType, which includes typeAny:
  * Used to denote don't care type. Only used by RPCTypeCheckObj */
 struct UniValueType {
@@ -138,6 +173,20 @@ public:
     bool okSafeMode;
 };
 
+typedef void(*rpcstreamfn_type)(const UniValue& params, bool fHelp, CJSONWriter& writer);
+
+/**
+ * A command whose result can be written piece by piece, so that it need not
+ * be held in memory all at once. Its actor gets the same result by passing
+ * a CJSONTreeWriter to the stream actor.
+ */
+class CRPCStreamCommand
+{
+public:
+    std::string name;
+    rpcstreamfn_type streamActor;
+};
+
 /**
  * Bitcoin RPC command dispatcher.
  */
@@ -145,6 +194,9 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, const CRPCStreamCommand*> mapStreamCommands;
+
+    const CRPCCommand* prepareCommand(const std::string& method) const;
 public:
     CRPCTable();
     const CRPCCommand* operator[](const std::string& name) const;
@@ -159,6 +211,14 @@ public:
      */
     UniValue execute(const std::string &method, const UniValue &params) const;
 
+    /**
+     * Execute a method, writing its result to writer, piece by piece if the
+     * method has a stream actor.
+     * @throws an exception (UniValue) when an error happens, possibly after
+     * part of the result has been written.
+     */
+    void execute(const std::string &method, const UniValue &params, CJSONWriter& writer) const;
+
     /**
     * Returns a list of registered commands
     * @returns List of registered commands.
@@ -172,6 +232,11 @@ public:
      * Commands cannot be overwritten (returns false).
      */
     bool appendCommand(const std::string& name, const CRPCCommand* pcmd);
+
+    /**
+     * Adds a stream actor for a command appended with appendCommand.
+     */
+    bool appendStreamCommand(const std::string& name, const CRPCStreamCommand* pcmd);
 };
 
 extern CRPCTable tableRPC;
@@ -200,6 +265,8 @@ extern void EnsureWalletIsUnlocked();
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
+/** Execute a single call of a JSON-RPC batch, returning its reply object */
+UniValue JSONRPCExecOne(const UniValue& req);
 std::string JSONRPCExecBatch(const UniValue& vReq);
 
 #endif // BITCOIN_RPCSERVER_H
@@ -5,12 +5,14 @@
 #include "scheduler.h"
 
 #include "reverselock.h"
+#include "util.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <boost/bind.hpp>
 #include <utility>
 
-CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+CScheduler::CScheduler() : nThreadsServicingQueue(0), nLowPriorityRunning(0), stopRequested(false), stopWhenEmpty(false)
 {
 }
 
@@ -27,6 +29,37 @@ static boost::system_time toPosixTime(const boost::chrono::system_clock::time_po
 }
 #endif
 
+void CScheduler::waitUntil(boost::unique_lock<boost::mutex>& lock, boost::chrono::system_clock::time_point t)
+{
+// wait_until needs boost 1.50 or later; older versions have timed_wait:
+#if BOOST_VERSION < 105000
+    newTaskScheduled.timed_wait(lock, toPosixTime(t));
+#else
+    // Some boost versions have a conflicting overload of wait_until that returns void.
+    // Explicitly use a template here to avoid hitting that overload.
+    newTaskScheduled.wait_until<>(lock, t);
+#endif
+}
+
+CScheduler::TaskQueue::iterator CScheduler::nextTask(boost::chrono::system_clock::time_point now,
+                                                     boost::chrono::system_clock::time_point& next)
+{
+    const bool fLowAllowed = canRunLowPriority();
+    TaskQueue::iterator itBest = taskQueue.end();
+    next = boost::chrono::system_clock::time_point::max();
+    for (TaskQueue::iterator it = taskQueue.begin(); it != taskQueue.end(); ++it) {
+        if (it->second.priority == PRIORITY_LOW && !fLowAllowed)
+            continue;
+        if (it->first > now) {
+            next = it->first;
+            break;
+        }
+        if (itBest == taskQueue.end() || it->second.priority < itBest->second.priority)
+            itBest = it;
+    }
+    return itBest;
+}
+
 void CScheduler::serviceQueue()
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
@@ -41,37 +74,52 @@ void CScheduler::serviceQueue()
                 // Wait until there is something to do.
                 newTaskScheduled.wait(lock);
             }
+            if (shouldStop())
+                continue;
 
-            // Wait until either there is a new task, or until
-            // the time of the first item on the queue:
-
-// wait_until needs boost 1.50 or later; older versions have timed_wait:
-#if BOOST_VERSION < 105000
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.timed_wait(lock, toPosixTime(taskQueue.begin()->first))) {
-                // Keep waiting until timeout
-            }
-#else
-            // Some boost versions have a conflicting overload of wait_until that returns void.
-            // Explicitly use a template here to avoid hitting that overload.
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.wait_until<>(lock, taskQueue.begin()->first) != boost::cv_status::timeout) {
-                // Keep waiting until timeout
-            }
-#endif
-            // If there are multiple threads, the queue can empty while we're waiting (another
-            // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
+            // Wait until either there is a new task, a task finishes, or
+            // the time of the first task we may run. If there are multiple
+            // threads, another one may service the task we were waiting on.
+            boost::chrono::system_clock::time_point next;
+            TaskQueue::iterator itTask = nextTask(boost::chrono::system_clock::now(), next);
+            if (itTask == taskQueue.end()) {
+                if (next == boost::chrono::system_clock::time_point::max())
+                    newTaskScheduled.wait(lock);
+                else
+                    waitUntil(lock, next);
                 continue;
+            }
 
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
+            Task task = itTask->second;
+            taskQueue.erase(itTask);
+            const bool fLow = task.priority == PRIORITY_LOW;
+            if (fLow)
+                ++nLowPriorityRunning;
 
-            {
+            int64_t nMicros;
+            try {
                 // Unlock before calling f, so it can reschedule itself or another task
                 // without deadlocking:
                 reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
-                f();
+                const boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+                task.f();
+                nMicros = boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::steady_clock::now() - start).count();
+            } catch (...) {
+                if (fLow)
+                    --nLowPriorityRunning;
+                throw;
+            }
+            if (fLow) {
+                --nLowPriorityRunning;
+                // A thread may be waiting for a low priority task to finish.
+                newTaskScheduled.notify_all();
+            }
+            if (!task.strName.empty()) {
+                TaskStats& stats = mapTaskStats[task.strName];
+                stats.nRuns++;
+                stats.nTotalMicros += nMicros;
+                stats.nMaxMicros = std::max(stats.nMaxMicros, nMicros);
+                LogPrint("bench", "Scheduled task %s: %.2fms (%u runs, max %.2fms)\n", task.strName, nMicros * 0.001, stats.nRuns, stats.nMaxMicros * 0.001);
             }
         } catch (...) {
             --nThreadsServicingQueue;
@@ -94,29 +142,38 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t,
+                          CScheduler::Priority priority, const std::string& strName)
 {
     {
         boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        Task task;
+        task.f = f;
+        task.priority = priority;
+        task.strName = strName;
+        taskQueue.insert(std::make_pair(t, task));
     }
-    newTaskScheduled.notify_one();
+    // A thread waiting for a later task may not be the one to run this one.
+    newTaskScheduled.notify_all();
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds,
+                                 CScheduler::Priority priority, const std::string& strName)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds), priority, strName);
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds)
+static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds,
+                   CScheduler::Priority priority, const std::string& strName)
 {
     f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds), deltaSeconds);
+    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds, priority, strName), deltaSeconds, priority, strName);
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds,
+                               CScheduler::Priority priority, const std::string& strName)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds), deltaSeconds);
+    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds, priority, strName), deltaSeconds, priority, strName);
 }
 
 size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
@@ -130,3 +187,9 @@ size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
     }
     return result;
 }
+
+std::map<std::string, CScheduler::TaskStats> CScheduler::getTaskStats() const
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    return mapTaskStats;
+}
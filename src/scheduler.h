@@ -14,6 +14,9 @@
 #include <boost/chrono/chrono.hpp>
 #include <boost/thread.hpp>
 #include <map>
+#include <string>
+
+static const int DEFAULT_SCHEDULER_THREADS = 2;
 
 //
 // Simple class for background tasks that should be run
@@ -26,6 +29,10 @@
 // s->scheduleFromNow(boost::bind(Class::func, this, argument), 3);
 // boost::thread* t = new boost::thread(boost::bind(CScheduler::serviceQueue, s));
 //
+// Several threads may run serviceQueue. Of the tasks that are due, those of
+// higher priority run first, and low priority tasks (slow disk or network
+// jobs, say) never take up every thread, so they cannot hold up the rest.
+//
 // ... then at program shutdown, clean up the thread running serviceQueue:
 // t->interrupt();
 // t->join();
@@ -41,18 +48,37 @@ public:
 
     typedef boost::function<void(void)> Function;
 
-    // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    enum Priority {
+        PRIORITY_HIGH,
+        PRIORITY_NORMAL,
+        PRIORITY_LOW,
+    };
+
+    // How often a named task ran and for how long
+    struct TaskStats {
+        uint64_t nRuns;
+        int64_t nTotalMicros;
+        int64_t nMaxMicros;
+
+        TaskStats() : nRuns(0), nTotalMicros(0), nMaxMicros(0) {}
+    };
+
+    // Call func at/after time t. Tasks given a name have their
+    // runtimes recorded under it.
+    void schedule(Function f, boost::chrono::system_clock::time_point t,
+                  Priority priority = PRIORITY_NORMAL, const std::string& strName = "");
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaSeconds);
+    void scheduleFromNow(Function f, int64_t deltaSeconds,
+                         Priority priority = PRIORITY_NORMAL, const std::string& strName = "");
 
     // Another convenience method: call f approximately
     // every deltaSeconds forever, starting deltaSeconds from now.
     // To be more precise: every time f is finished, it
     // is rescheduled to run deltaSeconds later. If you
     // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaSeconds);
+    void scheduleEvery(Function f, int64_t deltaSeconds,
+                       Priority priority = PRIORITY_NORMAL, const std::string& strName = "");
 
     // To keep things as simple as possible, there is no unschedule.
 
@@ -70,14 +96,33 @@ public:
     size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
                         boost::chrono::system_clock::time_point &last) const;
 
+    // Returns the runtime statistics of the named tasks
+    std::map<std::string, TaskStats> getTaskStats() const;
+
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    struct Task {
+        Function f;
+        Priority priority;
+        std::string strName;
+    };
+    typedef std::multimap<boost::chrono::system_clock::time_point, Task> TaskQueue;
+
+    TaskQueue taskQueue;
+    std::map<std::string, TaskStats> mapTaskStats;
     boost::condition_variable newTaskScheduled;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
+    int nLowPriorityRunning;
     bool stopRequested;
     bool stopWhenEmpty;
     bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+    // Whether another thread may start a low priority task
+    bool canRunLowPriority() const { return nThreadsServicingQueue == 1 || nLowPriorityRunning < nThreadsServicingQueue - 1; }
+    // The due task to run next, or the end of the queue if there is none;
+    // otherwise sets next to when the next task we may run is due
+    TaskQueue::iterator nextTask(boost::chrono::system_clock::time_point now,
+                                 boost::chrono::system_clock::time_point& next);
+    void waitUntil(boost::unique_lock<boost::mutex>& lock, boost::chrono::system_clock::time_point t);
 };
 
 #endif
@@ -5,11 +5,17 @@
 
 #include "bitcoinconsensus.h"
 
+#include "eccontext.h"
 #include "primitives/transaction.h"
 #include "pubkey.h"
 #include "script/interpreter.h"
 #include "version.h"
 
+#include <atomic>
+#include <thread>
+
+#include <secp256k1_rangeproof.h>
+
 namespace {
 
 /** A class that deserializes a single CTransaction one time. */
@@ -47,6 +53,8 @@ public:
         return *this;
     }
 
+    size_t size() const { return m_remaining; }
+
 private:
     const int m_type;
     const int m_version;
@@ -67,6 +75,70 @@ struct ECCryptoClosure
 };
 
 ECCryptoClosure instance_of_eccryptoclosure;
+
+/**
+ * The amount checks of VerifyAmounts, against the outputs a transaction
+ * spends rather than a coins view: the commitments are tallied right away,
+ * and the blinded outputs that need their range proof checked are returned
+ * in vpRangeChecks.
+ */
+bool VerifyTransactionAmounts(const CTransaction& tx, const std::vector<CTxOut>& vSpent, std::vector<const CTxOutValue*>& vpRangeChecks)
+{
+    CAmount nPlainAmount = tx.nTxFee;
+    if (!MoneyRange(nPlainAmount))
+        return false;
+    std::vector<const unsigned char*> vpchCommitsIn, vpchCommitsOut;
+    bool fNullRangeproof = false;
+    if (!tx.IsCoinBase()) {
+        for (size_t i = 0; i < vSpent.size(); i++) {
+            const CTxOutValue& val = vSpent[i].nValue;
+            if (val.IsAmount()) {
+                nPlainAmount -= val.GetAmount();
+                if (!MoneyRange(val.GetAmount()) || (!MoneyRange(nPlainAmount) && !MoneyRange(-nPlainAmount)))
+                    return false;
+            } else {
+                if (val.vchCommitment.size() != CTxOutValue::nCommitmentSize)
+                    return false;
+                vpchCommitsIn.push_back(&val.vchCommitment[0]);
+            }
+        }
+    }
+    for (size_t i = 0; i < tx.vout.size(); i++) {
+        const CTxOutValue& val = tx.vout[i].nValue;
+        if (val.vchCommitment.size() != CTxOutValue::nCommitmentSize || val.vchNonceCommitment.size() > CTxOutValue::nCommitmentSize || val.vchRangeproof.size() > 5000)
+            return false;
+        if (val.IsAmount()) {
+            nPlainAmount += val.GetAmount();
+            if (!MoneyRange(val.GetAmount()) || (!MoneyRange(nPlainAmount) && !MoneyRange(-nPlainAmount)))
+                return false;
+        } else {
+            vpchCommitsOut.push_back(&val.vchCommitment[0]);
+            if (val.vchRangeproof.empty())
+                fNullRangeproof = true;
+        }
+    }
+
+    // If there are no encrypted input or output values, we can do simple math
+    if (vpchCommitsIn.empty() && vpchCommitsOut.empty())
+        return nPlainAmount == 0;
+    if (!secp256k1_pedersen_verify_tally(ECC_GetContext(), vpchCommitsIn.data(), vpchCommitsIn.size(), vpchCommitsOut.data(), vpchCommitsOut.size(), nPlainAmount))
+        return false;
+
+    // Rangeproof is optional in this case
+    if (!vpchCommitsIn.empty() && vpchCommitsOut.size() == 1 && nPlainAmount <= 0 && fNullRangeproof)
+        return true;
+    for (size_t i = 0; i < tx.vout.size(); i++) {
+        if (!tx.vout[i].nValue.IsAmount())
+            vpRangeChecks.push_back(&tx.vout[i].nValue);
+    }
+    return true;
+}
+
+bool VerifyRangeProof(const CTxOutValue& val)
+{
+    uint64_t min_value, max_value;
+    return secp256k1_rangeproof_verify(ECC_GetContext(), &min_value, &max_value, &val.vchCommitment[0], val.vchRangeproof.data(), val.vchRangeproof.size());
+}
 }
 
 static int verify_script(const unsigned char *scriptPubKey, unsigned int scriptPubKeyLen, CTxOutValue amount,
@@ -80,7 +152,7 @@ static int verify_script(const unsigned char *scriptPubKey, unsigned int scriptP
         stream >> tx;
         if (nIn >= tx.vin.size())
             return set_error(err, bitcoinconsensus_ERR_TX_INDEX);
-        if (tx.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION) != txToLen)
+        if (tx.GetTotalSize() != txToLen)
             return set_error(err, bitcoinconsensus_ERR_TX_SIZE_MISMATCH);
 
         // Regardless of the verification result, the tx did not error.
@@ -130,6 +202,67 @@ int bitcoinconsensus_verify_script(const unsigned char *scriptPubKey, unsigned i
     return ::verify_script(scriptPubKey, scriptPubKeyLen, am, prevInAm, txTo, txToLen, nIn, flags, err);
 }
 
+int bitcoinconsensus_verify_transaction(const unsigned char *spentOutputs, unsigned int spentOutputsLen,
+                                        const unsigned char *txTo        , unsigned int txToLen,
+                                        unsigned int flags, unsigned int nThreads, bitcoinconsensus_error* err)
+{
+    CTransaction tx;
+    std::vector<CTxOut> vSpent;
+    try {
+        TxInputStream stream(SER_NETWORK, PROTOCOL_VERSION, txTo, txToLen);
+        stream >> tx;
+        if (tx.GetTotalSize() != txToLen)
+            return set_error(err, bitcoinconsensus_ERR_TX_SIZE_MISMATCH);
+        TxInputStream streamSpent(SER_NETWORK, PROTOCOL_VERSION, spentOutputs, spentOutputsLen);
+        streamSpent >> vSpent;
+        if (streamSpent.size() != 0 || vSpent.size() != tx.vin.size())
+            return set_error(err, bitcoinconsensus_ERR_SPENT_OUTPUTS_MISMATCH);
+    } catch (const std::exception&) {
+        return set_error(err, bitcoinconsensus_ERR_TX_DESERIALIZE); // Error deserializing
+    }
+
+    // Regardless of the verification result, the tx did not error.
+    set_error(err, bitcoinconsensus_ERR_OK);
+    const unsigned int nScriptFlags = flags & ~bitcoinconsensus_VERIFY_AMOUNTS;
+    std::vector<const CTxOutValue*> vpRangeChecks;
+    if ((flags & bitcoinconsensus_VERIFY_AMOUNTS) && !VerifyTransactionAmounts(tx, vSpent, vpRangeChecks))
+        return 0;
+
+    // The inputs' script checks and the range proofs are taken in turn by
+    // as many threads as asked for, sharing one PrecomputedTransactionData.
+    const PrecomputedTransactionData txdata(tx);
+    const size_t nChecks = tx.vin.size() + vpRangeChecks.size();
+    std::atomic<size_t> nNext(0);
+    std::atomic<bool> fOk(true);
+    auto worker = [&]() {
+        for (size_t i = nNext++; i < nChecks && fOk; i = nNext++) {
+            bool fValid;
+            if (i < tx.vin.size()) {
+                // Withdraw locks look at the amount of the output spent by the previous input.
+                const CTxOutValue amountPreviousInput = (i > 0 && vSpent[i - 1].nValue.IsAmount()) ? vSpent[i - 1].nValue : CTxOutValue(-1);
+                const CScriptWitness* witness = i < tx.wit.vtxinwit.size() ? &tx.wit.vtxinwit[i].scriptWitness : NULL;
+                fValid = VerifyScript(tx.vin[i].scriptSig, vSpent[i].scriptPubKey, witness, nScriptFlags, TransactionSignatureChecker(&tx, i, vSpent[i].nValue, amountPreviousInput, txdata, CScript()), NULL);
+            } else {
+                fValid = VerifyRangeProof(*vpRangeChecks[i - tx.vin.size()]);
+            }
+            if (!fValid)
+                fOk = false;
+        }
+    };
+
+    std::vector<std::thread> vThreads;
+    try {
+        for (unsigned int t = 1; t < nThreads && t < nChecks; t++)
+            vThreads.push_back(std::thread(worker));
+    } catch (const std::exception&) {
+        // Whatever threads could not be started, the calling thread makes up for.
+    }
+    worker();
+    for (size_t t = 0; t < vThreads.size(); t++)
+        vThreads[t].join();
+    return fOk ? 1 : 0;
+}
+
 unsigned int bitcoinconsensus_version()
 {
     // Just use the API version for now
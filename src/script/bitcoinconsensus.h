@@ -35,7 +35,7 @@
 extern "C" {
 #endif
 
-#define BITCOINCONSENSUS_API_VER 1
+#define BITCOINCONSENSUS_API_VER 2
 
 typedef enum bitcoinconsensus_error_t
 {
@@ -44,6 +44,7 @@ typedef enum bitcoinconsensus_error_t
     bitcoinconsensus_ERR_TX_SIZE_MISMATCH,
     bitcoinconsensus_ERR_TX_DESERIALIZE,
     bitcoinconsensus_ERR_AMOUNT_REQUIRED,
+    bitcoinconsensus_ERR_SPENT_OUTPUTS_MISMATCH,
 } bitcoinconsensus_error;
 
 /** Script verification flags */
@@ -57,6 +58,7 @@ enum
     bitcoinconsensus_SCRIPT_FLAGS_VERIFY_CHECKSEQUENCEVERIFY = (1U << 10), // enable CHECKSEQUENCEVERIFY (BIP112)
     bitcoinconsensus_SCRIPT_FLAGS_VERIFY_WITNESS             = (1U << 11), // enable WITNESS (BIP141)
     bitcoinconsensus_SCRIPT_FLAGS_VERIFY_WITHDRAWS           = (1U << 13), // evaluate withdrawproof opcodes
+    bitcoinconsensus_VERIFY_AMOUNTS                          = (1U << 31), // bitcoinconsensus_verify_transaction only: check amounts and range proofs
 };
 
 /// Returns 1 if the input nIn of the serialized transaction pointed to by
@@ -73,6 +75,21 @@ EXPORT_SYMBOL int bitcoinconsensus_verify_script_with_amount(const unsigned char
                                     const unsigned char *txTo        , unsigned int txToLen,
                                     unsigned int nIn, unsigned int flags, bitcoinconsensus_error* err);
 
+/// Returns 1 if every input of the serialized transaction pointed to by txTo
+/// correctly spends the output it refers to under the constraints specified
+/// by flags. spentOutputs points to those outputs, serialized as a vector of
+/// transaction outputs (a compact size count followed by the outputs, in
+/// input order). The transaction is deserialized and its signature hash data
+/// precomputed once for all inputs, which are verified by up to nThreads
+/// threads; 0 or 1 verifies them on the calling thread.
+/// With bitcoinconsensus_VERIFY_AMOUNTS in flags, the amounts of the
+/// transaction must also balance and its blinded outputs carry valid range
+/// proofs, as for a transaction in a block.
+/// If not NULL, err will contain an error/success code for the operation
+EXPORT_SYMBOL int bitcoinconsensus_verify_transaction(const unsigned char *spentOutputs, unsigned int spentOutputsLen,
+                                                      const unsigned char *txTo        , unsigned int txToLen,
+                                                      unsigned int flags, unsigned int nThreads, bitcoinconsensus_error* err);
+
 EXPORT_SYMBOL unsigned int bitcoinconsensus_version();
 
 #ifdef __cplusplus
@@ -8,10 +8,13 @@
 #include <secp256k1.h>
 
 #include "primitives/transaction.h"
+#include "crypto/common.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/hmac_sha256.h"
+#include "eccontext.h"
+#include "hash.h"
 #include "merkleblock.h"
 #include "pow.h"
 #include "pubkey.h"
@@ -26,25 +29,15 @@
 #include "callrpc.h"
 #endif
 
+#include <map>
+#include <mutex>
+
 using namespace std;
 
 typedef vector<unsigned char> valtype;
 
 namespace {
 
-static secp256k1_context *secp256k1_ctx;
-
-class CSecp256k1Init {
-public:
-    CSecp256k1Init() {
-        secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY);
-    }
-    ~CSecp256k1Init() {
-        secp256k1_context_destroy(secp256k1_ctx);
-    }
-};
-static CSecp256k1Init instance_of_csecp256k1;
-
 inline bool set_success(ScriptError* ret)
 {
     if (ret)
@@ -271,7 +264,11 @@ bool static CheckMinimalPush(const valtype& data, opcodetype opcode) {
     return true;
 }
 
-bool static WithdrawProofReadStackItem(const vector<valtype>& stack, const bool fRequireMinimal, int *stackOffset, valtype& read)
+/**
+ * Find the pushes that a withdraw proof item was split into. The pushes are
+ * referenced in place; see WithdrawProofHashItem and WithdrawProofJoinItem.
+ */
+bool static WithdrawProofReadStackItem(const vector<valtype>& stack, const bool fRequireMinimal, int *stackOffset, vector<const valtype*>& read)
 {
     if (stack.size() < size_t(-(*stackOffset)))
         return false;
@@ -280,18 +277,391 @@ bool static WithdrawProofReadStackItem(const vector<valtype>& stack, const bool
         return false;
     (*stackOffset)--;
 
-    read.reserve(pushCount > 1 ? pushCount * 520 : 0);
+    read.reserve(pushCount);
     for (int i = pushCount - 1; i >= 0; i--) {
         if (i != 0 && stacktop((*stackOffset) - i).size() != 520)
             return false;
-        const valtype& stackElem = stacktop((*stackOffset) - i);
-        read.insert(read.end(), stackElem.begin(), stackElem.end());
+        read.push_back(&stacktop((*stackOffset) - i));
     }
     (*stackOffset) -= pushCount;
     return true;
 }
 
+/** Serialize the concatenation of the pushes, as a byte vector, into a hash. */
+void static WithdrawProofHashItem(CHashWriter& ss, const vector<const valtype*>& vpush)
+{
+    size_t nSize = 0;
+    for (size_t i = 0; i < vpush.size(); i++)
+        nSize += vpush[i]->size();
+    WriteCompactSize(ss, nSize);
+    for (size_t i = 0; i < vpush.size(); i++)
+        ss.write((const char*)begin_ptr(*vpush[i]), vpush[i]->size());
+}
+
+valtype static WithdrawProofJoinItem(const vector<const valtype*>& vpush)
+{
+    valtype ret;
+    ret.reserve(vpush.size() * 520);
+    for (size_t i = 0; i < vpush.size(); i++)
+        ret.insert(ret.end(), vpush[i]->begin(), vpush[i]->end());
+    return ret;
+}
+
+namespace {
+
+/**
+ * The parts of a withdraw proof which do not depend on the spending script:
+ * the bitcoin block the lock transaction was included in and that
+ * transaction's outputs.
+ */
+struct CWithdrawProof
+{
+    uint256 blockHash;
+    std::vector<CTxOut> vLockTxOut;
+};
+
+/**
+ * Remembers withdraw proofs whose merkle block passed CheckBitcoinProof and
+ * proves inclusion of exactly the given lock transaction, keyed by the hash
+ * of the serialized (merkle block, lock tx) pair. A proof is checked when its
+ * transaction enters the mempool and again when it is connected, and every
+ * input spending the same lock output carries it, so this saves decoding and
+ * checking it each time. Only valid proofs are stored.
+ */
+class CWithdrawProofCache
+{
+private:
+    static const size_t MAX_ENTRIES = 1024;
+
+    std::mutex cs;
+    std::map<uint256, CWithdrawProof> map;
+
+public:
+    bool Get(const uint256& key, CWithdrawProof& proof)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        std::map<uint256, CWithdrawProof>::const_iterator it = map.find(key);
+        if (it == map.end())
+            return false;
+        proof = it->second;
+        return true;
+    }
+
+    void Set(const uint256& key, const CWithdrawProof& proof)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (map.size() >= MAX_ENTRIES) {
+            // Keys are hashes, so the first one is as good as a random pick.
+            map.erase(map.begin());
+        }
+        map.insert(std::make_pair(key, proof));
+    }
+};
+
+CWithdrawProofCache withdrawProofCache;
+
+}
+
+bool static EvalWithdrawProofVerify(vector<valtype>& stack, unsigned int flags, const BaseSignatureChecker& checker, const bool fRequireMinimal, ScriptError* serror)
+{
+    // In the make-withdraw case, reads the following from the stack:
+    // 1. genesis block hash of the chain the withdraw is coming from
+    // 2. the index within the locking tx's outputs we are claiming
+    // 3. the locking tx itself (WithdrawProofReadStackItem)
+    // 4. the merkle block structure which contains the block in which
+    //    the locking transaction is present (WithdrawProofReadStackItem)
+    // 5. The contract which we are expected to send coins to
+    //
+    // In the combine-outputs case, reads the following from the stack:
+    // 1. genesis block hash of the chain the withdraw is coming from
+
+    if (flags & SCRIPT_VERIFY_WITHDRAW) {
+        if (stack.size() < 7 && stack.size() != 1)
+            return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
+
+        const valtype &vgenesisHash = stacktop(-1);
+        if (vgenesisHash.size() != 32)
+            return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_FORMAT);
+
+        assert(checker.GetValueIn() != -1); // Not using a NoWithdrawSignatureChecker
+
+        CScript relockScript = CScript() << vgenesisHash << OP_WITHDRAWPROOFVERIFY;
+
+        if (stack.size() == 1) { // increasing value of locked coins
+            if (!checker.GetValueIn().IsAmount())
+                return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLINDED_AMOUNTS);
+            CAmount minValue = checker.GetValueIn().GetAmount();
+            CTxOut newOutput = checker.GetOutputOffsetFromCurrent(0);
+            if (newOutput.IsNull()) {
+                newOutput = checker.GetOutputOffsetFromCurrent(-1);
+                if (!checker.GetValueInPrevIn().IsAmount())
+                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLINDED_AMOUNTS);
+                minValue += checker.GetValueInPrevIn().GetAmount();
+            }
+            if (!newOutput.nValue.IsAmount())
+                return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLINDED_AMOUNTS);
+            if (newOutput.scriptPubKey != relockScript || newOutput.nValue.GetAmount() < minValue)
+                return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_OUTPUT);
+        } else { // stack.size() >= 7...ie regular withdraw
+            int stackReadPos = -2;
+
+            const valtype &vlockTxOutIndex = stacktop(stackReadPos--);
+
+            vector<const valtype*> vlockTxPushes;
+            if (!WithdrawProofReadStackItem(stack, fRequireMinimal, &stackReadPos, vlockTxPushes))
+                return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
+
+            vector<const valtype*> vmerkleBlockPushes;
+            if (!WithdrawProofReadStackItem(stack, fRequireMinimal, &stackReadPos, vmerkleBlockPushes))
+                return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
+
+            if (stack.size() < size_t(-stackReadPos))
+                return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
+            const valtype& vcontract = stacktop(stackReadPos--);
+
+            uint256 genesishash(vgenesisHash);
+
+            try {
+                // The proof is only joined into contiguous buffers when it has to be decoded
+                CHashWriter ssProof(SER_GETHASH, 0);
+                WithdrawProofHashItem(ssProof, vmerkleBlockPushes);
+                WithdrawProofHashItem(ssProof, vlockTxPushes);
+                const uint256 proofHash = ssProof.GetHash();
+                CWithdrawProof proof;
+                if (!withdrawProofCache.Get(proofHash, proof)) {
+                    const valtype vmerkleBlock = WithdrawProofJoinItem(vmerkleBlockPushes);
+                    CMerkleBlock merkleBlock;
+                    CDataStream merkleBlockStream(vmerkleBlock, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX);
+                    merkleBlockStream >> merkleBlock;
+                    if (!merkleBlockStream.empty() || !CheckBitcoinProof(merkleBlock.header))
+                        return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLOCK);
+
+                    vector<uint256> txHashes;
+                    vector<unsigned int> txIndices;
+                    if (merkleBlock.txn.ExtractMatches(txHashes, txIndices) != merkleBlock.header.hashMerkleRoot || txHashes.size() != 1)
+                        return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLOCK);
+
+                    const valtype vlockTx = WithdrawProofJoinItem(vlockTxPushes);
+                    CTransaction locktx;
+                    CDataStream locktxStream(vlockTx, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX);
+                    locktxStream >> locktx;
+                    if (!locktxStream.empty())
+                        return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_LOCKTX);
+
+                    if (locktx.GetHash() != txHashes[0])
+                        return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_LOCKTX);
+
+                    proof.blockHash = merkleBlock.header.GetHash();
+                    proof.vLockTxOut = locktx.vout;
+                    withdrawProofCache.Set(proofHash, proof);
+                }
+
+                // We disallow returns from the genesis block, allowing sidechains to
+                // make genesis outputs spendable with a 21m initially-locked-to-btc
+                // distributing transaction.
+                if (proof.blockHash == genesishash)
+                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLOCK);
+
+                int nlocktxOut = CScriptNum(vlockTxOutIndex, fRequireMinimal).getint();
+                if (nlocktxOut < 0 || (unsigned int)nlocktxOut >= proof.vLockTxOut.size())
+                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_LOCKTX);
+                const CTxOut& lockTxOut = proof.vLockTxOut[nlocktxOut];
+
+                if (vcontract.size() != 40)
+                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_FORMAT);
+
+                opcodetype opcodeTmp;
+                CScript scriptDestination = checker.GetFedpegScript();
+                {
+                    CScript::iterator sdpc = scriptDestination.begin();
+                    vector<unsigned char> vch;
+                    while (scriptDestination.GetOp(sdpc, opcodeTmp, vch))
+                    {
+                        assert((vch.size() == 33 && opcodeTmp < OP_PUSHDATA4) ||
+                               (opcodeTmp <= OP_16 && opcodeTmp >= OP_1) || opcodeTmp == OP_CHECKMULTISIG);
+                        if (vch.size() == 33)
+                        {
+                            unsigned char tweak[32];
+                            size_t pub_len = 33;
+                            unsigned char *pub_start = &(*(sdpc - pub_len));
+                            CHMAC_SHA256(pub_start, pub_len).Write(&vcontract[0], 40).Finalize(tweak);
+                            secp256k1_pubkey pubkey;
+                            assert(secp256k1_ec_pubkey_parse(ECC_GetContext(), &pubkey, pub_start, pub_len) == 1);
+                            // If someone creates a tweak that makes this fail, they broke SHA256
+                            assert(secp256k1_ec_pubkey_tweak_add(ECC_GetContext(), &pubkey, tweak) == 1);
+                            assert(secp256k1_ec_pubkey_serialize(ECC_GetContext(), pub_start, &pub_len, &pubkey, SECP256K1_EC_COMPRESSED) == 1);
+                            assert(pub_len == 33);
+                        }
+                    }
+                }
+
+                CScriptID expectedP2SH(scriptDestination);
+                if (lockTxOut.scriptPubKey != GetScriptForDestination(expectedP2SH))
+                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_OUTPUT_SCRIPTDEST);
+
+                // Past the tweak only the type (bytes 0 to 4) and the destination
+                // (bytes 20 to 40) matter; bytes 4 to 20 are the nonce.
+
+                // We check values by doing the following:
+                // * Tx must relock at least <unlocked coins> - <locked-on-bitcoin coins>
+                // * Tx must send at least the withdraw value to its P2SH withdraw, but may send more
+                assert(lockTxOut.nValue.IsAmount()); // Its a SERIALIZE_BITCOIN_BLOCK_OR_TX
+                CAmount withdrawVal = lockTxOut.nValue.GetAmount();
+                if (!checker.GetValueIn().IsAmount()) // Heh, you just destroyed coins
+                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLINDED_AMOUNTS);
+
+                CAmount lockValueRequired = checker.GetValueIn().GetAmount() - withdrawVal;
+                if (lockValueRequired > 0) {
+                    const CTxOut newLockOutput = checker.GetOutputOffsetFromCurrent(1);
+                    if (!newLockOutput.nValue.IsAmount())
+                        return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLINDED_AMOUNTS);
+                    if (newLockOutput.IsNull() || newLockOutput.scriptPubKey != relockScript || newLockOutput.nValue.GetAmount() < lockValueRequired)
+                        return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_RELOCK_SCRIPTVAL);
+                }
+
+                const CTxOut withdrawOutput = checker.GetOutputOffsetFromCurrent(0);
+                if (!withdrawOutput.nValue.IsAmount())
+                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLINDED_AMOUNTS);
+                if (withdrawOutput.nValue.GetAmount() < withdrawVal)
+                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_OUTPUT_VAL);
+
+                CScript expectedWithdrawScriptPubKey;
+                if (vcontract[0] == 'P' && vcontract[1] == '2' && vcontract[2] == 'S' && vcontract[3] == 'H')
+                    expectedWithdrawScriptPubKey = CScript() << OP_HASH160 << std::vector<unsigned char>(vcontract.begin() + 20, vcontract.begin() + 40) << OP_EQUAL;
+                else if (vcontract[0] == 'P' && vcontract[1] == '2' && vcontract[2] == 'P' && vcontract[3] == 'H')
+                    expectedWithdrawScriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(vcontract.begin() + 20, vcontract.begin() + 40) << OP_EQUALVERIFY << OP_CHECKSIG;
+                else
+                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_FORMAT);
+
+                if (withdrawOutput.scriptPubKey != expectedWithdrawScriptPubKey)
+                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_OUTPUT_SCRIPT);
+
+#ifndef BITCOIN_SCRIPT_NO_CALLRPC
+                if (GetBoolArg("-validatepegin", false) && !checker.IsConfirmedBitcoinBlock(genesishash, proof.blockHash, flags & SCRIPT_VERIFY_INCREASE_CONFIRMATIONS_REQUIRED))
+                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLOCKCONFIRMED);
+#endif
+            } catch (std::exception& e) {
+                // Probably invalid encoding of something which was deserialized
+                return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_FORMAT);
+            }
+        }
+    } // else...OP_NOP3
+    return true;
+}
+
+/**
+ * Specialized evaluation of the most common scripts. These give exactly the
+ * result and error of running the opcode loop over the same stack, without
+ * decoding opcodes or copying stack items.
+ */
+
+/** OP_DUP OP_HASH160 <20-byte hash> OP_EQUALVERIFY OP_CHECKSIG, also run by P2WPKH programs */
+/**
+ * The draw of OP_DETERMINISTICRANDOM from vchSeed, in [0, nModulus): little
+ * endian 64 bit words are taken, three per hash, from SHA256(seed || counter)
+ * with a little endian 64 bit counter, and those above the largest multiple
+ * of nModulus are rejected so that every value is equally likely. The seed is
+ * hashed once, and the words are read straight out of the digest.
+ */
+uint64_t static DeterministicRandom(const valtype& vchSeed, uint64_t nModulus)
+{
+    const uint64_t nRange = (std::numeric_limits<uint64_t>::max() / nModulus) * nModulus;
+    CSHA256 hasher;
+    hasher.Write(begin_ptr(vchSeed), vchSeed.size());
+    unsigned char counter[8];
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    for (uint64_t nCounter = 0; ; nCounter++) {
+        WriteLE64(counter, nCounter);
+        CSHA256(hasher).Write(counter, sizeof(counter)).Finalize(hash);
+        for (int i = 0; i < 3; i++) {
+            const uint64_t nRand = ReadLE64(hash + 8 * i);
+            if (nRand <= nRange)
+                return nRand % nModulus;
+        }
+    }
+}
+
+bool static IsPayToPubKeyHashTemplate(const CScript& script)
+{
+    return script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+           script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG;
+}
+
+bool static EvalPayToPubKeyHash(vector<valtype>& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
+{
+    if (stack.size() < 1)
+        return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
+    // OP_DUP and the hash push each grow the stack by one before OP_EQUALVERIFY
+    if (stack.size() + 2 > 1000)
+        return set_error(serror, SCRIPT_ERR_STACK_SIZE);
+
+    const valtype& vchPubKey = stacktop(-1);
+    unsigned char vchHash[20];
+    CHash160().Write(begin_ptr(vchPubKey), vchPubKey.size()).Finalize(vchHash);
+    if (memcmp(vchHash, &script[3], sizeof(vchHash)) != 0)
+        return set_error(serror, SCRIPT_ERR_EQUALVERIFY);
+
+    if (stack.size() < 2)
+        return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
+    const valtype& vchSig = stacktop(-2);
+
+    CScript scriptCode(script.begin(), script.end());
+    if (sigversion == SIGVERSION_BASE) {
+        scriptCode.FindAndDelete(CScript(vchSig));
+    }
+
+    if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, sigversion, serror)) {
+        //serror is set
+        return false;
+    }
+    bool fSuccess = checker.CheckSig(vchSig, vchPubKey, scriptCode, sigversion);
+
+    if (!fSuccess && (flags & SCRIPT_VERIFY_NULLFAIL) && vchSig.size())
+        return set_error(serror, SCRIPT_ERR_SIG_NULLFAIL);
+
+    popstack(stack);
+    popstack(stack);
+    stack.push_back(fSuccess ? valtype(1, 1) : valtype());
+    return set_success(serror);
+}
+
+/** [<24-byte destination> OP_DROP] <32-byte genesis hash> OP_WITHDRAWPROOFVERIFY */
+bool static IsWithdrawLockTemplate(const CScript& script)
+{
+    size_t nOffset = 0;
+    if (script.size() == 60 && script[0] == 24 && script[25] == OP_DROP)
+        nOffset = 26;
+    return script.size() == nOffset + 34 && script[nOffset] == 32 && script[nOffset + 33] == OP_WITHDRAWPROOFVERIFY;
+}
+
+bool static EvalWithdrawLock(vector<valtype>& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+{
+    // The destination, if any, is pushed and dropped again
+    if (stack.size() + 1 > 1000)
+        return set_error(serror, SCRIPT_ERR_STACK_SIZE);
+    stack.push_back(valtype(script.end() - 33, script.end() - 1));
+    if (!EvalWithdrawProofVerify(stack, flags, checker, (flags & SCRIPT_VERIFY_MINIMALDATA) != 0, serror))
+        return false;
+    return set_success(serror);
+}
+
 bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
+{
+    try
+    {
+        if (IsPayToPubKeyHashTemplate(script))
+            return EvalPayToPubKeyHash(stack, script, flags, checker, sigversion, serror);
+        if (IsWithdrawLockTemplate(script))
+            return EvalWithdrawLock(stack, script, flags, checker, serror);
+    }
+    catch (...)
+    {
+        return set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
+    }
+    return EvalScriptGeneric(stack, script, flags, checker, sigversion, serror);
+}
+
+bool EvalScriptGeneric(vector<vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
 {
     static const CScriptNum bnZero(0);
     static const CScriptNum bnOne(1);
@@ -570,8 +940,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     valtype vch1 = stacktop(-2);
                     valtype vch2 = stacktop(-1);
-                    stack.push_back(vch1);
-                    stack.push_back(vch2);
+                    stack.push_back(std::move(vch1));
+                    stack.push_back(std::move(vch2));
                 }
                 break;
 
@@ -583,9 +953,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     valtype vch1 = stacktop(-3);
                     valtype vch2 = stacktop(-2);
                     valtype vch3 = stacktop(-1);
-                    stack.push_back(vch1);
-                    stack.push_back(vch2);
-                    stack.push_back(vch3);
+                    stack.push_back(std::move(vch1));
+                    stack.push_back(std::move(vch2));
+                    stack.push_back(std::move(vch3));
                 }
                 break;
 
@@ -596,8 +966,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     valtype vch1 = stacktop(-4);
                     valtype vch2 = stacktop(-3);
-                    stack.push_back(vch1);
-                    stack.push_back(vch2);
+                    stack.push_back(std::move(vch1));
+                    stack.push_back(std::move(vch2));
                 }
                 break;
 
@@ -606,11 +976,11 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 x3 x4 x5 x6 -- x3 x4 x5 x6 x1 x2)
                     if (stack.size() < 6)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-6);
-                    valtype vch2 = stacktop(-5);
+                    valtype vch1 = std::move(stacktop(-6));
+                    valtype vch2 = std::move(stacktop(-5));
                     stack.erase(stack.end()-6, stack.end()-4);
-                    stack.push_back(vch1);
-                    stack.push_back(vch2);
+                    stack.push_back(std::move(vch1));
+                    stack.push_back(std::move(vch2));
                 }
                 break;
 
@@ -629,9 +999,10 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x - 0 | x x)
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-1);
-                    if (CastToBool(vch))
-                        stack.push_back(vch);
+                    if (CastToBool(stacktop(-1))) {
+                        valtype vch = stacktop(-1);
+                        stack.push_back(std::move(vch));
+                    }
                 }
                 break;
 
@@ -658,7 +1029,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     valtype vch = stacktop(-1);
-                    stack.push_back(vch);
+                    stack.push_back(std::move(vch));
                 }
                 break;
 
@@ -677,7 +1048,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     valtype vch = stacktop(-2);
-                    stack.push_back(vch);
+                    stack.push_back(std::move(vch));
                 }
                 break;
 
@@ -692,10 +1063,14 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     popstack(stack);
                     if (n < 0 || n >= (int)stack.size())
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-n-1);
-                    if (opcode == OP_ROLL)
+                    valtype vch;
+                    if (opcode == OP_ROLL) {
+                        vch = std::move(stacktop(-n-1));
                         stack.erase(stack.end()-n-1);
-                    stack.push_back(vch);
+                    } else {
+                        vch = stacktop(-n-1);
+                    }
+                    stack.push_back(std::move(vch));
                 }
                 break;
 
@@ -726,7 +1101,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     valtype vch = stacktop(-1);
-                    stack.insert(stack.end()-2, vch);
+                    stack.insert(stack.end()-2, std::move(vch));
                 }
                 break;
 
@@ -734,20 +1109,15 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                 {
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-2);
-                    valtype vch2 = stacktop(-1);
+                    valtype& vch1 = stacktop(-2);
+                    const valtype& vch2 = stacktop(-1);
 
                     if (vch1.size() + vch2.size() > MAX_SCRIPT_ELEMENT_SIZE)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
 
-                    valtype vch3;
-                    vch3.reserve(vch1.size() + vch2.size());
-                    vch3.insert(vch3.end(), vch1.begin(), vch1.end());
-                    vch3.insert(vch3.end(), vch2.begin(), vch2.end());
-
-                    popstack(stack);
+                    // Append in place; x1 is kept, x2 is dropped
+                    vch1.insert(vch1.end(), vch2.begin(), vch2.end());
                     popstack(stack);
-                    stack.push_back(vch3);
                 }
                 break;
 
@@ -770,7 +1140,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
 
-                    valtype vch1 = stacktop(-2);
+                    const valtype& vch1 = stacktop(-2);
                     CScriptNum start(stacktop(-1), fRequireMinimal);
 
                     if (start < 0)
@@ -802,7 +1172,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     }
                     popstack(stack);
                     popstack(stack);
-                    stack.push_back(vch2);
+                    stack.push_back(std::move(vch2));
                 }
                 break;
 
@@ -812,7 +1182,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     if (stack.size() < 3)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
 
-                    valtype vch1 = stacktop(-3);
+                    const valtype& vch1 = stacktop(-3);
                     CScriptNum start(stacktop(-2), fRequireMinimal);
                     CScriptNum length(stacktop(-1), fRequireMinimal);
 
@@ -858,7 +1228,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     popstack(stack);
                     popstack(stack);
                     popstack(stack);
-                    stack.push_back(vch2);
+                    stack.push_back(std::move(vch2));
                 }
                 break;
 
@@ -869,7 +1239,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                 {
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-2);
+                    const valtype& vch1 = stacktop(-2);
                     CScriptNum bn(stacktop(-1), fRequireMinimal);
 
                     if (bn < 0)
@@ -900,7 +1270,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
 
                     popstack(stack);
                     popstack(stack);
-                    stack.push_back(vch2);
+                    stack.push_back(std::move(vch2));
                 }
                 break;
 
@@ -908,7 +1278,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                 {
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-2);
+                    const valtype& vch1 = stacktop(-2);
                     CScriptNum bn(stacktop(-1), fRequireMinimal);
 
                     if (bn < 0)
@@ -938,7 +1308,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
 
                     popstack(stack);
                     popstack(stack);
-                    stack.push_back(vch2);
+                    stack.push_back(std::move(vch2));
                 }
                 break;
 
@@ -962,12 +1332,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     if (vch1.size() != vch2.size())
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
 
-                    valtype vch3(vch1);
                     for (size_t i = 0; i < vch1.size(); i++)
-                        vch3[i] &= vch2[i];
-                    popstack(stack);
+                        vch2[i] &= vch1[i];
                     popstack(stack);
-                    stack.push_back(vch3);
                 }
                 break;
 
@@ -981,12 +1348,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     if (vch1.size() != vch2.size())
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
 
-                    valtype vch3(vch1);
                     for (size_t i = 0; i < vch1.size(); i++)
-                        vch3[i] |= vch2[i];
+                        vch2[i] |= vch1[i];
                     popstack(stack);
-                    popstack(stack);
-                    stack.push_back(vch3);
                 }
                 break;
 
@@ -1000,12 +1364,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     if (vch1.size() != vch2.size())
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
 
-                    valtype vch3(vch1);
                     for (size_t i = 0; i < vch1.size(); i++)
-                        vch3[i] ^= vch2[i];
-                    popstack(stack);
+                        vch2[i] ^= vch1[i];
                     popstack(stack);
-                    stack.push_back(vch3);
                 }
                 break;
 
@@ -1166,7 +1527,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     else if (opcode == OP_HASH256)
                         CHash256().Write(begin_ptr(vch), vch.size()).Finalize(begin_ptr(vchHash));
                     popstack(stack);
-                    stack.push_back(vchHash);
+                    stack.push_back(std::move(vchHash));
                 }
                 break;                                   
 
@@ -1342,12 +1703,10 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                         return false;
                     }
 
-                    valtype vchHash(32);
-                    CSHA256().Write(begin_ptr(vchData), vchData.size()).Finalize(begin_ptr(vchHash));
-                    uint256 hash(vchHash);
+                    uint256 hash;
+                    CSHA256().Write(begin_ptr(vchData), vchData.size()).Finalize(hash.begin());
 
-                    CPubKey pubkey(vchPubKey);
-                    bool fSuccess = pubkey.Verify(hash, vchSig);
+                    bool fSuccess = checker.CheckSigFromStack(vchSig, vchPubKey, hash);
 
                     popstack(stack);
                     popstack(stack);
@@ -1366,7 +1725,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     if (stack.size() < 3)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
 
-                    valtype vchSeed = stacktop(-3);
+                    const valtype& vchSeed = stacktop(-3);
                     CScriptNum bnMin(stacktop(-2), fRequireMinimal);
                     CScriptNum bnMax(stacktop(-1), fRequireMinimal);
 
@@ -1381,210 +1740,20 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                         break;
                     }
 
-                    // The range of the random source must be a multiple of the modulus
-                    // to give every possible output value an equal possibility
-                    uint64_t nMax = (bnMax-bnMin).getint();
-                    uint64_t nRange = (std::numeric_limits<uint64_t>::max() / nMax) * nMax;
-                    uint64_t nRand;
-
-                    valtype vchHash(32, 0);
-                    uint64_t nCounter = 0;
-                    int nHashIndex = 3;
-                    CSHA256 hasher;
-                    hasher.Write(begin_ptr(vchSeed), vchSeed.size());
-                    do {
-                        if (nHashIndex >= 3) {
-                            //TODO this isn't endian safe
-                            CSHA256(hasher).Write((const unsigned char*)&nCounter, sizeof(nCounter)).Finalize(begin_ptr(vchHash));
-                            nHashIndex = 0;
-                            nCounter++;
-                        }
-
-                        nRand = 0;
-                        for (size_t i=0; i<8; ++i)
-                            nRand |= ((uint64_t)vchHash[(nHashIndex*8) + i]) << (8*i);
+                    // The modulus is capped at INT_MAX, as CScriptNum::getint does.
+                    const uint64_t nModulus = (bnMax - bnMin).getint();
+                    const int64_t nResult = bnMin.getint() + (int64_t)DeterministicRandom(vchSeed, nModulus);
 
-                        nHashIndex++;
-                    } while (nRand > nRange);
-                    CScriptNum result(nRand % nMax);
-                    result += bnMin.getint();
-
-                    popstack(stack);
                     popstack(stack);
                     popstack(stack);
-                    stack.push_back(result.getvch());
+                    stacktop(-1) = CScriptNum::serialize(nResult);
                  }
                  break;
 
                 case OP_WITHDRAWPROOFVERIFY:
                 {
-                    // In the make-withdraw case, reads the following from the stack:
-                    // 1. genesis block hash of the chain the withdraw is coming from
-                    // 2. the index within the locking tx's outputs we are claiming
-                    // 3. the locking tx itself (WithdrawProofReadStackItem)
-                    // 4. the merkle block structure which contains the block in which
-                    //    the locking transaction is present (WithdrawProofReadStackItem)
-                    // 5. The contract which we are expected to send coins to
-                    //
-                    // In the combine-outputs case, reads the following from the stack:
-                    // 1. genesis block hash of the chain the withdraw is coming from
-
-                    if (flags & SCRIPT_VERIFY_WITHDRAW) {
-                        if (stack.size() < 7 && stack.size() != 1)
-                            return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-
-                        const valtype &vgenesisHash = stacktop(-1);
-                        if (vgenesisHash.size() != 32)
-                            return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_FORMAT);
-
-                        assert(checker.GetValueIn() != -1); // Not using a NoWithdrawSignatureChecker
-
-                        CScript relockScript = CScript() << vgenesisHash << OP_WITHDRAWPROOFVERIFY;
-
-                        if (stack.size() == 1) { // increasing value of locked coins
-                            if (!checker.GetValueIn().IsAmount())
-                                return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLINDED_AMOUNTS);
-                            CAmount minValue = checker.GetValueIn().GetAmount();
-                            CTxOut newOutput = checker.GetOutputOffsetFromCurrent(0);
-                            if (newOutput.IsNull()) {
-                                newOutput = checker.GetOutputOffsetFromCurrent(-1);
-                                if (!checker.GetValueInPrevIn().IsAmount())
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLINDED_AMOUNTS);
-                                minValue += checker.GetValueInPrevIn().GetAmount();
-                            }
-                            if (!newOutput.nValue.IsAmount())
-                                return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLINDED_AMOUNTS);
-                            if (newOutput.scriptPubKey != relockScript || newOutput.nValue.GetAmount() < minValue)
-                                return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_OUTPUT);
-                        } else { // stack.size() >= 7...ie regular withdraw
-                            int stackReadPos = -2;
-
-                            const valtype &vlockTxOutIndex = stacktop(stackReadPos--);
-
-                            valtype vlockTx;
-                            if (!WithdrawProofReadStackItem(stack, fRequireMinimal, &stackReadPos, vlockTx))
-                                return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-
-                            valtype vmerkleBlock;
-                            if (!WithdrawProofReadStackItem(stack, fRequireMinimal, &stackReadPos, vmerkleBlock))
-                                return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-
-                            if (stack.size() < size_t(-stackReadPos))
-                                return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                            valtype vcontract = std::vector<unsigned char>(stacktop(stackReadPos--));
-
-                            uint256 genesishash(vgenesisHash);
-
-                            try {
-                                CMerkleBlock merkleBlock;
-                                CDataStream merkleBlockStream(vmerkleBlock, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX);
-                                merkleBlockStream >> merkleBlock;
-                                if (!merkleBlockStream.empty() || !CheckBitcoinProof(merkleBlock.header))
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLOCK);
-
-                                vector<uint256> txHashes;
-                                vector<unsigned int> txIndices;
-                                if (merkleBlock.txn.ExtractMatches(txHashes, txIndices) != merkleBlock.header.hashMerkleRoot || txHashes.size() != 1)
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLOCK);
-
-                                // We disallow returns from the genesis block, allowing sidechains to
-                                // make genesis outputs spendable with a 21m initially-locked-to-btc
-                                // distributing transaction.
-                                if (merkleBlock.header.GetHash() == genesishash)
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLOCK);
-
-                                CTransaction locktx;
-                                CDataStream locktxStream(vlockTx, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX);
-                                locktxStream >> locktx;
-                                if (!locktxStream.empty())
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_LOCKTX);
-
-                                int nlocktxOut = CScriptNum(vlockTxOutIndex, fRequireMinimal).getint();
-                                if (nlocktxOut < 0 || (unsigned int)nlocktxOut >= locktx.vout.size())
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_LOCKTX);
-
-                                if (locktx.GetHash() != txHashes[0])
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_LOCKTX);
-
-                                if (vcontract.size() != 40)
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_FORMAT);
-
-                                opcodetype opcodeTmp;
-                                CScript scriptDestination = checker.GetFedpegScript();
-                                {
-                                    CScript::iterator sdpc = scriptDestination.begin();
-                                    vector<unsigned char> vch;
-                                    while (scriptDestination.GetOp(sdpc, opcodeTmp, vch))
-                                    {
-                                        assert((vch.size() == 33 && opcodeTmp < OP_PUSHDATA4) ||
-                                               (opcodeTmp <= OP_16 && opcodeTmp >= OP_1) || opcodeTmp == OP_CHECKMULTISIG);
-                                        if (vch.size() == 33)
-                                        {
-                                            unsigned char tweak[32];
-                                            size_t pub_len = 33;
-                                            unsigned char *pub_start = &(*(sdpc - pub_len));
-                                            CHMAC_SHA256(pub_start, pub_len).Write(&vcontract[0], 40).Finalize(tweak);
-                                            secp256k1_pubkey pubkey;
-                                            assert(secp256k1_ec_pubkey_parse(secp256k1_ctx, &pubkey, pub_start, pub_len) == 1);
-                                            // If someone creates a tweak that makes this fail, they broke SHA256
-                                            assert(secp256k1_ec_pubkey_tweak_add(secp256k1_ctx, &pubkey, tweak) == 1);
-                                            assert(secp256k1_ec_pubkey_serialize(secp256k1_ctx, pub_start, &pub_len, &pubkey, SECP256K1_EC_COMPRESSED) == 1);
-                                            assert(pub_len == 33);
-                                        }
-                                    }
-                                }
-
-                                CScriptID expectedP2SH(scriptDestination);
-                                if (locktx.vout[nlocktxOut].scriptPubKey != GetScriptForDestination(expectedP2SH))
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_OUTPUT_SCRIPTDEST);
-
-                                vcontract.erase(vcontract.begin() + 4, vcontract.begin() + 20); // Remove the nonce from the contract before further processing
-                                assert(vcontract.size() == 24);
-
-                                // We check values by doing the following:
-                                // * Tx must relock at least <unlocked coins> - <locked-on-bitcoin coins>
-                                // * Tx must send at least the withdraw value to its P2SH withdraw, but may send more
-                                assert(locktx.vout[nlocktxOut].nValue.IsAmount()); // Its a SERIALIZE_BITCOIN_BLOCK_OR_TX
-                                CAmount withdrawVal = locktx.vout[nlocktxOut].nValue.GetAmount();
-                                if (!checker.GetValueIn().IsAmount()) // Heh, you just destroyed coins
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLINDED_AMOUNTS);
-
-                                CAmount lockValueRequired = checker.GetValueIn().GetAmount() - withdrawVal;
-                                if (lockValueRequired > 0) {
-                                    const CTxOut newLockOutput = checker.GetOutputOffsetFromCurrent(1);
-                                    if (!newLockOutput.nValue.IsAmount())
-                                        return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLINDED_AMOUNTS);
-                                    if (newLockOutput.IsNull() || newLockOutput.scriptPubKey != relockScript || newLockOutput.nValue.GetAmount() < lockValueRequired)
-                                        return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_RELOCK_SCRIPTVAL);
-                                }
-
-                                const CTxOut withdrawOutput = checker.GetOutputOffsetFromCurrent(0);
-                                if (!withdrawOutput.nValue.IsAmount())
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLINDED_AMOUNTS);
-                                if (withdrawOutput.nValue.GetAmount() < withdrawVal)
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_OUTPUT_VAL);
-
-                                CScript expectedWithdrawScriptPubKey;
-                                if (vcontract[0] == 'P' && vcontract[1] == '2' && vcontract[2] == 'S' && vcontract[3] == 'H')
-                                    expectedWithdrawScriptPubKey = CScript() << OP_HASH160 << std::vector<unsigned char>(vcontract.begin() + 4, vcontract.begin() + 24) << OP_EQUAL;
-                                else if (vcontract[0] == 'P' && vcontract[1] == '2' && vcontract[2] == 'P' && vcontract[3] == 'H')
-                                    expectedWithdrawScriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(vcontract.begin() + 4, vcontract.begin() + 24) << OP_EQUALVERIFY << OP_CHECKSIG;
-                                else
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_FORMAT);
-
-                                if (withdrawOutput.scriptPubKey != expectedWithdrawScriptPubKey)
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_OUTPUT_SCRIPT);
-
-#ifndef BITCOIN_SCRIPT_NO_CALLRPC
-                                if (GetBoolArg("-validatepegin", false) && !checker.IsConfirmedBitcoinBlock(genesishash, merkleBlock.header.GetHash(), flags & SCRIPT_VERIFY_INCREASE_CONFIRMATIONS_REQUIRED))
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLOCKCONFIRMED);
-#endif
-                            } catch (std::exception& e) {
-                                // Probably invalid encoding of something which was deserialized
-                                return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_FORMAT);
-                            }
-                        }
-                    } // else...OP_NOP3
+                    if (!EvalWithdrawProofVerify(stack, flags, checker, fRequireMinimal, serror))
+                        return false;
                 }
                 break;
 
@@ -1622,13 +1791,15 @@ private:
     const bool fAnyoneCanPay;  //!< whether the hashtype has the SIGHASH_ANYONECANPAY flag set
     const bool fHashSingle;    //!< whether the hashtype is SIGHASH_SINGLE
     const bool fHashNone;      //!< whether the hashtype is SIGHASH_NONE
+    const PrecomputedTransactionData* cache; //!< serialized outputs of txTo, if available
 
 public:
-    CTransactionSignatureSerializer(const CTransaction &txToIn, const CScript &scriptCodeIn, unsigned int nInIn, int nHashTypeIn) :
+    CTransactionSignatureSerializer(const CTransaction &txToIn, const CScript &scriptCodeIn, unsigned int nInIn, int nHashTypeIn, const PrecomputedTransactionData* cacheIn) :
         txTo(txToIn), scriptCode(scriptCodeIn), nIn(nInIn),
         fAnyoneCanPay(!!(nHashTypeIn & SIGHASH_ANYONECANPAY)),
         fHashSingle((nHashTypeIn & 0x1f) == SIGHASH_SINGLE),
-        fHashNone((nHashTypeIn & 0x1f) == SIGHASH_NONE) {}
+        fHashNone((nHashTypeIn & 0x1f) == SIGHASH_NONE),
+        cache(cacheIn) {}
 
     /** Serialize the passed scriptCode, skipping OP_CODESEPARATORs */
     template<typename S>
@@ -1681,6 +1852,8 @@ public:
         if (fHashSingle && nOutput != nIn)
             // Do not lock-in the txout payee at other indices as txin
             ::Serialize(s, CTxOut(), nType, nVersion);
+        else if (cache)
+            s.write((const char*)&cache->vchOutputs[cache->vOutputOffsets[nOutput]], cache->vOutputOffsets[nOutput + 1] - cache->vOutputOffsets[nOutput]);
         else
             ::Serialize(s, txTo.vout[nOutput], nType, nVersion);
     }
@@ -1697,9 +1870,14 @@ public:
              SerializeInput(s, nInput, nType, nVersion);
         // Serialize vout
         unsigned int nOutputs = fHashNone ? 0 : (fHashSingle ? nIn+1 : txTo.vout.size());
-        ::WriteCompactSize(s, nOutputs);
-        for (unsigned int nOutput = 0; nOutput < nOutputs; nOutput++)
-             SerializeOutput(s, nOutput, nType, nVersion);
+        if (cache && !fHashNone && !fHashSingle) {
+            // All outputs, count included, exactly as precomputed
+            s.write((const char*)&cache->vchOutputs[0], cache->vchOutputs.size());
+        } else {
+            ::WriteCompactSize(s, nOutputs);
+            for (unsigned int nOutput = 0; nOutput < nOutputs; nOutput++)
+                 SerializeOutput(s, nOutput, nType, nVersion);
+        }
         // Serialize nLockTime
         ::Serialize(s, txTo.nLockTime, nType, nVersion);
     }
@@ -1735,7 +1913,19 @@ PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
 {
     hashPrevouts = GetPrevoutHash(txTo);
     hashSequence = GetSequenceHash(txTo);
-    hashOutputs = GetOutputsHash(txTo);
+
+    // Serialize the value commitments and scripts of the outputs only once,
+    // rather than for every signature that covers them.
+    CDataStream ss(SER_GETHASH, 0);
+    WriteCompactSize(ss, txTo.vout.size());
+    vOutputOffsets.reserve(txTo.vout.size() + 1);
+    for (unsigned int n = 0; n < txTo.vout.size(); n++) {
+        vOutputOffsets.push_back(ss.size());
+        ss << txTo.vout[n];
+    }
+    vOutputOffsets.push_back(ss.size());
+    vchOutputs.assign(ss.begin(), ss.end());
+    hashOutputs = Hash(vchOutputs.begin() + vOutputOffsets[0], vchOutputs.end());
 }
 
 uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CTxOutValue& amount, SigVersion sigversion, const PrecomputedTransactionData* cache)
@@ -1757,9 +1947,13 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
         if ((nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
             hashOutputs = cache ? cache->hashOutputs : GetOutputsHash(txTo);
         } else if ((nHashType & 0x1f) == SIGHASH_SINGLE && nIn < txTo.vout.size()) {
-            CHashWriter ss(SER_GETHASH, 0);
-            ss << txTo.vout[nIn];
-            hashOutputs = ss.GetHash();
+            if (cache) {
+                hashOutputs = Hash(cache->vchOutputs.begin() + cache->vOutputOffsets[nIn], cache->vchOutputs.begin() + cache->vOutputOffsets[nIn + 1]);
+            } else {
+                CHashWriter ss(SER_GETHASH, 0);
+                ss << txTo.vout[nIn];
+                hashOutputs = ss.GetHash();
+            }
         }
 
         CHashWriter ss(SER_GETHASH, 0);
@@ -1800,7 +1994,7 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     }
 
     // Wrapper to serialize only the necessary parts of the transaction being signed
-    CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
+    CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType, cache);
 
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
@@ -1808,6 +2002,11 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     return ss.GetHash();
 }
 
+bool BaseSignatureChecker::CheckSigFromStack(const vector<unsigned char>& vchSig, const vector<unsigned char>& vchPubKey, const uint256& hash) const
+{
+    return CPubKey(vchPubKey).Verify(hash, vchSig);
+}
+
 CTxOut BaseSignatureChecker::GetOutputOffsetFromCurrent(const int offset) const
 {
     return CTxOut();
@@ -122,6 +122,12 @@ bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned i
 struct PrecomputedTransactionData
 {
     uint256 hashPrevouts, hashSequence, hashOutputs;
+    /** All outputs serialized once, preceded by their count. The legacy
+     *  signature hash includes these bytes as they are, and both signature
+     *  hash versions take single outputs from them. */
+    std::vector<unsigned char> vchOutputs;
+    /** Where each output starts in vchOutputs, plus the end of the last one. */
+    std::vector<uint32_t> vOutputOffsets;
 
     PrecomputedTransactionData(const CTransaction& tx);
 };
@@ -142,6 +148,9 @@ public:
         return false;
     }
 
+    /** Verify a signature over the SHA256 of data taken from the stack, for OP_CHECKSIGFROMSTACK. */
+    virtual bool CheckSigFromStack(const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey, const uint256& hash) const;
+
     virtual CScript GetFedpegScript() const
     {
         CScript fedpegScript(CScript() << OP_FALSE);
@@ -227,6 +236,8 @@ public:
 };
 
 bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* error = NULL);
+/** Like EvalScript, but always runs the opcode loop, also for the script templates EvalScript has faster paths for. */
+bool EvalScriptGeneric(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* error = NULL);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror = NULL);
 
 size_t CountWitnessSigOps(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags);
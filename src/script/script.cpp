@@ -8,6 +8,7 @@
 #include <list>
 
 #include "hash.h"
+#include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "streams.h"
 #include "tinyformat.h"
@@ -240,30 +241,15 @@ bool CScript::IsWithdrawLock() const
     // This function must return true for an OP_WITHDRAWPROOFVERIFY opcode to execute.
     // We require all pushes be in their minimal form, to make inspection of
     // withdraw locks a purely byte-matching affair.
-    const_iterator pc = begin();
-    vector<unsigned char> data;
-    opcodetype opcode;
-
-    if (!GetOp(pc, opcode, data))
-        return false;
-    if (opcode == 24 && data.size() == 24) { // 4 byte type + 20 byte destination is suggested
-        if (!GetOp(pc, opcode, data) || opcode != OP_DROP || data.size() != 0)
+    const size_t nSize = size();
+    if (nSize == 60) {
+        // 4 byte type + 20 byte destination is suggested
+        if ((*this)[0] != 24 || (*this)[25] != OP_DROP || (*this)[26] != 32)
             return false;
-
-        if (!GetOp(pc, opcode, data))
-            return false;
-    }
-
-    if (opcode != 32 || data.size() != 32)
-        return false;
-
-    if (!GetOp(pc, opcode, data) || opcode != OP_WITHDRAWPROOFVERIFY || data.size() != 0)
+    } else if (nSize != 34 || (*this)[0] != 32) {
         return false;
-
-    if (GetOp(pc, opcode))
-        return false;
-
-    return true;
+    }
+    return (*this)[nSize - 1] == OP_WITHDRAWPROOFVERIFY;
 }
 
 uint256 CScript::GetWithdrawLockGenesisHash() const
@@ -341,6 +327,43 @@ COutPoint CScript::GetWithdrawSpent() const
     }
 }
 
+uint256 CScript::GetWithdrawBlockHash() const
+{
+    assert(IsWithdrawProof());
+
+    try {
+        const_iterator pc = begin();
+        opcodetype opcode;
+
+        vector<vector<unsigned char> > pushes;
+        pushes.reserve(6);
+        while (pc < end()) {
+            pushes.push_back(vector<unsigned char>());
+            assert(GetOp(pc, opcode, pushes.back()));
+            if (opcode <= OP_16 && opcode >= OP_1)
+                pushes.back().push_back(opcode - OP_1 + 1);
+            else if (opcode == OP_1NEGATE)
+                pushes.back().push_back(0x81);
+        }
+
+        // Skip the output index and the locking transaction
+        pushes.pop_back();
+        if (!PopWithdrawPush(pushes))
+            return uint256();
+
+        vector<unsigned char> vMerkleBlock;
+        if (!PopWithdrawPush(pushes, &vMerkleBlock))
+            return uint256();
+
+        // A merkle block starts with its header, which is all we need
+        CBlockHeader header;
+        CDataStream(vMerkleBlock, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX) >> header;
+        return header.GetHash();
+    } catch (std::exception& e) {
+        return uint256();
+    }
+}
+
 void CScript::PushWithdraw(const vector<unsigned char> push) {
     int64_t pushCount = 0;
     for (vector<unsigned char>::const_iterator it = push.begin(); it < push.end(); pushCount++) {
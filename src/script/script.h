@@ -646,6 +646,9 @@ public:
     /** Get the withdraw output spent, asserting IsWithdrawProof first */
     COutPoint GetWithdrawSpent() const;
 
+    /** Get the hash of the parent chain block the withdraw proof refers to, asserting IsWithdrawProof first */
+    uint256 GetWithdrawBlockHash() const;
+
     /** Get the genesis hash locked to, asserting IsWithdrawLock first */
     uint256 GetWithdrawLockGenesisHash() const;
 
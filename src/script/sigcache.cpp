@@ -5,29 +5,21 @@
 
 #include "sigcache.h"
 
-#include "memusage.h"
+#include "amountverifier.h"
+#include "cuckoocache.h"
+#include "hash.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <atomic>
+
+#include <boost/foreach.hpp>
 #include <boost/thread.hpp>
-#include <boost/unordered_set.hpp>
 
 namespace {
 
-/**
- * We're hashing a nonce into the entries themselves, so we don't need extra
- * blinding in the set hash computation.
- */
-class CSignatureCacheHasher
-{
-public:
-    size_t operator()(const uint256& key) const {
-        return key.GetCheapHash();
-    }
-};
-
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
@@ -38,15 +30,18 @@ class CSignatureCache
 private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef boost::unordered_set<uint256, CSignatureCacheHasher> map_type;
+     //! OP_CHECKSIGFROMSTACK entries use a separate nonce, and are SHA256d(nonce || data hash || public key || signature)
+     //! with the key and signature length-prefixed
+    uint256 nonceFromStack;
+    typedef CuckooCache::cache<uint256, CSignatureCacheHasher> map_type;
     map_type setValid;
     boost::shared_mutex cs_sigcache;
 
-
 public:
     CSignatureCache()
     {
         GetRandBytes(nonce.begin(), 32);
+        GetRandBytes(nonceFromStack.begin(), 32);
     }
 
     void
@@ -55,53 +50,48 @@ public:
         CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(&vchSig[0], vchSig.size()).Finalize(entry.begin());
     }
 
+    void
+    ComputeEntryFromStack(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
+    {
+        // Length-prefixed, so that no other split of the same bytes into a
+        // key and a signature maps to this entry
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << nonceFromStack << hash << pubkey << vchSig;
+        entry = ss.GetHash();
+    }
+
+    /** Look entry up; with erase, allow its slot to be reused. Never blocks on other lookups. */
     bool
-    Get(const uint256& entry)
+    Get(const uint256& entry, const bool erase)
     {
         boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.count(entry);
+        return setValid.contains(entry, erase);
     }
 
-    void Erase(const uint256& entry)
+    void Set(const uint256& entry)
     {
         boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.erase(entry);
+        setValid.insert(entry);
     }
 
-    void Set(const uint256& entry)
+    uint32_t setup_bytes(size_t n)
     {
-        size_t nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-        if (nMaxCacheSize <= 0) return;
-
         boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
-        {
-            map_type::size_type s = GetRand(setValid.bucket_count());
-            map_type::local_iterator it = setValid.begin(s);
-            if (it != setValid.end(s)) {
-                setValid.erase(*it);
-            }
-        }
-
-        setValid.insert(entry);
+        return setValid.setup_bytes(n);
     }
 };
 
+CSignatureCache signatureCache;
+
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
-
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(entry)) {
-        if (!store) {
-            signatureCache.Erase(entry);
-        }
+    if (signatureCache.Get(entry, !store))
         return true;
-    }
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -112,23 +102,202 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
     return true;
 }
 
-bool CachingRangeProofChecker::VerifyRangeProof(const std::vector<unsigned char>& vchRangeProof, const std::vector<unsigned char>& vchCommitment, const secp256k1_context* secp256k1_ctx_verify_amounts) const
+bool CachingTransactionSignatureChecker::CheckSigFromStack(const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey, const uint256& hash) const
 {
-    static CSignatureCache rangeProofCache;
+    // CPubKey::Verify fails for these too; the entry is only built for a
+    // key of the length its encoding declares
+    CPubKey pubkey(vchPubKey);
+    if (vchSig.empty() || !pubkey.IsValid())
+        return false;
 
-    CPubKey pubkey(vchCommitment);
     uint256 entry;
-    rangeProofCache.ComputeEntry(entry, uint256(), vchRangeProof, pubkey);
+    signatureCache.ComputeEntryFromStack(entry, hash, vchSig, pubkey);
 
-    if (rangeProofCache.Get(entry)) {
-        if (!store) {
-            rangeProofCache.Erase(entry);
-        }
+    if (signatureCache.Get(entry, !store))
         return true;
+
+    if (!TransactionSignatureChecker::CheckSigFromStack(vchSig, vchPubKey, hash))
+        return false;
+
+    if (store) {
+        signatureCache.Set(entry);
+    }
+    return true;
+}
+
+namespace {
+
+/**
+ * Valid range proof cache. Range proofs are by far the most expensive part
+ * of validating a confidential transaction, and the proofs themselves are
+ * several kilobytes, so entries are derived from the witness hash of the
+ * transaction (which commits to every output's commitment and proof) and
+ * the output index instead of from the proof.
+ */
+class CRangeProofCache
+{
+private:
+    //! Entries are SHA256(nonce || witness hash || output index):
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, CSignatureCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_rangeproofcache;
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+public:
+    CRangeProofCache() : nHits(0), nMisses(0)
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    void ComputeEntry(uint256& entry, const RangeProofCacheKey& key)
+    {
+        unsigned char n[4];
+        WriteLE32(n, key.second);
+        CSHA256().Write(nonce.begin(), 32).Write(key.first.begin(), 32).Write(n, 4).Finalize(entry.begin());
+    }
+
+    bool Get(const uint256& entry, const bool erase)
+    {
+        bool fFound;
+        {
+            boost::shared_lock<boost::shared_mutex> lock(cs_rangeproofcache);
+            fFound = setValid.contains(entry, erase);
+        }
+        ++(fFound ? nHits : nMisses);
+        return fFound;
+    }
+
+    void Set(const uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_rangeproofcache);
+        setValid.insert(entry);
+    }
+
+    uint32_t setup_bytes(size_t n)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_rangeproofcache);
+        return setValid.setup_bytes(n);
+    }
+
+    void GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut) const
+    {
+        nHitsOut = nHits;
+        nMissesOut = nMisses;
+    }
+};
+
+CRangeProofCache rangeProofCache;
+
+/**
+ * Witness hashes of transactions whose range proofs trusted nodes of the same
+ * operator verified, so that each proof is verified once per fleet.
+ */
+class CFleetVerifiedCache
+{
+private:
+    //! Entries are SHA256(nonce || witness hash):
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, CSignatureCacheHasher> map_type;
+    map_type setVerified;
+    boost::shared_mutex cs_fleetcache;
+    std::atomic<bool> fEnabled;
+    std::atomic<bool> fBlocks;
+
+    void ComputeEntry(uint256& entry, const uint256& wtxid)
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(wtxid.begin(), 32).Finalize(entry.begin());
+    }
+
+public:
+    CFleetVerifiedCache() : fEnabled(false), fBlocks(false)
+    {
+        GetRandBytes(nonce.begin(), 32);
     }
 
-    uint64_t min_value, max_value;
-    if (!secp256k1_rangeproof_verify(secp256k1_ctx_verify_amounts, &min_value, &max_value, &vchCommitment[0], vchRangeProof.data(), vchRangeProof.size())) {
+    void Enable(bool fBlocksIn)
+    {
+        fBlocks = fBlocksIn;
+        fEnabled = true;
+    }
+
+    //! Whether a check that stores its result if fStore may take the proofs of wtxid as verified
+    bool Contains(const uint256& wtxid, bool fStore)
+    {
+        if (!fEnabled || !(fStore || fBlocks))
+            return false;
+        uint256 entry;
+        ComputeEntry(entry, wtxid);
+        boost::shared_lock<boost::shared_mutex> lock(cs_fleetcache);
+        return setVerified.contains(entry, false);
+    }
+
+    void Add(const uint256& wtxid)
+    {
+        uint256 entry;
+        ComputeEntry(entry, wtxid);
+        boost::unique_lock<boost::shared_mutex> lock(cs_fleetcache);
+        setVerified.insert(entry);
+    }
+
+    uint32_t setup_bytes(size_t n)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_fleetcache);
+        return setVerified.setup_bytes(n);
+    }
+};
+
+CFleetVerifiedCache fleetVerifiedCache;
+
+/** Size a cache from the MiB given by strArg, and log the outcome. */
+template <typename Cache>
+void SetupCache(Cache& cache, const std::string& strName, const std::string& strArg, int64_t nDefault)
+{
+    // A zero or negative size gives the smallest possible cache (2 entries).
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg(strArg, nDefault)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = cache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for %s cache, able to store %zu elements\n",
+              (nElems * sizeof(uint256)) >> 20, nMaxCacheSize >> 20, strName, nElems);
+}
+
+}
+
+void InitSignatureCache()
+{
+    SetupCache(signatureCache, "signature", "-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE);
+    SetupCache(rangeProofCache, "range proof", "-rangeproofcachesize", DEFAULT_MAX_RANGEPROOF_CACHE_SIZE);
+}
+
+void GetRangeProofCacheStats(uint64_t& nHits, uint64_t& nMisses)
+{
+    rangeProofCache.GetStats(nHits, nMisses);
+}
+
+void InitFleetVerifiedCache(bool fBlocks)
+{
+    // One entry covers all proofs of a transaction, so the range proof cache size is plenty.
+    SetupCache(fleetVerifiedCache, "fleet verified transaction", "-rangeproofcachesize", DEFAULT_MAX_RANGEPROOF_CACHE_SIZE);
+    fleetVerifiedCache.Enable(fBlocks);
+}
+
+void AddFleetVerifiedTransaction(const uint256& wtxid)
+{
+    fleetVerifiedCache.Add(wtxid);
+}
+
+bool CachingRangeProofChecker::VerifyRangeProof(const RangeProofCacheKey& key, const CTxOutValue& value, const secp256k1_context* secp256k1_ctx_verify_amounts) const
+{
+    uint256 entry;
+    rangeProofCache.ComputeEntry(entry, key);
+
+    if (rangeProofCache.Get(entry, !store) || fleetVerifiedCache.Contains(key.first, store))
+        return true;
+
+    const unsigned char* pchCommit = &value.vchCommitment[0];
+    const unsigned char* pchProof = value.vchRangeproof.data();
+    const int nProofLen = value.vchRangeproof.size();
+    if (!VerifyRangeProofBatch(secp256k1_ctx_verify_amounts, &pchCommit, &pchProof, &nProofLen, 1)) {
         return false;
     }
 
@@ -138,3 +307,47 @@ bool CachingRangeProofChecker::VerifyRangeProof(const std::vector<unsigned char>
     return true;
 
 }
+
+bool CachingRangeProofChecker::VerifyRangeProofs(const std::vector<RangeProofCacheKey>& vKeys, const std::vector<const CTxOutValue*>& vValues, const secp256k1_context* secp256k1_ctx_verify_amounts, size_t* pnFailed) const
+{
+    assert(vKeys.size() == vValues.size());
+    std::vector<size_t> vIndex;
+    std::vector<uint256> vEntries;
+    std::vector<const unsigned char*> vProofPtrs, vCommitPtrs;
+    std::vector<int> vProofLens;
+    for (size_t i = 0; i < vValues.size(); i++) {
+        uint256 entry;
+        rangeProofCache.ComputeEntry(entry, vKeys[i]);
+        if (rangeProofCache.Get(entry, !store) || fleetVerifiedCache.Contains(vKeys[i].first, store))
+            continue;
+        vIndex.push_back(i);
+        vEntries.push_back(entry);
+        vProofPtrs.push_back(vValues[i]->vchRangeproof.data());
+        vCommitPtrs.push_back(&vValues[i]->vchCommitment[0]);
+        vProofLens.push_back(vValues[i]->vchRangeproof.size());
+    }
+
+    if (vIndex.empty())
+        return true;
+
+    if (!VerifyRangeProofBatch(secp256k1_ctx_verify_amounts, vCommitPtrs.data(), vProofPtrs.data(), vProofLens.data(), vIndex.size())) {
+        // The batch only tells us that something is wrong; check the
+        // proofs one at a time to find the culprit.
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            uint64_t min_value, max_value;
+            if (!secp256k1_rangeproof_verify(secp256k1_ctx_verify_amounts, &min_value, &max_value, vCommitPtrs[i], vProofPtrs[i], vProofLens[i])) {
+                if (pnFailed)
+                    *pnFailed = vIndex[i];
+                return false;
+            }
+        }
+        // Every individual proof passed, so the batch failure was not
+        // caused by an invalid proof.
+    }
+
+    if (store) {
+        BOOST_FOREACH(const uint256& entry, vEntries)
+            rangeProofCache.Set(entry);
+    }
+    return true;
+}
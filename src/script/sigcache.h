@@ -6,29 +6,80 @@
 #ifndef BITCOIN_SCRIPT_SIGCACHE_H
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
+#include "crypto/common.h"
 #include "script/interpreter.h"
+#include "uint256.h"
 
 #include <secp256k1.h>
 #include <secp256k1_rangeproof.h>
+#include <stdint.h>
+#include <utility>
 #include <vector>
 
 // DoS prevention: limit cache size to less than 40MB (over 500000
 // entries on 64-bit systems).
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
+// Range proof cache entries are as small as signature cache entries, but
+// there are far fewer confidential outputs than signatures.
+static const unsigned int DEFAULT_MAX_RANGEPROOF_CACHE_SIZE = 10;
+// Maximum size of either cache in MiB; the cuckoo cache indexes its table
+// with 32 bits.
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
 class CPubKey;
 
+/**
+ * We're hashing a nonce into the entries themselves, so we don't need extra
+ * blinding in the set hash computation: the eight hash functions a cuckoo
+ * cache needs are just the eight 32-bit words of the entry.
+ */
+class CSignatureCacheHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select < 8, "CSignatureCacheHasher only has 8 hashes available.");
+        return ReadLE32(key.begin() + 4 * hash_select);
+    }
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CTxOutValue& amount, const CTxOutValue& amountPreviousInput, const CScript& scriptFedRedeem, bool storeIn, PrecomputedTransactionData& txdataIn) : TransactionSignatureChecker(txToIn, nInIn, amount, amountPreviousInput, scriptFedRedeem), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CTxOutValue& amount, const CTxOutValue& amountPreviousInput, const CScript& scriptFedRedeem, bool storeIn, PrecomputedTransactionData& txdataIn) : TransactionSignatureChecker(txToIn, nInIn, amount, amountPreviousInput, txdataIn, scriptFedRedeem), store(storeIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
+    bool CheckSigFromStack(const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey, const uint256& hash) const;
 };
 
+/**
+ * Identifies the range proof of an output by the witness hash of its
+ * transaction, which commits to the output's commitment and proof, and the
+ * output index.
+ */
+typedef std::pair<uint256, uint32_t> RangeProofCacheKey;
+
+/** Allocate the signature and range proof caches, sized from -maxsigcachesize and -rangeproofcachesize. */
+void InitSignatureCache();
+
+/** Number of range proof cache lookups that found, resp. did not find, an entry. */
+void GetRangeProofCacheStats(uint64_t& nHits, uint64_t& nMisses);
+
+/**
+ * Take the range proofs of transactions marked with AddFleetVerifiedTransaction
+ * as valid without checking them. Only checks that store their results, those
+ * of transactions entering the mempool, do so unless fBlocks; block
+ * validation otherwise keeps checking every proof itself.
+ */
+void InitFleetVerifiedCache(bool fBlocks);
+
+/** Mark the range proofs of the transaction with this witness hash as verified by a trusted node. */
+void AddFleetVerifiedTransaction(const uint256& wtxid);
+
 class CachingRangeProofChecker
 {
 private:
@@ -38,7 +89,15 @@ public:
         store = storeIn;
     };
 
-    bool VerifyRangeProof(const std::vector<unsigned char>& vchRangeProof, const std::vector<unsigned char>& vchCommitment, const secp256k1_context* ctx) const;
+    bool VerifyRangeProof(const RangeProofCacheKey& key, const CTxOutValue& value, const secp256k1_context* ctx) const;
+
+    /**
+     * Verify several range proofs with one batched secp256k1 call. Proofs
+     * already in the cache are skipped. If the batch fails, the remaining
+     * proofs are checked one by one and the index of the first invalid one
+     * is returned through pnFailed.
+     */
+    bool VerifyRangeProofs(const std::vector<RangeProofCacheKey>& vKeys, const std::vector<const CTxOutValue*>& vValues, const secp256k1_context* ctx, size_t* pnFailed = NULL) const;
 
 };
 
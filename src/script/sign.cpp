@@ -12,13 +12,20 @@
 #include "script/standard.h"
 #include "uint256.h"
 
+#include <atomic>
+#include <thread>
+
 #include <boost/foreach.hpp>
 
 using namespace std;
 
 typedef std::vector<unsigned char> valtype;
 
-TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CTxOutValue& amountIn, int nHashTypeIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), amount(amountIn), checker(txTo, nIn, amountIn) {}
+//! Fewer inputs than this per thread are not worth starting a thread for
+static const size_t SIGN_INPUTS_PER_THREAD = 8;
+
+TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CTxOutValue& amountIn, int nHashTypeIn, const PrecomputedTransactionData* txdataIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), amount(amountIn), txdata(txdataIn),
+    checker(txdataIn ? TransactionNoWithdrawsSignatureChecker(txTo, nIn, amountIn, *txdataIn) : TransactionNoWithdrawsSignatureChecker(txTo, nIn, amountIn)) {}
 
 bool TransactionSignatureCreator::CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& address, const CScript& scriptCode, SigVersion sigversion) const
 {
@@ -30,7 +37,7 @@ bool TransactionSignatureCreator::CreateSig(std::vector<unsigned char>& vchSig,
     if (sigversion == SIGVERSION_WITNESS_V0 && !key.IsCompressed())
         return false;
 
-    uint256 hash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, sigversion);
+    uint256 hash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, sigversion, txdata);
     if (!key.Sign(hash, vchSig))
         return false;
     vchSig.push_back((unsigned char)nHashType);
@@ -144,7 +151,7 @@ static CScript PushAll(const vector<valtype>& values)
     return result;
 }
 
-bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& fromPubKey, SignatureData& sigdata)
+bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& fromPubKey, SignatureData& sigdata, bool fVerify)
 {
     CScript script = fromPubKey;
     bool solved = true;
@@ -190,7 +197,28 @@ bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& fromPu
     sigdata.scriptSig = PushAll(result);
 
     // Test solution
-    return solved && VerifyScript(sigdata.scriptSig, fromPubKey, &sigdata.scriptWitness, STANDARD_SCRIPT_VERIFY_FLAGS, creator.Checker());
+    return solved && (!fVerify || VerifyScript(sigdata.scriptSig, fromPubKey, &sigdata.scriptWitness, STANDARD_SCRIPT_VERIFY_FLAGS, creator.Checker()));
+}
+
+void ForEachInputParallel(size_t nInputs, int nThreads, const std::function<void(size_t)>& f)
+{
+    std::atomic<size_t> nNext(0);
+    auto worker = [&]() {
+        for (size_t i = nNext++; i < nInputs; i = nNext++)
+            f(i);
+    };
+
+    const size_t nMaxThreads = (nInputs + SIGN_INPUTS_PER_THREAD - 1) / SIGN_INPUTS_PER_THREAD;
+    std::vector<std::thread> vThreads;
+    try {
+        for (size_t t = 1; t < (size_t)std::max(nThreads, 1) && t < nMaxThreads; t++)
+            vThreads.push_back(std::thread(worker));
+    } catch (const std::exception&) {
+        // Whatever threads could not be started, the calling thread makes up for.
+    }
+    worker();
+    for (size_t t = 0; t < vThreads.size(); t++)
+        vThreads[t].join();
 }
 
 SignatureData DataFromTransaction(const CMutableTransaction& tx, unsigned int nIn)
@@ -8,6 +8,8 @@
 
 #include "script/interpreter.h"
 
+#include <functional>
+
 class CKeyID;
 class CKeyStore;
 class CScript;
@@ -36,10 +38,12 @@ class TransactionSignatureCreator : public BaseSignatureCreator {
     unsigned int nIn;
     int nHashType;
     CTxOutValue amount;
+    const PrecomputedTransactionData* txdata;
     const TransactionNoWithdrawsSignatureChecker checker;
 
 public:
-    TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CTxOutValue& amountIn, int nHashTypeIn=SIGHASH_ALL);
+    /** txdataIn, if given, must outlive the creator and belong to *txToIn */
+    TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CTxOutValue& amountIn, int nHashTypeIn=SIGHASH_ALL, const PrecomputedTransactionData* txdataIn=NULL);
     const BaseSignatureChecker& Checker() const { return checker; }
     bool CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& keyid, const CScript& scriptCode, SigVersion sigversion) const;
 };
@@ -67,8 +71,19 @@ struct SignatureData {
     explicit SignatureData(const CScript& script) : scriptSig(script) {}
 };
 
-/** Produce a script signature using a generic signature creator. */
-bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& scriptPubKey, SignatureData& sigdata);
+/**
+ * Produce a script signature using a generic signature creator. Unless
+ * fVerify is false, for callers that verify the result themselves anyway,
+ * the signature is checked against scriptPubKey before returning true.
+ */
+bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& scriptPubKey, SignatureData& sigdata, bool fVerify = true);
+
+/**
+ * Call f(nIn) for each of the nInputs inputs of a transaction, on up to
+ * nThreads threads including the calling one, so that the inputs of a large
+ * transaction are signed in parallel. f must not throw.
+ */
+void ForEachInputParallel(size_t nInputs, int nThreads, const std::function<void(size_t)>& f);
 
 /** Produce a script signature for a transaction. */
 bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CMutableTransaction& txTo, unsigned int nIn, const CTxOutValue& amount, int nHashType);
@@ -39,64 +39,85 @@ const char* GetTxnOutputType(txnouttype t)
     return NULL;
 }
 
-/**
- * Return public keys or hashes from scriptPubKey, for 'standard' transaction types.
- */
-bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsigned char> >& vSolutionsRet)
+static bool IsSmallInteger(opcodetype opcode)
 {
-    // Templates
-    static multimap<txnouttype, CScript> mTemplates;
-    if (mTemplates.empty())
-    {
-        // Standard tx, sender provides pubkey, receiver adds signature
-        mTemplates.insert(make_pair(TX_PUBKEY, CScript() << OP_PUBKEY << OP_CHECKSIG));
-
-        // Bitcoin address tx, sender provides hash of pubkey, receiver provides signature and pubkey
-        mTemplates.insert(make_pair(TX_PUBKEYHASH, CScript() << OP_DUP << OP_HASH160 << OP_PUBKEYHASH << OP_EQUALVERIFY << OP_CHECKSIG));
+    return opcode == OP_0 || (opcode >= OP_1 && opcode <= OP_16);
+}
 
-        // Sender provides N pubkeys, receivers provides M signatures
-        mTemplates.insert(make_pair(TX_MULTISIG, CScript() << OP_SMALLINTEGER << OP_PUBKEYS << OP_SMALLINTEGER << OP_CHECKMULTISIG));
-    }
+static bool IsPubKeySize(size_t nSize)
+{
+    return nSize >= 33 && nSize <= 65;
+}
 
-    vSolutionsRet.clear();
+/**
+ * Classify scriptPubKey and, if pvSolutionsRet is given, return the public
+ * keys or hashes it pays to. The fixed layouts nearly every output uses are
+ * recognized from their bytes; only multisig and keys or hashes pushed in an
+ * unusual form are parsed opcode by opcode.
+ */
+static bool SolverImpl(const CScript& scriptPubKey, txnouttype& typeRet, vector<valtype>* pvSolutionsRet)
+{
+    if (pvSolutionsRet)
+        pvSolutionsRet->clear();
+    const size_t nSize = scriptPubKey.size();
 
     // Shortcut for pay-to-script-hash, which are more constrained than the other types:
     // it is always OP_HASH160 20 [20 byte hash] OP_EQUAL
     if (scriptPubKey.IsPayToScriptHash())
     {
         typeRet = TX_SCRIPTHASH;
-        vector<unsigned char> hashBytes(scriptPubKey.begin()+2, scriptPubKey.begin()+22);
-        vSolutionsRet.push_back(hashBytes);
+        if (pvSolutionsRet)
+            pvSolutionsRet->push_back(valtype(scriptPubKey.begin()+2, scriptPubKey.begin()+22));
         return true;
     }
 
+    // OP_DUP OP_HASH160 20 [20 byte hash] OP_EQUALVERIFY OP_CHECKSIG
+    if (nSize == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 && scriptPubKey[2] == 20 &&
+        scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG)
+    {
+        typeRet = TX_PUBKEYHASH;
+        if (pvSolutionsRet)
+            pvSolutionsRet->push_back(valtype(scriptPubKey.begin()+3, scriptPubKey.begin()+23));
+        return true;
+    }
+
+    // OP_0 20 [20 byte hash] and OP_0 32 [32 byte hash]
+    if ((nSize == 22 || nSize == 34) && scriptPubKey[0] == OP_0 && (size_t)scriptPubKey[1] + 2 == nSize)
+    {
+        typeRet = nSize == 22 ? TX_WITNESS_V0_KEYHASH : TX_WITNESS_V0_SCRIPTHASH;
+        if (pvSolutionsRet)
+            pvSolutionsRet->push_back(valtype(scriptPubKey.begin()+2, scriptPubKey.end()));
+        return true;
+    }
+
+    // Other witness programs are not ours to spend, nor standard to create
     int witnessversion;
-    std::vector<unsigned char> witnessprogram;
-    if (scriptPubKey.IsWitnessProgram(witnessversion, witnessprogram)) {
-        if (witnessversion == 0 && witnessprogram.size() == 20) {
-            typeRet = TX_WITNESS_V0_KEYHASH;
-            vSolutionsRet.push_back(witnessprogram);
-            return true;
-        }
-        if (witnessversion == 0 && witnessprogram.size() == 32) {
-            typeRet = TX_WITNESS_V0_SCRIPTHASH;
-            vSolutionsRet.push_back(witnessprogram);
-            return true;
-        }
+    valtype witnessprogram;
+    if (nSize >= 4 && nSize <= 42 && scriptPubKey.IsWitnessProgram(witnessversion, witnessprogram)) {
+        typeRet = TX_NONSTANDARD;
         return false;
     }
 
+    // 33 [compressed pubkey] OP_CHECKSIG and 65 [uncompressed pubkey] OP_CHECKSIG
+    if (((nSize == 35 && scriptPubKey[0] == 33) || (nSize == 67 && scriptPubKey[0] == 65)) && scriptPubKey[nSize-1] == OP_CHECKSIG)
+    {
+        typeRet = TX_PUBKEY;
+        if (pvSolutionsRet)
+            pvSolutionsRet->push_back(valtype(scriptPubKey.begin()+1, scriptPubKey.end()-1));
+        return true;
+    }
+
     // Provably prunable, data-carrying output
     //
     // So long as script passes the IsUnspendable() test and all but the first
     // byte passes the IsPushOnly() test we don't care what exactly is in the
     // script.
-    if (scriptPubKey.size() >= 1 && scriptPubKey[0] == OP_RETURN && scriptPubKey.IsPushOnly(scriptPubKey.begin()+1)) {
+    if (nSize >= 1 && scriptPubKey[0] == OP_RETURN && scriptPubKey.IsPushOnly(scriptPubKey.begin()+1)) {
         typeRet = TX_NULL_DATA;
         return true;
     }
 
-    if (scriptPubKey == CScript() << OP_TRUE) {
+    if (nSize == 1 && scriptPubKey[0] == OP_TRUE) {
         typeRet = TX_TRUE;
         return true;
     }
@@ -107,91 +128,76 @@ bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsi
         return true;
     }
 
-    // Scan templates
-    const CScript& script1 = scriptPubKey;
-    BOOST_FOREACH(const PAIRTYPE(txnouttype, CScript)& tplate, mTemplates)
-    {
-        const CScript& script2 = tplate.second;
-        vSolutionsRet.clear();
-
-        opcodetype opcode1, opcode2;
-        vector<unsigned char> vch1, vch2;
-
-        // Compare
-        CScript::const_iterator pc1 = script1.begin();
-        CScript::const_iterator pc2 = script2.begin();
-        while (true)
-        {
-            if (pc1 == script1.end() && pc2 == script2.end())
-            {
-                // Found a match
-                typeRet = tplate.first;
-                if (typeRet == TX_MULTISIG)
-                {
-                    // Additional checks for TX_MULTISIG:
-                    unsigned char m = vSolutionsRet.front()[0];
-                    unsigned char n = vSolutionsRet.back()[0];
-                    if (m < 1 || n < 1 || m > n || vSolutionsRet.size()-2 != n)
-                        return false;
-                }
+    // What is left is parsed opcode by opcode:
+    //   [pubkey] OP_CHECKSIG
+    //   OP_DUP OP_HASH160 [pubkeyhash] OP_EQUALVERIFY OP_CHECKSIG
+    //   m [pubkey]... n OP_CHECKMULTISIG
+    CScript::const_iterator pc = scriptPubKey.begin();
+    opcodetype opcode;
+    valtype vch;
+    if (!scriptPubKey.GetOp(pc, opcode, vch)) {
+        // Not a valid script
+    } else if (IsPubKeySize(vch.size())) {
+        valtype vchPubKey;
+        vchPubKey.swap(vch);
+        if (scriptPubKey.GetOp(pc, opcode) && opcode == OP_CHECKSIG && pc == scriptPubKey.end()) {
+            typeRet = TX_PUBKEY;
+            if (pvSolutionsRet)
+                pvSolutionsRet->push_back(vchPubKey);
+            return true;
+        }
+    } else if (opcode == OP_DUP) {
+        if (scriptPubKey.GetOp(pc, opcode) && opcode == OP_HASH160 &&
+            scriptPubKey.GetOp(pc, opcode, vch) && vch.size() == sizeof(uint160) &&
+            scriptPubKey.GetOp(pc, opcode) && opcode == OP_EQUALVERIFY &&
+            scriptPubKey.GetOp(pc, opcode) && opcode == OP_CHECKSIG && pc == scriptPubKey.end()) {
+            typeRet = TX_PUBKEYHASH;
+            if (pvSolutionsRet)
+                pvSolutionsRet->push_back(vch);
+            return true;
+        }
+    } else if (IsSmallInteger(opcode)) {
+        const unsigned char m = CScript::DecodeOP_N(opcode);
+        if (pvSolutionsRet)
+            pvSolutionsRet->push_back(valtype(1, m));
+        unsigned int nKeys = 0;
+        bool fOp;
+        while ((fOp = scriptPubKey.GetOp(pc, opcode, vch)) && IsPubKeySize(vch.size())) {
+            if (pvSolutionsRet)
+                pvSolutionsRet->push_back(vch);
+            nKeys++;
+        }
+        if (fOp && IsSmallInteger(opcode)) {
+            const unsigned char n = CScript::DecodeOP_N(opcode);
+            if (scriptPubKey.GetOp(pc, opcode) && opcode == OP_CHECKMULTISIG && pc == scriptPubKey.end() &&
+                m >= 1 && n >= 1 && m <= n && nKeys == n) {
+                typeRet = TX_MULTISIG;
+                if (pvSolutionsRet)
+                    pvSolutionsRet->push_back(valtype(1, n));
                 return true;
             }
-            if (!script1.GetOp(pc1, opcode1, vch1))
-                break;
-            if (!script2.GetOp(pc2, opcode2, vch2))
-                break;
-
-            // Template matching opcodes:
-            if (opcode2 == OP_PUBKEYS)
-            {
-                while (vch1.size() >= 33 && vch1.size() <= 65)
-                {
-                    vSolutionsRet.push_back(vch1);
-                    if (!script1.GetOp(pc1, opcode1, vch1))
-                        break;
-                }
-                if (!script2.GetOp(pc2, opcode2, vch2))
-                    break;
-                // Normal situation is to fall through
-                // to other if/else statements
-            }
-
-            if (opcode2 == OP_PUBKEY)
-            {
-                if (vch1.size() < 33 || vch1.size() > 65)
-                    break;
-                vSolutionsRet.push_back(vch1);
-            }
-            else if (opcode2 == OP_PUBKEYHASH)
-            {
-                if (vch1.size() != sizeof(uint160))
-                    break;
-                vSolutionsRet.push_back(vch1);
-            }
-            else if (opcode2 == OP_SMALLINTEGER)
-            {   // Single-byte small integer pushed onto vSolutions
-                if (opcode1 == OP_0 ||
-                    (opcode1 >= OP_1 && opcode1 <= OP_16))
-                {
-                    char n = (char)CScript::DecodeOP_N(opcode1);
-                    vSolutionsRet.push_back(valtype(1, n));
-                }
-                else
-                    break;
-            }
-            else if (opcode1 != opcode2 || vch1 != vch2)
-            {
-                // Others must match exactly
-                break;
-            }
         }
     }
 
-    vSolutionsRet.clear();
+    if (pvSolutionsRet)
+        pvSolutionsRet->clear();
     typeRet = TX_NONSTANDARD;
     return false;
 }
 
+/**
+ * Return public keys or hashes from scriptPubKey, for 'standard' transaction types.
+ */
+bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsigned char> >& vSolutionsRet)
+{
+    return SolverImpl(scriptPubKey, typeRet, &vSolutionsRet);
+}
+
+bool Solver(const CScript& scriptPubKey, txnouttype& typeRet)
+{
+    return SolverImpl(scriptPubKey, typeRet, NULL);
+}
+
 bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet)
 {
     vector<valtype> vSolutions;
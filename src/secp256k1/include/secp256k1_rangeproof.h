@@ -72,6 +72,27 @@ SECP256K1_WARN_UNUSED_RESULT int secp256k1_pedersen_verify_tally(
   int64_t excess
 ) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(2) SECP256K1_ARG_NONNULL(4);
 
+/** Verify several commitment tallies with one call.
+ *  Returns 1: every tally sums to zero.
+ *          0: at least one tally does not, or other error. Use secp256k1_pedersen_verify_tally to find out which one.
+ * In:     ctx:        pointer to a context object, initialized for Pedersen commitment (cannot be NULL)
+ *         commits:    array of n pointers to arrays of pointers to positive commitments, as in secp256k1_pedersen_verify_tally.
+ *         pcnts:      array of n counts of positive commitments.
+ *         ncommits:   array of n pointers to arrays of pointers to negative commitments.
+ *         ncnts:      array of n counts of negative commitments.
+ *         excesses:   array of n signed 64bit excess amounts.
+ *         n:          number of tallies.
+ */
+SECP256K1_WARN_UNUSED_RESULT int secp256k1_pedersen_verify_tally_batch(
+  const secp256k1_context* ctx,
+  const unsigned char * const * const *commits,
+  const int *pcnts,
+  const unsigned char * const * const *ncommits,
+  const int *ncnts,
+  const int64_t *excesses,
+  int n
+) SECP256K1_ARG_NONNULL(1);
+
 /** Initialize a context for usage with Pedersen commitments. */
 void secp256k1_rangeproof_context_initialize(secp256k1_context* ctx);
 
@@ -94,6 +115,43 @@ SECP256K1_WARN_UNUSED_RESULT int secp256k1_rangeproof_verify(
   int plen
 ) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(2) SECP256K1_ARG_NONNULL(3) SECP256K1_ARG_NONNULL(4) SECP256K1_ARG_NONNULL(5);
 
+/** Verify several range proofs at once.
+ * Returns 1: Every proof is valid.
+ *         0: At least one proof failed or other error. Use secp256k1_rangeproof_verify to find out which one.
+ * In:   ctx: pointer to a context object, initialized for range-proof and commitment (cannot be NULL)
+ *       commits: array of n pointers to the 33-byte commitments being proved.
+ *       proofs: array of n pointers to character arrays with the proofs.
+ *       plens: array of n proof lengths in bytes.
+ *       n: number of proofs.
+ * Unlike secp256k1_rangeproof_verify, the proven ranges are not returned.
+ */
+SECP256K1_WARN_UNUSED_RESULT int secp256k1_rangeproof_verify_batch(
+  const secp256k1_context* ctx,
+  const unsigned char * const *commits,
+  const unsigned char * const *proofs,
+  const int *plens,
+  int n
+) SECP256K1_ARG_NONNULL(1);
+
+/** Cheaply test whether a nonce could be the one a range proof was created with.
+ *  Returns 1: The nonce may be the prover's, or the proof carries no value for secp256k1_rangeproof_rewind to find.
+ *          0: The nonce is certainly not the prover's, so secp256k1_rangeproof_rewind would fail, or the proof is malformed.
+ *  In:   ctx: pointer to a context object (cannot be NULL)
+ *        nonce: 32-byte secret nonce to test (cannot be NULL)
+ *        commit: the 33-byte commitment being proved. (cannot be NULL)
+ *        proof: pointer to character array with the proof. (cannot be NULL)
+ *        plen: length of proof in bytes.
+ * This only regenerates the prover's random stream from the nonce and looks for the value encoding in the
+ * proof's last ring; it does no curve arithmetic and does not verify the proof.
+ */
+SECP256K1_WARN_UNUSED_RESULT int secp256k1_rangeproof_rewind_precheck(
+  const secp256k1_context* ctx,
+  const unsigned char *nonce,
+  const unsigned char *commit,
+  const unsigned char *proof,
+  int plen
+) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(2) SECP256K1_ARG_NONNULL(3) SECP256K1_ARG_NONNULL(4);
+
 /** Verify a range proof proof and rewind the proof to recover information sent by its author.
  *  Returns 1: Value is within the range [0..2^64), the specifically proven range is in the min/max value outputs, and the value and blinding were recovered.
  *          0: Proof failed, rewind failed, or other error.
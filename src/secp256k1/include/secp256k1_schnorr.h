@@ -48,6 +48,26 @@ SECP256K1_API SECP256K1_WARN_UNUSED_RESULT int secp256k1_schnorr_verify(
   const secp256k1_pubkey *pubkey
 ) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(2) SECP256K1_ARG_NONNULL(3) SECP256K1_ARG_NONNULL(4);
 
+/** Verify several signatures created by secp256k1_schnorr_sign at once.
+ *  Returns: 1: every signature is correct
+ *           0: at least one signature is incorrect. Use secp256k1_schnorr_verify
+ *              to find out which one.
+ *  Args:    ctx:     a secp256k1 context object, initialized for verification.
+ *  In:      sig64s:  array of n pointers to 64-byte signatures
+ *           msg32s:  array of n pointers to the 32-byte message hashes signed
+ *           pubkeys: array of n pointers to the public keys to verify with
+ *           n:       number of signatures (0 is trivially correct)
+ *  All signatures are checked in one multi-exponentiation. Signatures made with
+ *  the same public key are cheaper to verify together than ones with distinct keys.
+ */
+SECP256K1_API SECP256K1_WARN_UNUSED_RESULT int secp256k1_schnorr_verify_batch(
+  const secp256k1_context* ctx,
+  const unsigned char * const *sig64s,
+  const unsigned char * const *msg32s,
+  const secp256k1_pubkey * const *pubkeys,
+  size_t n
+) SECP256K1_ARG_NONNULL(1);
+
 /** Recover an EC public key from a Schnorr signature created using
  *  secp256k1_schnorr_sign.
  *  Returns: 1: public key successfully recovered (which guarantees a correct
@@ -5,6 +5,7 @@
  **********************************************************************/
 
 #include <stdint.h>
+#include <string.h>
 
 #include "include/secp256k1_rangeproof.h"
 #include "util.h"
@@ -18,8 +19,34 @@ typedef struct {
     int len;
     int min_bits;
     uint64_t v;
+    unsigned char tally_commits[16][33];
 } bench_rangeproof_t;
 
+static void print_backends(void) {
+    printf("Backends: field %s, scalar %s, asm %s, endomorphism %s\n",
+#if defined(USE_FIELD_5X52)
+        "5x52",
+#else
+        "10x26",
+#endif
+#if defined(USE_SCALAR_4X64)
+        "4x64",
+#else
+        "8x32",
+#endif
+#if defined(USE_ASM_X86_64)
+        "x86_64",
+#else
+        "no",
+#endif
+#if defined(USE_ENDOMORPHISM)
+        "yes"
+#else
+        "no"
+#endif
+    );
+}
+
 static void bench_rangeproof_setup(void* arg) {
     int i;
     uint64_t minv;
@@ -49,6 +76,40 @@ static void bench_rangeproof(void* arg) {
     }
 }
 
+static void bench_tally_setup(void* arg) {
+    int i;
+    unsigned char blinds[16][32];
+    const unsigned char *blind_ptrs[16];
+    bench_rangeproof_t *data = (bench_rangeproof_t*)arg;
+
+    /* Eight inputs balanced by eight outputs of the same values, the last output
+     * taking whatever blinding factor makes the blinding factors cancel out. */
+    for (i = 0; i < 16; i++) {
+        memset(blinds[i], 0, 32);
+        blinds[i][31] = i + 1;
+        blind_ptrs[i] = blinds[i];
+    }
+    CHECK(secp256k1_pedersen_blind_sum(data->ctx, blinds[15], blind_ptrs, 15, 8));
+    for (i = 0; i < 16; i++) {
+        CHECK(secp256k1_pedersen_commit(data->ctx, data->tally_commits[i], blinds[i], 8 + (i & 7)));
+    }
+}
+
+static void bench_tally(void* arg) {
+    int i;
+    const unsigned char *inputs[8];
+    const unsigned char *outputs[8];
+    bench_rangeproof_t *data = (bench_rangeproof_t*)arg;
+
+    for (i = 0; i < 8; i++) {
+        inputs[i] = data->tally_commits[i];
+        outputs[i] = data->tally_commits[8 + i];
+    }
+    for (i = 0; i < 20000; i++) {
+        CHECK(secp256k1_pedersen_verify_tally(data->ctx, inputs, 8, outputs, 8, 0));
+    }
+}
+
 int main(void) {
     bench_rangeproof_t data;
 
@@ -58,7 +119,9 @@ int main(void) {
 
     data.min_bits = 32;
 
+    print_backends();
     run_benchmark("rangeproof_verify_bit", bench_rangeproof, bench_rangeproof_setup, NULL, &data, 10, 1000 * data.min_bits);
+    run_benchmark("pedersen_verify_tally_8x8", bench_tally, bench_tally_setup, NULL, &data, 10, 20000);
 
     secp256k1_context_destroy(data.ctx);
     return 0;
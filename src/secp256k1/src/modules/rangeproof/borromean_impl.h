@@ -17,6 +17,8 @@
 
 #include <limits.h>
 
+#define BORROMEAN_VERIFY_GROUP 32
+
 #ifdef WORDS_BIGENDIAN
 #define BE32(x) (x)
 #else
@@ -54,16 +56,29 @@ SECP256K1_INLINE static void secp256k1_borromean_hash(unsigned char *hash, const
  */
 int secp256k1_borromean_verify(const secp256k1_ecmult_context* ecmult_ctx, secp256k1_scalar *evalues, const unsigned char *e0,
  const secp256k1_scalar *s, const secp256k1_gej *pubs, const int *rsizes, int nrings, const unsigned char *m, int mlen) {
-    secp256k1_gej rgej;
+    /* The rings only depend on each other through e0, so they are walked in lock-step, in groups of up to
+     * BORROMEAN_VERIFY_GROUP rings: every step converts the points of all rings in the group to affine coordinates
+     * with one shared field inversion, instead of one inversion per point. */
+    secp256k1_gej rgej[BORROMEAN_VERIFY_GROUP];
+    secp256k1_fe az[BORROMEAN_VERIFY_GROUP];
+    secp256k1_fe azi[BORROMEAN_VERIFY_GROUP];
     secp256k1_ge rge;
-    secp256k1_scalar ens;
+    secp256k1_scalar ens[BORROMEAN_VERIFY_GROUP];
+    int overflow[BORROMEAN_VERIFY_GROUP];
+    int offsets[BORROMEAN_VERIFY_GROUP];
+    int active[BORROMEAN_VERIFY_GROUP];
+    unsigned char rlast[BORROMEAN_VERIFY_GROUP][33];
     secp256k1_sha256_t sha256_e0;
     unsigned char tmp[33];
+    int group;
+    int ngroup;
+    int nactive;
+    int maxsize;
     int i;
     int j;
+    int k;
     int count;
     size_t size;
-    int overflow;
     VERIFY_CHECK(ecmult_ctx != NULL);
     VERIFY_CHECK(e0 != NULL);
     VERIFY_CHECK(s != NULL);
@@ -73,32 +88,57 @@ int secp256k1_borromean_verify(const secp256k1_ecmult_context* ecmult_ctx, secp2
     VERIFY_CHECK(m != NULL);
     count = 0;
     secp256k1_sha256_initialize(&sha256_e0);
-    for (i = 0; i < nrings; i++) {
-        VERIFY_CHECK(INT_MAX - count > rsizes[i]);
-        secp256k1_borromean_hash(tmp, m, mlen, e0, 32, i, 0);
-        secp256k1_scalar_set_b32(&ens, tmp, &overflow);
-        for (j = 0; j < rsizes[i]; j++) {
-            if (overflow || secp256k1_scalar_is_zero(&s[count]) || secp256k1_scalar_is_zero(&ens) || secp256k1_gej_is_infinity(&pubs[count])) {
-                return 0;
+    for (group = 0; group < nrings; group += ngroup) {
+        ngroup = nrings - group < BORROMEAN_VERIFY_GROUP ? nrings - group : BORROMEAN_VERIFY_GROUP;
+        maxsize = 0;
+        for (i = 0; i < ngroup; i++) {
+            VERIFY_CHECK(INT_MAX - count > rsizes[group + i]);
+            offsets[i] = count;
+            count += rsizes[group + i];
+            if (rsizes[group + i] > maxsize) {
+                maxsize = rsizes[group + i];
             }
-            if (evalues) {
-                /*If requested, save the challenges for proof rewind.*/
-                evalues[count] = ens;
+            secp256k1_borromean_hash(tmp, m, mlen, e0, 32, group + i, 0);
+            secp256k1_scalar_set_b32(&ens[i], tmp, &overflow[i]);
+        }
+        for (j = 0; j < maxsize; j++) {
+            nactive = 0;
+            for (i = 0; i < ngroup; i++) {
+                const int idx = offsets[i] + j;
+                if (j >= rsizes[group + i]) {
+                    continue;
+                }
+                if (overflow[i] || secp256k1_scalar_is_zero(&s[idx]) || secp256k1_scalar_is_zero(&ens[i]) || secp256k1_gej_is_infinity(&pubs[idx])) {
+                    return 0;
+                }
+                if (evalues) {
+                    /*If requested, save the challenges for proof rewind.*/
+                    evalues[idx] = ens[i];
+                }
+                secp256k1_ecmult(ecmult_ctx, &rgej[nactive], &pubs[idx], &ens[i], &s[idx]);
+                if (secp256k1_gej_is_infinity(&rgej[nactive])) {
+                    return 0;
+                }
+                az[nactive] = rgej[nactive].z;
+                active[nactive++] = i;
             }
-            secp256k1_ecmult(ecmult_ctx, &rgej, &pubs[count], &ens, &s[count]);
-            if (secp256k1_gej_is_infinity(&rgej)) {
-                return 0;
+            secp256k1_fe_inv_all_var(nactive, azi, az);
+            for (k = 0; k < nactive; k++) {
+                i = active[k];
+                secp256k1_ge_set_gej_zinv(&rge, &rgej[k], &azi[k]);
+                secp256k1_eckey_pubkey_serialize(&rge, tmp, &size, 1);
+                if (j != rsizes[group + i] - 1) {
+                    secp256k1_borromean_hash(tmp, m, mlen, tmp, 33, group + i, j + 1);
+                    secp256k1_scalar_set_b32(&ens[i], tmp, &overflow[i]);
+                } else {
+                    memcpy(rlast[i], tmp, 33);
+                }
             }
-            /* OPT: loop can be hoisted and split to use batch inversion across all the rings; this would make it much faster. */
-            secp256k1_ge_set_gej_var(&rge, &rgej);
-            secp256k1_eckey_pubkey_serialize(&rge, tmp, &size, 1);
-            if (j != rsizes[i] - 1) {
-                secp256k1_borromean_hash(tmp, m, mlen, tmp, 33, i, j + 1);
-                secp256k1_scalar_set_b32(&ens, tmp, &overflow);
-            } else {
-                secp256k1_sha256_write(&sha256_e0, tmp, size);
+        }
+        for (i = 0; i < ngroup; i++) {
+            if (rsizes[group + i] > 0) {
+                secp256k1_sha256_write(&sha256_e0, rlast[i], 33);
             }
-            count++;
         }
     }
     secp256k1_sha256_write(&sha256_e0, m, mlen);
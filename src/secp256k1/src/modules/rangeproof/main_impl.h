@@ -71,23 +71,18 @@ int secp256k1_pedersen_blind_sum(const secp256k1_context* ctx, unsigned char *bl
     return 1;
 }
 
-/* Takes two list of 33-byte commitments and sums the first set and subtracts the second and verifies that they sum to excess. */
-int secp256k1_pedersen_verify_tally(const secp256k1_context* ctx, const unsigned char * const *commits, int pcnt,
+static int secp256k1_pedersen_tally_impl(const secp256k1_pedersen_context *pedersen_ctx, const unsigned char * const *commits, int pcnt,
  const unsigned char * const *ncommits, int ncnt, int64_t excess) {
     secp256k1_gej accj;
     secp256k1_ge add;
     int i;
-    ARG_CHECK(ctx != NULL);
-    ARG_CHECK(!pcnt || (commits != NULL));
-    ARG_CHECK(!ncnt || (ncommits != NULL));
-    ARG_CHECK(secp256k1_pedersen_context_is_built(&ctx->pedersen_ctx));
     secp256k1_gej_set_infinity(&accj);
     if (excess) {
         uint64_t ex;
         int neg;
         /* Take the absolute value, and negate the result if the input was negative. */
         neg = secp256k1_sign_and_abs64(&ex, excess);
-        secp256k1_pedersen_ecmult_small(&ctx->pedersen_ctx, &accj, ex);
+        secp256k1_pedersen_ecmult_small(pedersen_ctx, &accj, ex);
         if (neg) {
             secp256k1_gej_neg(&accj, &accj);
         }
@@ -108,6 +103,35 @@ int secp256k1_pedersen_verify_tally(const secp256k1_context* ctx, const unsigned
     return secp256k1_gej_is_infinity(&accj);
 }
 
+/* Takes two list of 33-byte commitments and sums the first set and subtracts the second and verifies that they sum to excess. */
+int secp256k1_pedersen_verify_tally(const secp256k1_context* ctx, const unsigned char * const *commits, int pcnt,
+ const unsigned char * const *ncommits, int ncnt, int64_t excess) {
+    ARG_CHECK(ctx != NULL);
+    ARG_CHECK(!pcnt || (commits != NULL));
+    ARG_CHECK(!ncnt || (ncommits != NULL));
+    ARG_CHECK(secp256k1_pedersen_context_is_built(&ctx->pedersen_ctx));
+    return secp256k1_pedersen_tally_impl(&ctx->pedersen_ctx, commits, pcnt, ncommits, ncnt, excess);
+}
+
+int secp256k1_pedersen_verify_tally_batch(const secp256k1_context* ctx, const unsigned char * const * const *commits, const int *pcnts,
+ const unsigned char * const * const *ncommits, const int *ncnts, const int64_t *excesses, int n) {
+    int i;
+    ARG_CHECK(ctx != NULL);
+    ARG_CHECK(n >= 0);
+    ARG_CHECK(!n || (commits != NULL && pcnts != NULL));
+    ARG_CHECK(!n || (ncommits != NULL && ncnts != NULL));
+    ARG_CHECK(!n || (excesses != NULL));
+    ARG_CHECK(secp256k1_pedersen_context_is_built(&ctx->pedersen_ctx));
+    for (i = 0; i < n; i++) {
+        ARG_CHECK(!pcnts[i] || (commits[i] != NULL));
+        ARG_CHECK(!ncnts[i] || (ncommits[i] != NULL));
+        if (!secp256k1_pedersen_tally_impl(&ctx->pedersen_ctx, commits[i], pcnts[i], ncommits[i], ncnts[i], excesses[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 void secp256k1_rangeproof_context_initialize(secp256k1_context* ctx) {
     secp256k1_rangeproof_context_build(&ctx->rangeproof_ctx, &ctx->error_callback);
 }
@@ -126,6 +150,16 @@ int secp256k1_rangeproof_info(const secp256k1_context* ctx, int *exp, int *manti
     return secp256k1_rangeproof_getheader_impl(&offset, exp, mantissa, &scale, min_value, max_value, proof, plen);
 }
 
+int secp256k1_rangeproof_rewind_precheck(const secp256k1_context* ctx, const unsigned char *nonce,
+ const unsigned char *commit, const unsigned char *proof, int plen) {
+    ARG_CHECK(ctx != NULL);
+    ARG_CHECK(nonce != NULL);
+    ARG_CHECK(commit != NULL);
+    ARG_CHECK(proof != NULL);
+    (void)ctx;
+    return secp256k1_rangeproof_rewind_precheck_impl(nonce, commit, proof, plen);
+}
+
 int secp256k1_rangeproof_rewind(const secp256k1_context* ctx,
  unsigned char *blind_out, uint64_t *value_out, unsigned char *message_out, int *outlen, const unsigned char *nonce,
  uint64_t *min_value, uint64_t *max_value,
@@ -157,6 +191,20 @@ int secp256k1_rangeproof_verify(const secp256k1_context* ctx, uint64_t *min_valu
      NULL, NULL, NULL, NULL, NULL, min_value, max_value, commit, proof, plen);
 }
 
+int secp256k1_rangeproof_verify_batch(const secp256k1_context* ctx, const unsigned char * const *commits,
+ const unsigned char * const *proofs, const int *plens, int n) {
+    ARG_CHECK(ctx != NULL);
+    ARG_CHECK(n >= 0);
+    ARG_CHECK(!n || (commits != NULL));
+    ARG_CHECK(!n || (proofs != NULL));
+    ARG_CHECK(!n || (plens != NULL));
+    ARG_CHECK(secp256k1_ecmult_context_is_built(&ctx->ecmult_ctx));
+    ARG_CHECK(secp256k1_pedersen_context_is_built(&ctx->pedersen_ctx));
+    ARG_CHECK(secp256k1_rangeproof_context_is_built(&ctx->rangeproof_ctx));
+    return secp256k1_rangeproof_verify_batch_impl(&ctx->ecmult_ctx, &ctx->pedersen_ctx, &ctx->rangeproof_ctx, &ctx->error_callback,
+     commits, proofs, plens, n);
+}
+
 int secp256k1_rangeproof_sign(const secp256k1_context* ctx, unsigned char *proof, int *plen, uint64_t min_value,
  const unsigned char *commit, const unsigned char *blind, const unsigned char *nonce, int exp, int min_bits, uint64_t value){
     ARG_CHECK(ctx != NULL);
@@ -14,6 +14,17 @@ typedef struct {
     secp256k1_ge_storage (*prec)[1005];
 } secp256k1_rangeproof_context;
 
+/** Everything derived from a parsed proof that the Borromean signature check needs. */
+typedef struct {
+    secp256k1_gej pubs[128];
+    secp256k1_scalar s[128];
+    int rsizes[32];
+    int rings;
+    int npub;
+    unsigned char m[32];
+    const unsigned char *e0;
+} secp256k1_rangeproof_verify_data;
+
 
 static void secp256k1_rangeproof_context_init(secp256k1_rangeproof_context* ctx);
 static void secp256k1_rangeproof_context_build(secp256k1_rangeproof_context* ctx, const secp256k1_callback* cb);
@@ -28,4 +39,8 @@ static int secp256k1_rangeproof_verify_impl(const secp256k1_ecmult_context* ecmu
  unsigned char *blindout, uint64_t *value_out, unsigned char *message_out, int *outlen, const unsigned char *nonce,
  uint64_t *min_value, uint64_t *max_value, const unsigned char *commit, const unsigned char *proof, int plen);
 
+static int secp256k1_rangeproof_verify_batch_impl(const secp256k1_ecmult_context* ecmult_ctx,
+ const secp256k1_pedersen_context* pedersen_ctx, const secp256k1_rangeproof_context* rangeproof_ctx, const secp256k1_callback *cb,
+ const unsigned char * const *commits, const unsigned char * const *proofs, const int *plens, int n);
+
 #endif
@@ -593,38 +593,97 @@ SECP256K1_INLINE static int secp256k1_rangeproof_getheader_impl(int *offset, int
     return 1;
 }
 
+/* Regenerates the prover's random values from nonce and looks for the value encoding in the last ring, exactly as
+ * secp256k1_rangeproof_rewind_inner does, but straight from the proof bytes so that no point needs to be parsed.
+ * Returns 0 if rewinding with this nonce is certain to fail. */
+SECP256K1_INLINE static int secp256k1_rangeproof_rewind_precheck_impl(const unsigned char *nonce, const unsigned char *commit,
+ const unsigned char *proof, int plen) {
+    secp256k1_scalar s_orig[128];
+    secp256k1_scalar sec[32];
+    unsigned char prep[4096];
+    unsigned char tmp[32];
+    uint64_t scale;
+    uint64_t min_value;
+    uint64_t max_value;
+    int rsizes[32];
+    int exp;
+    int mantissa;
+    int offset;
+    int soffset;
+    int rings;
+    int npub;
+    int ret;
+    int i;
+    int j;
+    offset = 0;
+    if (!secp256k1_rangeproof_getheader_impl(&offset, &exp, &mantissa, &scale, &min_value, &max_value, proof, plen)) {
+        return 0;
+    }
+    if (mantissa == 0) {
+        /* A proof of an exact value has no value encoding to look for. */
+        return 1;
+    }
+    rings = mantissa >> 1;
+    for (i = 0; i < rings; i++) {
+        rsizes[i] = 4;
+    }
+    npub = rings << 2;
+    if (mantissa & 1) {
+        rsizes[rings] = 2;
+        npub += 2;
+        rings++;
+    }
+    if (plen - offset < 32 * (npub + rings - 1) + 32 + ((rings+6) >> 3)) {
+        return 0;
+    }
+    /* The signatures follow the sign bits, the blinded digits and e0. */
+    soffset = offset + ((rings + 6) >> 3) + 32 * (rings - 1) + 32;
+    memset(prep, 0, 4096);
+    secp256k1_rangeproof_genrand(sec, s_orig, prep, rsizes, rings, nonce, commit, proof, offset);
+    ret = 0;
+    npub = (rings - 1) << 2;
+    for (j = 0; j < 2; j++) {
+        int idx;
+        idx = npub + rsizes[rings - 1] - 1 - j;
+        memcpy(tmp, &proof[soffset + idx * 32], 32);
+        secp256k1_rangeproof_ch32xor(tmp, &prep[idx * 32]);
+        if ((tmp[0] & 128) && (memcmp(&tmp[16], &tmp[24], 8) == 0) && (memcmp(&tmp[8], &tmp[16], 8) == 0)) {
+            ret = 1;
+        }
+    }
+    memset(prep, 0, 4096);
+    memset(tmp, 0, 32);
+    for (i = 0; i < 128; i++) {
+        secp256k1_scalar_clear(&s_orig[i]);
+    }
+    for (i = 0; i < 32; i++) {
+        secp256k1_scalar_clear(&sec[i]);
+    }
+    return ret;
+}
+
 /* Verifies range proof (len plen) for 33-byte commit, the min/max values proven are put in the min/max arguments; returns 0 on failure 1 on success.*/
-SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecmult_context* ecmult_ctx,
- const secp256k1_ecmult_gen_context* ecmult_gen_ctx,
- const secp256k1_pedersen_context* pedersen_ctx, const secp256k1_rangeproof_context* rangeproof_ctx,
- unsigned char *blindout, uint64_t *value_out, unsigned char *message_out, int *outlen, const unsigned char *nonce,
+/* Parses a proof and derives everything needed to check its Borromean signature. */
+SECP256K1_INLINE static int secp256k1_rangeproof_verify_setup(secp256k1_rangeproof_verify_data *data, int *offset_post_header,
+ int *exp, uint64_t *scale, const secp256k1_pedersen_context* pedersen_ctx, const secp256k1_rangeproof_context* rangeproof_ctx,
  uint64_t *min_value, uint64_t *max_value, const unsigned char *commit, const unsigned char *proof, int plen) {
     secp256k1_gej accj;
-    secp256k1_gej pubs[128];
     secp256k1_ge c;
-    secp256k1_scalar s[128];
-    secp256k1_scalar evalues[128]; /* Challenges, only used during proof rewind. */
     secp256k1_sha256_t sha256_m;
-    int rsizes[32];
-    int ret;
     int i;
-    size_t size;
-    int exp;
     int mantissa;
     int offset;
     int rings;
     int overflow;
     int npub;
-    int offset_post_header;
-    uint64_t scale;
     unsigned char signs[31];
     unsigned char m[33];
-    const unsigned char *e0;
+    int *rsizes = data->rsizes;
     offset = 0;
-    if (!secp256k1_rangeproof_getheader_impl(&offset, &exp, &mantissa, &scale, min_value, max_value, proof, plen)) {
+    if (!secp256k1_rangeproof_getheader_impl(&offset, exp, &mantissa, scale, min_value, max_value, proof, plen)) {
         return 0;
     }
-    offset_post_header = offset;
+    *offset_post_header = offset;
     rings = 1;
     rsizes[0] = 1;
     npub = 1;
@@ -669,7 +728,7 @@ SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecm
             return 0;
         }
         secp256k1_sha256_write(&sha256_m, m, 33);
-        secp256k1_gej_set_ge(&pubs[npub], &c);
+        secp256k1_gej_set_ge(&data->pubs[npub], &c);
         secp256k1_gej_add_ge_var(&accj, &accj, &c, NULL);
         offset += 32;
         npub += rsizes[i];
@@ -678,16 +737,16 @@ SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecm
     if (!secp256k1_eckey_pubkey_parse(&c, commit, 33)) {
         return 0;
     }
-    secp256k1_gej_add_ge_var(&pubs[npub], &accj, &c, NULL);
-    if (secp256k1_gej_is_infinity(&pubs[npub])) {
+    secp256k1_gej_add_ge_var(&data->pubs[npub], &accj, &c, NULL);
+    if (secp256k1_gej_is_infinity(&data->pubs[npub])) {
         return 0;
     }
-    secp256k1_rangeproof_pub_expand(rangeproof_ctx, pubs, exp, rsizes, rings);
+    secp256k1_rangeproof_pub_expand(rangeproof_ctx, data->pubs, *exp, rsizes, rings);
     npub += rsizes[rings - 1];
-    e0 = &proof[offset];
+    data->e0 = &proof[offset];
     offset += 32;
     for (i = 0; i < npub; i++) {
-        secp256k1_scalar_set_b32(&s[i], &proof[offset], &overflow);
+        secp256k1_scalar_set_b32(&data->s[i], &proof[offset], &overflow);
         if (overflow) {
             return 0;
         }
@@ -697,8 +756,31 @@ SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecm
         /*Extra data found, reject.*/
         return 0;
     }
-    secp256k1_sha256_finalize(&sha256_m, m);
-    ret = secp256k1_borromean_verify(ecmult_ctx, nonce ? evalues : NULL, e0, s, pubs, rsizes, rings, m, 32);
+    secp256k1_sha256_finalize(&sha256_m, data->m);
+    data->rings = rings;
+    data->npub = npub;
+    return 1;
+}
+
+SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecmult_context* ecmult_ctx,
+ const secp256k1_ecmult_gen_context* ecmult_gen_ctx,
+ const secp256k1_pedersen_context* pedersen_ctx, const secp256k1_rangeproof_context* rangeproof_ctx,
+ unsigned char *blindout, uint64_t *value_out, unsigned char *message_out, int *outlen, const unsigned char *nonce,
+ uint64_t *min_value, uint64_t *max_value, const unsigned char *commit, const unsigned char *proof, int plen) {
+    secp256k1_rangeproof_verify_data data;
+    secp256k1_gej accj;
+    secp256k1_ge c;
+    secp256k1_scalar evalues[128]; /* Challenges, only used during proof rewind. */
+    int ret;
+    size_t size;
+    int exp;
+    int offset_post_header;
+    uint64_t scale;
+    if (!secp256k1_rangeproof_verify_setup(&data, &offset_post_header, &exp, &scale, pedersen_ctx, rangeproof_ctx,
+     min_value, max_value, commit, proof, plen)) {
+        return 0;
+    }
+    ret = secp256k1_borromean_verify(ecmult_ctx, nonce ? evalues : NULL, data.e0, data.s, data.pubs, data.rsizes, data.rings, data.m, 32);
     if (ret && nonce) {
         /* Given the nonce, try rewinding the witness to recover its initial state. */
         secp256k1_scalar blind;
@@ -707,7 +789,7 @@ SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecm
         if (!ecmult_gen_ctx) {
             return 0;
         }
-        if (!secp256k1_rangeproof_rewind_inner(&blind, &vv, message_out, outlen, evalues, s, rsizes, rings, nonce, commit, proof, offset_post_header)) {
+        if (!secp256k1_rangeproof_rewind_inner(&blind, &vv, message_out, outlen, evalues, data.s, data.rsizes, data.rings, nonce, commit, proof, offset_post_header)) {
             return 0;
         }
         /* Unwind apparently successful, see if the commitment can be reconstructed. */
@@ -733,4 +815,118 @@ SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecm
     return ret;
 }
 
+/* Verifies n proofs together. All proofs are parsed first, then the Borromean rings of every proof are walked in
+ * lock-step so that each step converts all of its points to affine coordinates with one shared field inversion,
+ * instead of one inversion per point. The challenge chain inside a ring is a hash of the previous point, so the
+ * rings themselves cannot be folded into a single multi-exponentiation. Returns 1 only if every proof is valid. */
+SECP256K1_INLINE static int secp256k1_rangeproof_verify_batch_impl(const secp256k1_ecmult_context* ecmult_ctx,
+ const secp256k1_pedersen_context* pedersen_ctx, const secp256k1_rangeproof_context* rangeproof_ctx, const secp256k1_callback *cb,
+ const unsigned char * const *commits, const unsigned char * const *proofs, const int *plens, int n) {
+    secp256k1_rangeproof_verify_data *data;
+    secp256k1_scalar *ens;
+    secp256k1_gej *rgej;
+    secp256k1_ge *rge;
+    unsigned char (*rlast)[33];
+    int *active;
+    secp256k1_sha256_t sha256_e0;
+    unsigned char tmp[33];
+    size_t size;
+    uint64_t min_value;
+    uint64_t max_value;
+    uint64_t scale;
+    int offset_post_header;
+    int exp;
+    int overflow;
+    int nrings;
+    int nactive;
+    int ret;
+    int i;
+    int j;
+    int k;
+    if (n <= 0) {
+        return 1;
+    }
+    ret = 0;
+    data = (secp256k1_rangeproof_verify_data *)checked_malloc(cb, sizeof(secp256k1_rangeproof_verify_data) * n);
+    ens = (secp256k1_scalar *)checked_malloc(cb, sizeof(secp256k1_scalar) * 32 * n);
+    rgej = (secp256k1_gej *)checked_malloc(cb, sizeof(secp256k1_gej) * 32 * n);
+    rge = (secp256k1_ge *)checked_malloc(cb, sizeof(secp256k1_ge) * 32 * n);
+    rlast = (unsigned char (*)[33])checked_malloc(cb, 33 * 32 * n);
+    active = (int *)checked_malloc(cb, sizeof(int) * 32 * n);
+    /* Ring number k * 32 + i is ring i of proof k. */
+    for (k = 0; k < n; k++) {
+        if (!secp256k1_rangeproof_verify_setup(&data[k], &offset_post_header, &exp, &scale, pedersen_ctx, rangeproof_ctx,
+         &min_value, &max_value, commits[k], proofs[k], plens[k])) {
+            goto done;
+        }
+        for (i = 0; i < data[k].rings; i++) {
+            secp256k1_borromean_hash(tmp, data[k].m, 32, data[k].e0, 32, i, 0);
+            secp256k1_scalar_set_b32(&ens[k * 32 + i], tmp, &overflow);
+            if (overflow) {
+                goto done;
+            }
+        }
+    }
+    for (j = 0; j < 4; j++) {
+        nactive = 0;
+        for (k = 0; k < n; k++) {
+            int count = 0;
+            for (i = 0; i < data[k].rings; i++) {
+                const int r = k * 32 + i;
+                if (j < data[k].rsizes[i]) {
+                    if (secp256k1_scalar_is_zero(&data[k].s[count + j]) || secp256k1_scalar_is_zero(&ens[r]) ||
+                     secp256k1_gej_is_infinity(&data[k].pubs[count + j])) {
+                        goto done;
+                    }
+                    secp256k1_ecmult(ecmult_ctx, &rgej[nactive], &data[k].pubs[count + j], &ens[r], &data[k].s[count + j]);
+                    if (secp256k1_gej_is_infinity(&rgej[nactive])) {
+                        goto done;
+                    }
+                    active[nactive++] = r;
+                }
+                count += data[k].rsizes[i];
+            }
+        }
+        if (nactive == 0) {
+            break;
+        }
+        secp256k1_ge_set_all_gej_var(nactive, rge, rgej, cb);
+        for (i = 0; i < nactive; i++) {
+            const int r = active[i];
+            const secp256k1_rangeproof_verify_data *d = &data[r / 32];
+            secp256k1_eckey_pubkey_serialize(&rge[i], tmp, &size, 1);
+            if (j != d->rsizes[r % 32] - 1) {
+                secp256k1_borromean_hash(tmp, d->m, 32, tmp, 33, r % 32, j + 1);
+                secp256k1_scalar_set_b32(&ens[r], tmp, &overflow);
+                if (overflow) {
+                    goto done;
+                }
+            } else {
+                memcpy(rlast[r], tmp, 33);
+            }
+        }
+    }
+    for (k = 0; k < n; k++) {
+        nrings = data[k].rings;
+        secp256k1_sha256_initialize(&sha256_e0);
+        for (i = 0; i < nrings; i++) {
+            secp256k1_sha256_write(&sha256_e0, rlast[k * 32 + i], 33);
+        }
+        secp256k1_sha256_write(&sha256_e0, data[k].m, 32);
+        secp256k1_sha256_finalize(&sha256_e0, tmp);
+        if (memcmp(data[k].e0, tmp, 32) != 0) {
+            goto done;
+        }
+    }
+    ret = 1;
+done:
+    free(active);
+    free(rlast);
+    free(rge);
+    free(rgej);
+    free(ens);
+    free(data);
+    return ret;
+}
+
 #endif
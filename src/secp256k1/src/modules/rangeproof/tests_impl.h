@@ -76,6 +76,24 @@ void test_pedersen(void) {
     CHECK(secp256k1_pedersen_verify_tally(ctx, &cptr[0], 1, &cptr[1], 1, INT64_MAX));
     CHECK(secp256k1_pedersen_verify_tally(ctx, &cptr[1], 1, &cptr[1], 1, 0));
     CHECK(secp256k1_pedersen_verify_tally(ctx, &cptr[1], 1, &cptr[0], 1, -INT64_MAX));
+    {
+        const unsigned char * const *bcommits[3];
+        const unsigned char * const *bncommits[3];
+        int pcnts[3] = {1, 1, 1};
+        int ncnts[3] = {1, 1, 1};
+        int64_t excesses[3] = {-1, 0, INT64_MAX};
+        bcommits[0] = &cptr[1];
+        bncommits[0] = &cptr[2];
+        bcommits[1] = &cptr[0];
+        bncommits[1] = &cptr[0];
+        bcommits[2] = &cptr[0];
+        bncommits[2] = &cptr[1];
+        CHECK(secp256k1_pedersen_verify_tally_batch(ctx, bcommits, pcnts, bncommits, ncnts, excesses, 0));
+        CHECK(secp256k1_pedersen_verify_tally_batch(ctx, bcommits, pcnts, bncommits, ncnts, excesses, 3));
+        excesses[1] = 1;
+        CHECK(!secp256k1_pedersen_verify_tally_batch(ctx, bcommits, pcnts, bncommits, ncnts, excesses, 3));
+        CHECK(secp256k1_pedersen_verify_tally_batch(ctx, bcommits, pcnts, bncommits, ncnts, excesses, 1));
+    }
 }
 
 void test_borromean(void) {
@@ -182,6 +200,7 @@ void test_rangeproof(void) {
             len = 5134;
             CHECK(secp256k1_rangeproof_sign(ctx, proof, &len, v, commit, blind, commit, -1, 64, v));
             CHECK(len <= 73);
+            CHECK(secp256k1_rangeproof_rewind_precheck(ctx, blind, commit, proof, len));
             CHECK(secp256k1_rangeproof_rewind(ctx, blindout, &vout, NULL, NULL, commit, &minv, &maxv, commit, proof, len));
             CHECK(memcmp(blindout, blind, 32) == 0);
             CHECK(vout == v);
@@ -239,6 +258,8 @@ void test_rangeproof(void) {
         }
         CHECK(secp256k1_rangeproof_sign(ctx, proof, &len, vmin, commit, blind, commit, exp, min_bits, v));
         CHECK(len <= 5134);
+        CHECK(secp256k1_rangeproof_rewind_precheck(ctx, commit, commit, proof, len));
+        CHECK(!secp256k1_rangeproof_rewind_precheck(ctx, blind, commit, proof, len));
         mlen = 4096;
         CHECK(secp256k1_rangeproof_rewind(ctx, blindout, &vout, message, &mlen, commit, &minv, &maxv, commit, proof, len));
         for (j = 0; j < mlen; j++) {
@@ -265,6 +286,41 @@ void test_rangeproof(void) {
     }
 }
 
+void test_rangeproof_batch(void) {
+    unsigned char commits[4][33];
+    unsigned char proofs[4][5134];
+    unsigned char blind[32];
+    const unsigned char *commitptr[4];
+    const unsigned char *proofptr[4];
+    int plens[4];
+    uint64_t minv;
+    uint64_t maxv;
+    int i;
+    for (i = 0; i < 4; i++) {
+        uint64_t v = secp256k1_rands64(0, UINT64_MAX >> (secp256k1_rand32()&63));
+        secp256k1_rand256(blind);
+        CHECK(secp256k1_pedersen_commit(ctx, commits[i], blind, v));
+        plens[i] = 5134;
+        /* Mix proof shapes so the rings of different proofs finish at different steps. */
+        CHECK(secp256k1_rangeproof_sign(ctx, proofs[i], &plens[i], 0, commits[i], blind, commits[i], i - 1, i * 16, v));
+        commitptr[i] = commits[i];
+        proofptr[i] = proofs[i];
+    }
+    CHECK(secp256k1_rangeproof_verify_batch(ctx, commitptr, proofptr, plens, 0));
+    CHECK(secp256k1_rangeproof_verify_batch(ctx, commitptr, proofptr, plens, 1));
+    CHECK(secp256k1_rangeproof_verify_batch(ctx, commitptr, proofptr, plens, 4));
+    for (i = 0; i < 4; i++) {
+        int bit = secp256k1_rand32() % (plens[i] * 8);
+        proofs[i][bit >> 3] ^= 1 << (bit & 7);
+        CHECK(!secp256k1_rangeproof_verify_batch(ctx, commitptr, proofptr, plens, 4));
+        CHECK(!secp256k1_rangeproof_verify(ctx, &minv, &maxv, commits[i], proofs[i], plens[i]));
+        proofs[i][bit >> 3] ^= 1 << (bit & 7);
+    }
+    /* A valid proof against the wrong commitment must fail the batch too. */
+    commitptr[0] = commits[1];
+    CHECK(!secp256k1_rangeproof_verify_batch(ctx, commitptr, proofptr, plens, 4));
+}
+
 void run_rangeproof_tests(void) {
     int i;
     secp256k1_pedersen_context_initialize(ctx);
@@ -276,6 +332,9 @@ void run_rangeproof_tests(void) {
         test_borromean();
     }
     test_rangeproof();
+    for (i = 0; i < count; i++) {
+        test_rangeproof_batch();
+    }
 }
 
 #endif
@@ -70,6 +70,46 @@ int secp256k1_schnorr_verify(const secp256k1_context* ctx, const unsigned char *
     return secp256k1_schnorr_sig_verify(&ctx->ecmult_ctx, sig64, &q, secp256k1_schnorr_msghash_sha256, msg32);
 }
 
+int secp256k1_schnorr_verify_batch(const secp256k1_context* ctx, const unsigned char * const *sig64s, const unsigned char * const *msg32s, const secp256k1_pubkey * const *pubkeys, size_t n) {
+    secp256k1_ge *keys;
+    const secp256k1_pubkey **distinct;
+    size_t *keyidx;
+    size_t nkeys = 0;
+    size_t i, j;
+    int ret;
+    VERIFY_CHECK(ctx != NULL);
+    ARG_CHECK(secp256k1_ecmult_context_is_built(&ctx->ecmult_ctx));
+    ARG_CHECK(!n || (sig64s != NULL));
+    ARG_CHECK(!n || (msg32s != NULL));
+    ARG_CHECK(!n || (pubkeys != NULL));
+
+    if (n == 0) {
+        return 1;
+    }
+
+    /* Signatures by the same key share one term of the multi-exponentiation. */
+    keys = (secp256k1_ge*)checked_malloc(&ctx->error_callback, sizeof(secp256k1_ge) * n);
+    distinct = (const secp256k1_pubkey**)checked_malloc(&ctx->error_callback, sizeof(secp256k1_pubkey*) * n);
+    keyidx = (size_t*)checked_malloc(&ctx->error_callback, sizeof(size_t) * n);
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < nkeys; j++) {
+            if (distinct[j] == pubkeys[i] || memcmp(distinct[j], pubkeys[i], sizeof(secp256k1_pubkey)) == 0) {
+                break;
+            }
+        }
+        if (j == nkeys) {
+            secp256k1_pubkey_load(ctx, &keys[nkeys], pubkeys[i]);
+            distinct[nkeys++] = pubkeys[i];
+        }
+        keyidx[i] = j;
+    }
+    ret = secp256k1_schnorr_sig_verify_batch(&ctx->ecmult_ctx, &ctx->error_callback, n, sig64s, msg32s, keyidx, nkeys, keys, secp256k1_schnorr_msghash_sha256);
+    free(keyidx);
+    free(distinct);
+    free(keys);
+    return ret;
+}
+
 int secp256k1_schnorr_recover(const secp256k1_context* ctx, secp256k1_pubkey *pubkey, const unsigned char *sig64, const unsigned char *msg32) {
     secp256k1_ge q;
 
@@ -57,6 +57,17 @@
  *   Option 2 (allows batch validation and pubkey recovery):
  *     Decompress x coordinate r into point R, with odd y coordinate. Fail if R is not on the curve.
  *     Signature is valid if R + h * Q + s * G == 0.
+ *
+ * Batch verification:
+ *   Inputs: n signatures (r_i, s_i) on messages m_i with public keys Q_i.
+ *
+ *   Decompress every r_i into R_i with even y coordinate (as Option 1 requires of R) and
+ *   compute h_i as above. Pick weights a_i, with a_0 = 1 and the others 128-bit scalars
+ *   derived from a hash of all inputs. All signatures are valid (except with negligible
+ *   probability) if (sum a_i * s_i) * G + sum (a_i * h_i) * Q_i - sum a_i * R_i == 0.
+ *   Signatures sharing a public key share its term, so the cost of the one
+ *   multi-exponentiation grows mostly with the number of distinct keys and the (short)
+ *   R_i terms rather than with the number of signatures.
  */
 
 static int secp256k1_schnorr_sig_sign(const secp256k1_ecmult_gen_context* ctx, unsigned char *sig64, const secp256k1_scalar *key, const secp256k1_scalar *nonce, const secp256k1_ge *pubnonce, secp256k1_schnorr_msghash hash, const unsigned char *msg32) {
@@ -178,6 +189,147 @@ static int secp256k1_schnorr_sig_recover(const secp256k1_ecmult_context* ctx, co
     return 1;
 }
 
+static int secp256k1_schnorr_sig_verify_batch(const secp256k1_ecmult_context* ctx, const secp256k1_callback* cb, size_t n, const unsigned char * const *sig64, const unsigned char * const *msg32, const size_t *keyidx, size_t nkeys, const secp256k1_ge *pubkeys, secp256k1_schnorr_msghash hash) {
+    /* Points are the distinct public keys followed by the R_i, each with its own scalar. */
+    const size_t npoints = nkeys + n;
+    const size_t tsize = ECMULT_TABLE_SIZE(WINDOW_A);
+    secp256k1_gej *prej;
+    secp256k1_ge *pre;
+    secp256k1_scalar *scalars;
+    int *wnaf;
+    int *bits;
+    int wnaf_g[256];
+    int bits_g;
+    int maxbits;
+    secp256k1_scalar sg;
+    secp256k1_sha256_t sha;
+    unsigned char seed[32];
+    secp256k1_gej r;
+    secp256k1_ge tmp;
+    size_t i, j;
+    int k;
+    int ret = 0;
+
+    if (n == 0) {
+        return 1;
+    }
+
+    prej = (secp256k1_gej*)checked_malloc(cb, sizeof(secp256k1_gej) * npoints * tsize);
+    pre = (secp256k1_ge*)checked_malloc(cb, sizeof(secp256k1_ge) * npoints * tsize);
+    scalars = (secp256k1_scalar*)checked_malloc(cb, sizeof(secp256k1_scalar) * npoints);
+    wnaf = (int*)checked_malloc(cb, sizeof(int) * npoints * 256);
+    bits = (int*)checked_malloc(cb, sizeof(int) * npoints);
+
+    /* The weights must not be predictable before all signatures are fixed. */
+    secp256k1_sha256_initialize(&sha);
+    for (i = 0; i < n; i++) {
+        unsigned char q[64];
+        secp256k1_ge q_ge = pubkeys[keyidx[i]];
+        secp256k1_fe_normalize_var(&q_ge.x);
+        secp256k1_fe_normalize_var(&q_ge.y);
+        secp256k1_fe_get_b32(q, &q_ge.x);
+        secp256k1_fe_get_b32(q + 32, &q_ge.y);
+        secp256k1_sha256_write(&sha, sig64[i], 64);
+        secp256k1_sha256_write(&sha, msg32[i], 32);
+        secp256k1_sha256_write(&sha, q, 64);
+    }
+    secp256k1_sha256_finalize(&sha, seed);
+
+    secp256k1_scalar_clear(&sg);
+    for (i = 0; i < nkeys; i++) {
+        secp256k1_scalar_clear(&scalars[i]);
+    }
+    for (i = 0; i < n; i++) {
+        secp256k1_scalar a, h, s;
+        secp256k1_fe Rx;
+        secp256k1_ge Ra;
+        unsigned char hh[32];
+        int overflow = 0;
+
+        hash(hh, sig64[i], msg32[i]);
+        secp256k1_scalar_set_b32(&h, hh, &overflow);
+        if (overflow || secp256k1_scalar_is_zero(&h)) {
+            goto done;
+        }
+        secp256k1_scalar_set_b32(&s, sig64[i] + 32, &overflow);
+        if (overflow) {
+            goto done;
+        }
+        if (!secp256k1_fe_set_b32(&Rx, sig64[i]) || !secp256k1_ge_set_xo_var(&Ra, &Rx, 0)) {
+            goto done;
+        }
+
+        if (i == 0) {
+            secp256k1_scalar_set_int(&a, 1);
+        } else {
+            unsigned char a32[32];
+            unsigned char idx[8];
+            for (k = 0; k < 8; k++) {
+                idx[k] = (unsigned char)(((uint64_t)i) >> (8 * k));
+            }
+            secp256k1_sha256_initialize(&sha);
+            secp256k1_sha256_write(&sha, seed, 32);
+            secp256k1_sha256_write(&sha, idx, 8);
+            secp256k1_sha256_finalize(&sha, a32);
+            memset(a32, 0, 16);
+            secp256k1_scalar_set_b32(&a, a32, NULL);
+        }
+
+        secp256k1_scalar_mul(&s, &s, &a);
+        secp256k1_scalar_add(&sg, &sg, &s);
+        secp256k1_scalar_mul(&h, &h, &a);
+        secp256k1_scalar_add(&scalars[keyidx[i]], &scalars[keyidx[i]], &h);
+        secp256k1_scalar_negate(&scalars[nkeys + i], &a);
+        secp256k1_gej_set_ge(&prej[(nkeys + i) * tsize], &Ra);
+    }
+    for (i = 0; i < nkeys; i++) {
+        secp256k1_gej_set_ge(&prej[i * tsize], &pubkeys[i]);
+    }
+
+    /* Odd multiples of every point, all brought to affine with one shared inversion. */
+    for (i = 0; i < npoints; i++) {
+        secp256k1_gej d;
+        secp256k1_gej_double_var(&d, &prej[i * tsize], NULL);
+        for (j = 1; j < tsize; j++) {
+            secp256k1_gej_add_var(&prej[i * tsize + j], &prej[i * tsize + j - 1], &d, NULL);
+        }
+    }
+    secp256k1_ge_set_all_gej_var(npoints * tsize, pre, prej, cb);
+
+    maxbits = bits_g = secp256k1_ecmult_wnaf(wnaf_g, 256, &sg, WINDOW_G);
+    for (i = 0; i < npoints; i++) {
+        bits[i] = secp256k1_ecmult_wnaf(&wnaf[i * 256], 256, &scalars[i], WINDOW_A);
+        if (bits[i] > maxbits) {
+            maxbits = bits[i];
+        }
+    }
+
+    secp256k1_gej_set_infinity(&r);
+    for (k = maxbits - 1; k >= 0; k--) {
+        int m;
+        secp256k1_gej_double_var(&r, &r, NULL);
+        for (i = 0; i < npoints; i++) {
+            if (k < bits[i] && (m = wnaf[i * 256 + k])) {
+                ECMULT_TABLE_GET_GE(&tmp, &pre[i * tsize], m, WINDOW_A);
+                secp256k1_gej_add_ge_var(&r, &r, &tmp, NULL);
+            }
+        }
+        if (k < bits_g && (m = wnaf_g[k])) {
+            ECMULT_TABLE_GET_GE_STORAGE(&tmp, *ctx->pre_g, m, WINDOW_G);
+            secp256k1_gej_add_ge_var(&r, &r, &tmp, NULL);
+        }
+    }
+    ret = secp256k1_gej_is_infinity(&r);
+
+done:
+    free(bits);
+    free(wnaf);
+    free(scalars);
+    free(pre);
+    free(prej);
+    return ret;
+}
+
 static int secp256k1_schnorr_sig_combine(unsigned char *sig64, size_t n, const unsigned char * const *sig64ins) {
     secp256k1_scalar s = SECP256K1_SCALAR_CONST(0, 0, 0, 0, 0, 0, 0, 0);
     size_t i;
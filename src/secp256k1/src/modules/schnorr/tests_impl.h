@@ -156,6 +156,52 @@ void test_schnorr_recovery(void) {
     }
 }
 
+void test_schnorr_batch(void) {
+    unsigned char privkey[3][32];
+    unsigned char msg32[8][32];
+    unsigned char sig64[8][64];
+    secp256k1_pubkey pubkey[3];
+    const unsigned char *sigptr[8];
+    const unsigned char *msgptr[8];
+    const secp256k1_pubkey *pubkeyptr[8];
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        secp256k1_scalar key;
+        random_scalar_order_test(&key);
+        secp256k1_scalar_get_b32(privkey[i], &key);
+        CHECK(secp256k1_ec_pubkey_create(ctx, &pubkey[i], privkey[i]) == 1);
+    }
+    for (i = 0; i < 8; i++) {
+        /* Mostly repeated keys, as with a run of blocks signed by one federation. */
+        int k = secp256k1_rand_int(3);
+        secp256k1_rand256_test(msg32[i]);
+        CHECK(secp256k1_schnorr_sign(ctx, sig64[i], msg32[i], privkey[k], NULL, NULL) == 1);
+        sigptr[i] = sig64[i];
+        msgptr[i] = msg32[i];
+        pubkeyptr[i] = &pubkey[k];
+    }
+    CHECK(secp256k1_schnorr_verify_batch(ctx, sigptr, msgptr, pubkeyptr, 0) == 1);
+    CHECK(secp256k1_schnorr_verify_batch(ctx, sigptr, msgptr, pubkeyptr, 1) == 1);
+    CHECK(secp256k1_schnorr_verify_batch(ctx, sigptr, msgptr, pubkeyptr, 8) == 1);
+
+    for (i = 0; i < 8; i++) {
+        int pos = secp256k1_rand_bits(6);
+        unsigned char orig = sig64[i][pos];
+        sig64[i][pos] += 1 + secp256k1_rand_int(255);
+        CHECK(secp256k1_schnorr_verify_batch(ctx, sigptr, msgptr, pubkeyptr, 8) == 0);
+        sig64[i][pos] = orig;
+    }
+
+    /* A valid signature under the wrong key or message must fail the batch too. */
+    pubkeyptr[0] = &pubkey[(pubkeyptr[0] - pubkey + 1) % 3];
+    CHECK(secp256k1_schnorr_verify_batch(ctx, sigptr, msgptr, pubkeyptr, 8) == 0);
+    pubkeyptr[0] = &pubkey[(pubkeyptr[0] - pubkey + 2) % 3];
+    CHECK(secp256k1_schnorr_verify_batch(ctx, sigptr, msgptr, pubkeyptr, 8) == 1);
+    msgptr[7] = msg32[6];
+    CHECK(secp256k1_schnorr_verify_batch(ctx, sigptr, msgptr, pubkeyptr, 8) == 0);
+}
+
 void run_schnorr_tests(void) {
     int i;
     for (i = 0; i < 32*count; i++) {
@@ -170,6 +216,9 @@ void run_schnorr_tests(void) {
     for (i = 0; i < 10 * count; i++) {
          test_schnorr_threshold();
     }
+    for (i = 0; i < 4 * count; i++) {
+         test_schnorr_batch();
+    }
 }
 
 #endif
@@ -0,0 +1,186 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SHAREDVECTOR_H
+#define BITCOIN_SHAREDVECTOR_H
+
+#include "arena.h"
+#include "serialize.h"
+
+#include <algorithm>
+#include <memory>
+#include <stddef.h>
+#include <vector>
+
+/** Implements a drop-in replacement for std::vector<T> whose copies share
+ *  their elements until one of them is modified (copy on write). Copying one
+ *  costs a reference count update rather than a heap allocation and a copy,
+ *  which suits large blobs that are rarely modified but copied along with the
+ *  objects holding them, such as the rangeproofs of transaction outputs.
+ *
+ *  Only the const member functions give direct access to shared elements; the
+ *  others first make the elements private to this copy. Like std::vector, an
+ *  object must not be modified while another thread accesses it, but distinct
+ *  copies may be used from different threads.
+ *
+ *  Byte elements read from a stream with an arena (CArenaStream) are kept in
+ *  that arena rather than in a std::vector of their own, until modified.
+ */
+template<typename T>
+class shared_vector
+{
+public:
+    typedef T value_type;
+    typedef size_t size_type;
+    typedef const T* const_iterator;
+
+private:
+    std::shared_ptr<std::vector<T> > ptr;
+    //! Elements in an arena instead, if ptr is null
+    std::shared_ptr<const T> pArena;
+    size_type nArenaSize;
+
+    std::vector<T>& detach()
+    {
+        if (!ptr) {
+            ptr = std::make_shared<std::vector<T> >(pArena.get(), pArena.get() + nArenaSize);
+            pArena.reset();
+            nArenaSize = 0;
+        } else if (!ptr.unique())
+            ptr = std::make_shared<std::vector<T> >(*ptr);
+        return *ptr;
+    }
+
+    template<typename Stream>
+    void Unserialize_impl(Stream& s, int nType, int nVersion, const unsigned char&)
+    {
+        // Never write into elements that other copies still refer to.
+        const uint64_t nSize = ReadCompactSize(s);
+        CMonotonicArena* parena = GetStreamArena(s);
+        if (nSize == 0) {
+            clear();
+        } else if (parena && nSize <= CMonotonicArena::MAX_ALLOCATION) {
+            std::shared_ptr<unsigned char> p = parena->Allocate(nSize);
+            s.read((char*)p.get(), nSize);
+            ptr.reset();
+            pArena = p;
+            nArenaSize = nSize;
+        } else {
+            std::shared_ptr<std::vector<T> > ptrNew = std::make_shared<std::vector<T> >();
+            // Limit size per read so bogus size value won't cause out of memory
+            for (uint64_t i = 0; i < nSize; ) {
+                const uint64_t blk = std::min(nSize - i, (uint64_t)(1 + 4999999));
+                ptrNew->resize(i + blk);
+                s.read((char*)&(*ptrNew)[i], blk);
+                i += blk;
+            }
+            ptr.swap(ptrNew);
+            pArena.reset();
+            nArenaSize = 0;
+        }
+    }
+
+    template<typename Stream, typename V>
+    void Unserialize_impl(Stream& s, int nType, int nVersion, const V&)
+    {
+        std::shared_ptr<std::vector<T> > ptrNew = std::make_shared<std::vector<T> >();
+        ::Unserialize(s, *ptrNew, nType, nVersion);
+        clear();
+        if (!ptrNew->empty())
+            ptr.swap(ptrNew);
+    }
+
+public:
+    shared_vector() : nArenaSize(0) {}
+    shared_vector(const std::vector<T>& v) : nArenaSize(0)
+    {
+        if (!v.empty())
+            ptr = std::make_shared<std::vector<T> >(v);
+    }
+    shared_vector(std::vector<T>&& v) : nArenaSize(0)
+    {
+        if (!v.empty())
+            ptr = std::make_shared<std::vector<T> >(std::move(v));
+    }
+
+    size_type size() const { return ptr ? ptr->size() : nArenaSize; }
+    bool empty() const { return size() == 0; }
+    size_type capacity() const { return ptr ? ptr->capacity() : nArenaSize; }
+    //! Whether the elements are in a heap allocation or an arena (possibly shared with other copies)
+    bool is_allocated() const { return ptr != nullptr || pArena != nullptr; }
+    //! Whether the elements are in an arena
+    bool is_in_arena() const { return pArena != nullptr; }
+
+    //! Move elements that are in an arena to an allocation of their own, so that they no longer keep the arena's chunk alive
+    void release_arena()
+    {
+        if (pArena)
+            detach();
+    }
+
+    const T* data() const { return ptr ? ptr->data() : pArena.get(); }
+    T* data() { return detach().data(); }
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + size(); }
+
+    const T& operator[](size_type pos) const { return data()[pos]; }
+    T& operator[](size_type pos) { return detach()[pos]; }
+    const T& back() const { return data()[size() - 1]; }
+    T& back() { return detach().back(); }
+
+    void resize(size_type n) { detach().resize(n); }
+    void assign(size_type n, const T& val) { detach().assign(n, val); }
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last) { detach().assign(first, last); }
+    void clear()
+    {
+        ptr.reset();
+        pArena.reset();
+        nArenaSize = 0;
+    }
+    void swap(shared_vector& other)
+    {
+        ptr.swap(other.ptr);
+        pArena.swap(other.pArena);
+        std::swap(nArenaSize, other.nArenaSize);
+    }
+
+    friend bool operator==(const shared_vector& a, const shared_vector& b)
+    {
+        if (a.data() == b.data() && a.size() == b.size())
+            return true;
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+    }
+
+    friend bool operator!=(const shared_vector& a, const shared_vector& b)
+    {
+        return !(a == b);
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        // Only byte elements are ever in an arena.
+        return ptr ? ::GetSerializeSize(*ptr, nType, nVersion) : GetSizeOfCompactSize(nArenaSize) + nArenaSize;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        if (ptr)
+            ::Serialize(s, *ptr, nType, nVersion);
+        else {
+            WriteCompactSize(s, nArenaSize);
+            if (nArenaSize)
+                s.write((const char*)pArena.get(), nArenaSize);
+        }
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        Unserialize_impl(s, nType, nVersion, T());
+    }
+};
+
+#endif // BITCOIN_SHAREDVECTOR_H
@@ -0,0 +1,305 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "socketevents.h"
+
+#include "netbase.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include <boost/foreach.hpp>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(USE_EPOLL)
+#include <sys/epoll.h>
+#elif defined(USE_KQUEUE)
+#include <sys/event.h>
+#include <sys/time.h>
+#elif defined(USE_POLL)
+#include <poll.h>
+#endif
+
+CSocketEvents::CSocketEvents()
+{
+#ifndef WIN32
+    if (pipe(fdWakeup) == 0) {
+        for (int i = 0; i < 2; i++) {
+            fcntl(fdWakeup[i], F_SETFL, fcntl(fdWakeup[i], F_GETFL) | O_NONBLOCK);
+            fcntl(fdWakeup[i], F_SETFD, FD_CLOEXEC);
+        }
+    } else {
+        LogPrintf("%s: pipe() failed: %s\n", __func__, NetworkErrorString(errno));
+        fdWakeup[0] = fdWakeup[1] = -1;
+    }
+#endif
+#if defined(USE_EPOLL)
+    fdQueue = epoll_create(1);
+    if (fdQueue != -1) {
+        fcntl(fdQueue, F_SETFD, FD_CLOEXEC);
+        if (fdWakeup[0] != -1) {
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.fd = fdWakeup[0];
+            epoll_ctl(fdQueue, EPOLL_CTL_ADD, fdWakeup[0], &ev);
+        }
+    }
+#elif defined(USE_KQUEUE)
+    fdQueue = kqueue();
+    if (fdQueue != -1 && fdWakeup[0] != -1) {
+        struct kevent ev;
+        EV_SET(&ev, fdWakeup[0], EVFILT_READ, EV_ADD, 0, 0, NULL);
+        kevent(fdQueue, &ev, 1, NULL, 0, NULL);
+    }
+#endif
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    if (fdQueue == -1)
+        LogPrintf("%s: unable to create %s instance: %s\n", __func__, Backend(), NetworkErrorString(errno));
+#endif
+}
+
+CSocketEvents::~CSocketEvents()
+{
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    if (fdQueue != -1)
+        close(fdQueue);
+#endif
+#ifndef WIN32
+    for (int i = 0; i < 2; i++)
+        if (fdWakeup[i] != -1)
+            close(fdWakeup[i]);
+#endif
+}
+
+const char* CSocketEvents::Backend()
+{
+#if defined(USE_EPOLL)
+    return "epoll";
+#elif defined(USE_KQUEUE)
+    return "kqueue";
+#elif defined(USE_POLL)
+    return "poll";
+#else
+    return "select";
+#endif
+}
+
+void CSocketEvents::Wakeup()
+{
+#ifndef WIN32
+    if (fdWakeup[1] != -1) {
+        // A full pipe already has a wakeup pending.
+        char c = 0;
+        if (write(fdWakeup[1], &c, 1) < 0) {}
+    }
+#endif
+}
+
+#if defined(USE_EPOLL)
+bool CSocketEvents::Register(SOCKET socket, int nEventsOld, int nEventsNew)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = ((nEventsNew & RECV) ? (uint32_t)EPOLLIN : 0) | ((nEventsNew & SEND) ? (uint32_t)EPOLLOUT : 0);
+    ev.data.fd = socket;
+    if (nEventsNew == 0) {
+        // Closing a socket already unregisters it, so failures are expected.
+        epoll_ctl(fdQueue, EPOLL_CTL_DEL, socket, &ev);
+        return true;
+    }
+    if (epoll_ctl(fdQueue, nEventsOld ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, socket, &ev) == 0)
+        return true;
+    // The descriptor was closed and reused without us noticing, or the reverse.
+    if (errno == ENOENT)
+        return epoll_ctl(fdQueue, EPOLL_CTL_ADD, socket, &ev) == 0;
+    if (errno == EEXIST)
+        return epoll_ctl(fdQueue, EPOLL_CTL_MOD, socket, &ev) == 0;
+    return false;
+}
+#elif defined(USE_KQUEUE)
+bool CSocketEvents::Register(SOCKET socket, int nEventsOld, int nEventsNew)
+{
+    static const int filters[][2] = {{RECV, EVFILT_READ}, {SEND, EVFILT_WRITE}};
+    bool ret = true;
+    for (unsigned int i = 0; i < sizeof(filters) / sizeof(filters[0]); i++) {
+        bool fOld = (nEventsOld & filters[i][0]) != 0;
+        bool fNew = (nEventsNew & filters[i][0]) != 0;
+        if (fOld == fNew)
+            continue;
+        struct kevent ev;
+        EV_SET(&ev, socket, filters[i][1], fNew ? EV_ADD : EV_DELETE, 0, 0, NULL);
+        // Closing a socket already removes its filters, so deletions may fail.
+        if (kevent(fdQueue, &ev, 1, NULL, 0, NULL) == -1 && fNew)
+            ret = false;
+    }
+    return ret;
+}
+#endif
+
+bool CSocketEvents::Wait(const std::vector<Interest>& vInterest, int nTimeoutMs, std::set<int64_t>& setRecv, std::set<int64_t>& setSend)
+{
+    setRecv.clear();
+    setSend.clear();
+
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    if (fdQueue == -1)
+        return false;
+
+    // Bring the kernel's registrations in line with the requested interest.
+    std::map<SOCKET, std::pair<int64_t, int> > mapInterest;
+    BOOST_FOREACH(const Interest& interest, vInterest)
+        if (interest.nEvents != 0)
+            mapInterest[interest.socket] = std::make_pair(interest.nToken, interest.nEvents);
+    for (std::map<SOCKET, std::pair<int64_t, int> >::const_iterator it = mapRegistered.begin(); it != mapRegistered.end(); ++it)
+        if (!mapInterest.count(it->first))
+            Register(it->first, it->second.second, 0);
+    for (std::map<SOCKET, std::pair<int64_t, int> >::iterator it = mapInterest.begin(); it != mapInterest.end(); ) {
+        std::map<SOCKET, std::pair<int64_t, int> >::const_iterator itOld = mapRegistered.find(it->first);
+        int nEventsOld = itOld == mapRegistered.end() ? 0 : itOld->second.second;
+        if (nEventsOld != 0 && itOld->second.first != it->second.first) {
+            // A new socket with the descriptor of an old one
+            Register(it->first, nEventsOld, 0);
+            nEventsOld = 0;
+        }
+        if (nEventsOld != it->second.second && !Register(it->first, nEventsOld, it->second.second)) {
+            // Let recv() report what is wrong with it.
+            LogPrint("net", "%s: unable to watch socket %d: %s\n", __func__, it->first, NetworkErrorString(errno));
+            setRecv.insert(it->second.first);
+            mapInterest.erase(it++);
+            continue;
+        }
+        ++it;
+    }
+    mapRegistered.swap(mapInterest);
+#endif
+
+#if defined(USE_EPOLL)
+    std::vector<struct epoll_event> vEvents(mapRegistered.size() + 1);
+    int nEvents = epoll_wait(fdQueue, &vEvents[0], vEvents.size(), setRecv.empty() ? nTimeoutMs : 0);
+    if (nEvents == -1)
+        return errno == EINTR;
+    for (int i = 0; i < nEvents; i++) {
+        const struct epoll_event& ev = vEvents[i];
+        if (ev.data.fd == fdWakeup[0]) {
+            char buf[64];
+            while (read(fdWakeup[0], buf, sizeof(buf)) > 0) {}
+            continue;
+        }
+        std::map<SOCKET, std::pair<int64_t, int> >::const_iterator it = mapRegistered.find(ev.data.fd);
+        if (it == mapRegistered.end())
+            continue;
+        if (ev.events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            setRecv.insert(it->second.first);
+        if (ev.events & EPOLLOUT)
+            setSend.insert(it->second.first);
+    }
+    return true;
+#elif defined(USE_KQUEUE)
+    // Each socket can have a read and a write filter.
+    std::vector<struct kevent> vEvents(2 * mapRegistered.size() + 1);
+    struct timespec timeout;
+    timeout.tv_sec = setRecv.empty() ? nTimeoutMs / 1000 : 0;
+    timeout.tv_nsec = setRecv.empty() ? (nTimeoutMs % 1000) * 1000000 : 0;
+    int nEvents = kevent(fdQueue, NULL, 0, &vEvents[0], vEvents.size(), &timeout);
+    if (nEvents == -1)
+        return errno == EINTR;
+    for (int i = 0; i < nEvents; i++) {
+        const struct kevent& ev = vEvents[i];
+        if ((int)ev.ident == fdWakeup[0]) {
+            char buf[64];
+            while (read(fdWakeup[0], buf, sizeof(buf)) > 0) {}
+            continue;
+        }
+        std::map<SOCKET, std::pair<int64_t, int> >::const_iterator it = mapRegistered.find(ev.ident);
+        if (it == mapRegistered.end())
+            continue;
+        if (ev.filter == EVFILT_READ || (ev.flags & (EV_EOF | EV_ERROR)))
+            setRecv.insert(it->second.first);
+        if (ev.filter == EVFILT_WRITE && !(ev.flags & EV_ERROR))
+            setSend.insert(it->second.first);
+    }
+    return true;
+#elif defined(USE_POLL)
+    std::vector<struct pollfd> vPollFds;
+    std::vector<int64_t> vTokens;
+    vPollFds.reserve(vInterest.size() + 1);
+    vTokens.reserve(vInterest.size());
+    BOOST_FOREACH(const Interest& interest, vInterest) {
+        if (interest.nEvents == 0)
+            continue;
+        struct pollfd pfd;
+        pfd.fd = interest.socket;
+        pfd.events = ((interest.nEvents & RECV) ? POLLIN : 0) | ((interest.nEvents & SEND) ? POLLOUT : 0);
+        pfd.revents = 0;
+        vPollFds.push_back(pfd);
+        vTokens.push_back(interest.nToken);
+    }
+    if (fdWakeup[0] != -1) {
+        struct pollfd pfd;
+        pfd.fd = fdWakeup[0];
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        vPollFds.push_back(pfd);
+    }
+    int nEvents = poll(vPollFds.empty() ? NULL : &vPollFds[0], vPollFds.size(), nTimeoutMs);
+    if (nEvents == -1)
+        return errno == EINTR;
+    for (unsigned int i = 0; i < vTokens.size(); i++) {
+        if (vPollFds[i].revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL))
+            setRecv.insert(vTokens[i]);
+        if (vPollFds[i].revents & POLLOUT)
+            setSend.insert(vTokens[i]);
+    }
+    if (fdWakeup[0] != -1 && vPollFds.back().revents) {
+        char buf[64];
+        while (read(fdWakeup[0], buf, sizeof(buf)) > 0) {}
+    }
+    return true;
+#else
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+    BOOST_FOREACH(const Interest& interest, vInterest) {
+        if (interest.nEvents == 0)
+            continue;
+        if (interest.nEvents & RECV)
+            FD_SET(interest.socket, &fdsetRecv);
+        if (interest.nEvents & SEND)
+            FD_SET(interest.socket, &fdsetSend);
+        FD_SET(interest.socket, &fdsetError);
+        hSocketMax = std::max(hSocketMax, interest.socket);
+        have_fds = true;
+    }
+    if (!have_fds) {
+        // select() with no sockets is an error on Windows.
+        MilliSleep(nTimeoutMs);
+        return true;
+    }
+    struct timeval timeout;
+    timeout.tv_sec = nTimeoutMs / 1000;
+    timeout.tv_usec = (nTimeoutMs % 1000) * 1000;
+    if (select(hSocketMax + 1, &fdsetRecv, &fdsetSend, &fdsetError, &timeout) == SOCKET_ERROR)
+        return false;
+    BOOST_FOREACH(const Interest& interest, vInterest) {
+        if (interest.nEvents == 0)
+            continue;
+        if (FD_ISSET(interest.socket, &fdsetRecv) || FD_ISSET(interest.socket, &fdsetError))
+            setRecv.insert(interest.nToken);
+        if (FD_ISSET(interest.socket, &fdsetSend))
+            setSend.insert(interest.nToken);
+    }
+    return true;
+#endif
+}
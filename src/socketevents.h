@@ -0,0 +1,94 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SOCKETEVENTS_H
+#define BITCOIN_SOCKETEVENTS_H
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "compat.h"
+
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#if defined(HAVE_SYS_EPOLL_H)
+#define USE_EPOLL
+#elif defined(HAVE_SYS_EVENT_H)
+#define USE_KQUEUE
+#elif !defined(WIN32)
+#define USE_POLL
+#endif
+
+/**
+ * Waits for readiness on a set of sockets, using epoll on Linux, kqueue on
+ * the BSDs and OS X, poll() on other Unix systems and select() on Windows.
+ *
+ * The caller passes its full interest set to every Wait(); sockets are
+ * registered with the kernel (epoll and kqueue) only when their interest
+ * changes, so the cost of a pass does not grow with the number of idle
+ * connections. Each socket is identified by a token chosen by the caller,
+ * which makes a closed socket whose descriptor was reused distinguishable
+ * from the one it replaces.
+ *
+ * Not thread safe, except for Wakeup().
+ */
+class CSocketEvents
+{
+public:
+    enum {
+        RECV = 1,
+        SEND = 2,
+    };
+
+    struct Interest {
+        SOCKET socket;
+        int64_t nToken;
+        int nEvents;
+
+        Interest(SOCKET socketIn, int64_t nTokenIn, int nEventsIn) : socket(socketIn), nToken(nTokenIn), nEvents(nEventsIn) {}
+    };
+
+private:
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    int fdQueue;
+    //! Registered sockets and their (token, events)
+    std::map<SOCKET, std::pair<int64_t, int> > mapRegistered;
+#endif
+#ifndef WIN32
+    int fdWakeup[2];
+#endif
+
+    CSocketEvents(const CSocketEvents&);
+    CSocketEvents& operator=(const CSocketEvents&);
+
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    bool Register(SOCKET socket, int nEventsOld, int nEventsNew);
+#endif
+
+public:
+    CSocketEvents();
+    ~CSocketEvents();
+
+    //! Name of the mechanism in use
+    static const char* Backend();
+
+    /**
+     * Wait up to nTimeoutMs for any of the sockets in vInterest to become
+     * ready, and fill setRecv and setSend with the tokens of those that are.
+     * A socket that failed or was closed by its peer is reported in setRecv,
+     * whatever was asked for, so that recv() finds out. Sockets without
+     * events are not watched at all. Returns false if waiting failed.
+     */
+    bool Wait(const std::vector<Interest>& vInterest, int nTimeoutMs, std::set<int64_t>& setRecv, std::set<int64_t>& setSend);
+
+    //! Make a running or the next Wait() return early. No-op on Windows.
+    void Wakeup();
+};
+
+#endif // BITCOIN_SOCKETEVENTS_H
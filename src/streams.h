@@ -55,6 +55,40 @@ OverrideStream<S> WithOrVersion(S* s, int nVersionFlag)
     return OverrideStream<S>(s, s->GetType(), s->GetVersion() | nVersionFlag);
 }
 
+/**
+ * Appends serialized data directly to a byte vector (of char or unsigned
+ * char), for when the bytes are wanted in a vector anyway and copying them
+ * out of a CDataStream would be wasted.
+ */
+template<typename Vector>
+class CVectorWriter
+{
+    Vector& vch;
+public:
+    const int nType;
+    const int nVersion;
+
+    CVectorWriter(Vector& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    CVectorWriter<Vector>& write(const char* pch, size_t nSize)
+    {
+        typedef typename Vector::value_type value_type;
+        vch.insert(vch.end(), (const value_type*)pch, (const value_type*)(pch + nSize));
+        return (*this);
+    }
+
+    template<typename T>
+    CVectorWriter<Vector>& operator<<(const T& obj)
+    {
+        // Serialize to this stream
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+};
+
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
@@ -332,6 +366,14 @@ public:
         clear();
     }
 
+    /** Exchange the underlying buffer with data, rewinding the read position,
+     *  so that buffers can be handed between streams without copying.
+     */
+    void SwapData(CSerializeData &data) {
+        vch.swap(data);
+        nReadPos = 0;
+    }
+
     /**
      * XOR the contents of this stream with a certain key.
      *
@@ -365,6 +407,54 @@ public:
 
 
 
+/** Stream deserializing from a range of memory it does not own, such as a
+ * mapped file, without copying it first. The memory must outlive the reader.
+ */
+class CMemoryReader
+{
+private:
+    const char* pcur;
+    const char* pend;
+    const int nType;
+    const int nVersion;
+
+public:
+    CMemoryReader(const char* pbegin, const char* pendIn, int nTypeIn, int nVersionIn) :
+        pcur(pbegin), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    int GetType() const          { return nType; }
+    int GetVersion() const       { return nVersion; }
+    const char* begin() const    { return pcur; }
+    const char* end() const      { return pend; }
+    size_t size() const          { return pend - pcur; }
+    bool empty() const           { return pcur == pend; }
+
+    CMemoryReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::read(): end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    CMemoryReader& ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::ignore(): end of data");
+        pcur += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CMemoryReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 /** Non-refcounted RAII wrapper for FILE*
  *
  * Will automatically close the file when it goes out of scope if not null.
@@ -0,0 +1,189 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <assert.h>
+#include <stddef.h>
+
+#include <cstddef>
+#include <list>
+#include <new>
+
+/**
+ * Memory resource for node based containers with many small, equally sized
+ * elements, such as the coins cache.
+ *
+ * Blocks of up to MAX_BLOCK_SIZE_BYTES are carved from large chunks and,
+ * once freed, kept in a free list per size for reuse; larger requests go to
+ * operator new. This saves the per-allocation malloc overhead and keeps
+ * millions of map nodes from fragmenting the heap. Chunks are only returned
+ * to the system when the resource is destroyed, so the memory in use is
+ * exactly the number of chunks times their size, which is what
+ * memusage::DynamicUsage reports for containers using it.
+ *
+ * Not thread safe; containers using it need external locking anyway.
+ */
+template <size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+class PoolResource
+{
+private:
+    /** In-place linked list of the free blocks of one size. */
+    struct ListNode {
+        ListNode* next;
+    };
+
+    /** Every block is a multiple of this, so free blocks can hold a ListNode. */
+    static const size_t ELEM_ALIGN_BYTES = ALIGN_BYTES > sizeof(ListNode) ? ALIGN_BYTES : sizeof(ListNode);
+    static const size_t NUM_FREE_LISTS = (MAX_BLOCK_SIZE_BYTES + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + 1;
+
+    static_assert((ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+    static_assert(ELEM_ALIGN_BYTES <= alignof(std::max_align_t), "operator new must align chunks sufficiently");
+
+    const size_t nChunkSizeBytes;
+    std::list<char*> allocatedChunks;
+    ListNode* freeLists[NUM_FREE_LISTS];
+
+    /** Unused remainder of the most recent chunk. */
+    char* pAvailableBegin;
+    char* pAvailableEnd;
+
+    static size_t NumElemAlignBytes(size_t bytes)
+    {
+        return (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (bytes == 0);
+    }
+
+    static bool IsFreeListUsable(size_t bytes, size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PushFree(void* p, size_t nFreeList)
+    {
+        ListNode* node = new (p) ListNode;
+        node->next = freeLists[nFreeList];
+        freeLists[nFreeList] = node;
+    }
+
+    void AllocateChunk()
+    {
+        // Hand the remainder of the current chunk to the matching free list
+        // so nothing is lost. It is a multiple of ELEM_ALIGN_BYTES smaller
+        // than the block that did not fit, so it has a free list.
+        if (pAvailableBegin != pAvailableEnd)
+            PushFree(pAvailableBegin, (pAvailableEnd - pAvailableBegin) / ELEM_ALIGN_BYTES);
+
+        char* chunk = static_cast<char*>(::operator new(nChunkSizeBytes));
+        allocatedChunks.push_back(chunk);
+        pAvailableBegin = chunk;
+        pAvailableEnd = chunk + nChunkSizeBytes;
+    }
+
+    PoolResource(const PoolResource&);
+    PoolResource& operator=(const PoolResource&);
+
+public:
+    explicit PoolResource(size_t nChunkSizeBytesIn = 1 << 18) : nChunkSizeBytes(nChunkSizeBytesIn), pAvailableBegin(NULL), pAvailableEnd(NULL)
+    {
+        assert(nChunkSizeBytes >= MAX_BLOCK_SIZE_BYTES && nChunkSizeBytes % ELEM_ALIGN_BYTES == 0);
+        for (size_t i = 0; i < NUM_FREE_LISTS; i++)
+            freeLists[i] = NULL;
+    }
+
+    ~PoolResource()
+    {
+        for (std::list<char*>::iterator it = allocatedChunks.begin(); it != allocatedChunks.end(); ++it)
+            ::operator delete(*it);
+    }
+
+    void* Allocate(size_t bytes, size_t alignment)
+    {
+        if (!IsFreeListUsable(bytes, alignment))
+            return ::operator new(bytes);
+
+        const size_t nFreeList = NumElemAlignBytes(bytes);
+        if (freeLists[nFreeList] != NULL) {
+            ListNode* node = freeLists[nFreeList];
+            freeLists[nFreeList] = node->next;
+            return node;
+        }
+        const size_t nBytes = nFreeList * ELEM_ALIGN_BYTES;
+        if ((size_t)(pAvailableEnd - pAvailableBegin) < nBytes)
+            AllocateChunk();
+        char* p = pAvailableBegin;
+        pAvailableBegin += nBytes;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t bytes, size_t alignment)
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            ::operator delete(p);
+            return;
+        }
+        PushFree(p, NumElemAlignBytes(bytes));
+    }
+
+    size_t NumAllocatedChunks() const { return allocatedChunks.size(); }
+    size_t ChunkSizeBytes() const { return nChunkSizeBytes; }
+};
+
+/**
+ * Allocator handing out memory from a PoolResource, which must outlive every
+ * container using it. Copies share the resource.
+ */
+template <typename T, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES = alignof(std::max_align_t)>
+class PoolAllocator
+{
+public:
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator(ResourceType* resourceIn) : resource(resourceIn) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) : resource(other.Resource()) {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* Resource() const { return resource; }
+
+private:
+    ResourceType* resource;
+};
+
+template <typename T, typename U, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return a.Resource() == b.Resource();
+}
+
+template <typename T, typename U, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
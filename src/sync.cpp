@@ -7,11 +7,153 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <chrono>
+#include <map>
+#include <set>
 #include <stdio.h>
 
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 
+std::atomic<bool> fProfileLocks(false);
+
+namespace {
+
+/** Lock sites by their __FILE__ and __LINE__; each translation unit has its own __FILE__ pointer */
+typedef std::map<std::pair<const char*, int>, CLockSiteStats> LockSiteMap;
+
+/** The lock profile of one thread. Only its thread writes it, so its mutex is hardly ever contended. */
+struct CLockProfileBuffer {
+    boost::mutex mutex;
+    LockSiteMap sites;
+    // All the thread's waits, never reset, so that callers can take differences
+    uint64_t nWaitMicros;
+
+    CLockProfileBuffer() : nWaitMicros(0) {}
+};
+
+struct LockProfileData {
+    boost::mutex mutex;
+    std::set<CLockProfileBuffer*> buffers;
+    // The profiles of threads that have exited
+    LockSiteMap retired;
+};
+
+LockProfileData& GetLockProfileData()
+{
+    // Never destroyed, as threads may exit after static destructors ran.
+    static LockProfileData* data = new LockProfileData();
+    return *data;
+}
+
+void AddLockSiteStats(CLockSiteStats& stats, const CLockSiteStats& other)
+{
+    stats.nCount += other.nCount;
+    stats.nContended += other.nContended;
+    stats.nWaitMicros += other.nWaitMicros;
+    stats.nMaxWaitMicros = std::max(stats.nMaxWaitMicros, other.nMaxWaitMicros);
+    stats.nHoldMicros += other.nHoldMicros;
+    stats.nMaxHoldMicros = std::max(stats.nMaxHoldMicros, other.nMaxHoldMicros);
+}
+
+void RetireLockProfileBuffer(CLockProfileBuffer* buffer)
+{
+    LockProfileData& data = GetLockProfileData();
+    boost::unique_lock<boost::mutex> lock(data.mutex);
+    data.buffers.erase(buffer);
+    for (LockSiteMap::const_iterator it = buffer->sites.begin(); it != buffer->sites.end(); ++it) {
+        CLockSiteStats& stats = data.retired[it->first];
+        stats.strName = it->second.strName;
+        AddLockSiteStats(stats, it->second);
+    }
+    delete buffer;
+}
+
+boost::thread_specific_ptr<CLockProfileBuffer> lockprofilebuffer(RetireLockProfileBuffer);
+
+}
+
+int64_t GetLockProfileMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RecordLockProfile(const char* pszName, const char* pszFile, int nLine, bool fContended, int64_t nWaitMicros, int64_t nHoldMicros)
+{
+    CLockProfileBuffer* buffer = lockprofilebuffer.get();
+    if (buffer == NULL) {
+        buffer = new CLockProfileBuffer();
+        lockprofilebuffer.reset(buffer);
+        LockProfileData& data = GetLockProfileData();
+        boost::unique_lock<boost::mutex> lock(data.mutex);
+        data.buffers.insert(buffer);
+    }
+
+    boost::unique_lock<boost::mutex> lock(buffer->mutex);
+    buffer->nWaitMicros += nWaitMicros;
+    CLockSiteStats& stats = buffer->sites[std::make_pair(pszFile, nLine)];
+    if (stats.nCount == 0)
+        stats.strName = pszName;
+    stats.nCount++;
+    if (fContended)
+        stats.nContended++;
+    stats.nWaitMicros += nWaitMicros;
+    stats.nMaxWaitMicros = std::max(stats.nMaxWaitMicros, (uint64_t)nWaitMicros);
+    stats.nHoldMicros += nHoldMicros;
+    stats.nMaxHoldMicros = std::max(stats.nMaxHoldMicros, (uint64_t)nHoldMicros);
+}
+
+std::vector<CLockSiteStats> GetLockProfile()
+{
+    // Merge the sites of all threads, and of all translation units that
+    // include the same header, by name and location.
+    std::map<std::pair<std::string, int>, CLockSiteStats> mapSites;
+    LockProfileData& data = GetLockProfileData();
+    boost::unique_lock<boost::mutex> lock(data.mutex);
+    BOOST_FOREACH(CLockProfileBuffer* buffer, data.buffers) {
+        boost::unique_lock<boost::mutex> lockBuffer(buffer->mutex);
+        for (LockSiteMap::const_iterator it = buffer->sites.begin(); it != buffer->sites.end(); ++it) {
+            CLockSiteStats& stats = mapSites[std::make_pair(std::string(it->first.first), it->first.second)];
+            stats.strName = it->second.strName;
+            AddLockSiteStats(stats, it->second);
+        }
+    }
+    for (LockSiteMap::const_iterator it = data.retired.begin(); it != data.retired.end(); ++it) {
+        CLockSiteStats& stats = mapSites[std::make_pair(std::string(it->first.first), it->first.second)];
+        stats.strName = it->second.strName;
+        AddLockSiteStats(stats, it->second);
+    }
+
+    std::vector<CLockSiteStats> vStats;
+    vStats.reserve(mapSites.size());
+    for (std::map<std::pair<std::string, int>, CLockSiteStats>::iterator it = mapSites.begin(); it != mapSites.end(); ++it) {
+        it->second.strFile = it->first.first;
+        it->second.nLine = it->first.second;
+        vStats.push_back(it->second);
+    }
+    return vStats;
+}
+
+uint64_t GetThreadLockWaitMicros()
+{
+    CLockProfileBuffer* buffer = lockprofilebuffer.get();
+    if (buffer == NULL)
+        return 0;
+    boost::unique_lock<boost::mutex> lock(buffer->mutex);
+    return buffer->nWaitMicros;
+}
+
+void ResetLockProfile()
+{
+    LockProfileData& data = GetLockProfileData();
+    boost::unique_lock<boost::mutex> lock(data.mutex);
+    data.retired.clear();
+    BOOST_FOREACH(CLockProfileBuffer* buffer, data.buffers) {
+        boost::unique_lock<boost::mutex> lockBuffer(buffer->mutex);
+        buffer->sites.clear();
+    }
+}
+
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 {
@@ -8,6 +8,11 @@
 
 #include "threadsafety.h"
 
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -108,6 +113,48 @@ typedef boost::condition_variable CConditionVariable;
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/**
+ * Whether LOCK and TRY_LOCK record how long they wait for and hold their
+ * lock, per lock site (-lockprofile, setlockprofiling). Off, the profiler
+ * costs a relaxed load per lock.
+ */
+extern std::atomic<bool> fProfileLocks;
+static const bool DEFAULT_LOCKPROFILE = false;
+
+/** Monotonic clock of the lock profiler, in microseconds */
+int64_t GetLockProfileMicros();
+
+/** Record one acquisition and release of lock pszName at pszFile:nLine in the calling thread's profile */
+void RecordLockProfile(const char* pszName, const char* pszFile, int nLine, bool fContended, int64_t nWaitMicros, int64_t nHoldMicros);
+
+/** Profile of the acquisitions at one lock site */
+struct CLockSiteStats
+{
+    std::string strName;
+    std::string strFile;
+    int nLine;
+    uint64_t nCount;
+    uint64_t nContended;
+    uint64_t nWaitMicros;
+    uint64_t nMaxWaitMicros;
+    uint64_t nHoldMicros;
+    uint64_t nMaxHoldMicros;
+
+    CLockSiteStats() : nLine(0), nCount(0), nContended(0), nWaitMicros(0), nMaxWaitMicros(0), nHoldMicros(0), nMaxHoldMicros(0) {}
+};
+
+/** The profiles of all threads, past and present, summed per lock site */
+std::vector<CLockSiteStats> GetLockProfile();
+
+/**
+ * Total time the calling thread has waited for locks while profiling was on.
+ * ResetLockProfile does not clear it.
+ */
+uint64_t GetThreadLockWaitMicros();
+
+/** Clear the profiles of all threads */
+void ResetLockProfile();
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
@@ -115,9 +162,35 @@ class SCOPED_LOCKABLE CMutexLock
 private:
     boost::unique_lock<Mutex> lock;
 
+    // Set while a profiled acquisition holds the lock
+    const char* pszProfileName;
+    const char* pszProfileFile;
+    int nProfileLine;
+    bool fProfileContended;
+    int64_t nProfileWait;
+    int64_t nProfileLocked;
+
+    void StartProfile(const char* pszName, const char* pszFile, int nLine, bool fContended, int64_t nWait)
+    {
+        pszProfileName = pszName;
+        pszProfileFile = pszFile;
+        nProfileLine = nLine;
+        fProfileContended = fContended;
+        nProfileWait = nWait;
+        nProfileLocked = GetLockProfileMicros();
+    }
+
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        if (fProfileLocks.load(std::memory_order_relaxed)) {
+            int64_t nStart = GetLockProfileMicros();
+            bool fContended = !lock.try_lock();
+            if (fContended)
+                lock.lock();
+            StartProfile(pszName, pszFile, nLine, fContended, GetLockProfileMicros() - nStart);
+            return;
+        }
 #ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
@@ -134,11 +207,13 @@ private:
         lock.try_lock();
         if (!lock.owns_lock())
             LeaveCritical();
+        else if (fProfileLocks.load(std::memory_order_relaxed))
+            StartProfile(pszName, pszFile, nLine, false, 0);
         return lock.owns_lock();
     }
 
 public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock), pszProfileName(NULL), pszProfileFile(NULL), nProfileLine(0), fProfileContended(false), nProfileWait(0), nProfileLocked(0)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -146,7 +221,7 @@ public:
             Enter(pszName, pszFile, nLine);
     }
 
-    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn)
+    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn) : pszProfileName(NULL), pszProfileFile(NULL), nProfileLine(0), fProfileContended(false), nProfileWait(0), nProfileLocked(0)
     {
         if (!pmutexIn) return;
 
@@ -159,8 +234,11 @@ public:
 
     ~CMutexLock() UNLOCK_FUNCTION()
     {
-        if (lock.owns_lock())
+        if (lock.owns_lock()) {
+            if (pszProfileFile)
+                RecordLockProfile(pszProfileName, pszProfileFile, nProfileLine, fProfileContended, nProfileWait, GetLockProfileMicros() - nProfileLocked);
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -25,7 +25,7 @@
 // Tests this internal-to-main.cpp method:
 extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
 extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphansUsage);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
@@ -186,13 +186,23 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     }
 
     // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
+    size_t nCount, nUsage, nMissingOutpoints;
+    GetOrphanStats(nCount, nUsage, nMissingOutpoints);
+    BOOST_CHECK(nCount == mapOrphanTransactions.size());
+    BOOST_CHECK(nMissingOutpoints == mapOrphanTransactionsByPrev.size());
+    LimitOrphanTxSize(40, nUsage);
     BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
+    GetOrphanStats(nCount, nUsage, nMissingOutpoints);
+    LimitOrphanTxSize(40, nUsage / 2);
+    BOOST_CHECK(mapOrphanTransactions.size() < nCount);
+    GetOrphanStats(nCount, nUsage, nMissingOutpoints);
+    LimitOrphanTxSize(10, nUsage);
     BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
+    LimitOrphanTxSize(0, nUsage);
     BOOST_CHECK(mapOrphanTransactions.empty());
     BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    GetOrphanStats(nCount, nUsage, nMissingOutpoints);
+    BOOST_CHECK(nUsage == 0);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -124,6 +124,37 @@ BOOST_AUTO_TEST_CASE(addrman_ports)
     BOOST_CHECK(addr_ret3.ToString() == "250.1.1.1:8333");
 }
 
+BOOST_AUTO_TEST_CASE(addrman_add_batch)
+{
+    CAddrManTest addrman;
+    CAddrManTest addrman_single;
+
+    // Set addrman addr placement to be deterministic.
+    addrman.MakeDeterministic();
+    addrman_single.MakeDeterministic();
+
+    CNetAddr source = CNetAddr("252.2.2.2");
+
+    // Repeats of an address in a batch count once, whatever their port.
+    std::vector<CAddress> vAddr;
+    for (int i = 1; i <= 100; i++) {
+        vAddr.push_back(CAddress(CService(strprintf("250.1.%i.1", i), 8333), NODE_NONE));
+        if (i % 10 == 0)
+            vAddr.push_back(CAddress(CService(strprintf("250.1.%i.1", i), 8334), NODE_NONE));
+    }
+    BOOST_CHECK(addrman.Add(vAddr, source));
+    BOOST_CHECK(!addrman.Add(vAddr, source));
+
+    // Placement is the same as when adding one at a time.
+    for (int i = 1; i <= 100; i++)
+        addrman_single.Add(CAddress(CService(strprintf("250.1.%i.1", i), 8333), NODE_NONE), source);
+    BOOST_CHECK_EQUAL(addrman.size(), addrman_single.size());
+    CDataStream ssBatch(SER_DISK, CLIENT_VERSION);
+    CDataStream ssSingle(SER_DISK, CLIENT_VERSION);
+    ssBatch << addrman;
+    ssSingle << addrman_single;
+    BOOST_CHECK(ssBatch.str() == ssSingle.str());
+}
 
 BOOST_AUTO_TEST_CASE(addrman_select)
 {
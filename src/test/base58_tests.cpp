@@ -9,6 +9,7 @@
 #include "data/base58_keys_valid.json.h"
 
 #include "key.h"
+#include "random.h"
 #include "script/script.h"
 #include "uint256.h"
 #include "util.h"
@@ -73,6 +74,21 @@ BOOST_AUTO_TEST_CASE(base58_DecodeBase58)
     BOOST_CHECK_EQUAL_COLLECTIONS(result.begin(), result.end(), expected.begin(), expected.end());
 }
 
+// Goal: round trip every length around the limb boundaries of the conversions
+BOOST_AUTO_TEST_CASE(base58_RoundTrip)
+{
+    for (size_t len = 0; len < 100; len++) {
+        std::vector<unsigned char> data(len);
+        for (size_t i = 0; i < len; i++)
+            data[i] = (i < len % 3) ? 0 : GetRand(256);
+        std::string base58string = EncodeBase58(data);
+        BOOST_CHECK(base58string.size() <= len * 138 / 100 + 1);
+        std::vector<unsigned char> result;
+        BOOST_CHECK(DecodeBase58(base58string, result));
+        BOOST_CHECK_EQUAL_COLLECTIONS(result.begin(), result.end(), data.begin(), data.end());
+    }
+}
+
 // Visitor to check address type
 class TestAddrTypeVisitor : public boost::static_visitor<bool>
 {
@@ -2,12 +2,18 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "amountverifier.h"
 #include "arith_uint256.h"
 #include "blind.h"
 #include "coins.h"
+#include "consensus/validation.h"
+#include "eccontext.h"
+#include "random.h"
 #include "uint256.h"
 #include "wallet/wallet.h"
 #include "main.h"
+#include "script/standard.h"
+#include "script/sigcache.h"
 
 #include "test/test_bitcoin.h"
 
@@ -218,4 +224,399 @@ BOOST_AUTO_TEST_CASE(naive_blinding_test)
     }
 }
 
+#ifdef ENABLE_WALLET
+BOOST_AUTO_TEST_CASE(blinding_cache_test)
+{
+    CWallet cachewallet;
+    LOCK(cachewallet.cs_wallet);
+    cachewallet.blinding_derivation_key = ArithToUint256(12345);
+
+    CKey foreign;
+    foreign.MakeNewKey(true);
+    CScript script0 = CScript() << OP_1;
+    CScript script1 = CScript() << OP_2;
+
+    // One output blinded to our derived key, one to somebody else.
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 10;
+    tx.vout[0].scriptPubKey = script0;
+    tx.vout[1].nValue = 20;
+    tx.vout[1].scriptPubKey = script1;
+    std::vector<uint256> input_blinds(1);
+    std::vector<uint256> output_blinds(2);
+    std::vector<CPubKey> output_pubkeys;
+    output_pubkeys.push_back(cachewallet.GetBlindingPubKey(script0));
+    output_pubkeys.push_back(foreign.GetPubKey());
+    BOOST_CHECK(BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx));
+
+    CWalletTx wtx(&cachewallet, tx);
+    const COutPoint out0(wtx.GetHash(), 0), out1(wtx.GetHash(), 1);
+    BOOST_CHECK_EQUAL(wtx.GetValueOut(0), 10);
+    BOOST_CHECK_EQUAL(wtx.GetValueOut(1), -1);
+    BOOST_CHECK(cachewallet.mapBlindingCache[out0].IsUnblinded());
+    BOOST_CHECK(!cachewallet.mapBlindingCache[out1].IsUnblinded());
+    BOOST_CHECK(cachewallet.mapBlindingCache[out1].keysFingerprint == cachewallet.GetBlindingKeysFingerprint(script1));
+
+    // A fresh copy of the transaction is served from the cache.
+    CBlindingCacheEntry entry = cachewallet.mapBlindingCache[out0];
+    entry.amount = 11;
+    cachewallet.LoadBlindingCacheEntry(out0, entry);
+    CWalletTx wtx2(&cachewallet, tx);
+    BOOST_CHECK_EQUAL(wtx2.GetValueOut(0), 11);
+    BOOST_CHECK_EQUAL(wtx2.GetValueOut(1), -1);
+
+    // Learning the right blinding key invalidates the failed attempt.
+    uint256 foreignkey;
+    memcpy(foreignkey.begin(), foreign.begin(), 32);
+    cachewallet.LoadSpecificBlindingKey(CScriptID(script1), foreignkey);
+    wtx2.MarkDirty();
+    BOOST_CHECK_EQUAL(wtx2.GetValueOut(1), 20);
+    BOOST_CHECK(cachewallet.mapBlindingCache[out1].IsUnblinded());
+}
+
+BOOST_AUTO_TEST_CASE(blinding_precompute_test)
+{
+    CWallet prewallet;
+    LOCK(prewallet.cs_wallet);
+    prewallet.blinding_derivation_key = ArithToUint256(54321);
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(prewallet.AddKeyPubKey(key, key.GetPubKey()));
+    CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // Paying us makes the whole transaction interesting, so all of its
+    // confidential outputs are unblinded up front, ours or not.
+    CBlock block;
+    for (int n = 0; n < 4; n++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = ArithToUint256(n + 1);
+        tx.vout.resize(2);
+        tx.vout[0].nValue = 100 + n;
+        tx.vout[0].scriptPubKey = n == 3 ? CScript() << OP_1 : script;
+        tx.vout[1].nValue = 200 + n;
+        tx.vout[1].scriptPubKey = CScript() << OP_1;
+        std::vector<uint256> input_blinds(1);
+        std::vector<uint256> output_blinds(2);
+        std::vector<CPubKey> output_pubkeys(2, prewallet.GetBlindingPubKey(tx.vout[0].scriptPubKey));
+        output_pubkeys[1] = prewallet.GetBlindingPubKey(tx.vout[1].scriptPubKey);
+        BOOST_CHECK(BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx));
+        block.vtx.push_back(MakeTransactionRef(tx));
+    }
+    prewallet.PrecomputeBlindingData(std::vector<const CBlock*>(1, &block));
+
+    BOOST_CHECK_EQUAL(prewallet.mapBlindingCache.size(), 6U);
+    for (int n = 0; n < 3; n++) {
+        BOOST_CHECK_EQUAL(prewallet.mapBlindingCache[COutPoint(block.vtx[n]->GetHash(), 0)].amount, 100 + n);
+        BOOST_CHECK_EQUAL(prewallet.mapBlindingCache[COutPoint(block.vtx[n]->GetHash(), 1)].amount, 200 + n);
+    }
+    BOOST_CHECK(!prewallet.mapBlindingCache.count(COutPoint(block.vtx[3]->GetHash(), 0)));
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(rangeproof_batch_test)
+{
+    const secp256k1_context* ctx = ECC_GetContext();
+
+    CKey key;
+    key.MakeNewKey(true);
+
+    // Spend one unblinded coin into three blinded outputs.
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(3);
+    tx.vout[0].nValue = 10;
+    tx.vout[1].nValue = 20;
+    tx.vout[2].nValue = 30;
+    std::vector<uint256> input_blinds(1);
+    std::vector<uint256> output_blinds(3);
+    std::vector<CPubKey> output_pubkeys(3, key.GetPubKey());
+    BOOST_CHECK(BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx));
+
+    std::vector<RangeProofCacheKey> vKeys;
+    std::vector<const CTxOutValue*> vValues;
+    for (size_t i = 0; i < tx.vout.size(); i++) {
+        BOOST_CHECK(!tx.vout[i].nValue.IsAmount());
+        vKeys.push_back(RangeProofCacheKey(GetRandHash(), i));
+        vValues.push_back(&tx.vout[i].nValue);
+    }
+
+    const CachingRangeProofChecker checker(false);
+    BOOST_CHECK(checker.VerifyRangeProofs(vKeys, vValues, ctx));
+
+    // A corrupted proof fails the batch and is reported by index.
+    size_t nFailed = 0;
+    tx.vout[1].nValue.vchRangeproof.back() ^= 1;
+    BOOST_CHECK(!checker.VerifyRangeProofs(vKeys, vValues, ctx, &nFailed));
+    BOOST_CHECK_EQUAL(nFailed, 1U);
+    tx.vout[1].nValue.vchRangeproof.back() ^= 1;
+
+    // So does a valid proof paired with the wrong commitment.
+    std::swap(tx.vout[0].nValue.vchCommitment, tx.vout[2].nValue.vchCommitment);
+    BOOST_CHECK(!checker.VerifyRangeProofs(vKeys, vValues, ctx, &nFailed));
+    BOOST_CHECK_EQUAL(nFailed, 0U);
+    std::swap(tx.vout[0].nValue.vchCommitment, tx.vout[2].nValue.vchCommitment);
+
+    // Proofs that were stored are answered from the cache, keyed by
+    // witness hash and output index alone.
+    uint64_t nHits, nMisses, nHitsBefore, nMissesBefore;
+    GetRangeProofCacheStats(nHitsBefore, nMissesBefore);
+    BOOST_CHECK(CachingRangeProofChecker(true).VerifyRangeProofs(vKeys, vValues, ctx));
+    tx.vout[1].nValue.vchRangeproof.back() ^= 1;
+    BOOST_CHECK(checker.VerifyRangeProof(vKeys[1], *vValues[1], ctx));
+    BOOST_CHECK(!checker.VerifyRangeProof(RangeProofCacheKey(vKeys[1].first, 0), *vValues[1], ctx));
+    tx.vout[1].nValue.vchRangeproof.back() ^= 1;
+    GetRangeProofCacheStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits - nHitsBefore, 1U);
+    BOOST_CHECK_EQUAL(nMisses - nMissesBefore, 4U);
+}
+
+static CAmountVerifier* CreateUnavailableAmountVerifier(int nThreads)
+{
+    return NULL;
+}
+
+BOOST_AUTO_TEST_CASE(amount_verifier_test)
+{
+    const secp256k1_context* ctx = ECC_GetContext();
+
+    CKey key;
+    key.MakeNewKey(true);
+
+    // Enough proofs for the threads backend to cut the batch into chunks.
+    std::vector<CMutableTransaction> vtx(10);
+    std::vector<const unsigned char*> vCommits, vProofs;
+    std::vector<int> vLens;
+    for (size_t n = 0; n < vtx.size(); n++) {
+        CMutableTransaction& tx = vtx[n];
+        tx.vin.resize(1);
+        tx.vout.resize(4);
+        for (size_t i = 0; i < tx.vout.size(); i++)
+            tx.vout[i].nValue = 10 * (i + 1);
+        std::vector<uint256> input_blinds(1);
+        std::vector<uint256> output_blinds(tx.vout.size());
+        std::vector<CPubKey> output_pubkeys(tx.vout.size(), key.GetPubKey());
+        BOOST_CHECK(BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx));
+    }
+    for (size_t n = 0; n < vtx.size(); n++) {
+        for (size_t i = 0; i < vtx[n].vout.size(); i++) {
+            const CTxOutValue& val = vtx[n].vout[i].nValue;
+            vCommits.push_back(&val.vchCommitment[0]);
+            vProofs.push_back(val.vchRangeproof.data());
+            vLens.push_back(val.vchRangeproof.size());
+        }
+    }
+
+    bool fFallback;
+    BOOST_CHECK(!StartAmountVerifier("nonexistent", 0, fFallback));
+
+    BOOST_CHECK(StartAmountVerifier("threads", 3, fFallback));
+    BOOST_CHECK(!fFallback);
+    BOOST_CHECK(GetAmountVerifierBatchSize() > vCommits.size() / 2);
+    BOOST_CHECK(VerifyRangeProofBatch(ctx, vCommits.data(), vProofs.data(), vLens.data(), vCommits.size()));
+    BOOST_CHECK(VerifyRangeProofBatch(ctx, vCommits.data(), vProofs.data(), vLens.data(), 1));
+    vtx[8].vout[1].nValue.vchRangeproof.back() ^= 1;
+    BOOST_CHECK(!VerifyRangeProofBatch(ctx, vCommits.data(), vProofs.data(), vLens.data(), vCommits.size()));
+    BOOST_CHECK(VerifyRangeProofBatch(ctx, vCommits.data(), vProofs.data(), vLens.data(), 32));
+    vtx[8].vout[1].nValue.vchRangeproof.back() ^= 1;
+
+    // A backend that cannot run leaves the work to the calling thread.
+    RegisterAmountVerifier("unavailable", CreateUnavailableAmountVerifier);
+    BOOST_CHECK(StartAmountVerifier("unavailable", 0, fFallback));
+    BOOST_CHECK(fFallback);
+    BOOST_CHECK(VerifyRangeProofBatch(ctx, vCommits.data(), vProofs.data(), vLens.data(), vCommits.size()));
+    vtx[0].vout[0].nValue.vchRangeproof.back() ^= 1;
+    BOOST_CHECK(!VerifyRangeProofBatch(ctx, vCommits.data(), vProofs.data(), vLens.data(), vCommits.size()));
+    vtx[0].vout[0].nValue.vchRangeproof.back() ^= 1;
+
+    StopAmountVerifier();
+    BOOST_CHECK(VerifyRangeProofBatch(ctx, vCommits.data(), vProofs.data(), vLens.data(), vCommits.size()));
+}
+
+BOOST_AUTO_TEST_CASE(rangeproof_header_test)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vout.resize(3);
+    tx.vout[0].nValue = 10;
+    tx.vout[1].nValue = 20;
+    tx.vout[2].nValue = 30;
+    std::vector<uint256> input_blinds(1);
+    std::vector<uint256> output_blinds(2);
+    std::vector<CPubKey> output_pubkeys(2, key.GetPubKey());
+    output_pubkeys.push_back(CPubKey());
+    output_blinds.push_back(uint256());
+    BOOST_CHECK(BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx));
+    BOOST_CHECK(tx.vout[2].nValue.IsAmount());
+
+    unsigned int nCost0, nCost1, nCost2;
+    BOOST_CHECK(CheckRangeProofHeader(tx.vout[0].nValue, nCost0));
+    BOOST_CHECK(CheckRangeProofHeader(tx.vout[1].nValue, nCost1));
+    BOOST_CHECK(CheckRangeProofHeader(tx.vout[2].nValue, nCost2));
+    BOOST_CHECK(nCost0 > 0 && nCost1 > 0);
+    BOOST_CHECK_EQUAL(nCost2, 0U);
+    BOOST_CHECK_EQUAL(GetTransactionRangeProofCost(tx), nCost0 + nCost1);
+    CValidationState state;
+    BOOST_CHECK(CheckTransaction(tx, state));
+
+    // The header is all that is checked, not the proof itself
+    unsigned int nCost;
+    CTxOutValue value = tx.vout[0].nValue;
+    value.vchRangeproof.back() ^= 1;
+    BOOST_CHECK(CheckRangeProofHeader(value, nCost));
+
+    // Any other length than the rings call for
+    value = tx.vout[0].nValue;
+    value.vchRangeproof.resize(value.vchRangeproof.size() - 32);
+    BOOST_CHECK(!CheckRangeProofHeader(value, nCost));
+    value = tx.vout[0].nValue;
+    value.vchRangeproof.resize(value.vchRangeproof.size() + 1);
+    BOOST_CHECK(!CheckRangeProofHeader(value, nCost));
+    value.vchRangeproof.resize(64);
+    BOOST_CHECK(!CheckRangeProofHeader(value, nCost));
+
+    // Reserved header bit, and an exponent beyond 10^18
+    value = tx.vout[0].nValue;
+    value.vchRangeproof[0] |= 128;
+    BOOST_CHECK(!CheckRangeProofHeader(value, nCost));
+    value = tx.vout[0].nValue;
+    value.vchRangeproof[0] = (value.vchRangeproof[0] & ~31) | 64 | 19;
+    BOOST_CHECK(!CheckRangeProofHeader(value, nCost));
+
+    // Such proofs are rejected with the transaction
+    tx.vout[1].nValue.vchRangeproof.resize(tx.vout[1].nValue.vchRangeproof.size() - 1);
+    BOOST_CHECK(!CheckTransaction(tx, state));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-rangeproof-header");
+    BOOST_CHECK_EQUAL(GetTransactionRangeProofCost(tx), nCost0);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_precheck_test)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout.hash = GetRandHash();
+    mtx.vout.resize(3);
+    mtx.vout[0].nValue = 10;
+    mtx.vout[1].nValue = 20;
+    mtx.vout[2].nValue = 30;
+    mtx.nTxFee = COIN;
+    std::vector<uint256> input_blinds(1);
+    std::vector<uint256> output_blinds(3);
+    std::vector<CPubKey> output_pubkeys(3, key.GetPubKey());
+    BOOST_CHECK(BlindOutputs(input_blinds, output_blinds, output_pubkeys, mtx));
+
+    // Valid proofs are left in the range proof cache for AcceptToMemoryPool.
+    uint64_t nHits, nMisses, nHitsBefore, nMissesBefore;
+    CTransaction tx(mtx);
+    CValidationState state;
+    BOOST_CHECK(PreCheckTransactionForMempool(tx, state));
+    GetRangeProofCacheStats(nHitsBefore, nMissesBefore);
+    BOOST_CHECK(PreCheckTransactionForMempool(tx, state));
+    GetRangeProofCacheStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits - nHitsBefore, 3U);
+    BOOST_CHECK_EQUAL(nMisses - nMissesBefore, 0U);
+
+    // A corrupted proof is rejected, without blaming the transaction id.
+    mtx.vout[2].nValue.vchRangeproof.back() ^= 1;
+    CTransaction txBad(mtx);
+    BOOST_CHECK(!PreCheckTransactionForMempool(txBad, state));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-rangeproof");
+    BOOST_CHECK(state.CorruptionPossible());
+
+    // Proofs of transactions below the relay fee are left alone.
+    mtx.nTxFee = 0;
+    CTransaction txFree(mtx);
+    CValidationState stateFree;
+    BOOST_CHECK(PreCheckTransactionForMempool(txFree, stateFree));
+}
+
+BOOST_AUTO_TEST_CASE(blind_rangeproof_settings)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    // Each setting is applied to an amount above the minimum and one below it.
+    const CRangeProofSettings settings[] = {
+        CRangeProofSettings(0, 32, 0),
+        CRangeProofSettings(2, 26, 0),
+        CRangeProofSettings(0, 32, COIN),
+        CRangeProofSettings(-1, 32, 0),
+    };
+    const CAmount amounts[] = {123456789, 50};
+    size_t nPrevSize = 0;
+    for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vout.resize(2);
+        tx.vout[0].nValue = amounts[0];
+        tx.vout[1].nValue = amounts[1];
+        std::vector<uint256> input_blinds(1);
+        std::vector<uint256> output_blinds(2);
+        std::vector<CPubKey> output_pubkeys(2, key.GetPubKey());
+        BOOST_CHECK(BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx, settings[i]));
+
+        for (size_t j = 0; j < 2; j++) {
+            const CTxOutValue& value = tx.vout[j].nValue;
+            int exp, mantissa;
+            uint64_t min_value, max_value;
+            BOOST_CHECK(secp256k1_rangeproof_info(ECC_GetContext(), &exp, &mantissa, &min_value, &max_value, &value.vchRangeproof[0], value.vchRangeproof.size()));
+            BOOST_CHECK_EQUAL(exp, settings[i].nExponent);
+            BOOST_CHECK(min_value <= (uint64_t)amounts[j] && (uint64_t)amounts[j] <= max_value);
+            if (settings[i].nExponent >= 0)
+                BOOST_CHECK(mantissa >= settings[i].nMinBits);
+            if (amounts[j] >= settings[i].nMinValue)
+                BOOST_CHECK(min_value >= (uint64_t)settings[i].nMinValue);
+
+            CAmount amount;
+            uint256 blinding_factor;
+            BOOST_CHECK(UnblindOutput(key, tx.vout[j], amount, blinding_factor));
+            BOOST_CHECK_EQUAL(amount, amounts[j]);
+        }
+
+        // Fewer bits of mantissa make for a smaller proof.
+        if (i == 1)
+            BOOST_CHECK(tx.vout[0].nValue.vchRangeproof.size() < nPrevSize);
+        nPrevSize = tx.vout[0].nValue.vchRangeproof.size();
+    }
+
+    BOOST_CHECK(CRangeProofSettings().IsValid());
+    BOOST_CHECK(!CRangeProofSettings(19, 32, 0).IsValid());
+    BOOST_CHECK(!CRangeProofSettings(0, MAX_CT_BITS + 1, 0).IsValid());
+    BOOST_CHECK(!CRangeProofSettings(0, 32, -1).IsValid());
+}
+
+BOOST_AUTO_TEST_CASE(blind_many_outputs)
+{
+    // Enough outputs for the range proofs to be split across threads.
+    CKey key;
+    key.MakeNewKey(true);
+    const size_t nOutputs = 20;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(nOutputs);
+    for (size_t i = 0; i < nOutputs; i++)
+        tx.vout[i].nValue = 1000 + i;
+    std::vector<uint256> input_blinds(1);
+    std::vector<uint256> output_blinds(nOutputs);
+    std::vector<CPubKey> output_pubkeys(nOutputs, key.GetPubKey());
+    BOOST_CHECK(BlindOutputs(input_blinds, output_blinds, output_pubkeys, tx));
+
+    for (size_t i = 0; i < nOutputs; i++) {
+        CAmount amount;
+        uint256 blinding_factor;
+        BOOST_CHECK(UnblindOutput(key, tx.vout[i], amount, blinding_factor));
+        BOOST_CHECK_EQUAL(amount, 1000 + (CAmount)i);
+        BOOST_CHECK(blinding_factor == output_blinds[i]);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -60,8 +60,8 @@ BOOST_AUTO_TEST_CASE(SimpleRoundTripTest)
     TestMemPoolEntryHelper entry;
     CBlock block(BuildBlockTestCase());
 
-    pool.addUnchecked(block.vtx[2].GetHash(), entry.FromTx(block.vtx[2]));
-    BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[2].GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 0);
+    pool.addUnchecked(block.vtx[2]->GetHash(), entry.FromTx(block.vtx[2]));
+    BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[2]->GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 0);
 
     // Do a simple ShortTxIDs RT
     {
@@ -79,7 +79,7 @@ BOOST_AUTO_TEST_CASE(SimpleRoundTripTest)
         BOOST_CHECK(!partialBlock.IsTxAvailable(1));
         BOOST_CHECK( partialBlock.IsTxAvailable(2));
 
-        BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[2].GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 1);
+        BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[2]->GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 1);
 
         std::list<CTransaction> removed;
         pool.removeRecursive(block.vtx[2], removed);
@@ -154,8 +154,8 @@ BOOST_AUTO_TEST_CASE(NonCoinbasePreforwardRTTest)
     TestMemPoolEntryHelper entry;
     CBlock block(BuildBlockTestCase());
 
-    pool.addUnchecked(block.vtx[2].GetHash(), entry.FromTx(block.vtx[2]));
-    BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[2].GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 0);
+    pool.addUnchecked(block.vtx[2]->GetHash(), entry.FromTx(block.vtx[2]));
+    BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[2]->GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 0);
 
     // Test with pre-forwarding tx 1, but not coinbase
     {
@@ -163,8 +163,8 @@ BOOST_AUTO_TEST_CASE(NonCoinbasePreforwardRTTest)
         shortIDs.prefilledtxn.resize(1);
         shortIDs.prefilledtxn[0] = {1, block.vtx[1]};
         shortIDs.shorttxids.resize(2);
-        shortIDs.shorttxids[0] = shortIDs.GetShortID(block.vtx[0].GetHash());
-        shortIDs.shorttxids[1] = shortIDs.GetShortID(block.vtx[2].GetHash());
+        shortIDs.shorttxids[0] = shortIDs.GetShortID(block.vtx[0]->GetHash());
+        shortIDs.shorttxids[1] = shortIDs.GetShortID(block.vtx[2]->GetHash());
 
         CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
         stream << shortIDs;
@@ -178,7 +178,7 @@ BOOST_AUTO_TEST_CASE(NonCoinbasePreforwardRTTest)
         BOOST_CHECK( partialBlock.IsTxAvailable(1));
         BOOST_CHECK( partialBlock.IsTxAvailable(2));
 
-        BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[2].GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 1);
+        BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[2]->GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 1);
 
         CBlock block2;
         std::vector<CTransaction> vtx_missing;
@@ -196,9 +196,9 @@ BOOST_AUTO_TEST_CASE(NonCoinbasePreforwardRTTest)
         BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), BlockMerkleRoot(block3, &mutated).ToString());
         BOOST_CHECK(!mutated);
 
-        BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[2].GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 1);
+        BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[2]->GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 1);
     }
-    BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[2].GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 0);*/
+    BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[2]->GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 0);*/
 }
 
 BOOST_AUTO_TEST_CASE(SufficientPreforwardRTTest)
@@ -208,8 +208,8 @@ BOOST_AUTO_TEST_CASE(SufficientPreforwardRTTest)
     TestMemPoolEntryHelper entry;
     CBlock block(BuildBlockTestCase());
 
-    pool.addUnchecked(block.vtx[1].GetHash(), entry.FromTx(block.vtx[1]));
-    BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[1].GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 0);
+    pool.addUnchecked(block.vtx[1]->GetHash(), entry.FromTx(block.vtx[1]));
+    BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[1]->GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 0);
 
     // Test with pre-forwarding coinbase + tx 2 with tx 1 in mempool
     {
@@ -218,7 +218,7 @@ BOOST_AUTO_TEST_CASE(SufficientPreforwardRTTest)
         shortIDs.prefilledtxn[0] = {0, block.vtx[0]};
         shortIDs.prefilledtxn[1] = {1, block.vtx[2]}; // id == 1 as it is 1 after index 1
         shortIDs.shorttxids.resize(1);
-        shortIDs.shorttxids[0] = shortIDs.GetShortID(block.vtx[1].GetHash());
+        shortIDs.shorttxids[0] = shortIDs.GetShortID(block.vtx[1]->GetHash());
 
         CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
         stream << shortIDs;
@@ -232,7 +232,7 @@ BOOST_AUTO_TEST_CASE(SufficientPreforwardRTTest)
         BOOST_CHECK( partialBlock.IsTxAvailable(1));
         BOOST_CHECK( partialBlock.IsTxAvailable(2));
 
-        BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[1].GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 1);
+        BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[1]->GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 1);
 
         CBlock block2;
         std::vector<CTransaction> vtx_missing;
@@ -242,9 +242,9 @@ BOOST_AUTO_TEST_CASE(SufficientPreforwardRTTest)
         BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), BlockMerkleRoot(block2, &mutated).ToString());
         BOOST_CHECK(!mutated);
 
-        BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[1].GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 1);
+        BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[1]->GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 1);
     }
-    BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[1].GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 0);*/
+    BOOST_CHECK_EQUAL(pool.mapTx.find(block.vtx[1]->GetHash())->GetSharedTx().use_count(), SHARED_TX_OFFSET + 0);*/
 }
 
 BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
@@ -317,4 +317,79 @@ BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BOOST_CHECK_EQUAL(req1.indexes[3], req2.indexes[3]);*/
 }
 
+BOOST_AUTO_TEST_CASE(TransactionsNoRangeproofsTest) {
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout.hash = GetRandHash();
+    mtx.vout.resize(2);
+    mtx.vout[0].nValue.vchRangeproof = std::vector<unsigned char>(1000, 1);
+    mtx.vout[0].nValue.vchNonceCommitment.assign(CTxOutValue::nCommitmentSize, 2);
+    CTransaction tx1(mtx);
+    mtx.vin[0].prevout.hash = GetRandHash();
+    CTransaction tx2(mtx);
+    mtx.vout[0].nValue.vchRangeproof.clear();
+    mtx.vout[0].nValue.vchNonceCommitment.clear();
+    CTransaction tx3(mtx);
+
+    BlockTransactionsNoRangeproofs resp1(GetRandHash());
+    resp1.AddTransaction(tx1, true);
+    resp1.AddTransaction(tx2, false);
+    resp1.AddTransaction(tx3, true); // nothing to strip
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << resp1;
+    BlockTransactionsNoRangeproofs resp2;
+    stream >> resp2;
+
+    BOOST_CHECK_EQUAL(resp1.blockhash.ToString(), resp2.blockhash.ToString());
+    BOOST_CHECK_EQUAL(resp2.txn.size(), 3);
+    BOOST_CHECK(resp2.stripped_wtxids[0] == tx1.GetWitnessHash());
+    BOOST_CHECK(resp2.stripped_wtxids[1].IsNull() && resp2.stripped_wtxids[2].IsNull());
+    BOOST_CHECK(resp2.txn[0].GetHash() == tx1.GetHash());
+    BOOST_CHECK(resp2.txn[0].vout[0].nValue.vchRangeproof.empty());
+    BOOST_CHECK(resp2.txn[1].GetWitnessHash() == tx2.GetWitnessHash());
+    BOOST_CHECK(resp2.txn[2].GetWitnessHash() == tx3.GetWitnessHash());
+
+    // Only a copy with the right rangeproofs completes the transaction.
+    BOOST_CHECK(!resp2.FillRangeproofs(0, tx2));
+    mtx = CMutableTransaction(tx1);
+    mtx.vout[0].nValue.vchRangeproof[0] = 3;
+    BOOST_CHECK(!resp2.FillRangeproofs(0, CTransaction(mtx)));
+    BOOST_CHECK(resp2.FillRangeproofs(0, tx1));
+    BOOST_CHECK(resp2.stripped_wtxids[0].IsNull());
+    BOOST_CHECK(resp2.txn[0].GetWitnessHash() == tx1.GetWitnessHash());
+}
+
+BOOST_AUTO_TEST_CASE(CompactHeadersTest) {
+    const CScript challenge1 = CScript() << OP_1 << std::vector<unsigned char>(33, 2) << OP_1 << OP_CHECKMULTISIG;
+    const CScript challenge2 = CScript() << OP_TRUE;
+    CompactHeaders cheaders1;
+    for (int i = 0; i < 4; i++) {
+        CBlockHeader header;
+        header.nVersion = 1;
+        header.hashPrevBlock = GetRandHash();
+        header.hashMerkleRoot = GetRandHash();
+        header.nTime = 1000 + i;
+        header.nHeight = i;
+        header.proof = CProof(i < 3 ? challenge1 : challenge2, CScript() << std::vector<unsigned char>(72, i));
+        cheaders1.headers.push_back(header);
+    }
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << cheaders1;
+    // The first challenge repeats twice and is left out both times.
+    std::vector<CBlock> vHeaders(cheaders1.headers.begin(), cheaders1.headers.end());
+    BOOST_CHECK_EQUAL(stream.size() + 2 * (challenge1.size() + 1), GetSerializeSize(vHeaders, SER_NETWORK, PROTOCOL_VERSION));
+    CompactHeaders cheaders2;
+    stream >> cheaders2;
+
+    BOOST_CHECK_EQUAL(cheaders2.headers.size(), 4U);
+    for (size_t i = 0; i < 4; i++) {
+        BOOST_CHECK(cheaders2.headers[i].GetHash() == cheaders1.headers[i].GetHash());
+        BOOST_CHECK(cheaders2.headers[i].proof.solution == cheaders1.headers[i].proof.solution);
+    }
+    BOOST_CHECK(cheaders2.headers[2].proof.challenge == challenge1);
+    BOOST_CHECK(cheaders2.headers[3].proof.challenge == challenge2);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,83 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilewriter.h"
+#include "main.h"
+#include "random.h"
+#include "streams.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilewriter_tests, TestingSetup)
+
+static std::vector<char> ReadFromFile(bool fUndo, const CDiskBlockPos& pos, size_t nSize)
+{
+    std::vector<char> vData(nSize);
+    CAutoFile file((fUndo ? OpenUndoFile : OpenBlockFile)(pos, true), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!file.IsNull());
+    file.read(vData.data(), nSize);
+    return vData;
+}
+
+static std::vector<char> RandomData(size_t nSize)
+{
+    std::vector<char> vData(nSize);
+    GetRandBytes((unsigned char*)vData.data(), nSize);
+    return vData;
+}
+
+BOOST_AUTO_TEST_CASE(blockfilewriter_order)
+{
+    // A queue limit below the record size, so writers wait for each other.
+    CBlockFileWriter writer(OpenBlockFile, OpenUndoFile, NULL, 100);
+    writer.Start();
+
+    std::vector<std::vector<char> > vRecords;
+    CDiskBlockPos pos(2000, 0);
+    for (int i = 0; i < 20; i++) {
+        vRecords.push_back(RandomData(1000 + i));
+        std::vector<char> vData = vRecords.back();
+        BOOST_CHECK(writer.Write(i % 2, pos, vData));
+        BOOST_CHECK(vData.empty());
+        if (i % 2)
+            pos.nPos += vRecords.back().size() + vRecords[i - 1].size();
+    }
+    writer.Commit(2000, false, 0, 0);
+
+    // Each record is there once its write is waited for.
+    pos.nPos = 0;
+    for (int i = 0; i < 20; i += 2) {
+        CDiskBlockPos posInside(pos.nFile, pos.nPos + 10);
+        writer.WaitForWrite(false, posInside);
+        BOOST_CHECK(ReadFromFile(false, pos, vRecords[i].size()) == vRecords[i]);
+        writer.WaitForWrite(true, pos);
+        BOOST_CHECK(ReadFromFile(true, pos, vRecords[i + 1].size()) == vRecords[i + 1]);
+        pos.nPos += vRecords[i].size() + vRecords[i + 1].size();
+    }
+    BOOST_CHECK(writer.Sync());
+
+    // Once stopped, writing is done on the spot.
+    writer.Stop();
+    std::vector<char> vData = RandomData(10);
+    const std::vector<char> vExpected = vData;
+    BOOST_CHECK(writer.Write(false, pos, vData));
+    BOOST_CHECK(ReadFromFile(false, pos, vExpected.size()) == vExpected);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilewriter_failure)
+{
+    CBlockFileWriter writer(OpenBlockFile, OpenUndoFile, NULL, MAX_BLOCK_WRITE_QUEUE_BYTES);
+    writer.Start();
+    // A null position cannot be opened; the failure sticks.
+    std::vector<char> vData = RandomData(10);
+    writer.Write(false, CDiskBlockPos(), vData);
+    BOOST_CHECK(!writer.Sync());
+    vData = RandomData(10);
+    BOOST_CHECK(!writer.Write(false, CDiskBlockPos(2001, 0), vData));
+    BOOST_CHECK(!writer.Sync());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,92 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/script.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+static CBlockFilter::Element RandomElement(size_t nSize)
+{
+    CBlockFilter::Element element(nSize);
+    for (size_t i = 0; i < nSize; i++)
+        element[i] = insecure_rand();
+    return element;
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_match)
+{
+    std::vector<CBlockFilter::Element> vElements;
+    for (int i = 0; i < 300; i++)
+        vElements.push_back(RandomElement(1 + insecure_rand() % 50));
+    // Duplicates count once.
+    vElements.push_back(vElements[0]);
+
+    CBlockFilter filter(GetRandHash(), vElements);
+    BOOST_CHECK_EQUAL(filter.GetN(), 300U);
+
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    stream << filter;
+    CBlockFilter filter2;
+    stream >> filter2;
+    BOOST_CHECK(filter2.GetBlockHash() == filter.GetBlockHash());
+
+    for (size_t i = 0; i < vElements.size(); i++)
+        BOOST_CHECK(filter2.Match(vElements[i]));
+    BOOST_CHECK(filter2.MatchAny(vElements));
+
+    // With a false positive rate of 1/784931, none of these should match.
+    std::vector<CBlockFilter::Element> vOthers;
+    for (int i = 0; i < 100; i++)
+        vOthers.push_back(RandomElement(33));
+    BOOST_CHECK(!filter2.MatchAny(vOthers));
+    vOthers.push_back(vElements[insecure_rand() % vElements.size()]);
+    BOOST_CHECK(filter2.MatchAny(vOthers));
+
+    BOOST_CHECK(!CBlockFilter().MatchAny(vElements));
+    BOOST_CHECK(!filter2.MatchAny(std::vector<CBlockFilter::Element>()));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_block_elements)
+{
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_1 << OP_1;
+    coinbase.vout.resize(2);
+    coinbase.vout[0].scriptPubKey = CScript() << OP_1;
+    coinbase.vout[1].scriptPubKey = CScript() << OP_RETURN << OP_2;
+
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(GetRandHash(), 3);
+    spend.vout.resize(2);
+    spend.vout[0].scriptPubKey = CScript() << OP_3;
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    block.vtx.push_back(MakeTransactionRef(spend));
+
+    // Output scripts and spent outpoints are in, except for data carriers,
+    // empty fee scripts and the coinbase input.
+    CBlockFilter filter(block);
+    BOOST_CHECK_EQUAL(filter.GetN(), 3U);
+    CScript script = CScript() << OP_1;
+    BOOST_CHECK(filter.Match(CBlockFilter::Element(script.begin(), script.end())));
+    script = CScript() << OP_3;
+    BOOST_CHECK(filter.Match(CBlockFilter::Element(script.begin(), script.end())));
+    BOOST_CHECK(filter.Match(CBlockFilter::OutPointElement(spend.vin[0].prevout)));
+    BOOST_CHECK(!filter.Match(CBlockFilter::OutPointElement(COutPoint(spend.vin[0].prevout.hash, 4))));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
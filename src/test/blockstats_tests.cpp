@@ -0,0 +1,137 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstats.h"
+
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/script.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "undo.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockstats_tests, BasicTestingSetup)
+
+static CScript WithdrawLock()
+{
+    const uint256 genesis = GetRandHash();
+    return CScript() << std::vector<unsigned char>(genesis.begin(), genesis.end()) << OP_WITHDRAWPROOFVERIFY;
+}
+
+static CScript P2PKH()
+{
+    return CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+}
+
+static CTxOut BlindedOutput()
+{
+    CTxOut txout(CTxOutValue(), P2PKH());
+    txout.nValue.vchCommitment.assign(CTxOutValue::nCommitmentSize, 0x08);
+    txout.nValue.vchRangeproof.assign(100, 0);
+    return txout;
+}
+
+BOOST_AUTO_TEST_CASE(blockstats_compute)
+{
+    CBlock block;
+    CBlockUndo blockundo;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.push_back(CTxOut(CTxOutValue(50), P2PKH()));
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+
+    // Spends a blinded output into one explicit and one blinded output.
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = GetRandHash();
+    spend.vout.push_back(CTxOut(CTxOutValue(20), P2PKH()));
+    spend.vout.push_back(BlindedOutput());
+    spend.nTxFee = 1000;
+    block.vtx.push_back(MakeTransactionRef(spend));
+    blockundo.vtxundo.push_back(CTxUndo());
+    blockundo.vtxundo.back().vprevout.push_back(CTxInUndo(BlindedOutput()));
+
+    // Releases 300 of locked value and locks 100 again: a peg-in of 200.
+    CMutableTransaction pegin;
+    pegin.vin.resize(1);
+    pegin.vin[0].prevout.hash = GetRandHash();
+    pegin.vout.push_back(CTxOut(CTxOutValue(100), WithdrawLock()));
+    pegin.vout.push_back(CTxOut(CTxOutValue(200), P2PKH()));
+    block.vtx.push_back(MakeTransactionRef(pegin));
+    blockundo.vtxundo.push_back(CTxUndo());
+    blockundo.vtxundo.back().vprevout.push_back(CTxInUndo(CTxOut(CTxOutValue(300), WithdrawLock())));
+
+    // Locks 40: a peg-out.
+    CMutableTransaction pegout;
+    pegout.vin.resize(2);
+    pegout.vin[0].prevout.hash = GetRandHash();
+    pegout.vin[1].prevout.hash = GetRandHash();
+    pegout.vout.push_back(CTxOut(CTxOutValue(40), WithdrawLock()));
+    pegout.nTxFee = 5000;
+    block.vtx.push_back(MakeTransactionRef(pegout));
+    blockundo.vtxundo.push_back(CTxUndo());
+    blockundo.vtxundo.back().vprevout.push_back(CTxInUndo(CTxOut(CTxOutValue(25), P2PKH())));
+    blockundo.vtxundo.back().vprevout.push_back(CTxInUndo(CTxOut(CTxOutValue(20), P2PKH())));
+
+    CBlockStats stats(block, blockundo, 7);
+    BOOST_CHECK(stats.blockHash == block.GetHash());
+    BOOST_CHECK_EQUAL(stats.nHeight, 7);
+    BOOST_CHECK_EQUAL(stats.nTx, 4U);
+    BOOST_CHECK_EQUAL(stats.nInputs, 4U);
+    BOOST_CHECK_EQUAL(stats.nOutputs, 6U);
+    BOOST_CHECK_EQUAL(stats.nBlindedOutputs, 1U);
+    BOOST_CHECK_EQUAL(stats.nExplicitOutputs, 5U);
+    BOOST_CHECK_EQUAL(stats.nExplicitOutputValue, 410);
+    BOOST_CHECK_EQUAL(stats.nRangeProofBytes, 100U);
+    BOOST_CHECK_EQUAL(stats.nTotalFee, 6000);
+    BOOST_CHECK_EQUAL(stats.nMinFeeRate, 0);
+    BOOST_CHECK(stats.nMedianFeeRate > 0);
+    BOOST_CHECK(stats.nMaxFeeRate > stats.nMedianFeeRate);
+    BOOST_CHECK_EQUAL(stats.nPegIns, 1U);
+    BOOST_CHECK_EQUAL(stats.nPegInValue, 200);
+    BOOST_CHECK_EQUAL(stats.nPegOuts, 1U);
+    BOOST_CHECK_EQUAL(stats.nPegOutValue, 40);
+    BOOST_CHECK_EQUAL(stats.mapOutputScriptTypes["pubkeyhash"], 4U);
+    BOOST_CHECK_EQUAL(stats.mapOutputScriptTypes["withdraw"], 2U);
+    BOOST_CHECK_EQUAL(stats.mapSpentScriptTypes["pubkeyhash"], 3U);
+    BOOST_CHECK_EQUAL(stats.mapSpentScriptTypes["withdraw"], 1U);
+
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    stream << stats;
+    CBlockStats stats2;
+    stream >> stats2;
+    BOOST_CHECK(stats2.blockHash == stats.blockHash);
+    BOOST_CHECK_EQUAL(stats2.nHeight, stats.nHeight);
+    BOOST_CHECK_EQUAL(stats2.nTime, stats.nTime);
+    BOOST_CHECK_EQUAL(stats2.nWeight, stats.nWeight);
+    BOOST_CHECK_EQUAL(stats2.nRangeProofBytes, stats.nRangeProofBytes);
+    BOOST_CHECK_EQUAL(stats2.nMedianFeeRate, stats.nMedianFeeRate);
+    BOOST_CHECK_EQUAL(stats2.nPegInValue, stats.nPegInValue);
+    BOOST_CHECK_EQUAL(stats2.nPegOutValue, stats.nPegOutValue);
+    BOOST_CHECK(stats2.mapOutputScriptTypes == stats.mapOutputScriptTypes);
+    BOOST_CHECK(stats2.mapSpentScriptTypes == stats.mapSpentScriptTypes);
+}
+
+BOOST_AUTO_TEST_CASE(blockstats_no_undo)
+{
+    // The genesis block is connected without undo data.
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.push_back(CTxOut(CTxOutValue(50), P2PKH()));
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+
+    CBlockStats stats(block, CBlockUndo(), 0);
+    BOOST_CHECK_EQUAL(stats.nTx, 1U);
+    BOOST_CHECK_EQUAL(stats.nInputs, 0U);
+    BOOST_CHECK_EQUAL(stats.nExplicitOutputValue, 50);
+    BOOST_CHECK_EQUAL(stats.nTotalFee, 0);
+    BOOST_CHECK(stats.mapSpentScriptTypes.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -433,6 +433,7 @@ BOOST_AUTO_TEST_CASE(merkle_block_4_test_p2pubkey_only)
     filter.insert(ParseHex("04eaafc2314def4ca98ac970241bcab022b9c1e1f4ea423a20f134c876f2c01ec0f0dd5b2e86e7168cefe0d81113c3807420ce13ad1357231a2252247d97a46a91"));
     // ...and the output address of the 4th transaction
     filter.insert(ParseHex("b6efd80d99179f4f4ff6f4dd0a007d018c385d21"));
+    CBloomFilter filterElements(filter);
 
     CMerkleBlock merkleBlock(block, filter);
     BOOST_CHECK(merkleBlock.header.GetHash() == block.GetHash());
@@ -441,6 +442,23 @@ BOOST_AUTO_TEST_CASE(merkle_block_4_test_p2pubkey_only)
     BOOST_CHECK(filter.contains(COutPoint(uint256S("0x147caa76786596590baa4e98f5d9f48b86c7765e489f7a6ff3360fe5c674360b"), 0)));
     // ... but not the 4th transaction's output (its not pay-2-pubkey)
     BOOST_CHECK(!filter.contains(COutPoint(uint256S("0x02981fa052f0481dbc5868f4fc2166035a10f27a03cfd2de67326471df5bc041"), 0)));
+
+    // The same from the block's merkle tree and parsed transactions, as
+    // served to filtered peers
+    std::vector<uint256> vTxid;
+    std::vector<CBloomTxElements> vElements;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        vTxid.push_back(block.vtx[i]->GetHash());
+        vElements.push_back(CBloomTxElements(*block.vtx[i]));
+    }
+    CMerkleBlock merkleBlockElements(block.GetBlockHeader(), CMerkleTreeLevels(vTxid), vElements, filterElements);
+    BOOST_CHECK(merkleBlockElements.vMatchedTxn == merkleBlock.vMatchedTxn);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION), ssElements(SER_NETWORK, PROTOCOL_VERSION);
+    ss << merkleBlock;
+    ssElements << merkleBlockElements;
+    BOOST_CHECK(ss.str() == ssElements.str());
+    BOOST_CHECK(filterElements.contains(COutPoint(uint256S("0x147caa76786596590baa4e98f5d9f48b86c7765e489f7a6ff3360fe5c674360b"), 0)));
+    BOOST_CHECK(!filterElements.contains(COutPoint(uint256S("0x02981fa052f0481dbc5868f4fc2166035a10f27a03cfd2de67326471df5bc041"), 0)));
 }
 
 BOOST_AUTO_TEST_CASE(merkle_block_4_test_update_none)
@@ -545,4 +563,29 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     }
 }
 
+BOOST_AUTO_TEST_CASE(rolling_bloom_uint256)
+{
+    // A hash and its bytes are the same key, whichever overload is used.
+    CRollingBloomFilter rb(1000, 0.001);
+    std::vector<uint256> hashes;
+    for (int i = 0; i < 500; i++) {
+        hashes.push_back(GetRandHash());
+        if (i % 2)
+            rb.insert(hashes.back());
+        else
+            rb.insert(std::vector<unsigned char>(hashes.back().begin(), hashes.back().end()));
+    }
+    for (int i = 0; i < 500; i++) {
+        BOOST_CHECK(rb.contains(hashes[i]));
+        BOOST_CHECK(rb.contains(std::vector<unsigned char>(hashes[i].begin(), hashes[i].end())));
+    }
+    rb.reset();
+    unsigned int nHits = 0;
+    for (int i = 0; i < 500; i++) {
+        if (rb.contains(hashes[i]))
+            ++nHits;
+    }
+    BOOST_CHECK_EQUAL(nHits, 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,122 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+static std::atomic<unsigned int> nChecksRun;
+static std::atomic<uint64_t> nCostRun;
+
+/** A check of a given cost that succeeds unless told otherwise. */
+struct FakeCheck
+{
+    unsigned int nCost;
+    bool fOk;
+
+    FakeCheck(unsigned int nCostIn, bool fOkIn = true) : nCost(nCostIn), fOk(fOkIn) {}
+
+    bool operator()()
+    {
+        nChecksRun++;
+        nCostRun += nCost;
+        return fOk;
+    }
+
+    unsigned int GetCost() const { return nCost; }
+};
+
+BOOST_AUTO_TEST_CASE(checkqueue_mixed_costs)
+{
+    CCheckQueue<FakeCheck> queue(128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 4; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<FakeCheck>::Thread, boost::ref(queue)));
+
+    for (int nRound = 0; nRound < 20; nRound++) {
+        nChecksRun = 0;
+        nCostRun = 0;
+        unsigned int nChecks = 0;
+        uint64_t nCost = 0;
+        {
+            CCheckQueueControl<FakeCheck> control(&queue);
+            for (int nBatch = 0; nBatch < 50; nBatch++) {
+                std::vector<FakeCheck*> vChecks;
+                for (int i = 0; i <= nBatch % 7; i++) {
+                    // Every fifth check stands in for a range proof.
+                    unsigned int nCheckCost = (nChecks % 5 == 0) ? 50 : 1;
+                    vChecks.push_back(new FakeCheck(nCheckCost));
+                    nChecks++;
+                    nCost += nCheckCost;
+                }
+                control.Add(vChecks);
+            }
+            BOOST_CHECK(control.Wait());
+        }
+        BOOST_CHECK_EQUAL(nChecksRun, nChecks);
+        BOOST_CHECK_EQUAL(nCostRun, nCost);
+        BOOST_CHECK(queue.IsIdle());
+    }
+    queue.GetStats();
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_failure)
+{
+    CCheckQueue<FakeCheck> queue(128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<FakeCheck>::Thread, boost::ref(queue)));
+
+    for (int nFail = 0; nFail < 3; nFail++) {
+        CCheckQueueControl<FakeCheck> control(&queue);
+        std::vector<FakeCheck*> vChecks;
+        for (int i = 0; i < 200; i++)
+            vChecks.push_back(new FakeCheck(i % 3 + 1, !(nFail == 1 && i == 150)));
+        control.Add(vChecks);
+        BOOST_CHECK_EQUAL(control.Wait(), nFail != 1);
+    }
+    // A failure does not stick to the next round.
+    BOOST_CHECK(queue.IsIdle());
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_restart_threads)
+{
+    // Worker slots of interrupted threads are reused, so a queue outlives
+    // many more threads than it has slots, as the static script check queue
+    // does across test setups.
+    CCheckQueue<FakeCheck> queue(128);
+    for (int nRound = 0; nRound < 40; nRound++) {
+        boost::thread_group threadGroup;
+        for (int i = 0; i < 3; i++)
+            threadGroup.create_thread(boost::bind(&CCheckQueue<FakeCheck>::Thread, boost::ref(queue)));
+        nChecksRun = 0;
+        {
+            CCheckQueueControl<FakeCheck> control(&queue);
+            std::vector<FakeCheck*> vChecks;
+            for (int i = 0; i < 10; i++)
+                vChecks.push_back(new FakeCheck(1 + i % 2));
+            control.Add(vChecks);
+            BOOST_CHECK(control.Wait());
+        }
+        BOOST_CHECK_EQUAL(nChecksRun, 10U);
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 #include "main.h"
+#include "txdb.h"
 #include "consensus/validation.h"
 
 #include <vector>
@@ -423,4 +424,262 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     }*/
 }
 
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true, true) {}
+
+    void WriteLegacyCoins(const uint256& txid, const CCoins& coins) {
+        BOOST_CHECK(db.Write(std::make_pair('c', txid), coins));
+    }
+
+    void EraseCoinTx(const uint256& txid) {
+        BOOST_CHECK(db.Erase(std::make_pair('T', txid)));
+        BOOST_CHECK(db.Erase('M'));
+    }
+};
+
+static void CheckCoinsEqual(const CCoins& a, const CCoins& b)
+{
+    BOOST_CHECK_EQUAL(a.nHeight, b.nHeight);
+    BOOST_CHECK_EQUAL(a.fCoinBase, b.fCoinBase);
+    BOOST_CHECK_EQUAL(a.vout.size(), b.vout.size());
+    for (unsigned int n = 0; n < std::min(a.vout.size(), b.vout.size()); n++)
+        BOOST_CHECK(a.vout[n] == b.vout[n]);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_per_output, TestingSetup)
+{
+    CCoinsViewDBTest base;
+    uint256 txid = GetRandHash();
+    CCoins expected;
+    expected.nHeight = 7;
+    expected.nVersion = 1;
+    expected.vout.resize(4);
+    for (unsigned int n = 0; n < expected.vout.size(); n++) {
+        expected.vout[n].nValue = (n + 1) * COIN;
+        expected.vout[n].scriptPubKey = CScript() << OP_TRUE;
+    }
+
+    {
+        CCoinsViewCache cache(&base);
+        *cache.ModifyNewCoins(txid, false) = expected;
+        BOOST_CHECK(cache.Flush());
+    }
+    CCoins coins;
+    BOOST_CHECK(base.GetCoins(txid, coins));
+    CheckCoinsEqual(coins, expected);
+
+    // Spending outputs only changes those, also through a stack of caches.
+    {
+        CCoinsViewCache cache(&base);
+        CCoinsViewCache child(&cache);
+        child.ModifyCoins(txid)->Spend(1);
+        BOOST_CHECK(child.Flush());
+        cache.ModifyCoins(txid)->Spend(3);
+        BOOST_CHECK(cache.Flush());
+    }
+    expected.vout[1].SetNull();
+    expected.vout.resize(3);
+    BOOST_CHECK(base.GetCoins(txid, coins));
+    CheckCoinsEqual(coins, expected);
+
+    // Restoring a spent output, as when disconnecting a block.
+    expected.vout.resize(4);
+    expected.vout[3].nValue = 4 * COIN;
+    expected.vout[3].scriptPubKey = CScript() << OP_TRUE;
+    {
+        CCoinsViewCache cache(&base);
+        {
+            CCoinsModifier modifier = cache.ModifyCoins(txid);
+            modifier->vout.resize(4);
+            modifier->vout[3] = expected.vout[3];
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(base.GetCoins(txid, coins));
+    CheckCoinsEqual(coins, expected);
+
+    // Spending everything removes the transaction.
+    {
+        CCoinsViewCache cache(&base);
+        {
+            CCoinsModifier modifier = cache.ModifyCoins(txid);
+            for (unsigned int n = 0; n < 4; n++)
+                modifier->Spend(n);
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!base.HaveCoins(txid));
+    BOOST_CHECK(!base.GetCoins(txid, coins));
+
+    // Records of older versions are converted.
+    BOOST_CHECK(base.Sync());
+    uint256 txidLegacy = GetRandHash();
+    base.WriteLegacyCoins(txidLegacy, expected);
+    BOOST_CHECK(!base.HaveCoins(txidLegacy));
+    BOOST_CHECK(base.Upgrade());
+    BOOST_CHECK(base.GetCoins(txidLegacy, coins));
+    CheckCoinsEqual(coins, expected);
+
+    // So are outputs written before transactions had a record of their own.
+    base.EraseCoinTx(txidLegacy);
+    BOOST_CHECK(!base.HaveCoins(txidLegacy));
+    BOOST_CHECK(base.Upgrade());
+    BOOST_CHECK(base.HaveCoins(txidLegacy));
+    BOOST_CHECK(base.GetCoins(txidLegacy, coins));
+    CheckCoinsEqual(coins, expected);
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(base.Cursor());
+    uint256 key;
+    BOOST_CHECK(pcursor->Valid() && pcursor->GetKey(key) && key == txidLegacy);
+    pcursor->Next();
+    BOOST_CHECK(!pcursor->Valid());
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_background_flush, TestingSetup)
+{
+    CCoinsViewDBTest base;
+    std::vector<uint256> txids;
+    for (int round = 0; round < 3; round++) {
+        CCoinsViewCache cache(&base);
+        // Spend what the previous flush, possibly still being written, left.
+        for (unsigned int i = 0; i < txids.size(); i++) {
+            BOOST_CHECK(cache.HaveCoins(txids[i]));
+            cache.ModifyCoins(txids[i])->Spend(0);
+        }
+        txids.clear();
+        for (int i = 0; i < 1000; i++) {
+            txids.push_back(GetRandHash());
+            CCoinsModifier coins = cache.ModifyNewCoins(txids.back(), false);
+            coins->vout.resize(1);
+            coins->vout[0].nValue = COIN;
+            coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+        }
+        uint256 hashBlock = GetRandHash();
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(base.GetBestBlock() == hashBlock);
+    }
+    BOOST_CHECK(base.Sync());
+    unsigned int nTxs = 0;
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(base.Cursor());
+    for (; pcursor->Valid(); pcursor->Next())
+        nTxs++;
+    BOOST_CHECK_EQUAL(nTxs, txids.size());
+    BOOST_CHECK(pcursor->GetBestBlock() == base.GetBestBlock());
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_withdraws_spent, TestingSetup)
+{
+    const uint256 genesisHash = GetRandHash();
+    std::vector<std::pair<uint256, COutPoint> > vWithdraws;
+    for (uint32_t n = 0; n < 300; n++)
+        vWithdraws.push_back(std::make_pair(genesisHash, COutPoint(GetRandHash(), n)));
+    {
+        CCoinsViewDB base(1 << 20, false, true);
+        {
+            CCoinsViewCache cache(&base);
+            for (size_t i = 0; i < vWithdraws.size(); i++)
+                cache.SetWithdrawSpent(vWithdraws[i], true);
+            BOOST_CHECK(cache.Flush());
+        }
+        // Answered while the write may still be pending.
+        for (size_t i = 0; i < vWithdraws.size(); i++)
+            BOOST_CHECK(base.IsWithdrawSpent(vWithdraws[i]));
+        BOOST_CHECK(!base.IsWithdrawSpent(std::make_pair(GetRandHash(), vWithdraws[0].second)));
+
+        // Disconnecting unspends some of them.
+        CCoinsViewCache cache(&base);
+        cache.SetWithdrawSpent(vWithdraws[0], false);
+        cache.SetWithdrawSpent(vWithdraws[299], false);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(!base.IsWithdrawSpent(vWithdraws[0]));
+        BOOST_CHECK(base.IsWithdrawSpent(vWithdraws[1]));
+        BOOST_CHECK(base.Sync());
+    }
+
+    // A reopened database loads what was written.
+    CCoinsViewDB base(1 << 20);
+    std::vector<std::pair<uint256, COutPoint> > vSpent;
+    BOOST_CHECK(base.GetWithdrawsSpent(vSpent));
+    BOOST_CHECK_EQUAL(vSpent.size(), vWithdraws.size() - 2);
+    for (size_t i = 1; i < vWithdraws.size() - 1; i++)
+        BOOST_CHECK(base.IsWithdrawSpent(vWithdraws[i]));
+    BOOST_CHECK(!base.IsWithdrawSpent(vWithdraws[0]));
+    BOOST_CHECK(!base.IsWithdrawSpent(vWithdraws[299]));
+}
+
+BOOST_AUTO_TEST_CASE(coins_prefetch)
+{
+    CCoinsViewTest base;
+    std::vector<uint256> txids;
+    {
+        CCoinsViewCache cache(&base);
+        for (int i = 0; i < 100; i++) {
+            txids.push_back(GetRandHash());
+            CCoinsModifier coins = cache.ModifyNewCoins(txids.back(), false);
+            coins->vout.resize(1);
+            coins->vout[0].nValue = i + 1;
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CCoinsViewPrefetch prefetch(&base, 1 << 20);
+    prefetch.Start(4);
+    std::vector<uint256> vPrefetch(txids);
+    vPrefetch.push_back(GetRandHash());
+    prefetch.Prefetch(vPrefetch);
+    for (int i = 0; i < 1000 && prefetch.GetCacheSize() < txids.size(); i++)
+        MilliSleep(1);
+    BOOST_CHECK_EQUAL(prefetch.GetCacheSize(), txids.size());
+
+    // Loaded coins are handed to the cache on top exactly once.
+    CCoinsViewCache cache(&prefetch);
+    for (unsigned int i = 0; i < txids.size(); i++)
+        BOOST_CHECK(cache.AccessCoins(txids[i])->vout[0].nValue == CAmount(i + 1));
+    BOOST_CHECK_EQUAL(prefetch.GetCacheSize(), 0);
+
+    // Writes through the prefetcher drop whatever it loaded.
+    prefetch.Prefetch(txids);
+    for (int i = 0; i < 1000 && prefetch.GetCacheSize() < txids.size(); i++)
+        MilliSleep(1);
+    cache.ModifyCoins(txids[0])->Spend(0);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(prefetch.GetCacheSize(), 0);
+    CCoinsViewCache check(&prefetch);
+    BOOST_CHECK(!check.HaveCoins(txids[0]));
+    BOOST_CHECK(check.HaveCoins(txids[1]));
+    prefetch.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_fromtx)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vout.resize(2);
+    mtx.vout[0].nValue.vchCommitment.assign(CTxOutValue::nCommitmentSize, 0x08);
+    mtx.vout[0].nValue.vchRangeproof.assign(4000, 0x01);
+    mtx.vout[0].nValue.vchNonceCommitment.assign(CTxOutValue::nCommitmentSize, 0x02);
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    mtx.vout[1].nValue = 1000;
+    mtx.vout[1].scriptPubKey = CScript() << OP_RETURN << std::vector<unsigned char>(40, 0x03);
+    CTransaction tx(mtx);
+
+    // Reuse outputs that still hold witness data, as a recycled entry might
+    CCoins coins;
+    coins.vout.resize(2);
+    coins.vout[1].nValue.vchRangeproof.assign(100, 0x04);
+    coins.FromTx(tx, 10);
+    BOOST_CHECK_EQUAL(coins.nHeight, 10);
+    BOOST_CHECK_EQUAL(coins.vout.size(), 2U);
+    BOOST_CHECK(coins.vout[0].nValue.vchCommitment == tx.vout[0].nValue.vchCommitment);
+    BOOST_CHECK(coins.vout[0].scriptPubKey == tx.vout[0].scriptPubKey);
+    BOOST_CHECK(coins.vout[0].nValue.vchRangeproof.empty());
+    BOOST_CHECK(coins.vout[0].nValue.vchNonceCommitment.empty());
+    BOOST_CHECK(coins.vout[1].IsNull());
+    BOOST_CHECK(coins.vout[1].nValue.vchRangeproof.empty());
+    BOOST_CHECK(coins.IsAvailable(0));
+    BOOST_CHECK(!coins.IsAvailable(1));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
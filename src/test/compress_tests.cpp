@@ -2,8 +2,12 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
 #include "compressor.h"
+#include "streams.h"
+#include "undo.h"
 #include "util.h"
+#include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 
 #include <stdint.h>
@@ -62,4 +66,49 @@ BOOST_AUTO_TEST_CASE(compress_amounts)
         BOOST_CHECK(TestDecode(i));
 }
 
+static CTxOut UndoRoundTrip(const CTxOut& txout, size_t& nSize)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CTxInUndo(txout);
+    nSize = ss.size();
+    CTxInUndo undo;
+    ss >> undo;
+    BOOST_CHECK(ss.empty());
+    return undo.txout;
+}
+
+BOOST_AUTO_TEST_CASE(compress_undo_txouts)
+{
+    const std::vector<unsigned char> vchCommitment = ParseHex("0353f6a2c9e5bd8e0a2e9a4cc71cbe67d7ff73ab6f2cd9ea8f8bc05f4b8f2b5c41");
+    CTxOutValue commitment;
+    std::copy(vchCommitment.begin(), vchCommitment.end(), commitment.vchCommitment.begin());
+    const CScript p2pkh = CScript() << OP_DUP << OP_HASH160 << ParseHex("0102030405060708090a0b0c0d0e0f1011121314") << OP_EQUALVERIFY << OP_CHECKSIG;
+    const CScript p2wpkh = CScript() << OP_0 << ParseHex("0102030405060708090a0b0c0d0e0f1011121314");
+    const CScript p2wsh = CScript() << OP_0 << ParseHex("0102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f20");
+    const CScript other = CScript() << OP_1 << OP_ADD << OP_2 << OP_EQUAL;
+
+    // Commitments lose their separate type byte, witness programs their
+    // opcodes; the first byte of the record is the nHeight code.
+    size_t nSize;
+    BOOST_CHECK(UndoRoundTrip(CTxOut(commitment, p2pkh), nSize) == CTxOut(commitment, p2pkh));
+    BOOST_CHECK_EQUAL(nSize, 1 + 1 + 32 + 21);
+    BOOST_CHECK(UndoRoundTrip(CTxOut(commitment, p2wpkh), nSize) == CTxOut(commitment, p2wpkh));
+    BOOST_CHECK_EQUAL(nSize, 1 + 1 + 32 + 20);
+    BOOST_CHECK(UndoRoundTrip(CTxOut(commitment, p2wsh), nSize) == CTxOut(commitment, p2wsh));
+    BOOST_CHECK_EQUAL(nSize, 1 + 1 + 32 + 32);
+    BOOST_CHECK(UndoRoundTrip(CTxOut(CTxOutValue(50 * COIN), p2wpkh), nSize) == CTxOut(CTxOutValue(50 * COIN), p2wpkh));
+    BOOST_CHECK_EQUAL(nSize, 1 + 1 + 1 + 20);
+    BOOST_CHECK(UndoRoundTrip(CTxOut(CTxOutValue(COIN), other), nSize) == CTxOut(CTxOutValue(COIN), other));
+    BOOST_CHECK_EQUAL(nSize, 1 + 1 + 1 + 1 + other.size());
+
+    // Undo data written in the CTxOutCompressor format still reads.
+    CTxOut txout(commitment, p2wpkh);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << VARINT(0u) << CTxOutCompressor(txout);
+    BOOST_CHECK_EQUAL(ss.size(), 1 + 1 + 33 + 1 + 22);
+    CTxInUndo undo;
+    ss >> undo;
+    BOOST_CHECK(undo.txout == txout);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
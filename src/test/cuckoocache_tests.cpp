@@ -0,0 +1,127 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "crypto/common.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+#include "uint256.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+namespace {
+
+struct TestHasher
+{
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        return ReadLE32(key.begin() + 4 * hash_select);
+    }
+};
+
+typedef CuckooCache::cache<uint256, TestHasher> TestCache;
+
+uint256 InsecureRandHash()
+{
+    uint256 hash;
+    for (int i = 0; i < 8; i++)
+        WriteLE32(hash.begin() + 4 * i, insecure_rand());
+    return hash;
+}
+
+std::vector<uint256> InsecureRandHashes(size_t n)
+{
+    std::vector<uint256> hashes;
+    hashes.reserve(n);
+    for (size_t i = 0; i < n; i++)
+        hashes.push_back(InsecureRandHash());
+    return hashes;
+}
+
+/** Fraction of hashes that are still in the cache. */
+double HitRate(const TestCache& cache, const std::vector<uint256>& hashes)
+{
+    size_t nHits = 0;
+    for (size_t i = 0; i < hashes.size(); i++)
+        nHits += cache.contains(hashes[i], false);
+    return (double)nHits / hashes.size();
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_no_false_positives)
+{
+    seed_insecure_rand(true);
+    TestCache cache;
+    cache.setup_bytes(32 << 10);
+    for (int i = 0; i < 100000; i++) {
+        cache.insert(InsecureRandHash());
+        BOOST_CHECK(!cache.contains(InsecureRandHash(), false));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_setup)
+{
+    TestCache cache;
+    BOOST_CHECK_EQUAL(cache.setup(0), 2U);
+    BOOST_CHECK_EQUAL(cache.setup_bytes(1 << 20), (1U << 20) / sizeof(uint256));
+
+    // Even the smallest cache holds what was just inserted.
+    cache.setup(0);
+    const uint256 hash = InsecureRandHash();
+    cache.insert(hash);
+    BOOST_CHECK(cache.contains(hash, false));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate)
+{
+    seed_insecure_rand(true);
+    TestCache cache;
+    const uint32_t nSize = cache.setup_bytes(1 << 20);
+
+    // Filled to half its size, almost nothing is lost.
+    std::vector<uint256> hashes = InsecureRandHashes(nSize / 2);
+    for (size_t i = 0; i < hashes.size(); i++)
+        cache.insert(hashes[i]);
+    BOOST_CHECK(HitRate(cache, hashes) > 0.99);
+
+    // Well past its size, the most recent inserts are still mostly there.
+    std::vector<uint256> moreHashes = InsecureRandHashes(2 * nSize);
+    for (size_t i = 0; i < moreHashes.size(); i++)
+        cache.insert(moreHashes[i]);
+    std::vector<uint256> recent(moreHashes.end() - nSize / 4, moreHashes.end());
+    BOOST_CHECK(HitRate(cache, recent) > 0.95);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    seed_insecure_rand(true);
+    TestCache cache;
+    const uint32_t nSize = cache.setup_bytes(1 << 20);
+
+    // Erased entries stay visible until their slot is reused...
+    std::vector<uint256> erased = InsecureRandHashes(nSize / 4);
+    std::vector<uint256> kept = InsecureRandHashes(nSize / 4);
+    for (size_t i = 0; i < erased.size(); i++) {
+        cache.insert(erased[i]);
+        cache.insert(kept[i]);
+    }
+    for (size_t i = 0; i < erased.size(); i++)
+        BOOST_CHECK(cache.contains(erased[i], true));
+    BOOST_CHECK(HitRate(cache, erased) > 0.99);
+
+    // ...and are the first to go once the cache fills up.
+    std::vector<uint256> fill = InsecureRandHashes(nSize / 2);
+    for (size_t i = 0; i < fill.size(); i++)
+        cache.insert(fill[i]);
+    BOOST_CHECK(HitRate(cache, kept) > 0.8);
+    BOOST_CHECK(HitRate(cache, erased) < HitRate(cache, kept) - 0.2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
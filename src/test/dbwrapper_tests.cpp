@@ -3,6 +3,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "dbwrapper.h"
+#include "main.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "random.h"
 #include "test/test_bitcoin.h"
@@ -126,6 +128,105 @@ BOOST_AUTO_TEST_CASE(dbwrapper_iterator)
     }
 }
 
+// Test that lookups are counted and work with the Bloom filter on or off.
+BOOST_AUTO_TEST_CASE(dbwrapper_read_stats)
+{
+    for (int nBloomBits = 0; nBloomBits <= DEFAULT_DB_BLOOM_BITS; nBloomBits += DEFAULT_DB_BLOOM_BITS) {
+        path ph = temp_directory_path() / unique_path();
+        CDBWrapper dbw(ph, (1 << 20), true, false, false, nBloomBits);
+        const CDBReadStats start = dbw.GetReadStats();
+
+        uint256 in = GetRandHash();
+        uint256 res;
+        BOOST_CHECK(dbw.Write('k', in));
+        BOOST_CHECK(dbw.Read('k', res));
+        BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
+        BOOST_CHECK(!dbw.Read('m', res));
+        BOOST_CHECK(!dbw.Exists('n'));
+        BOOST_CHECK(dbw.Exists('k'));
+
+        boost::scoped_ptr<CDBIterator> it(dbw.NewIterator());
+        it->Seek('a');
+        BOOST_CHECK(it->Valid());
+
+        const CDBReadStats stats = dbw.GetReadStats();
+        BOOST_CHECK_EQUAL(stats.nReads - start.nReads, 4);
+        BOOST_CHECK_EQUAL(stats.nReadsNotFound - start.nReadsNotFound, 2);
+        BOOST_CHECK_EQUAL(stats.nSeeks - start.nSeeks, 1);
+    }
+}
+
+// Test that writes and compactions are counted, in and out of bulk load mode.
+BOOST_AUTO_TEST_CASE(dbwrapper_write_stats)
+{
+    path ph = temp_directory_path() / unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true);
+    BOOST_CHECK(!dbw.IsBulkLoad());
+    for (int nMode = 0; nMode < 2; nMode++) {
+        dbw.SetBulkLoad(nMode == 1, 1 << 20);
+        BOOST_CHECK_EQUAL(dbw.IsBulkLoad(), nMode == 1);
+        const CDBWriteStats start = dbw.GetWriteStats();
+        // Enough to fill the write buffer several times over.
+        for (int i = 0; i < 20; i++) {
+            CDBBatch batch(dbw);
+            for (int j = 0; j < 1000; j++)
+                batch.Write(GetRandHash(), GetRandHash());
+            BOOST_CHECK(dbw.WriteBatch(batch));
+        }
+        BOOST_CHECK(dbw.Sync());
+        const CDBWriteStats stats = dbw.GetWriteStats();
+        BOOST_CHECK_EQUAL(stats.nWrites - start.nWrites, 21);
+        BOOST_CHECK(stats.nCompactions > start.nCompactions);
+        BOOST_CHECK(stats.nCompactionBytesWritten > start.nCompactionBytesWritten);
+    }
+}
+
+// Test that every profile stores and finds data the same way.
+BOOST_AUTO_TEST_CASE(dbwrapper_profiles)
+{
+    const DBProfile profiles[] = {DB_PROFILE_DEFAULT, DB_PROFILE_METADATA, DB_PROFILE_INDEX};
+    for (unsigned int i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+        path ph = temp_directory_path() / unique_path();
+        CDBWrapper dbw(ph, (1 << 20), true, false, false, DEFAULT_DB_BLOOM_BITS, profiles[i]);
+        CDBBatch batch(dbw);
+        std::vector<uint256> keys;
+        for (int j = 0; j < 1000; j++) {
+            keys.push_back(GetRandHash());
+            batch.Write(keys.back(), j);
+        }
+        BOOST_CHECK(dbw.WriteBatch(batch));
+        for (int j = 0; j < 1000; j++) {
+            int res = -1;
+            BOOST_CHECK(dbw.Read(keys[j], res));
+            BOOST_CHECK_EQUAL(res, j);
+        }
+        BOOST_CHECK(!dbw.Exists(GetRandHash()));
+    }
+}
+
+// Test that transaction index entries of older versions move out of the block tree.
+BOOST_FIXTURE_TEST_CASE(txindex_upgrade, TestingSetup)
+{
+    const uint256 txid = GetRandHash();
+    const std::pair<char, uint256> key('t', txid);
+    const CDiskTxPos pos(CDiskBlockPos(1, 2), 3);
+    BOOST_CHECK(pblocktree->Write(key, pos));
+
+    CTxIndexDB txindex(1 << 20, true);
+    CDiskTxPos res;
+    BOOST_CHECK(!txindex.ReadTxIndex(txid, res));
+    BOOST_CHECK(txindex.Upgrade(*pblocktree));
+    BOOST_CHECK(txindex.ReadTxIndex(txid, res));
+    BOOST_CHECK_EQUAL(res.nFile, pos.nFile);
+    BOOST_CHECK_EQUAL(res.nPos, pos.nPos);
+    BOOST_CHECK_EQUAL(res.nTxOffset, pos.nTxOffset);
+    BOOST_CHECK(!pblocktree->Exists(key));
+
+    // Nothing is left to move the second time.
+    BOOST_CHECK(txindex.Upgrade(*pblocktree));
+    BOOST_CHECK(txindex.ReadTxIndex(txid, res));
+}
+
 // Test that we do not obfuscation if there is existing data.
 BOOST_AUTO_TEST_CASE(existing_data_no_obfuscate)
 {
@@ -0,0 +1,126 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/jsonwriter.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(jsonwriter_tests, BasicTestingSetup)
+
+static void AppendTo(std::string* pstr, const std::string& str)
+{
+    BOOST_CHECK(!str.empty());
+    *pstr += str;
+}
+
+//! Write val through w, opening arrays and objects with the writer's own calls
+static void WriteDoc(CJSONWriter& w, const UniValue& val)
+{
+    if (val.isArray()) {
+        w.BeginArray();
+        for (unsigned int i = 0; i < val.size(); i++)
+            WriteDoc(w, val[i]);
+        w.EndArray();
+    } else if (val.isObject()) {
+        const std::vector<std::string>& keys = val.getKeys();
+        w.BeginObject();
+        for (unsigned int i = 0; i < keys.size(); i++) {
+            w.Key(keys[i]);
+            WriteDoc(w, val[i]);
+        }
+        w.EndObject();
+    } else {
+        w.Value(val);
+    }
+}
+
+static UniValue MakeDoc()
+{
+    UniValue doc(UniValue::VOBJ);
+    doc.pushKV("hash", "00000000839a8e6886ab5951d76f411475428afc90947ee320161bbf18eb6048");
+    doc.pushKV("height", 1);
+    doc.pushKV("difficulty", 1.5);
+    doc.pushKV("quote\"d", "line\nbreak");
+    doc.pushKV("empty", UniValue(UniValue::VARR));
+    doc.pushKV("none", UniValue(UniValue::VOBJ));
+    doc.pushKV("null", NullUniValue);
+    UniValue txs(UniValue::VARR);
+    for (int i = 0; i < 20; i++) {
+        UniValue tx(UniValue::VOBJ);
+        tx.pushKV("n", i);
+        tx.pushKV("spent", i % 2 == 0);
+        UniValue vout(UniValue::VARR);
+        vout.push_back(i);
+        vout.push_back(UniValue(UniValue::VARR));
+        tx.pushKV("vout", vout);
+        txs.push_back(tx);
+    }
+    doc.pushKV("tx", txs);
+    return doc;
+}
+
+BOOST_AUTO_TEST_CASE(jsonwriter_stream_matches_write)
+{
+    const UniValue doc = MakeDoc();
+    const std::string strExpected = doc.write();
+
+    size_t flushSizes[] = {1, 7, 100, CJSONStreamWriter::DEFAULT_FLUSH_SIZE};
+    for (unsigned int i = 0; i < sizeof(flushSizes) / sizeof(flushSizes[0]); i++) {
+        // Element by element
+        std::string str;
+        CJSONStreamWriter w(boost::bind(AppendTo, &str, _1), flushSizes[i]);
+        WriteDoc(w, doc);
+        BOOST_CHECK_EQUAL(w.HasFlushed(), flushSizes[i] < strExpected.size());
+        BOOST_CHECK_EQUAL(str + w.GetBuffered(), strExpected);
+        w.Flush();
+        BOOST_CHECK(w.GetBuffered().empty());
+        BOOST_CHECK_EQUAL(str, strExpected);
+
+        // Whole values and members at once
+        std::string str2;
+        CJSONStreamWriter w2(boost::bind(AppendTo, &str2, _1), flushSizes[i]);
+        w2.BeginArray();
+        w2.Value(doc);
+        w2.BeginObject();
+        w2.Members(doc);
+        w2.EndObject();
+        w2.EndArray();
+        w2.Flush();
+        BOOST_CHECK_EQUAL(str2, "[" + strExpected + "," + strExpected + "]");
+    }
+
+    // A lone scalar is a document too
+    std::string str;
+    CJSONStreamWriter w(boost::bind(AppendTo, &str, _1));
+    w.Value(UniValue("abc"));
+    w.Flush();
+    BOOST_CHECK_EQUAL(str, "\"abc\"");
+}
+
+BOOST_AUTO_TEST_CASE(jsonwriter_tree)
+{
+    const UniValue doc = MakeDoc();
+
+    UniValue result;
+    CJSONTreeWriter w(result);
+    WriteDoc(w, doc);
+    BOOST_CHECK_EQUAL(result.write(), doc.write());
+
+    UniValue result2;
+    CJSONTreeWriter w2(result2);
+    w2.BeginObject();
+    w2.Members(doc);
+    w2.EndObject();
+    BOOST_CHECK_EQUAL(result2.write(), doc.write());
+
+    UniValue result3;
+    CJSONTreeWriter w3(result3);
+    w3.Value(UniValue(42));
+    BOOST_CHECK_EQUAL(result3.write(), "42");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -188,4 +188,27 @@ BOOST_AUTO_TEST_CASE(key_test1)
     BOOST_CHECK(detsigc == ParseHex("2052d8a32079c11e79db95af63bb9600c5b04f21a9ca33dc129c2bfa8ac9dc1cd561d8ae5e0f6c1a16bde3719c64c2fd70e404b6428ab9a69566962e8771b5944d"));
 }
 
+BOOST_AUTO_TEST_CASE(key_parse_cache)
+{
+    CBitcoinSecret bsecret;
+    BOOST_CHECK(bsecret.SetString(strSecret1C));
+    CKey key = bsecret.GetKey();
+    CPubKey pubkey = key.GetPubKey();
+    uint256 hashMsg = Hash(strSecret1C.begin(), strSecret1C.end());
+    vector<unsigned char> sig;
+    BOOST_CHECK(key.Sign(hashMsg, sig));
+    BOOST_CHECK(pubkey.Verify(hashMsg, sig));
+
+    // A key that shares the cached key's slot but is not on the curve
+    vector<unsigned char> vchBad(pubkey.begin(), pubkey.end());
+    CPubKey bad;
+    do {
+        vchBad.back()++;
+        bad = CPubKey(vchBad);
+    } while (bad.IsFullyValid());
+    BOOST_CHECK(!bad.Verify(hashMsg, sig));
+    BOOST_CHECK(pubkey.Verify(hashMsg, sig));
+    BOOST_CHECK(!bad.Verify(hashMsg, sig));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
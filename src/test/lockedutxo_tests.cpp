@@ -27,6 +27,8 @@ BOOST_FIXTURE_TEST_SUITE(lockedutxo_tests, TestingSetup)
 
 BOOST_AUTO_TEST_CASE(Getlocked_validity)
 {
+    LOCK(cs_main);
+
     std::multimap<uint256, std::pair<COutPoint, CAmount> > mLocksCreated;
 
     uint256 gen0 = uint256S("0");
@@ -56,21 +58,18 @@ BOOST_AUTO_TEST_CASE(Getlocked_validity)
     value = 1;
     mLocksCreated.insert(std::make_pair(gen0, std::make_pair(COutPoint(uint256S("3"), 0), value)));
 
-    //Write list of 4
-    pblocktree->WriteLocksCreated(mLocksCreated);
+    //Write index of 4
+    std::multimap<uint256, std::pair<COutPoint, CAmount> > mEmpty;
+    assert(UpdateLockedOutputs(mLocksCreated, mEmpty));
 
-    //Read the list back, ensure it was written correctly
-    std::vector<std::pair<COutPoint, CAmount> > locksCreated;
-    assert(pblocktree->ReadLocksCreated(gen0, locksCreated));
-    assert(locksCreated.size() == 4);
+    //Read the index back, ensure it was written correctly
+    std::multimap<uint256, std::pair<COutPoint, CAmount> > mLocksRead;
+    assert(pblocktree->ReadLocks(mLocksRead));
+    assert(mLocksRead.size() == 4);
     std::multimap<uint256, std::pair<COutPoint, CAmount> >::iterator it = mLocksCreated.equal_range(gen0).first;
-    assert(locksCreated[0] == it->second);
-    std::advance(it, 1);
-    assert(locksCreated[1] == it->second);
-    std::advance(it, 1);
-    assert(locksCreated[2] == it->second);
-    std::advance(it, 1);
-    assert(locksCreated[3] == it->second);
+    std::multimap<uint256, std::pair<COutPoint, CAmount> >::iterator itRead = mLocksRead.equal_range(gen0).first;
+    for (unsigned int i = 0; i < 4; i++, it++, itRead++)
+        assert(itRead->second == it->second);
 
     //Call GetLockedOutputs to get the single output large enough
     CAmount desiredAmount = 101;
@@ -78,48 +77,67 @@ BOOST_AUTO_TEST_CASE(Getlocked_validity)
     assert(GetLockedOutputs(gen0, desiredAmount, res));
     assert(res.size() == 1 && res[0].second == 1000);
 
-    //Read it back again
-    std::vector<std::pair<COutPoint, CAmount> > locksCreated2;
-    assert(pblocktree->ReadLocksCreated(gen0, locksCreated2));
-    assert(locksCreated2.size() == 4);
+    //The smallest single output large enough is preferred
+    assert(GetLockedOutputs(gen0, 100, res));
+    assert(res.size() == 1 && res[0].second == 100);
 
-    //Write a blank list and read it back
-    std::vector<std::pair<COutPoint, CAmount> > locksCreated3;
-    pblocktree->ReWriteLocksCreated(gen0, locksCreated3);
-    assert(pblocktree->ReadLocksCreated(gen0, locksCreated3));
-    assert(locksCreated3.size() == 0);
+    //Read it back again
+    assert(pblocktree->ReadLocks(mLocksRead));
+    assert(mLocksRead.size() == 4);
 
     //Delete the largest element, and read back
-    locksCreated.erase(locksCreated.begin());
-    pblocktree->ReWriteLocksCreated(gen0, locksCreated);
-    assert(pblocktree->ReadLocksCreated(gen0, locksCreated));
-    assert(locksCreated.size() == 3);
+    std::multimap<uint256, std::pair<COutPoint, CAmount> > mLocksRemoved;
+    mLocksRemoved.insert(std::make_pair(gen0, std::make_pair(COutPoint(uint256S("0"), 0), CAmount(1000))));
+    assert(UpdateLockedOutputs(mEmpty, mLocksRemoved));
+    assert(pblocktree->ReadLocks(mLocksRead));
+    assert(mLocksRead.size() == 3);
 
     //Find at least 2 utxos to fulfill amount
     std::vector<std::pair<COutPoint, CAmount> > res2;
     assert(GetLockedOutputs(gen0, desiredAmount, res2));
-    assert(res2.size() > 1);
+    assert(res2.size() == 2 && res2[0].second == 100 && res2[1].second == 10);
 
     //Delete the second-largest element, and read back
-    locksCreated.erase(locksCreated.begin());
-    pblocktree->ReWriteLocksCreated(gen0, locksCreated);
-    assert(pblocktree->ReadLocksCreated(gen0, locksCreated));
-    assert(locksCreated.size() == 2);
+    mLocksRemoved.clear();
+    mLocksRemoved.insert(std::make_pair(gen0, std::make_pair(COutPoint(uint256S("1"), 0), CAmount(100))));
+    assert(UpdateLockedOutputs(mEmpty, mLocksRemoved));
+    assert(pblocktree->ReadLocks(mLocksRead));
+    assert(mLocksRead.size() == 2);
 
     //Will not find enough, but will return the last 2
     std::vector<std::pair<COutPoint, CAmount> > res3;
     assert(!GetLockedOutputs(gen0, desiredAmount, res3));
     assert(res3.size() == 2);
 
+    //Locks in the mempool make up the difference
+    CMutableTransaction mtxLock;
+    mtxLock.vin.resize(1);
+    mtxLock.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtxLock.vout.push_back(CTxOut(CTxOutValue(100), CScript() << std::vector<unsigned char>(gen0.begin(), gen0.end()) << OP_WITHDRAWPROOFVERIFY));
+    TestMemPoolEntryHelper entry;
+    mempool.addUnchecked(mtxLock.GetHash(), entry.FromTx(mtxLock));
+    std::vector<std::pair<COutPoint, CAmount> > res4;
+    assert(GetLockedOutputs(gen0, desiredAmount, res4));
+    assert(res4.size() == 3 && res4[2].first == COutPoint(mtxLock.GetHash(), 0));
+    mempool.clear();
+    assert(mempool.mapWithdrawLocks.empty());
+
+    //Locks which are no longer in the UTXO set are dropped from the index
+    pcoinsTip->ModifyCoins(uint256S("2"))->Spend(0);
+    std::vector<std::pair<COutPoint, CAmount> > res5;
+    assert(!GetLockedOutputs(gen0, desiredAmount, res5));
+    assert(res5.size() == 1 && res5[0].second == 1);
+    assert(pblocktree->ReadLocks(mLocksRead));
+    assert(mLocksRead.size() == 1);
 
     // Make sure this terminates
     for (unsigned int i = 0; i < 10000; i++) {
         // Make random set of 100 utxos
-        std::vector<std::pair<COutPoint, CAmount> > locksCreated4;
+        std::multimap<uint256, std::pair<COutPoint, CAmount> > mLocksCreated4;
         for (unsigned int j = 0; j < GetRand(100); j++) {
-            locksCreated4.push_back(std::make_pair(COutPoint(GetRandHash(), GetRand(10)), GetRand(100000)));
+            mLocksCreated4.insert(std::make_pair(gen0, std::make_pair(COutPoint(GetRandHash(), GetRand(10)), GetRand(100000))));
         }
-        pblocktree->ReWriteLocksCreated(gen0, locksCreated4);
+        UpdateLockedOutputs(mLocksCreated4, mEmpty);
         CAmount desiredAmount = GetRand(1000000);
         std::vector<std::pair<COutPoint, CAmount> > res;
         GetLockedOutputs(gen0, desiredAmount, res);
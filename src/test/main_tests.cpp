@@ -2,8 +2,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chain.h"
 #include "chainparams.h"
 #include "main.h"
+#include "random.h"
 
 #include "test/test_bitcoin.h"
 
@@ -75,4 +77,64 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_FIXTURE_TEST_CASE(block_proof_cached, TestChain100Setup)
+{
+    LOCK(cs_main);
+    for (CBlockIndex* pindex = chainActive.Tip(); pindex->pprev; pindex = pindex->pprev)
+        BOOST_CHECK(pindex->nStatus & BLOCK_PROOF_VALID);
+
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, chainActive.Tip(), Params().GetConsensus()));
+    BOOST_CHECK(block.proof.solution == chainActive.Tip()->solution);
+
+    // All blocks share one copy of their challenge.
+    BOOST_CHECK(chainActive.Tip()->pchallenge == chainActive.Genesis()->pchallenge);
+    BOOST_CHECK(block.proof.challenge == chainActive.Tip()->GetChallenge());
+    CBlockHeader header;
+    BOOST_CHECK(GetBlockIndexHeader(chainActive.Tip(), header));
+    BOOST_CHECK(header.GetHash() == block.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(raw_block_from_disk)
+{
+    CBlock block = Params().GenesisBlock();
+    CMutableTransaction mtx;
+    mtx.vin.resize(2);
+    mtx.vin[0].prevout.hash = GetRandHash();
+    mtx.vin[1].scriptSig = CScript() << OP_TRUE;
+    mtx.vout.resize(2);
+    mtx.vout[0].nValue.vchRangeproof = std::vector<unsigned char>(1000, 1);
+    mtx.wit.vtxinwit.resize(2);
+    mtx.wit.vtxinwit[1].scriptWitness.stack.push_back(std::vector<unsigned char>(100, 2));
+    block.vtx.push_back(MakeTransactionRef(mtx));
+
+    // Write it behind another block, into a file of its own.
+    CDiskBlockPos pos(1000, 0);
+    BOOST_CHECK(WriteBlockToDisk(Params().GenesisBlock(), pos, Params().MessageStart()));
+    pos.nPos += ::GetSerializeSize(Params().GenesisBlock(), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(WriteBlockToDisk(block, pos, Params().MessageStart()));
+
+    uint256 hash = block.GetHash();
+    CBlockIndex index(block);
+    index.phashBlock = &hash;
+    index.nFile = pos.nFile;
+    index.nDataPos = pos.nPos;
+    index.nStatus |= BLOCK_HAVE_DATA;
+
+    for (int fWitness = 0; fWitness < 2; fWitness++) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | (fWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS));
+        ss << block;
+        std::vector<char> vData;
+        BOOST_CHECK(ReadRawBlockFromDisk(vData, &index, fWitness));
+        BOOST_CHECK(std::string(vData.begin(), vData.end()) == ss.str());
+    }
+
+    // The bytes must belong to the block the index refers to.
+    uint256 hashOther = GetRandHash();
+    index.phashBlock = &hashOther;
+    std::vector<char> vData;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vData, &index, true));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
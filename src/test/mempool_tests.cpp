@@ -416,8 +416,8 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
     CheckSort<ancestor_score>(pool, sortedOrder);
 
     /* after tx6 is mined, tx7 should move up in the sort */
-    std::vector<CTransaction> vtx;
-    vtx.push_back(tx6);
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(tx6));
     std::list<CTransaction> dummy;
     std::set<std::pair<uint256, COutPoint> > setWithdrawsSpent;
     pool.removeForBlock(vtx, 1, setWithdrawsSpent, dummy, false);
@@ -554,7 +554,7 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     pool.addUnchecked(tx5.GetHash(), entry.Fee(1000LL).FromTx(tx5, &pool));
     pool.addUnchecked(tx7.GetHash(), entry.Fee(9000LL).FromTx(tx7, &pool));
 
-    std::vector<CTransaction> vtx;
+    std::vector<CTransactionRef> vtx;
     std::list<CTransaction> conflicts;
     SetMockTime(42);
     SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
@@ -585,6 +585,67 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolRangeproofUsageTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    TestMemPoolEntryHelper entry;
+    entry.dPriority = 10.0;
+
+    // A large transaction without any witness data...
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << std::vector<unsigned char>(4000, 1);
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+
+    // ...and one whose range proof is discounted as witness data, but still
+    // has to be kept in memory in full.
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    tx2.vout[0].nValue.vchRangeproof.assign(5000, 2);
+
+    CTxMemPoolEntry entry1 = entry.Fee(10000LL).FromTx(tx1, &pool);
+    CTxMemPoolEntry entry2 = entry.FromTx(tx2, &pool);
+    BOOST_CHECK(entry2.DynamicMemoryUsage() >= 5000);
+    BOOST_CHECK(entry2.GetTxSize() < 2000);
+
+    // tx2 pays a higher feerate per virtual byte, but a lower one per byte of memory
+    const CAmount nFee2 = 10000LL * entry2.GetTxSize() * 12 / entry1.GetTxSize() / 10;
+    BOOST_CHECK(nFee2 * entry1.DynamicMemoryUsage() < 10000LL * entry2.DynamicMemoryUsage());
+    pool.addUnchecked(tx1.GetHash(), entry1);
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(nFee2).FromTx(tx2, &pool));
+
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx2.GetHash())->GetUsageWithDescendants(), entry2.DynamicMemoryUsage());
+
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1); // evicts the transaction using more memory per fee paid
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
+
+    // The descendant usage of a parent includes its children.
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx3.vin[0].scriptSig = CScript() << OP_3;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    tx3.vout[0].nValue = 10 * COIN;
+    tx3.vout[0].nValue.vchRangeproof.assign(3000, 3);
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(1000LL).FromTx(tx3, &pool));
+
+    CTxMemPool::txiter it1 = pool.mapTx.find(tx1.GetHash());
+    CTxMemPool::txiter it3 = pool.mapTx.find(tx3.GetHash());
+    BOOST_CHECK_EQUAL(it1->GetUsageWithDescendants(), it1->DynamicMemoryUsage() + it3->DynamicMemoryUsage());
+
+    std::list<CTransaction> removed;
+    pool.removeRecursive(tx3, removed);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx1.GetHash())->GetUsageWithDescendants(), pool.mapTx.find(tx1.GetHash())->DynamicMemoryUsage());
+}
+
 BOOST_AUTO_TEST_CASE(WithdrawsSpentTest)
 {
     CTxMemPool pool(CFeeRate(0));
@@ -632,7 +693,7 @@ BOOST_AUTO_TEST_CASE(WithdrawsSpentTest)
     tx.vout.resize(4);
     tx.vout[3].nValue = 0;
     std::list<CTransaction> conflicts;
-    pool.removeForBlock({tx}, 1, setWithdrawsSpent, conflicts);
+    pool.removeForBlock({MakeTransactionRef(tx)}, 1, setWithdrawsSpent, conflicts);
 
     BOOST_CHECK_EQUAL(pool.size(), 3);
     BOOST_CHECK_EQUAL(pool.mapWithdrawsSpentToTxid.size(), 2);
@@ -643,7 +704,7 @@ BOOST_AUTO_TEST_CASE(WithdrawsSpentTest)
     GetRandBytes(tx.vin[0].prevout.hash.begin(), tx.vin[0].prevout.hash.size());
     tx.vout.resize(5);
     tx.vout[4].nValue = 0;
-    pool.removeForBlock({tx}, 2, setWithdrawsSpent, conflicts);
+    pool.removeForBlock({MakeTransactionRef(tx)}, 2, setWithdrawsSpent, conflicts);
 
     BOOST_CHECK_EQUAL(pool.size(), 2);
     BOOST_CHECK_EQUAL(pool.mapWithdrawsSpentToTxid.size(), 1);
@@ -662,10 +723,209 @@ BOOST_AUTO_TEST_CASE(WithdrawsSpentTest)
     GetRandBytes(tx.vin[0].prevout.hash.begin(), tx.vin[0].prevout.hash.size());
     tx.vout.resize(7);
     tx.vout[6].nValue = 0;
-    pool.removeForBlock({tx}, 3, setWithdrawsSpent, conflicts);
+    pool.removeForBlock({MakeTransactionRef(tx)}, 3, setWithdrawsSpent, conflicts);
 
     BOOST_CHECK_EQUAL(pool.size(), 1);
     BOOST_CHECK(pool.mapWithdrawsSpentToTxid.empty());
 }
 
+BOOST_AUTO_TEST_CASE(MempoolInfoSortedTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction txParent = CMutableTransaction();
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent));
+
+    // A high fee child still comes after its parent.
+    CMutableTransaction txChild = CMutableTransaction();
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(50000LL).FromTx(txChild));
+
+    CMutableTransaction txOther = CMutableTransaction();
+    txOther.vout.resize(1);
+    txOther.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txOther.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(txOther.GetHash(), entry.Fee(20000LL).FromTx(txOther));
+
+    // Repeats and transactions not in the pool are left out.
+    std::vector<uint256> vHashes;
+    vHashes.push_back(txChild.GetHash());
+    vHashes.push_back(GetRandHash());
+    vHashes.push_back(txParent.GetHash());
+    vHashes.push_back(txChild.GetHash());
+    vHashes.push_back(txOther.GetHash());
+    std::vector<TxMempoolInfo> vInfo = pool.infoSorted(vHashes);
+    BOOST_CHECK_EQUAL(vInfo.size(), 3);
+    BOOST_CHECK(vInfo[0].tx->GetHash() == txOther.GetHash());
+    BOOST_CHECK(vInfo[1].tx->GetHash() == txParent.GetHash());
+    BOOST_CHECK(vInfo[2].tx->GetHash() == txChild.GetHash());
+    BOOST_CHECK(vInfo[0].feeRate > vInfo[1].feeRate);
+
+    BOOST_CHECK(pool.infoSorted(std::vector<uint256>()).empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAncestorLimitTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    std::string dummy;
+
+    // A chain in which each transaction spends the two before it, so most
+    // ancestors are reached along more than one path.
+    uint256 hashPrev2 = GetRandHash(), hashPrev1 = GetRandHash(), hashFirst;
+    for (unsigned int i = 0; i < 25; i++) {
+        CMutableTransaction tx = CMutableTransaction();
+        tx.vin.resize(2);
+        tx.vin[0].prevout = COutPoint(hashPrev2, 1);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vin[1].prevout = COutPoint(hashPrev1, 0);
+        tx.vin[1].scriptSig = CScript() << OP_11;
+        tx.vout.resize(2);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = COIN;
+        tx.vout[1] = tx.vout[0];
+
+        CTxMemPool::setEntries setAncestors;
+        BOOST_CHECK(pool.CalculateMemPoolAncestors(entry.FromTx(tx), setAncestors, 25, 1000000, 25, 1000000, dummy));
+        BOOST_CHECK_EQUAL(setAncestors.size(), i);
+        pool.addUnchecked(tx.GetHash(), entry.FromTx(tx), setAncestors);
+        BOOST_CHECK_EQUAL(pool.mapTx.find(tx.GetHash())->GetCountWithAncestors(), i + 1);
+
+        if (i == 0)
+            hashFirst = tx.GetHash();
+        hashPrev2 = hashPrev1;
+        hashPrev1 = tx.GetHash();
+    }
+
+    // One more exceeds the ancestor count limit, and the last transaction
+    // with it the descendant count limit of the first.
+    CMutableTransaction tx = CMutableTransaction();
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(hashPrev1, 1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = COIN;
+    CTxMemPool::setEntries setAncestors;
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry.FromTx(tx), setAncestors, 25, 1000000, 1000, 1000000, dummy));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry.FromTx(tx), setAncestors, 1000, 1000000, 25, 1000000, dummy));
+    setAncestors.clear();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entry.FromTx(tx), setAncestors, 26, 1000000, 26, 1000000, dummy));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 25);
+
+    // All of the chain descends from its first transaction.
+    CTxMemPool::setEntries setDescendants;
+    pool.CalculateDescendants(pool.mapTx.find(hashFirst), setDescendants);
+    BOOST_CHECK_EQUAL(setDescendants.size(), 25);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolDeltasTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    std::vector<CMempoolDelta> vDeltas;
+    uint64_t nSequence, nSequenceNow;
+
+    // Sequence 0 always gets the whole mempool.
+    BOOST_CHECK(!pool.GetDeltas(0, vDeltas, nSequence));
+    BOOST_CHECK(vDeltas.empty());
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(1000LL).FromTx(tx1));
+    CMutableTransaction tx2 = tx1;
+    tx2.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(2000LL).FromTx(tx2));
+
+    BOOST_CHECK(pool.GetDeltas(nSequence, vDeltas, nSequenceNow));
+    BOOST_CHECK_EQUAL(nSequenceNow, nSequence + 2);
+    BOOST_CHECK_EQUAL(vDeltas.size(), 2);
+    BOOST_CHECK(vDeltas[0].fAdded && vDeltas[0].txid == tx1.GetHash() && vDeltas[0].nFee == 1000);
+    BOOST_CHECK(vDeltas[1].fAdded && vDeltas[1].txid == tx2.GetHash() && vDeltas[1].nSequence == nSequenceNow);
+    nSequence = nSequenceNow;
+
+    // Nothing new: waiting times out.
+    BOOST_CHECK(pool.GetDeltas(nSequence, vDeltas, nSequenceNow));
+    BOOST_CHECK(vDeltas.empty());
+    BOOST_CHECK(!pool.WaitForDeltas(nSequence, boost::get_system_time()));
+
+    std::list<CTransaction> removed;
+    pool.removeRecursive(tx1, removed);
+    BOOST_CHECK(pool.WaitForDeltas(nSequence, boost::get_system_time()));
+    BOOST_CHECK(pool.GetDeltas(nSequence, vDeltas, nSequenceNow));
+    BOOST_CHECK_EQUAL(vDeltas.size(), 1);
+    BOOST_CHECK(!vDeltas[0].fAdded && vDeltas[0].txid == tx1.GetHash());
+
+    // Once the changes are lost, the whole mempool is returned instead.
+    pool.clear();
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(1000LL).FromTx(tx1));
+    BOOST_CHECK(!pool.GetDeltas(nSequence, vDeltas, nSequenceNow));
+    BOOST_CHECK_EQUAL(vDeltas.size(), 1);
+    BOOST_CHECK(vDeltas[0].fAdded && vDeltas[0].txid == tx1.GetHash() && vDeltas[0].nSequence == nSequenceNow);
+    // ... as it is for a sequence the mempool has not reached.
+    BOOST_CHECK(!pool.GetDeltas(nSequenceNow + 1, vDeltas, nSequence));
+    BOOST_CHECK_EQUAL(nSequence, nSequenceNow);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolOverlayTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CCoinsView viewDummy;
+    CCoinsViewCache tip(&viewDummy);
+
+    CMutableTransaction txConfirmed = CMutableTransaction();
+    txConfirmed.vout.resize(2);
+    txConfirmed.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txConfirmed.vout[0].nValue = 10 * COIN;
+    txConfirmed.vout[1] = txConfirmed.vout[0];
+    tip.ModifyNewCoins(txConfirmed.GetHash(), false)->FromTx(txConfirmed, 5);
+    CMutableTransaction txPruned = txConfirmed;
+    txPruned.nLockTime = 1;
+    tip.ModifyNewCoins(txPruned.GetHash(), false)->Clear();
+
+    CMutableTransaction txUnconfirmed = CMutableTransaction();
+    txUnconfirmed.vin.resize(1);
+    txUnconfirmed.vin[0].prevout = COutPoint(txConfirmed.GetHash(), 0);
+    txUnconfirmed.vout = txConfirmed.vout;
+    pool.addUnchecked(txUnconfirmed.GetHash(), entry.Fee(1000LL).FromTx(txUnconfirmed));
+
+    LOCK(pool.cs);
+    CCoinsViewMemPoolOverlay view(&tip, pool);
+    // Confirmed coins are those in tip, not a copy of them.
+    BOOST_CHECK(view.AccessCoins(txConfirmed.GetHash()) == tip.AccessCoins(txConfirmed.GetHash()));
+    BOOST_CHECK(view.HaveCoins(txUnconfirmed.GetHash()));
+    BOOST_CHECK_EQUAL(view.AccessCoins(txUnconfirmed.GetHash())->nHeight, MEMPOOL_HEIGHT);
+    BOOST_CHECK(!view.HaveCoins(txPruned.GetHash()));
+
+    CMutableTransaction txSpend = CMutableTransaction();
+    txSpend.vin.resize(2);
+    txSpend.vin[0].prevout = COutPoint(txConfirmed.GetHash(), 1);
+    txSpend.vin[1].prevout = COutPoint(txUnconfirmed.GetHash(), 0);
+    BOOST_CHECK(view.HaveInputs(txSpend));
+    txSpend.vin[1].prevout.n = 2;
+    BOOST_CHECK(!view.HaveInputs(txSpend));
+
+    // Once detached, only what was found before is.
+    view.Detach();
+    CMutableTransaction txLater = txConfirmed;
+    txLater.nLockTime = 2;
+    tip.ModifyNewCoins(txLater.GetHash(), false)->FromTx(txLater, 6);
+    BOOST_CHECK(!view.HaveCoins(txLater.GetHash()));
+    BOOST_CHECK(view.HaveCoins(txConfirmed.GetHash()));
+    BOOST_CHECK_EQUAL(view.GetOutputFor(txSpend.vin[0]).nValue.GetAmount(), 10 * COIN);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
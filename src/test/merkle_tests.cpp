@@ -15,8 +15,8 @@ static uint256 BlockBuildMerkleTree(const CBlock& block, bool* fMutated, std::ve
 {
     vMerkleTree.clear();
     vMerkleTree.reserve(block.vtx.size() * 2 + 16); // Safe upper bound for the number of total nodes.
-    for (std::vector<CTransaction>::const_iterator it(block.vtx.begin()); it != block.vtx.end(); ++it)
-        vMerkleTree.push_back(it->GetHash());
+    for (std::vector<CTransactionRef>::const_iterator it(block.vtx.begin()); it != block.vtx.end(); ++it)
+        vMerkleTree.push_back((*it)->GetHash());
     int j = 0;
     bool mutated = false;
     for (int nSize = block.vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
@@ -86,7 +86,7 @@ BOOST_AUTO_TEST_CASE(merkle_test)
             for (int j = 0; j < ntx; j++) {
                 CMutableTransaction mtx;
                 mtx.nLockTime = j;
-                block.vtx[j] = mtx;
+                block.vtx[j] = MakeTransactionRef(std::move(mtx));
             }
             // Compute the root of the block before mutating it.
             bool unmutatedMutated = false;
@@ -126,11 +126,39 @@ BOOST_AUTO_TEST_CASE(merkle_test)
                     std::vector<uint256> newBranch = BlockMerkleBranch(block, mtx);
                     std::vector<uint256> oldBranch = BlockGetMerkleBranch(block, merkleTree, mtx);
                     BOOST_CHECK(oldBranch == newBranch);
-                    BOOST_CHECK(ComputeMerkleRootFromBranch(block.vtx[mtx].GetHash(), newBranch, mtx) == oldRoot);
+                    BOOST_CHECK(ComputeMerkleRootFromBranch(block.vtx[mtx]->GetHash(), newBranch, mtx) == oldRoot);
                 }
             }
         }
     }
 }
 
+BOOST_AUTO_TEST_CASE(incremental_merkle_test)
+{
+    for (int i = 0; i < 32; i++) {
+        // All sizes from 0 to 16 inclusive, and then 15 random sizes.
+        int ntx = (i <= 16) ? i : 17 + (insecure_rand() % 4000);
+        std::vector<uint256> leaves;
+        CIncrementalMerkleTree tree;
+        for (int j = 0; j < ntx; j++) {
+            leaves.push_back(GetRandHash());
+            tree.Append(leaves.back());
+            // The root is right after every leaf, not just the last one.
+            if (j < 16 || j + 1 == ntx)
+                BOOST_CHECK(tree.Root() == ComputeMerkleRoot(leaves));
+        }
+        BOOST_CHECK_EQUAL(tree.size(), (size_t)ntx);
+        BOOST_CHECK(tree.Root() == ComputeMerkleRoot(leaves));
+        if (ntx == 0)
+            continue;
+        BOOST_CHECK(tree.FirstBranch() == ComputeMerkleBranch(leaves, 0));
+
+        // Replacing the first leaf leaves its branch as it is.
+        leaves[0] = GetRandHash();
+        tree.SetFirst(leaves[0]);
+        BOOST_CHECK(tree.Root() == ComputeMerkleRoot(leaves));
+        BOOST_CHECK(ComputeMerkleRootFromBranch(leaves[0], tree.FirstBranch(), 0) == tree.Root());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
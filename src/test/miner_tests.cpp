@@ -108,9 +108,9 @@ void TestPackageSelection(const CChainParams& chainparams, CScript scriptPubKey,
     mempool.addUnchecked(hashHighFeeTx, entry.Fee(50000).Time(GetTime()).SpendsCoinbase(false).FromTx(tx));
 
     CBlockTemplate *pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
-    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == hashParentTx);
-    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == hashHighFeeTx);
-    BOOST_CHECK(pblocktemplate->block.vtx[3].GetHash() == hashMediumFeeTx);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == hashParentTx);
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == hashHighFeeTx);
+    BOOST_CHECK(pblocktemplate->block.vtx[3]->GetHash() == hashMediumFeeTx);
 
     // Test that a package below the min relay fee doesn't get included
     tx.vin[0].prevout.hash = hashHighFeeTx;
@@ -130,8 +130,8 @@ void TestPackageSelection(const CChainParams& chainparams, CScript scriptPubKey,
     pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
     // Verify that the free tx and the low fee tx didn't get selected
     for (size_t i=0; i<pblocktemplate->block.vtx.size(); ++i) {
-        BOOST_CHECK(pblocktemplate->block.vtx[i].GetHash() != hashFreeTx);
-        BOOST_CHECK(pblocktemplate->block.vtx[i].GetHash() != hashLowFeeTx);
+        BOOST_CHECK(pblocktemplate->block.vtx[i]->GetHash() != hashFreeTx);
+        BOOST_CHECK(pblocktemplate->block.vtx[i]->GetHash() != hashLowFeeTx);
     }
 
     // Test that packages above the min relay fee do get included, even if one
@@ -143,8 +143,8 @@ void TestPackageSelection(const CChainParams& chainparams, CScript scriptPubKey,
     hashLowFeeTx = tx.GetHash();
     mempool.addUnchecked(hashLowFeeTx, entry.Fee(feeToUse+2).FromTx(tx));
     pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
-    BOOST_CHECK(pblocktemplate->block.vtx[4].GetHash() == hashFreeTx);
-    BOOST_CHECK(pblocktemplate->block.vtx[5].GetHash() == hashLowFeeTx);
+    BOOST_CHECK(pblocktemplate->block.vtx[4]->GetHash() == hashFreeTx);
+    BOOST_CHECK(pblocktemplate->block.vtx[5]->GetHash() == hashLowFeeTx);
 
     // Test that transaction selection properly updates ancestor fee
     // calculations as ancestor transactions get included in a block.
@@ -167,8 +167,8 @@ void TestPackageSelection(const CChainParams& chainparams, CScript scriptPubKey,
 
     // Verify that this tx isn't selected.
     for (size_t i=0; i<pblocktemplate->block.vtx.size(); ++i) {
-        BOOST_CHECK(pblocktemplate->block.vtx[i].GetHash() != hashFreeTx2);
-        BOOST_CHECK(pblocktemplate->block.vtx[i].GetHash() != hashLowFeeTx2);
+        BOOST_CHECK(pblocktemplate->block.vtx[i]->GetHash() != hashFreeTx2);
+        BOOST_CHECK(pblocktemplate->block.vtx[i]->GetHash() != hashLowFeeTx2);
     }
 
     // This tx will be mineable, and should cause hashLowFeeTx2 to be selected
@@ -177,7 +177,7 @@ void TestPackageSelection(const CChainParams& chainparams, CScript scriptPubKey,
     tx.vout[0].nValue = 100000000 - 10000; // 10k satoshi fee
     mempool.addUnchecked(tx.GetHash(), entry.Fee(10000).FromTx(tx));
     pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
-    BOOST_CHECK(pblocktemplate->block.vtx[8].GetHash() == hashLowFeeTx2);
+    BOOST_CHECK(pblocktemplate->block.vtx[8]->GetHash() == hashLowFeeTx2);
     */
 }
 
@@ -188,7 +188,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     /*
     const CChainParams& chainparams = Params();
     CScript scriptPubKey = chainparams.CoinbaseDestination();
-    CScript genScriptPubKey = chainparams.GenesisBlock().vtx[0].vout[0].scriptPubKey;
+    CScript genScriptPubKey = chainparams.GenesisBlock().vtx[0]->vout[0].scriptPubKey;
     CBlockTemplate *pblocktemplate;
     CMutableTransaction tx,tx2;
     CScript script;
@@ -210,7 +210,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     std::vector<unsigned char> vchSig;
 
     //This assumes evenly split genesis outputs
-    int32_t rewardShards = chainparams.GenesisBlock().vtx[0].vout.size();
+    int32_t rewardShards = chainparams.GenesisBlock().vtx[0]->vout.size();
 
     const CAmount GENESISVALUE = MAX_MONEY/rewardShards;
     const CAmount LOWFEE = CENT;
@@ -235,7 +235,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
         if (i == 100) {
 
             tx.vin.resize(1);
-            tx.vin[0].prevout.hash = chainparams.GenesisBlock().vtx[0].GetHash();
+            tx.vin[0].prevout.hash = chainparams.GenesisBlock().vtx[0]->GetHash();
             tx.vin[0].prevout.n = 0;
             tx.vout.resize(1);
             tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
@@ -546,4 +546,71 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     */
 }
 
+static void SignSpend(CMutableTransaction& tx, const CKey& key, const CScript& scriptPubKey)
+{
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig = CScript() << vchSig;
+}
+
+static bool ToMemPool(const CMutableTransaction& tx)
+{
+    LOCK(cs_main);
+    CValidationState state;
+    return AcceptToMemoryPool(mempool, state, tx, false, NULL, true, 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(CreateNewBlock_candidate, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    mempool.clear();
+
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    tx1.vout.resize(1);
+    tx1.vout[0].nValue = 11*CENT;
+    tx1.vout[0].scriptPubKey = scriptPubKey;
+    tx1.nTxFee = coinbaseTxns[0].vout[0].nValue.GetAmount() - 11*CENT;
+    SignSpend(tx1, coinbaseKey, scriptPubKey);
+
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vout.resize(1);
+    tx2.vout[0].nValue = 10*CENT;
+    tx2.vout[0].scriptPubKey = scriptPubKey;
+    tx2.nTxFee = 1*CENT;
+    SignSpend(tx2, coinbaseKey, scriptPubKey);
+
+    BOOST_CHECK(ToMemPool(tx1));
+    std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+
+    // A transaction entering the mempool is appended to the last template
+    BOOST_CHECK(ToMemPool(tx2));
+    pblocktemplate.reset(BlockAssembler(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == tx1.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == tx2.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -(tx1.nTxFee + tx2.nTxFee));
+
+    // One of its transactions leaving the mempool means starting over
+    std::list<CTransaction> removed;
+    mempool.removeRecursive(tx2, removed);
+    pblocktemplate.reset(BlockAssembler(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == tx1.GetHash());
+
+    // So does a new tip
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, tx1), scriptPubKey);
+    pblocktemplate.reset(BlockAssembler(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -164,4 +164,24 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(cnetmessage_hash)
+{
+    std::vector<char> vData(100000);
+    for (size_t i = 0; i < vData.size(); i++)
+        vData[i] = i * 7;
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader << CMessageHeader(Params().MessageStart(), "block", vData.size());
+
+    CNetMessage msg(Params().MessageStart(), SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK_EQUAL(msg.readHeader(&ssHeader[0], ssHeader.size()), (int)ssHeader.size());
+    // Arrives in uneven pieces, as it would off the socket
+    for (size_t nPos = 0, nChunk = 1; nPos < vData.size(); nChunk = nChunk * 3 + 1) {
+        BOOST_CHECK(!msg.complete());
+        nPos += msg.readData(&vData[nPos], std::min(nChunk, vData.size() - nPos));
+    }
+    BOOST_CHECK(msg.complete());
+    BOOST_CHECK(msg.GetMessageHash() == Hash(vData.begin(), vData.end()));
+    BOOST_CHECK(msg.GetMessageHash() == Hash(msg.vRecv.begin(), msg.vRecv.end()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,67 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netbufferpool.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(netbufferpool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(netbufferpool_reuse)
+{
+    CNetBufferPool pool(100000);
+    CSerializeData data;
+    BOOST_CHECK(!pool.Get(data, 1000));
+
+    data.resize(1000);
+    const char* pbuf = data.data();
+    pool.Put(data);
+    BOOST_CHECK(data.empty() && data.capacity() == 0);
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), 1000);
+
+    // Too large for the buffer.
+    BOOST_CHECK(!pool.Get(data, 1001));
+    // Requests below the smallest size class are not served from the pool.
+    BOOST_CHECK(!pool.Get(data, 100));
+    BOOST_CHECK(!pool.Get(data, 255));
+
+    BOOST_CHECK(pool.Get(data, 600));
+    BOOST_CHECK(data.empty() && data.capacity() == 1000 && data.data() == pbuf);
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), 0);
+    BOOST_CHECK(!pool.Get(data, 600));
+}
+
+BOOST_AUTO_TEST_CASE(netbufferpool_limits)
+{
+    CNetBufferPool pool(10000);
+    CSerializeData data;
+
+    // Buffers too small to pool are freed.
+    data.resize(100);
+    pool.Put(data);
+    BOOST_CHECK(data.capacity() == 0);
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), 0);
+
+    // As are ones beyond the limit.
+    for (int i = 0; i < 3; i++) {
+        data.resize(4000);
+        pool.Put(data);
+        BOOST_CHECK(data.capacity() == 0);
+    }
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), 8000);
+
+    uint64_t nHits, nMisses, nPooledBytes;
+    CNetBufferPool::GetStats(nHits, nMisses, nPooledBytes);
+    BOOST_CHECK(nPooledBytes >= 8000);
+    BOOST_CHECK(pool.Get(data, 4000));
+    uint64_t nHitsAfter, nMissesAfter, nPooledBytesAfter;
+    CNetBufferPool::GetStats(nHitsAfter, nMissesAfter, nPooledBytesAfter);
+    BOOST_CHECK_EQUAL(nHitsAfter, nHits + 1);
+    BOOST_CHECK_EQUAL(nMissesAfter, nMisses);
+    BOOST_CHECK_EQUAL(nPooledBytesAfter, nPooledBytes - 4000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
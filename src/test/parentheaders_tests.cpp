@@ -0,0 +1,125 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "parentheaders.h"
+#include "pow.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "test/test_bitcoin.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+struct ParentHeadersSetup : public TestingSetup {
+    ParentHeadersSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+BOOST_FIXTURE_TEST_SUITE(parentheaders_tests, ParentHeadersSetup)
+
+/** The genesis block of the parent regtest chain */
+static CBlockHeader ParentGenesisHeader()
+{
+    CBlockHeader header;
+    header.nVersion = 1;
+    header.hashMerkleRoot = uint256S("4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b");
+    header.nTime = 1296688602;
+    header.bitcoinproof = CBitcoinProof(0x207fffff, 2);
+    return header;
+}
+
+static CBlockHeader MineParentHeader(const uint256& hashPrev, uint32_t nTime)
+{
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = hashPrev;
+    header.nTime = nTime;
+    header.bitcoinproof = CBitcoinProof(0x207fffff, 0);
+    while (!CheckBitcoinProof(header))
+        header.bitcoinproof.solution++;
+    return header;
+}
+
+static std::vector<CBlockHeader> MineParentHeaders(const uint256& hashPrev, size_t nCount, uint32_t nTime)
+{
+    std::vector<CBlockHeader> vHeaders;
+    for (size_t i = 0; i < nCount; i++)
+        vHeaders.push_back(MineParentHeader(i == 0 ? hashPrev : vHeaders.back().GetHash(), nTime + i));
+    return vHeaders;
+}
+
+BOOST_AUTO_TEST_CASE(parentheaders_connect)
+{
+    const uint256 genesishash = Params().ParentGenesisBlockHash();
+    const CBlockHeader genesis = ParentGenesisHeader();
+    BOOST_CHECK(genesis.GetHash() == genesishash);
+    const boost::filesystem::path path = GetDataDir() / "parentheaders.dat";
+    std::string strError;
+
+    std::vector<CBlockHeader> vChain(1, genesis);
+    std::vector<CBlockHeader> vBlocks = MineParentHeaders(genesishash, 5, 1296688700);
+    vChain.insert(vChain.end(), vBlocks.begin(), vBlocks.end());
+
+    {
+        CParentHeaderStore store;
+        BOOST_CHECK(store.Open(path, genesishash));
+        BOOST_CHECK_EQUAL(store.Height(), -1);
+
+        // The chain must start at the genesis block.
+        BOOST_CHECK(!store.Connect(0, vBlocks, strError));
+        BOOST_CHECK(store.Connect(0, vChain, strError));
+        BOOST_CHECK_EQUAL(store.Height(), 5);
+        BOOST_CHECK_EQUAL(store.GetDepth(genesishash), 6);
+        BOOST_CHECK_EQUAL(store.GetDepth(vChain[5].GetHash()), 1);
+        BOOST_CHECK_EQUAL(store.GetDepth(uint256S("01")), -1);
+        BOOST_CHECK(store.GetHash(2) == vChain[2].GetHash());
+        BOOST_CHECK(store.GetHash(6).IsNull());
+
+        // Headers that leave a gap, do not link up or lack their proof of
+        // work change nothing.
+        BOOST_CHECK(!store.Connect(7, MineParentHeaders(vChain[5].GetHash(), 1, 1296688800), strError));
+        BOOST_CHECK(!store.Connect(6, MineParentHeaders(vChain[4].GetHash(), 1, 1296688800), strError));
+        CBlockHeader weak = MineParentHeader(vChain[5].GetHash(), 1296688800);
+        weak.bitcoinproof.challenge = 0x1d00ffff;
+        BOOST_CHECK(!store.Connect(6, std::vector<CBlockHeader>(1, weak), strError));
+        BOOST_CHECK_EQUAL(store.Height(), 5);
+
+        // A reorg replaces everything above the fork.
+        std::vector<CBlockHeader> vFork = MineParentHeaders(vChain[2].GetHash(), 2, 1296688900);
+        BOOST_CHECK(store.Connect(3, vFork, strError));
+        BOOST_CHECK_EQUAL(store.Height(), 4);
+        BOOST_CHECK_EQUAL(store.GetDepth(vChain[5].GetHash()), -1);
+        BOOST_CHECK_EQUAL(store.GetDepth(vChain[3].GetHash()), -1);
+        BOOST_CHECK_EQUAL(store.GetDepth(vFork[0].GetHash()), 2);
+        BOOST_CHECK_EQUAL(store.GetDepth(genesishash), 5);
+        vChain.resize(3);
+        vChain.insert(vChain.end(), vFork.begin(), vFork.end());
+    }
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), 5 * PARENT_HEADER_SIZE);
+
+    // A torn write at the end is dropped on reopening.
+    FILE* file = fopen(path.string().c_str(), "ab");
+    BOOST_CHECK(file);
+    const std::vector<unsigned char> vTorn(PARENT_HEADER_SIZE / 2, 0xab);
+    fwrite(&vTorn[0], 1, vTorn.size(), file);
+    fclose(file);
+
+    CParentHeaderStore store;
+    BOOST_CHECK(store.Open(path, genesishash));
+    BOOST_CHECK_EQUAL(store.Height(), 4);
+    for (int i = 0; i <= 4; i++) {
+        BOOST_CHECK(store.GetHash(i) == vChain[i].GetHash());
+        BOOST_CHECK_EQUAL(store.GetDepth(vChain[i].GetHash()), 5 - i);
+    }
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), 5 * PARENT_HEADER_SIZE);
+
+    // Extending the reopened store appends to the file.
+    BOOST_CHECK(store.Connect(5, MineParentHeaders(vChain[4].GetHash(), 3, 1296689000), strError));
+    BOOST_CHECK_EQUAL(store.Height(), 7);
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), 8 * PARENT_HEADER_SIZE);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
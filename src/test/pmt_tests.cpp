@@ -45,30 +45,38 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
         for (unsigned int j=0; j<nTx; j++) {
             CMutableTransaction tx;
             tx.nLockTime = j; // actual transaction data doesn't matter; just make the nLockTime's unique
-            block.vtx.push_back(CTransaction(tx));
+            block.vtx.push_back(MakeTransactionRef(std::move(tx)));
         }
 
         // calculate actual merkle root and height
         uint256 merkleRoot1 = BlockMerkleRoot(block);
         std::vector<uint256> vTxid(nTx, uint256());
         for (unsigned int j=0; j<nTx; j++)
-            vTxid[j] = block.vtx[j].GetHash();
+            vTxid[j] = block.vtx[j]->GetHash();
         int nHeight = 1, nTx_ = nTx;
         while (nTx_ > 1) {
             nTx_ = (nTx_+1)/2;
             nHeight++;
         }
 
+        // the complete tree, for cutting the same partial trees out of
+        CMerkleTreeLevels tree(vTxid);
+        BOOST_CHECK(tree.GetHash(tree.GetHeight(), 0) == merkleRoot1);
+        BOOST_CHECK_EQUAL(tree.GetHeight(), nHeight - 1);
+
         // check with random subsets with inclusion chances 1, 1/2, 1/4, ..., 1/128
         for (int att = 1; att < 15; att++) {
             // build random subset of txid's
             std::vector<bool> vMatch(nTx, false);
             std::vector<uint256> vMatchTxid1;
+            std::vector<unsigned int> vMatchPos;
             for (unsigned int j=0; j<nTx; j++) {
                 bool fInclude = (insecure_rand() & ((1 << (att/2)) - 1)) == 0;
                 vMatch[j] = fInclude;
-                if (fInclude)
+                if (fInclude) {
                     vMatchTxid1.push_back(vTxid[j]);
+                    vMatchPos.push_back(j);
+                }
             }
 
             // build the partial merkle tree
@@ -78,6 +86,11 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
             CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
             ss << pmt1;
 
+            // cutting it out of the complete tree gives the same tree
+            CDataStream ssLevels(SER_NETWORK, PROTOCOL_VERSION);
+            ssLevels << CPartialMerkleTree(tree, vMatchPos);
+            BOOST_CHECK(ss.str() == ssLevels.str());
+
             // verify CPartialMerkleTree's size guarantees
             unsigned int n = std::min<unsigned int>(nTx, 1 + vMatchTxid1.size()*nHeight);
             BOOST_CHECK(ss.size() <= 10 + (258*n+7)/8);
@@ -0,0 +1,76 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "memusage.h"
+#include "random.h"
+#include "support/allocators/pool.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pool_resource_reuse)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0);
+
+    void* a = resource.Allocate(16, 8);
+    void* b = resource.Allocate(16, 8);
+    BOOST_CHECK(a != b);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+
+    // Freed blocks are handed out again for the same size only.
+    resource.Deallocate(a, 16, 8);
+    void* c = resource.Allocate(24, 8);
+    BOOST_CHECK(c != a);
+    BOOST_CHECK(resource.Allocate(13, 8) == a);
+
+    // Oversized and overaligned blocks bypass the pool.
+    void* big = resource.Allocate(1000, 8);
+    void* aligned = resource.Allocate(8, 32);
+    resource.Deallocate(big, 1000, 8);
+    resource.Deallocate(aligned, 8, 32);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+
+    // Filling the chunk allocates another; the rest of the old one is kept.
+    for (int i = 0; i < 1024 / 64; i++)
+        resource.Allocate(64, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2);
+    resource.Deallocate(b, 16, 8);
+    resource.Deallocate(c, 24, 8);
+}
+
+BOOST_AUTO_TEST_CASE(pool_coins_map)
+{
+    CCoinsMapMemoryResource resource;
+    {
+        CCoinsMap map(0, SaltedTxidHasher(), CCoinsMap::key_equal(), &resource);
+        const size_t nEmptyUsage = memusage::DynamicUsage(map);
+        for (int i = 0; i < 10000; i++) {
+            CCoinsCacheEntry& entry = map[std::make_pair(GetRandHash(), COutPoint())];
+            entry.flags = CCoinsCacheEntry::DIRTY;
+        }
+        BOOST_CHECK_EQUAL(map.size(), 10000);
+        const size_t nUsage = memusage::DynamicUsage(map);
+        BOOST_CHECK(nUsage > nEmptyUsage);
+        BOOST_CHECK(nUsage >= resource.NumAllocatedChunks() * resource.ChunkSizeBytes());
+
+        // Erased nodes are recycled rather than growing the pool.
+        const size_t nChunks = resource.NumAllocatedChunks();
+        for (int i = 0; i < 10; i++) {
+            for (int j = 0; j < 1000; j++)
+                map.erase(map.begin());
+            for (int j = 0; j < 1000; j++)
+                map[std::make_pair(GetRandHash(), COutPoint())];
+        }
+        BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), nChunks);
+    }
+    // The pool keeps its memory after the map is gone.
+    BOOST_CHECK(resource.NumAllocatedChunks() > 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
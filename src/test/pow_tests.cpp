@@ -4,7 +4,10 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "hash.h"
+#include "key.h"
 #include "pow.h"
+#include "primitives/block.h"
 #include "random.h"
 #include "util.h"
 #include "test/test_bitcoin.h"
@@ -19,6 +22,119 @@ BOOST_AUTO_TEST_CASE(dummy_case)
 {
 
 }
+
+/* A solution for a Schnorr challenge of up to 8 keys, signed by key i only. */
+static CScript SignSchnorrChallenge(const CBlockHeader& header, const CKey& key, int i)
+{
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.SignSchnorr(SerializeHash(header), vchSig));
+    return CScript() << std::vector<unsigned char>(1, 1 << i) << vchSig;
+}
+
+BOOST_AUTO_TEST_CASE(schnorr_challenge)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    std::vector<CKey> keys(3);
+    CScript multisig;
+    multisig << OP_2;
+    for (int i = 0; i < 3; i++) {
+        keys[i].MakeNewKey(true);
+        multisig << ToByteVector(keys[i].GetPubKey());
+    }
+    multisig << OP_3 << OP_CHECKMULTISIG;
+    CScript challenge = CScript() << OP_RETURN;
+    challenge += multisig;
+    BOOST_CHECK(IsSchnorrChallenge(challenge));
+    BOOST_CHECK(!IsSchnorrChallenge(multisig));
+    BOOST_CHECK(!IsSchnorrChallenge(CScript() << OP_TRUE));
+
+    std::vector<CBlockHeader> headers(3);
+    std::vector<const CBlockHeader*> vpheaders;
+    for (int n = 0; n < 3; n++) {
+        CBlockHeader& header = headers[n];
+        header.nTime = 1000 + n;
+        header.proof.challenge = challenge;
+        CScript solution0 = SignSchnorrChallenge(header, keys[0], 0);
+        CScript solution2 = SignSchnorrChallenge(header, keys[2], 2);
+
+        // One signature out of the two required is not enough.
+        header.proof.solution = solution0;
+        BOOST_CHECK(!CheckProof(header, params));
+        header.proof.solution = CombineBlockSignatures(header, solution0, solution2);
+        BOOST_CHECK(CheckProof(header, params));
+        BOOST_CHECK(header.proof.solution == CombineBlockSignatures(header, solution2, solution0));
+        vpheaders.push_back(&header);
+    }
+    BOOST_CHECK(CheckProofs(vpheaders, params));
+
+    // The signatures commit to the header, and must sit at their key's bit.
+    headers[1].nTime++;
+    BOOST_CHECK(!CheckProof(headers[1], params));
+    BOOST_CHECK(!CheckProofs(vpheaders, params));
+    headers[1].nTime--;
+    BOOST_CHECK(CheckProofs(vpheaders, params));
+    CScript solution = headers[1].proof.solution;
+    headers[1].proof.solution[1] = 0x03;
+    BOOST_CHECK(!CheckProof(headers[1], params));
+    BOOST_CHECK(!CheckProofs(vpheaders, params));
+    headers[1].proof.solution = solution;
+    BOOST_CHECK(CheckProofs(vpheaders, params));
+}
+BOOST_AUTO_TEST_CASE(combine_block_signatures)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    std::vector<CKey> keys(3);
+    CScript multisig;
+    multisig << OP_2;
+    for (int i = 0; i < 3; i++) {
+        keys[i].MakeNewKey(true);
+        multisig << ToByteVector(keys[i].GetPubKey());
+    }
+    multisig << OP_3 << OP_CHECKMULTISIG;
+    CScript schnorr = CScript() << OP_RETURN;
+    schnorr += multisig;
+
+    CBlockHeader header;
+    header.nTime = 1000;
+    header.proof.challenge = multisig;
+    std::vector<CScript> vSolutions;
+    for (int i = 2; i >= 0; i--) {
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(keys[i].Sign(SerializeHash(header), vchSig));
+        vSolutions.push_back(CScript() << OP_0 << vchSig);
+    }
+    // A signature by the wrong key, or on another header, is dropped.
+    CBlockHeader other = header;
+    other.nTime++;
+    std::vector<unsigned char> vchOther;
+    BOOST_CHECK(keys[1].Sign(SerializeHash(other), vchOther));
+    vSolutions.insert(vSolutions.begin(), CScript() << OP_0 << vchOther);
+
+    // One pass over all of them gives what merging them pairwise does.
+    header.proof.solution = CombineBlockSignatures(header, std::vector<CScript>(vSolutions.begin(), vSolutions.begin() + 2));
+    BOOST_CHECK(!CheckProof(header, params));
+    header.proof.solution = CombineBlockSignatures(header, vSolutions);
+    BOOST_CHECK(CheckProof(header, params));
+    CScript solution;
+    for (size_t i = 0; i < vSolutions.size(); i++)
+        solution = CombineBlockSignatures(header, solution, vSolutions[i]);
+    BOOST_CHECK(header.proof.solution == solution);
+
+    // The same goes for a Schnorr challenge, whose keys replace the cached ones.
+    header.proof.challenge = schnorr;
+    vSolutions.clear();
+    for (int i = 2; i >= 0; i--)
+        vSolutions.push_back(SignSchnorrChallenge(header, keys[i], i));
+    header.proof.solution = CombineBlockSignatures(header, vSolutions);
+    BOOST_CHECK(CheckProof(header, params));
+    BOOST_CHECK(header.proof.solution == CombineBlockSignatures(header, vSolutions[2], vSolutions[1]));
+
+    // Challenges of other forms are merged pairwise.
+    header.proof.challenge = CScript() << OP_TRUE;
+    header.proof.solution = CombineBlockSignatures(header, std::vector<CScript>(1, CScript()));
+    BOOST_CHECK(CheckProof(header, params));
+}
+
 #if 0
 // TODO: Re-enable when we re-add bitcoin stuff
 
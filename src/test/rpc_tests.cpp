@@ -333,4 +333,27 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 */
+BOOST_AUTO_TEST_CASE(rpc_jobs)
+{
+    BOOST_CHECK(StartRPC());
+
+    // Still in warmup, so the call fails, but on a job thread.
+    int64_t nId = CallRPC("submitjob getblockcount").get_int64();
+    UniValue result = CallRPC(strprintf("getjobresult %d 60", nId));
+    BOOST_CHECK_EQUAL(find_value(result, "id").get_int64(), nId);
+    BOOST_CHECK_EQUAL(find_value(result, "method").get_str(), "getblockcount");
+    BOOST_CHECK_EQUAL(find_value(result, "status").get_str(), "failed");
+    BOOST_CHECK_EQUAL(find_value(find_value(result, "error"), "code").get_int(), RPC_IN_WARMUP);
+    BOOST_CHECK_EQUAL(CallRPC(strprintf("canceljob %d", nId)).get_bool(), false);
+
+    BOOST_CHECK_THROW(CallRPC("submitjob nosuchmethod"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("submitjob getjobresult"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC(strprintf("getjobresult %d", nId + 1)), runtime_error);
+    BOOST_CHECK_THROW(CallRPC(strprintf("getjobresult %d -1", nId)), runtime_error);
+
+    InterruptRPC();
+    StopRPC();
+    BOOST_CHECK_THROW(CallRPC("submitjob getblockcount"), runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
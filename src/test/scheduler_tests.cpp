@@ -116,4 +116,65 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+static void blockingTask(boost::mutex& mutex, boost::condition_variable& cond, int& nRunning, int& nMaxRunning, bool& fRelease)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nMaxRunning = std::max(nMaxRunning, ++nRunning);
+    cond.notify_all();
+    while (!fRelease)
+        cond.wait(lock);
+    --nRunning;
+}
+
+static void flagTask(boost::mutex& mutex, boost::condition_variable& cond, bool& fRan)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fRan = true;
+    cond.notify_all();
+}
+
+BOOST_AUTO_TEST_CASE(priorities)
+{
+    CScheduler scheduler;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    int nRunning = 0, nMaxRunning = 0;
+    bool fRelease = false, fRan = false;
+
+    // Three low priority tasks that block until released leave one of the
+    // three threads free for the others.
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    for (int i = 0; i < 3; i++)
+        scheduler.schedule(boost::bind(&blockingTask, boost::ref(mutex), boost::ref(cond), boost::ref(nRunning), boost::ref(nMaxRunning), boost::ref(fRelease)),
+                           now, CScheduler::PRIORITY_LOW, "blocking");
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (nRunning < 2)
+            cond.wait(lock);
+    }
+    scheduler.schedule(boost::bind(&flagTask, boost::ref(mutex), boost::ref(cond), boost::ref(fRan)),
+                       boost::chrono::system_clock::now(), CScheduler::PRIORITY_HIGH, "flag");
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fRan)
+            cond.wait(lock);
+        BOOST_CHECK_EQUAL(nRunning, 2);
+        fRelease = true;
+        cond.notify_all();
+    }
+
+    scheduler.stop(true);
+    threads.join_all();
+    BOOST_CHECK_EQUAL(nMaxRunning, 2);
+
+    std::map<std::string, CScheduler::TaskStats> mapStats = scheduler.getTaskStats();
+    BOOST_CHECK_EQUAL(mapStats.size(), 2U);
+    BOOST_CHECK_EQUAL(mapStats["blocking"].nRuns, 3U);
+    BOOST_CHECK_EQUAL(mapStats["flag"].nRuns, 1U);
+    BOOST_CHECK(mapStats["blocking"].nMaxMicros <= mapStats["blocking"].nTotalMicros);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
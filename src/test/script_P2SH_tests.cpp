@@ -365,6 +365,17 @@ BOOST_AUTO_TEST_CASE(AreInputsStandard)
 
     BOOST_CHECK(!::AreInputsStandard(txToNonStd2, coins));
     BOOST_CHECK_EQUAL(GetP2SHSigOpCount(txToNonStd2, coins), 20U);
+
+    // The single pass agrees with the separate checks and sigop count
+    int64_t nSigOpCost;
+    std::string reason;
+    BOOST_CHECK(CheckInputsStandard(txTo, coins, true, STANDARD_SCRIPT_VERIFY_FLAGS, nSigOpCost, reason));
+    BOOST_CHECK_EQUAL(nSigOpCost, GetTransactionSigOpCost(txTo, coins, STANDARD_SCRIPT_VERIFY_FLAGS));
+    BOOST_CHECK(!CheckInputsStandard(txToNonStd1, coins, true, STANDARD_SCRIPT_VERIFY_FLAGS, nSigOpCost, reason));
+    BOOST_CHECK_EQUAL(reason, "bad-txns-nonstandard-inputs");
+    BOOST_CHECK(CheckInputsStandard(txToNonStd2, coins, false, STANDARD_SCRIPT_VERIFY_FLAGS, nSigOpCost, reason));
+    BOOST_CHECK_EQUAL(nSigOpCost, GetTransactionSigOpCost(txToNonStd2, coins, STANDARD_SCRIPT_VERIFY_FLAGS));
+    BOOST_CHECK_EQUAL(nSigOpCost, 20 * WITNESS_SCALE_FACTOR);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,89 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "script/script.h"
+#include "script/standard.h"
+#include "uint256.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+typedef std::vector<unsigned char> valtype;
+
+BOOST_FIXTURE_TEST_SUITE(script_standard_tests, BasicTestingSetup)
+
+/** Solve s both ways, check that they agree and return the solutions */
+static std::vector<valtype> CheckSolve(const CScript& s, bool fExpected, txnouttype typeExpected)
+{
+    txnouttype type, typeOnly;
+    std::vector<valtype> vSolutions(1, valtype(1, 0xff));
+    BOOST_CHECK_EQUAL(Solver(s, type, vSolutions), fExpected);
+    BOOST_CHECK_EQUAL(Solver(s, typeOnly), fExpected);
+    BOOST_CHECK_EQUAL(type, typeExpected);
+    BOOST_CHECK_EQUAL(typeOnly, typeExpected);
+    if (!fExpected)
+        BOOST_CHECK(vSolutions.empty());
+    return vSolutions;
+}
+
+BOOST_AUTO_TEST_CASE(script_standard_Solver)
+{
+    const valtype vchPubKey(33, 0x02), vchUncompressed(65, 0x04), vchOddKey(40, 0x03);
+    const valtype vchHash160(20, 0xab), vchHash256(32, 0xcd);
+    std::vector<valtype> vSolutions;
+
+    vSolutions = CheckSolve(CScript() << vchPubKey << OP_CHECKSIG, true, TX_PUBKEY);
+    BOOST_CHECK(vSolutions.size() == 1 && vSolutions[0] == vchPubKey);
+    vSolutions = CheckSolve(CScript() << vchUncompressed << OP_CHECKSIG, true, TX_PUBKEY);
+    BOOST_CHECK(vSolutions.size() == 1 && vSolutions[0] == vchUncompressed);
+    vSolutions = CheckSolve(CScript() << vchOddKey << OP_CHECKSIG, true, TX_PUBKEY);
+    BOOST_CHECK(vSolutions.size() == 1 && vSolutions[0] == vchOddKey);
+
+    vSolutions = CheckSolve(CScript() << OP_DUP << OP_HASH160 << vchHash160 << OP_EQUALVERIFY << OP_CHECKSIG, true, TX_PUBKEYHASH);
+    BOOST_CHECK(vSolutions.size() == 1 && vSolutions[0] == vchHash160);
+    // A key hash pushed with OP_PUSHDATA1 is still one
+    CScript s;
+    s << OP_DUP << OP_HASH160 << OP_PUSHDATA1;
+    s.push_back(20);
+    s.insert(s.end(), vchHash160.begin(), vchHash160.end());
+    s << OP_EQUALVERIFY << OP_CHECKSIG;
+    vSolutions = CheckSolve(s, true, TX_PUBKEYHASH);
+    BOOST_CHECK(vSolutions.size() == 1 && vSolutions[0] == vchHash160);
+
+    vSolutions = CheckSolve(CScript() << OP_HASH160 << vchHash160 << OP_EQUAL, true, TX_SCRIPTHASH);
+    BOOST_CHECK(vSolutions.size() == 1 && vSolutions[0] == vchHash160);
+    vSolutions = CheckSolve(CScript() << OP_0 << vchHash160, true, TX_WITNESS_V0_KEYHASH);
+    BOOST_CHECK(vSolutions.size() == 1 && vSolutions[0] == vchHash160);
+    vSolutions = CheckSolve(CScript() << OP_0 << vchHash256, true, TX_WITNESS_V0_SCRIPTHASH);
+    BOOST_CHECK(vSolutions.size() == 1 && vSolutions[0] == vchHash256);
+    CheckSolve(CScript() << OP_0 << valtype(24, 0xab), false, TX_NONSTANDARD);
+    CheckSolve(CScript() << OP_1 << vchHash256, false, TX_NONSTANDARD);
+
+    vSolutions = CheckSolve(CScript() << OP_1 << vchPubKey << vchUncompressed << OP_2 << OP_CHECKMULTISIG, true, TX_MULTISIG);
+    BOOST_CHECK_EQUAL(vSolutions.size(), 4U);
+    BOOST_CHECK(vSolutions[0] == valtype(1, 1) && vSolutions[1] == vchPubKey && vSolutions[2] == vchUncompressed && vSolutions[3] == valtype(1, 2));
+    CheckSolve(CScript() << OP_3 << vchPubKey << vchPubKey << OP_2 << OP_CHECKMULTISIG, false, TX_NONSTANDARD);
+    CheckSolve(CScript() << OP_1 << vchPubKey << vchPubKey << OP_3 << OP_CHECKMULTISIG, false, TX_NONSTANDARD);
+    CheckSolve(CScript() << OP_0 << vchPubKey << OP_1 << OP_CHECKMULTISIG, false, TX_NONSTANDARD);
+    CheckSolve(CScript() << OP_1 << vchPubKey << OP_1 << OP_CHECKMULTISIG << OP_NOP, false, TX_NONSTANDARD);
+
+    CheckSolve(CScript() << OP_RETURN, true, TX_NULL_DATA);
+    CheckSolve(CScript() << OP_RETURN << vchHash256 << OP_1, true, TX_NULL_DATA);
+    CheckSolve(CScript() << OP_RETURN << OP_DUP, false, TX_NONSTANDARD);
+    CheckSolve(CScript() << OP_TRUE, true, TX_TRUE);
+
+    const valtype vchDest(24, 0x11);
+    CheckSolve(CScript() << vchHash256 << OP_WITHDRAWPROOFVERIFY, true, TX_WITHDRAW_LOCK);
+    CheckSolve(CScript() << vchDest << OP_DROP << vchHash256 << OP_WITHDRAWPROOFVERIFY, true, TX_WITHDRAW_LOCK);
+    CheckSolve(CScript() << vchDest << OP_DROP << vchHash160 << OP_WITHDRAWPROOFVERIFY, false, TX_NONSTANDARD);
+
+    CheckSolve(CScript(), false, TX_NONSTANDARD);
+    CheckSolve(CScript() << vchPubKey << OP_CHECKSIG << OP_NOP, false, TX_NONSTANDARD);
+    CheckSolve(CScript() << OP_DUP << OP_HASH160 << vchHash256 << OP_EQUALVERIFY << OP_CHECKSIG, false, TX_NONSTANDARD);
+    // A truncated push
+    const valtype vchTruncated(10, 33);
+    CheckSolve(CScript(vchTruncated.begin(), vchTruncated.end()), false, TX_NONSTANDARD);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
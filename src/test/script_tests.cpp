@@ -7,6 +7,7 @@
 #include "core_io.h"
 #include "key.h"
 #include "keystore.h"
+#include "random.h"
 #include "script/script.h"
 #include "script/script_error.h"
 #include "script/sign.h"
@@ -1450,4 +1451,145 @@ BOOST_AUTO_TEST_CASE(script_FindAndDelete)
     BOOST_CHECK(s == expect);
 }
 
+
+/** Signature checker whose verdict is a fixed function of everything CheckSig is given. */
+class TemplateTestSignatureChecker : public BaseSignatureChecker
+{
+public:
+    bool CheckSig(const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << vchSig << vchPubKey << static_cast<const CScriptBase&>(scriptCode) << (int)sigversion;
+        return ss.GetHash().GetCheapHash() & 1;
+    }
+
+    CTxOutValue GetValueIn() const
+    {
+        return CTxOutValue(CAmount(100));
+    }
+};
+
+BOOST_AUTO_TEST_CASE(script_template_fastpath)
+{
+    // EvalScript evaluates some standard scripts without the opcode loop.
+    // Run random stacks through both and check they agree.
+    CKey key;
+    key.MakeNewKey(true);
+    CKey keyUncompressed;
+    keyUncompressed.MakeNewKey(false);
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(GetRandHash(), vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    const uint256 genesis = GetRandHash();
+    CKeyID randomID;
+    GetRandBytes(randomID.begin(), randomID.size());
+
+    std::vector<CScript> scripts;
+    scripts.push_back(GetScriptForDestination(key.GetPubKey().GetID()));
+    scripts.push_back(GetScriptForDestination(keyUncompressed.GetPubKey().GetID()));
+    scripts.push_back(GetScriptForDestination(randomID));
+    scripts.push_back(GetScriptForDestination(CKeyID(Hash160(vchSig.begin(), vchSig.end()))));
+    scripts.push_back(CScript() << std::vector<unsigned char>(genesis.begin(), genesis.end()) << OP_WITHDRAWPROOFVERIFY);
+    scripts.push_back(CScript() << std::vector<unsigned char>(24, 0x50) << OP_DROP << std::vector<unsigned char>(genesis.begin(), genesis.end()) << OP_WITHDRAWPROOFVERIFY);
+
+    std::vector<std::vector<unsigned char> > items;
+    items.push_back(ToByteVector(key.GetPubKey()));
+    items.push_back(ToByteVector(keyUncompressed.GetPubKey()));
+    items.push_back(vchSig);
+    items.push_back(std::vector<unsigned char>());
+    items.push_back(std::vector<unsigned char>(randomID.begin(), randomID.end()));
+    items.push_back(std::vector<unsigned char>(genesis.begin(), genesis.end()));
+    items.push_back(CScriptNum(1).getvch());
+    items.push_back(CScriptNum(7).getvch());
+
+    const TemplateTestSignatureChecker checker;
+    for (int i = 0; i < 20000; i++) {
+        const CScript& script = scripts[insecure_rand() % scripts.size()];
+        const unsigned int nFlags = insecure_rand() & ((1U << 18) - 1);
+        const SigVersion sigversion = insecure_rand() & 1 ? SIGVERSION_WITNESS_V0 : SIGVERSION_BASE;
+
+        std::vector<std::vector<unsigned char> > stack;
+        if (insecure_rand() % 16 == 0) {
+            stack.resize(997 + insecure_rand() % 4);
+        }
+        for (int n = insecure_rand() % 9; n > 0; n--) {
+            if (insecure_rand() % 4 == 0) {
+                std::vector<unsigned char> vch(insecure_rand() % 80);
+                for (size_t j = 0; j < vch.size(); j++)
+                    vch[j] = insecure_rand();
+                stack.push_back(vch);
+            } else {
+                stack.push_back(items[insecure_rand() % items.size()]);
+            }
+        }
+
+        std::vector<std::vector<unsigned char> > stackFast(stack), stackGeneric(stack);
+        ScriptError errFast, errGeneric;
+        bool fFast = EvalScript(stackFast, script, nFlags, checker, sigversion, &errFast);
+        bool fGeneric = EvalScriptGeneric(stackGeneric, script, nFlags, checker, sigversion, &errGeneric);
+        BOOST_CHECK_EQUAL(fFast, fGeneric);
+        BOOST_CHECK_EQUAL(errFast, errGeneric);
+        if (fFast && fGeneric) {
+            BOOST_CHECK(stackFast == stackGeneric);
+        }
+    }
+}
+
+#if defined(HAVE_CONSENSUS_LIB)
+BOOST_AUTO_TEST_CASE(bitcoinconsensus_verify_transaction_batch)
+{
+    std::vector<CKey> keys(3);
+    std::vector<CTxOut> vSpent;
+    CMutableTransaction tx;
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i].MakeNewKey(true);
+        vSpent.push_back(CTxOut(CTxOutValue(1000 * (i + 1)), CScript() << ToByteVector(keys[i].GetPubKey()) << OP_CHECKSIG));
+        tx.vin.push_back(CTxIn(COutPoint(GetRandHash(), i)));
+    }
+    tx.vout.push_back(CTxOut(CTxOutValue(5900), CScript() << OP_TRUE));
+    tx.nTxFee = 100;
+    for (size_t i = 0; i < keys.size(); i++) {
+        uint256 hash = SignatureHash(vSpent[i].scriptPubKey, tx, i, SIGHASH_ALL, vSpent[i].nValue, SIGVERSION_BASE);
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(keys[i].Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[i].scriptSig = CScript() << vchSig;
+    }
+
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+    CDataStream ssSpent(SER_NETWORK, PROTOCOL_VERSION);
+    ssSpent << vSpent;
+    const unsigned int flags = bitcoinconsensus_SCRIPT_FLAGS_VERIFY_P2SH | bitcoinconsensus_VERIFY_AMOUNTS;
+    bitcoinconsensus_error err;
+    for (unsigned int nThreads = 0; nThreads <= 4; nThreads++) {
+        BOOST_CHECK_EQUAL(bitcoinconsensus_verify_transaction((const unsigned char*)&ssSpent[0], ssSpent.size(), (const unsigned char*)&ssTx[0], ssTx.size(), flags, nThreads, &err), 1);
+        BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_OK);
+    }
+
+    // Every input is verified against the output it spends.
+    std::vector<CTxOut> vSwapped(vSpent);
+    std::swap(vSwapped[1], vSwapped[2]);
+    CDataStream ssSwapped(SER_NETWORK, PROTOCOL_VERSION);
+    ssSwapped << vSwapped;
+    BOOST_CHECK_EQUAL(bitcoinconsensus_verify_transaction((const unsigned char*)&ssSwapped[0], ssSwapped.size(), (const unsigned char*)&ssTx[0], ssTx.size(), flags & ~bitcoinconsensus_VERIFY_AMOUNTS, 2, &err), 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_OK);
+
+    // Amounts are only checked when asked to.
+    vSpent[0].nValue = CTxOutValue(999);
+    CDataStream ssShort(SER_NETWORK, PROTOCOL_VERSION);
+    ssShort << vSpent;
+    BOOST_CHECK_EQUAL(bitcoinconsensus_verify_transaction((const unsigned char*)&ssShort[0], ssShort.size(), (const unsigned char*)&ssTx[0], ssTx.size(), flags, 2, &err), 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_OK);
+    BOOST_CHECK_EQUAL(bitcoinconsensus_verify_transaction((const unsigned char*)&ssShort[0], ssShort.size(), (const unsigned char*)&ssTx[0], ssTx.size(), flags & ~bitcoinconsensus_VERIFY_AMOUNTS, 2, &err), 1);
+
+    // One spent output per input.
+    vSpent.pop_back();
+    CDataStream ssMissing(SER_NETWORK, PROTOCOL_VERSION);
+    ssMissing << vSpent;
+    BOOST_CHECK_EQUAL(bitcoinconsensus_verify_transaction((const unsigned char*)&ssMissing[0], ssMissing.size(), (const unsigned char*)&ssTx[0], ssTx.size(), flags, 2, &err), 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_SPENT_OUTPUTS_MISMATCH);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
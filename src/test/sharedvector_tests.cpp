@@ -0,0 +1,137 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "memusage.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "sharedvector.h"
+#include "streams.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sharedvector_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(sharedvector_copy_on_write)
+{
+    shared_vector<unsigned char> a;
+    BOOST_CHECK(a.empty() && !a.is_allocated());
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(a), 0);
+
+    a = std::vector<unsigned char>(100, 1);
+    shared_vector<unsigned char> b(a);
+    BOOST_CHECK(a.begin() == b.begin());
+    BOOST_CHECK(a == b);
+
+    // Modifying a copy leaves the others untouched.
+    b.back() = 2;
+    BOOST_CHECK(a.begin() != b.begin());
+    BOOST_CHECK(a != b);
+    BOOST_CHECK_EQUAL(a.back(), 1);
+    BOOST_CHECK_EQUAL(b.back(), 2);
+
+    // Without other copies, modifications happen in place.
+    const unsigned char* p = b.begin();
+    b[0] = 3;
+    BOOST_CHECK(b.begin() == p);
+
+    b.clear();
+    BOOST_CHECK(b.empty() && !b.is_allocated());
+    BOOST_CHECK_EQUAL(a.size(), 100);
+}
+
+BOOST_AUTO_TEST_CASE(sharedvector_serialization)
+{
+    std::vector<unsigned char> v(300, 7);
+    shared_vector<unsigned char> a(v), b, empty;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << a;
+    BOOST_CHECK_EQUAL(ss.size(), ::GetSerializeSize(v, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(ss.size(), ::GetSerializeSize(a, SER_NETWORK, PROTOCOL_VERSION));
+    ss >> b;
+    BOOST_CHECK(a == b);
+
+    // Reading into a copy does not change the elements it shared.
+    shared_vector<unsigned char> c(a);
+    ss << empty;
+    BOOST_CHECK_EQUAL(ss.size(), 1);
+    ss >> c;
+    BOOST_CHECK(c.empty() && !c.is_allocated());
+    BOOST_CHECK_EQUAL(a.size(), 300);
+}
+
+BOOST_AUTO_TEST_CASE(sharedvector_transaction_copies)
+{
+    CMutableTransaction mtx;
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue.vchRangeproof = std::vector<unsigned char>(5000, 1);
+    CTransaction tx(mtx);
+
+    // Copies of a transaction, such as a block's copy of a mempool
+    // transaction, refer to the same rangeproofs.
+    CTransaction txCopy(tx);
+    BOOST_CHECK(txCopy.vout[0].nValue.vchRangeproof.begin() == tx.vout[0].nValue.vchRangeproof.begin());
+    BOOST_CHECK(txCopy.GetWitnessHash() == tx.GetWitnessHash());
+
+    CMutableTransaction mtx2(tx);
+    mtx2.vout[0].nValue.vchRangeproof[0] = 2;
+    BOOST_CHECK_EQUAL(tx.vout[0].nValue.vchRangeproof[0], 1);
+    BOOST_CHECK(CTransaction(mtx2).GetWitnessHash() != tx.GetWitnessHash());
+}
+
+BOOST_AUTO_TEST_CASE(sharedvector_block_arena)
+{
+    CBlock block;
+    block.proof = CProof(CScript() << OP_TRUE, CScript());
+    for (int i = 0; i < 2; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout.n = i;
+        mtx.vout.resize(2);
+        mtx.vout[0].nValue.vchRangeproof = std::vector<unsigned char>(2000, 1 + i);
+        mtx.vout[1].nValue.vchRangeproof = std::vector<unsigned char>(CMonotonicArena::MAX_ALLOCATION + 1, 3);
+        block.vtx.push_back(MakeTransactionRef(std::move(mtx)));
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    CBlock blockRead;
+    ss >> blockRead;
+    BOOST_CHECK(blockRead.GetHash() == block.GetHash());
+    for (int i = 0; i < 2; i++)
+        BOOST_CHECK(blockRead.vtx[i]->GetWitnessHash() == block.vtx[i]->GetWitnessHash());
+
+    // The rangeproofs of the block are next to each other in its arena,
+    // except for those too large for it.
+    const shared_vector<unsigned char>& proof0 = blockRead.vtx[0]->vout[0].nValue.vchRangeproof;
+    const shared_vector<unsigned char>& proof1 = blockRead.vtx[1]->vout[0].nValue.vchRangeproof;
+    BOOST_CHECK(proof0.is_in_arena() && proof1.is_in_arena());
+    BOOST_CHECK(proof1.begin() == proof0.end());
+    BOOST_CHECK(!blockRead.vtx[0]->vout[1].nValue.vchRangeproof.is_in_arena());
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(proof0), 2000);
+
+    // Copies that release the arena, and modified ones, get their own.
+    CTransaction txCopy(*blockRead.vtx[1]);
+    BOOST_CHECK(txCopy.vout[0].nValue.vchRangeproof.begin() == proof1.begin());
+    txCopy.ReleaseArena();
+    BOOST_CHECK(!txCopy.vout[0].nValue.vchRangeproof.is_in_arena());
+    BOOST_CHECK(txCopy.vout[0].nValue.vchRangeproof == proof1);
+    BOOST_CHECK(txCopy.GetWitnessHash() == blockRead.vtx[1]->GetWitnessHash());
+    CMutableTransaction mtx(*blockRead.vtx[0]);
+    mtx.vout[0].nValue.vchRangeproof[0] = 5;
+    BOOST_CHECK(!mtx.vout[0].nValue.vchRangeproof.is_in_arena());
+    BOOST_CHECK_EQUAL(proof0[0], 1);
+
+    // Serializing with the proofs in the arena gives the same bytes.
+    CDataStream ss2(SER_NETWORK, PROTOCOL_VERSION);
+    ss2 << blockRead;
+    CDataStream ss3(SER_NETWORK, PROTOCOL_VERSION);
+    ss3 << block;
+    BOOST_CHECK(ss2.str() == ss3.str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -166,6 +166,28 @@ BOOST_AUTO_TEST_CASE(sighash_test)
     #endif
 }
 
+// Goal: check that the precomputed transaction data does not change any signature hash
+BOOST_AUTO_TEST_CASE(sighash_precomputed)
+{
+    seed_insecure_rand(false);
+
+    for (int i=0; i<2000; i++) {
+        int nHashType = insecure_rand();
+        CMutableTransaction txTo;
+        RandomTransaction(txTo, (nHashType & 0x1f) == SIGHASH_SINGLE);
+        CScript scriptCode;
+        RandomScript(scriptCode);
+        int nIn = insecure_rand() % txTo.vin.size();
+
+        const CTransaction tx(txTo);
+        const PrecomputedTransactionData txdata(tx);
+        BOOST_CHECK(SignatureHash(scriptCode, tx, nIn, nHashType, 0, SIGVERSION_BASE, &txdata) ==
+                    SignatureHash(scriptCode, tx, nIn, nHashType, 0, SIGVERSION_BASE));
+        BOOST_CHECK(SignatureHash(scriptCode, tx, nIn, nHashType, 0, SIGVERSION_WITNESS_V0, &txdata) ==
+                    SignatureHash(scriptCode, tx, nIn, nHashType, 0, SIGVERSION_WITNESS_V0));
+    }
+}
+
 // Goal: check that SignatureHash generates correct hash
 BOOST_AUTO_TEST_CASE(sighash_from_data)
 {
@@ -100,4 +100,51 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(chainsnapshot_test)
+{
+    // A main chain and a branch off it at height 2999, both crossing chunk boundaries.
+    std::vector<CBlockIndex> vBlocksMain(5000);
+    for (unsigned int i = 0; i < vBlocksMain.size(); i++) {
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+    }
+    std::vector<CBlockIndex> vBlocksSide(3000);
+    for (unsigned int i = 0; i < vBlocksSide.size(); i++) {
+        vBlocksSide[i].nHeight = i + 3000;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[2999];
+    }
+
+    CChain chain;
+    CChainSnapshot empty(chain, NULL);
+    BOOST_CHECK_EQUAL(empty.Height(), -1);
+    BOOST_CHECK(empty.Tip() == NULL);
+    BOOST_CHECK(empty.Genesis() == NULL);
+
+    chain.SetTip(&vBlocksMain[4000]);
+    CChainSnapshot snapshot1(chain, &empty);
+    chain.SetTip(&vBlocksMain.back());
+    CChainSnapshot snapshot2(chain, &snapshot1);
+    chain.SetTip(&vBlocksSide.back());
+    CChainSnapshot snapshot3(chain, &snapshot2);
+
+    // Each one matches the chain it was made from, even after the chain moved on.
+    BOOST_CHECK_EQUAL(snapshot1.Height(), 4000);
+    BOOST_CHECK(snapshot1.Tip() == &vBlocksMain[4000]);
+    BOOST_CHECK(snapshot1[4001] == NULL);
+    BOOST_CHECK_EQUAL(snapshot2.Height(), 4999);
+    BOOST_CHECK_EQUAL(snapshot3.Height(), 5999);
+    for (int i = 0; i < 5000; i++) {
+        BOOST_CHECK(snapshot2[i] == &vBlocksMain[i]);
+        BOOST_CHECK_EQUAL(snapshot1.Contains(&vBlocksMain[i]), i <= 4000);
+    }
+    for (int i = 0; i < 6000; i++) {
+        BOOST_CHECK(snapshot3[i] == chain[i]);
+    }
+    BOOST_CHECK(snapshot3.Genesis() == &vBlocksMain[0]);
+    BOOST_CHECK(snapshot3.Next(&vBlocksMain[2998]) == &vBlocksMain[2999]);
+    BOOST_CHECK(snapshot3.Next(&vBlocksMain[2999]) == &vBlocksSide[0]);
+    BOOST_CHECK(snapshot3.Next(&vBlocksMain[3000]) == NULL);
+    BOOST_CHECK(snapshot3.Next(&vBlocksSide.back()) == NULL);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
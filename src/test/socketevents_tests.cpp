@@ -0,0 +1,78 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "socketevents.h"
+#include "utiltime.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(socketevents_tests, BasicTestingSetup)
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(socketevents_readiness)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CSocketEvents events;
+    std::set<int64_t> setRecv, setSend;
+
+    std::vector<CSocketEvents::Interest> vInterest;
+    vInterest.push_back(CSocketEvents::Interest(fds[0], 7, CSocketEvents::RECV));
+    BOOST_CHECK(events.Wait(vInterest, 0, setRecv, setSend));
+    BOOST_CHECK(setRecv.empty() && setSend.empty());
+
+    // Readable once the other end writes, and stays so until read.
+    BOOST_CHECK_EQUAL(write(fds[1], "x", 1), 1);
+    for (int i = 0; i < 2; i++) {
+        BOOST_CHECK(events.Wait(vInterest, 1000, setRecv, setSend));
+        BOOST_CHECK(setRecv.count(7) && setSend.empty());
+    }
+
+    // A socket without events is not watched.
+    vInterest[0].nEvents = 0;
+    BOOST_CHECK(events.Wait(vInterest, 0, setRecv, setSend));
+    BOOST_CHECK(setRecv.empty() && setSend.empty());
+
+    vInterest[0].nEvents = CSocketEvents::SEND;
+    BOOST_CHECK(events.Wait(vInterest, 1000, setRecv, setSend));
+    BOOST_CHECK(setRecv.empty() && setSend.count(7));
+
+    // A new socket reusing the descriptor is reported under its own token.
+    close(fds[0]);
+    close(fds[1]);
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    vInterest[0] = CSocketEvents::Interest(fds[0], 8, CSocketEvents::SEND);
+    BOOST_CHECK(events.Wait(vInterest, 1000, setRecv, setSend));
+    BOOST_CHECK(setRecv.empty() && setSend.count(8) && !setSend.count(7));
+
+    // A closed peer is reported as readable, whatever was asked for.
+    close(fds[1]);
+    BOOST_CHECK(events.Wait(vInterest, 1000, setRecv, setSend));
+    BOOST_CHECK(setRecv.count(8));
+    close(fds[0]);
+}
+
+BOOST_AUTO_TEST_CASE(socketevents_wakeup)
+{
+    CSocketEvents events;
+    std::vector<CSocketEvents::Interest> vInterest;
+    std::set<int64_t> setRecv, setSend;
+
+    events.Wakeup();
+    events.Wakeup();
+    int64_t nStart = GetTimeMillis();
+    BOOST_CHECK(events.Wait(vInterest, 10000, setRecv, setSend));
+    BOOST_CHECK(GetTimeMillis() - nStart < 5000);
+    BOOST_CHECK(setRecv.empty() && setSend.empty());
+
+    // Both wakeups were consumed.
+    nStart = GetTimeMillis();
+    BOOST_CHECK(events.Wait(vInterest, 100, setRecv, setSend));
+    BOOST_CHECK(GetTimeMillis() - nStart >= 90);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,12 +2,14 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "mappedfile.h"
 #include "streams.h"
 #include "support/allocators/zeroafterfree.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/assign/std/vector.hpp> // for 'operator+=()'
 #include <boost/assert.hpp>
+#include <boost/filesystem/operations.hpp>
 #include <boost/test/unit_test.hpp>
                     
 using namespace std;
@@ -64,4 +66,57 @@ BOOST_AUTO_TEST_CASE(streams_serializedata_xor)
             std::string(ds.begin(), ds.end()));  
 }         
 
+BOOST_AUTO_TEST_CASE(streams_memory_reader)
+{
+    CDataStream ds(SER_DISK, 0);
+    std::vector<std::string> in;
+    in += "a", std::string(300, 'b');
+    ds << in << (uint32_t)7;
+
+    CMemoryReader reader(&ds[0], &ds[0] + ds.size(), SER_DISK, 0);
+    std::vector<std::string> out;
+    uint32_t n;
+    reader >> out >> n;
+    BOOST_CHECK(out == in);
+    BOOST_CHECK_EQUAL(n, 7);
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK_THROW(reader >> n, std::ios_base::failure);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(streams_mapped_file)
+{
+    boost::filesystem::path path = GetDataDir() / "mapped.dat";
+    CMappedFileCache cache(1);
+    BOOST_CHECK(!cache.Get(0, path, 0));
+
+    {
+        CAutoFile file(fopen(path.string().c_str(), "wb"), SER_DISK, 0);
+        file << (uint32_t)1;
+    }
+    boost::shared_ptr<CMappedFile> pfile = cache.Get(0, path, 4);
+    BOOST_CHECK(pfile && pfile->size() == 4);
+    BOOST_CHECK(cache.Get(0, path, 4) == pfile);
+
+    // Growing the file is only seen once a longer mapping is asked for.
+    {
+        CAutoFile file(fopen(path.string().c_str(), "ab"), SER_DISK, 0);
+        file << (uint32_t)2;
+    }
+    BOOST_CHECK(!cache.Get(0, path, 9));
+    boost::shared_ptr<CMappedFile> pfile2 = cache.Get(0, path, 8);
+    BOOST_CHECK(pfile2 && pfile2 != pfile);
+    uint32_t a, b;
+    CMemoryReader(pfile2->begin(), pfile2->begin() + pfile2->size(), SER_DISK, 0) >> a >> b;
+    BOOST_CHECK_EQUAL(a, 1);
+    BOOST_CHECK_EQUAL(b, 2);
+
+    // Mappings outlive eviction and deletion of the file.
+    cache.Get(1, path, 0);
+    cache.Erase(0);
+    boost::filesystem::remove(path);
+    BOOST_CHECK_EQUAL(memcmp(pfile->begin(), pfile2->begin(), 4), 0);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
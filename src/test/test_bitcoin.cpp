@@ -10,6 +10,7 @@
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
 #include "consensus/merkle.h"
+#include "crypto/sha256.h"
 #include "key.h"
 #include "main.h"
 #include "miner.h"
@@ -20,6 +21,7 @@
 #include "ui_interface.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
+#include "script/sigcache.h"
 
 #include "test/testutil.h"
 
@@ -32,9 +34,12 @@ extern void noui_connect();
 
 BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
 {
+        SHA256AutoDetect();
         ECC_Start();
         SetupEnvironment();
         SetupNetworking();
+        InitSignatureCache();
+        InitTxValidationCache();
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
         SelectParams(chainName, mapArgs);
@@ -56,10 +61,10 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
     // Make genesis coinbase use out spend-key
     coinbaseKey.MakeNewKey(true);
     CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
-    CMutableTransaction newCoinbase(Params().GenesisBlock().vtx[0]);
-    for (unsigned int i = 0; i < Params().GenesisBlock().vtx[0].vout.size(); i++)
+    CMutableTransaction newCoinbase(*Params().GenesisBlock().vtx[0]);
+    for (unsigned int i = 0; i < Params().GenesisBlock().vtx[0]->vout.size(); i++)
         newCoinbase.vout[i].scriptPubKey = scriptPubKey;
-    const_cast<CBlock&>(Params().GenesisBlock()).vtx[0] = newCoinbase;
+    const_cast<CBlock&>(Params().GenesisBlock()).vtx[0] = MakeTransactionRef(std::move(newCoinbase));
     const_cast<CBlock&>(Params().GenesisBlock()).hashMerkleRoot = BlockMerkleRoot(Params().GenesisBlock());
     const_cast<CBlock&>(Params().GenesisBlock()).proof = CProof(CScript()<<OP_TRUE, CScript());
     const_cast<Consensus::Params&>(Params().GetConsensus()).hashGenesisBlock = Params().GenesisBlock().GetHash();
@@ -100,13 +105,13 @@ TestChain100Setup::TestChain100Setup() : TestingSetup(CBaseChainParams::REGTEST)
 {
     // Generate a 100-block chain:
     CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
-    assert(Params().GenesisBlock().vtx[0].vout[0].scriptPubKey == scriptPubKey);
-    coinbaseTxns.push_back(Params().GenesisBlock().vtx[0]);
+    assert(Params().GenesisBlock().vtx[0]->vout[0].scriptPubKey == scriptPubKey);
+    coinbaseTxns.push_back(*Params().GenesisBlock().vtx[0]);
     for (int i = 0; i < COINBASE_MATURITY; i++)
     {
         std::vector<CMutableTransaction> noTxns;
         CBlock b = CreateAndProcessBlock(noTxns, scriptPubKey);
-        coinbaseTxns.push_back(b.vtx[0]);
+        coinbaseTxns.push_back(*b.vtx[0]);
     }
 }
 
@@ -124,7 +129,7 @@ TestChain100Setup::CreateAndProcessBlock(const std::vector<CMutableTransaction>&
     // Replace mempool-selected txns with just coinbase plus passed-in txns:
     block.vtx.resize(1);
     BOOST_FOREACH(const CMutableTransaction& tx, txns)
-        block.vtx.push_back(tx);
+        block.vtx.push_back(MakeTransactionRef(tx));
     // IncrementExtraNonce creates a valid coinbase and merkleRoot
     unsigned int extraNonce = 0;
     IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
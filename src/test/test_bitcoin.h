@@ -28,7 +28,6 @@ struct BasicTestingSetup {
  * Included are data directory, coins database, script check threads setup.
  */
 struct TestingSetup: public BasicTestingSetup {
-    CCoinsViewDB *pcoinsdbview;
     boost::filesystem::path pathTemp;
     boost::thread_group threadGroup;
     CKey coinbaseKey; // private/public key needed to spend coinbase transactions
@@ -350,6 +350,47 @@ BOOST_AUTO_TEST_CASE(test_Get)
     BOOST_CHECK(VerifyAmounts(coins, t1, t1.nTxFee));
 }
 
+BOOST_AUTO_TEST_CASE(test_cached_sizes)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout.hash = GetRandHash();
+    mtx.vin[0].scriptSig << std::vector<unsigned char>(65, 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 90*CENT;
+    mtx.vout[0].scriptPubKey << OP_1;
+
+    // Without witness data, the witness hash is the txid.
+    CTransaction tx(mtx);
+    BOOST_CHECK(tx.GetWitnessHash() == tx.GetHash());
+    BOOST_CHECK_EQUAL(tx.GetStrippedSize(), ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS));
+    BOOST_CHECK_EQUAL(tx.GetTotalSize(), ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(GetTransactionWeight(tx), tx.GetTotalSize() * WITNESS_SCALE_FACTOR);
+
+    // Changing the witness of a CTransaction requires refreshing the cache.
+    tx.wit.vtxinwit.resize(1);
+    tx.wit.vtxinwit[0].scriptWitness.stack.push_back(std::vector<unsigned char>(72, 1));
+    tx.UpdateHash();
+    BOOST_CHECK(tx.GetHash() == mtx.GetHash());
+    BOOST_CHECK(tx.GetWitnessHash() == SerializeHash(tx, SER_GETHASH, 0));
+    BOOST_CHECK(tx.GetWitnessHash() != tx.GetHash());
+    BOOST_CHECK_EQUAL(tx.GetTotalSize(), ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK(tx.GetTotalSize() > tx.GetStrippedSize());
+
+    // Deserialization and copies carry the cache along.
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    CTransaction tx2;
+    ss >> tx2;
+    BOOST_CHECK(tx2.GetWitnessHash() == tx.GetWitnessHash());
+    BOOST_CHECK_EQUAL(tx2.GetTotalSize(), tx.GetTotalSize());
+    CTransaction tx3;
+    tx3 = tx2;
+    BOOST_CHECK(tx3.GetWitnessHash() == tx.GetWitnessHash());
+    BOOST_CHECK_EQUAL(tx3.GetStrippedSize(), tx.GetStrippedSize());
+    BOOST_CHECK_EQUAL(GetTransactionWeight(tx3), GetTransactionWeight(tx));
+}
+
 void CreateCreditAndSpend(const CKeyStore& keystore, const CScript& outscript, CTransaction& output, CMutableTransaction& input, bool success = true)
 {
     CMutableTransaction outputm;
@@ -0,0 +1,121 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txreconciliation.h"
+
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "version.h"
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txreconciliation_tests, BasicTestingSetup)
+
+static std::vector<uint32_t> ShortIds(uint32_t nBegin, uint32_t nEnd)
+{
+    std::vector<uint32_t> vIds;
+    for (uint32_t i = nBegin; i < nEnd; i++)
+        vIds.push_back(i * 2654435761U);
+    return vIds;
+}
+
+static CReconSketch MakeSketch(size_t nCells, const std::vector<uint32_t>& vIds)
+{
+    CReconSketch sketch(nCells);
+    for (size_t i = 0; i < vIds.size(); i++)
+        sketch.Add(vIds[i]);
+    return sketch;
+}
+
+BOOST_AUTO_TEST_CASE(sketch_decode)
+{
+    // Local has ids 0..110, remote 100..130: 100 only here, 20 only there
+    const size_t nCells = CReconSketch::CellsForCapacity(120);
+    CReconSketch local = MakeSketch(nCells, ShortIds(0, 110));
+    const CReconSketch remote = MakeSketch(nCells, ShortIds(100, 130));
+
+    // The remote one goes over the wire
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << remote;
+    CReconSketch received;
+    ss >> received;
+    BOOST_CHECK(received.IsValid());
+    BOOST_CHECK_EQUAL(received.GetCells(), nCells);
+
+    BOOST_CHECK(local.Subtract(received));
+    std::vector<uint32_t> vPositive, vNegative;
+    BOOST_CHECK(local.Decode(vPositive, vNegative));
+    std::sort(vPositive.begin(), vPositive.end());
+    std::sort(vNegative.begin(), vNegative.end());
+    std::vector<uint32_t> vExpectedPositive = ShortIds(0, 100), vExpectedNegative = ShortIds(110, 130);
+    std::sort(vExpectedPositive.begin(), vExpectedPositive.end());
+    std::sort(vExpectedNegative.begin(), vExpectedNegative.end());
+    BOOST_CHECK(vPositive == vExpectedPositive);
+    BOOST_CHECK(vNegative == vExpectedNegative);
+
+    // Equal sets leave nothing
+    CReconSketch same = MakeSketch(nCells, ShortIds(0, 50));
+    BOOST_CHECK(same.Subtract(MakeSketch(nCells, ShortIds(0, 50))));
+    BOOST_CHECK(same.Decode(vPositive, vNegative));
+    BOOST_CHECK(vPositive.empty() && vNegative.empty());
+
+    // Sketches of different sizes do not mix
+    BOOST_CHECK(!same.Subtract(MakeSketch(nCells + CReconSketch::RECON_SKETCH_HASHES, ShortIds(0, 50))));
+}
+
+BOOST_AUTO_TEST_CASE(sketch_overloaded)
+{
+    // Far more differences than the sketch was made for
+    const size_t nCells = CReconSketch::CellsForCapacity(10);
+    CReconSketch local = MakeSketch(nCells, ShortIds(0, 300));
+    BOOST_CHECK(local.Subtract(MakeSketch(nCells, ShortIds(1000, 1100))));
+    std::vector<uint32_t> vPositive, vNegative;
+    BOOST_CHECK(!local.Decode(vPositive, vNegative));
+
+    BOOST_CHECK(!CReconSketch().IsValid());
+    BOOST_CHECK(!CReconSketch(CReconSketch::RECON_SKETCH_HASHES + 1).IsValid());
+    BOOST_CHECK(!CReconSketch(MAX_TXRECON_SKETCH_CELLS + CReconSketch::RECON_SKETCH_HASHES).IsValid());
+    BOOST_CHECK(CReconSketch(MAX_TXRECON_SKETCH_CELLS).IsValid());
+}
+
+BOOST_AUTO_TEST_CASE(recon_state)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vout.resize(1);
+    std::vector<CTransactionRef> vtx;
+    for (int i = 0; i < 10; i++) {
+        mtx.vin[0].prevout.n = i;
+        vtx.push_back(MakeTransactionRef(CTransaction(mtx)));
+    }
+
+    // Both sides key the short ids alike
+    CTxReconState initiator(true, 1234, 5678), responder(false, 5678, 1234), other(false, 5678, 1235);
+    BOOST_CHECK_EQUAL(initiator.GetShortId(vtx[0]->GetHash()), responder.GetShortId(vtx[0]->GetHash()));
+    BOOST_CHECK(initiator.GetShortId(vtx[0]->GetHash()) != other.GetShortId(vtx[0]->GetHash()));
+
+    for (int i = 0; i < 7; i++)
+        BOOST_CHECK(initiator.Add(vtx[i]));
+    BOOST_CHECK(initiator.Add(vtx[0]));
+    BOOST_CHECK_EQUAL(initiator.mapSet.size(), 7U);
+    for (int i = 4; i < 10; i++)
+        BOOST_CHECK(responder.Add(vtx[i]));
+
+    // One round: the responder sketches its set, the initiator decodes the difference
+    const size_t nCells = CReconSketch::CellsForCapacity(responder.EstimateDifference(initiator.mapSet.size()));
+    CReconSketch diff = initiator.GetSketch(nCells);
+    BOOST_CHECK(diff.Subtract(responder.GetSketch(nCells)));
+    std::vector<uint32_t> vLocal, vRemote;
+    BOOST_CHECK(diff.Decode(vLocal, vRemote));
+    BOOST_CHECK_EQUAL(vLocal.size(), 4U);
+    for (size_t i = 0; i < vLocal.size(); i++)
+        BOOST_CHECK(initiator.mapSet.count(vLocal[i]) && !responder.mapSet.count(vLocal[i]));
+    BOOST_CHECK_EQUAL(vRemote.size(), 3U);
+    for (size_t i = 0; i < vRemote.size(); i++)
+        BOOST_CHECK(responder.mapSet.count(vRemote[i]) && !initiator.mapSet.count(vRemote[i]));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
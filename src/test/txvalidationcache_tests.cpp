@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
 #include "consensus/validation.h"
 #include "key.h"
 #include "main.h"
@@ -84,4 +85,75 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+static CMutableTransaction
+SignedSpend(const CTransaction& coinbase, const CKey& key, const CScript& scriptPubKey)
+{
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = coinbase.GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11*CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    spend.nTxFee = coinbase.vout[0].nValue.GetAmount() - 11*CENT;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(coinbase.vout[0].scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    return spend;
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_mempool_validation_cache, TestChain100Setup)
+{
+    // Transactions the mempool accepted queue no checks when they are
+    // connected under the flags of the next block; others still do.
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction inPool = SignedSpend(coinbaseTxns[0], coinbaseKey, scriptPubKey);
+    // A conflicting spend, as only the first coinbase has matured.
+    CMutableTransaction notInPool = SignedSpend(coinbaseTxns[0], coinbaseKey, CScript() << OP_TRUE);
+    BOOST_CHECK(ToMemPool(inPool));
+
+    LOCK(cs_main);
+    CCoinsViewCache view(pcoinsTip);
+    const unsigned int flags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
+    {
+        // The mempool remembers what it validated the transaction under.
+        LOCK(mempool.cs);
+        CTxMemPool::txiter it = mempool.mapTx.find(inPool.GetHash());
+        BOOST_CHECK(it != mempool.mapTx.end());
+        BOOST_CHECK_EQUAL(it->GetValidatedFlags(), flags);
+    }
+    for (int i = 0; i < 2; i++) {
+        const CTransaction tx(i == 0 ? inPool : notInPool);
+        CValidationState state;
+        PrecomputedTransactionData txdata(tx);
+        std::set<std::pair<uint256, COutPoint> > setWithdrawsSpent;
+        std::vector<CCheck*> vChecks;
+        BOOST_CHECK(CheckInputs(tx, state, view, true, flags, false, txdata, setWithdrawsSpent, &vChecks));
+        BOOST_CHECK_EQUAL(vChecks.empty(), i == 0);
+        BOOST_FOREACH(CCheck* check, vChecks) {
+            BOOST_CHECK((*check)());
+            delete check;
+        }
+
+        // Other flags miss the cache.
+        vChecks.clear();
+        BOOST_CHECK(CheckInputs(tx, state, view, true, flags | SCRIPT_VERIFY_LOW_S, false, txdata, setWithdrawsSpent, &vChecks));
+        BOOST_CHECK(!vChecks.empty());
+        BOOST_FOREACH(CCheck* check, vChecks)
+            delete check;
+    }
+
+    // The checks against the UTXO set still run: once the coin is spent,
+    // the cached transaction is rejected.
+    view.ModifyCoins(coinbaseTxns[0].GetHash())->Spend(0);
+    CValidationState state;
+    const CTransaction tx(inPool);
+    PrecomputedTransactionData txdata(tx);
+    std::set<std::pair<uint256, COutPoint> > setWithdrawsSpent;
+    BOOST_CHECK(!CheckInputs(tx, state, view, true, flags, false, txdata, setWithdrawsSpent));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
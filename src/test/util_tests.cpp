@@ -90,6 +90,37 @@ BOOST_AUTO_TEST_CASE(util_HexStr)
         "04 67 8a fd b0");
 }
 
+BOOST_AUTO_TEST_CASE(util_HexStr_ParseHex_lengths)
+{
+    // Cover the block sizes of the vector kernels and the tails after them.
+    static const char hexmap[] = "0123456789abcdef";
+    for (size_t len = 0; len < 200; len++) {
+        std::vector<unsigned char> vch(len);
+        std::string expected;
+        for (size_t i = 0; i < len; i++) {
+            vch[i] = insecure_rand();
+            expected += hexmap[vch[i] >> 4];
+            expected += hexmap[vch[i] & 15];
+        }
+        const std::string hex = HexStr(vch);
+        BOOST_CHECK_EQUAL(hex, expected);
+        BOOST_CHECK(ParseHex(hex) == vch);
+
+        std::string upper = hex;
+        for (size_t i = 0; i < upper.size(); i++)
+            upper[i] = toupper(upper[i]);
+        BOOST_CHECK(ParseHex(upper) == vch);
+
+        // Parsing stops at the first character that is not a hex digit.
+        if (len > 0) {
+            const size_t nStop = insecure_rand() % len;
+            std::string invalid = hex;
+            invalid[2 * nStop + insecure_rand() % 2] = 'g';
+            BOOST_CHECK(ParseHex(invalid) == std::vector<unsigned char>(vch.begin(), vch.begin() + nStop));
+        }
+    }
+}
+
 
 BOOST_AUTO_TEST_CASE(util_DateTimeStrFormat)
 {
@@ -32,13 +32,14 @@ public:
         return CCoinsView::IsWithdrawSpent(outpoint);
     }
 
+    CCoinsMapMemoryResource resource;
     CCoinsMap mapCoinsWritten;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
         mapCoinsWritten = mapCoins;
         return CCoinsView::BatchWrite(mapCoins, hashBlock);
     }
 
-    CCoinsViewTester() : IsWithdrawSpentCalled(false) {}
+    CCoinsViewTester() : IsWithdrawSpentCalled(false), mapCoinsWritten(0, SaltedTxidHasher(), CCoinsMap::key_equal(), &resource) {}
 };
 
 BOOST_AUTO_TEST_CASE(withdrawspent_validity)
@@ -71,7 +72,8 @@ BOOST_AUTO_TEST_CASE(withdrawspent_validity)
     outpoint2.second.n = 0;
     BOOST_CHECK(!coinsCache.IsWithdrawSpent(outpoint2));
 
-    CCoinsMap mapCoins;
+    CCoinsMapMemoryResource resource;
+    CCoinsMap mapCoins(0, SaltedTxidHasher(), CCoinsMap::key_equal(), &resource);
     CCoinsCacheEntry entry;
     std::pair<uint256, COutPoint> outpoint3(std::make_pair(GetRandHash(), COutPoint(GetRandHash(), 42)));
 
@@ -5,48 +5,234 @@
 
 #include "txdb.h"
 
+#include "blockfilter.h"
+#include "blockstats.h"
 #include "chainparams.h"
+#include "crypto/sha256.h"
 #include "hash.h"
 #include "pow.h"
 #include "uint256.h"
+#include "undo.h"
 
+#include <algorithm>
 #include <stdint.h>
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
 
-static const char DB_COINS = 'c';
+static const char DB_COIN = 'C';
+static const char DB_COINS = 'c'; // Per-transaction records written by older versions, see Upgrade()
+static const char DB_COIN_TX = 'T'; // Present for every transaction with unspent outputs
+static const char DB_COIN_TX_COMPLETE = 'M'; // Set once every transaction has its DB_COIN_TX record
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_LOCKS = 'k';
+static const char DB_LOCK = 'L';
 static const char DB_BLOCK_INDEX = 'b';
 static const char DB_WITHDRAW_FLAG = 'w';
 static const char DB_INVALID_BLOCK_Q = 'q';
+static const char DB_PARENT_BLOCKS = 'p';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_INDEX_SNAPSHOT = 'S';
+static const char DB_UTXO_STATS = 'u';
+static const char DB_SNAPSHOT_BASE = 'U';
 
+static const char DB_BLOCK_FILTER = 'g';
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+static const char DB_SCRIPT_OUTPUT = 'o';
+static const char DB_SCRIPT_SPEND = 's';
+
+static const char DB_BLOCK_STATS = 'b';
+
+
+namespace {
+
+/** Key of a single unspent output in the chainstate. */
+struct CoinEntry
+{
+    char key;
+    uint256 txid;
+    uint32_t n;
+
+    CoinEntry() : key(DB_COIN), n(0) {}
+    CoinEntry(const uint256& txidIn, uint32_t nIn) : key(DB_COIN), txid(txidIn), n(nIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(key);
+        READWRITE(txid);
+        READWRITE(VARINT(n));
+    }
+};
+
+/**
+ * Value of a single unspent output: the metadata of its transaction, as in
+ * CCoins, and the compressed output.
+ */
+struct CoinRecord
+{
+    int nTxVersion;
+    int nHeight;
+    bool fCoinBase;
+    CTxOut out;
+
+    CoinRecord() : nTxVersion(0), nHeight(0), fCoinBase(false) {}
+    CoinRecord(const CCoins& coins, unsigned int n) : nTxVersion(coins.nVersion), nHeight(coins.nHeight), fCoinBase(coins.fCoinBase), out(coins.vout[n]) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(VARINT(nTxVersion));
+        unsigned int nCode = nHeight * 2 + fCoinBase;
+        READWRITE(VARINT(nCode));
+        nHeight = nCode / 2;
+        fCoinBase = nCode & 1;
+        READWRITE(REF(CTxOutCompressor(out)));
+    }
+};
+
+/**
+ * Read the outputs of txid, starting at the current position of cursor, into
+ * coins. Leaves cursor at the first record after them.
+ */
+bool ReadCoins(CDBIterator& cursor, const uint256& txid, CCoins& coins, unsigned int* pnValueSize = NULL)
 {
+    coins.Clear();
+    bool fFound = false;
+    CoinEntry entry;
+    while (cursor.Valid() && cursor.GetKey(entry) && entry.key == DB_COIN && entry.txid == txid) {
+        CoinRecord record;
+        if (!cursor.GetValue(record))
+            return error("%s: unable to read output %s:%u", __func__, txid.ToString(), entry.n);
+        if (coins.vout.size() <= entry.n)
+            coins.vout.resize(entry.n + 1);
+        coins.vout[entry.n] = record.out;
+        coins.nVersion = record.nTxVersion;
+        coins.nHeight = record.nHeight;
+        coins.fCoinBase = record.fCoinBase;
+        if (pnValueSize)
+            *pnValueSize += cursor.GetValueSize();
+        fFound = true;
+        cursor.Next();
+    }
+    return fFound;
+}
+
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, int nBloomBits) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, nBloomBits), fPendingWriteFailed(false), fStatsPending(false)
+{
+    LoadWithdrawsSpent();
+}
+
+CCoinsViewDB::~CCoinsViewDB()
+{
+    Sync();
+}
+
+const CCoinsCacheEntry* CCoinsViewDB::FindPending(const CCoinsMapKey &key) const {
+    AssertLockHeld(cs_pending);
+    if (!pmapPending)
+        return NULL;
+    CCoinsMap::const_iterator it = pmapPending->find(key);
+    return it == pmapPending->end() ? NULL : &it->second;
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+    {
+        LOCK(cs_pending);
+        const CCoinsCacheEntry* pentry = FindPending(make_pair(txid, COutPoint()));
+        if (pentry) {
+            coins = pentry->coins;
+            return !coins.IsPruned();
+        }
+    }
+    // Most lookups are for transactions that have no unspent outputs, which
+    // the bloom filter can rule out for a point lookup but not for a seek.
+    if (!db.Exists(make_pair(DB_COIN_TX, txid))) {
+        coins.Clear();
+        return false;
+    }
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper&>(db).NewIterator());
+    pcursor->Seek(CoinEntry(txid, 0));
+    return ReadCoins(*pcursor, txid, coins);
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+    {
+        LOCK(cs_pending);
+        const CCoinsCacheEntry* pentry = FindPending(make_pair(txid, COutPoint()));
+        if (pentry)
+            return !pentry->coins.IsPruned();
+    }
+    return db.Exists(make_pair(DB_COIN_TX, txid));
+}
+
+void CCoinsViewDB::LoadWithdrawsSpent() {
+    LOCK(cs_pending);
+    mapWithdrawsSpent.clear();
+    size_t nCount = 0;
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(DB_WITHDRAW_FLAG);
+    while (pcursor->Valid()) {
+        pair<char, pair<uint256, COutPoint> > key;
+        if (!pcursor->GetKey(key) || key.first != DB_WITHDRAW_FLAG)
+            break;
+        mapWithdrawsSpent[key.second.first].push_back(key.second.second);
+        nCount++;
+        pcursor->Next();
+    }
+    // The database orders output indexes by their serialization.
+    for (std::map<uint256, std::vector<COutPoint> >::iterator it = mapWithdrawsSpent.begin(); it != mapWithdrawsSpent.end(); it++)
+        std::sort(it->second.begin(), it->second.end());
+    LogPrint("coindb", "Loaded %u spent withdraws\n", (unsigned int)nCount);
+}
+
+void CCoinsViewDB::SetWithdrawSpent(const pair<uint256, COutPoint> &outpoint, bool fSpent) {
+    AssertLockHeld(cs_pending);
+    std::vector<COutPoint>& vSpent = mapWithdrawsSpent[outpoint.first];
+    std::vector<COutPoint>::iterator it = std::lower_bound(vSpent.begin(), vSpent.end(), outpoint.second);
+    const bool fFound = it != vSpent.end() && *it == outpoint.second;
+    if (fSpent && !fFound) {
+        vSpent.insert(it, outpoint.second);
+    } else if (!fSpent && fFound) {
+        vSpent.erase(it);
+        if (vSpent.empty())
+            mapWithdrawsSpent.erase(outpoint.first);
+    }
 }
 
 bool CCoinsViewDB::IsWithdrawSpent(const pair<uint256, COutPoint> &outpoint) const {
-    return db.Exists(make_pair(DB_WITHDRAW_FLAG, outpoint));
+    LOCK(cs_pending);
+    std::map<uint256, std::vector<COutPoint> >::const_iterator it = mapWithdrawsSpent.find(outpoint.first);
+    return it != mapWithdrawsSpent.end() && std::binary_search(it->second.begin(), it->second.end(), outpoint.second);
+}
+
+bool CCoinsViewDB::GetWithdrawsSpent(std::vector<pair<uint256, COutPoint> > &vSpent) const {
+    LOCK(cs_pending);
+    vSpent.clear();
+    for (std::map<uint256, std::vector<COutPoint> >::const_iterator it = mapWithdrawsSpent.begin(); it != mapWithdrawsSpent.end(); it++) {
+        for (size_t i = 0; i < it->second.size(); i++)
+            vSpent.push_back(std::make_pair(it->first, it->second[i]));
+    }
+    return true;
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        LOCK(cs_pending);
+        if (pmapPending && !hashPendingBlock.IsNull())
+            return hashPendingBlock;
+    }
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
@@ -54,36 +240,148 @@ uint256 CCoinsViewDB::GetBestBlock() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
-    CDBBatch batch(db);
+    // Only one flush is in flight at a time.
+    bool fOk = Sync();
+
+    // Take over the dirty entries; moving them is cheap compared to writing.
+    boost::scoped_ptr<CCoinsMapMemoryResource> resource(new CCoinsMapMemoryResource());
+    boost::scoped_ptr<CCoinsMap> pmap(new CCoinsMap(0, SaltedTxidHasher(), CCoinsMap::key_equal(), resource.get()));
+    std::vector<std::pair<CCoinsMapKey, bool> > vWithdraws;
     size_t count = 0;
-    size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.flags & CCoinsCacheEntry::WITHDRAW) {
-                if (!it->second.withdrawSpent)
-                    batch.Erase(make_pair(DB_WITHDRAW_FLAG, it->first));
-                else
-                    batch.Write(make_pair(DB_WITHDRAW_FLAG, it->first), '1');
-            } else {
-                if (it->second.coins.IsPruned())
-                    batch.Erase(make_pair(DB_COINS, it->first.first));
-                else
-                    batch.Write(make_pair(DB_COINS, it->first.first), it->second.coins);
-            }
-            changed++;
+            CCoinsCacheEntry& entry = (*pmap)[it->first];
+            entry.coins.swap(it->second.coins);
+            entry.vChanged.swap(it->second.vChanged);
+            entry.withdrawSpent = it->second.withdrawSpent;
+            entry.flags = it->second.flags;
+            if (entry.flags & CCoinsCacheEntry::WITHDRAW)
+                vWithdraws.push_back(std::make_pair(it->first, entry.withdrawSpent));
         }
         count++;
         CCoinsMap::iterator itOld = it++;
         mapCoins.erase(itOld);
     }
+    LogPrint("coindb", "Handing %u changed transactions (out of %u) to the coin database writer...\n", (unsigned int)pmap->size(), (unsigned int)count);
+
+    {
+        LOCK(cs_pending);
+        pendingMemoryResource.swap(resource);
+        pmapPending.swap(pmap);
+        // The spent withdraws are ahead of the database from here on, as
+        // the pending entries are.
+        for (size_t i = 0; i < vWithdraws.size(); i++)
+            SetWithdrawSpent(vWithdraws[i].first, vWithdraws[i].second);
+        hashPendingBlock = hashBlock;
+        fStatsPending = !hashBlock.IsNull() && hashBlock == hashStatsNext;
+        if (fStatsPending)
+            statsPending = statsNext;
+    }
+    writerThread = boost::thread(boost::bind(&CCoinsViewDB::WritePending, this));
+    return fOk;
+}
+
+bool CCoinsViewDB::Sync() {
+    if (writerThread.joinable())
+        writerThread.join();
+    LOCK(cs_pending);
+    bool fOk = !fPendingWriteFailed;
+    fPendingWriteFailed = false;
+    return fOk;
+}
+
+void CCoinsViewDB::WritePending() {
+    RenameThread("bitcoin-coindb");
+    // The entries are not modified until this is done, so they can be read
+    // without holding cs_pending.
+    bool fOk = false;
+    try {
+        fOk = WriteCoins(*pmapPending, hashPendingBlock, fStatsPending ? &statsPending : NULL);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    if (!fOk)
+        LogPrintf("Error: failed to write to coin database\n");
+
+    LOCK(cs_pending);
+    fPendingWriteFailed = !fOk;
+    pmapPending.reset();
+    pendingMemoryResource.reset();
+    hashPendingBlock.SetNull();
+    fStatsPending = false;
+}
+
+bool CCoinsViewDB::GetUTXOStats(const uint256 &hashBlock, CUTXOStats &stats) const {
+    {
+        LOCK(cs_pending);
+        if (pmapPending && fStatsPending && hashPendingBlock == hashBlock) {
+            stats = statsPending;
+            return true;
+        }
+    }
+    std::pair<uint256, CUTXOStats> record;
+    if (!db.Read(DB_UTXO_STATS, record) || record.first != hashBlock)
+        return false;
+    stats = record.second;
+    return true;
+}
+
+void CCoinsViewDB::SetUTXOStats(const uint256 &hashBlock, const CUTXOStats &stats) {
+    LOCK(cs_pending);
+    hashStatsNext = hashBlock;
+    statsNext = stats;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOStats *pstats) {
+    CDBBatch batch(db);
+    size_t written = 0;
+    size_t erased = 0;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::WITHDRAW) {
+            if (!it->second.withdrawSpent)
+                batch.Erase(make_pair(DB_WITHDRAW_FLAG, it->first));
+            else
+                batch.Write(make_pair(DB_WITHDRAW_FLAG, it->first), '1');
+        } else {
+            // Entries the database has are only touched where outputs
+            // were spent or restored; everything else is new.
+            const CCoinsCacheEntry& entry = it->second;
+            const bool fFresh = entry.flags & CCoinsCacheEntry::FRESH;
+            const size_t nOutputs = fFresh ? entry.coins.vout.size() : std::max(entry.coins.vout.size(), entry.vChanged.size());
+            bool fWritten = false;
+            for (size_t n = 0; n < nOutputs; n++) {
+                if (!fFresh && !entry.IsChanged(n))
+                    continue;
+                if (entry.coins.IsAvailable(n)) {
+                    batch.Write(CoinEntry(it->first.first, n), CoinRecord(entry.coins, n));
+                    written++;
+                    fWritten = true;
+                } else if (!fFresh) {
+                    batch.Erase(CoinEntry(it->first.first, n));
+                    erased++;
+                }
+            }
+            if (fWritten)
+                batch.Write(make_pair(DB_COIN_TX, it->first.first), '1');
+            else if (!fFresh && entry.coins.IsPruned())
+                batch.Erase(make_pair(DB_COIN_TX, it->first.first));
+        }
+    }
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
-
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    // Statistics only count if they belong to the best block written with them.
+    if (pstats)
+        batch.Write(DB_UTXO_STATS, std::make_pair(hashBlock, *pstats));
+
+    LogPrint("coindb", "Committing %u changed transactions (%u outputs written, %u erased) to coin database...\n",
+             (unsigned int)mapCoins.size(), (unsigned int)written, (unsigned int)erased);
+    CDBReadStats stats = db.GetReadStats();
+    LogPrint("coindb", "Coin database lookups so far: %u reads (%u not found), %u seeks\n",
+             stats.nReads, stats.nReadsNotFound, stats.nSeeks);
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, int nBloomBits) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, nBloomBits, DB_PROFILE_METADATA) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -106,23 +404,245 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+bool CCoinsViewDB::Upgrade() {
+    return UpgradeCoins() && UpgradeCoinTxs();
+}
+
+bool CCoinsViewDB::UpgradeCoins() {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    if (!pcursor->Valid())
+        return true;
+    std::pair<char, uint256> key;
+    if (!pcursor->GetKey(key) || key.first != DB_COINS)
+        return true;
+
+    LogPrintf("Upgrading the chainstate to one record per output...\n");
+    size_t nTxs = 0;
+    size_t nOutputs = 0;
+    CDBBatch batch(db);
+    size_t nBatchOps = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (!pcursor->GetKey(key) || key.first != DB_COINS)
+            break;
+        CCoins coins;
+        if (!pcursor->GetValue(coins))
+            return error("%s: unable to read coins of %s", __func__, key.second.ToString());
+        for (unsigned int n = 0; n < coins.vout.size(); n++) {
+            if (!coins.IsAvailable(n))
+                continue;
+            batch.Write(CoinEntry(key.second, n), CoinRecord(coins, n));
+            nOutputs++;
+            nBatchOps++;
+        }
+        if (!coins.IsPruned())
+            batch.Write(make_pair(DB_COIN_TX, key.second), '1');
+        // Each batch moves whole transactions, so an interrupted upgrade
+        // simply continues on the next start.
+        batch.Erase(key);
+        nTxs++;
+        if (++nBatchOps >= 100000) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
+            nBatchOps = 0;
+            LogPrintf("Upgraded %u transactions...\n", (unsigned int)nTxs);
+        }
+        pcursor->Next();
+    }
+    if (!db.WriteBatch(batch))
+        return false;
+    LogPrintf("Upgraded %u transactions with %u unspent outputs\n", (unsigned int)nTxs, (unsigned int)nOutputs);
+    return true;
+}
+
+bool CCoinsViewDB::UpgradeCoinTxs() {
+    if (db.Exists(DB_COIN_TX_COMPLETE))
+        return true;
+
+    // Chainstates with one record per output from before DB_COIN_TX, and
+    // new ones, which are done at once.
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(DB_COIN);
+    size_t nTxs = 0;
+    CDBBatch batch(db);
+    CoinEntry entry;
+    uint256 txidLast;
+    while (pcursor->Valid() && pcursor->GetKey(entry) && entry.key == DB_COIN) {
+        boost::this_thread::interruption_point();
+        if (nTxs == 0 || entry.txid != txidLast) {
+            if (nTxs == 0)
+                LogPrintf("Indexing the transactions of the chainstate...\n");
+            // Rewriting records is harmless, so an interrupted run simply
+            // starts over on the next start.
+            batch.Write(make_pair(DB_COIN_TX, entry.txid), '1');
+            txidLast = entry.txid;
+            if (++nTxs % 100000 == 0) {
+                if (!db.WriteBatch(batch))
+                    return false;
+                batch.Clear();
+                LogPrintf("Indexed %u transactions...\n", (unsigned int)nTxs);
+            }
+        }
+        pcursor->Next();
+    }
+    batch.Write(DB_COIN_TX_COMPLETE, '1');
+    if (!db.WriteBatch(batch))
+        return false;
+    if (nTxs)
+        LogPrintf("Indexed %u transactions\n", (unsigned int)nTxs);
+    return true;
+}
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView *viewIn, size_t nMaxUsageIn) : CCoinsViewBacked(viewIn), nUsage(0), nMaxUsage(nMaxUsageIn), nGeneration(0), fStop(false)
+{
+}
+
+CCoinsViewPrefetch::~CCoinsViewPrefetch()
+{
+    Stop();
+}
+
+void CCoinsViewPrefetch::Start(int nThreads)
+{
+    for (int i = 0; i < nThreads; i++)
+        workers.create_thread(boost::bind(&CCoinsViewPrefetch::ThreadPrefetch, this));
+}
+
+void CCoinsViewPrefetch::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+    }
+    condQueue.notify_all();
+    workers.join_all();
+}
+
+size_t CCoinsViewPrefetch::EntryUsage(const CCoins& coins) const
+{
+    return memusage::MallocUsage(sizeof(memusage::boost_unordered_node<PrefetchMap::value_type>)) + coins.DynamicMemoryUsage();
+}
+
+void CCoinsViewPrefetch::Prefetch(const std::vector<uint256> &vTxids)
+{
+    if (vTxids.empty())
+        return;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        queue.insert(queue.end(), vTxids.begin(), vTxids.end());
+    }
+    condQueue.notify_all();
+}
+
+size_t CCoinsViewPrefetch::GetCacheSize() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return mapPrefetched.size();
+}
+
+void CCoinsViewPrefetch::ThreadPrefetch()
+{
+    RenameThread("bitcoin-prefetch");
+    while (true) {
+        uint256 txid;
+        uint64_t nGenerationStart;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fStop && queue.empty())
+                condQueue.wait(lock);
+            if (fStop)
+                return;
+            txid = queue.front();
+            queue.pop_front();
+            if (nUsage >= nMaxUsage || mapPrefetched.count(txid))
+                continue;
+            nGenerationStart = nGeneration;
+        }
+
+        CCoins coins;
+        try {
+            if (!base->GetCoins(txid, coins))
+                continue;
+        } catch (const std::exception& e) {
+            // Validation reads it again and handles the error.
+            continue;
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nGeneration != nGenerationStart)
+            continue;
+        std::pair<PrefetchMap::iterator, bool> ret = mapPrefetched.insert(std::make_pair(txid, CCoins()));
+        if (ret.second) {
+            ret.first->second.swap(coins);
+            nUsage += EntryUsage(ret.first->second);
+        }
+    }
+}
+
+bool CCoinsViewPrefetch::GetCoins(const uint256 &txid, CCoins &coins) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        PrefetchMap::iterator it = mapPrefetched.find(txid);
+        if (it != mapPrefetched.end()) {
+            // The cache on top keeps it from now on.
+            nUsage -= EntryUsage(it->second);
+            coins.swap(it->second);
+            mapPrefetched.erase(it);
+            return true;
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewPrefetch::HaveCoins(const uint256 &txid) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (mapPrefetched.count(txid))
+            return true;
+    }
+    return base->HaveCoins(txid);
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nGeneration++;
+        mapPrefetched.clear();
+        nUsage = 0;
+    }
+    return base->BatchWrite(mapCoins, hashBlock);
+}
+
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
-    CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper*>(&db)->NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COINS);
-    // Cache key of first record
-    i->pcursor->GetKey(i->keyTmp);
+    CDBIterator *pcursor = const_cast<CDBWrapper*>(&db)->NewIterator();
+    // A flush may still be in progress; report the best block of the
+    // snapshot the iterator sees rather than GetBestBlock().
+    uint256 hashBestChain;
+    char key;
+    pcursor->Seek(DB_BEST_BLOCK);
+    if (pcursor->Valid() && pcursor->GetKey(key) && key == DB_BEST_BLOCK)
+        pcursor->GetValue(hashBestChain);
+    CCoinsViewDBCursor *i = new CCoinsViewDBCursor(pcursor, hashBestChain);
+    i->pcursor->Seek(DB_COIN);
+    // Read the first transaction
+    i->Next();
     return i;
 }
 
 bool CCoinsViewDBCursor::GetKey(uint256 &key) const
 {
     // Return cached key
-    if (keyTmp.first == DB_COINS) {
-        key = keyTmp.second;
+    if (fValid) {
+        key = txidTmp;
         return true;
     }
     return false;
@@ -130,24 +650,30 @@ bool CCoinsViewDBCursor::GetKey(uint256 &key) const
 
 bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
 {
-    return pcursor->GetValue(coins);
+    if (!fValid)
+        return false;
+    coins = coinsTmp;
+    return true;
 }
 
 unsigned int CCoinsViewDBCursor::GetValueSize() const
 {
-    return pcursor->GetValueSize();
+    return nValueSizeTmp;
 }
 
 bool CCoinsViewDBCursor::Valid() const
 {
-    return keyTmp.first == DB_COINS;
+    return fValid;
 }
 
 void CCoinsViewDBCursor::Next()
 {
-    pcursor->Next();
-    if (!pcursor->Valid() || !pcursor->GetKey(keyTmp))
-        keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
+    // Gather all outputs of the next transaction
+    CoinEntry entry;
+    nValueSizeTmp = 0;
+    fValid = pcursor->Valid() && pcursor->GetKey(entry) && entry.key == DB_COIN &&
+             ReadCoins(*pcursor, entry.txid, coinsTmp, &nValueSizeTmp);
+    txidTmp = entry.txid;
 }
 
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
@@ -157,50 +683,95 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
+        assert(!(*it)->fSolutionDropped);
         batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
+    // A block index snapshot no longer matches once the index changes.
+    if (!blockinfo.empty())
+        batch.Erase(DB_INDEX_SNAPSHOT);
     return WriteBatch(batch, true);
 }
 
-bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
-    return Read(make_pair(DB_TXINDEX, txid), pos);
+bool CBlockTreeDB::ReadBlockIndex(const uint256& hash, CDiskBlockIndex& diskindex) {
+    return Read(make_pair(DB_BLOCK_INDEX, hash), diskindex);
 }
 
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(make_pair(DB_TXINDEX, it->first), it->second);
-    return WriteBatch(batch);
+bool CBlockTreeDB::WriteIndexSnapshotTag(const uint256& tag) {
+    return Write(DB_INDEX_SNAPSHOT, tag, true);
+}
+
+bool CBlockTreeDB::ReadIndexSnapshotTag(uint256& tag) {
+    return Read(DB_INDEX_SNAPSHOT, tag);
+}
+
+bool CBlockTreeDB::WriteSnapshotBase(const uint256& hash) {
+    return Write(DB_SNAPSHOT_BASE, hash, true);
 }
 
-bool CBlockTreeDB::WriteLocksCreated(const std::multimap<uint256, std::pair<COutPoint, CAmount> > &map) {
-    if (map.size() == 0)
+bool CBlockTreeDB::ReadSnapshotBase(uint256& hash) {
+    return Read(DB_SNAPSHOT_BASE, hash);
+}
+
+bool CBlockTreeDB::UpdateLocks(const std::multimap<uint256, std::pair<COutPoint, CAmount> > &mapAdded, const std::multimap<uint256, std::pair<COutPoint, CAmount> > &mapRemoved) {
+    if (mapAdded.empty() && mapRemoved.empty())
         return true;
 
-    uint256 prevGenesis;
     CDBBatch batch(*this);
-    std::vector<std::pair<COutPoint, CAmount> > vLocks;
-    for (std::multimap<uint256, std::pair<COutPoint, CAmount> >::const_iterator it=map.begin(); it!=map.end(); it++) {
-        if (prevGenesis != it->first || it == map.begin()) {
-            if (it != map.begin())
-                batch.Write(make_pair(DB_LOCKS, prevGenesis), vLocks);
-            prevGenesis = it->first;
-            if (!Read(make_pair(DB_LOCKS, it->first), vLocks))
-                vLocks.clear();
-        }
-        vLocks.push_back(it->second);
-    }
-    batch.Write(make_pair(DB_LOCKS, prevGenesis), vLocks);
+    for (std::multimap<uint256, std::pair<COutPoint, CAmount> >::const_iterator it = mapAdded.begin(); it != mapAdded.end(); it++)
+        batch.Write(make_pair(DB_LOCK, make_pair(it->first, it->second.first)), it->second.second);
+    // Erases go last, so a lock both created and spent in the same block ends up absent
+    for (std::multimap<uint256, std::pair<COutPoint, CAmount> >::const_iterator it = mapRemoved.begin(); it != mapRemoved.end(); it++)
+        batch.Erase(make_pair(DB_LOCK, make_pair(it->first, it->second.first)));
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadLocks(std::multimap<uint256, std::pair<COutPoint, CAmount> > &mapLocks) {
+    mapLocks.clear();
+
+    // Convert the per-genesis lock lists written by older versions
+    std::multimap<uint256, std::pair<COutPoint, CAmount> > mapLegacy;
+    std::vector<uint256> vLegacyKeys;
+    {
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+        pcursor->Seek(make_pair(DB_LOCKS, uint256()));
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            std::pair<char, uint256> key;
+            if (!pcursor->GetKey(key) || key.first != DB_LOCKS)
+                break;
+            std::vector<std::pair<COutPoint, CAmount> > vLocks;
+            if (!pcursor->GetValue(vLocks))
+                return error("ReadLocks() : failed to read legacy lock list");
+            for (std::vector<std::pair<COutPoint, CAmount> >::const_iterator it = vLocks.begin(); it != vLocks.end(); it++)
+                mapLegacy.insert(std::make_pair(key.second, *it));
+            vLegacyKeys.push_back(key.second);
+            pcursor->Next();
+        }
+    }
+    if (!vLegacyKeys.empty()) {
+        CDBBatch batch(*this);
+        for (std::multimap<uint256, std::pair<COutPoint, CAmount> >::const_iterator it = mapLegacy.begin(); it != mapLegacy.end(); it++)
+            batch.Write(make_pair(DB_LOCK, make_pair(it->first, it->second.first)), it->second.second);
+        for (std::vector<uint256>::const_iterator it = vLegacyKeys.begin(); it != vLegacyKeys.end(); it++)
+            batch.Erase(make_pair(DB_LOCKS, *it));
+        if (!WriteBatch(batch, true))
+            return error("ReadLocks() : failed to convert legacy lock lists");
+    }
 
-bool CBlockTreeDB::ReadLocksCreated(const uint256 &genesisHash, std::vector<std::pair<COutPoint, CAmount> > &vLocks) {
-    return Read(make_pair(DB_LOCKS, genesisHash), vLocks);
-}
-
-bool CBlockTreeDB::ReWriteLocksCreated(const uint256 &genesisHash, const std::vector<std::pair<COutPoint, CAmount> > &vLocks) {
-    return Write(make_pair(DB_LOCKS, genesisHash), vLocks);
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(DB_LOCK);
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, std::pair<uint256, COutPoint> > key;
+        if (!pcursor->GetKey(key) || key.first != DB_LOCK)
+            break;
+        CAmount nAmount;
+        if (!pcursor->GetValue(nAmount))
+            return error("ReadLocks() : failed to read lock");
+        mapLocks.insert(std::make_pair(key.second.first, std::make_pair(key.second.second, nAmount)));
+        pcursor->Next();
+    }
+    return true;
 }
 
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
@@ -223,6 +794,14 @@ bool CBlockTreeDB::WriteInvalidBlockQueue(const std::vector<uint256> &vBlocks) {
     return Write(make_pair(DB_INVALID_BLOCK_Q, uint256S("0")), vBlocks);
 }
 
+bool CBlockTreeDB::ReadConfirmedParentBlocks(std::vector<uint256> &vBlocks) {
+    return Read(DB_PARENT_BLOCKS, vBlocks);
+}
+
+bool CBlockTreeDB::WriteConfirmedParentBlocks(const std::vector<uint256> &vBlocks) {
+    return Write(DB_PARENT_BLOCKS, vBlocks);
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
@@ -246,7 +825,8 @@ bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256
                 pindexNew->nVersion       = diskindex.nVersion;
                 pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
                 pindexNew->nTime          = diskindex.nTime;
-                pindexNew->proof          = diskindex.proof;
+                pindexNew->pchallenge     = diskindex.pchallenge;
+                pindexNew->solution       = diskindex.solution;
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
 
@@ -261,3 +841,174 @@ bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256
 
     return true;
 }
+
+CTxIndexDB::CTxIndexDB(size_t nCacheSize, bool fMemory, bool fWipe, int nBloomBits) : CDBWrapper(GetDataDir() / "blocks" / "txindex", nCacheSize, fMemory, fWipe, false, nBloomBits, DB_PROFILE_INDEX) {
+}
+
+bool CTxIndexDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
+    return Read(make_pair(DB_TXINDEX, txid), pos);
+}
+
+bool CTxIndexDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(make_pair(DB_TXINDEX, it->first), it->second);
+    return WriteBatch(batch);
+}
+
+bool CTxIndexDB::Upgrade(CBlockTreeDB& blocktree) {
+    boost::scoped_ptr<CDBIterator> pcursor(blocktree.NewIterator());
+    pcursor->Seek(make_pair(DB_TXINDEX, uint256()));
+    std::pair<char, uint256> key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_TXINDEX)
+        return true;
+
+    LogPrintf("Moving the transaction index out of the block index database...\n");
+    size_t nTxs = 0;
+    CDBBatch batch(*this);
+    CDBBatch batchErase(blocktree);
+    size_t nBatchOps = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (!pcursor->GetKey(key) || key.first != DB_TXINDEX)
+            break;
+        CDiskTxPos pos;
+        if (!pcursor->GetValue(pos))
+            return error("%s: unable to read index entry of %s", __func__, key.second.ToString());
+        batch.Write(key, pos);
+        batchErase.Erase(key);
+        nTxs++;
+        if (++nBatchOps >= 100000) {
+            // The entries are only erased once their copies are on disk, so
+            // an interrupted move simply continues on the next start.
+            if (!WriteBatch(batch, true) || !blocktree.WriteBatch(batchErase))
+                return false;
+            batch.Clear();
+            batchErase.Clear();
+            nBatchOps = 0;
+            LogPrintf("Moved %u transactions...\n", (unsigned int)nTxs);
+        }
+        pcursor->Next();
+    }
+    if (!WriteBatch(batch, true) || !blocktree.WriteBatch(batchErase))
+        return false;
+    LogPrintf("Moved %u transactions to the transaction index database\n", (unsigned int)nTxs);
+    return true;
+}
+
+CBlockFilterDB::CBlockFilterDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "filter", nCacheSize, fMemory, fWipe) {
+}
+
+bool CBlockFilterDB::WriteFilter(const CBlockFilter& filter) {
+    return Write(make_pair(DB_BLOCK_FILTER, filter.GetBlockHash()), filter);
+}
+
+bool CBlockFilterDB::ReadFilter(const uint256& blockHash, CBlockFilter& filter) const {
+    return Read(make_pair(DB_BLOCK_FILTER, blockHash), filter);
+}
+
+CScriptIndexDB::CScriptIndexDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "scriptindex", nCacheSize, fMemory, fWipe) {
+}
+
+uint256 CScriptIndexDB::GetScriptHash(const CScript& scriptPubKey) {
+    uint256 hash;
+    CSHA256().Write(begin_ptr(scriptPubKey), scriptPubKey.size()).Finalize(hash.begin());
+    return hash;
+}
+
+namespace {
+
+/** Fee outputs have an empty script, and data carriers pay no one. */
+bool IsIndexedScript(const CScript& scriptPubKey)
+{
+    return !scriptPubKey.empty() && !scriptPubKey.IsUnspendable();
+}
+
+}
+
+bool CScriptIndexDB::ConnectBlock(const CBlock& block, const CBlockUndo& blockundo, int nHeight) {
+    CDBBatch batch(*this);
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            const CTxOut& txout = tx.vout[j];
+            if (IsIndexedScript(txout.scriptPubKey))
+                batch.Write(make_pair(DB_SCRIPT_OUTPUT, make_pair(GetScriptHash(txout.scriptPubKey), COutPoint(tx.GetHash(), j))), CScriptIndexOutput(nHeight, txout.nValue));
+        }
+        if (i == 0)
+            continue;
+        const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            const CScript& scriptPubKey = txundo.vprevout[j].txout.scriptPubKey;
+            if (IsIndexedScript(scriptPubKey))
+                batch.Write(make_pair(DB_SCRIPT_SPEND, make_pair(GetScriptHash(scriptPubKey), tx.vin[j].prevout)), CScriptIndexSpend(tx.GetHash(), j, nHeight));
+        }
+    }
+    return WriteBatch(batch);
+}
+
+bool CScriptIndexDB::DisconnectBlock(const CBlock& block, const CBlockUndo& blockundo) {
+    CDBBatch batch(*this);
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            const CTxOut& txout = tx.vout[j];
+            if (IsIndexedScript(txout.scriptPubKey))
+                batch.Erase(make_pair(DB_SCRIPT_OUTPUT, make_pair(GetScriptHash(txout.scriptPubKey), COutPoint(tx.GetHash(), j))));
+        }
+        if (i == 0)
+            continue;
+        const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            const CScript& scriptPubKey = txundo.vprevout[j].txout.scriptPubKey;
+            if (IsIndexedScript(scriptPubKey))
+                batch.Erase(make_pair(DB_SCRIPT_SPEND, make_pair(GetScriptHash(scriptPubKey), tx.vin[j].prevout)));
+        }
+    }
+    return WriteBatch(batch);
+}
+
+bool CScriptIndexDB::ReadOutputs(const uint256& scriptHash, std::vector<std::pair<COutPoint, CScriptIndexOutput> >& vOutputs) const {
+    vOutputs.clear();
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CScriptIndexDB*>(this)->NewIterator());
+    pcursor->Seek(make_pair(DB_SCRIPT_OUTPUT, scriptHash));
+    while (pcursor->Valid()) {
+        pair<char, pair<uint256, COutPoint> > key;
+        if (!pcursor->GetKey(key) || key.first != DB_SCRIPT_OUTPUT || key.second.first != scriptHash)
+            break;
+        CScriptIndexOutput output;
+        if (!pcursor->GetValue(output))
+            return error("%s: failed to read output", __func__);
+        vOutputs.push_back(make_pair(key.second.second, output));
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CScriptIndexDB::ReadSpends(const uint256& scriptHash, std::map<COutPoint, CScriptIndexSpend>& mapSpends) const {
+    mapSpends.clear();
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CScriptIndexDB*>(this)->NewIterator());
+    pcursor->Seek(make_pair(DB_SCRIPT_SPEND, scriptHash));
+    while (pcursor->Valid()) {
+        pair<char, pair<uint256, COutPoint> > key;
+        if (!pcursor->GetKey(key) || key.first != DB_SCRIPT_SPEND || key.second.first != scriptHash)
+            break;
+        CScriptIndexSpend spend;
+        if (!pcursor->GetValue(spend))
+            return error("%s: failed to read spend", __func__);
+        mapSpends[key.second.second] = spend;
+        pcursor->Next();
+    }
+    return true;
+}
+
+CBlockStatsDB::CBlockStatsDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "stats", nCacheSize, fMemory, fWipe) {
+}
+
+bool CBlockStatsDB::WriteStats(const CBlockStats& stats) {
+    return Write(make_pair(DB_BLOCK_STATS, stats.blockHash), stats);
+}
+
+bool CBlockStatsDB::ReadStats(const uint256& blockHash, CBlockStats& stats) const {
+    return Read(make_pair(DB_BLOCK_STATS, blockHash), stats);
+}
@@ -9,14 +9,24 @@
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
+#include "sync.h"
 
+#include <deque>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_map.hpp>
 
+class CBlockFilter;
+class CBlockStats;
+class CBlockUndo;
 class CBlockIndex;
 class CCoinsViewDBCursor;
 class uint256;
@@ -30,7 +40,7 @@ static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 static const int64_t nMinDbCache = 4;
 //! Max memory allocated to block tree DB specific cache, if no -txindex (MiB)
 static const int64_t nMaxBlockDBCache = 2;
-//! Max memory allocated to block tree DB specific cache, if -txindex (MiB)
+//! Max memory allocated to block tree and txindex DB specific caches together, if -txindex (MiB)
 // Unlike for the UTXO database, for the txindex scenario the leveldb cache make
 // a meaningful difference: https://github.com/bitcoin/bitcoin/pull/8273#issuecomment-229601991
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
@@ -62,20 +72,120 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
-/** CCoinsView backed by the coin database (chainstate/) */
+/**
+ * CCoinsView backed by the coin database (chainstate/)
+ *
+ * BatchWrite only takes over the dirty entries and leaves writing them to a
+ * background thread, so flushing a large cache does not stall whoever holds
+ * cs_main. Until the write is done, reads are answered from those entries.
+ * A new BatchWrite waits for the previous one; use Sync() to wait for
+ * durability.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+private:
+    //! Guards the pending entries against the writer thread dropping them
+    mutable CCriticalSection cs_pending;
+    boost::scoped_ptr<CCoinsMapMemoryResource> pendingMemoryResource;
+    boost::scoped_ptr<CCoinsMap> pmapPending;
+    uint256 hashPendingBlock;
+    bool fPendingWriteFailed;
+    //! Statistics to write along with best block hashStatsNext, see SetUTXOStats
+    CUTXOStats statsNext;
+    uint256 hashStatsNext;
+    //! Statistics written along with the pending entries, if fStatsPending
+    CUTXOStats statsPending;
+    bool fStatsPending;
+    boost::thread writerThread;
+    //! Every spent withdraw, written or pending, as sorted outpoints per
+    //! genesis hash (guarded by cs_pending). Peg-ins are checked against
+    //! this alone.
+    std::map<uint256, std::vector<COutPoint> > mapWithdrawsSpent;
+
+    //! Load mapWithdrawsSpent from the database
+    void LoadWithdrawsSpent();
+    //! Update mapWithdrawsSpent; cs_pending must be held
+    void SetWithdrawSpent(const std::pair<uint256, COutPoint> &outpoint, bool fSpent);
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOStats *pstats);
+    void WritePending();
+    //! Find a pending entry, or NULL; cs_pending must be held
+    const CCoinsCacheEntry* FindPending(const CCoinsMapKey &key) const;
+    //! Convert per-transaction records of older versions to one record per output
+    bool UpgradeCoins();
+    //! Add the per-transaction records GetCoins and HaveCoins look up first
+    bool UpgradeCoinTxs();
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, int nBloomBits = DEFAULT_DB_BLOOM_BITS);
+    ~CCoinsViewDB();
 
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
     bool IsWithdrawSpent(const std::pair<uint256, COutPoint> &outpoint) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool Sync();
     CCoinsViewCursor *Cursor() const;
+    bool GetUTXOStats(const uint256 &hashBlock, CUTXOStats &stats) const;
+    void SetUTXOStats(const uint256 &hashBlock, const CUTXOStats &stats);
+    bool GetWithdrawsSpent(std::vector<std::pair<uint256, COutPoint> > &vSpent) const;
+
+    //! Convert records of older versions to the current format
+    bool Upgrade();
+
+    CDBReadStats GetReadStats() const { return db.GetReadStats(); }
+    CDBWriteStats GetWriteStats() const { return db.GetWriteStats(); }
+    void SetBulkLoad(bool fBulkLoad, uint64_t nCompactionRate) { db.SetBulkLoad(fBulkLoad, nCompactionRate); }
+    bool IsBulkLoad() const { return db.IsBulkLoad(); }
+};
+
+/**
+ * CCoinsView that reads ahead of validation. Prefetch() queues txids whose
+ * coins worker threads load from the base view in parallel, typically for
+ * the inputs of a block that is about to be connected; when the cache on
+ * top misses, it takes them from memory instead of waiting for the
+ * database.
+ *
+ * Loaded coins are exactly what the base view had. Anything that changes
+ * the base view goes through BatchWrite, which drops them (and discards
+ * reads still in flight).
+ */
+class CCoinsViewPrefetch : public CCoinsViewBacked
+{
+private:
+    typedef boost::unordered_map<uint256, CCoins, SaltedTxidHasher> PrefetchMap;
+
+    mutable boost::mutex mutex;
+    boost::condition_variable condQueue;
+    std::deque<uint256> queue;
+    mutable PrefetchMap mapPrefetched;
+    mutable size_t nUsage;
+    const size_t nMaxUsage;
+    //! Incremented by BatchWrite; loads started before are discarded
+    uint64_t nGeneration;
+    bool fStop;
+    boost::thread_group workers;
+
+    void ThreadPrefetch();
+    size_t EntryUsage(const CCoins& coins) const;
+
+public:
+    CCoinsViewPrefetch(CCoinsView *viewIn, size_t nMaxUsageIn);
+    ~CCoinsViewPrefetch();
+
+    //! Start loading with the given number of threads
+    void Start(int nThreads);
+    //! Stop and join the worker threads
+    void Stop();
+    //! Queue the coins of these transactions to be loaded
+    void Prefetch(const std::vector<uint256> &vTxids);
+    //! Number of loaded, not yet used transactions
+    size_t GetCacheSize() const;
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -93,9 +203,14 @@ public:
 
 private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
-        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn), nValueSizeTmp(0), fValid(false) {}
     boost::scoped_ptr<CDBIterator> pcursor;
-    std::pair<char, uint256> keyTmp;
+    // The outputs of a transaction are separate records; the current one is
+    // assembled from them.
+    uint256 txidTmp;
+    CCoins coinsTmp;
+    unsigned int nValueSizeTmp;
+    bool fValid;
 
     friend class CCoinsViewDB;
 };
@@ -104,7 +219,7 @@ private:
 class CBlockTreeDB : public CDBWrapper
 {
 public:
-    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, int nBloomBits = DEFAULT_DB_BLOOM_BITS);
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
@@ -114,16 +229,124 @@ public:
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
-    bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
-    bool WriteLocksCreated(const std::multimap<uint256, std::pair<COutPoint, CAmount> > &list);
-    bool ReadLocksCreated(const uint256 &genesisHash, std::vector<std::pair<COutPoint, CAmount> > &vLocks);
-    bool ReWriteLocksCreated(const uint256 &genesisHash, const std::vector<std::pair<COutPoint, CAmount> > &vLocks);
+    bool UpdateLocks(const std::multimap<uint256, std::pair<COutPoint, CAmount> > &mapAdded, const std::multimap<uint256, std::pair<COutPoint, CAmount> > &mapRemoved);
+    bool ReadLocks(std::multimap<uint256, std::pair<COutPoint, CAmount> > &mapLocks);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    bool ReadBlockIndex(const uint256& hash, CDiskBlockIndex& diskindex);
+    //! Tag of the block index snapshot that matches the stored block index, if any
+    bool WriteIndexSnapshotTag(const uint256& tag);
+    bool ReadIndexSnapshotTag(uint256& tag);
+    //! Block a UTXO snapshot was loaded at, whose history is assumed valid
+    bool WriteSnapshotBase(const uint256& hash);
+    bool ReadSnapshotBase(uint256& hash);
     bool ReadInvalidBlockQueue(std::vector<uint256> &vBlocks);
     bool WriteInvalidBlockQueue(const std::vector<uint256> &vBlocks);
+    bool ReadConfirmedParentBlocks(std::vector<uint256> &vBlocks);
+    bool WriteConfirmedParentBlocks(const std::vector<uint256> &vBlocks);
+};
+
+/** Positions of transactions in the block files, keyed by txid (-txindex) */
+class CTxIndexDB : public CDBWrapper
+{
+public:
+    CTxIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, int nBloomBits = DEFAULT_DB_BLOOM_BITS);
+private:
+    CTxIndexDB(const CTxIndexDB&);
+    void operator=(const CTxIndexDB&);
+public:
+    bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
+    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    //! Move the entries that older versions kept in the block tree DB over
+    bool Upgrade(CBlockTreeDB& blocktree);
+};
+
+/** Compact filters of connected blocks, keyed by block hash (-blockfilterindex) */
+class CBlockFilterDB : public CDBWrapper
+{
+public:
+    CBlockFilterDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CBlockFilterDB(const CBlockFilterDB&);
+    void operator=(const CBlockFilterDB&);
+public:
+    bool WriteFilter(const CBlockFilter& filter);
+    bool ReadFilter(const uint256& blockHash, CBlockFilter& filter) const;
+};
+
+/** An output to a script, in the script index */
+struct CScriptIndexOutput
+{
+    int nHeight;
+    //! The value as committed to on chain; blinded amounts stay blinded
+    CTxOutValue nValue;
+
+    CScriptIndexOutput() : nHeight(0) {}
+    CScriptIndexOutput(int nHeightIn, const CTxOutValue& nValueIn) : nHeight(nHeightIn), nValue(nValueIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(VARINT(nHeight));
+        READWRITE(nValue);
+    }
+};
+
+/** The input that spent an output to a script, in the script index */
+struct CScriptIndexSpend
+{
+    uint256 txid;
+    uint32_t nInput;
+    int nHeight;
+
+    CScriptIndexSpend() : nInput(0), nHeight(0) {}
+    CScriptIndexSpend(const uint256& txidIn, uint32_t nInputIn, int nHeightIn) : txid(txidIn), nInput(nInputIn), nHeight(nHeightIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(txid);
+        READWRITE(VARINT(nInput));
+        READWRITE(VARINT(nHeight));
+    }
+};
+
+/**
+ * Outputs to each script, and the inputs that spent them, of the active
+ * chain (-scriptindex). Scripts are keyed by the SHA256 of the scriptPubKey.
+ */
+class CScriptIndexDB : public CDBWrapper
+{
+public:
+    CScriptIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CScriptIndexDB(const CScriptIndexDB&);
+    void operator=(const CScriptIndexDB&);
+public:
+    static uint256 GetScriptHash(const CScript& scriptPubKey);
+
+    //! Index the outputs of a block and the spends of its inputs, which blockundo holds the spent outputs of
+    bool ConnectBlock(const CBlock& block, const CBlockUndo& blockundo, int nHeight);
+    bool DisconnectBlock(const CBlock& block, const CBlockUndo& blockundo);
+
+    bool ReadOutputs(const uint256& scriptHash, std::vector<std::pair<COutPoint, CScriptIndexOutput> >& vOutputs) const;
+    bool ReadSpends(const uint256& scriptHash, std::map<COutPoint, CScriptIndexSpend>& mapSpends) const;
+};
+
+/** Statistics of connected blocks, keyed by block hash (-blockstatsindex) */
+class CBlockStatsDB : public CDBWrapper
+{
+public:
+    CBlockStatsDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CBlockStatsDB(const CBlockStatsDB&);
+    void operator=(const CBlockStatsDB&);
+public:
+    bool WriteStats(const CBlockStats& stats);
+    bool ReadStats(const uint256& blockHash, CBlockStats& stats) const;
 };
 
 #endif // BITCOIN_TXDB_H
@@ -26,14 +26,15 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  bool _spendsCoinbase, int64_t _sigOpsCost, LockPoints lp, std::set<std::pair<uint256, COutPoint> >& _setWithdrawsSpent):
     tx(std::make_shared<CTransaction>(_tx)), nFee(_nFee), nTime(_nTime), entryPriority(_entryPriority), entryHeight(_entryHeight),
     hadNoDependencies(poolHasNoInputsOf), inChainInputValue(_inChainInputValue),
-    spendsCoinbase(_spendsCoinbase), sigOpCost(_sigOpsCost), lockPoints(lp), setWithdrawsSpent(_setWithdrawsSpent)
+    spendsCoinbase(_spendsCoinbase), sigOpCost(_sigOpsCost), lockPoints(lp), nValidatedFlags(0), setWithdrawsSpent(_setWithdrawsSpent)
 {
     nTxWeight = GetTransactionWeight(_tx);
     nModSize = _tx.CalculateModifiedSize(GetTxSize());
-    nUsageSize = RecursiveDynamicUsage(*tx) + memusage::DynamicUsage(tx);
+    nUsageSize = RecursiveDynamicUsage(*tx) + memusage::DynamicUsage(tx) + memusage::DynamicUsage(setWithdrawsSpent);
 
     nCountWithDescendants = 1;
     nSizeWithDescendants = GetTxSize();
+    nUsageWithDescendants = nUsageSize;
     nModFeesWithDescendants = nFee;
 
     feeDelta = 0;
@@ -42,6 +43,8 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
     nSizeWithAncestors = GetTxSize();
     nModFeesWithAncestors = nFee;
     nSigOpCostWithAncestors = sigOpCost;
+
+    nVisitedEpoch = 0;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -81,36 +84,41 @@ size_t CTxMemPoolEntry::GetTxSize() const
 // descendants.
 void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
 {
-    setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
+    // Entries go into setAllDescendants as they are found, so that each is
+    // staged once.
+    setEntries setAllDescendants;
+    std::vector<txiter> stageEntries;
+    BOOST_FOREACH(const txiter childEntry, GetMemPoolChildren(updateIt)) {
+        setAllDescendants.insert(childEntry);
+        stageEntries.push_back(childEntry);
+    }
 
     while (!stageEntries.empty()) {
-        const txiter cit = *stageEntries.begin();
-        setAllDescendants.insert(cit);
-        stageEntries.erase(cit);
+        const txiter cit = stageEntries.back();
+        stageEntries.pop_back();
         const setEntries &setChildren = GetMemPoolChildren(cit);
         BOOST_FOREACH(const txiter childEntry, setChildren) {
             cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
             if (cacheIt != cachedDescendants.end()) {
                 // We've already calculated this one, just add the entries for this set
                 // but don't traverse again.
-                BOOST_FOREACH(const txiter cacheEntry, cacheIt->second) {
-                    setAllDescendants.insert(cacheEntry);
-                }
-            } else if (!setAllDescendants.count(childEntry)) {
+                setAllDescendants.insert(cacheIt->second.begin(), cacheIt->second.end());
+            } else if (setAllDescendants.insert(childEntry).second) {
                 // Schedule for later processing
-                stageEntries.insert(childEntry);
+                stageEntries.push_back(childEntry);
             }
         }
     }
     // setAllDescendants now contains all in-mempool descendants of updateIt.
     // Update and add to cached descendant map
     int64_t modifySize = 0;
+    int64_t modifyUsage = 0;
     CAmount modifyFee = 0;
     int64_t modifyCount = 0;
     BOOST_FOREACH(txiter cit, setAllDescendants) {
         if (!setExclude.count(cit->GetTx().GetHash())) {
             modifySize += cit->GetTxSize();
+            modifyUsage += cit->DynamicMemoryUsage();
             modifyFee += cit->GetModifiedFee();
             modifyCount++;
             cachedDescendants[updateIt].insert(cit);
@@ -118,7 +126,7 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
             mapTx.modify(cit, update_ancestor_state(updateIt->GetTxSize(), updateIt->GetModifiedFee(), 1, updateIt->GetSigOpCost()));
         }
     }
-    mapTx.modify(updateIt, update_descendant_state(modifySize, modifyFee, modifyCount));
+    mapTx.modify(updateIt, update_descendant_state(modifySize, modifyUsage, modifyFee, modifyCount));
 }
 
 // vHashesToUpdate is the set of transaction hashes from a disconnected block
@@ -171,7 +179,10 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
 
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
 {
-    setEntries parentHashes;
+    // Ancestors found but not walked yet. Entries are marked visited as they
+    // are found, so each is staged once.
+    std::vector<txiter> stage;
+    const uint64_t epoch = NewEpoch();
     const CTransaction &tx = entry.GetTx();
 
     if (fSearchForParents) {
@@ -180,28 +191,44 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // iterate mapTx to find parents.
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             txiter piter = mapTx.find(tx.vin[i].prevout.hash);
-            if (piter != mapTx.end()) {
-                parentHashes.insert(piter);
-                if (parentHashes.size() + 1 > limitAncestorCount) {
+            if (piter != mapTx.end() && Visit(piter, epoch)) {
+                stage.push_back(piter);
+                if (stage.size() + 1 > limitAncestorCount) {
                     errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
                     return false;
                 }
+                // The ancestors of each parent are ancestors too, so the
+                // state the mempool keeps for it is enough to reject long
+                // chains without walking them.
+                if (piter->GetCountWithAncestors() + 1 > limitAncestorCount) {
+                    errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
+                    return false;
+                } else if (piter->GetSizeWithAncestors() + entry.GetTxSize() > limitAncestorSize) {
+                    errString = strprintf("exceeds ancestor size limit [limit: %u]", limitAncestorSize);
+                    return false;
+                }
             }
         }
     } else {
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
         txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        Visit(it, epoch);
+        BOOST_FOREACH(const txiter &piter, GetMemPoolParents(it)) {
+            Visit(piter, epoch);
+            stage.push_back(piter);
+        }
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
+    // Number of ancestors found so far, walked or not
+    size_t nAncestors = stage.size();
 
-    while (!parentHashes.empty()) {
-        txiter stageit = *parentHashes.begin();
+    while (!stage.empty()) {
+        txiter stageit = stage.back();
+        stage.pop_back();
 
         setAncestors.insert(stageit);
-        parentHashes.erase(stageit);
         totalSizeWithAncestors += stageit->GetTxSize();
 
         if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
@@ -218,10 +245,11 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
         BOOST_FOREACH(const txiter &phash, setMemPoolParents) {
             // If this is a new ancestor, add it.
-            if (setAncestors.count(phash) == 0) {
-                parentHashes.insert(phash);
+            if (Visit(phash, epoch)) {
+                stage.push_back(phash);
+                nAncestors++;
             }
-            if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
+            if (nAncestors + 1 > limitAncestorCount) {
                 errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
                 return false;
             }
@@ -240,9 +268,10 @@ void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors
     }
     const int64_t updateCount = (add ? 1 : -1);
     const int64_t updateSize = updateCount * it->GetTxSize();
+    const int64_t updateUsage = updateCount * (int64_t)it->DynamicMemoryUsage();
     const CAmount updateFee = updateCount * it->GetModifiedFee();
     BOOST_FOREACH(txiter ancestorIt, setAncestors) {
-        mapTx.modify(ancestorIt, update_descendant_state(updateSize, updateFee, updateCount));
+        mapTx.modify(ancestorIt, update_descendant_state(updateSize, updateUsage, updateFee, updateCount));
     }
 }
 
@@ -326,10 +355,12 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
     }
 }
 
-void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, int64_t modifyUsage, CAmount modifyFee, int64_t modifyCount)
 {
     nSizeWithDescendants += modifySize;
     assert(int64_t(nSizeWithDescendants) > 0);
+    nUsageWithDescendants += modifyUsage;
+    assert(int64_t(nUsageWithDescendants) > 0);
     nModFeesWithDescendants += modifyFee;
     nCountWithDescendants += modifyCount;
     assert(int64_t(nCountWithDescendants) > 0);
@@ -347,7 +378,7 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), nEpoch(0), nDeltaSequence(0)
 {
     _clear(); //lock free clear
 
@@ -449,11 +480,22 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     BOOST_FOREACH(const WithdrawPair& it, entry.setWithdrawsSpent)
         assert(mapWithdrawsSpentToTxid.insert(std::make_pair(it, hash)).second);
 
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        const CTxOut& txout = tx.vout[i];
+        if (txout.scriptPubKey.IsWithdrawLock() && txout.nValue.IsAmount())
+            mapWithdrawLocks[txout.scriptPubKey.GetWithdrawLockGenesisHash()].insert(std::make_pair(txout.nValue.GetAmount(), COutPoint(hash, i)));
+    }
+
+    NotifyEntryAdded(tx);
+    RecordDelta(true, *newit);
+
     return true;
 }
 
 void CTxMemPool::removeUnchecked(txiter it)
 {
+    NotifyEntryRemoved(it->GetTx());
+    RecordDelta(false, *it);
     const uint256 hash = it->GetTx().GetHash();
     BOOST_FOREACH(const CTxIn& txin, it->GetTx().vin)
         mapNextTx.erase(txin.prevout);
@@ -462,6 +504,18 @@ void CTxMemPool::removeUnchecked(txiter it)
     BOOST_FOREACH(const WithdrawPair& it2, it->setWithdrawsSpent)
         assert(mapWithdrawsSpentToTxid.erase(it2));
 
+    const CTransaction& tx = it->GetTx();
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        const CTxOut& txout = tx.vout[i];
+        if (!txout.scriptPubKey.IsWithdrawLock() || !txout.nValue.IsAmount())
+            continue;
+        std::map<uint256, std::set<std::pair<CAmount, COutPoint> > >::iterator itLocks = mapWithdrawLocks.find(txout.scriptPubKey.GetWithdrawLockGenesisHash());
+        assert(itLocks != mapWithdrawLocks.end());
+        assert(itLocks->second.erase(std::make_pair(txout.nValue.GetAmount(), COutPoint(hash, i))));
+        if (itLocks->second.empty())
+            mapWithdrawLocks.erase(itLocks);
+    }
+
     if (vTxHashes.size() > 1) {
         vTxHashes[it->vTxHashesIdx] = std::move(vTxHashes.back());
         vTxHashes[it->vTxHashesIdx].second->vTxHashesIdx = it->vTxHashesIdx;
@@ -488,22 +542,21 @@ void CTxMemPool::removeUnchecked(txiter it)
 // can save time by not iterating over those entries.
 void CTxMemPool::CalculateDescendants(txiter entryit, setEntries &setDescendants)
 {
-    setEntries stage;
-    if (setDescendants.count(entryit) == 0) {
-        stage.insert(entryit);
+    std::vector<txiter> stage;
+    if (setDescendants.insert(entryit).second) {
+        stage.push_back(entryit);
     }
     // Traverse down the children of entry, only adding children that are not
     // accounted for in setDescendants already (because those children have either
     // already been walked, or will be walked in this iteration).
     while (!stage.empty()) {
-        txiter it = *stage.begin();
-        setDescendants.insert(it);
-        stage.erase(it);
+        txiter it = stage.back();
+        stage.pop_back();
 
         const setEntries &setChildren = GetMemPoolChildren(it);
         BOOST_FOREACH(const txiter &childiter, setChildren) {
-            if (!setDescendants.count(childiter)) {
-                stage.insert(childiter);
+            if (setDescendants.insert(childiter).second) {
+                stage.push_back(childiter);
             }
         }
     }
@@ -600,22 +653,23 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
 /**
  * Called when a block is connected. Removes from mempool and updates the miner fee estimator.
  */
-void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight,
+void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigned int nBlockHeight,
                                 const std::set<std::pair<uint256, COutPoint> >& setWithdrawsSpent,
                                 std::list<CTransaction>& conflicts, bool fCurrentEstimate)
 {
     LOCK(cs);
     std::vector<CTxMemPoolEntry> entries;
-    BOOST_FOREACH(const CTransaction& tx, vtx)
+    BOOST_FOREACH(const CTransactionRef& ptx, vtx)
     {
-        uint256 hash = tx.GetHash();
+        uint256 hash = ptx->GetHash();
 
         indexed_transaction_set::iterator i = mapTx.find(hash);
         if (i != mapTx.end())
             entries.push_back(*i);
     }
-    BOOST_FOREACH(const CTransaction& tx, vtx)
+    BOOST_FOREACH(const CTransactionRef& ptx, vtx)
     {
+        const CTransaction& tx = *ptx;
         txiter it = mapTx.find(tx.GetHash());
         if (it != mapTx.end()) {
             setEntries stage;
@@ -646,12 +700,20 @@ void CTxMemPool::_clear()
     mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+    mapWithdrawLocks.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
+
+    // The entries go without a change recorded for each, so the changes
+    // kept so far no longer bring a copy of the mempool up to date.
+    boost::unique_lock<boost::mutex> lock(csDeltas);
+    nDeltaSequence++;
+    deltas.clear();
+    cvDeltas.notify_all();
 }
 
 void CTxMemPool::clear()
@@ -660,6 +722,46 @@ void CTxMemPool::clear()
     _clear();
 }
 
+void CTxMemPool::RecordDelta(bool fAdded, const CTxMemPoolEntry& entry)
+{
+    boost::unique_lock<boost::mutex> lock(csDeltas);
+    const CMempoolDelta delta(++nDeltaSequence, fAdded, entry);
+    deltas.push_back(delta);
+    if (deltas.size() > MEMPOOL_DELTAS_KEPT)
+        deltas.pop_front();
+    cvDeltas.notify_all();
+    lock.unlock();
+    NotifyDelta(delta);
+}
+
+bool CTxMemPool::GetDeltas(uint64_t nSequence, std::vector<CMempoolDelta>& vDeltas, uint64_t& nSequenceNow) const
+{
+    vDeltas.clear();
+    LOCK(cs);
+    boost::unique_lock<boost::mutex> lock(csDeltas);
+    nSequenceNow = nDeltaSequence;
+    if (nSequence == nDeltaSequence)
+        return true;
+    if (nSequence < nDeltaSequence && !deltas.empty() && deltas.front().nSequence <= nSequence + 1) {
+        vDeltas.assign(deltas.begin() + (nSequence + 1 - deltas.front().nSequence), deltas.end());
+        return true;
+    }
+    vDeltas.reserve(mapTx.size());
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); ++it)
+        vDeltas.push_back(CMempoolDelta(nDeltaSequence, true, *it));
+    return false;
+}
+
+bool CTxMemPool::WaitForDeltas(uint64_t nSequence, const boost::system_time& deadline) const
+{
+    boost::unique_lock<boost::mutex> lock(csDeltas);
+    while (nDeltaSequence == nSequence) {
+        if (!cvDeltas.timed_wait(lock, deadline))
+            return nDeltaSequence != nSequence;
+    }
+    return true;
+}
+
 void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 {
     if (nCheckFrequency == 0)
@@ -739,17 +841,20 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         CTxMemPool::setEntries setChildrenCheck;
         auto iter = mapNextTx.lower_bound(COutPoint(it->GetTx().GetHash(), 0));
         int64_t childSizes = 0;
+        uint64_t childUsage = 0;
         for (; iter != mapNextTx.end() && iter->first->hash == it->GetTx().GetHash(); ++iter) {
             txiter childit = mapTx.find(iter->second->GetHash());
             assert(childit != mapTx.end()); // mapNextTx points to in-mempool transactions
             if (setChildrenCheck.insert(childit).second) {
                 childSizes += childit->GetTxSize();
+                childUsage += childit->DynamicMemoryUsage();
             }
         }
         assert(setChildrenCheck == GetMemPoolChildren(it));
         // Also check to make sure size is greater than sum with immediate children.
         // just a sanity check, not definitive that this calc is correct...
         assert(it->GetSizeWithDescendants() >= childSizes + it->GetTxSize());
+        assert(it->GetUsageWithDescendants() >= childUsage + it->DynamicMemoryUsage());
 
         if (fDependsWait)
             waitingOnDependants.push_back(&(*it));
@@ -802,6 +907,17 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     }
     assert(setGlobalWithdrawsSpent.size() == 0);
 
+    for (std::map<uint256, std::set<std::pair<CAmount, COutPoint> > >::const_iterator it = mapWithdrawLocks.begin(); it != mapWithdrawLocks.end(); it++) {
+        assert(!it->second.empty());
+        for (std::set<std::pair<CAmount, COutPoint> >::const_iterator it2 = it->second.begin(); it2 != it->second.end(); it2++) {
+            indexed_transaction_set::const_iterator it3 = mapTx.find(it2->second.hash);
+            assert(it3 != mapTx.end());
+            const CTxOut& txout = it3->GetTx().vout[it2->second.n];
+            assert(txout.scriptPubKey.IsWithdrawLock() && txout.scriptPubKey.GetWithdrawLockGenesisHash() == it->first);
+            assert(txout.nValue.IsAmount() && txout.nValue.GetAmount() == it2->first);
+        }
+    }
+
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
 }
@@ -878,6 +994,28 @@ std::vector<TxMempoolInfo> CTxMemPool::infoAll() const
     return ret;
 }
 
+std::vector<TxMempoolInfo> CTxMemPool::infoSorted(const std::vector<uint256>& vHashes) const
+{
+    LOCK(cs);
+    std::vector<indexed_transaction_set::const_iterator> iters;
+    iters.reserve(vHashes.size());
+    for (const uint256& hash : vHashes) {
+        indexed_transaction_set::const_iterator i = mapTx.find(hash);
+        if (i != mapTx.end())
+            iters.push_back(i);
+    }
+    // Only entries of the same transaction compare equal, so repeats end up next to each other.
+    std::sort(iters.begin(), iters.end(), DepthAndScoreComparator());
+    iters.erase(std::unique(iters.begin(), iters.end()), iters.end());
+
+    std::vector<TxMempoolInfo> ret;
+    ret.reserve(iters.size());
+    for (auto it : iters) {
+        ret.push_back(TxMempoolInfo{it->GetSharedTx(), it->GetTime(), CFeeRate(it->GetFee(), it->GetTxSize())});
+    }
+    return ret;
+}
+
 std::shared_ptr<const CTransaction> CTxMemPool::get(const uint256& hash) const
 {
     LOCK(cs);
@@ -968,9 +1106,10 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
             std::string dummy;
             CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
             BOOST_FOREACH(txiter ancestorIt, setAncestors) {
-                mapTx.modify(ancestorIt, update_descendant_state(0, nFeeDelta, 0));
+                mapTx.modify(ancestorIt, update_descendant_state(0, 0, nFeeDelta, 0));
             }
         }
+        ++nTransactionsUpdated;
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -1008,7 +1147,8 @@ bool CCoinsViewMemPool::GetCoins(const uint256 &txid, CCoins &coins) const {
     // transactions. First checking the underlying cache risks returning a pruned entry instead.
     shared_ptr<const CTransaction> ptx = mempool.get(txid);
     if (ptx) {
-        coins = CCoins(*ptx, MEMPOOL_HEIGHT);
+        // In place, so that the caller's outputs are reused
+        coins.FromTx(*ptx, MEMPOOL_HEIGHT);
         return true;
     }
     return (base->GetCoins(txid, coins) && !coins.IsPruned());
@@ -1022,10 +1162,58 @@ bool CCoinsViewMemPool::IsWithdrawSpent(const std::pair<uint256, COutPoint> &out
     return mempool.mapWithdrawsSpentToTxid.count(outpoint) || base->IsWithdrawSpent(outpoint);
 }
 
+CCoinsViewMemPoolOverlay::CCoinsViewMemPoolOverlay(CCoinsViewCache* tipIn, const CTxMemPool& mempoolIn) :
+    CCoinsViewCache(&viewDummy), tip(tipIn), mempool(&mempoolIn), viewMemPool(tipIn, mempoolIn)
+{
+    SetBackend(viewMemPool);
+}
+
+const CCoins* CCoinsViewMemPoolOverlay::AccessCoins(const uint256 &txid) const {
+    for (size_t i = 0; i < vCoinsFound.size(); i++) {
+        if (vCoinsFound[i].first == txid)
+            return vCoinsFound[i].second;
+    }
+    if (!tip)
+        return NULL;
+    // As CCoinsViewMemPool::GetCoins, the mempool comes first and pruned
+    // entries of tip are not found.
+    const CCoins* coins = NULL;
+    shared_ptr<const CTransaction> ptx = mempool->get(txid);
+    if (ptx) {
+        dequeMemPoolCoins.emplace_back(*ptx, MEMPOOL_HEIGHT);
+        coins = &dequeMemPoolCoins.back();
+    } else {
+        coins = tip->AccessCoins(txid);
+        if (!coins || coins->IsPruned())
+            return NULL;
+    }
+    vCoinsFound.push_back(std::make_pair(txid, coins));
+    return coins;
+}
+
+bool CCoinsViewMemPoolOverlay::GetCoins(const uint256 &txid, CCoins &coins) const {
+    const CCoins* pcoins = AccessCoins(txid);
+    if (!pcoins)
+        return false;
+    coins = *pcoins;
+    return true;
+}
+
+bool CCoinsViewMemPoolOverlay::HaveCoins(const uint256 &txid) const {
+    const CCoins* coins = AccessCoins(txid);
+    return coins && !coins->vout.empty();
+}
+
+void CCoinsViewMemPoolOverlay::Detach() {
+    SetBackend(viewDummy);
+    tip = NULL;
+    mempool = NULL;
+}
+
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + memusage::DynamicUsage(mapWithdrawsSpentToTxid) + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants) {
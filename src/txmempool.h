@@ -6,6 +6,7 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <deque>
 #include <list>
 #include <memory>
 #include <set>
@@ -21,6 +22,8 @@
 #include "boost/multi_index/ordered_index.hpp"
 #include "boost/multi_index/hashed_index.hpp"
 
+#include <boost/signals2/signal.hpp>
+
 class CAutoFile;
 class CBlockIndex;
 
@@ -63,8 +66,8 @@ class CTxMemPool;
  * ("descendant" transactions).
  *
  * When a new entry is added to the mempool, we update the descendant state
- * (nCountWithDescendants, nSizeWithDescendants, and nModFeesWithDescendants) for
- * all ancestors of the newly added transaction.
+ * (nCountWithDescendants, nSizeWithDescendants, nUsageWithDescendants and
+ * nModFeesWithDescendants) for all ancestors of the newly added transaction.
  *
  * If updating the descendant state is skipped, we can mark the entry as
  * "dirty", and set nSizeWithDescendants/nModFeesWithDescendants to equal nTxSize/
@@ -80,7 +83,7 @@ private:
     CAmount nFee;              //!< Cached to avoid expensive parent-transaction lookups
     size_t nTxWeight;          //!< ... and avoid recomputing tx weight (also used for GetTxSize())
     size_t nModSize;           //!< ... and modified size for priority
-    size_t nUsageSize;         //!< ... and total memory usage
+    size_t nUsageSize;         //!< ... and total memory usage, including range proofs and witnesses
     int64_t nTime;             //!< Local time when entering the mempool
     double entryPriority;      //!< Priority when entering the mempool
     unsigned int entryHeight;  //!< Chain height when entering the mempool
@@ -90,6 +93,7 @@ private:
     int64_t sigOpCost;         //!< Total sigop cost
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
+    unsigned int nValidatedFlags; //!< Script flags all input checks passed under, 0 if not fully validated
 
     // Information about descendants of this transaction that are in the
     // mempool; if we remove this transaction we must remove all of these
@@ -98,6 +102,7 @@ private:
     // correct.
     uint64_t nCountWithDescendants;  //!< number of descendant transactions
     uint64_t nSizeWithDescendants;   //!< ... and size
+    uint64_t nUsageWithDescendants;  //!< ... and memory usage
     CAmount nModFeesWithDescendants; //!< ... and total fees (all including us)
 
     // Analogous statistics for ancestor transactions
@@ -132,9 +137,11 @@ public:
     int64_t GetModifiedFee() const { return nFee + feeDelta; }
     size_t DynamicMemoryUsage() const { return nUsageSize; }
     const LockPoints& GetLockPoints() const { return lockPoints; }
+    unsigned int GetValidatedFlags() const { return nValidatedFlags; }
+    void SetValidatedFlags(unsigned int flags) { nValidatedFlags = flags; }
 
     // Adjusts the descendant state, if this entry is not dirty.
-    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    void UpdateDescendantState(int64_t modifySize, int64_t modifyUsage, CAmount modifyFee, int64_t modifyCount);
     // Adjusts the ancestor state
     void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int modifySigOps);
     // Updates the fee delta used for mining priority score, and the
@@ -145,6 +152,7 @@ public:
 
     uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
     uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    uint64_t GetUsageWithDescendants() const { return nUsageWithDescendants; }
     CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
 
     bool GetSpendsCoinbase() const { return spendsCoinbase; }
@@ -155,20 +163,22 @@ public:
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint64_t nVisitedEpoch; //!< Last mempool walk (CTxMemPool::NewEpoch) that reached this entry
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
 struct update_descendant_state
 {
-    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
-        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    update_descendant_state(int64_t _modifySize, int64_t _modifyUsage, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyUsage(_modifyUsage), modifyFee(_modifyFee), modifyCount(_modifyCount)
     {}
 
     void operator() (CTxMemPoolEntry &e)
-        { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
+        { e.UpdateDescendantState(modifySize, modifyUsage, modifyFee, modifyCount); }
 
     private:
         int64_t modifySize;
+        int64_t modifyUsage;
         CAmount modifyFee;
         int64_t modifyCount;
 };
@@ -221,7 +231,10 @@ struct mempoolentry_txid
 
 /** \class CompareTxMemPoolEntryByDescendantScore
  *
- *  Sort an entry by max(score/size of entry's tx, score/size with all descendants).
+ *  Sort an entry by max(score/usage of entry's tx, score/usage with all descendants),
+ *  where usage is the memory the transactions take up in the mempool. This is
+ *  the order TrimToSize() evicts in, so that a transaction carrying large range
+ *  proofs pays for the memory it uses rather than only for its virtual size.
  */
 class CompareTxMemPoolEntryByDescendantScore
 {
@@ -232,10 +245,10 @@ public:
         bool fUseBDescendants = UseDescendantScore(b);
 
         double aModFee = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
-        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+        double aSize = fUseADescendants ? a.GetUsageWithDescendants() : a.DynamicMemoryUsage();
 
         double bModFee = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
-        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+        double bSize = fUseBDescendants ? b.GetUsageWithDescendants() : b.DynamicMemoryUsage();
 
         // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
         double f1 = aModFee * bSize;
@@ -250,8 +263,8 @@ public:
     // Calculate which score to use for an entry (avoiding division).
     bool UseDescendantScore(const CTxMemPoolEntry &a)
     {
-        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
-        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        double f1 = (double)a.GetModifiedFee() * a.GetUsageWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.DynamicMemoryUsage();
         return f2 > f1;
     }
 };
@@ -329,6 +342,29 @@ struct TxMempoolInfo
     CFeeRate feeRate;
 };
 
+/**
+ * A transaction entering or leaving the mempool, as reported by
+ * CTxMemPool::GetDeltas.
+ */
+struct CMempoolDelta
+{
+    /** Position of the change among all changes to the mempool since startup, from 1 */
+    uint64_t nSequence;
+    /** Whether the transaction was added, or else removed */
+    bool fAdded;
+    uint256 txid;
+    uint256 wtxid;
+    CAmount nFee;
+    /** Virtual size of the transaction */
+    size_t nSize;
+
+    CMempoolDelta(uint64_t nSequenceIn, bool fAddedIn, const CTxMemPoolEntry& entry) :
+        nSequence(nSequenceIn), fAdded(fAddedIn), txid(entry.GetTx().GetHash()), wtxid(entry.GetTx().GetWitnessHash()), nFee(entry.GetFee()), nSize(entry.GetTxSize()) {}
+};
+
+/** Number of the most recent changes to the mempool kept for GetDeltas */
+static const size_t MEMPOOL_DELTAS_KEPT = 100000;
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -421,6 +457,14 @@ private:
     mutable int64_t lastRollingFeeUpdate;
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
+    mutable uint64_t nEpoch; //!< counter of walks over the mempool graph, see NewEpoch
+
+    mutable CWaitableCriticalSection csDeltas; //!< guards nDeltaSequence and deltas; taken after cs
+    mutable CConditionVariable cvDeltas; //!< notified when nDeltaSequence changes
+    uint64_t nDeltaSequence; //!< sequence of the last change to mapTx
+    std::deque<CMempoolDelta> deltas; //!< the last MEMPOOL_DELTAS_KEPT changes to mapTx, oldest first
+
+    void RecordDelta(bool fAdded, const CTxMemPoolEntry& entry);
 
     void trackPackageRemoved(const CFeeRate& rate);
 
@@ -477,6 +521,8 @@ public:
     const setEntries & GetMemPoolChildren(txiter entry) const;
 
     std::map<std::pair<uint256, COutPoint>, uint256> mapWithdrawsSpentToTxid;
+    /** Withdraw lock outputs created by mempool transactions, by genesis hash and sorted by amount */
+    std::map<uint256, std::set<std::pair<CAmount, COutPoint> > > mapWithdrawLocks;
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
@@ -524,7 +570,7 @@ public:
     void removeRecursive(const CTransaction &tx, std::list<CTransaction>& removed);
     void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags);
     void removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed);
-    void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight,
+    void removeForBlock(const std::vector<CTransactionRef>& vtx, unsigned int nBlockHeight,
                         const std::set<std::pair<uint256, COutPoint> >& setWithdrawsSpent,
                         std::list<CTransaction>& conflicts, bool fCurrentEstimate = true);
     void clear();
@@ -621,6 +667,8 @@ public:
     std::shared_ptr<const CTransaction> get(const uint256& hash) const;
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
+    /** Info of those of vHashes in the mempool, once each and in the order of infoAll. */
+    std::vector<TxMempoolInfo> infoSorted(const std::vector<uint256>& vHashes) const;
 
     /** Estimate fee rate needed to get into the next nBlocks
      *  If no answer can be given at nBlocks, return an estimate
@@ -646,6 +694,23 @@ public:
 
     size_t DynamicMemoryUsage() const;
 
+    /**
+     * The changes to the mempool after nSequence, oldest first, and the
+     * sequence of the last change to it. If the changes after nSequence are
+     * no longer all kept, returns false and the whole mempool as added at
+     * nSequenceNow instead, which the caller has to replace its copy with.
+     */
+    bool GetDeltas(uint64_t nSequence, std::vector<CMempoolDelta>& vDeltas, uint64_t& nSequenceNow) const;
+    /** Wait until the mempool changed after nSequence, or until deadline; false on timeout */
+    bool WaitForDeltas(uint64_t nSequence, const boost::system_time& deadline) const;
+
+    /** Fired, with cs held, after a transaction was added to mapTx */
+    boost::signals2::signal<void (const CTransaction &)> NotifyEntryAdded;
+    /** Fired, with cs held, before a transaction is removed from mapTx */
+    boost::signals2::signal<void (const CTransaction &)> NotifyEntryRemoved;
+    /** Fired, with cs held, for each change recorded for GetDeltas */
+    boost::signals2::signal<void (const CMempoolDelta &)> NotifyDelta;
+
 private:
     /** UpdateForDescendants is used by UpdateTransactionsFromBlock to update
      *  the descendants for a single transaction that has been added to the
@@ -674,6 +739,19 @@ private:
     /** Sever link between specified transaction and direct children. */
     void UpdateChildrenForRemoval(txiter entry);
 
+    /** Start a walk over the mempool graph, in which each entry can be marked
+     *  visited once with Visit, so that no set of the entries seen has to be
+     *  kept. Walks must not be nested. */
+    uint64_t NewEpoch() const { return ++nEpoch; }
+    /** Mark it visited in the walk of epoch; false if it already was */
+    static bool Visit(txiter it, uint64_t epoch)
+    {
+        if (it->nVisitedEpoch == epoch)
+            return false;
+        it->nVisitedEpoch = epoch;
+        return true;
+    }
+
     /** Before calling removeUnchecked for a given transaction,
      *  UpdateForRemoveFromMempool must be called on the entire (dependent) set
      *  of transactions being removed at the same time.  We use each
@@ -701,6 +779,35 @@ public:
     bool IsWithdrawSpent(const std::pair<uint256, COutPoint> &outpoint) const;
 };
 
+/**
+ * A read-only CCoinsViewCache over a CCoinsViewMemPool that does not copy the
+ * coins it looks up: coins of confirmed transactions are referenced where
+ * they are in the cache of tip, which must keep them while the overlay is
+ * used, and only those of mempool transactions are built. Look-ups need
+ * mempool.cs until Detach(), after which only coins that were found before
+ * are, as with a CCoinsViewCache switched to a dummy backend.
+ */
+class CCoinsViewMemPoolOverlay : public CCoinsViewCache
+{
+private:
+    const CCoinsViewCache* tip;
+    const CTxMemPool* mempool;
+    CCoinsView viewDummy;
+    CCoinsViewMemPool viewMemPool;
+    //! Coins found so far; a transaction has few enough inputs to search them in order
+    mutable std::vector<std::pair<uint256, const CCoins*> > vCoinsFound;
+    //! Coins built for mempool transactions, which vCoinsFound points into
+    mutable std::deque<CCoins> dequeMemPoolCoins;
+
+public:
+    CCoinsViewMemPoolOverlay(CCoinsViewCache* tipIn, const CTxMemPool& mempoolIn);
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    const CCoins* AccessCoins(const uint256 &txid) const;
+    //! Stop looking up coins in tip and the mempool
+    void Detach();
+};
+
 // We want to sort transactions by coin age priority
 typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
 
@@ -0,0 +1,146 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txreconciliation.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <deque>
+
+/** Seeds of the cell hashes, one per part of the table, and of the check hash */
+static const uint32_t SKETCH_SEEDS[CReconSketch::RECON_SKETCH_HASHES] = {0x8f1bbcdc, 0x5a827999, 0x6ed9eba1};
+static const uint32_t SKETCH_CHECK_SEED = 0xca62c1d6;
+
+static inline uint32_t MixShortId(uint32_t nShortId, uint32_t nSeed)
+{
+    // The finalizer of MurmurHash3
+    uint32_t h = nShortId ^ nSeed;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+size_t CReconSketch::CellsForCapacity(size_t nCapacity)
+{
+    // Large tables peel with about 1.25 cells per element, small ones need
+    // more; the margin over that keeps failures, which cost a round of
+    // flooding, to a few percent at any size.
+    return RECON_SKETCH_HASHES * ((nCapacity * 2 + 12) / RECON_SKETCH_HASHES);
+}
+
+bool CReconSketch::IsValid() const
+{
+    return !vCells.empty() && vCells.size() % RECON_SKETCH_HASHES == 0 && vCells.size() <= MAX_TXRECON_SKETCH_CELLS;
+}
+
+size_t CReconSketch::GetCell(uint32_t nShortId, unsigned int nHash) const
+{
+    const size_t nPartCells = vCells.size() / RECON_SKETCH_HASHES;
+    return nHash * nPartCells + (((uint64_t)MixShortId(nShortId, SKETCH_SEEDS[nHash]) * nPartCells) >> 32);
+}
+
+void CReconSketch::Update(uint32_t nShortId, int32_t nDelta)
+{
+    if (vCells.size() < RECON_SKETCH_HASHES)
+        return;
+    const uint32_t nHash = MixShortId(nShortId, SKETCH_CHECK_SEED);
+    for (unsigned int i = 0; i < RECON_SKETCH_HASHES; i++) {
+        Cell& cell = vCells[GetCell(nShortId, i)];
+        cell.nCount += nDelta;
+        cell.nIdSum ^= nShortId;
+        cell.nHashSum ^= nHash;
+    }
+}
+
+bool CReconSketch::Subtract(const CReconSketch& other)
+{
+    if (other.vCells.size() != vCells.size())
+        return false;
+    for (size_t i = 0; i < vCells.size(); i++) {
+        vCells[i].nCount -= other.vCells[i].nCount;
+        vCells[i].nIdSum ^= other.vCells[i].nIdSum;
+        vCells[i].nHashSum ^= other.vCells[i].nHashSum;
+    }
+    return true;
+}
+
+bool CReconSketch::Decode(std::vector<uint32_t>& vPositive, std::vector<uint32_t>& vNegative) const
+{
+    CReconSketch sketch(*this);
+    std::vector<Cell>& vWork = sketch.vCells;
+    vPositive.clear();
+    vNegative.clear();
+
+    std::deque<size_t> dequePure;
+    for (size_t i = 0; i < vWork.size(); i++)
+        dequePure.push_back(i);
+    // Every short id peeled off empties a cell, so a sketch that keeps
+    // yielding more than it has cells was not made of sets.
+    while (!dequePure.empty() && vPositive.size() + vNegative.size() <= vWork.size()) {
+        const Cell& cell = vWork[dequePure.front()];
+        dequePure.pop_front();
+        if ((cell.nCount != 1 && cell.nCount != -1) || cell.nHashSum != MixShortId(cell.nIdSum, SKETCH_CHECK_SEED))
+            continue;
+        const uint32_t nShortId = cell.nIdSum;
+        const int32_t nCount = cell.nCount;
+        (nCount == 1 ? vPositive : vNegative).push_back(nShortId);
+        sketch.Update(nShortId, -nCount);
+        for (unsigned int i = 0; i < RECON_SKETCH_HASHES; i++)
+            dequePure.push_back(sketch.GetCell(nShortId, i));
+    }
+
+    for (size_t i = 0; i < vWork.size(); i++) {
+        if (vWork[i].nCount != 0 || vWork[i].nIdSum != 0 || vWork[i].nHashSum != 0)
+            return false;
+    }
+    return true;
+}
+
+CTxReconState::CTxReconState(bool fInitiatorIn, uint64_t nLocalSalt, uint64_t nRemoteSalt) :
+    fInitiator(fInitiatorIn), fAwaitingSketch(false), nNextRequest(0)
+{
+    // Both sides derive the same keys, whichever salt is whose.
+    static const std::string strTag = "Tx Relay Salting";
+    unsigned char vchSalts[16];
+    WriteLE64(vchSalts, std::min(nLocalSalt, nRemoteSalt));
+    WriteLE64(vchSalts + 8, std::max(nLocalSalt, nRemoteSalt));
+    unsigned char vchKey[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write((const unsigned char*)strTag.data(), strTag.size()).Write(vchSalts, sizeof(vchSalts)).Finalize(vchKey);
+    k0 = ReadLE64(vchKey);
+    k1 = ReadLE64(vchKey + 8);
+}
+
+uint32_t CTxReconState::GetShortId(const uint256& txid) const
+{
+    return (uint32_t)SipHashUint256(k0, k1, txid);
+}
+
+bool CTxReconState::Add(const CTransactionRef& tx)
+{
+    if (mapSet.size() >= MAX_TXRECON_SET_SIZE)
+        return false;
+    std::pair<std::map<uint32_t, CTransactionRef>::iterator, bool> ret = mapSet.insert(std::make_pair(GetShortId(tx->GetHash()), tx));
+    return ret.second || ret.first->second->GetHash() == tx->GetHash();
+}
+
+CReconSketch CTxReconState::GetSketch(size_t nCells) const
+{
+    CReconSketch sketch(nCells);
+    for (std::map<uint32_t, CTransactionRef>::const_iterator it = mapSet.begin(); it != mapSet.end(); it++)
+        sketch.Add(it->first);
+    return sketch;
+}
+
+size_t CTxReconState::EstimateDifference(size_t nRemoteSize) const
+{
+    // Most of the smaller set is usually in the larger one as well.
+    const size_t nLocalSize = mapSet.size();
+    return std::max(nLocalSize, nRemoteSize) - std::min(nLocalSize, nRemoteSize) + std::min(nLocalSize, nRemoteSize) / 4 + 1;
+}
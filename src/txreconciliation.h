@@ -0,0 +1,130 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXRECONCILIATION_H
+#define BITCOIN_TXRECONCILIATION_H
+
+#include "primitives/transaction.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+/** Version of the reconciliation protocol sent in "sendrecon" */
+static const uint32_t TXRECON_VERSION = 1;
+/** Transactions waiting to be reconciled with a peer, past which they are flooded to it instead */
+static const size_t MAX_TXRECON_SET_SIZE = 4000;
+/** Cells in the largest sketch sent or accepted */
+static const size_t MAX_TXRECON_SKETCH_CELLS = 3 * 4000;
+/** Average delay between reconciliation requests to a peer, in seconds */
+static const unsigned int TXRECON_REQUEST_INTERVAL = 4;
+
+/**
+ * An invertible Bloom lookup table over the 32-bit short ids of a set of
+ * transactions. Subtracting the sketch of one set from that of another with
+ * the same number of cells leaves a sketch of their symmetric difference,
+ * which can be decoded as long as it is not much larger than the capacity
+ * the sketch was made for. Each short id goes into one cell of each of
+ * RECON_SKETCH_HASHES equal parts of the table.
+ */
+class CReconSketch
+{
+public:
+    static const unsigned int RECON_SKETCH_HASHES = 3;
+
+private:
+    struct Cell
+    {
+        int32_t nCount;
+        uint32_t nIdSum;   //!< XOR of the short ids
+        uint32_t nHashSum; //!< XOR of their check hashes
+
+        Cell() : nCount(0), nIdSum(0), nHashSum(0) {}
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+            READWRITE(nCount);
+            READWRITE(nIdSum);
+            READWRITE(nHashSum);
+        }
+    };
+
+    std::vector<Cell> vCells;
+
+    void Update(uint32_t nShortId, int32_t nDelta);
+    size_t GetCell(uint32_t nShortId, unsigned int nHash) const;
+
+public:
+    CReconSketch() {}
+    explicit CReconSketch(size_t nCells) : vCells(nCells) {}
+
+    //! The number of cells to decode a difference of nCapacity short ids with
+    static size_t CellsForCapacity(size_t nCapacity);
+
+    size_t GetCells() const { return vCells.size(); }
+    //! Whether the table splits into its parts and is no larger than MAX_TXRECON_SKETCH_CELLS
+    bool IsValid() const;
+
+    void Add(uint32_t nShortId) { Update(nShortId, 1); }
+    //! Subtract a sketch of as many cells, leaving the difference of the sets
+    bool Subtract(const CReconSketch& other);
+    /**
+     * Recover the difference a subtracted sketch holds: the short ids of the
+     * set it was subtracted from in vPositive, those of the other in
+     * vNegative. Returns false if it is too large to decode.
+     */
+    bool Decode(std::vector<uint32_t>& vPositive, std::vector<uint32_t>& vNegative) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(vCells);
+    }
+};
+
+/**
+ * Transaction reconciliation with one peer. Rather than announcing each
+ * transaction with an inv, both sides collect the transactions they would
+ * have announced. Periodically the side that made the connection (the
+ * initiator) sends "reqrecon" with the size of its set; the other side
+ * answers with a "sketch" of its own and moves its set aside. The initiator
+ * subtracts its sketch from that, announces the transactions only it has,
+ * and asks for those only the peer has in "reconcildiff", which the peer
+ * then announces. If the difference does not decode, both sides announce
+ * everything they had instead.
+ */
+class CTxReconState
+{
+public:
+    //! Whether we made the connection and so send the requests
+    const bool fInitiator;
+    //! Whether a request was sent and its sketch has not arrived
+    bool fAwaitingSketch;
+    //! When to send the next request, in microseconds
+    int64_t nNextRequest;
+    //! Transactions we have not reconciled with the peer yet, by short id
+    std::map<uint32_t, CTransactionRef> mapSet;
+    //! Transactions the last sketch sent was made of, until its "reconcildiff" arrives
+    std::map<uint32_t, CTransactionRef> mapSketched;
+
+private:
+    uint64_t k0, k1;
+
+public:
+    CTxReconState(bool fInitiatorIn, uint64_t nLocalSalt, uint64_t nRemoteSalt);
+
+    uint32_t GetShortId(const uint256& txid) const;
+    //! Add a transaction to announce; false if the set is full or another one has its short id
+    bool Add(const CTransactionRef& tx);
+    CReconSketch GetSketch(size_t nCells) const;
+    //! The capacity a sketch of our set needs, with the peer's set of nRemoteSize
+    size_t EstimateDifference(size_t nRemoteSize) const;
+};
+
+#endif // BITCOIN_TXRECONCILIATION_H
@@ -114,8 +114,6 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     case '8':
     case '9': {
         // part 1: int
-        string numStr;
-
         const char *first = raw;
 
         const char *firstDigit = first;
@@ -124,49 +122,39 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
         if ((*firstDigit == '0') && json_isdigit(firstDigit[1]))
             return JTOK_ERR;
 
-        numStr += *raw;                       // copy first char
-        raw++;
+        raw++;                                // skip first char
 
         if ((*first == '-') && (!json_isdigit(*raw)))
             return JTOK_ERR;
 
-        while ((*raw) && json_isdigit(*raw)) {     // copy digits
-            numStr += *raw;
+        while ((*raw) && json_isdigit(*raw))  // skip digits
             raw++;
-        }
 
         // part 2: frac
         if (*raw == '.') {
-            numStr += *raw;                   // copy .
-            raw++;
+            raw++;                            // skip .
 
             if (!json_isdigit(*raw))
                 return JTOK_ERR;
-            while ((*raw) && json_isdigit(*raw)) { // copy digits
-                numStr += *raw;
+            while ((*raw) && json_isdigit(*raw)) // skip digits
                 raw++;
-            }
         }
 
         // part 3: exp
         if (*raw == 'e' || *raw == 'E') {
-            numStr += *raw;                   // copy E
-            raw++;
+            raw++;                            // skip E
 
-            if (*raw == '-' || *raw == '+') { // copy +/-
-                numStr += *raw;
+            if (*raw == '-' || *raw == '+')   // skip +/-
                 raw++;
-            }
 
             if (!json_isdigit(*raw))
                 return JTOK_ERR;
-            while ((*raw) && json_isdigit(*raw)) { // copy digits
-                numStr += *raw;
+            while ((*raw) && json_isdigit(*raw)) // skip digits
                 raw++;
-            }
         }
 
-        tokenVal = numStr;
+        // the number is copied as written, in one go
+        tokenVal.assign(first, raw);
         consumed = (raw - rawStart);
         return JTOK_NUMBER;
         }
@@ -174,7 +162,20 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     case '"': {
         raw++;                                // skip "
 
-        string valStr;
+        // fast path: 7-bit ASCII without escapes is copied as is, in one go
+        const char *first = raw;
+        while (((unsigned char)*raw >= 0x20) && ((unsigned char)*raw < 0x80) &&
+               (*raw != '\\') && (*raw != '"'))
+            raw++;
+        if (*raw == '"') {
+            tokenVal.assign(first, raw);
+            raw++;                            // skip "
+            consumed = (raw - rawStart);
+            return JTOK_STRING;
+        }
+
+        // otherwise decode the rest of the string from where that stopped
+        string valStr(first, raw);
         JSONUTF8StringFilter writer(valStr);
 
         while (*raw) {
@@ -224,7 +225,7 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
 
         if (!writer.finalize())
             return JTOK_ERR;
-        tokenVal = valStr;
+        tokenVal.swap(valStr);
         consumed = (raw - rawStart);
         return JTOK_STRING;
         }
@@ -312,9 +313,9 @@ bool UniValue::read(const char *raw)
                     setArray();
                 stack.push_back(this);
             } else {
-                UniValue tmpVal(utyp);
+                // values are built in place, rather than copied in when done
                 UniValue *top = stack.back();
-                top->values.push_back(tmpVal);
+                top->values.push_back(UniValue(utyp));
 
                 UniValue *newTop = &(top->values.back());
                 stack.push_back(newTop);
@@ -399,9 +400,9 @@ bool UniValue::read(const char *raw)
             if (!stack.size())
                 return false;
 
-            UniValue tmpVal(VNUM, tokenVal);
             UniValue *top = stack.back();
-            top->values.push_back(tmpVal);
+            top->values.push_back(UniValue(VNUM));
+            top->values.back().val.swap(tokenVal);
 
             setExpect(NOT_VALUE);
             break;
@@ -414,12 +415,13 @@ bool UniValue::read(const char *raw)
             UniValue *top = stack.back();
 
             if (expect(OBJ_NAME)) {
-                top->keys.push_back(tokenVal);
+                top->keys.push_back(string());
+                top->keys.back().swap(tokenVal);
                 clearExpect(OBJ_NAME);
                 setExpect(COLON);
             } else {
-                UniValue tmpVal(VSTR, tokenVal);
-                top->values.push_back(tmpVal);
+                top->values.push_back(UniValue(VSTR));
+                top->values.back().val.swap(tokenVal);
             }
 
             setExpect(NOT_VALUE);
@@ -81,6 +81,7 @@
 #include <boost/foreach.hpp>
 #include <boost/program_options/detail/config_file.hpp>
 #include <boost/program_options/parsers.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include <openssl/crypto.h>
 #include <openssl/rand.h>
@@ -205,6 +206,53 @@ static int FileWriteStr(const std::string &str, FILE *fp)
     return fwrite(str.data(), 1, str.size(), fp);
 }
 
+namespace {
+
+/**
+ * The messages one thread has logged while the log writer runs. Only that
+ * thread adds to it and only the writer takes from it, so the two share
+ * nothing but a pair of counters. When it is full, messages are dropped, and
+ * the writer says how many.
+ */
+struct CLogBuffer
+{
+    struct Entry
+    {
+        uint64_t nSequence;
+        std::string str;
+    };
+
+    std::vector<Entry> vEntries;
+    //! Entries ever added, by the owning thread
+    std::atomic<uint64_t> nAdded;
+    //! Entries ever taken, by the writer
+    std::atomic<uint64_t> nTaken;
+    std::atomic<uint64_t> nDropped;
+    std::atomic<bool> fThreadExited;
+    //! For LogTimestampStr; only used by the owning thread
+    bool fStartedNewLine;
+
+    CLogBuffer() : vEntries(LOG_BUFFER_MESSAGES), nAdded(0), nTaken(0), nDropped(0), fThreadExited(false), fStartedNewLine(true) {}
+};
+
+boost::mutex csLogBuffers;
+std::vector<boost::shared_ptr<CLogBuffer> > vLogBuffers;
+//! Orders the messages of different threads
+std::atomic<uint64_t> nLogSequence(0);
+std::atomic<bool> fLogWriterRunning(false);
+std::atomic<bool> fStopLogWriter(false);
+uint64_t nLogMessagesDropped = 0;
+boost::thread* pthreadLogWriter = NULL;
+
+void ReleaseLogBuffer(boost::shared_ptr<CLogBuffer>* pbuffer)
+{
+    // The writer still empties it, and then lets it go.
+    (*pbuffer)->fThreadExited = true;
+    delete pbuffer;
+}
+
+}
+
 static void DebugPrintInit()
 {
     assert(mutexDebugLog == NULL);
@@ -320,8 +368,144 @@ static std::string LogTimestampStr(const std::string &str, bool *fStartedNewLine
     return strStamped;
 }
 
+/** Write timestamped debug output to the log file, with mutexDebugLog held */
+static int WriteDebugLogFile(const std::string &strTimestamped)
+{
+    // buffer if we haven't opened the log yet
+    if (fileout_debug == NULL) {
+        assert(vMsgsBeforeOpenDebugLog);
+        vMsgsBeforeOpenDebugLog->push_back(strTimestamped);
+        return strTimestamped.length();
+    }
+
+    // reopen the log file, if requested
+    if (fReopenDebugLog) {
+        fReopenDebugLog = false;
+        boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+        if (freopen(pathDebug.string().c_str(),"a",fileout_debug) != NULL)
+            setbuf(fileout_debug, NULL); // unbuffered
+    }
+
+    return FileWriteStr(strTimestamped, fileout_debug);
+}
+
+/** Add str to the calling thread's log buffer, for the log writer */
+static int QueueDebugLogStr(const std::string &str)
+{
+    static boost::thread_specific_ptr<boost::shared_ptr<CLogBuffer> > ptrBuffer(&ReleaseLogBuffer);
+    if (ptrBuffer.get() == NULL) {
+        boost::shared_ptr<CLogBuffer> pbuffer(new CLogBuffer());
+        {
+            boost::mutex::scoped_lock scoped_lock(csLogBuffers);
+            vLogBuffers.push_back(pbuffer);
+        }
+        ptrBuffer.reset(new boost::shared_ptr<CLogBuffer>(pbuffer));
+    }
+    CLogBuffer& buffer = **ptrBuffer;
+
+    const uint64_t nAdded = buffer.nAdded.load(std::memory_order_relaxed);
+    if (nAdded - buffer.nTaken.load(std::memory_order_acquire) >= buffer.vEntries.size()) {
+        buffer.nDropped.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    CLogBuffer::Entry& entry = buffer.vEntries[nAdded % buffer.vEntries.size()];
+    entry.str = LogTimestampStr(str, &buffer.fStartedNewLine);
+    entry.nSequence = nLogSequence.fetch_add(1, std::memory_order_relaxed);
+    const int ret = entry.str.size();
+    buffer.nAdded.store(nAdded + 1, std::memory_order_release);
+    return ret;
+}
+
+/** Write out what the threads' log buffers hold; false if there was nothing */
+static bool WriteLogBuffers()
+{
+    std::vector<boost::shared_ptr<CLogBuffer> > vBuffers;
+    {
+        boost::mutex::scoped_lock scoped_lock(csLogBuffers);
+        // Buffers of exited threads were emptied by the last call.
+        std::vector<boost::shared_ptr<CLogBuffer> >::iterator it = vLogBuffers.begin();
+        while (it != vLogBuffers.end()) {
+            if ((*it)->fThreadExited && (*it)->nTaken == (*it)->nAdded && (*it)->nDropped == 0)
+                it = vLogBuffers.erase(it);
+            else
+                ++it;
+        }
+        vBuffers = vLogBuffers;
+    }
+
+    std::vector<std::pair<uint64_t, std::string> > vMessages;
+    uint64_t nDropped = 0;
+    for (size_t i = 0; i < vBuffers.size(); i++) {
+        CLogBuffer& buffer = *vBuffers[i];
+        const uint64_t nTaken = buffer.nTaken.load(std::memory_order_relaxed);
+        const uint64_t nAdded = buffer.nAdded.load(std::memory_order_acquire);
+        for (uint64_t n = nTaken; n < nAdded; n++) {
+            CLogBuffer::Entry& entry = buffer.vEntries[n % buffer.vEntries.size()];
+            vMessages.push_back(std::make_pair(entry.nSequence, std::string()));
+            vMessages.back().second.swap(entry.str);
+        }
+        buffer.nTaken.store(nAdded, std::memory_order_release);
+        nDropped += buffer.nDropped.exchange(0);
+    }
+    if (vMessages.empty() && nDropped == 0)
+        return false;
+
+    std::sort(vMessages.begin(), vMessages.end());
+    std::string strOut;
+    if (nDropped > 0) {
+        nLogMessagesDropped += nDropped;
+        bool fStartedNewLine = true;
+        strOut = LogTimestampStr(strprintf("Dropped %u log messages (%u in total): logged faster than they could be written\n", nDropped, nLogMessagesDropped), &fStartedNewLine);
+    }
+    for (size_t i = 0; i < vMessages.size(); i++)
+        strOut += vMessages[i].second;
+
+    if (fPrintToConsole) {
+        fwrite(strOut.data(), 1, strOut.size(), stdout);
+        fflush(stdout);
+    } else if (fPrintToDebugLog) {
+        boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        WriteDebugLogFile(strOut);
+    }
+    return true;
+}
+
+static void ThreadLogWriter()
+{
+    RenameThread("bitcoin-logwriter");
+    while (!fStopLogWriter) {
+        if (!WriteLogBuffers())
+            MilliSleep(10);
+    }
+}
+
+void StartLogWriter()
+{
+    if (pthreadLogWriter)
+        return;
+    fStopLogWriter = false;
+    pthreadLogWriter = new boost::thread(&ThreadLogWriter);
+    fLogWriterRunning = true;
+}
+
+void StopLogWriter()
+{
+    if (!pthreadLogWriter)
+        return;
+    fLogWriterRunning = false;
+    fStopLogWriter = true;
+    pthreadLogWriter->join();
+    delete pthreadLogWriter;
+    pthreadLogWriter = NULL;
+    WriteLogBuffers();
+}
+
 int DebugLogPrintStr(const std::string &str)
 {
+    if (fLogWriterRunning && (fPrintToConsole || fPrintToDebugLog))
+        return QueueDebugLogStr(str);
+
     int ret = 0; // Returns total number of characters written
     static bool fStartedNewLine = true;
 
@@ -337,25 +521,7 @@ int DebugLogPrintStr(const std::string &str)
     {
         boost::call_once(&DebugPrintInit, debugPrintInitFlag);
         boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
-
-        // buffer if we haven't opened the log yet
-        if (fileout_debug == NULL) {
-            assert(vMsgsBeforeOpenDebugLog);
-            ret = strTimestamped.length();
-            vMsgsBeforeOpenDebugLog->push_back(strTimestamped);
-        }
-        else
-        {
-            // reopen the log file, if requested
-            if (fReopenDebugLog) {
-                fReopenDebugLog = false;
-                boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-                if (freopen(pathDebug.string().c_str(),"a",fileout_debug) != NULL)
-                    setbuf(fileout_debug, NULL); // unbuffered
-            }
-
-            ret = FileWriteStr(strTimestamped, fileout_debug);
-        }
+        ret = WriteDebugLogFile(strTimestamped);
     }
     return ret;
 }
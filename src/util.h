@@ -33,6 +33,9 @@
 static const bool DEFAULT_LOGTIMEMICROS = false;
 static const bool DEFAULT_LOGIPS        = false;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
+static const bool DEFAULT_LOGASYNC      = true;
+//! Messages a thread can have waiting for the log writer before it drops them
+static const size_t LOG_BUFFER_MESSAGES = 4096;
 
 /** Signals for translation. */
 class CTranslationInterface
@@ -141,6 +144,14 @@ boost::filesystem::path GetSpecialFolderPath(int nFolder, bool fCreate = true);
 #endif
 void OpenDebugLog();
 void OpenAuditLog();
+/**
+ * Have debug output written by a background thread (-logasync). Each thread
+ * then queues its messages in a buffer of its own, which the writer empties
+ * in the order they were logged.
+ */
+void StartLogWriter();
+/** Write out what is still queued and go back to writing debug output directly */
+void StopLogWriter();
 void ShrinkDebugFile();
 void runCommand(const std::string& strCommand);
 
@@ -3,6 +3,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
 #include "utilstrencodings.h"
 
 #include "tinyformat.h"
@@ -12,8 +16,28 @@
 #include <errno.h>
 #include <limits>
 
+#if defined(ENABLE_SSE41) || defined(ENABLE_AVX2)
+#include <cpuid.h>
+#endif
+
 using namespace std;
 
+#if defined(ENABLE_SSE41)
+namespace hex_sse41
+{
+size_t Encode(char* out, const unsigned char* in, size_t len);
+size_t Decode(unsigned char* out, const char* in, size_t len);
+}
+#endif
+
+#if defined(ENABLE_AVX2)
+namespace hex_avx2
+{
+size_t Encode(char* out, const unsigned char* in, size_t len);
+size_t Decode(unsigned char* out, const char* in, size_t len);
+}
+#endif
+
 static const string CHARS_ALPHA_NUM = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
 
 static const string SAFE_CHARS[] =
@@ -56,6 +80,78 @@ signed char HexDigit(char c)
     return p_util_hexdigit[(unsigned char)c];
 }
 
+namespace {
+
+/** The vector kernels process whole blocks, returning how many bytes they encoded or decoded. */
+typedef size_t (*HexEncodeFn)(char* out, const unsigned char* in, size_t len);
+typedef size_t (*HexDecodeFn)(unsigned char* out, const char* in, size_t len);
+
+size_t HexEncodeNone(char* out, const unsigned char* in, size_t len) { return 0; }
+size_t HexDecodeNone(unsigned char* out, const char* in, size_t len) { return 0; }
+
+struct HexKernels
+{
+    HexEncodeFn encode;
+    HexDecodeFn decode;
+
+    HexKernels() : encode(HexEncodeNone), decode(HexDecodeNone)
+    {
+#if defined(ENABLE_SSE41) || defined(ENABLE_AVX2)
+        uint32_t eax, ebx, ecx, edx;
+        __cpuid(0, eax, ebx, ecx, edx);
+        const uint32_t max_leaf = eax;
+        __cpuid_count(1, 0, eax, ebx, ecx, edx);
+        const bool have_sse4 = (ecx >> 19) & 1;
+        const bool have_avx = ((ecx >> 27) & 1) && ((ecx >> 28) & 1);
+#endif
+#if defined(ENABLE_SSE41)
+        if (have_sse4) {
+            encode = hex_sse41::Encode;
+            decode = hex_sse41::Decode;
+        }
+#endif
+#if defined(ENABLE_AVX2)
+        if (have_avx && max_leaf >= 7) {
+            // The OS must also save the AVX registers on context switches.
+            uint32_t xcr0_lo, xcr0_hi;
+            __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            if ((xcr0_lo & 6) == 6 && ((ebx >> 5) & 1)) {
+                encode = hex_avx2::Encode;
+                decode = hex_avx2::Decode;
+            }
+        }
+#endif
+    }
+};
+
+const HexKernels& GetHexKernels()
+{
+    // Detected on first use; C++11 makes this initialization thread safe.
+    static const HexKernels kernels;
+    return kernels;
+}
+
+}
+
+string HexStr(const unsigned char* pbegin, const unsigned char* pend, bool fSpaces)
+{
+    if (fSpaces)
+        return HexStr<const unsigned char*>(pbegin, pend, true);
+    static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                     '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+    const size_t len = pend - pbegin;
+    string rv(len * 2, '\0');
+    if (len == 0)
+        return rv;
+    char* out = &rv[0];
+    for (size_t i = GetHexKernels().encode(out, pbegin, len); i < len; i++) {
+        out[2 * i] = hexmap[pbegin[i] >> 4];
+        out[2 * i + 1] = hexmap[pbegin[i] & 15];
+    }
+    return rv;
+}
+
 bool IsHex(const string& str)
 {
     for(std::string::const_iterator it(str.begin()); it != str.end(); ++it)
@@ -66,12 +162,21 @@ bool IsHex(const string& str)
     return (str.size() > 0) && (str.size()%2 == 0);
 }
 
-vector<unsigned char> ParseHex(const char* psz)
+static vector<unsigned char> ParseHex(const char* psz, size_t len)
 {
-    // convert hex dump to vector
-    vector<unsigned char> vch;
+    // convert hex dump to vector; every byte takes two characters
+    vector<unsigned char> vch(len / 2);
+    const HexDecodeFn decode = GetHexKernels().decode;
+    const char* pend = psz + len;
+    size_t nOut = 0;
     while (true)
     {
+        // Runs of hex digits go through the vector kernel, which stops
+        // ahead of anything else for the loop below to handle.
+        const size_t nDecoded = decode(vch.data() + nOut, psz, pend - psz);
+        nOut += nDecoded;
+        psz += 2 * nDecoded;
+
         while (isspace(*psz))
             psz++;
         signed char c = HexDigit(*psz++);
@@ -82,14 +187,21 @@ vector<unsigned char> ParseHex(const char* psz)
         if (c == (signed char)-1)
             break;
         n |= c;
-        vch.push_back(n);
+        vch[nOut++] = n;
     }
+    vch.resize(nOut);
     return vch;
 }
 
+vector<unsigned char> ParseHex(const char* psz)
+{
+    return ParseHex(psz, strlen(psz));
+}
+
 vector<unsigned char> ParseHex(const string& str)
 {
-    return ParseHex(str.c_str());
+    // Stop at an embedded NUL, as the C string overload does.
+    return ParseHex(str.c_str(), strlen(str.c_str()));
 }
 
 string EncodeBase64(const unsigned char* pch, size_t len)
@@ -110,6 +110,31 @@ std::string HexStr(const T itbegin, const T itend, bool fSpaces=false)
     return rv;
 }
 
+/**
+ * Hex encode a contiguous range of bytes. Without fSpaces this uses the
+ * SSE4.1 or AVX2 kernels when the CPU has them. The overloads below route
+ * the common byte vector iterators here, ahead of the generic template.
+ */
+std::string HexStr(const unsigned char* pbegin, const unsigned char* pend, bool fSpaces=false);
+
+inline std::string HexStr(unsigned char* pbegin, unsigned char* pend, bool fSpaces=false)
+{
+    return HexStr((const unsigned char*)pbegin, (const unsigned char*)pend, fSpaces);
+}
+
+inline std::string HexStr(std::vector<unsigned char>::const_iterator itbegin, std::vector<unsigned char>::const_iterator itend, bool fSpaces=false)
+{
+    if (itbegin == itend)
+        return std::string();
+    const unsigned char* pbegin = &*itbegin;
+    return HexStr(pbegin, pbegin + (itend - itbegin), fSpaces);
+}
+
+inline std::string HexStr(std::vector<unsigned char>::iterator itbegin, std::vector<unsigned char>::iterator itend, bool fSpaces=false)
+{
+    return HexStr(std::vector<unsigned char>::const_iterator(itbegin), std::vector<unsigned char>::const_iterator(itend), fSpaces);
+}
+
 template<typename T>
 inline std::string HexStr(const T& vch, bool fSpaces=false)
 {
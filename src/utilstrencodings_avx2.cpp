@@ -0,0 +1,70 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// Hex encoding and decoding of 32 bytes at a time. This is the SSE4.1 code
+// widened to AVX2, whose unpacks and packs work within each 128 bit half, so
+// that the halves are put back in order at the end.
+
+#ifdef ENABLE_AVX2
+
+#include <stddef.h>
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace hex_avx2 {
+namespace {
+
+/** The value of each of the 32 hex digits in c; valid is set to all ones in the lanes holding one. */
+__m256i inline DigitValues(__m256i c, __m256i& valid)
+{
+    const __m256i digit = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    const __m256i alpha = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    const __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    const __m256i is_alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(5)), alpha);
+    valid = _mm256_or_si256(is_digit, is_alpha);
+    return _mm256_or_si256(_mm256_and_si256(is_digit, digit), _mm256_and_si256(is_alpha, _mm256_add_epi8(alpha, _mm256_set1_epi8(10))));
+}
+
+}
+
+size_t Encode(char* out, const unsigned char* in, size_t len)
+{
+    const __m256i lut = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+                                         '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t n = 0;
+    for (; n + 32 <= len; n += 32) {
+        const __m256i bytes = _mm256_loadu_si256((const __m256i*)(in + n));
+        const __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), mask));
+        const __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(bytes, mask));
+        // Bytes 0-7 and 16-23, and bytes 8-15 and 24-31.
+        const __m256i first = _mm256_unpacklo_epi8(hi, lo);
+        const __m256i second = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i*)(out + 2 * n), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i*)(out + 2 * n + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    return n;
+}
+
+size_t Decode(unsigned char* out, const char* in, size_t len)
+{
+    // Each 16 bit lane becomes high nibble * 16 + low nibble.
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    size_t n = 0;
+    for (; 2 * n + 64 <= len; n += 32) {
+        __m256i valid_a, valid_b;
+        const __m256i a = DigitValues(_mm256_loadu_si256((const __m256i*)(in + 2 * n)), valid_a);
+        const __m256i b = DigitValues(_mm256_loadu_si256((const __m256i*)(in + 2 * n + 32)), valid_b);
+        if (_mm256_movemask_epi8(_mm256_and_si256(valid_a, valid_b)) != -1)
+            break;
+        // The pack leaves bytes 0-7, 16-23, 8-15 and 24-31.
+        const __m256i packed = _mm256_packus_epi16(_mm256_maddubs_epi16(a, weights), _mm256_maddubs_epi16(b, weights));
+        _mm256_storeu_si256((__m256i*)(out + n), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    return n;
+}
+
+}
+
+#endif
@@ -0,0 +1,64 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// Hex encoding and decoding of 16 bytes at a time, with the SSSE3 byte
+// shuffle as the digit lookup table. Built with the SSE4.1 flags, which
+// include SSSE3.
+
+#ifdef ENABLE_SSE41
+
+#include <stddef.h>
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace hex_sse41 {
+namespace {
+
+/** The value of each of the 16 hex digits in c; valid is set to all ones in the lanes holding one. */
+__m128i inline DigitValues(__m128i c, __m128i& valid)
+{
+    const __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    const __m128i alpha = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    const __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    const __m128i is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+    valid = _mm_or_si128(is_digit, is_alpha);
+    return _mm_or_si128(_mm_and_si128(is_digit, digit), _mm_and_si128(is_alpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+}
+
+}
+
+size_t Encode(char* out, const unsigned char* in, size_t len)
+{
+    const __m128i lut = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t n = 0;
+    for (; n + 16 <= len; n += 16) {
+        const __m128i bytes = _mm_loadu_si128((const __m128i*)(in + n));
+        const __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+        const __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(bytes, mask));
+        _mm_storeu_si128((__m128i*)(out + 2 * n), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(out + 2 * n + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    return n;
+}
+
+size_t Decode(unsigned char* out, const char* in, size_t len)
+{
+    // Each 16 bit lane becomes high nibble * 16 + low nibble.
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    size_t n = 0;
+    for (; 2 * n + 32 <= len; n += 16) {
+        __m128i valid_a, valid_b;
+        const __m128i a = DigitValues(_mm_loadu_si128((const __m128i*)(in + 2 * n)), valid_a);
+        const __m128i b = DigitValues(_mm_loadu_si128((const __m128i*)(in + 2 * n + 16)), valid_b);
+        if (_mm_movemask_epi8(_mm_and_si128(valid_a, valid_b)) != 0xffff)
+            break;
+        _mm_storeu_si128((__m128i*)(out + n), _mm_packus_epi16(_mm_maddubs_epi16(a, weights), _mm_maddubs_epi16(b, weights)));
+    }
+    return n;
+}
+
+}
+
+#endif
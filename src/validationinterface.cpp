@@ -5,21 +5,219 @@
 
 #include "validationinterface.h"
 
+#include "consensus/validation.h"
+#include "primitives/block.h"
+#include "util.h"
+
+#include <deque>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 static CMainSignals g_signals;
 
+namespace {
+
+/** The signals queued listeners are connected to, fired from the queue */
+CMainSignals g_queuedSignals;
+//! Whether g_signals forwards to g_queuedSignals
+bool fForwarding = false;
+
+boost::mutex csQueue;
+boost::condition_variable condQueue;
+std::deque<boost::function<void ()> > queueCallbacks;
+//! Callbacks queued and delivered since the thread started
+uint64_t nQueued = 0;
+uint64_t nDelivered = 0;
+boost::thread* pthreadQueue = NULL;
+bool fStopQueue = false;
+
+/**
+ * The last block copied for the queue. The transactions of a connected block
+ * each come with a pointer to it, and all share one copy, which shares the
+ * transactions themselves with the original.
+ */
+boost::mutex csBlockCopy;
+const CBlock* pblockCopySource = NULL;
+uint256 hashBlockCopy;
+boost::shared_ptr<const CBlock> pblockCopy;
+//! Where in the copied block to look for the next transaction first
+size_t nBlockCopyNextTx = 0;
+
+void ThreadValidationQueue()
+{
+    RenameThread("bitcoin-notify");
+    while (true) {
+        boost::function<void ()> func;
+        {
+            boost::unique_lock<boost::mutex> lock(csQueue);
+            while (queueCallbacks.empty() && !fStopQueue)
+                condQueue.wait(lock);
+            if (queueCallbacks.empty())
+                return;
+            func.swap(queueCallbacks.front());
+            queueCallbacks.pop_front();
+        }
+        try {
+            func();
+        } catch (const std::exception& e) {
+            PrintExceptionContinue(&e, "validationqueue");
+        } catch (...) {
+            PrintExceptionContinue(NULL, "validationqueue");
+        }
+        {
+            boost::unique_lock<boost::mutex> lock(csQueue);
+            nDelivered++;
+        }
+        condQueue.notify_all();
+    }
+}
+
+void Enqueue(const boost::function<void ()>& func)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csQueue);
+        if (pthreadQueue) {
+            queueCallbacks.push_back(func);
+            nQueued++;
+            condQueue.notify_all();
+            return;
+        }
+    }
+    func();
+}
+
+boost::shared_ptr<const CBlock> CopyBlock(const CBlock& block)
+{
+    boost::unique_lock<boost::mutex> lock(csBlockCopy);
+    const uint256 hash = block.GetHash();
+    if (&block != pblockCopySource || hash != hashBlockCopy) {
+        pblockCopy.reset(new CBlock(block));
+        pblockCopySource = &block;
+        hashBlockCopy = hash;
+        nBlockCopyNextTx = 0;
+    }
+    return pblockCopy;
+}
+
+/** The index of tx in the block last copied, or -1 if it is not one of its transactions */
+int FindBlockCopyTx(const CTransaction& tx)
+{
+    boost::unique_lock<boost::mutex> lock(csBlockCopy);
+    // The transactions of a block come in order.
+    const std::vector<CTransactionRef>& vtx = pblockCopy->vtx;
+    for (size_t n = 0; n < vtx.size(); n++) {
+        const size_t i = (nBlockCopyNextTx + n) % vtx.size();
+        if (vtx[i].get() == &tx) {
+            nBlockCopyNextTx = i + 1;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void DeliverUpdatedBlockTip(const CBlockIndex* pindex)
+{
+    g_queuedSignals.UpdatedBlockTip(pindex);
+}
+
+void DeliverSyncTransaction(boost::shared_ptr<const CTransaction> ptx, const CBlockIndex* pindex, boost::shared_ptr<const CBlock> pblock, int nIndex)
+{
+    g_queuedSignals.SyncTransaction(nIndex >= 0 ? *pblock->vtx[nIndex] : *ptx, pindex, pblock.get());
+}
+
+void DeliverUpdatedTransaction(const uint256& hash)
+{
+    g_queuedSignals.UpdatedTransaction(hash);
+}
+
+void DeliverSetBestChain(const CBlockLocator& locator)
+{
+    g_queuedSignals.SetBestChain(locator);
+}
+
+void DeliverBlockChecked(boost::shared_ptr<const CBlock> pblock, const CValidationState& state)
+{
+    g_queuedSignals.BlockChecked(*pblock, state);
+}
+
+// The callbacks' arguments only live as long as the call, so what the queued
+// listeners get is a copy. Block indexes live until shutdown, and are passed
+// on as they are.
+
+void QueueUpdatedBlockTip(const CBlockIndex* pindex)
+{
+    if (!g_queuedSignals.UpdatedBlockTip.empty())
+        Enqueue(boost::bind(&DeliverUpdatedBlockTip, pindex));
+}
+
+void QueueSyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, const CBlock* pblock)
+{
+    if (g_queuedSignals.SyncTransaction.empty())
+        return;
+    boost::shared_ptr<const CBlock> pblockQueued;
+    boost::shared_ptr<const CTransaction> ptxQueued;
+    int nIndex = -1;
+    if (pblock) {
+        pblockQueued = CopyBlock(*pblock);
+        // A transaction of the block itself is passed on as the copy's, so
+        // that listeners can still tell where in the block it is.
+        nIndex = FindBlockCopyTx(tx);
+    }
+    if (nIndex < 0)
+        ptxQueued.reset(new CTransaction(tx));
+    Enqueue(boost::bind(&DeliverSyncTransaction, ptxQueued, pindex, pblockQueued, nIndex));
+}
+
+void QueueUpdatedTransaction(const uint256& hash)
+{
+    if (!g_queuedSignals.UpdatedTransaction.empty())
+        Enqueue(boost::bind(&DeliverUpdatedTransaction, hash));
+}
+
+void QueueSetBestChain(const CBlockLocator& locator)
+{
+    if (!g_queuedSignals.SetBestChain.empty())
+        Enqueue(boost::bind(&DeliverSetBestChain, locator));
+}
+
+void QueueBlockChecked(const CBlock& block, const CValidationState& state)
+{
+    if (!g_queuedSignals.BlockChecked.empty())
+        Enqueue(boost::bind(&DeliverBlockChecked, CopyBlock(block), state));
+}
+
+}
+
 CMainSignals& GetMainSignals()
 {
     return g_signals;
 }
 
-void RegisterValidationInterface(CValidationInterface* pwalletIn) {
-    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
-    g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
-    g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
-    g_signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fQueued) {
+    if (fQueued) {
+        if (!fForwarding) {
+            g_signals.UpdatedBlockTip.connect(&QueueUpdatedBlockTip);
+            g_signals.SyncTransaction.connect(&QueueSyncTransaction);
+            g_signals.UpdatedTransaction.connect(&QueueUpdatedTransaction);
+            g_signals.SetBestChain.connect(&QueueSetBestChain);
+            g_signals.BlockChecked.connect(&QueueBlockChecked);
+            fForwarding = true;
+        }
+        g_queuedSignals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
+        g_queuedSignals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
+        g_queuedSignals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
+        g_queuedSignals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
+        g_queuedSignals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
+    } else {
+        g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
+        g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
+        g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
+        g_signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
+        g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
+    }
     g_signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
     g_signals.Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
-    g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
     g_signals.ScriptForMining.connect(boost::bind(&CValidationInterface::GetScriptForMining, pwalletIn, _1));
     g_signals.BlockFound.connect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
 }
@@ -34,6 +232,11 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
     g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
     g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
+    g_queuedSignals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
+    g_queuedSignals.SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
+    g_queuedSignals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
+    g_queuedSignals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
+    g_queuedSignals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
 }
 
 void UnregisterAllValidationInterfaces() {
@@ -46,8 +249,73 @@ void UnregisterAllValidationInterfaces() {
     g_signals.UpdatedTransaction.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
     g_signals.UpdatedBlockTip.disconnect_all_slots();
+    g_queuedSignals.BlockChecked.disconnect_all_slots();
+    g_queuedSignals.SetBestChain.disconnect_all_slots();
+    g_queuedSignals.UpdatedTransaction.disconnect_all_slots();
+    g_queuedSignals.SyncTransaction.disconnect_all_slots();
+    g_queuedSignals.UpdatedBlockTip.disconnect_all_slots();
+    fForwarding = false;
 }
 
 void SyncWithWallets(const CTransaction &tx, const CBlockIndex *pindex, const CBlock *pblock) {
     g_signals.SyncTransaction(tx, pindex, pblock);
 }
+
+void StartValidationQueue()
+{
+    boost::unique_lock<boost::mutex> lock(csQueue);
+    if (pthreadQueue)
+        return;
+    fStopQueue = false;
+    nQueued = nDelivered = 0;
+    pthreadQueue = new boost::thread(&ThreadValidationQueue);
+}
+
+void StopValidationQueue()
+{
+    boost::thread* pthread;
+    {
+        boost::unique_lock<boost::mutex> lock(csQueue);
+        if (!pthreadQueue)
+            return;
+        pthread = pthreadQueue;
+        fStopQueue = true;
+        condQueue.notify_all();
+    }
+    pthread->join();
+
+    // Callbacks queued after the thread ran out of work are delivered here.
+    std::deque<boost::function<void ()> > queueLeft;
+    {
+        boost::unique_lock<boost::mutex> lock(csQueue);
+        pthreadQueue = NULL;
+        queueLeft.swap(queueCallbacks);
+    }
+    delete pthread;
+    for (size_t i = 0; i < queueLeft.size(); i++)
+        queueLeft[i]();
+    {
+        boost::unique_lock<boost::mutex> lock(csQueue);
+        nDelivered = nQueued;
+    }
+    condQueue.notify_all();
+
+    boost::unique_lock<boost::mutex> lock(csBlockCopy);
+    pblockCopySource = NULL;
+    pblockCopy.reset();
+}
+
+void SyncWithValidationQueue()
+{
+    boost::unique_lock<boost::mutex> lock(csQueue);
+    const uint64_t nTarget = nQueued;
+    while (nDelivered < nTarget)
+        condQueue.wait(lock);
+}
+
+void LimitValidationQueue()
+{
+    boost::unique_lock<boost::mutex> lock(csQueue);
+    while (pthreadQueue && queueCallbacks.size() >= MAX_VALIDATION_QUEUE_SIZE)
+        condQueue.wait(lock);
+}
@@ -21,8 +21,13 @@ class uint256;
 
 // These functions dispatch to one or all registered wallets
 
-/** Register a wallet to receive updates from core */
-void RegisterValidationInterface(CValidationInterface* pwalletIn);
+/**
+ * Register a wallet to receive updates from core. A queued listener gets
+ * UpdatedBlockTip, SyncTransaction, UpdatedTransaction, SetBestChain and
+ * BlockChecked from the validation queue's thread, in order, rather than
+ * from inside validation; the other callbacks are always synchronous.
+ */
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fQueued = false);
 /** Unregister a wallet from core */
 void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
@@ -30,6 +35,32 @@ void UnregisterAllValidationInterfaces();
 /** Push an updated transaction to all registered wallets */
 void SyncWithWallets(const CTransaction& tx, const CBlockIndex *pindex, const CBlock* pblock = NULL);
 
+/**
+ * Most callbacks the validation queue holds before producers wait for it.
+ * Callbacks are queued with cs_main held, so the wait is in LimitValidationQueue.
+ */
+static const size_t MAX_VALIDATION_QUEUE_SIZE = 1000;
+
+/**
+ * Start the thread that delivers callbacks to queued listeners. Until it is
+ * started, and after it is stopped, they are delivered synchronously.
+ */
+void StartValidationQueue();
+/** Deliver whatever is still queued and stop the thread */
+void StopValidationQueue();
+/**
+ * Wait until the callbacks queued so far have been delivered, so that queued
+ * listeners have caught up with validation. Must not be called with cs_main
+ * held, which the listeners may need.
+ */
+void SyncWithValidationQueue();
+/**
+ * Wait until fewer than MAX_VALIDATION_QUEUE_SIZE callbacks are queued. Call
+ * this, without cs_main held, before taking cs_main for work that queues
+ * callbacks, lest the queue and the blocks it keeps alive grow without bound.
+ */
+void LimitValidationQueue();
+
 class CValidationInterface {
 protected:
     virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
@@ -41,7 +72,7 @@ protected:
     virtual void BlockChecked(const CBlock&, const CValidationState&) {}
     virtual void GetScriptForMining(boost::shared_ptr<CReserveScript>&) {};
     virtual void ResetRequestCount(const uint256 &hash) {};
-    friend void ::RegisterValidationInterface(CValidationInterface*);
+    friend void ::RegisterValidationInterface(CValidationInterface*, bool);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
 };
@@ -0,0 +1,92 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "validationstats.h"
+
+#include "tinyformat.h"
+
+#include <atomic>
+
+namespace {
+
+struct CStageHistogram
+{
+    std::atomic<uint64_t> nTotalMicros;
+    std::atomic<uint64_t> vBuckets[VALIDATION_HISTOGRAM_BUCKETS];
+};
+
+// Zero-initialized as a static, before any thread can record into it.
+CStageHistogram histograms[VALIDATION_STAGE_COUNT];
+
+const char* const stageNames[VALIDATION_STAGE_COUNT] = {
+    "connect_block",
+    "utxo_fetch",
+    "script_check",
+    "rangeproof_check",
+    "tally_check",
+    "withdraw_rpc",
+    "index_write",
+    "flush",
+};
+
+int GetBucket(uint64_t nMicros)
+{
+    int nBucket = 0;
+    while (nMicros > 0 && nBucket < VALIDATION_HISTOGRAM_BUCKETS - 1) {
+        nMicros >>= 1;
+        nBucket++;
+    }
+    return nBucket;
+}
+
+}
+
+const char* GetValidationStageName(ValidationStage stage)
+{
+    return stageNames[stage];
+}
+
+void RecordValidationTime(ValidationStage stage, int64_t nMicros)
+{
+    // The clock may step backwards.
+    const uint64_t n = nMicros > 0 ? nMicros : 0;
+    CStageHistogram& histogram = histograms[stage];
+    histogram.nTotalMicros.fetch_add(n, std::memory_order_relaxed);
+    histogram.vBuckets[GetBucket(n)].fetch_add(1, std::memory_order_relaxed);
+}
+
+CValidationStageStats GetValidationStageStats(ValidationStage stage)
+{
+    const CStageHistogram& histogram = histograms[stage];
+    CValidationStageStats stats;
+    for (int i = 0; i < VALIDATION_HISTOGRAM_BUCKETS; i++)
+        stats.vBuckets[i] = histogram.vBuckets[i].load(std::memory_order_relaxed);
+    stats.nTotalMicros = histogram.nTotalMicros.load(std::memory_order_relaxed);
+    // The count is that of the buckets, so that the snapshot is consistent
+    // with itself even while other threads record.
+    for (int i = 0; i < VALIDATION_HISTOGRAM_BUCKETS; i++)
+        stats.nCount += stats.vBuckets[i];
+    return stats;
+}
+
+std::string FormatValidationMetrics()
+{
+    std::string strMetrics;
+    strMetrics += "# HELP elements_validation_stage_seconds Latency of block validation stages.\n";
+    strMetrics += "# TYPE elements_validation_stage_seconds histogram\n";
+    for (int s = 0; s < VALIDATION_STAGE_COUNT; s++) {
+        const ValidationStage stage = (ValidationStage)s;
+        const CValidationStageStats stats = GetValidationStageStats(stage);
+        const char* name = GetValidationStageName(stage);
+        uint64_t nCumulative = 0;
+        for (int i = 0; i < VALIDATION_HISTOGRAM_BUCKETS - 1; i++) {
+            nCumulative += stats.vBuckets[i];
+            strMetrics += strprintf("elements_validation_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %u\n", name, (double)((uint64_t)1 << i) * 0.000001, nCumulative);
+        }
+        strMetrics += strprintf("elements_validation_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %u\n", name, stats.nCount);
+        strMetrics += strprintf("elements_validation_stage_seconds_sum{stage=\"%s\"} %.6f\n", name, stats.nTotalMicros * 0.000001);
+        strMetrics += strprintf("elements_validation_stage_seconds_count{stage=\"%s\"} %u\n", name, stats.nCount);
+    }
+    return strMetrics;
+}
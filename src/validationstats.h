@@ -0,0 +1,70 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_VALIDATIONSTATS_H
+#define BITCOIN_VALIDATIONSTATS_H
+
+#include "utiltime.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Stages of block validation whose latencies are collected. */
+enum ValidationStage
+{
+    VALIDATION_CONNECT_BLOCK,   //!< ConnectBlock for one block of the active chain
+    VALIDATION_UTXO_FETCH,      //!< looking up the inputs of one block
+    VALIDATION_SCRIPT,          //!< one script check
+    VALIDATION_RANGEPROOF,      //!< one range proof, or a batch of them
+    VALIDATION_TALLY,           //!< one amount balance check, or a batch of them
+    VALIDATION_WITHDRAW_RPC,    //!< one parent chain RPC round trip for a peg-in
+    VALIDATION_INDEX_WRITE,     //!< writing the undo data and indexes of one block
+    VALIDATION_FLUSH,           //!< one write of the chain state to disk
+    VALIDATION_STAGE_COUNT
+};
+
+/**
+ * Latency histograms have a bucket per power of two microseconds: bucket i
+ * counts durations below 2^i us, the last one everything longer.
+ */
+static const int VALIDATION_HISTOGRAM_BUCKETS = 32;
+
+struct CValidationStageStats
+{
+    uint64_t nCount;
+    uint64_t nTotalMicros;
+    std::vector<uint64_t> vBuckets;
+
+    CValidationStageStats() : nCount(0), nTotalMicros(0), vBuckets(VALIDATION_HISTOGRAM_BUCKETS, 0) {}
+};
+
+/** Name of a stage, as used by getvalidationstats and the metrics endpoint. */
+const char* GetValidationStageName(ValidationStage stage);
+
+/**
+ * Record one duration of stage. This only takes a few relaxed atomic
+ * increments and may be called from any thread.
+ */
+void RecordValidationTime(ValidationStage stage, int64_t nMicros);
+
+/** Snapshot of the histogram of stage. */
+CValidationStageStats GetValidationStageStats(ValidationStage stage);
+
+/** All histograms in the Prometheus text exposition format. */
+std::string FormatValidationMetrics();
+
+/** Records the time from construction to destruction as one duration of a stage. */
+class CValidationTimer
+{
+private:
+    const ValidationStage stage;
+    const int64_t nStart;
+
+public:
+    CValidationTimer(ValidationStage stageIn) : stage(stageIn), nStart(GetTimeMicros()) {}
+    ~CValidationTimer() { RecordValidationTime(stage, GetTimeMicros() - nStart); }
+};
+
+#endif // BITCOIN_VALIDATIONSTATS_H
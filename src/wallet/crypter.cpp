@@ -10,9 +10,12 @@
 #include "script/standard.h"
 #include "util.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 
 int CCrypter::BytesToKeySHA512AES(const std::vector<unsigned char>& chSalt, const SecureString& strKeyData, int count, unsigned char *key,unsigned char *iv) const
 {
@@ -168,6 +171,15 @@ bool CCryptoKeyStore::Lock()
     return true;
 }
 
+/** Decrypt and verify the keys in vKeys from nStart on, every nStep-th one, recording failures. */
+static void DecryptKeys(const CKeyingMaterial& vMasterKey, const std::vector<const CryptedKeyMap::mapped_type*>& vKeys, std::vector<char>& vFail, size_t nStart, size_t nStep)
+{
+    for (size_t i = nStart; i < vKeys.size(); i += nStep) {
+        CKey key;
+        vFail[i] = !DecryptKey(vMasterKey, vKeys[i]->second, vKeys[i]->first, key);
+    }
+}
+
 bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
 {
     {
@@ -178,19 +190,30 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
         bool keyPass = false;
         bool keyFail = false;
         CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi)
+        if (mi != mapCryptedKeys.end())
         {
-            const CPubKey &vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
+            // A wrong passphrase already fails on the first key, and after
+            // the first unlock that is the only one we decrypt.
             CKey key;
-            if (!DecryptKey(vMasterKeyIn, vchCryptedSecret, vchPubKey, key))
-            {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
+            keyPass = DecryptKey(vMasterKeyIn, mi->second.second, mi->second.first, key);
+            keyFail = !keyPass;
+        }
+        if (keyPass && !fDecryptionThoroughlyChecked && mapCryptedKeys.size() > 1)
+        {
+            // Verifying each key takes an EC multiplication, so check the
+            // rest on all cores.
+            std::vector<const CryptedKeyMap::mapped_type*> vKeys;
+            vKeys.reserve(mapCryptedKeys.size() - 1);
+            for (++mi; mi != mapCryptedKeys.end(); ++mi)
+                vKeys.push_back(&mi->second);
+            std::vector<char> vFail(vKeys.size(), 0);
+            const size_t nThreads = std::min(vKeys.size(), (size_t)std::max(GetNumCores(), 1));
+            boost::thread_group threads;
+            for (size_t i = 1; i < nThreads; i++)
+                threads.create_thread(boost::bind(&DecryptKeys, boost::cref(vMasterKeyIn), boost::cref(vKeys), boost::ref(vFail), i, nThreads));
+            DecryptKeys(vMasterKeyIn, vKeys, vFail, 0, nThreads);
+            threads.join_all();
+            keyFail = std::find(vFail.begin(), vFail.end(), 1) != vFail.end();
         }
         if (keyPass && keyFail)
         {
@@ -16,11 +16,15 @@
 #include "merkleblock.h"
 #include "core_io.h"
 
+#include <atomic>
 #include <fstream>
 #include <stdint.h>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/assign/list_of.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
 
 #include <univalue.h>
 
@@ -74,6 +78,84 @@ std::string DecodeDumpString(const std::string &str) {
     return ret.str();
 }
 
+/** Keys dumpwallet formats, and lines importwallet decodes, at a time */
+static const size_t WALLET_DUMP_CHUNK = 10000;
+/** Consecutive keys or lines a worker takes from a chunk at once */
+static const size_t WALLET_DUMP_JOB_CHUNK = 64;
+
+static void WalletDumpWorker(size_t nJobs, const boost::function<void(size_t)>* pf, std::atomic<size_t>* pnNext)
+{
+    while (true) {
+        const size_t nStart = pnNext->fetch_add(WALLET_DUMP_JOB_CHUNK);
+        if (nStart >= nJobs)
+            return;
+        const size_t nEnd = std::min(nStart + WALLET_DUMP_JOB_CHUNK, nJobs);
+        for (size_t i = nStart; i < nEnd; i++)
+            (*pf)(i);
+    }
+}
+
+/**
+ * Call f(i) for each i below nJobs on up to nScriptCheckThreads threads,
+ * the calling one included. f must not throw.
+ */
+static void ForEachWalletDumpJob(size_t nJobs, const boost::function<void(size_t)>& f)
+{
+    std::atomic<size_t> nNext(0);
+    const size_t nChunks = (nJobs + WALLET_DUMP_JOB_CHUNK - 1) / WALLET_DUMP_JOB_CHUNK;
+    const size_t nWorkers = std::max(1, std::min(nScriptCheckThreads, (int)nChunks));
+    boost::thread_group workers;
+    for (size_t n = 1; n < nWorkers; n++)
+        workers.create_thread(boost::bind(&WalletDumpWorker, nJobs, &f, &nNext));
+    WalletDumpWorker(nJobs, &f, &nNext);
+    workers.join_all();
+}
+
+/** A line of a wallet dump, and what importwallet makes of it */
+struct CImportKeyJob
+{
+    std::string strLine;
+    bool fValid;
+    CKey key;
+    CPubKey pubkey;
+    std::string strAddr;
+    int64_t nTime;
+    bool fLabel;
+    std::string strLabel;
+
+    CImportKeyJob() : fValid(false), nTime(0), fLabel(true) {}
+};
+
+/** Decode the key of a dump line and derive its public key */
+static void ParseImportKeyJob(CImportKeyJob& job)
+{
+    std::vector<std::string> vstr;
+    boost::split(vstr, job.strLine, boost::is_any_of(" "));
+    if (vstr.size() < 2)
+        return;
+    CBitcoinSecret vchSecret;
+    if (!vchSecret.SetString(vstr[0]))
+        return;
+    job.key = vchSecret.GetKey();
+    job.pubkey = job.key.GetPubKey();
+    assert(job.key.VerifyPubKey(job.pubkey));
+    job.strAddr = CBitcoinAddress(job.pubkey.GetID()).ToString();
+    job.nTime = DecodeDumpTime(vstr[1]);
+    for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
+        if (boost::algorithm::starts_with(vstr[nStr], "#"))
+            break;
+        if (vstr[nStr] == "change=1")
+            job.fLabel = false;
+        if (vstr[nStr] == "reserve=1")
+            job.fLabel = false;
+        if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
+            job.strLabel = DecodeDumpString(vstr[nStr].substr(6));
+            job.fLabel = true;
+        }
+    }
+    job.fValid = true;
+}
+
 UniValue importprivkey(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -446,73 +528,72 @@ UniValue importwallet(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open wallet dump file");
 
     int64_t nTimeBegin = chainActive.Tip()->GetBlockTime();
+    bool fImported = false;
 
     bool fGood = true;
 
+    // Write all keys, labels and found transactions with a single flush
+    CWalletBatch batch(pwalletMain);
+
     int64_t nFilesize = std::max((int64_t)1, (int64_t)file.tellg());
     file.seekg(0, file.beg);
 
+    // Read the file a chunk of lines at a time, decode the chunk's keys and
+    // derive their public keys in parallel, then add them in file order.
     pwalletMain->ShowProgress(_("Importing..."), 0); // show progress dialog in GUI
+    std::vector<CImportKeyJob> vJobs;
     while (file.good()) {
         pwalletMain->ShowProgress("", std::max(1, std::min(99, (int)(((double)file.tellg() / (double)nFilesize) * 100))));
-        std::string line;
-        std::getline(file, line);
-        if (line.empty() || line[0] == '#')
-            continue;
-
-        std::vector<std::string> vstr;
-        boost::split(vstr, line, boost::is_any_of(" "));
-        if (vstr.size() < 2)
-            continue;
-        CBitcoinSecret vchSecret;
-        if (!vchSecret.SetString(vstr[0]))
-            continue;
-        CKey key = vchSecret.GetKey();
-        CPubKey pubkey = key.GetPubKey();
-        assert(key.VerifyPubKey(pubkey));
-        CKeyID keyid = pubkey.GetID();
-        if (pwalletMain->HaveKey(keyid)) {
-            LogPrintf("Skipping import of %s (key already present)\n", CBitcoinAddress(keyid).ToString());
-            continue;
+        vJobs.clear();
+        while (vJobs.size() < WALLET_DUMP_CHUNK && file.good()) {
+            std::string line;
+            std::getline(file, line);
+            if (line.empty() || line[0] == '#')
+                continue;
+            vJobs.push_back(CImportKeyJob());
+            vJobs.back().strLine.swap(line);
         }
-        int64_t nTime = DecodeDumpTime(vstr[1]);
-        std::string strLabel;
-        bool fLabel = true;
-        for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
-            if (boost::algorithm::starts_with(vstr[nStr], "#"))
-                break;
-            if (vstr[nStr] == "change=1")
-                fLabel = false;
-            if (vstr[nStr] == "reserve=1")
-                fLabel = false;
-            if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
-                strLabel = DecodeDumpString(vstr[nStr].substr(6));
-                fLabel = true;
+        ForEachWalletDumpJob(vJobs.size(), [&vJobs](size_t i) { ParseImportKeyJob(vJobs[i]); });
+
+        BOOST_FOREACH(const CImportKeyJob& job, vJobs) {
+            if (!job.fValid)
+                continue;
+            CKeyID keyid = job.pubkey.GetID();
+            if (pwalletMain->HaveKey(keyid)) {
+                LogPrintf("Skipping import of %s (key already present)\n", job.strAddr);
+                continue;
             }
+            LogPrintf("Importing %s...\n", job.strAddr);
+            // Set the birth time first, so that it is written with the key
+            pwalletMain->mapKeyMetadata[keyid].nCreateTime = job.nTime;
+            if (!pwalletMain->AddKeyPubKey(job.key, job.pubkey)) {
+                pwalletMain->mapKeyMetadata.erase(keyid);
+                fGood = false;
+                continue;
+            }
+            if (job.fLabel)
+                pwalletMain->SetAddressBook(keyid, job.strLabel, "receive");
+            nTimeBegin = std::min(nTimeBegin, job.nTime);
+            fImported = true;
         }
-        LogPrintf("Importing %s...\n", CBitcoinAddress(keyid).ToString());
-        if (!pwalletMain->AddKeyPubKey(key, pubkey)) {
-            fGood = false;
-            continue;
-        }
-        pwalletMain->mapKeyMetadata[keyid].nCreateTime = nTime;
-        if (fLabel)
-            pwalletMain->SetAddressBook(keyid, strLabel, "receive");
-        nTimeBegin = std::min(nTimeBegin, nTime);
     }
     file.close();
     pwalletMain->ShowProgress("", 100); // hide progress dialog in GUI
 
-    CBlockIndex *pindex = chainActive.Tip();
-    while (pindex && pindex->pprev && pindex->GetBlockTime() > nTimeBegin - 7200)
-        pindex = pindex->pprev;
+    // One rescan for all of the new keys, from the oldest of their birth
+    // times; none at all if every key was already known.
+    if (fImported) {
+        CBlockIndex *pindex = chainActive.Tip();
+        while (pindex && pindex->pprev && pindex->GetBlockTime() > nTimeBegin - 7200)
+            pindex = pindex->pprev;
 
-    if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
-        pwalletMain->nTimeFirstKey = nTimeBegin;
+        if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
+            pwalletMain->nTimeFirstKey = nTimeBegin;
 
-    LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
-    pwalletMain->ScanForWalletTransactions(pindex);
-    pwalletMain->MarkDirty();
+        LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
+        pwalletMain->ScanForWalletTransactions(pindex);
+        pwalletMain->MarkDirty();
+    }
 
     if (!fGood)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
@@ -595,6 +676,7 @@ UniValue dumpwallet(const UniValue& params, bool fHelp)
 
     // sort time/key pairs
     std::vector<std::pair<int64_t, CKeyID> > vKeyBirth;
+    vKeyBirth.reserve(mapKeyBirth.size());
     for (std::map<CKeyID, int64_t>::const_iterator it = mapKeyBirth.begin(); it != mapKeyBirth.end(); it++) {
         vKeyBirth.push_back(std::make_pair(it->second, it->first));
     }
@@ -624,26 +706,38 @@ UniValue dumpwallet(const UniValue& params, bool fHelp)
             file << "# extended private masterkey: " << b58extkey.ToString() << "\n\n";
         }
     }
-    for (std::vector<std::pair<int64_t, CKeyID> >::const_iterator it = vKeyBirth.begin(); it != vKeyBirth.end(); it++) {
-        const CKeyID &keyid = it->second;
-        std::string strTime = EncodeDumpTime(it->first);
-        std::string strAddr = CBitcoinAddress(keyid).ToString();
-        CKey key;
-        if (pwalletMain->GetKey(keyid, key)) {
-            file << strprintf("%s %s ", CBitcoinSecret(key).ToString(), strTime);
-            if (pwalletMain->mapAddressBook.count(keyid)) {
-                file << strprintf("label=%s", EncodeDumpString(pwalletMain->mapAddressBook[keyid].name));
+    // Format the key lines a chunk at a time on parallel threads, so that
+    // only one chunk of them is ever held in memory.
+    std::vector<std::string> vLines;
+    for (size_t nChunkStart = 0; nChunkStart < vKeyBirth.size(); nChunkStart += WALLET_DUMP_CHUNK) {
+        const size_t nChunkSize = std::min(WALLET_DUMP_CHUNK, vKeyBirth.size() - nChunkStart);
+        vLines.assign(nChunkSize, std::string());
+        ForEachWalletDumpJob(nChunkSize, [&](size_t i) {
+            const CKeyID &keyid = vKeyBirth[nChunkStart + i].second;
+            CKey key;
+            if (!pwalletMain->GetKey(keyid, key))
+                return;
+            // Read-only lookups only: the workers share the wallet's maps
+            std::map<CTxDestination, CAddressBookData>::const_iterator mi = pwalletMain->mapAddressBook.find(keyid);
+            std::map<CKeyID, CKeyMetadata>::const_iterator meta = pwalletMain->mapKeyMetadata.find(keyid);
+            const std::string strKeypath = meta != pwalletMain->mapKeyMetadata.end() ? meta->second.hdKeypath : "";
+            std::string& strLine = vLines[i];
+            strLine = strprintf("%s %s ", CBitcoinSecret(key).ToString(), EncodeDumpTime(vKeyBirth[nChunkStart + i].first));
+            if (mi != pwalletMain->mapAddressBook.end()) {
+                strLine += strprintf("label=%s", EncodeDumpString(mi->second.name));
             } else if (keyid == masterKeyID) {
-                file << "hdmaster=1";
+                strLine += "hdmaster=1";
             } else if (setKeyPool.count(keyid)) {
-                file << "reserve=1";
-            } else if (pwalletMain->mapKeyMetadata[keyid].hdKeypath == "m") {
-                file << "inactivehdmaster=1";
+                strLine += "reserve=1";
+            } else if (strKeypath == "m") {
+                strLine += "inactivehdmaster=1";
             } else {
-                file << "change=1";
+                strLine += "change=1";
             }
-            file << strprintf(" # addr=%s%s\n", strAddr, (pwalletMain->mapKeyMetadata[keyid].hdKeypath.size() > 0 ? " hdkeypath="+pwalletMain->mapKeyMetadata[keyid].hdKeypath : ""));
-        }
+            strLine += strprintf(" # addr=%s%s\n", CBitcoinAddress(keyid).ToString(), (strKeypath.size() > 0 ? " hdkeypath="+strKeypath : ""));
+        });
+        BOOST_FOREACH(const std::string& strLine, vLines)
+            file << strLine;
     }
     file << "\n";
     file << "# End of dump\n";
@@ -700,6 +794,26 @@ UniValue dumpblindingkey(const UniValue& params, bool fHelp)
     throw JSONRPCError(RPC_WALLET_ERROR, "Blinding key for address is unknown");
 }
 
+/** Add the private blinding key keydata of the CT address to the wallet */
+static void ImportBlindingKey(const CBitcoinAddress& address, const std::vector<unsigned char>& keydata)
+{
+    if (keydata.size() != 32) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid hexadecimal key length");
+    }
+
+    CKey key;
+    key.Set(keydata.begin(), keydata.end(), true);
+    if (!key.IsValid() || key.GetPubKey() != address.GetBlindingKey()) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Address and key do not match");
+    }
+
+    uint256 keyval;
+    memcpy(keyval.begin(), &keydata[0], 32);
+    if (!pwalletMain->AddSpecificBlindingKey(CScriptID(GetScriptForDestination(address.Get())), keyval)) {
+        throw JSONRPCError(RPC_WALLET_ERROR, "Failed to import blinding key");
+    }
+}
+
 UniValue importblindingkey(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -728,22 +842,183 @@ UniValue importblindingkey(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid hexadecimal for key");
     }
     std::vector<unsigned char> keydata = ParseHex(params[1].get_str());
-    if (keydata.size() != 32) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid hexadecimal key length");
+    ImportBlindingKey(address, keydata);
+    pwalletMain->MarkDirty();
+
+    return NullUniValue;
+}
+
+UniValue importmulti(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "importmulti [{...},...] ( rescan )\n"
+            "\nAdds private keys, public keys, addresses, scripts and blinding keys to your wallet, then rescans\n"
+            "the block chain once, from the earliest timestamp given.\n"
+            "\nArguments:\n"
+            "1. requests             (array, required) The keys and scripts to import\n"
+            "  [\n"
+            "    {\n"
+            "      \"privkey\" : \"key\",      (string, optional) A private key (see dumpprivkey)\n"
+            "      \"pubkey\" : \"hex\",       (string, optional) A hex-encoded public key to watch\n"
+            "      \"address\" : \"address\",  (string, optional) An address to watch\n"
+            "      \"script\" : \"hex\",       (string, optional) A hex-encoded script to watch\n"
+            "      \"p2sh\" : true|false,      (boolean, optional, default=false) Add the P2SH version of script as well\n"
+            "      \"blindingkey\" : \"hex\",  (string, optional) The blinding key in hex for address, which must be a CT address\n"
+            "      \"label\" : \"label\",      (string, optional, default=\"\") An optional label\n"
+            "      \"timestamp\" : n         (numeric, optional) The creation time of the key or script, in seconds since\n"
+            "                                epoch (Jan 1 1970 GMT); if not given the whole block chain is rescanned\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "2. rescan               (boolean, optional, default=true) Rescan the wallet for transactions once all are imported\n"
+            "\nNote: This call can take minutes to complete if rescan is true.\n"
+            "\nResult:\n"
+            "[                       (array) One entry per request, in order\n"
+            "  {\n"
+            "    \"success\" : true|false,   (boolean) Whether everything in the request was imported\n"
+            "    \"error\" : {...}           (object) What went wrong, if it failed\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("importmulti", "'[{\"privkey\":\"mykey\",\"timestamp\":1455191478},{\"address\":\"myaddress\",\"blindingkey\":\"mykey\"}]'")
+            + HelpExampleCli("importmulti", "'[{\"pubkey\":\"mypubkey\",\"label\":\"testing\"}]' false")
+            + HelpExampleRpc("importmulti", "[{\"privkey\":\"mykey\",\"timestamp\":1455191478}], false")
+        );
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VARR)(UniValue::VBOOL));
+    const UniValue& requests = params[0].get_array();
+
+    // Whether to perform rescan after import
+    bool fRescan = true;
+    if (params.size() > 1)
+        fRescan = params[1].get_bool();
+
+    if (fRescan && fPruneMode)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is disabled in pruned mode");
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    bool fHavePrivKey = false;
+    for (size_t i = 0; i < requests.size(); i++) {
+        if (requests[i].isObject() && find_value(requests[i].get_obj(), "privkey").isStr())
+            fHavePrivKey = true;
     }
+    if (fHavePrivKey)
+        EnsureWalletIsUnlocked();
+
+    // Everything is added before the one rescan, which starts at the
+    // earliest timestamp; 1 stands for the genesis block as in importprivkey.
+    int64_t nTimeBegin = std::numeric_limits<int64_t>::max();
+    UniValue results(UniValue::VARR);
+    for (size_t i = 0; i < requests.size(); i++) {
+        UniValue result(UniValue::VOBJ);
+        try {
+            if (!requests[i].isObject())
+                throw JSONRPCError(RPC_TYPE_ERROR, "Request must be an object");
+            const UniValue& request = requests[i].get_obj();
+            RPCTypeCheckObj(request, boost::assign::map_list_of
+                ("privkey", UniValueType(UniValue::VSTR))
+                ("pubkey", UniValueType(UniValue::VSTR))
+                ("address", UniValueType(UniValue::VSTR))
+                ("script", UniValueType(UniValue::VSTR))
+                ("p2sh", UniValueType(UniValue::VBOOL))
+                ("blindingkey", UniValueType(UniValue::VSTR))
+                ("label", UniValueType(UniValue::VSTR))
+                ("timestamp", UniValueType(UniValue::VNUM)), true, true);
+
+            const std::string strLabel = request.exists("label") ? request["label"].get_str() : "";
+            const int64_t nTime = request.exists("timestamp") ? std::max(request["timestamp"].get_int64(), (int64_t)1) : 1;
+            const bool fP2SH = request.exists("p2sh") && request["p2sh"].get_bool();
+            if (fP2SH && !request.exists("script"))
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot use the p2sh flag without a script");
+
+            if (request.exists("privkey")) {
+                CBitcoinSecret vchSecret;
+                if (!vchSecret.SetString(request["privkey"].get_str()))
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid private key encoding");
+                CKey key = vchSecret.GetKey();
+                if (!key.IsValid())
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Private key outside allowed range");
+                CPubKey pubkey = key.GetPubKey();
+                assert(key.VerifyPubKey(pubkey));
+                CKeyID vchAddress = pubkey.GetID();
+                pwalletMain->MarkDirty();
+                pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
+                if (!pwalletMain->HaveKey(vchAddress)) {
+                    pwalletMain->mapKeyMetadata[vchAddress].nCreateTime = nTime;
+                    if (!pwalletMain->AddKeyPubKey(key, pubkey))
+                        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
+                }
+            }
+            if (request.exists("pubkey")) {
+                if (!IsHex(request["pubkey"].get_str()))
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Pubkey must be a hex string");
+                std::vector<unsigned char> data(ParseHex(request["pubkey"].get_str()));
+                CPubKey pubKey(data.begin(), data.end());
+                if (!pubKey.IsFullyValid())
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Pubkey is not a valid public key");
+                ImportAddress(CBitcoinAddress(pubKey.GetID()), strLabel);
+                ImportScript(GetScriptForRawPubKey(pubKey), strLabel, false);
+            }
+            if (request.exists("script")) {
+                if (!IsHex(request["script"].get_str()))
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Script must be a hex string");
+                std::vector<unsigned char> data(ParseHex(request["script"].get_str()));
+                ImportScript(CScript(data.begin(), data.end()), strLabel, fP2SH);
+            }
+            if (request.exists("address")) {
+                CBitcoinAddress address(request["address"].get_str());
+                if (!address.IsValid())
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
+                // The address of an imported private key is already the wallet's
+                if (!request.exists("privkey"))
+                    ImportAddress(address, strLabel);
+                if (request.exists("blindingkey")) {
+                    if (!address.IsBlinded())
+                        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Not a CT address");
+                    if (!IsHex(request["blindingkey"].get_str()))
+                        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid hexadecimal for key");
+                    ImportBlindingKey(address, ParseHex(request["blindingkey"].get_str()));
+                    pwalletMain->MarkDirty();
+                }
+            } else if (request.exists("blindingkey")) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "A blinding key needs the CT address it belongs to");
+            }
 
-    CKey key;
-    key.Set(keydata.begin(), keydata.end(), true);
-    if (!key.IsValid() || key.GetPubKey() != address.GetBlindingKey()) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Address and key do not match");
+            nTimeBegin = std::min(nTimeBegin, nTime);
+            result.pushKV("success", true);
+        } catch (const UniValue& error) {
+            result.pushKV("success", false);
+            result.pushKV("error", error);
+        } catch (const std::exception& e) {
+            result.pushKV("success", false);
+            result.pushKV("error", JSONRPCError(RPC_MISC_ERROR, e.what()));
+        }
+        results.push_back(result);
     }
 
-    uint256 keyval;
-    memcpy(keyval.begin(), &keydata[0], 32);
-    if (!pwalletMain->AddSpecificBlindingKey(CScriptID(GetScriptForDestination(address.Get())), keyval)) {
-        throw JSONRPCError(RPC_WALLET_ERROR, "Failed to import blinding key");
+    if (nTimeBegin != std::numeric_limits<int64_t>::max()) {
+        if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
+            pwalletMain->nTimeFirstKey = nTimeBegin;
+
+        if (fRescan) {
+            CBlockIndex *pindex = chainActive.Tip();
+            while (pindex && pindex->pprev && pindex->GetBlockTime() > nTimeBegin - 7200)
+                pindex = pindex->pprev;
+            if (pindex) {
+                LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
+                pwalletMain->ScanForWalletTransactions(pindex, true);
+                pwalletMain->ReacceptWalletTransactions();
+            }
+        }
     }
-    pwalletMain->MarkDirty();
 
-    return NullUniValue;
+    AuditLogPrintf("%s : importmulti %u requests\n", getUser(), requests.size());
+
+    return results;
 }
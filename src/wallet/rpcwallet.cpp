@@ -5,15 +5,18 @@
 
 #include "amount.h"
 #include "base58.h"
+#include "callrpc.h"
 #include "chain.h"
 #include "core_io.h"
 #include "consensus/validation.h"
 #include "crypto/hmac_sha256.h"
+#include "eccontext.h"
 #include "init.h"
 #include "main.h"
 #include "net.h"
 #include "netbase.h"
 #include "policy/rbf.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/server.h"
 #include "random.h"
 #include "timedata.h"
@@ -136,9 +139,6 @@ UniValue getnewaddress(const UniValue& params, bool fHelp)
     if (params.size() > 0)
         strAccount = AccountFromValue(params[0]);
 
-    if (!pwalletMain->IsLocked())
-        pwalletMain->TopUpKeyPool();
-
     // Generate a new key that is added to wallet
     CPubKey newKey;
     if (!pwalletMain->GetKeyFromPool(newKey))
@@ -212,9 +212,6 @@ UniValue getrawchangeaddress(const UniValue& params, bool fHelp)
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    if (!pwalletMain->IsLocked())
-        pwalletMain->TopUpKeyPool();
-
     CReserveKey reservekey(pwalletMain);
     CPubKey vchPubKey;
     if (!reservekey.GetReservedKey(vchPubKey))
@@ -1473,10 +1470,12 @@ void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Un
     }
 }
 
-UniValue listtransactions(const UniValue& params, bool fHelp)
+void streamlisttransactions(const UniValue& params, bool fHelp, CJSONWriter& writer)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
-        return NullUniValue;
+    if (!EnsureWalletIsAvailable(fHelp)) {
+        writer.Value(NullUniValue);
+        return;
+    }
 
     if (fHelp || params.size() > 4)
         throw runtime_error(
@@ -1538,8 +1537,6 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
             + HelpExampleRpc("listtransactions", "\"*\", 20, 100")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     string strAccount = "*";
     if (params.size() > 0)
         strAccount = params[0].get_str();
@@ -1561,19 +1558,23 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
 
     UniValue ret(UniValue::VARR);
 
-    const CWallet::TxItems & txOrdered = pwalletMain->wtxOrdered;
-
-    // iterate backwards until we have nCount items to return:
-    for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
     {
-        CWalletTx *const pwtx = (*it).second.first;
-        if (pwtx != 0)
-            ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
-        CAccountingEntry *const pacentry = (*it).second.second;
-        if (pacentry != 0)
-            AcentryToJSON(*pacentry, strAccount, ret);
-
-        if ((int)ret.size() >= (nCount+nFrom)) break;
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        const CWallet::TxItems & txOrdered = pwalletMain->wtxOrdered;
+
+        // iterate backwards until we have nCount items to return:
+        for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+        {
+            CWalletTx *const pwtx = (*it).second.first;
+            if (pwtx != 0)
+                ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
+            CAccountingEntry *const pacentry = (*it).second.second;
+            if (pacentry != 0)
+                AcentryToJSON(*pacentry, strAccount, ret);
+
+            if ((int)ret.size() >= (nCount+nFrom)) break;
+        }
     }
     // ret is newest to oldest
 
@@ -1582,22 +1583,96 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
     if ((nFrom + nCount) > (int)ret.size())
         nCount = ret.size() - nFrom;
 
-    vector<UniValue> arrTmp = ret.getValues();
+    // Return oldest to newest, written without the wallet locked
+    writer.BeginArray();
+    for (int i = nFrom + nCount - 1; i >= nFrom; i--)
+        writer.Value(ret[i]);
+    writer.EndArray();
+}
 
-    vector<UniValue>::iterator first = arrTmp.begin();
-    std::advance(first, nFrom);
-    vector<UniValue>::iterator last = arrTmp.begin();
-    std::advance(last, nFrom+nCount);
+UniValue listtransactions(const UniValue& params, bool fHelp)
+{
+    UniValue result;
+    CJSONTreeWriter writer(result);
+    streamlisttransactions(params, fHelp, writer);
+    return result;
+}
 
-    if (last != arrTmp.end()) arrTmp.erase(last, arrTmp.end());
-    if (first != arrTmp.begin()) arrTmp.erase(arrTmp.begin(), first);
+UniValue listtransactionpage(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
 
-    std::reverse(arrTmp.begin(), arrTmp.end()); // Return oldest to newest
+    if (fHelp || params.size() > 3)
+        throw runtime_error(
+            "listtransactionpage ( cursor count includeWatchonly )\n"
+            "\nReturns a page of the wallet's transactions, as listtransactions \"*\" does, going back from the newest.\n"
+            "Each page takes the same time however far back it is.\n"
+            "\nArguments:\n"
+            "1. cursor           (numeric, optional) The cursor the previous page returned; omit it for the newest page\n"
+            "2. count            (numeric, optional, default=10) The number of entries to return. A page can have a few more,\n"
+            "                    as the entries of a transaction are never split between pages\n"
+            "3. includeWatchonly (bool, optional, default=false) Include transactions to watchonly addresses (see 'importaddress')\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"transactions\": [...],  (array) The entries, oldest to newest, as listtransactions returns them\n"
+            "  \"cursor\": n             (numeric) The cursor of the next, older, page. Not present on the oldest page\n"
+            "}\n"
+            "\nExamples:\n"
+            "\nList the most recent 100 entries\n"
+            + HelpExampleCli("listtransactionpage", "") +
+            "\nList the 100 before those\n"
+            + HelpExampleCli("listtransactionpage", "2412 100") +
+            "\nAs a json rpc call\n"
+            + HelpExampleRpc("listtransactionpage", "2412, 100")
+        );
+
+    int64_t nCursor = std::numeric_limits<int64_t>::max();
+    if (params.size() > 0 && !params[0].isNull())
+        nCursor = params[0].get_int64();
+    int nCount = 10;
+    if (params.size() > 1)
+        nCount = params[1].get_int();
+    isminefilter filter = ISMINE_SPENDABLE;
+    if (params.size() > 2)
+        if (params[2].get_bool())
+            filter = filter | ISMINE_WATCH_ONLY;
 
-    ret.clear();
-    ret.setArray();
-    ret.push_backV(arrTmp);
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+
+    UniValue entries(UniValue::VARR);
+    UniValue ret(UniValue::VOBJ);
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
 
+        // wtxOrdered is the wallet's index by order position, so a page
+        // starts with a lookup instead of a walk over the newer entries.
+        const CWallet::TxItems& txOrdered = pwalletMain->wtxOrdered;
+        CWallet::TxItems::const_reverse_iterator it(txOrdered.lower_bound(nCursor));
+        for (; it != txOrdered.rend(); ++it)
+        {
+            // A cursor is an order position, so the page must not end
+            // between entries that share one.
+            if ((int)entries.size() >= nCount && it->first != nCursor)
+                break;
+            nCursor = it->first;
+            CWalletTx *const pwtx = it->second.first;
+            if (pwtx != 0)
+                ListTransactions(*pwtx, "*", 0, true, entries, filter);
+            CAccountingEntry *const pacentry = it->second.second;
+            if (pacentry != 0)
+                AcentryToJSON(*pacentry, "*", entries);
+        }
+        if (it != txOrdered.rend())
+            ret.push_back(Pair("cursor", nCursor));
+    }
+
+    // entries is newest to oldest; return oldest to newest
+    UniValue transactions(UniValue::VARR);
+    for (int i = (int)entries.size() - 1; i >= 0; i--)
+        transactions.push_back(entries[i]);
+    ret.push_back(Pair("transactions", transactions));
     return ret;
 }
 
@@ -1754,9 +1829,9 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
 
     UniValue transactions(UniValue::VARR);
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+    for (map<uint256, CWalletTx>::const_iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
     {
-        CWalletTx tx = (*it).second;
+        const CWalletTx& tx = (*it).second;
 
         if (depth == -1 || tx.GetDepthInMainChain() < depth)
             ListTransactions(tx, "*", 0, true, transactions, filter);
@@ -2406,6 +2481,27 @@ UniValue resendwallettransactions(const UniValue& params, bool fHelp)
     return result;
 }
 
+/** An output listunspent reports, copied out of the wallet. */
+struct CUnspentResult
+{
+    uint256 txid;
+    int vout;
+    bool fValidAddress;
+    CTxDestination address;
+    bool fHaveAccount;
+    std::string strAccount;
+    bool fHaveRedeemScript;
+    CScript redeemScript;
+    CScript scriptPubKey;
+    CAmount nValue;
+    int nDepth;
+    bool fSpendable;
+    bool fSolvable;
+    uint256 blinder;
+
+    CUnspentResult() : vout(0), fValidAddress(false), fHaveAccount(false), fHaveRedeemScript(false), nValue(0), nDepth(0), fSpendable(false), fSolvable(false) {}
+};
+
 UniValue listunspent(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -2474,53 +2570,81 @@ UniValue listunspent(const UniValue& params, bool fHelp)
         }
     }
 
-    UniValue results(UniValue::VARR);
-    vector<COutput> vecOutputs;
-    assert(pwalletMain != NULL);
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
-    BOOST_FOREACH(const COutput& out, vecOutputs) {
-        if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
-            continue;
+    // Copy what the result needs out of the wallet, and only encode it once
+    // the locks are released: address encoding and hex conversion of every
+    // output should not hold up block processing or other RPC threads.
+    vector<CUnspentResult> vecResults;
+    {
+        vector<COutput> vecOutputs;
+        assert(pwalletMain != NULL);
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
+        vecResults.reserve(vecOutputs.size());
+        BOOST_FOREACH(const COutput& out, vecOutputs) {
+            if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
+                continue;
 
-        CTxDestination address;
-        const CScript& scriptPubKey = out.tx->vout[out.i].scriptPubKey;
-        bool fValidAddress = ExtractDestination(scriptPubKey, address);
+            CTxDestination address;
+            const CScript& scriptPubKey = out.tx->vout[out.i].scriptPubKey;
+            bool fValidAddress = ExtractDestination(scriptPubKey, address);
 
-        if (setAddress.size() && (!fValidAddress || !setAddress.count(address)))
-            continue;
+            if (setAddress.size() && (!fValidAddress || !setAddress.count(address)))
+                continue;
 
-        CAmount nValue = out.tx->GetValueOut(out.i);
-        if (nValue == -1)
-            continue;
+            CAmount nValue = out.tx->GetValueOut(out.i);
+            if (nValue == -1)
+                continue;
+
+            vecResults.push_back(CUnspentResult());
+            CUnspentResult& result = vecResults.back();
+            result.txid = out.tx->GetHash();
+            result.vout = out.i;
+            result.fValidAddress = fValidAddress;
+            if (fValidAddress) {
+                result.address = address;
+                map<CTxDestination, CAddressBookData>::const_iterator mi = pwalletMain->mapAddressBook.find(address);
+                if (mi != pwalletMain->mapAddressBook.end()) {
+                    result.fHaveAccount = true;
+                    result.strAccount = mi->second.name;
+                }
+                if (scriptPubKey.IsPayToScriptHash()) {
+                    const CScriptID& hash = boost::get<CScriptID>(address);
+                    result.fHaveRedeemScript = pwalletMain->GetCScript(hash, result.redeemScript);
+                }
+            }
+            result.scriptPubKey = scriptPubKey;
+            result.nValue = nValue;
+            result.nDepth = out.nDepth;
+            result.fSpendable = out.fSpendable;
+            result.fSolvable = out.fSolvable;
+            result.blinder = out.tx->GetBlindingFactor(out.i);
+        }
+    }
 
+    UniValue results(UniValue::VARR);
+    BOOST_FOREACH(const CUnspentResult& result, vecResults) {
         UniValue entry(UniValue::VOBJ);
-        entry.push_back(Pair("txid", out.tx->GetHash().GetHex()));
-        entry.push_back(Pair("vout", out.i));
+        entry.push_back(Pair("txid", result.txid.GetHex()));
+        entry.push_back(Pair("vout", result.vout));
 
-        if (fValidAddress) {
-            CBitcoinAddress addr(address);
+        if (result.fValidAddress) {
+            CBitcoinAddress addr(result.address);
             entry.push_back(Pair("address", addr.ToString()));
-            if (pwalletMain->mapAddressBook.count(address))
-                entry.push_back(Pair("account", pwalletMain->mapAddressBook[address].name));
-
-            if (scriptPubKey.IsPayToScriptHash()) {
-                const CScriptID& hash = boost::get<CScriptID>(address);
-                CScript redeemScript;
-                if (pwalletMain->GetCScript(hash, redeemScript))
-                    entry.push_back(Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
-            }
+            if (result.fHaveAccount)
+                entry.push_back(Pair("account", result.strAccount));
+            if (result.fHaveRedeemScript)
+                entry.push_back(Pair("redeemScript", HexStr(result.redeemScript.begin(), result.redeemScript.end())));
         }
 
-        entry.push_back(Pair("scriptPubKey", HexStr(scriptPubKey.begin(), scriptPubKey.end())));
-        entry.push_back(Pair("amount", ValueFromAmount(nValue)));
-        entry.push_back(Pair("confirmations", out.nDepth));
-        entry.push_back(Pair("spendable", out.fSpendable));
-        entry.push_back(Pair("solvable", out.fSolvable));
+        entry.push_back(Pair("scriptPubKey", HexStr(result.scriptPubKey.begin(), result.scriptPubKey.end())));
+        entry.push_back(Pair("amount", ValueFromAmount(result.nValue)));
+        entry.push_back(Pair("confirmations", result.nDepth));
+        entry.push_back(Pair("spendable", result.fSpendable));
+        entry.push_back(Pair("solvable", result.fSolvable));
         CDataStream ssValue(SER_NETWORK, PROTOCOL_VERSION);
-        ssValue << nValue;
+        ssValue << result.nValue;
         entry.push_back(Pair("serValue", HexStr(ssValue.begin(), ssValue.end())));
-        entry.push_back(Pair("blinder",out.tx->GetBlindingFactor(out.i).ToString()));
+        entry.push_back(Pair("blinder", result.blinder.ToString()));
         results.push_back(entry);
     }
 
@@ -2663,6 +2787,8 @@ UniValue signblock(const UniValue& params, bool fHelp)
         throw runtime_error(
             "signblock \"blockhex\"\n"
             "\nSigns a block proposal, checking that it would be accepted first\n"
+            "The signature is also combined with those of the other signers as they arrive from the network,\n"
+            "and the block is submitted once it has enough of them.\n"
             "\nArguments:\n"
             "1. \"blockhex\"    (string, required) The hex-encoded block from getnewblockhex\n"
             "\nResult\n"
@@ -2675,44 +2801,32 @@ UniValue signblock(const UniValue& params, bool fHelp)
     if (!DecodeHexBlk(block, params[0].get_str()))
         throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Block decode failed");
 
-    LOCK(cs_main);
-
-    uint256 hash = block.GetHash();
-    BlockMap::iterator mi = mapBlockIndex.find(hash);
-    if (mi != mapBlockIndex.end())
-        throw JSONRPCError(RPC_VERIFY_ERROR, "already have block");
-
-    CBlockIndex* const pindexPrev = chainActive.Tip();
-    // TestBlockValidity only supports blocks built on the current Tip
-    if (block.hashPrevBlock != pindexPrev->GetBlockHash())
-        throw JSONRPCError(RPC_VERIFY_ERROR, "proposal was not based on our best chain");
-
-    CValidationState state;
-    if (!TestBlockValidity(state, Params(), block, pindexPrev, false, true) || !state.IsValid()) {
-        std::string strRejectReason = state.GetRejectReason();
-        if (strRejectReason.empty())
-            throw JSONRPCError(RPC_VERIFY_ERROR, state.IsInvalid() ? "Block proposal was invalid" : "Error checking block proposal");
-        throw JSONRPCError(RPC_VERIFY_ERROR, strRejectReason);
-    }
+    const uint256 hash = block.GetHash();
+    {
+        LOCK(cs_main);
 
-    block.proof.solution = CScript();
-    MaybeGenerateProof(&block, pwalletMain);
-    return HexStr(block.proof.solution.begin(), block.proof.solution.end());
-}
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi != mapBlockIndex.end())
+            throw JSONRPCError(RPC_VERIFY_ERROR, "already have block");
 
-namespace {
-static secp256k1_context *secp256k1_ctx;
+        CValidationState state;
+        if (!TestProposedBlock(state, Params(), block)) {
+            std::string strRejectReason = state.GetRejectReason();
+            if (strRejectReason.empty())
+                throw JSONRPCError(RPC_VERIFY_ERROR, state.IsInvalid() ? "Block proposal was invalid" : "Error checking block proposal");
+            throw JSONRPCError(RPC_VERIFY_ERROR, strRejectReason);
+        }
 
-class CSecp256k1Init {
-public:
-    CSecp256k1Init() {
-        secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY | SECP256K1_CONTEXT_SIGN);
+        block.proof.solution = CScript();
+        MaybeGenerateProof(&block, pwalletMain);
     }
-    ~CSecp256k1Init() {
-        secp256k1_context_destroy(secp256k1_ctx);
-    }
-};
-static CSecp256k1Init instance_of_csecp256k1;
+
+    // Hand our signature to the other signers right away; this may complete
+    // the block, which is then processed without cs_main held, as submitblock
+    // does.
+    if (!block.proof.solution.empty())
+        AddBlockSignature(Params(), hash, block.proof.solution);
+    return HexStr(block.proof.solution.begin(), block.proof.solution.end());
 }
 
 CScriptID calculate_contract(const CScript& federationRedeemScript, const CBitcoinAddress& destAddress, const unsigned char nonce[16], unsigned char fullcontract[40]) {
@@ -2755,11 +2869,11 @@ CScriptID calculate_contract(const CScript& federationRedeemScript, const CBitco
                 CHMAC_SHA256(pub_start, pub_len).Write(fullcontract, 40).Finalize(tweak);
                 secp256k1_pubkey watchman;
                 secp256k1_pubkey tweaked;
-                assert(secp256k1_ec_pubkey_parse(secp256k1_ctx, &watchman, pub_start, pub_len) == 1);
-                assert(secp256k1_ec_pubkey_parse(secp256k1_ctx, &tweaked, pub_start, pub_len) == 1);
+                assert(secp256k1_ec_pubkey_parse(ECC_GetContext(), &watchman, pub_start, pub_len) == 1);
+                assert(secp256k1_ec_pubkey_parse(ECC_GetContext(), &tweaked, pub_start, pub_len) == 1);
                 // If someone creates a tweak that makes this fail, they broke SHA256
-                assert(secp256k1_ec_pubkey_tweak_add(secp256k1_ctx, &tweaked, tweak) == 1);
-                assert(secp256k1_ec_pubkey_serialize(secp256k1_ctx, pub_start, &pub_len, &tweaked, SECP256K1_EC_COMPRESSED) == 1);
+                assert(secp256k1_ec_pubkey_tweak_add(ECC_GetContext(), &tweaked, tweak) == 1);
+                assert(secp256k1_ec_pubkey_serialize(ECC_GetContext(), pub_start, &pub_len, &tweaked, SECP256K1_EC_COMPRESSED) == 1);
                 assert(pub_len == 33);
 
                 // Sanity checks to reduce pegin risk. If the tweaked
@@ -2768,13 +2882,13 @@ CScriptID calculate_contract(const CScript& federationRedeemScript, const CBitco
                 // `tweaked - watchman = tweak` to check the computation
                 // two different ways
                 secp256k1_pubkey tweaked2;
-                assert(secp256k1_ec_pubkey_create(secp256k1_ctx, &tweaked2, tweak));
-                assert(secp256k1_ec_pubkey_negate(secp256k1_ctx, &watchman));
+                assert(secp256k1_ec_pubkey_create(ECC_GetContext(), &tweaked2, tweak));
+                assert(secp256k1_ec_pubkey_negate(ECC_GetContext(), &watchman));
                 secp256k1_pubkey* pubkey_combined[2];
                 pubkey_combined[0] = &watchman;
                 pubkey_combined[1] = &tweaked;
                 secp256k1_pubkey maybe_tweaked2;
-                assert(secp256k1_ec_pubkey_combine(secp256k1_ctx, &maybe_tweaked2, pubkey_combined, 2));
+                assert(secp256k1_ec_pubkey_combine(ECC_GetContext(), &maybe_tweaked2, pubkey_combined, 2));
                 assert(!memcmp(&maybe_tweaked2, &tweaked2, 64));
             }
         }
@@ -2830,18 +2944,22 @@ UniValue sendtomainchain(const UniValue& params, bool fHelp)
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() != 2)
+    if (fHelp || params.size() < 2 || params.size() > 3)
         throw runtime_error(
-            "sendtomainchain mainchainaddress amount\n"
+            "sendtomainchain mainchainaddress amount ( queue )\n"
             "\nSends sidechain funds to the given mainchain address, through the federated withdraw mechanism\n"
             + HelpRequiringPassphrase() +
             "\nArguments:\n"
             "1. \"address\"        (string, required) The destination address on Bitcoin mainchain\n"
             "2. \"amount\"         (numeric, required) The amount being sent to Bitcoin mainchain\n"
+            "3. queue            (boolean, optional, default=false) Send it later, in one transaction with the other queued peg-outs,\n"
+            "                    once -pegoutbatchsize are queued or the oldest has waited -pegoutinterval seconds\n"
             "\nResult:\n"
-            "\"txid\"              (string) Transaction ID of the resulting sidechain transaction\n"
+            "\"txid\"              (string) Transaction ID of the resulting sidechain transaction, or with queue the id of the\n"
+            "                    request to pass to getpegout\n"
             "\nExamples:\n"
             + HelpExampleCli("sendtomainchain", "\"mgWEy4vBJSHt3mC8C2SEWJQitifb4qeZQq\" 0.1")
+            + HelpExampleCli("sendtomainchain", "\"mgWEy4vBJSHt3mC8C2SEWJQitifb4qeZQq\" 0.1 true")
             + HelpExampleRpc("sendtomainchain", "\"mgWEy4vBJSHt3mC8C2SEWJQitifb4qeZQq\" 0.1")
         );
 
@@ -2894,6 +3012,19 @@ UniValue sendtomainchain(const UniValue& params, bool fHelp)
 
     EnsureWalletIsUnlocked();
 
+    if (params.size() > 2 && params[2].get_bool()) {
+        if (nAmount > pwalletMain->GetBalance())
+            throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Insufficient funds");
+        const uint256 id = pwalletMain->QueuePegout(scriptPubKey, nAmount);
+        AuditLogPrintf("%s : sendtomainchain queued %s %s to %s\n", getUser(), id.GetHex(), FormatMoney(nAmount), address.ToString());
+        // This may be the one that fills the batch.
+        std::string strError;
+        const uint256 txid = pwalletMain->SendQueuedPegouts(false, strError);
+        if (!txid.IsNull())
+            AuditLogPrintf("%s : sendqueuedpegouts %s\n", getUser(), txid.GetHex());
+        return id.GetHex();
+    }
+
     CWalletTx wtxNew;
     SendMoney(scriptPubKey, nAmount, false, CPubKey(), wtxNew);
 
@@ -2907,38 +3038,101 @@ UniValue sendtomainchain(const UniValue& params, bool fHelp)
     return wtxNew.GetHash().GetHex();
 }
 
-extern UniValue sendrawtransaction(const UniValue& params, bool fHelp);
-
-UniValue claimpegin(const UniValue& params, bool fHelp)
+UniValue getpegout(const UniValue& params, bool fHelp)
 {
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
 
-    if (fHelp || params.size() != 3)
+    if (fHelp || params.size() != 1)
         throw runtime_error(
-            "claimpegin sidechainaddress bitcoinTx txoutproof\n"
-            "\nClaim coins from the main chain by creating a withdraw transaction with the necessary metadata after the corresponding Bitcoin transaction.\n"
-            "Note that the transaction will not be mined or relayed unless it is buried at least 10 blocks deep.\n"
-            "If a transaction is not relayed it may require manual addition to a functionary mempool in order for it to be mined.\n"
+            "getpegout \"requestid\"\n"
+            "\nReturns a peg-out queued by sendtomainchain\n"
             "\nArguments:\n"
-            "1. \"sidechain_address\"  (string, required) The sidechain_address address generated by getpeginaddress\n"
-            "2. \"bitcoinTx\"         (string, required) The raw bitcoin transaction (in hex) depositing bitcoin to the mainchain_address generated by getpeginaddress\n"
-            "3. \"txoutproof\"        (string, required) A rawtxoutproof (in hex) generated by bitcoind's `gettxoutproof` containing a proof of only bitcoinTx\n"
+            "1. \"requestid\"      (string, required) The id sendtomainchain returned\n"
             "\nResult:\n"
-            "\"txid\"                 (string) Txid of the resulting sidechain transaction\n"
+            "{\n"
+            "  \"amount\" : x.xxx,   (numeric) The amount being sent to Bitcoin mainchain\n"
+            "  \"time\" : ttt,       (numeric) The time it was queued, in seconds since epoch (Jan 1 1970 GMT)\n"
+            "  \"txid\" : \"id\",      (string) The sidechain transaction it was sent in, if it was sent\n"
+            "}\n"
             "\nExamples:\n"
-//XXX: Fix the examples
-            + HelpExampleCli("claimpegin", "\"2NEqRzqBst5rWrVx7SpwG37T17mvehLhKaN\", \"eb00b5dc3afc67beee5bfdfd79665283\" \"d50c8eec366e98b258414509d88e72ed0d2b24f63256e076d2b9d0ac3d55abc1\"")
-            + HelpExampleRpc("claimpegin", "\"2NEqRzqBst5rWrVx7SpwG37T17mvehLhKaN\", \"eb00b5dc3afc67beee5bfdfd79665283\", \"d50c8eec366e98b258414509d88e72ed0d2b24f63256e076d2b9d0ac3d55abc1\"")
+            + HelpExampleCli("getpegout", "\"1075db55d416d3ca199f55b6084e2115b9345e16c5cf302fc80e9d5fbf5d48d\"")
+            + HelpExampleRpc("getpegout", "\"1075db55d416d3ca199f55b6084e2115b9345e16c5cf302fc80e9d5fbf5d48d\"")
         );
 
-    CBitcoinAddress sidechainAddress(params[0].get_str());
-    if (!sidechainAddress.IsValid())
+    LOCK(pwalletMain->cs_wallet);
+
+    std::map<uint256, CPegoutRequest>::const_iterator it = pwalletMain->mapPegouts.find(ParseHashV(params[0], "requestid"));
+    if (it == pwalletMain->mapPegouts.end())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown peg-out request");
+
+    UniValue entry(UniValue::VOBJ);
+    entry.push_back(Pair("amount", ValueFromAmount(it->second.nAmount)));
+    entry.push_back(Pair("time", it->second.nTime));
+    if (!it->second.IsQueued())
+        entry.push_back(Pair("txid", it->second.txid.GetHex()));
+    return entry;
+}
+
+UniValue sendqueuedpegouts(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "sendqueuedpegouts\n"
+            "\nSends the peg-outs sendtomainchain queued now, in one transaction\n"
+            + HelpRequiringPassphrase() +
+            "\nResult:\n"
+            "\"txid\"              (string) Transaction ID of the resulting sidechain transaction, or empty if none were queued\n"
+            "\nExamples:\n"
+            + HelpExampleCli("sendqueuedpegouts", "")
+            + HelpExampleRpc("sendqueuedpegouts", "")
+        );
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    EnsureWalletIsUnlocked();
+
+    std::string strError;
+    const uint256 txid = pwalletMain->SendQueuedPegouts(true, strError);
+    if (txid.IsNull() && !strError.empty())
+        throw JSONRPCError(RPC_WALLET_ERROR, strError);
+    if (txid.IsNull())
+        return "";
+    AuditLogPrintf("%s : sendqueuedpegouts %s\n", getUser(), txid.GetHex());
+    if (!strError.empty())
+        throw JSONRPCError(RPC_WALLET_ERROR, strError);
+    return txid.GetHex();
+}
+
+extern UniValue sendrawtransaction(const UniValue& params, bool fHelp);
+
+/** A mainchain deposit to claim, as checked by ParsePeginClaim */
+struct CPeginClaim
+{
+    CBitcoinAddress sidechainAddress;
+    std::vector<unsigned char> txData;
+    std::vector<unsigned char> txOutProofData;
+    uint256 parentBlockHash;
+    unsigned char fullcontract[40];
+    unsigned int nOut;
+    CAmount value;
+};
+
+/** Check a claim's arguments, throwing as claimpegin does if they are invalid. Needs no locks. */
+static void ParsePeginClaim(const UniValue& address, const UniValue& bitcoinTx, const UniValue& txoutproof, CPeginClaim& claim)
+{
+    claim.sidechainAddress = CBitcoinAddress(address.get_str());
+    if (!claim.sidechainAddress.IsValid())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid sidechain_address");
 
-    if (!IsHex(params[1].get_str()) || !IsHex(params[2].get_str()))
+    if (!IsHex(bitcoinTx.get_str()) || !IsHex(txoutproof.get_str()))
         throw JSONRPCError(RPC_TYPE_ERROR, "the last two arguments must be hex strings");
 
-    std::vector<unsigned char> txData = ParseHex(params[1].get_str());
-    CDataStream ssTx(txData, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX);
+    claim.txData = ParseHex(bitcoinTx.get_str());
+    CDataStream ssTx(claim.txData, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX);
     CTransaction txBTC;
     try {
         ssTx >> txBTC;
@@ -2947,8 +3141,8 @@ UniValue claimpegin(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_TYPE_ERROR, "The included bitcoinTx is malformed. Are you sure that is the whole string?");
     }
 
-    std::vector<unsigned char> txOutProofData = ParseHex(params[2].get_str());
-    CDataStream ssTxOutProof(txOutProofData, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX);
+    claim.txOutProofData = ParseHex(txoutproof.get_str());
+    CDataStream ssTxOutProof(claim.txOutProofData, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_BITCOIN_BLOCK_OR_TX);
     CMerkleBlock merkleBlock;
     try {
         ssTxOutProof >> merkleBlock;
@@ -2958,6 +3152,7 @@ UniValue claimpegin(const UniValue& params, bool fHelp)
     }
     if (!ssTxOutProof.empty() || !CheckBitcoinProof(merkleBlock.header))
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid tx out proof");
+    claim.parentBlockHash = merkleBlock.header.GetHash();
 
     vector<uint256> txHashes;
     vector<unsigned int> txIndices;
@@ -2970,16 +3165,24 @@ UniValue claimpegin(const UniValue& params, bool fHelp)
     //Call contracthashtool
     unsigned char nonce[16];
     memset(nonce, 0, sizeof(nonce));
-    unsigned char fullcontract[40];
-    CScript mainchain_script = GetScriptForDestination(calculate_contract(Params().GetConsensus().fedpegScript, sidechainAddress, &nonce[0], fullcontract));
+    CScript mainchain_script = GetScriptForDestination(calculate_contract(Params().GetConsensus().fedpegScript, claim.sidechainAddress, &nonce[0], claim.fullcontract));
 
-    unsigned int nOut = 0;
-    for (; nOut < txBTC.vout.size(); nOut++)
-        if (txBTC.vout[nOut].scriptPubKey == mainchain_script)
+    claim.nOut = 0;
+    for (; claim.nOut < txBTC.vout.size(); claim.nOut++)
+        if (txBTC.vout[claim.nOut].scriptPubKey == mainchain_script)
             break;
-    if (nOut == txBTC.vout.size())
+    if (claim.nOut == txBTC.vout.size())
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Failed to find output in bitcoinTx to the mainchain_address from getpeginaddress");
-    CAmount value = txBTC.vout[nOut].nValue.GetAmount();
+    claim.value = txBTC.vout[claim.nOut].nValue.GetAmount();
+
+    if (claim.value > MAX_MONEY / 200)
+        throw JSONRPCError(RPC_VERIFY_REJECTED, "IsStandard rules prevent pegging-in > 0.105 million BTC reliably at a time - please work with your functionary to mine a large lock-merge transaction first");
+}
+
+/** Pick the locks for a checked claim, build its transaction and send it. Returns its txid. */
+static uint256 SendPeginClaim(const CPeginClaim& claim)
+{
+    AssertLockHeld(cs_main);
 
     uint256 genesisBlockHash = Params().ParentGenesisBlockHash();
 
@@ -2988,14 +3191,10 @@ UniValue claimpegin(const UniValue& params, bool fHelp)
     relock_spk << std::vector<unsigned char>(genesisBlockHash.begin(), genesisBlockHash.end());
     relock_spk << OP_WITHDRAWPROOFVERIFY;
 
-    if (value > MAX_MONEY / 200)
-        throw JSONRPCError(RPC_VERIFY_REJECTED, "IsStandard rules prevent pegging-in > 0.105 million BTC reliably at a time - please work with your functionary to mine a large lock-merge transaction first");
-
     //Pad the locked outputs by the IsStandard lock dust value
     CTxOut dummyTxOut(0, relock_spk);
     CAmount lockDust(dummyTxOut.GetDustThreshold(withdrawLockTxFee));
-
-    LOCK(cs_main);
+    const CAmount value = claim.value;
 
     std::vector<std::pair<COutPoint, CAmount> > lockedUTXO;
     if (!GetLockedOutputs(genesisBlockHash, value+lockDust, lockedUTXO))
@@ -3026,15 +3225,15 @@ UniValue claimpegin(const UniValue& params, bool fHelp)
 
 
     CScript scriptSig;
-    scriptSig << std::vector<unsigned char>(fullcontract, fullcontract + 40);
-    scriptSig.PushWithdraw(txOutProofData);
-    scriptSig.PushWithdraw(txData);
-    scriptSig << nOut;
+    scriptSig << std::vector<unsigned char>(claim.fullcontract, claim.fullcontract + 40);
+    scriptSig.PushWithdraw(claim.txOutProofData);
+    scriptSig.PushWithdraw(claim.txData);
+    scriptSig << claim.nOut;
 
     //Build the transaction
     CMutableTransaction mtxn;
     CTxIn txin(utxo_txid, utxo_vout, scriptSig, ~(uint32_t)0);
-    CTxOut txout(value, GetScriptForDestination(sidechainAddress.Get()));
+    CTxOut txout(value, GetScriptForDestination(claim.sidechainAddress.Get()));
     CTxOut txrelock(utxo_value - value, relock_spk);
     mtxn.vin.push_back(txin);
     mtxn.vout.push_back(txout);
@@ -3048,7 +3247,126 @@ UniValue claimpegin(const UniValue& params, bool fHelp)
 
     sendrawtransaction(signedTxnArray, false);
     AuditLogPrintf("%s : claimpegin %s\n", getUser(), finalTxn.ToString());
-    return finalTxn.GetHash().GetHex();
+    return finalTxn.GetHash();
+}
+
+UniValue claimpegin(const UniValue& params, bool fHelp)
+{
+
+    if (fHelp || params.size() != 3)
+        throw runtime_error(
+            "claimpegin sidechainaddress bitcoinTx txoutproof\n"
+            "\nClaim coins from the main chain by creating a withdraw transaction with the necessary metadata after the corresponding Bitcoin transaction.\n"
+            "Note that the transaction will not be mined or relayed unless it is buried at least 10 blocks deep.\n"
+            "If a transaction is not relayed it may require manual addition to a functionary mempool in order for it to be mined.\n"
+            "\nArguments:\n"
+            "1. \"sidechain_address\"  (string, required) The sidechain_address address generated by getpeginaddress\n"
+            "2. \"bitcoinTx\"         (string, required) The raw bitcoin transaction (in hex) depositing bitcoin to the mainchain_address generated by getpeginaddress\n"
+            "3. \"txoutproof\"        (string, required) A rawtxoutproof (in hex) generated by bitcoind's `gettxoutproof` containing a proof of only bitcoinTx\n"
+            "\nResult:\n"
+            "\"txid\"                 (string) Txid of the resulting sidechain transaction\n"
+            "\nExamples:\n"
+//XXX: Fix the examples
+            + HelpExampleCli("claimpegin", "\"2NEqRzqBst5rWrVx7SpwG37T17mvehLhKaN\", \"eb00b5dc3afc67beee5bfdfd79665283\" \"d50c8eec366e98b258414509d88e72ed0d2b24f63256e076d2b9d0ac3d55abc1\"")
+            + HelpExampleRpc("claimpegin", "\"2NEqRzqBst5rWrVx7SpwG37T17mvehLhKaN\", \"eb00b5dc3afc67beee5bfdfd79665283\", \"d50c8eec366e98b258414509d88e72ed0d2b24f63256e076d2b9d0ac3d55abc1\"")
+        );
+
+    CPeginClaim claim;
+    ParsePeginClaim(params[0], params[1], params[2], claim);
+
+    LOCK(cs_main);
+    return SendPeginClaim(claim).GetHex();
+}
+
+UniValue claimpegins(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "claimpegins [{\"sidechain_address\":\"address\",\"bitcoinTx\":\"hex\",\"txoutproof\":\"hex\"},...]\n"
+            "\nClaim several main chain deposits at once, as claimpegin does for one. The parent chain blocks of all\n"
+            "claims are checked in one round trip to bitcoind, and the locks are picked for all claims under one lock\n"
+            "of the chain state, largest claims first. Claims fail independently of each other.\n"
+            "\nArguments:\n"
+            "1. claims                     (array, required) The deposits to claim\n"
+            "  [\n"
+            "    {\n"
+            "      \"sidechain_address\": \"address\", (string, required) The sidechain_address generated by getpeginaddress\n"
+            "      \"bitcoinTx\": \"hex\",            (string, required) The raw bitcoin transaction depositing to its mainchain_address\n"
+            "      \"txoutproof\": \"hex\"            (string, required) A rawtxoutproof from bitcoind's `gettxoutproof` of only bitcoinTx\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "\nResult:\n"
+            "[                             (array) One entry per claim, in the order given\n"
+            "  {\n"
+            "    \"txid\": \"txid\",           (string) Txid of the resulting sidechain transaction, if the claim succeeded\n"
+            "    \"error\": {...}            (object) The error claimpegin would have returned, if it failed\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("claimpegins", "'[{\"sidechain_address\":\"2NEqRzqBst5rWrVx7SpwG37T17mvehLhKaN\",\"bitcoinTx\":\"eb00b5dc3afc67beee5bfdfd79665283\",\"txoutproof\":\"d50c8eec366e98b258414509d88e72ed0d2b24f63256e076d2b9d0ac3d55abc1\"}]'")
+            + HelpExampleRpc("claimpegins", "[{\"sidechain_address\":\"2NEqRzqBst5rWrVx7SpwG37T17mvehLhKaN\",\"bitcoinTx\":\"eb00b5dc3afc67beee5bfdfd79665283\",\"txoutproof\":\"d50c8eec366e98b258414509d88e72ed0d2b24f63256e076d2b9d0ac3d55abc1\"}]")
+        );
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VARR));
+    const UniValue& claims = params[0].get_array();
+
+    std::vector<CPeginClaim> vClaims(claims.size());
+    std::vector<UniValue> vResults(claims.size());
+    std::vector<uint256> vParentBlocks;
+    for (size_t i = 0; i < claims.size(); i++) {
+        try {
+            const UniValue& o = claims[i].get_obj();
+            RPCTypeCheckObj(o, boost::assign::map_list_of("sidechain_address", UniValueType(UniValue::VSTR))("bitcoinTx", UniValueType(UniValue::VSTR))("txoutproof", UniValueType(UniValue::VSTR)));
+            ParsePeginClaim(find_value(o, "sidechain_address"), find_value(o, "bitcoinTx"), find_value(o, "txoutproof"), vClaims[i]);
+            vParentBlocks.push_back(vClaims[i].parentBlockHash);
+        } catch (const UniValue& objError) {
+            vResults[i] = objError;
+        } catch (const std::exception& e) {
+            vResults[i] = JSONRPCError(RPC_TYPE_ERROR, e.what());
+        }
+    }
+
+    // Sending each claim checks its parent block under cs_main, so ask
+    // bitcoind about all of them beforehand, in one go and without the lock.
+    if (GetBoolArg("-validatepegin", false))
+        PrefetchConfirmedBitcoinBlocks(Params().ParentGenesisBlockHash(), vParentBlocks);
+
+    // Largest first, so that each claim gets the smallest lock that covers
+    // it while larger locks are still left for the claims that need them.
+    std::vector<std::pair<CAmount, size_t> > vOrder;
+    for (size_t i = 0; i < claims.size(); i++)
+        if (vResults[i].isNull())
+            vOrder.push_back(std::make_pair(vClaims[i].value, i));
+    std::sort(vOrder.rbegin(), vOrder.rend());
+
+    {
+        LOCK(cs_main);
+        for (size_t j = 0; j < vOrder.size(); j++) {
+            const size_t i = vOrder[j].second;
+            try {
+                vResults[i] = UniValue(UniValue::VOBJ);
+                vResults[i].push_back(Pair("txid", SendPeginClaim(vClaims[i]).GetHex()));
+            } catch (const UniValue& objError) {
+                vResults[i] = objError;
+            } catch (const std::exception& e) {
+                vResults[i] = JSONRPCError(RPC_MISC_ERROR, e.what());
+            }
+        }
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (size_t i = 0; i < vResults.size(); i++) {
+        if (vResults[i].isObject() && !find_value(vResults[i], "txid").isNull()) {
+            ret.push_back(vResults[i]);
+            continue;
+        }
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("error", vResults[i]));
+        ret.push_back(entry);
+    }
+    return ret;
 }
 
 extern UniValue dumpprivkey(const UniValue& params, bool fHelp); // in rpcdump.cpp
@@ -3061,6 +3379,7 @@ extern UniValue importprunedfunds(const UniValue& params, bool fHelp);
 extern UniValue removeprunedfunds(const UniValue& params, bool fHelp);
 extern UniValue dumpblindingkey(const UniValue& params, bool fHelp);
 extern UniValue importblindingkey(const UniValue& params, bool fHelp);
+extern UniValue importmulti(const UniValue& params, bool fHelp);
 
 static const CRPCCommand commands[] =
 { //  category              name                        actor (function)           okSafeMode
@@ -3075,6 +3394,7 @@ static const CRPCCommand commands[] =
     { "wallet",             "dumpprivkey",              &dumpprivkey,              true  },
     { "wallet",             "dumpwallet",               &dumpwallet,               true  },
     { "wallet",             "claimpegin",               &claimpegin,               false },
+    { "wallet",             "claimpegins",              &claimpegins,              false },
     { "wallet",             "encryptwallet",            &encryptwallet,            true  },
     { "wallet",             "getaccountaddress",        &getaccountaddress,        true  },
     { "wallet",             "getaccount",               &getaccount,               true  },
@@ -3092,6 +3412,7 @@ static const CRPCCommand commands[] =
     { "wallet",             "importwallet",             &importwallet,             true  },
     { "wallet",             "importaddress",            &importaddress,            true  },
     { "wallet",             "importblindingkey",        &importblindingkey,        true  },
+    { "wallet",             "importmulti",              &importmulti,              true  },
     { "wallet",             "importprunedfunds",        &importprunedfunds,        true  },
     { "wallet",             "importpubkey",             &importpubkey,             true  },
     { "wallet",             "keypoolrefill",            &keypoolrefill,            true  },
@@ -3102,6 +3423,7 @@ static const CRPCCommand commands[] =
     { "wallet",             "listreceivedbyaddress",    &listreceivedbyaddress,    false },
     { "wallet",             "listsinceblock",           &listsinceblock,           false },
     { "wallet",             "listtransactions",         &listtransactions,         false },
+    { "wallet",             "listtransactionpage",      &listtransactionpage,      false },
     { "wallet",             "listunspent",              &listunspent,              false },
     { "wallet",             "lockunspent",              &lockunspent,              true  },
     { "wallet",             "move",                     &movecmd,                  false },
@@ -3109,6 +3431,8 @@ static const CRPCCommand commands[] =
     { "wallet",             "sendmany",                 &sendmany,                 false },
     { "wallet",             "sendtoaddress",            &sendtoaddress,            false },
     { "wallet",             "sendtomainchain",          &sendtomainchain,          false },
+    { "wallet",             "getpegout",                &getpegout,                true  },
+    { "wallet",             "sendqueuedpegouts",        &sendqueuedpegouts,        false },
     { "wallet",             "setaccount",               &setaccount,               true  },
     { "wallet",             "settxfee",                 &settxfee,                 true  },
     { "wallet",             "signblock",                &signblock,                true  },
@@ -3119,8 +3443,16 @@ static const CRPCCommand commands[] =
     { "wallet",             "removeprunedfunds",        &removeprunedfunds,        true  },
 };
 
+static const CRPCStreamCommand streamCommands[] =
+{ //  name                      stream actor (function)
+  //  ------------------------  -----------------------
+    { "listtransactions",       &streamlisttransactions  },
+};
+
 void RegisterWalletRPCCommands(CRPCTable &tableRPC)
 {
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+    for (unsigned int vcidx = 0; vcidx < ARRAYLEN(streamCommands); vcidx++)
+        tableRPC.appendStreamCommand(streamCommands[vcidx].name, &streamCommands[vcidx]);
 }
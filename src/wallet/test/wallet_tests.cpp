@@ -351,4 +351,65 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
 }
 
+BOOST_AUTO_TEST_CASE(branch_and_bound)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+
+    empty_wallet();
+
+    add_coin(21 * CENT / 10);
+    add_coin( 3 * CENT);
+    add_coin( 5 * CENT);
+    add_coin( 9 * CENT);
+
+    // Without a cost of change, the knapsack solver leaves at least MIN_CHANGE
+    BOOST_CHECK(wallet.SelectCoinsMinConf(10 * CENT, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK(nValueRet >= 10 * CENT + MIN_CHANGE);
+
+    // 2.1 + 3 + 5 overshoots by less than the cost of change
+    BOOST_CHECK(wallet.SelectCoinsMinConf(10 * CENT, 1, 6, vCoins, setCoinsRet, nValueRet, CENT / 5));
+    BOOST_CHECK_EQUAL(nValueRet, 101 * CENT / 10);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 3U);
+
+    // Nothing falls within the window, so fall back to the knapsack solver
+    BOOST_CHECK(wallet.SelectCoinsMinConf(13 * CENT, 1, 6, vCoins, setCoinsRet, nValueRet, CENT / 5));
+    BOOST_CHECK(nValueRet >= 13 * CENT + MIN_CHANGE);
+
+    // Many equal coins must not blow up the search
+    empty_wallet();
+    for (int i = 0; i < 1000; i++)
+        add_coin(CENT);
+    BOOST_CHECK(wallet.SelectCoinsMinConf(55 * CENT / 10, 1, 6, vCoins, setCoinsRet, nValueRet, CENT / 10));
+    BOOST_CHECK(nValueRet >= 55 * CENT / 10 + MIN_CHANGE);
+    BOOST_CHECK(wallet.SelectCoinsMinConf(5 * CENT, 1, 6, vCoins, setCoinsRet, nValueRet, CENT / 10));
+    BOOST_CHECK_EQUAL(nValueRet, 5 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 5U);
+    empty_wallet();
+}
+
+BOOST_AUTO_TEST_CASE(ismine_cache)
+{
+    CWallet keywallet;
+    LOCK(keywallet.cs_wallet);
+
+    CKey key;
+    key.MakeNewKey(true);
+    CTxOut txout;
+    txout.scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // Cached results go when keys or watch-only scripts come and go
+    BOOST_CHECK_EQUAL(keywallet.IsMine(txout), ISMINE_NO);
+    BOOST_CHECK_EQUAL(keywallet.IsMine(txout), ISMINE_NO);
+    BOOST_CHECK(keywallet.AddWatchOnly(txout.scriptPubKey));
+    BOOST_CHECK(keywallet.IsMine(txout) & ISMINE_WATCH_ONLY);
+    BOOST_CHECK(keywallet.RemoveWatchOnly(txout.scriptPubKey));
+    BOOST_CHECK_EQUAL(keywallet.IsMine(txout), ISMINE_NO);
+    BOOST_CHECK(keywallet.AddKeyPubKey(key, key.GetPubKey()));
+    BOOST_CHECK_EQUAL(keywallet.IsMine(txout), ISMINE_SPENDABLE);
+    BOOST_CHECK_EQUAL(keywallet.IsMine(txout), ISMINE_SPENDABLE);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
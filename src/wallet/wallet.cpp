@@ -19,17 +19,22 @@
 #include "policy/policy.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "random.h"
 #include "script/script.h"
 #include "script/sign.h"
 #include "timedata.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "ui_interface.h"
 #include "utilmoneystr.h"
 
 #include <assert.h>
+#include <atomic>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -43,6 +48,8 @@ CFeeRate payTxFee(DEFAULT_TRANSACTION_FEE);
 unsigned int nTxConfirmTarget = DEFAULT_TX_CONFIRM_TARGET;
 bool bSpendZeroConfChange = DEFAULT_SPEND_ZEROCONF_CHANGE;
 bool fSendFreeTransactions = DEFAULT_SEND_FREE_TRANSACTIONS;
+int64_t nPegoutInterval = DEFAULT_PEGOUT_INTERVAL;
+unsigned int nPegoutBatchSize = DEFAULT_PEGOUT_BATCH_SIZE;
 
 const char * DEFAULT_WALLET_DAT = "wallet.dat";
 const uint32_t BIP32_HARDENED_KEY_LIMIT = 0x80000000;
@@ -137,7 +144,8 @@ CPubKey CWallet::GenerateNewKey()
         secret = childKey.key;
 
         // update the chain model in the database
-        if (!CWalletDB(strWalletFile).WriteHDChain(hdChain))
+        bool fWritten = pwalletdbBatch ? pwalletdbBatch->WriteHDChain(hdChain) : CWalletDB(strWalletFile).WriteHDChain(hdChain);
+        if (!fWritten)
             throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
     } else {
         secret.MakeNewKey(fCompressed);
@@ -154,8 +162,12 @@ CPubKey CWallet::GenerateNewKey()
     if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
         nTimeFirstKey = nCreationTime;
 
+    // A freshly generated key cannot own outputs already in the wallet, so
+    // it leaves the unspent index as valid as it was.
+    bool fWasUnspentStale = fUnspentStale;
     if (!AddKeyPubKey(secret, pubkey))
         throw std::runtime_error(std::string(__func__) + ": AddKey failed");
+    fUnspentStale = fWasUnspentStale;
     return pubkey;
 }
 
@@ -164,6 +176,8 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    ClearIsMineCache();
+    fUnspentStale = true;
 
     // check if we need to remove from watch-only
     CScript script;
@@ -177,6 +191,10 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
+        if (pwalletdbBatch)
+            return pwalletdbBatch->WriteKey(pubkey,
+                                            secret.GetPrivKey(),
+                                            mapKeyMetadata[pubkey.GetID()]);
         return CWalletDB(strWalletFile).WriteKey(pubkey,
                                                  secret.GetPrivKey(),
                                                  mapKeyMetadata[pubkey.GetID()]);
@@ -189,6 +207,7 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    ClearIsMineCache();
     if (!fFileBacked)
         return true;
     {
@@ -197,6 +216,10 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
             return pwalletdbEncryption->WriteCryptedKey(vchPubKey,
                                                         vchCryptedSecret,
                                                         mapKeyMetadata[vchPubKey.GetID()]);
+        else if (pwalletdbBatch)
+            return pwalletdbBatch->WriteCryptedKey(vchPubKey,
+                                                   vchCryptedSecret,
+                                                   mapKeyMetadata[vchPubKey.GetID()]);
         else
             return CWalletDB(strWalletFile).WriteCryptedKey(vchPubKey,
                                                             vchCryptedSecret,
@@ -205,6 +228,14 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
     return false;
 }
 
+bool CWallet::LoadKey(const CKey& key, const CPubKey &pubkey)
+{
+    if (!CCryptoKeyStore::AddKeyPubKey(key, pubkey))
+        return false;
+    ClearIsMineCache();
+    return true;
+}
+
 bool CWallet::LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &meta)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
@@ -217,16 +248,24 @@ bool CWallet::LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &meta)
 
 bool CWallet::LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
-    return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
+    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+        return false;
+    ClearIsMineCache();
+    return true;
 }
 
 bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    ClearIsMineCache();
+    fUnspentStale = true;
     if (!fFileBacked)
         return true;
-    return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
+    if (pwalletdbBatch)
+        return pwalletdbBatch->WriteCScript(Hash160(redeemScript), redeemScript);
+    // Left for the flush thread to write out, see ThreadFlushWalletDB
+    return CWalletDB(strWalletFile, "r+", false).WriteCScript(Hash160(redeemScript), redeemScript);
 }
 
 bool CWallet::LoadCScript(const CScript& redeemScript)
@@ -242,18 +281,26 @@ bool CWallet::LoadCScript(const CScript& redeemScript)
         return true;
     }
 
-    return CCryptoKeyStore::AddCScript(redeemScript);
+    if (!CCryptoKeyStore::AddCScript(redeemScript))
+        return false;
+    ClearIsMineCache();
+    return true;
 }
 
 bool CWallet::AddWatchOnly(const CScript &dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    ClearIsMineCache();
+    fUnspentStale = true;
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
         return true;
-    return CWalletDB(strWalletFile).WriteWatchOnly(dest);
+    if (pwalletdbBatch)
+        return pwalletdbBatch->WriteWatchOnly(dest);
+    // Left for the flush thread to write out, see ThreadFlushWalletDB
+    return CWalletDB(strWalletFile, "r+", false).WriteWatchOnly(dest);
 }
 
 bool CWallet::RemoveWatchOnly(const CScript &dest)
@@ -261,6 +308,8 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    ClearIsMineCache();
+    fUnspentStale = true;
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -272,7 +321,10 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
 
 bool CWallet::LoadWatchOnly(const CScript &dest)
 {
-    return CCryptoKeyStore::AddWatchOnly(dest);
+    if (!CCryptoKeyStore::AddWatchOnly(dest))
+        return false;
+    ClearIsMineCache();
+    return true;
 }
 
 bool CWallet::Unlock(const SecureString& strWalletPassphrase)
@@ -551,6 +603,53 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+void CWallet::UpdateUnspent(const CWalletTx& wtx, unsigned int n) const
+{
+    AssertLockHeld(cs_wallet);
+    if (fUnspentStale)
+        return;
+
+    const COutPoint outpoint(wtx.GetHash(), n);
+    isminetype mine = IsMine(wtx.vout[n]);
+    if (mine != ISMINE_NO && !IsSpent(outpoint.hash, n)) {
+        UnspentIndex::iterator it = mapUnspent.find(outpoint);
+        if (it == mapUnspent.end())
+            mapUnspent.insert(make_pair(outpoint, CUnspentOutput(wtx.GetValueOut(n), mine)));
+        else
+            it->second.mine = mine;
+    } else {
+        mapUnspent.erase(outpoint);
+    }
+}
+
+void CWallet::UpdateUnspent(const CWalletTx& wtx) const
+{
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+        UpdateUnspent(wtx, i);
+}
+
+void CWallet::UpdateUnspentInputs(const CTransaction& tx) const
+{
+    if (fUnspentStale || tx.IsCoinBase())
+        return;
+
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
+        if (mi != mapWallet.end() && txin.prevout.n < mi->second.vout.size())
+            UpdateUnspent(mi->second, txin.prevout.n);
+    }
+}
+
+void CWallet::RebuildUnspent() const
+{
+    AssertLockHeld(cs_wallet);
+    mapUnspent.clear();
+    fUnspentStale = false;
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateUnspent(it->second);
+}
+
 bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 {
     if (IsCrypted())
@@ -744,6 +843,22 @@ void CWallet::MarkDirty()
     }
 }
 
+void CWallet::LoadToWallet(CWalletTx& wtx)
+{
+    assert(&mapWallet[wtx.GetHash()] == &wtx);
+    wtx.BindWallet(this);
+    wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
+    AddToSpends(wtx.GetHash());
+    BOOST_FOREACH(const CTxIn& txin, wtx.vin) {
+        if (mapWallet.count(txin.prevout.hash)) {
+            CWalletTx& prevtx = mapWallet[txin.prevout.hash];
+            if (prevtx.nIndex == -1 && !prevtx.hashUnset()) {
+                MarkConflicted(prevtx.hashBlock, wtx.GetHash());
+            }
+        }
+    }
+}
+
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb)
 {
     uint256 hash = wtxIn.GetHash();
@@ -751,18 +866,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
     if (fFromLoadWallet)
     {
         mapWallet[hash] = wtxIn;
-        CWalletTx& wtx = mapWallet[hash];
-        wtx.BindWallet(this);
-        wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
-        AddToSpends(hash);
-        BOOST_FOREACH(const CTxIn& txin, wtx.vin) {
-            if (mapWallet.count(txin.prevout.hash)) {
-                CWalletTx& prevtx = mapWallet[txin.prevout.hash];
-                if (prevtx.nIndex == -1 && !prevtx.hashUnset()) {
-                    MarkConflicted(prevtx.hashBlock, wtx.GetHash());
-                }
-            }
-        }
+        LoadToWallet(mapWallet[hash]);
     }
     else
     {
@@ -863,6 +967,9 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         // Break debit/credit balance caches:
         wtx.MarkDirty();
 
+        UpdateUnspent(wtx);
+        UpdateUnspentInputs(wtx);
+
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
@@ -912,6 +1019,9 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
             if (pblock)
                 wtx.SetMerkleBranch(*pblock);
 
+            if (pwalletdbBatch)
+                return AddToWallet(wtx, false, pwalletdbBatch);
+
             // Do not flush the wallet here for performance reasons
             // this is safe, as in case of a crash, we rescan the necessary blocks on startup through our SetBestChain-mechanism
             CWalletDB walletdb(strWalletFile, "r+", false);
@@ -974,6 +1084,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
                 if (mapWallet.count(txin.prevout.hash))
                     mapWallet[txin.prevout.hash].MarkDirty();
             }
+            UpdateUnspentInputs(wtx);
         }
     }
 
@@ -1035,12 +1146,21 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
                 if (mapWallet.count(txin.prevout.hash))
                     mapWallet[txin.prevout.hash].MarkDirty();
             }
+            UpdateUnspentInputs(wtx);
         }
     }
 }
 
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, const CBlock* pblock)
 {
+    // The first transaction of a connected block is the cue to unblind our
+    // outputs in all of the block at once, on -par threads. That needs no
+    // cs_main, so validation can go on meanwhile.
+    if (pblock && !pblock->vtx.empty() && &tx == pblock->vtx[0].get()) {
+        LOCK(cs_wallet);
+        PrecomputeBlindingData(std::vector<const CBlock*>(1, pblock));
+    }
+
     LOCK2(cs_main, cs_wallet);
 
     if (!AddToWalletIfInvolvingMe(tx, pblock, true))
@@ -1090,7 +1210,40 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
 
 isminetype CWallet::IsMine(const CTxOut& txout) const
 {
-    return ::IsMine(*this, txout.scriptPubKey);
+    const CScript& script = txout.scriptPubKey;
+    uint64_t nGeneration;
+    {
+        LOCK(cs_isMineCache);
+        std::map<CScript, IsMineCacheList::iterator>::const_iterator it = mapIsMineCache.find(script);
+        if (it != mapIsMineCache.end()) {
+            listIsMineCache.splice(listIsMineCache.begin(), listIsMineCache, it->second);
+            return it->second->second;
+        }
+        nGeneration = nIsMineCacheGeneration;
+    }
+
+    // Look up outside the lock, as the keystore takes its own. A result that
+    // raced with a keystore change is returned but not stored.
+    const isminetype mine = ::IsMine(*this, script);
+
+    LOCK(cs_isMineCache);
+    if (nGeneration == nIsMineCacheGeneration && !mapIsMineCache.count(script)) {
+        if (mapIsMineCache.size() >= MAX_ISMINE_CACHE) {
+            mapIsMineCache.erase(listIsMineCache.back().first);
+            listIsMineCache.pop_back();
+        }
+        listIsMineCache.push_front(std::make_pair(script, mine));
+        mapIsMineCache.insert(std::make_pair(script, listIsMineCache.begin()));
+    }
+    return mine;
+}
+
+void CWallet::ClearIsMineCache()
+{
+    LOCK(cs_isMineCache);
+    mapIsMineCache.clear();
+    listIsMineCache.clear();
+    nIsMineCacheGeneration++;
 }
 
 bool CWallet::IsChange(const CTxOut& txout) const
@@ -1102,7 +1255,7 @@ bool CWallet::IsChange(const CTxOut& txout) const
     // a better way of identifying which outputs are 'the send' and which are
     // 'the change' will need to be implemented (maybe extend CWalletTx to remember
     // which output, if any, was change).
-    if (::IsMine(*this, txout.scriptPubKey))
+    if (IsMine(txout))
     {
         CTxDestination address;
         if (!ExtractDestination(txout.scriptPubKey, address))
@@ -1404,6 +1557,7 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     CBlockIndex* pindex = pindexStart;
     {
         LOCK2(cs_main, cs_wallet);
+        CWalletBatch batch(this);
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
@@ -1413,20 +1567,61 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
         double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
         double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+        // With -blockfilterindex, blocks whose filter matches none of our
+        // scripts and outpoints need not be read at all.
+        std::vector<CBlockFilter::Element> vFilterQuery;
+        if (pblockfilterdb)
+            vFilterQuery = GetBlockFilterQuery();
+
         while (pindex)
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            // Read a run of blocks ahead and unblind the outputs we will be
+            // adding on all cores, then add the transactions in block order.
+            // A block we skip may only spend outputs of an earlier block in
+            // the run if that one matched, so the run stops at the first
+            // skip after a match and the rest is checked again next time,
+            // against our outpoints as they are then.
+            std::vector<CBlockIndex*> vIndex;
+            CBlockIndex* pnext = pindex;
+            for (bool fMatched = false; pnext && vIndex.size() < WALLET_RESCAN_BATCH_BLOCKS; pnext = chainActive.Next(pnext)) {
+                CBlockFilter filter;
+                if (pblockfilterdb && pblockfilterdb->ReadFilter(pnext->GetBlockHash(), filter) && !filter.MatchAny(vFilterQuery)) {
+                    if (fMatched)
+                        break;
+                    continue;
+                }
+                fMatched = true;
+                vIndex.push_back(pnext);
+            }
+            std::vector<CBlock> vBlocks(vIndex.size());
+            std::vector<const CBlock*> vpBlocks(vIndex.size());
+            for (size_t i = 0; i < vIndex.size(); i++) {
+                ReadBlockFromDisk(vBlocks[i], vIndex[i], Params().GetConsensus());
+                vpBlocks[i] = &vBlocks[i];
+            }
+            PrecomputeBlindingData(vpBlocks);
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            for (size_t i = 0; i < vIndex.size(); i++)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+                pindex = vIndex[i];
+                if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                    ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+                BOOST_FOREACH(const CTransactionRef& ptx, vBlocks[i].vtx)
+                {
+                    const CTransaction& tx = *ptx;
+                    if (AddToWalletIfInvolvingMe(tx, &vBlocks[i], fUpdate)) {
+                        ret++;
+                        if (pblockfilterdb) {
+                            for (unsigned int n = 0; n < tx.vout.size(); n++)
+                                if (IsMine(tx.vout[n]) != ISMINE_NO)
+                                    vFilterQuery.push_back(CBlockFilter::OutPointElement(COutPoint(tx.GetHash(), n)));
+                        }
+                    }
+                }
             }
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
+            pindex = pnext;
+            if (pindex && GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
             }
@@ -1436,6 +1631,45 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     return ret;
 }
 
+std::vector<CBlockFilter::Element> CWallet::GetBlockFilterQuery() const
+{
+    AssertLockHeld(cs_wallet);
+    std::vector<CBlockFilter::Element> vQuery;
+
+    // Outputs to our keys, to our scripts (witness programs are stored
+    // as scripts too), and watched scripts.
+    std::set<CKeyID> setKeyIDs;
+    GetKeys(setKeyIDs);
+    BOOST_FOREACH(const CKeyID& keyid, setKeyIDs) {
+        const CScript script = GetScriptForDestination(keyid);
+        vQuery.push_back(CBlockFilter::Element(script.begin(), script.end()));
+        CPubKey pubkey;
+        if (GetPubKey(keyid, pubkey)) {
+            const CScript p2pk = GetScriptForRawPubKey(pubkey);
+            vQuery.push_back(CBlockFilter::Element(p2pk.begin(), p2pk.end()));
+        }
+    }
+    {
+        LOCK(cs_KeyStore);
+        BOOST_FOREACH(const PAIRTYPE(CScriptID, CScript)& item, mapScripts) {
+            const CScript p2sh = GetScriptForDestination(item.first);
+            vQuery.push_back(CBlockFilter::Element(p2sh.begin(), p2sh.end()));
+            vQuery.push_back(CBlockFilter::Element(item.second.begin(), item.second.end()));
+        }
+        BOOST_FOREACH(const CScript& script, setWatchOnly)
+            vQuery.push_back(CBlockFilter::Element(script.begin(), script.end()));
+    }
+
+    // Spends of our outputs.
+    BOOST_FOREACH(const PAIRTYPE(uint256, CWalletTx)& item, mapWallet) {
+        const CWalletTx& wtx = item.second;
+        for (unsigned int n = 0; n < wtx.vout.size(); n++)
+            if (IsMine(wtx.vout[n]) != ISMINE_NO)
+                vQuery.push_back(CBlockFilter::OutPointElement(COutPoint(item.first, n)));
+    }
+    return vQuery;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     // If transactions aren't being broadcasted, don't let them into local mempool either
@@ -1771,7 +2005,7 @@ void CWalletTx::GetBlindingData(unsigned int nOut, CAmount* pamountOut, CPubKey*
         memcpy(blindingfactor.begin(), &*(it + 9), 32);
         pubkey.Set(it + 41, it + 74);
     } else {
-        pwallet->ComputeBlindingData(vout[nOut], amount, pubkey, blindingfactor);
+        pwallet->GetCachedBlindingData(COutPoint(GetHash(), nOut), vout[nOut], amount, pubkey, blindingfactor);
         *it = 1;
         memcpy(&*(it + 1), &amount, 8);
         memcpy(&*(it + 9), blindingfactor.begin(), 32);
@@ -1864,14 +2098,75 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime)
  */
 
 
+void CWallet::MarkBalanceDirty(const uint256& hash) const
+{
+    LOCK(cs_wallet);
+    if (!fBalanceStale)
+        setBalanceDirty.insert(hash);
+}
+
+void CWallet::UpdateBalances() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (fBalanceStale) {
+        mapSettledCredit.clear();
+        setBalanceDirty.clear();
+        setBalancePending.clear();
+        nSettledCredit = 0;
+        nSettledWatchCredit = 0;
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            setBalancePending.insert(it->first);
+        fBalanceStale = false;
+    }
+
+    // Take dirty transactions out of the totals, to be looked at again below
+    BOOST_FOREACH(const uint256& hash, setBalanceDirty)
+    {
+        map<uint256, pair<CAmount, CAmount> >::iterator it = mapSettledCredit.find(hash);
+        if (it != mapSettledCredit.end()) {
+            nSettledCredit -= it->second.first;
+            nSettledWatchCredit -= it->second.second;
+            mapSettledCredit.erase(it);
+        }
+        setBalancePending.insert(hash);
+    }
+    setBalanceDirty.clear();
+
+    // Settle the transactions that are now deep enough. Their credit can
+    // only change through a new spend or a reorg, both of which mark them
+    // dirty again.
+    for (set<uint256>::iterator it = setBalancePending.begin(); it != setBalancePending.end(); )
+    {
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(*it);
+        if (mi == mapWallet.end()) {
+            setBalancePending.erase(it++);
+            continue;
+        }
+        const CWalletTx& wtx = mi->second;
+        if (wtx.GetDepthInMainChain() >= 1 && wtx.GetBlocksToMaturity() == 0) {
+            pair<CAmount, CAmount> credit(wtx.GetAvailableCredit(), wtx.GetAvailableWatchOnlyCredit());
+            nSettledCredit += credit.first;
+            nSettledWatchCredit += credit.second;
+            mapSettledCredit.insert(make_pair(*it, credit));
+            setBalancePending.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
 CAmount CWallet::GetBalance() const
 {
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateBalances();
+        nTotal = nSettledCredit;
+        BOOST_FOREACH(const uint256& hash, setBalancePending)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1885,9 +2180,10 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateBalances();
+        BOOST_FOREACH(const uint256& hash, setBalancePending)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1900,9 +2196,10 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateBalances();
+        BOOST_FOREACH(const uint256& hash, setBalancePending)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -1914,9 +2211,11 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateBalances();
+        nTotal = nSettledWatchCredit;
+        BOOST_FOREACH(const uint256& hash, setBalancePending)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1930,9 +2229,10 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateBalances();
+        BOOST_FOREACH(const uint256& hash, setBalancePending)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1945,9 +2245,10 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateBalances();
+        BOOST_FOREACH(const uint256& hash, setBalancePending)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -1960,41 +2261,123 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        if (fUnspentStale)
+            RebuildUnspent();
+
+        // The index is ordered by outpoint, so the outputs of each transaction
+        // are adjacent and the per-transaction checks run once for all of them.
+        const CWalletTx* pcoin = NULL;
+        bool fUsable = false;
+        int nDepth = 0;
+        for (UnspentIndex::const_iterator it = mapUnspent.begin(); it != mapUnspent.end(); ++it)
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const COutPoint& outpoint = it->first;
+            if (!pcoin || pcoin->GetHash() != outpoint.hash) {
+                map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(outpoint.hash);
+                assert(mi != mapWallet.end());
+                pcoin = &mi->second;
+                fUsable = false;
+
+                if (!CheckFinalTx(*pcoin))
+                    continue;
 
-            if (!CheckFinalTx(*pcoin))
-                continue;
+                if (fOnlyConfirmed && !pcoin->IsTrusted())
+                    continue;
 
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
+                if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+                    continue;
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+                nDepth = pcoin->GetDepthInMainChain();
+                if (nDepth < 0)
+                    continue;
 
-            int nDepth = pcoin->GetDepthInMainChain();
-            if (nDepth < 0)
-                continue;
+                // We should not consider coins which aren't at least in our mempool
+                // It's possible for these to be conflicted via ancestors which we may never be able to detect
+                if (nDepth == 0 && !pcoin->InMempool())
+                    continue;
 
-            // We should not consider coins which aren't at least in our mempool
-            // It's possible for these to be conflicted via ancestors which we may never be able to detect
-            if (nDepth == 0 && !pcoin->InMempool())
+                fUsable = true;
+            }
+            if (!fUsable)
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                isminetype mine = IsMine(pcoin->vout[i]);
-                if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && (pcoin->GetValueOut(i) > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint((*it).first, i))))
-                        vCoins.push_back(COutput(pcoin, i, nDepth,
-                                                 ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
-                                                  (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO),
-                                                 (mine & (ISMINE_SPENDABLE | ISMINE_WATCH_SOLVABLE)) != ISMINE_NO));
+            // The index may lag behind a spend that was only just confirmed or
+            // unconflicted, so check again.
+            isminetype mine = it->second.mine;
+            if (!(IsSpent(outpoint.hash, outpoint.n)) &&
+                !IsLockedCoin(outpoint.hash, outpoint.n) && (it->second.nValue > 0 || fIncludeZeroValue) &&
+                (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(outpoint)))
+                    vCoins.push_back(COutput(pcoin, outpoint.n, nDepth,
+                                             ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
+                                              (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO),
+                                             (mine & (ISMINE_SPENDABLE | ISMINE_WATCH_SOLVABLE)) != ISMINE_NO));
+        }
+    }
+}
+
+/**
+ * Depth-first search for a subset of vValue (sorted by descending value) that
+ * adds up to between nTargetValue and nTargetValue + nCostOfChange, so that
+ * no change output is needed. Of the subsets found within BNB_MAX_TRIES steps,
+ * the one overshooting the target least is returned.
+ */
+static bool SelectCoinsBnB(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTargetValue, const CAmount& nCostOfChange,
+                           vector<char>& vfBest, CAmount& nBest)
+{
+    // Total of the coins not yet included or excluded
+    CAmount nRemaining = 0;
+    for (unsigned int i = 0; i < vValue.size(); i++)
+        nRemaining += vValue[i].first;
+
+    vector<char> vfSelected(vValue.size(), false);
+    CAmount nSelected = 0;
+    CAmount nBestWaste = std::numeric_limits<CAmount>::max();
+    vfBest.clear();
+
+    unsigned int i = 0;
+    for (int nTries = 0; nTries < BNB_MAX_TRIES; nTries++)
+    {
+        bool fBacktrack = false;
+        if (nSelected + nRemaining < nTargetValue || nSelected > nTargetValue + nCostOfChange)
+            fBacktrack = true;
+        else if (nSelected >= nTargetValue) {
+            // Any further coin would only overshoot more
+            if (nSelected - nTargetValue < nBestWaste) {
+                nBestWaste = nSelected - nTargetValue;
+                vfBest = vfSelected;
+                if (nBestWaste == 0)
+                    break;
+            }
+            fBacktrack = true;
+        }
+
+        if (fBacktrack) {
+            // Return the trailing excluded coins to the undecided ones, and
+            // exclude the last included coin instead
+            while (i > 0 && !vfSelected[i - 1]) {
+                i--;
+                nRemaining += vValue[i].first;
+            }
+            if (i == 0)
+                break; // Whole tree searched
+            vfSelected[i - 1] = false;
+            nSelected -= vValue[i - 1].first;
+        } else {
+            nRemaining -= vValue[i].first;
+            // Including a coin worth the same as the one just excluded would
+            // repeat a subset already searched
+            if (i == 0 || vfSelected[i - 1] || vValue[i].first != vValue[i - 1].first) {
+                vfSelected[i] = true;
+                nSelected += vValue[i].first;
             }
+            i++;
         }
     }
+
+    if (vfBest.empty())
+        return false;
+    nBest = nTargetValue + nBestWaste;
+    return true;
 }
 
 static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
@@ -2044,7 +2427,7 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
 }
 
 bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
-                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CAmount& nCostOfChange) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
@@ -2115,6 +2498,21 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     vector<char> vfBest;
     CAmount nBest;
 
+    // Change is not worth creating if it costs more than it is worth, so
+    // first look for coins that come close enough to do without
+    if (nCostOfChange > 0 && SelectCoinsBnB(vValue, nTargetValue, nCostOfChange, vfBest, nBest))
+    {
+        for (unsigned int i = 0; i < vValue.size(); i++)
+            if (vfBest[i])
+            {
+                setCoinsRet.insert(vValue[i].second);
+                nValueRet += vValue[i].first;
+            }
+
+        LogPrint("selectcoins", "SelectCoins() branch and bound: %d coins, total %s\n", setCoinsRet.size(), FormatMoney(nBest));
+        return true;
+    }
+
     ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest);
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + MIN_CHANGE)
         ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest);
@@ -2145,7 +2543,7 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     return true;
 }
 
-bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl) const
+bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl, const CAmount& nCostOfChange) const
 {
     vector<COutput> vCoins(vAvailableCoins);
 
@@ -2194,9 +2592,9 @@ bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount&
     }
 
     bool res = nTargetValue <= nValueFromPresetInputs ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, vCoins, setCoinsRet, nValueRet) ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, vCoins, setCoinsRet, nValueRet) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, vCoins, setCoinsRet, nValueRet));
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, vCoins, setCoinsRet, nValueRet, nCostOfChange) ||
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, vCoins, setCoinsRet, nValueRet, nCostOfChange) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, vCoins, setCoinsRet, nValueRet, nCostOfChange));
 
     // because SelectCoinsMinConf clears the setCoinsRet, we now add the possible inputs to the coinset
     setCoinsRet.insert(setPresetCoins.begin(), setPresetCoins.end());
@@ -2324,6 +2722,18 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
             std::vector<COutput> vAvailableCoins;
             AvailableCoins(vAvailableCoins, true, coinControl);
 
+            // What a change output costs in fees: its rangeproof makes it
+            // large, and it has to be spent again later. Overshooting the
+            // target by less than this is cheaper than creating change.
+            // With fees subtracted from the amount, change is never dropped.
+            CAmount nCostOfChange = 0;
+            if (nSubtractFeeFromAmount == 0) {
+                if (coinControl && coinControl->fOverrideFeeRate)
+                    nCostOfChange = coinControl->nFeeRate.GetFee(BLINDED_CHANGE_OUTPUT_VSIZE + CHANGE_SPEND_VSIZE);
+                else
+                    nCostOfChange = GetMinimumFee(BLINDED_CHANGE_OUTPUT_VSIZE + CHANGE_SPEND_VSIZE, nTxConfirmTarget, mempool);
+            }
+
             nFeeRet = 0;
             // Start with no fee and loop until there is enough fee
             while (true)
@@ -2377,7 +2787,7 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 // Choose coins to use
                 set<pair<const CWalletTx*,unsigned int> > setCoins;
                 CAmount nValueIn = 0;
-                if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, coinControl))
+                if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, coinControl, nCostOfChange))
                 {
                     strFailReason = _("Insufficient funds");
                     return false;
@@ -2397,7 +2807,14 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 }
 
                 const CAmount nChange = nValueIn - nValueToSelect;
-                if (nChange > 0)
+                if (nChange > 0 && nChange <= nCostOfChange)
+                {
+                    // Cheaper to leave the excess to the fee than to create change
+                    nChangePosInOut = -1;
+                    nFeeRet += nChange;
+                    reservekey.ReturnKey();
+                }
+                else if (nChange > 0)
                 {
                     // Fill a vout to ourself
                     // TODO: pass in scriptChange instead of reservekey so
@@ -2523,28 +2940,28 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                     assert(ret);
                 }
 
-                // Sign
-                int nIn = 0;
+                // Sign, the inputs of a large transaction in parallel
                 CTransaction txNewConst(txNew);
-                BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
-                {
-                    bool signSuccess;
-                    const CScript& scriptPubKey = coin.first->vout[coin.second].scriptPubKey;
-                    SignatureData sigdata;
+                const std::vector<PAIRTYPE(const CWalletTx*,unsigned int)> vCoins(setCoins.begin(), setCoins.end());
+                boost::scoped_ptr<PrecomputedTransactionData> txdata(sign ? new PrecomputedTransactionData(txNewConst) : NULL);
+                std::vector<SignatureData> vSigData(vCoins.size());
+                std::vector<char> vSignSuccess(vCoins.size(), false);
+                ForEachInputParallel(vCoins.size(), nScriptCheckThreads, [&](size_t nIn) {
+                    const CTxOut& prevout = vCoins[nIn].first->vout[vCoins[nIn].second];
                     if (sign)
-                        signSuccess = ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, coin.first->vout[coin.second].nValue, SIGHASH_ALL), scriptPubKey, sigdata);
+                        vSignSuccess[nIn] = ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, prevout.nValue, SIGHASH_ALL, txdata.get()), prevout.scriptPubKey, vSigData[nIn]);
                     else
-                        signSuccess = ProduceSignature(DummySignatureCreator(this), scriptPubKey, sigdata);
+                        vSignSuccess[nIn] = ProduceSignature(DummySignatureCreator(this), prevout.scriptPubKey, vSigData[nIn]);
+                });
 
-                    if (!signSuccess)
+                for (unsigned int nIn = 0; nIn < vCoins.size(); nIn++)
+                {
+                    if (!vSignSuccess[nIn])
                     {
                         strFailReason = _("Signing transaction failed");
                         return false;
-                    } else {
-                        UpdateTransaction(txNew, nIn, sigdata);
                     }
-
-                    nIn++;
+                    UpdateTransaction(txNew, nIn, vSigData[nIn]);
                 }
 
                 unsigned int nBytes = GetVirtualTransactionSize(txNew);
@@ -2665,6 +3082,76 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
     return true;
 }
 
+uint256 CWallet::QueuePegout(const CScript& scriptPubKey, const CAmount& nAmount)
+{
+    LOCK(cs_wallet);
+    const uint256 id = GetRandHash();
+    CPegoutRequest& request = mapPegouts[id];
+    request.scriptPubKey = scriptPubKey;
+    request.nAmount = nAmount;
+    request.nTime = GetTime();
+    if (fFileBacked)
+        CWalletDB(strWalletFile).WritePegout(id, request);
+    return id;
+}
+
+uint256 CWallet::SendQueuedPegouts(bool fForce, std::string& strError)
+{
+    LOCK2(cs_main, cs_wallet);
+    std::vector<std::map<uint256, CPegoutRequest>::iterator> vQueued;
+    int64_t nOldest = std::numeric_limits<int64_t>::max();
+    for (std::map<uint256, CPegoutRequest>::iterator it = mapPegouts.begin(); it != mapPegouts.end(); ++it) {
+        if (it->second.IsQueued()) {
+            vQueued.push_back(it);
+            nOldest = std::min(nOldest, it->second.nTime);
+        }
+    }
+    if (vQueued.empty())
+        return uint256();
+    if (!fForce && vQueued.size() < nPegoutBatchSize && (nPegoutInterval <= 0 || GetTime() - nOldest < nPegoutInterval))
+        return uint256();
+
+    std::vector<CRecipient> vecSend;
+    for (size_t i = 0; i < vQueued.size(); i++) {
+        CRecipient recipient = {vQueued[i]->second.scriptPubKey, vQueued[i]->second.nAmount, CPubKey(), false};
+        vecSend.push_back(recipient);
+    }
+    CWalletTx wtxNew;
+    CReserveKey reservekey(this);
+    CAmount nFeeRequired;
+    int nChangePosRet = -1;
+    if (IsLocked()) {
+        strError = "Error: Please enter the wallet passphrase with walletpassphrase first.";
+        return uint256();
+    }
+    if (!CreateTransaction(vecSend, wtxNew, reservekey, nFeeRequired, nChangePosRet, strError))
+        return uint256();
+
+    // From here on the transaction is in the wallet, which rebroadcasts it
+    // if it could not be relayed right away.
+    const bool fCommitted = CommitTransaction(wtxNew, reservekey);
+    const uint256 txid = wtxNew.GetHash();
+    CWalletDB* pwalletdb = fFileBacked ? new CWalletDB(strWalletFile) : NULL;
+    for (size_t i = 0; i < vQueued.size(); i++) {
+        vQueued[i]->second.txid = txid;
+        if (pwalletdb)
+            pwalletdb->WritePegout(vQueued[i]->first, vQueued[i]->second);
+    }
+    delete pwalletdb;
+    LogPrintf("%s: sent %u peg-outs in %s\n", __func__, vQueued.size(), txid.ToString());
+    if (!fCommitted)
+        strError = "Error: The transaction was rejected! This might happen if some of the coins in your wallet were already spent, such as if you used a copy of the wallet and coins were spent in the copy but not marked as spent here.";
+    return txid;
+}
+
+void CWallet::SendDuePegouts()
+{
+    std::string strError;
+    SendQueuedPegouts(false, strError);
+    if (!strError.empty())
+        LogPrintf("%s: %s\n", __func__, strError);
+}
+
 bool CWallet::AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB & pwalletdb)
 {
     if (!pwalletdb.WriteAccountingEntry_Backend(acentry))
@@ -2736,6 +3223,11 @@ DBErrors CWallet::ZapSelectTx(vector<uint256>& vHashIn, vector<uint256>& vHashOu
 {
     if (!fFileBacked)
         return DB_LOAD_OK;
+    {
+        LOCK(cs_wallet);
+        fUnspentStale = true;
+        fBalanceStale = true;
+    }
     DBErrors nZapSelectTxRet = CWalletDB(strWalletFile,"cr+").ZapSelectTx(this, vHashIn, vHashOut);
     if (nZapSelectTxRet == DB_NEED_REWRITE)
     {
@@ -2797,6 +3289,11 @@ bool CWallet::SetAddressBook(const CTxDestination& address, const string& strNam
                              strPurpose, (fUpdated ? CT_UPDATED : CT_NEW) );
     if (!fFileBacked)
         return false;
+    if (pwalletdbBatch) {
+        if (!strPurpose.empty() && !pwalletdbBatch->WritePurpose(CBitcoinAddress(address).ToString(), strPurpose))
+            return false;
+        return pwalletdbBatch->WriteName(CBitcoinAddress(address).ToString(), strName);
+    }
     if (!strPurpose.empty() && !CWalletDB(strWalletFile).WritePurpose(CBitcoinAddress(address).ToString(), strPurpose))
         return false;
     return CWalletDB(strWalletFile).WriteName(CBitcoinAddress(address).ToString(), strName);
@@ -2866,7 +3363,25 @@ bool CWallet::NewKeyPool()
     return true;
 }
 
-bool CWallet::TopUpKeyPool(unsigned int kpSize)
+CWalletBatch::CWalletBatch(CWallet* pwalletIn) : pwallet(pwalletIn), pwalletdb(NULL)
+{
+    AssertLockHeld(pwallet->cs_wallet);
+    if (!pwallet->pwalletdbBatch) {
+        pwalletdb = new CWalletDB(pwallet->strWalletFile);
+        pwallet->pwalletdbBatch = pwalletdb;
+    }
+}
+
+CWalletBatch::~CWalletBatch()
+{
+    if (pwalletdb) {
+        pwallet->pwalletdbBatch = NULL;
+        // Closing the handle flushes everything written through it
+        delete pwalletdb;
+    }
+}
+
+bool CWallet::TopUpKeyPool(unsigned int kpSize, unsigned int nMaxNew)
 {
     {
         LOCK(cs_wallet);
@@ -2874,7 +3389,9 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         if (IsLocked())
             return false;
 
-        CWalletDB walletdb(strWalletFile);
+        // One flush for the whole refill, rather than one per key
+        CWalletBatch batch(this);
+        CWalletDB& walletdb = *pwalletdbBatch;
 
         // Top up key pool
         unsigned int nTargetSize;
@@ -2883,7 +3400,7 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         else
             nTargetSize = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0);
 
-        while (setKeyPool.size() < (nTargetSize + 1))
+        for (unsigned int nNew = 0; setKeyPool.size() < (nTargetSize + 1) && (nMaxNew == 0 || nNew < nMaxNew); nNew++)
         {
             int64_t nEnd = 1;
             if (!setKeyPool.empty())
@@ -2897,6 +3414,35 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
     return true;
 }
 
+void CWallet::KeyPoolThread()
+{
+    {
+        LOCK(cs_wallet);
+        fKeyPoolThread = true;
+    }
+    unsigned int nTargetSize = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0);
+    while (true)
+    {
+        // Refill a batch at a time, so that a getnewaddress waiting for
+        // cs_wallet never waits for more than one batch of keys.
+        while (true)
+        {
+            boost::this_thread::interruption_point();
+            {
+                LOCK(cs_wallet);
+                if (IsLocked() || setKeyPool.size() >= nTargetSize + 1)
+                    break;
+            }
+            TopUpKeyPool(0, KEYPOOL_TOPUP_BATCH);
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutexKeyPoolLow);
+        while (!fKeyPoolLow)
+            condKeyPoolLow.wait(lock);
+        fKeyPoolLow = false;
+    }
+}
+
 void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
 {
     nIndex = -1;
@@ -2904,8 +3450,13 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
     {
         LOCK(cs_wallet);
 
-        if (!IsLocked())
-            TopUpKeyPool();
+        if (!IsLocked()) {
+            if (!fKeyPoolThread)
+                TopUpKeyPool();
+            else if (setKeyPool.empty())
+                // The keypool thread is behind; make just the key asked for.
+                TopUpKeyPool(0, 1);
+        }
 
         // Get the oldest key
         if(setKeyPool.empty())
@@ -2921,6 +3472,12 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
             throw runtime_error(std::string(__func__) + ": unknown key in key pool");
         assert(keypool.vchPubKey.IsValid());
         LogPrintf("keypool reserve %d\n", nIndex);
+
+        if (fKeyPoolThread) {
+            boost::unique_lock<boost::mutex> lock(mutexKeyPoolLow);
+            fKeyPoolLow = true;
+            condKeyPoolLow.notify_one();
+        }
     }
 }
 
@@ -3402,6 +3959,9 @@ bool CWallet::GetDestData(const CTxDestination &dest, const std::string &key, st
 std::string CWallet::GetWalletHelpString(bool showDebug)
 {
     std::string strUsage = HelpMessageGroup(_("Wallet options:"));
+    strUsage += HelpMessageOpt("-ct_bits=<n>", strprintf(_("Make the range proofs of blinded outputs cover at least <n> bits of mantissa, from 1 to %d (default: %d)"), MAX_CT_BITS, DEFAULT_CT_BITS));
+    strUsage += HelpMessageOpt("-ct_exponent=<n>", strprintf(_("Reveal the lowest <n> decimal digits of blinded amounts to shrink their range proofs, or the whole amount for -1 (default: %d)"), DEFAULT_CT_EXPONENT));
+    strUsage += HelpMessageOpt("-ct_minvalue=<amt>", _("Reveal that blinded amounts of at least <amt> are at least <amt> (default: 0)"));
     strUsage += HelpMessageOpt("-disablewallet", _("Do not load the wallet and disable wallet RPC calls"));
     strUsage += HelpMessageOpt("-keypool=<n>", strprintf(_("Set key pool size to <n> (default: %u)"), DEFAULT_KEYPOOL_SIZE));
     strUsage += HelpMessageOpt("-fallbackfee=<amt>", strprintf(_("A fee rate (in %s/kB) that will be used when fee estimation has insufficient data (default: %s)"),
@@ -3410,6 +3970,8 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
                                                             CURRENCY_UNIT, FormatMoney(DEFAULT_TRANSACTION_MINFEE)));
     strUsage += HelpMessageOpt("-paytxfee=<amt>", strprintf(_("Fee (in %s/kB) to add to transactions you send (default: %s)"),
                                                             CURRENCY_UNIT, FormatMoney(payTxFee.GetFeePerK())));
+    strUsage += HelpMessageOpt("-pegoutbatchsize=<n>", strprintf(_("Send the peg-outs sendtomainchain queues as soon as <n> of them are queued (default: %u)"), DEFAULT_PEGOUT_BATCH_SIZE));
+    strUsage += HelpMessageOpt("-pegoutinterval=<n>", strprintf(_("Send the peg-outs sendtomainchain queues once the oldest has waited <n> seconds, 0 to only send them in batches of -pegoutbatchsize or with sendqueuedpegouts (default: %d)"), DEFAULT_PEGOUT_INTERVAL));
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions on startup"));
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet on startup"));
     if (showDebug)
@@ -3529,7 +4091,7 @@ bool CWallet::InitLoadWallet()
 
     LogPrintf(" wallet      %15dms\n", GetTimeMillis() - nStart);
 
-    RegisterValidationInterface(walletInstance);
+    RegisterValidationInterface(walletInstance, true);
 
     CBlockIndex *pindexRescan = chainActive.Tip();
     if (GetBoolArg("-rescan", false))
@@ -3548,10 +4110,10 @@ bool CWallet::InitLoadWallet()
         //We can't rescan beyond non-pruned blocks, stop and throw an error
         //this might happen if a user uses a old wallet within a pruned node
         // or if he ran -disablewallet for a longer time, then decided to re-enable
-        if (fPruneMode)
+        if (fPruneMode || fRangeproofPruneMode)
         {
             CBlockIndex *block = chainActive.Tip();
-            while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA) && block->pprev->nTx > 0 && pindexRescan != block)
+            while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA) && !(block->pprev->nStatus & BLOCK_RANGEPROOFS_PRUNED) && block->pprev->nTx > 0 && pindexRescan != block)
                 block = block->pprev;
 
             if (pindexRescan != block)
@@ -3599,6 +4161,12 @@ bool CWallet::InitLoadWallet()
 
 bool CWallet::ParameterInteraction()
 {
+    if (mapArgs.count("-ct_minvalue"))
+    {
+        CAmount n = 0;
+        if (!ParseMoney(mapArgs["-ct_minvalue"], n) || !MoneyRange(n))
+            return InitError(AmountErrMsg("ct_minvalue", mapArgs["-ct_minvalue"]));
+    }
     if (mapArgs.count("-mintxfee"))
     {
         CAmount n = 0;
@@ -3647,6 +4215,8 @@ bool CWallet::ParameterInteraction()
     nTxConfirmTarget = GetArg("-txconfirmtarget", DEFAULT_TX_CONFIRM_TARGET);
     bSpendZeroConfChange = GetBoolArg("-spendzeroconfchange", DEFAULT_SPEND_ZEROCONF_CHANGE);
     fSendFreeTransactions = GetBoolArg("-sendfreetransactions", DEFAULT_SEND_FREE_TRANSACTIONS);
+    nPegoutInterval = GetArg("-pegoutinterval", DEFAULT_PEGOUT_INTERVAL);
+    nPegoutBatchSize = std::max(GetArg("-pegoutbatchsize", DEFAULT_PEGOUT_BATCH_SIZE), (int64_t)1);
 
     return true;
 }
@@ -3718,7 +4288,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock& block)
 
     // Locate the transaction
     for (nIndex = 0; nIndex < (int)block.vtx.size(); nIndex++)
-        if (block.vtx[nIndex] == *(CTransaction*)this)
+        if (*block.vtx[nIndex] == *(CTransaction*)this)
             break;
     if (nIndex == (int)block.vtx.size())
     {
@@ -3771,30 +4341,86 @@ bool CMerkleTx::AcceptToMemoryPool(bool fLimitFree, CAmount nAbsurdFee)
     return ::AcceptToMemoryPool(mempool, state, *this, fLimitFree, NULL, false, nAbsurdFee);
 }
 
-CKey CWallet::GetBlindingKey(const CScript* script) const
+CKey CWallet::DeriveBlindingKey(const CScript& script, const CScriptID& scriptid) const
 {
     CKey key;
 
-    if (script != NULL) {
-        std::map<CScriptID, uint256>::const_iterator it = mapSpecificBlindingKeys.find(CScriptID(*script));
-        if (it != mapSpecificBlindingKeys.end()) {
-            key.Set(it->second.begin(), it->second.end(), true);
-            if (key.IsValid()) {
-                return key;
-            }
+    boost::unordered_map<CScriptID, uint256, SaltedKeyStoreHasher>::const_iterator it = mapSpecificBlindingKeys.find(scriptid);
+    if (it != mapSpecificBlindingKeys.end()) {
+        key.Set(it->second.begin(), it->second.end(), true);
+        if (key.IsValid()) {
+            return key;
         }
     }
 
-    if (script != NULL && !blinding_derivation_key.IsNull()) {
+    if (!blinding_derivation_key.IsNull()) {
         unsigned char vch[32];
-        CHMAC_SHA256(blinding_derivation_key.begin(), blinding_derivation_key.size()).Write(&((*script)[0]), script->size()).Finalize(vch);
+        CHMAC_SHA256(blinding_derivation_key.begin(), blinding_derivation_key.size()).Write(script.empty() ? NULL : &script[0], script.size()).Finalize(vch);
         key.Set(&vch[0], &vch[32], true);
         if (key.IsValid()) {
             return key;
         }
     }
 
-    if (script == NULL && blinding_key.IsValid()) {
+    return CKey();
+}
+
+CWallet::CBlindingKeyCacheEntry CWallet::LookupBlindingKey(const CScript& script, bool fPubKey) const
+{
+    const CScriptID scriptid(script);
+    uint64_t nGeneration;
+    {
+        LOCK(cs_blindingKeyCache);
+        if (blindingKeyCacheDerivationKey != blinding_derivation_key) {
+            mapBlindingKeyCache.clear();
+            blindingKeyCacheDerivationKey = blinding_derivation_key;
+            nBlindingKeyCacheGeneration++;
+        }
+        nGeneration = nBlindingKeyCacheGeneration;
+        std::map<CScriptID, CBlindingKeyCacheEntry>::const_iterator it = mapBlindingKeyCache.find(scriptid);
+        if (it != mapBlindingKeyCache.end() && (it->second.fHavePubKey || !fPubKey))
+            return it->second;
+    }
+
+    // Derive outside the lock. A concurrent miss on the same script just
+    // computes the same entry twice; a result that raced with a key change
+    // is returned but not stored.
+    CBlindingKeyCacheEntry entry;
+    const CKey key = DeriveBlindingKey(script, scriptid);
+    entry.fValid = key.IsValid();
+    if (entry.fValid) {
+        memcpy(entry.key.begin(), key.begin(), key.size());
+        if (fPubKey)
+            entry.pubkey = key.GetPubKey();
+    }
+    entry.fHavePubKey = fPubKey || !entry.fValid;
+
+    LOCK(cs_blindingKeyCache);
+    if (nGeneration == nBlindingKeyCacheGeneration && blindingKeyCacheDerivationKey == blinding_derivation_key) {
+        if (mapBlindingKeyCache.size() >= MAX_BLINDING_KEY_CACHE && !mapBlindingKeyCache.count(scriptid)) {
+            uint256 rand = GetRandHash();
+            std::map<CScriptID, CBlindingKeyCacheEntry>::iterator it = mapBlindingKeyCache.lower_bound(CScriptID(uint160(std::vector<unsigned char>(rand.begin(), rand.begin() + 20))));
+            if (it == mapBlindingKeyCache.end())
+                it = mapBlindingKeyCache.begin();
+            mapBlindingKeyCache.erase(it);
+        }
+        mapBlindingKeyCache[scriptid] = entry;
+    }
+    return entry;
+}
+
+CKey CWallet::GetBlindingKey(const CScript* script) const
+{
+    CKey key;
+
+    if (script != NULL) {
+        const CBlindingKeyCacheEntry entry = LookupBlindingKey(*script, false);
+        if (entry.fValid)
+            key.Set(entry.key.begin(), entry.key.end(), true);
+        return key;
+    }
+
+    if (blinding_key.IsValid()) {
         return blinding_key;
     }
 
@@ -3803,18 +4429,16 @@ CKey CWallet::GetBlindingKey(const CScript* script) const
 
 CPubKey CWallet::GetBlindingPubKey(const CScript& script) const
 {
-    CKey key = GetBlindingKey(&script);
-    if (key.IsValid()) {
-        return key.GetPubKey();
-    }
-
-    return CPubKey();
+    return LookupBlindingKey(script, true).pubkey;
 }
 
 bool CWallet::LoadSpecificBlindingKey(const CScriptID& scriptid, const uint256& key)
 {
     AssertLockHeld(cs_wallet); // mapSpecificBlindingKeys
     mapSpecificBlindingKeys[scriptid] = key;
+    LOCK(cs_blindingKeyCache);
+    mapBlindingKeyCache.erase(scriptid);
+    nBlindingKeyCacheGeneration++;
     return true;
 }
 
@@ -3823,35 +4447,109 @@ bool CWallet::AddSpecificBlindingKey(const CScriptID& scriptid, const uint256& k
     AssertLockHeld(cs_wallet); // mapSpecificBlindingKeys
     if (!LoadSpecificBlindingKey(scriptid, key))
         return false;
+    fUnspentStale = true;
 
     if (!fFileBacked)
         return true;
+    if (pwalletdbBatch)
+        return pwalletdbBatch->WriteSpecificBlindingKey(scriptid, key);
     return CWalletDB(strWalletFile).WriteSpecificBlindingKey(scriptid, key);
 }
 
-void CWallet::ComputeBlindingData(const CTxOut& output, CAmount& amount, CPubKey& pubkey, uint256& blindingfactor) const
+bool CWallet::LoadBlindingCacheEntry(const COutPoint& outpoint, const CBlindingCacheEntry& entry)
+{
+    AssertLockHeld(cs_wallet); // mapBlindingCache
+    mapBlindingCache[outpoint] = entry;
+    return true;
+}
+
+bool CWallet::LoadPegout(const uint256& id, const CPegoutRequest& request)
+{
+    AssertLockHeld(cs_wallet); // mapPegouts
+    mapPegouts[id] = request;
+    return true;
+}
+
+uint160 CWallet::GetBlindingKeysFingerprint(const CScript& script) const
+{
+    CHash160 hasher;
+    const CKey keys[2] = {GetBlindingKey(&script), GetBlindingKey(NULL)};
+    for (int i = 0; i < 2; i++) {
+        const unsigned char fValid = keys[i].IsValid();
+        hasher.Write(&fValid, 1);
+        if (fValid)
+            hasher.Write(keys[i].begin(), keys[i].size());
+    }
+    uint160 result;
+    hasher.Finalize(result.begin());
+    return result;
+}
+
+const CBlindingCacheEntry* CWallet::FindBlindingCacheEntry(const COutPoint& outpoint, const CTxOut& output, uint160& fingerprint) const
+{
+    AssertLockHeld(cs_wallet); // mapBlindingCache
+    // A successful unblinding stays valid whatever keys we gain later; a
+    // failed one only for as long as the keys it was tried with.
+    fingerprint = GetBlindingKeysFingerprint(output.scriptPubKey);
+    std::map<COutPoint, CBlindingCacheEntry>::const_iterator it = mapBlindingCache.find(outpoint);
+    if (it != mapBlindingCache.end() && (it->second.IsUnblinded() || it->second.keysFingerprint == fingerprint))
+        return &it->second;
+    return NULL;
+}
+
+void CWallet::StoreBlindingCacheEntry(const COutPoint& outpoint, const CBlindingCacheEntry& entry, CWalletDB* pwalletdb) const
+{
+    AssertLockHeld(cs_wallet); // mapBlindingCache
+    mapBlindingCache[outpoint] = entry;
+    if (fFileBacked) {
+        if (pwalletdb)
+            pwalletdb->WriteBlindingCacheEntry(outpoint, entry);
+        else if (pwalletdbBatch)
+            pwalletdbBatch->WriteBlindingCacheEntry(outpoint, entry);
+        else
+            CWalletDB(strWalletFile).WriteBlindingCacheEntry(outpoint, entry);
+    }
+}
+
+void CWallet::GetCachedBlindingData(const COutPoint& outpoint, const CTxOut& output, CAmount& amount, CPubKey& pubkey, uint256& blindingfactor) const
 {
     if (output.nValue.IsAmount()) {
-        amount = output.nValue.GetAmount();
-        pubkey = CPubKey();
-        blindingfactor.SetNull();
+        ComputeBlindingData(output, amount, pubkey, blindingfactor);
         return;
     }
 
-    CKey blinding_key;
-    if ((blinding_key = GetBlindingKey(&output.scriptPubKey)).IsValid()) {
-        // For outputs using derived blinding.
-        if (UnblindOutput(blinding_key, output, amount, blindingfactor)) {
-            pubkey = blinding_key.GetPubKey();
-            return;
-        }
+    LOCK(cs_wallet);
+    uint160 fingerprint;
+    const CBlindingCacheEntry* pentry = FindBlindingCacheEntry(outpoint, output, fingerprint);
+    if (pentry) {
+        amount = pentry->amount;
+        pubkey = pentry->pubkey;
+        blindingfactor = pentry->blindingfactor;
+        return;
     }
-    if ((blinding_key = GetBlindingKey(NULL)).IsValid()) {
-        // For outputs using deprecated static blinding.
-        if (UnblindOutput(blinding_key, output, amount, blindingfactor)) {
-            pubkey = blinding_key.GetPubKey();
-            return;
-        }
+
+    ComputeBlindingData(output, amount, pubkey, blindingfactor);
+    CBlindingCacheEntry entry;
+    entry.keysFingerprint = fingerprint;
+    entry.amount = amount;
+    entry.pubkey = pubkey;
+    entry.blindingfactor = blindingfactor;
+    StoreBlindingCacheEntry(outpoint, entry, NULL);
+}
+
+/** Unblind output with the blinding key of its script, then with the wallet-wide one. */
+static void UnblindWithKeys(const CTxOut& output, const CKey& scriptKey, const CKey& walletKey, CAmount& amount, CPubKey& pubkey, uint256& blindingfactor)
+{
+    // For outputs using derived blinding.
+    if (scriptKey.IsValid() && UnblindOutput(scriptKey, output, amount, blindingfactor)) {
+        pubkey = scriptKey.GetPubKey();
+        return;
+    }
+    // For outputs using deprecated static blinding, unless that is the key
+    // we just tried.
+    if (walletKey.IsValid() && !(scriptKey.IsValid() && scriptKey == walletKey) && UnblindOutput(walletKey, output, amount, blindingfactor)) {
+        pubkey = walletKey.GetPubKey();
+        return;
     }
 
     amount = -1;
@@ -3859,6 +4557,113 @@ void CWallet::ComputeBlindingData(const CTxOut& output, CAmount& amount, CPubKey
     blindingfactor.SetNull();
 }
 
+namespace {
+
+/** A confidential output for PrecomputeBlindingData to unblind */
+struct CUnblindJob
+{
+    COutPoint outpoint;
+    const CTxOut* poutput;
+    CKey scriptKey;
+    CBlindingCacheEntry result;
+};
+
+/**
+ * Unblind chunks of consecutive jobs until there are none left. The jobs are
+ * in block order, so a chunk keeps the outputs of a transaction, and mostly
+ * of its block, together on one core.
+ */
+void UnblindJobsWorker(std::vector<CUnblindJob>* pvJobs, const CKey* pwalletKey, std::atomic<size_t>* pnNext)
+{
+    while (true) {
+        const size_t nStart = pnNext->fetch_add(UNBLIND_JOB_CHUNK);
+        if (nStart >= pvJobs->size())
+            return;
+        const size_t nEnd = std::min(nStart + UNBLIND_JOB_CHUNK, pvJobs->size());
+        for (size_t i = nStart; i < nEnd; i++) {
+            CUnblindJob& job = (*pvJobs)[i];
+            UnblindWithKeys(*job.poutput, job.scriptKey, *pwalletKey, job.result.amount, job.result.pubkey, job.result.blindingfactor);
+        }
+    }
+}
+
+}
+
+void CWallet::PrecomputeBlindingData(const std::vector<const CBlock*>& vBlocks)
+{
+    AssertLockHeld(cs_wallet);
+
+    // The confidential outputs of every transaction AddToWalletIfInvolvingMe
+    // is going to add, which aren't in the cache yet. Transactions that only
+    // become ours by spending an output from this same run of blocks are
+    // missed, and simply unblinded one by one later on. The keys are looked
+    // up here, once per output, so that the workers share nothing but the
+    // job list.
+    std::vector<CUnblindJob> vJobs;
+    BOOST_FOREACH(const CBlock* pblock, vBlocks) {
+        BOOST_FOREACH(const CTransactionRef& ptx, pblock->vtx) {
+            const CTransaction& tx = *ptx;
+            if (!mapWallet.count(tx.GetHash()) && !IsMine(tx) && !IsFromMe(tx))
+                continue;
+            for (unsigned int i = 0; i < tx.vout.size(); i++) {
+                const COutPoint outpoint(tx.GetHash(), i);
+                uint160 fingerprint;
+                if (tx.vout[i].nValue.IsAmount() || FindBlindingCacheEntry(outpoint, tx.vout[i], fingerprint))
+                    continue;
+                vJobs.push_back(CUnblindJob());
+                CUnblindJob& job = vJobs.back();
+                job.outpoint = outpoint;
+                job.poutput = &tx.vout[i];
+                job.scriptKey = GetBlindingKey(&tx.vout[i].scriptPubKey);
+                job.result.keysFingerprint = fingerprint;
+            }
+        }
+    }
+    if (vJobs.empty())
+        return;
+
+    const CKey walletKey = GetBlindingKey(NULL);
+    std::atomic<size_t> nNext(0);
+    const size_t nChunks = (vJobs.size() + UNBLIND_JOB_CHUNK - 1) / UNBLIND_JOB_CHUNK;
+    const size_t nWorkers = std::max(1, std::min(nScriptCheckThreads, (int)nChunks));
+    boost::thread_group workers;
+    for (size_t n = 1; n < nWorkers; n++)
+        workers.create_thread(boost::bind(&UnblindJobsWorker, &vJobs, &walletKey, &nNext));
+    UnblindJobsWorker(&vJobs, &walletKey, &nNext);
+    workers.join_all();
+
+    boost::scoped_ptr<CWalletDB> pwalletdb(fFileBacked ? new CWalletDB(strWalletFile, "r+", false) : NULL);
+    for (size_t i = 0; i < vJobs.size(); i++)
+        StoreBlindingCacheEntry(vJobs[i].outpoint, vJobs[i].result, pwalletdb.get());
+}
+
+void CWallet::ComputeBlindingData(const CTxOut& output, CAmount& amount, CPubKey& pubkey, uint256& blindingfactor) const
+{
+    if (output.nValue.IsAmount()) {
+        amount = output.nValue.GetAmount();
+        pubkey = CPubKey();
+        blindingfactor.SetNull();
+        return;
+    }
+
+    UnblindWithKeys(output, GetBlindingKey(&output.scriptPubKey), GetBlindingKey(NULL), amount, pubkey, blindingfactor);
+}
+
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+    WipeUnknownBlindingData();
+    if (pwallet)
+        pwallet->MarkBalanceDirty(GetHash());
+}
+
 void CWalletTx::WipeUnknownBlindingData() const
 {
     for (unsigned int n = 0; n < vout.size(); n++) {
@@ -8,6 +8,7 @@
 
 #include "amount.h"
 #include "blind.h"
+#include "blockfilter.h"
 #include "streams.h"
 #include "tinyformat.h"
 #include "ui_interface.h"
@@ -28,6 +29,8 @@
 #include <vector>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 
 extern CWallet* pwalletMain;
 
@@ -38,8 +41,12 @@ extern CFeeRate payTxFee;
 extern unsigned int nTxConfirmTarget;
 extern bool bSpendZeroConfChange;
 extern bool fSendFreeTransactions;
+extern int64_t nPegoutInterval;
+extern unsigned int nPegoutBatchSize;
 
 static const unsigned int DEFAULT_KEYPOOL_SIZE = 100;
+//! Keys the keypool thread generates each time it takes cs_wallet
+static const unsigned int KEYPOOL_TOPUP_BATCH = 10;
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 0;
 //! -fallbackfee default
@@ -48,6 +55,12 @@ static const CAmount DEFAULT_FALLBACK_FEE = 20000;
 static const CAmount DEFAULT_TRANSACTION_MINFEE = 1000;
 //! minimum change amount
 static const CAmount MIN_CHANGE = CENT;
+//! Virtual size of a blinded P2PKH change output, most of it its rangeproof (default -ct_bits/-ct_exponent)
+static const unsigned int BLINDED_CHANGE_OUTPUT_VSIZE = 590;
+//! Virtual size of the P2PKH input that later spends a change output
+static const unsigned int CHANGE_SPEND_VSIZE = 148;
+//! Number of steps the branch and bound coin selection may take before giving up
+static const int BNB_MAX_TRIES = 100000;
 //! Default for -spendzeroconfchange
 static const bool DEFAULT_SPEND_ZEROCONF_CHANGE = true;
 //! Default for -sendfreetransactions
@@ -57,6 +70,20 @@ static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 2;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
 static const bool DEFAULT_WALLETBROADCAST = true;
+//! Number of blocks a rescan reads ahead to unblind their outputs in parallel
+static const unsigned int WALLET_RESCAN_BATCH_BLOCKS = 64;
+//! Number of scripts whose blinding keys are kept in memory once derived
+static const unsigned int MAX_BLINDING_KEY_CACHE = 50000;
+//! Number of scripts whose IsMine result is kept in memory
+static const unsigned int MAX_ISMINE_CACHE = 50000;
+//! Number of consecutive outputs a worker unblinds at a time in PrecomputeBlindingData
+static const size_t UNBLIND_JOB_CHUNK = 16;
+//! -pegoutinterval default: seconds a queued peg-out waits for others to be sent with
+static const int64_t DEFAULT_PEGOUT_INTERVAL = 600;
+//! -pegoutbatchsize default: number of queued peg-outs that are sent right away
+static const unsigned int DEFAULT_PEGOUT_BATCH_SIZE = 100;
+//! Seconds between checks whether the queued peg-outs are due
+static const int64_t PEGOUT_CHECK_INTERVAL = 10;
 
 //! if set, all keys will be derived by using BIP32
 static const bool DEFAULT_USE_HD_WALLET = true;
@@ -183,6 +210,8 @@ public:
     CMerkleTx(const CTransaction& txIn) : CTransaction(txIn)
     {
         Init();
+        // Wallet transactions live on long after the block they came in.
+        ReleaseArena();
     }
 
     void Init()
@@ -362,18 +391,8 @@ public:
     }
 
     //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-        WipeUnknownBlindingData();
-    }
+    //! Forget the cached amounts, and have the wallet recount this transaction's balance
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -575,10 +594,14 @@ private:
      * all coins from coinControl are selected; Never select unconfirmed coins
      * if they are not ours
      */
-    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL) const;
+    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL, const CAmount& nCostOfChange = 0) const;
 
     CWalletDB *pwalletdbEncryption;
 
+    //! Handle that key, script and blinding records are written through while a CWalletBatch is open
+    CWalletDB *pwalletdbBatch;
+    friend class CWalletBatch;
+
     //! the current wallet version: clients below this version are not able to load the wallet
     int nWalletVersion;
 
@@ -589,6 +612,16 @@ private:
     int64_t nLastResend;
     bool fBroadcastTransactions;
 
+    /**
+     * Set once ThreadTopUpKeyPool runs. From then on, taking a key out of the
+     * pool only wakes that thread to refill it, and the caller generates a
+     * key only if the pool is empty.
+     */
+    bool fKeyPoolThread;
+    boost::mutex mutexKeyPoolLow;
+    boost::condition_variable condKeyPoolLow;
+    bool fKeyPoolLow;
+
     /**
      * Used to keep track of spent outpoints, and
      * detect and report conflicts (double-spends or
@@ -604,9 +637,92 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Index of wallet outputs that are ours and not spent, with their unblinded
+     * amounts, so that AvailableCoins does not have to walk all of mapWallet.
+     * It is kept up to date as transactions are added, conflicted or abandoned.
+     * It may still hold an output that has since become spent, but never misses
+     * an unspent one. It is rebuilt from scratch on first use after loading and
+     * after anything that can change IsMine or unblinding for existing outputs
+     * (imported keys, scripts and blinding keys, zapped transactions).
+     */
+    struct CUnspentOutput
+    {
+        CAmount nValue;
+        isminetype mine;
+
+        CUnspentOutput(CAmount nValueIn, isminetype mineIn) : nValue(nValueIn), mine(mineIn) {}
+    };
+    typedef std::map<COutPoint, CUnspentOutput> UnspentIndex;
+    mutable UnspentIndex mapUnspent;
+    mutable bool fUnspentStale;
+    void UpdateUnspent(const CWalletTx& wtx, unsigned int n) const;
+    void UpdateUnspent(const CWalletTx& wtx) const;
+    void UpdateUnspentInputs(const CTransaction& tx) const;
+    void RebuildUnspent() const;
+
+    /**
+     * Running balance totals. A transaction at least one block deep (and
+     * mature, for a coinbase) is settled: its available credit is added to
+     * the totals once, and taken out again only when it is marked dirty.
+     * The remaining transactions (unconfirmed, immature, conflicted or
+     * abandoned) are few, and are evaluated on every call.
+     */
+    mutable std::map<uint256, std::pair<CAmount, CAmount> > mapSettledCredit;
+    mutable std::set<uint256> setBalanceDirty;
+    mutable std::set<uint256> setBalancePending;
+    mutable CAmount nSettledCredit;
+    mutable CAmount nSettledWatchCredit;
+    mutable bool fBalanceStale;
+    void UpdateBalances() const;
+
+    /**
+     * Blinding keys (and, once asked for, pubkeys) per script, so that the
+     * HMAC and the EC multiplication are not repeated for every output we
+     * look at. Entries are dropped at random once the cache is full, and all
+     * of them when blinding_derivation_key changes. It has its own lock, as
+     * PrecomputeBlindingData uses it from several threads.
+     */
+    struct CBlindingKeyCacheEntry
+    {
+        uint256 key;
+        bool fValid;
+        bool fHavePubKey;
+        CPubKey pubkey;
+
+        CBlindingKeyCacheEntry() : fValid(false), fHavePubKey(false) {}
+    };
+    mutable CCriticalSection cs_blindingKeyCache;
+    mutable std::map<CScriptID, CBlindingKeyCacheEntry> mapBlindingKeyCache;
+    mutable uint256 blindingKeyCacheDerivationKey;
+    mutable uint64_t nBlindingKeyCacheGeneration;
+    CKey DeriveBlindingKey(const CScript& script, const CScriptID& scriptid) const;
+    CBlindingKeyCacheEntry LookupBlindingKey(const CScript& script, bool fPubKey) const;
+
+    /**
+     * IsMine results per scriptPubKey, so that rescans and balance calls do
+     * not repeat the keystore lookups for every output they look at. The least
+     * recently used entry goes once the cache is full, and all of them
+     * whenever a key, script or watch-only entry is added or removed. It has
+     * its own lock, as IsMine is called both with and without cs_wallet.
+     */
+    typedef std::list<std::pair<CScript, isminetype> > IsMineCacheList;
+    mutable CCriticalSection cs_isMineCache;
+    mutable IsMineCacheList listIsMineCache;
+    mutable std::map<CScript, IsMineCacheList::iterator> mapIsMineCache;
+    mutable uint64_t nIsMineCacheGeneration;
+    void ClearIsMineCache();
+
     /* the HD chain data model (external chain counters) */
     CHDChain hdChain;
 
+    /* Blinding cache lookup and update, see GetCachedBlindingData. */
+    const CBlindingCacheEntry* FindBlindingCacheEntry(const COutPoint& outpoint, const CTxOut& output, uint160& fingerprint) const;
+    void StoreBlindingCacheEntry(const COutPoint& outpoint, const CBlindingCacheEntry& entry, CWalletDB* pwalletdb) const;
+
+    /* Block filter items that would make a block relevant to ScanForWalletTransactions. */
+    std::vector<CBlockFilter::Element> GetBlockFilterQuery() const;
+
 public:
     /*
      * Main wallet lock.
@@ -622,7 +738,11 @@ public:
 
     std::set<int64_t> setKeyPool;
     std::map<CKeyID, CKeyMetadata> mapKeyMetadata;
-    std::map<CScriptID, uint256> mapSpecificBlindingKeys;
+    boost::unordered_map<CScriptID, uint256, SaltedKeyStoreHasher> mapSpecificBlindingKeys;
+    //! Unblinding results for confidential outputs, mirrored in the wallet database
+    mutable std::map<COutPoint, CBlindingCacheEntry> mapBlindingCache;
+    //! Peg-outs by request id, queued or sent, mirrored in the wallet database
+    std::map<uint256, CPegoutRequest> mapPegouts;
 
     typedef std::map<unsigned int, CMasterKey> MasterKeyMap;
     MasterKeyMap mapMasterKeys;
@@ -654,13 +774,22 @@ public:
         fFileBacked = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        pwalletdbBatch = NULL;
+        nBlindingKeyCacheGeneration = 0;
+        nIsMineCacheGeneration = 0;
         nOrderPosNext = 0;
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
+        fKeyPoolThread = false;
+        fKeyPoolLow = false;
         blinding_key = CKey();
         blinding_derivation_key = uint256();
+        fUnspentStale = true;
+        nSettledCredit = 0;
+        nSettledWatchCredit = 0;
+        fBalanceStale = true;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -702,9 +831,11 @@ public:
      * Shuffle and select coins until nTargetValue is reached while avoiding
      * small change; This method is stochastic for some inputs and upon
      * completion the coin set and corresponding actual target value is
-     * assembled
+     * assembled. If nCostOfChange is positive, a branch and bound search first
+     * looks for coins that overshoot nTargetValue by at most nCostOfChange, so
+     * that the transaction can do without a change output.
      */
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CAmount& nCostOfChange = 0) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
 
@@ -722,13 +853,17 @@ public:
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
-    bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
+    bool LoadKey(const CKey& key, const CPubKey &pubkey);
     //! Load metadata (used by LoadWallet)
     bool LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &metadata);
     //! Adds a script-specific blinding key to the wallet, and saves it to disk.
     bool AddSpecificBlindingKey(const CScriptID& scriptid, const uint256& key);
     //! Adds a script-specific blinding key to the wallet without saving it to disk (used by LoadWallet)
     bool LoadSpecificBlindingKey(const CScriptID& scriptid, const uint256& key);
+    //! Adds an unblinding result to the cache without saving it to disk (used by LoadWallet)
+    bool LoadBlindingCacheEntry(const COutPoint& outpoint, const CBlindingCacheEntry& entry);
+    //! Adds a peg-out request without saving it to disk (used by LoadWallet)
+    bool LoadPegout(const uint256& id, const CPegoutRequest& request);
 
     bool LoadMinVersion(int nVersion) { AssertLockHeld(cs_wallet); nWalletVersion = nVersion; nWalletMaxVersion = std::max(nWalletMaxVersion, nVersion); return true; }
 
@@ -769,6 +904,10 @@ public:
     bool GetAccountPubkey(CPubKey &pubKey, std::string strAccount, bool bForceNew = false);
 
     void MarkDirty();
+    //! Have the balance totals recount transaction hash
+    void MarkBalanceDirty(const uint256& hash) const;
+    //! Index a transaction that was deserialized in place into mapWallet
+    void LoadToWallet(CWalletTx& wtx);
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
@@ -798,6 +937,22 @@ public:
                            std::string& strFailReason, const CCoinControl *coinControl = NULL, bool sign = true, std::vector<CAmount> *outAmounts = NULL);
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey);
 
+    /**
+     * Queue a peg-out to the withdraw lock scriptPubKey, to be sent in one
+     * transaction with the other queued ones by SendQueuedPegouts. Returns
+     * the id of the request.
+     */
+    uint256 QueuePegout(const CScript& scriptPubKey, const CAmount& nAmount);
+    /**
+     * Send the queued peg-outs in one transaction, if there are
+     * -pegoutbatchsize of them, the oldest has waited -pegoutinterval seconds
+     * or fForce. If they cannot be sent, they stay queued and strError says
+     * why. Returns the transaction, or null if none was sent.
+     */
+    uint256 SendQueuedPegouts(bool fForce, std::string& strError);
+    //! SendQueuedPegouts for the scheduler, which logs what went wrong
+    void SendDuePegouts();
+
     bool AddAccountingEntry(const CAccountingEntry&, CWalletDB & pwalletdb);
 
     static CFeeRate minTxFee;
@@ -814,7 +969,10 @@ public:
     static CAmount GetRequiredFee(unsigned int nTxBytes);
 
     bool NewKeyPool();
-    bool TopUpKeyPool(unsigned int kpSize = 0);
+    //! Fill the keypool up to kpSize (default: -keypool) keys, adding no more than nMaxNew if it is not 0
+    bool TopUpKeyPool(unsigned int kpSize = 0, unsigned int nMaxNew = 0);
+    //! Run by ThreadTopUpKeyPool: refill the keypool in batches whenever a key is taken from it
+    void KeyPoolThread();
     void ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool);
     void KeepKey(int64_t nIndex);
     void ReturnKey(int64_t nIndex);
@@ -929,6 +1087,12 @@ public:
     CPubKey GetBlindingPubKey(const CScript& script) const;
 
     void ComputeBlindingData(const CTxOut& output, CAmount& amount, CPubKey& pubkey, uint256& blindingfactor) const;
+    //! Like ComputeBlindingData, but remembers the result for outpoint, also on disk
+    void GetCachedBlindingData(const COutPoint& outpoint, const CTxOut& output, CAmount& amount, CPubKey& pubkey, uint256& blindingfactor) const;
+    //! Identifies the set of blinding keys ComputeBlindingData tries for an output to script
+    uint160 GetBlindingKeysFingerprint(const CScript& script) const;
+    //! Fill the blinding cache for the transactions in vBlocks we are going to add, on -par threads
+    void PrecomputeBlindingData(const std::vector<const CBlock*>& vBlocks);
 
     /* Returns the wallets help message */
     static std::string GetWalletHelpString(bool showDebug);
@@ -952,6 +1116,27 @@ public:
     bool SetHDMasterKey(const CPubKey& key);
 };
 
+/**
+ * Groups the wallet's record writes. While a batch is open, key, script, key
+ * pool, blinding and transaction records all go through one database handle,
+ * which is flushed to disk once when the batch closes rather than after every
+ * record. A batch opened while another is open joins it. cs_wallet must be
+ * held for as long as the batch is open.
+ */
+class CWalletBatch
+{
+private:
+    CWallet* pwallet;
+    CWalletDB* pwalletdb;
+
+    CWalletBatch(const CWalletBatch&);
+    void operator=(const CWalletBatch&);
+
+public:
+    explicit CWalletBatch(CWallet* pwalletIn);
+    ~CWalletBatch();
+};
+
 /** A key allocated from the key pool. */
 class CReserveKey : public CReserveScript
 {
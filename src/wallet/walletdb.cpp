@@ -207,6 +207,16 @@ bool CWalletDB::WriteBlindingDerivationKey(const uint256& key)
     return Write(std::string("blindingderivationkey"), key);
 }
 
+bool CWalletDB::WriteBlindingCacheEntry(const COutPoint& outpoint, const CBlindingCacheEntry& entry)
+{
+    return Write(make_pair(std::string("blindingcache"), outpoint), entry);
+}
+
+bool CWalletDB::WritePegout(const uint256& id, const CPegoutRequest& request)
+{
+    return Write(make_pair(std::string("pegout"), id), request);
+}
+
 CAmount CWalletDB::GetAccountCreditDebit(const string& strAccount)
 {
     list<CAccountingEntry> entries;
@@ -381,11 +391,23 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         {
             uint256 hash;
             ssKey >> hash;
-            CWalletTx wtx;
-            ssValue >> wtx;
+            // Read the record straight into its map slot; loading into a
+            // temporary and copying it over would duplicate every rangeproof,
+            // surjection proof and witness the wallet holds.
+            if (pwallet->mapWallet.count(hash))
+                return false;
+            CWalletTx& wtx = pwallet->mapWallet[hash];
             CValidationState state;
-            if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+            try {
+                ssValue >> wtx;
+            } catch (...) {
+                pwallet->mapWallet.erase(hash);
+                throw;
+            }
+            if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid())) {
+                pwallet->mapWallet.erase(hash);
                 return false;
+            }
 
             // Undo serialize changes in 31600
             if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
@@ -394,7 +416,12 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
                 {
                     char fTmp;
                     char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+                    try {
+                        ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+                    } catch (...) {
+                        pwallet->mapWallet.erase(hash);
+                        throw;
+                    }
                     strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
                                        wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
                     wtx.fTimeReceivedIsTxTime = fTmp;
@@ -410,7 +437,7 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             if (wtx.nOrderPos == -1)
                 wss.fAnyUnordered = true;
 
-            pwallet->AddToWallet(wtx, true, NULL);
+            pwallet->LoadToWallet(wtx);
         }
         else if (strType == "acentry")
         {
@@ -649,6 +676,24 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
                 return false;
             }
         }
+        else if (strType == "blindingcache")
+        {
+            COutPoint outpoint;
+            ssKey >> outpoint;
+            CBlindingCacheEntry entry;
+            ssValue >> entry;
+            // Entries written by a newer version are recomputed and replaced.
+            if (entry.nVersion <= CBlindingCacheEntry::CURRENT_VERSION)
+                pwallet->LoadBlindingCacheEntry(outpoint, entry);
+        }
+        else if (strType == "pegout")
+        {
+            uint256 id;
+            ssKey >> id;
+            CPegoutRequest request;
+            ssValue >> request;
+            pwallet->LoadPegout(id, request);
+        }
     } catch (...)
     {
         return false;
@@ -115,6 +115,85 @@ public:
     }
 };
 
+/**
+ * Result of unblinding one confidential wallet output (see
+ * CWallet::ComputeBlindingData). Outputs that could not be unblinded are
+ * remembered too, together with a fingerprint of the blinding keys that
+ * were tried, so that they are only retried once those keys change.
+ */
+class CBlindingCacheEntry
+{
+public:
+    static const int CURRENT_VERSION = 1;
+    int nVersion;
+    uint160 keysFingerprint; //!< see CWallet::GetBlindingKeysFingerprint
+    CAmount amount; //!< -1 if none of the blinding keys could unblind the output
+    CPubKey pubkey;
+    uint256 blindingfactor;
+
+    CBlindingCacheEntry() { SetNull(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(this->nVersion);
+        nVersion = this->nVersion;
+        READWRITE(keysFingerprint);
+        READWRITE(amount);
+        READWRITE(pubkey);
+        READWRITE(blindingfactor);
+    }
+
+    void SetNull()
+    {
+        nVersion = CBlindingCacheEntry::CURRENT_VERSION;
+        keysFingerprint.SetNull();
+        amount = -1;
+        pubkey = CPubKey();
+        blindingfactor.SetNull();
+    }
+
+    bool IsUnblinded() const { return amount != -1; }
+};
+
+/** A peg-out sendtomainchain queued to be sent along with others (see CWallet::QueuePegout) */
+class CPegoutRequest
+{
+public:
+    static const int CURRENT_VERSION = 1;
+    int nVersion;
+    CScript scriptPubKey; //!< the withdraw lock to pay
+    CAmount nAmount;
+    int64_t nTime; //!< when it was queued
+    uint256 txid; //!< the transaction that sent it, null while it is queued
+
+    CPegoutRequest() { SetNull(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(this->nVersion);
+        nVersion = this->nVersion;
+        READWRITE(*(CScriptBase*)(&scriptPubKey));
+        READWRITE(nAmount);
+        READWRITE(nTime);
+        READWRITE(txid);
+    }
+
+    void SetNull()
+    {
+        nVersion = CPegoutRequest::CURRENT_VERSION;
+        scriptPubKey.clear();
+        nAmount = 0;
+        nTime = 0;
+        txid.SetNull();
+    }
+
+    bool IsQueued() const { return txid.IsNull(); }
+};
+
 /** Access to the wallet database */
 class CWalletDB : public CDB
 {
@@ -170,6 +249,8 @@ public:
 
     bool WriteSpecificBlindingKey(const CScriptID& scriptid, const uint256& key);
     bool WriteBlindingDerivationKey(const uint256& key);
+    bool WriteBlindingCacheEntry(const COutPoint& outpoint, const CBlindingCacheEntry& entry);
+    bool WritePegout(const uint256& id, const CPegoutRequest& request);
 
     DBErrors ReorderTransactions(CWallet* pwallet);
     DBErrors LoadWallet(CWallet* pwallet);
@@ -9,6 +9,7 @@
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
+struct CMempoolDelta;
 
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
 
@@ -34,6 +35,7 @@ public:
 
     virtual bool NotifyBlock(const CBlockIndex *pindex);
     virtual bool NotifyTransaction(const CTransaction &transaction);
+    virtual bool NotifyMempoolDelta(const CMempoolDelta &delta);
 
 protected:
     void *psocket;
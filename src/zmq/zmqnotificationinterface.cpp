@@ -8,8 +8,11 @@
 #include "version.h"
 #include "main.h"
 #include "streams.h"
+#include "txmempool.h"
 #include "util.h"
 
+#include <boost/bind.hpp>
+
 void zmqError(const char *str)
 {
     LogPrint("zmq", "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
@@ -37,8 +40,11 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
 
     factories["pubhashblock"] = CZMQAbstractNotifier::Create<CZMQPublishHashBlockNotifier>;
     factories["pubhashtx"] = CZMQAbstractNotifier::Create<CZMQPublishHashTransactionNotifier>;
+    factories["pubmempooldelta"] = CZMQAbstractNotifier::Create<CZMQPublishMempoolDeltaNotifier>;
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
+    factories["pubunblindedoutput"] = CZMQAbstractNotifier::Create<CZMQPublishUnblindedOutputNotifier>;
+    factories["pubverifiedtx"] = CZMQAbstractNotifier::Create<CZMQPublishVerifiedTransactionNotifier>;
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i)
     {
@@ -103,6 +109,8 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
+    mempool.NotifyDelta.connect(boost::bind(&CZMQNotificationInterface::MempoolDelta, this, _1));
+
     return true;
 }
 
@@ -112,6 +120,7 @@ void CZMQNotificationInterface::Shutdown()
     LogPrint("zmq", "zmq: Shutdown notification interface\n");
     if (pcontext)
     {
+        mempool.NotifyDelta.disconnect(boost::bind(&CZMQNotificationInterface::MempoolDelta, this, _1));
         for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
         {
             CZMQAbstractNotifier *notifier = *i;
@@ -157,3 +166,20 @@ void CZMQNotificationInterface::SyncTransaction(const CTransaction& tx, const CB
         }
     }
 }
+
+void CZMQNotificationInterface::MempoolDelta(const CMempoolDelta& delta)
+{
+    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    {
+        CZMQAbstractNotifier *notifier = *i;
+        if (notifier->NotifyMempoolDelta(delta))
+        {
+            i++;
+        }
+        else
+        {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
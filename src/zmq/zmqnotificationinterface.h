@@ -11,6 +11,7 @@
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
+struct CMempoolDelta;
 
 class CZMQNotificationInterface : public CValidationInterface
 {
@@ -27,6 +28,9 @@ protected:
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, const CBlock* pblock);
     void UpdatedBlockTip(const CBlockIndex *pindex);
 
+    // CTxMemPool::NotifyDelta
+    void MempoolDelta(const CMempoolDelta& delta);
+
 private:
     CZMQNotificationInterface();
 
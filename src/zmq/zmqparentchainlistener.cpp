@@ -0,0 +1,125 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zmqparentchainlistener.h"
+#include "zmqconfig.h"
+
+#include "callrpc.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+static const char *MSG_HASHBLOCK = "hashblock";
+
+//! How long a receive may block before checking for shutdown, in milliseconds
+static const int ZMQ_PARENT_RECV_TIMEOUT = 1000;
+
+CZMQParentChainListener::CZMQParentChainListener(const std::string& addressIn, const uint256& genesishashIn) :
+    address(addressIn), genesishash(genesishashIn), pcontext(NULL), psocket(NULL)
+{
+}
+
+CZMQParentChainListener::~CZMQParentChainListener()
+{
+    Shutdown();
+}
+
+CZMQParentChainListener* CZMQParentChainListener::Create(const std::string& address, const uint256& genesishash)
+{
+    CZMQParentChainListener* listener = new CZMQParentChainListener(address, genesishash);
+    if (!listener->Initialize()) {
+        delete listener;
+        return NULL;
+    }
+    return listener;
+}
+
+bool CZMQParentChainListener::Initialize()
+{
+    LogPrint("zmq", "zmq: Subscribing to parent chain hashblock at %s\n", address);
+    assert(!pcontext);
+
+    pcontext = zmq_init(1);
+    if (!pcontext)
+    {
+        zmqError("Unable to initialize context");
+        return false;
+    }
+
+    psocket = zmq_socket(pcontext, ZMQ_SUB);
+    if (!psocket)
+    {
+        zmqError("Failed to create socket");
+        return false;
+    }
+
+    int timeout = ZMQ_PARENT_RECV_TIMEOUT;
+    if (zmq_setsockopt(psocket, ZMQ_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+        zmq_setsockopt(psocket, ZMQ_SUBSCRIBE, MSG_HASHBLOCK, strlen(MSG_HASHBLOCK)) != 0)
+    {
+        zmqError("Failed to set socket options");
+        return false;
+    }
+
+    if (zmq_connect(psocket, address.c_str()) != 0)
+    {
+        zmqError("Failed to connect address");
+        return false;
+    }
+
+    return true;
+}
+
+void CZMQParentChainListener::Shutdown()
+{
+    if (psocket)
+    {
+        int linger = 0;
+        zmq_setsockopt(psocket, ZMQ_LINGER, &linger, sizeof(linger));
+        zmq_close(psocket);
+        psocket = NULL;
+    }
+    if (pcontext)
+    {
+        zmq_ctx_destroy(pcontext);
+        pcontext = NULL;
+    }
+}
+
+void CZMQParentChainListener::Thread()
+{
+    // Start from the current parent tip rather than waiting for the next block
+    UpdateParentChainWindow(genesishash);
+
+    while (true)
+    {
+        boost::this_thread::interruption_point();
+
+        // A notification is topic, block hash and sequence number; only the
+        // arrival matters, as the window is re-read from bitcoind anyway.
+        bool fReceived = false;
+        int more = 1;
+        while (more)
+        {
+            zmq_msg_t msg;
+            zmq_msg_init(&msg);
+            int rc = zmq_msg_recv(&msg, psocket, 0);
+            zmq_msg_close(&msg);
+            if (rc == -1)
+            {
+                if (errno != EAGAIN)
+                    zmqError("Unable to receive ZMQ msg");
+                break;
+            }
+            fReceived = true;
+            size_t moresize = sizeof(more);
+            zmq_getsockopt(psocket, ZMQ_RCVMORE, &more, &moresize);
+        }
+
+        if (fReceived && !UpdateParentChainWindow(genesishash))
+            LogPrintf("Failed to refresh parent chain window after parent tip notification\n");
+        if (fReceived)
+            WakeParentHeaderSync();
+    }
+}
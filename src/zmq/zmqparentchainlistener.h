@@ -0,0 +1,38 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ZMQ_ZMQPARENTCHAINLISTENER_H
+#define BITCOIN_ZMQ_ZMQPARENTCHAINLISTENER_H
+
+#include "uint256.h"
+
+#include <string>
+
+/**
+ * Subscribes to the hashblock feed of the parent chain daemon and refreshes
+ * the parent chain window (see UpdateParentChainWindow) on every new tip.
+ */
+class CZMQParentChainListener
+{
+public:
+    ~CZMQParentChainListener();
+
+    static CZMQParentChainListener* Create(const std::string& address, const uint256& genesishash);
+
+    /** Receive loop, run on its own thread until interrupted */
+    void Thread();
+
+private:
+    CZMQParentChainListener(const std::string& address, const uint256& genesishash);
+
+    bool Initialize();
+    void Shutdown();
+
+    std::string address;
+    uint256 genesishash;
+    void *pcontext;
+    void *psocket;
+};
+
+#endif // BITCOIN_ZMQ_ZMQPARENTCHAINLISTENER_H
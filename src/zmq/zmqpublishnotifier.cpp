@@ -4,15 +4,29 @@
 
 #include "chainparams.h"
 #include "zmqpublishnotifier.h"
+#include "zmqverifiedtxlistener.h"
+#include "blind.h"
 #include "main.h"
+#include "txmempool.h"
 #include "util.h"
+#include "utilstrencodings.h"
+
+#include <boost/bind.hpp>
 
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
+static CZMQPublishQueue publishQueue;
+
+std::atomic<uint64_t> CZMQPublishQueue::nTotalQueued(0);
+std::atomic<uint64_t> CZMQPublishQueue::nTotalDropped(0);
+std::atomic<uint64_t> CZMQPublishQueue::nTotalSent(0);
 
 static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
+static const char *MSG_MEMPOOLDELTA = "mempooldelta";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_UNBLINDEDOUTPUT = "unblindedoutput";
+static const char *MSG_VERIFIEDTX = "verifiedtx";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -54,6 +68,101 @@ static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
     return 0;
 }
 
+void CZMQPublishQueue::Start()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    if (thread.joinable())
+        return;
+    fStop = false;
+    thread = boost::thread(boost::bind(&TraceThread<boost::function<void()> >, "zmqpub",
+        boost::function<void()>(boost::bind(&CZMQPublishQueue::Thread, this))));
+}
+
+void CZMQPublishQueue::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!thread.joinable())
+            return;
+        fStop = true;
+        nTotalQueued -= queue.size();
+        nTotalDropped += queue.size();
+        queue.clear();
+    }
+    cond.notify_all();
+    thread.join();
+}
+
+bool CZMQPublishQueue::Push(Message& msg)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fStop || !thread.joinable() || queue.size() >= MAX_ZMQ_PUBLISH_QUEUE_SIZE) {
+            nTotalDropped++;
+            return false;
+        }
+        queue.push_back(std::move(msg));
+        nTotalQueued++;
+    }
+    cond.notify_one();
+    return true;
+}
+
+bool CZMQPublishQueue::Push(CZMQAbstractPublishNotifier* notifier, const char* command, const void* data, size_t size)
+{
+    Message msg;
+    msg.notifier = notifier;
+    msg.command = command;
+    msg.data.assign((const char*)data, (const char*)data + size);
+    return Push(msg);
+}
+
+bool CZMQPublishQueue::Push(CZMQAbstractPublishNotifier* notifier, const char* command, std::vector<char>& data)
+{
+    Message msg;
+    msg.notifier = notifier;
+    msg.command = command;
+    msg.data.swap(data);
+    return Push(msg);
+}
+
+bool CZMQPublishQueue::Push(CZMQAbstractPublishNotifier* notifier, const char* command, const DataSource& source)
+{
+    Message msg;
+    msg.notifier = notifier;
+    msg.command = command;
+    msg.source = source;
+    return Push(msg);
+}
+
+void CZMQPublishQueue::Thread()
+{
+    while (true) {
+        Message msg;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (!fStop && queue.empty())
+                cond.wait(lock);
+            if (fStop)
+                return;
+            msg = std::move(queue.front());
+            queue.pop_front();
+            nTotalQueued--;
+        }
+        if (!msg.notifier->SendQueuedMessage(msg.command, msg.data, msg.source))
+            nTotalDropped++;
+        else if (!msg.data.empty())
+            nTotalSent++;
+    }
+}
+
+void CZMQPublishQueue::GetStats(uint64_t& nQueued, uint64_t& nDropped, uint64_t& nSent)
+{
+    nQueued = nTotalQueued;
+    nDropped = nTotalDropped;
+    nSent = nTotalSent;
+}
+
 bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
 {
     assert(!psocket);
@@ -80,6 +189,7 @@ bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
 
         // register this notifier for the address, so it can be reused for other publish notifier
         mapPublishNotifiers.insert(std::make_pair(address, this));
+        publishQueue.Start();
         return true;
     }
     else
@@ -88,6 +198,7 @@ bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
 
         psocket = i->second->psocket;
         mapPublishNotifiers.insert(std::make_pair(address, this));
+        publishQueue.Start();
 
         return true;
     }
@@ -97,6 +208,9 @@ void CZMQAbstractPublishNotifier::Shutdown()
 {
     assert(psocket);
 
+    // Nothing may be sent on the sockets from here on.
+    publishQueue.Stop();
+
     int count = mapPublishNotifiers.count(address);
 
     // remove this notifier from the list of publishers using this address
@@ -140,6 +254,45 @@ bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* d
     return true;
 }
 
+bool CZMQAbstractPublishNotifier::QueueMessage(const char *command, const void* data, size_t size)
+{
+    if (fFailed)
+        return false;
+    return publishQueue.Push(this, command, data, size);
+}
+
+bool CZMQAbstractPublishNotifier::QueueMessage(const char *command, std::vector<char>& data)
+{
+    if (fFailed)
+        return false;
+    return publishQueue.Push(this, command, data);
+}
+
+bool CZMQAbstractPublishNotifier::QueueMessage(const char *command, const CZMQPublishQueue::DataSource& source)
+{
+    if (fFailed)
+        return false;
+    return publishQueue.Push(this, command, source);
+}
+
+bool CZMQAbstractPublishNotifier::SendQueuedMessage(const char *command, std::vector<char>& data, const CZMQPublishQueue::DataSource& source)
+{
+    if (fFailed)
+        return false;
+    if (source && !source(data))
+        return false;
+    if (data.empty())
+        return true; // nothing to publish
+    if (!SendMessage(command, begin_ptr(data), data.size())) {
+        // Stop publishing rather than unregistering, as messages of this
+        // notifier may still be queued.
+        LogPrint("zmq", "zmq: Stop publishing %s to %s\n", command, address);
+        fFailed = true;
+        return false;
+    }
+    return true;
+}
+
 bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     uint256 hash = pindex->GetBlockHash();
@@ -147,7 +300,8 @@ bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
     char data[32];
     for (unsigned int i = 0; i < 32; i++)
         data[31 - i] = hash.begin()[i];
-    return SendMessage(MSG_HASHBLOCK, data, 32);
+    QueueMessage(MSG_HASHBLOCK, data, 32);
+    return true;
 }
 
 bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
@@ -157,35 +311,153 @@ bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &t
     char data[32];
     for (unsigned int i = 0; i < 32; i++)
         data[31 - i] = hash.begin()[i];
-    return SendMessage(MSG_HASHTX, data, 32);
+    QueueMessage(MSG_HASHTX, data, 32);
+    return true;
+}
+
+bool CZMQPublishMempoolDeltaNotifier::NotifyMempoolDelta(const CMempoolDelta &delta)
+{
+    LogPrint("zmq", "zmq: Publish mempooldelta %s %s\n", delta.fAdded ? "added" : "removed", delta.txid.GetHex());
+    std::vector<char> data(32);
+    for (unsigned int i = 0; i < 32; i++)
+        data[31 - i] = delta.txid.begin()[i];
+    CVectorWriter<std::vector<char> >(data, SER_NETWORK, PROTOCOL_VERSION) << (char)(delta.fAdded ? 'A' : 'R') << delta.nSequence << delta.nFee << (uint32_t)delta.nSize;
+    QueueMessage(MSG_MEMPOOLDELTA, data);
+    return true;
+}
+
+static bool ReadRawBlock(const CDiskBlockPos& pos, const uint256& hash, std::vector<char>& vData)
+{
+    if (!ReadRawBlockFromDisk(vData, pos, hash, true)) {
+        zmqError("Can't read block from disk");
+        return false;
+    }
+    return true;
 }
 
 bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
-    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    // The stored bytes are the block as serialized on the network, so the
+    // publish thread sends them as they are once it gets to the block.
+    CDiskBlockPos pos;
     {
         LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
-        {
-            zmqError("Can't read block from disk");
+        pos = pindex->GetBlockPos();
+    }
+    QueueMessage(MSG_RAWBLOCK, boost::bind(ReadRawBlock, pos, pindex->GetBlockHash(), _1));
+    return true;
+}
+
+bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
+{
+    uint256 hash = transaction.GetHash();
+    LogPrint("zmq", "zmq: Publish rawtx %s\n", hash.GetHex());
+    std::vector<char> data;
+    data.reserve(transaction.GetTotalSize());
+    CVectorWriter<std::vector<char> >(data, SER_NETWORK, PROTOCOL_VERSION) << transaction;
+    QueueMessage(MSG_RAWTX, data);
+    return true;
+}
+
+bool CZMQPublishUnblindedOutputNotifier::Initialize(void *pcontext)
+{
+    vBlindingKeys.clear();
+    vBlindingPubKeys.clear();
+    BOOST_FOREACH(const std::string& strKey, mapMultiArgs["-zmqblindingkey"]) {
+        std::vector<unsigned char> keydata = ParseHex(strKey);
+        CKey key;
+        if (keydata.size() == 32)
+            key.Set(keydata.begin(), keydata.end(), true);
+        if (!key.IsValid()) {
+            LogPrintf("zmq: Invalid -zmqblindingkey %s\n", strKey);
             return false;
         }
+        vBlindingKeys.push_back(key);
+        vBlindingPubKeys.push_back(key.GetPubKey());
+    }
+    if (vBlindingKeys.empty()) {
+        LogPrintf("zmq: -zmqpub%s needs at least one -zmqblindingkey\n", MSG_UNBLINDEDOUTPUT);
+        return false;
+    }
+    return CZMQAbstractPublishNotifier::Initialize(pcontext);
+}
 
-        ss << block;
+/**
+ * The data is the txid (32 bytes, reversed like hashtx), followed for each
+ * output that unblinds by its index (4 bytes), amount (8 bytes), blinding
+ * factor (32 bytes) and the blinding pubkey it unblinds with (33 bytes).
+ */
+bool CZMQPublishUnblindedOutputNotifier::UnblindTransaction(const CTransaction &transaction, std::vector<char>& data) const
+{
+    for (unsigned int n = 0; n < transaction.vout.size(); n++) {
+        const CTxOut& txout = transaction.vout[n];
+        if (txout.nValue.IsAmount())
+            continue;
+        for (unsigned int k = 0; k < vBlindingKeys.size(); k++) {
+            CAmount amount;
+            uint256 blindingfactor;
+            if (!UnblindOutput(vBlindingKeys[k], txout, amount, blindingfactor))
+                continue;
+            if (data.empty()) {
+                uint256 hash = transaction.GetHash();
+                for (unsigned int i = 0; i < 32; i++)
+                    data.push_back(hash.begin()[31 - i]);
+            }
+            unsigned char buf[12];
+            WriteLE32(&buf[0], n);
+            WriteLE64(&buf[4], amount);
+            data.insert(data.end(), (const char*)buf, (const char*)buf + sizeof(buf));
+            data.insert(data.end(), (const char*)blindingfactor.begin(), (const char*)blindingfactor.end());
+            data.insert(data.end(), (const char*)vBlindingPubKeys[k].begin(), (const char*)vBlindingPubKeys[k].end());
+            break;
+        }
     }
+    return true;
+}
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+bool CZMQPublishUnblindedOutputNotifier::NotifyTransaction(const CTransaction &transaction)
+{
+    LogPrint("zmq", "zmq: Queue %s for %s\n", MSG_UNBLINDEDOUTPUT, transaction.GetHash().GetHex());
+    QueueMessage(MSG_UNBLINDEDOUTPUT, boost::bind(&CZMQPublishUnblindedOutputNotifier::UnblindTransaction, this, transaction, _1));
+    return true;
 }
 
-bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
+bool CZMQPublishVerifiedTransactionNotifier::Initialize(void *pcontext)
 {
-    uint256 hash = transaction.GetHash();
-    LogPrint("zmq", "zmq: Publish rawtx %s\n", hash.GetHex());
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << transaction;
-    return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
+    std::vector<unsigned char> keydata = ParseHex(GetArg("-zmqverifiedtxkey", ""));
+    key = CKey();
+    if (keydata.size() == 32)
+        key.Set(keydata.begin(), keydata.end(), true);
+    if (!key.IsValid()) {
+        LogPrintf("zmq: -zmqpub%s needs a valid -zmqverifiedtxkey\n", MSG_VERIFIEDTX);
+        return false;
+    }
+    return CZMQAbstractPublishNotifier::Initialize(pcontext);
+}
+
+/**
+ * The data is the witness hash (32 bytes, reversed like hashtx) followed by
+ * a compact signature (65 bytes) of GetVerifiedTxSignatureHash.
+ */
+bool CZMQPublishVerifiedTransactionNotifier::SignTransaction(const uint256& wtxid, std::vector<char>& data) const
+{
+    std::vector<unsigned char> vchSig;
+    if (!key.SignCompact(GetVerifiedTxSignatureHash(wtxid), vchSig))
+        return false;
+    data.resize(32);
+    for (unsigned int i = 0; i < 32; i++)
+        data[31 - i] = wtxid.begin()[i];
+    data.insert(data.end(), vchSig.begin(), vchSig.end());
+    return true;
+}
+
+bool CZMQPublishVerifiedTransactionNotifier::NotifyMempoolDelta(const CMempoolDelta &delta)
+{
+    if (!delta.fAdded)
+        return true;
+    LogPrint("zmq", "zmq: Queue %s for %s\n", MSG_VERIFIEDTX, delta.wtxid.GetHex());
+    QueueMessage(MSG_VERIFIEDTX, boost::bind(&CZMQPublishVerifiedTransactionNotifier::SignTransaction, this, delta.wtxid, _1));
+    return true;
 }
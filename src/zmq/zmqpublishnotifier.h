@@ -6,15 +6,87 @@
 #define BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
 
 #include "zmqabstractnotifier.h"
+#include "key.h"
+#include "pubkey.h"
+#include "sync.h"
+
+#include <atomic>
+#include <deque>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
 
 class CBlockIndex;
+class CZMQAbstractPublishNotifier;
+
+/** Maximum number of messages waiting to be published */
+static const size_t MAX_ZMQ_PUBLISH_QUEUE_SIZE = 1000;
+
+/**
+ * Publishes messages on a thread of its own, so that validation does not
+ * wait for the sockets, for slow subscribers or for blocks to be read back
+ * from disk. Messages that do not fit in the queue are dropped. All sending
+ * happens on that thread, which also keeps each socket on a single thread.
+ */
+class CZMQPublishQueue
+{
+public:
+    /**
+     * Produces the data of a message once it is its turn to be sent. Returns
+     * false if it failed, and leaves the data empty if there is nothing to
+     * publish.
+     */
+    typedef boost::function<bool(std::vector<char>&)> DataSource;
+
+private:
+    struct Message
+    {
+        CZMQAbstractPublishNotifier* notifier;
+        const char* command;
+        std::vector<char> data;
+        DataSource source;
+    };
+
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    std::deque<Message> queue;
+    bool fStop;
+    boost::thread thread;
+
+    static std::atomic<uint64_t> nTotalQueued;
+    static std::atomic<uint64_t> nTotalDropped;
+    static std::atomic<uint64_t> nTotalSent;
+
+    bool Push(Message& msg);
+    void Thread();
+
+public:
+    CZMQPublishQueue() : fStop(false) {}
+
+    //! Start the thread, unless it is running
+    void Start();
+    //! Stop the thread, unless it is stopped; messages not sent by then are dropped
+    void Stop();
+
+    bool Push(CZMQAbstractPublishNotifier* notifier, const char* command, const void* data, size_t size);
+    //! Queue data without copying it; data is left empty
+    bool Push(CZMQAbstractPublishNotifier* notifier, const char* command, std::vector<char>& data);
+    bool Push(CZMQAbstractPublishNotifier* notifier, const char* command, const DataSource& source);
+
+    //! Messages queued now, and totals of messages dropped and sent
+    static void GetStats(uint64_t& nQueued, uint64_t& nDropped, uint64_t& nSent);
+};
 
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
     uint32_t nSequence; //!< upcounting per message sequence number
+    //! Set once a message failed to send; nothing more is published then
+    std::atomic<bool> fFailed;
 
 public:
+    CZMQAbstractPublishNotifier() : nSequence(0), fFailed(false) {}
 
     /* send zmq multipart message
        parts:
@@ -24,6 +96,14 @@ public:
     */
     bool SendMessage(const char *command, const void* data, size_t size);
 
+    /* queue a message to be sent by SendMessage on the publish thread */
+    bool QueueMessage(const char *command, const void* data, size_t size);
+    bool QueueMessage(const char *command, std::vector<char>& data);
+    bool QueueMessage(const char *command, const CZMQPublishQueue::DataSource& source);
+
+    /* send a queued message, on the publish thread */
+    bool SendQueuedMessage(const char *command, std::vector<char>& data, const CZMQPublishQueue::DataSource& source);
+
     bool Initialize(void *pcontext);
     void Shutdown();
 };
@@ -40,6 +120,17 @@ public:
     bool NotifyTransaction(const CTransaction &transaction);
 };
 
+/**
+ * Publishes each transaction added to or removed from the mempool, with the
+ * sequence getmempooldeltas reports the change under, so that subscribers
+ * notice missed messages and catch up with that RPC.
+ */
+class CZMQPublishMempoolDeltaNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyMempoolDelta(const CMempoolDelta &delta);
+};
+
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
@@ -52,4 +143,40 @@ public:
     bool NotifyTransaction(const CTransaction &transaction);
 };
 
+/**
+ * Publishes the outputs of transactions that unblind with one of the keys
+ * given by -zmqblindingkey, with their amounts and blinding factors. The
+ * outputs are unblinded on the publish thread.
+ */
+class CZMQPublishUnblindedOutputNotifier : public CZMQAbstractPublishNotifier
+{
+private:
+    std::vector<CKey> vBlindingKeys;
+    std::vector<CPubKey> vBlindingPubKeys;
+
+    bool UnblindTransaction(const CTransaction &transaction, std::vector<char>& data) const;
+
+public:
+    bool Initialize(void *pcontext);
+    bool NotifyTransaction(const CTransaction &transaction);
+};
+
+/**
+ * Publishes the witness hash of each transaction accepted to the mempool,
+ * signed with -zmqverifiedtxkey, for other nodes of the same operator to skip
+ * verifying its range proofs (see CZMQVerifiedTxListener). Signing happens on
+ * the publish thread.
+ */
+class CZMQPublishVerifiedTransactionNotifier : public CZMQAbstractPublishNotifier
+{
+private:
+    CKey key;
+
+    bool SignTransaction(const uint256& wtxid, std::vector<char>& data) const;
+
+public:
+    bool Initialize(void *pcontext);
+    bool NotifyMempoolDelta(const CMempoolDelta &delta);
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
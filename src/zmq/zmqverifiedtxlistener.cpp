@@ -0,0 +1,159 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zmqverifiedtxlistener.h"
+#include "zmqconfig.h"
+
+#include "chainparams.h"
+#include "hash.h"
+#include "script/sigcache.h"
+#include "util.h"
+
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+static const char *MSG_VERIFIEDTX = "verifiedtx";
+
+//! How long a receive may block before checking for shutdown, in milliseconds
+static const int ZMQ_VERIFIEDTX_RECV_TIMEOUT = 1000;
+
+uint256 GetVerifiedTxSignatureHash(const uint256& wtxid)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << std::string(MSG_VERIFIEDTX) << Params().GenesisBlock().GetHash() << wtxid;
+    return ss.GetHash();
+}
+
+CZMQVerifiedTxListener::CZMQVerifiedTxListener(const std::vector<std::string>& addressesIn, const std::vector<CPubKey>& signersIn) :
+    addresses(addressesIn), signers(signersIn), pcontext(NULL), psocket(NULL)
+{
+}
+
+CZMQVerifiedTxListener::~CZMQVerifiedTxListener()
+{
+    Shutdown();
+}
+
+CZMQVerifiedTxListener* CZMQVerifiedTxListener::Create(const std::vector<std::string>& addresses, const std::vector<CPubKey>& signers)
+{
+    CZMQVerifiedTxListener* listener = new CZMQVerifiedTxListener(addresses, signers);
+    if (!listener->Initialize()) {
+        delete listener;
+        return NULL;
+    }
+    return listener;
+}
+
+bool CZMQVerifiedTxListener::Initialize()
+{
+    assert(!pcontext);
+
+    pcontext = zmq_init(1);
+    if (!pcontext)
+    {
+        zmqError("Unable to initialize context");
+        return false;
+    }
+
+    psocket = zmq_socket(pcontext, ZMQ_SUB);
+    if (!psocket)
+    {
+        zmqError("Failed to create socket");
+        return false;
+    }
+
+    int timeout = ZMQ_VERIFIEDTX_RECV_TIMEOUT;
+    if (zmq_setsockopt(psocket, ZMQ_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+        zmq_setsockopt(psocket, ZMQ_SUBSCRIBE, MSG_VERIFIEDTX, strlen(MSG_VERIFIEDTX)) != 0)
+    {
+        zmqError("Failed to set socket options");
+        return false;
+    }
+
+    BOOST_FOREACH(const std::string& address, addresses)
+    {
+        LogPrint("zmq", "zmq: Subscribing to verifiedtx at %s\n", address);
+        if (zmq_connect(psocket, address.c_str()) != 0)
+        {
+            zmqError("Failed to connect address");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void CZMQVerifiedTxListener::Shutdown()
+{
+    if (psocket)
+    {
+        int linger = 0;
+        zmq_setsockopt(psocket, ZMQ_LINGER, &linger, sizeof(linger));
+        zmq_close(psocket);
+        psocket = NULL;
+    }
+    if (pcontext)
+    {
+        zmq_ctx_destroy(pcontext);
+        pcontext = NULL;
+    }
+}
+
+/**
+ * The data is the witness hash (32 bytes, reversed like hashtx) followed by
+ * a compact signature (65 bytes) of GetVerifiedTxSignatureHash by the
+ * publishing node's -zmqverifiedtxkey.
+ */
+bool CZMQVerifiedTxListener::ProcessNotification(const std::vector<unsigned char>& data) const
+{
+    if (data.size() != 32 + 65)
+        return false;
+    uint256 wtxid;
+    std::reverse_copy(data.begin(), data.begin() + 32, wtxid.begin());
+    std::vector<unsigned char> vchSig(data.begin() + 32, data.end());
+    CPubKey pubkey;
+    if (!pubkey.RecoverCompact(GetVerifiedTxSignatureHash(wtxid), vchSig))
+        return false;
+    if (std::find(signers.begin(), signers.end(), pubkey) == signers.end())
+        return false;
+    AddFleetVerifiedTransaction(wtxid);
+    return true;
+}
+
+void CZMQVerifiedTxListener::Thread()
+{
+    while (true)
+    {
+        boost::this_thread::interruption_point();
+
+        // A notification is topic, data and sequence number.
+        std::vector<std::vector<unsigned char> > vParts;
+        int more = 1;
+        while (more)
+        {
+            zmq_msg_t msg;
+            zmq_msg_init(&msg);
+            int rc = zmq_msg_recv(&msg, psocket, 0);
+            if (rc == -1)
+            {
+                zmq_msg_close(&msg);
+                if (errno != EAGAIN)
+                    zmqError("Unable to receive ZMQ msg");
+                break;
+            }
+            const unsigned char* pdata = (const unsigned char*)zmq_msg_data(&msg);
+            vParts.push_back(std::vector<unsigned char>(pdata, pdata + zmq_msg_size(&msg)));
+            zmq_msg_close(&msg);
+            size_t moresize = sizeof(more);
+            zmq_getsockopt(psocket, ZMQ_RCVMORE, &more, &moresize);
+        }
+
+        if (vParts.size() < 2)
+            continue;
+        if (!ProcessNotification(vParts[1]))
+            LogPrint("zmq", "zmq: Ignoring %s notification that is not from a trusted signer\n", MSG_VERIFIEDTX);
+    }
+}
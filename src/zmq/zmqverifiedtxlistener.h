@@ -0,0 +1,50 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ZMQ_ZMQVERIFIEDTXLISTENER_H
+#define BITCOIN_ZMQ_ZMQVERIFIEDTXLISTENER_H
+
+#include "pubkey.h"
+#include "uint256.h"
+
+#include <string>
+#include <vector>
+
+/** Default for -zmqverifiedtxinblocks */
+static const bool DEFAULT_ZMQ_VERIFIEDTX_IN_BLOCKS = false;
+
+/** The hash a verifiedtx notification signs: the witness hash, bound to the chain */
+uint256 GetVerifiedTxSignatureHash(const uint256& wtxid);
+
+/**
+ * Subscribes to the verifiedtx feeds of other nodes of the same operator
+ * (-zmqsubverifiedtx), and marks the range proofs of each transaction one of
+ * the trusted signers (-zmqverifiedtxsigner) vouches for as verified, see
+ * AddFleetVerifiedTransaction.
+ */
+class CZMQVerifiedTxListener
+{
+public:
+    ~CZMQVerifiedTxListener();
+
+    static CZMQVerifiedTxListener* Create(const std::vector<std::string>& addresses, const std::vector<CPubKey>& signers);
+
+    /** Receive loop, run on its own thread until interrupted */
+    void Thread();
+
+private:
+    CZMQVerifiedTxListener(const std::vector<std::string>& addresses, const std::vector<CPubKey>& signers);
+
+    bool Initialize();
+    void Shutdown();
+    //! Handle the data part of a notification; false if it is not from a trusted signer
+    bool ProcessNotification(const std::vector<unsigned char>& data) const;
+
+    std::vector<std::string> addresses;
+    std::vector<CPubKey> signers;
+    void *pcontext;
+    void *psocket;
+};
+
+#endif // BITCOIN_ZMQ_ZMQVERIFIEDTXLISTENER_H